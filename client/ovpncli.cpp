@@ -22,10 +22,16 @@
 // Implementation file for OpenVPNClient API defined in ovpncli.hpp.
 
 #include <iostream>
+#include <fstream>
 #include <string>
 #include <memory>
 #include <utility>
 #include <atomic>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <algorithm>
 
 #include <asio.hpp>
 
@@ -69,9 +75,6 @@
 // force null tun device (useful for testing)
 //#define OPENVPN_FORCE_TUN_NULL
 
-// log cleartext tunnel packets to file for debugging/analysis
-//#define OPENVPN_PACKET_LOG "pkt.log"
-
 #ifndef OPENVPN_LOG
 // log thread settings
 #define OPENVPN_LOG_CLASS openvpn::ClientAPI::LogReceiver
@@ -92,13 +95,21 @@
 #include <openvpn/common/size.hpp>
 #include <openvpn/common/platform_string.hpp>
 #include <openvpn/common/count.hpp>
+#include <openvpn/common/spscring.hpp>
 #include <openvpn/common/asiostop.hpp>
+#include <openvpn/common/busypoll.hpp>
 #include <openvpn/client/cliconnect.hpp>
 #include <openvpn/client/cliopthelper.hpp>
+#include <openvpn/client/cliconfcache.hpp>
 #include <openvpn/options/merge.hpp>
 #include <openvpn/error/excode.hpp>
 #include <openvpn/crypto/selftest.hpp>
 
+#if defined(OPENVPN_PLATFORM_LINUX) || defined(OPENVPN_PLATFORM_ANDROID)
+#include <openvpn/linux/threadpolicy.hpp>
+#define OPENVPN_CLIENT_THREAD_POLICY
+#endif
+
 // copyright
 #include <openvpn/legal/copyright.hpp>
 
@@ -152,6 +163,24 @@ namespace openvpn {
 	  return 0;
       }
 
+      // first n combined values, with the stats taken from one snapshot
+      void combined_fill(long long* dest, const size_t n) const
+      {
+	const Snapshot snap = snapshot();
+	for (size_t i = 0; i < n && i < N_STATS + Error::N_ERRORS; ++i)
+	  dest[i] = i < N_STATS ? snap.stats[i] : errors[i - N_STATS];
+      }
+
+      // all combined values, with the stats taken from one snapshot
+      void combined_bundle(std::vector<long long>& sv) const
+      {
+	const Snapshot snap = snapshot();
+	for (size_t i = 0; i < N_STATS; ++i)
+	  sv.push_back(snap.stats[i]);
+	for (size_t i = 0; i < Error::N_ERRORS; ++i)
+	  sv.push_back(errors[i]);
+      }
+
       count_t stat_count(const size_t index) const
       {
 	return get_stat_fast(index);
@@ -186,6 +215,131 @@ namespace openvpn {
       count_t errors[Error::N_ERRORS];
     };
 
+    // Refreshes the stats page from a helper thread, reading the
+    // atomic stats counters, so the connect() thread does no work for it.
+    class MyStatsPageUpdater
+    {
+    public:
+      MyStatsPageUpdater(ClientStatsPage& page_arg,
+			 const MySessionStats::Ptr& stats_arg,
+			 const int interval_ms)
+	: page(page_arg),
+	  stats(stats_arg),
+	  interval(interval_ms)
+      {
+	update();
+	thread = std::thread([this]() {
+	    std::unique_lock<std::mutex> lock(mutex);
+	    while (!cv.wait_for(lock, interval, [this]() { return halt; }))
+	      update();
+	  });
+      }
+
+      ~MyStatsPageUpdater()
+      {
+	{
+	  std::lock_guard<std::mutex> lock(mutex);
+	  halt = true;
+	}
+	cv.notify_all();
+	thread.join();
+	update(); // final values remain readable after disconnect
+      }
+
+    private:
+      void update()
+      {
+	const SessionStats::Snapshot snap = stats->snapshot();
+	const std::int64_t now = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+	page.update([&](ClientStatsPage& p) {
+	    const std::int64_t elapsed = now - p.update_ms;
+	    if (p.update_ms && elapsed > 0)
+	      {
+		p.bytes_in_per_sec = (snap.get(SessionStats::BYTES_IN) - p.bytes_in) * 1000 / elapsed;
+		p.bytes_out_per_sec = (snap.get(SessionStats::BYTES_OUT) - p.bytes_out) * 1000 / elapsed;
+	      }
+	    p.update_ms = now;
+	    p.bytes_in = snap.get(SessionStats::BYTES_IN);
+	    p.bytes_out = snap.get(SessionStats::BYTES_OUT);
+	    p.packets_in = snap.get(SessionStats::PACKETS_IN);
+	    p.packets_out = snap.get(SessionStats::PACKETS_OUT);
+	    p.tun_bytes_in = snap.get(SessionStats::TUN_BYTES_IN);
+	    p.tun_bytes_out = snap.get(SessionStats::TUN_BYTES_OUT);
+	    p.tun_packets_in = snap.get(SessionStats::TUN_PACKETS_IN);
+	    p.tun_packets_out = snap.get(SessionStats::TUN_PACKETS_OUT);
+	  });
+      }
+
+      ClientStatsPage& page;
+      MySessionStats::Ptr stats;
+      const std::chrono::milliseconds interval;
+      std::mutex mutex;
+      std::condition_variable cv;
+      bool halt = false;
+      std::thread thread;
+    };
+
+    // Carries events and log lines from the connect() thread to the
+    // thread calling drain_events(), see Config::eventQueueSize.
+    class MyEventQueue : public LogReceiver, public RC<thread_safe_refcount>
+    {
+    public:
+      typedef RCPtr<MyEventQueue> Ptr;
+
+      MyEventQueue(const size_t size)
+	: events(size),
+	  log_lines(size)
+      {
+      }
+
+      void add_event(Event&& ev, const bool transitional)
+      {
+	QueuedEvent qe;
+	qe.ev = std::move(ev);
+	qe.transitional = transitional;
+	if (!events.push(std::move(qe)))
+	  ++dropped;
+      }
+
+      virtual void log(const LogInfo& li) override
+      {
+	if (!log_lines.push(LogInfo(li)))
+	  ++dropped;
+      }
+
+      void drain(EventBatch& batch)
+      {
+	QueuedEvent qe, prev;
+	bool have_prev = false;
+	while (events.pop(qe))
+	  {
+	    // collapse runs of the same transitional event
+	    if (have_prev && !(prev.transitional && qe.transitional && prev.ev.name == qe.ev.name))
+	      batch.events.push_back(std::move(prev.ev));
+	    prev = std::move(qe);
+	    have_prev = true;
+	  }
+	if (have_prev)
+	  batch.events.push_back(std::move(prev.ev));
+
+	LogInfo li;
+	while (log_lines.pop(li))
+	  batch.log.push_back(std::move(li));
+	batch.dropped = dropped.exchange(0);
+      }
+
+    private:
+      struct QueuedEvent
+      {
+	Event ev;
+	bool transitional = false;
+      };
+
+      SPSCRing<QueuedEvent> events;
+      SPSCRing<LogInfo> log_lines;
+      std::atomic<int> dropped{0};
+    };
+
     class MyClientEvents : public ClientEvent::Queue
     {
     public:
@@ -203,14 +357,24 @@ namespace openvpn {
 	    ev.error = event->is_error();
 	    ev.fatal = event->is_fatal();
 
+	    const ClientEvent::Type id = event->id();
+
 	    // save connected event
-	    if (event->id() == ClientEvent::CONNECTED)
+	    if (id == ClientEvent::CONNECTED)
 	      last_connected = std::move(event);
 
-	    parent->event(ev);
+	    if (queue)
+	      queue->add_event(std::move(ev), id >= ClientEvent::RECONNECTING && id <= ClientEvent::ADD_ROUTES);
+	    else
+	      parent->event(ev);
 	  }
       }
 
+      void set_queue(MyEventQueue* queue_arg)
+      {
+	queue.reset(queue_arg);
+      }
+
       void get_connection_info(ConnectionInfo& ci)
       {
 	ClientEvent::Base::Ptr connected = last_connected;
@@ -245,6 +409,7 @@ namespace openvpn {
     private:
       OpenVPNClient* parent;
       ClientEvent::Base::Ptr last_connected;
+      MyEventQueue::Ptr queue;
     };
 
     class MySocketProtect : public SocketProtect
@@ -343,6 +508,9 @@ namespace openvpn {
     };
 
     namespace Private {
+      // parsed profiles shared by all clients in the process
+      ClientConfigCache config_cache; // GLOBAL
+
       class ClientState
       {
       public:
@@ -362,8 +530,17 @@ namespace openvpn {
 	Protocol proto_override;
 	IPv6Setting ipv6;
 	int conn_timeout = 0;
+	int race_count = 0;
+	int race_stagger_ms = 250;
+	std::string remote_score_file;
+	int dns_cache_lifetime = 0;
 	bool tun_persist = false;
+	bool tun_ring_buffer = false;
 	bool google_dns_fallback = false;
+	int timer_leeway_ms = 0;
+	bool keepalive_idle = false;
+	int busy_poll_us = 0;
+	bool tls_session_cache = false;
 	bool autologin_sessions = false;
 	std::string private_key_password;
 	std::string external_pki_alias;
@@ -376,11 +553,23 @@ namespace openvpn {
 	ProtoContextOptions::Ptr proto_context_options;
 	PeerInfo::Set::Ptr extra_peer_info;
 	HTTPProxyTransport::Options::Ptr http_proxy_options;
+	PacketCapture::Ptr packet_capture;
+	MyEventQueue::Ptr event_queue;
+	ClientStatsPage stats_page;
+	int stats_page_interval_ms = 0;
+#ifdef OPENVPN_CLIENT_THREAD_POLICY
+	ThreadPolicy::Mode thread_policy = ThreadPolicy::NONE;
+#endif
 #ifdef OPENVPN_GREMLIN
 	Gremlin::Config::Ptr gremlin_config;
+#endif
+#if defined(USE_TUN_BUILDER)
+	TunBuilderClient::PacketBridge::Ptr packet_bridge{new TunBuilderClient::PacketBridge()};
 #endif
 	bool alt_proxy = false;
 	bool dco = false;
+	bool dc_threads = false;
+	int dc_threads_core = -1;
 	bool echo = false;
 	bool info = false;
 
@@ -532,7 +721,7 @@ namespace openvpn {
 	    const KeyValue& kv = config.contentList[i];
 	    kvl.push_back(new OptionList::KeyValue(kv.key, kv.value));
 	  }
-	const ParseClientConfig cc = ParseClientConfig::parse(config.content, &kvl, options);
+	const ParseClientConfig cc = Private::config_cache.parse(config.content, &kvl, options);
 #ifdef OPENVPN_DUMP_CONFIG
 	std::cout << "---------- ARGS ----------" << std::endl;
 	std::cout << options.render(Option::RENDER_PASS_FMT|Option::RENDER_NUMBER|Option::RENDER_BRACKET) << std::endl;
@@ -573,8 +762,17 @@ namespace openvpn {
       try {
 	state->server_override = config.serverOverride;
 	state->conn_timeout = config.connTimeout;
+	state->race_count = config.raceCount;
+	state->race_stagger_ms = config.raceStaggerMs;
+	state->remote_score_file = config.remoteScoreFile;
+	state->dns_cache_lifetime = config.dnsCacheLifetime;
 	state->tun_persist = config.tunPersist;
+	state->tun_ring_buffer = config.tunRingBuffer;
 	state->google_dns_fallback = config.googleDnsFallback;
+	state->timer_leeway_ms = config.timerLeewayMs;
+	state->keepalive_idle = config.keepaliveIdle;
+	state->busy_poll_us = config.busyPollUs;
+	state->tls_session_cache = config.tlsSessionCache;
 	state->autologin_sessions = config.autologinSessions;
 	state->private_key_password = config.privateKeyPassword;
 	if (!config.protoOverride.empty())
@@ -593,6 +791,8 @@ namespace openvpn {
 	state->gui_version = config.guiVersion;
 	state->alt_proxy = config.altProxy;
 	state->dco = config.dco;
+	state->dc_threads = config.dataThreads;
+	state->dc_threads_core = config.dataThreadsCore;
 	state->echo = config.echo;
 	state->info = config.info;
 	if (!config.gremlinConfig.empty())
@@ -604,6 +804,17 @@ namespace openvpn {
 #endif
 	  }
 	state->extra_peer_info = PeerInfo::Set::new_from_foreign_set(config.peerInfo);
+	if (config.packetCaptureSize > 0)
+	  state->packet_capture.reset(new PacketCapture(config.packetCaptureSize));
+	state->stats_page_interval_ms = config.statsPageIntervalMs;
+#ifdef OPENVPN_CLIENT_THREAD_POLICY
+	state->thread_policy = ThreadPolicy::parse_mode(config.threadPolicy);
+#else
+	if (!config.threadPolicy.empty() && config.threadPolicy != "none")
+	  throw Exception("threadPolicy is not supported on this platform");
+#endif
+	if (config.eventQueueSize > 0)
+	  state->event_queue.reset(new MyEventQueue(config.eventQueueSize));
 	if (!config.proxyHost.empty())
 	  {
 	    HTTPProxyTransport::Options::Ptr ho(new HTTPProxyTransport::Options());
@@ -759,7 +970,7 @@ namespace openvpn {
 #ifdef OPENVPN_LOG_GLOBAL
 #error ovpn3 core logging object only supports thread-local scope
 #endif
-      Log::Context log_context(this);
+      Log::Context log_context(state->event_queue ? (LogReceiver*)state->event_queue.get() : this);
 #endif
       return do_connect();
     }
@@ -770,6 +981,23 @@ namespace openvpn {
       bool in_run = false;
 
       connect_attach();
+      state->events->set_queue(state->event_queue.get());
+
+      std::unique_ptr<MyStatsPageUpdater> stats_page_updater;
+      if (state->stats_page_interval_ms > 0)
+	stats_page_updater.reset(new MyStatsPageUpdater(state->stats_page, state->stats, state->stats_page_interval_ms));
+
+#ifdef OPENVPN_CLIENT_THREAD_POLICY
+      // connect() runs the io_context, so this is the data thread
+      std::unique_ptr<ThreadPolicy> thread_policy;
+      if (state->thread_policy != ThreadPolicy::NONE)
+	{
+	  MySessionStats::Ptr stats = state->stats;
+	  thread_policy.reset(new ThreadPolicy(state->thread_policy, [stats]() {
+		return std::uint64_t(stats->stat_count(SessionStats::BYTES_IN) + stats->stat_count(SessionStats::BYTES_OUT));
+	      }));
+	}
+#endif
 
       try {
 	// set global PolarSSL debug level
@@ -785,13 +1013,24 @@ namespace openvpn {
 	cc.proto_override = state->proto_override;
 	cc.ipv6 = state->ipv6;
 	cc.conn_timeout = state->conn_timeout;
+	cc.race_count = state->race_count;
+	cc.race_stagger_ms = state->race_stagger_ms;
+	cc.remote_score_file = state->remote_score_file;
+	cc.dns_cache_lifetime = state->dns_cache_lifetime;
 	cc.tun_persist = state->tun_persist;
+	cc.tun_ring_buffer = state->tun_ring_buffer;
 	cc.google_dns_fallback = state->google_dns_fallback;
+	cc.timer_leeway_ms = state->timer_leeway_ms;
+	cc.keepalive_idle = state->keepalive_idle;
+	cc.busy_poll_us = state->busy_poll_us;
+	cc.tls_session_cache = state->tls_session_cache;
 	cc.autologin_sessions = state->autologin_sessions;
 	cc.proto_context_options = state->proto_context_options;
 	cc.http_proxy_options = state->http_proxy_options;
 	cc.alt_proxy = state->alt_proxy;
 	cc.dco = state->dco;
+	cc.dc_threads = state->dc_threads;
+	cc.dc_threads_core = state->dc_threads_core;
 	cc.echo = state->echo;
 	cc.info = state->info;
 	cc.reconnect_notify = &state->reconnect_notify;
@@ -805,6 +1044,7 @@ namespace openvpn {
 	cc.tls_version_min_override = state->tls_version_min_override;
 	cc.gui_version = state->gui_version;
 	cc.extra_peer_info = state->extra_peer_info;
+	cc.packet_capture = state->packet_capture;
 	cc.stop = state->async_stop_local();
 #ifdef OPENVPN_GREMLIN
 	cc.gremlin_config = state->gremlin_config;
@@ -812,6 +1052,7 @@ namespace openvpn {
 #if defined(USE_TUN_BUILDER)
 	cc.socket_protect = &state->socket_protect;
 	cc.builder = this;
+	cc.packet_bridge = state->packet_bridge;
 #endif
 
 	// force Session ID use and disable password cache if static challenge is enabled
@@ -915,7 +1156,10 @@ namespace openvpn {
 
     OPENVPN_CLIENT_EXPORT void OpenVPNClient::connect_run()
     {
-      state->io_context()->run();
+      if (state->busy_poll_us > 0)
+	BusyPoll::run(*state->io_context(), std::chrono::microseconds(state->busy_poll_us));
+      else
+	state->io_context()->run();
     }
 
     OPENVPN_CLIENT_EXPORT void OpenVPNClient::connect_session_stop()
@@ -1036,9 +1280,15 @@ namespace openvpn {
 	{
 	  MySessionStats* stats = state->stats.get();
 	  if (stats)
-	    stats->dco_update();
-	  for (size_t i = 0; i < n; ++i)
-	    sv.push_back(stats ? stats->combined_value(i) : 0);
+	    {
+	      stats->dco_update();
+	      stats->combined_bundle(sv);
+	    }
+	  else
+	    {
+	      for (size_t i = 0; i < n; ++i)
+		sv.push_back(0);
+	    }
 	}
       else
 	{
@@ -1048,6 +1298,69 @@ namespace openvpn {
       return sv;
     }
 
+    OPENVPN_CLIENT_EXPORT std::string OpenVPNClient::perf_stats() const
+    {
+#ifdef OPENVPN_PERF_INSTRUMENTATION
+      if (state->is_foreign_thread_access())
+	{
+	  MySessionStats* stats = state->stats.get();
+	  if (stats)
+	    return stats->perf()->to_string();
+	}
+#endif
+      return std::string();
+    }
+
+    OPENVPN_CLIENT_EXPORT EventBatch OpenVPNClient::drain_events()
+    {
+      EventBatch batch;
+      if (state->event_queue)
+	state->event_queue->drain(batch);
+      return batch;
+    }
+
+    OPENVPN_CLIENT_EXPORT bool OpenVPNClient::packet_capture(bool enable)
+    {
+      PacketCapture* pc = state->packet_capture.get();
+      if (!pc)
+	return false;
+      pc->enable(enable);
+      return true;
+    }
+
+    OPENVPN_CLIENT_EXPORT bool OpenVPNClient::packet_capture_export(const std::string& path) const
+    {
+      const PacketCapture* pc = state->packet_capture.get();
+      if (!pc)
+	return false;
+      std::ofstream out(path, std::ios::binary);
+      if (!out)
+	return false;
+      pc->write_pcapng(out);
+      return bool(out);
+    }
+
+    OPENVPN_CLIENT_EXPORT int OpenVPNClient::stats_fill(long long* values, int n) const
+    {
+      if (!values || n <= 0)
+	return 0;
+      n = std::min(n, stats_n());
+      MySessionStats* stats = state->is_foreign_thread_access() ? state->stats.get() : nullptr;
+      if (stats)
+	{
+	  stats->dco_update();
+	  stats->combined_fill(values, n);
+	}
+      else
+	std::fill(values, values + n, 0);
+      return n;
+    }
+
+    OPENVPN_CLIENT_EXPORT const ClientStatsPage* OpenVPNClient::stats_page() const
+    {
+      return &state->stats_page;
+    }
+
     OPENVPN_CLIENT_EXPORT InterfaceStats OpenVPNClient::tun_stats() const
     {
       InterfaceStats ret;
@@ -1096,6 +1409,11 @@ namespace openvpn {
 	      ret.packetsOut = stats->stat_count(SessionStats::PACKETS_OUT);
 	      ret.packetsIn = stats->stat_count(SessionStats::PACKETS_IN);
 
+	      const SessionStats::Latency lat = stats->latency();
+	      ret.rttUs = lat.rtt_us;
+	      ret.rttMinUs = lat.rtt_min_us;
+	      ret.jitterUs = lat.jitter_us;
+
 	      // calculate time since last packet received
 	      {
 		const Time& lpr = stats->last_packet_received();
@@ -1115,6 +1433,9 @@ namespace openvpn {
       ret.bytesIn = 0;
       ret.packetsOut = 0;
       ret.packetsIn = 0;
+      ret.rttUs = 0;
+      ret.rttMinUs = 0;
+      ret.jitterUs = 0;
       return ret;
     }
 
@@ -1154,9 +1475,33 @@ namespace openvpn {
 	}
     }
 
+    OPENVPN_CLIENT_EXPORT void OpenVPNClient::migrate()
+    {
+      if (state->is_foreign_thread_access())
+	{
+	  ClientConnect* session = state->session.get();
+	  if (session)
+	    state->session->thread_safe_migrate();
+	}
+    }
+
+    OPENVPN_CLIENT_EXPORT bool OpenVPNClient::tun_read_packets(const TunBuilderPacket* packets, size_t n)
+    {
+#if defined(USE_TUN_BUILDER)
+      if (state->is_foreign_thread_access())
+	return state->packet_bridge->packets_in(packets, n);
+#endif
+      return false;
+    }
+
     OPENVPN_CLIENT_EXPORT std::string OpenVPNClient::crypto_self_test()
     {
-      return SelfTest::crypto_self_test();
+      return SelfTest::crypto_self_test_result();
+    }
+
+    OPENVPN_CLIENT_EXPORT void OpenVPNClient::start_crypto_self_test()
+    {
+      SelfTest::crypto_self_test_start();
     }
 
     OPENVPN_CLIENT_EXPORT int OpenVPNClient::app_expire()
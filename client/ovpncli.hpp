@@ -29,6 +29,7 @@
 
 #include <openvpn/tun/builder/base.hpp>
 #include <openvpn/pki/epkibase.hpp>
+#include <openvpn/client/clistatspage.hpp>
 
 namespace openvpn {
   class OptionList;
@@ -183,9 +184,32 @@ namespace openvpn {
       // Connection timeout in seconds, or 0 to retry indefinitely
       int connTimeout = 0;
 
+      // Number of extra remote entries to race in parallel with the
+      // current one (Happy Eyeballs), or 0 to try them one at a time.
+      // The first attempt to complete its TLS handshake is kept.
+      int raceCount = 0;
+
+      // Delay in milliseconds between starting racing attempts
+      int raceStaggerMs = 250;
+
+      // If > 0, resolve all remote hosts in parallel before the first
+      // connection attempt, and reuse the results for this many
+      // seconds across reconnects.
+      int dnsCacheLifetime = 0;
+
+      // If non-empty, a file in which per-remote handshake latency and
+      // failure history is kept between runs, and used to try the
+      // remotes most likely to connect quickly first.
+      std::string remoteScoreFile;
+
       // Keep tun interface active during pauses or reconnections
       bool tunPersist = false;
 
+      // Windows only: move packets through ring buffers shared with
+      // the tun driver when it supports them, instead of one
+      // overlapped read/write per packet.
+      bool tunRingBuffer = false;
+
       // If true and a redirect-gateway profile doesn't also define
       // DNS servers, use the standard Google DNS servers.
       bool googleDnsFallback = false;
@@ -232,6 +256,7 @@ namespace openvpn {
       //   tls_1_0  -- use TLS 1.0 minimum (overrides profile)
       //   tls_1_1  -- use TLS 1.1 minimum (overrides profile)
       //   tls_1_2  -- use TLS 1.2 minimum (overrides profile)
+      //   tls_1_3  -- use TLS 1.3 minimum (overrides profile)
       std::string tlsVersionMinOverride;
 
       // Pass custom key/value pairs to OpenVPN server.
@@ -250,6 +275,14 @@ namespace openvpn {
       // Custom Data Channel Offload implementation
       bool dco = false;
 
+      // Linux only: run the data channel on two threads of its own,
+      // one reading tun and encrypting, one reading the socket and
+      // decrypting, while connect() keeps the control channel.  UDP,
+      // dev tun and no compression only.  If dataThreadsCore >= 0,
+      // the threads are pinned to that core and the next one.
+      bool dataThreads = false;
+      int dataThreadsCore = -1;
+
       // pass through pushed "echo" directives via "ECHO" event
       bool echo = false;
 
@@ -258,6 +291,48 @@ namespace openvpn {
 
       // Gremlin configuration (requires that the core is built with OPENVPN_GREMLIN)
       std::string gremlinConfig;
+
+      // Size in bytes of the packet capture ring, 0 to disable.
+      // Capture starts off and is toggled with packet_capture().
+      int packetCaptureSize = 0;
+
+      // If nonzero, event() and log() are not called from the connect()
+      // thread.  Events and log lines are queued in lock-free rings of
+      // this many entries, to be collected with drain_events().
+      int eventQueueSize = 0;
+
+      // If nonzero, refresh the page returned by stats_page() every
+      // this many milliseconds while connect() is running.
+      int statsPageIntervalMs = 0;
+
+      // Placement of the connect() thread on big.LITTLE CPUs
+      // (Linux and Android only):
+      //   none        -- leave it to the scheduler (default)
+      //   performance -- pin to performance cores at raised priority
+      //   efficiency  -- pin to efficiency cores
+      //   adaptive    -- performance cores while traffic is flowing,
+      //                  back to efficiency cores when idle
+      std::string threadPolicy;
+
+      // If nonzero, keepalive and housekeeping timers of a connected
+      // session are delayed by up to this many milliseconds so that
+      // they fire together on shared boundaries (fewer wakeups).
+      int timerLeewayMs = 0;
+
+      // Once the tunnel is idle, send keepalives at half the
+      // ping-restart interval instead of every ping interval.
+      bool keepaliveIdle = false;
+
+      // Latency mode: if nonzero, the connect() thread busy-polls the
+      // transport socket and tun instead of sleeping in the reactor,
+      // until nothing has happened for this many microseconds.  Keeps
+      // a CPU core busy while traffic flows.
+      int busyPollUs = 0;
+
+      // Resume the TLS session of the previous connection to the same
+      // remote on reconnect, skipping the full handshake if the server
+      // allows it.
+      bool tlsSessionCache = false;
     };
 
     // used to communicate VPN events such as connect, disconnect, etc.
@@ -306,6 +381,15 @@ namespace openvpn {
       std::string text;     // log output (usually but not always one line)
     };
 
+    // events and log lines queued since the last drain_events() call
+    // (client reads)
+    struct EventBatch
+    {
+      std::vector<Event> events;
+      std::vector<LogInfo> log;
+      int dropped = 0;      // events and log lines lost to a full queue
+    };
+
     // receives log messages
     struct LogReceiver
     {
@@ -335,6 +419,12 @@ namespace openvpn {
       // number of binary milliseconds (1/1024th of a second) since
       // last packet was received, or -1 if undefined
       int lastPacketReceived;
+
+      // data channel latency in microseconds, measured when the
+      // "latency-probe" option is active, otherwise 0
+      long long rttUs;
+      long long rttMinUs;
+      long long jitterUs;
     };
 
     // return value of merge_config methods
@@ -462,6 +552,19 @@ namespace openvpn {
       // from a different thread when connect() is running.
       void reconnect(int seconds);
 
+      // Call on a local network change to move the session to the
+      // new network path without a new handshake (UDP with peer-id
+      // only).  Falls back to an immediate reconnect otherwise.  May
+      // be called from a different thread when connect() is running.
+      void migrate();
+
+      // In packet-batch mode (see tun_builder_establish_packets), pass
+      // a burst of n packets read from the tunnel to the core.  The
+      // packets are copied before returning.  May be called from a
+      // different thread when connect() is running.  Returns false
+      // if no packet-batch tunnel is established.
+      bool tun_read_packets(const TunBuilderPacket* packets, size_t n);
+
       // When a connection is close to timeout, the core will call this
       // method.  If it returns false, the core will disconnect with a
       // CONNECTION_TIMEOUT event.  If true, the core will enter a PAUSE
@@ -483,9 +586,39 @@ namespace openvpn {
       // return all stats in a bundle
       std::vector<long long> stats_bundle() const;
 
+      // same as stats_bundle, but fills the first n values of a caller
+      // provided array without allocating, returns number of values filled
+      int stats_fill(long long* values, int n) const;
+
+      // Stats page kept up to date while connected when
+      // Config::statsPageIntervalMs is nonzero, remains valid for the
+      // lifetime of this object and may be read from any thread
+      // (see ClientStatsPage::read).
+      const ClientStatsPage* stats_page() const;
+
       // return tun stats only
       InterfaceStats tun_stats() const;
 
+      // return data path latency/batch/queue report, empty unless
+      // built with OPENVPN_PERF_INSTRUMENTATION
+      std::string perf_stats() const;
+
+      // Collect queued events and log lines when Config::eventQueueSize
+      // is nonzero.  Never blocks the connect() thread, but must be
+      // called from only one thread at a time.  Runs of the same
+      // transitional event (such as RECONNECTING or WAIT) are
+      // collapsed to the last one.
+      EventBatch drain_events();
+
+      // Start or stop recording packets into the capture ring.
+      // Returns false if Config::packetCaptureSize was 0.
+      // May be called from a different thread.
+      bool packet_capture(bool enable);
+
+      // Write the capture ring contents to path as pcapng.
+      // May be called from a different thread while capturing.
+      bool packet_capture_export(const std::string& path) const;
+
       // return transport stats only
       TransportStats transport_stats() const;
 
@@ -509,6 +642,10 @@ namespace openvpn {
       // Do a crypto library self test
       static std::string crypto_self_test();
 
+      // Start the crypto library self test on a background thread,
+      // crypto_self_test() will then wait for and return its result
+      static void start_crypto_self_test();
+
       // Returns date/time of app expiration as a unix time value
       static int app_expire();
 
@@ -0,0 +1,42 @@
+/*
+ * OPENSSL_cpuid_setup for Apple arm64 targets, where the SIGILL
+ * probes of armcap.c are not usable.  Sets OPENSSL_armcap_P from
+ * the hw.optional sysctls, falling back to the features that every
+ * Apple arm64 CPU has (A7 and later: NEON, AES, PMULL, SHA1, SHA256).
+ */
+
+#include <sys/types.h>
+#include <sys/sysctl.h>
+
+#include "arm_arch.h"
+
+unsigned int OPENSSL_armcap_P = 0;
+
+static int has_feature(const char *name, const int def)
+{
+    int val = 0;
+    size_t len = sizeof(val);
+    if (sysctlbyname(name, &val, &len, NULL, 0) != 0)
+	return def;
+    return val != 0;
+}
+
+void OPENSSL_cpuid_setup(void)
+{
+    static int trigger = 0;
+    unsigned int cap = ARMV7_NEON;
+
+    if (trigger)
+	return;
+    trigger = 1;
+
+    if (has_feature("hw.optional.arm.FEAT_AES", 1))
+	cap |= ARMV8_AES;
+    if (has_feature("hw.optional.arm.FEAT_PMULL", 1))
+	cap |= ARMV8_PMULL;
+    if (has_feature("hw.optional.arm.FEAT_SHA1", 1))
+	cap |= ARMV8_SHA1;
+    if (has_feature("hw.optional.arm.FEAT_SHA256", 1))
+	cap |= ARMV8_SHA256;
+    OPENSSL_armcap_P = cap;
+}
@@ -30,6 +30,7 @@
 %rename(ClientAPI_ConnectionInfo) ConnectionInfo;
 %rename(ClientAPI_Status) Status;
 %rename(ClientAPI_LogInfo) LogInfo;
+%rename(ClientAPI_EventBatch) EventBatch;
 %rename(ClientAPI_InterfaceStats) InterfaceStats;
 %rename(ClientAPI_TransportStats) TransportStats;
 %rename(ClientAPI_MergeConfig) MergeConfig;
@@ -42,6 +43,8 @@
 namespace std {
   %template(ClientAPI_ServerEntryVector) vector<openvpn::ClientAPI::ServerEntry>;
   %template(ClientAPI_LLVector) vector<long long>;
+  %template(ClientAPI_EventVector) vector<openvpn::ClientAPI::Event>;
+  %template(ClientAPI_LogInfoVector) vector<openvpn::ClientAPI::LogInfo>;
 };
 
 // interface to be bridged between C++ and target language
@@ -0,0 +1,175 @@
+//    OpenVPN -- An application to securely tunnel IP networks
+//               over a single port, with support for SSL/TLS-based
+//               session authentication and key exchange,
+//               packet encryption, packet authentication, and
+//               packet compression.
+//
+//    Copyright (C) 2012-2016 OpenVPN Technologies, Inc.
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU Affero General Public License Version 3
+//    as published by the Free Software Foundation.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU Affero General Public License for more details.
+//
+//    You should have received a copy of the GNU Affero General Public License
+//    along with this program in the COPYING file.
+//    If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef OPENVPN_ADDR_BITMAPPOOL_H
+#define OPENVPN_ADDR_BITMAPPOOL_H
+
+#include <vector>
+#include <cstdint> // for std::uint32_t
+
+#include <openvpn/common/size.hpp>
+#include <openvpn/common/exception.hpp>
+#include <openvpn/common/ffs.hpp>
+
+#include <openvpn/addr/ip.hpp>
+#include <openvpn/addr/range.hpp>
+
+namespace openvpn {
+  namespace IP {
+
+    // Pool of the addresses of one contiguous range, kept as a bitmap
+    // with one bit per address, so it costs no hashing or heap nodes
+    // and a /12 fits in 128 KB.  Acquire scans from a rotating cursor,
+    // so released addresses are normally reused only after the rest
+    // of the range, like the freelist order of PoolType.
+    // A should be IP::Addr, IPv4::Addr, or IPv6::Addr.
+    template <typename ADDR>
+    class BitmapPoolType
+    {
+    public:
+      OPENVPN_EXCEPTION(bitmap_pool_error);
+
+      BitmapPoolType() {}
+
+      explicit BitmapPoolType(const RangeType<ADDR>& range)
+      {
+	add_range(range);
+      }
+
+      // Set the range of addresses of the pool, only one range is supported.
+      void add_range(const RangeType<ADDR>& range)
+      {
+	if (extent_)
+	  throw bitmap_pool_error("pool range already defined");
+	if (!range.defined())
+	  return;
+	start_ = range.start();
+	extent_ = range.extent();
+	words.assign((extent_ + 31) / 32, 0);
+	if (extent_ % 32)
+	  words.back() = ~std::uint32_t(0) << (extent_ % 32); // past the end
+	cursor = 0;
+	n_used = 0;
+      }
+
+      // Return number of pool addresses currently in use.
+      size_t n_in_use() const
+      {
+	return n_used;
+      }
+
+      size_t size() const
+      {
+	return extent_;
+      }
+
+      // Acquire an address from pool.  Returns true if successful,
+      // with address placed in dest, or false if pool depleted.
+      bool acquire_addr(ADDR& dest)
+      {
+	if (n_used >= extent_)
+	  return false;
+	for (size_t n = 0; n < words.size(); ++n)
+	  {
+	    const size_t w = cursor;
+	    const std::uint32_t free_bits = ~words[w];
+	    if (free_bits)
+	      {
+		const unsigned int bit = find_first_set(free_bits) - 1;
+		words[w] |= std::uint32_t(1) << bit;
+		++n_used;
+		dest = start_ + long(w * 32 + bit);
+		return true;
+	      }
+	    if (++cursor == words.size())
+	      cursor = 0;
+	  }
+	return false;
+      }
+
+      // Acquire a specific address from pool, returning true if
+      // successful, or false if the address is not available.
+      bool acquire_specific_addr(const ADDR& addr)
+      {
+	size_t i;
+	if (!index(addr, i) || test(i))
+	  return false;
+	words[i / 32] |= std::uint32_t(1) << (i % 32);
+	++n_used;
+	return true;
+      }
+
+      // Return a previously acquired address to the pool.  Does nothing if
+      // (a) the address is owned by the pool and marked as free, or
+      // (b) the address is not owned by the pool.
+      void release_addr(const ADDR& addr)
+      {
+	size_t i;
+	if (index(addr, i) && test(i))
+	  {
+	    words[i / 32] &= ~(std::uint32_t(1) << (i % 32));
+	    --n_used;
+	  }
+      }
+
+      bool owns(const ADDR& addr) const
+      {
+	size_t i;
+	return index(addr, i);
+      }
+
+    private:
+      static bool same_family(const IP::Addr& a, const IP::Addr& b)
+      {
+	return a.version() == b.version();
+      }
+
+      template <typename A>
+      static bool same_family(const A&, const A&)
+      {
+	return true;
+      }
+
+      bool index(const ADDR& addr, size_t& i) const
+      {
+	if (!extent_ || !same_family(addr, start_) || addr < start_ || addr > start_ + long(extent_ - 1))
+	  return false;
+	i = (addr - start_).to_ulong();
+	return true;
+      }
+
+      bool test(const size_t i) const
+      {
+	return (words[i / 32] >> (i % 32)) & 1;
+      }
+
+      ADDR start_;
+      size_t extent_ = 0;
+      size_t cursor = 0;
+      size_t n_used = 0;
+      std::vector<std::uint32_t> words; // bit set: in use
+    };
+
+    typedef BitmapPoolType<IP::Addr> BitmapPool;
+  }
+}
+
+#endif
@@ -751,13 +751,13 @@ namespace openvpn {
 		low = 0;
 		shift -= 64;
 	      }
-	    if (shift < 64)
+	    if (shift == 64)
+	      high = 0;
+	    else if (shift) // avoid undefined shift by 64
 	      {
 		high = (high << shift) | (low >> (64-shift));
 		low <<= shift;
 	      }
-	    else // shift == 64
-	      high = 0;
 	  }
 	else
 	  throw ipv6_exception("l-shift too large");
@@ -784,13 +784,13 @@ namespace openvpn {
 		high = 0;
 		shift -= 64;
 	      }
-	    if (shift < 64)
+	    if (shift == 64)
+	      low = 0;
+	    else if (shift) // avoid undefined shift by 64
 	      {
 		low = (low >> shift) | (high << (64-shift));
 		high >>= shift;
 	      }
-	    else // shift == 64
-	      low = 0;
 	  }
 	else
 	  throw ipv6_exception("r-shift too large");
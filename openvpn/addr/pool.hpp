@@ -24,6 +24,7 @@
 
 #include <string>
 #include <sstream>
+#include <vector>
 #include <deque>
 #include <unordered_map>
 
@@ -36,64 +37,75 @@
 namespace openvpn {
   namespace IP {
 
-    // Maintain a pool of IP addresses.
+    // Maintain a pool of IP addresses.  Ranges are not expanded when
+    // added: fresh addresses are handed out by advancing a cursor over
+    // the ranges, and only addresses that have been acquired or released
+    // are tracked, so even a /64 pool is free to construct.
     // A should be IP::Addr, IPv4::Addr, or IPv6::Addr.
     template <typename ADDR>
     class PoolType
     {
     public:
+      OPENVPN_EXCEPTION(pool_error);
+
+      // Pool state, for carrying a pool across a restart.  It can only
+      // be restored onto a pool built with the same ranges.
+      struct Snapshot
+      {
+	size_t range_index = 0;  // number of ranges reached by cursor
+	RangeType<ADDR> rest;    // unvisited part of last range reached
+	std::vector<ADDR> in_use;
+	std::vector<ADDR> freelist;
+      };
+
       PoolType() {}
 
       // Add range of addresses to pool (pool will own the addresses).
       void add_range(const RangeType<ADDR>& range)
       {
-	typename RangeType<ADDR>::Iterator iter = range.iterator();
-	while (iter.more())
-	  {
-	    const ADDR& a = iter.addr();
-	    add_addr(a);
-	    iter.next();
-	  }
+	if (range.defined())
+	  ranges.emplace_back(range);
       }
 
       // Add single address to pool (pool will own the address).
       void add_addr(const ADDR& addr)
       {
-	typename std::unordered_map<ADDR, bool>::const_iterator e = map.find(addr);
-	if (e == map.end())
-	  {
-	    freelist.push_back(addr);
-	    map[addr] = false;
-	  }
+	if (!owns(addr))
+	  add_range(RangeType<ADDR>(addr, 1));
       }
 
       // Return number of pool addresses currently in use.
       size_t n_in_use() const
       {
-	return map.size() - freelist.size();
+	return n_used;
       }
 
       // Acquire an address from pool.  Returns true if successful,
       // with address placed in dest, or false if pool depleted.
       bool acquire_addr(ADDR& dest)
       {
-	while (true)
+	if (next_fresh(dest))
 	  {
-	    if (freelist.empty())
-	      return false;
-	    const ADDR& a = freelist.front();
+	    map[dest] = true;
+	    ++n_used;
+	    return true;
+	  }
+	while (!freelist.empty())
+	  {
+	    const ADDR a = freelist.front();
+	    freelist.pop_front();
 	    typename std::unordered_map<ADDR, bool>::iterator e = map.find(a);
 	    if (e == map.end()) // any address in freelist must exist in map
 	      throw Exception("PoolType: address in freelist doesn't exist in map");
 	    if (!e->second)
 	      {
 		e->second = true;
+		++n_used;
 		dest = a;
-		freelist.pop_front();
 		return true;
 	      }
-	    freelist.pop_front();
 	  }
+	return false;
       }
 
       // Acquire a specific address from pool, returning true if
@@ -101,13 +113,18 @@ namespace openvpn {
       bool acquire_specific_addr(const ADDR& addr)
       {
 	typename std::unordered_map<ADDR, bool>::iterator e = map.find(addr);
-	if (e != map.end() && !e->second)
+	if (e != map.end())
 	  {
+	    if (e->second)
+	      return false;
 	    e->second = true;
-	    return true;
 	  }
+	else if (owns(addr)) // not yet reached by cursor
+	  map[addr] = true;
 	else
 	  return false;
+	++n_used;
+	return true;
       }
 
       // Return a previously acquired address to the pool.  Does nothing if
@@ -120,6 +137,64 @@ namespace openvpn {
 	  {
 	    freelist.push_back(addr);
 	    e->second = false;
+	    --n_used;
+	  }
+      }
+
+      // Return true if address falls within one of the pool ranges.
+      bool owns(const ADDR& addr) const
+      {
+	for (auto &r : ranges)
+	  {
+	    if (same_family(addr, r.start())
+		&& !(addr < r.start())
+		&& !(r.start() + offset_addr(r.start(), r.extent() - 1) < addr))
+	      return true;
+	  }
+	return false;
+      }
+
+      Snapshot snapshot() const
+      {
+	Snapshot s;
+	s.range_index = range_index;
+	s.rest = rest;
+	for (auto &e : map)
+	  {
+	    if (e.second)
+	      s.in_use.push_back(e.first);
+	  }
+	for (auto &a : freelist)
+	  {
+	    const typename std::unordered_map<ADDR, bool>::const_iterator e = map.find(a);
+	    if (e != map.end() && !e->second)
+	      s.freelist.push_back(a);
+	  }
+	return s;
+      }
+
+      void restore(const Snapshot& s)
+      {
+	if (s.range_index > ranges.size())
+	  throw pool_error("snapshot doesn't match pool ranges");
+	map.clear();
+	freelist.clear();
+	n_used = 0;
+	range_index = s.range_index;
+	rest = s.rest;
+	for (auto &a : s.in_use)
+	  {
+	    if (!owns(a))
+	      throw pool_error("snapshot address " + a.to_string() + " not in pool");
+	    if (map.emplace(a, true).second)
+	      ++n_used;
+	  }
+	for (auto &a : s.freelist)
+	  {
+	    if (!owns(a))
+	      throw pool_error("snapshot address " + a.to_string() + " not in pool");
+	    if (map.emplace(a, false).second)
+	      freelist.push_back(a);
 	  }
       }
 
@@ -127,8 +202,55 @@ namespace openvpn {
       float load_factor() const { return map.load_factor(); }
 
     private:
-      std::deque<ADDR> freelist;
-      std::unordered_map<ADDR, bool> map;
+      // Advance cursor to the next address not already tracked in map.
+      bool next_fresh(ADDR& dest)
+      {
+	while (true)
+	  {
+	    if (!rest.defined())
+	      {
+		if (range_index >= ranges.size())
+		  return false;
+		rest = ranges[range_index++];
+	      }
+	    const ADDR a = rest.pull_front(1).start();
+	    if (map.find(a) == map.end())
+	      {
+		dest = a;
+		return true;
+	      }
+	  }
+      }
+
+      static bool same_family(const IP::Addr& a, const IP::Addr& b)
+      {
+	return a.version() == b.version();
+      }
+
+      template <typename A>
+      static bool same_family(const A&, const A&)
+      {
+	return true;
+      }
+
+      // offset as an address, since a range extent may exceed a long
+      static IP::Addr offset_addr(const IP::Addr& start, const size_t offset)
+      {
+	return IP::Addr::from_ulong(start.version(), offset);
+      }
+
+      template <typename A>
+      static A offset_addr(const A&, const size_t offset)
+      {
+	return A::from_ulong(offset);
+      }
+
+      std::vector<RangeType<ADDR>> ranges;
+      size_t range_index = 0;
+      RangeType<ADDR> rest;
+      size_t n_used = 0;
+      std::deque<ADDR> freelist;                 // released addresses
+      std::unordered_map<ADDR, bool> map;        // addresses touched so far
     };
 
     typedef PoolType<IP::Addr> Pool;
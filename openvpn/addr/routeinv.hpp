@@ -27,6 +27,7 @@
 
 #include <openvpn/common/exception.hpp>
 #include <openvpn/addr/route.hpp>
+#include <openvpn/addr/routetrie.hpp>
 
 namespace openvpn {
   namespace IP {
@@ -48,55 +49,10 @@ namespace openvpn {
       RouteInverter(const RouteList& in, const Addr::VersionMask vermask)
       {
 	in.verify_canonical();
-	if (vermask & Addr::V4_MASK)
-	  descend(in, Addr::V4, Route(Addr::from_zero(Addr::V4), 0));
-	if (vermask & Addr::V6_MASK)
-	  descend(in, Addr::V6, Route(Addr::from_zero(Addr::V6), 0));
-      }
-
-    private:
-      enum Type {
-	EQUAL,
-	SUBROUTE,
-	LEAF,
-      };
-
-      void descend(const RouteList& in, const Addr::Version ver, const Route& route)
-      {
-	switch (find(in, route))
-	  {
-	  case SUBROUTE:
-	    {
-	      Route r1, r2;
-	      if (route.split(r1, r2))
-		{
-		  descend(in, ver, r1);
-		  descend(in, ver, r2);
-		}
-	      else
-		push_back(route);
-	      break;
-	    }
-	  case LEAF:
-	    push_back(route);
-	    break;
-	  case EQUAL:
-	    break;
-	  }
-      }
-
-      static Type find(const RouteList& in, const Route& route)
-      {
-	Type type = LEAF;
+	RouteTrie<bool> trie;
 	for (RouteList::const_iterator i = in.begin(); i != in.end(); ++i)
-	  {
-	    const Route& r = *i;
-	    if (route == r)
-	      return EQUAL;
-	    else if (route.contains(r))
-	      type = SUBROUTE;
-	  }
-	return type;
+	  trie.insert(*i, true);
+	trie.complement(*this, vermask);
       }
     };
   }
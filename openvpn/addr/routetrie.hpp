@@ -0,0 +1,492 @@
+//    OpenVPN -- An application to securely tunnel IP networks
+//               over a single port, with support for SSL/TLS-based
+//               session authentication and key exchange,
+//               packet encryption, packet authentication, and
+//               packet compression.
+//
+//    Copyright (C) 2012-2016 OpenVPN Technologies, Inc.
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU Affero General Public License Version 3
+//    as published by the Free Software Foundation.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU Affero General Public License for more details.
+//
+//    You should have received a copy of the GNU Affero General Public License
+//    along with this program in the COPYING file.
+//    If not, see <http://www.gnu.org/licenses/>.
+
+// Longest-prefix-match table for IPv4 and IPv6 routes, implemented
+// as a path-compressed binary (Patricia) trie per address family.
+
+#ifndef OPENVPN_ADDR_ROUTETRIE_H
+#define OPENVPN_ADDR_ROUTETRIE_H
+
+#include <cstdint>
+#include <memory>
+#include <algorithm>
+#include <utility>
+
+#include <openvpn/common/exception.hpp>
+#include <openvpn/common/ffs.hpp>
+#include <openvpn/addr/ip.hpp>
+#include <openvpn/addr/route.hpp>
+
+namespace openvpn {
+  namespace IP {
+
+    // Maps routes to values of type T, lookup() returns the value of
+    // the most specific route containing an address.  Insert, erase,
+    // and lookup walk at most one node per distinct branch point, so
+    // cost depends on address width rather than the number of routes.
+    template <typename T>
+    class RouteTrie
+    {
+    public:
+      OPENVPN_EXCEPTION(route_trie_error);
+
+      RouteTrie() : size_(0) {}
+
+      // add or replace route, returns true if route is new
+      bool insert(const Route& route, T value)
+      {
+	const Key k = key(route.addr, route.prefix_len);
+	return insert(root(route.addr.version()), k, route.prefix_len, std::move(value));
+      }
+
+      bool insert(const Route4& route, T value)
+      {
+	return insert(root4, key(route.addr, route.prefix_len), route.prefix_len, std::move(value));
+      }
+
+      bool insert(const Route6& route, T value)
+      {
+	return insert(root6, key(route.addr, route.prefix_len), route.prefix_len, std::move(value));
+      }
+
+      // remove route, returns true if it existed
+      bool erase(const Route& route)
+      {
+	return erase(root(route.addr.version()), key(route.addr, route.prefix_len), route.prefix_len);
+      }
+
+      // value of the most specific route containing addr, or nullptr
+      const T* lookup(const Addr& addr) const
+      {
+	switch (addr.version())
+	  {
+	  case Addr::V4:
+	    return lookup(addr.to_ipv4_nocheck());
+	  case Addr::V6:
+	    return lookup(addr.to_ipv6_nocheck());
+	  default:
+	    return nullptr;
+	  }
+      }
+
+      const T* lookup(const IPv4::Addr& addr) const
+      {
+	return lookup(root4.get(), key(addr, IPv4::Addr::SIZE), IPv4::Addr::SIZE);
+      }
+
+      const T* lookup(const IPv6::Addr& addr) const
+      {
+	return lookup(root6.get(), key(addr, IPv6::Addr::SIZE), IPv6::Addr::SIZE);
+      }
+
+      // value of exactly this route, or nullptr
+      const T* find(const Route& route) const
+      {
+	const Node* n = find_node(root_const(route.addr.version()), key(route.addr, route.prefix_len), route.prefix_len);
+	return n ? &n->value : nullptr;
+      }
+
+      // Append the minimal route list covering the union of all
+      // routes in the trie: routes contained in another route are
+      // dropped, and sibling routes are merged into their parent.
+      void aggregate(RouteList& out) const
+      {
+	aggregate(root4.get(), Addr::V4, out);
+	aggregate(root6.get(), Addr::V6, out);
+      }
+
+      // Append the minimal route list covering the addresses of the
+      // families in vermask that no route in the trie contains,
+      // in address order.
+      void complement(RouteList& out, const Addr::VersionMask vermask) const
+      {
+	if (vermask & Addr::V4_MASK)
+	  gaps(Key(), 0, IPv4::Addr::SIZE, root4.get(), Addr::V4, out);
+	if (vermask & Addr::V6_MASK)
+	  gaps(Key(), 0, IPv6::Addr::SIZE, root6.get(), Addr::V6, out);
+      }
+
+      size_t size() const
+      {
+	return size_;
+      }
+
+      bool empty() const
+      {
+	return !size_;
+      }
+
+      void clear()
+      {
+	root4.reset();
+	root6.reset();
+	size_ = 0;
+      }
+
+    private:
+      // address bits, most significant first, left aligned
+      struct Key
+      {
+	std::uint64_t hi = 0;
+	std::uint64_t lo = 0;
+
+	unsigned int bit(const unsigned int i) const
+	{
+	  return i < 64 ? (hi >> (63 - i)) & 1 : (lo >> (127 - i)) & 1;
+	}
+
+	// number of leading bits shared with other, at most limit
+	unsigned int common(const Key& other, const unsigned int limit) const
+	{
+	  unsigned int n;
+	  const std::uint64_t xh = hi ^ other.hi;
+	  if (xh)
+	    n = clz64(xh);
+	  else
+	    {
+	      const std::uint64_t xl = lo ^ other.lo;
+	      n = xl ? 64 + clz64(xl) : 128;
+	    }
+	  return n < limit ? n : limit;
+	}
+
+	static unsigned int clz64(const std::uint64_t v) // v != 0
+	{
+	  const unsigned int h = (unsigned int)(v >> 32);
+	  if (h)
+	    return 32 - find_last_set(h);
+	  return 64 - find_last_set((unsigned int)v);
+	}
+      };
+
+      struct Node
+      {
+	Key key;                      // canonical prefix
+	unsigned int prefix_len = 0;
+	bool has_value = false;
+	T value;
+	std::unique_ptr<Node> child[2];
+      };
+
+      typedef std::unique_ptr<Node> NodePtr;
+
+      static Key mask(Key k, const unsigned int prefix_len)
+      {
+	if (prefix_len < 64)
+	  {
+	    k.hi = prefix_len ? k.hi & (~std::uint64_t(0) << (64 - prefix_len)) : 0;
+	    k.lo = 0;
+	  }
+	else if (prefix_len < 128)
+	  k.lo = prefix_len > 64 ? k.lo & (~std::uint64_t(0) << (128 - prefix_len)) : 0;
+	return k;
+      }
+
+      static Key key(const IPv4::Addr& a, const unsigned int prefix_len)
+      {
+	Key k;
+	k.hi = std::uint64_t(a.to_uint32()) << 32;
+	return mask(k, prefix_len);
+      }
+
+      static Key key(const IPv6::Addr& a, const unsigned int prefix_len)
+      {
+	unsigned char b[16];
+	a.to_byte_string(b);
+	Key k;
+	for (unsigned int i = 0; i < 8; ++i)
+	  {
+	    k.hi = (k.hi << 8) | b[i];
+	    k.lo = (k.lo << 8) | b[i + 8];
+	  }
+	return mask(k, prefix_len);
+      }
+
+      static Key with_bit(Key k, const unsigned int i)
+      {
+	if (i < 64)
+	  k.hi |= std::uint64_t(1) << (63 - i);
+	else
+	  k.lo |= std::uint64_t(1) << (127 - i);
+	return k;
+      }
+
+      static Route route(const Key& k, const unsigned int prefix_len, const Addr::Version v)
+      {
+	if (v == Addr::V6)
+	  {
+	    unsigned char b[16];
+	    for (unsigned int i = 0; i < 8; ++i)
+	      {
+		b[i] = (unsigned char)(k.hi >> (56 - 8 * i));
+		b[i + 8] = (unsigned char)(k.lo >> (56 - 8 * i));
+	      }
+	    return Route(Addr::from_ipv6(IPv6::Addr::from_byte_string(b)), prefix_len);
+	  }
+	else
+	  return Route(Addr::from_ipv4(IPv4::Addr::from_uint32((std::uint32_t)(k.hi >> 32))), prefix_len);
+      }
+
+      static void aggregate(const Node* n, const Addr::Version v, RouteList& out)
+      {
+	if (n && cover(n, v, out))
+	  out.push_back(route(n->key, n->prefix_len, v));
+      }
+
+      // Return true if n's prefix is entirely covered by routes,
+      // otherwise append the routes that cover n's subtree.
+      static bool cover(const Node* n, const Addr::Version v, RouteList& out)
+      {
+	if (n->has_value)
+	  return true;
+	bool half[2] = { false, false };
+	for (unsigned int b = 0; b < 2; ++b)
+	  {
+	    const Node* c = n->child[b].get();
+	    if (c && cover(c, v, out))
+	      {
+		if (c->prefix_len == n->prefix_len + 1)
+		  half[b] = true;
+		else
+		  out.push_back(route(c->key, c->prefix_len, v));
+	      }
+	  }
+	if (half[0] && half[1])
+	  return true;
+	for (unsigned int b = 0; b < 2; ++b)
+	  {
+	    if (half[b])
+	      out.push_back(route(n->child[b]->key, n->prefix_len + 1, v));
+	  }
+	return false;
+      }
+
+      // Append the parts of prefix k/plen not covered by the routes
+      // of subtree n, which lies within k/plen.
+      static void gaps(const Key& k,
+		       const unsigned int plen,
+		       const unsigned int width,
+		       const Node* n,
+		       const Addr::Version v,
+		       RouteList& out)
+      {
+	if (!n)
+	  {
+	    out.push_back(route(k, plen, v));
+	    return;
+	  }
+	if (n->prefix_len == plen)
+	  {
+	    if (n->has_value || plen >= width)
+	      return;
+	    gaps(k, plen + 1, width, n->child[0].get(), v, out);
+	    gaps(with_bit(k, plen), plen + 1, width, n->child[1].get(), v, out);
+	  }
+	else if (n->key.bit(plen))
+	  {
+	    out.push_back(route(k, plen + 1, v));
+	    gaps(with_bit(k, plen), plen + 1, width, n, v, out);
+	  }
+	else
+	  {
+	    gaps(k, plen + 1, width, n, v, out);
+	    out.push_back(route(with_bit(k, plen), plen + 1, v));
+	  }
+      }
+
+      static Key key(const Addr& a, const unsigned int prefix_len)
+      {
+	switch (a.version())
+	  {
+	  case Addr::V4:
+	    return key(a.to_ipv4_nocheck(), prefix_len);
+	  case Addr::V6:
+	    return key(a.to_ipv6_nocheck(), prefix_len);
+	  default:
+	    throw route_trie_error("address not defined");
+	  }
+      }
+
+      NodePtr& root(const Addr::Version v)
+      {
+	return v == Addr::V6 ? root6 : root4;
+      }
+
+      const Node* root_const(const Addr::Version v) const
+      {
+	return v == Addr::V6 ? root6.get() : root4.get();
+      }
+
+      bool insert(NodePtr& rootp, const Key& k, const unsigned int plen, T&& value)
+      {
+	NodePtr* slot = &rootp;
+	while (true)
+	  {
+	    Node* n = slot->get();
+	    if (!n)
+	      {
+		slot->reset(new Node);
+		(*slot)->key = k;
+		(*slot)->prefix_len = plen;
+		return set_value(**slot, std::move(value));
+	      }
+	    const unsigned int c = k.common(n->key, std::min(plen, n->prefix_len));
+	    if (c == n->prefix_len)
+	      {
+		if (plen == n->prefix_len)
+		  return set_value(*n, std::move(value));
+		slot = &n->child[k.bit(n->prefix_len)];
+		continue;
+	      }
+
+	    // diverges inside n's prefix: n moves under a new node
+	    NodePtr old(std::move(*slot));
+	    NodePtr mid(new Node);
+	    mid->key = mask(k, c);
+	    mid->prefix_len = c;
+	    const unsigned int obit = old->key.bit(c);
+	    mid->child[obit] = std::move(old);
+	    bool ret;
+	    if (c == plen)
+	      ret = set_value(*mid, std::move(value));
+	    else
+	      {
+		NodePtr leaf(new Node);
+		leaf->key = k;
+		leaf->prefix_len = plen;
+		ret = set_value(*leaf, std::move(value));
+		mid->child[obit ^ 1] = std::move(leaf);
+	      }
+	    *slot = std::move(mid);
+	    return ret;
+	  }
+      }
+
+      bool set_value(Node& n, T&& value)
+      {
+	n.value = std::move(value);
+	if (n.has_value)
+	  return false;
+	n.has_value = true;
+	++size_;
+	return true;
+      }
+
+      bool erase(NodePtr& rootp, const Key& k, const unsigned int plen)
+      {
+	NodePtr* parent = nullptr;
+	NodePtr* slot = &rootp;
+	while (Node* n = slot->get())
+	  {
+	    if (n->prefix_len > plen || k.common(n->key, n->prefix_len) < n->prefix_len)
+	      return false;
+	    if (n->prefix_len == plen)
+	      {
+		if (!n->has_value)
+		  return false;
+		n->has_value = false;
+		n->value = T();
+		--size_;
+		collapse(*slot);
+		if (parent && *parent && !(*parent)->has_value)
+		  collapse(*parent);
+		return true;
+	      }
+	    parent = slot;
+	    slot = &n->child[k.bit(n->prefix_len)];
+	  }
+	return false;
+      }
+
+      // remove a valueless node with fewer than two children
+      static void collapse(NodePtr& slot)
+      {
+	Node* n = slot.get();
+	if (!n || n->has_value || (n->child[0] && n->child[1]))
+	  return;
+	NodePtr only(std::move(n->child[0] ? n->child[0] : n->child[1]));
+	slot = std::move(only);
+      }
+
+      static const Node* find_node(const Node* n, const Key& k, const unsigned int plen)
+      {
+	while (n && n->prefix_len <= plen && k.common(n->key, n->prefix_len) == n->prefix_len)
+	  {
+	    if (n->prefix_len == plen)
+	      return n->has_value ? n : nullptr;
+	    n = n->child[k.bit(n->prefix_len)].get();
+	  }
+	return nullptr;
+      }
+
+      static const T* lookup(const Node* n, const Key& k, const unsigned int width)
+      {
+	const T* best = nullptr;
+	while (n && k.common(n->key, n->prefix_len) == n->prefix_len)
+	  {
+	    if (n->has_value)
+	      best = &n->value;
+	    if (n->prefix_len >= width)
+	      break;
+	    n = n->child[k.bit(n->prefix_len)].get();
+	  }
+	return best;
+      }
+
+      NodePtr root4;
+      NodePtr root6;
+      size_t size_;
+    };
+
+    // Split-tunnel decision table: the most specific matching
+    // include or exclude route decides whether an address is
+    // routed into the tunnel.
+    class RouteInclusionMap
+    {
+    public:
+      void include(const Route& route)
+      {
+	trie.insert(route, true);
+      }
+
+      void exclude(const Route& route)
+      {
+	trie.insert(route, false);
+      }
+
+      bool tunneled(const Addr& addr) const
+      {
+	const bool* v = trie.lookup(addr);
+	return v && *v;
+      }
+
+      size_t size() const
+      {
+	return trie.size();
+      }
+
+    private:
+      RouteTrie<bool> trie;
+    };
+  }
+}
+
+#endif
@@ -59,7 +59,8 @@ namespace openvpn {
 
       enum {
 	MAX_IV_LENGTH = 16,
-	CIPH_CBC_MODE = 0
+	CIPH_CBC_MODE = 0,
+	CIPH_CTR_MODE = 1
       };
 
       CipherContext()
@@ -77,6 +78,17 @@ namespace openvpn {
 	if (!(mode == ENCRYPT || mode == DECRYPT))
 	  throw apple_cipher_mode_error();
 
+	cinfo = CryptoAlgs::get_ptr(alg);
+
+	// CTR mode cryptors can't be reset to a new IV, so keep the key
+	// and create a fresh cryptor in reset()
+	if (alg == CryptoAlgs::AES_256_CTR)
+	  {
+	    ctr_mode = mode;
+	    std::memcpy(ctr_key, key, CryptoAlgs::key_length(alg));
+	    return;
+	  }
+
 	// initialize cipher context with cipher type
 	const CCCryptorStatus status = CCCryptorCreate(mode,
 						       cipher_type(alg),
@@ -86,14 +98,34 @@ namespace openvpn {
 						       nullptr,
 						       &cref);
 	if (status != kCCSuccess)
-	  throw CFException("CipherContext: CCCryptorCreate", status);
-
-	cinfo = CryptoAlgs::get_ptr(alg);
+	  {
+	    cinfo = nullptr;
+	    throw CFException("CipherContext: CCCryptorCreate", status);
+	  }
       }
 
       void reset(const unsigned char *iv)
       {
 	check_initialized();
+	if (ctr_mode >= 0)
+	  {
+	    if (cref)
+	      CCCryptorRelease(cref);
+	    cref = nullptr;
+	    const CCCryptorStatus status = CCCryptorCreateWithMode(ctr_mode,
+								   kCCModeCTR,
+								   kCCAlgorithmAES,
+								   ccNoPadding,
+								   iv,
+								   ctr_key,
+								   cinfo->key_length(),
+								   nullptr, 0, 0,
+								   kCCModeOptionCTR_BE,
+								   &cref);
+	    if (status != kCCSuccess)
+	      throw CFException("CipherContext: CCCryptorCreateWithMode", status);
+	    return;
+	  }
 	const CCCryptorStatus status = CCCryptorReset(cref, iv);
 	if (status != kCCSuccess)
 	  throw CFException("CipherContext: CCCryptorReset", status);
@@ -147,7 +179,7 @@ namespace openvpn {
       int cipher_mode() const
       {
 	check_initialized();
-	return CIPH_CBC_MODE;
+	return ctr_mode >= 0 ? CIPH_CTR_MODE : CIPH_CBC_MODE;
       }
 
     private:
@@ -181,6 +213,11 @@ namespace openvpn {
 	    cref = nullptr;
 	    cinfo = nullptr;
 	  }
+	if (ctr_mode >= 0)
+	  {
+	    std::memset(ctr_key, 0, sizeof(ctr_key));
+	    ctr_mode = -1;
+	  }
       }
 
       void check_initialized() const
@@ -193,6 +230,8 @@ namespace openvpn {
 
       const CryptoAlgs::Alg* cinfo;
       CCCryptorRef cref;
+      int ctr_mode = -1;              // ENCRYPT/DECRYPT for CTR mode, otherwise -1
+      unsigned char ctr_key[32];
     };
   }
 }
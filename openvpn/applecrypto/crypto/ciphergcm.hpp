@@ -0,0 +1,211 @@
+//    OpenVPN -- An application to securely tunnel IP networks
+//               over a single port, with support for SSL/TLS-based
+//               session authentication and key exchange,
+//               packet encryption, packet authentication, and
+//               packet compression.
+//
+//    Copyright (C) 2012-2016 OpenVPN Technologies, Inc.
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU Affero General Public License Version 3
+//    as published by the Free Software Foundation.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU Affero General Public License for more details.
+//
+//    You should have received a copy of the GNU Affero General Public License
+//    along with this program in the COPYING file.
+//    If not, see <http://www.gnu.org/licenses/>.
+
+// Wrap the Apple AES-GCM API so that it can be used by the
+// AEAD data channel (see openvpn/crypto/crypto_aead.hpp).
+
+#ifndef OPENVPN_APPLECRYPTO_CRYPTO_CIPHERGCM_H
+#define OPENVPN_APPLECRYPTO_CRYPTO_CIPHERGCM_H
+
+#include <string>
+#include <cstring>
+
+#include <CommonCrypto/CommonCryptor.h>
+
+#include <openvpn/common/size.hpp>
+#include <openvpn/common/exception.hpp>
+#include <openvpn/common/likely.hpp>
+#include <openvpn/crypto/static_key.hpp>
+#include <openvpn/crypto/cryptoalgs.hpp>
+#include <openvpn/applecrypto/cf/error.hpp>
+
+// The one-shot GCM functions of CommonCrypto are exported by
+// libcommonCrypto (macOS 10.13, iOS 11 and later) but only declared
+// in the SPI header, which is not part of the SDK.  The decrypt
+// variant verifies the tag in constant time before releasing any
+// plaintext.  They are weak-linked so that the binary still loads
+// on older systems, where is_supported() then returns false and
+// the data channel falls back to a CBC/HMAC cipher.
+extern "C" {
+  __attribute__((weak_import))
+  CCCryptorStatus CCCryptorGCMOneshotEncrypt(CCAlgorithm alg,
+					     const void *key, size_t keyLength,
+					     const void *iv, size_t ivLen,
+					     const void *aData, size_t aDataLen,
+					     const void *dataIn, size_t dataInLength,
+					     void *dataOut,
+					     void *tagOut, size_t tagLength);
+
+  __attribute__((weak_import))
+  CCCryptorStatus CCCryptorGCMOneshotDecrypt(CCAlgorithm alg,
+					     const void *key, size_t keyLength,
+					     const void *iv, size_t ivLen,
+					     const void *aData, size_t aDataLen,
+					     const void *dataIn, size_t dataInLength,
+					     void *dataOut,
+					     const void *tagIn, size_t tagLength);
+}
+
+namespace openvpn {
+  namespace AppleCrypto {
+    class CipherContextGCM
+    {
+      CipherContextGCM(const CipherContextGCM&) = delete;
+      CipherContextGCM& operator=(const CipherContextGCM&) = delete;
+
+    public:
+      OPENVPN_EXCEPTION(apple_gcm_error);
+
+      // mode parameter for constructor
+      enum {
+	MODE_UNDEF = -1,
+	ENCRYPT = kCCEncrypt,
+	DECRYPT = kCCDecrypt
+      };
+
+      // Apple cipher constants
+      enum {
+	IV_LEN = 12,
+	AUTH_TAG_LEN = 16,
+	SUPPORTS_IN_PLACE_ENCRYPT = 1, // CommonCrypto GCM allows input == output
+	SUPPORTS_IN_PLACE_DECRYPT = 1,
+      };
+
+      CipherContextGCM()
+	: keysize(0)
+      {
+      }
+
+      ~CipherContextGCM() { erase() ; }
+
+      // The one-shot API takes the key on each call, so keep a copy.
+      void init(const CryptoAlgs::Type alg,
+		const unsigned char *key,
+		const unsigned int keysize_arg,
+		const int mode) // unused
+      {
+	erase();
+	unsigned int ckeysz = 0;
+	if (!cipher_keysize(alg, ckeysz) || !gcm_available())
+	  OPENVPN_THROW(apple_gcm_error, CryptoAlgs::name(alg) << ": not usable");
+	if (ckeysz > keysize_arg)
+	  throw apple_gcm_error("insufficient key material");
+	std::memcpy(key_, key, ckeysz);
+	keysize = ckeysz;
+      }
+
+      void encrypt(const unsigned char *input,
+		   unsigned char *output,
+		   size_t length,
+		   const unsigned char *iv,
+		   unsigned char *tag,
+		   const unsigned char *ad,
+		   size_t ad_len)
+      {
+	check_initialized();
+	const CCCryptorStatus status = CCCryptorGCMOneshotEncrypt(kCCAlgorithmAES,
+								  key_, keysize,
+								  iv, IV_LEN,
+								  ad, ad_len,
+								  input, length,
+								  output,
+								  tag, AUTH_TAG_LEN);
+	if (unlikely(status != kCCSuccess))
+	  throw CFException("CipherContextGCM: CCCryptorGCMOneshotEncrypt", status);
+      }
+
+      // input and output may be equal, but must not partially overlap
+      bool decrypt(const unsigned char *input,
+		   unsigned char *output,
+		   size_t length,
+		   const unsigned char *iv,
+		   const unsigned char *tag,
+		   const unsigned char *ad,
+		   size_t ad_len)
+      {
+	check_initialized();
+	const CCCryptorStatus status = CCCryptorGCMOneshotDecrypt(kCCAlgorithmAES,
+								  key_, keysize,
+								  iv, IV_LEN,
+								  ad, ad_len,
+								  input, length,
+								  output,
+								  tag, AUTH_TAG_LEN);
+	return status == kCCSuccess;
+      }
+
+      bool is_initialized() const { return keysize != 0; }
+
+      // CommonCrypto has no ChaCha20-Poly1305, so only AES-GCM is
+      // usable, and only where the one-shot GCM functions exist
+      static bool is_supported(const CryptoAlgs::Type alg)
+      {
+	unsigned int keysize;
+	return cipher_keysize(alg, keysize) && gcm_available();
+      }
+
+    private:
+      // weak symbols resolve to null on systems without them
+      static bool gcm_available()
+      {
+	return &CCCryptorGCMOneshotEncrypt != nullptr && &CCCryptorGCMOneshotDecrypt != nullptr;
+      }
+
+      static bool cipher_keysize(const CryptoAlgs::Type alg, unsigned int& keysize)
+      {
+	switch (alg)
+	  {
+	  case CryptoAlgs::AES_128_GCM:
+	    keysize = 16;
+	    return true;
+	  case CryptoAlgs::AES_192_GCM:
+	    keysize = 24;
+	    return true;
+	  case CryptoAlgs::AES_256_GCM:
+	    keysize = 32;
+	    return true;
+	  default:
+	    return false;
+	  }
+      }
+
+      void erase()
+      {
+	if (keysize)
+	  {
+	    std::memset(key_, 0, sizeof(key_));
+	    keysize = 0;
+	  }
+      }
+
+      void check_initialized() const
+      {
+	if (unlikely(!keysize))
+	  throw apple_gcm_error("uninitialized");
+      }
+
+      unsigned int keysize;
+      unsigned char key_[32];
+    };
+  }
+}
+
+#endif
@@ -79,7 +79,7 @@ namespace openvpn {
 	state = PARTIAL;
       }
 
-      void reset() // Apple HMAC API is missing reset method, so we have to reinit
+      void reset() // Apple HMAC API is missing reset method, so we restore the keyed context
       {
 	cond_reset(true);
       }
@@ -119,8 +119,12 @@ namespace openvpn {
 	  case READY:
 	    if (!force_init)
 	      return;
+	    std::memcpy(&ctx, &keyed, sizeof(ctx));
+	    return;
 	  case PARTIAL:
-	    CCHmacInit(&ctx, hmac_alg, key_, key_size_);
+	    // key once, then restore the keyed context by copy
+	    CCHmacInit(&keyed, hmac_alg, key_, key_size_);
+	    std::memcpy(&ctx, &keyed, sizeof(ctx));
 	    state = READY;
 	  }
       }
@@ -137,6 +141,7 @@ namespace openvpn {
       size_t key_size_;
       size_t digest_size_;
       unsigned char key_[MAX_HMAC_KEY_SIZE];
+      CCHmacContext keyed; // state right after CCHmacInit
       CCHmacContext ctx;
     };
   }
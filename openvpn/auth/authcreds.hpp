@@ -75,6 +75,8 @@ namespace openvpn {
 	std::ostringstream os;
 	os << "*** AuthCreds ***" << std::endl;
 	os << "user: '" << username << "'" << std::endl;
+	if (session_token)
+	  os << "session token: verified" << std::endl;
 	//os << "pass: '" << password << "'" << std::endl;
 	os << "peer info:" << std::endl;
 	os << peer_info.render(Option::RENDER_BRACKET|Option::RENDER_NUMBER);
@@ -84,6 +86,10 @@ namespace openvpn {
       std::string username;
       SafeString password;
       OptionList peer_info;
+
+      // password was a session token, already verified by the
+      // server thread, so the auth backend may be skipped
+      bool session_token = false;
     };
 
 }
@@ -25,6 +25,7 @@
 #include <openvpn/common/exception.hpp>
 #include <openvpn/buffer/bufcomplete.hpp>
 #include <openvpn/buffer/buflist.hpp>
+#include <openvpn/buffer/bufrope.hpp>
 
 namespace openvpn {
   class BufferComposed
@@ -44,6 +45,16 @@ namespace openvpn {
 	return ret;
       }
 
+      // like get(), but hands over the buffers as they are
+      BufferRope get_rope()
+      {
+	BufferRope ret;
+	for (auto &b : bc.bv)
+	  ret.append(std::move(b));
+	bc.bv.clear();
+	return ret;
+      }
+
     private:
       friend class BufferComposed;
 
@@ -63,7 +63,9 @@
 #include <openvpn/common/abort.hpp>
 #include <openvpn/common/exception.hpp>
 #include <openvpn/common/rc.hpp>
+#include <openvpn/common/alloccount.hpp>
 #include <openvpn/buffer/bufclamp.hpp>
+#include <openvpn/buffer/bufpool.hpp>
 
 #ifdef OPENVPN_BUFFER_ABORT
 #define OPENVPN_BUFFER_THROW(exc) { std::abort(); }
@@ -427,7 +429,8 @@ namespace openvpn {
     }
 #endif
 
-    void realign(size_t headroom)
+    // returns true if the content had to be moved
+    bool realign(size_t headroom)
     {
       if (headroom != offset_)
 	{
@@ -435,7 +438,9 @@ namespace openvpn {
 	    OPENVPN_BUFFER_THROW(buffer_headroom);
 	  std::memmove(data_ + headroom, data_ + offset_, size_);
 	  offset_ = headroom;
+	  return true;
 	}
+      return false;
     }
 
     void write(const T* data, const size_t size)
@@ -563,6 +568,7 @@ namespace openvpn {
       DESTRUCT_ZERO  = (1<<1),  // if enabled, destructor will zero data before deletion
       GROW  = (1<<2),           // if enabled, buffer will grow (otherwise buffer_full exception will be thrown)
       ARRAY = (1<<3),           // if enabled, use as array
+      POOL  = (1<<4),           // if enabled, allocate from thread-local BufferPool
     };
 
     BufferAllocatedType()
@@ -577,7 +583,7 @@ namespace openvpn {
       capacity_ = capacity;
       if (capacity)
 	{
-	  data_ = new T[capacity];
+	  data_ = new_(capacity, flags);
 	  if (flags & CONSTRUCT_ZERO)
 	    std::memset(data_, 0, capacity * sizeof(T));
 	  if (flags & ARRAY)
@@ -591,7 +597,7 @@ namespace openvpn {
       size_ = capacity_ = size;
       if (size)
 	{
-	  data_ = new T[size];
+	  data_ = new_(size, flags);
 	  std::memcpy(data_, data, size * sizeof(T));
 	}
     }
@@ -604,7 +610,7 @@ namespace openvpn {
       flags_ = other.flags_;
       if (capacity_)
         {
-          data_ = new T[capacity_];
+          data_ = new_(capacity_, flags_);
           if (size_)
             std::memcpy(data_ + offset_, other.data_ + offset_, size_ * sizeof(T));
         }
@@ -620,7 +626,7 @@ namespace openvpn {
       flags_ = flags;
       if (capacity_)
 	{
-	  data_ = new T[capacity_];
+	  data_ = new_(capacity_, flags_);
 	  if (size_)
 	    std::memcpy(data_ + offset_, other.c_data(), size_ * sizeof(T));
 	}
@@ -635,12 +641,14 @@ namespace openvpn {
 	    {
 	      erase_();
 	      if (other.capacity_)
-		data_ = new T[other.capacity_];
+		data_ = new_(other.capacity_, other.flags_);
 	      capacity_ = other.capacity_;
+	      flags_ = other.flags_;
 	    }
+	  else
+	    set_flags_keep_pool(other.flags_);
 	  offset_ = other.offset_;
 	  size_ = other.size_;
-	  flags_ = other.flags_;
 	  if (size_)
 	    std::memcpy(data_ + offset_, other.data_ + offset_, size_ * sizeof(T));
 	}
@@ -649,16 +657,18 @@ namespace openvpn {
     void init(const size_t capacity, const unsigned int flags)
     {
       offset_ = size_ = 0;
-      flags_ = flags;
       if (capacity_ != capacity)
 	{
 	  erase_();
 	  if (capacity)
 	    {
-	      data_ = new T[capacity];
+	      data_ = new_(capacity, flags);
 	    }
 	  capacity_ = capacity;
+	  flags_ = flags;
 	}
+      else
+	set_flags_keep_pool(flags);
       if ((flags & CONSTRUCT_ZERO) && capacity)
 	std::memset(data_, 0, capacity * sizeof(T));
       if (flags & ARRAY)
@@ -668,14 +678,16 @@ namespace openvpn {
     void init(const T* data, const size_t size, const unsigned int flags)
     {
       offset_ = size_ = 0;
-      flags_ = flags;
       if (size != capacity_)
 	{
 	  erase_();
 	  if (size)
-	    data_ = new T[size];
+	    data_ = new_(size, flags);
 	  capacity_ = size;
+	  flags_ = flags;
 	}
+      else
+	set_flags_keep_pool(flags);
       size_ = size;
       std::memcpy(data_, data, size * sizeof(T));
     }
@@ -739,14 +751,15 @@ namespace openvpn {
       size_ = offset_ = 0;
     }
 
+    // POOL cannot be changed on an existing allocation
     void or_flags(const unsigned int flags)
     {
-      flags_ |= flags;
+      flags_ |= (flags & ~POOL);
     }
 
     void and_flags(const unsigned int flags)
     {
-      flags_ &= flags;
+      flags_ &= (flags | POOL);
     }
 
     ~BufferAllocatedType()
@@ -777,7 +790,8 @@ namespace openvpn {
 
     void realloc_(const size_t newcap)
     {
-      T* data = new T[newcap];
+      OPENVPN_ALLOC_COUNT(buffer_realloc);
+      T* data = new_(newcap, flags_);
       if (size_)
 	std::memcpy(data + offset_, data_ + offset_, size_ * sizeof(T));
       delete_(data_, capacity_, flags_);
@@ -808,11 +822,34 @@ namespace openvpn {
       capacity_ = 0;
     }
 
+    // Replace flags on a retained allocation, keeping the POOL
+    // bit that the allocation was made with.
+    void set_flags_keep_pool(const unsigned int flags)
+    {
+      if (data_)
+	flags_ = (flags & ~POOL) | (flags_ & POOL);
+      else
+	flags_ = flags;
+    }
+
+    static T* new_(const size_t capacity, const unsigned int flags)
+    {
+      OPENVPN_ALLOC_COUNT(buffer_alloc);
+      if (flags & POOL)
+	return static_cast<T*>(BufferPool::alloc(capacity * sizeof(T)));
+      else
+	return new T[capacity];
+    }
+
     static void delete_(T* data, const size_t size, const unsigned int flags)
     {
+      OPENVPN_ALLOC_COUNT(buffer_free);
       if (size && (flags & DESTRUCT_ZERO))
 	std::memset(data, 0, size * sizeof(T));
-      delete [] data;
+      if (flags & POOL)
+	BufferPool::release(data, size * sizeof(T));
+      else
+	delete [] data;
     }
 
     unsigned int flags_;
@@ -0,0 +1,148 @@
+//    OpenVPN -- An application to securely tunnel IP networks
+//               over a single port, with support for SSL/TLS-based
+//               session authentication and key exchange,
+//               packet encryption, packet authentication, and
+//               packet compression.
+//
+//    Copyright (C) 2012-2016 OpenVPN Technologies, Inc.
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU Affero General Public License Version 3
+//    as published by the Free Software Foundation.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU Affero General Public License for more details.
+//
+//    You should have received a copy of the GNU Affero General Public License
+//    along with this program in the COPYING file.
+//    If not, see <http://www.gnu.org/licenses/>.
+
+// Thread-local, size-classed pool of raw memory blocks used by
+// BufferAllocated when the POOL flag is set.  Blocks are grouped
+// into power-of-two size classes, and freed blocks are kept on a
+// per-thread free list for reuse, so that steady-state packet
+// forwarding does no heap allocation.
+
+#ifndef OPENVPN_BUFFER_BUFPOOL_H
+#define OPENVPN_BUFFER_BUFPOOL_H
+
+#include <cstddef>
+#include <new>
+#include <vector>
+
+namespace openvpn {
+  namespace BufferPool {
+
+    enum {
+      MIN_CLASS_SHIFT = 8,       // smallest class is 256 bytes
+      MAX_CLASS_SHIFT = 16,      // largest class is 64 KB
+      N_CLASSES = MAX_CLASS_SHIFT - MIN_CLASS_SHIFT + 1,
+      MAX_FREE_PER_CLASS = 1024, // cap on cached blocks per class per thread
+    };
+
+    // Return the size class index for a block of the given size,
+    // or -1 if the size is too large to be pooled.
+    inline int size_class(const size_t bytes)
+    {
+      int cls = 0;
+      size_t cap = size_t(1) << MIN_CLASS_SHIFT;
+      while (cap < bytes)
+	{
+	  if (++cls >= N_CLASSES)
+	    return -1;
+	  cap <<= 1;
+	}
+      return cls;
+    }
+
+    inline size_t class_size(const int cls)
+    {
+      return size_t(1) << (cls + MIN_CLASS_SHIFT);
+    }
+
+    class FreeList
+    {
+    public:
+      FreeList()
+      {
+	destroyed() = false;
+      }
+
+      ~FreeList()
+      {
+	destroyed() = true;
+	for (auto &l : lists)
+	  for (auto p : l)
+	    ::operator delete(p);
+      }
+
+      void* alloc(const int cls)
+      {
+	std::vector<void*>& l = lists[cls];
+	if (!l.empty())
+	  {
+	    void* p = l.back();
+	    l.pop_back();
+	    return p;
+	  }
+	return ::operator new(class_size(cls));
+      }
+
+      void release(void* p, const int cls)
+      {
+	std::vector<void*>& l = lists[cls];
+	if (l.size() < MAX_FREE_PER_CLASS)
+	  l.push_back(p);
+	else
+	  ::operator delete(p);
+      }
+
+      size_t n_free(const int cls) const
+      {
+	return lists[cls].size();
+      }
+
+      // true once this thread's free list has been destroyed,
+      // so that buffers released during thread/static teardown
+      // go straight back to the heap
+      static bool& destroyed()
+      {
+	static thread_local bool d = false;
+	return d;
+      }
+
+    private:
+      std::vector<void*> lists[N_CLASSES];
+    };
+
+    inline FreeList& local()
+    {
+      static thread_local FreeList fl;
+      return fl;
+    }
+
+    inline void* alloc(const size_t bytes)
+    {
+      const int cls = size_class(bytes);
+      if (cls < 0 || FreeList::destroyed())
+	return ::operator new(bytes);
+      return local().alloc(cls);
+    }
+
+    inline void release(void* p, const size_t bytes)
+    {
+      if (!p)
+	return;
+      const int cls = size_class(bytes);
+      if (cls < 0 || FreeList::destroyed())
+	::operator delete(p);
+      else
+	local().release(p, cls);
+    }
+
+  }
+}
+
+#endif
@@ -0,0 +1,188 @@
+//    OpenVPN -- An application to securely tunnel IP networks
+//               over a single port, with support for SSL/TLS-based
+//               session authentication and key exchange,
+//               packet encryption, packet authentication, and
+//               packet compression.
+//
+//    Copyright (C) 2012-2016 OpenVPN Technologies, Inc.
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU Affero General Public License Version 3
+//    as published by the Free Software Foundation.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU Affero General Public License for more details.
+//
+//    You should have received a copy of the GNU Affero General Public License
+//    along with this program in the COPYING file.
+//    If not, see <http://www.gnu.org/licenses/>.
+
+// A message held as a chain of refcounted, frame-sized chunks, so
+// that large control-channel messages (PUSH_REPLY, auth payloads,
+// certificate chains) can travel between the application and the
+// SSL layer without ever being linearized into one big buffer.
+
+#ifndef OPENVPN_BUFFER_BUFROPE_H
+#define OPENVPN_BUFFER_BUFROPE_H
+
+#include <string>
+#include <cstring>
+#include <utility>
+#include <algorithm>
+
+#include <openvpn/common/exception.hpp>
+#include <openvpn/buffer/buffer.hpp>
+#include <openvpn/buffer/buflist.hpp>
+
+namespace openvpn {
+
+  class BufferRope
+  {
+  public:
+    OPENVPN_SIMPLE_EXCEPTION(buffer_rope_range);
+
+    // chunk_size bounds the chunks allocated by write(), normally
+    // the payload size of the frame context the chunks are bound for
+    explicit BufferRope(const size_t chunk_size_arg = 1024)
+      : chunk_size(std::max(chunk_size_arg, size_t(1))),
+	size_(0)
+    {
+    }
+
+    // Take ownership of a chunk without copying it.
+    void append(BufferPtr bp)
+    {
+      if (bp && bp->size())
+	{
+	  size_ += bp->size();
+	  chunks_.push_back(std::move(bp));
+	}
+    }
+
+    // Copy data in, topping up the last chunk before starting a new one.
+    void write(const unsigned char *data, size_t len)
+    {
+      while (len)
+	{
+	  if (chunks_.empty() || !chunks_.back()->remaining())
+	    chunks_.emplace_back(new BufferAllocated(chunk_size, 0));
+	  Buffer& b = *chunks_.back();
+	  const size_t n = std::min(len, b.remaining());
+	  b.write(data, n);
+	  data += n;
+	  len -= n;
+	  size_ += n;
+	}
+    }
+
+    void write(const std::string& str)
+    {
+      write((const unsigned char *)str.c_str(), str.length());
+    }
+
+    void push_back(const unsigned char c)
+    {
+      write(&c, 1);
+    }
+
+    size_t size() const { return size_; }
+    bool empty() const { return !size_; }
+    size_t n_chunks() const { return chunks_.size(); }
+    const BufferVector& chunks() const { return chunks_; }
+
+    // Byte at pos, for peeking at headers and terminators.
+    unsigned char operator[](size_t pos) const
+    {
+      for (auto &b : chunks_)
+	{
+	  if (pos < b->size())
+	    return (*b)[pos];
+	  pos -= b->size();
+	}
+      throw buffer_rope_range();
+    }
+
+    bool starts_with(const void *prefix, const size_t len) const
+    {
+      if (len > size_)
+	return false;
+      const unsigned char *p = (const unsigned char *)prefix;
+      size_t done = 0;
+      for (auto &b : chunks_)
+	{
+	  const size_t n = std::min(len - done, b->size());
+	  if (std::memcmp(b->c_data(), p + done, n))
+	    return false;
+	  done += n;
+	  if (done == len)
+	    break;
+	}
+      return true;
+    }
+
+    // Copy [pos, pos+len) straight out of the chunks.
+    template <typename S>
+    S to_string(size_t pos, size_t len) const
+    {
+      if (pos > size_)
+	throw buffer_rope_range();
+      len = std::min(len, size_ - pos);
+      S ret;
+      ret.reserve(len);
+      for (auto &b : chunks_)
+	{
+	  if (!len)
+	    break;
+	  if (pos >= b->size())
+	    {
+	      pos -= b->size();
+	      continue;
+	    }
+	  const size_t n = std::min(len, b->size() - pos);
+	  ret.append((const char *)b->c_data() + pos, n);
+	  pos = 0;
+	  len -= n;
+	}
+      return ret;
+    }
+
+    std::string to_string() const
+    {
+      return to_string<std::string>(0, size_);
+    }
+
+    // For consumers that need contiguous data.  Free if there is
+    // only one chunk.
+    BufferPtr join() const
+    {
+      if (chunks_.empty())
+	return BufferPtr(new BufferAllocated());
+      return chunks_.join();
+    }
+
+    // Hand the chunks over, leaving the rope empty.
+    BufferVector release()
+    {
+      BufferVector ret;
+      ret.swap(chunks_);
+      size_ = 0;
+      return ret;
+    }
+
+    void clear()
+    {
+      chunks_.clear();
+      size_ = 0;
+    }
+
+  private:
+    size_t chunk_size;
+    size_t size_;
+    BufferVector chunks_;
+  };
+
+}
+
+#endif
@@ -0,0 +1,131 @@
+//    OpenVPN -- An application to securely tunnel IP networks
+//               over a single port, with support for SSL/TLS-based
+//               session authentication and key exchange,
+//               packet encryption, packet authentication, and
+//               packet compression.
+//
+//    Copyright (C) 2012-2016 OpenVPN Technologies, Inc.
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU Affero General Public License Version 3
+//    as published by the Free Software Foundation.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU Affero General Public License for more details.
+//
+//    You should have received a copy of the GNU Affero General Public License
+//    along with this program in the COPYING file.
+//    If not, see <http://www.gnu.org/licenses/>.
+
+// Cache of parsed client profiles, so that evaluating the same
+// profile again (reconnect, or a new OpenVPNClient in the same
+// process) skips option list parsing.
+
+#ifndef OPENVPN_CLIENT_CLICONFCACHE_H
+#define OPENVPN_CLIENT_CLICONFCACHE_H
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <functional>
+
+#include <openvpn/common/size.hpp>
+#include <openvpn/common/options.hpp>
+#include <openvpn/client/cliopthelper.hpp>
+
+namespace openvpn {
+
+  class ClientConfigCache
+  {
+  public:
+    ClientConfigCache(const size_t max_entries_arg = 4)
+      : max_entries(max_entries_arg)
+    {
+    }
+
+    // Same as ParseClientConfig::parse, but reuses the result of an
+    // earlier parse of an identical profile.  Profiles that fail to
+    // parse are not cached.
+    ParseClientConfig parse(const std::string& content,
+			    OptionList::KeyValueList* content_list,
+			    OptionList& options)
+    {
+      std::string key = profile_key(content, content_list);
+      const size_t hash = std::hash<std::string>()(key);
+      {
+	std::lock_guard<std::mutex> lock(mutex);
+	for (auto &e : entries)
+	  {
+	    if (e->hash == hash && e->key == key)
+	      {
+		options = e->options;
+		return e->pcc;
+	      }
+	  }
+      }
+
+      const ParseClientConfig pcc = ParseClientConfig::parse(content, content_list, options);
+      if (!pcc.error() && max_entries)
+	{
+	  std::lock_guard<std::mutex> lock(mutex);
+	  if (entries.size() >= max_entries)
+	    entries.erase(entries.begin());
+	  entries.emplace_back(new Entry(hash, std::move(key), options, pcc));
+	}
+      return pcc;
+    }
+
+    void clear()
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      entries.clear();
+    }
+
+  private:
+    struct Entry
+    {
+      Entry(const size_t hash_arg,
+	    std::string&& key_arg,
+	    const OptionList& options_arg,
+	    const ParseClientConfig& pcc_arg)
+	: hash(hash_arg),
+	  key(std::move(key_arg)),
+	  options(options_arg),
+	  pcc(pcc_arg)
+      {
+      }
+
+      size_t hash;
+      std::string key; // full profile, compared to rule out hash collisions
+      OptionList options;
+      ParseClientConfig pcc;
+    };
+
+    static std::string profile_key(const std::string& content,
+				   const OptionList::KeyValueList* content_list)
+    {
+      std::string key = content;
+      if (content_list)
+	{
+	  for (auto &kv : *content_list)
+	    {
+	      key += '\0';
+	      key += kv->key;
+	      key += '\0';
+	      key += kv->value;
+	    }
+	}
+      return key;
+    }
+
+    const size_t max_entries;
+    std::mutex mutex;
+    std::vector<std::unique_ptr<Entry>> entries; // oldest first
+  };
+
+}
+
+#endif
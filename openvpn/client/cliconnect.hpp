@@ -50,6 +50,7 @@
 #define OPENVPN_CLIENT_CLICONNECT_H
 
 #include <memory>
+#include <vector>
 
 #include <openvpn/common/rc.hpp>
 #include <openvpn/error/excode.hpp>
@@ -74,6 +75,10 @@ namespace openvpn {
 
     OPENVPN_SIMPLE_EXCEPTION(client_connect_unhandled_exception);
 
+    enum {
+      MIGRATE_PROBE_SECONDS = 3, // renegotiate if server is silent this long after migrate
+    };
+
     ClientConnect(asio::io_context& io_context_arg,
 		  const ClientOptions::Ptr& client_options_arg)
       : generation(0),
@@ -88,7 +93,9 @@ namespace openvpn {
 	server_poll_timer(io_context_arg),
 	restart_wait_timer(io_context_arg),
 	conn_timer(io_context_arg),
-	conn_timer_pending(false)
+	conn_timer_pending(false),
+	race_timer(io_context_arg),
+	prewarm_timer(io_context_arg)
     {
     }
 
@@ -140,6 +147,7 @@ namespace openvpn {
 	      client->tun_set_disconnect();
 	      client->stop(false);
 	    }
+	  race_stop();
 	  cancel_timers();
 	  asio_work.reset();
 
@@ -183,6 +191,7 @@ namespace openvpn {
 	      client->stop(false);
 	      interim_finalize();
 	    }
+	  race_stop();
 	  cancel_timers();
 	  asio_work.reset(new asio::io_context::work(io_context));
 	  ClientEvent::Base::Ptr ev = new ClientEvent::Pause(reason);
@@ -220,6 +229,28 @@ namespace openvpn {
 	}
     }
 
+    // Try to move the session to a new network path (such as after
+    // a Wi-Fi to cellular handover) while keeping its keys, and fall
+    // back to an immediate reconnect if that isn't possible.
+    void migrate()
+    {
+      if (!halt && !paused)
+	{
+	  if (client && client->migrate(Time::Duration::seconds(MIGRATE_PROBE_SECONDS)))
+	    return;
+	  reconnect(0);
+	}
+    }
+
+    void thread_safe_migrate()
+    {
+      if (!halt)
+	asio::post(io_context, [self=Ptr(this)]()
+		   {
+		     self->migrate();
+		   });
+    }
+
     void thread_safe_pause(const std::string& reason)
     {
       if (!halt)
@@ -258,6 +289,165 @@ namespace openvpn {
     }
 
   private:
+    // A parallel connection attempt started in racing mode
+    // (Happy Eyeballs).  The first attempt, including the primary
+    // client, to complete its TLS handshake wins and the rest are
+    // stopped.  Once it has won, a Racer simply forwards
+    // notifications to the parent.
+    class Racer : public ClientProto::NotifyCallback,
+		  public RC<thread_unsafe_refcount>
+    {
+    public:
+      typedef RCPtr<Racer> Ptr;
+
+      Racer(ClientConnect* parent_arg)
+	: parent(parent_arg)
+      {
+      }
+
+      ClientConnect* parent;
+      Client::Ptr client;
+      RemoteList::Ptr remote_list;
+      Time start;
+      bool failed = false;
+      bool won = false;
+
+    private:
+      virtual void client_proto_terminate()
+      {
+	if (won)
+	  parent->client_proto_terminate();
+	else
+	  {
+	    failed = true;
+	    parent->client_options->remote_score_update(remote_list.get(), false, Time::Duration());
+	    parent->race_lost();
+	  }
+      }
+
+      virtual void client_proto_connected()
+      {
+	if (won)
+	  parent->client_proto_connected();
+      }
+
+      virtual void client_proto_active()
+      {
+	if (!won)
+	  parent->race_won(this);
+      }
+    };
+
+    // schedule the next racing attempt, if any remain
+    void race_schedule()
+    {
+      if (racers.size() < race_count)
+	{
+	  race_timer.expires_at(Time::now() + client_options->race_stagger());
+	  race_timer.async_wait([self=Ptr(this), gen=generation](const asio::error_code& error)
+				{
+				  self->race_timer_callback(gen, error);
+				});
+	}
+    }
+
+    void race_timer_callback(unsigned int gen, const asio::error_code& e)
+    {
+      if (!e && gen == generation && !halt && !paused && race_count)
+	{
+	  Racer::Ptr r(new Racer(this));
+	  Client::Config::Ptr cli_config = client_options->client_config_race(racers.size() + 1, r->remote_list);
+	  r->client.reset(new Client(io_context, *cli_config, r.get()));
+	  r->start = Time::now();
+	  racers.push_back(r);
+	  OPENVPN_LOG("Racing connection attempt " << racers.size() << " to "
+		      << r->remote_list->current_server_host() << ' '
+		      << r->remote_list->current_transport_protocol().str());
+	  race_schedule();
+	  r->client->start();
+	}
+    }
+
+    // return true if a racing attempt might still win
+    bool race_pending() const
+    {
+      if (!race_count)
+	return false;
+      if (racers.size() < race_count)
+	return true;
+      for (auto& r : racers)
+	{
+	  if (!r->failed)
+	    return true;
+	}
+      return false;
+    }
+
+    void race_won(Racer* r)
+    {
+      if (halt || !race_count)
+	return;
+      OPENVPN_LOG("Racing connection attempt to " << r->remote_list->current_server_host() << " won");
+      r->won = true;
+      race_winner.reset(r);
+      attempt_active = true;
+      client_options->remote_score_update(r->remote_list.get(), true, Time::now() - r->start);
+      race_timer.cancel();
+      for (auto& o : racers)
+	{
+	  if (o.get() != r)
+	    o->client->stop(false);
+	}
+      race_count = 0;
+      if (client)
+	client->stop(false);
+      client = r->client;
+      client_options->race_adopt(*r->remote_list);
+    }
+
+    void race_lost()
+    {
+      if (!halt && race_primary_failed && !race_pending())
+	{
+	  race_count = 0;
+	  queue_restart();
+	}
+    }
+
+    // Stop any racing attempts that haven't won.  Racer objects are
+    // retained until the next generation since they are the notify
+    // callbacks of their (now halted) clients.
+    void race_stop()
+    {
+      race_timer.cancel();
+      for (auto& r : racers)
+	{
+	  if (!r->won)
+	    r->client->stop(false);
+	}
+      race_count = 0;
+    }
+
+    virtual void client_proto_active()
+    {
+      attempt_active = true;
+      client_options->remote_score_update(nullptr, true, Time::now() - attempt_start);
+
+      // primary client won the race
+      if (race_count)
+	race_stop();
+    }
+
+    // the current attempt didn't make it through the TLS handshake
+    void attempt_failed()
+    {
+      if (!attempt_active)
+	{
+	  attempt_active = true; // count each attempt only once
+	  client_options->remote_score_update(nullptr, false, Time::Duration());
+	}
+    }
+
     void interim_finalize()
     {
       if (!client_finalized)
@@ -279,6 +469,48 @@ namespace openvpn {
       server_poll_timer.cancel();
       conn_timer.cancel();
       conn_timer_pending = false;
+      prewarm_stop();
+    }
+
+    // Failover pre-warming: while connected, keep the DNS cache of the
+    // remote list fresh, so that a reconnect only costs the handshake.
+    struct PrewarmDone : public RemoteList::PreResolve::NotifyCallback
+    {
+      virtual void pre_resolve_done() {}
+    };
+
+    void prewarm_schedule()
+    {
+      const Time::Duration interval = client_options->prewarm_interval();
+      if (!interval.enabled())
+	return;
+      prewarm_timer.expires_at(Time::now() + interval);
+      prewarm_timer.async_wait([self=Ptr(this), gen=generation](const asio::error_code& error)
+			       {
+				 self->prewarm_callback(gen, error);
+			       });
+    }
+
+    void prewarm_callback(unsigned int gen, const asio::error_code& e)
+    {
+      if (!e && gen == generation && !halt && client && client->reached_connected_state())
+	{
+	  if (!prewarm)
+	    prewarm.reset(new RemoteList::PreResolve(io_context,
+						     client_options->remote_list_precache(),
+						     client_options->stats_ptr()));
+
+	  // also refresh entries that would go stale before the next pass
+	  prewarm->refresh(&prewarm_done, client_options->prewarm_interval() * 2);
+	  prewarm_schedule();
+	}
+    }
+
+    void prewarm_stop()
+    {
+      prewarm_timer.cancel();
+      if (prewarm)
+	prewarm->cancel();
     }
 
     void restart_wait_callback(unsigned int gen, const asio::error_code& e)
@@ -301,6 +533,7 @@ namespace openvpn {
       if (!e && gen == generation && !halt && !client->first_packet_received())
 	{
 	  OPENVPN_LOG("Server poll timeout, trying next remote entry...");
+	  attempt_failed();
 	  new_client();
 	}
     }
@@ -309,6 +542,7 @@ namespace openvpn {
     {
       if (!e && !halt)
 	{
+	  attempt_failed();
 	  client_options->stats().error(Error::CONNECTION_TIMEOUT);
 	  if (!paused && client_options->pause_on_connection_timeout())
 	    {
@@ -368,6 +602,8 @@ namespace openvpn {
 	      lifecycle_started = true;
 	    }
 	}
+
+      prewarm_schedule();
     }
 
     void queue_restart(const unsigned int delay = 2)
@@ -387,7 +623,15 @@ namespace openvpn {
     {
       if (!halt)
 	{
-	  if (dont_restart_)
+	  attempt_failed();
+	  if (race_pending() && !dont_restart_
+	      && (client->fatal() == Error::UNDEF || client->fatal() == Error::TRANSPORT_ERROR))
+	    {
+	      // let the remaining racing attempts play out
+	      OPENVPN_LOG("Primary connection attempt failed, waiting for racing attempts...");
+	      race_primary_failed = true;
+	    }
+	  else if (dont_restart_)
 	    {
 	      stop();
 	    }
@@ -539,6 +783,14 @@ namespace openvpn {
 	  if (!(client && client->reached_connected_state()))
 	    client_options->next();
 	}
+      race_stop();
+      prewarm_stop();
+      racers.clear();
+      race_winner.reset();
+      race_primary_failed = false;
+      attempt_active = false;
+      attempt_start = Time::now();
+
       Client::Config::Ptr cli_config = client_options->client_config(); // client_config in cliopt.hpp
       client.reset(new Client(io_context, *cli_config, this)); // build ClientProto::Session from cliproto.hpp
       client_finalized = false;
@@ -553,6 +805,8 @@ namespace openvpn {
                                        });
 	}
       conn_timer_start();
+      race_count = client_options->race_count();
+      race_schedule();
       client->start();
     }
 
@@ -594,6 +848,22 @@ namespace openvpn {
     bool conn_timer_pending;
     std::unique_ptr<asio::io_context::work> asio_work;
     RemoteList::PreResolve::Ptr pre_resolve;
+
+    // Happy Eyeballs racing state
+    AsioTimer race_timer;
+    std::vector<Racer::Ptr> racers;
+    Racer::Ptr race_winner;
+    size_t race_count = 0;
+    bool race_primary_failed = false;
+
+    // failover pre-warming state
+    AsioTimer prewarm_timer;
+    RemoteList::PreResolve::Ptr prewarm;
+    PrewarmDone prewarm_done;
+
+    // remote scoreboard state for the current attempt
+    Time attempt_start;
+    bool attempt_active = false;
   };
 
 }
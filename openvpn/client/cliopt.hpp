@@ -49,12 +49,15 @@
 #include <openvpn/transport/client/udpcli.hpp>
 #include <openvpn/transport/client/tcpcli.hpp>
 #include <openvpn/transport/client/httpcli.hpp>
+#include <openvpn/transport/client/socks5cli.hpp>
+#include <openvpn/transport/client/multipath.hpp>
 #include <openvpn/transport/altproxy.hpp>
 #include <openvpn/transport/dco.hpp>
 #include <openvpn/client/cliproto.hpp>
 #include <openvpn/client/cliopthelper.hpp>
 #include <openvpn/client/optfilt.hpp>
 #include <openvpn/client/clilife.hpp>
+#include <openvpn/client/remotescore.hpp>
 
 #include <openvpn/ssl/sslchoose.hpp>
 
@@ -90,6 +93,10 @@
 #include <openvpn/tun/client/tunnull.hpp>
 #endif
 
+#if defined(USE_TUN_BUILDER)
+#include <openvpn/tun/builder/pktbridge.hpp>
+#endif
+
 #ifdef PRIVATE_TUNNEL_PROXY
 #include <openvpn/pt/ptproxy.hpp>
 #endif
@@ -98,6 +105,11 @@
 #include <openvpn/dco/dcocli.hpp>
 #endif
 
+#if defined(OPENVPN_PLATFORM_LINUX) && !defined(OPENVPN_FORCE_TUN_NULL) && !defined(OPENVPN_CUSTOM_TUN_FACTORY) && !defined(USE_TUN_BUILDER)
+#define OPENVPN_DC_THREADS
+#include <openvpn/dco/threadcli.hpp>
+#endif
+
 #ifndef OPENVPN_UNUSED_OPTIONS
 #define OPENVPN_UNUSED_OPTIONS "UNUSED OPTIONS"
 #endif
@@ -118,16 +130,27 @@ namespace openvpn {
       Protocol proto_override;
       IPv6Setting ipv6;
       int conn_timeout = 0;
+      int race_count = 0;
+      int race_stagger_ms = 250;
+      int dns_cache_lifetime = 0;
+      std::string remote_score_file;
       SessionStats::Ptr cli_stats;
       ClientEvent::Queue::Ptr cli_events;
       ProtoContextOptions::Ptr proto_context_options;
       HTTPProxyTransport::Options::Ptr http_proxy_options;
       bool alt_proxy = false;
       bool dco = false;
+      bool dc_threads = false; // data channel on TX/RX threads (see ThreadedDCO)
+      int dc_threads_core = -1; // pin TX thread here, RX thread on the next core
       bool echo = false;
       bool info = false;
       bool tun_persist = false;
+      bool tun_ring_buffer = false;
       bool google_dns_fallback = false;
+      int timer_leeway_ms = 0;
+      bool keepalive_idle = false;
+      int busy_poll_us = 0;
+      bool tls_session_cache = false; // resume TLS sessions on reconnect
       std::string private_key_password;
       bool disable_client_cert = false;
       int ssl_debug_level = 0;
@@ -136,6 +159,7 @@ namespace openvpn {
       bool autologin_sessions = false;
       std::string tls_version_min_override;
       PeerInfo::Set::Ptr extra_peer_info;
+      PacketCapture::Ptr packet_capture;
 #ifdef OPENVPN_GREMLIN
       Gremlin::Config::Ptr gremlin_config;
 #endif
@@ -149,6 +173,7 @@ namespace openvpn {
 
 #if defined(USE_TUN_BUILDER)
       TunBuilderBase* builder = nullptr;
+      TunBuilderClient::PacketBridge::Ptr packet_bridge;
 #endif
     };
 
@@ -163,9 +188,12 @@ namespace openvpn {
 	server_override(config.server_override),
 	proto_override(config.proto_override),
 	conn_timeout_(config.conn_timeout),
+	race_count_(config.remote_override ? 0 : std::max(config.race_count, 0)),
+	race_stagger_ms(std::max(config.race_stagger_ms, 0)),
 	tcp_queue_limit(64),
 	proto_context_options(config.proto_context_options),
 	http_proxy_options(config.http_proxy_options),
+	packet_capture(config.packet_capture),
 #ifdef OPENVPN_GREMLIN
 	gremlin_config(config.gremlin_config),
 #endif
@@ -197,15 +225,109 @@ namespace openvpn {
       if (config.dco)
 	throw option_error("DCO not enabled in this build");
 #endif
+#if defined(OPENVPN_DC_THREADS)
+      if (config.dc_threads && !dco)
+	dco = ThreadedDCO::new_controller(config.dc_threads_core,
+					  config.dc_threads_core >= 0 ? config.dc_threads_core + 1 : -1);
+#else
+      if (config.dc_threads)
+	throw option_error("threaded data channel not supported in this build");
+#endif
 
       // frame
       const unsigned int tun_mtu = parse_tun_mtu(opt, 0); // get tun-mtu parameter from config
       const MSSCtrlParms mc(opt);
+#ifdef OPENVPN_FRAME_PLAN
+      // size data-path buffers to the worst-case pipeline overhead
+      // rather than the generic 512-byte headroom/tailroom
+      const FramePlan frame_plan;
+      frame = frame_init(true, tun_mtu, mc.mssfix_ctrl, true, &frame_plan);
+#else
       frame = frame_init(true, tun_mtu, mc.mssfix_ctrl, true);
+#endif
 
       // TCP queue limit
       tcp_queue_limit = opt.get_num<decltype(tcp_queue_limit)>("tcp-queue-limit", 1, tcp_queue_limit, 1, 65536);
 
+      // flow queueing and AQM ahead of the TCP transport queue
+      fq_codel = opt.exists("fq-codel");
+
+      // TCP Fast Open for the TCP transport
+      tcp_fast_open = opt.exists("tcp-fastopen");
+
+      // read the TCP stream in large chunks and decrypt packets in
+      // place, "tcp-recv-ring [bytes]"
+      if (opt.exists("tcp-recv-ring"))
+	tcp_recv_ring = opt.get_num<size_t>("tcp-recv-ring", 1, 65536, 4096, 16*1024*1024);
+
+      // copy inner DSCP/ECN to the outer UDP header, and outer CE inward
+      pass_tos = opt.exists("passtos");
+
+      // UDP socket buffers, and autotuning on kernel drops
+      rcvbuf = opt.get_num<int>("rcvbuf", 1, 0, 0, 64*1024*1024);
+      sndbuf = opt.get_num<int>("sndbuf", 1, 0, 0, 64*1024*1024);
+      if (opt.exists("sockbuf-autotune"))
+	sockbuf_autotune_max = opt.get_num<int>("sockbuf-autotune", 1, 4*1024*1024, 64*1024, 64*1024*1024);
+
+      // batched UDP receive, and coalesced UDP sends, optionally
+      // as one GSO send
+      if (opt.exists("udp-recv-batch"))
+	udp_recv_batch = opt.get_num<unsigned int>("udp-recv-batch", 1, 64, 1, 1024);
+      if (opt.exists("udp-send-queue"))
+	udp_send_queue = opt.get_num<unsigned int>("udp-send-queue", 1, 64, 1, 1024);
+      udp_gso = opt.exists("udp-gso");
+
+      // multipath UDP, one sub-flow per local interface,
+      // "multipath dev1 dev2 ..."
+      {
+	const Option* o = opt.get_ptr("multipath");
+	if (o)
+	  {
+	    o->min_args(3);
+	    for (size_t i = 1; i < o->size(); ++i)
+	      multipath_devs.push_back(o->get(i, 64));
+	  }
+      }
+
+      // inner packet classifier, one "pkt-rule" directive per rule
+      {
+	const OptionList::IndexList* pr = opt.get_index_ptr("pkt-rule");
+	if (pr)
+	  {
+	    classifier.reset(new IPClass::Classifier());
+	    for (OptionList::IndexList::const_iterator i = pr->begin(); i != pr->end(); ++i)
+	      {
+		const Option& o = opt[*i];
+		o.touch();
+		std::string text;
+		for (size_t j = 1; j < o.size(); ++j)
+		  {
+		    if (j > 1)
+		      text += ' ';
+		    text += o.get(j, 256);
+		  }
+		classifier->add(IPClass::Rule::parse(text));
+	      }
+	  }
+      }
+
+      // answer pushed-DNS queries from a cache inside the client,
+      // "dns-stub [max-entries]"
+      if (opt.exists("dns-stub"))
+	{
+	  DNSStub::Config dc;
+	  dc.max_entries = opt.get_num<size_t>("dns-stub", 1, dc.max_entries, 16, 1024*1024);
+	  dns_stub.reset(new DNSStub::Resolver(dc));
+	}
+
+      // align connected-session timer wakeups
+      if (config.timer_leeway_ms > 0)
+	timer_leeway = Time::Duration::milliseconds(config.timer_leeway_ms);
+
+      // latency mode, also let the kernel busy poll the UDP socket
+      if (config.busy_poll_us > 0)
+	busy_poll_us = config.busy_poll_us;
+
       // route-nopull
       pushed_options_filter.reset(new PushedOptionsFilter(opt.exists("route-nopull")));
 
@@ -213,7 +335,10 @@ namespace openvpn {
       SSLLib::SSLAPI::Config::Ptr cc(new SSLLib::SSLAPI::Config());
       cc->set_external_pki_callback(config.external_pki);
       cc->set_frame(frame);
-      cc->set_flags(SSLConst::LOG_VERIFY_STATUS);
+      unsigned int ssl_flags = SSLConst::LOG_VERIFY_STATUS;
+      if (config.tls_session_cache)
+	ssl_flags |= SSLConst::ENABLE_SESSION_CACHE;
+      cc->set_flags(ssl_flags);
       cc->set_debug_level(config.ssl_debug_level);
       cc->set_rng(rng);
       cc->set_local_cert_enabled(pcc.clientCertEnabled() && !config.disable_client_cert);
@@ -229,11 +354,13 @@ namespace openvpn {
       cp->dc.set_factory(new CryptoDCSelect<SSLLib::CryptoAPI>(frame, cli_stats, prng));
       cp->dc_deferred = true; // defer data channel setup until after options pull
       cp->tls_auth_factory.reset(new CryptoOvpnHMACFactory<SSLLib::CryptoAPI>());
+      cp->tls_crypt_factory.reset(new CryptoTLSCryptFactory<SSLLib::CryptoAPI>());
       cp->tlsprf_factory.reset(new CryptoTLSPRFFactory<SSLLib::CryptoAPI>());
       cp->ssl_factory = cc->new_factory();
       cp->load(opt, *proto_context_options, config.default_key_direction, false);
       cp->set_xmit_creds(!autologin || pcc.hasEmbeddedPassword() || autologin_sessions);
       cp->gui_version = config.gui_version;
+      cp->keepalive_idle = config.keepalive_idle;
       cp->force_aes_cbc_ciphersuites = config.force_aes_cbc_ciphersuites; // also used to disable proto V2
       cp->extra_peer_info = build_peer_info(config, pcc, autologin_sessions);
       cp->frame = frame;
@@ -250,6 +377,10 @@ namespace openvpn {
       if (!http_proxy_options)
 	http_proxy_options = HTTPProxyTransport::Options::parse(opt);
 
+      // SOCKS proxy, only used if there is no HTTP proxy
+      if (!http_proxy_options)
+	socks_proxy_options = Socks5Transport::Options::parse(opt);
+
       // load remote list
       if (config.remote_override)
 	  remote_list.reset(new RemoteList(config.remote_override));
@@ -266,6 +397,10 @@ namespace openvpn {
       // reconnections.
       remote_list->set_enable_cache(config.tun_persist);
 
+      // reuse DNS results across reconnects while they are fresh
+      if (config.dns_cache_lifetime > 0)
+	remote_list->set_cache_lifetime(Time::Duration::seconds(config.dns_cache_lifetime));
+
       // process server override
       remote_list->set_server_override(config.server_override);
 
@@ -277,6 +412,20 @@ namespace openvpn {
       if (opt.exists("remote-random"))
 	remote_list->randomize();
 
+      // rank remotes by the health and latency seen on earlier runs
+      if (!config.remote_score_file.empty())
+	{
+	  remote_score.reset(new RemoteScoreboard(config.remote_score_file, rng));
+	  remote_score->load();
+	  if (!remote_score->empty())
+	    {
+	      const std::time_t now = std::time(nullptr);
+	      remote_list->rank([this, now](const RemoteList::Item& item) {
+		  return remote_score->expected_latency(item.key(), now);
+		});
+	    }
+	}
+
       // get "float" option
       server_addr_float = opt.exists("float");
 
@@ -291,6 +440,11 @@ namespace openvpn {
 	  remote_list->set_enable_cache(false); // remote server addresses will be resolved by proxy
 	  http_proxy_options->proxy_server_set_enable_cache(config.tun_persist);
 	}
+      else if (socks_proxy_options)
+	{
+	  remote_list->set_enable_cache(false); // remote server addresses will be resolved by proxy
+	  socks_proxy_options->proxy_server_set_enable_cache(config.tun_persist);
+	}
 
       // secret option not supported
       if (opt.exists("secret"))
@@ -334,6 +488,7 @@ namespace openvpn {
 	  {
 	    TunBuilderClient::ClientConfig::Ptr tunconf = TunBuilderClient::ClientConfig::new_obj();
 	    tunconf->builder = config.builder;
+	    tunconf->packet_bridge = config.packet_bridge;
 	    tunconf->tun_prop.session_name = session_name;
 	    tunconf->tun_prop.google_dns_fallback = config.google_dns_fallback;
 	    if (tun_mtu)
@@ -400,6 +555,7 @@ namespace openvpn {
 	    tunconf->frame = frame;
 	    tunconf->stats = cli_stats;
 	    tunconf->stop = config.stop;
+	    tunconf->ring_buffer = config.tun_ring_buffer;
 	    if (config.tun_persist)
 	      tunconf->tun_persist.reset(new TunWin::TunPersist(true, false, nullptr));
 #ifdef OPENVPN_COMMAND_AGENT
@@ -428,6 +584,9 @@ namespace openvpn {
 	  server_poll_timeout_ = parse_number_throw<unsigned int>(o->get(1, 16), "server-poll-timeout");
       }
 
+      // while connected, periodically re-resolve the failover remotes
+      prewarm_interval_ = opt.get_num<unsigned int>("prewarm-interval", 1, 0, 0, 86400);
+
       // create default creds object in case submit_creds is not called,
       // and populate it with embedded creds, if available
       {
@@ -547,6 +706,9 @@ namespace openvpn {
       // not persist across client instantiations.
       cli_config->proto_context_config.reset(new Client::ProtoConfig(*cp));
 
+      // resume the TLS session from the last connection to this remote
+      cp->ssl_factory->set_session_cache_key(remote_list->current_session_cache_key());
+
       cli_config->proto_context_options = proto_context_options;
       cli_config->push_base = push_base;
       cli_config->transport_factory = transport_factory;
@@ -556,9 +718,15 @@ namespace openvpn {
       cli_config->creds = creds;
       cli_config->pushed_options_filter = pushed_options_filter;
       cli_config->tcp_queue_limit = tcp_queue_limit;
+      cli_config->fq_codel = fq_codel;
+      cli_config->classifier = classifier;
+      cli_config->pass_tos = pass_tos;
+      cli_config->dns_stub = dns_stub;
+      cli_config->timer_leeway = timer_leeway;
       cli_config->echo = echo;
       cli_config->info = info;
       cli_config->autologin_sessions = autologin_sessions;
+      cli_config->packet_capture = packet_capture;
       return cli_config;
     }
 
@@ -596,6 +764,76 @@ namespace openvpn {
 
     int conn_timeout() const { return conn_timeout_; }
 
+    // Number of extra connection attempts to race against the
+    // current remote, or 0 if racing is disabled.  Racing is only
+    // possible when each attempt can own its own transport, which
+    // excludes proxied and DCO transports.
+    size_t race_count() const
+    {
+      if (alt_proxy || http_proxy_options || socks_proxy_options || dco || remote_list->size() < 2)
+	return 0;
+      return std::min(size_t(race_count_), remote_list->size() - 1);
+    }
+
+    Time::Duration race_stagger() const
+    {
+      return Time::Duration::milliseconds(race_stagger_ms);
+    }
+
+    // Interval for refreshing the DNS cache of the remote list while
+    // connected, so a failover does not wait for name resolution.
+    // Zero if disabled or if there is no DNS cache lifetime to refresh.
+    Time::Duration prewarm_interval() const
+    {
+      if (!prewarm_interval_ || !remote_list->get_cache_lifetime().enabled())
+	return Time::Duration();
+      return Time::Duration::seconds(prewarm_interval_);
+    }
+
+    // Build a client config for a racing attempt against the remote
+    // n entries past the current one.  The forked remote list that
+    // the attempt walks is returned in rl_out, so that the winner's
+    // position can later be adopted by race_adopt().
+    Client::Config::Ptr client_config_race(const size_t n, RemoteList::Ptr& rl_out)
+    {
+      rl_out = remote_list->fork(n);
+      Client::Config::Ptr cli_config = client_config();
+      cli_config->proto_context_config->set_protocol(rl_out->current_transport_protocol());
+      cli_config->transport_factory = new_transport_factory(rl_out);
+      cp->ssl_factory->set_session_cache_key(rl_out->current_session_cache_key());
+      return cli_config;
+    }
+
+    // Record the outcome of a connection attempt against the current
+    // entry of rl (or of our own remote list if rl is null) in the
+    // persistent remote scoreboard, if enabled.
+    void remote_score_update(const RemoteList* rl, const bool success, const Time::Duration& rtt)
+    {
+      if (!remote_score)
+	return;
+      if (!rl)
+	rl = remote_list.get();
+      try {
+	const std::string key = rl->current_item().key();
+	if (success)
+	  remote_score->success(key, rtt);
+	else
+	  remote_score->failure(key);
+	remote_score->save();
+      }
+      catch (const std::exception& e)
+	{
+	  OPENVPN_LOG("remote scoreboard error: " << e.what());
+	}
+    }
+
+    // continue from the position of a racing attempt that won
+    void race_adopt(const RemoteList& rl)
+    {
+      remote_list->adopt_index(rl);
+      load_transport_config();
+    }
+
     RemoteList::Ptr remote_list_precache() const
     {
       RemoteList::Ptr r;
@@ -611,6 +849,12 @@ namespace openvpn {
 	  if (r)
 	    return r;
 	}
+      if (socks_proxy_options)
+	{
+	  socks_proxy_options->proxy_server_precache(r);
+	  if (r)
+	    return r;
+	}
       return remote_list;
     }
 
@@ -634,6 +878,15 @@ namespace openvpn {
       // set transport protocol in Client::ProtoConfig
       cp->set_protocol(transport_protocol);
 
+      // construct transport factory for current remote
+      transport_factory = new_transport_factory(remote_list);
+      return remote_list->current_server_host();
+    }
+
+    TransportClientFactory::Ptr new_transport_factory(const RemoteList::Ptr& rl)
+    {
+      const Protocol& transport_protocol = rl->current_transport_protocol();
+
       // If we are connecting over a proxy, and TCP protocol is required, but current
       // transport protocol is NOT TCP, we will throw an internal error because this
       // should have been caught earlier in RemoteList::handle_proto_override.
@@ -643,24 +896,24 @@ namespace openvpn {
 	{
 	  DCO::TransportConfig transconf;
 	  transconf.protocol = transport_protocol;
-	  transconf.remote_list = remote_list;
+	  transconf.remote_list = rl;
 	  transconf.frame = frame;
 	  transconf.stats = cli_stats;
 	  transconf.server_addr_float = server_addr_float;
-	  transport_factory = dco->new_transport_factory(transconf);
+	  return dco->new_transport_factory(transconf);
 	}
       else if (alt_proxy)
 	{
 	  if (alt_proxy->requires_tcp() && !transport_protocol.is_tcp())
 	    throw option_error("internal error: no TCP server entries for " + alt_proxy->name() + " transport");
 	  AltProxy::Config conf;
-	  conf.remote_list = remote_list;
+	  conf.remote_list = rl;
 	  conf.frame = frame;
 	  conf.stats = cli_stats;
 	  conf.digest_factory.reset(new CryptoDigestFactory<SSLLib::CryptoAPI>());
 	  conf.socket_protect = socket_protect;
 	  conf.rng = rng;
-	  transport_factory = alt_proxy->new_transport_client_factory(conf);
+	  return alt_proxy->new_transport_client_factory(conf);
 	}
       else if (http_proxy_options)
 	{
@@ -669,7 +922,7 @@ namespace openvpn {
 
 	  // HTTP Proxy transport
 	  HTTPProxyTransport::ClientConfig::Ptr httpconf = HTTPProxyTransport::ClientConfig::new_obj();
-	  httpconf->remote_list = remote_list;
+	  httpconf->remote_list = rl;
 	  httpconf->frame = frame;
 	  httpconf->stats = cli_stats;
 	  httpconf->digest_factory.reset(new CryptoDigestFactory<SSLLib::CryptoAPI>());
@@ -679,41 +932,80 @@ namespace openvpn {
 #ifdef PRIVATE_TUNNEL_PROXY
 	  httpconf->skip_html = true;
 #endif
-	  transport_factory = httpconf;
+	  return httpconf;
+	}
+      else if (socks_proxy_options)
+	{
+	  // SOCKS5 Proxy transport, TCP via CONNECT or UDP via UDP ASSOCIATE
+	  Socks5Transport::ClientConfig::Ptr socksconf = Socks5Transport::ClientConfig::new_obj();
+	  socksconf->remote_list = rl;
+	  socksconf->frame = frame;
+	  socksconf->stats = cli_stats;
+	  socksconf->socket_protect = socket_protect;
+	  socksconf->socks_proxy_options = socks_proxy_options;
+	  return socksconf;
 	}
       else
 	{
-	  if (transport_protocol.is_udp())
+	  if (transport_protocol.is_udp() && !multipath_devs.empty())
+	    {
+	      // multipath UDP transport, one UDP sub-flow per device
+	      MultipathTransport::ClientConfig::Ptr mpconf = MultipathTransport::ClientConfig::new_obj();
+	      mpconf->stats = cli_stats;
+	      for (const auto& dev : multipath_devs)
+		{
+		  UDPTransport::ClientConfig::Ptr udpconf = new_udp_config(rl);
+		  udpconf->bind_dev = dev;
+		  mpconf->paths.push_back(udpconf);
+		}
+	      return mpconf;
+	    }
+	  else if (transport_protocol.is_udp())
 	    {
 	      // UDP transport
-	      UDPTransport::ClientConfig::Ptr udpconf = UDPTransport::ClientConfig::new_obj();
-	      udpconf->remote_list = remote_list;
-	      udpconf->frame = frame;
-	      udpconf->stats = cli_stats;
-	      udpconf->socket_protect = socket_protect;
-	      udpconf->server_addr_float = server_addr_float;
-#ifdef OPENVPN_GREMLIN
-	      udpconf->gremlin_config = gremlin_config;
-#endif
-	      transport_factory = udpconf;
+	      return new_udp_config(rl);
 	    }
 	  else if (transport_protocol.is_tcp())
 	    {
 	      // TCP transport
 	      TCPTransport::ClientConfig::Ptr tcpconf = TCPTransport::ClientConfig::new_obj();
-	      tcpconf->remote_list = remote_list;
+	      tcpconf->remote_list = rl;
 	      tcpconf->frame = frame;
 	      tcpconf->stats = cli_stats;
 	      tcpconf->socket_protect = socket_protect;
+	      tcpconf->fast_open = tcp_fast_open;
+	      tcpconf->recv_ring_size = tcp_recv_ring;
 #ifdef OPENVPN_GREMLIN
 	      tcpconf->gremlin_config = gremlin_config;
 #endif
-	      transport_factory = tcpconf;
+	      return tcpconf;
 	    }
 	  else
 	    throw option_error("internal error: unknown transport protocol");
 	}
-      return remote_list->current_server_host();
+    }
+
+    UDPTransport::ClientConfig::Ptr new_udp_config(const RemoteList::Ptr& rl)
+    {
+      UDPTransport::ClientConfig::Ptr udpconf = UDPTransport::ClientConfig::new_obj();
+      udpconf->remote_list = rl;
+      udpconf->frame = frame;
+      udpconf->stats = cli_stats;
+      udpconf->socket_protect = socket_protect;
+      udpconf->server_addr_float = server_addr_float;
+      udpconf->pmtu_probe = cp->pmtud;
+      udpconf->pass_tos = pass_tos;
+      udpconf->rcvbuf = rcvbuf;
+      udpconf->sndbuf = sndbuf;
+      udpconf->sockbuf_autotune_max = sockbuf_autotune_max;
+      udpconf->busy_poll_us = busy_poll_us;
+      udpconf->recv_batch_size = udp_recv_batch;
+      udpconf->send_queue_size = udp_send_queue;
+      udpconf->send_gso = udp_gso;
+#ifdef OPENVPN_GREMLIN
+      udpconf->gremlin_config = gremlin_config;
+#endif
+      return udpconf;
     }
 
     Time now_; // current time
@@ -723,6 +1015,7 @@ namespace openvpn {
     SSLLib::SSLAPI::Config cc;
     Client::ProtoConfig::Ptr cp;
     RemoteList::Ptr remote_list;
+    RemoteScoreboard::Ptr remote_score;
     bool server_addr_float;
     TransportClientFactory::Ptr transport_factory;
     TunClientFactory::Ptr tun_factory;
@@ -735,9 +1028,29 @@ namespace openvpn {
     std::string server_override;
     Protocol proto_override;
     int conn_timeout_;
+    int race_count_;
+    int race_stagger_ms;
+    unsigned int prewarm_interval_ = 0;
     unsigned int tcp_queue_limit;
+    bool fq_codel = false;
+    bool tcp_fast_open = false;
+    size_t tcp_recv_ring = 0;
+    IPClass::Classifier::Ptr classifier;
+    bool pass_tos = false;
+    DNSStub::Resolver::Ptr dns_stub;
+    int rcvbuf = 0;
+    int sndbuf = 0;
+    int sockbuf_autotune_max = 0;
+    int busy_poll_us = 0;
+    unsigned int udp_recv_batch = 0;
+    unsigned int udp_send_queue = 0;
+    bool udp_gso = false;
+    std::vector<std::string> multipath_devs;
+    Time::Duration timer_leeway;
     ProtoContextOptions::Ptr proto_context_options;
     HTTPProxyTransport::Options::Ptr http_proxy_options;
+    Socks5Transport::Options::Ptr socks_proxy_options;
+    PacketCapture::Ptr packet_capture;
 #ifdef OPENVPN_GREMLIN
     Gremlin::Config::Ptr gremlin_config;
 #endif
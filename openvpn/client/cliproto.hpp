@@ -63,6 +63,11 @@
 #include <openvpn/error/excode.hpp>
 
 #include <openvpn/ssl/proto.hpp>
+#include <openvpn/log/pktcap.hpp>
+#include <openvpn/tun/fqcodel.hpp>
+#include <openvpn/ip/pktclass.hpp>
+#include <openvpn/ip/ecn.hpp>
+#include <openvpn/ip/dnsstub.hpp>
 
 #ifdef OPENVPN_DEBUG_CLIPROTO
 #define OPENVPN_LOG_CLIPROTO(x) OPENVPN_LOG(x)
@@ -76,6 +81,7 @@ namespace openvpn {
     struct NotifyCallback {
       virtual void client_proto_terminate() = 0;
       virtual void client_proto_connected() {}
+      virtual void client_proto_active() {} // TLS handshake completed
     };
 
     class Session : ProtoContext,
@@ -127,7 +133,14 @@ namespace openvpn {
 	ClientCreds::Ptr creds;
 	OptionList::Limits pushed_options_limit;
 	OptionList::FilterBase::Ptr pushed_options_filter;
+	OptionListContinuation::ChunkHandler* push_chunk_handler = nullptr; // validates push fragments as they arrive
+	PacketCapture::Ptr packet_capture;
 	unsigned int tcp_queue_limit = 0;
+	bool fq_codel = false; // schedule tun packets by flow ahead of a transport send queue
+	IPClass::Classifier::Ptr classifier; // optional policy rules for tun packets
+	bool pass_tos = false; // copy inner TOS to the transport, and outer CE marks inward
+	DNSStub::Resolver::Ptr dns_stub; // optional cache in front of the pushed DNS servers
+	Time::Duration timer_leeway; // if defined, align timer wakeups to this boundary
 	bool echo = false;
 	bool info = false;
 	bool autologin_sessions = false;
@@ -141,6 +154,10 @@ namespace openvpn {
 	  transport_factory(config.transport_factory),
 	  tun_factory(config.tun_factory),
 	  tcp_queue_limit(config.tcp_queue_limit),
+	  timer_leeway(config.timer_leeway),
+	  classifier(config.classifier),
+	  pass_tos(config.pass_tos),
+	  dns_stub(config.dns_stub),
 	  notify_callback(notify_callback_arg),
 	  housekeeping_timer(io_context_arg),
 	  push_request_timer(io_context_arg),
@@ -155,18 +172,24 @@ namespace openvpn {
 	  pushed_options_limit(config.pushed_options_limit),
 	  pushed_options_filter(config.pushed_options_filter),
 	  inactive_timer(io_context_arg),
-	  info_hold_timer(io_context_arg)
+	  info_hold_timer(io_context_arg),
+	  migrate_timer(io_context_arg),
+	  reorder_timer(io_context_arg),
+	  packet_capture(config.packet_capture),
+	  capture_session_id(packet_capture ? packet_capture->new_session_id() : 0)
       {
-#ifdef OPENVPN_PACKET_LOG
-	packet_log.open(OPENVPN_PACKET_LOG, std::ios::binary);
-	if (!packet_log)
-	  OPENVPN_THROW(open_file_error, "cannot open packet log for output: " << OPENVPN_PACKET_LOG);
-#endif
+	received_options.set_chunk_handler(config.push_chunk_handler);
 	Base::update_now();
 	Base::reset();
 	//Base::enable_strict_openvpn_2x();
 
 	info_hold.reset(new std::vector<ClientEvent::Base::Ptr>());
+	if (config.fq_codel)
+	  fq.reset(new FQCoDel(FQCoDel::Config()));
+
+	// TCP already delivers in order
+	if (Base::conf().reorder && Base::is_udp())
+	  reorder.reset(new DataReorder(Base::conf().reorder_config));
       }
 
       bool first_packet_received() const { return first_packet_received_; }
@@ -208,6 +231,8 @@ namespace openvpn {
 	    push_request_timer.cancel();
 	    inactive_timer.cancel();
 	    info_hold_timer.cancel();
+	    migrate_timer.cancel();
+	    reorder_timer.cancel();
 	    if (notify_callback && call_terminate_callback)
 	      notify_callback->client_proto_terminate();
 	    if (tun)
@@ -224,6 +249,29 @@ namespace openvpn {
 
       bool reached_connected_state() const { return bool(connected_); }
 
+      // Move the session to a new network path, such as after a
+      // network change, without a new handshake.  The transport
+      // reopens its socket and we keep sending with the current keys
+      // and peer-id, so that the server floats us to the new address.
+      // If nothing is heard from the server within probe_window, we
+      // renegotiate.  Returns false if migration isn't possible, in
+      // which case the caller should reconnect instead.
+      bool migrate(const Time::Duration& probe_window)
+      {
+	if (halt || !transport || !connected_ || Base::conf().remote_peer_id < 0)
+	  return false;
+	if (!transport->transport_rebind())
+	  return false;
+	Base::update_now();
+	migrate_heard = false;
+	migrate_timer.expires_at(now() + probe_window);
+	migrate_timer.async_wait([self=Ptr(this)](const asio::error_code& error)
+                                 {
+                                   self->migrate_probe_callback(error);
+                                 });
+	return true;
+      }
+
       // If fatal() returns something other than Error::UNDEF, it
       // is intended to flag the higher levels (cliconnect.hpp)
       // that special handling is required.  This handling might include
@@ -244,17 +292,38 @@ namespace openvpn {
 	return true;
       }
 
+      // transport obj calls here with incoming packets and their outer
+      // TOS, when pass_tos is enabled
+      virtual void transport_recv_tos(BufferAllocated& buf, const unsigned int tos)
+      {
+	recv_ce = pass_tos && (tos & IPECN::MASK) == IPECN::CE;
+	transport_recv(buf);
+	recv_ce = false;
+      }
+
+      // data packets that decrypt in place are processed straight
+      // from the transport's receive buffer
+      virtual bool transport_recv_in_place(BufferAllocated& buf)
+      {
+	if (reorder || !Base::data_decrypt_in_place(Base::packet_type(buf)))
+	  return false;
+	transport_recv(buf);
+	return true;
+      }
+
       // transport obj calls here with incoming packets
       virtual void transport_recv(BufferAllocated& buf)
       {
 	try {
 	  OPENVPN_LOG_CLIPROTO("Transport RECV " << server_endpoint_render() << ' ' << Base::dump_packet(buf));
+	  capture(PacketCapture::WIRE_IN, buf);
 
 	  // update current time
 	  Base::update_now();
 
 	  // update last packet received
 	  stat().update_last_packet_received(now());
+	  migrate_heard = true;
 
 	  // log connecting event (only on first packet received)
 	  if (!first_packet_received_)
@@ -272,18 +341,31 @@ namespace openvpn {
 	    {
 	      // data packet
 	      Base::data_decrypt(pt, buf);
+	      if (reorder)
+		reorder_push(buf);
 	      if (buf.size())
+		tun_deliver(buf);
+	      else
 		{
-#ifdef OPENVPN_PACKET_LOG
-		  log_packet(buf, false);
-#endif
-		  // make packet appear as incoming on tun interface
-		  if (tun)
+		  // bundled packets
+		  BufferAllocated** bufs;
+		  const size_t n = Base::data_unbundled(bufs);
+		  if (n && tun)
 		    {
-		      OPENVPN_LOG_CLIPROTO("TUN send, size=" << buf.size());
-		      tun->tun_send(buf);
+		      for (size_t i = 0; i < n; ++i)
+			{
+			  if (recv_ce)
+			    IPECN::set_ce(*bufs[i]);
+			  capture(PacketCapture::TUN_OUT, *bufs[i]);
+			  if (dns_stub && !dns_response(*bufs[i]))
+			    bufs[i]->reset_size();
+			}
+		      OPENVPN_LOG_CLIPROTO("TUN send bundle, n=" << n);
+		      tun->tun_send_batch(bufs, n);
 		    }
 		}
+	      if (reorder)
+		reorder_release();
 
 	      // do a lightweight flush
 	      Base::flush(false);
@@ -322,6 +404,18 @@ namespace openvpn {
 
       virtual void transport_needs_send()
       {
+	if (!fq || halt || fq->empty())
+	  return;
+	try {
+	  Base::update_now();
+	  fq_send();
+	  Base::flush(false);
+	  set_housekeeping_timer();
+	}
+	catch (const std::exception& e)
+	  {
+	    process_exception(e, "transport_needs_send");
+	  }
       }
 
       // tun i/o driver calls here with incoming packets
@@ -333,10 +427,23 @@ namespace openvpn {
 	  // update current time
 	  Base::update_now();
 
-	  // log packet
-#ifdef OPENVPN_PACKET_LOG
-	  log_packet(buf, true);
-#endif
+	  capture(PacketCapture::TUN_IN, buf);
+
+	  if (classifier && !classify(buf))
+	    return;
+
+	  if (dns_stub && !dns_query(buf))
+	    return;
+
+	  // let fq-codel choose what the transport queue gets next
+	  if (fq && transport_has_send_queue)
+	    {
+	      fq->enqueue(buf, Base::now(), flow_hash(buf));
+	      fq_send();
+	      Base::flush(false);
+	      set_housekeeping_timer();
+	      return;
+	    }
 
 	  // if transport layer has an output queue, check if it's full
 	  if (transport_has_send_queue)
@@ -351,12 +458,14 @@ namespace openvpn {
 	  // encrypt packet
 	  if (buf.size())
 	    {
+	      const unsigned int tos = pass_tos ? IPECN::tos(buf) : 0;
 	      Base::data_encrypt(buf);
 	      if (buf.size())
 		{
 		  // send packet via transport to destination
 		  OPENVPN_LOG_CLIPROTO("Transport SEND " << server_endpoint_render() << ' ' << Base::dump_packet(buf));
-		  if (transport->transport_send(buf))
+		  capture(PacketCapture::WIRE_OUT, buf);
+		  if (transport->transport_send_tos(buf, tos))
 		    Base::update_last_sent();
 		  else if (halt)
 		    return;
@@ -375,6 +484,88 @@ namespace openvpn {
 	  }
       }
 
+      // tun i/o driver calls here with packets read together,
+      // which lets the data channel bundle small ones
+      virtual void tun_recv_batch(BufferAllocated** bufs, const size_t n)
+      {
+	try {
+	  OPENVPN_LOG_CLIPROTO("TUN recv batch, n=" << n);
+
+	  // update current time
+	  Base::update_now();
+
+	  if (fq && transport_has_send_queue)
+	    {
+	      for (size_t i = 0; i < n; ++i)
+		{
+		  capture(PacketCapture::TUN_IN, *bufs[i]);
+		  if (classifier)
+		    classify(*bufs[i]);
+		  if (dns_stub && bufs[i]->size())
+		    dns_query(*bufs[i]);
+		  if (bufs[i]->size())
+		    fq->enqueue(*bufs[i], Base::now(), flow_hash(*bufs[i]));
+		}
+	      fq_send();
+	      Base::flush(false);
+	      set_housekeeping_timer();
+	      return;
+	    }
+
+	  for (size_t i = 0; i < n; ++i)
+	    {
+	      capture(PacketCapture::TUN_IN, *bufs[i]);
+	      if (classifier && !classify(*bufs[i]))
+		continue;
+	      if (dns_stub && !dns_query(*bufs[i]))
+		continue;
+
+	      // if transport layer has an output queue, check if it's full
+	      if (transport_has_send_queue
+		  && transport->transport_send_queue_size() > tcp_queue_limit)
+		{
+		  bufs[i]->reset_size(); // queue full, drop packet
+		  cli_stats->error(Error::TCP_OVERFLOW);
+		}
+	    }
+
+	  // a bundle goes out with the TOS of its first packet
+	  if (pass_tos)
+	    {
+	      batch_tos.resize(n);
+	      for (size_t i = 0; i < n; ++i)
+		batch_tos[i] = IPECN::tos(*bufs[i]);
+	    }
+
+	  // encrypt packets, some may have been merged into others
+	  Base::data_encrypt_batch(bufs, n);
+	  for (size_t i = 0; i < n; ++i)
+	    {
+	      BufferAllocated& buf = *bufs[i];
+	      if (buf.size())
+		{
+		  // send packet via transport to destination
+		  OPENVPN_LOG_CLIPROTO("Transport SEND " << server_endpoint_render() << ' ' << Base::dump_packet(buf));
+		  capture(PacketCapture::WIRE_OUT, buf);
+		  if (transport->transport_send_tos(buf, pass_tos ? batch_tos[i] : 0))
+		    Base::update_last_sent();
+		  else if (halt)
+		    return;
+		}
+	    }
+
+	  // do a lightweight flush
+	  Base::flush(false);
+
+	  // schedule housekeeping wakeup
+	  set_housekeeping_timer();
+	}
+	catch (const std::exception& e)
+	  {
+	    process_exception(e, "tun_recv_batch");
+	  }
+      }
+
       // Return true if keepalive parameter(s) are enabled.
       virtual bool is_keepalive_enabled() const
       {
@@ -504,6 +695,7 @@ namespace openvpn {
       virtual void control_net_send(const Buffer& net_buf)
       {
 	OPENVPN_LOG_CLIPROTO("Transport SEND " << server_endpoint_render() << ' ' << Base::dump_packet(net_buf));
+	capture(PacketCapture::WIRE_OUT, net_buf);
 	if (transport->transport_send_const(net_buf))
 	  Base::update_last_sent();
       }
@@ -511,8 +703,18 @@ namespace openvpn {
       // proto base class calls here for app-level control-channel messages received
       virtual void control_recv(BufferPtr&& app_bp)
       {
-	const std::string msg = Unicode::utf8_printable(Base::template read_control_string<std::string>(*app_bp),
-							Unicode::UTF8_FILTER|Unicode::UTF8_PASS_FMT);
+	control_msg(Base::template read_control_string<std::string>(*app_bp));
+      }
+
+      // large messages such as PUSH_REPLY arrive as a chain of SSL reads
+      virtual void control_recv_rope(BufferRope&& app_rope)
+      {
+	control_msg(Base::template read_control_string<std::string>(app_rope));
+      }
+
+      void control_msg(const std::string& raw_msg)
+      {
+	const std::string msg = Unicode::utf8_printable(raw_msg, Unicode::UTF8_FILTER|Unicode::UTF8_PASS_FMT);
 
 	//OPENVPN_LOG("SERVER: " << sanitize_control_message(msg));
 
@@ -540,6 +742,13 @@ namespace openvpn {
 		tun = tun_factory->new_tun_client_obj(io_context, *this, transport.get());
 		tun->tun_start(received_options, *transport, Base::dc_settings());
 
+		// point the DNS stub resolver at the pushed servers
+		if (dns_stub)
+		  {
+		    dns_stub->set_servers(received_options);
+		    OPENVPN_LOG("DNS stub resolver: " << dns_stub->n_servers() << " server(s)");
+		  }
+
 		// we should be connected at this point
 		if (!connected_)
 		  throw tun_exception("not connected");
@@ -736,6 +945,8 @@ namespace openvpn {
       {
 	OPENVPN_LOG("Session is ACTIVE");
 	schedule_push_request_callback(Time::Duration::seconds(0));
+	if (notify_callback)
+	  notify_callback->client_proto_active();
       }
 
       void housekeeping_callback(const asio::error_code& e)
@@ -767,6 +978,28 @@ namespace openvpn {
 	  }
       }
 
+      // Encrypt and send packets chosen by fq-codel while the transport
+      // queue is short, so that queueing happens where flows are kept apart.
+      void fq_send()
+      {
+	while (transport->transport_send_queue_size() < FQ_TRANSPORT_DEPTH
+	       && fq->dequeue(fq_buf, Base::now()))
+	  {
+	    Base::data_encrypt(fq_buf);
+	    if (fq_buf.size())
+	      {
+		OPENVPN_LOG_CLIPROTO("Transport SEND " << server_endpoint_render() << ' ' << Base::dump_packet(fq_buf));
+		capture(PacketCapture::WIRE_OUT, fq_buf);
+		if (transport->transport_send(fq_buf))
+		  Base::update_last_sent();
+		else if (halt)
+		  return;
+	      }
+	  }
+	for (size_t drops = fq->take_drops(); drops; --drops)
+	  cli_stats->error(Error::AQM_DROP);
+      }
+
       void set_housekeeping_timer()
       {
 	if (halt)
@@ -778,6 +1011,7 @@ namespace openvpn {
 	    if (!next.is_infinite())
 	      {
 		next.max(now());
+		next = AsioTimer::coalesce(next, timer_leeway);
 		housekeeping_schedule.reset(next);
 		housekeeping_timer.expires_at(next);
 		housekeeping_timer.async_wait([self=Ptr(this)](const asio::error_code& error)
@@ -811,7 +1045,7 @@ namespace openvpn {
 
       void schedule_inactive_timer()
       {
-	inactive_timer.expires_at(now() + inactive_duration);
+	inactive_timer.expires_at_coalesced(now() + inactive_duration, timer_leeway);
 	inactive_timer.async_wait([self=Ptr(this)](const asio::error_code& error)
                                   {
                                     self->inactive_callback(error);
@@ -898,6 +1132,43 @@ namespace openvpn {
 	  throw client_halt_restart(ch.render());
       }
 
+      // transport has reopened its socket after transport_rebind()
+      virtual void transport_rebound()
+      {
+	try {
+	  if (!halt)
+	    {
+	      OPENVPN_LOG("Session migrated to new network path, probing server");
+	      Base::update_now();
+	      Base::send_keepalive_now();
+	      Base::flush(true);
+	      set_housekeeping_timer();
+	    }
+	}
+	catch (const std::exception& e)
+	  {
+	    process_exception(e, "transport_rebound");
+	  }
+      }
+
+      void migrate_probe_callback(const asio::error_code& e)
+      {
+	try {
+	  if (!e && !halt && !migrate_heard)
+	    {
+	      OPENVPN_LOG("No response on new network path, renegotiating");
+	      Base::update_now();
+	      Base::renegotiate();
+	      Base::flush(true);
+	      set_housekeeping_timer();
+	    }
+	}
+	catch (const std::exception& e)
+	  {
+	    process_exception(e, "migrate_probe_callback");
+	  }
+      }
+
       void schedule_info_hold_callback()
       {
 	Base::update_now();
@@ -928,19 +1199,136 @@ namespace openvpn {
 	  }
       }
 
-#ifdef OPENVPN_PACKET_LOG
-      void log_packet(const Buffer& buf, const bool out)
+      // Parse the headers of a tun packet into tun_meta and apply
+      // the classifier rules, returns false if the packet was dropped.
+      bool classify(BufferAllocated& buf)
       {
-	if (buf.size())
+	IPClass::parse(buf, tun_meta);
+	tun_class = classifier->classify(tun_meta);
+	if (tun_class.action == IPClass::Rule::DROP)
 	  {
-	    std::uint16_t len = buf.size() & 0x7FFF;
-	    if (out)
-	      len |= 0x8000;
-	    packet_log.write((const char *)&len, sizeof(len));
-	    packet_log.write((const char *)buf.c_data(), buf.size());
+	    buf.reset_size();
+	    cli_stats->error(Error::POLICY_DROP);
+	    return false;
 	  }
+	return true;
+      }
+
+      // Let the DNS stub resolver see a tun packet, answering it from
+      // the cache if possible.  Returns false if the packet should
+      // not be sent to the server.
+      bool dns_query(BufferAllocated& buf)
+      {
+	if (!dns_stub->is_query(buf))
+	  return true;
+	Base::frame().prepare(Frame::READ_TUN, dns_reply);
+	const unsigned int flags = dns_stub->query(buf, dns_reply, Base::now());
+	if ((flags & DNSStub::Resolver::REPLY) && tun)
+	  {
+	    capture(PacketCapture::TUN_OUT, dns_reply);
+	    tun->tun_send(dns_reply);
+	  }
+	if (!(flags & DNSStub::Resolver::FORWARD))
+	  {
+	    buf.reset_size();
+	    return false;
+	  }
+	return true;
+      }
+
+      // make a decrypted data packet appear as incoming on tun interface
+      void tun_deliver(BufferAllocated& buf)
+      {
+	if (recv_ce)
+	  IPECN::set_ce(buf);
+	capture(PacketCapture::TUN_OUT, buf);
+	if (tun && (!dns_stub || dns_response(buf)))
+	  {
+	    OPENVPN_LOG_CLIPROTO("TUN send, size=" << buf.size());
+	    tun->tun_send(buf);
+	  }
+      }
+
+      // Pass a decrypted data packet through the reorder stage,
+      // leaving buf empty if it is held back.
+      void reorder_push(BufferAllocated& buf)
+      {
+	unsigned int key_id;
+	std::uint64_t pid;
+	if (Base::data_rx_seq(key_id, pid))
+	  reorder->push(key_id, pid, buf, now());
+      }
+
+      // Deliver the packets that the reorder stage lets go, and wake
+      // up when it will give up on the gap holding back the rest.
+      void reorder_release()
+      {
+	while (BufferAllocated* b = reorder->pop())
+	  tun_deliver(*b);
+
+	const Time next = reorder->next_event();
+	if (next != reorder_timer_at)
+	  {
+	    reorder_timer_at = next;
+	    if (!next.is_infinite())
+	      {
+		reorder_timer.expires_at(next);
+		reorder_timer.async_wait([self=Ptr(this)](const asio::error_code& error)
+                                         {
+                                           self->reorder_callback(error);
+                                         });
+	      }
+	    else
+	      reorder_timer.cancel();
+	  }
+      }
+
+      void reorder_callback(const asio::error_code& e)
+      {
+	try {
+	  if (!e && !halt)
+	    {
+	      // update current time
+	      Base::update_now();
+
+	      reorder_timer_at = Time::infinite();
+	      reorder->expire(now());
+	      reorder_release();
+	    }
+	}
+	catch (const std::exception& e)
+	  {
+	    process_exception(e, "reorder_callback");
+	  }
+      }
+
+      // Let the DNS stub resolver see a packet from the server before
+      // it goes to the tun, answering coalesced queries from it.
+      // Returns false if the packet was a prefetch nobody waits for.
+      bool dns_response(BufferAllocated& buf)
+      {
+	dns_fanout.clear();
+	const bool deliver = dns_stub->response(buf, dns_fanout, Base::now());
+	if (tun)
+	  for (auto& b : dns_fanout)
+	    {
+	      capture(PacketCapture::TUN_OUT, b);
+	      tun->tun_send(b);
+	    }
+	return deliver;
+      }
+
+      // reuse the classifier's parse when there is one
+      std::size_t flow_hash(const Buffer& buf) const
+      {
+	return classifier ? tun_meta.flow_hash() : IPFlow::hash(buf);
+      }
+
+      void capture(const PacketCapture::Point point, const Buffer& buf)
+      {
+	if (packet_capture)
+	  packet_capture->capture(point, capture_session_id, buf);
       }
-#endif
 
       asio::io_context& io_context;
 
@@ -951,8 +1339,26 @@ namespace openvpn {
       TunClient::Ptr tun;
 
       unsigned int tcp_queue_limit;
+      Time::Duration timer_leeway;
       bool transport_has_send_queue = false;
 
+      IPClass::Classifier::Ptr classifier;
+      IPClass::Meta tun_meta;           // headers of the tun packet being processed
+      IPClass::Classifier::Result tun_class;
+
+      bool pass_tos;
+      bool recv_ce = false; // outer packet being processed was marked CE
+      std::vector<unsigned int> batch_tos;
+
+      DNSStub::Resolver::Ptr dns_stub;
+      BufferAllocated dns_reply;
+      std::vector<BufferAllocated> dns_fanout;
+
+      // packets kept in the transport queue when fq-codel is on
+      static constexpr unsigned int FQ_TRANSPORT_DEPTH = 4;
+      std::unique_ptr<FQCoDel> fq;
+      BufferAllocated fq_buf;
+
       NotifyCallback* notify_callback;
 
       CoarseTime housekeeping_schedule;
@@ -992,9 +1398,15 @@ namespace openvpn {
       std::unique_ptr<std::vector<ClientEvent::Base::Ptr>> info_hold;
       AsioTimer info_hold_timer;
 
-#ifdef OPENVPN_PACKET_LOG
-      std::ofstream packet_log;
-#endif
+      AsioTimer migrate_timer;
+      bool migrate_heard = false;
+
+      std::unique_ptr<DataReorder> reorder; // if proto_context_config->reorder on UDP
+      AsioTimer reorder_timer;
+      Time reorder_timer_at = Time::infinite();
+
+      PacketCapture::Ptr packet_capture;
+      std::uint64_t capture_session_id;
     };
   }
 }
@@ -0,0 +1,105 @@
+//    OpenVPN -- An application to securely tunnel IP networks
+//               over a single port, with support for SSL/TLS-based
+//               session authentication and key exchange,
+//               packet encryption, packet authentication, and
+//               packet compression.
+//
+//    Copyright (C) 2012-2016 OpenVPN Technologies, Inc.
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU Affero General Public License Version 3
+//    as published by the Free Software Foundation.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU Affero General Public License for more details.
+//
+//    You should have received a copy of the GNU Affero General Public License
+//    along with this program in the COPYING file.
+//    If not, see <http://www.gnu.org/licenses/>.
+
+// Fixed-layout client stats page, updated in place by the client so
+// that an app can poll traffic counters and rates by reading memory
+// instead of calling into the library (and, for Java, crossing JNI).
+
+#ifndef OPENVPN_CLIENT_CLISTATSPAGE_H
+#define OPENVPN_CLIENT_CLISTATSPAGE_H
+
+#include <cstdint>
+#include <atomic>
+
+namespace openvpn {
+
+  // All counters are 64-bit and the layout is versioned, so it may be
+  // mapped directly, for example as a JNI direct ByteBuffer.  seq is
+  // odd while an update is in progress, readers should retry until
+  // they see the same even seq before and after reading.
+  struct ClientStatsPage
+  {
+    enum {
+      VERSION = 1,
+    };
+
+    std::uint32_t version = VERSION;
+    std::atomic<std::uint32_t> seq{0};
+
+    std::int64_t update_ms = 0;         // steady-clock ms of last update
+    std::int64_t bytes_in = 0;          // network bytes
+    std::int64_t bytes_out = 0;
+    std::int64_t packets_in = 0;
+    std::int64_t packets_out = 0;
+    std::int64_t tun_bytes_in = 0;      // tun device bytes, as SessionStats counts them
+    std::int64_t tun_bytes_out = 0;
+    std::int64_t tun_packets_in = 0;
+    std::int64_t tun_packets_out = 0;
+    std::int64_t bytes_in_per_sec = 0;  // network rates over the last interval
+    std::int64_t bytes_out_per_sec = 0;
+
+    // Copy a consistent view of the page into dest (C++ readers).
+    void read(ClientStatsPage& dest) const
+    {
+      while (true)
+	{
+	  const std::uint32_t s = seq.load(std::memory_order_acquire);
+	  if (!(s & 1))
+	    {
+	      copy_counters(dest, *this);
+	      std::atomic_thread_fence(std::memory_order_acquire);
+	      if (seq.load(std::memory_order_relaxed) == s)
+		return;
+	    }
+	}
+    }
+
+    // Writer side, update() runs fill(page) with seq held odd.
+    template <typename FILL>
+    void update(FILL fill)
+    {
+      const std::uint32_t s = seq.load(std::memory_order_relaxed);
+      seq.store(s + 1, std::memory_order_relaxed);
+      std::atomic_thread_fence(std::memory_order_release);
+      fill(*this);
+      seq.store(s + 2, std::memory_order_release);
+    }
+
+  private:
+    static void copy_counters(ClientStatsPage& dest, const ClientStatsPage& src)
+    {
+      dest.update_ms = src.update_ms;
+      dest.bytes_in = src.bytes_in;
+      dest.bytes_out = src.bytes_out;
+      dest.packets_in = src.packets_in;
+      dest.packets_out = src.packets_out;
+      dest.tun_bytes_in = src.tun_bytes_in;
+      dest.tun_bytes_out = src.tun_bytes_out;
+      dest.tun_packets_in = src.tun_packets_in;
+      dest.tun_packets_out = src.tun_packets_out;
+      dest.bytes_in_per_sec = src.bytes_in_per_sec;
+      dest.bytes_out_per_sec = src.bytes_out_per_sec;
+    }
+  };
+
+}
+
+#endif
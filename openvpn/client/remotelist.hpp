@@ -29,8 +29,13 @@
 #include <string>
 #include <sstream>
 #include <vector>
+#include <deque>
+#include <unordered_map>
 #include <algorithm>
 #include <utility>
+#include <memory>
+#include <functional>
+#include <thread>
 
 #include <asio.hpp>
 
@@ -40,6 +45,7 @@
 #include <openvpn/common/number.hpp>
 #include <openvpn/common/hostport.hpp>
 #include <openvpn/random/randapi.hpp>
+#include <openvpn/time/time.hpp>
 #include <openvpn/addr/ip.hpp>
 #include <openvpn/addr/addrlist.hpp>
 #include <openvpn/transport/protocol.hpp>
@@ -74,6 +80,9 @@ namespace openvpn {
     {
       typedef RCPtr<ResolvedAddrList> Ptr;
 
+      // when the list should be re-resolved, undefined if never
+      Time expire;
+
       std::string to_string() const
       {
 	std::string ret;
@@ -125,6 +134,26 @@ namespace openvpn {
 	return res_addr_list && res_addr_list->size() > 0;
       }
 
+      // like res_addr_list_defined, but false once the list
+      // has outlived the DNS cache lifetime
+      bool res_addr_list_fresh() const
+      {
+	return res_addr_list_fresh_at(Time::now());
+      }
+
+      // like res_addr_list_fresh, but evaluated at a given time
+      bool res_addr_list_fresh_at(const Time& at) const
+      {
+	return res_addr_list_defined()
+	  && (!res_addr_list->expire.defined() || at < res_addr_list->expire);
+      }
+
+      // identifies the remote across runs
+      std::string key() const
+      {
+	return server_host + '/' + server_port + '/' + transport_protocol.str();
+      }
+
       // cache a single IP address
       void set_ip_addr(const IP::Addr& addr)
       {
@@ -262,7 +291,13 @@ namespace openvpn {
     // Helper class used to pre-resolve all items in remote list.
     // This is useful in tun_persist mode, where it may be necessary
     // to pre-resolve all potential remote server items prior
-    // to initial tunnel establishment.
+    // to initial tunnel establishment.  It is also used to warm
+    // the DNS cache when a cache lifetime is set.
+    //
+    // All host names are resolved concurrently, with separate
+    // A and AAAA lookups.  Lookups are run on short-lived threads
+    // since the Asio resolver serializes requests on a single
+    // background thread.
     class PreResolve : public RC<thread_unsafe_refcount>
     {
     public:
@@ -274,21 +309,24 @@ namespace openvpn {
 	virtual void pre_resolve_done() = 0;
       };
 
+      enum {
+	MAX_CONCURRENT = 16, // maximum number of lookup threads in flight
+      };
+
       PreResolve(asio::io_context& io_context_arg,
 		 const RemoteList::Ptr& remote_list_arg,
 		 const SessionStats::Ptr& stats_arg)
 	:  io_context(io_context_arg),
-	   resolver(io_context_arg),
 	   notify_callback(nullptr),
 	   remote_list(remote_list_arg),
-	   stats(stats_arg),
-	   index(0)
+	   stats(stats_arg)
       {
       }
 
       bool work_available() const
       {
-	return remote_list->defined() && remote_list->enable_cache;
+	return remote_list->defined()
+	  && (remote_list->enable_cache || remote_list->cache_lifetime.enabled());
       }
 
       void start(NotifyCallback* notify_callback_arg)
@@ -301,53 +339,196 @@ namespace openvpn {
 	    if (!notify_callback && work_available())
 	      {
 		notify_callback = notify_callback_arg;
+		refresh_ = false;
 		remote_list->index.reset();
-		index = 0;
-		next();
+		queue_lookups();
+		if (queue.empty())
+		  done();
+		else
+		  launch();
 	      }
 	    else
 	      notify_callback_arg->pre_resolve_done();
 	  }
       }
 
+      // Re-resolve in the background the items whose cached addresses
+      // are stale or will expire within ahead, without resetting the
+      // list index or pruning, so that a connected session can keep
+      // the failover remotes warm.  No-op if already in progress.
+      void refresh(NotifyCallback* notify_callback_arg, const Time::Duration& ahead)
+      {
+	if (notify_callback_arg && !notify_callback && work_available())
+	  {
+	    notify_callback = notify_callback_arg;
+	    refresh_ = true;
+	    fresh_at = Time::now() + ahead;
+	    queue_lookups();
+	    if (queue.empty())
+	      done();
+	    else
+	      launch();
+	  }
+      }
+
       void cancel()
       {
+	// lookups already in flight will be ignored when they complete
 	notify_callback = nullptr;
-	index = 0;
-	resolver.cancel();
+	++generation;
+	queue.clear();
+	results.clear();
+	outstanding = 0;
       }
 
     private:
-      void next()
+      // a single A or AAAA lookup of one host name
+      struct Lookup
+      {
+	typedef std::shared_ptr<Lookup> Ptr;
+
+	std::string host;
+	bool ipv6 = false;
+	unsigned int gen = 0;
+	asio::error_code error;
+	std::vector<IP::Addr> addrs;
+      };
+
+      struct Result
+      {
+	ResolvedAddrList::Ptr addrs{new ResolvedAddrList()};
+	asio::error_code error;
+	unsigned int failed = 0;
+      };
+
+      void queue_lookups()
       {
-	while (index < remote_list->list.size())
+	for (auto& e : remote_list->list)
 	  {
-	    Item& item = *remote_list->list[index];
+	    const Item& item = *e;
 
-	    // try to resolve item if no cached data present
-	    if (!item.res_addr_list_defined())
+	    // try to resolve item if no fresh cached data present
+	    if (fresh(item) || results.find(item.server_host) != results.end())
+	      continue;
+
+	    // item's server_host matches one previously resolved -- use it
+	    const Item* sitem = remote_list->search_server_host(item.server_host);
+	    if (sitem && fresh(*sitem))
+	      continue;
+
+	    OPENVPN_LOG_REMOTELIST("*** PreResolve RESOLVE on " << item.server_host);
+	    results[item.server_host];
+	    for (int v6 = 0; v6 <= 1; ++v6)
+	      {
+		Lookup::Ptr lu(new Lookup());
+		lu->host = item.server_host;
+		lu->ipv6 = bool(v6);
+		lu->gen = generation;
+		queue.push_back(std::move(lu));
+	      }
+	  }
+      }
+
+      // start queued lookups, up to MAX_CONCURRENT at a time
+      void launch()
+      {
+	while (!queue.empty() && outstanding < MAX_CONCURRENT)
+	  {
+	    Lookup::Ptr lu = std::move(queue.front());
+	    queue.pop_front();
+	    ++outstanding;
+
+	    // The lookup thread must not touch our (thread-unsafe)
+	    // refcount, so it only carries the Lookup and a work
+	    // object to keep io_context running.  The completion
+	    // handler, which holds a ref to us, is built here.
+	    std::shared_ptr<asio::io_context::work> work(new asio::io_context::work(io_context));
+	    auto handler = std::make_shared<std::function<void()>>([self=Ptr(this), lu]() {
+		self->lookup_done(*lu);
+	      });
+	    std::thread([lu, work, handler, &ioc=io_context]() mutable {
+		resolve(*lu);
+		asio::post(ioc, [handler=std::move(handler)]() { (*handler)(); });
+		work.reset();
+	      }).detach();
+	  }
+      }
+
+      // runs on a lookup thread
+      static void resolve(Lookup& lu)
+      {
+	asio::io_context ioc;
+	asio::ip::tcp::resolver resolver(ioc);
+	const asio::ip::tcp::resolver::results_type results =
+	  resolver.resolve(lu.ipv6 ? asio::ip::tcp::v6() : asio::ip::tcp::v4(),
+			   lu.host, "", lu.error);
+	if (!lu.error)
+	  for (const auto& i : results)
+	    lu.addrs.push_back(IP::Addr::from_asio(i.endpoint().address()));
+      }
+
+      // callback on lookup completion
+      void lookup_done(const Lookup& lu)
+      {
+	if (!notify_callback || lu.gen != generation)
+	  return;
+
+	Result& r = results[lu.host];
+	if (lu.error)
+	  {
+	    r.error = lu.error;
+	    ++r.failed;
+	  }
+	for (auto& a : lu.addrs)
+	  {
+	    ResolvedAddr::Ptr ra(new ResolvedAddr());
+	    ra->addr = a;
+	    r.addrs->push_back(std::move(ra));
+	  }
+
+	--outstanding;
+	if (outstanding || !queue.empty())
+	  launch();
+	else
+	  done();
+      }
+
+      void done()
+      {
+	const Time now = Time::now();
+	for (auto& kv : results)
+	  {
+	    Result& r = kv.second;
+	    if (r.addrs->empty())
+	      {
+		// both A and AAAA lookups failed (or returned nothing)
+		OPENVPN_LOG("DNS pre-resolve error on " << kv.first << ": "
+			    << (r.error ? r.error.message() : std::string("no addresses")));
+		if (stats)
+		  stats->error(Error::RESOLVE_ERROR);
+		continue;
+	      }
+	    if (remote_list->rng && r.addrs->size() >= 2)
+	      std::shuffle(r.addrs->begin(), r.addrs->end(), *remote_list->rng);
+	    if (remote_list->cache_lifetime.enabled())
+	      r.addrs->expire = now + remote_list->cache_lifetime;
+	  }
+
+	// share results between all items with the same server_host
+	for (auto& e : remote_list->list)
+	  {
+	    Item& item = *e;
+	    if (fresh(item))
+	      continue;
+	    auto i = results.find(item.server_host);
+	    if (i != results.end() && !i->second.addrs->empty())
+	      item.res_addr_list = i->second.addrs;
+	    else
 	      {
-		// next item to resolve
 		const Item* sitem = remote_list->search_server_host(item.server_host);
-		if (sitem)
-		  {
-		    // item's server_host matches one previously resolved -- use it
-		    OPENVPN_LOG_REMOTELIST("*** PreResolve USED CACHE for " << item.server_host);
-		    item.res_addr_list = sitem->res_addr_list;
-		  }
-		else
-		  {
-		    // call into Asio to do the resolve operation
-		    OPENVPN_LOG_REMOTELIST("*** PreResolve RESOLVE on " << item.server_host);
-		    resolver.async_resolve(item.server_host, "",
-					   [self=Ptr(this)](const asio::error_code& error, asio::ip::tcp::resolver::results_type results)
-					   {
-					     self->resolve_callback(error, results);
-					   });
-		    return;
-		  }
+		if (sitem && sitem != &item)
+		  item.res_addr_list = sitem->res_addr_list;
 	      }
-	    ++index;
 	  }
 
 	// Done resolving list.  Prune out all entries we were unable to
@@ -355,42 +536,28 @@ namespace openvpn {
 	// Then call client's callback method.
 	{
 	  NotifyCallback* ncb = notify_callback;
-	  if (remote_list->cached_item_exists())
+	  if (!refresh_ && remote_list->cached_item_exists())
 	    remote_list->prune_uncached();
 	  cancel();
 	  ncb->pre_resolve_done();
 	}
       }
 
-      // callback on resolve completion
-      void resolve_callback(const asio::error_code& error,
-			    asio::ip::tcp::resolver::results_type results)
+      bool fresh(const Item& item) const
       {
-	if (notify_callback && index < remote_list->list.size())
-	  {
-	    Item& item = *remote_list->list[index++];
-	    if (!error)
-	      {
-		// resolve succeeded
-		item.set_endpoint_range(results, remote_list->rng.get());
-	      }
-	    else
-	      {
-		// resolve failed
-		OPENVPN_LOG("DNS pre-resolve error on " << item.server_host << ": " << error.message());
-		if (stats)
-		  stats->error(Error::RESOLVE_ERROR);
-	      }
-	    next();
-	  }
+	return refresh_ ? item.res_addr_list_fresh_at(fresh_at) : item.res_addr_list_fresh();
       }
 
       asio::io_context& io_context;
-      asio::ip::tcp::resolver resolver;
       NotifyCallback* notify_callback;
       RemoteList::Ptr remote_list;
       SessionStats::Ptr stats;
-      size_t index;
+      bool refresh_ = false;
+      Time fresh_at;
+      unsigned int generation = 0;
+      unsigned int outstanding = 0;
+      std::deque<Lookup::Ptr> queue;
+      std::unordered_map<std::string, Result> results;
     };
 
     // create an empty remote list
@@ -514,6 +681,20 @@ namespace openvpn {
       return enable_cache;
     }
 
+    // If enabled, DNS results are kept for this long and reused
+    // across reconnects, rather than being re-resolved on each
+    // attempt.  The system resolver doesn't report record TTLs,
+    // so a single lifetime applies to all results.
+    void set_cache_lifetime(const Time::Duration& lifetime)
+    {
+      cache_lifetime = lifetime;
+    }
+
+    const Time::Duration& get_cache_lifetime() const
+    {
+      return cache_lifetime;
+    }
+
     // override all server hosts to server_override
     void set_server_override(const std::string& server_override)
     {
@@ -544,6 +725,27 @@ namespace openvpn {
 	}
     }
 
+    // Stable-sort item list by score (lower is better), used to
+    // try remotes in order of expected connect latency.  score is
+    // a callable taking a const Item& and returning an unsigned int.
+    template <typename SCORE>
+    void rank(SCORE score)
+    {
+      std::vector<std::pair<unsigned int, Item::Ptr>> scored;
+      scored.reserve(list.size());
+      for (auto& item : list)
+	scored.emplace_back(score(*item), item);
+      std::stable_sort(scored.begin(), scored.end(),
+		       [](const std::pair<unsigned int, Item::Ptr>& a,
+			  const std::pair<unsigned int, Item::Ptr>& b)
+		       {
+			 return a.first < b.first;
+		       });
+      for (size_t i = 0; i < list.size(); ++i)
+	list[i] = std::move(scored[i].second);
+      index.reset();
+    }
+
     // return true if at least one remote entry is of type proto
     bool contains_protocol(const Protocol& proto)
     {
@@ -591,6 +793,30 @@ namespace openvpn {
 	}
     }
 
+    // Return a list that shares our items but walks them with
+    // its own index, starting n entries past our current one.
+    // Used to race several connection attempts in parallel.
+    RemoteList::Ptr fork(const size_t n) const
+    {
+      RemoteList::Ptr rl(new RemoteList());
+      rl->enable_cache = enable_cache;
+      rl->cache_lifetime = cache_lifetime;
+      rl->index = index;
+      rl->list = list;
+      rl->directives = directives;
+      rl->rng = rng;
+      for (size_t i = 0; i < n; ++i)
+	rl->index.increment(list.size(), rl->secondary_length(rl->index.primary()));
+      return rl;
+    }
+
+    // continue from the current position of a forked list
+    void adopt_index(const RemoteList& other)
+    {
+      if (!remote_override && other.list.size() == list.size())
+	index = other.index;
+    }
+
     // Return details about current connection entry.
     // Return value is true if get_endpoint may be called
     // without raising an exception.
@@ -624,6 +850,8 @@ namespace openvpn {
     {
       Item& item = *list[primary_index()];
       item.set_endpoint_range(endpoint_range, rng.get());
+      if (cache_lifetime.enabled())
+	item.res_addr_list->expire = Time::now() + cache_lifetime;
       index.reset_secondary();
     }
 
@@ -647,6 +875,11 @@ namespace openvpn {
       return *list.at(index);
     }
 
+    const Item& current_item() const
+    {
+      return *list[primary_index()];
+    }
+
     // return hostname (or IP address) of current connection entry
     const std::string& current_server_host() const
     {
@@ -675,6 +908,14 @@ namespace openvpn {
       return dynamic_cast<T*>(item.conn_block.get());
     }
 
+    // key under which TLS sessions with the current remote are
+    // cached for resumption on reconnect
+    std::string current_session_cache_key() const
+    {
+      const Item& item = *list[primary_index()];
+      return item.key();
+    }
+
     // return hostname (or IP address) of first connection entry
     std::string first_server_host() const
     {
@@ -746,7 +987,12 @@ namespace openvpn {
     void reset_item(const size_t i)
     {
       if (i <= list.size())
-	list[i]->res_addr_list.reset(nullptr);
+	{
+	  // keep DNS results that are still within the cache lifetime
+	  Item& item = *list[i];
+	  if (!(cache_lifetime.enabled() && item.res_addr_list_fresh()))
+	    item.res_addr_list.reset(nullptr);
+	}
     }
 
     // return the current primary index (into list) and raise an exception
@@ -902,6 +1148,7 @@ namespace openvpn {
     }
 
     bool enable_cache;
+    Time::Duration cache_lifetime;
     Index index;
 
     std::vector<Item::Ptr> list;
@@ -0,0 +1,184 @@
+//    OpenVPN -- An application to securely tunnel IP networks
+//               over a single port, with support for SSL/TLS-based
+//               session authentication and key exchange,
+//               packet encryption, packet authentication, and
+//               packet compression.
+//
+//    Copyright (C) 2012-2016 OpenVPN Technologies, Inc.
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU Affero General Public License Version 3
+//    as published by the Free Software Foundation.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU Affero General Public License for more details.
+//
+//    You should have received a copy of the GNU Affero General Public License
+//    along with this program in the COPYING file.
+//    If not, see <http://www.gnu.org/licenses/>.
+
+// Persistent per-remote health and latency scoreboard, used to rank
+// RemoteList entries by expected time-to-connect so that clients with
+// multi-region profiles prefer a nearby, working server.
+
+#ifndef OPENVPN_CLIENT_REMOTESCORE_H
+#define OPENVPN_CLIENT_REMOTESCORE_H
+
+#include <ctime>
+#include <string>
+#include <sstream>
+#include <unordered_map>
+
+#include <openvpn/common/exception.hpp>
+#include <openvpn/common/rc.hpp>
+#include <openvpn/common/platform.hpp>
+#include <openvpn/common/file.hpp>
+#if !defined(OPENVPN_PLATFORM_WIN)
+#include <openvpn/common/fileatomic.hpp>
+#endif
+#include <openvpn/buffer/bufstr.hpp>
+#include <openvpn/random/randapi.hpp>
+#include <openvpn/time/time.hpp>
+
+namespace openvpn {
+
+  class RemoteScoreboard : public RC<thread_unsafe_refcount>
+  {
+  public:
+    typedef RCPtr<RemoteScoreboard> Ptr;
+
+    enum {
+      DEFAULT_RTT_MS = 1000,       // assumed handshake latency of an unknown remote
+      FAILURE_PENALTY_MS = 10000,  // added while a failure is recent
+      FAILURE_HOLDOFF_SEC = 300,   // how long a failure is considered recent
+      MAX_SAMPLES = 32,            // success/failure counts are halved beyond this
+      MAX_FILE_SIZE = 65536,
+    };
+
+    struct Entry
+    {
+      unsigned int rtt_ms = 0;     // smoothed handshake latency
+      unsigned int successes = 0;
+      unsigned int failures = 0;
+      std::time_t last_failure = 0;
+    };
+
+    RemoteScoreboard(const std::string& fn_arg, const RandomAPI::Ptr& rng_arg)
+      : fn(fn_arg),
+	rng(rng_arg)
+    {
+    }
+
+    // Load scoreboard from file.  A missing or malformed file
+    // leaves the scoreboard empty, since it is only a hint.
+    void load()
+    {
+      map.clear();
+      try {
+	std::istringstream in(read_text(fn, MAX_FILE_SIZE));
+	std::string line;
+	while (std::getline(in, line))
+	  {
+	    std::istringstream ls(line);
+	    std::string key;
+	    Entry e;
+	    long long lf = 0;
+	    if (ls >> key >> e.rtt_ms >> e.successes >> e.failures >> lf)
+	      {
+		e.last_failure = std::time_t(lf);
+		map[key] = e;
+	      }
+	  }
+      }
+      catch (const std::exception&)
+	{
+	  map.clear();
+	}
+    }
+
+    // Save scoreboard to file, atomically where supported
+    void save() const
+    {
+      std::ostringstream out;
+      for (auto& kv : map)
+	{
+	  const Entry& e = kv.second;
+	  out << kv.first << ' ' << e.rtt_ms << ' ' << e.successes << ' '
+	      << e.failures << ' ' << (long long)e.last_failure << '\n';
+	}
+#if defined(OPENVPN_PLATFORM_WIN)
+      write_string(fn, out.str());
+#else
+      write_binary_atomic(fn, *buf_from_string(out.str()), *rng);
+#endif
+    }
+
+    // record a completed TLS handshake to remote
+    void success(const std::string& key, const Time::Duration& rtt)
+    {
+      Entry& e = map[key];
+      const unsigned int ms = (unsigned int)rtt.to_milliseconds();
+      if (e.successes)
+	e.rtt_ms = (e.rtt_ms * 3 + ms) / 4;
+      else
+	e.rtt_ms = ms;
+      ++e.successes;
+      decay(e);
+    }
+
+    // record a connection attempt to remote that never reached
+    // the end of the TLS handshake
+    void failure(const std::string& key)
+    {
+      Entry& e = map[key];
+      ++e.failures;
+      e.last_failure = std::time(nullptr);
+      decay(e);
+    }
+
+    // Expected time-to-connect for remote in milliseconds, lower is
+    // better.  Unknown remotes are scored neutrally.
+    unsigned int expected_latency(const std::string& key, const std::time_t now) const
+    {
+      auto i = map.find(key);
+      if (i == map.end())
+	return DEFAULT_RTT_MS;
+      const Entry& e = i->second;
+      unsigned long long lat = e.successes ? e.rtt_ms : DEFAULT_RTT_MS;
+
+      // scale by inverse of (Laplace-smoothed) success rate
+      lat = lat * (e.successes + e.failures + 2) / (e.successes + 1);
+
+      if (e.last_failure && now - e.last_failure < FAILURE_HOLDOFF_SEC)
+	lat += FAILURE_PENALTY_MS;
+      return lat < ~0u ? (unsigned int)lat : ~0u;
+    }
+
+    const Entry* get(const std::string& key) const
+    {
+      auto i = map.find(key);
+      return i != map.end() ? &i->second : nullptr;
+    }
+
+    bool empty() const { return map.empty(); }
+
+  private:
+    static void decay(Entry& e)
+    {
+      if (e.successes + e.failures > MAX_SAMPLES)
+	{
+	  e.successes = (e.successes + 1) / 2;
+	  e.failures /= 2;
+	}
+    }
+
+    std::string fn;
+    RandomAPI::Ptr rng;
+    std::unordered_map<std::string, Entry> map;
+  };
+
+}
+
+#endif
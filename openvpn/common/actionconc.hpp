@@ -0,0 +1,129 @@
+//    OpenVPN -- An application to securely tunnel IP networks
+//               over a single port, with support for SSL/TLS-based
+//               session authentication and key exchange,
+//               packet encryption, packet authentication, and
+//               packet compression.
+//
+//    Copyright (C) 2012-2016 OpenVPN Technologies, Inc.
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU Affero General Public License Version 3
+//    as published by the Free Software Foundation.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU Affero General Public License for more details.
+//
+//    You should have received a copy of the GNU Affero General Public License
+//    along with this program in the COPYING file.
+//    If not, see <http://www.gnu.org/licenses/>.
+
+// Run a group of mutually independent actions concurrently
+
+#ifndef OPENVPN_COMMON_ACTIONCONC_H
+#define OPENVPN_COMMON_ACTIONCONC_H
+
+#include <vector>
+#include <string>
+#include <sstream>
+#include <thread>
+#include <atomic>
+#include <algorithm>
+
+#include <openvpn/common/action.hpp>
+
+namespace openvpn {
+
+  // The actions of the group must not depend on each other, since
+  // they may run in any order, up to max_threads at a time.  Each
+  // action logs into its own buffer, and the buffers are appended
+  // to os in order, so the log reads as if the group had run
+  // sequentially.  Like ActionList, an exception thrown by one
+  // action is logged and doesn't prevent the others from running.
+  class ActionConcurrent : public Action
+  {
+  public:
+    typedef RCPtr<ActionConcurrent> Ptr;
+
+    ActionConcurrent(const unsigned int max_threads_arg = 8)
+      : max_threads(max_threads_arg ? max_threads_arg : 1)
+    {
+    }
+
+    void add(const Action::Ptr& action)
+    {
+      list.add(action);
+    }
+
+    bool empty() const
+    {
+      return list.empty();
+    }
+
+    ActionList& actions()
+    {
+      return list;
+    }
+
+    virtual void execute(std::ostream& os) override
+    {
+      const size_t n = list.size();
+      if (n <= 1 || max_threads <= 1)
+	{
+	  list.execute(os);
+	  return;
+	}
+
+      std::vector<std::ostringstream> logs(n);
+      std::atomic<size_t> next(0);
+      auto worker = [this, n, &logs, &next]() {
+	size_t i;
+	while ((i = next++) < n)
+	  {
+	    try {
+	      list[i]->execute(logs[i]);
+	    }
+	    catch (const std::exception& e)
+	      {
+		logs[i] << "action exception: " << e.what() << std::endl;
+	      }
+	  }
+      };
+
+      // the calling thread is one of the workers, and if a thread
+      // can't be started the remaining ones take up its share
+      std::vector<std::thread> threads;
+      const size_t n_threads = std::min(n, size_t(max_threads));
+      threads.reserve(n_threads - 1);
+      try {
+	for (size_t i = 1; i < n_threads; ++i)
+	  threads.emplace_back(worker);
+      }
+      catch (const std::exception&)
+	{
+	}
+      worker();
+      for (auto &t : threads)
+	t.join();
+
+      for (auto &l : logs)
+	os << l.str();
+    }
+
+    virtual std::string to_string() const override
+    {
+      std::string ret = list.to_string();
+      if (!ret.empty() && ret.back() == '\n')
+	ret.pop_back();
+      return ret;
+    }
+
+  private:
+    ActionList list;
+    const unsigned int max_threads;
+  };
+
+}
+
+#endif
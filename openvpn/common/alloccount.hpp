@@ -0,0 +1,88 @@
+//    OpenVPN -- An application to securely tunnel IP networks
+//               over a single port, with support for SSL/TLS-based
+//               session authentication and key exchange,
+//               packet encryption, packet authentication, and
+//               packet compression.
+//
+//    Copyright (C) 2012-2016 OpenVPN Technologies, Inc.
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU Affero General Public License Version 3
+//    as published by the Free Software Foundation.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU Affero General Public License for more details.
+//
+//    You should have received a copy of the GNU Affero General Public License
+//    along with this program in the COPYING file.
+//    If not, see <http://www.gnu.org/licenses/>.
+
+// Optional per-thread counters for allocation and reference count
+// traffic, used to check that the per-packet data path runs without
+// touching the heap.  Hooks compile to nothing unless
+// OPENVPN_ALLOC_INSTRUMENTATION is defined.  Heap allocations in
+// general (std::deque growth, std::function, asio handlers) are
+// counted only if the program also replaces global operator new
+// and calls AllocCount::heap_alloc(), as test/dpalloc does.
+
+#ifndef OPENVPN_COMMON_ALLOCCOUNT_H
+#define OPENVPN_COMMON_ALLOCCOUNT_H
+
+#include <cstdint>
+
+namespace openvpn {
+  namespace AllocCount {
+
+    struct Counters
+    {
+      std::uint64_t heap_alloc = 0;    // replaced operator new
+      std::uint64_t heap_free = 0;     // replaced operator delete
+      std::uint64_t buffer_alloc = 0;  // BufferAllocated storage, incl. pool
+      std::uint64_t buffer_realloc = 0; // growth, also in buffer_alloc
+      std::uint64_t buffer_free = 0;
+      std::uint64_t rc_ops = 0;        // thread_unsafe_refcount inc/dec
+      std::uint64_t rc_atomic_ops = 0; // thread_safe_refcount inc/dec
+
+      Counters operator-(const Counters& o) const
+      {
+	Counters ret;
+	ret.heap_alloc = heap_alloc - o.heap_alloc;
+	ret.heap_free = heap_free - o.heap_free;
+	ret.buffer_alloc = buffer_alloc - o.buffer_alloc;
+	ret.buffer_realloc = buffer_realloc - o.buffer_realloc;
+	ret.buffer_free = buffer_free - o.buffer_free;
+	ret.rc_ops = rc_ops - o.rc_ops;
+	ret.rc_atomic_ops = rc_atomic_ops - o.rc_atomic_ops;
+	return ret;
+      }
+    };
+
+    // counters of the calling thread, constant-initialized so that
+    // they are usable from operator new during static init
+    inline Counters& local() noexcept
+    {
+      static thread_local Counters c;
+      return c;
+    }
+
+    inline void heap_alloc() noexcept
+    {
+      ++local().heap_alloc;
+    }
+
+    inline void heap_free() noexcept
+    {
+      ++local().heap_free;
+    }
+  }
+}
+
+#ifdef OPENVPN_ALLOC_INSTRUMENTATION
+#define OPENVPN_ALLOC_COUNT(field) (++openvpn::AllocCount::local().field)
+#else
+#define OPENVPN_ALLOC_COUNT(field)
+#endif
+
+#endif
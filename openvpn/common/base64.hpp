@@ -25,11 +25,13 @@
 #define OPENVPN_COMMON_BASE64_H
 
 #include <string>
-#include <cstring> // for std::memset, std::strlen
+#include <cstring>   // for std::memset, std::memcpy
+#include <algorithm> // for std::min
 
 #include <openvpn/common/size.hpp>
 #include <openvpn/common/exception.hpp>
 #include <openvpn/common/extern.hpp>
+#include <openvpn/common/simd.hpp>
 
 namespace openvpn {
 
@@ -88,6 +90,12 @@ namespace openvpn {
 	    dec[c] = i;
 	  }
       }
+
+      // the vector decoder classifies by range, so the last two chars
+      // and padding must be outside of A-Z a-z 0-9
+      simd = SIMD::have_ssse3()
+	&& !is_alnum(enc[62]) && !is_alnum(enc[63]) && !is_alnum(equal)
+	&& equal != enc[62] && equal != enc[63];
     }
 
     static size_t decode_size_max(const size_t encode_size)
@@ -103,12 +111,12 @@ namespace openvpn {
     template <typename V>
     std::string encode(const V& data) const
     {
-      char *s, *p;
       size_t i;
       unsigned int c;
       const size_t size = data.size();
 
-      p = s = new char[encode_size_max(size)];
+      std::string ret((size + 2) / 3 * 4, '\0');
+      char *p = &ret[0];
       for (i = 0; i < size; ) {
 	c = static_cast<unsigned char>(data[i++]) << 8;
 	if (i < size)
@@ -128,15 +136,28 @@ namespace openvpn {
 	  p[2] = equal;
 	p += 4;
       }
-      *p = '\0';
-      const std::string ret(s);
-      delete [] s;
       return ret;
     }
 
     std::string encode(const unsigned char *data, size_t size) const
     {
-      return encode(UCharWrap(data, size));
+      if (!simd)
+	return encode(UCharWrap(data, size));
+
+      std::string ret((size + 2) / 3 * 4, '\0');
+      char *p = &ret[0];
+      const size_t done = SIMD::base64_encode(p, data, size, enc[62], enc[63]);
+      if (done < size)
+	{
+	  const std::string tail = encode(UCharWrap(data + done, size - done));
+	  std::memcpy(p + done / 3 * 4, tail.c_str(), tail.length());
+	}
+      return ret;
+    }
+
+    std::string encode(const std::string& str) const
+    {
+      return encode((const unsigned char *)str.c_str(), str.length());
     }
 
     std::string decode(const std::string& str) const
@@ -150,10 +171,23 @@ namespace openvpn {
     template <typename V>
     void decode(V& dest, const std::string& str) const
     {
-      for (const char *p = str.c_str(); *p != '\0' && (*p == equal || is_base64_char(*p)); p += 4)
+      const char *p = str.c_str();
+      const char *end = p + str.length();
+      if (simd)
+	{
+	  unsigned char tmp[192];
+	  size_t n;
+	  while ((n = SIMD::base64_decode(tmp, p, std::min(size_t(end - p), size_t(256)), enc[62], enc[63])))
+	    {
+	      for (size_t i = 0; i < n / 4 * 3; ++i)
+		dest.push_back(tmp[i]);
+	      p += n;
+	    }
+	}
+      for (; *p != '\0' && (*p == equal || is_base64_char(*p)); p += 4)
 	{
 	  unsigned int marker;
-	  const unsigned int val = token_decode(p, marker);
+	  const unsigned int val = token_decode(p, end - p, marker);
 	  dest.push_back((val >> 16) & 0xff);
 	  if (marker < 2)
 	    dest.push_back((val >> 8) & 0xff);
@@ -163,6 +197,11 @@ namespace openvpn {
     }
 
   private:
+    static bool is_alnum(const unsigned char c)
+    {
+      return (c >= 'A' && c <= 'Z') || (c >= 'a' && c <= 'z') || (c >= '0' && c <= '9');
+    }
+
     bool is_base64_char(const char c) const
     {
       const size_t idx = c;
@@ -180,12 +219,12 @@ namespace openvpn {
       return v;
     }
 
-    unsigned int token_decode(const char *token, unsigned int& marker) const
+    unsigned int token_decode(const char *token, const size_t remaining, unsigned int& marker) const
     {
       size_t i;
       unsigned int val = 0;
       marker = 0; // number of equal chars seen
-      if (std::strlen(token) < 4)
+      if (remaining < 4)
 	throw base64_decode_error();
       for (i = 0; i < 4; i++)
 	{
@@ -205,6 +244,7 @@ namespace openvpn {
     unsigned char enc[64];
     unsigned char dec[128];
     unsigned char equal;
+    bool simd;
   };
 
   // provide a static Base64 object
@@ -0,0 +1,88 @@
+//    OpenVPN -- An application to securely tunnel IP networks
+//               over a single port, with support for SSL/TLS-based
+//               session authentication and key exchange,
+//               packet encryption, packet authentication, and
+//               packet compression.
+//
+//    Copyright (C) 2012-2016 OpenVPN Technologies, Inc.
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU Affero General Public License Version 3
+//    as published by the Free Software Foundation.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU Affero General Public License for more details.
+//
+//    You should have received a copy of the GNU Affero General Public License
+//    along with this program in the COPYING file.
+//    If not, see <http://www.gnu.org/licenses/>.
+
+// Latency mode for an io_context thread: instead of sleeping in the
+// reactor between packets, poll it without blocking in a loop, so a
+// packet is picked up as soon as it's readable rather than after a
+// wakeup.  Empty polls back off with a growing number of CPU pause
+// hints, and once nothing has run for the idle period the thread
+// blocks in the reactor again until the next event.
+
+#ifndef OPENVPN_COMMON_BUSYPOLL_H
+#define OPENVPN_COMMON_BUSYPOLL_H
+
+#include <chrono>
+
+#include <asio.hpp>
+
+namespace openvpn {
+  namespace BusyPoll {
+
+    inline void cpu_relax()
+    {
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+      __builtin_ia32_pause();
+#elif defined(__aarch64__) && defined(__GNUC__)
+      asm volatile("yield");
+#endif
+    }
+
+    // Like io_context.run(), returns when the io_context stops or
+    // runs out of work.
+    inline void run(asio::io_context& io_context, const std::chrono::microseconds idle)
+    {
+      enum {
+	MAX_BACKOFF = 1024, // pause hints between empty polls
+      };
+
+      typedef std::chrono::steady_clock clock;
+      clock::time_point last_work = clock::now();
+      unsigned int backoff = 1;
+      while (!io_context.stopped())
+	{
+	  if (io_context.poll())
+	    {
+	      last_work = clock::now();
+	      backoff = 1;
+	      continue;
+	    }
+	  if (io_context.stopped())
+	    break;
+	  if (clock::now() - last_work >= idle)
+	    {
+	      // idle, wait in the reactor for the next event
+	      if (!io_context.run_one())
+		break;
+	      last_work = clock::now();
+	      backoff = 1;
+	      continue;
+	    }
+	  for (unsigned int i = 0; i < backoff; ++i)
+	    cpu_relax();
+	  if (backoff < MAX_BACKOFF)
+	    backoff <<= 1;
+	}
+    }
+
+  }
+}
+
+#endif
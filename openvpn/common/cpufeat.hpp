@@ -0,0 +1,218 @@
+//    OpenVPN -- An application to securely tunnel IP networks
+//               over a single port, with support for SSL/TLS-based
+//               session authentication and key exchange,
+//               packet encryption, packet authentication, and
+//               packet compression.
+//
+//    Copyright (C) 2012-2016 OpenVPN Technologies, Inc.
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU Affero General Public License Version 3
+//    as published by the Free Software Foundation.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU Affero General Public License for more details.
+//
+//    You should have received a copy of the GNU Affero General Public License
+//    along with this program in the COPYING file.
+//    If not, see <http://www.gnu.org/licenses/>.
+
+// Detect the CPU features used by our own SIMD kernels, once per
+// process.  Vector kernels are bound to function pointers on first
+// use based on these flags, so that one binary runs the best kernel
+// the host supports.  The cipher/HMAC engines (OpenSSL, minicrypto)
+// do their own detection through OPENSSL_cpuid_setup.
+
+#ifndef OPENVPN_COMMON_CPUFEAT_H
+#define OPENVPN_COMMON_CPUFEAT_H
+
+#include <string>
+
+#include <openvpn/common/arch.hpp>
+
+#if defined(__GNUC__) && (defined(OPENVPN_ARCH_x86_64) || defined(OPENVPN_ARCH_i386))
+#define OPENVPN_CPUFEAT_X86
+#include <cpuid.h>
+#elif defined(OPENVPN_ARCH_ARM64) && defined(__APPLE__)
+#define OPENVPN_CPUFEAT_ARM64_APPLE
+#include <sys/types.h>
+#include <sys/sysctl.h>
+#elif defined(OPENVPN_ARCH_ARM64) && defined(__linux__)
+#define OPENVPN_CPUFEAT_ARM64_LINUX
+#include <sys/auxv.h>
+#endif
+
+namespace openvpn {
+  namespace CPUFeatures {
+
+    enum Flags : unsigned int {
+      // x86
+      SSE2     = (1<<0),
+      SSSE3    = (1<<1),
+      AVX2     = (1<<2),
+      AVX512F  = (1<<3),
+      AVX512BW = (1<<4),
+      AESNI    = (1<<5),
+      PCLMUL   = (1<<6),
+      VAES     = (1<<7),
+      VPCLMUL  = (1<<8),
+      SHA_NI   = (1<<9),
+
+      // ARM
+      NEON         = (1<<16),
+      ARMV8_AES    = (1<<17),
+      ARMV8_PMULL  = (1<<18),
+      ARMV8_SHA1   = (1<<19),
+      ARMV8_SHA256 = (1<<20),
+    };
+
+#if defined(OPENVPN_CPUFEAT_X86)
+    // XCR0, the register state enabled by the OS
+    inline unsigned long long xgetbv0()
+    {
+      unsigned int eax, edx;
+      __asm__ volatile ("xgetbv" : "=a"(eax), "=d"(edx) : "c"(0));
+      return ((unsigned long long)edx << 32) | eax;
+    }
+#endif
+
+#if defined(OPENVPN_CPUFEAT_ARM64_APPLE)
+    inline bool sysctl_feature(const char *name, const bool def)
+    {
+      int val = 0;
+      size_t len = sizeof(val);
+      if (::sysctlbyname(name, &val, &len, nullptr, 0) != 0)
+	return def;
+      return val != 0;
+    }
+#endif
+
+    // query the hardware, prefer get() which caches the result
+    inline unsigned int detect()
+    {
+      unsigned int ret = 0;
+#if defined(OPENVPN_CPUFEAT_X86)
+      unsigned int eax, ebx, ecx, edx;
+      if (__get_cpuid(1, &eax, &ebx, &ecx, &edx))
+	{
+	  if (edx & (1<<26))
+	    ret |= SSE2;
+	  if (ecx & (1<<9))
+	    ret |= SSSE3;
+	  if (ecx & (1<<25))
+	    ret |= AESNI;
+	  if (ecx & (1<<1))
+	    ret |= PCLMUL;
+
+	  // AVX state must be enabled by the OS (OSXSAVE)
+	  const bool osxsave = (ecx & (1<<27)) != 0;
+	  const unsigned long long xcr0 = osxsave ? xgetbv0() : 0;
+	  const bool avx_os = (xcr0 & 0x06) == 0x06;
+	  const bool avx512_os = (xcr0 & 0xe6) == 0xe6;
+
+	  if (__get_cpuid_max(0, nullptr) >= 7)
+	    {
+	      __cpuid_count(7, 0, eax, ebx, ecx, edx);
+	      if (avx_os && (ebx & (1<<5)))
+		ret |= AVX2;
+	      if (avx512_os && (ebx & (1<<16)))
+		ret |= AVX512F;
+	      if (avx512_os && (ebx & (1<<30)))
+		ret |= AVX512BW;
+	      if (ebx & (1<<29))
+		ret |= SHA_NI;
+	      if (avx_os && (ecx & (1<<9)))
+		ret |= VAES;
+	      if (avx_os && (ecx & (1<<10)))
+		ret |= VPCLMUL;
+	    }
+	}
+#elif defined(OPENVPN_CPUFEAT_ARM64_APPLE)
+      // every Apple arm64 CPU has NEON and the AES/SHA1/SHA256 extensions
+      ret |= NEON;
+      if (sysctl_feature("hw.optional.arm.FEAT_AES", true))
+	ret |= ARMV8_AES;
+      if (sysctl_feature("hw.optional.arm.FEAT_PMULL", true))
+	ret |= ARMV8_PMULL;
+      if (sysctl_feature("hw.optional.arm.FEAT_SHA1", true))
+	ret |= ARMV8_SHA1;
+      if (sysctl_feature("hw.optional.arm.FEAT_SHA256", true))
+	ret |= ARMV8_SHA256;
+#elif defined(OPENVPN_CPUFEAT_ARM64_LINUX)
+      // AT_HWCAP bits from the arm64 <asm/hwcap.h>
+      const unsigned long hwcap = ::getauxval(AT_HWCAP);
+      if (hwcap & (1<<1))
+	ret |= NEON;
+      if (hwcap & (1<<3))
+	ret |= ARMV8_AES;
+      if (hwcap & (1<<4))
+	ret |= ARMV8_PMULL;
+      if (hwcap & (1<<5))
+	ret |= ARMV8_SHA1;
+      if (hwcap & (1<<6))
+	ret |= ARMV8_SHA256;
+#elif defined(OPENVPN_ARCH_ARM64) || defined(__ARM_NEON)
+      ret |= NEON; // NEON is mandatory on arm64
+#endif
+      return ret;
+    }
+
+    // Features of this CPU, detected on the first call.
+    inline unsigned int get()
+    {
+#if defined(OPENVPN_NO_SIMD)
+      return 0;
+#else
+      static const unsigned int flags = detect();
+      return flags;
+#endif
+    }
+
+    inline bool have(const unsigned int f)
+    {
+      return (get() & f) == f;
+    }
+
+    inline std::string to_string(const unsigned int flags)
+    {
+      static const struct {
+	unsigned int flag;
+	const char *name;
+      } names[] = {
+	{ SSE2, "SSE2" },
+	{ SSSE3, "SSSE3" },
+	{ AVX2, "AVX2" },
+	{ AVX512F, "AVX512F" },
+	{ AVX512BW, "AVX512BW" },
+	{ AESNI, "AES-NI" },
+	{ PCLMUL, "PCLMUL" },
+	{ VAES, "VAES" },
+	{ VPCLMUL, "VPCLMUL" },
+	{ SHA_NI, "SHA-NI" },
+	{ NEON, "NEON" },
+	{ ARMV8_AES, "ARMv8-AES" },
+	{ ARMV8_PMULL, "ARMv8-PMULL" },
+	{ ARMV8_SHA1, "ARMv8-SHA1" },
+	{ ARMV8_SHA256, "ARMv8-SHA256" },
+      };
+      std::string ret;
+      for (const auto &n : names)
+	{
+	  if (flags & n.flag)
+	    {
+	      if (!ret.empty())
+		ret += ' ';
+	      ret += n.name;
+	    }
+	}
+      if (ret.empty())
+	ret = "none";
+      return ret;
+    }
+
+  }
+}
+
+#endif
@@ -0,0 +1,157 @@
+//    OpenVPN -- An application to securely tunnel IP networks
+//               over a single port, with support for SSL/TLS-based
+//               session authentication and key exchange,
+//               packet encryption, packet authentication, and
+//               packet compression.
+//
+//    Copyright (C) 2012-2016 OpenVPN Technologies, Inc.
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU Affero General Public License Version 3
+//    as published by the Free Software Foundation.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU Affero General Public License for more details.
+//
+//    You should have received a copy of the GNU Affero General Public License
+//    along with this program in the COPYING file.
+//    If not, see <http://www.gnu.org/licenses/>.
+
+// Pass file descriptors between processes over a unix socket
+// (SCM_RIGHTS), together with a small payload
+
+#ifndef OPENVPN_COMMON_FDPASS_H
+#define OPENVPN_COMMON_FDPASS_H
+
+#include <string>
+#include <vector>
+#include <cstring>
+#include <cerrno>
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include <openvpn/common/size.hpp>
+#include <openvpn/common/exception.hpp>
+
+namespace openvpn {
+  namespace FDPass {
+
+    OPENVPN_EXCEPTION(fdpass_error);
+
+    enum {
+      MAX_FDS = 64, // per message
+    };
+
+    // received fds are close-on-exec where supported
+    inline int recv_flags()
+    {
+#ifdef MSG_CMSG_CLOEXEC
+      return MSG_CMSG_CLOEXEC;
+#else
+      return 0;
+#endif
+    }
+
+    // Send payload and fds as a single message on the unix socket
+    // sock.  The fds stay open on our side.
+    inline void send(const int sock, const std::string& payload, const std::vector<int>& fds)
+    {
+      if (payload.empty())
+	throw fdpass_error("empty payload");
+      if (fds.size() > MAX_FDS)
+	throw fdpass_error("too many fds");
+
+      struct iovec iov;
+      iov.iov_base = const_cast<char *>(payload.c_str());
+      iov.iov_len = payload.length();
+
+      std::vector<unsigned char> cbuf(CMSG_SPACE(sizeof(int) * MAX_FDS));
+      struct msghdr msg;
+      std::memset(&msg, 0, sizeof(msg));
+      msg.msg_iov = &iov;
+      msg.msg_iovlen = 1;
+      if (!fds.empty())
+	{
+	  msg.msg_control = cbuf.data();
+	  msg.msg_controllen = CMSG_SPACE(sizeof(int) * fds.size());
+	  struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+	  cmsg->cmsg_level = SOL_SOCKET;
+	  cmsg->cmsg_type = SCM_RIGHTS;
+	  cmsg->cmsg_len = CMSG_LEN(sizeof(int) * fds.size());
+	  std::memcpy(CMSG_DATA(cmsg), fds.data(), sizeof(int) * fds.size());
+	}
+
+      ssize_t status;
+      do {
+	status = ::sendmsg(sock, &msg, 0);
+      } while (status < 0 && errno == EINTR);
+      if (status < 0)
+	{
+	  const int eno = errno;
+	  OPENVPN_THROW(fdpass_error, "sendmsg: " << std::strerror(eno));
+	}
+      if (size_t(status) != payload.length())
+	throw fdpass_error("sendmsg: partial write");
+    }
+
+    // Receive a message sent by send().  Received fds are appended
+    // to fds and owned by the caller, on error none are kept open.
+    inline std::string recv(const int sock, std::vector<int>& fds, const size_t max_payload)
+    {
+      std::string payload(max_payload, '\0');
+
+      struct iovec iov;
+      iov.iov_base = &payload[0];
+      iov.iov_len = payload.length();
+
+      std::vector<unsigned char> cbuf(CMSG_SPACE(sizeof(int) * MAX_FDS));
+      struct msghdr msg;
+      std::memset(&msg, 0, sizeof(msg));
+      msg.msg_iov = &iov;
+      msg.msg_iovlen = 1;
+      msg.msg_control = cbuf.data();
+      msg.msg_controllen = cbuf.size();
+
+      ssize_t status;
+      do {
+	status = ::recvmsg(sock, &msg, recv_flags());
+      } while (status < 0 && errno == EINTR);
+      if (status < 0)
+	{
+	  const int eno = errno;
+	  OPENVPN_THROW(fdpass_error, "recvmsg: " << std::strerror(eno));
+	}
+
+      std::vector<int> got;
+      for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg))
+	{
+	  if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS)
+	    {
+	      const size_t n = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+	      const size_t base = got.size();
+	      got.resize(base + n);
+	      std::memcpy(got.data() + base, CMSG_DATA(cmsg), n * sizeof(int));
+	    }
+	}
+
+      if (status == 0 || (msg.msg_flags & (MSG_TRUNC|MSG_CTRUNC)))
+	{
+	  for (auto fd : got)
+	    ::close(fd);
+	  throw fdpass_error(status == 0 ? "recvmsg: peer closed" : "recvmsg: message truncated");
+	}
+
+      payload.resize(status);
+      fds.insert(fds.end(), got.begin(), got.end());
+      return payload;
+    }
+
+  }
+}
+
+#endif
@@ -90,6 +90,63 @@ namespace openvpn {
       std::size_t seed_;
     };
 
+    // SipHash-1-3 keyed with a 128-bit secret, for tables whose keys
+    // are chosen by remote peers, so that colliding keys cannot be
+    // precomputed.  Hashes whole 64-bit words in host byte order.
+    class SipHash13
+    {
+    public:
+      SipHash13()
+      {
+	k[0] = k[1] = 0;
+      }
+
+      SipHash13(const std::uint64_t k0, const std::uint64_t k1)
+      {
+	k[0] = k0;
+	k[1] = k1;
+      }
+
+      std::uint64_t operator()(const std::uint64_t *words, const std::size_t n) const
+      {
+	std::uint64_t v0 = k[0] ^ 0x736f6d6570736575ULL;
+	std::uint64_t v1 = k[1] ^ 0x646f72616e646f6dULL;
+	std::uint64_t v2 = k[0] ^ 0x6c7967656e657261ULL;
+	std::uint64_t v3 = k[1] ^ 0x7465646279746573ULL;
+	for (std::size_t i = 0; i < n; ++i)
+	  {
+	    v3 ^= words[i];
+	    round(v0, v1, v2, v3);
+	    v0 ^= words[i];
+	  }
+	const std::uint64_t b = std::uint64_t(n * 8) << 56;
+	v3 ^= b;
+	round(v0, v1, v2, v3);
+	v0 ^= b;
+	v2 ^= 0xff;
+	round(v0, v1, v2, v3);
+	round(v0, v1, v2, v3);
+	round(v0, v1, v2, v3);
+	return v0 ^ v1 ^ v2 ^ v3;
+      }
+
+    private:
+      static std::uint64_t rotl(const std::uint64_t x, const int b)
+      {
+	return (x << b) | (x >> (64 - b));
+      }
+
+      static void round(std::uint64_t& v0, std::uint64_t& v1, std::uint64_t& v2, std::uint64_t& v3)
+      {
+	v0 += v1; v1 = rotl(v1, 13); v1 ^= v0; v0 = rotl(v0, 32);
+	v2 += v3; v3 = rotl(v3, 16); v3 ^= v2;
+	v0 += v3; v3 = rotl(v3, 21); v3 ^= v0;
+	v2 += v1; v1 = rotl(v1, 17); v1 ^= v2; v2 = rotl(v2, 32);
+      }
+
+      std::uint64_t k[2];
+    };
+
     inline void combine_data(std::size_t& seed, const void *data, std::size_t size)
     {
       while (size >= sizeof(std::uint32_t))
@@ -27,9 +27,11 @@
 #include <string>
 #include <iomanip>
 #include <sstream>
+#include <algorithm> // for std::min
 
 #include <openvpn/common/exception.hpp>
 #include <openvpn/common/string.hpp>
+#include <openvpn/common/simd.hpp>
 
 namespace openvpn {
 
@@ -59,13 +61,20 @@ namespace openvpn {
   {
     if (!data)
       return "NULL";
-    std::string ret;
-    ret.reserve(size*2+1);
+    std::string ret(size*2, '\0');
+    char *p = &ret[0];
+    if (SIMD::have_ssse3())
+      {
+	const size_t done = SIMD::hex_encode(p, data, size, caps);
+	data += done;
+	size -= done;
+	p += done * 2;
+      }
     while (size--)
       {
 	const unsigned char c = *data++;
-	ret += render_hex_char(c >> 4, caps);
-	ret += render_hex_char(c & 0x0F, caps);
+	*p++ = render_hex_char(c >> 4, caps);
+	*p++ = render_hex_char(c & 0x0F, caps);
       }
     return ret;
   }
@@ -152,8 +161,19 @@ namespace openvpn {
   inline void parse_hex(V& dest, const std::string& str)
   {
     const int len = int(str.length());
-    int i;
-    for (i = 0; i <= len - 2; i += 2)
+    int i = 0;
+    if (SIMD::have_ssse3())
+      {
+	unsigned char tmp[128];
+	size_t n;
+	while ((n = SIMD::hex_decode(tmp, str.c_str() + i, std::min(size_t(len - i), sizeof(tmp) * 2))))
+	  {
+	    for (size_t j = 0; j < n / 2; ++j)
+	      dest.push_back(tmp[j]);
+	    i += int(n);
+	  }
+      }
+    for (; i <= len - 2; i += 2)
       {
 	const int high = parse_hex_char(str[i]);
 	const int low = parse_hex_char(str[i+1]);
@@ -0,0 +1,108 @@
+//    OpenVPN -- An application to securely tunnel IP networks
+//               over a single port, with support for SSL/TLS-based
+//               session authentication and key exchange,
+//               packet encryption, packet authentication, and
+//               packet compression.
+//
+//    Copyright (C) 2012-2016 OpenVPN Technologies, Inc.
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU Affero General Public License Version 3
+//    as published by the Free Software Foundation.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU Affero General Public License for more details.
+//
+//    You should have received a copy of the GNU Affero General Public License
+//    along with this program in the COPYING file.
+//    If not, see <http://www.gnu.org/licenses/>.
+// Approximate per-subsystem accounting of memory held by a session.
+
+#ifndef OPENVPN_COMMON_MEMUSAGE_H
+#define OPENVPN_COMMON_MEMUSAGE_H
+
+#include <string>
+#include <sstream>
+
+#include <openvpn/common/size.hpp>
+
+namespace openvpn {
+
+  // Counts the bytes of heap buffers a session keeps between packets.
+  // Fixed-size members and allocator overhead are not included, and
+  // SSL library internals are opaque, so treat the totals as a lower
+  // bound useful for comparing sessions and observing compaction.
+  class MemUsage
+  {
+  public:
+    enum Type {
+      CONTROL=0,  // reliability layer, control channel queues and buffers
+      CRYPTO,     // data channel encrypt/decrypt work buffers
+      COMPRESS,   // compressor work buffers and state
+      N_TYPES
+    };
+
+    MemUsage()
+    {
+      for (size_t i = 0; i < N_TYPES; ++i)
+	bytes[i] = 0;
+    }
+
+    void add(const Type type, const size_t n)
+    {
+      bytes[type] += n;
+    }
+
+    size_t get(const Type type) const
+    {
+      return bytes[type];
+    }
+
+    size_t total() const
+    {
+      size_t ret = 0;
+      for (size_t i = 0; i < N_TYPES; ++i)
+	ret += bytes[i];
+      return ret;
+    }
+
+    MemUsage& operator+=(const MemUsage& other)
+    {
+      for (size_t i = 0; i < N_TYPES; ++i)
+	bytes[i] += other.bytes[i];
+      return *this;
+    }
+
+    static const char *type_name(const Type type)
+    {
+      switch (type)
+	{
+	case CONTROL:
+	  return "control";
+	case CRYPTO:
+	  return "crypto";
+	case COMPRESS:
+	  return "compress";
+	default:
+	  return "UNKNOWN";
+	}
+    }
+
+    std::string to_string() const
+    {
+      std::ostringstream os;
+      for (size_t i = 0; i < N_TYPES; ++i)
+	os << type_name(Type(i)) << '=' << bytes[i] << ' ';
+      os << "total=" << total();
+      return os.str();
+    }
+
+  private:
+    size_t bytes[N_TYPES];
+  };
+
+}
+
+#endif
@@ -0,0 +1,137 @@
+//    OpenVPN -- An application to securely tunnel IP networks
+//               over a single port, with support for SSL/TLS-based
+//               session authentication and key exchange,
+//               packet encryption, packet authentication, and
+//               packet compression.
+//
+//    Copyright (C) 2012-2016 OpenVPN Technologies, Inc.
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU Affero General Public License Version 3
+//    as published by the Free Software Foundation.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU Affero General Public License for more details.
+//
+//    You should have received a copy of the GNU Affero General Public License
+//    along with this program in the COPYING file.
+//    If not, see <http://www.gnu.org/licenses/>.
+
+// Read-only view of a whole file, memory-mapped where the platform
+// supports it, so that large files can be scanned without copying
+// them into a std::string first.
+
+#ifndef OPENVPN_COMMON_MMAPFILE_H
+#define OPENVPN_COMMON_MMAPFILE_H
+
+#include <string>
+#include <cstring> // for std::memchr
+#include <cstdint> // for std::uint64_t
+
+#include <openvpn/common/platform.hpp>
+#include <openvpn/common/exception.hpp>
+#include <openvpn/common/unicode.hpp>
+#include <openvpn/common/file.hpp>
+
+#ifdef OPENVPN_PLATFORM_TYPE_UNIX
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <openvpn/common/scoped_fd.hpp>
+#endif
+
+namespace openvpn {
+
+  class MappedFile
+  {
+  public:
+    MappedFile(const std::string& filename, const std::uint64_t max_size = 0)
+      : data_(nullptr),
+	size_(0),
+	offset_(0),
+	map_(nullptr),
+	map_size_(0)
+    {
+#ifdef OPENVPN_PLATFORM_TYPE_UNIX
+      ScopedFD fd(::open(filename.c_str(), O_RDONLY | O_CLOEXEC));
+      if (!fd.defined())
+	OPENVPN_THROW(open_file_error, "cannot open for read: " << filename);
+      struct stat st;
+      if (::fstat(fd(), &st) < 0 || !S_ISREG(st.st_mode))
+	{
+	  // not a regular file, fall back to reading it
+	  read_(filename, max_size);
+	  return;
+	}
+      if (max_size && std::uint64_t(st.st_size) > max_size)
+	OPENVPN_THROW(file_too_large, "file too large [" << st.st_size << '/' << max_size << "]: " << filename);
+      if (st.st_size)
+	{
+	  void *m = ::mmap(nullptr, size_t(st.st_size), PROT_READ, MAP_PRIVATE, fd(), 0);
+	  if (m == MAP_FAILED)
+	    OPENVPN_THROW(open_file_error, "cannot map: " << filename);
+	  map_ = m;
+	  map_size_ = size_t(st.st_size);
+	  data_ = (const char *)m;
+	  size_ = map_size_;
+	}
+#else
+      read_(filename, max_size);
+#endif
+    }
+
+    ~MappedFile()
+    {
+#ifdef OPENVPN_PLATFORM_TYPE_UNIX
+      if (map_)
+	::munmap(map_, map_size_);
+#endif
+    }
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    // same checks as read_text_utf8(): throw if the file is binary or
+    // malformed UTF-8, and skip a Windows UTF-8 BOM
+    void validate_text_utf8(const std::string& filename)
+    {
+      if (std::memchr(c_str(), 0, length()))
+	OPENVPN_THROW(file_is_binary, "file is binary: " << filename);
+      if (length() >= 3)
+	{
+	  const unsigned char *d = (const unsigned char *)c_str();
+	  if (d[0] == 0xEF && d[1] == 0xBB && d[2] == 0xBF)
+	    offset_ += 3;
+	}
+      if (!Unicode::is_valid_utf8_uchar_buf((const unsigned char *)c_str(), length()))
+	OPENVPN_THROW(file_not_utf8, "file is not UTF8: " << filename);
+    }
+
+    // string-like accessors, note that c_str() is not null terminated
+    const char *c_str() const { return data_ + offset_; }
+    size_t length() const { return size_ - offset_; }
+    size_t size() const { return length(); }
+
+  private:
+    void read_(const std::string& filename, const std::uint64_t max_size)
+    {
+      buf_ = read_binary(filename, max_size);
+      data_ = (const char *)buf_->c_data();
+      size_ = buf_->size();
+    }
+
+    const char *data_;
+    size_t size_;
+    size_t offset_;
+    void *map_;
+    size_t map_size_;
+    BufferPtr buf_; // fallback when the file can't be mapped
+  };
+
+}
+
+#endif
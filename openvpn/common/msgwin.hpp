@@ -115,6 +115,14 @@ namespace openvpn {
     // Return a reference to the object at the front of the queue
     M& ref_head() { return q_.front(); }
 
+    // Call f on each object currently held in the queue
+    template <typename F>
+    void for_each(F f) const
+    {
+      for (const auto& m : q_)
+	f(m);
+    }
+
     // Remove the object at head of queue, throw an exception if undefined
     void rm_head()
     {
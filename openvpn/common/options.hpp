@@ -55,6 +55,7 @@
 #include <type_traits> // for std::is_nothrow_move_constructible
 #include <unordered_map>
 #include <cstdint>     // for std::uint64_t
+#include <cstring>     // for std::memcmp
 
 #include <openvpn/common/rc.hpp>
 #include <openvpn/common/exception.hpp>
@@ -63,6 +64,7 @@
 #include <openvpn/common/hexstr.hpp>
 #include <openvpn/common/string.hpp>
 #include <openvpn/common/split.hpp>
+#include <openvpn/common/strview.hpp>
 #include <openvpn/common/splitlines.hpp>
 #include <openvpn/common/unicode.hpp>
 
@@ -119,6 +121,18 @@ namespace openvpn {
 	return STATUS_GOOD;
     }
 
+    static validate_status validate(const StringView& str, const size_t max_len)
+    {
+      const size_t len = max_len & ((size_t)MULTILINE-1);
+      if (!(max_len & MULTILINE)
+	  && (std::memchr(str.data(), '\r', str.size()) || std::memchr(str.data(), '\n', str.size())))
+	return STATUS_MULTILINE;
+      else if (len > 0 && Unicode::utf8_length(str) > len)
+	return STATUS_LENGTH;
+      else
+	return STATUS_GOOD;
+    }
+
     static const char *validate_status_description(const validate_status status)
     {
       switch (status)
@@ -368,6 +382,64 @@ namespace openvpn {
     std::vector<std::string> data;
   };
 
+  // A read-only option whose arguments are StringView slices of a
+  // caller-owned parse buffer, as produced by OptionList::parse_csv_view.
+  // Arguments are only copied into strings when asked for, so a
+  // consumer that just dispatches on the directive or inspects a few
+  // arguments allocates nothing.  Valid only while the buffer lives.
+  class OptionView
+  {
+  public:
+    size_t size() const { return data.size(); }
+    bool empty() const { return data.empty(); }
+
+    const StringView& ref(const size_t i) const { return data[i]; }
+
+    void min_args(const size_t n) const
+    {
+      if (data.size() < n)
+	OPENVPN_THROW(option_error, err_ref() << " must have at least " << n << " arguments");
+    }
+
+    void validate_arg(const size_t index, const size_t max_len) const
+    {
+      if (max_len > 0 && index < data.size())
+	{
+	  const Option::validate_status status = Option::validate(data[index], max_len);
+	  if (status != Option::STATUS_GOOD)
+	    OPENVPN_THROW(option_error, err_ref() << " is " << Option::validate_status_description(status));
+	}
+    }
+
+    // like Option::get, but materializes the argument
+    std::string get(const size_t index, const size_t max_len) const
+    {
+      min_args(index+1);
+      validate_arg(index, max_len);
+      return data[index].to_string();
+    }
+
+    // copy into an owning Option
+    Option to_option() const
+    {
+      Option opt;
+      opt.reserve(data.size());
+      for (auto &a : data)
+	opt.push_back(a.to_string());
+      return opt;
+    }
+
+    std::string err_ref() const
+    {
+      return to_option().err_ref();
+    }
+
+  private:
+    friend class OptionList;
+
+    std::vector<StringView> data;
+  };
+
   class OptionList : public std::vector<Option>, public RCCopyable<thread_unsafe_refcount>
   {
   public:
@@ -491,6 +563,11 @@ namespace openvpn {
 	opt.validate_arg(0, max_directive_len);
       }
 
+      void validate_directive(const OptionView& opt)
+      {
+	opt.validate_arg(0, max_directive_len);
+      }
+
     private:
       void check_overflow()
       {
@@ -699,15 +776,22 @@ namespace openvpn {
       map_.clear();
     }
 
-    // caller should call update_map() after this function
-    void parse_from_csv(const std::string& str, Limits* lim)
+    // Tokenize a comma-separated option list in place, calling
+    // func(const OptionView&) for each non-empty option.  data is
+    // compacted by the lexer and must outlive any views retained
+    // by func.  Applies the same limits as parse_from_csv.
+    template <typename F>
+    static void parse_csv_view(char *data, const size_t size, Limits* lim, F func)
     {
       if (lim)
-	lim->add_string(str);
-      std::vector<std::string> list = Split::by_char<std::vector<std::string>, Lex, Limits>(str, ',', 0, ~0, lim);
-      for (std::vector<std::string>::const_iterator i = list.begin(); i != list.end(); ++i)
+	lim->add_bytes(size);
+      std::vector<StringView> list;
+      Split::by_char_view<std::vector<StringView>, Lex, Limits>(list, data, size, ',', 0, ~0, lim);
+      OptionView opt;
+      for (auto &term : list)
 	{
-	  const Option opt = Split::by_space<Option, Lex, SpaceMatch, Limits>(*i, lim);
+	  opt.data.clear();
+	  Split::by_space_view<std::vector<StringView>, Lex, SpaceMatch, Limits>(opt.data, data + (term.data() - data), term.size(), lim);
 	  if (opt.size())
 	    {
 	      if (lim)
@@ -715,11 +799,20 @@ namespace openvpn {
 		  lim->add_opt();
 		  lim->validate_directive(opt);
 		}
-	      push_back(std::move(opt));
+	      func(static_cast<const OptionView&>(opt));
 	    }
 	}
     }
 
+    // caller should call update_map() after this function
+    void parse_from_csv(const std::string& str, Limits* lim)
+    {
+      std::string buf(str);
+      parse_csv_view(&buf[0], buf.length(), lim, [this](const OptionView& opt) {
+	  push_back(opt.to_option());
+	});
+    }
+
     // caller should call update_map() after this function
     void parse_from_argv(const std::vector<std::string>& argv)
     {
@@ -749,21 +842,18 @@ namespace openvpn {
       if (lim)
 	lim->add_string(str);
       SplitLines in(str, 0);
+      OptionView opt;
       while (in(true))
 	{
-	  const std::string& line = in.line_ref();
-	  Option opt;
-	  opt.reserve(2);
-	  Split::by_char_void<Option, NullLex, Limits>(opt, line, '=', 0, 1, lim);
-	  if (opt.size())
+	  std::string& line = in.line_ref();
+	  opt.data.clear();
+	  Split::by_char_view<std::vector<StringView>, NullLex, Limits>(opt.data, &line[0], line.length(), '=', 0, 1, lim);
+	  if (lim)
 	    {
-	      if (lim)
-		{
-		  lim->add_opt();
-		  lim->validate_directive(opt);
-		}
-	      push_back(std::move(opt));
+	      lim->add_opt();
+	      lim->validate_directive(opt);
 	    }
+	  push_back(opt.to_option());
 	}
     }
 
@@ -1279,6 +1369,16 @@ namespace openvpn {
 	}
     }
 
+    void add_item(Option&& opt)
+    {
+      if (!opt.empty())
+	{
+	  const size_t i = size();
+	  map_[opt.ref(0)].push_back((unsigned int)i);
+	  push_back(std::move(opt));
+	}
+    }
+
     // Return hash map used to locate options.
     const IndexMap& map() const { return map_; }
 
@@ -1334,24 +1434,30 @@ namespace openvpn {
     // detect multiline breakout attempt (return true)
     static bool detect_multiline_breakout_nothrow(const std::string& opt, const std::string& tag)
     {
-      std::string line;
-      for (auto &c : opt)
+      return detect_multiline_breakout_nothrow(opt.c_str(), opt.length(), tag);
+    }
+
+    // true if any line starts with </tag> (or with </ if tag is empty)
+    static bool detect_multiline_breakout_nothrow(const char *data, const size_t size, const std::string& tag)
+    {
+      const char *const end = data + size;
+      const char *p = data;
+      while (p < end)
 	{
-	  if (c == '\n' || c == '\r')
-	    line.clear();
-	  else
+	  const size_t rem = end - p;
+	  if (rem >= 2 && p[0] == '<' && p[1] == '/')
 	    {
-	      line += c;
 	      if (tag.empty())
-		{
-		  if (line.length() >= 2
-		      && line[0] == '<'
-		      && line[1] == '/')
-		    return true;
-		}
-	      else if (is_close_tag(line, tag))
+		return true;
+	      if (rem >= tag.length() + 3
+		  && std::memcmp(p + 2, tag.c_str(), tag.length()) == 0
+		  && p[tag.length() + 2] == '>')
 		return true;
 	    }
+	  while (p < end && *p != '\n' && *p != '\r')
+	    ++p;
+	  if (p < end)
+	    ++p;
 	}
       return false;
     }
@@ -1363,6 +1469,12 @@ namespace openvpn {
 	throw option_error("multiline breakout detected");
     }
 
+    static void detect_multiline_breakout(const char *data, const size_t size, const std::string& tag)
+    {
+      if (detect_multiline_breakout_nothrow(data, size, tag))
+	throw option_error("multiline breakout detected");
+    }
+
   private:
     // multiline tagging (meta)
 
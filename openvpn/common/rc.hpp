@@ -56,6 +56,7 @@
 #include <utility>
 
 #include <openvpn/common/olong.hpp>
+#include <openvpn/common/alloccount.hpp>
 
 #ifdef OPENVPN_RC_DEBUG
 #include <iostream>
@@ -250,11 +251,13 @@ namespace openvpn {
 
     void operator++() noexcept
     {
+      OPENVPN_ALLOC_COUNT(rc_ops);
       ++rc;
     }
 
     olong operator--() noexcept
     {
+      OPENVPN_ALLOC_COUNT(rc_ops);
       return --rc;
     }
 
@@ -323,11 +326,13 @@ namespace openvpn {
 
     void operator++() noexcept
     {
+      OPENVPN_ALLOC_COUNT(rc_atomic_ops);
       rc.fetch_add(1, std::memory_order_relaxed);
     }
 
     olong operator--() noexcept
     {
+      OPENVPN_ALLOC_COUNT(rc_atomic_ops);
       // http://www.boost.org/doc/libs/1_55_0/doc/html/atomic/usage_examples.html
       const olong ret = rc.fetch_sub(1, std::memory_order_release) - 1;
       if (ret == 0)
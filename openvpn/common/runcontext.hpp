@@ -52,6 +52,10 @@
 #include <openvpn/common/scoped_fd.hpp>
 #endif
 
+#if defined(OPENVPN_PLATFORM_LINUX)
+#include <openvpn/linux/topology.hpp>
+#endif
+
 namespace openvpn {
 
   struct RunContextLogEntry
@@ -146,6 +150,31 @@ namespace openvpn {
       threadlist[unit] = thread;
     }
 
+#if defined(OPENVPN_PLATFORM_LINUX)
+    // set before the worker threads are started
+    void set_topology(const ThreadTopology::Layout& layout)
+    {
+      topology = layout;
+      if (topology.defined())
+	OPENVPN_LOG(prefix << "Thread layout: " << topology.to_string());
+    }
+
+    const ThreadTopology::Layout& get_topology() const
+    {
+      return topology;
+    }
+#endif
+
+    // called from worker thread, before it allocates its
+    // buffers and sessions
+    void bind_thread(const unsigned int unit)
+    {
+#if defined(OPENVPN_PLATFORM_LINUX)
+      if (unit < topology.size() && !topology.bind(unit))
+	OPENVPN_LOG(prefix << "Thread " << unit << ": could not bind to cpu" << topology.cpu(unit));
+#endif
+    }
+
     // called from worker thread
     void set_server(const unsigned int unit, ServerThread* serv)
     {
@@ -371,6 +400,9 @@ namespace openvpn {
     AsioTimer exit_timer;
     std::string prefix;
     std::vector<std::thread*> threadlist;
+#if defined(OPENVPN_PLATFORM_LINUX)
+    ThreadTopology::Layout topology;
+#endif
 #ifdef ASIO_HAS_LOCAL_SOCKETS
     std::unique_ptr<asio::posix::stream_descriptor> exit_sock;
 #endif
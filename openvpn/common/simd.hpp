@@ -0,0 +1,220 @@
+//    OpenVPN -- An application to securely tunnel IP networks
+//               over a single port, with support for SSL/TLS-based
+//               session authentication and key exchange,
+//               packet encryption, packet authentication, and
+//               packet compression.
+//
+//    Copyright (C) 2012-2016 OpenVPN Technologies, Inc.
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU Affero General Public License Version 3
+//    as published by the Free Software Foundation.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU Affero General Public License for more details.
+//
+//    You should have received a copy of the GNU Affero General Public License
+//    along with this program in the COPYING file.
+//    If not, see <http://www.gnu.org/licenses/>.
+
+// SSSE3 kernels for the hex and base64 codecs and the HTTP header
+// scanner, selected at runtime.  Each kernel handles whole blocks only
+// and returns how much input it consumed, leaving the tail (or an
+// invalid block) to the scalar code.
+
+#ifndef OPENVPN_COMMON_SIMD_H
+#define OPENVPN_COMMON_SIMD_H
+
+#include <cstddef> // for std::size_t
+#include <cstring> // for std::memcpy
+
+#include <openvpn/common/cpufeat.hpp>
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__) && !defined(OPENVPN_NO_SIMD)
+#define OPENVPN_SIMD_SSSE3
+#include <immintrin.h>
+#endif
+
+namespace openvpn {
+  namespace SIMD {
+
+#ifdef OPENVPN_SIMD_SSSE3
+
+#define OPENVPN_SIMD_TARGET __attribute__((target("ssse3")))
+
+    inline bool have_ssse3()
+    {
+      return CPUFeatures::have(CPUFeatures::SSSE3);
+    }
+
+    // 16 bytes -> 32 hex chars per block
+    OPENVPN_SIMD_TARGET
+    inline std::size_t hex_encode(char *out, const unsigned char *in, std::size_t size, const bool caps)
+    {
+      const __m128i lut = caps
+	? _mm_setr_epi8('0','1','2','3','4','5','6','7','8','9','A','B','C','D','E','F')
+	: _mm_setr_epi8('0','1','2','3','4','5','6','7','8','9','a','b','c','d','e','f');
+      const __m128i mask = _mm_set1_epi8(0x0f);
+      std::size_t i = 0;
+      for (; i + 16 <= size; i += 16)
+	{
+	  const __m128i v = _mm_loadu_si128((const __m128i *)(in + i));
+	  const __m128i hi = _mm_shuffle_epi8(lut, _mm_and_si128(_mm_srli_epi16(v, 4), mask));
+	  const __m128i lo = _mm_shuffle_epi8(lut, _mm_and_si128(v, mask));
+	  _mm_storeu_si128((__m128i *)(out + i * 2), _mm_unpacklo_epi8(hi, lo));
+	  _mm_storeu_si128((__m128i *)(out + i * 2 + 16), _mm_unpackhi_epi8(hi, lo));
+	}
+      return i;
+    }
+
+    // map 16 hex chars to nibbles, return false if any is not a hex digit
+    OPENVPN_SIMD_TARGET
+    inline bool hex_nibbles(const __m128i v, __m128i& nib)
+    {
+      const __m128i lv = _mm_or_si128(v, _mm_set1_epi8(0x20));
+      const __m128i digit = _mm_and_si128(_mm_cmpgt_epi8(v, _mm_set1_epi8('0' - 1)),
+					  _mm_cmplt_epi8(v, _mm_set1_epi8('9' + 1)));
+      const __m128i alpha = _mm_and_si128(_mm_cmpgt_epi8(lv, _mm_set1_epi8('a' - 1)),
+					  _mm_cmplt_epi8(lv, _mm_set1_epi8('f' + 1)));
+      if (_mm_movemask_epi8(_mm_or_si128(digit, alpha)) != 0xffff)
+	return false;
+      nib = _mm_or_si128(_mm_and_si128(digit, _mm_sub_epi8(v, _mm_set1_epi8('0'))),
+			 _mm_and_si128(alpha, _mm_sub_epi8(lv, _mm_set1_epi8('a' - 10))));
+      return true;
+    }
+
+    // 32 hex chars -> 16 bytes per block, stops at the first block
+    // holding a non-hex char
+    OPENVPN_SIMD_TARGET
+    inline std::size_t hex_decode(unsigned char *out, const char *in, const std::size_t len)
+    {
+      const __m128i weights = _mm_set1_epi16(0x0110); // high nibble * 16 + low nibble
+      std::size_t i = 0;
+      for (; i + 32 <= len; i += 32)
+	{
+	  __m128i n0, n1;
+	  if (!hex_nibbles(_mm_loadu_si128((const __m128i *)(in + i)), n0)
+	      || !hex_nibbles(_mm_loadu_si128((const __m128i *)(in + i + 16)), n1))
+	    break;
+	  const __m128i b = _mm_packus_epi16(_mm_maddubs_epi16(n0, weights),
+					     _mm_maddubs_epi16(n1, weights));
+	  _mm_storeu_si128((__m128i *)(out + i / 2), b);
+	}
+      return i;
+    }
+
+    // 12 bytes -> 16 base64 chars per block.  Reads 16 bytes per block,
+    // so blocks are only taken while 16 bytes remain.  c62/c63 are the
+    // last two chars of the alphabet.
+    OPENVPN_SIMD_TARGET
+    inline std::size_t base64_encode(char *out, const unsigned char *in, const std::size_t size,
+				     const char c62, const char c63)
+    {
+      const __m128i shuf = _mm_setr_epi8(1,0,2,1, 4,3,5,4, 7,6,8,7, 10,9,11,10);
+      const __m128i lut = _mm_setr_epi8('a' - 26,
+					'0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+					'0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+					char(c62 - 62), char(c63 - 63), 'A', 0, 0);
+      std::size_t i = 0, o = 0;
+      for (; i + 16 <= size; i += 12, o += 16)
+	{
+	  // split each 3 byte group into four 6 bit indices
+	  const __m128i v = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(in + i)), shuf);
+	  const __m128i t0 = _mm_mulhi_epu16(_mm_and_si128(v, _mm_set1_epi32(0x0fc0fc00)),
+					     _mm_set1_epi32(0x04000040));
+	  const __m128i t1 = _mm_mullo_epi16(_mm_and_si128(v, _mm_set1_epi32(0x003f03f0)),
+					     _mm_set1_epi32(0x01000010));
+	  const __m128i idx = _mm_or_si128(t0, t1);
+
+	  // pick the range offset: 13 for 0..25, 0 for 26..51,
+	  // 1..10 for digits, 11 and 12 for the last two chars
+	  __m128i r = _mm_subs_epu8(idx, _mm_set1_epi8(51));
+	  r = _mm_or_si128(r, _mm_and_si128(_mm_cmpgt_epi8(_mm_set1_epi8(26), idx), _mm_set1_epi8(13)));
+	  _mm_storeu_si128((__m128i *)(out + o), _mm_add_epi8(_mm_shuffle_epi8(lut, r), idx));
+	}
+      return i;
+    }
+
+    // 16 base64 chars -> 12 bytes per block, stops at the first block
+    // holding padding or a char outside the alphabet
+    OPENVPN_SIMD_TARGET
+    inline std::size_t base64_decode(unsigned char *out, const char *in, const std::size_t len,
+				     const char c62, const char c63)
+    {
+      const __m128i pack = _mm_setr_epi8(2,1,0, 6,5,4, 10,9,8, 14,13,12, -1,-1,-1,-1);
+      std::size_t i = 0, o = 0;
+      for (; i + 16 <= len; i += 16, o += 12)
+	{
+	  const __m128i v = _mm_loadu_si128((const __m128i *)(in + i));
+	  const __m128i upper = _mm_and_si128(_mm_cmpgt_epi8(v, _mm_set1_epi8('A' - 1)),
+					      _mm_cmplt_epi8(v, _mm_set1_epi8('Z' + 1)));
+	  const __m128i lower = _mm_and_si128(_mm_cmpgt_epi8(v, _mm_set1_epi8('a' - 1)),
+					      _mm_cmplt_epi8(v, _mm_set1_epi8('z' + 1)));
+	  const __m128i digit = _mm_and_si128(_mm_cmpgt_epi8(v, _mm_set1_epi8('0' - 1)),
+					      _mm_cmplt_epi8(v, _mm_set1_epi8('9' + 1)));
+	  const __m128i e62 = _mm_cmpeq_epi8(v, _mm_set1_epi8(c62));
+	  const __m128i e63 = _mm_cmpeq_epi8(v, _mm_set1_epi8(c63));
+	  const __m128i valid = _mm_or_si128(_mm_or_si128(upper, lower),
+					     _mm_or_si128(digit, _mm_or_si128(e62, e63)));
+	  if (_mm_movemask_epi8(valid) != 0xffff)
+	    break;
+
+	  __m128i val = _mm_and_si128(upper, _mm_sub_epi8(v, _mm_set1_epi8('A')));
+	  val = _mm_or_si128(val, _mm_and_si128(lower, _mm_sub_epi8(v, _mm_set1_epi8('a' - 26))));
+	  val = _mm_or_si128(val, _mm_and_si128(digit, _mm_add_epi8(v, _mm_set1_epi8(52 - '0'))));
+	  val = _mm_or_si128(val, _mm_and_si128(e62, _mm_set1_epi8(62)));
+	  val = _mm_or_si128(val, _mm_and_si128(e63, _mm_set1_epi8(63)));
+
+	  // merge four 6 bit values into 3 bytes, then squeeze out the gaps
+	  const __m128i ab = _mm_maddubs_epi16(val, _mm_set1_epi32(0x01400140));
+	  const __m128i abcd = _mm_madd_epi16(ab, _mm_set1_epi32(0x00011000));
+	  unsigned char tmp[16];
+	  _mm_storeu_si128((__m128i *)tmp, _mm_shuffle_epi8(abcd, pack));
+	  std::memcpy(out + o, tmp, 12);
+	}
+      return i;
+    }
+
+    // Skip bytes that are not HTTP control characters (0-31, 127),
+    // nor, if high is set, 8-bit characters.  Stops at the block
+    // holding the first such byte and returns its offset.
+    OPENVPN_SIMD_TARGET
+    inline std::size_t http_skip_text(const unsigned char *in, const std::size_t len, const bool high)
+    {
+      const __m128i c31 = _mm_set1_epi8(31);
+      const __m128i del = _mm_set1_epi8(127);
+      const __m128i hmask = high ? _mm_set1_epi8(-1) : _mm_setzero_si128();
+      std::size_t i = 0;
+      for (; i + 16 <= len; i += 16)
+	{
+	  const __m128i v = _mm_loadu_si128((const __m128i *)(in + i));
+	  const __m128i ctl = _mm_or_si128(_mm_cmpeq_epi8(_mm_min_epu8(v, c31), v),
+					   _mm_cmpeq_epi8(v, del));
+	  const __m128i bad = _mm_or_si128(ctl, _mm_and_si128(hmask, _mm_cmplt_epi8(v, _mm_setzero_si128())));
+	  const int m = _mm_movemask_epi8(bad);
+	  if (m)
+	    return i + __builtin_ctz(m);
+	}
+      return i;
+    }
+
+#undef OPENVPN_SIMD_TARGET
+
+#else
+
+    inline bool have_ssse3() { return false; }
+
+    inline std::size_t hex_encode(char *, const unsigned char *, std::size_t, const bool) { return 0; }
+    inline std::size_t hex_decode(unsigned char *, const char *, const std::size_t) { return 0; }
+    inline std::size_t base64_encode(char *, const unsigned char *, const std::size_t, const char, const char) { return 0; }
+    inline std::size_t base64_decode(unsigned char *, const char *, const std::size_t, const char, const char) { return 0; }
+    inline std::size_t http_skip_text(const unsigned char *, const std::size_t, const bool) { return 0; }
+
+#endif
+
+  }
+}
+
+#endif
@@ -30,6 +30,11 @@
 #include <fcntl.h>
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <net/if.h>
+
+#include <string>
 
 #include <openvpn/common/exception.hpp>
 
@@ -65,6 +70,162 @@ namespace openvpn {
 	throw Exception("error setting TCP_NODELAY on socket");
     }
 
+#ifdef TCP_DEFER_ACCEPT
+    // set TCP_DEFER_ACCEPT on a TCP listener so that accept only
+    // completes once the client has sent data, or after a timeout
+    inline bool tcp_defer_accept(const int fd, const int seconds)
+    {
+      return ::setsockopt(fd, IPPROTO_TCP, TCP_DEFER_ACCEPT,
+			  (void *)&seconds, sizeof(seconds)) == 0;
+    }
+#endif
+
+#ifdef TCP_FASTOPEN
+    // enable TCP Fast Open on a TCP listener, qlen is the max
+    // number of pending TFO connections
+    inline bool tcp_fastopen(const int fd, const int qlen)
+    {
+      return ::setsockopt(fd, IPPROTO_TCP, TCP_FASTOPEN,
+			  (void *)&qlen, sizeof(qlen)) == 0;
+    }
+#endif
+
+#ifdef TCP_FASTOPEN_CONNECT
+    // enable TCP Fast Open on a client socket before connect, the
+    // first write then goes out in the SYN if a cookie is cached
+    inline bool tcp_fastopen_connect(const int fd)
+    {
+      int on = 1;
+      return ::setsockopt(fd, IPPROTO_TCP, TCP_FASTOPEN_CONNECT,
+			  (void *)&on, sizeof(on)) == 0;
+    }
+#endif
+
+    // Set DF on outgoing UDP packets without letting the kernel's
+    // cached path MTU block larger sends, so that PMTU probes
+    // go out as sized.  No-op where not supported.
+    inline void pmtu_probe(const int fd, const bool ipv6)
+    {
+#if defined(IP_MTU_DISCOVER) && defined(IP_PMTUDISC_PROBE)
+      if (ipv6)
+	{
+#if defined(IPV6_MTU_DISCOVER) && defined(IPV6_PMTUDISC_PROBE)
+	  int v6 = IPV6_PMTUDISC_PROBE;
+	  if (::setsockopt(fd, IPPROTO_IPV6, IPV6_MTU_DISCOVER,
+			   (void *)&v6, sizeof(v6)) < 0)
+	    throw Exception("error setting IPV6_MTU_DISCOVER on socket");
+#endif
+	}
+      else
+	{
+	  int v = IP_PMTUDISC_PROBE;
+	  if (::setsockopt(fd, IPPROTO_IP, IP_MTU_DISCOVER,
+			   (void *)&v, sizeof(v)) < 0)
+	    throw Exception("error setting IP_MTU_DISCOVER on socket");
+	}
+#elif defined(IP_DONTFRAG)
+      int on = 1;
+      if (::setsockopt(fd, ipv6 ? IPPROTO_IPV6 : IPPROTO_IP, ipv6 ? IPV6_DONTFRAG : IP_DONTFRAG,
+		       (void *)&on, sizeof(on)) < 0)
+	throw Exception("error setting IP_DONTFRAG on socket");
+#endif
+    }
+
+    // Send through the local interface dev, whatever the routing
+    // table says, such as one sub-flow per uplink for multipath.
+    inline void bind_device(const int fd, const std::string& dev, const bool ipv6)
+    {
+#if defined(SO_BINDTODEVICE)
+      if (::setsockopt(fd, SOL_SOCKET, SO_BINDTODEVICE,
+		       dev.c_str(), socklen_t(dev.length())) < 0)
+	throw Exception("error setting SO_BINDTODEVICE on socket");
+#elif defined(IP_BOUND_IF)
+      const unsigned int index = ::if_nametoindex(dev.c_str());
+      if (!index)
+	throw Exception("unknown interface " + dev);
+      if (ipv6)
+	{
+	  if (::setsockopt(fd, IPPROTO_IPV6, IPV6_BOUND_IF,
+			   (void *)&index, sizeof(index)) < 0)
+	    throw Exception("error setting IPV6_BOUND_IF on socket");
+	}
+      else
+	{
+	  if (::setsockopt(fd, IPPROTO_IP, IP_BOUND_IF,
+			   (void *)&index, sizeof(index)) < 0)
+	    throw Exception("error setting IP_BOUND_IF on socket");
+	}
+#else
+      throw Exception("binding a socket to an interface is not supported");
+#endif
+    }
+
+    // Set the socket receive/send buffer size in bytes.  Tries the
+    // privileged *BUFFORCE variant first, which may exceed the system
+    // maximum, then falls back to the capped request.  Returns false
+    // if neither succeeded.
+    inline bool set_rcvbuf(const int fd, const int size)
+    {
+#ifdef SO_RCVBUFFORCE
+      if (::setsockopt(fd, SOL_SOCKET, SO_RCVBUFFORCE, (void *)&size, sizeof(size)) == 0)
+	return true;
+#endif
+      return ::setsockopt(fd, SOL_SOCKET, SO_RCVBUF, (void *)&size, sizeof(size)) == 0;
+    }
+
+    inline bool set_sndbuf(const int fd, const int size)
+    {
+#ifdef SO_SNDBUFFORCE
+      if (::setsockopt(fd, SOL_SOCKET, SO_SNDBUFFORCE, (void *)&size, sizeof(size)) == 0)
+	return true;
+#endif
+      return ::setsockopt(fd, SOL_SOCKET, SO_SNDBUF, (void *)&size, sizeof(size)) == 0;
+    }
+
+    // Current buffer sizes as reported by the kernel (on Linux,
+    // twice the requested size to account for bookkeeping), 0 on error.
+    inline int get_rcvbuf(const int fd)
+    {
+      int size = 0;
+      socklen_t len = sizeof(size);
+      if (::getsockopt(fd, SOL_SOCKET, SO_RCVBUF, (void *)&size, &len) < 0)
+	return 0;
+      return size;
+    }
+
+    inline int get_sndbuf(const int fd)
+    {
+      int size = 0;
+      socklen_t len = sizeof(size);
+      if (::getsockopt(fd, SOL_SOCKET, SO_SNDBUF, (void *)&size, &len) < 0)
+	return 0;
+      return size;
+    }
+
+#ifdef SO_RXQ_OVFL
+    // Ask for a SO_RXQ_OVFL cmsg on received datagrams, holding the
+    // number of datagrams the socket's receive queue dropped so far.
+    inline void rxq_ovfl(const int fd)
+    {
+      int on = 1;
+      if (::setsockopt(fd, SOL_SOCKET, SO_RXQ_OVFL,
+		       (void *)&on, sizeof(on)) < 0)
+	throw Exception("error setting SO_RXQ_OVFL on socket");
+    }
+#endif
+
+#ifdef SO_BUSY_POLL
+    // Let the kernel busy poll the device queue for up to usec
+    // microseconds on reads of this socket when it is empty.  Values
+    // above net.core.busy_read need CAP_NET_ADMIN, returns false if
+    // the option couldn't be set.
+    inline bool busy_poll(const int fd, const int usec)
+    {
+      return ::setsockopt(fd, SOL_SOCKET, SO_BUSY_POLL,
+			  (void *)&usec, sizeof(usec)) == 0;
+    }
+#endif
+
     // set FD_CLOEXEC to prevent fd from being passed across execs
     inline void set_cloexec(const int fd)
     {
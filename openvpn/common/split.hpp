@@ -32,6 +32,7 @@
 
 #include <openvpn/common/size.hpp>
 #include <openvpn/common/lex.hpp>
+#include <openvpn/common/strview.hpp>
 
 namespace openvpn {
   namespace Split {
@@ -151,6 +152,81 @@ namespace openvpn {
       by_space_void<V, LEX, SPACE, LIM>(ret, input, lim);
       return ret;
     }
+
+    // Zero-copy forms of by_char_void and by_space_void.  Rather than
+    // building a string per term, terms are returned as StringView
+    // slices of data[0..size), which the caller owns and which must
+    // outlive them.  Where the lexer drops characters (quotes,
+    // backslash escapes, TRIM_SPECIAL) the terms are compacted in
+    // place, so data is modified.  The results match by_char_void
+    // and by_space_void for the same LEX, flags and limits.
+    // Types:
+    //   V : vector of StringView
+    template <typename V, typename LEX, typename LIM>
+    inline void by_char_view(V& ret, char *data, const size_t size, const char split_by, const unsigned int flags=0, const unsigned int max_terms=~0, LIM* lim=nullptr)
+    {
+      LEX lex;
+      unsigned int nterms = 0;
+      char *term = data;
+      char *w = data;
+      for (size_t i = 0; i < size; ++i)
+	{
+	  const char c = data[i];
+	  lex.put(c);
+	  if (!lex.in_quote() && c == split_by && nterms < max_terms)
+	    {
+	      if (lim)
+		lim->add_term();
+	      ret.emplace_back(term, w - term);
+	      ++nterms;
+	      term = w;
+	    }
+	  else if ((!(flags & TRIM_SPECIAL) || lex.available())
+		   && (!(flags & TRIM_LEADING_SPACES) || w != term || !SpaceMatch::is_space(c)))
+	    *w++ = c;
+	}
+      if (lim)
+	lim->add_term();
+      ret.emplace_back(term, w - term);
+    }
+
+    template <typename V, typename LEX, typename SPACE, typename LIM>
+    inline void by_space_view(V& ret, char *data, const size_t size, LIM* lim=nullptr)
+    {
+      LEX lex;
+      char *term = data;
+      char *w = data;
+      bool defined = false;
+      for (size_t i = 0; i < size; ++i)
+	{
+	  lex.put(data[i]);
+	  if (lex.in_quote())
+	    defined = true;
+	  if (lex.available())
+	    {
+	      const char tc = lex.get();
+	      if (!SPACE::is_space(tc) || lex.in_quote())
+		{
+		  defined = true;
+		  *w++ = tc;
+		}
+	      else if (defined)
+		{
+		  if (lim)
+		    lim->add_term();
+		  ret.emplace_back(term, w - term);
+		  term = w;
+		  defined = false;
+		}
+	    }
+	}
+      if (defined)
+	{
+	  if (lim)
+	    lim->add_term();
+	  ret.emplace_back(term, w - term);
+	}
+    }
   }
 } // namespace openvpn
 
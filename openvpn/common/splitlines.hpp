@@ -25,6 +25,7 @@
 #define OPENVPN_COMMON_SPLITLINES_H
 
 #include <utility>
+#include <cstring> // for std::memchr
 
 #include <openvpn/common/string.hpp>
 
@@ -43,28 +44,34 @@ namespace openvpn {
     {
     }
 
+    SplitLinesType(const char *data_arg, const size_t size_arg, const size_t max_line_len_arg=0)
+      : data(data_arg),
+	size(size_arg),
+	max_line_len(max_line_len_arg)
+    {
+    }
+
     bool operator()(const bool trim=true)
     {
       line.clear();
       overflow = false;
-      const size_t overflow_index = index + max_line_len;
-      while (index < size)
-	{
-	  if (max_line_len && index >= overflow_index)
-	    {
-	      overflow = true;
-	      return true;
-	    }
-	  const char c = data[index++];
-	  line += c;
-	  if (c == '\n' || index >= size)
-	    {
-	      if (trim)
-		string::trim_crlf(line);
-	      return true;
-	    }
-	}
-      return false;
+      if (index >= size)
+	return false;
+
+      // search at most max_line_len chars ahead for the end of line
+      size_t end = size;
+      if (max_line_len && max_line_len < size - index)
+	end = index + max_line_len;
+      const char *nl = (const char *)std::memchr(data + index, '\n', end - index);
+      if (nl)
+	end = nl - data + 1;
+      else if (end < size)
+	overflow = true;
+      line.assign(data + index, end - index);
+      index = end;
+      if (trim && !overflow)
+	string::trim_crlf(line);
+      return true;
     }
 
     bool line_overflow() const
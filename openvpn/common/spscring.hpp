@@ -0,0 +1,91 @@
+//    OpenVPN -- An application to securely tunnel IP networks
+//               over a single port, with support for SSL/TLS-based
+//               session authentication and key exchange,
+//               packet encryption, packet authentication, and
+//               packet compression.
+//
+//    Copyright (C) 2012-2016 OpenVPN Technologies, Inc.
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU Affero General Public License Version 3
+//    as published by the Free Software Foundation.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU Affero General Public License for more details.
+//
+//    You should have received a copy of the GNU Affero General Public License
+//    along with this program in the COPYING file.
+//    If not, see <http://www.gnu.org/licenses/>.
+
+// Fixed-capacity lock-free ring for one producer thread and one
+// consumer thread.
+
+#ifndef OPENVPN_COMMON_SPSCRING_H
+#define OPENVPN_COMMON_SPSCRING_H
+
+#include <vector>
+#include <atomic>
+#include <utility>
+
+#include <openvpn/common/size.hpp>
+
+namespace openvpn {
+
+  template <typename T>
+  class SPSCRing
+  {
+  public:
+    // capacity is rounded up to a power of 2
+    explicit SPSCRing(const size_t capacity)
+      : slots(round_up(capacity)),
+	mask(slots.size() - 1)
+    {
+    }
+
+    // Producer side.  Never blocks, returns false if the ring is full.
+    bool push(T&& item)
+    {
+      const size_t t = tail.load(std::memory_order_relaxed);
+      if (t - head.load(std::memory_order_acquire) >= slots.size())
+	return false;
+      slots[t & mask] = std::move(item);
+      tail.store(t + 1, std::memory_order_release);
+      return true;
+    }
+
+    // Consumer side.  Returns false if the ring is empty.
+    bool pop(T& item)
+    {
+      const size_t h = head.load(std::memory_order_relaxed);
+      if (h == tail.load(std::memory_order_acquire))
+	return false;
+      item = std::move(slots[h & mask]);
+      head.store(h + 1, std::memory_order_release);
+      return true;
+    }
+
+    size_t capacity() const
+    {
+      return slots.size();
+    }
+
+  private:
+    static size_t round_up(const size_t n)
+    {
+      size_t ret = 1;
+      while (ret < n)
+	ret <<= 1;
+      return ret;
+    }
+
+    std::vector<T> slots;
+    const size_t mask;
+    std::atomic<size_t> head{0}; // next slot to pop
+    std::atomic<size_t> tail{0}; // next slot to push
+  };
+
+}
+
+#endif
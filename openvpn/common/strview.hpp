@@ -0,0 +1,108 @@
+//    OpenVPN -- An application to securely tunnel IP networks
+//               over a single port, with support for SSL/TLS-based
+//               session authentication and key exchange,
+//               packet encryption, packet authentication, and
+//               packet compression.
+//
+//    Copyright (C) 2012-2016 OpenVPN Technologies, Inc.
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU Affero General Public License Version 3
+//    as published by the Free Software Foundation.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU Affero General Public License for more details.
+//
+//    You should have received a copy of the GNU Affero General Public License
+//    along with this program in the COPYING file.
+//    If not, see <http://www.gnu.org/licenses/>.
+
+// A non-owning, read-only slice of a character buffer, for parsers
+// that hand out tokens without copying them.  Equivalent to the
+// subset of C++17 std::string_view we need, usable from C++11.
+
+#ifndef OPENVPN_COMMON_STRVIEW_H
+#define OPENVPN_COMMON_STRVIEW_H
+
+#include <string>
+#include <cstring>
+#include <ostream>
+
+#include <openvpn/common/size.hpp>
+
+namespace openvpn {
+
+  class StringView
+  {
+  public:
+    StringView() : data_(""), size_(0) {}
+
+    StringView(const char *data, const size_t size)
+      : data_(data), size_(size)
+    {
+    }
+
+    StringView(const char *str)
+      : data_(str), size_(std::strlen(str))
+    {
+    }
+
+    StringView(const std::string& str)
+      : data_(str.data()), size_(str.length())
+    {
+    }
+
+    const char *data() const { return data_; }
+    size_t size() const { return size_; }
+    size_t length() const { return size_; }
+    bool empty() const { return !size_; }
+
+    const char *begin() const { return data_; }
+    const char *end() const { return data_ + size_; }
+
+    const char& operator[](const size_t i) const { return data_[i]; }
+
+    std::string to_string() const
+    {
+      return std::string(data_, size_);
+    }
+
+    bool starts_with(const StringView& prefix) const
+    {
+      return size_ >= prefix.size_ && !std::memcmp(data_, prefix.data_, prefix.size_);
+    }
+
+    StringView substr(const size_t pos, size_t len = std::string::npos) const
+    {
+      if (pos >= size_)
+	return StringView(data_ + size_, 0);
+      if (len > size_ - pos)
+	len = size_ - pos;
+      return StringView(data_ + pos, len);
+    }
+
+    bool operator==(const StringView& other) const
+    {
+      return size_ == other.size_ && !std::memcmp(data_, other.data_, size_);
+    }
+
+    bool operator!=(const StringView& other) const
+    {
+      return !operator==(other);
+    }
+
+  private:
+    const char *data_;
+    size_t size_;
+  };
+
+  inline std::ostream& operator<<(std::ostream& os, const StringView& sv)
+  {
+    return os.write(sv.data(), sv.size());
+  }
+
+}
+
+#endif
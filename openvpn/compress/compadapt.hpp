@@ -0,0 +1,140 @@
+//    OpenVPN -- An application to securely tunnel IP networks
+//               over a single port, with support for SSL/TLS-based
+//               session authentication and key exchange,
+//               packet encryption, packet authentication, and
+//               packet compression.
+//
+//    Copyright (C) 2012-2016 OpenVPN Technologies, Inc.
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU Affero General Public License Version 3
+//    as published by the Free Software Foundation.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU Affero General Public License for more details.
+//
+//    You should have received a copy of the GNU Affero General Public License
+//    along with this program in the COPYING file.
+//    If not, see <http://www.gnu.org/licenses/>.
+// Track per-flow compressibility so that compressors can stop
+// spending cycles on flows that never shrink (TLS, media, archives).
+
+#ifndef OPENVPN_COMPRESS_COMPADAPT_H
+#define OPENVPN_COMPRESS_COMPADAPT_H
+
+#include <cstdint>
+
+#include <openvpn/common/size.hpp>
+#include <openvpn/buffer/buffer.hpp>
+#include <openvpn/ip/flowhash.hpp>
+
+namespace openvpn {
+
+  // Flows are identified by IPFlow::hash and kept in a small
+  // direct-mapped table, so a collision simply restarts tracking
+  // for the newcomer.  Each slot keeps an EWMA of out/in (in 1/256
+  // units).  Once a flow has shown itself incompressible it is
+  // skipped for a number of packets, doubling on every failed
+  // re-probe up to SKIP_MAX and resetting as soon as a probe wins.
+  class CompressAdapt
+  {
+  public:
+    enum {
+      SLOTS = 256,          // must be a power of 2
+      RATIO_ONE = 256,      // out/in == 1.0
+      RATIO_GIVE_UP = 243,  // less than ~5% savings isn't worth it
+      EWMA_SHIFT = 2,       // alpha = 1/4
+      MIN_SAMPLES = 2,      // samples needed before skipping
+      SKIP_MIN = 16,        // packets skipped after first verdict
+      SKIP_MAX = 1024,      // ... growing to this between probes
+    };
+
+    CompressAdapt()
+    {
+      for (auto &s : slots)
+	s.reset(0);
+    }
+
+    // Return true if the packet should be handed to the compressor.
+    // flow is set for the subsequent call to update().
+    bool consider(const Buffer& buf, std::size_t& flow)
+    {
+      flow = IPFlow::hash(buf);
+      Slot& s = slot(flow);
+      if (s.tag != flow)
+	{
+	  s.reset(flow);
+	  return true;
+	}
+      if (s.skip)
+	{
+	  --s.skip;
+	  ++n_skipped;
+	  return false;
+	}
+      return true;
+    }
+
+    // Record the outcome of a compression attempt, out == in
+    // when the compressor declined to shrink the packet.
+    void update(const std::size_t flow, const size_t in, const size_t out)
+    {
+      Slot& s = slot(flow);
+      if (s.tag != flow || !in)
+	return;
+
+      const unsigned int sample = out >= in ? (unsigned int)RATIO_ONE : (unsigned int)(out * RATIO_ONE / in);
+      if (s.samples)
+	s.ratio = (unsigned int)((int)s.ratio + (((int)sample - (int)s.ratio) >> EWMA_SHIFT));
+      else
+	s.ratio = sample;
+      if (s.samples < MIN_SAMPLES)
+	++s.samples;
+
+      if (s.samples >= MIN_SAMPLES && s.ratio >= RATIO_GIVE_UP)
+	{
+	  // incompressible: back off, then come back and re-probe
+	  s.skip = s.backoff;
+	  if (s.backoff < SKIP_MAX)
+	    s.backoff <<= 1;
+	}
+      else if (sample < RATIO_GIVE_UP)
+	s.backoff = SKIP_MIN;
+    }
+
+    // number of packets sent uncompressed without trying
+    std::uint64_t skipped() const { return n_skipped; }
+
+  private:
+    struct Slot
+    {
+      void reset(const std::size_t tag_arg)
+      {
+	tag = tag_arg;
+	ratio = RATIO_ONE;
+	samples = 0;
+	skip = 0;
+	backoff = SKIP_MIN;
+      }
+
+      std::size_t tag;
+      unsigned int ratio;
+      unsigned int samples;
+      unsigned int skip;
+      unsigned int backoff;
+    };
+
+    Slot& slot(const std::size_t flow)
+    {
+      return slots[flow & (SLOTS - 1)];
+    }
+
+    Slot slots[SLOTS];
+    std::uint64_t n_skipped = 0;
+  };
+
+}
+
+#endif
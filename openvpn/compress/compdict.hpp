@@ -0,0 +1,99 @@
+//    OpenVPN -- An application to securely tunnel IP networks
+//               over a single port, with support for SSL/TLS-based
+//               session authentication and key exchange,
+//               packet encryption, packet authentication, and
+//               packet compression.
+//
+//    Copyright (C) 2012-2016 OpenVPN Technologies, Inc.
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU Affero General Public License Version 3
+//    as published by the Free Software Foundation.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU Affero General Public License for more details.
+//
+//    You should have received a copy of the GNU Affero General Public License
+//    along with this program in the COPYING file.
+//    If not, see <http://www.gnu.org/licenses/>.
+// Preset dictionary of common protocol header bytes, used to prime
+// dictionary compressors so that small packets have something to
+// match against.  Both peers must use exactly the same bytes, so
+// this content is part of the wire protocol of the methods that
+// use it: never change it, add a new dictionary instead.
+
+#ifndef OPENVPN_COMPRESS_COMPDICT_H
+#define OPENVPN_COMPRESS_COMPDICT_H
+
+#include <string>
+
+namespace openvpn {
+  namespace CompressDict {
+
+    // Version 1 of the header dictionary.  Less common material
+    // comes first, since matchers prefer nearby (later) offsets.
+    inline const std::string& headers_v1()
+    {
+      static const std::string dict = []() {
+	// raw header templates
+	static const unsigned char bin[] = {
+	  // IPv4, 20 byte header, DF, TTL 64, TCP / UDP
+	  0x45, 0x00, 0x00, 0x00, 0x00, 0x00, 0x40, 0x00, 0x40, 0x06,
+	  0x45, 0x00, 0x00, 0x00, 0x00, 0x00, 0x40, 0x00, 0x40, 0x11,
+	  0x45, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x80, 0x11,
+	  // IPv6, TCP / UDP, hop limit 64
+	  0x60, 0x00, 0x00, 0x00, 0x00, 0x00, 0x06, 0x40,
+	  0x60, 0x00, 0x00, 0x00, 0x00, 0x00, 0x11, 0x40,
+	  // TCP SYN options: MSS 1460, SACK permitted, timestamps, NOP, wscale 7
+	  0x02, 0x04, 0x05, 0xb4, 0x04, 0x02, 0x08, 0x0a,
+	  0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+	  0x01, 0x03, 0x03, 0x07,
+	  // TCP ACK with timestamps: data offset 8, ACK / PSH+ACK
+	  0x80, 0x10, 0x01, 0xf6, 0x00, 0x00, 0x00, 0x00, 0x01, 0x01, 0x08, 0x0a,
+	  0x80, 0x18, 0x01, 0xf6, 0x00, 0x00, 0x00, 0x00, 0x01, 0x01, 0x08, 0x0a,
+	  // DNS: standard query, RD, 1 question / response, 1 answer
+	  0x01, 0x00, 0x00, 0x01, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+	  0x81, 0x80, 0x00, 0x01, 0x00, 0x01, 0x00, 0x00, 0x00, 0x00,
+	  // DNS: QTYPE A / AAAA, QCLASS IN, answer name pointer
+	  0x00, 0x00, 0x01, 0x00, 0x01, 0xc0, 0x0c, 0x00, 0x01, 0x00, 0x01,
+	  0x00, 0x00, 0x1c, 0x00, 0x01, 0xc0, 0x0c, 0x00, 0x1c, 0x00, 0x01,
+	  // DNS: EDNS0 OPT record, 1232 byte payload
+	  0x00, 0x00, 0x29, 0x04, 0xd0, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+	};
+
+	std::string d((const char *)bin, sizeof(bin));
+
+	// DNS labels (embedded nulls, so append by size)
+	static const char labels[] = "\x03www\x06google\x03""com\x00\x03""com\x00\x03net\x00\x03org\x00";
+	d.append(labels, sizeof(labels) - 1);
+
+	// HTTP/1.1 request and response headers
+	d += "Content-Type: application/json; charset=utf-8\r\n"
+	     "Content-Type: text/html; charset=UTF-8\r\n"
+	     "Cache-Control: no-cache\r\n"
+	     "Cache-Control: max-age=0\r\n"
+	     "Accept-Language: en-US,en;q=0.9\r\n"
+	     "Accept-Encoding: gzip, deflate, br\r\n"
+	     "Accept: text/html,application/xhtml+xml,application/xml;q=0.9,*/*;q=0.8\r\n"
+	     "User-Agent: Mozilla/5.0 (Windows NT 10.0; Win64; x64) AppleWebKit/537.36 (KHTML, like Gecko) Chrome/\r\n"
+	     "Connection: keep-alive\r\n"
+	     "Content-Length: \r\n"
+	     "Transfer-Encoding: chunked\r\n"
+	     "Date: \r\n"
+	     "Server: nginx\r\n"
+	     "HTTP/1.1 200 OK\r\n"
+	     "HTTP/1.1 304 Not Modified\r\n"
+	     "POST / HTTP/1.1\r\n"
+	     "GET / HTTP/1.1\r\n"
+	     "Host: www.";
+	return d;
+      }();
+      return dict;
+    }
+
+  }
+}
+
+#endif
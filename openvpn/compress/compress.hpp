@@ -20,18 +20,22 @@
 //    If not, see <http://www.gnu.org/licenses/>.
 
 // Base class and factory for compression/decompression objects.
-// Currently we support LZO, Snappy, and LZ4 implementations.
+// Currently we support LZO, Snappy, LZ4 and Zstandard implementations.
 
 #ifndef OPENVPN_COMPRESS_COMPRESS_H
 #define OPENVPN_COMPRESS_COMPRESS_H
 
+#include <memory>
+
 #include <openvpn/common/size.hpp>
 #include <openvpn/common/exception.hpp>
 #include <openvpn/common/rc.hpp>
 #include <openvpn/common/likely.hpp>
+#include <openvpn/common/memusage.hpp>
 #include <openvpn/buffer/buffer.hpp>
 #include <openvpn/frame/frame.hpp>
 #include <openvpn/log/sessionstats.hpp>
+#include <openvpn/compress/compadapt.hpp>
 
 #define OPENVPN_LOG_COMPRESS(x)
 #define OPENVPN_LOG_COMPRESS_VERBOSE(x)
@@ -65,6 +69,27 @@ namespace openvpn {
     // Decompression method implemented by underlying compression class.
     virtual void decompress(BufferAllocated& buf) = 0;
 
+    // If enabled (the default), compressors that support it stop
+    // trying on flows that have recently proven incompressible.
+    void set_adaptive(const bool enable)
+    {
+      adaptive = enable;
+      if (!enable)
+	adapt.reset();
+    }
+
+    const CompressAdapt* adaptive_state() const { return adapt.get(); }
+
+    // Release scratch buffers while the session is idle,
+    // they are reallocated by the next compress/decompress.
+    virtual void compact() {}
+
+    virtual void memory_usage(MemUsage& mu) const
+    {
+      if (adapt)
+	mu.add(MemUsage::COMPRESS, sizeof(CompressAdapt));
+    }
+
   protected:
     // magic numbers to indicate no compression
     enum {
@@ -79,6 +104,13 @@ namespace openvpn {
       // Compression algs
       OVPN_COMPv2_NONE=0,
       OVPN_COMPv2_LZ4=1,
+
+      // local extensions, only used when the peer
+      // advertises IV_LZ4_DICT / IV_ZSTD
+      OVPN_COMPv2_LZ4_DICT=0x10,
+      OVPN_COMPv2_ZSTD=0x11,
+      OVPN_COMPv2_HDR=0x20,      // | CID, header compressed
+      OVPN_COMPv2_HDR_FULL=0x30, // | CID, full header (re)establishes CID
     };
 
     Compress(const Frame::Ptr& frame_arg,
@@ -136,14 +168,35 @@ namespace openvpn {
       return uc;
     }
 
+    // Return false if buf belongs to a flow we are currently skipping.
+    bool adaptive_consider(const Buffer& buf, std::size_t& flow)
+    {
+      if (!adaptive)
+	return true;
+      if (!adapt)
+	adapt.reset(new CompressAdapt());
+      return adapt->consider(buf, flow);
+    }
+
+    void adaptive_update(const std::size_t flow, const size_t in, const size_t out)
+    {
+      if (adapt)
+	adapt->update(flow, in, out);
+    }
+
     Frame::Ptr frame;
     SessionStats::Ptr stats;
+
+  private:
+    bool adaptive = true;
+    std::unique_ptr<CompressAdapt> adapt;
   };
 }
 
 // include compressor implementations here
 #include <openvpn/compress/compnull.hpp>
 #include <openvpn/compress/compstub.hpp>
+#include <openvpn/compress/hdrcomp.hpp>
 
 #ifndef NO_LZO
 #include <openvpn/compress/lzoselect.hpp>
@@ -154,6 +207,9 @@ namespace openvpn {
 #ifdef HAVE_SNAPPY
 #include <openvpn/compress/snappy.hpp>
 #endif
+#ifdef HAVE_ZSTD
+#include <openvpn/compress/zstd.hpp>
+#endif
 
 namespace openvpn {
   class CompressContext
@@ -171,6 +227,9 @@ namespace openvpn {
       LZ4,
       LZ4v2,
       SNAPPY,
+      LZ4_DICTv2, // LZ4 with preset header dictionary, v2 protocol
+      ZSTDv2,     // Zstandard with preset header dictionary, v2 protocol
+      HDRv2,      // stateful IP/TCP/UDP header compression, v2 protocol
     };
 
     OPENVPN_SIMPLE_EXCEPTION(compressor_unavailable);
@@ -196,7 +255,11 @@ namespace openvpn {
 	  return 0;
 	case COMP_STUBv2:
 	case LZ4v2:
+	case LZ4_DICTv2:
+	case ZSTDv2:
 	  return 2; // worst case
+	case HDRv2:
+	  return 3; // escape, op|CID, generation
 	default:
 	  return 1;
 	}
@@ -216,6 +279,8 @@ namespace openvpn {
 	  return new CompressStub(frame, stats, true);
 	case COMP_STUBv2:
 	  return new CompressStubV2(frame, stats);
+	case HDRv2:
+	  return new CompressHeader(frame, stats, asym_);
 #ifndef NO_LZO
 	case LZO:
 	  return new CompressLZO(frame, stats, false, asym_);
@@ -227,6 +292,12 @@ namespace openvpn {
 	  return new CompressLZ4(frame, stats, asym_);
 	case LZ4v2:
 	  return new CompressLZ4v2(frame, stats, asym_);
+	case LZ4_DICTv2:
+	  return new CompressLZ4Dict(frame, stats, asym_);
+#endif
+#ifdef HAVE_ZSTD
+	case ZSTDv2:
+	  return new CompressZSTD(frame, stats, asym_);
 #endif
 #ifdef HAVE_SNAPPY
 	case SNAPPY:
@@ -247,6 +318,7 @@ namespace openvpn {
 	case LZO_STUB:
 	case COMP_STUB:
 	case COMP_STUBv2:
+	case HDRv2:
 	  return true;
 	case LZO:
 	case LZO_SWAP:
@@ -262,6 +334,7 @@ namespace openvpn {
 	  return false;
 #endif
 	case LZ4v2:
+	case LZ4_DICTv2:
 #ifdef HAVE_LZ4
 	  return true;
 #else
@@ -272,6 +345,12 @@ namespace openvpn {
 	  return true;
 #else
 	  return false;
+#endif
+	case ZSTDv2:
+#ifdef HAVE_ZSTD
+	  return true;
+#else
+	  return false;
 #endif
 	default:
 	  return false;
@@ -297,7 +376,15 @@ namespace openvpn {
 #ifdef HAVE_LZ4
 	case LZ4v2:
 	  return "IV_LZ4v2=1\n";
+	case LZ4_DICTv2:
+	  return "IV_LZ4_DICT=1\n";
+#endif
+#ifdef HAVE_ZSTD
+	case ZSTDv2:
+	  return "IV_ZSTD=1\n";
 #endif
+	case HDRv2:
+	  return "IV_COMP_HDR=1\n";
 #ifdef HAVE_SNAPPY
 	case SNAPPY:
 	  return "IV_SNAPPY=1\n";
@@ -324,7 +411,12 @@ namespace openvpn {
 #ifdef HAVE_LZ4
 	    "IV_LZ4=1\n"
 	    "IV_LZ4v2=1\n"
+	    "IV_LZ4_DICT=1\n"
+#endif
+#ifdef HAVE_ZSTD
+	    "IV_ZSTD=1\n"
 #endif
+	    "IV_COMP_HDR=1\n"
 	    "IV_COMP_STUB=1\n"
 	    "IV_COMP_STUBv2=1\n"
 	    ;
@@ -410,6 +502,9 @@ namespace openvpn {
 	case SNAPPY:
 	case LZ4:
 	case LZ4v2:
+	case LZ4_DICTv2:
+	case ZSTDv2:
+	case HDRv2:
 	case LZO_SWAP:
 	case COMP_STUB:
 	case COMP_STUBv2:
@@ -433,6 +528,12 @@ namespace openvpn {
 	  return "LZ4";
 	case LZ4v2:
 	  return "LZ4v2";
+	case LZ4_DICTv2:
+	  return "LZ4_DICTv2";
+	case ZSTDv2:
+	  return "ZSTDv2";
+	case HDRv2:
+	  return "HDRv2";
 	case SNAPPY:
 	  return "SNAPPY";
 	case LZO_STUB:
@@ -462,6 +563,12 @@ namespace openvpn {
 	return LZ4;
       else if (method == "lz4-v2")
 	return LZ4v2;
+      else if (method == "lz4-dict")
+	return LZ4_DICTv2;
+      else if (method == "zstd")
+	return ZSTDv2;
+      else if (method == "hdr")
+	return HDRv2;
       else if (method == "snappy")
 	return SNAPPY;
       else if (method == "stub")
@@ -478,6 +585,9 @@ namespace openvpn {
 	{
 	case COMP_STUBv2:
 	case LZ4v2:
+	case LZ4_DICTv2:
+	case ZSTDv2:
+	case HDRv2:
 	  return COMP_STUBv2;
 	default:
 	  return COMP_STUB;
@@ -0,0 +1,369 @@
+//    OpenVPN -- An application to securely tunnel IP networks
+//               over a single port, with support for SSL/TLS-based
+//               session authentication and key exchange,
+//               packet encryption, packet authentication, and
+//               packet compression.
+//
+//    Copyright (C) 2012-2016 OpenVPN Technologies, Inc.
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU Affero General Public License Version 3
+//    as published by the Free Software Foundation.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU Affero General Public License for more details.
+//
+//    You should have received a copy of the GNU Affero General Public License
+//    along with this program in the COPYING file.
+//    If not, see <http://www.gnu.org/licenses/>.
+#ifndef OPENVPN_COMPRESS_HDRCOMP_H
+#define OPENVPN_COMPRESS_HDRCOMP_H
+
+// Implement stateful compression of inner IPv4/IPv6 + TCP/UDP headers.
+// Should only be included by compress.hpp
+
+#include <cstring>
+#include <cstdint>
+
+#include <openvpn/common/socktypes.hpp>
+#include <openvpn/ip/ip.hpp>
+#include <openvpn/ip/udp.hpp>
+
+namespace openvpn {
+
+  // Header compression along the lines of ROHC unidirectional mode.
+  //
+  // Both peers keep up to N_CONTEXTS header templates indexed by a
+  // context ID (CID).  The compressor establishes a context by sending
+  // the packet unchanged, prefixed with its CID and a per-CID
+  // generation byte (FULL).  Later packets of the same flow carry only
+  // the CID, generation and the fields that cannot be inferred: the
+  // IPv4 ID and the UDP checksum.  Lengths and the IPv4 header
+  // checksum are rebuilt by the decompressor.
+  //
+  // There is no feedback channel, so the compressor repeats FULL for
+  // the first few packets of a context and then refreshes it
+  // periodically.  Compressed packets carry absolute values rather
+  // than deltas, so losing one never affects the next, and a packet
+  // that refers to a context the decompressor hasn't seen (or an older
+  // generation of it) is dropped quietly until the next refresh.
+  class CompressHeader : public Compress
+  {
+  public:
+    enum {
+      N_CONTEXTS = 16,  // CID lives in the low nibble of the v2 op
+      FULL_REPEAT = 3,  // FULL packets sent for a new context
+      REFRESH = 32,     // then one FULL every REFRESH packets
+      MAX_TEMPLATE = 48,
+    };
+
+    CompressHeader(const Frame::Ptr& frame, const SessionStats::Ptr& stats, const bool asym_arg)
+      : Compress(frame, stats),
+	asym(asym_arg),
+	next_victim(0)
+    {
+      OPENVPN_LOG_COMPRESS("HDR init asym=" << asym_arg);
+    }
+
+    virtual const char *name() const { return "hdr"; }
+
+    virtual void compact()
+    {
+      work.clear();
+    }
+
+    virtual void memory_usage(MemUsage& mu) const
+    {
+      Compress::memory_usage(mu);
+      mu.add(MemUsage::COMPRESS, work.capacity());
+    }
+
+    // hint refers to the payload, headers are always worth compressing
+    virtual void compress(BufferAllocated& buf, const bool hint)
+    {
+      // skip null packets
+      if (!buf.size())
+	return;
+
+      Layout lay;
+      if (!asym && parse(buf.c_data(), buf.size(), lay))
+	{
+	  unsigned char key[MAX_TEMPLATE];
+	  make_key(buf.c_data(), lay, key);
+	  const unsigned int cid = tx_context(lay, key);
+	  TxContext& c = tx[cid];
+
+	  ++c.count;
+	  if (c.count <= FULL_REPEAT || !(c.count % REFRESH))
+	    {
+	      unsigned char *h = buf.prepend_alloc(3);
+	      h[0] = COMPRESS_V2_ESCAPE;
+	      h[1] = OVPN_COMPv2_HDR_FULL | cid;
+	      h[2] = c.gen;
+	    }
+	  else
+	    {
+	      // save dynamic fields, then replace the header with them
+	      unsigned char dyn[4];
+	      size_t dyn_len = 0;
+	      if (lay.version == 4)
+		{
+		  std::memcpy(dyn + dyn_len, buf.c_data() + IPV4_ID_OFF, 2);
+		  dyn_len += 2;
+		}
+	      if (lay.proto == IPHeader::UDP)
+		{
+		  std::memcpy(dyn + dyn_len, buf.c_data() + lay.ip_hlen + UDP_CHECK_OFF, 2);
+		  dyn_len += 2;
+		}
+	      buf.advance(lay.tmpl_len);
+	      buf.prepend(dyn, dyn_len);
+	      unsigned char *h = buf.prepend_alloc(3);
+	      h[0] = COMPRESS_V2_ESCAPE;
+	      h[1] = OVPN_COMPv2_HDR | cid;
+	      h[2] = c.gen;
+	      OPENVPN_LOG_COMPRESS_VERBOSE("HDR compress cid=" << cid << ' ' << lay.tmpl_len << " -> " << (3 + dyn_len));
+	    }
+	  return;
+	}
+
+      // indicate that we didn't compress
+      v2_push(buf, OVPN_COMPv2_NONE);
+    }
+
+    virtual void decompress(BufferAllocated& buf)
+    {
+      // skip null packets
+      if (!buf.size())
+	return;
+
+      const int c = v2_pull(buf);
+      if (c == OVPN_COMPv2_NONE)
+	return;
+      if (!buf.size())
+	{
+	  error(buf);
+	  return;
+	}
+      const unsigned int cid = c & CID_MASK;
+      switch (c & ~CID_MASK)
+	{
+	case OVPN_COMPv2_HDR_FULL:
+	  {
+	    RxContext& rc = rx[cid];
+	    const unsigned char gen = buf.pop_front();
+	    if (!parse(buf.c_data(), buf.size(), rc.lay))
+	      {
+		rc.valid = false;
+		error(buf);
+		return;
+	      }
+	    std::memcpy(rc.tmpl, buf.c_data(), rc.lay.tmpl_len);
+	    rc.gen = gen;
+	    rc.valid = true;
+	  }
+	  break;
+	case OVPN_COMPv2_HDR:
+	  {
+	    const RxContext& rc = rx[cid];
+	    const unsigned char gen = buf.pop_front();
+	    if (!rc.valid || rc.gen != gen)
+	      {
+		// context FULL was lost, wait for a refresh
+		OPENVPN_LOG_COMPRESS_VERBOSE("HDR drop cid=" << cid << " gen=" << int(gen));
+		buf.reset_size();
+		return;
+	      }
+	    const Layout& lay = rc.lay;
+	    const size_t dyn_len = (lay.version == 4 ? 2 : 0) + (lay.proto == IPHeader::UDP ? 2 : 0);
+	    if (buf.size() < dyn_len)
+	      {
+		error(buf);
+		return;
+	      }
+	    const size_t total = lay.tmpl_len + buf.size() - dyn_len;
+
+	    // rebuild header in work buffer
+	    frame->prepare(Frame::DECOMPRESS_WORK, work);
+	    if (total > work.max_size() || total > 0xFFFF)
+	      {
+		error(buf);
+		return;
+	      }
+	    unsigned char *h = work.write_alloc(lay.tmpl_len);
+	    std::memcpy(h, rc.tmpl, lay.tmpl_len);
+	    const unsigned char *d = buf.c_data();
+	    if (lay.version == 4)
+	      {
+		std::memcpy(h + IPV4_ID_OFF, d, 2);
+		d += 2;
+		IPHeader* iph = (IPHeader*)h;
+		iph->tot_len = htons(std::uint16_t(total));
+		iph->check = 0;
+		iph->check = ip_checksum(h, lay.ip_hlen);
+	      }
+	    else
+	      write_u16(h + IPV6_PLEN_OFF, total - lay.ip_hlen);
+	    if (lay.proto == IPHeader::UDP)
+	      {
+		write_u16(h + lay.ip_hlen + UDP_LEN_OFF, total - lay.ip_hlen);
+		std::memcpy(h + lay.ip_hlen + UDP_CHECK_OFF, d, 2);
+	      }
+	    buf.advance(dyn_len);
+	    work.write(buf.c_data(), buf.size());
+	    OPENVPN_LOG_COMPRESS_VERBOSE("HDR uncompress cid=" << cid << " -> " << total);
+	    buf.swap(work);
+	  }
+	  break;
+	default:
+	  error(buf); // unknown op
+	  break;
+	}
+    }
+
+  private:
+    enum {
+      CID_MASK = 0x0F,
+      IPV4_ID_OFF = 4,
+      IPV6_HLEN = 40,
+      IPV6_PLEN_OFF = 4,
+      IPV6_NEXT_OFF = 6,
+      UDP_LEN_OFF = 4,
+      UDP_CHECK_OFF = 6,
+    };
+
+    struct Layout
+    {
+      unsigned int version = 0;
+      unsigned int ip_hlen = 0;
+      unsigned int proto = 0;
+      unsigned int tmpl_len = 0; // header bytes covered by the context
+    };
+
+    struct TxContext
+    {
+      bool used = false;
+      unsigned char gen = 0;
+      unsigned int count = 0;
+      unsigned int key_len = 0;
+      unsigned char key[MAX_TEMPLATE];
+    };
+
+    struct RxContext
+    {
+      bool valid = false;
+      unsigned char gen = 0;
+      Layout lay;
+      unsigned char tmpl[MAX_TEMPLATE];
+    };
+
+    static unsigned int read_u16(const unsigned char *p)
+    {
+      return (p[0] << 8) | p[1];
+    }
+
+    static void write_u16(unsigned char *p, const size_t v)
+    {
+      p[0] = (unsigned char)(v >> 8);
+      p[1] = (unsigned char)v;
+    }
+
+    // Decide whether a packet is eligible and how much of its header
+    // the context covers.  Must give identical results on both peers.
+    static bool parse(const unsigned char *data, const size_t size, Layout& lay)
+    {
+      if (size < 1)
+	return false;
+      lay.version = IPHeader::version(data[0]);
+      if (lay.version == 4)
+	{
+	  if (size < sizeof(IPHeader))
+	    return false;
+	  const IPHeader* iph = (const IPHeader*)data;
+	  lay.ip_hlen = IPHeader::length(iph->version_len);
+	  if (lay.ip_hlen != sizeof(IPHeader)                  // no options
+	      || (ntohs(iph->frag_off) & (IPHeader::OFFMASK|0x2000)) // no fragments
+	      || ntohs(iph->tot_len) != size)
+	    return false;
+	  lay.proto = iph->protocol;
+	}
+      else if (lay.version == 6)
+	{
+	  if (size < IPV6_HLEN || read_u16(data + IPV6_PLEN_OFF) + IPV6_HLEN != size)
+	    return false;
+	  lay.ip_hlen = IPV6_HLEN;
+	  lay.proto = data[IPV6_NEXT_OFF];
+	}
+      else
+	return false;
+
+      lay.tmpl_len = lay.ip_hlen;
+      if (lay.proto == IPHeader::UDP)
+	{
+	  if (size < lay.ip_hlen + sizeof(UDPHeader)
+	      || read_u16(data + lay.ip_hlen + UDP_LEN_OFF) != size - lay.ip_hlen)
+	    return false;
+	  lay.tmpl_len += sizeof(UDPHeader);
+	}
+      else if (lay.proto == IPHeader::TCP)
+	{
+	  // ports only, the rest of the TCP header travels as-is
+	  if (size < lay.ip_hlen + 20)
+	    return false;
+	  lay.tmpl_len += 4;
+	}
+      return true;
+    }
+
+    // template with the per-packet fields cleared
+    static void make_key(const unsigned char *data, const Layout& lay, unsigned char *key)
+    {
+      std::memcpy(key, data, lay.tmpl_len);
+      if (lay.version == 4)
+	{
+	  IPHeader* iph = (IPHeader*)key;
+	  iph->tot_len = 0;
+	  iph->id = 0;
+	  iph->check = 0;
+	}
+      else
+	write_u16(key + IPV6_PLEN_OFF, 0);
+      if (lay.proto == IPHeader::UDP)
+	{
+	  write_u16(key + lay.ip_hlen + UDP_LEN_OFF, 0);
+	  write_u16(key + lay.ip_hlen + UDP_CHECK_OFF, 0);
+	}
+    }
+
+    // find or (re)assign the context for key
+    unsigned int tx_context(const Layout& lay, const unsigned char *key)
+    {
+      for (unsigned int i = 0; i < N_CONTEXTS; ++i)
+	{
+	  const TxContext& c = tx[i];
+	  if (c.used && c.key_len == lay.tmpl_len && !std::memcmp(c.key, key, lay.tmpl_len))
+	    return i;
+	}
+      const unsigned int cid = next_victim;
+      next_victim = (next_victim + 1) % N_CONTEXTS;
+      TxContext& c = tx[cid];
+      c.used = true;
+      ++c.gen;
+      c.count = 0;
+      c.key_len = lay.tmpl_len;
+      std::memcpy(c.key, key, lay.tmpl_len);
+      return cid;
+    }
+
+    const bool asym;
+    unsigned int next_victim;
+    TxContext tx[N_CONTEXTS];
+    RxContext rx[N_CONTEXTS];
+    BufferAllocated work;
+  };
+
+} // namespace openvpn
+
+#endif // OPENVPN_COMPRESS_HDRCOMP_H
@@ -29,10 +29,24 @@
 
 #include <lz4.h>
 
+#include <openvpn/compress/compdict.hpp>
+
 namespace openvpn {
 
   class CompressLZ4Base : public Compress
   {
+  public:
+    virtual void compact()
+    {
+      work.clear();
+    }
+
+    virtual void memory_usage(MemUsage& mu) const
+    {
+      Compress::memory_usage(mu);
+      mu.add(MemUsage::COMPRESS, work.capacity());
+    }
+
   protected:
     CompressLZ4Base(const Frame::Ptr& frame, const SessionStats::Ptr& stats)
       : Compress(frame, stats)
@@ -129,9 +143,13 @@ namespace openvpn {
       if (!buf.size())
 	return;
 
-      if (hint && !asym)
+      std::size_t flow = 0;
+      if (hint && !asym && adaptive_consider(buf, flow))
 	{
-	  if (do_compress(buf))
+	  const size_t in = buf.size();
+	  const bool comp = do_compress(buf);
+	  adaptive_update(flow, in, comp ? buf.size() : in);
+	  if (comp)
 	    {
 	      do_swap(buf, LZ4_COMPRESS);
 	      return;
@@ -185,9 +203,13 @@ namespace openvpn {
       if (!buf.size())
 	return;
 
-      if (hint && !asym)
+      std::size_t flow = 0;
+      if (hint && !asym && adaptive_consider(buf, flow))
 	{
-	  if (do_compress(buf))
+	  const size_t in = buf.size();
+	  const bool comp = do_compress(buf);
+	  adaptive_update(flow, in, comp ? buf.size() : in);
+	  if (comp)
 	    {
 	      v2_push(buf, OVPN_COMPv2_LZ4);
 	      return;
@@ -221,6 +243,125 @@ namespace openvpn {
     const bool asym;
   };
 
+  // LZ4 primed with the preset header dictionary, which gives
+  // small packets something to match against.  Every packet is
+  // compressed against the pristine dictionary only, so packets
+  // remain independently decodable across loss and reordering.
+  class CompressLZ4Dict : public CompressLZ4Base
+  {
+  public:
+    CompressLZ4Dict(const Frame::Ptr& frame, const SessionStats::Ptr& stats, const bool asym_arg)
+      : CompressLZ4Base(frame, stats),
+	asym(asym_arg),
+	dict(CompressDict::headers_v1())
+    {
+      OPENVPN_LOG_COMPRESS("LZ4-DICT init asym=" << asym_arg << " dict=" << dict.size());
+    }
+
+    virtual const char *name() const { return "lz4-dict"; }
+
+    virtual void compress(BufferAllocated& buf, const bool hint)
+    {
+      // skip null packets
+      if (!buf.size())
+	return;
+
+      std::size_t flow = 0;
+      if (hint && !asym && adaptive_consider(buf, flow))
+	{
+	  const size_t in = buf.size();
+	  const bool comp = do_compress_dict(buf);
+	  adaptive_update(flow, in, comp ? buf.size() : in);
+	  if (comp)
+	    {
+	      v2_push(buf, OVPN_COMPv2_LZ4_DICT);
+	      return;
+	    }
+	}
+
+      // indicate that we didn't compress
+      v2_push(buf, OVPN_COMPv2_NONE);
+    }
+
+    virtual void decompress(BufferAllocated& buf)
+    {
+      // skip null packets
+      if (!buf.size())
+	return;
+
+      const int c = v2_pull(buf);
+      switch (c)
+	{
+	case OVPN_COMPv2_NONE:
+	  break;
+	case OVPN_COMPv2_LZ4_DICT:
+	  do_decompress_dict(buf);
+	  break;
+	default:
+	  error(buf); // unknown op
+	}
+    }
+
+  private:
+    bool do_compress_dict(BufferAllocated& buf)
+    {
+      // initialize work buffer
+      frame->prepare(Frame::COMPRESS_WORK, work);
+
+      // verify that input data length is not too large
+      if (lz4_extra_buffer(buf.size()) > work.max_size())
+	{
+	  error(buf);
+	  return false;
+	}
+
+      // do compress against a freshly loaded dictionary
+      LZ4_loadDict(&stream, dict.c_str(), (int)dict.size());
+      const int comp_size = LZ4_compress_fast_continue(&stream, (const char *)buf.c_data(), (char *)work.data(),
+						       (int)buf.size(), (int)work.max_size(), 1);
+
+      // did compression actually reduce data length?
+      if (comp_size < buf.size())
+	{
+	  if (comp_size <= 0)
+	    {
+	      error(buf);
+	      return false;
+	    }
+	  OPENVPN_LOG_COMPRESS_VERBOSE("LZ4-DICT compress " << buf.size() << " -> " << comp_size);
+	  work.set_size(comp_size);
+	  buf.swap(work);
+	  return true;
+	}
+      else
+	return false;
+    }
+
+    bool do_decompress_dict(BufferAllocated& buf)
+    {
+      // initialize work buffer
+      const int payload_size = frame->prepare(Frame::DECOMPRESS_WORK, work);
+
+      // do uncompress
+      const int decomp_size = LZ4_decompress_safe_usingDict((const char *)buf.c_data(), (char *)work.data(),
+							    (int)buf.size(), payload_size,
+							    dict.c_str(), (int)dict.size());
+      if (decomp_size < 0)
+	{
+	  error(buf);
+	  return false;
+	}
+      OPENVPN_LOG_COMPRESS_VERBOSE("LZ4-DICT uncompress " << buf.size() << " -> " << decomp_size);
+      work.set_size(decomp_size);
+      buf.swap(work);
+      return true;
+    }
+
+    const bool asym;
+    const std::string& dict;
+    LZ4_stream_t stream;
+  };
+
 }
 
 #endif
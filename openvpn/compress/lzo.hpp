@@ -25,6 +25,8 @@
 // Implement LZO compression.
 // Should only be included by lzoselect.hpp
 
+#include <mutex>
+
 #include "lzo/lzoutil.h"
 #include "lzo/lzo1x.h"
 
@@ -50,6 +52,9 @@ namespace openvpn {
 	asym(asym_arg)
     {
       OPENVPN_LOG_COMPRESS("LZO init swap=" << support_swap_arg << " asym=" << asym_arg);
+#ifdef OPENVPN_LAZY_INIT
+      init_static_once();
+#endif
       lzo_workspace.init(LZO1X_1_15_MEM_COMPRESS, BufferAllocated::ARRAY);
     }
 
@@ -59,8 +64,27 @@ namespace openvpn {
 	throw lzo_init_failed();
     }
 
+    // With OPENVPN_LAZY_INIT, InitProcess leaves LZO init to the
+    // first compressor instantiated.
+    static void init_static_once()
+    {
+      static std::once_flag once;
+      std::call_once(once, init_static);
+    }
+
     virtual const char *name() const { return "lzo"; }
 
+    virtual void compact()
+    {
+      work.clear();
+    }
+
+    virtual void memory_usage(MemUsage& mu) const
+    {
+      Compress::memory_usage(mu);
+      mu.add(MemUsage::COMPRESS, work.capacity() + lzo_workspace.capacity());
+    }
+
     void decompress_work(BufferAllocated& buf)
     {
       // initialize work buffer
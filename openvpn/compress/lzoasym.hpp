@@ -56,13 +56,26 @@ namespace openvpn {
 
     virtual const char *name() const { return "lzo-asym"; }
 
+    virtual void compact()
+    {
+      work.clear();
+    }
+
+    virtual void memory_usage(MemUsage& mu) const
+    {
+      Compress::memory_usage(mu);
+      mu.add(MemUsage::COMPRESS, work.capacity());
+    }
+
     void decompress_work(BufferAllocated& buf)
     {
       // initialize work buffer
       size_t zlen = frame->prepare(Frame::DECOMPRESS_WORK, work);
 
       // do uncompress
-      const int err = lzo_asym_impl::lzo1x_decompress_safe(buf.c_data(), buf.size(), work.data(), &zlen);
+      // the frame's tailroom lets the decoder use wild copies
+      const size_t slack = work.remaining() - zlen;
+      const int err = lzo_asym_impl::lzo1x_decompress_safe(buf.c_data(), buf.size(), work.data(), &zlen, slack);
       if (err != lzo_asym_impl::LZOASYM_E_OK)
 	{
 	  error(buf);
@@ -31,6 +31,7 @@
 #define OPENVPN_COMPRESS_LZOASYM_IMPL_H
 
 #include <cstdint> // for std::uint32_t, etc.
+#include <cstring> // for std::memcpy
 
 #include <openvpn/common/size.hpp>  // for ssize_t
 #include <openvpn/common/likely.hpp> // for likely/unlikely
@@ -184,10 +185,34 @@ namespace openvpn {
 	}
     }
 
+    // Wild copy: move whole 16 byte blocks, so up to 15 bytes may be
+    // read and written past the end of the copy.  Callers check for
+    // room on both sides with wild_room.  With overlapping regions,
+    // dest - src must be at least 16.
+    inline void wild_copy_16(unsigned char *dest, const unsigned char *src, ssize_t len)
+    {
+      do {
+	std::memcpy(dest, src, 16);
+	src += 16;
+	dest += 16;
+	len -= 16;
+      } while (len > 0);
+    }
+
+    inline bool wild_room(const unsigned char *p, const unsigned char *end, const size_t len)
+    {
+      return size_t(end - p) >= ((len + 15) & ~size_t(15));
+    }
+
+    // output_slack is the number of bytes beyond *output_length that
+    // may be scribbled on, which lets literal runs and matches use
+    // wild copies right up to the end of the packet.  The decoded
+    // length is still limited to *output_length.
     inline int lzo1x_decompress_safe(const unsigned char *input,
 				     size_t input_length,
 				     unsigned char *output,
-				     size_t *output_length)
+				     size_t *output_length,
+				     const size_t output_slack = 0)
     {
       size_t z;
       const unsigned char *input_ptr;
@@ -195,6 +220,7 @@ namespace openvpn {
       const unsigned char *match_ptr;
       const unsigned char *const input_ptr_end = input + input_length;
       unsigned char *const output_ptr_end = output + *output_length;
+      unsigned char *const output_wild_end = output_ptr_end + output_slack;
 
       *output_length = 0;
 
@@ -229,7 +255,11 @@ namespace openvpn {
 		    const size_t len = z + 3;
 		    LZOASYM_CHECK_OUTPUT_OVERFLOW(len);
 		    LZOASYM_CHECK_INPUT_OVERFLOW(len+1);
-		    copy_fast(output_ptr, input_ptr, len);
+		    if (LZOASYM_LIKELY(wild_room(output_ptr, output_wild_end, len))
+			&& LZOASYM_LIKELY(wild_room(input_ptr, input_ptr_end, len)))
+		      wild_copy_16(output_ptr, input_ptr, len);
+		    else
+		      copy_fast(output_ptr, input_ptr, len);
 		    input_ptr += len;
 		    output_ptr += len;
 		  }
@@ -322,10 +352,13 @@ namespace openvpn {
 		  LZOASYM_CHECK_OUTPUT_OVERFLOW(z+3-1);
 
 		  const size_t len = z + 2;
-		  // Should we use optimized incremental copy?
-		  // incremental_copy_fast might copy 10 more bytes than needed, so
-		  // don't use it unless we have enough trailing space in buffer.
-		  if (LZOASYM_LIKELY(size_t(output_ptr_end - output_ptr) >= len + 10))
+		  // Should we use a wild or optimized incremental copy?
+		  // Both might copy more bytes than needed, so don't use
+		  // them unless we have enough trailing space in buffer.
+		  if (LZOASYM_LIKELY(output_ptr - match_ptr >= 16)
+		      && LZOASYM_LIKELY(wild_room(output_ptr, output_wild_end, len)))
+		    wild_copy_16(output_ptr, match_ptr, len);
+		  else if (LZOASYM_LIKELY(size_t(output_wild_end - output_ptr) >= len + 10))
 		    incremental_copy_fast(output_ptr, match_ptr, len);
 		  else
 		    incremental_copy(output_ptr, match_ptr, len);
@@ -344,12 +377,23 @@ namespace openvpn {
 		LZOASYM_ASSERT(z < 4);
 		LZOASYM_CHECK_OUTPUT_OVERFLOW(z);
 		LZOASYM_CHECK_INPUT_OVERFLOW(z+1);
-		*output_ptr++ = *input_ptr++;
-		if (LZOASYM_LIKELY(z > 1))
+		if (LZOASYM_LIKELY(input_ptr_end - input_ptr >= 4)
+		    && LZOASYM_LIKELY(output_wild_end - output_ptr >= 4))
+		  {
+		    // copy 4, keep 1 to 3
+		    std::memcpy(output_ptr, input_ptr, 4);
+		    output_ptr += z;
+		    input_ptr += z;
+		  }
+		else
 		  {
 		    *output_ptr++ = *input_ptr++;
-		    if (z > 2)
-		      *output_ptr++ = *input_ptr++;
+		    if (LZOASYM_LIKELY(z > 1))
+		      {
+			*output_ptr++ = *input_ptr++;
+			if (z > 2)
+			  *output_ptr++ = *input_ptr++;
+		      }
 		  }
 		z = *input_ptr++;
 	      } while (LZOASYM_LIKELY(input_ptr < input_ptr_end) && LZOASYM_LIKELY(output_ptr <= output_ptr_end));
@@ -46,6 +46,17 @@ namespace openvpn {
 
     virtual const char *name() const { return "snappy"; }
 
+    virtual void compact()
+    {
+      work.clear();
+    }
+
+    virtual void memory_usage(MemUsage& mu) const
+    {
+      Compress::memory_usage(mu);
+      mu.add(MemUsage::COMPRESS, work.capacity());
+    }
+
     virtual void compress(BufferAllocated& buf, const bool hint)
     {
       // skip null packets
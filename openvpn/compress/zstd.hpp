@@ -0,0 +1,194 @@
+//    OpenVPN -- An application to securely tunnel IP networks
+//               over a single port, with support for SSL/TLS-based
+//               session authentication and key exchange,
+//               packet encryption, packet authentication, and
+//               packet compression.
+//
+//    Copyright (C) 2012-2016 OpenVPN Technologies, Inc.
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU Affero General Public License Version 3
+//    as published by the Free Software Foundation.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU Affero General Public License for more details.
+//
+//    You should have received a copy of the GNU Affero General Public License
+//    along with this program in the COPYING file.
+//    If not, see <http://www.gnu.org/licenses/>.
+#ifndef OPENVPN_COMPRESS_ZSTD_H
+#define OPENVPN_COMPRESS_ZSTD_H
+
+// Implement Zstandard compression.
+// Should only be included by compress.hpp
+
+#include <zstd.h>
+
+#include <openvpn/compress/compdict.hpp>
+
+namespace openvpn {
+
+  // Per-packet zstd at a low level, primed with the preset header
+  // dictionary.  Packets are independent of each other (no stream
+  // history), so loss and reordering are harmless.
+  class CompressZSTD : public Compress
+  {
+  public:
+    enum {
+      LEVEL = 1,
+    };
+
+    OPENVPN_SIMPLE_EXCEPTION(zstd_init_error);
+
+    CompressZSTD(const Frame::Ptr& frame, const SessionStats::Ptr& stats, const bool asym_arg)
+      : Compress(frame, stats),
+	asym(asym_arg),
+	cctx(nullptr),
+	dctx(nullptr),
+	cdict(nullptr),
+	ddict(nullptr)
+    {
+      const std::string& dict = CompressDict::headers_v1();
+      cctx = ZSTD_createCCtx();
+      dctx = ZSTD_createDCtx();
+      cdict = ZSTD_createCDict(dict.c_str(), dict.size(), LEVEL);
+      ddict = ZSTD_createDDict(dict.c_str(), dict.size());
+      if (!cctx || !dctx || !cdict || !ddict)
+	{
+	  free_ctx();
+	  throw zstd_init_error();
+	}
+      OPENVPN_LOG_COMPRESS("ZSTD init asym=" << asym_arg << " level=" << int(LEVEL));
+    }
+
+    virtual ~CompressZSTD()
+    {
+      free_ctx();
+    }
+
+    virtual const char *name() const { return "zstd"; }
+
+    virtual void compact()
+    {
+      work.clear();
+    }
+
+    virtual void memory_usage(MemUsage& mu) const
+    {
+      Compress::memory_usage(mu);
+      mu.add(MemUsage::COMPRESS, work.capacity());
+    }
+
+    virtual void compress(BufferAllocated& buf, const bool hint)
+    {
+      // skip null packets
+      if (!buf.size())
+	return;
+
+      std::size_t flow = 0;
+      if (hint && !asym && adaptive_consider(buf, flow))
+	{
+	  const size_t in = buf.size();
+	  const bool comp = do_compress(buf);
+	  adaptive_update(flow, in, comp ? buf.size() : in);
+	  if (comp)
+	    {
+	      v2_push(buf, OVPN_COMPv2_ZSTD);
+	      return;
+	    }
+	}
+
+      // indicate that we didn't compress
+      v2_push(buf, OVPN_COMPv2_NONE);
+    }
+
+    virtual void decompress(BufferAllocated& buf)
+    {
+      // skip null packets
+      if (!buf.size())
+	return;
+
+      const int c = v2_pull(buf);
+      switch (c)
+	{
+	case OVPN_COMPv2_NONE:
+	  break;
+	case OVPN_COMPv2_ZSTD:
+	  {
+	    // initialize work buffer
+	    const size_t payload_size = frame->prepare(Frame::DECOMPRESS_WORK, work);
+
+	    // do uncompress
+	    const size_t decomp_size = ZSTD_decompress_usingDDict(dctx, work.data(), payload_size,
+								  buf.c_data(), buf.size(), ddict);
+	    if (ZSTD_isError(decomp_size))
+	      {
+		error(buf);
+		break;
+	      }
+	    OPENVPN_LOG_COMPRESS_VERBOSE("ZSTD uncompress " << buf.size() << " -> " << decomp_size);
+	    work.set_size(decomp_size);
+	    buf.swap(work);
+	  }
+	  break;
+	default:
+	  error(buf); // unknown op
+	  break;
+	}
+    }
+
+  private:
+    bool do_compress(BufferAllocated& buf)
+    {
+      // initialize work buffer
+      frame->prepare(Frame::COMPRESS_WORK, work);
+
+      // verify that input data length is not too large
+      if (ZSTD_compressBound(buf.size()) > work.max_size())
+	{
+	  error(buf);
+	  return false;
+	}
+
+      // do compress
+      const size_t comp_size = ZSTD_compress_usingCDict(cctx, work.data(), work.max_size(),
+							buf.c_data(), buf.size(), cdict);
+      if (ZSTD_isError(comp_size))
+	{
+	  error(buf);
+	  return false;
+	}
+
+      // did compression actually reduce data length?
+      if (comp_size < buf.size())
+	{
+	  OPENVPN_LOG_COMPRESS_VERBOSE("ZSTD compress " << buf.size() << " -> " << comp_size);
+	  work.set_size(comp_size);
+	  buf.swap(work);
+	  return true;
+	}
+      else
+	return false;
+    }
+
+    void free_ctx()
+    {
+      ZSTD_freeCCtx(cctx);
+      ZSTD_freeDCtx(dctx);
+      ZSTD_freeCDict(cdict);
+      ZSTD_freeDDict(ddict);
+    }
+
+    const bool asym;
+    ZSTD_CCtx* cctx;
+    ZSTD_DCtx* dctx;
+    ZSTD_CDict* cdict;
+    ZSTD_DDict* ddict;
+    BufferAllocated work;
+  };
+
+} // namespace openvpn
+
+#endif // OPENVPN_COMPRESS_ZSTD_H
@@ -25,6 +25,7 @@
 #define OPENVPN_CRYPTO_CIPHER_H
 
 #include <string>
+#include <algorithm>
 
 #include <openvpn/common/size.hpp>
 #include <openvpn/common/exception.hpp>
@@ -123,7 +124,74 @@ namespace openvpn {
       return outlen;
     }
 
+    // Like encrypt, but feed the ciphertext to mac.update() a chunk at
+    // a time as it is produced, so that encrypt-then-MAC reads each
+    // part of the packet while it is still in cache.
+    template <typename MAC>
+    size_t encrypt_mac(const unsigned char *iv,
+		       unsigned char *out, const size_t out_size,
+		       const unsigned char *in, const size_t in_size,
+		       MAC& mac)
+    {
+      if (mode_ != CRYPTO_API::CipherContext::ENCRYPT)
+	throw cipher_mode_error();
+      if (out_size < output_size(in_size))
+	throw cipher_output_buffer();
+      ctx.reset(iv);
+      size_t outlen = 0;
+      size_t maclen = 0;
+      for (size_t i = 0; i < in_size; i += MAC_CHUNK)
+	{
+	  const size_t n = std::min(in_size - i, size_t(MAC_CHUNK));
+	  if (!ctx.update(out + outlen, out_size - outlen, in + i, n, outlen))
+	    return 0;
+	  mac.update(out + maclen, outlen - maclen);
+	  maclen = outlen;
+	}
+      if (!ctx.final(out + outlen, out_size - outlen, outlen))
+	return 0;
+      mac.update(out + maclen, outlen - maclen);
+      return outlen;
+    }
+
+    // Like decrypt, but feed the ciphertext to mac.update() a chunk at
+    // a time just before decrypting it.  The whole input is always
+    // passed to mac, even if decryption fails part way through, so
+    // that the caller can check the MAC before trusting the result.
+    template <typename MAC>
+    size_t decrypt_mac(const unsigned char *iv,
+		       unsigned char *out, const size_t out_size,
+		       const unsigned char *in, const size_t in_size,
+		       MAC& mac)
+    {
+      if (mode_ != CRYPTO_API::CipherContext::DECRYPT)
+	throw cipher_mode_error();
+      if (out_size < output_size(in_size))
+	throw cipher_output_buffer();
+      ctx.reset(iv);
+      size_t outlen = 0;
+      for (size_t i = 0; i < in_size; i += MAC_CHUNK)
+	{
+	  const size_t n = std::min(in_size - i, size_t(MAC_CHUNK));
+	  mac.update(in + i, n);
+	  if (!ctx.update(out + outlen, out_size - outlen, in + i, n, outlen))
+	    {
+	      mac.update(in + i + n, in_size - i - n);
+	      return 0;
+	    }
+	}
+      if (!ctx.final(out + outlen, out_size - outlen, outlen))
+	return 0;
+      return outlen;
+    }
+
   private:
+    // bytes of cipher input processed between MAC updates, a
+    // multiple of every supported cipher block size
+    enum {
+      MAC_CHUNK = 512
+    };
+
     int mode_;
     typename CRYPTO_API::CipherContext ctx;
   };
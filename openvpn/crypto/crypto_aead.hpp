@@ -25,21 +25,34 @@
 #define OPENVPN_CRYPTO_CRYPTO_AEAD_H
 
 #include <cstring>           // for std::memcpy, std::memset
+#include <cstdint>           // for std::uint64_t
+#include <algorithm>         // for std::min
+#include <utility>           // for std::move
+#include <memory>            // for std::unique_ptr
 
 #include <openvpn/common/size.hpp>
 #include <openvpn/common/exception.hpp>
+#include <openvpn/common/likely.hpp>
 #include <openvpn/buffer/buffer.hpp>
 #include <openvpn/frame/frame.hpp>
 #include <openvpn/crypto/static_key.hpp>
 #include <openvpn/crypto/packet_id.hpp>
 #include <openvpn/log/sessionstats.hpp>
 #include <openvpn/crypto/cryptodc.hpp>
+#include <openvpn/crypto/hkdf.hpp>
 
 // Sample AES-GCM head:
 //   48000001 00000005 7e7046bd 444a7e28 cc6387b1 64a4d6c1 380275a...
 //   [ OP32 ] [seq # ] [             auth tag            ] [ payload ... ]
 //            [4-byte
 //            IV head]
+//
+// With 64-bit packet IDs (PacketID::WIDE_FORM) the seq # is 8 bytes
+// and the IV becomes [8-byte pkt ID][4-byte nonce tail].
+//
+// With key epochs (init_epoch) the key and nonce tail change every
+// 2^epoch_bits packet IDs, so the upper bits of the cleartext seq #
+// tell the receiver which epoch key to use.
 
 namespace openvpn {
   namespace AEAD {
@@ -56,6 +69,7 @@ namespace openvpn {
 	  static_assert(4 + CRYPTO_API::CipherContextGCM::IV_LEN == sizeof(data),
 			"AEAD IV_LEN inconsistency");
 	  ad_op32 = false;
+	  pid_len = 4;
 	  std::memset(data, 0, sizeof(data));
 	}
 
@@ -67,12 +81,26 @@ namespace openvpn {
 	  std::memcpy(data + 8, sk.data(), 8);
 	}
 
-	// for encrypt
-	Nonce(const Nonce& ref, PacketIDSend& pid_send, const PacketID::time_t now,
+	// setup, after set_tail: widen the packet ID to 8 bytes,
+	// keeping the leading 4 bytes of the tail
+	void set_wide()
+	{
+	  if (pid_len == 4)
+	    {
+	      std::memmove(data + 12, data + 8, 4);
+	      std::memset(data + 8, 0, 4);
+	      pid_len = 8;
+	    }
+	}
+
+	// for encrypt, PID_SEND is PacketIDSend or PacketIDWideSend
+	template <typename PID_SEND>
+	Nonce(const Nonce& ref, PID_SEND& pid_send, const PacketID::time_t now,
 	      const unsigned char *op32)
 	{
 	  std::memcpy(data, ref.data, sizeof(data));
-	  Buffer buf(data + 4, 4, false);
+	  pid_len = ref.pid_len;
+	  Buffer buf(data + 4, pid_len, false);
 	  pid_send.write_next(buf, false, now);
 	  if (op32)
 	    {
@@ -86,14 +114,15 @@ namespace openvpn {
 	// for encrypt
 	void prepend_ad(Buffer& buf) const
 	{
-	  buf.prepend(data + 4, 4);
+	  buf.prepend(data + 4, pid_len);
 	}
 
 	// for decrypt
 	Nonce(const Nonce& ref, Buffer& buf, const unsigned char *op32)
 	{
 	  std::memcpy(data, ref.data, sizeof(data));
-	  buf.read(data + 4, 4);
+	  pid_len = ref.pid_len;
+	  buf.read(data + 4, pid_len);
 	  if (op32)
 	    {
 	      ad_op32 = true;
@@ -103,6 +132,21 @@ namespace openvpn {
 	    ad_op32 = false;
 	}
 
+	// for decrypt, the packet ID read by the constructor
+	std::uint64_t packet_id() const
+	{
+	  std::uint64_t ret = 0;
+	  for (unsigned int i = 0; i < pid_len; ++i)
+	    ret = (ret << 8) | data[4 + i];
+	  return ret;
+	}
+
+	// for decrypt, take the nonce tail of ref
+	void copy_tail(const Nonce& ref)
+	{
+	  std::memcpy(data + 4 + pid_len, ref.data + 4 + pid_len, sizeof(data) - 4 - pid_len);
+	}
+
 	// for decrypt
 	bool verify_packet_id(PacketIDReceive& pid_recv, const PacketID::time_t now)
 	{
@@ -111,6 +155,23 @@ namespace openvpn {
 	  return pid_recv.test_add(pid, now, true); // verify packet ID
 	}
 
+	// for decrypt, 64-bit packet IDs
+	bool verify_packet_id(PacketIDWideReceive& pid_recv, const PacketID::time_t now)
+	{
+	  Buffer buf(data + 4, 8, true);
+	  const PacketIDWide pid = pid_recv.read_next(buf);
+	  return pid_recv.test_add(pid, now, true); // verify packet ID
+	}
+
+	// for decrypt, on a window shared by several threads
+	Error::Type verify_packet_id(PacketIDReceiveShared& pid_shared)
+	{
+	  Buffer buf(data + 4, 4, true);
+	  PacketID pid;
+	  pid.read(buf, PacketID::SHORT_FORM);
+	  return pid_shared.do_test_add(pid);
+	}
+
 	const unsigned char *iv() const
 	{
 	  return data + 4;
@@ -123,11 +184,12 @@ namespace openvpn {
 
 	const size_t ad_len() const
 	{
-	  return ad_op32 ? 8 : 4;
+	  return (ad_op32 ? 4 : 0) + pid_len;
 	}
 
       private:
 	bool ad_op32; // true if AD includes op32 opcode
+	unsigned char pid_len; // 4, or 8 for 64-bit packet IDs
 
 	// Sample data:
 	//   [ OP32 (optional) ] [  pkt ID     ] [     nonce tail          ]
@@ -139,6 +201,7 @@ namespace openvpn {
 	typename CRYPTO_API::CipherContextGCM impl;
 	Nonce nonce;
 	PacketIDSend pid_send;
+	PacketIDWideSend pid_send_wide;
 	BufferAllocated work;
       };
 
@@ -146,8 +209,76 @@ namespace openvpn {
 	typename CRYPTO_API::CipherContextGCM impl;
 	Nonce nonce;
 	PacketIDReceive pid_recv;
+	PacketIDWideReceive pid_recv_wide;
+	PacketIDReceiveShared::Ptr pid_shared; // defined once lanes exist
 	BufferAllocated work;
       };
+
+      // One-way HKDF chain of epoch keys for one direction.  Each step
+      // replaces the PRK, so past epoch keys can't be derived again.
+      struct EpochChain {
+	void seed(const StaticKey& secret)
+	{
+	  static const unsigned char salt[] = "OpenVPN key epoch";
+	  HKDF<CRYPTO_API>::extract(CryptoAlgs::SHA256, salt, sizeof(salt) - 1,
+				    secret.data(), secret.size(), prk);
+	  n = 0;
+	}
+
+	// set up impl and nonce for epoch n, then step to n + 1
+	void next(const CryptoAlgs::Type cipher, const int mode, const bool wide,
+		  typename CRYPTO_API::CipherContextGCM& impl, Nonce& nonce)
+	{
+	  static const unsigned char key_info[] = "key";
+	  static const unsigned char chain_info[] = "chain";
+	  const size_t key_len = CryptoAlgs::key_length(cipher);
+	  unsigned char okm[64 + 8];
+	  if (key_len + 8 > sizeof(okm))
+	    throw aead_error("epoch key too long");
+
+	  HKDF<CRYPTO_API>::expand(CryptoAlgs::SHA256, prk, sizeof(prk),
+				   key_info, sizeof(key_info) - 1, okm, key_len + 8);
+	  impl.init(cipher, okm, (unsigned int)key_len, mode);
+	  nonce = Nonce();
+	  nonce.set_tail(StaticKey(okm + key_len, 8));
+	  if (wide)
+	    nonce.set_wide();
+
+	  HKDF<CRYPTO_API>::expand(CryptoAlgs::SHA256, prk, sizeof(prk),
+				   chain_info, sizeof(chain_info) - 1, okm, sizeof(prk));
+	  std::memcpy(prk, okm, sizeof(prk));
+	  std::memset(okm, 0, sizeof(okm));
+	  ++n;
+	}
+
+	~EpochChain()
+	{
+	  std::memset(prk, 0, sizeof(prk));
+	}
+
+	unsigned char prk[32];
+	std::uint64_t n = 0; // epoch of the next key
+      };
+
+      struct EpochSlot {
+	typename CRYPTO_API::CipherContextGCM impl;
+	Nonce nonce;
+	std::uint64_t n = 0;
+	bool defined = false;
+      };
+
+      struct Epoch {
+	enum { AHEAD = 2 }; // receive keys derived beyond the current epoch
+
+	unsigned int bits = 0;
+	PacketID::time_t period = 0;
+	PacketID::time_t send_deadline = 0;
+	bool send_last = false;   // no epoch left to step to, renegotiate
+	EpochChain send;          // current send epoch is send.n - 1
+	EpochChain recv;
+	EpochSlot slot[4];        // receive keys for recv_n - 1 .. recv_n + AHEAD, by n & 3
+	std::uint64_t recv_n = 0; // highest epoch received on
+      };
     public:
       typedef CryptoDCInstance Base;
 
@@ -156,7 +287,9 @@ namespace openvpn {
 	     const SessionStats::Ptr& stats_arg)
 	: cipher(cipher_arg),
 	  frame(frame_arg),
-	  stats(stats_arg)
+	  stats(stats_arg),
+	  recv_form(PacketID::LONG_FORM),
+	  wide(false)
       {
       }
 
@@ -168,15 +301,20 @@ namespace openvpn {
 	// only process non-null packets
 	if (buf.size())
 	  {
+	    if (unlikely(epoch != nullptr))
+	      epoch_send(now, 1);
+
 	    // build nonce/IV/AD
-	    Nonce nonce(e.nonce, e.pid_send, now, op32);
+	    const Nonce nonce = wide
+	      ? Nonce(e.nonce, e.pid_send_wide, now, op32)
+	      : Nonce(e.nonce, e.pid_send, now, op32);
 
 	    if (CRYPTO_API::CipherContextGCM::SUPPORTS_IN_PLACE_ENCRYPT)
 	      {
 		unsigned char *data = buf.data();
 		const size_t size = buf.size();
 
-		// alloc auth tag in buffer
+		// alloc auth tag in buffer headroom
 		unsigned char *auth_tag = buf.prepend_alloc(CRYPTO_API::CipherContextGCM::AUTH_TAG_LEN);
 
 		// encrypt in-place
@@ -203,7 +341,55 @@ namespace openvpn {
 	    // prepend additional data
 	    nonce.prepend_ad(buf);
 	  }
-	return e.pid_send.wrap_warning();
+	return send_wrap_warning();
+      }
+
+      // Burst encrypt in three passes over the batch: assign packet
+      // IDs and reserve tags, run the cipher back-to-back over all
+      // payloads so the key schedule and GHASH tables stay hot, then
+      // prepend the AD.  Back-ends without in-place encrypt use the loop.
+      virtual bool encrypt_batch(BufferAllocated** bufs, const size_t n, const PacketID::time_t now, const unsigned char *op32)
+      {
+	if (!CRYPTO_API::CipherContextGCM::SUPPORTS_IN_PLACE_ENCRYPT)
+	  return Base::encrypt_batch(bufs, n, now, op32);
+
+	enum { MAX_BATCH = 64 };
+	for (size_t base = 0; base < n; base += MAX_BATCH)
+	  {
+	    const size_t count = std::min(n - base, size_t(MAX_BATCH));
+	    BufferAllocated** b = bufs + base;
+	    unsigned char *auth_tag[MAX_BATCH];
+	    Nonce nonce[MAX_BATCH];
+
+	    if (unlikely(epoch != nullptr))
+	      epoch_send(now, count);
+
+	    for (size_t i = 0; i < count; ++i)
+	      {
+		if (b[i]->size())
+		  {
+		    nonce[i] = wide
+		      ? Nonce(e.nonce, e.pid_send_wide, now, op32)
+		      : Nonce(e.nonce, e.pid_send, now, op32);
+		    auth_tag[i] = b[i]->prepend_alloc(CRYPTO_API::CipherContextGCM::AUTH_TAG_LEN);
+		  }
+	      }
+	    for (size_t i = 0; i < count; ++i)
+	      {
+		if (b[i]->size())
+		  {
+		    unsigned char *data = auth_tag[i] + CRYPTO_API::CipherContextGCM::AUTH_TAG_LEN;
+		    const size_t size = b[i]->size() - CRYPTO_API::CipherContextGCM::AUTH_TAG_LEN;
+		    e.impl.encrypt(data, data, size, nonce[i].iv(), auth_tag[i], nonce[i].ad(), nonce[i].ad_len());
+		  }
+	      }
+	    for (size_t i = 0; i < count; ++i)
+	      {
+		if (b[i]->size())
+		  nonce[i].prepend_ad(*b[i]);
+	      }
+	  }
+	return send_wrap_warning();
       }
 
       virtual Error::Type decrypt(BufferAllocated& buf, const PacketID::time_t now, const unsigned char *op32)
@@ -217,33 +403,92 @@ namespace openvpn {
 	    // get auth tag
 	    unsigned char *auth_tag = buf.read_alloc(CRYPTO_API::CipherContextGCM::AUTH_TAG_LEN);
 
-	    // initialize work buffer
-	    frame->prepare(Frame::DECRYPT_WORK, d.work);
-	    if (d.work.max_size() < buf.size())
-	      throw aead_error("decrypt work buffer too small");
+	    // pick the key of the packet's epoch
+	    typename CRYPTO_API::CipherContextGCM* impl = &d.impl;
+	    std::uint64_t en = 0;
+	    if (unlikely(epoch != nullptr))
+	      {
+		en = nonce.packet_id() >> epoch->bits;
+		EpochSlot& es = epoch->slot[en & 3];
+		if (!es.defined || es.n != en)
+		  {
+		    buf.reset_size();
+		    return Error::DECRYPT_ERROR;
+		  }
+		nonce.copy_tail(es.nonce);
+		impl = &es.impl;
+	      }
 
-	    // decrypt from buf -> work
-	    if (!d.impl.decrypt(buf.c_data(), d.work.data(), buf.size(), nonce.iv(), auth_tag,
-				nonce.ad(), nonce.ad_len()))
+	    if (CRYPTO_API::CipherContextGCM::SUPPORTS_IN_PLACE_DECRYPT)
 	      {
-		buf.reset_size();
-		return Error::DECRYPT_ERROR;
+		unsigned char *data = buf.data();
+
+		// decrypt in-place
+		if (!impl->decrypt(data, data, buf.size(), nonce.iv(), auth_tag,
+				   nonce.ad(), nonce.ad_len()))
+		  {
+		    buf.reset_size();
+		    return Error::DECRYPT_ERROR;
+		  }
+	      }
+	    else
+	      {
+		// initialize work buffer
+		frame->prepare(Frame::DECRYPT_WORK, d.work);
+		if (d.work.max_size() < buf.size())
+		  throw aead_error("decrypt work buffer too small");
+
+		// decrypt from buf -> work
+		if (!impl->decrypt(buf.c_data(), d.work.data(), buf.size(), nonce.iv(), auth_tag,
+				   nonce.ad(), nonce.ad_len()))
+		  {
+		    buf.reset_size();
+		    return Error::DECRYPT_ERROR;
+		  }
+		d.work.set_size(buf.size());
 	      }
-	    d.work.set_size(buf.size());
 
 	    // verify packet ID
-	    if (!nonce.verify_packet_id(d.pid_recv, now))
+	    if (!verify_packet_id(nonce, now))
 	      {
 		buf.reset_size();
 		return Error::REPLAY_ERROR;
 	      }
+	    rx_pid = nonce.packet_id();
+
+	    // peer has moved on to a new epoch
+	    if (unlikely(epoch != nullptr) && en > epoch->recv_n)
+	      epoch_recv(en);
 
 	    // return cleartext result in buf
-	    buf.swap(d.work);
+	    if (!CRYPTO_API::CipherContextGCM::SUPPORTS_IN_PLACE_DECRYPT)
+	      buf.swap(d.work);
 	  }
 	return Error::SUCCESS;
       }
 
+      virtual bool decrypt_in_place() const
+      {
+	return CRYPTO_API::CipherContextGCM::SUPPORTS_IN_PLACE_DECRYPT;
+      }
+
+      // Lanes get their own cipher context keyed from a retained copy
+      // of the decrypt key, and switch this instance over to a shared
+      // replay window that starts above everything received so far.
+      virtual Base::Ptr new_decrypt_lane()
+      {
+	if (!d_key.size() || recv_form != PacketID::SHORT_FORM || epoch)
+	  return Base::Ptr();
+	if (!d.pid_shared)
+	  d.pid_shared.reset(new PacketIDReceiveShared(d.pid_recv.id_high_water()));
+	Crypto* lane = new Crypto(cipher, frame, SessionStats::Ptr());
+	Base::Ptr ret(lane);
+	lane->d.impl.init(cipher, d_key.data(), d_key.size(), CRYPTO_API::CipherContextGCM::DECRYPT);
+	lane->d.nonce = d.nonce;
+	lane->d.pid_shared = d.pid_shared;
+	return ret;
+      }
+
       // Initialization
 
       virtual void init_cipher(StaticKey&& encrypt_key,
@@ -251,6 +496,7 @@ namespace openvpn {
       {
 	e.impl.init(cipher, encrypt_key.data(), encrypt_key.size(), CRYPTO_API::CipherContextGCM::ENCRYPT);
 	d.impl.init(cipher, decrypt_key.data(), decrypt_key.size(), CRYPTO_API::CipherContextGCM::DECRYPT);
+	d_key = std::move(decrypt_key);
       }
 
       virtual void init_hmac(StaticKey&& encrypt_key,
@@ -267,8 +513,38 @@ namespace openvpn {
 			    const int recv_unit,
 			    const SessionStats::Ptr& recv_stats_arg)
       {
-	e.pid_send.init(send_form);
-	d.pid_recv.init(recv_mode, recv_form, recv_name, recv_unit, recv_stats_arg);
+	wide = (send_form == PacketID::WIDE_FORM);
+	if (wide)
+	  {
+	    e.nonce.set_wide();
+	    d.nonce.set_wide();
+	    e.pid_send_wide.init();
+	    d.pid_recv_wide.init(recv_mode, recv_form, recv_name, recv_unit, recv_stats_arg);
+	  }
+	else
+	  {
+	    e.pid_send.init(send_form);
+	    d.pid_recv.init(recv_mode, recv_form, recv_name, recv_unit, recv_stats_arg);
+	  }
+	this->recv_form = recv_form;
+      }
+
+      virtual bool init_epoch(const unsigned int epoch_bits,
+			      const unsigned int period,
+			      const StaticKey& encrypt_secret,
+			      const StaticKey& decrypt_secret)
+      {
+	if (epoch_bits < 1 || epoch_bits > (wide ? 62 : 31))
+	  throw aead_error("epoch bits out of range");
+	epoch.reset(new Epoch());
+	epoch->bits = epoch_bits;
+	epoch->period = period;
+	epoch->send.seed(encrypt_secret);
+	epoch->send.next(cipher, CRYPTO_API::CipherContextGCM::ENCRYPT, wide, e.impl, e.nonce);
+	epoch->recv.seed(decrypt_secret);
+	epoch_recv(0);
+	d_key.erase(); // only kept for lanes, which epochs don't use
+	return true;
       }
 
       // Indicate whether or not cipher/digest is defined
@@ -295,12 +571,102 @@ namespace openvpn {
       {
       }
 
+      virtual void compact()
+      {
+	e.work.clear();
+	d.work.clear();
+      }
+
+      virtual void memory_usage(MemUsage& mu) const
+      {
+	mu.add(MemUsage::CRYPTO, e.work.capacity() + d.work.capacity() + (epoch ? sizeof(Epoch) : 0));
+      }
+
     private:
+      bool send_wrap_warning() const
+      {
+	if (unlikely(epoch != nullptr) && epoch->send_last)
+	  return true;
+	return wide ? e.pid_send_wide.wrap_warning() : e.pid_send.wrap_warning();
+      }
+
+      // Step to the next send epoch if the next count packet IDs would
+      // run past the current one, or its period is up.  The packet ID
+      // jumps to the first ID of the new epoch, so a batch never spans
+      // two epochs and the peer sees when the period was up.
+      void epoch_send(const PacketID::time_t now, const size_t count)
+      {
+	Epoch& ep = *epoch;
+	const std::uint64_t cur = ep.send.n - 1;
+	const std::uint64_t next_id = 1 + (wide ? e.pid_send_wide.last_id() : e.pid_send.last_id());
+	if (!ep.send_deadline)
+	  ep.send_deadline = now + ep.period;
+	if (((next_id + count - 1) >> ep.bits) == cur && (!ep.period || now < ep.send_deadline))
+	  return;
+
+	// short packet IDs have no room for another epoch, so ask for
+	// a renegotiation, and stop sending once the IDs of this epoch
+	// run out rather than reuse the key beyond it
+	const std::uint64_t first = (cur + 1) << ep.bits;
+	if (!wide && first > 0xFFFFFFFFull)
+	  {
+	    if (((next_id + count - 1) >> ep.bits) != cur)
+	      throw aead_error("epoch packet IDs exhausted");
+	    ep.send_last = true;
+	    return;
+	  }
+	if (wide)
+	  e.pid_send_wide.skip_to(first);
+	else
+	  e.pid_send.skip_to(PacketID::id_t(first));
+	ep.send.next(cipher, CRYPTO_API::CipherContextGCM::ENCRYPT, wide, e.impl, e.nonce);
+	ep.send_deadline = now + ep.period;
+      }
+
+      // Make n the current receive epoch, deriving keys up to AHEAD
+      // epochs past it into the slots of the epochs left behind.
+      // Only called for a packet that authenticated under epoch n,
+      // so forged packets can't make us derive keys.
+      void epoch_recv(const std::uint64_t n)
+      {
+	Epoch& ep = *epoch;
+	ep.recv_n = n;
+	while (ep.recv.n <= n + Epoch::AHEAD)
+	  {
+	    EpochSlot& es = ep.slot[ep.recv.n & 3];
+	    es.n = ep.recv.n;
+	    ep.recv.next(cipher, CRYPTO_API::CipherContextGCM::DECRYPT, wide, es.impl, es.nonce);
+	    es.defined = true;
+	  }
+      }
+
+      bool verify_packet_id(Nonce& nonce, const PacketID::time_t now)
+      {
+	if (d.pid_shared)
+	  {
+	    const Error::Type err = nonce.verify_packet_id(*d.pid_shared);
+	    if (unlikely(err != Error::SUCCESS))
+	      {
+		if (stats) // undefined on lanes
+		  stats->error(err);
+		return false;
+	      }
+	    return true;
+	  }
+	if (wide)
+	  return nonce.verify_packet_id(d.pid_recv_wide, now);
+	return nonce.verify_packet_id(d.pid_recv, now);
+      }
+
       CryptoAlgs::Type cipher;
       Frame::Ptr frame;
       SessionStats::Ptr stats;
       Encrypt e;
       Decrypt d;
+      StaticKey d_key;  // retained for new_decrypt_lane
+      int recv_form;
+      bool wide;        // 64-bit packet IDs
+      std::unique_ptr<Epoch> epoch; // defined if key epochs are enabled
     };
 
     template <typename CRYPTO_API>
@@ -28,6 +28,7 @@
 #include <openvpn/crypto/decrypt_chm.hpp>
 #include <openvpn/crypto/cryptodc.hpp>
 #include <openvpn/random/randapi.hpp>
+#include <openvpn/random/chacharand.hpp>
 
 namespace openvpn {
 
@@ -50,7 +51,9 @@ namespace openvpn {
     {
       encrypt_.frame = frame;
       decrypt_.frame = frame;
-      encrypt_.prng = prng;
+      // CBC mode draws a random IV per packet, so serve IVs from
+      // a buffered DRBG seeded by prng rather than calling it each time
+      encrypt_.prng.reset(new ChaChaRand(prng));
     }
 
     // Encrypt/Decrypt
@@ -64,7 +67,9 @@ namespace openvpn {
 
     virtual Error::Type decrypt(BufferAllocated& buf, const PacketID::time_t now, const unsigned char *op32)
     {
-      return decrypt_.decrypt(buf, now);
+      const Error::Type err = decrypt_.decrypt(buf, now);
+      rx_pid = decrypt_.last_pid;
+      return err;
     }
 
     // Initialization
@@ -117,6 +122,17 @@ namespace openvpn {
     {
     }
 
+    virtual void compact()
+    {
+      encrypt_.release_work();
+      decrypt_.release_work();
+    }
+
+    virtual void memory_usage(MemUsage& mu) const
+    {
+      mu.add(MemUsage::CRYPTO, encrypt_.work_capacity() + decrypt_.work_capacity());
+    }
+
   private:
     CryptoAlgs::Type cipher;
     CryptoAlgs::Type digest;
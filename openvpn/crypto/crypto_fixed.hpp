@@ -0,0 +1,51 @@
+//    OpenVPN -- An application to securely tunnel IP networks
+//               over a single port, with support for SSL/TLS-based
+//               session authentication and key exchange,
+//               packet encryption, packet authentication, and
+//               packet compression.
+//
+//    Copyright (C) 2012-2016 OpenVPN Technologies, Inc.
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU Affero General Public License Version 3
+//    as published by the Free Software Foundation.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU Affero General Public License for more details.
+//
+//    You should have received a copy of the GNU Affero General Public License
+//    along with this program in the COPYING file.
+//    If not, see <http://www.gnu.org/licenses/>.
+
+// Compile-time selection of the data channel implementation, for
+// builds that ship exactly one (AEAD) cipher suite.
+
+#ifndef OPENVPN_CRYPTO_CRYPTO_FIXED_H
+#define OPENVPN_CRYPTO_CRYPTO_FIXED_H
+
+#ifdef OPENVPN_FIXED_DC_AEAD
+
+#include <openvpn/crypto/cryptodc.hpp>
+#include <openvpn/crypto/crypto_aead.hpp>
+#include <openvpn/ssl/sslchoose.hpp>
+
+namespace openvpn {
+
+  // Defining OPENVPN_FIXED_DC_AEAD makes ProtoContext call this class
+  // directly rather than through the virtual CryptoDCInstance
+  // interface, so that the compiler can inline packet ID, nonce and
+  // AEAD calls into the framing code.  Keys negotiated to any other
+  // cipher mode still work, through the virtual path.
+  typedef AEAD::Crypto<SSLLib::CryptoAPI> FixedCryptoDC;
+
+  inline FixedCryptoDC* fixed_crypto_dc(CryptoDCInstance* dc)
+  {
+    return dynamic_cast<FixedCryptoDC*>(dc);
+  }
+
+}
+
+#endif
+#endif
@@ -53,6 +53,10 @@ namespace openvpn {
       AES_128_GCM,
       AES_192_GCM,
       AES_256_GCM,
+      CHACHA20_POLY1305,
+
+      // stream ciphers (control channel only)
+      AES_256_CTR,
 
       // digests
       MD4,
@@ -123,6 +127,8 @@ namespace openvpn {
       { "AES-128-GCM",  F_CIPHER|F_ALLOW_DC|AEAD,              16, 12, 16 },
       { "AES-192-GCM",  F_CIPHER|F_ALLOW_DC|AEAD,              24, 12, 16 },
       { "AES-256-GCM",  F_CIPHER|F_ALLOW_DC|AEAD,              32, 12, 16 },
+      { "CHACHA20-POLY1305", F_CIPHER|F_ALLOW_DC|AEAD,         32, 12,  1 },
+      { "AES-256-CTR",  F_CIPHER,                              32, 16,  1 },
       { "MD4",          F_DIGEST,                              16,  0,  0 },
       { "MD5",          F_DIGEST|F_ALLOW_DC,                   16,  0,  0 },
       { "SHA1",         F_DIGEST|F_ALLOW_DC,                   20,  0,  0 },
@@ -31,6 +31,7 @@
 #include <openvpn/buffer/buffer.hpp>
 #include <openvpn/error/error.hpp>
 #include <openvpn/common/rc.hpp>
+#include <openvpn/common/memusage.hpp>
 #include <openvpn/frame/frame.hpp>
 #include <openvpn/crypto/static_key.hpp>
 #include <openvpn/crypto/packet_id.hpp>
@@ -52,6 +53,49 @@ namespace openvpn {
 
     virtual Error::Type decrypt(BufferAllocated& buf, const PacketID::time_t now, const unsigned char *op32) = 0;
 
+    // True if decrypt() leaves the cleartext in the storage of buf,
+    // without swapping it with a work buffer or keeping it.
+    virtual bool decrypt_in_place() const
+    {
+      return false;
+    }
+
+    // Packet ID of the last packet accepted by decrypt(), or 0 if the
+    // backend doesn't report it.  Used to restore send order once the
+    // replay check has passed a packet (see DataReorder).
+    std::uint64_t rx_packet_id() const
+    {
+      return rx_pid;
+    }
+
+    // Encrypt a burst of n packets that will be assigned consecutive
+    // packet IDs and share the same op32.  Implementations may
+    // interleave the per-packet work; the default is a simple loop.
+    // Returns true if packet ID is close to wrapping.
+    virtual bool encrypt_batch(BufferAllocated** bufs, const size_t n, const PacketID::time_t now, const unsigned char *op32)
+    {
+      bool pid_wrap = false;
+      for (size_t i = 0; i < n; ++i)
+	pid_wrap |= encrypt(*bufs[i], now, op32);
+      return pid_wrap;
+    }
+
+    // Return an additional decrypt-only instance that may run on another
+    // thread, concurrently with this one and with other lanes, or an
+    // undefined pointer if parallel decryption is not supported.  Lanes
+    // share one replay window with this instance and never touch
+    // SessionStats, so their errors are only returned by decrypt().
+    virtual Ptr new_decrypt_lane()
+    {
+      return Ptr();
+    }
+
+    // Release scratch buffers while the session is idle,
+    // they are reallocated by the next encrypt/decrypt.
+    virtual void compact() {}
+
+    virtual void memory_usage(MemUsage& mu) const {}
+
     // Initialization
 
     // return value of defined()
@@ -76,12 +120,32 @@ namespace openvpn {
 			  const int recv_unit,
 			  const SessionStats::Ptr& recv_stats_arg) = 0;
 
+    // Call after init_pid to replace the keys with a chain of epoch
+    // keys derived from the given secrets, the key changing every
+    // 2^epoch_bits packet IDs, or after period seconds if nonzero.
+    // Returns false if key epochs are not supported.
+    virtual bool init_epoch(const unsigned int epoch_bits,
+			    const unsigned int period,
+			    const StaticKey& encrypt_secret,
+			    const StaticKey& decrypt_secret)
+    {
+      return false;
+    }
+
     virtual bool consider_compression(const CompressContext& comp_ctx) = 0;
 
     virtual void explicit_exit_notify() {}
 
     // Rekeying
 
+    // Key slot transitions, issued by ProtoContext on the instance of
+    // the key concerned.  Backends that keep keys elsewhere (such as
+    // a kernel data channel) map them onto primary/secondary slots:
+    //   ACTIVATE_PRIMARY             -- first key, install as primary
+    //   NEW_SECONDARY                -- install renegotiated key as secondary (receive only)
+    //   PROMOTE_SECONDARY_TO_PRIMARY -- swap slots, old primary keeps receiving
+    //   DEACTIVATE_SECONDARY         -- retire the secondary slot
+    //   DEACTIVATE_ALL               -- retire both slots
     enum RekeyType {
       ACTIVATE_PRIMARY,
       DEACTIVATE_SECONDARY,
@@ -91,6 +155,9 @@ namespace openvpn {
     };
 
     virtual void rekey(const RekeyType type) = 0;
+
+  protected:
+    std::uint64_t rx_pid = 0;
   };
 
   // Factory for CryptoDCInstance objects
@@ -121,6 +188,12 @@ namespace openvpn {
 
     virtual CryptoDCContext::Ptr new_obj(const CryptoAlgs::Type cipher,
 					 const CryptoAlgs::Type digest) = 0;
+
+    // return true if cipher is usable with this factory
+    virtual bool supports_cipher(const CryptoAlgs::Type cipher) const
+    {
+      return true;
+    }
   };
 
   // Manage cipher/digest settings, DC factory, and DC context.
@@ -61,6 +61,15 @@ namespace openvpn {
 	OPENVPN_THROW(crypto_dc_select, alg.name() << ": only CBC/HMAC and AEAD cipher modes supported");
     }
 
+    virtual bool supports_cipher(const CryptoAlgs::Type cipher) const
+    {
+      const CryptoAlgs::Alg& alg = CryptoAlgs::get(cipher);
+      if (alg.flags() & CryptoAlgs::AEAD)
+	return CRYPTO_API::CipherContextGCM::is_supported(cipher);
+      else
+	return true;
+    }
+
   private:
     Frame::Ptr frame;
     SessionStats::Ptr stats;
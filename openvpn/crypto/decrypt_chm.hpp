@@ -50,6 +50,11 @@ namespace openvpn {
       if (!buf.size())
 	return Error::SUCCESS;
 
+      // with both cipher and HMAC, verify and decrypt in one pass
+      if (cipher.defined() && hmac.defined()
+	  && buf.size() >= hmac.output_size() + cipher.iv_length())
+	return decrypt_mac(buf, now);
+
       // verify the HMAC
       if (hmac.defined())
 	{
@@ -118,8 +123,57 @@ namespace openvpn {
     CipherContext<CRYPTO_API> cipher;
     OvpnHMAC<CRYPTO_API> hmac;
     PacketIDReceive pid_recv;
+    std::uint64_t last_pid = 0; // packet ID of the last verified packet
+
+    void release_work() { work.clear(); }
+    size_t work_capacity() const { return work.capacity(); }
 
   private:
+    Error::Type decrypt_mac(BufferAllocated& buf, const PacketID::time_t now)
+    {
+      unsigned char local_hmac[CRYPTO_API::HMACContext::MAX_HMAC_SIZE];
+      unsigned char iv_buf[CRYPTO_API::CipherContext::MAX_IV_LENGTH];
+      const size_t hmac_size = hmac.output_size();
+      const size_t iv_length = cipher.iv_length();
+
+      if (cipher.cipher_mode() != CRYPTO_API::CipherContext::CIPH_CBC_MODE)
+	throw chm_unsupported_cipher_mode();
+
+      // HMAC covers IV + ciphertext
+      const unsigned char *packet_hmac = buf.read_alloc(hmac_size);
+      buf.read(iv_buf, iv_length);
+      hmac.reset();
+      hmac.update(iv_buf, iv_length);
+
+      // decrypt from buf -> work, HMAC'ing the ciphertext as it is read
+      frame->prepare(Frame::DECRYPT_WORK, work);
+      const size_t decrypt_bytes = cipher.decrypt_mac(iv_buf, work.data(), work.max_size(), buf.c_data(), buf.size(), hmac);
+
+      // the HMAC verdict takes precedence over the decrypt result
+      hmac.final(local_hmac);
+      if (crypto::memneq(local_hmac, packet_hmac, hmac_size))
+	{
+	  buf.reset_size();
+	  return Error::HMAC_ERROR;
+	}
+      if (!decrypt_bytes)
+	{
+	  buf.reset_size();
+	  return Error::DECRYPT_ERROR;
+	}
+      work.set_size(decrypt_bytes);
+
+      if (!verify_packet_id(work, now))
+	{
+	  buf.reset_size();
+	  return Error::REPLAY_ERROR;
+	}
+
+      // return cleartext result in buf
+      buf.swap(work);
+      return Error::SUCCESS;
+    }
+
     bool verify_packet_id(BufferAllocated& buf, const PacketID::time_t now)
     {
       // ignore packet ID if pid_recv is not initialized
@@ -128,6 +182,7 @@ namespace openvpn {
 	  const PacketID pid = pid_recv.read_next(buf);
 	  if (!pid_recv.test_add(pid, now, true)) // verify packet ID
 	    return false;
+	  last_pid = pid.id;
 	}
       return true;
     }
@@ -72,20 +72,38 @@ namespace openvpn {
 	  // initialize work buffer
 	  frame->prepare(Frame::ENCRYPT_WORK, work);
 
-	  // encrypt from buf -> work
-	  const size_t encrypt_bytes = cipher.encrypt(iv_buf, work.data(), work.max_size(), buf.c_data(), buf.size());
-	  if (!encrypt_bytes)
+	  if (hmac.defined())
 	    {
-	      buf.reset_size();
-	      return;
+	      // encrypt from buf -> work, computing HMAC(IV + ciphertext)
+	      // in the same pass
+	      unsigned char hmac_buf[CRYPTO_API::HMACContext::MAX_HMAC_SIZE];
+	      hmac.reset();
+	      hmac.update(iv_buf, iv_length);
+	      const size_t encrypt_bytes = cipher.encrypt_mac(iv_buf, work.data(), work.max_size(), buf.c_data(), buf.size(), hmac);
+	      if (!encrypt_bytes)
+		{
+		  buf.reset_size();
+		  return;
+		}
+	      hmac.final(hmac_buf);
+	      work.set_size(encrypt_bytes);
+	      work.prepend(iv_buf, iv_length);
+	      work.prepend(hmac_buf, hmac.output_size());
+	    }
+	  else
+	    {
+	      // encrypt from buf -> work
+	      const size_t encrypt_bytes = cipher.encrypt(iv_buf, work.data(), work.max_size(), buf.c_data(), buf.size());
+	      if (!encrypt_bytes)
+		{
+		  buf.reset_size();
+		  return;
+		}
+	      work.set_size(encrypt_bytes);
+
+	      // prepend the IV to the ciphertext
+	      work.prepend(iv_buf, iv_length);
 	    }
-	  work.set_size(encrypt_bytes);
-
-	  // prepend the IV to the ciphertext
-	  work.prepend(iv_buf, iv_length);
-
-	  // HMAC the ciphertext
-	  prepend_hmac(work);
 
 	  // return ciphertext result in buf
 	  buf.swap(work);
@@ -106,6 +124,9 @@ namespace openvpn {
     PacketIDSend pid_send;
     RandomAPI::Ptr prng;
 
+    void release_work() { work.clear(); }
+    size_t work_capacity() const { return work.capacity(); }
+
   private:
     // compute HMAC signature of data buffer,
     // then prepend the signature to the buffer.
@@ -0,0 +1,86 @@
+//    OpenVPN -- An application to securely tunnel IP networks
+//               over a single port, with support for SSL/TLS-based
+//               session authentication and key exchange,
+//               packet encryption, packet authentication, and
+//               packet compression.
+//
+//    Copyright (C) 2012-2016 OpenVPN Technologies, Inc.
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU Affero General Public License Version 3
+//    as published by the Free Software Foundation.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU Affero General Public License for more details.
+//
+//    You should have received a copy of the GNU Affero General Public License
+//    along with this program in the COPYING file.
+//    If not, see <http://www.gnu.org/licenses/>.
+
+// HKDF key derivation (RFC 5869) over the HMAC of a crypto back-end
+
+#ifndef OPENVPN_CRYPTO_HKDF_H
+#define OPENVPN_CRYPTO_HKDF_H
+
+#include <cstring> // for std::memcpy, std::memset
+
+#include <openvpn/common/size.hpp>
+#include <openvpn/common/exception.hpp>
+#include <openvpn/crypto/cryptoalgs.hpp>
+
+namespace openvpn {
+
+  template <typename CRYPTO_API>
+  class HKDF
+  {
+  public:
+    OPENVPN_SIMPLE_EXCEPTION(hkdf_output_too_long);
+
+    // PRK = HMAC-Hash(salt, ikm), prk must hold CryptoAlgs::size(md)
+    // bytes, returns the PRK length
+    static size_t extract(const CryptoAlgs::Type md,
+			  const unsigned char *salt, const size_t salt_len,
+			  const unsigned char *ikm, const size_t ikm_len,
+			  unsigned char *prk)
+    {
+      typename CRYPTO_API::HMACContext ctx(md, salt, salt_len);
+      ctx.update(ikm, ikm_len);
+      return ctx.final(prk);
+    }
+
+    // OKM = T(1) | T(2) | ... truncated to olen, where
+    // T(i) = HMAC-Hash(PRK, T(i-1) | info | i)
+    static void expand(const CryptoAlgs::Type md,
+		       const unsigned char *prk, const size_t prk_len,
+		       const unsigned char *info, const size_t info_len,
+		       unsigned char *out, size_t olen)
+    {
+      const size_t chunk = CryptoAlgs::size(md);
+      if (olen > chunk * 255)
+	throw hkdf_output_too_long();
+
+      unsigned char t[CRYPTO_API::HMACContext::MAX_HMAC_SIZE];
+      size_t t_len = 0;
+      typename CRYPTO_API::HMACContext ctx(md, prk, prk_len);
+      for (unsigned char i = 1; olen; ++i)
+	{
+	  if (i > 1)
+	    ctx.reset();
+	  ctx.update(t, t_len);
+	  ctx.update(info, info_len);
+	  ctx.update(&i, 1);
+	  t_len = ctx.final(t);
+	  const size_t n = olen < t_len ? olen : t_len;
+	  std::memcpy(out, t, n);
+	  out += n;
+	  olen -= n;
+	}
+      std::memset(t, 0, sizeof(t));
+    }
+  };
+
+}
+
+#endif
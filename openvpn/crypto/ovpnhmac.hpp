@@ -80,6 +80,23 @@ namespace openvpn {
       ctx.final(out);
     }
 
+    // Incremental HMAC, for callers that interleave it with encryption
+
+    void reset()
+    {
+      ctx.reset();
+    }
+
+    void update(const unsigned char *in, const size_t in_size)
+    {
+      ctx.update(in, in_size);
+    }
+
+    void final(unsigned char *out)
+    {
+      ctx.final(out);
+    }
+
     // Special HMAC for OpenVPN control packets
 
     void ovpn_hmac_gen(unsigned char *data, const size_t data_size,
@@ -28,17 +28,20 @@
 #include <cstring>
 #include <sstream>
 #include <cstdint> // for std::uint32_t
+#include <atomic>
 
 #include <asio.hpp>
 
 #include <openvpn/common/size.hpp>
 #include <openvpn/common/exception.hpp>
+#include <openvpn/common/rc.hpp>
 #include <openvpn/common/circ_list.hpp>
 #include <openvpn/common/socktypes.hpp>
 #include <openvpn/common/likely.hpp>
 #include <openvpn/time/time.hpp>
 #include <openvpn/buffer/buffer.hpp>
 #include <openvpn/log/sessionstats.hpp>
+#include <openvpn/log/usdt.hpp>
 
 namespace openvpn {
   /*
@@ -73,6 +76,7 @@ namespace openvpn {
     enum {
       SHORT_FORM = 0, // short form of ID (4 bytes)
       LONG_FORM = 1,  // long form of ID (8 bytes)
+      WIDE_FORM = 2,  // 64-bit ID without time (8 bytes), see PacketIDWide
 
       UNDEF = 0,       // special undefined/null id_t value
     };
@@ -82,7 +86,7 @@ namespace openvpn {
 
     static size_t size(const int form)
     {
-      if (form == PacketID::LONG_FORM)
+      if (form == PacketID::LONG_FORM || form == PacketID::WIDE_FORM)
 	return sizeof(id_t) + sizeof(net_time_t);
       else
 	return sizeof(id_t);
@@ -203,6 +207,19 @@ namespace openvpn {
       return pid_.id >= wrap_at;
     }
 
+    // ID of the last packet sent
+    PacketID::id_t last_id() const
+    {
+      return pid_.id;
+    }
+
+    // skip ahead so that the next packet gets ID id
+    void skip_to(const PacketID::id_t id)
+    {
+      if (id && id - 1 > pid_.id)
+	pid_.id = id - 1;
+    }
+
     std::string str() const
     {
       std::string ret;
@@ -273,6 +290,12 @@ namespace openvpn {
       return initialized_;
     }
 
+    // highest sequence number received
+    PacketID::id_t id_high_water() const
+    {
+      return id_high;
+    }
+
     bool test_add(const PacketID& pin,
 		  const PacketID::time_t now,
 		  const bool mod) // don't modify history unless mod is true
@@ -280,6 +303,7 @@ namespace openvpn {
       const Error::Type err = do_test_add(pin, now, mod);
       if (unlikely(err != Error::SUCCESS))
 	{
+	  OPENVPN_USDT3(pktid_reject, int(err), pin.id, id_high);
 	  stats->error(err);
 	  return false;
 	}
@@ -435,9 +459,454 @@ namespace openvpn {
     std::uint8_t history[REPLAY_WINDOW_BYTES]; /* "sliding window" bitmask of recent packet IDs received */
   };
 
+  /*
+   * 64-bit packet ID, sent as 8 bytes in network order without a
+   * timestamp.  Negotiated for AEAD data channels so that a key can
+   * carry more than 2^32 packets without a forced renegotiation.
+   * time is always zero and only exists so that PacketIDReceiveWordType
+   * can be instantiated on this type.
+   */
+  struct PacketIDWide
+  {
+    typedef std::uint64_t id_t;
+    typedef PacketID::time_t time_t;
+
+    id_t id;       // legal values are 1 through 2^64-1
+    time_t time;   // always 0
+
+    static size_t size(const int form)
+    {
+      return sizeof(id_t);
+    }
+
+    bool is_valid() const
+    {
+      return id != PacketID::UNDEF;
+    }
+
+    void reset()
+    {
+      id = id_t(0);
+      time = time_t(0);
+    }
+
+    void read(Buffer& buf, const int form)
+    {
+      unsigned char net_id[sizeof(id_t)];
+      buf.read(net_id, sizeof(net_id));
+      id = 0;
+      for (size_t i = 0; i < sizeof(net_id); ++i)
+	id = (id << 8) | net_id[i];
+      time = time_t(0);
+    }
+
+    void write(Buffer& buf, const int form, const bool prepend) const
+    {
+      unsigned char net_id[sizeof(id_t)];
+      for (size_t i = 0; i < sizeof(net_id); ++i)
+	net_id[i] = (unsigned char)(id >> (8 * (sizeof(net_id) - 1 - i)));
+      if (prepend)
+	buf.prepend(net_id, sizeof(net_id));
+      else
+	buf.write(net_id, sizeof(net_id));
+    }
+
+    std::string str() const
+    {
+      std::ostringstream os;
+      os << "[" << id << "]";
+      return os.str();
+    }
+  };
+
+  class PacketIDWideSend
+  {
+  public:
+    PacketIDWideSend()
+    {
+      init();
+    }
+
+    void init()
+    {
+      pid_.reset();
+    }
+
+    PacketIDWide next()
+    {
+      PacketIDWide ret;
+      ret.id = ++pid_.id;
+      ret.time = PacketIDWide::time_t(0);
+      return ret;
+    }
+
+    void write_next(Buffer& buf, const bool prepend, const PacketID::time_t now)
+    {
+      const PacketIDWide pid = next();
+      pid.write(buf, PacketID::WIDE_FORM, prepend);
+    }
+
+    // Kept for symmetry with PacketIDSend, a 64-bit ID
+    // will not get here in the lifetime of a key.
+    bool wrap_warning() const
+    {
+      const PacketIDWide::id_t wrap_at = 0xFF00000000000000ull;
+      return pid_.id >= wrap_at;
+    }
+
+    PacketIDWide::id_t last_id() const
+    {
+      return pid_.id;
+    }
+
+    void skip_to(const PacketIDWide::id_t id)
+    {
+      if (id && id - 1 > pid_.id)
+	pid_.id = id - 1;
+    }
+
+    std::string str() const
+    {
+      return pid_.str() + 'W';
+    }
+
+  private:
+    PacketIDWide pid_;
+  };
+
+  /*
+   * Alternative receive-side replay window, kept as a ring of
+   * 64-bit words indexed directly by packet ID (as in RFC 6479)
+   * rather than as a byte deque relative to a moving base.
+   * Advancing the window only clears whole words, so the cost
+   * of a forward jump is bounded by the number of words rather
+   * than the number of skipped IDs, which makes much larger
+   * windows practical when packets are heavily reordered by
+   * multi-queue or parallel decryption.
+   *
+   * PID is PacketID, or PacketIDWide for 64-bit IDs.
+   * Replay window sizing in 64-bit words = 2^REPLAY_WINDOW_WORDS_ORDER.
+   * The usable backtrack distance is one word less than the
+   * window size, since the word holding id_high is shared.
+   * PKTID_RECV_EXPIRE is backtrack expire in seconds.
+   */
+  template <unsigned int REPLAY_WINDOW_WORDS_ORDER,
+	    unsigned int PKTID_RECV_EXPIRE,
+	    typename PID = PacketID>
+  class PacketIDReceiveWordType
+  {
+  public:
+    typedef std::uint64_t word_t;
+
+    static constexpr unsigned int WORD_BITS = 64;
+    static constexpr unsigned int REPLAY_WINDOW_WORDS = 1 << REPLAY_WINDOW_WORDS_ORDER;
+    static constexpr unsigned int REPLAY_WINDOW_SIZE = REPLAY_WINDOW_WORDS * WORD_BITS;
+    static constexpr unsigned int REPLAY_WINDOW_BACKTRACK = REPLAY_WINDOW_SIZE - WORD_BITS;
+
+    // mode
+    enum {
+      UDP_MODE = 0,
+      TCP_MODE = 1
+    };
+
+    OPENVPN_SIMPLE_EXCEPTION(packet_id_not_initialized);
+
+    PacketIDReceiveWordType()
+      : initialized_(false)
+    {
+    }
+
+    void init(const int mode_arg,
+	      const int form_arg,
+	      const char *name_arg,
+	      const int unit_arg,
+	      const SessionStats::Ptr& stats_arg)
+    {
+      initialized_ = true;
+      expire = 0;
+      id_high = 0;
+      time_high = 0;
+      id_floor = 0;
+      max_backtrack = 0;
+      mode = mode_arg;
+      form = form_arg;
+      unit = unit_arg;
+      name = name_arg;
+      stats = stats_arg;
+      std::memset(history, 0, sizeof(history));
+    }
+
+    bool initialized() const
+    {
+      return initialized_;
+    }
+
+    // highest sequence number received
+    typename PID::id_t id_high_water() const
+    {
+      return id_high;
+    }
+
+    bool test_add(const PID& pin,
+		  const typename PID::time_t now,
+		  const bool mod) // don't modify history unless mod is true
+    {
+      const Error::Type err = do_test_add(pin, now, mod);
+      if (unlikely(err != Error::SUCCESS))
+	{
+	  OPENVPN_USDT3(pktid_reject, int(err), pin.id, id_high);
+	  stats->error(err);
+	  return false;
+	}
+      else
+	return true;
+    }
+
+    Error::Type do_test_add(const PID& pin,
+			    const typename PID::time_t now,
+			    const bool mod) // don't modify history unless mod is true
+    {
+      // make sure we were initialized
+      if (unlikely(!initialized_))
+	throw packet_id_not_initialized();
+
+      // expire backtracks at or below id_floor after PKTID_RECV_EXPIRE time
+      if (unlikely(now >= expire))
+	id_floor = id_high;
+      expire = now + PKTID_RECV_EXPIRE;
+
+      // ID must not be zero
+      if (unlikely(!pin.is_valid()))
+	return Error::PKTID_INVALID;
+
+      // time changed?
+      if (unlikely(pin.time != time_high))
+	{
+	  if (pin.time > time_high)
+	    {
+	      // time moved forward, accept
+	      if (!mod)
+		return Error::SUCCESS;
+	      id_high = 0;
+	      time_high = pin.time;
+	      id_floor = 0;
+	      std::memset(history, 0, sizeof(history));
+	    }
+	  else
+	    {
+	      // time moved backward, reject
+	      return Error::PKTID_TIME_BACKTRACK;
+	    }
+	}
+
+      if (likely(pin.id > id_high))
+	{
+	  // ID moved forward, clear any words we skipped over
+	  if (!mod)
+	    return Error::SUCCESS;
+	  const typename PID::id_t wdelta = word_index(pin.id) - word_index(id_high);
+	  if (wdelta >= REPLAY_WINDOW_WORDS)
+	    std::memset(history, 0, sizeof(history));
+	  else
+	    {
+	      for (typename PID::id_t i = 1; i <= wdelta; ++i)
+		history[ring_index(word_index(id_high) + i)] = 0;
+	    }
+	  id_high = pin.id;
+	  history[ring_index(word_index(pin.id))] |= bit_mask(pin.id);
+	}
+      else
+	{
+	  // ID backtrack
+	  const typename PID::id_t delta = id_high - pin.id;
+	  if (delta > max_backtrack)
+	    max_backtrack = (unsigned int)delta;
+	  if (delta < REPLAY_WINDOW_BACKTRACK)
+	    {
+	      if (pin.id > id_floor)
+		{
+		  word_t& w = history[ring_index(word_index(pin.id))];
+		  const word_t mask = bit_mask(pin.id);
+		  if (w & mask)
+		    return Error::PKTID_REPLAY;
+		  if (!mod)
+		    return Error::SUCCESS;
+		  w |= mask;
+		}
+	      else
+		return Error::PKTID_EXPIRE;
+	    }
+	  else
+	    return Error::PKTID_BACKTRACK;
+	}
+
+      return Error::SUCCESS;
+    }
+
+    PID read_next(Buffer& buf) const
+    {
+      if (!initialized_)
+	throw packet_id_not_initialized();
+      PID pid;
+      pid.read(buf, form);
+      return pid;
+    }
+
+    std::string str() const
+    {
+      std::ostringstream os;
+      os << "[w=" << REPLAY_WINDOW_SIZE << " f=" << id_floor << " h=" << time_high << '/' << id_high << ']';
+      return os.str();
+    }
+
+  private:
+    static typename PID::id_t word_index(const typename PID::id_t id)
+    {
+      return id / WORD_BITS;
+    }
+
+    static unsigned int ring_index(const typename PID::id_t widx)
+    {
+      return widx & (REPLAY_WINDOW_WORDS - 1);
+    }
+
+    static word_t bit_mask(const typename PID::id_t id)
+    {
+      return word_t(1) << (id % WORD_BITS);
+    }
+
+    bool initialized_;
+
+    typename PID::time_t expire;        // expiration of history
+    typename PID::id_t id_high;         // highest sequence number received
+    typename PID::time_t time_high;     // highest time stamp received
+    typename PID::id_t id_floor;        // we will only accept backtrack IDs > id_floor
+    unsigned int max_backtrack;
+
+    int mode;                       // UDP_MODE or TCP_MODE
+    int form;                       // PacketID::LONG_FORM or PacketID::SHORT_FORM
+    int unit;                       // unit number of this object (for debugging)
+    std::string name;               // name of this object (for debugging)
+
+    SessionStats::Ptr stats;
+
+    word_t history[REPLAY_WINDOW_WORDS]; // ring of 64-bit words, bit (id % 64) of word (id / 64)
+  };
+
+  /*
+   * Receive-side replay window that can be shared by several threads
+   * decrypting packets of the same key in parallel.  Each ring slot is
+   * one 64-bit atomic holding a 32-bit bitmap in its low half and, in
+   * its high half, the index of the 32-ID word the bitmap describes.
+   * A packet ID is committed with a CAS on its slot: a matching tag
+   * test-and-sets the bit, an older tag recycles the slot for the new
+   * word, and a newer tag means the ID has fallen out of the window.
+   * Slots only move forward, so no ID can be accepted twice however
+   * commits from different threads interleave.
+   *
+   * Only short-form packet IDs are supported and backtracks don't expire.
+   * Errors are returned rather than counted, because SessionStats
+   * is not thread-safe.
+   * Replay window sizing in slots = 2^REPLAY_WINDOW_SLOTS_ORDER.
+   */
+  template <unsigned int REPLAY_WINDOW_SLOTS_ORDER>
+  class PacketIDReceiveSharedType : public RC<thread_safe_refcount>
+  {
+  public:
+    typedef RCPtr<PacketIDReceiveSharedType> Ptr;
+    typedef std::uint64_t slot_t;
+
+    static constexpr unsigned int SLOT_BITS = 32;
+    static constexpr unsigned int REPLAY_WINDOW_SLOTS = 1 << REPLAY_WINDOW_SLOTS_ORDER;
+    static constexpr unsigned int REPLAY_WINDOW_SIZE = REPLAY_WINDOW_SLOTS * SLOT_BITS;
+    static constexpr unsigned int REPLAY_WINDOW_BACKTRACK = REPLAY_WINDOW_SIZE - SLOT_BITS;
+
+    // IDs at or below id_floor_arg are rejected, so that a shared
+    // window can take over from a window that was already in use.
+    PacketIDReceiveSharedType(const PacketID::id_t id_floor_arg = 0)
+      : id_floor(id_floor_arg),
+	id_high(id_floor_arg)
+    {
+      for (auto &s : history)
+	s.store(0, std::memory_order_relaxed);
+    }
+
+    Error::Type do_test_add(const PacketID& pin)
+    {
+      // ID must not be zero
+      if (unlikely(!pin.is_valid()))
+	return Error::PKTID_INVALID;
+
+      if (unlikely(pin.id <= id_floor))
+	return Error::PKTID_EXPIRE;
+
+      // cheap early reject, the slot tag below is authoritative
+      PacketID::id_t high = id_high.load(std::memory_order_relaxed);
+      if (pin.id < high && high - pin.id >= REPLAY_WINDOW_BACKTRACK)
+	return Error::PKTID_BACKTRACK;
+
+      const slot_t tag = pin.id / SLOT_BITS;
+      const slot_t mask = slot_t(1) << (pin.id % SLOT_BITS);
+      std::atomic<slot_t>& slot = history[tag & (REPLAY_WINDOW_SLOTS - 1)];
+      slot_t v = slot.load(std::memory_order_acquire);
+      while (true)
+	{
+	  const slot_t vtag = v >> 32;
+	  slot_t nv;
+	  if (vtag == tag)
+	    {
+	      if (v & mask)
+		return Error::PKTID_REPLAY;
+	      nv = v | mask;
+	    }
+	  else if (vtag < tag)
+	    nv = (tag << 32) | mask;
+	  else
+	    return Error::PKTID_BACKTRACK;
+	  if (slot.compare_exchange_weak(v, nv, std::memory_order_acq_rel, std::memory_order_acquire))
+	    break;
+	}
+
+      // advance high-water mark
+      while (high < pin.id && !id_high.compare_exchange_weak(high, pin.id, std::memory_order_relaxed))
+	;
+      return Error::SUCCESS;
+    }
+
+    PacketID::id_t id_high_water() const
+    {
+      return id_high.load(std::memory_order_relaxed);
+    }
+
+    std::string str() const
+    {
+      std::ostringstream os;
+      os << "[w=" << REPLAY_WINDOW_SIZE << " f=" << id_floor << " h=" << id_high_water() << ']';
+      return os.str();
+    }
+
+  private:
+    const PacketID::id_t id_floor;
+    std::atomic<PacketID::id_t> id_high;
+    std::atomic<slot_t> history[REPLAY_WINDOW_SLOTS];
+  };
+
   // Our standard packet ID window with order=8 (window size=2048).
-  // and recv expire=30 seconds.
+  // and recv expire=30 seconds.  Defining OPENVPN_PKTID_WIDE_REPLAY_WINDOW
+  // selects the word-based window with order=7 (window size=8192)
+  // for configurations that decrypt out of order.
+#ifdef OPENVPN_PKTID_WIDE_REPLAY_WINDOW
+  typedef PacketIDReceiveWordType<7, 30> PacketIDReceive;
+#else
   typedef PacketIDReceiveType<8, 30> PacketIDReceive;
+#endif
+
+  // Window for 64-bit packet IDs, always word-based with
+  // order=7 (window size=8192).
+  typedef PacketIDReceiveWordType<7, 30, PacketIDWide> PacketIDWideReceive;
+
+  // Shared window for parallel decryption with 256 slots (window size=8192).
+  typedef PacketIDReceiveSharedType<8> PacketIDReceiveShared;
 
 } // namespace openvpn
 
@@ -25,6 +25,10 @@
 #define OPENVPN_CRYPTO_SELFTEST_H
 
 #include <string>
+#include <future>
+#include <mutex>
+
+#include <openvpn/common/extern.hpp>
 
 #ifdef USE_OPENSSL
 //#include <openvpn/openssl/util/selftest.hpp>
@@ -59,6 +63,32 @@ namespace openvpn {
 #     endif
       return ret;
     }
+
+    OPENVPN_EXTERN std::shared_future<std::string> background_result; // GLOBAL
+    OPENVPN_EXTERN std::mutex background_mutex; // GLOBAL
+
+    // Start crypto_self_test on a background thread, so that an app
+    // can kick it off at launch without delaying its cold start.
+    inline void crypto_self_test_start()
+    {
+      std::lock_guard<std::mutex> lock(background_mutex);
+      if (!background_result.valid())
+	background_result = std::async(std::launch::async, crypto_self_test).share();
+    }
+
+    // Return the self-test output, blocking only if a background run
+    // is still in progress, or running it inline if none was started.
+    inline std::string crypto_self_test_result()
+    {
+      std::shared_future<std::string> f;
+      {
+	std::lock_guard<std::mutex> lock(background_mutex);
+	f = background_result;
+      }
+      if (f.valid())
+	return f.get();
+      return crypto_self_test();
+    }
   }
 } // namespace openvpn
 
@@ -0,0 +1,264 @@
+//    OpenVPN -- An application to securely tunnel IP networks
+//               over a single port, with support for SSL/TLS-based
+//               session authentication and key exchange,
+//               packet encryption, packet authentication, and
+//               packet compression.
+//
+//    Copyright (C) 2012-2016 OpenVPN Technologies, Inc.
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU Affero General Public License Version 3
+//    as published by the Free Software Foundation.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU Affero General Public License for more details.
+//
+//    You should have received a copy of the GNU Affero General Public License
+//    along with this program in the COPYING file.
+//    If not, see <http://www.gnu.org/licenses/>.
+
+// tls-crypt control channel wrapping: control packets are
+// authenticated with a keyed HMAC over header and cleartext, then
+// encrypted with a stream cipher using (part of) the tag as IV.
+
+#ifndef OPENVPN_CRYPTO_TLS_CRYPT_H
+#define OPENVPN_CRYPTO_TLS_CRYPT_H
+
+#include <string>
+
+#include <openvpn/common/size.hpp>
+#include <openvpn/common/exception.hpp>
+#include <openvpn/common/rc.hpp>
+#include <openvpn/common/memneq.hpp>
+#include <openvpn/crypto/static_key.hpp>
+#include <openvpn/crypto/cryptoalgs.hpp>
+
+namespace openvpn {
+
+  template <typename CRYPTO_API>
+  class TLSCrypt
+  {
+  public:
+    OPENVPN_SIMPLE_EXCEPTION(tls_crypt_key_size);
+    OPENVPN_SIMPLE_EXCEPTION(tls_crypt_iv_size);
+
+    TLSCrypt() {}
+
+    bool defined() const { return ctx_hmac.is_initialized() && ctx_crypt.is_initialized(); }
+
+    // size of the authentication tag
+    size_t output_size() const
+    {
+      return ctx_hmac.size();
+    }
+
+    void init(const CryptoAlgs::Type digest, const StaticKey& key_hmac,
+	      const CryptoAlgs::Type cipher, const StaticKey& key_crypt)
+    {
+      const CryptoAlgs::Alg& alg_hmac = CryptoAlgs::get(digest);
+      const CryptoAlgs::Alg& alg_crypt = CryptoAlgs::get(cipher);
+
+      // check that keys are large enough
+      if (key_hmac.size() < alg_hmac.size() || key_crypt.size() < alg_crypt.key_length())
+	throw tls_crypt_key_size();
+
+      // the IV is taken from the tag
+      if (alg_crypt.iv_length() > alg_hmac.size())
+	throw tls_crypt_iv_size();
+
+      // a stream cipher is symmetric, so always initialize for encrypt
+      ctx_hmac.init(digest, key_hmac.data(), alg_hmac.size());
+      ctx_crypt.init(cipher, key_crypt.data(), CRYPTO_API::CipherContext::ENCRYPT);
+    }
+
+    // write tag over header and payload to header + header_len
+    void hmac_gen(unsigned char *header, const size_t header_len,
+		  const unsigned char *payload, const size_t payload_len)
+    {
+      hmac_pre(header, header_len, payload, payload_len);
+      ctx_hmac.final(header + header_len);
+    }
+
+    // verify tag at header + header_len, return true if verified
+    bool hmac_cmp(const unsigned char *header, const size_t header_len,
+		  const unsigned char *payload, const size_t payload_len)
+    {
+      unsigned char local_hmac[CRYPTO_API::HMACContext::MAX_HMAC_SIZE];
+      hmac_pre(header, header_len, payload, payload_len);
+      ctx_hmac.final(local_hmac);
+      return !crypto::memneq(header + header_len, local_hmac, output_size());
+    }
+
+    // Encrypt or decrypt in_size bytes from in to out, which may be
+    // the same buffer.  Return number of bytes written, or 0 on error.
+    size_t encrypt_decrypt(const unsigned char *iv,
+			   unsigned char *out, const size_t out_size,
+			   const unsigned char *in, const size_t in_size)
+    {
+      if (out_size < in_size)
+	return 0;
+      ctx_crypt.reset(iv);
+      size_t outlen = 0;
+      if (!ctx_crypt.update(out, out_size, in, in_size, outlen))
+	return 0;
+      if (!ctx_crypt.final(out + outlen, out_size - outlen, outlen))
+	return 0;
+      return outlen;
+    }
+
+  private:
+    void hmac_pre(const unsigned char *header, const size_t header_len,
+		  const unsigned char *payload, const size_t payload_len)
+    {
+      ctx_hmac.reset();
+      ctx_hmac.update(header, header_len);
+      ctx_hmac.update(payload, payload_len);
+    }
+
+    typename CRYPTO_API::HMACContext ctx_hmac;
+    typename CRYPTO_API::CipherContext ctx_crypt;
+  };
+
+  // TLSCrypt wrapper API using dynamic polymorphism
+
+  class TLSCryptInstance : public RC<thread_unsafe_refcount>
+  {
+  public:
+    typedef RCPtr<TLSCryptInstance> Ptr;
+
+    virtual void init(const StaticKey& key_hmac, const StaticKey& key_crypt) = 0;
+
+    virtual size_t output_size() const = 0;
+
+    virtual void hmac_gen(unsigned char *header, const size_t header_len,
+			  const unsigned char *payload, const size_t payload_len) = 0;
+
+    virtual bool hmac_cmp(const unsigned char *header, const size_t header_len,
+			  const unsigned char *payload, const size_t payload_len) = 0;
+
+    virtual size_t encrypt(const unsigned char *iv,
+			   unsigned char *out, const size_t out_size,
+			   const unsigned char *in, const size_t in_size) = 0;
+
+    virtual size_t decrypt(const unsigned char *iv,
+			   unsigned char *out, const size_t out_size,
+			   const unsigned char *in, const size_t in_size) = 0;
+  };
+
+  class TLSCryptContext : public RC<thread_unsafe_refcount>
+  {
+  public:
+    typedef RCPtr<TLSCryptContext> Ptr;
+
+    // size of the authentication tag
+    virtual size_t digest_size() const = 0;
+
+    virtual TLSCryptInstance::Ptr new_obj() = 0;
+  };
+
+  class TLSCryptFactory : public RC<thread_unsafe_refcount>
+  {
+  public:
+    typedef RCPtr<TLSCryptFactory> Ptr;
+
+    virtual TLSCryptContext::Ptr new_obj(const CryptoAlgs::Type digest_type,
+					 const CryptoAlgs::Type cipher_type) = 0;
+  };
+
+  // TLSCrypt wrapper implementation using dynamic polymorphism
+
+  template <typename CRYPTO_API>
+  class CryptoTLSCryptInstance : public TLSCryptInstance
+  {
+  public:
+    CryptoTLSCryptInstance(const CryptoAlgs::Type digest_arg,
+			   const CryptoAlgs::Type cipher_arg)
+      : digest(digest_arg),
+	cipher(cipher_arg)
+    {
+    }
+
+    virtual void init(const StaticKey& key_hmac, const StaticKey& key_crypt)
+    {
+      tls_crypt.init(digest, key_hmac, cipher, key_crypt);
+    }
+
+    virtual size_t output_size() const
+    {
+      return tls_crypt.output_size();
+    }
+
+    virtual void hmac_gen(unsigned char *header, const size_t header_len,
+			  const unsigned char *payload, const size_t payload_len)
+    {
+      tls_crypt.hmac_gen(header, header_len, payload, payload_len);
+    }
+
+    virtual bool hmac_cmp(const unsigned char *header, const size_t header_len,
+			  const unsigned char *payload, const size_t payload_len)
+    {
+      return tls_crypt.hmac_cmp(header, header_len, payload, payload_len);
+    }
+
+    virtual size_t encrypt(const unsigned char *iv,
+			   unsigned char *out, const size_t out_size,
+			   const unsigned char *in, const size_t in_size)
+    {
+      return tls_crypt.encrypt_decrypt(iv, out, out_size, in, in_size);
+    }
+
+    virtual size_t decrypt(const unsigned char *iv,
+			   unsigned char *out, const size_t out_size,
+			   const unsigned char *in, const size_t in_size)
+    {
+      return tls_crypt.encrypt_decrypt(iv, out, out_size, in, in_size);
+    }
+
+  private:
+    CryptoAlgs::Type digest;
+    CryptoAlgs::Type cipher;
+    TLSCrypt<CRYPTO_API> tls_crypt;
+  };
+
+  template <typename CRYPTO_API>
+  class CryptoTLSCryptContext : public TLSCryptContext
+  {
+  public:
+    CryptoTLSCryptContext(const CryptoAlgs::Type digest_type,
+			  const CryptoAlgs::Type cipher_type)
+      : digest(digest_type),
+	cipher(cipher_type)
+    {
+    }
+
+    virtual size_t digest_size() const
+    {
+      return CryptoAlgs::size(digest);
+    }
+
+    virtual TLSCryptInstance::Ptr new_obj()
+    {
+      return new CryptoTLSCryptInstance<CRYPTO_API>(digest, cipher);
+    }
+
+  private:
+    CryptoAlgs::Type digest;
+    CryptoAlgs::Type cipher;
+  };
+
+  template <typename CRYPTO_API>
+  class CryptoTLSCryptFactory : public TLSCryptFactory
+  {
+  public:
+    virtual TLSCryptContext::Ptr new_obj(const CryptoAlgs::Type digest_type,
+					 const CryptoAlgs::Type cipher_type)
+    {
+      return new CryptoTLSCryptContext<CRYPTO_API>(digest_type, cipher_type);
+    }
+  };
+
+}
+
+#endif
@@ -0,0 +1,850 @@
+//    OpenVPN -- An application to securely tunnel IP networks
+//               over a single port, with support for SSL/TLS-based
+//               session authentication and key exchange,
+//               packet encryption, packet authentication, and
+//               packet compression.
+//
+//    Copyright (C) 2012-2016 OpenVPN Technologies, Inc.
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU Affero General Public License Version 3
+//    as published by the Free Software Foundation.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU Affero General Public License for more details.
+//
+//    You should have received a copy of the GNU Affero General Public License
+//    along with this program in the COPYING file.
+//    If not, see <http://www.gnu.org/licenses/>.
+
+// Client transport and tun for Linux kernel data channel offload.
+// Control packets stay in user space on our UDP socket, while the
+// kernel ovpn module handles the data channel on the same socket.
+
+#ifndef OPENVPN_DCO_DCOCLI_H
+#define OPENVPN_DCO_DCOCLI_H
+
+#include <string>
+#include <sstream>
+#include <memory>
+#include <utility> // for std::move
+
+#include <asio.hpp>
+
+#include <openvpn/common/platform.hpp>
+
+#if !defined(OPENVPN_PLATFORM_LINUX)
+#error DCO is only implemented for Linux
+#endif
+
+#include <openvpn/common/exception.hpp>
+#include <openvpn/common/rc.hpp>
+#include <openvpn/common/action.hpp>
+#include <openvpn/common/number.hpp>
+#include <openvpn/buffer/buffer.hpp>
+#include <openvpn/crypto/cryptoalgs.hpp>
+#include <openvpn/crypto/cryptodc.hpp>
+#include <openvpn/crypto/static_key.hpp>
+#include <openvpn/transport/dco.hpp>
+#include <openvpn/transport/udplink.hpp>
+#include <openvpn/tun/builder/capture.hpp>
+#include <openvpn/tun/linux/client/tuncli.hpp>
+#include <openvpn/dco/linux/ovpnnl.hpp>
+
+namespace openvpn {
+  namespace DCOTransport {
+
+    OPENVPN_EXCEPTION(dco_error);
+
+    class Client;
+
+    // The controller is both the transport and the tun factory, since
+    // one Client object plays both roles for a session.
+    class ClientConfig : public DCO,
+			 public TransportClientFactory,
+			 public TunClientFactory
+    {
+    public:
+      typedef RCPtr<ClientConfig> Ptr;
+
+      std::string dev_name = "ovpn0";
+
+      DCO::TransportConfig transport;
+      DCO::TunConfig tun;
+
+      static Ptr new_obj()
+      {
+	return new ClientConfig;
+      }
+
+      virtual TunClientFactory::Ptr new_tun_factory(const DCO::TunConfig& conf, const OptionList& opt)
+      {
+	tun = conf;
+	return TunClientFactory::Ptr(this);
+      }
+
+      virtual TransportClientFactory::Ptr new_transport_factory(const DCO::TransportConfig& conf)
+      {
+	if (!conf.protocol.is_udp())
+	  throw dco_error("only UDP transport is supported");
+	transport = conf;
+	return TransportClientFactory::Ptr(this);
+      }
+
+      virtual TransportClient::Ptr new_transport_client_obj(asio::io_context& io_context,
+							    TransportClientParent& parent);
+
+      virtual TunClient::Ptr new_tun_client_obj(asio::io_context& io_context,
+						TunClientParent& parent,
+						TransportClient* transcli);
+
+    private:
+      ClientConfig() {}
+    };
+
+    // Captures the keys that KeyContext::init_data_channel derives and
+    // passes them to the kernel as the key is activated, promoted, or
+    // retired.  Only the control channel is encrypted in user space,
+    // so CRYPTO_DEFINED is never advertised.
+    class CryptoInstance : public CryptoDCInstance
+    {
+    public:
+      CryptoInstance(Client* client_arg,
+		     const CryptoAlgs::Type cipher_arg,
+		     const unsigned int key_id_arg)
+	: client(client_arg),
+	  cipher(cipher_arg),
+	  key_id(key_id_arg)
+      {
+      }
+
+      virtual bool encrypt(BufferAllocated& buf, const PacketID::time_t now, const unsigned char *op32)
+      {
+	buf.reset_size();
+	return false;
+      }
+
+      virtual Error::Type decrypt(BufferAllocated& buf, const PacketID::time_t now, const unsigned char *op32)
+      {
+	buf.reset_size();
+	return Error::DECRYPT_ERROR;
+      }
+
+      virtual unsigned int defined() const
+      {
+	return CIPHER_DEFINED|HMAC_DEFINED;
+      }
+
+      virtual void init_cipher(StaticKey&& encrypt_key,
+			       StaticKey&& decrypt_key)
+      {
+	encrypt_cipher_key = std::move(encrypt_key);
+	decrypt_cipher_key = std::move(decrypt_key);
+      }
+
+      // AEAD ciphers use the HMAC key slice as nonce tail
+      virtual void init_hmac(StaticKey&& encrypt_key,
+			     StaticKey&& decrypt_key)
+      {
+	if (encrypt_key.size() < OvpnNL::NONCE_TAIL_SIZE || decrypt_key.size() < OvpnNL::NONCE_TAIL_SIZE)
+	  throw dco_error("insufficient key material for nonce tail");
+	encrypt_nonce_tail = std::move(encrypt_key);
+	decrypt_nonce_tail = std::move(decrypt_key);
+      }
+
+      virtual void init_pid(const int send_form,
+			    const int recv_mode,
+			    const int recv_form,
+			    const char *recv_name,
+			    const int recv_unit,
+			    const SessionStats::Ptr& recv_stats_arg)
+      {
+      }
+
+      // the kernel doesn't compress
+      virtual bool consider_compression(const CompressContext& comp_ctx)
+      {
+	return false;
+      }
+
+      virtual void rekey(const RekeyType type);
+
+      OvpnNL::KeyDir encrypt_dir() const
+      {
+	return key_dir(encrypt_cipher_key, encrypt_nonce_tail);
+      }
+
+      OvpnNL::KeyDir decrypt_dir() const
+      {
+	return key_dir(decrypt_cipher_key, decrypt_nonce_tail);
+      }
+
+      CryptoAlgs::Type cipher_alg() const { return cipher; }
+      unsigned int kid() const { return key_id; }
+
+    private:
+      OvpnNL::KeyDir key_dir(const StaticKey& cipher_key, const StaticKey& nonce_tail) const
+      {
+	const size_t key_len = CryptoAlgs::key_length(cipher);
+	if (cipher_key.size() < key_len)
+	  throw dco_error("insufficient key material for cipher");
+	OvpnNL::KeyDir kd;
+	kd.cipher_key = cipher_key.data();
+	kd.cipher_key_size = key_len;
+	kd.nonce_tail = nonce_tail.data();
+	return kd;
+      }
+
+      RCPtr<Client> client;
+      CryptoAlgs::Type cipher;
+      unsigned int key_id;
+      StaticKey encrypt_cipher_key;
+      StaticKey decrypt_cipher_key;
+      StaticKey encrypt_nonce_tail;
+      StaticKey decrypt_nonce_tail;
+    };
+
+    class CryptoContext : public CryptoDCContext
+    {
+    public:
+      CryptoContext(Client* client_arg, const CryptoAlgs::Type cipher_arg)
+	: client(client_arg),
+	  cipher(CryptoAlgs::legal_dc_cipher(cipher_arg))
+      {
+      }
+
+      virtual CryptoDCInstance::Ptr new_obj(const unsigned int key_id)
+      {
+	return new CryptoInstance(client.get(), cipher, key_id);
+      }
+
+      virtual Info crypto_info()
+      {
+	Info ret;
+	ret.cipher_alg = cipher;
+	ret.hmac_alg = CryptoAlgs::NONE;
+	return ret;
+      }
+
+      // AEAD auth tag
+      virtual size_t encap_overhead() const
+      {
+	return 16;
+      }
+
+    private:
+      RCPtr<Client> client;
+      CryptoAlgs::Type cipher;
+    };
+
+    class CryptoFactory : public CryptoDCFactory
+    {
+    public:
+      CryptoFactory(Client* client_arg)
+	: client(client_arg)
+      {
+      }
+
+      virtual CryptoDCContext::Ptr new_obj(const CryptoAlgs::Type cipher,
+					   const CryptoAlgs::Type digest)
+      {
+	if (!supports_cipher(cipher))
+	  OPENVPN_THROW(dco_error, "cipher " << CryptoAlgs::name(cipher, "NONE") << " is not supported by the kernel data channel");
+	return new CryptoContext(client.get(), cipher);
+      }
+
+      virtual bool supports_cipher(const CryptoAlgs::Type cipher) const
+      {
+	return alg(cipher) != OvpnNL::CIPHER_ALG_NONE;
+      }
+
+      static OvpnNL::CipherAlg alg(const CryptoAlgs::Type cipher)
+      {
+	switch (cipher)
+	  {
+	  case CryptoAlgs::AES_128_GCM:
+	  case CryptoAlgs::AES_192_GCM:
+	  case CryptoAlgs::AES_256_GCM:
+	    return OvpnNL::CIPHER_ALG_AES_GCM;
+	  case CryptoAlgs::CHACHA20_POLY1305:
+	    return OvpnNL::CIPHER_ALG_CHACHA20_POLY1305;
+	  default:
+	    return OvpnNL::CIPHER_ALG_NONE;
+	  }
+      }
+
+    private:
+      RCPtr<Client> client;
+    };
+
+    class Client : public TransportClient,
+		   public TunClient,
+		   public SessionStats::DCOTransportSource
+    {
+      friend class ClientConfig;    // calls constructor
+      friend class CryptoInstance;  // calls rekey
+
+    public:
+      typedef RCPtr<Client> Ptr;
+
+      // TransportClient
+
+      virtual void transport_start()
+      {
+	if (!halt && !socket.is_open())
+	  {
+	    config->transport.stats->dco_configure(this);
+	    if (config->transport.remote_list->endpoint_available(&server_host, &server_port, nullptr))
+	      start_connect_();
+	    else
+	      {
+		transport_parent.transport_pre_resolve();
+		resolver.async_resolve(server_host, server_port,
+				       [self=Ptr(this)](const asio::error_code& error, asio::ip::udp::resolver::results_type results)
+				       {
+					 self->do_resolve_(error, results);
+				       });
+	      }
+	  }
+      }
+
+      virtual bool transport_send_const(const Buffer& buf)
+      {
+	return send(buf);
+      }
+
+      virtual bool transport_send(BufferAllocated& buf)
+      {
+	return send(buf);
+      }
+
+      virtual bool transport_send_queue_empty()
+      {
+	return false;
+      }
+
+      virtual bool transport_has_send_queue()
+      {
+	return false;
+      }
+
+      virtual unsigned int transport_send_queue_size()
+      {
+	return 0;
+      }
+
+      virtual void reset_align_adjust(const size_t align_adjust)
+      {
+	frame_context.reset_align_adjust(align_adjust);
+      }
+
+      virtual void server_endpoint_info(std::string& host, std::string& port, std::string& proto, std::string& ip_addr) const
+      {
+	host = server_host;
+	port = server_port;
+	const IP::Addr addr = server_endpoint_addr();
+	proto = "UDP";
+	proto += addr.version_string();
+	proto += "-DCO";
+	ip_addr = addr.to_string();
+      }
+
+      virtual IP::Addr server_endpoint_addr() const
+      {
+	return IP::Addr::from_asio(server_endpoint.address());
+      }
+
+      // TunClient
+
+      virtual void tun_start(const OptionList& opt, TransportClient& transcli, CryptoDCSettings& dc_settings)
+      {
+	if (!halt && !ifindex && tun_parent)
+	  {
+	    try {
+	      // notify parent
+	      tun_parent->tun_pre_tun_config();
+
+	      // parse pushed options
+	      TunBuilderCapture::Ptr po(new TunBuilderCapture());
+	      TunProp::configure_builder(po.get(),
+					 state.get(),
+					 config->transport.stats.get(),
+					 server_endpoint_addr(),
+					 config->tun.tun_prop,
+					 opt,
+					 nullptr,
+					 false);
+
+	      OPENVPN_LOG("CAPTURED OPTIONS:" << std::endl << po->to_string());
+
+	      // the kernel only speaks DATA_V2
+	      peer_id = parse_peer_id(opt);
+
+	      // create interface and install peer on our socket,
+	      // taking over keepalive from ClientProto
+	      ifindex = OvpnNL::link_new(config->dev_name);
+	      state->iface_name = config->dev_name;
+	      add_peer();
+
+	      // watch for the kernel removing the peer
+	      start_notify();
+
+	      // send data channel keys to the kernel
+	      dc_settings.set_factory(CryptoDCFactory::Ptr(new CryptoFactory(this)));
+
+	      // configure interface properties and routes
+	      ActionList::Ptr add_cmds = new ActionList();
+	      remove_cmds.reset(new ActionList());
+	      TunLinux::tun_config(state->iface_name, *po, nullptr, *add_cmds, *remove_cmds);
+
+	      // execute commands to bring up interface
+	      add_cmds->execute(std::cout);
+
+	      // signal that we are connected
+	      tun_parent->tun_connected();
+	    }
+	    catch (const std::exception& e)
+	      {
+		stop();
+		tun_parent->tun_error(Error::TUN_SETUP_FAILED, e.what());
+	      }
+	  }
+      }
+
+      // data packets never reach user space
+      virtual bool tun_send(BufferAllocated& buf)
+      {
+	return false;
+      }
+
+      virtual std::string tun_name() const
+      {
+	if (ifindex)
+	  return state->iface_name;
+	else
+	  return "UNDEF_DCO";
+      }
+
+      virtual std::string vpn_ip4() const
+      {
+	if (state->vpn_ip4_addr.specified())
+	  return state->vpn_ip4_addr.to_string();
+	else
+	  return "";
+      }
+
+      virtual std::string vpn_ip6() const
+      {
+	if (state->vpn_ip6_addr.specified())
+	  return state->vpn_ip6_addr.to_string();
+	else
+	  return "";
+      }
+
+      virtual std::string vpn_gw4() const override
+      {
+	if (state->vpn_ip4_gw.specified())
+	  return state->vpn_ip4_gw.to_string();
+	else
+	  return "";
+      }
+
+      virtual std::string vpn_gw6() const override
+      {
+	if (state->vpn_ip6_gw.specified())
+	  return state->vpn_ip6_gw.to_string();
+	else
+	  return "";
+      }
+
+      virtual void set_disconnect()
+      {
+      }
+
+      // SessionStats::DCOTransportSource
+
+      virtual SessionStats::DCOTransportSource::Data dco_transport_stats_delta()
+      {
+	if (halt || !ifindex)
+	  return Data();
+	try {
+	  const OvpnNL::PeerStats ps = genl->peer_stats(ifindex, peer_id);
+	  const Data cur(ps.link_rx_bytes, ps.link_tx_bytes);
+	  const Data delta = cur - last_stats;
+	  last_stats = cur;
+	  return delta;
+	}
+	catch (const std::exception& e)
+	  {
+	    OPENVPN_LOG("DCO stats error: " << e.what());
+	    return Data();
+	  }
+      }
+
+      virtual void stop() { stop_(); }
+      virtual ~Client() { stop_(); }
+
+    private:
+      Client(asio::io_context& io_context_arg,
+	     ClientConfig* config_arg,
+	     TransportClientParent& parent_arg)
+	: io_context(io_context_arg),
+	  socket(io_context_arg),
+	  resolver(io_context_arg),
+	  notify_sd(io_context_arg),
+	  config(config_arg),
+	  transport_parent(parent_arg),
+	  tun_parent(nullptr),
+	  frame_context((*config_arg->transport.frame)[Frame::READ_LINK_UDP]),
+	  state(new TunProp::State()),
+	  ifindex(0),
+	  peer_id(0),
+	  halt(false)
+      {
+      }
+
+      static std::uint32_t parse_peer_id(const OptionList& opt)
+      {
+	const Option* o = opt.get_ptr("peer-id");
+	if (!o)
+	  throw dco_error("server did not push peer-id, which is required for DCO");
+	int id = -1;
+	if (!parse_number_validate<int>(o->get(1, 16), 16, 0, 0xFFFFFE, &id))
+	  throw dco_error("bad peer-id");
+	return std::uint32_t(id);
+      }
+
+      void add_peer()
+      {
+	genl.reset(new OvpnNL::Client());
+
+	OvpnNL::PeerConfig pc;
+	pc.peer_id = peer_id;
+	pc.socket = socket.native_handle();
+	const IP::Addr remote = server_endpoint_addr();
+	if (remote.version() == IP::Addr::V6)
+	  {
+	    pc.remote_ipv6 = true;
+	    pc.remote_ipv6_addr = remote.to_ipv6().to_in6_addr();
+	  }
+	else
+	  pc.remote_ipv4 = remote.to_uint32_net();
+	pc.remote_port = htons(server_endpoint.port());
+
+	if (transport_parent.is_keepalive_enabled())
+	  {
+	    unsigned int keepalive_ping = 0;
+	    unsigned int keepalive_timeout = 0;
+	    transport_parent.disable_keepalive(keepalive_ping, keepalive_timeout);
+	    pc.keepalive_interval = keepalive_ping;
+	    pc.keepalive_timeout = keepalive_timeout;
+	  }
+
+	genl->peer_new(ifindex, pc);
+      }
+
+      void start_notify()
+      {
+	genl_notify.reset(new OvpnNL::Client());
+	notify_sd.assign(genl_notify->subscribe_peers());
+	queue_notify();
+      }
+
+      void queue_notify()
+      {
+	notify_sd.async_wait(asio::posix::stream_descriptor::wait_read,
+			     [self=Ptr(this)](const asio::error_code& error)
+			     {
+			       self->handle_notify(error);
+			     });
+      }
+
+      void handle_notify(const asio::error_code& error)
+      {
+	if (halt || error)
+	  return;
+	OvpnNL::DelPeerReason reason;
+	if (genl_notify->read_peer_del(ifindex, peer_id, reason))
+	  {
+	    const Error::Type err = reason == OvpnNL::DEL_PEER_REASON_EXPIRED ? Error::KEEPALIVE_TIMEOUT : Error::TRANSPORT_ERROR;
+	    stop();
+	    transport_parent.transport_error(err, "DCO peer removed by kernel");
+	    return;
+	  }
+	queue_notify();
+      }
+
+      // Called by CryptoInstance as ProtoContext moves keys between
+      // slots.  A new key is installed in the secondary slot as soon as
+      // it is negotiated, so the kernel decrypts on it (by key_id) the
+      // moment the peer switches.  Promotion is a single KEY_SWAP, which
+      // leaves the old key in the secondary slot for stragglers until
+      // ProtoContext retires it after the transition window.  The kernel
+      // can't report first use of a key, so promotion waits for
+      // become_primary rather than for the first decrypt.
+      void rekey(const CryptoDCInstance::RekeyType type, const CryptoInstance& key)
+      {
+	if (halt || !ifindex)
+	  return;
+	try {
+	  switch (type)
+	    {
+	    case CryptoDCInstance::ACTIVATE_PRIMARY:
+	      key_new(OvpnNL::KEY_SLOT_PRIMARY, key);
+	      break;
+	    case CryptoDCInstance::NEW_SECONDARY:
+	      key_new(OvpnNL::KEY_SLOT_SECONDARY, key);
+	      break;
+	    case CryptoDCInstance::PROMOTE_SECONDARY_TO_PRIMARY:
+	      genl->key_swap(ifindex, peer_id);
+	      break;
+	    case CryptoDCInstance::DEACTIVATE_SECONDARY:
+	      genl->key_del(ifindex, peer_id, OvpnNL::KEY_SLOT_SECONDARY);
+	      break;
+	    case CryptoDCInstance::DEACTIVATE_ALL:
+	      genl->key_del(ifindex, peer_id, OvpnNL::KEY_SLOT_PRIMARY);
+	      try {
+		genl->key_del(ifindex, peer_id, OvpnNL::KEY_SLOT_SECONDARY);
+	      }
+	      catch (const std::exception&) // slot may be empty
+		{
+		}
+	      break;
+	    }
+	}
+	catch (const std::exception& e)
+	  {
+	    // we're called from inside ProtoContext, so report the error later
+	    const std::string text = std::string("DCO rekey error: ") + e.what();
+	    asio::post(io_context, [self=Ptr(this), text]()
+		       {
+			 if (!self->halt)
+			   {
+			     self->stop();
+			     self->transport_parent.transport_error(Error::TRANSPORT_ERROR, text);
+			   }
+		       });
+	  }
+      }
+
+      void key_new(const OvpnNL::KeySlot slot, const CryptoInstance& key)
+      {
+	genl->key_new(ifindex,
+		      peer_id,
+		      slot,
+		      key.kid(),
+		      CryptoFactory::alg(key.cipher_alg()),
+		      key.encrypt_dir(),
+		      key.decrypt_dir());
+      }
+
+      bool send(const Buffer& buf)
+      {
+	if (halt || !socket.is_open())
+	  return false;
+	asio::error_code ec;
+	const size_t wrote = socket.send(asio::buffer(buf.c_data(), buf.size()), 0, ec);
+	if (ec || wrote != buf.size())
+	  {
+	    config->transport.stats->error(Error::NETWORK_SEND_ERROR);
+	    return false;
+	  }
+	config->transport.stats->inc_stat(SessionStats::BYTES_OUT, wrote);
+	config->transport.stats->inc_stat(SessionStats::PACKETS_OUT, 1);
+	return true;
+      }
+
+      // Only control packets arrive here, the kernel consumes DATA_V2.
+      void queue_read()
+      {
+	frame_context.prepare(read_buf);
+	socket.async_receive(frame_context.mutable_buffers_1_clamp(read_buf),
+			     [self=Ptr(this)](const asio::error_code& error, const size_t bytes_recvd)
+			     {
+			       self->handle_read(error, bytes_recvd);
+			     });
+      }
+
+      void handle_read(const asio::error_code& error, const size_t bytes_recvd)
+      {
+	if (halt)
+	  return;
+	if (!error)
+	  {
+	    read_buf.set_size(bytes_recvd);
+	    config->transport.stats->inc_stat(SessionStats::BYTES_IN, bytes_recvd);
+	    config->transport.stats->inc_stat(SessionStats::PACKETS_IN, 1);
+	    transport_parent.transport_recv(read_buf);
+	  }
+	else
+	  {
+	    OPENVPN_LOG_UDPLINK_ERROR("DCO UDP recv error: " << error.message());
+	    config->transport.stats->error(Error::NETWORK_RECV_ERROR);
+	  }
+	if (!halt)
+	  queue_read();
+      }
+
+      void stop_()
+      {
+	if (!halt)
+	  {
+	    halt = true;
+
+	    // remove added routes
+	    if (remove_cmds)
+	      remove_cmds->execute(std::cout);
+
+	    // the notify socket is owned by genl_notify
+	    if (notify_sd.is_open())
+	      {
+		notify_sd.cancel();
+		notify_sd.release();
+	      }
+
+	    // deleting the interface also frees its peer and keys
+	    if (ifindex)
+	      {
+		try {
+		  if (genl)
+		    genl->peer_del(ifindex, peer_id);
+		}
+		catch (const std::exception&)
+		  {
+		  }
+		try {
+		  OvpnNL::link_del(ifindex);
+		}
+		catch (const std::exception& e)
+		  {
+		    OPENVPN_LOG("DCO: " << e.what());
+		  }
+		ifindex = 0;
+	      }
+	    genl.reset();
+	    genl_notify.reset();
+
+	    socket.close();
+	    resolver.cancel();
+	  }
+      }
+
+      // called after DNS resolution has succeeded or failed
+      void do_resolve_(const asio::error_code& error,
+		       asio::ip::udp::resolver::results_type results)
+      {
+	if (!halt)
+	  {
+	    if (!error)
+	      {
+		// save resolved endpoint list in remote_list
+		config->transport.remote_list->set_endpoint_range(results);
+		start_connect_();
+	      }
+	    else
+	      {
+		std::ostringstream os;
+		os << "DNS resolve error on '" << server_host << "' for UDP session: " << error.message();
+		config->transport.stats->error(Error::RESOLVE_ERROR);
+		stop();
+		transport_parent.transport_error(Error::UNDEF, os.str());
+	      }
+	  }
+      }
+
+      // do UDP connect
+      void start_connect_()
+      {
+	config->transport.remote_list->get_endpoint(server_endpoint);
+	OPENVPN_LOG("Contacting " << server_endpoint << " via UDP (DCO)");
+	transport_parent.transport_wait();
+	transport_parent.ip_hole_punch(server_endpoint_addr());
+	socket.open(server_endpoint.protocol());
+	socket.async_connect(server_endpoint, [self=Ptr(this)](const asio::error_code& error)
+			     {
+			       self->start_impl_(error);
+			     });
+      }
+
+      // start reading control packets
+      void start_impl_(const asio::error_code& error)
+      {
+	if (!halt)
+	  {
+	    if (!error)
+	      {
+		queue_read();
+		transport_parent.transport_connecting();
+	      }
+	    else
+	      {
+		std::ostringstream os;
+		os << "UDP connect error on '" << server_host << ':' << server_port << "' (" << server_endpoint << "): " << error.message();
+		config->transport.stats->error(Error::UDP_CONNECT_ERROR);
+		stop();
+		transport_parent.transport_error(Error::UNDEF, os.str());
+	      }
+	  }
+      }
+
+      std::string server_host;
+      std::string server_port;
+
+      asio::io_context& io_context;
+      asio::ip::udp::socket socket;
+      asio::ip::udp::resolver resolver;
+      asio::posix::stream_descriptor notify_sd;
+      UDPTransport::AsioEndpoint server_endpoint;
+
+      ClientConfig::Ptr config;
+      TransportClientParent& transport_parent;
+      TunClientParent* tun_parent;
+
+      Frame::Context frame_context;
+      BufferAllocated read_buf;
+
+      TunProp::State::Ptr state;
+      ActionList::Ptr remove_cmds;
+
+      std::unique_ptr<OvpnNL::Client> genl;
+      std::unique_ptr<OvpnNL::Client> genl_notify;
+      unsigned int ifindex;
+      std::uint32_t peer_id;
+      Data last_stats;
+      bool halt;
+    };
+
+    inline void CryptoInstance::rekey(const RekeyType type)
+    {
+      if (client)
+	client->rekey(type, *this);
+    }
+
+    inline TransportClient::Ptr ClientConfig::new_transport_client_obj(asio::io_context& io_context,
+								       TransportClientParent& parent)
+    {
+      return TransportClient::Ptr(new Client(io_context, this, parent));
+    }
+
+    // The transport object is created first, and is also our tun.
+    inline TunClient::Ptr ClientConfig::new_tun_client_obj(asio::io_context& io_context,
+							   TunClientParent& parent,
+							   TransportClient* transcli)
+    {
+      Client* client = dynamic_cast<Client*>(transcli);
+      if (!client)
+	throw dco_error("tun requires DCO transport");
+      client->tun_parent = &parent;
+      return TunClient::Ptr(client);
+    }
+
+    inline DCO::Ptr new_controller()
+    {
+      return DCO::Ptr(ClientConfig::new_obj().get());
+    }
+  }
+}
+
+#endif
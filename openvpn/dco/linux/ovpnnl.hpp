@@ -0,0 +1,740 @@
+//    OpenVPN -- An application to securely tunnel IP networks
+//               over a single port, with support for SSL/TLS-based
+//               session authentication and key exchange,
+//               packet encryption, packet authentication, and
+//               packet compression.
+//
+//    Copyright (C) 2012-2016 OpenVPN Technologies, Inc.
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU Affero General Public License Version 3
+//    as published by the Free Software Foundation.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU Affero General Public License for more details.
+//
+//    You should have received a copy of the GNU Affero General Public License
+//    along with this program in the COPYING file.
+//    If not, see <http://www.gnu.org/licenses/>.
+
+// Netlink client for the Linux kernel ovpn data channel offload module.
+
+#ifndef OPENVPN_DCO_LINUX_OVPNNL_H
+#define OPENVPN_DCO_LINUX_OVPNNL_H
+
+#include <sys/socket.h>
+#include <net/if.h>
+#include <netinet/in.h>
+#include <linux/netlink.h>
+#include <linux/genetlink.h>
+#include <linux/rtnetlink.h>
+#include <linux/if_link.h>
+#include <errno.h>
+
+#include <string>
+#include <vector>
+#include <cstring>
+#include <cstdint>
+
+#include <openvpn/common/exception.hpp>
+#include <openvpn/common/asioerr.hpp>
+#include <openvpn/common/scoped_fd.hpp>
+
+namespace openvpn {
+  namespace OvpnNL {
+
+    OPENVPN_EXCEPTION(ovpn_netlink_error);
+
+    // Protocol constants, mirroring <linux/ovpn.h> so that we
+    // don't depend on the installed kernel headers being recent.
+    static const char FAMILY_NAME[] = "ovpn";
+    static const char MCGRP_PEERS[] = "peers";
+    static const char LINK_KIND[] = "ovpn";
+
+    enum {
+      FAMILY_VERSION = 1,
+    };
+
+    enum Command {
+      CMD_PEER_NEW = 1,
+      CMD_PEER_SET,
+      CMD_PEER_GET,
+      CMD_PEER_DEL,
+      CMD_PEER_DEL_NTF,
+      CMD_KEY_NEW,
+      CMD_KEY_GET,
+      CMD_KEY_SWAP,
+      CMD_KEY_SWAP_NTF,
+      CMD_KEY_DEL,
+    };
+
+    enum {
+      A_IFINDEX = 1,
+      A_PEER,
+      A_KEYCONF,
+      A_MAX = A_KEYCONF
+    };
+
+    enum {
+      A_PEER_ID = 1,
+      A_PEER_REMOTE_IPV4,
+      A_PEER_REMOTE_IPV6,
+      A_PEER_REMOTE_IPV6_SCOPE_ID,
+      A_PEER_REMOTE_PORT,
+      A_PEER_SOCKET,
+      A_PEER_SOCKET_NETNSID,
+      A_PEER_VPN_IPV4,
+      A_PEER_VPN_IPV6,
+      A_PEER_LOCAL_IPV4,
+      A_PEER_LOCAL_IPV6,
+      A_PEER_LOCAL_PORT,
+      A_PEER_KEEPALIVE_INTERVAL,
+      A_PEER_KEEPALIVE_TIMEOUT,
+      A_PEER_DEL_REASON,
+      A_PEER_VPN_RX_BYTES,
+      A_PEER_VPN_TX_BYTES,
+      A_PEER_VPN_RX_PACKETS,
+      A_PEER_VPN_TX_PACKETS,
+      A_PEER_LINK_RX_BYTES,
+      A_PEER_LINK_TX_BYTES,
+      A_PEER_LINK_RX_PACKETS,
+      A_PEER_LINK_TX_PACKETS,
+      A_PEER_MAX = A_PEER_LINK_TX_PACKETS
+    };
+
+    enum {
+      A_KEYCONF_PEER_ID = 1,
+      A_KEYCONF_SLOT,
+      A_KEYCONF_KEY_ID,
+      A_KEYCONF_CIPHER_ALG,
+      A_KEYCONF_ENCRYPT_DIR,
+      A_KEYCONF_DECRYPT_DIR,
+    };
+
+    enum {
+      A_KEYDIR_CIPHER_KEY = 1,
+      A_KEYDIR_NONCE_TAIL,
+    };
+
+    enum CipherAlg {
+      CIPHER_ALG_NONE = 0,
+      CIPHER_ALG_AES_GCM,
+      CIPHER_ALG_CHACHA20_POLY1305,
+    };
+
+    enum KeySlot {
+      KEY_SLOT_PRIMARY = 0,
+      KEY_SLOT_SECONDARY,
+    };
+
+    enum DelPeerReason {
+      DEL_PEER_REASON_TEARDOWN = 0,
+      DEL_PEER_REASON_USERSPACE,
+      DEL_PEER_REASON_EXPIRED,
+      DEL_PEER_REASON_TRANSPORT_ERROR,
+      DEL_PEER_REASON_TRANSPORT_DISCONNECT,
+    };
+
+    enum {
+      IFLA_OVPN_MODE = 1, // u8, in IFLA_INFO_DATA
+      MODE_P2P = 0,
+    };
+
+    enum {
+      NONCE_TAIL_SIZE = 8,
+    };
+
+    // Netlink request under construction.  Attributes are appended
+    // in order; nested attributes are opened with nest_begin and
+    // closed with nest_end.
+    class Message
+    {
+    public:
+      Message(const std::uint16_t type, const std::uint16_t flags)
+      {
+	struct nlmsghdr h;
+	std::memset(&h, 0, sizeof(h));
+	h.nlmsg_type = type;
+	h.nlmsg_flags = NLM_F_REQUEST | NLM_F_ACK | flags;
+	append(&h, sizeof(h));
+      }
+
+      // family header following nlmsghdr (genlmsghdr, ifinfomsg)
+      void put_header(const void *data, const size_t size)
+      {
+	append(data, size);
+      }
+
+      void put(const std::uint16_t type, const void *data, const size_t size)
+      {
+	struct nlattr a;
+	a.nla_type = type;
+	a.nla_len = std::uint16_t(NLA_HDRLEN + size);
+	append(&a, sizeof(a));
+	append(data, size);
+      }
+
+      void put_u8(const std::uint16_t type, const std::uint8_t value)
+      {
+	put(type, &value, sizeof(value));
+      }
+
+      void put_u16(const std::uint16_t type, const std::uint16_t value)
+      {
+	put(type, &value, sizeof(value));
+      }
+
+      void put_u32(const std::uint16_t type, const std::uint32_t value)
+      {
+	put(type, &value, sizeof(value));
+      }
+
+      void put_string(const std::uint16_t type, const std::string& value)
+      {
+	put(type, value.c_str(), value.length() + 1);
+      }
+
+      size_t nest_begin(const std::uint16_t type)
+      {
+	const size_t offset = buf.size();
+	put(type | NLA_F_NESTED, nullptr, 0);
+	return offset;
+      }
+
+      void nest_end(const size_t offset)
+      {
+	const std::uint16_t len = std::uint16_t(buf.size() - offset);
+	std::memcpy(&buf[offset] + offsetof(struct nlattr, nla_len), &len, sizeof(len));
+      }
+
+      // finalize header and return complete message
+      const std::vector<unsigned char>& finalize(const std::uint32_t seq)
+      {
+	struct nlmsghdr *h = (struct nlmsghdr *)buf.data();
+	h->nlmsg_len = std::uint32_t(buf.size());
+	h->nlmsg_seq = seq;
+	return buf;
+      }
+
+    private:
+      void append(const void *data, const size_t size)
+      {
+	const unsigned char *p = (const unsigned char *)data;
+	if (size)
+	  buf.insert(buf.end(), p, p + size);
+	buf.resize(NLMSG_ALIGN(buf.size()), 0);
+      }
+
+      std::vector<unsigned char> buf;
+    };
+
+    // Index attributes in [data, data+size) by type, ignoring
+    // types above max.
+    inline void parse_attrs(const unsigned char *data,
+			    size_t size,
+			    const struct nlattr **tb,
+			    const unsigned int max)
+    {
+      std::memset(tb, 0, sizeof(*tb) * (max + 1));
+      while (size >= NLA_HDRLEN)
+	{
+	  const struct nlattr *a = (const struct nlattr *)data;
+	  if (a->nla_len < NLA_HDRLEN || a->nla_len > size)
+	    break;
+	  const unsigned int type = a->nla_type & NLA_TYPE_MASK;
+	  if (type <= max)
+	    tb[type] = a;
+	  const size_t len = NLA_ALIGN(a->nla_len);
+	  if (len >= size)
+	    break;
+	  data += len;
+	  size -= len;
+	}
+    }
+
+    inline const unsigned char *attr_data(const struct nlattr *a)
+    {
+      return (const unsigned char *)a + NLA_HDRLEN;
+    }
+
+    inline size_t attr_size(const struct nlattr *a)
+    {
+      return a->nla_len - NLA_HDRLEN;
+    }
+
+    // kernel "uint" attributes are either 32 or 64 bits wide
+    inline std::uint64_t attr_uint(const struct nlattr *a)
+    {
+      if (!a)
+	return 0;
+      if (attr_size(a) == sizeof(std::uint64_t))
+	{
+	  std::uint64_t v;
+	  std::memcpy(&v, attr_data(a), sizeof(v));
+	  return v;
+	}
+      else if (attr_size(a) == sizeof(std::uint32_t))
+	{
+	  std::uint32_t v;
+	  std::memcpy(&v, attr_data(a), sizeof(v));
+	  return v;
+	}
+      return 0;
+    }
+
+    // Synchronous netlink socket, for control-plane requests that
+    // are issued a few times per session.
+    class Socket
+    {
+    public:
+      Socket(const int protocol)
+	: seq(0)
+      {
+	fd.reset(::socket(AF_NETLINK, SOCK_RAW | SOCK_CLOEXEC, protocol));
+	if (!fd.defined())
+	  throw ovpn_netlink_error("socket: " + errinfo(errno));
+	struct sockaddr_nl sa;
+	std::memset(&sa, 0, sizeof(sa));
+	sa.nl_family = AF_NETLINK;
+	if (::bind(fd(), (struct sockaddr *)&sa, sizeof(sa)) < 0)
+	  throw ovpn_netlink_error("bind: " + errinfo(errno));
+      }
+
+      // Send msg, pass each reply to reply(const nlmsghdr*),
+      // and wait for the kernel ACK.  Throws on a kernel error.
+      template <typename REPLY>
+      void transact(Message& msg, const char *what, REPLY reply)
+      {
+	const std::uint32_t s = ++seq;
+	const std::vector<unsigned char>& req = msg.finalize(s);
+	struct sockaddr_nl sa;
+	std::memset(&sa, 0, sizeof(sa));
+	sa.nl_family = AF_NETLINK;
+	if (::sendto(fd(), req.data(), req.size(), 0, (struct sockaddr *)&sa, sizeof(sa)) < 0)
+	  OPENVPN_THROW(ovpn_netlink_error, what << ": send: " << errinfo(errno));
+
+	std::vector<unsigned char> rbuf(RECV_SIZE);
+	while (true)
+	  {
+	    const ssize_t len = ::recv(fd(), rbuf.data(), rbuf.size(), 0);
+	    if (len < 0)
+	      {
+		if (errno == EINTR)
+		  continue;
+		OPENVPN_THROW(ovpn_netlink_error, what << ": recv: " << errinfo(errno));
+	      }
+	    size_t remaining = len;
+	    for (const struct nlmsghdr *h = (const struct nlmsghdr *)rbuf.data();
+		 NLMSG_OK(h, remaining);
+		 h = NLMSG_NEXT(h, remaining))
+	      {
+		if (h->nlmsg_seq != s)
+		  continue;
+		if (h->nlmsg_type == NLMSG_ERROR)
+		  {
+		    const struct nlmsgerr *e = (const struct nlmsgerr *)NLMSG_DATA(h);
+		    if (e->error)
+		      OPENVPN_THROW(ovpn_netlink_error, what << ": " << errinfo(-e->error));
+		    return;
+		  }
+		if (h->nlmsg_type == NLMSG_DONE)
+		  return;
+		reply(h);
+	      }
+	  }
+      }
+
+      void transact(Message& msg, const char *what)
+      {
+	transact(msg, what, [](const struct nlmsghdr *) {});
+      }
+
+      // Send msgs with as few sendmsg() calls as possible.  Requests
+      // go out in chunks of BATCH_SIZE, and the ACKs of a chunk are
+      // collected before the next is sent, so that the kernel's
+      // replies can't overrun our receive buffer.  A kernel error
+      // doesn't abort the batch, but is passed to
+      // error(index into msgs, errno).
+      template <typename ERROR>
+      void transact_batch(std::vector<Message>& msgs, const char *what, ERROR error)
+      {
+	std::vector<unsigned char> req;
+	std::vector<unsigned char> rbuf(RECV_SIZE);
+	size_t i = 0;
+	while (i < msgs.size())
+	  {
+	    // concatenate the requests of this chunk
+	    const size_t base = i;
+	    const std::uint32_t first = seq + 1;
+	    req.clear();
+	    for (; i < msgs.size() && i - base < BATCH_SIZE; ++i)
+	      {
+		const std::vector<unsigned char>& m = msgs[i].finalize(++seq);
+		req.insert(req.end(), m.begin(), m.end());
+	      }
+	    const size_t n = i - base;
+
+	    struct sockaddr_nl sa;
+	    std::memset(&sa, 0, sizeof(sa));
+	    sa.nl_family = AF_NETLINK;
+	    if (::sendto(fd(), req.data(), req.size(), 0, (struct sockaddr *)&sa, sizeof(sa)) < 0)
+	      OPENVPN_THROW(ovpn_netlink_error, what << ": send: " << errinfo(errno));
+
+	    // wait for one ACK per request
+	    size_t acked = 0;
+	    while (acked < n)
+	      {
+		const ssize_t len = ::recv(fd(), rbuf.data(), rbuf.size(), 0);
+		if (len < 0)
+		  {
+		    if (errno == EINTR)
+		      continue;
+		    OPENVPN_THROW(ovpn_netlink_error, what << ": recv: " << errinfo(errno));
+		  }
+		size_t remaining = len;
+		for (const struct nlmsghdr *h = (const struct nlmsghdr *)rbuf.data();
+		     NLMSG_OK(h, remaining);
+		     h = NLMSG_NEXT(h, remaining))
+		  {
+		    const std::uint32_t idx = h->nlmsg_seq - first;
+		    if (h->nlmsg_type != NLMSG_ERROR || idx >= n)
+		      continue;
+		    const struct nlmsgerr *e = (const struct nlmsgerr *)NLMSG_DATA(h);
+		    if (e->error)
+		      error(base + idx, -e->error);
+		    ++acked;
+		  }
+	      }
+	  }
+      }
+
+      void join_group(const std::uint32_t group)
+      {
+	if (::setsockopt(fd(), SOL_NETLINK, NETLINK_ADD_MEMBERSHIP, &group, sizeof(group)) < 0)
+	  throw ovpn_netlink_error("NETLINK_ADD_MEMBERSHIP: " + errinfo(errno));
+      }
+
+      int native_handle() const
+      {
+	return fd();
+      }
+
+      enum {
+	RECV_SIZE = 32768,
+	BATCH_SIZE = 64, // requests per sendmsg() in transact_batch
+      };
+
+    private:
+      ScopedFD fd;
+      std::uint32_t seq;
+    };
+
+    // Create a point-to-point ovpn interface, returning its ifindex.
+    inline unsigned int link_new(const std::string& name)
+    {
+      Socket sock(NETLINK_ROUTE);
+      Message msg(RTM_NEWLINK, NLM_F_CREATE | NLM_F_EXCL);
+      struct ifinfomsg ifi;
+      std::memset(&ifi, 0, sizeof(ifi));
+      ifi.ifi_family = AF_UNSPEC;
+      msg.put_header(&ifi, sizeof(ifi));
+      msg.put_string(IFLA_IFNAME, name);
+      const size_t linkinfo = msg.nest_begin(IFLA_LINKINFO);
+      msg.put_string(IFLA_INFO_KIND, LINK_KIND);
+      const size_t data = msg.nest_begin(IFLA_INFO_DATA);
+      msg.put_u8(IFLA_OVPN_MODE, MODE_P2P);
+      msg.nest_end(data);
+      msg.nest_end(linkinfo);
+      sock.transact(msg, "RTM_NEWLINK ovpn");
+
+      const unsigned int ifindex = ::if_nametoindex(name.c_str());
+      if (!ifindex)
+	OPENVPN_THROW(ovpn_netlink_error, "ovpn interface " << name << " not found after creation");
+      return ifindex;
+    }
+
+    inline void link_del(const unsigned int ifindex)
+    {
+      Socket sock(NETLINK_ROUTE);
+      Message msg(RTM_DELLINK, 0);
+      struct ifinfomsg ifi;
+      std::memset(&ifi, 0, sizeof(ifi));
+      ifi.ifi_family = AF_UNSPEC;
+      ifi.ifi_index = int(ifindex);
+      msg.put_header(&ifi, sizeof(ifi));
+      sock.transact(msg, "RTM_DELLINK ovpn");
+    }
+
+    struct PeerConfig
+    {
+      std::uint32_t peer_id = 0;
+      int socket = -1;                   // user-space UDP socket, connected to remote
+
+      bool remote_ipv6 = false;
+      std::uint32_t remote_ipv4 = 0;     // network byte order
+      struct in6_addr remote_ipv6_addr;
+      std::uint16_t remote_port = 0;     // network byte order
+
+      std::uint32_t keepalive_interval = 0;  // seconds, 0 to disable
+      std::uint32_t keepalive_timeout = 0;
+    };
+
+    struct KeyDir
+    {
+      const unsigned char *cipher_key = nullptr;
+      size_t cipher_key_size = 0;
+      const unsigned char *nonce_tail = nullptr; // NONCE_TAIL_SIZE bytes
+    };
+
+    struct PeerStats
+    {
+      std::uint64_t link_rx_bytes = 0;
+      std::uint64_t link_tx_bytes = 0;
+      std::uint64_t vpn_rx_bytes = 0;
+      std::uint64_t vpn_tx_bytes = 0;
+    };
+
+    // Generic netlink client for the ovpn family.
+    class Client
+    {
+    public:
+      Client()
+	: sock(NETLINK_GENERIC),
+	  family_id(0),
+	  peers_group(0)
+      {
+	resolve_family();
+      }
+
+      void peer_new(const unsigned int ifindex, const PeerConfig& pc)
+      {
+	Message msg = request(CMD_PEER_NEW, ifindex);
+	const size_t peer = msg.nest_begin(A_PEER);
+	msg.put_u32(A_PEER_ID, pc.peer_id);
+	msg.put_u32(A_PEER_SOCKET, std::uint32_t(pc.socket));
+	if (pc.remote_ipv6)
+	  msg.put(A_PEER_REMOTE_IPV6, &pc.remote_ipv6_addr, sizeof(pc.remote_ipv6_addr));
+	else
+	  msg.put(A_PEER_REMOTE_IPV4, &pc.remote_ipv4, sizeof(pc.remote_ipv4));
+	msg.put(A_PEER_REMOTE_PORT, &pc.remote_port, sizeof(pc.remote_port));
+	if (pc.keepalive_interval && pc.keepalive_timeout)
+	  {
+	    msg.put_u32(A_PEER_KEEPALIVE_INTERVAL, pc.keepalive_interval);
+	    msg.put_u32(A_PEER_KEEPALIVE_TIMEOUT, pc.keepalive_timeout);
+	  }
+	msg.nest_end(peer);
+	sock.transact(msg, "OVPN_CMD_PEER_NEW");
+      }
+
+      void peer_del(const unsigned int ifindex, const std::uint32_t peer_id)
+      {
+	Message msg = request(CMD_PEER_DEL, ifindex);
+	const size_t peer = msg.nest_begin(A_PEER);
+	msg.put_u32(A_PEER_ID, peer_id);
+	msg.nest_end(peer);
+	sock.transact(msg, "OVPN_CMD_PEER_DEL");
+      }
+
+      PeerStats peer_stats(const unsigned int ifindex, const std::uint32_t peer_id)
+      {
+	PeerStats ret;
+	Message msg = request(CMD_PEER_GET, ifindex);
+	const size_t peer = msg.nest_begin(A_PEER);
+	msg.put_u32(A_PEER_ID, peer_id);
+	msg.nest_end(peer);
+	sock.transact(msg, "OVPN_CMD_PEER_GET", [&ret](const struct nlmsghdr *h)
+		      {
+			const struct nlattr *tb[A_MAX + 1];
+			parse_genl(h, tb, A_MAX);
+			if (!tb[A_PEER])
+			  return;
+			const struct nlattr *pa[A_PEER_MAX + 1];
+			parse_attrs(attr_data(tb[A_PEER]), attr_size(tb[A_PEER]), pa, A_PEER_MAX);
+			ret.link_rx_bytes = attr_uint(pa[A_PEER_LINK_RX_BYTES]);
+			ret.link_tx_bytes = attr_uint(pa[A_PEER_LINK_TX_BYTES]);
+			ret.vpn_rx_bytes = attr_uint(pa[A_PEER_VPN_RX_BYTES]);
+			ret.vpn_tx_bytes = attr_uint(pa[A_PEER_VPN_TX_BYTES]);
+		      });
+	return ret;
+      }
+
+      void key_new(const unsigned int ifindex,
+		   const std::uint32_t peer_id,
+		   const KeySlot slot,
+		   const unsigned int key_id,
+		   const CipherAlg alg,
+		   const KeyDir& encrypt,
+		   const KeyDir& decrypt)
+      {
+	Message msg = request(CMD_KEY_NEW, ifindex);
+	const size_t kc = msg.nest_begin(A_KEYCONF);
+	msg.put_u32(A_KEYCONF_PEER_ID, peer_id);
+	msg.put_u32(A_KEYCONF_SLOT, slot);
+	msg.put_u32(A_KEYCONF_KEY_ID, key_id);
+	msg.put_u32(A_KEYCONF_CIPHER_ALG, alg);
+	put_keydir(msg, A_KEYCONF_ENCRYPT_DIR, encrypt);
+	put_keydir(msg, A_KEYCONF_DECRYPT_DIR, decrypt);
+	msg.nest_end(kc);
+	sock.transact(msg, "OVPN_CMD_KEY_NEW");
+      }
+
+      void key_swap(const unsigned int ifindex, const std::uint32_t peer_id)
+      {
+	Message msg = request(CMD_KEY_SWAP, ifindex);
+	const size_t kc = msg.nest_begin(A_KEYCONF);
+	msg.put_u32(A_KEYCONF_PEER_ID, peer_id);
+	msg.nest_end(kc);
+	sock.transact(msg, "OVPN_CMD_KEY_SWAP");
+      }
+
+      void key_del(const unsigned int ifindex, const std::uint32_t peer_id, const KeySlot slot)
+      {
+	Message msg = request(CMD_KEY_DEL, ifindex);
+	const size_t kc = msg.nest_begin(A_KEYCONF);
+	msg.put_u32(A_KEYCONF_PEER_ID, peer_id);
+	msg.put_u32(A_KEYCONF_SLOT, slot);
+	msg.nest_end(kc);
+	sock.transact(msg, "OVPN_CMD_KEY_DEL");
+      }
+
+      // Subscribe to peer notifications, after which the socket
+      // should only be used to read_peer_del().
+      int subscribe_peers()
+      {
+	if (!peers_group)
+	  throw ovpn_netlink_error("ovpn family has no peers multicast group");
+	sock.join_group(peers_group);
+	return sock.native_handle();
+      }
+
+      // Non-blocking read of pending notifications.  Returns true and
+      // sets reason if peer_id on ifindex was deleted by the kernel.
+      bool read_peer_del(const unsigned int ifindex, const std::uint32_t peer_id, DelPeerReason& reason)
+      {
+	bool ret = false;
+	std::vector<unsigned char> rbuf(Socket::RECV_SIZE);
+	while (true)
+	  {
+	    const ssize_t len = ::recv(sock.native_handle(), rbuf.data(), rbuf.size(), MSG_DONTWAIT);
+	    if (len <= 0)
+	      break;
+	    size_t remaining = len;
+	    for (const struct nlmsghdr *h = (const struct nlmsghdr *)rbuf.data();
+		 NLMSG_OK(h, remaining);
+		 h = NLMSG_NEXT(h, remaining))
+	      {
+		if (h->nlmsg_type != family_id)
+		  continue;
+		const struct genlmsghdr *g = (const struct genlmsghdr *)NLMSG_DATA(h);
+		if (g->cmd != CMD_PEER_DEL_NTF)
+		  continue;
+		const struct nlattr *tb[A_MAX + 1];
+		parse_genl(h, tb, A_MAX);
+		if (!tb[A_IFINDEX] || !tb[A_PEER] || attr_uint(tb[A_IFINDEX]) != ifindex)
+		  continue;
+		const struct nlattr *pa[A_PEER_MAX + 1];
+		parse_attrs(attr_data(tb[A_PEER]), attr_size(tb[A_PEER]), pa, A_PEER_MAX);
+		if (pa[A_PEER_ID] && attr_uint(pa[A_PEER_ID]) == peer_id)
+		  {
+		    reason = DelPeerReason(attr_uint(pa[A_PEER_DEL_REASON]));
+		    ret = true;
+		  }
+	      }
+	  }
+	return ret;
+      }
+
+    private:
+      Message request(const std::uint8_t cmd, const unsigned int ifindex)
+      {
+	Message msg(family_id, 0);
+	put_genl(msg, cmd, FAMILY_VERSION);
+	msg.put_u32(A_IFINDEX, ifindex);
+	return msg;
+      }
+
+      static void put_genl(Message& msg, const std::uint8_t cmd, const std::uint8_t version)
+      {
+	struct genlmsghdr g;
+	std::memset(&g, 0, sizeof(g));
+	g.cmd = cmd;
+	g.version = version;
+	msg.put_header(&g, sizeof(g));
+      }
+
+      static void parse_genl(const struct nlmsghdr *h, const struct nlattr **tb, const unsigned int max)
+      {
+	const size_t hdr = NLMSG_HDRLEN + GENL_HDRLEN;
+	if (h->nlmsg_len < hdr)
+	  {
+	    std::memset(tb, 0, sizeof(*tb) * (max + 1));
+	    return;
+	  }
+	parse_attrs((const unsigned char *)h + hdr, h->nlmsg_len - hdr, tb, max);
+      }
+
+      static void put_keydir(Message& msg, const std::uint16_t type, const KeyDir& kd)
+      {
+	const size_t dir = msg.nest_begin(type);
+	msg.put(A_KEYDIR_CIPHER_KEY, kd.cipher_key, kd.cipher_key_size);
+	msg.put(A_KEYDIR_NONCE_TAIL, kd.nonce_tail, NONCE_TAIL_SIZE);
+	msg.nest_end(dir);
+      }
+
+      void resolve_family()
+      {
+	Message msg(GENL_ID_CTRL, 0);
+	put_genl(msg, CTRL_CMD_GETFAMILY, 1);
+	msg.put_string(CTRL_ATTR_FAMILY_NAME, FAMILY_NAME);
+	try {
+	  sock.transact(msg, "CTRL_CMD_GETFAMILY", [this](const struct nlmsghdr *h)
+			{
+			  const struct nlattr *tb[CTRL_ATTR_MAX + 1];
+			  parse_genl(h, tb, CTRL_ATTR_MAX);
+			  if (tb[CTRL_ATTR_FAMILY_ID])
+			    std::memcpy(&family_id, attr_data(tb[CTRL_ATTR_FAMILY_ID]), sizeof(family_id));
+			  if (tb[CTRL_ATTR_MCAST_GROUPS])
+			    parse_mcast_groups(tb[CTRL_ATTR_MCAST_GROUPS]);
+			});
+	}
+	catch (const ovpn_netlink_error& e)
+	  {
+	    OPENVPN_THROW(ovpn_netlink_error, "ovpn kernel module not available (" << e.what() << ')');
+	  }
+	if (!family_id)
+	  throw ovpn_netlink_error("ovpn generic netlink family id not returned");
+      }
+
+      void parse_mcast_groups(const struct nlattr *groups)
+      {
+	const unsigned char *data = attr_data(groups);
+	size_t size = attr_size(groups);
+	while (size >= NLA_HDRLEN)
+	  {
+	    const struct nlattr *g = (const struct nlattr *)data;
+	    if (g->nla_len < NLA_HDRLEN || g->nla_len > size)
+	      break;
+	    const struct nlattr *ga[CTRL_ATTR_MCAST_GRP_MAX + 1];
+	    parse_attrs(attr_data(g), attr_size(g), ga, CTRL_ATTR_MCAST_GRP_MAX);
+	    if (ga[CTRL_ATTR_MCAST_GRP_NAME] && ga[CTRL_ATTR_MCAST_GRP_ID]
+		&& !std::strcmp((const char *)attr_data(ga[CTRL_ATTR_MCAST_GRP_NAME]), MCGRP_PEERS))
+	      peers_group = std::uint32_t(attr_uint(ga[CTRL_ATTR_MCAST_GRP_ID]));
+	    const size_t len = NLA_ALIGN(g->nla_len);
+	    if (len >= size)
+	      break;
+	    data += len;
+	    size -= len;
+	  }
+      }
+
+      Socket sock;
+      std::uint16_t family_id;
+      std::uint32_t peers_group;
+    };
+
+  }
+}
+
+#endif
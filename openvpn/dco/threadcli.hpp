@@ -0,0 +1,1259 @@
+//    OpenVPN -- An application to securely tunnel IP networks
+//               over a single port, with support for SSL/TLS-based
+//               session authentication and key exchange,
+//               packet encryption, packet authentication, and
+//               packet compression.
+//
+//    Copyright (C) 2012-2016 OpenVPN Technologies, Inc.
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU Affero General Public License Version 3
+//    as published by the Free Software Foundation.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU Affero General Public License for more details.
+//
+//    You should have received a copy of the GNU Affero General Public License
+//    along with this program in the COPYING file.
+//    If not, see <http://www.gnu.org/licenses/>.
+
+// Client transport and tun that run the data channel on two threads
+// of their own, in the manner of a kernel data channel offload:
+//
+//   TX thread      -- reads the tun device, encrypts with the primary
+//                     key and sends on the UDP socket
+//   RX thread      -- reads the UDP socket, decrypts data packets and
+//                     writes them to the tun device; anything else is
+//                     queued to the control thread on an SPSCRing
+//   control thread -- the client io_context, which keeps ProtoContext,
+//                     TLS, renegotiation and timers
+//
+// Each data thread owns one direction, so the two run in parallel on
+// their own cores, and a TLS renegotiation on the control thread no
+// longer holds up data packets.
+
+#ifndef OPENVPN_DCO_THREADCLI_H
+#define OPENVPN_DCO_THREADCLI_H
+
+#include <sys/socket.h>
+#include <sys/eventfd.h>
+#include <poll.h>
+#include <unistd.h>
+#include <errno.h>
+
+#include <string>
+#include <sstream>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <memory>
+#include <utility> // for std::move
+
+#include <asio.hpp>
+
+#include <openvpn/common/platform.hpp>
+
+#if !defined(OPENVPN_PLATFORM_LINUX)
+#error the threaded data channel is only implemented for Linux
+#endif
+
+#include <openvpn/common/exception.hpp>
+#include <openvpn/common/rc.hpp>
+#include <openvpn/common/action.hpp>
+#include <openvpn/common/number.hpp>
+#include <openvpn/common/scoped_fd.hpp>
+#include <openvpn/common/spscring.hpp>
+#include <openvpn/buffer/buffer.hpp>
+#include <openvpn/time/time.hpp>
+#include <openvpn/time/asiotimer.hpp>
+#include <openvpn/crypto/cryptodc.hpp>
+#include <openvpn/crypto/static_key.hpp>
+#include <openvpn/ssl/proto.hpp>
+#include <openvpn/transport/dco.hpp>
+#include <openvpn/transport/udplink.hpp>
+#include <openvpn/tun/builder/capture.hpp>
+#include <openvpn/tun/linux/tun.hpp>
+#include <openvpn/tun/linux/client/tuncli.hpp>
+#include <openvpn/linux/core.hpp>
+
+namespace openvpn {
+  namespace ThreadedDCO {
+
+    OPENVPN_EXCEPTION(threaded_dco_error);
+
+    class Client;
+
+    // Like DCOTransport::ClientConfig, one object is both the
+    // transport and the tun factory.
+    class ClientConfig : public DCO,
+			 public TransportClientFactory,
+			 public TunClientFactory
+    {
+    public:
+      typedef RCPtr<ClientConfig> Ptr;
+
+      std::string dev_name;
+      int txqueuelen = 200;
+
+      // cores to pin the data threads to, or -1 to leave them unpinned
+      int tx_core = -1;
+      int rx_core = -1;
+
+      // packets moved per read/encrypt/send pass
+      unsigned int batch = 32;
+
+      // control packets queued from the RX thread to the control thread
+      size_t control_queue = 256;
+
+      DCO::TransportConfig transport;
+      DCO::TunConfig tun;
+
+      static Ptr new_obj()
+      {
+	return new ClientConfig;
+      }
+
+      virtual TunClientFactory::Ptr new_tun_factory(const DCO::TunConfig& conf, const OptionList& opt)
+      {
+	if (conf.tun_prop.layer() != Layer::OSI_LAYER_3)
+	  throw threaded_dco_error("only layer 3 (dev tun) is supported");
+	tun = conf;
+	if (dev_name.empty())
+	  {
+	    const Option* dev = opt.get_ptr("dev");
+	    if (dev)
+	      dev_name = dev->get(1, 64);
+	  }
+	return TunClientFactory::Ptr(this);
+      }
+
+      virtual TransportClientFactory::Ptr new_transport_factory(const DCO::TransportConfig& conf)
+      {
+	if (!conf.protocol.is_udp())
+	  throw threaded_dco_error("only UDP transport is supported");
+	transport = conf;
+	return TransportClientFactory::Ptr(this);
+      }
+
+      virtual TransportClient::Ptr new_transport_client_obj(asio::io_context& io_context,
+							    TransportClientParent& parent);
+
+      virtual TunClient::Ptr new_tun_client_obj(asio::io_context& io_context,
+						TunClientParent& parent,
+						TransportClient* transcli);
+
+    private:
+      ClientConfig() {}
+    };
+
+    // Wraps the CryptoDCInstance of the configured crypto backend.
+    // ProtoContext keeps driving it on the control thread, while the
+    // data threads use the same keys through Client's key tables:
+    // the TX thread encrypts through this instance, and the RX thread
+    // decrypts through a decrypt lane (see new_decrypt_lane) so that
+    // the two never contend.  Backends without lanes decrypt through
+    // this instance under the TX lock.
+    class CryptoInstance : public CryptoDCInstance
+    {
+      friend class Client;
+
+    public:
+      typedef RCPtr<CryptoInstance> Ptr;
+
+      CryptoInstance(Client* client_arg,
+		     CryptoDCInstance::Ptr&& inner_arg,
+		     const unsigned int key_id_arg)
+	: client(client_arg),
+	  inner(std::move(inner_arg)),
+	  key_id(key_id_arg)
+      {
+      }
+
+      virtual ~CryptoInstance();
+
+      // Control thread encrypts, such as explicit-exit-notify.
+      virtual bool encrypt(BufferAllocated& buf, const PacketID::time_t now, const unsigned char *op32);
+
+      // Data packets are consumed by the RX thread, so this is
+      // only reached for stragglers received before it started.
+      virtual Error::Type decrypt(BufferAllocated& buf, const PacketID::time_t now, const unsigned char *op32);
+
+      virtual unsigned int defined() const
+      {
+	return inner->defined();
+      }
+
+      virtual void init_cipher(StaticKey&& encrypt_key,
+			       StaticKey&& decrypt_key)
+      {
+	inner->init_cipher(std::move(encrypt_key), std::move(decrypt_key));
+      }
+
+      virtual void init_hmac(StaticKey&& encrypt_key,
+			     StaticKey&& decrypt_key)
+      {
+	inner->init_hmac(std::move(encrypt_key), std::move(decrypt_key));
+      }
+
+      virtual void init_pid(const int send_form,
+			    const int recv_mode,
+			    const int recv_form,
+			    const char *recv_name,
+			    const int recv_unit,
+			    const SessionStats::Ptr& recv_stats_arg)
+      {
+	inner->init_pid(send_form, recv_mode, recv_form, recv_name, recv_unit, recv_stats_arg);
+      }
+
+      virtual bool init_epoch(const unsigned int epoch_bits,
+			      const unsigned int period,
+			      const StaticKey& encrypt_secret,
+			      const StaticKey& decrypt_secret)
+      {
+	return inner->init_epoch(epoch_bits, period, encrypt_secret, decrypt_secret);
+      }
+
+      // the data threads don't compress
+      virtual bool consider_compression(const CompressContext& comp_ctx)
+      {
+	return false;
+      }
+
+      virtual void explicit_exit_notify()
+      {
+	inner->explicit_exit_notify();
+      }
+
+      virtual void rekey(const RekeyType type);
+
+      unsigned int kid() const { return key_id; }
+
+    private:
+      RCPtr<Client> client;
+      CryptoDCInstance::Ptr inner;
+      CryptoDCInstance::Ptr lane;  // RX thread decrypt lane
+      unsigned int key_id;
+    };
+
+    class CryptoContext : public CryptoDCContext
+    {
+    public:
+      CryptoContext(Client* client_arg, CryptoDCContext::Ptr&& inner_arg)
+	: client(client_arg),
+	  inner(std::move(inner_arg))
+      {
+      }
+
+      virtual CryptoDCInstance::Ptr new_obj(const unsigned int key_id)
+      {
+	return new CryptoInstance(client.get(), inner->new_obj(key_id), key_id);
+      }
+
+      virtual Info crypto_info()
+      {
+	return inner->crypto_info();
+      }
+
+      virtual size_t encap_overhead() const
+      {
+	return inner->encap_overhead();
+      }
+
+    private:
+      RCPtr<Client> client;
+      CryptoDCContext::Ptr inner;
+    };
+
+    class CryptoFactory : public CryptoDCFactory
+    {
+    public:
+      CryptoFactory(Client* client_arg, const CryptoDCFactory::Ptr& inner_arg)
+	: client(client_arg),
+	  inner(inner_arg)
+      {
+      }
+
+      virtual CryptoDCContext::Ptr new_obj(const CryptoAlgs::Type cipher,
+					   const CryptoAlgs::Type digest)
+      {
+	return new CryptoContext(client.get(), inner->new_obj(cipher, digest));
+      }
+
+      virtual bool supports_cipher(const CryptoAlgs::Type cipher) const
+      {
+	return inner->supports_cipher(cipher);
+      }
+
+    private:
+      RCPtr<Client> client;
+      CryptoDCFactory::Ptr inner;
+    };
+
+    class Client : public TransportClient,
+		   public TunClient
+    {
+      friend class ClientConfig;    // calls constructor
+      friend class CryptoInstance;  // calls rekey
+
+    public:
+      typedef RCPtr<Client> Ptr;
+
+      // TransportClient
+
+      virtual void transport_start()
+      {
+	if (!halt && !socket.is_open())
+	  {
+	    if (config->transport.remote_list->endpoint_available(&server_host, &server_port, nullptr))
+	      start_connect_();
+	    else
+	      {
+		transport_parent.transport_pre_resolve();
+		resolver.async_resolve(server_host, server_port,
+				       [self=Ptr(this)](const asio::error_code& error, asio::ip::udp::resolver::results_type results)
+				       {
+					 self->do_resolve_(error, results);
+				       });
+	      }
+	  }
+      }
+
+      virtual bool transport_send_const(const Buffer& buf)
+      {
+	return send(buf);
+      }
+
+      virtual bool transport_send(BufferAllocated& buf)
+      {
+	return send(buf);
+      }
+
+      virtual bool transport_send_queue_empty()
+      {
+	return false;
+      }
+
+      virtual bool transport_has_send_queue()
+      {
+	return false;
+      }
+
+      virtual unsigned int transport_send_queue_size()
+      {
+	return 0;
+      }
+
+      virtual void reset_align_adjust(const size_t align_adjust)
+      {
+	frame_context.reset_align_adjust(align_adjust);
+      }
+
+      virtual void server_endpoint_info(std::string& host, std::string& port, std::string& proto, std::string& ip_addr) const
+      {
+	host = server_host;
+	port = server_port;
+	const IP::Addr addr = server_endpoint_addr();
+	proto = "UDP";
+	proto += addr.version_string();
+	proto += "-THREADED";
+	ip_addr = addr.to_string();
+      }
+
+      virtual IP::Addr server_endpoint_addr() const
+      {
+	return IP::Addr::from_asio(server_endpoint.address());
+      }
+
+      // TunClient
+
+      virtual void tun_start(const OptionList& opt, TransportClient& transcli, CryptoDCSettings& dc_settings)
+      {
+	if (!halt && !tun_fd.defined() && tun_parent)
+	  {
+	    try {
+	      // notify parent
+	      tun_parent->tun_pre_tun_config();
+
+	      if (opt.exists("compress") || opt.exists("comp-lzo"))
+		throw threaded_dco_error("compression is not supported by the threaded data channel");
+
+	      // parse pushed options
+	      TunBuilderCapture::Ptr po(new TunBuilderCapture());
+	      TunProp::configure_builder(po.get(),
+					 state.get(),
+					 config->transport.stats.get(),
+					 server_endpoint_addr(),
+					 config->tun.tun_prop,
+					 opt,
+					 nullptr,
+					 false);
+
+	      OPENVPN_LOG("CAPTURED OPTIONS:" << std::endl << po->to_string());
+
+	      // DATA_V2 if the server assigned us a peer-id
+	      peer_id = parse_peer_id(opt);
+
+	      // open tun
+	      std::string name = config->dev_name;
+	      tun_fd.reset(TunLinux::tun_open(name, config->tun.tun_prop.layer, config->txqueuelen));
+	      state->iface_name = name;
+
+	      // the data threads take over keepalive from ClientProto
+	      if (transport_parent.is_keepalive_enabled())
+		{
+		  unsigned int ping = 0;
+		  unsigned int timeout = 0;
+		  transport_parent.disable_keepalive(ping, timeout);
+		  keepalive_ping = ping;
+		  keepalive_timeout = timeout;
+		}
+
+	      // route data channel keys through our key tables
+	      if (!dc_settings.factory())
+		throw threaded_dco_error("no data channel factory");
+	      dc_settings.set_factory(CryptoDCFactory::Ptr(new CryptoFactory(this, dc_settings.factory())));
+
+	      // configure interface properties and routes
+	      ActionList::Ptr add_cmds = new ActionList();
+	      remove_cmds.reset(new ActionList());
+	      TunLinux::tun_config(state->iface_name, *po, nullptr, *add_cmds, *remove_cmds);
+
+	      // execute commands to bring up interface
+	      add_cmds->execute(std::cout);
+
+	      start_threads();
+
+	      // signal that we are connected
+	      tun_parent->tun_connected();
+	    }
+	    catch (const std::exception& e)
+	      {
+		stop();
+		tun_parent->tun_error(Error::TUN_SETUP_FAILED, e.what());
+	      }
+	  }
+      }
+
+      // data packets are written by the RX thread
+      virtual bool tun_send(BufferAllocated& buf)
+      {
+	return false;
+      }
+
+      virtual std::string tun_name() const
+      {
+	if (tun_fd.defined())
+	  return state->iface_name;
+	else
+	  return "UNDEF_THREADED";
+      }
+
+      virtual std::string vpn_ip4() const
+      {
+	if (state->vpn_ip4_addr.specified())
+	  return state->vpn_ip4_addr.to_string();
+	else
+	  return "";
+      }
+
+      virtual std::string vpn_ip6() const
+      {
+	if (state->vpn_ip6_addr.specified())
+	  return state->vpn_ip6_addr.to_string();
+	else
+	  return "";
+      }
+
+      virtual std::string vpn_gw4() const override
+      {
+	if (state->vpn_ip4_gw.specified())
+	  return state->vpn_ip4_gw.to_string();
+	else
+	  return "";
+      }
+
+      virtual std::string vpn_gw6() const override
+      {
+	if (state->vpn_ip6_gw.specified())
+	  return state->vpn_ip6_gw.to_string();
+	else
+	  return "";
+      }
+
+      virtual void set_disconnect()
+      {
+      }
+
+      virtual void stop() { stop_(); }
+      virtual ~Client() { stop_(); }
+
+    private:
+      enum {
+	OPCODE_SHIFT = 3,
+	KEY_ID_MASK = 0x07,
+	DATA_V1 = 6,
+	DATA_V2 = 9,
+	OP_SIZE_V2 = 4,
+	OP_PEER_ID_UNDEF = 0x00FFFFFF,
+	N_KEY_IDS = 8,
+      };
+
+      // A decrypt slot of the RX key table.  If shared, crypto is
+      // the key's own instance and must be used under tx_mutex.
+      struct RecvKey
+      {
+	CryptoDCInstance* crypto = nullptr;
+	const CryptoInstance* owner = nullptr;
+	bool shared = false;
+      };
+
+      Client(asio::io_context& io_context_arg,
+	     ClientConfig* config_arg,
+	     TransportClientParent& parent_arg)
+	: io_context(io_context_arg),
+	  socket(io_context_arg),
+	  resolver(io_context_arg),
+	  wake_sd(io_context_arg),
+	  housekeeping_timer(io_context_arg),
+	  config(config_arg),
+	  transport_parent(parent_arg),
+	  tun_parent(nullptr),
+	  frame_context((*config_arg->transport.frame)[Frame::READ_LINK_UDP]),
+	  state(new TunProp::State()),
+	  control_ring(config_arg->control_queue),
+	  halt(false)
+      {
+	for (auto &e : errors)
+	  e.store(0, std::memory_order_relaxed);
+      }
+
+      static std::uint32_t parse_peer_id(const OptionList& opt)
+      {
+	const Option* o = opt.get_ptr("peer-id");
+	if (!o)
+	  return OP_PEER_ID_UNDEF;
+	int id = -1;
+	if (!parse_number_validate<int>(o->get(1, 16), 16, 0, 0xFFFFFE, &id))
+	  throw threaded_dco_error("bad peer-id");
+	return std::uint32_t(id);
+      }
+
+      // Called by CryptoInstance, on the control thread, as
+      // ProtoContext moves keys between slots.  Both locks are taken
+      // (RX before TX, as in the RX thread) so that neither data thread
+      // sees a key half installed.
+      void rekey(const CryptoDCInstance::RekeyType type, CryptoInstance& key)
+      {
+	std::lock_guard<std::mutex> rl(rx_mutex);
+	std::lock_guard<std::mutex> tl(tx_mutex);
+	switch (type)
+	  {
+	  case CryptoDCInstance::ACTIVATE_PRIMARY:
+	    install_recv_key(key);
+	    tx_key = &key;
+	    break;
+	  case CryptoDCInstance::NEW_SECONDARY:
+	    install_recv_key(key);
+	    break;
+	  case CryptoDCInstance::PROMOTE_SECONDARY_TO_PRIMARY:
+	    tx_key = &key;
+	    break;
+	  case CryptoDCInstance::DEACTIVATE_SECONDARY:
+	    forget_key(key);
+	    break;
+	  case CryptoDCInstance::DEACTIVATE_ALL:
+	    tx_key = nullptr;
+	    for (auto &rk : rx_keys)
+	      rk = RecvKey();
+	    break;
+	  }
+      }
+
+      // called with both locks held
+      void install_recv_key(CryptoInstance& key)
+      {
+	if (!key.lane)
+	  key.lane = key.inner->new_decrypt_lane();
+	RecvKey& rk = rx_keys[key.kid() & KEY_ID_MASK];
+	rk.owner = &key;
+	if (key.lane)
+	  {
+	    rk.crypto = key.lane.get();
+	    rk.shared = false;
+	  }
+	else
+	  {
+	    rk.crypto = key.inner.get();
+	    rk.shared = true;
+	  }
+      }
+
+      // called with both locks held
+      void forget_key(const CryptoInstance& key)
+      {
+	if (tx_key == &key)
+	  tx_key = nullptr;
+	RecvKey& rk = rx_keys[key.kid() & KEY_ID_MASK];
+	if (rk.owner == &key)
+	  rk = RecvKey();
+      }
+
+      void key_destroyed(const CryptoInstance& key)
+      {
+	std::lock_guard<std::mutex> rl(rx_mutex);
+	std::lock_guard<std::mutex> tl(tx_mutex);
+	forget_key(key);
+      }
+
+      bool send(const Buffer& buf)
+      {
+	if (halt || !socket.is_open())
+	  return false;
+	const ssize_t wrote = ::send(socket.native_handle(), buf.c_data(), buf.size(), MSG_DONTWAIT);
+	if (wrote < 0 || size_t(wrote) != buf.size())
+	  {
+	    config->transport.stats->error(Error::NETWORK_SEND_ERROR);
+	    return false;
+	  }
+	config->transport.stats->inc_stat(SessionStats::BYTES_OUT, wrote);
+	config->transport.stats->inc_stat(SessionStats::PACKETS_OUT, 1);
+	return true;
+      }
+
+      // Until the data threads start, the control thread reads the
+      // socket itself, as the handshake only carries control packets.
+      void queue_read()
+      {
+	frame_context.prepare(read_buf);
+	socket.async_receive(frame_context.mutable_buffers_1_clamp(read_buf),
+			     [self=Ptr(this)](const asio::error_code& error, const size_t bytes_recvd)
+			     {
+			       self->handle_read(error, bytes_recvd);
+			     });
+      }
+
+      void handle_read(const asio::error_code& error, const size_t bytes_recvd)
+      {
+	if (halt || threads_started)
+	  return;
+	if (!error)
+	  {
+	    read_buf.set_size(bytes_recvd);
+	    config->transport.stats->inc_stat(SessionStats::BYTES_IN, bytes_recvd);
+	    config->transport.stats->inc_stat(SessionStats::PACKETS_IN, 1);
+	    transport_parent.transport_recv(read_buf);
+	  }
+	else
+	  {
+	    OPENVPN_LOG_UDPLINK_ERROR("UDP recv error: " << error.message());
+	    config->transport.stats->error(Error::NETWORK_RECV_ERROR);
+	  }
+	// tun_start may have run inside transport_recv
+	if (!halt && !threads_started)
+	  queue_read();
+      }
+
+      void start_threads()
+      {
+	stop_fd.reset(::eventfd(0, EFD_NONBLOCK|EFD_CLOEXEC));
+	const int wfd = ::eventfd(0, EFD_NONBLOCK|EFD_CLOEXEC);
+	if (!stop_fd.defined() || wfd < 0)
+	  throw threaded_dco_error("eventfd failed");
+	wake_sd.assign(wfd);
+	last_rx.store(Time::now().seconds_since_epoch(), std::memory_order_relaxed);
+
+	threads_started = true;
+	{
+	  asio::error_code ec;
+	  socket.cancel(ec);
+	}
+	tx_thread.reset(new std::thread([this]() { tx_loop(); }));
+	rx_thread.reset(new std::thread([this]() { rx_loop(); }));
+
+	queue_wake();
+	schedule_housekeeping();
+      }
+
+      // Control thread side of the RX thread's queue.
+      void queue_wake()
+      {
+	wake_sd.async_wait(asio::posix::stream_descriptor::wait_read,
+			   [self=Ptr(this)](const asio::error_code& error)
+			   {
+			     if (!error && !self->halt)
+			       self->handle_wake();
+			   });
+      }
+
+      void handle_wake()
+      {
+	std::uint64_t count;
+	if (::read(wake_sd.native_handle(), &count, sizeof(count)) < 0)
+	  count = 0;
+	BufferAllocated buf;
+	while (!halt && control_ring.pop(buf))
+	  transport_parent.transport_recv(buf);
+	if (!halt && !check_thread_error())
+	  queue_wake();
+      }
+
+      // Data thread errors and keepalive timeout surface here, on the
+      // control thread, where transport_error may be called.
+      bool check_thread_error()
+      {
+	const int err = thread_error.load(std::memory_order_acquire);
+	if (err)
+	  {
+	    std::string text;
+	    {
+	      std::lock_guard<std::mutex> lock(thread_error_mutex);
+	      text = thread_error_text;
+	    }
+	    stop();
+	    transport_parent.transport_error((Error::Type)err, text);
+	    return true;
+	  }
+	return false;
+      }
+
+      void set_thread_error(const Error::Type err, const std::string& text)
+      {
+	{
+	  std::lock_guard<std::mutex> lock(thread_error_mutex);
+	  thread_error_text = text;
+	}
+	thread_error.store(err, std::memory_order_release);
+	wake();
+      }
+
+      void schedule_housekeeping()
+      {
+	housekeeping_timer.expires_at(Time::now() + Time::Duration::seconds(1));
+	housekeeping_timer.async_wait([self=Ptr(this)](const asio::error_code& error)
+				      {
+					if (!error && !self->halt)
+					  self->housekeeping();
+				      });
+      }
+
+      void housekeeping()
+      {
+	// pass counted data thread errors to stats
+	for (size_t i = 0; i < Error::N_ERRORS; ++i)
+	  {
+	    unsigned int n = errors[i].exchange(0, std::memory_order_relaxed);
+	    while (n--)
+	      config->transport.stats->error(i);
+	  }
+
+	if (check_thread_error())
+	  return;
+
+	if (keepalive_timeout)
+	  {
+	    const Time::base_type now = Time::now().seconds_since_epoch();
+	    if (now > last_rx.load(std::memory_order_relaxed) + keepalive_timeout)
+	      {
+		stop();
+		transport_parent.transport_error(Error::KEEPALIVE_TIMEOUT, "keepalive timeout");
+		return;
+	      }
+	  }
+	schedule_housekeeping();
+      }
+
+      void wake()
+      {
+	signal_fd(wake_sd.native_handle());
+      }
+
+      // bump an eventfd, which can only fail if its counter overflows
+      static void signal_fd(const int fd)
+      {
+	const std::uint64_t one = 1;
+	const ssize_t status = ::write(fd, &one, sizeof(one));
+	(void)status;
+      }
+
+      void count_error(const Error::Type err)
+      {
+	errors[err].fetch_add(1, std::memory_order_relaxed);
+      }
+
+      std::uint32_t op32(const unsigned int key_id) const
+      {
+	return htonl((((DATA_V2 << OPCODE_SHIFT) | key_id) << 24) | (peer_id & 0x00FFFFFF));
+      }
+
+      // Encrypt bufs with the primary key and prepend the op header.
+      // Packets are emptied if no key is active.
+      bool encrypt(BufferAllocated** bufs, const size_t n)
+      {
+	std::lock_guard<std::mutex> lock(tx_mutex);
+	if (!tx_key)
+	  return false;
+	const unsigned int kid = tx_key->kid();
+	const PacketID::time_t now = Time::now().seconds_since_epoch();
+	if (peer_id != OP_PEER_ID_UNDEF)
+	  {
+	    const std::uint32_t op = op32(kid);
+	    tx_key->inner->encrypt_batch(bufs, n, now, (const unsigned char *)&op);
+	    for (size_t i = 0; i < n; ++i)
+	      bufs[i]->prepend((const unsigned char *)&op, sizeof(op));
+	  }
+	else
+	  {
+	    tx_key->inner->encrypt_batch(bufs, n, now, nullptr);
+	    const unsigned char op = (DATA_V1 << OPCODE_SHIFT) | kid;
+	    for (size_t i = 0; i < n; ++i)
+	      bufs[i]->push_front(op);
+	  }
+	return true;
+      }
+
+      void send_batch(BufferAllocated** bufs, const size_t n)
+      {
+	std::unique_ptr<struct mmsghdr[]> msgs(new struct mmsghdr[n]);
+	std::unique_ptr<struct iovec[]> iov(new struct iovec[n]);
+	size_t m = 0;
+	for (size_t i = 0; i < n; ++i)
+	  {
+	    if (!bufs[i]->size())
+	      continue;
+	    iov[m].iov_base = bufs[i]->data();
+	    iov[m].iov_len = bufs[i]->size();
+	    std::memset(&msgs[m], 0, sizeof(msgs[m]));
+	    msgs[m].msg_hdr.msg_iov = &iov[m];
+	    msgs[m].msg_hdr.msg_iovlen = 1;
+	    ++m;
+	  }
+	size_t sent = 0;
+	while (sent < m)
+	  {
+	    const int r = ::sendmmsg(sock_fd, &msgs[sent], (unsigned int)(m - sent), MSG_DONTWAIT);
+	    if (r <= 0)
+	      {
+		count_error(Error::NETWORK_SEND_ERROR);
+		break;
+	      }
+	    for (int i = 0; i < r; ++i)
+	      config->transport.stats->inc_stat(SessionStats::BYTES_OUT, msgs[sent+i].msg_len);
+	    config->transport.stats->inc_stat(SessionStats::PACKETS_OUT, r);
+	    sent += r;
+	  }
+      }
+
+      void tx_loop()
+      {
+	if (config->tx_core >= 0)
+	  bind_to_core(config->tx_core);
+
+	const Frame::Context& fc = (*config->transport.frame)[Frame::READ_TUN];
+	const size_t batch = std::max(config->batch, 1u);
+	std::unique_ptr<BufferAllocated[]> bufs(new BufferAllocated[batch]);
+	std::unique_ptr<BufferAllocated*[]> ptrs(new BufferAllocated*[batch]);
+	for (size_t i = 0; i < batch; ++i)
+	  ptrs[i] = &bufs[i];
+
+	Time::base_type last_tx = Time::now().seconds_since_epoch();
+	struct pollfd pfd[2];
+	pfd[0].fd = tun_fd();
+	pfd[0].events = POLLIN;
+	pfd[1].fd = stop_fd();
+	pfd[1].events = POLLIN;
+
+	while (!halt.load(std::memory_order_relaxed))
+	  {
+	    const int timeout = keepalive_ping ? 1000 : -1;
+	    const int pr = ::poll(pfd, 2, timeout);
+	    if (pr < 0 && errno != EINTR)
+	      {
+		set_thread_error(Error::TUN_READ_ERROR, "TX poll failed");
+		return;
+	      }
+	    if (halt.load(std::memory_order_relaxed))
+	      return;
+
+	    size_t n = 0;
+	    if (pr > 0 && (pfd[0].revents & POLLIN))
+	      {
+		while (n < batch)
+		  {
+		    BufferAllocated& buf = bufs[n];
+		    fc.prepare(buf);
+		    const ssize_t r = ::read(tun_fd(), buf.data(), fc.remaining_payload(buf));
+		    if (r <= 0)
+		      {
+			if (r < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+			  count_error(Error::TUN_READ_ERROR);
+			break;
+		      }
+		    buf.set_size(r);
+		    config->transport.stats->inc_stat(SessionStats::TUN_BYTES_IN, r);
+		    ++n;
+		  }
+		config->transport.stats->inc_stat(SessionStats::TUN_PACKETS_IN, n);
+	      }
+
+	    const Time::base_type now = Time::now().seconds_since_epoch();
+	    if (!n && keepalive_ping && now >= last_tx + keepalive_ping)
+	      {
+		fc.prepare(bufs[0]);
+		bufs[0].write(proto_context_private::keepalive_message,
+			      sizeof(proto_context_private::keepalive_message));
+		n = 1;
+	      }
+
+	    if (n)
+	      {
+		try {
+		  if (encrypt(ptrs.get(), n))
+		    {
+		      send_batch(ptrs.get(), n);
+		      last_tx = now;
+		    }
+		}
+		catch (const std::exception&)
+		  {
+		    count_error(Error::DECRYPT_ERROR);
+		  }
+	      }
+	  }
+      }
+
+      // Decrypt one data packet, called with rx_mutex held.
+      bool decrypt(BufferAllocated& buf, const PacketID::time_t now)
+      {
+	const unsigned int op = buf[0];
+	const RecvKey& rk = rx_keys[op & KEY_ID_MASK];
+	if (!rk.crypto)
+	  {
+	    count_error(Error::KEY_STATE_ERROR);
+	    return false;
+	  }
+	const bool v2 = (op >> OPCODE_SHIFT) == DATA_V2;
+	unsigned char op32[OP_SIZE_V2];
+	if (v2)
+	  std::memcpy(op32, buf.c_data(), OP_SIZE_V2);
+	buf.advance(v2 ? OP_SIZE_V2 : 1);
+
+	Error::Type err;
+	if (rk.shared)
+	  {
+	    std::lock_guard<std::mutex> lock(tx_mutex);
+	    err = rk.crypto->decrypt(buf, now, v2 ? op32 : nullptr);
+	  }
+	else
+	  err = rk.crypto->decrypt(buf, now, v2 ? op32 : nullptr);
+	if (err)
+	  {
+	    count_error(err);
+	    return false;
+	  }
+	return buf.size() > 0;
+      }
+
+      void rx_loop()
+      {
+	if (config->rx_core >= 0)
+	  bind_to_core(config->rx_core);
+
+	const Frame::Context& fc = (*config->transport.frame)[Frame::READ_LINK_UDP];
+	const size_t batch = std::max(config->batch, 1u);
+	std::unique_ptr<BufferAllocated[]> bufs(new BufferAllocated[batch]);
+	std::unique_ptr<struct mmsghdr[]> msgs(new struct mmsghdr[batch]);
+	std::unique_ptr<struct iovec[]> iov(new struct iovec[batch]);
+
+	struct pollfd pfd[2];
+	pfd[0].fd = sock_fd;
+	pfd[0].events = POLLIN;
+	pfd[1].fd = stop_fd();
+	pfd[1].events = POLLIN;
+
+	while (!halt.load(std::memory_order_relaxed))
+	  {
+	    const int pr = ::poll(pfd, 2, -1);
+	    if (pr < 0 && errno != EINTR)
+	      {
+		set_thread_error(Error::NETWORK_RECV_ERROR, "RX poll failed");
+		return;
+	      }
+	    if (halt.load(std::memory_order_relaxed))
+	      return;
+	    if (pr <= 0 || !(pfd[0].revents & (POLLIN|POLLERR)))
+	      continue;
+
+	    for (size_t i = 0; i < batch; ++i)
+	      {
+		fc.prepare(bufs[i]);
+		iov[i].iov_base = bufs[i].data();
+		iov[i].iov_len = fc.remaining_payload(bufs[i]);
+		std::memset(&msgs[i], 0, sizeof(msgs[i]));
+		msgs[i].msg_hdr.msg_iov = &iov[i];
+		msgs[i].msg_hdr.msg_iovlen = 1;
+	      }
+	    const int r = ::recvmmsg(sock_fd, msgs.get(), (unsigned int)batch, MSG_DONTWAIT, nullptr);
+	    if (r <= 0)
+	      {
+		if (r < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+		  count_error(Error::NETWORK_RECV_ERROR);
+		continue;
+	      }
+
+	    const Time::base_type now = Time::now().seconds_since_epoch();
+	    last_rx.store(now, std::memory_order_relaxed);
+	    config->transport.stats->inc_stat(SessionStats::PACKETS_IN, r);
+
+	    bool control = false;
+	    {
+	      std::lock_guard<std::mutex> lock(rx_mutex);
+	      for (int i = 0; i < r; ++i)
+		{
+		  BufferAllocated& buf = bufs[i];
+		  buf.set_size(msgs[i].msg_len);
+		  config->transport.stats->inc_stat(SessionStats::BYTES_IN, buf.size());
+		  if (!buf.size())
+		    continue;
+		  const unsigned int opcode = buf[0] >> OPCODE_SHIFT;
+		  if (opcode != DATA_V1 && opcode != DATA_V2)
+		    {
+		      if (control_ring.push(std::move(buf)))
+			control = true;
+		      else
+			count_error(Error::NETWORK_RECV_ERROR);
+		      continue;
+		    }
+		  try {
+		    if (!decrypt(buf, now))
+		      continue;
+		  }
+		  catch (const std::exception&)
+		    {
+		      count_error(Error::DECRYPT_ERROR);
+		      continue;
+		    }
+
+		  // Only IP packets go to the tun.  In-band messages
+		  // such as keepalive pings are dropped, keepalive
+		  // having been taken over by last_rx above.
+		  const unsigned int ver = buf[0] >> 4;
+		  if (ver != 4 && ver != 6)
+		    continue;
+		  const ssize_t w = ::write(tun_fd(), buf.c_data(), buf.size());
+		  if (w < 0)
+		    count_error(Error::TUN_WRITE_ERROR);
+		  else
+		    {
+		      config->transport.stats->inc_stat(SessionStats::TUN_BYTES_OUT, w);
+		      config->transport.stats->inc_stat(SessionStats::TUN_PACKETS_OUT, 1);
+		    }
+		}
+	    }
+	    if (control)
+	      wake();
+	  }
+      }
+
+      void stop_threads()
+      {
+	halt.store(true, std::memory_order_relaxed);
+	if (stop_fd.defined())
+	  signal_fd(stop_fd());
+	if (tx_thread)
+	  {
+	    tx_thread->join();
+	    tx_thread.reset();
+	  }
+	if (rx_thread)
+	  {
+	    rx_thread->join();
+	    rx_thread.reset();
+	  }
+      }
+
+      void stop_()
+      {
+	if (!halt)
+	  {
+	    stop_threads();
+
+	    // remove added routes
+	    if (remove_cmds)
+	      remove_cmds->execute(std::cout);
+
+	    housekeeping_timer.cancel();
+	    if (wake_sd.is_open())
+	      {
+		asio::error_code ec;
+		wake_sd.close(ec);
+	      }
+	    tun_fd.close();
+	    stop_fd.close();
+	    socket.close();
+	    resolver.cancel();
+	  }
+      }
+
+      // called after DNS resolution has succeeded or failed
+      void do_resolve_(const asio::error_code& error,
+		       asio::ip::udp::resolver::results_type results)
+      {
+	if (!halt)
+	  {
+	    if (!error)
+	      {
+		// save resolved endpoint list in remote_list
+		config->transport.remote_list->set_endpoint_range(results);
+		start_connect_();
+	      }
+	    else
+	      {
+		std::ostringstream os;
+		os << "DNS resolve error on '" << server_host << "' for UDP session: " << error.message();
+		config->transport.stats->error(Error::RESOLVE_ERROR);
+		stop();
+		transport_parent.transport_error(Error::UNDEF, os.str());
+	      }
+	  }
+      }
+
+      // do UDP connect
+      void start_connect_()
+      {
+	config->transport.remote_list->get_endpoint(server_endpoint);
+	OPENVPN_LOG("Contacting " << server_endpoint << " via UDP (threaded data channel)");
+	transport_parent.transport_wait();
+	transport_parent.ip_hole_punch(server_endpoint_addr());
+	socket.open(server_endpoint.protocol());
+	sock_fd = socket.native_handle();
+	socket.async_connect(server_endpoint, [self=Ptr(this)](const asio::error_code& error)
+			     {
+			       self->start_impl_(error);
+			     });
+      }
+
+      // start reading control packets
+      void start_impl_(const asio::error_code& error)
+      {
+	if (!halt)
+	  {
+	    if (!error)
+	      {
+		queue_read();
+		transport_parent.transport_connecting();
+	      }
+	    else
+	      {
+		std::ostringstream os;
+		os << "UDP connect error on '" << server_host << ':' << server_port << "' (" << server_endpoint << "): " << error.message();
+		config->transport.stats->error(Error::UDP_CONNECT_ERROR);
+		stop();
+		transport_parent.transport_error(Error::UNDEF, os.str());
+	      }
+	  }
+      }
+
+      std::string server_host;
+      std::string server_port;
+
+      asio::io_context& io_context;
+      asio::ip::udp::socket socket;
+      asio::ip::udp::resolver resolver;
+      asio::posix::stream_descriptor wake_sd;
+      AsioTimer housekeeping_timer;
+      UDPTransport::AsioEndpoint server_endpoint;
+
+      ClientConfig::Ptr config;
+      TransportClientParent& transport_parent;
+      TunClientParent* tun_parent;
+
+      Frame::Context frame_context;
+      BufferAllocated read_buf;
+
+      TunProp::State::Ptr state;
+      ActionList::Ptr remove_cmds;
+
+      // shared with the data threads, fixed once they start
+      int sock_fd = -1;
+      ScopedFD tun_fd;
+      ScopedFD stop_fd;
+      std::uint32_t peer_id = OP_PEER_ID_UNDEF;
+      unsigned int keepalive_ping = 0;
+      unsigned int keepalive_timeout = 0;
+
+      // key tables, written only by the control thread
+      std::mutex tx_mutex;
+      std::mutex rx_mutex;
+      CryptoInstance* tx_key = nullptr;
+      RecvKey rx_keys[N_KEY_IDS];
+
+      SPSCRing<BufferAllocated> control_ring; // RX thread -> control thread
+      std::atomic<Time::base_type> last_rx{0};
+      std::atomic<unsigned int> errors[Error::N_ERRORS];
+      std::atomic<int> thread_error{0};
+      std::mutex thread_error_mutex;
+      std::string thread_error_text;
+
+      std::unique_ptr<std::thread> tx_thread;
+      std::unique_ptr<std::thread> rx_thread;
+      bool threads_started = false;
+      std::atomic<bool> halt;
+    };
+
+    inline CryptoInstance::~CryptoInstance()
+    {
+      if (client)
+	client->key_destroyed(*this);
+    }
+
+    inline bool CryptoInstance::encrypt(BufferAllocated& buf, const PacketID::time_t now, const unsigned char *op32)
+    {
+      std::lock_guard<std::mutex> lock(client->tx_mutex);
+      return inner->encrypt(buf, now, op32);
+    }
+
+    inline Error::Type CryptoInstance::decrypt(BufferAllocated& buf, const PacketID::time_t now, const unsigned char *op32)
+    {
+      std::lock_guard<std::mutex> lock(client->tx_mutex);
+      const Error::Type err = inner->decrypt(buf, now, op32);
+      rx_pid = inner->rx_packet_id();
+      return err;
+    }
+
+    inline void CryptoInstance::rekey(const RekeyType type)
+    {
+      if (client)
+	client->rekey(type, *this);
+    }
+
+    inline TransportClient::Ptr ClientConfig::new_transport_client_obj(asio::io_context& io_context,
+								       TransportClientParent& parent)
+    {
+      return TransportClient::Ptr(new Client(io_context, this, parent));
+    }
+
+    // The transport object is created first, and is also our tun.
+    inline TunClient::Ptr ClientConfig::new_tun_client_obj(asio::io_context& io_context,
+							   TunClientParent& parent,
+							   TransportClient* transcli)
+    {
+      Client* client = dynamic_cast<Client*>(transcli);
+      if (!client)
+	throw threaded_dco_error("tun requires the threaded transport");
+      client->tun_parent = &parent;
+      return TunClient::Ptr(client);
+    }
+
+    inline DCO::Ptr new_controller(const int tx_core, const int rx_core)
+    {
+      ClientConfig::Ptr conf = ClientConfig::new_obj();
+      conf->tx_core = tx_core;
+      conf->rx_core = rx_core;
+      return DCO::Ptr(conf.get());
+    }
+  }
+}
+
+#endif
@@ -51,10 +51,15 @@ namespace openvpn {
       TUN_IFACE_CREATE,    // error creating tun/tap interface
       TUN_IFACE_DISABLED,  // tun/tap interface is disabled
       TUN_ERROR,           // general tun error
+      TUN_NO_ROUTE,        // tun packet dropped because no client owns its destination
       TAP_NOT_SUPPORTED,   // dev tap is present in profile but not supported
       REROUTE_GW_NO_DNS,   // redirect-gateway specified without alt DNS servers
       TRANSPORT_ERROR,     // general transport error
       TCP_OVERFLOW,        // TCP output queue overflow
+      AQM_DROP,            // packet dropped by fq-codel ahead of the transport queue
+      SHAPER_DROP,         // packet dropped because the per-client shaper queue was full
+      POLICY_DROP,         // tun packet dropped by a packet classifier rule
+      HANDSHAKE_ADMISSION_DROP, // new client turned away because the handshake budget was used up
       TCP_SIZE_ERROR,      // bad embedded uint16_t TCP packet size
       TCP_CONNECT_ERROR,   // client error on TCP connect
       UDP_CONNECT_ERROR,   // client error on UDP connect
@@ -78,6 +83,9 @@ namespace openvpn {
       N_PAUSE,             // Number of transitions to Pause state
       N_RECONNECT,         // Number of reconnections
       N_KEY_LIMIT_RENEG,   // Number of renegotiations triggered by per-key limits such as data or packet limits
+      N_RENEG_DEFER,       // Number of scheduled renegotiations deferred while the server was busy
+      N_FEC_RECOVERED,     // Number of data channel packets rebuilt from FEC parity
+      N_FRAME_REALIGN,     // Number of received packets copied or realigned to restore frame headroom
       KEY_STATE_ERROR,     // Received packet didn't match expected key state
       PROXY_ERROR,         // HTTP proxy error
       PROXY_NEED_CREDS,    // HTTP proxy needs credentials
@@ -124,10 +132,15 @@ namespace openvpn {
 	"TUN_IFACE_CREATE",
 	"TUN_IFACE_DISABLED",
 	"TUN_ERROR",
+	"TUN_NO_ROUTE",
 	"TAP_NOT_SUPPORTED",
 	"REROUTE_GW_NO_DNS",
 	"TRANSPORT_ERROR",
 	"TCP_OVERFLOW",
+	"AQM_DROP",
+	"SHAPER_DROP",
+	"POLICY_DROP",
+	"HANDSHAKE_ADMISSION_DROP",
 	"TCP_SIZE_ERROR",
 	"TCP_CONNECT_ERROR",
 	"UDP_CONNECT_ERROR",
@@ -151,6 +164,9 @@ namespace openvpn {
 	"N_PAUSE",
 	"N_RECONNECT",
 	"N_KEY_LIMIT_RENEG",
+	"N_RENEG_DEFER",
+	"N_FEC_RECOVERED",
+	"N_FRAME_REALIGN",
 	"KEY_STATE_ERROR",
 	"PROXY_ERROR",
 	"PROXY_NEED_CREDS",
@@ -114,10 +114,10 @@ namespace openvpn {
 	return payload();
       }
 
-      // Realign a buffer to headroom
-      void realign(Buffer& buf) const
+      // Realign a buffer to headroom, returns true if data was moved
+      bool realign(Buffer& buf) const
       {
-	buf.realign(actual_headroom(buf.c_data_raw()));
+	return buf.realign(actual_headroom(buf.c_data_raw()));
       }
 
       // Return a new BufferAllocated object initialized with the given data.
@@ -27,19 +27,33 @@
 #include <algorithm>
 
 #include <openvpn/frame/frame.hpp>
+#include <openvpn/frame/frame_plan.hpp>
 
 namespace openvpn {
 
+  // Buffer flags for data-path frame contexts.  Define
+  // OPENVPN_BUFFER_POOL to draw data-path buffers from
+  // the thread-local BufferPool rather than the heap.
+  inline unsigned int frame_init_data_buffer_flags()
+  {
+#ifdef OPENVPN_BUFFER_POOL
+    return BufferAllocated::POOL;
+#else
+    return 0;
+#endif
+  }
+
   inline Frame::Ptr frame_init(const bool align_adjust_3_1,
 			       const size_t tun_mtu,
 			       const size_t control_channel_payload,
-			       const bool verbose)
+			       const bool verbose,
+			       const FramePlan* plan = nullptr)
   {
     const size_t payload = std::max(tun_mtu + 512, size_t(2048));
     const size_t headroom = 512;
     const size_t tailroom = 512;
     const size_t align_block = 16;
-    const unsigned int buffer_flags = 0;
+    const unsigned int buffer_flags = frame_init_data_buffer_flags();
 
     Frame::Ptr frame(new Frame(Frame::Context(headroom, payload, tailroom, 0, align_block, buffer_flags)));
     if (align_adjust_3_1)
@@ -47,6 +61,24 @@ namespace openvpn {
 	(*frame)[Frame::READ_LINK_TCP] = Frame::Context(headroom, payload, tailroom, 3, align_block, buffer_flags);
 	(*frame)[Frame::READ_LINK_UDP] = Frame::Context(headroom, payload, tailroom, 1, align_block, buffer_flags);
       }
+
+    // size data-path contexts to the planned worst case
+    if (plan)
+      {
+	static const unsigned int data_contexts[] = {
+	  Frame::ENCRYPT_WORK, Frame::DECRYPT_WORK,
+	  Frame::COMPRESS_WORK, Frame::DECOMPRESS_WORK,
+	  Frame::READ_LINK_UDP, Frame::READ_LINK_TCP,
+	  Frame::READ_TUN,
+	};
+	for (const unsigned int c : data_contexts)
+	  {
+	    const size_t align_adjust = align_adjust_3_1
+	      ? (c == Frame::READ_LINK_TCP ? 3 : (c == Frame::READ_LINK_UDP ? 1 : 0)) : 0;
+	    (*frame)[c] = Frame::Context(plan->headroom(), payload, plan->tailroom(),
+					 align_adjust, align_block, buffer_flags);
+	  }
+      }
     (*frame)[Frame::READ_BIO_MEMQ_STREAM] = Frame::Context(headroom, std::min(control_channel_payload, payload),
 							   tailroom, 0, align_block, buffer_flags);
     (*frame)[Frame::WRITE_SSL_CLEARTEXT] = Frame::Context(headroom, payload, tailroom, 0, align_block, BufferAllocated::GROW);
@@ -54,7 +86,8 @@ namespace openvpn {
 
     if (verbose)
       OPENVPN_LOG("Frame=" << headroom << '/' << payload << '/' << tailroom
-		  << " mssfix-ctrl=" << (*frame)[Frame::READ_BIO_MEMQ_STREAM].payload());
+		  << " mssfix-ctrl=" << (*frame)[Frame::READ_BIO_MEMQ_STREAM].payload()
+		  << (plan ? " plan " + plan->str() : std::string()));
 
     return frame;
   }
@@ -0,0 +1,81 @@
+//    OpenVPN -- An application to securely tunnel IP networks
+//               over a single port, with support for SSL/TLS-based
+//               session authentication and key exchange,
+//               packet encryption, packet authentication, and
+//               packet compression.
+//
+//    Copyright (C) 2012-2016 OpenVPN Technologies, Inc.
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU Affero General Public License Version 3
+//    as published by the Free Software Foundation.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU Affero General Public License for more details.
+//
+//    You should have received a copy of the GNU Affero General Public License
+//    along with this program in the COPYING file.
+//    If not, see <http://www.gnu.org/licenses/>.
+
+// Worst-case headroom/tailroom planning for data-path frame contexts
+
+#ifndef OPENVPN_FRAME_FRAME_PLAN_H
+#define OPENVPN_FRAME_FRAME_PLAN_H
+
+#include <algorithm>
+#include <sstream>
+#include <string>
+
+namespace openvpn {
+
+  // Sum of everything that may be prepended to or appended to a tun
+  // packet on its way to the link (and stripped on the way back).
+  // Defaults are the worst case over every data channel combination
+  // we can negotiate, since the Frame is built before the server
+  // pushes cipher or compression, so sizing data-path contexts to
+  // headroom()/tailroom() never forces a Buffer realign.
+  struct FramePlan
+  {
+    size_t tun_prefix = 4;   // AF prefix on utun/tap reads
+    size_t comp_head = 2;    // compression header, or v2 swap/escape byte
+    size_t comp_swap = 1;    // byte moved to the end by the swap compressor
+    size_t op = 4;           // op32 opcode and peer ID
+    size_t pid = 8;          // long-form or 64-bit packet ID
+    size_t iv = 16;          // CBC IV
+    size_t hmac = 64;        // HMAC, up to SHA512
+    size_t tag = 16;         // AEAD tag
+    size_t block = 16;       // CBC padding
+    size_t tcp_prefix = 2;   // TCP stream length
+    size_t extra = 64;       // bundle, FEC and proxy framing
+    size_t align_block = 16;
+
+    size_t headroom() const
+    {
+      const size_t crypto = std::max(iv + hmac, tag);
+      return round_up(tun_prefix + comp_head + op + pid + crypto + tcp_prefix + extra);
+    }
+
+    size_t tailroom() const
+    {
+      return round_up(comp_swap + block + extra);
+    }
+
+    std::string str() const
+    {
+      std::ostringstream os;
+      os << "head=" << headroom() << " tail=" << tailroom();
+      return os.str();
+    }
+
+  private:
+    size_t round_up(const size_t n) const
+    {
+      return (n + align_block - 1) / align_block * align_block;
+    }
+  };
+
+} // namespace openvpn
+
+#endif // OPENVPN_FRAME_FRAME_PLAN_H
@@ -34,6 +34,69 @@
 
 namespace openvpn {
 
+  // Per-thread stack of drained stream buffers.  The MemQStream that
+  // feeds received ciphertext to the SSL library returns buffers here
+  // once they are fully read and no longer referenced elsewhere, and
+  // the MemQStream collecting SSL output takes them back for the next
+  // TLS record, so the handshake path doesn't allocate a buffer per
+  // record.  Enabled with OPENVPN_BUFFER_POOL.
+  class MemQStreamRecycle
+  {
+  public:
+    enum {
+      MAX_SPARE = 64,
+    };
+
+    static void put(BufferPtr& bp)
+    {
+      Spares* s = spares();
+      if (s && s->n < MAX_SPARE && bp->use_count() == 1)
+	s->bufs[s->n++] = std::move(bp);
+    }
+
+    static BufferPtr get()
+    {
+      Spares* s = spares();
+      if (s && s->n)
+	return std::move(s->bufs[--s->n]);
+      return BufferPtr();
+    }
+
+  private:
+    struct Spares
+    {
+      Spares()
+      {
+	destroyed() = false;
+      }
+
+      ~Spares()
+      {
+	destroyed() = true;
+      }
+
+      BufferPtr bufs[MAX_SPARE];
+      size_t n = 0;
+    };
+
+    // true once this thread's spares have been destroyed
+    static bool& destroyed()
+    {
+      static thread_local bool d = false;
+      return d;
+    }
+
+    static Spares* spares()
+    {
+#ifdef OPENVPN_BUFFER_POOL
+      static thread_local Spares s;
+      if (!destroyed())
+	return &s;
+#endif
+      return nullptr;
+    }
+  };
+
   class MemQStream : public MemQBase {
   public:
     OPENVPN_SIMPLE_EXCEPTION(frame_uninitialized);
@@ -68,7 +131,9 @@ namespace openvpn {
 	      // Start a new buffer
 	      while (b.size())
 		{
-		  BufferPtr newbuf(new BufferAllocated);
+		  BufferPtr newbuf = MemQStreamRecycle::get();
+		  if (!newbuf)
+		    newbuf.reset(new BufferAllocated);
 		  fc.prepare(*newbuf);
 		  const size_t write_size = std::min(b.size(), fc.payload());
 		  const unsigned char *from = b.read_alloc(write_size);
@@ -96,7 +161,10 @@ namespace openvpn {
 	  qf->read(to, read_size);
 	  length -= read_size;
 	  if (qf->empty())
-	    q.pop_front();
+	    {
+	      MemQStreamRecycle::put(qf);
+	      q.pop_front();
+	    }
 	}
       return b.size();
     }
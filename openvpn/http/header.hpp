@@ -26,10 +26,13 @@
 
 #include <string>
 #include <sstream>
+#include <vector>
+#include <cctype>  // for std::tolower
 
 #include <openvpn/common/size.hpp>
 #include <openvpn/common/exception.hpp>
 #include <openvpn/common/string.hpp>
+#include <openvpn/common/strview.hpp>
 
 namespace openvpn {
   namespace HTTP {
@@ -95,6 +98,62 @@ namespace openvpn {
       }      
     };
 
+    // A header as views into the buffer it was parsed from
+    // (see ReplyViewParser).
+    struct HeaderView {
+      Header to_header() const
+      {
+	return Header(name.to_string(), value.to_string());
+      }
+
+      StringView name;
+      StringView value;
+    };
+
+    struct HeaderViewList : public std::vector<HeaderView>
+    {
+      const HeaderView* get(const StringView& key) const
+      {
+	for (auto &h : *this)
+	  {
+	    if (equal_nocase(key, h.name))
+	      return &h;
+	  }
+	return nullptr;
+      }
+
+      StringView get_value(const StringView& key) const
+      {
+	const HeaderView* h = get(key);
+	if (h)
+	  return h->value;
+	else
+	  return StringView();
+      }
+
+      HeaderList to_header_list() const
+      {
+	HeaderList ret;
+	ret.reserve(size());
+	for (auto &h : *this)
+	  ret.push_back(h.to_header());
+	return ret;
+      }
+
+    private:
+      static bool equal_nocase(const StringView& a, const StringView& b)
+      {
+	if (a.size() != b.size())
+	  return false;
+	for (size_t i = 0; i < a.size(); ++i)
+	  {
+	    if (std::tolower((unsigned char)a[i]) != std::tolower((unsigned char)b[i]))
+	      return false;
+	  }
+	return true;
+      }
+    };
+
   }
 }
 
@@ -29,6 +29,12 @@
 #ifndef OPENVPN_HTTP_REPLY_H
 #define OPENVPN_HTTP_REPLY_H
 
+#include <cstring> // for std::memmove
+#include <string>
+#include <vector>
+
+#include <openvpn/common/strview.hpp>
+#include <openvpn/common/simd.hpp>
 #include <openvpn/http/header.hpp>
 #include <openvpn/http/parseutil.hpp>
 
@@ -387,6 +393,247 @@ namespace openvpn {
       state state_;
     };
 
+    // Incremental, zero-copy counterpart of ReplyParser.  It is handed
+    // whole receive buffers, finds line ends with a SIMD scan that also
+    // validates the line's characters, and returns the status text and
+    // headers as views rather than copying them into strings.  It
+    // accepts exactly the replies ReplyParser accepts, though it only
+    // rejects a malformed header line once the whole line is in.
+    //
+    // A header that arrives in one buffer is parsed in place.  One that
+    // is split across buffers is gathered into an internal buffer, up
+    // to max_size bytes, with earlier lines kept as offsets so they are
+    // not parsed again.  Continuation lines are joined by moving them
+    // down onto the value they continue, so the input is modified.
+    class ReplyViewParser
+    {
+    public:
+      typedef ReplyParser::status status;
+
+      struct View
+      {
+	Reply to_reply() const
+	{
+	  Reply ret;
+	  ret.http_version_major = http_version_major;
+	  ret.http_version_minor = http_version_minor;
+	  ret.status_code = status_code;
+	  ret.status_text = status_text.to_string();
+	  ret.headers = headers.to_header_list();
+	  return ret;
+	}
+
+	int http_version_major = 0;
+	int http_version_minor = 0;
+	int status_code = 0;
+	StringView status_text;
+	HeaderViewList headers;
+      };
+
+      explicit ReplyViewParser(const size_t max_size_arg = 65536)
+	: max_size(max_size_arg)
+      {
+	reset();
+      }
+
+      void reset()
+      {
+	stage = STATUS_LINE;
+	pos = 0;
+	gathering = false;
+	gather.clear();
+	spans.clear();
+	view = View();
+      }
+
+      // Parse the next buffer of HTTP reply data.  On success, used is
+      // set to the number of bytes of data up to and including the
+      // blank line ending the header, anything after it is payload,
+      // and reply() refers into data (or the internal buffer) until
+      // the next call to consume or reset.
+      status consume(unsigned char *data, const size_t size, size_t& used)
+      {
+	unsigned char *base = data;
+	size_t len = size;
+	size_t prev = 0;
+	used = size;
+	if (gathering)
+	  {
+	    prev = gather.size();
+	    gather.append((const char *)data, size);
+	    base = (unsigned char *)&gather[0];
+	    len = gather.size();
+	  }
+
+	const status st = parse(base, len);
+	if (st == ReplyParser::pending)
+	  {
+	    if (!gathering)
+	      {
+		gather.assign((const char *)data, size);
+		gathering = true;
+	      }
+	    if (gather.size() > max_size)
+	      return ReplyParser::fail;
+	  }
+	else if (st == ReplyParser::success)
+	  {
+	    used = pos - prev;
+	    const char *b = (const char *)base;
+	    view.status_text = StringView(b + status_text.off, status_text.len);
+	    view.headers.resize(spans.size());
+	    for (size_t i = 0; i < spans.size(); ++i)
+	      {
+		view.headers[i].name = StringView(b + spans[i].name.off, spans[i].name.len);
+		view.headers[i].value = StringView(b + spans[i].value.off, spans[i].value.len);
+	      }
+	  }
+	return st;
+      }
+
+      const View& reply() const { return view; }
+
+    private:
+      enum Stage {
+	STATUS_LINE,
+	HEADERS,
+      };
+
+      struct Span
+      {
+	size_t off;
+	size_t len;
+      };
+
+      struct HeaderSpan
+      {
+	Span name;
+	Span value;
+      };
+
+      // Parse whole lines from pos onward.
+      status parse(unsigned char *base, const size_t len)
+      {
+	while (true)
+	  {
+	    const size_t s = pos;
+	    if (stage == STATUS_LINE)
+	      {
+		// fail early on something that isn't an HTTP reply
+		static const char http[] = "HTTP/";
+		for (size_t i = s; i < len && i < s + 5; ++i)
+		  if (base[i] != (unsigned char)http[i - s])
+		    return ReplyParser::fail;
+	      }
+
+	    // leading whitespace continues the previous header
+	    size_t t = s;
+	    const bool cont = stage == HEADERS && !spans.empty()
+	      && t < len && (base[t] == ' ' || base[t] == '\t');
+	    if (cont)
+	      while (t < len && (base[t] == ' ' || base[t] == '\t'))
+		++t;
+
+	    const size_t e = skip_text(base, t, len, stage == STATUS_LINE);
+	    if (e == len)
+	      return ReplyParser::pending;
+	    if (base[e] != '\r')
+	      return ReplyParser::fail;
+	    if (e + 1 == len)
+	      return ReplyParser::pending;
+	    if (base[e + 1] != '\n')
+	      return ReplyParser::fail;
+	    pos = e + 2;
+
+	    if (stage == STATUS_LINE)
+	      {
+		if (!status_line(base, s, e))
+		  return ReplyParser::fail;
+		stage = HEADERS;
+	      }
+	    else if (cont)
+	      {
+		Span& v = spans.back().value;
+		std::memmove(base + v.off + v.len, base + t, e - t);
+		v.len += e - t;
+	      }
+	    else if (s == e)
+	      return ReplyParser::success;
+	    else if (!header_line(base, s, e))
+	      return ReplyParser::fail;
+	  }
+      }
+
+      // Return the offset of the first control character at or after
+      // i (or 8-bit character if high is set), or len if none.
+      static size_t skip_text(const unsigned char *base, size_t i, const size_t len, const bool high)
+      {
+	if (SIMD::have_ssse3())
+	  i += SIMD::http_skip_text(base + i, len - i, high);
+	for (; i < len; ++i)
+	  {
+	    const unsigned char c = base[i];
+	    if (Util::is_ctl(c) || (high && !Util::is_char(c)))
+	      break;
+	  }
+	return i;
+      }
+
+      static bool digits(const unsigned char *base, size_t& i, const size_t e, int& value)
+      {
+	const size_t start = i;
+	value = 0;
+	while (i < e && Util::is_digit(base[i]))
+	  value = value * 10 + base[i++] - '0';
+	return i > start;
+      }
+
+      // "HTTP/" major "." minor " " code " " text
+      bool status_line(const unsigned char *base, const size_t s, const size_t e)
+      {
+	size_t i = s + 5;
+	if (i > e
+	    || !digits(base, i, e, view.http_version_major)
+	    || i == e || base[i++] != '.'
+	    || !digits(base, i, e, view.http_version_minor)
+	    || i == e || base[i++] != ' '
+	    || !digits(base, i, e, view.status_code)
+	    || i == e || base[i++] != ' '
+	    || i == e || Util::is_tspecial(base[i]))
+	  return false;
+	status_text.off = i;
+	status_text.len = e - i;
+	return true;
+      }
+
+      // name ": " value
+      bool header_line(const unsigned char *base, const size_t s, const size_t e)
+      {
+	size_t i = s;
+	for (; i < e && base[i] != ':'; ++i)
+	  if (!Util::is_char(base[i]) || Util::is_tspecial(base[i]))
+	    return false;
+	if (i == s || i + 1 >= e || base[i + 1] != ' ')
+	  return false;
+	HeaderSpan h;
+	h.name.off = s;
+	h.name.len = i - s;
+	h.value.off = i + 2;
+	h.value.len = e - (i + 2);
+	spans.push_back(h);
+	return true;
+      }
+
+      const size_t max_size;
+      Stage stage;
+      size_t pos;         // start of the next line
+      bool gathering;
+      std::string gather; // header split across buffers
+      Span status_text;
+      std::vector<HeaderSpan> spans;
+      View view;
+    };
+
     struct ReplyType
     {
       typedef Reply State;
@@ -33,7 +33,7 @@
 #include <openvpn/openssl/ssl/sslctx.hpp>
 #endif
 
-#if defined(USE_MINICRYPTO) && (defined(OPENVPN_ARCH_x86_64) || defined(OPENVPN_ARCH_i386))
+#if defined(USE_MINICRYPTO) && (defined(OPENVPN_ARCH_x86_64) || defined(OPENVPN_ARCH_i386) || defined(OPENVPN_ARCH_ARM64))
 extern "C" {
   void OPENSSL_cpuid_setup();
 }
@@ -46,7 +46,8 @@ namespace openvpn {
 #if defined(USE_OPENSSL)
     openssl_setup_engine(engine);
     OpenSSLContext::SSL::init_static();
-#elif defined(USE_MINICRYPTO) && (defined(OPENVPN_ARCH_x86_64) || defined(OPENVPN_ARCH_i386))
+#elif defined(USE_MINICRYPTO) && (defined(OPENVPN_ARCH_x86_64) || defined(OPENVPN_ARCH_i386) || defined(OPENVPN_ARCH_ARM64))
+    // selects the AES-NI or ARMv8 Crypto Extensions kernels
     OPENSSL_cpuid_setup();
 #endif
   }
@@ -46,11 +46,16 @@ namespace openvpn {
 	// initialize time base
 	Time::reset_base();
 
+	// with OPENVPN_LAZY_INIT, compressors and SSL contexts
+	// initialize on first use instead
+#ifndef OPENVPN_LAZY_INIT
 	// initialize compression
 	CompressContext::init_static();
 
 	// init OpenSSL if included
 	init_openssl("auto");
+#endif
+
 
 	base64_init_static();
       }
@@ -0,0 +1,56 @@
+//    OpenVPN -- An application to securely tunnel IP networks
+//               over a single port, with support for SSL/TLS-based
+//               session authentication and key exchange,
+//               packet encryption, packet authentication, and
+//               packet compression.
+//
+//    Copyright (C) 2012-2016 OpenVPN Technologies, Inc.
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU Affero General Public License Version 3
+//    as published by the Free Software Foundation.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU Affero General Public License for more details.
+//
+//    You should have received a copy of the GNU Affero General Public License
+//    along with this program in the COPYING file.
+//    If not, see <http://www.gnu.org/licenses/>.
+
+// Define the ARP packet for IPv4 over Ethernet
+
+#ifndef OPENVPN_IP_ARP_H
+#define OPENVPN_IP_ARP_H
+
+#include <cstdint> // for std::uint32_t, uint16_t, uint8_t
+
+#pragma pack(push)
+#pragma pack(1)
+
+namespace openvpn {
+  struct ARPHeader {
+    enum {
+      ETHERTYPE = 0x0806,
+      HTYPE_ETHER = 1,
+      PTYPE_IPV4 = 0x0800,
+      REQUEST = 1,
+      REPLY = 2,
+    };
+
+    std::uint16_t  htype;
+    std::uint16_t  ptype;
+    std::uint8_t   hlen;
+    std::uint8_t   plen;
+    std::uint16_t  oper;
+    std::uint8_t   sha[6];
+    std::uint8_t   spa[4];
+    std::uint8_t   tha[6];
+    std::uint8_t   tpa[4];
+  };
+}
+
+#pragma pack(pop)
+
+#endif
@@ -0,0 +1,269 @@
+//    OpenVPN -- An application to securely tunnel IP networks
+//               over a single port, with support for SSL/TLS-based
+//               session authentication and key exchange,
+//               packet encryption, packet authentication, and
+//               packet compression.
+//
+//    Copyright (C) 2012-2016 OpenVPN Technologies, Inc.
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU Affero General Public License Version 3
+//    as published by the Free Software Foundation.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU Affero General Public License for more details.
+//
+//    You should have received a copy of the GNU Affero General Public License
+//    along with this program in the COPYING file.
+//    If not, see <http://www.gnu.org/licenses/>.
+
+// Internet checksum (RFC 1071) kernels and RFC 1624 incremental
+// updates.  Sums are kept in the byte order of the data, so a
+// checksum computed over network-order headers can be stored as is.
+
+#ifndef OPENVPN_IP_CSUM_H
+#define OPENVPN_IP_CSUM_H
+
+#include <cstdint> // for std::uint64_t, uint32_t, uint16_t, uint8_t
+#include <cstddef> // for std::size_t
+#include <cstring> // for std::memcpy
+
+#include <openvpn/common/cpufeat.hpp>
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__) && !defined(OPENVPN_NO_SIMD)
+#define OPENVPN_CSUM_X86
+#include <immintrin.h>
+#elif defined(__ARM_NEON) && !defined(OPENVPN_NO_SIMD)
+#define OPENVPN_CSUM_NEON
+#include <arm_neon.h>
+#endif
+
+namespace openvpn {
+  namespace IPChecksum {
+
+    // Partial sums are 64-bit accumulations of 32-bit words, which fold
+    // to the same 16-bit ones-complement sum as adding 16-bit words.
+
+    inline std::uint64_t partial_scalar(const std::uint8_t *data, std::size_t len, std::uint64_t sum)
+    {
+      while (len >= 4)
+	{
+	  std::uint32_t w;
+	  std::memcpy(&w, data, 4);
+	  sum += w;
+	  data += 4;
+	  len -= 4;
+	}
+      if (len >= 2)
+	{
+	  std::uint16_t w;
+	  std::memcpy(&w, data, 2);
+	  sum += w;
+	  data += 2;
+	  len -= 2;
+	}
+      if (len)
+	{
+	  std::uint16_t w = 0;
+	  std::memcpy(&w, data, 1); // pad odd byte with zero
+	  sum += w;
+	}
+      return sum;
+    }
+
+#if defined(OPENVPN_CSUM_X86)
+
+    // 64 bytes per block, returns bytes consumed
+    __attribute__((target("avx512f")))
+    inline std::size_t partial_avx512(const std::uint8_t *data, const std::size_t len, std::uint64_t& sum)
+    {
+      const __m512i zero = _mm512_setzero_si512();
+      __m512i acc = zero;
+      std::size_t i = 0;
+      for (; i + 64 <= len; i += 64)
+	{
+	  const __m512i v = _mm512_loadu_si512((const void *)(data + i));
+	  acc = _mm512_add_epi64(acc, _mm512_unpacklo_epi32(v, zero));
+	  acc = _mm512_add_epi64(acc, _mm512_unpackhi_epi32(v, zero));
+	}
+      sum += _mm512_reduce_add_epi64(acc);
+      return i;
+    }
+
+    // 32 bytes per block, returns bytes consumed
+    __attribute__((target("avx2")))
+    inline std::size_t partial_avx2(const std::uint8_t *data, const std::size_t len, std::uint64_t& sum)
+    {
+      const __m256i zero = _mm256_setzero_si256();
+      __m256i acc = zero;
+      std::size_t i = 0;
+      for (; i + 32 <= len; i += 32)
+	{
+	  const __m256i v = _mm256_loadu_si256((const __m256i *)(data + i));
+	  acc = _mm256_add_epi64(acc, _mm256_unpacklo_epi32(v, zero));
+	  acc = _mm256_add_epi64(acc, _mm256_unpackhi_epi32(v, zero));
+	}
+      std::uint64_t lanes[4];
+      _mm256_storeu_si256((__m256i *)lanes, acc);
+      sum += lanes[0] + lanes[1] + lanes[2] + lanes[3];
+      return i;
+    }
+
+    // 16 bytes per block, returns bytes consumed
+    __attribute__((target("sse2")))
+    inline std::size_t partial_sse2(const std::uint8_t *data, const std::size_t len, std::uint64_t& sum)
+    {
+      const __m128i zero = _mm_setzero_si128();
+      __m128i acc = zero;
+      std::size_t i = 0;
+      for (; i + 16 <= len; i += 16)
+	{
+	  const __m128i v = _mm_loadu_si128((const __m128i *)(data + i));
+	  acc = _mm_add_epi64(acc, _mm_unpacklo_epi32(v, zero));
+	  acc = _mm_add_epi64(acc, _mm_unpackhi_epi32(v, zero));
+	}
+      std::uint64_t lanes[2];
+      _mm_storeu_si128((__m128i *)lanes, acc);
+      sum += lanes[0] + lanes[1];
+      return i;
+    }
+
+    typedef std::size_t (*PartialBlocks)(const std::uint8_t *data, const std::size_t len, std::uint64_t& sum);
+
+    // widest kernel supported by this CPU, bound on first use
+    inline PartialBlocks partial_blocks()
+    {
+      static const PartialBlocks fn =
+	CPUFeatures::have(CPUFeatures::AVX512F) ? partial_avx512
+	: CPUFeatures::have(CPUFeatures::AVX2) ? partial_avx2
+	: CPUFeatures::have(CPUFeatures::SSE2) ? partial_sse2
+	: nullptr;
+      return fn;
+    }
+
+#elif defined(OPENVPN_CSUM_NEON)
+
+    // 16 bytes per block, returns bytes consumed
+    inline std::size_t partial_neon(const std::uint8_t *data, const std::size_t len, std::uint64_t& sum)
+    {
+      uint64x2_t acc = vdupq_n_u64(0);
+      std::size_t i = 0;
+      for (; i + 16 <= len; i += 16)
+	acc = vpadalq_u32(acc, vreinterpretq_u32_u8(vld1q_u8(data + i)));
+      sum += vgetq_lane_u64(acc, 0) + vgetq_lane_u64(acc, 1);
+      return i;
+    }
+
+#endif
+
+    // Add len bytes at data to a running partial sum.  Only the final
+    // chunk of a multi-part sum may have odd length.
+    inline std::uint64_t partial(const void *data, std::size_t len, std::uint64_t sum = 0)
+    {
+      const std::uint8_t *p = (const std::uint8_t *)data;
+#if defined(OPENVPN_CSUM_X86)
+      if (len >= 64)
+	{
+	  const PartialBlocks fn = partial_blocks();
+	  if (fn)
+	    {
+	      const std::size_t n = fn(p, len, sum);
+	      p += n;
+	      len -= n;
+	    }
+	}
+#elif defined(OPENVPN_CSUM_NEON)
+      if (len >= 64)
+	{
+	  const std::size_t n = partial_neon(p, len, sum);
+	  p += n;
+	  len -= n;
+	}
+#endif
+      return partial_scalar(p, len, sum);
+    }
+
+    // fold a partial sum to 16 bits (not complemented)
+    inline std::uint16_t fold(std::uint64_t sum)
+    {
+      sum = (sum >> 32) + (sum & 0xffffffff);
+      sum = (sum >> 32) + (sum & 0xffffffff);
+      sum = (sum >> 16) + (sum & 0xffff);
+      sum = (sum >> 16) + (sum & 0xffff);
+      sum = (sum >> 16) + (sum & 0xffff);
+      return std::uint16_t(sum);
+    }
+
+    // checksum of a buffer, ready to store in a header
+    inline std::uint16_t compute(const void *data, const std::size_t len, const std::uint64_t sum = 0)
+    {
+      return std::uint16_t(~fold(partial(data, len, sum)));
+    }
+
+    // Partial sum of the TCP/UDP pseudo header, addresses in network
+    // order, proto and len in host order.
+    inline std::uint64_t pseudo_v4(const void *saddr, const void *daddr,
+				   const std::uint8_t proto, const std::uint32_t len)
+    {
+      std::uint64_t sum = partial(saddr, 4);
+      sum = partial(daddr, 4, sum);
+      const std::uint8_t tail[4] = { 0, proto, std::uint8_t(len >> 8), std::uint8_t(len) };
+      return partial(tail, 4, sum);
+    }
+
+    inline std::uint64_t pseudo_v6(const void *saddr, const void *daddr,
+				   const std::uint8_t proto, const std::uint32_t len)
+    {
+      std::uint64_t sum = partial(saddr, 16);
+      sum = partial(daddr, 16, sum);
+      const std::uint8_t tail[8] = { std::uint8_t(len >> 24), std::uint8_t(len >> 16),
+				     std::uint8_t(len >> 8), std::uint8_t(len),
+				     0, 0, 0, proto };
+      return partial(tail, 8, sum);
+    }
+
+    // Incrementally update check after one 16-bit word changed from
+    // old_word to new_word (RFC 1624, eqn. 3).  All values in the same
+    // (host or network) byte order.
+    inline std::uint16_t adjust16(const std::uint16_t check,
+				  const std::uint16_t old_word,
+				  const std::uint16_t new_word)
+    {
+      std::uint32_t sum = std::uint16_t(~check);
+      sum += std::uint16_t(~old_word);
+      sum += new_word;
+      sum = (sum >> 16) + (sum & 0xffff);
+      sum += (sum >> 16);
+      return std::uint16_t(~sum);
+    }
+
+    // same, for a 32-bit field such as an IPv4 address (NAT)
+    inline std::uint16_t adjust32(const std::uint16_t check,
+				  const std::uint32_t old_word,
+				  const std::uint32_t new_word)
+    {
+      std::uint64_t sum = std::uint16_t(~check);
+      sum += ~old_word & 0xffffffff;
+      sum += new_word;
+      return std::uint16_t(~fold(sum));
+    }
+
+    // Same, for a field of len bytes at an even offset replaced in
+    // place, such as an IPv6 address.  old_data is the previous content.
+    inline std::uint16_t adjust(const std::uint16_t check,
+				const void *old_data,
+				const void *new_data,
+				const std::size_t len)
+    {
+      const std::uint64_t old_sum = fold(partial(old_data, len));
+      std::uint64_t sum = std::uint16_t(~check);
+      sum += std::uint16_t(~old_sum);
+      return std::uint16_t(~fold(partial(new_data, len, sum)));
+    }
+
+  }
+}
+
+#endif
@@ -0,0 +1,683 @@
+//    OpenVPN -- An application to securely tunnel IP networks
+//               over a single port, with support for SSL/TLS-based
+//               session authentication and key exchange,
+//               packet encryption, packet authentication, and
+//               packet compression.
+//
+//    Copyright (C) 2012-2016 OpenVPN Technologies, Inc.
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU Affero General Public License Version 3
+//    as published by the Free Software Foundation.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU Affero General Public License for more details.
+//
+//    You should have received a copy of the GNU Affero General Public License
+//    along with this program in the COPYING file.
+//    If not, see <http://www.gnu.org/licenses/>.
+
+// A stub resolver that sits in the client data path in front of the
+// server-pushed DNS servers (dhcp-option DNS).  UDP queries read from
+// the tun and addressed to one of those servers are answered from a
+// TTL-respecting cache when possible, identical queries already in
+// flight are held back and answered from the single response, and
+// names that keep being asked for are re-queried shortly before they
+// expire so that the cache stays warm.  Everything else passes through.
+
+#ifndef OPENVPN_IP_DNSSTUB_H
+#define OPENVPN_IP_DNSSTUB_H
+
+#include <cstddef>   // for offsetof
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <algorithm> // for std::min, std::max
+#include <vector>
+#include <unordered_map>
+
+#include <openvpn/common/rc.hpp>
+#include <openvpn/common/options.hpp>
+#include <openvpn/common/socktypes.hpp>
+#include <openvpn/buffer/buffer.hpp>
+#include <openvpn/addr/ip.hpp>
+#include <openvpn/time/time.hpp>
+#include <openvpn/ip/ip.hpp>
+#include <openvpn/ip/udp.hpp>
+#include <openvpn/ip/csum.hpp>
+
+namespace openvpn {
+  namespace DNSStub {
+
+    struct Config
+    {
+      size_t max_entries = 1024;      // cached answers
+      unsigned int min_ttl = 0;       // clamp of cached TTLs, in seconds
+      unsigned int max_ttl = 86400;
+      unsigned int prefetch_hits = 2; // hits before an entry is worth prefetching
+      unsigned int prefetch_percent = 10; // prefetch in the last N% of the TTL
+      Time::Duration pending_timeout = Time::Duration::seconds(5);
+    };
+
+    class Resolver : public RC<thread_unsafe_refcount>
+    {
+    public:
+      typedef RCPtr<Resolver> Ptr;
+
+      // query() result flags
+      enum {
+	FORWARD=(1<<0), // send the (possibly rewritten) query on to the server
+	REPLY=(1<<1),   // reply holds an answer for the tun
+      };
+
+      Resolver(const Config& config_arg)
+	: config(config_arg)
+      {
+      }
+
+      // Take the DNS servers from the pushed options.  Queries still
+      // in flight to the previous servers are forgotten, the cache
+      // is kept since it is keyed by server.
+      void set_servers(const OptionList& opt)
+      {
+	servers.clear();
+	pending.clear();
+	const OptionList::IndexList* il = opt.get_index_ptr("dhcp-option");
+	if (!il)
+	  return;
+	for (OptionList::IndexList::const_iterator i = il->begin(); i != il->end(); ++i)
+	  {
+	    const Option& o = opt[*i];
+	    if (o.size() != 3 || o.get(1, 64) != "DNS")
+	      continue;
+	    const IP::Addr ip = IP::Addr::from_string(o.get(2, 256), "dns-server-ip");
+	    if (ip.version() == IP::Addr::V4)
+	      {
+		const std::uint32_t a = ip.to_uint32_net();
+		servers.emplace_back((const char *)&a, sizeof(a));
+	      }
+	    else if (ip.version() == IP::Addr::V6)
+	      {
+		unsigned char a[16];
+		ip.to_byte_string(a);
+		servers.emplace_back((const char *)a, sizeof(a));
+	      }
+	  }
+      }
+
+      size_t n_servers() const { return servers.size(); }
+
+      // Cheap test, run on every tun packet: is this a UDP packet to
+      // port 53 of one of the pushed servers?
+      bool is_query(const Buffer& buf) const
+      {
+	Packet p;
+	return !servers.empty()
+	  && parse(buf, p)
+	  && p.dport == PORT
+	  && is_server(buf.c_data() + p.daddr, p.alen);
+      }
+
+      // Process a query read from the tun.  reply must be prepared
+      // for a tun write, it is filled when REPLY is returned.  If
+      // neither flag is returned the query was absorbed.
+      unsigned int query(BufferAllocated& buf, BufferAllocated& reply, const Time& now)
+      {
+	Packet p;
+	Question q;
+	if (!parse(buf, p) || !parse_question(buf, p, false, q))
+	  return FORWARD;
+
+	const std::string key = make_key(buf, p, p.daddr, q);
+
+	// answer from cache
+	Cache::iterator ci = cache.find(key);
+	if (ci != cache.end())
+	  {
+	    Entry& e = ci->second;
+	    if (now < e.expire)
+	      {
+		build_reply(buf, p, q, e, now, reply);
+		++e.hits;
+
+		// refresh a popular name before it expires
+		if (e.hits >= config.prefetch_hits
+		    && (e.expire - now).to_seconds() * 100 < std::uint64_t(e.ttl) * config.prefetch_percent
+		    && !in_flight(key, now))
+		  {
+		    Pending& pe = pending[key];
+		    pe = Pending();
+		    pe.sent = now;
+		    pe.id = next_id++;
+		    pe.sport = p.sport;
+		    pe.prefetch = true;
+		    set_query_id(buf, p, pe.id);
+		    return REPLY|FORWARD;
+		  }
+		return REPLY;
+	      }
+	    cache.erase(ci);
+	  }
+
+	// coalesce with an identical query in flight
+	Pending::Map::iterator pi = pending.find(key);
+	if (pi != pending.end() && now - pi->second.sent < config.pending_timeout)
+	  {
+	    Pending& pe = pi->second;
+	    if (!(pe.id == q.id && pe.sport == p.sport))
+	      {
+		Waiter w;
+		w.id = q.id;
+		w.port = p.sport;
+		w.addr.assign((const char *)buf.c_data() + p.saddr, p.alen);
+		w.question.assign((const char *)buf.c_data() + p.dns + HEADER_SIZE, q.len);
+		pe.waiters.push_back(std::move(w));
+	      }
+	    return 0;
+	  }
+
+	// new query, the original sender gets the response as is
+	if (pending.size() >= config.max_entries)
+	  expire_pending(now);
+	Pending& pe = pending[key];
+	pe = Pending();
+	pe.sent = now;
+	pe.id = q.id;
+	pe.sport = p.sport;
+	return FORWARD;
+      }
+
+      // Process a packet from the server on its way to the tun.
+      // Returns false if buf should not be delivered.  Copies of a
+      // response for coalesced queries are appended to fanout.
+      bool response(BufferAllocated& buf, std::vector<BufferAllocated>& fanout, const Time& now)
+      {
+	Packet p;
+	if (servers.empty()
+	    || !parse(buf, p)
+	    || p.sport != PORT
+	    || !is_server(buf.c_data() + p.saddr, p.alen))
+	  return true;
+	Question q;
+	if (!parse_question(buf, p, true, q))
+	  return true;
+
+	const std::string key = make_key(buf, p, p.saddr, q);
+	Pending::Map::iterator pi = pending.find(key);
+	if (pi == pending.end() || pi->second.id != q.id || pi->second.sport != p.dport)
+	  return true;
+	Pending pe(std::move(pi->second));
+	pending.erase(pi);
+
+	store(key, buf, p, now);
+
+	for (const auto& w : pe.waiters)
+	  {
+	    fanout.emplace_back(buf);
+	    readdress(fanout.back(), p, w);
+	  }
+	return !pe.prefetch;
+      }
+
+    private:
+      enum {
+	PORT = 53,
+	HEADER_SIZE = 12,
+	MAX_NAME = 255,
+
+	// DNS header flags
+	QR = 0x8000,
+	OPCODE = 0x7800,
+	TC = 0x0200,
+	RD = 0x0100,
+	CD = 0x0010,
+	RCODE = 0x000f,
+
+	NOERROR = 0,
+	NXDOMAIN = 3,
+
+	// RR types
+	T_SOA = 6,
+	T_OPT = 41,
+
+	IP_MF = 0x2000,
+	IPV6_HLEN = 40,
+      };
+
+      // offsets into a UDP packet read from the tun or the transport
+      struct Packet
+      {
+	size_t saddr;
+	size_t daddr;
+	size_t alen;
+	size_t udp;
+	size_t dns;
+	size_t dns_len;
+	std::uint16_t sport; // host order
+	std::uint16_t dport;
+      };
+
+      struct Question
+      {
+	std::uint16_t id;
+	std::uint16_t flags;
+	size_t len;     // name + type + class
+	size_t rr;      // offset of the first RR after the question
+      };
+
+      struct Entry
+      {
+	std::string msg;                  // DNS response as received
+	std::vector<std::uint16_t> ttls;  // offsets of the TTL fields in msg
+	Time stored;
+	Time expire;
+	unsigned int ttl = 0;
+	unsigned int hits = 0;
+      };
+
+      struct Waiter
+      {
+	std::uint16_t id;
+	std::uint16_t port;
+	std::string addr;
+	std::string question; // as sent, 0x20 case randomization included
+      };
+
+      struct Pending
+      {
+	typedef std::unordered_map<std::string, Pending> Map;
+
+	Time sent;
+	std::uint16_t id = 0;    // DNS id and source port the response will carry
+	std::uint16_t sport = 0;
+	bool prefetch = false;   // nobody is waiting on the response
+	std::vector<Waiter> waiters;
+      };
+
+      typedef std::unordered_map<std::string, Entry> Cache;
+
+      static std::uint16_t get16(const std::uint8_t *p)
+      {
+	return std::uint16_t((p[0] << 8) | p[1]);
+      }
+
+      static std::uint32_t get32(const std::uint8_t *p)
+      {
+	return (std::uint32_t(p[0]) << 24) | (std::uint32_t(p[1]) << 16) | (std::uint32_t(p[2]) << 8) | p[3];
+      }
+
+      static void put16(std::uint8_t *p, const std::uint16_t v)
+      {
+	p[0] = std::uint8_t(v >> 8);
+	p[1] = std::uint8_t(v);
+      }
+
+      static void put32(std::uint8_t *p, const std::uint32_t v)
+      {
+	p[0] = std::uint8_t(v >> 24);
+	p[1] = std::uint8_t(v >> 16);
+	p[2] = std::uint8_t(v >> 8);
+	p[3] = std::uint8_t(v);
+      }
+
+      static bool parse(const Buffer& buf, Packet& p)
+      {
+	const std::uint8_t *data = buf.c_data();
+	const size_t size = buf.size();
+	size_t end;
+
+	if (size < 1)
+	  return false;
+	switch (IPHeader::version(data[0]))
+	  {
+	  case 4:
+	    {
+	      if (size < sizeof(IPHeader))
+		return false;
+	      const IPHeader* iph = (const IPHeader*)data;
+	      const unsigned int hlen = IPHeader::length(iph->version_len);
+	      if (hlen < sizeof(IPHeader)
+		  || iph->protocol != IPHeader::UDP
+		  || (ntohs(iph->frag_off) & (IPHeader::OFFMASK|IP_MF)))
+		return false;
+	      end = ntohs(iph->tot_len);
+	      p.saddr = offsetof(IPHeader, saddr);
+	      p.daddr = offsetof(IPHeader, daddr);
+	      p.alen = 4;
+	      p.udp = hlen;
+	      break;
+	    }
+	  case 6:
+	    {
+	      // UDP right after the fixed header only
+	      if (size < IPV6_HLEN || data[6] != IPHeader::UDP)
+		return false;
+	      end = IPV6_HLEN + get16(data + 4);
+	      p.saddr = 8;
+	      p.daddr = 24;
+	      p.alen = 16;
+	      p.udp = IPV6_HLEN;
+	      break;
+	    }
+	  default:
+	    return false;
+	  }
+	if (end > size || end < p.udp + sizeof(UDPHeader))
+	  return false;
+	const UDPHeader* uh = (const UDPHeader*)(data + p.udp);
+	const size_t ulen = ntohs(uh->len);
+	if (ulen < sizeof(UDPHeader) || p.udp + ulen > end)
+	  return false;
+	p.sport = ntohs(uh->source);
+	p.dport = ntohs(uh->dest);
+	p.dns = p.udp + sizeof(UDPHeader);
+	p.dns_len = ulen - sizeof(UDPHeader);
+	return true;
+      }
+
+      // Parse the header and the single question of a standard query
+      // or of a response to one.
+      static bool parse_question(const Buffer& buf, const Packet& p, const bool resp, Question& q)
+      {
+	const std::uint8_t *m = buf.c_data() + p.dns;
+	const size_t len = p.dns_len;
+	if (len < HEADER_SIZE)
+	  return false;
+	q.id = get16(m);
+	q.flags = get16(m + 2);
+	if (bool(q.flags & QR) != resp
+	    || (q.flags & OPCODE)
+	    || get16(m + 4) != 1)
+	  return false;
+	if (!resp && (get16(m + 6) || get16(m + 8)))
+	  return false;
+
+	// labels only, no compression in the question
+	size_t i = HEADER_SIZE;
+	while (true)
+	  {
+	    if (i >= len)
+	      return false;
+	    const unsigned int l = m[i];
+	    if (l & 0xC0)
+	      return false;
+	    ++i;
+	    if (!l)
+	      break;
+	    i += l;
+	    if (i - HEADER_SIZE > MAX_NAME)
+	      return false;
+	  }
+	if (i + 4 > len)
+	  return false;
+	q.rr = i + 4;
+	q.len = q.rr - HEADER_SIZE;
+	return true;
+      }
+
+      // server address, question with the name folded to lower case,
+      // and the flags that the response echoes
+      static std::string make_key(const Buffer& buf, const Packet& p, const size_t addr, const Question& q)
+      {
+	const std::uint8_t *data = buf.c_data();
+	const std::uint8_t *qs = data + p.dns + HEADER_SIZE;
+	std::string key;
+	key.reserve(p.alen + q.len + 2);
+	key.append((const char *)data + addr, p.alen);
+	for (size_t i = 0; i < q.len; ++i)
+	  {
+	    const char c = char(qs[i]);
+	    key += (c >= 'A' && c <= 'Z') ? char(c + ('a' - 'A')) : c;
+	  }
+	key += char((q.flags & (RD|CD)) >> 4);
+	return key;
+      }
+
+      bool is_server(const std::uint8_t *addr, const size_t alen) const
+      {
+	for (const auto& s : servers)
+	  if (s.size() == alen && !std::memcmp(s.data(), addr, alen))
+	    return true;
+	return false;
+      }
+
+      bool in_flight(const std::string& key, const Time& now) const
+      {
+	Pending::Map::const_iterator pi = pending.find(key);
+	return pi != pending.end() && now - pi->second.sent < config.pending_timeout;
+      }
+
+      void expire_pending(const Time& now)
+      {
+	for (Pending::Map::iterator i = pending.begin(); i != pending.end(); )
+	  {
+	    if (now - i->second.sent >= config.pending_timeout)
+	      i = pending.erase(i);
+	    else
+	      ++i;
+	  }
+      }
+
+      void expire_cache(const Time& now)
+      {
+	for (Cache::iterator i = cache.begin(); i != cache.end(); )
+	  {
+	    if (now >= i->second.expire)
+	      i = cache.erase(i);
+	    else
+	      ++i;
+	  }
+      }
+
+      // Skip a possibly compressed name starting at i, returns false
+      // if it runs past len.
+      static bool skip_name(const std::uint8_t *m, const size_t len, size_t& i)
+      {
+	while (i < len)
+	  {
+	    const unsigned int l = m[i];
+	    if ((l & 0xC0) == 0xC0)
+	      {
+		i += 2;
+		return i <= len;
+	      }
+	    if (l & 0xC0)
+	      return false;
+	    ++i;
+	    if (!l)
+	      return true;
+	    i += l;
+	  }
+	return false;
+      }
+
+      // Cache a successful or negative response, with a lifetime of its smallest TTL (or the
+      // SOA minimum for a negative answer).
+      void store(const std::string& key, const Buffer& buf, const Packet& p, const Time& now)
+      {
+	const std::uint8_t *m = buf.c_data() + p.dns;
+	const size_t len = p.dns_len;
+	const unsigned int n_rr = get16(m + 6) + get16(m + 8) + get16(m + 10);
+	const unsigned int n_ansauth = get16(m + 6) + get16(m + 8);
+	const bool negative = (get16(m + 2) & RCODE) == NXDOMAIN || !get16(m + 6);
+
+	Question q;
+	if (!parse_question(buf, p, true, q))
+	  return;
+	const unsigned int rcode = q.flags & RCODE;
+	if ((q.flags & TC) || (rcode != NOERROR && rcode != NXDOMAIN))
+	  return;
+
+	Entry e;
+	std::uint32_t ttl = 0xffffffff;
+	bool have_ttl = false;
+	size_t i = q.rr;
+	for (unsigned int r = 0; r < n_rr; ++r)
+	  {
+	    if (!skip_name(m, len, i) || i + 10 > len)
+	      return;
+	    const unsigned int type = get16(m + i);
+	    const std::uint32_t rr_ttl = get32(m + i + 4);
+	    const size_t rdlen = get16(m + i + 8);
+	    if (i + 10 + rdlen > len)
+	      return;
+	    if (type != T_OPT)
+	      {
+		e.ttls.push_back(std::uint16_t(i + 4));
+		if (r < n_ansauth)
+		  {
+		    std::uint32_t t = rr_ttl;
+		    if (negative && type == T_SOA && rdlen >= 20)
+		      t = std::min(t, get32(m + i + 10 + rdlen - 4));
+		    ttl = std::min(ttl, t);
+		    have_ttl = true;
+		  }
+	      }
+	    i += 10 + rdlen;
+	  }
+
+	// nothing to derive a negative TTL from
+	if (!have_ttl)
+	  return;
+	ttl = std::max(ttl, std::uint32_t(config.min_ttl));
+	ttl = std::min(ttl, std::uint32_t(config.max_ttl));
+	if (!ttl)
+	  return;
+
+	if (cache.size() >= config.max_entries && !cache.count(key))
+	  {
+	    expire_cache(now);
+	    if (cache.size() >= config.max_entries)
+	      cache.erase(cache.begin());
+	  }
+
+	e.msg.assign((const char *)m, len);
+	e.stored = now;
+	e.ttl = ttl;
+	e.expire = now + Time::Duration::seconds(ttl);
+	Entry& ce = cache[key];
+	e.hits = ce.hits;
+	ce = std::move(e);
+      }
+
+      // Build the answer to the query in buf from a cached response,
+      // with TTLs aged by the time spent in the cache.
+      static void build_reply(const Buffer& buf, const Packet& p, const Question& q,
+			      const Entry& e, const Time& now, BufferAllocated& reply)
+      {
+	const std::uint8_t *in = buf.c_data();
+	const size_t hlen = p.alen == 4 ? sizeof(IPHeader) : size_t(IPV6_HLEN);
+	const size_t ulen = sizeof(UDPHeader) + e.msg.size();
+	std::uint8_t *out = reply.write_alloc(hlen + ulen);
+
+	// DNS message
+	std::uint8_t *m = out + hlen + sizeof(UDPHeader);
+	std::memcpy(m, e.msg.data(), e.msg.size());
+	put16(m, q.id);
+	std::memcpy(m + HEADER_SIZE, in + p.dns + HEADER_SIZE, q.len);
+	const std::uint32_t aged = std::uint32_t((now - e.stored).to_seconds());
+	for (const auto off : e.ttls)
+	  {
+	    const std::uint32_t t = get32(m + off);
+	    put32(m + off, t > aged ? t - aged : 0);
+	  }
+
+	// UDP, ports swapped
+	UDPHeader* uh = (UDPHeader*)(out + hlen);
+	uh->source = htons(p.dport);
+	uh->dest = htons(p.sport);
+	uh->len = htons(std::uint16_t(ulen));
+	uh->check = 0;
+
+	// IP, addresses swapped
+	if (p.alen == 4)
+	  {
+	    IPHeader* iph = (IPHeader*)out;
+	    iph->version_len = IPHeader::ver_len(4, sizeof(IPHeader));
+	    iph->tos = 0;
+	    iph->tot_len = htons(std::uint16_t(hlen + ulen));
+	    iph->id = 0;
+	    iph->frag_off = 0;
+	    iph->ttl = 64;
+	    iph->protocol = IPHeader::UDP;
+	    iph->check = 0;
+	    std::memcpy(&iph->saddr, in + p.daddr, 4);
+	    std::memcpy(&iph->daddr, in + p.saddr, 4);
+	    iph->check = IPChecksum::compute(iph, sizeof(IPHeader));
+	  }
+	else
+	  {
+	    put32(out, 0x60000000);
+	    put16(out + 4, std::uint16_t(ulen));
+	    out[6] = IPHeader::UDP;
+	    out[7] = 64;
+	    std::memcpy(out + 8, in + p.daddr, 16);
+	    std::memcpy(out + 24, in + p.saddr, 16);
+	  }
+	udp_finalize(out, p.alen, hlen, ulen);
+      }
+
+      // Point a copy of a response at a coalesced query.
+      static void readdress(BufferAllocated& buf, const Packet& p, const Waiter& w)
+      {
+	std::uint8_t *data = buf.data();
+	std::uint8_t *m = data + p.dns;
+	put16(m, w.id);
+	std::memcpy(m + HEADER_SIZE, w.question.data(), w.question.size());
+	UDPHeader* uh = (UDPHeader*)(data + p.udp);
+	uh->dest = htons(w.port);
+	std::memcpy(data + p.daddr, w.addr.data(), p.alen);
+	if (p.alen == 4)
+	  {
+	    IPHeader* iph = (IPHeader*)data;
+	    iph->check = 0;
+	    iph->check = IPChecksum::compute(iph, p.udp);
+	  }
+	udp_finalize(data, p.alen, p.udp, p.dns_len + sizeof(UDPHeader));
+      }
+
+      // compute the UDP checksum of a packet with the given headers
+      static void udp_finalize(std::uint8_t *data, const size_t alen, const size_t hlen, const size_t ulen)
+      {
+	UDPHeader* uh = (UDPHeader*)(data + hlen);
+	const std::uint8_t *saddr = data + (alen == 4 ? offsetof(IPHeader, saddr) : 8);
+	const std::uint8_t *daddr = saddr + alen;
+	uh->check = 0;
+	const std::uint64_t sum = alen == 4
+	  ? IPChecksum::pseudo_v4(saddr, daddr, IPHeader::UDP, std::uint32_t(ulen))
+	  : IPChecksum::pseudo_v6(saddr, daddr, IPHeader::UDP, std::uint32_t(ulen));
+	const std::uint16_t check = IPChecksum::compute(uh, ulen, sum);
+	uh->check = check ? check : 0xffff;
+      }
+
+      // Give a forwarded query our own id, so that the response can
+      // be told apart from one the sender is waiting for.
+      static void set_query_id(BufferAllocated& buf, const Packet& p, const std::uint16_t id)
+      {
+	std::uint8_t *data = buf.data();
+	std::uint16_t old_id, new_id;
+	std::memcpy(&old_id, data + p.dns, 2);
+	put16(data + p.dns, id);
+	std::memcpy(&new_id, data + p.dns, 2);
+	UDPHeader* uh = (UDPHeader*)(data + p.udp);
+	if (uh->check)
+	  {
+	    uh->check = IPChecksum::adjust16(uh->check, old_id, new_id);
+	    if (!uh->check)
+	      uh->check = 0xffff;
+	  }
+      }
+
+      const Config config;
+      std::vector<std::string> servers; // addresses in network order
+      Cache cache;
+      Pending::Map pending;
+      std::uint16_t next_id = 0x5a5a;
+    };
+
+  }
+}
+
+#endif
@@ -0,0 +1,92 @@
+//    OpenVPN -- An application to securely tunnel IP networks
+//               over a single port, with support for SSL/TLS-based
+//               session authentication and key exchange,
+//               packet encryption, packet authentication, and
+//               packet compression.
+//
+//    Copyright (C) 2012-2016 OpenVPN Technologies, Inc.
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU Affero General Public License Version 3
+//    as published by the Free Software Foundation.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU Affero General Public License for more details.
+//
+//    You should have received a copy of the GNU Affero General Public License
+//    along with this program in the COPYING file.
+//    If not, see <http://www.gnu.org/licenses/>.
+
+// Read the DSCP/ECN byte of an inner IPv4/IPv6 packet, and mark an
+// inner packet Congestion Experienced when the outer packet carrying
+// it was marked (RFC 6040 decapsulation).
+
+#ifndef OPENVPN_IP_ECN_H
+#define OPENVPN_IP_ECN_H
+
+#include <cstdint>
+#include <cstring>
+
+#include <openvpn/buffer/buffer.hpp>
+#include <openvpn/ip/ip.hpp>
+#include <openvpn/ip/csum.hpp>
+
+namespace openvpn {
+  namespace IPECN {
+
+    enum {
+      NOT_ECT = 0,
+      ECT1 = 1,
+      ECT0 = 2,
+      CE = 3,
+      MASK = 3,
+    };
+
+    // IPv4 TOS or IPv6 traffic class, 0 if buf is not an IP packet
+    inline unsigned int tos(const Buffer& buf)
+    {
+      if (buf.size() < 2)
+	return 0;
+      const std::uint8_t *p = buf.c_data();
+      switch (IPHeader::version(p[0]))
+	{
+	case 4:
+	  return p[1];
+	case 6:
+	  return ((p[0] & 0x0f) << 4) | (p[1] >> 4);
+	default:
+	  return 0;
+	}
+    }
+
+    // Propagate an outer CE mark into the inner packet, returns true
+    // if the packet was changed.  Packets that are not ECN-capable
+    // are left alone.
+    inline bool set_ce(Buffer& buf)
+    {
+      const unsigned int t = tos(buf);
+      if ((t & MASK) == NOT_ECT || (t & MASK) == CE)
+	return false;
+      std::uint8_t *p = buf.data();
+      if (IPHeader::version(p[0]) == 4)
+	{
+	  if (buf.size() < sizeof(IPHeader))
+	    return false;
+	  IPHeader* iph = (IPHeader*)p;
+	  std::uint16_t old_word, new_word;
+	  std::memcpy(&old_word, p, 2);
+	  iph->tos |= CE;
+	  std::memcpy(&new_word, p, 2);
+	  iph->check = IPChecksum::adjust16(iph->check, old_word, new_word);
+	}
+      else
+	p[1] |= CE << 4;
+      return true;
+    }
+
+  }
+}
+
+#endif
@@ -0,0 +1,100 @@
+//    OpenVPN -- An application to securely tunnel IP networks
+//               over a single port, with support for SSL/TLS-based
+//               session authentication and key exchange,
+//               packet encryption, packet authentication, and
+//               packet compression.
+//
+//    Copyright (C) 2012-2016 OpenVPN Technologies, Inc.
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU Affero General Public License Version 3
+//    as published by the Free Software Foundation.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU Affero General Public License for more details.
+//
+//    You should have received a copy of the GNU Affero General Public License
+//    along with this program in the COPYING file.
+//    If not, see <http://www.gnu.org/licenses/>.
+
+// Compute a flow hash over the IP addresses, protocol, and
+// (if present) TCP/UDP ports of a raw IPv4/IPv6 packet, used
+// to steer packets of the same flow to the same queue.
+
+#ifndef OPENVPN_IP_FLOWHASH_H
+#define OPENVPN_IP_FLOWHASH_H
+
+#include <cstdint>
+#include <cstring>
+
+#include <openvpn/common/hash.hpp>
+#include <openvpn/common/socktypes.hpp>
+#include <openvpn/buffer/buffer.hpp>
+#include <openvpn/ip/ip.hpp>
+
+namespace openvpn {
+  namespace IPFlow {
+
+    inline std::size_t hash(const Buffer& buf)
+    {
+      const unsigned char *data = buf.c_data();
+      const size_t size = buf.size();
+      std::size_t seed = 0;
+
+      if (size < 1)
+	return seed;
+      switch (IPHeader::version(data[0]))
+	{
+	case 4:
+	  {
+	    if (size < sizeof(IPHeader))
+	      return seed;
+	    const IPHeader* iph = (const IPHeader*)data;
+	    const unsigned int hlen = IPHeader::length(iph->version_len);
+	    Hash::combine(seed, iph->saddr, iph->daddr, iph->protocol);
+
+	    // include ports on first or unfragmented TCP/UDP packets
+	    if ((iph->protocol == IPHeader::TCP || iph->protocol == IPHeader::UDP)
+		&& !(ntohs(iph->frag_off) & IPHeader::OFFMASK)
+		&& size >= hlen + 4)
+	      {
+		std::uint32_t ports;
+		std::memcpy(&ports, data + hlen, sizeof(ports));
+		Hash::combine(seed, ports);
+	      }
+	    return seed;
+	  }
+	case 6:
+	  {
+	    enum {
+	      IPV6_HLEN = 40,
+	      NEXT_HDR_OFF = 6,
+	      SADDR_OFF = 8,
+	    };
+	    if (size < IPV6_HLEN)
+	      return seed;
+	    const std::uint8_t next_hdr = data[NEXT_HDR_OFF];
+	    Hash::combine_data(seed, data + SADDR_OFF, 32);
+	    Hash::combine(seed, next_hdr);
+
+	    // ports only when no extension headers precede TCP/UDP
+	    if ((next_hdr == IPHeader::TCP || next_hdr == IPHeader::UDP)
+		&& size >= IPV6_HLEN + 4)
+	      {
+		std::uint32_t ports;
+		std::memcpy(&ports, data + IPV6_HLEN, sizeof(ports));
+		Hash::combine(seed, ports);
+	      }
+	    return seed;
+	  }
+	default:
+	  return seed;
+	}
+    }
+
+  }
+}
+
+#endif
@@ -0,0 +1,410 @@
+//    OpenVPN -- An application to securely tunnel IP networks
+//               over a single port, with support for SSL/TLS-based
+//               session authentication and key exchange,
+//               packet encryption, packet authentication, and
+//               packet compression.
+//
+//    Copyright (C) 2012-2016 OpenVPN Technologies, Inc.
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU Affero General Public License Version 3
+//    as published by the Free Software Foundation.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU Affero General Public License for more details.
+//
+//    You should have received a copy of the GNU Affero General Public License
+//    along with this program in the COPYING file.
+//    If not, see <http://www.gnu.org/licenses/>.
+
+// Segmentation of TCP super-packets read from a tun device with
+// offloads enabled (IFF_VNET_HDR), completion of checksums the
+// kernel left partial, and the reverse: coalescing of TCP segments
+// into super-packets to be written to the device.
+
+#ifndef OPENVPN_IP_GSO_H
+#define OPENVPN_IP_GSO_H
+
+#include <cstdint>
+#include <cstring>
+#include <algorithm> // for std::min
+
+#include <openvpn/buffer/buffer.hpp>
+#include <openvpn/ip/ip.hpp>
+#include <openvpn/ip/csum.hpp>
+
+namespace openvpn {
+  namespace GSO {
+
+#pragma pack(push)
+#pragma pack(1)
+
+    // struct virtio_net_hdr, in native byte order (the tun default)
+    struct VnetHdr
+    {
+      enum {
+	F_NEEDS_CSUM = 1,
+
+	GSO_NONE = 0,
+	GSO_TCPV4 = 1,
+	GSO_UDP = 3,
+	GSO_TCPV6 = 4,
+	GSO_ECN = 0x80,
+      };
+
+      std::uint8_t flags;
+      std::uint8_t gso_type;
+      std::uint16_t hdr_len;
+      std::uint16_t gso_size;
+      std::uint16_t csum_start;
+      std::uint16_t csum_offset;
+    };
+
+#pragma pack(pop)
+
+    enum {
+      TCP_HLEN = 20,
+      TCP_FIN = 0x01,
+      TCP_PSH = 0x08,
+      TCP_ACK = 0x10,
+      TCP_CWR = 0x80,
+    };
+
+    namespace detail {
+      inline std::uint16_t read16(const unsigned char *p)
+      {
+	return std::uint16_t((p[0] << 8) | p[1]);
+      }
+
+      inline std::uint32_t read32(const unsigned char *p)
+      {
+	return (std::uint32_t(p[0]) << 24) | (std::uint32_t(p[1]) << 16) | (std::uint32_t(p[2]) << 8) | p[3];
+      }
+
+      inline void write16(unsigned char *p, const std::uint16_t v)
+      {
+	p[0] = (unsigned char)(v >> 8);
+	p[1] = (unsigned char)v;
+      }
+
+      inline void write32(unsigned char *p, const std::uint32_t v)
+      {
+	p[0] = (unsigned char)(v >> 24);
+	p[1] = (unsigned char)(v >> 16);
+	p[2] = (unsigned char)(v >> 8);
+	p[3] = (unsigned char)v;
+      }
+    }
+
+    // Finish a checksum flagged F_NEEDS_CSUM: the field at
+    // csum_start + csum_offset holds the pseudo header sum, and the
+    // checksum covers everything from csum_start on.
+    inline bool complete_csum(Buffer& pkt, const VnetHdr& h)
+    {
+      const size_t start = h.csum_start;
+      const size_t off = h.csum_offset;
+      if (start + off + 2 > pkt.size())
+	return false;
+      unsigned char *p = pkt.data();
+      const std::uint16_t check = IPChecksum::compute(p + start, pkt.size() - start);
+      std::memcpy(p + start + off, &check, sizeof(check));
+      return true;
+    }
+
+    // Split the TCP super-packet pkt (IPv4 or IPv6 without extension
+    // headers) into segments of at most h.gso_size payload bytes, as
+    // the kernel would have.  alloc(size) must return a buffer to
+    // append a segment of size bytes to.  Each segment gets its own
+    // lengths, IPv4 ID, sequence number and checksums, and FIN/PSH
+    // only on the last and CWR only on the first.  Returns the number
+    // of segments, or 0 if pkt cannot be segmented.
+    template <typename ALLOC>
+    inline size_t segment_tcp(const Buffer& pkt, const VnetHdr& h, ALLOC alloc)
+    {
+      using namespace detail;
+
+      const unsigned char *p = pkt.c_data();
+      const size_t size = pkt.size();
+      const size_t mss = h.gso_size;
+      if (!size || !mss)
+	return 0;
+
+      const unsigned int ver = IPHeader::version(p[0]);
+      size_t iphl;
+      if (ver == 4)
+	{
+	  if (size < sizeof(IPHeader))
+	    return 0;
+	  iphl = IPHeader::length(p[0]);
+	  if (iphl < sizeof(IPHeader) || p[9] != IPHeader::TCP)
+	    return 0;
+	}
+      else if (ver == 6)
+	{
+	  iphl = 40;
+	  if (size < iphl || p[6] != IPHeader::TCP)
+	    return 0;
+	}
+      else
+	return 0;
+
+      if (size < iphl + TCP_HLEN)
+	return 0;
+      const size_t tcphl = size_t(p[iphl + 12] >> 4) << 2;
+      const size_t hl = iphl + tcphl;
+      if (tcphl < TCP_HLEN || size <= hl)
+	return 0;
+
+      const size_t payload = size - hl;
+      const std::uint32_t seq = read32(p + iphl + 4);
+      const std::uint16_t id = ver == 4 ? read16(p + 4) : 0;
+
+      size_t n = 0;
+      for (size_t off = 0; off < payload; off += mss, ++n)
+	{
+	  const size_t len = std::min(mss, payload - off);
+	  unsigned char *q = alloc(hl + len).write_alloc(hl + len);
+	  std::memcpy(q, p, hl);
+	  std::memcpy(q + hl, p + hl + off, len);
+
+	  unsigned char *tcp = q + iphl;
+	  std::uint64_t sum;
+	  if (ver == 4)
+	    {
+	      IPHeader *ip = (IPHeader *)q;
+	      write16(q + 2, std::uint16_t(hl + len));
+	      write16(q + 4, std::uint16_t(id + n));
+	      ip->check = 0;
+	      ip->check = ip_checksum(q, (unsigned int)iphl);
+	      sum = IPChecksum::pseudo_v4(q + 12, q + 16, IPHeader::TCP, std::uint32_t(tcphl + len));
+	    }
+	  else
+	    {
+	      write16(q + 4, std::uint16_t(tcphl + len));
+	      sum = IPChecksum::pseudo_v6(q + 8, q + 24, IPHeader::TCP, std::uint32_t(tcphl + len));
+	    }
+
+	  write32(tcp + 4, seq + std::uint32_t(off));
+	  if (off + len < payload)
+	    tcp[13] &= ~(TCP_FIN|TCP_PSH);
+	  if (off)
+	    tcp[13] &= ~TCP_CWR;
+	  tcp[16] = tcp[17] = 0;
+	  const std::uint16_t check = IPChecksum::compute(tcp, tcphl + len, sum);
+	  std::memcpy(tcp + 16, &check, sizeof(check));
+	}
+      return n;
+    }
+
+
+    // Coalesce in-order TCP segments of one flow into a super-packet
+    // that is written to the tun device behind a VnetHdr of type
+    // GSO_TCPV4/GSO_TCPV6, for the kernel to take as if GRO had
+    // merged them.  Only plain ACK segments (PSH allowed on the last)
+    // of IPv4 without options or fragmentation, or IPv6 without
+    // extension headers, are merged, and only while all headers other
+    // than lengths, IPv4 ID, sequence number and checksums match and
+    // every segment but the last has the size of the first.
+    class Coalescer
+    {
+    public:
+      Coalescer()
+      {
+      }
+
+      explicit Coalescer(const size_t max_size)
+      {
+	init(max_size);
+      }
+
+      // max_size is the largest super-packet, at most 65535
+      void init(const size_t max_size)
+      {
+	max = std::min(max_size, size_t(65535));
+	buf.reset(sizeof(VnetHdr) + max, 0);
+	reset();
+      }
+
+      void reset()
+      {
+	buf.reset_size();
+	n = 0;
+      }
+
+      bool empty() const { return !n; }
+
+      // number of segments merged into the pending super-packet
+      size_t segments() const { return n; }
+
+      // Merge pkt into the pending super-packet, or start a new one
+      // if none is pending.  Returns false, leaving the pending one
+      // unchanged, if pkt cannot be merged.
+      bool add(const Buffer& pkt)
+      {
+	Seg s;
+	if (!parse(pkt, s))
+	  return false;
+	const unsigned char *p = pkt.c_data();
+	if (!n)
+	  {
+	    if (pkt.size() > max)
+	      return false;
+	    buf.reset_size();
+	    buf.write_alloc(sizeof(VnetHdr));
+	    buf.write(p, pkt.size());
+	    ver = s.ver;
+	    iphl = s.iphl;
+	    hl = s.hl;
+	    mss = s.len;
+	  }
+	else
+	  {
+	    const unsigned char *h = head();
+	    if (s.ver != ver || s.hl != hl || s.iphl != iphl
+		|| psh || last_len != mss || s.len > mss
+		|| s.seq != next_seq
+		|| buf.size() - sizeof(VnetHdr) + s.len > max)
+	      return false;
+	    if (ver == 4)
+	      {
+		if (std::memcmp(p, h, 2) || std::memcmp(p + 6, h + 6, 4) || std::memcmp(p + 12, h + 12, 8))
+		  return false;
+	      }
+	    else if (std::memcmp(p, h, 4) || std::memcmp(p + 6, h + 6, 34))
+	      return false;
+	    const unsigned char *t = p + iphl;
+	    const unsigned char *ht = h + iphl;
+	    if (std::memcmp(t, ht, 4) || std::memcmp(t + 8, ht + 8, 5)
+		|| (t[13] & ~TCP_PSH) != (ht[13] & ~TCP_PSH)
+		|| std::memcmp(t + 14, ht + 14, 2) || std::memcmp(t + 18, ht + 18, hl - iphl - 18))
+	      return false;
+	    buf.write(p + hl, s.len);
+	  }
+	++n;
+	last_len = s.len;
+	next_seq = s.seq + std::uint32_t(s.len);
+	psh = (p[iphl + 13] & TCP_PSH) != 0;
+	return true;
+      }
+
+      // Complete the headers of the pending super-packet and return it
+      // with its VnetHdr, ready to be written to the device.  A single
+      // segment is returned unchanged, behind a header with no
+      // offloads.  Call reset() once written.
+      const Buffer& finish()
+      {
+	using namespace detail;
+
+	VnetHdr vh = {};
+	if (n > 1)
+	  {
+	    unsigned char *q = head();
+	    const size_t size = buf.size() - sizeof(VnetHdr);
+	    unsigned char *tcp = q + iphl;
+	    std::uint64_t sum;
+	    if (ver == 4)
+	      {
+		IPHeader *ip = (IPHeader *)q;
+		write16(q + 2, std::uint16_t(size));
+		ip->check = 0;
+		ip->check = ip_checksum(q, (unsigned int)iphl);
+		sum = IPChecksum::pseudo_v4(q + 12, q + 16, IPHeader::TCP, std::uint32_t(size - iphl));
+		vh.gso_type = VnetHdr::GSO_TCPV4;
+	      }
+	    else
+	      {
+		write16(q + 4, std::uint16_t(size - iphl));
+		sum = IPChecksum::pseudo_v6(q + 8, q + 24, IPHeader::TCP, std::uint32_t(size - iphl));
+		vh.gso_type = VnetHdr::GSO_TCPV6;
+	      }
+	    if (psh)
+	      tcp[13] |= TCP_PSH;
+
+	    // the kernel completes the checksum from the pseudo header sum
+	    const std::uint16_t check = IPChecksum::fold(sum);
+	    std::memcpy(tcp + 16, &check, sizeof(check));
+
+	    vh.flags = VnetHdr::F_NEEDS_CSUM;
+	    vh.hdr_len = std::uint16_t(hl);
+	    vh.gso_size = std::uint16_t(mss);
+	    vh.csum_start = std::uint16_t(iphl);
+	    vh.csum_offset = 16;
+	  }
+	std::memcpy(buf.data(), &vh, sizeof(vh));
+	return buf;
+      }
+
+    private:
+      struct Seg
+      {
+	unsigned int ver;
+	size_t iphl;
+	size_t hl;
+	size_t len;
+	std::uint32_t seq;
+      };
+
+      static bool parse(const Buffer& pkt, Seg& s)
+      {
+	using namespace detail;
+
+	const unsigned char *p = pkt.c_data();
+	const size_t size = pkt.size();
+	if (!size)
+	  return false;
+	s.ver = IPHeader::version(p[0]);
+	if (s.ver == 4)
+	  {
+	    s.iphl = sizeof(IPHeader);
+	    if (size < s.iphl + TCP_HLEN
+		|| IPHeader::length(p[0]) != s.iphl
+		|| p[9] != IPHeader::TCP
+		|| read16(p + 2) != size
+		|| (read16(p + 6) & 0x3fff)) // MF or fragment offset
+	      return false;
+	  }
+	else if (s.ver == 6)
+	  {
+	    s.iphl = 40;
+	    if (size < s.iphl + TCP_HLEN
+		|| p[6] != IPHeader::TCP
+		|| read16(p + 4) + s.iphl != size)
+	      return false;
+	  }
+	else
+	  return false;
+
+	const unsigned char *tcp = p + s.iphl;
+	const size_t tcphl = size_t(tcp[12] >> 4) << 2;
+	s.hl = s.iphl + tcphl;
+	if (tcphl < TCP_HLEN || size <= s.hl
+	    || (tcp[13] & ~TCP_PSH) != TCP_ACK)
+	  return false;
+	s.len = size - s.hl;
+	s.seq = read32(tcp + 4);
+	return true;
+      }
+
+      unsigned char *head()
+      {
+	return buf.data() + sizeof(VnetHdr);
+      }
+
+      BufferAllocated buf;
+      size_t max = 0;
+      size_t n = 0;
+      unsigned int ver = 0;
+      size_t iphl = 0;
+      size_t hl = 0;
+      size_t mss = 0;
+      size_t last_len = 0;
+      std::uint32_t next_seq = 0;
+      bool psh = false;
+    };
+
+  }
+}
+
+#endif
@@ -26,6 +26,8 @@
 
 #include <cstdint> // for std::uint32_t, uint16_t, uint8_t
 
+#include <openvpn/ip/csum.hpp>
+
 #pragma pack(push)
 #pragma pack(1)
 
@@ -77,21 +79,17 @@ namespace openvpn {
 
   inline std::uint16_t ip_checksum(const void *ip, unsigned int size)
   {
-    std::uint16_t *buffer = (std::uint16_t *)ip;
-    std::uint32_t cksum = 0;
-
-    while (size > 1)
-      {
-        cksum += *buffer++;
-        size -= sizeof(uint16_t);
-      }
-
-    if (size)
-      cksum += *(uint8_t*)buffer;
+    return IPChecksum::compute(ip, size);
+  }
 
-    cksum = (cksum >> 16) + (cksum & 0xffff);
-    cksum += (cksum >> 16);
-    return ~cksum;
+  // Incrementally update an Internet checksum after one 16-bit
+  // word changed from old_word to new_word (RFC 1624, eqn. 3).
+  // All values in the same (host or network) byte order.
+  inline std::uint16_t ip_checksum_adjust(const std::uint16_t check,
+					  const std::uint16_t old_word,
+					  const std::uint16_t new_word)
+  {
+    return IPChecksum::adjust16(check, old_word, new_word);
   }
 
 }
@@ -0,0 +1,158 @@
+//    OpenVPN -- An application to securely tunnel IP networks
+//               over a single port, with support for SSL/TLS-based
+//               session authentication and key exchange,
+//               packet encryption, packet authentication, and
+//               packet compression.
+//
+//    Copyright (C) 2012-2016 OpenVPN Technologies, Inc.
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU Affero General Public License Version 3
+//    as published by the Free Software Foundation.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU Affero General Public License for more details.
+//
+//    You should have received a copy of the GNU Affero General Public License
+//    along with this program in the COPYING file.
+//    If not, see <http://www.gnu.org/licenses/>.
+// Clamp the MSS option of TCP SYN packets carried in the tunnel so
+// that TCP endpoints size their segments to fit the tunnel path.
+
+#ifndef OPENVPN_IP_MSSFIX_H
+#define OPENVPN_IP_MSSFIX_H
+
+#include <cstdint>
+#include <cstring>
+#include <algorithm> // for std::min
+
+#include <openvpn/common/size.hpp>
+#include <openvpn/common/socktypes.hpp>
+#include <openvpn/buffer/buffer.hpp>
+#include <openvpn/ip/ip.hpp>
+
+namespace openvpn {
+  namespace MSSFix {
+
+    enum {
+      IPV6_HLEN = 40,
+      TCP_HLEN = 20,
+      TCP_FLAGS_OFF = 13,
+      TCP_CHECK_OFF = 16,
+      TCP_SYN = 0x02,
+      OPT_EOL = 0,
+      OPT_NOP = 1,
+      OPT_MSS = 2,
+      OPT_MSS_LEN = 4,
+    };
+
+    namespace detail {
+      inline std::uint16_t read16(const unsigned char *p)
+      {
+	return std::uint16_t((p[0] << 8) | p[1]);
+      }
+
+      inline std::uint16_t swap16(const std::uint16_t v)
+      {
+	return std::uint16_t((v << 8) | (v >> 8));
+      }
+
+      inline void write16(unsigned char *p, const std::uint16_t v)
+      {
+	p[0] = (unsigned char)(v >> 8);
+	p[1] = (unsigned char)v;
+      }
+
+      // tcp points to a TCP header with len bytes available
+      inline bool clamp_tcp(unsigned char *tcp, const size_t len, const size_t max_mss)
+      {
+	if (len < TCP_HLEN || !(tcp[TCP_FLAGS_OFF] & TCP_SYN))
+	  return false;
+	const size_t hlen = size_t(tcp[12] >> 4) << 2;
+	if (hlen < TCP_HLEN || hlen > len)
+	  return false;
+
+	unsigned char *opt = tcp + TCP_HLEN;
+	const unsigned char *end = tcp + hlen;
+	while (opt < end)
+	  {
+	    const unsigned char kind = *opt;
+	    if (kind == OPT_EOL)
+	      break;
+	    if (kind == OPT_NOP)
+	      {
+		++opt;
+		continue;
+	      }
+	    if (end - opt < 2 || opt[1] < 2 || opt[1] > end - opt)
+	      break;
+	    if (kind == OPT_MSS && opt[1] == OPT_MSS_LEN)
+	      {
+		const std::uint16_t mss = read16(opt + 2);
+		if (mss <= max_mss)
+		  return false;
+		const std::uint16_t check = read16(tcp + TCP_CHECK_OFF);
+		write16(opt + 2, std::uint16_t(max_mss));
+		if ((opt + 2 - tcp) & 1)
+		  {
+		    // field straddles two checksum words, which in
+		    // one's complement is the same as byte-swapping it
+		    write16(tcp + TCP_CHECK_OFF, ip_checksum_adjust(check, swap16(mss), swap16(std::uint16_t(max_mss))));
+		  }
+		else
+		  write16(tcp + TCP_CHECK_OFF, ip_checksum_adjust(check, mss, std::uint16_t(max_mss)));
+		return true;
+	      }
+	    opt += opt[1];
+	  }
+	return false;
+      }
+    }
+
+    // If buf is an IPv4 or IPv6 TCP SYN whose MSS option would let
+    // segments exceed mtu-byte IP packets, lower the MSS and patch the
+    // TCP checksum in place.  Return true if buf was modified.
+    // IPv6 packets with extension headers are left alone.
+    inline bool clamp(Buffer& buf, const size_t mtu)
+    {
+      unsigned char *data = buf.data();
+      const size_t size = buf.size();
+      if (size < sizeof(IPHeader))
+	return false;
+      switch (IPHeader::version(data[0]))
+	{
+	case 4:
+	  {
+	    const IPHeader* iph = (const IPHeader*)data;
+	    const size_t hlen = IPHeader::length(iph->version_len);
+	    if (iph->protocol != IPHeader::TCP
+		|| hlen < sizeof(IPHeader)
+		|| (ntohs(iph->frag_off) & IPHeader::OFFMASK)
+		|| mtu <= sizeof(IPHeader) + TCP_HLEN)
+	      return false;
+	    return detail::clamp_tcp(data + hlen, size - std::min(size, hlen),
+				     mtu - sizeof(IPHeader) - TCP_HLEN);
+	  }
+	case 6:
+	  {
+	    enum {
+	      NEXT_HDR_OFF = 6,
+	    };
+	    if (size < IPV6_HLEN
+		|| data[NEXT_HDR_OFF] != IPHeader::TCP
+		|| mtu <= IPV6_HLEN + TCP_HLEN)
+	      return false;
+	    return detail::clamp_tcp(data + IPV6_HLEN, size - IPV6_HLEN,
+				     mtu - IPV6_HLEN - TCP_HLEN);
+	  }
+	default:
+	  return false;
+	}
+    }
+
+  }
+}
+
+#endif
@@ -0,0 +1,496 @@
+//    OpenVPN -- An application to securely tunnel IP networks
+//               over a single port, with support for SSL/TLS-based
+//               session authentication and key exchange,
+//               packet encryption, packet authentication, and
+//               packet compression.
+//
+//    Copyright (C) 2012-2016 OpenVPN Technologies, Inc.
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU Affero General Public License Version 3
+//    as published by the Free Software Foundation.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU Affero General Public License for more details.
+//
+//    You should have received a copy of the GNU Affero General Public License
+//    along with this program in the COPYING file.
+//    If not, see <http://www.gnu.org/licenses/>.
+
+// Classify inner IPv4/IPv6 packets read from the tun.  The IP and
+// TCP/UDP headers are parsed once into a small Meta struct that later
+// stages (policy, queueing, marking) can reuse, and the packet is
+// matched against up to 64 rules compiled into per-field bitsets:
+// one table lookup per field narrows the candidate rules before any
+// address or port range is compared.
+
+#ifndef OPENVPN_IP_PKTCLASS_H
+#define OPENVPN_IP_PKTCLASS_H
+
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include <openvpn/common/exception.hpp>
+#include <openvpn/common/rc.hpp>
+#include <openvpn/common/hash.hpp>
+#include <openvpn/common/number.hpp>
+#include <openvpn/common/split.hpp>
+#include <openvpn/common/string.hpp>
+#include <openvpn/common/socktypes.hpp>
+#include <openvpn/buffer/buffer.hpp>
+#include <openvpn/addr/ip.hpp>
+#include <openvpn/addr/route.hpp>
+#include <openvpn/ip/ip.hpp>
+
+namespace openvpn {
+  namespace IPClass {
+
+    OPENVPN_EXCEPTION(ip_class_error);
+
+    // parsed headers of an inner packet
+    struct Meta
+    {
+      enum Flags {
+	PORTS=(1<<0),    // sport/dport are valid
+	FRAGMENT=(1<<1), // packet is a fragment
+      };
+
+      enum {
+	IPV6_HLEN = 40,
+	TCP_FLAGS_OFF = 13,
+	IP_MF = 0x2000, // IPv4 more fragments flag
+	ICMPV6 = 58,
+      };
+
+      unsigned int dscp() const { return tos >> 2; }
+      unsigned int ecn() const { return tos & 3; }
+
+      const std::uint8_t *saddr() const { return addr; }
+      const std::uint8_t *daddr() const { return addr + 16; }
+
+      // hash of addresses, protocol, and ports, for flow queueing
+      std::size_t flow_hash() const
+      {
+	std::size_t seed = 0;
+	Hash::combine_data(seed, addr, version == 6 ? 32 : 4);
+	if (version == 4)
+	  Hash::combine_data(seed, addr + 16, 4);
+	Hash::combine(seed, proto);
+	if (flags & PORTS)
+	  Hash::combine(seed, (std::uint32_t(sport) << 16) | dport);
+	return seed;
+      }
+
+      std::uint8_t version = 0;   // 4 or 6, 0 if not parsed
+      std::uint8_t proto = 0;     // transport protocol (after IPv6 extension headers)
+      std::uint8_t tos = 0;       // IPv4 TOS or IPv6 traffic class
+      std::uint8_t flags = 0;
+      std::uint8_t tcp_flags = 0; // when proto is TCP and PORTS is set
+      std::uint16_t l4_offset = 0; // offset of the transport header
+      std::uint16_t sport = 0;    // host order
+      std::uint16_t dport = 0;    // host order
+      std::uint8_t addr[32];      // source then destination, network order,
+				  // IPv4 addresses use the first 4 bytes of each
+    };
+
+    // Parse the headers of the packet in buf into m,
+    // returns false if it isn't a well-formed IPv4/IPv6 packet.
+    inline bool parse(const Buffer& buf, Meta& m)
+    {
+      const std::uint8_t *data = buf.c_data();
+      const size_t size = buf.size();
+      m.version = 0;
+      m.flags = 0;
+      m.tcp_flags = 0;
+      m.sport = m.dport = 0;
+      if (size < 1)
+	return false;
+
+      size_t l4;
+      switch (IPHeader::version(data[0]))
+	{
+	case 4:
+	  {
+	    if (size < sizeof(IPHeader))
+	      return false;
+	    const IPHeader* iph = (const IPHeader*)data;
+	    l4 = IPHeader::length(iph->version_len);
+	    if (l4 < sizeof(IPHeader) || l4 > size)
+	      return false;
+	    m.proto = iph->protocol;
+	    m.tos = iph->tos;
+	    std::memcpy(m.addr, &iph->saddr, 4);
+	    std::memcpy(m.addr + 16, &iph->daddr, 4);
+	    const std::uint16_t frag = ntohs(iph->frag_off);
+	    if (frag & (IPHeader::OFFMASK | Meta::IP_MF))
+	      {
+		m.flags |= Meta::FRAGMENT;
+		if (frag & IPHeader::OFFMASK)
+		  l4 = 0; // no transport header in later fragments
+	      }
+	    break;
+	  }
+	case 6:
+	  {
+	    enum {
+	      NEXT_HDR_OFF = 6,
+	      SADDR_OFF = 8,
+	      HOPOPTS = 0,
+	      ROUTING = 43,
+	      FRAGMENT = 44,
+	      DSTOPTS = 60,
+	      MAX_EXT = 4,
+	    };
+	    if (size < Meta::IPV6_HLEN)
+	      return false;
+	    m.tos = std::uint8_t(((data[0] & 0x0f) << 4) | (data[1] >> 4));
+	    std::memcpy(m.addr, data + SADDR_OFF, 32);
+	    std::uint8_t next = data[NEXT_HDR_OFF];
+	    l4 = Meta::IPV6_HLEN;
+
+	    // skip the common extension headers
+	    for (int i = 0; i < MAX_EXT && l4; ++i)
+	      {
+		if (next != HOPOPTS && next != ROUTING && next != FRAGMENT && next != DSTOPTS)
+		  break;
+		if (l4 + 8 > size)
+		  return false;
+		const std::uint8_t *ext = data + l4;
+		if (next == FRAGMENT)
+		  {
+		    m.flags |= Meta::FRAGMENT;
+		    if (((ext[2] << 8) | ext[3]) & 0xfff8)
+		      l4 = 0; // not the first fragment
+		    else
+		      l4 += 8;
+		  }
+		else
+		  l4 += (size_t(ext[1]) + 1) * 8;
+		next = ext[0];
+	      }
+	    m.proto = next;
+	    break;
+	  }
+	default:
+	  return false;
+	}
+
+      m.version = IPHeader::version(data[0]);
+      m.l4_offset = std::uint16_t(l4);
+      if (l4 && (m.proto == IPHeader::TCP || m.proto == IPHeader::UDP) && l4 + 4 <= size)
+	{
+	  const std::uint8_t *p = data + l4;
+	  m.sport = std::uint16_t((p[0] << 8) | p[1]);
+	  m.dport = std::uint16_t((p[2] << 8) | p[3]);
+	  m.flags |= Meta::PORTS;
+	  if (m.proto == IPHeader::TCP && l4 + Meta::TCP_FLAGS_OFF < size)
+	    m.tcp_flags = p[Meta::TCP_FLAGS_OFF];
+	}
+      return true;
+    }
+
+    struct Rule
+    {
+      enum Action {
+	PASS,
+	DROP,
+      };
+
+      struct PortRange
+      {
+	bool any() const { return lo == 0 && hi == 0xffff; }
+	bool contains(const unsigned int port) const { return port >= lo && port <= hi; }
+
+	unsigned int lo = 0;
+	unsigned int hi = 0xffff;
+      };
+
+      // Parse a rule from space separated key=value terms, for example
+      // "proto=udp dport=53 mark=1" or "dst=10.0.0.0/8 action=drop".
+      // Keys: action (pass|drop), mark, ip (4|6), proto (tcp|udp|icmp|
+      // icmp6|number), dscp, src, dst (address[/prefix]), sport, dport
+      // (port or lo-hi).  A key left out matches anything.
+      static Rule parse(const std::string& text)
+      {
+	typedef std::vector<std::string> strvec;
+	Rule r;
+	const strvec terms = Split::by_space<strvec, StandardLex, SpaceMatch, Split::NullLimit>(text);
+	for (auto &term : terms)
+	  {
+	    const strvec kv = string::split(term, '=', 1);
+	    if (kv.size() != 2)
+	      OPENVPN_THROW(ip_class_error, "rule term must be key=value: " << term);
+	    const std::string& k = kv[0];
+	    const std::string& v = kv[1];
+	    if (k == "action")
+	      {
+		if (v == "pass")
+		  r.action = PASS;
+		else if (v == "drop")
+		  r.action = DROP;
+		else
+		  OPENVPN_THROW(ip_class_error, "unknown rule action: " << v);
+	      }
+	    else if (k == "mark")
+	      r.mark = parse_number_throw<unsigned int>(v, "rule mark");
+	    else if (k == "ip")
+	      {
+		r.version = parse_number_throw<unsigned int>(v, "rule ip version");
+		if (r.version != 4 && r.version != 6)
+		  OPENVPN_THROW(ip_class_error, "rule ip version must be 4 or 6: " << v);
+	      }
+	    else if (k == "proto")
+	      r.proto = parse_proto(v);
+	    else if (k == "dscp")
+	      {
+		r.dscp = parse_number_throw<int>(v, "rule dscp");
+		if (r.dscp < 0 || r.dscp > 63)
+		  OPENVPN_THROW(ip_class_error, "rule dscp out of range: " << v);
+	      }
+	    else if (k == "src")
+	      r.src = IP::Route(v, "rule src");
+	    else if (k == "dst")
+	      r.dst = IP::Route(v, "rule dst");
+	    else if (k == "sport")
+	      r.sport = parse_ports(v);
+	    else if (k == "dport")
+	      r.dport = parse_ports(v);
+	    else
+	      OPENVPN_THROW(ip_class_error, "unknown rule key: " << k);
+	  }
+	return r;
+      }
+
+      Action action = PASS;
+      unsigned int mark = 0;  // passed on to later stages
+      unsigned int version = 0; // 0 for any
+      int proto = -1;         // -1 for any
+      int dscp = -1;          // -1 for any
+      IP::Route src;          // undefined for any
+      IP::Route dst;
+      PortRange sport;
+      PortRange dport;
+
+    private:
+      static int parse_proto(const std::string& v)
+      {
+	if (v == "tcp")
+	  return IPHeader::TCP;
+	else if (v == "udp")
+	  return IPHeader::UDP;
+	else if (v == "icmp")
+	  return IPHeader::ICMP;
+	else if (v == "icmp6")
+	  return Meta::ICMPV6;
+	const int p = parse_number_throw<int>(v, "rule proto");
+	if (p < 0 || p > 255)
+	  OPENVPN_THROW(ip_class_error, "rule proto out of range: " << v);
+	return p;
+      }
+
+      static PortRange parse_ports(const std::string& v)
+      {
+	const std::vector<std::string> lh = string::split(v, '-', 1);
+	PortRange pr;
+	pr.lo = parse_number_throw<unsigned int>(lh[0], "rule port");
+	pr.hi = lh.size() == 2 ? parse_number_throw<unsigned int>(lh[1], "rule port") : pr.lo;
+	if (pr.lo > pr.hi || pr.hi > 0xffff)
+	  OPENVPN_THROW(ip_class_error, "bad rule port range: " << v);
+	return pr;
+      }
+    };
+
+    // First matching rule wins, in the order rules were added.
+    class Classifier : public RC<thread_unsafe_refcount>
+    {
+    public:
+      typedef RCPtr<Classifier> Ptr;
+
+      enum {
+	MAX_RULES = 64,
+      };
+
+      struct Result
+      {
+	Rule::Action action = Rule::PASS;
+	unsigned int mark = 0;
+	int rule = -1; // index of the matching rule, -1 if none
+      };
+
+      Classifier()
+      {
+	std::memset(version_mask, 0, sizeof(version_mask));
+	std::memset(proto_mask, 0, sizeof(proto_mask));
+	std::memset(dscp_mask, 0, sizeof(dscp_mask));
+      }
+
+      // one rule per line, blank lines and '#' comments are ignored
+      static Ptr parse(const std::string& text)
+      {
+	Ptr c(new Classifier());
+	for (auto &line : string::split(text, '\n'))
+	  {
+	    const std::string r = string::trim_copy(line);
+	    if (!r.empty() && r[0] != '#')
+	      c->add(Rule::parse(r));
+	  }
+	return c;
+      }
+
+      void add(const Rule& r)
+      {
+	const size_t i = rules.size();
+	if (i >= MAX_RULES)
+	  OPENVPN_THROW(ip_class_error, "too many classifier rules, max is " << int(MAX_RULES));
+	rules.push_back(compile(r));
+	const std::uint64_t bit = std::uint64_t(1) << i;
+
+	for (unsigned int v = 0; v < 2; ++v)
+	  if (!r.version || r.version == (v ? 6u : 4u))
+	    version_mask[v] |= bit;
+	for (int p = 0; p < 256; ++p)
+	  if (r.proto < 0 || r.proto == p)
+	    proto_mask[p] |= bit;
+	for (int d = 0; d < 64; ++d)
+	  if (r.dscp < 0 || r.dscp == d)
+	    dscp_mask[d] |= bit;
+	if (!r.sport.any() || !r.dport.any())
+	  ports_mask |= bit;
+      }
+
+      size_t size() const
+      {
+	return rules.size();
+      }
+
+      bool empty() const
+      {
+	return rules.empty();
+      }
+
+      Result classify(const Meta& m) const
+      {
+	Result res;
+	if (!m.version)
+	  return res;
+	std::uint64_t cand = version_mask[m.version == 6]
+	  & proto_mask[m.proto]
+	  & dscp_mask[m.dscp()];
+	if (!(m.flags & Meta::PORTS))
+	  cand &= ~ports_mask;
+	while (cand)
+	  {
+	    const unsigned int i = lowest_bit(cand);
+	    cand &= cand - 1;
+	    const Compiled& c = rules[i];
+	    if (c.src.match(m.version, m.saddr())
+		&& c.dst.match(m.version, m.daddr())
+		&& c.sport.contains(m.sport)
+		&& c.dport.contains(m.dport))
+	      {
+		res.action = c.action;
+		res.mark = c.mark;
+		res.rule = int(i);
+		return res;
+	      }
+	  }
+	return res;
+      }
+
+    private:
+      // address prefix as network order bytes
+      struct Prefix
+      {
+	bool match(const unsigned int ver, const std::uint8_t *a) const
+	{
+	  if (!version)
+	    return true;
+	  if (version != ver)
+	    return false;
+	  const unsigned int full = prefix_len >> 3;
+	  if (std::memcmp(a, bytes, full))
+	    return false;
+	  const unsigned int rem = prefix_len & 7;
+	  if (!rem)
+	    return true;
+	  const std::uint8_t mask = std::uint8_t(0xff << (8 - rem));
+	  return (a[full] & mask) == bytes[full];
+	}
+
+	unsigned int version = 0; // 0 for any
+	unsigned int prefix_len = 0;
+	std::uint8_t bytes[16];
+      };
+
+      struct Compiled
+      {
+	Rule::Action action;
+	unsigned int mark;
+	Prefix src;
+	Prefix dst;
+	Rule::PortRange sport;
+	Rule::PortRange dport;
+      };
+
+      static Prefix compile_prefix(const IP::Route& route)
+      {
+	Prefix p;
+	std::memset(p.bytes, 0, sizeof(p.bytes));
+	if (!route.addr.defined())
+	  return p;
+	if (!route.is_canonical())
+	  OPENVPN_THROW(ip_class_error, "rule address has host bits set: " << route.to_string());
+	if (route.version() == IP::Addr::V4)
+	  {
+	    const std::uint32_t a = route.addr.to_uint32_net();
+	    std::memcpy(p.bytes, &a, 4);
+	    p.version = 4;
+	  }
+	else if (route.version() == IP::Addr::V6)
+	  {
+	    route.addr.to_byte_string(p.bytes);
+	    p.version = 6;
+	  }
+	p.prefix_len = route.prefix_len;
+	return p;
+      }
+
+      static Compiled compile(const Rule& r)
+      {
+	Compiled c;
+	c.action = r.action;
+	c.mark = r.mark;
+	c.src = compile_prefix(r.src);
+	c.dst = compile_prefix(r.dst);
+	c.sport = r.sport;
+	c.dport = r.dport;
+	return c;
+      }
+
+      static unsigned int lowest_bit(const std::uint64_t v)
+      {
+#if defined(__GNUC__)
+	return unsigned(__builtin_ctzll(v));
+#else
+	unsigned int i = 0;
+	while (!(v & (std::uint64_t(1) << i)))
+	  ++i;
+	return i;
+#endif
+      }
+
+      std::vector<Compiled> rules;
+      std::uint64_t version_mask[2];
+      std::uint64_t proto_mask[256];
+      std::uint64_t dscp_mask[64];
+      std::uint64_t ports_mask = 0; // rules that need ports
+    };
+
+  }
+}
+
+#endif
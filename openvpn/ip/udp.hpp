@@ -45,37 +45,12 @@ namespace openvpn {
 				     const std::uint8_t *src_addr,
 				     const std::uint8_t *dest_addr)
   {
-    std::uint32_t sum = 0;
+    const std::uint64_t sum = IPChecksum::pseudo_v4(src_addr, dest_addr, IPHeader::UDP, len_udp);
+    const std::uint16_t check = IPChecksum::compute(buf, len_udp, sum);
 
-    /* make 16 bit words out of every two adjacent 8 bit words and  */
-    /* calculate the sum of all 16 bit words */
-    for (unsigned int i = 0; i < len_udp; i += 2)
-      {
-	std::uint16_t word16 = ((buf[i] << 8) & 0xFF00) + ((i + 1 < len_udp) ? (buf[i+1] & 0xFF) : 0);
-	sum += word16;
-      }
-
-    /* add the UDP pseudo header which contains the IP source and destination addresses */
-    for (unsigned int i = 0; i < 4; i += 2)
-      {
-	std::uint16_t word16 =((src_addr[i] << 8) & 0xFF00) + (src_addr[i+1] & 0xFF);
-	sum += word16;
-      }
-    for (unsigned int i = 0; i < 4; i += 2)
-      {
-	std::uint16_t word16 =((dest_addr[i] << 8) & 0xFF00) + (dest_addr[i+1] & 0xFF);
-	sum += word16;
-      }
-
-    /* the protocol number and the length of the UDP packet */
-    sum += (std::uint16_t)IPHeader::UDP + (std::uint16_t)len_udp;
-
-    /* keep only the last 16 bits of the 32 bit calculated sum and add the carries */
-    while (sum >> 16)
-      sum = (sum & 0xFFFF) + (sum >> 16);
-
-    /* take the one's complement of sum */
-    return std::uint16_t(~sum);
+    // return in host byte order
+    const std::uint8_t *c = (const std::uint8_t *)&check;
+    return std::uint16_t((c[0] << 8) | c[1]);
   }
 
 }
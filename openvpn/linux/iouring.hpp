@@ -0,0 +1,457 @@
+//    OpenVPN -- An application to securely tunnel IP networks
+//               over a single port, with support for SSL/TLS-based
+//               session authentication and key exchange,
+//               packet encryption, packet authentication, and
+//               packet compression.
+//
+//    Copyright (C) 2012-2016 OpenVPN Technologies, Inc.
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU Affero General Public License Version 3
+//    as published by the Free Software Foundation.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU Affero General Public License for more details.
+//
+//    You should have received a copy of the GNU Affero General Public License
+//    along with this program in the COPYING file.
+//    If not, see <http://www.gnu.org/licenses/>.
+
+// Minimal io_uring engine for the data path, without liburing.
+// One ring is shared per thread and io_context.  Completions are
+// signalled through an eventfd that asio waits on, so io_uring and
+// reactor-driven I/O run side by side on the same io_context.
+// Submissions are gathered and flushed with one io_uring_enter()
+// per io_context handler run.  Requires Linux 5.19 (provided buffer
+// rings).
+
+#ifndef OPENVPN_LINUX_IOURING_H
+#define OPENVPN_LINUX_IOURING_H
+
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <algorithm>
+
+#include <errno.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/eventfd.h>
+#include <linux/io_uring.h>
+
+#include <asio.hpp>
+
+#include <openvpn/common/exception.hpp>
+#include <openvpn/common/rc.hpp>
+#include <openvpn/common/scoped_fd.hpp>
+
+namespace openvpn {
+
+  class IOUring : public RC<thread_unsafe_refcount>
+  {
+  public:
+    typedef RCPtr<IOUring> Ptr;
+
+    OPENVPN_EXCEPTION(io_uring_error);
+
+    // Target of a completion.  The SQE user_data holds the sink
+    // address with a 3 bit tag in the low bits.  Function pointers
+    // rather than virtuals, so that templates only instantiate the
+    // callbacks when io_uring is actually used.
+    struct Sink
+    {
+      typedef void (*Complete)(Sink* sink, const struct io_uring_cqe& cqe, const unsigned int tag);
+      typedef void (*Flush)(Sink* sink);
+
+      Sink(Complete complete_arg, Flush flush_arg = nullptr)
+	: complete(complete_arg),
+	  flush(flush_arg),
+	  flush_pending(false)
+      {
+      }
+
+      Complete complete;
+      Flush flush;        // optional, called once after a completion pass
+      bool flush_pending;
+    };
+
+    // Provided buffer ring.  The kernel picks a buffer for each
+    // receive, and the buffer is handed back with recycle() once
+    // its contents have been consumed.
+    class BufRing
+    {
+    public:
+      BufRing(IOUring& uring_arg, const unsigned int entries_arg, const size_t buf_size_arg)
+	: uring(&uring_arg),
+	  entries(round_pow2(entries_arg)),
+	  buf_size(buf_size_arg),
+	  ring(nullptr),
+	  mem(nullptr),
+	  tail(0),
+	  bgid_(uring_arg.next_bgid++)
+      {
+	ring_bytes = entries * sizeof(struct io_uring_buf);
+	void *r = ::mmap(nullptr, ring_bytes, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+	if (r == MAP_FAILED)
+	  throw io_uring_error("buffer ring mmap failed");
+	ring = (struct io_uring_buf_ring *)r;
+	mem_bytes = entries * buf_size;
+	void *m = ::mmap(nullptr, mem_bytes, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+	if (m == MAP_FAILED)
+	  {
+	    ::munmap(ring, ring_bytes);
+	    throw io_uring_error("buffer mmap failed");
+	  }
+	mem = (unsigned char *)m;
+
+	struct io_uring_buf_reg reg;
+	std::memset(&reg, 0, sizeof(reg));
+	reg.ring_addr = (std::uint64_t)ring;
+	reg.ring_entries = entries;
+	reg.bgid = bgid_;
+	if (uring->register_(IORING_REGISTER_PBUF_RING, &reg, 1) < 0)
+	  {
+	    const int eno = errno;
+	    ::munmap(mem, mem_bytes);
+	    ::munmap(ring, ring_bytes);
+	    OPENVPN_THROW(io_uring_error, "IORING_REGISTER_PBUF_RING: " << std::strerror(eno));
+	  }
+	for (unsigned int i = 0; i < entries; ++i)
+	  add(i);
+	publish();
+      }
+
+      ~BufRing()
+      {
+	struct io_uring_buf_reg reg;
+	std::memset(&reg, 0, sizeof(reg));
+	reg.bgid = bgid_;
+	uring->register_(IORING_UNREGISTER_PBUF_RING, &reg, 1);
+	::munmap(mem, mem_bytes);
+	::munmap(ring, ring_bytes);
+      }
+
+      BufRing(const BufRing&) = delete;
+      BufRing& operator=(const BufRing&) = delete;
+
+      unsigned char *buf(const unsigned int bid) const
+      {
+	return mem + size_t(bid) * buf_size;
+      }
+
+      void recycle(const unsigned int bid)
+      {
+	add(bid);
+	publish();
+      }
+
+      unsigned int bgid() const { return bgid_; }
+      size_t size() const { return buf_size; }
+
+    private:
+      static unsigned int round_pow2(const unsigned int n)
+      {
+	unsigned int r = 1;
+	while (r < n && r < 32768)
+	  r <<= 1;
+	return r;
+      }
+
+      void add(const unsigned int bid)
+      {
+	// Index from the ring start rather than through ring->bufs,
+	// the uapi flexible array is misplaced when compiled as C++.
+	struct io_uring_buf& b = ((struct io_uring_buf *)ring)[tail & (entries - 1)];
+	b.addr = (std::uint64_t)buf(bid);
+	b.len = (std::uint32_t)buf_size;
+	b.bid = (std::uint16_t)bid;
+	++tail;
+      }
+
+      void publish()
+      {
+	__atomic_store_n(&ring->tail, tail, __ATOMIC_RELEASE);
+      }
+
+      IOUring::Ptr uring;
+      const unsigned int entries;
+      const size_t buf_size;
+      size_t ring_bytes;
+      size_t mem_bytes;
+      struct io_uring_buf_ring *ring;
+      unsigned char *mem;
+      std::uint16_t tail;
+      const unsigned int bgid_;
+    };
+
+    // Return the ring of this thread, creating it if needed.  Every
+    // user must attach() while it has operations in flight, the ring
+    // shuts down when the last user detaches.
+    static Ptr instance(asio::io_context& io_context, const unsigned int entries = 1024)
+    {
+      IOUring*& cur = current();
+      if (cur && &cur->io_context == &io_context)
+	return Ptr(cur);
+      Ptr u(new IOUring(io_context, entries));
+      if (!cur)
+	cur = u.get();
+      return u;
+    }
+
+    static std::uint64_t user_data(Sink* sink, const unsigned int tag)
+    {
+      return (std::uint64_t)sink | (tag & TAG_MASK);
+    }
+
+    // Next free submission entry, zeroed.  The submission itself
+    // happens at the end of the current handler run.
+    struct io_uring_sqe *get_sqe()
+    {
+      if (sqe_tail - __atomic_load_n(sq_head, __ATOMIC_ACQUIRE) >= sq_entries)
+	{
+	  submit();
+	  if (sqe_tail - __atomic_load_n(sq_head, __ATOMIC_ACQUIRE) >= sq_entries)
+	    return nullptr;
+	}
+      struct io_uring_sqe *sqe = &sqes[sqe_tail & sq_mask];
+      ++sqe_tail;
+      std::memset(sqe, 0, sizeof(*sqe));
+      schedule_submit();
+      return sqe;
+    }
+
+    // Cancel every operation whose user_data matches.
+    void cancel(const std::uint64_t target)
+    {
+      struct io_uring_sqe *sqe = get_sqe();
+      if (sqe)
+	{
+	  sqe->opcode = IORING_OP_ASYNC_CANCEL;
+	  sqe->fd = -1;
+	  sqe->addr = target;
+	  sqe->cancel_flags = IORING_ASYNC_CANCEL_ALL;
+	  sqe->user_data = 0;
+	}
+    }
+
+    // Ask for sink->flush() after the current completion pass.
+    void flush_at_end(Sink* sink)
+    {
+      if (!sink->flush_pending)
+	{
+	  sink->flush_pending = true;
+	  flush_list.push_back(sink);
+	}
+    }
+
+    void submit()
+    {
+      const unsigned int to_submit = sqe_tail - submitted;
+      if (!to_submit || halt)
+	return;
+      __atomic_store_n(sq_tail, sqe_tail, __ATOMIC_RELEASE);
+      const int ret = (int)::syscall(__NR_io_uring_enter, ring_fd(), to_submit, 0, 0, nullptr, 0);
+      if (ret > 0)
+	submitted += ret;
+    }
+
+    void attach()
+    {
+      ++users;
+    }
+
+    void detach()
+    {
+      if (users && !--users)
+	shutdown();
+    }
+
+    asio::io_context& context() { return io_context; }
+
+    ~IOUring()
+    {
+      shutdown();
+      if (sqes)
+	::munmap(sqes, sqes_bytes);
+      if (ring_ptr)
+	::munmap(ring_ptr, ring_bytes);
+    }
+
+  private:
+    enum {
+      TAG_MASK = 7,
+    };
+
+    IOUring(asio::io_context& io_context_arg, const unsigned int entries)
+      : io_context(io_context_arg),
+	efd_stream(io_context_arg)
+    {
+      struct io_uring_params p;
+      std::memset(&p, 0, sizeof(p));
+      // No IORING_SETUP_COOP_TASKRUN: the thread mostly sleeps in
+      // epoll_wait(), and deferred task work would stall completions.
+      p.flags = IORING_SETUP_SUBMIT_ALL;
+      int fd = (int)::syscall(__NR_io_uring_setup, entries, &p);
+      if (fd < 0 && errno == EINVAL)
+	{
+	  // kernel without the setup flags
+	  std::memset(&p, 0, sizeof(p));
+	  fd = (int)::syscall(__NR_io_uring_setup, entries, &p);
+	}
+      if (fd < 0)
+	OPENVPN_THROW(io_uring_error, "io_uring_setup: " << std::strerror(errno));
+      ring_fd.reset(fd);
+      if (!(p.features & IORING_FEAT_SINGLE_MMAP))
+	throw io_uring_error("kernel too old");
+
+      ring_bytes = std::max(p.sq_off.array + p.sq_entries * sizeof(unsigned int),
+			    p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe));
+      void *r = ::mmap(nullptr, ring_bytes, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+      if (r == MAP_FAILED)
+	throw io_uring_error("ring mmap failed");
+      ring_ptr = (unsigned char *)r;
+      sqes_bytes = p.sq_entries * sizeof(struct io_uring_sqe);
+      void *s = ::mmap(nullptr, sqes_bytes, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_POPULATE, fd, IORING_OFF_SQES);
+      if (s == MAP_FAILED)
+	throw io_uring_error("sqe mmap failed");
+      sqes = (struct io_uring_sqe *)s;
+
+      sq_head = (unsigned int *)(ring_ptr + p.sq_off.head);
+      sq_tail = (unsigned int *)(ring_ptr + p.sq_off.tail);
+      sq_mask = *(unsigned int *)(ring_ptr + p.sq_off.ring_mask);
+      sq_entries = p.sq_entries;
+      cq_head = (unsigned int *)(ring_ptr + p.cq_off.head);
+      cq_tail = (unsigned int *)(ring_ptr + p.cq_off.tail);
+      cq_mask = *(unsigned int *)(ring_ptr + p.cq_off.ring_mask);
+      cqes = (struct io_uring_cqe *)(ring_ptr + p.cq_off.cqes);
+      unsigned int *sq_array = (unsigned int *)(ring_ptr + p.sq_off.array);
+      for (unsigned int i = 0; i < sq_entries; ++i)
+	sq_array[i] = i;
+      sqe_tail = submitted = *sq_tail;
+
+      // completion notification through asio
+      const int efd = ::eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+      if (efd < 0)
+	OPENVPN_THROW(io_uring_error, "eventfd: " << std::strerror(errno));
+      efd_stream.assign(efd);
+      if (register_(IORING_REGISTER_EVENTFD, &efd, 1) < 0)
+	OPENVPN_THROW(io_uring_error, "IORING_REGISTER_EVENTFD: " << std::strerror(errno));
+      queue_wait();
+    }
+
+    static IOUring*& current()
+    {
+      static thread_local IOUring* cur = nullptr;
+      return cur;
+    }
+
+    int register_(const unsigned int opcode, const void *arg, const unsigned int nr_args)
+    {
+      return (int)::syscall(__NR_io_uring_register, ring_fd(), opcode, arg, nr_args);
+    }
+
+    void schedule_submit()
+    {
+      if (!submit_pending)
+	{
+	  submit_pending = true;
+	  asio::post(io_context, [self=Ptr(this)]()
+		     {
+		       self->submit_pending = false;
+		       self->submit();
+		     });
+	}
+    }
+
+    void queue_wait()
+    {
+      efd_stream.async_wait(asio::posix::stream_descriptor::wait_read,
+			    [self=Ptr(this)](const asio::error_code& error)
+			    {
+			      if (!error && !self->halt)
+				{
+				  std::uint64_t count;
+				  while (::read(self->efd_stream.native_handle(), &count, sizeof(count)) > 0)
+				    ;
+				  self->reap();
+				  if (!self->halt)
+				    self->queue_wait();
+				}
+			    });
+    }
+
+    // dispatch all posted completions, then the requested flushes
+    void reap()
+    {
+      unsigned int head = *cq_head;
+      unsigned int tail;
+      while (head != (tail = __atomic_load_n(cq_tail, __ATOMIC_ACQUIRE)))
+	{
+	  while (head != tail)
+	    {
+	      const struct io_uring_cqe cqe = cqes[head & cq_mask];
+	      ++head;
+	      __atomic_store_n(cq_head, head, __ATOMIC_RELEASE);
+	      Sink* sink = (Sink *)(cqe.user_data & ~std::uint64_t(TAG_MASK));
+	      if (sink)
+		sink->complete(sink, cqe, unsigned(cqe.user_data & TAG_MASK));
+	    }
+	}
+      for (size_t i = 0; i < flush_list.size(); ++i)
+	{
+	  Sink* sink = flush_list[i];
+	  sink->flush_pending = false;
+	  sink->flush(sink);
+	}
+      flush_list.clear();
+      submit();
+    }
+
+    void shutdown()
+    {
+      if (!halt)
+	{
+	  halt = true;
+	  IOUring*& cur = current();
+	  if (cur == this)
+	    cur = nullptr;
+	  asio::error_code ec;
+	  efd_stream.close(ec);
+	}
+    }
+
+    asio::io_context& io_context;
+    asio::posix::stream_descriptor efd_stream;
+    ScopedFD ring_fd;
+
+    unsigned char *ring_ptr = nullptr;
+    size_t ring_bytes = 0;
+    struct io_uring_sqe *sqes = nullptr;
+    size_t sqes_bytes = 0;
+
+    unsigned int *sq_head = nullptr;
+    unsigned int *sq_tail = nullptr;
+    unsigned int sq_mask = 0;
+    unsigned int sq_entries = 0;
+    unsigned int sqe_tail = 0;
+    unsigned int submitted = 0;
+
+    unsigned int *cq_head = nullptr;
+    unsigned int *cq_tail = nullptr;
+    unsigned int cq_mask = 0;
+    struct io_uring_cqe *cqes = nullptr;
+
+    std::vector<Sink*> flush_list;
+    unsigned int next_bgid = 1;
+    unsigned int users = 0;
+    bool submit_pending = false;
+    bool halt = false;
+  };
+
+}
+
+#endif
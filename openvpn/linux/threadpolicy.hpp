@@ -0,0 +1,233 @@
+//    OpenVPN -- An application to securely tunnel IP networks
+//               over a single port, with support for SSL/TLS-based
+//               session authentication and key exchange,
+//               packet encryption, packet authentication, and
+//               packet compression.
+//
+//    Copyright (C) 2012-2016 OpenVPN Technologies, Inc.
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU Affero General Public License Version 3
+//    as published by the Free Software Foundation.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU Affero General Public License for more details.
+//
+//    You should have received a copy of the GNU Affero General Public License
+//    along with this program in the COPYING file.
+//    If not, see <http://www.gnu.org/licenses/>.
+
+// Linux/Android thread placement policy for heterogeneous
+// (big.LITTLE) CPUs: move a thread between performance and
+// efficiency cores and adjust its nice value based on traffic.
+
+#ifndef OPENVPN_LINUX_THREADPOLICY_H
+#define OPENVPN_LINUX_THREADPOLICY_H
+
+#include <sched.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <sys/resource.h>
+
+#include <string>
+#include <vector>
+#include <fstream>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <functional>
+#include <cstdint>
+
+#include <openvpn/common/exception.hpp>
+#include <openvpn/common/format.hpp>
+
+namespace openvpn {
+
+  // Performance and efficiency cores, ranked by the kernel's
+  // cpu_capacity, or by maximum frequency if capacity isn't exposed.
+  struct CoreClasses
+  {
+    static CoreClasses detect()
+    {
+      CoreClasses ret;
+      std::vector<long> rank;
+      long best = -1;
+      const int n = (int)::sysconf(_SC_NPROCESSORS_CONF);
+      for (int cpu = 0; cpu < n && cpu < CPU_SETSIZE; ++cpu)
+	{
+	  const std::string dir = "/sys/devices/system/cpu/cpu" + openvpn::to_string(cpu);
+	  long r = read_long(dir + "/cpu_capacity");
+	  if (r < 0)
+	    r = read_long(dir + "/cpufreq/cpuinfo_max_freq");
+	  rank.push_back(r); // -1 if unknown
+	  if (r > best)
+	    best = r;
+	}
+      for (size_t i = 0; i < rank.size(); ++i)
+	(rank[i] == best ? ret.performance : ret.efficiency).push_back((int)i);
+      return ret;
+    }
+
+    bool heterogeneous() const
+    {
+      return !performance.empty() && !efficiency.empty();
+    }
+
+    std::vector<int> performance;
+    std::vector<int> efficiency;
+
+  private:
+    static long read_long(const std::string& fn)
+    {
+      std::ifstream f(fn);
+      long v;
+      if (f >> v)
+	return v;
+      return -1;
+    }
+  };
+
+  class ThreadPolicy
+  {
+  public:
+    OPENVPN_EXCEPTION(thread_policy_error);
+
+    enum Mode {
+      NONE,
+      PERFORMANCE, // always on performance cores at raised priority
+      EFFICIENCY,  // always on efficiency cores at normal priority
+      ADAPTIVE,    // performance while traffic flows, efficiency when idle
+    };
+
+    static Mode parse_mode(const std::string& str)
+    {
+      if (str.empty() || str == "none")
+	return NONE;
+      else if (str == "performance")
+	return PERFORMANCE;
+      else if (str == "efficiency")
+	return EFFICIENCY;
+      else if (str == "adaptive")
+	return ADAPTIVE;
+      else
+	throw thread_policy_error("unknown thread policy: " + str);
+    }
+
+    enum {
+      SAMPLE_MS = 500,
+      ACTIVE_BYTES_PER_SEC = 64*1024, // traffic that counts as flowing
+      IDLE_SAMPLES = 10,              // quiet samples before dropping back
+      PERFORMANCE_NICE = -4,
+    };
+
+    // Apply mode to the calling thread.  For ADAPTIVE, traffic()
+    // returns a running byte count, sampled from a helper thread
+    // that moves the calling thread as the rate changes.
+    ThreadPolicy(const Mode mode, std::function<std::uint64_t()> traffic_arg)
+      : tid((pid_t)::syscall(SYS_gettid)),
+	cores(CoreClasses::detect()),
+	traffic(std::move(traffic_arg))
+    {
+      switch (mode)
+	{
+	case PERFORMANCE:
+	  place(true);
+	  break;
+	case EFFICIENCY:
+	  place(false);
+	  break;
+	case ADAPTIVE:
+	  place(false);
+	  monitor = std::thread([this]() { adapt(); });
+	  break;
+	default:
+	  break;
+	}
+    }
+
+    ~ThreadPolicy()
+    {
+      if (monitor.joinable())
+	{
+	  {
+	    std::lock_guard<std::mutex> lock(mutex);
+	    halt = true;
+	  }
+	  cv.notify_all();
+	  monitor.join();
+	}
+      if (placed)
+	place_cores(all_cores(), 0);
+    }
+
+  private:
+    void adapt()
+    {
+      std::uint64_t last = traffic();
+      unsigned int quiet = 0;
+      std::unique_lock<std::mutex> lock(mutex);
+      while (!cv.wait_for(lock, std::chrono::milliseconds(SAMPLE_MS), [this]() { return halt; }))
+	{
+	  const std::uint64_t now = traffic();
+	  const bool active = (now - last) * 1000 / SAMPLE_MS >= ACTIVE_BYTES_PER_SEC;
+	  last = now;
+	  if (active)
+	    {
+	      quiet = 0;
+	      if (!fast)
+		place(true);
+	    }
+	  else if (fast && ++quiet >= IDLE_SAMPLES)
+	    place(false);
+	}
+    }
+
+    void place(const bool performance)
+    {
+      fast = performance;
+      placed = true;
+      if (cores.heterogeneous())
+	place_cores(performance ? cores.performance : cores.efficiency, performance ? PERFORMANCE_NICE : 0);
+      else
+	place_cores(std::vector<int>(), performance ? PERFORMANCE_NICE : 0);
+    }
+
+    // failures are ignored, since placement is only a hint and
+    // raising priority may not be permitted
+    void place_cores(const std::vector<int>& cpus, const int nice)
+    {
+      if (!cpus.empty())
+	{
+	  cpu_set_t set;
+	  CPU_ZERO(&set);
+	  for (auto c : cpus)
+	    CPU_SET(c, &set);
+	  ::sched_setaffinity(tid, sizeof(set), &set);
+	}
+      ::setpriority(PRIO_PROCESS, (id_t)tid, nice);
+    }
+
+    std::vector<int> all_cores() const
+    {
+      std::vector<int> ret(cores.performance);
+      ret.insert(ret.end(), cores.efficiency.begin(), cores.efficiency.end());
+      return ret;
+    }
+
+    const pid_t tid;
+    const CoreClasses cores;
+    std::function<std::uint64_t()> traffic;
+    bool fast = false;
+    bool placed = false;
+    std::mutex mutex;
+    std::condition_variable cv;
+    bool halt = false;
+    std::thread monitor;
+  };
+
+}
+
+#endif
@@ -0,0 +1,369 @@
+//    OpenVPN -- An application to securely tunnel IP networks
+//               over a single port, with support for SSL/TLS-based
+//               session authentication and key exchange,
+//               packet encryption, packet authentication, and
+//               packet compression.
+//
+//    Copyright (C) 2012-2016 OpenVPN Technologies, Inc.
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU Affero General Public License Version 3
+//    as published by the Free Software Foundation.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU Affero General Public License for more details.
+//
+//    You should have received a copy of the GNU Affero General Public License
+//    along with this program in the COPYING file.
+//    If not, see <http://www.gnu.org/licenses/>.
+
+// CPU and NUMA layout for multi-threaded servers: assign each server
+// thread a core, preferring the cores that service the NIC's RSS
+// queues, and bind the thread's memory allocations to its local node.
+
+#ifndef OPENVPN_LINUX_TOPOLOGY_H
+#define OPENVPN_LINUX_TOPOLOGY_H
+
+#include <sched.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/syscall.h>
+#include <linux/mempolicy.h>
+
+#include <string>
+#include <vector>
+#include <fstream>
+#include <sstream>
+#include <algorithm>
+#include <cstdlib>
+
+#include <openvpn/common/exception.hpp>
+#include <openvpn/common/format.hpp>
+#include <openvpn/common/options.hpp>
+
+namespace openvpn {
+  namespace ThreadTopology {
+
+    OPENVPN_EXCEPTION(thread_topology_error);
+
+    // parse a sysfs cpu list such as "0-3,8,10-11"
+    inline std::vector<int> parse_cpulist(const std::string& str)
+    {
+      std::vector<int> ret;
+      std::istringstream is(str);
+      std::string item;
+      while (std::getline(is, item, ','))
+	{
+	  if (item.empty() || item == "\n")
+	    continue;
+	  char *end = nullptr;
+	  const long first = std::strtol(item.c_str(), &end, 10);
+	  long last = first;
+	  if (*end == '-')
+	    last = std::strtol(end + 1, nullptr, 10);
+	  for (long c = first; c <= last && c >= 0 && c < CPU_SETSIZE; ++c)
+	    ret.push_back((int)c);
+	}
+      return ret;
+    }
+
+    // parse a sysfs hex cpu mask such as "00000000,0000000f"
+    inline std::vector<int> parse_cpumask(const std::string& str)
+    {
+      std::vector<int> ret;
+      int bit = 0;
+      for (auto i = str.rbegin(); i != str.rend(); ++i)
+	{
+	  const char c = *i;
+	  int v;
+	  if (c >= '0' && c <= '9')
+	    v = c - '0';
+	  else if (c >= 'a' && c <= 'f')
+	    v = c - 'a' + 10;
+	  else if (c >= 'A' && c <= 'F')
+	    v = c - 'A' + 10;
+	  else
+	    continue;
+	  for (int b = 0; b < 4; ++b)
+	    if (v & (1 << b) && bit + b < CPU_SETSIZE)
+	      ret.push_back(bit + b);
+	  bit += 4;
+	}
+      std::sort(ret.begin(), ret.end());
+      return ret;
+    }
+
+    inline std::string read_line(const std::string& fn)
+    {
+      std::ifstream f(fn);
+      std::string line;
+      std::getline(f, line);
+      return line;
+    }
+
+    inline int read_int(const std::string& fn, const int def)
+    {
+      const std::string line = read_line(fn);
+      if (line.empty())
+	return def;
+      return std::atoi(line.c_str());
+    }
+
+    struct CPU
+    {
+      int id = -1;
+      int core = -1;    // physical core id, shared by SMT siblings
+      int package = -1;
+      int node = -1;    // NUMA node, -1 if unknown
+      bool primary = true; // first SMT thread of its core
+    };
+
+    // online CPUs, ordered by id
+    inline std::vector<CPU> cpus()
+    {
+      std::vector<CPU> ret;
+      std::vector<int> ids = parse_cpulist(read_line("/sys/devices/system/cpu/online"));
+      if (ids.empty())
+	for (int i = 0; i < (int)::sysconf(_SC_NPROCESSORS_ONLN) && i < CPU_SETSIZE; ++i)
+	  ids.push_back(i);
+
+      std::vector<int> node_of(CPU_SETSIZE, -1);
+      for (auto n : parse_cpulist(read_line("/sys/devices/system/node/online")))
+	for (auto c : parse_cpulist(read_line("/sys/devices/system/node/node" + openvpn::to_string(n) + "/cpulist")))
+	  node_of[c] = n;
+
+      for (auto id : ids)
+	{
+	  const std::string dir = "/sys/devices/system/cpu/cpu" + openvpn::to_string(id) + "/topology/";
+	  CPU cpu;
+	  cpu.id = id;
+	  cpu.core = read_int(dir + "core_id", id);
+	  cpu.package = read_int(dir + "physical_package_id", 0);
+	  cpu.node = node_of[id];
+	  const std::vector<int> sib = parse_cpulist(read_line(dir + "thread_siblings_list"));
+	  cpu.primary = sib.empty() || sib[0] == id;
+	  ret.push_back(cpu);
+	}
+      return ret;
+    }
+
+    // NUMA node the NIC is attached to, -1 if unknown
+    inline int nic_node(const std::string& dev)
+    {
+      return read_int("/sys/class/net/" + dev + "/device/numa_node", -1);
+    }
+
+    // CPU servicing each of the NIC's queues, in queue order.  Taken
+    // from the driver's XPS map where set, else from the affinity of
+    // the device's MSI vectors.  Empty if the mapping is unknown.
+    inline std::vector<int> nic_queue_cpus(const std::string& dev)
+    {
+      std::vector<int> ret;
+      for (int q = 0; ; ++q)
+	{
+	  const std::string fn = "/sys/class/net/" + dev + "/queues/tx-" + openvpn::to_string(q) + "/xps_cpus";
+	  std::ifstream f(fn);
+	  if (!f)
+	    break;
+	  std::string line;
+	  std::getline(f, line);
+	  const std::vector<int> c = parse_cpumask(line);
+	  if (c.empty())
+	    {
+	      ret.clear();
+	      break;
+	    }
+	  ret.push_back(c[0]);
+	}
+      if (!ret.empty())
+	return ret;
+
+      std::vector<int> irqs;
+      if (DIR* d = ::opendir(("/sys/class/net/" + dev + "/device/msi_irqs").c_str()))
+	{
+	  while (const struct dirent* e = ::readdir(d))
+	    if (e->d_name[0] >= '0' && e->d_name[0] <= '9')
+	      irqs.push_back(std::atoi(e->d_name));
+	  ::closedir(d);
+	}
+      std::sort(irqs.begin(), irqs.end());
+      for (auto irq : irqs)
+	{
+	  const std::string dir = "/proc/irq/" + openvpn::to_string(irq) + '/';
+	  std::vector<int> c = parse_cpulist(read_line(dir + "effective_affinity_list"));
+	  if (c.empty())
+	    c = parse_cpulist(read_line(dir + "smp_affinity_list"));
+	  // a vector open to many cores is not tied to a queue
+	  if (c.size() == 1 && std::find(ret.begin(), ret.end(), c[0]) == ret.end())
+	    ret.push_back(c[0]);
+	}
+      return ret;
+    }
+
+    struct Config
+    {
+      Config() {}
+
+      // thread-topology [nic <dev>] [smt] [no-numa]
+      explicit Config(const OptionList& opt)
+      {
+	const Option* o = opt.get_ptr("thread-topology");
+	if (!o)
+	  return;
+	enabled = true;
+	for (size_t i = 1; i < o->size(); ++i)
+	  {
+	    const std::string& a = o->get(i, 64);
+	    if (a == "nic")
+	      nic = o->get(++i, 64);
+	    else if (a == "smt")
+	      smt = true;
+	    else if (a == "no-numa")
+	      numa = false;
+	    else
+	      throw thread_topology_error("unknown thread-topology option: " + a);
+	  }
+      }
+
+      bool enabled = false;
+      std::string nic;  // align threads with this NIC's queues
+      bool smt = false; // use SMT siblings before wrapping around
+      bool numa = true; // bind thread memory to the local node
+    };
+
+    class Layout
+    {
+    public:
+      struct Unit
+      {
+	int cpu;
+	int node;
+      };
+
+      Layout() {}
+
+      // Assign n_threads threads to CPUs.  Thread i gets the CPU of NIC
+      // queue i where known, so that shard i of a reuseport group and
+      // tun queue i are served on the core that receives their packets.
+      // The remaining threads take one core each, closest node first,
+      // and wrap around once cores run out.
+      static Layout plan(const unsigned int n_threads, const Config& config)
+      {
+	Layout ret;
+	ret.numa = config.numa;
+	if (!config.enabled || !n_threads)
+	  return ret;
+
+	const std::vector<CPU> all = cpus();
+	if (all.empty())
+	  return ret;
+	auto find = [&all](const int id) -> const CPU* {
+	  for (auto &c : all)
+	    if (c.id == id)
+	      return &c;
+	  return nullptr;
+	};
+
+	std::vector<int> order;
+	int home = -1;
+	if (!config.nic.empty())
+	  {
+	    home = nic_node(config.nic);
+	    for (auto c : nic_queue_cpus(config.nic))
+	      if (find(c))
+		order.push_back(c);
+	  }
+	if (home < 0)
+	  home = all[0].node;
+
+	std::vector<const CPU*> rest;
+	for (auto &c : all)
+	  if (std::find(order.begin(), order.end(), c.id) == order.end()
+	      && (c.primary || config.smt))
+	    rest.push_back(&c);
+	std::stable_sort(rest.begin(), rest.end(), [home](const CPU* a, const CPU* b) {
+	    if ((a->node == home) != (b->node == home))
+	      return a->node == home;
+	    if (a->primary != b->primary)
+	      return a->primary;
+	    return a->node < b->node;
+	  });
+	for (auto c : rest)
+	  order.push_back(c->id);
+
+	for (unsigned int i = 0; i < n_threads; ++i)
+	  {
+	    const CPU* c = find(order[i % order.size()]);
+	    ret.units.push_back(Unit{c->id, c->node});
+	  }
+	return ret;
+      }
+
+      size_t size() const { return units.size(); }
+      bool defined() const { return !units.empty(); }
+
+      int cpu(const size_t unit) const { return units[unit].cpu; }
+      int node(const size_t unit) const { return units[unit].node; }
+
+      std::vector<int> cpu_list() const
+      {
+	std::vector<int> ret;
+	for (auto &u : units)
+	  ret.push_back(u.cpu);
+	return ret;
+      }
+
+      // Pin the calling thread to the unit's CPU and prefer its node
+      // for the thread's allocations, including the thread-local
+      // BufferPool and session objects.  Call before the thread
+      // allocates anything.  Returns false if placement failed, which
+      // is not fatal.
+      bool bind(const size_t unit) const
+      {
+	if (unit >= units.size())
+	  return false;
+	const Unit& u = units[unit];
+	bool ret = true;
+
+	cpu_set_t set;
+	CPU_ZERO(&set);
+	CPU_SET(u.cpu, &set);
+	if (::sched_setaffinity(0, sizeof(set), &set) < 0)
+	  ret = false;
+
+	if (numa && u.node >= 0)
+	  {
+	    unsigned long mask[CPU_SETSIZE / (8 * sizeof(unsigned long))] = {};
+	    const size_t bits = 8 * sizeof(unsigned long);
+	    mask[u.node / bits] |= 1UL << (u.node % bits);
+	    if (::syscall(SYS_set_mempolicy, MPOL_PREFERRED, mask, (unsigned long)CPU_SETSIZE) < 0)
+	      ret = false;
+	  }
+	return ret;
+      }
+
+      std::string to_string() const
+      {
+	std::ostringstream os;
+	for (size_t i = 0; i < units.size(); ++i)
+	  {
+	    if (i)
+	      os << ' ';
+	    os << i << ":cpu" << units[i].cpu;
+	    if (units[i].node >= 0)
+	      os << "/node" << units[i].node;
+	  }
+	return os.str();
+      }
+
+    private:
+      std::vector<Unit> units;
+      bool numa = true;
+    };
+
+  }
+}
+
+#endif
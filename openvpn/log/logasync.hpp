@@ -0,0 +1,218 @@
+//    OpenVPN -- An application to securely tunnel IP networks
+//               over a single port, with support for SSL/TLS-based
+//               session authentication and key exchange,
+//               packet encryption, packet authentication, and
+//               packet compression.
+//
+//    Copyright (C) 2012-2016 OpenVPN Technologies, Inc.
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU Affero General Public License Version 3
+//    as published by the Free Software Foundation.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU Affero General Public License for more details.
+//
+//    You should have received a copy of the GNU Affero General Public License
+//    along with this program in the COPYING file.
+//    If not, see <http://www.gnu.org/licenses/>.
+// Asynchronous LogBase: callers enqueue into a bounded lock-free
+// ring and a dedicated thread forwards the lines to the real log.
+
+#ifndef OPENVPN_LOG_LOGASYNC_H
+#define OPENVPN_LOG_LOGASYNC_H
+
+#include <string>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <utility> // for std::move
+
+#include <openvpn/common/size.hpp>
+#include <openvpn/common/exception.hpp>
+#include <openvpn/common/format.hpp>
+#include <openvpn/log/logbase.hpp>
+
+namespace openvpn {
+
+  // Install as the LogBase of threads that must never block on
+  // logging (e.g. server io threads).  log() costs one copy of the
+  // line plus a CAS; when the ring is full the line is dropped and
+  // counted, and the drain thread reports the number of drops.
+  //
+  // The ring is a bounded MPMC queue with per-cell sequence numbers
+  // (after D. Vyukov), used here with a single consumer.
+  class LogAsync : public LogBase
+  {
+  public:
+    typedef RCPtr<LogAsync> Ptr;
+
+    OPENVPN_EXCEPTION(log_async_error);
+
+    LogAsync(const LogBase::Ptr& sink_arg, const size_t capacity = 4096)
+      : sink(sink_arg),
+	cells(round_pow2(capacity)),
+	mask(cells.size() - 1),
+	enqueue_pos(0),
+	dequeue_pos(0),
+	dropped_(0),
+	reported_drops(0),
+	sleeping(false),
+	halt(false)
+    {
+      if (!sink)
+	throw log_async_error("no sink");
+      for (size_t i = 0; i < cells.size(); ++i)
+	cells[i].seq.store(i, std::memory_order_relaxed);
+      thread = std::thread(&LogAsync::drain_thread, this);
+    }
+
+    virtual ~LogAsync()
+    {
+      stop();
+    }
+
+    // Flush what is queued and stop the drain thread.
+    void stop()
+    {
+      if (thread.joinable())
+	{
+	  {
+	    std::lock_guard<std::mutex> lock(mutex);
+	    halt = true;
+	  }
+	  cv.notify_one();
+	  thread.join();
+	}
+    }
+
+    virtual void log(const std::string& str) override
+    {
+      std::string s(str);
+      push(s);
+    }
+
+    // Moves str on success.
+    bool push(std::string& str)
+    {
+      size_t pos = enqueue_pos.load(std::memory_order_relaxed);
+      Cell* cell;
+      for (;;)
+	{
+	  cell = &cells[pos & mask];
+	  const size_t seq = cell->seq.load(std::memory_order_acquire);
+	  const std::intptr_t dif = (std::intptr_t)seq - (std::intptr_t)pos;
+	  if (dif == 0)
+	    {
+	      if (enqueue_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+		break;
+	    }
+	  else if (dif < 0)
+	    {
+	      dropped_.fetch_add(1, std::memory_order_relaxed);
+	      return false;
+	    }
+	  else
+	    pos = enqueue_pos.load(std::memory_order_relaxed);
+	}
+      cell->msg = std::move(str);
+      cell->seq.store(pos + 1, std::memory_order_release);
+      if (sleeping.load(std::memory_order_relaxed))
+	cv.notify_one();
+      return true;
+    }
+
+    std::uint64_t dropped() const
+    {
+      return dropped_.load(std::memory_order_relaxed);
+    }
+
+  private:
+    enum {
+      IDLE_WAIT_MS = 100, // bounds the latency of a missed wakeup
+    };
+
+    struct Cell
+    {
+      std::atomic<size_t> seq;
+      std::string msg;
+    };
+
+    static size_t round_pow2(const size_t n)
+    {
+      size_t ret = 2;
+      while (ret < n)
+	ret <<= 1;
+      return ret;
+    }
+
+    bool pop(std::string& out)
+    {
+      Cell& cell = cells[dequeue_pos & mask];
+      if (cell.seq.load(std::memory_order_acquire) != dequeue_pos + 1)
+	return false;
+      out = std::move(cell.msg);
+      cell.msg.clear();
+      cell.seq.store(dequeue_pos + mask + 1, std::memory_order_release);
+      ++dequeue_pos;
+      return true;
+    }
+
+    bool drain()
+    {
+      bool did = false;
+      std::string line;
+      while (pop(line))
+	{
+	  sink->log(line);
+	  did = true;
+	}
+      const std::uint64_t d = dropped();
+      if (d != reported_drops)
+	{
+	  sink->log("LogAsync: " + openvpn::to_string(d - reported_drops) + " log messages dropped\n");
+	  reported_drops = d;
+	}
+      return did;
+    }
+
+    void drain_thread()
+    {
+      for (;;)
+	{
+	  if (drain())
+	    continue;
+	  std::unique_lock<std::mutex> lock(mutex);
+	  if (halt)
+	    break;
+	  sleeping.store(true, std::memory_order_relaxed);
+	  cv.wait_for(lock, std::chrono::milliseconds(IDLE_WAIT_MS));
+	  sleeping.store(false, std::memory_order_relaxed);
+	}
+      drain();
+    }
+
+    LogBase::Ptr sink;
+    std::vector<Cell> cells;
+    const size_t mask;
+    std::atomic<size_t> enqueue_pos;
+    size_t dequeue_pos;     // consumer only
+    std::atomic<std::uint64_t> dropped_;
+    std::uint64_t reported_drops; // consumer only
+
+    std::mutex mutex;
+    std::condition_variable cv;
+    std::atomic<bool> sleeping;
+    bool halt;
+    std::thread thread;
+  };
+
+}
+
+#endif
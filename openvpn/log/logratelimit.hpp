@@ -0,0 +1,97 @@
+//    OpenVPN -- An application to securely tunnel IP networks
+//               over a single port, with support for SSL/TLS-based
+//               session authentication and key exchange,
+//               packet encryption, packet authentication, and
+//               packet compression.
+//
+//    Copyright (C) 2012-2016 OpenVPN Technologies, Inc.
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU Affero General Public License Version 3
+//    as published by the Free Software Foundation.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU Affero General Public License for more details.
+//
+//    You should have received a copy of the GNU Affero General Public License
+//    along with this program in the COPYING file.
+//    If not, see <http://www.gnu.org/licenses/>.
+// Per-call-site rate limiting for log messages that can fire once
+// per packet, so that an error burst can't swamp the log path.
+
+#ifndef OPENVPN_LOG_LOGRATELIMIT_H
+#define OPENVPN_LOG_LOGRATELIMIT_H
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+
+namespace openvpn {
+
+  // Allow at most per_sec messages in each one second window.
+  // Safe to share between threads; the window boundary is only
+  // approximately respected when threads race across it.
+  class LogRateLimit
+  {
+  public:
+    LogRateLimit(const unsigned int per_sec_arg)
+      : per_sec(per_sec_arg),
+	window(0),
+	count(0),
+	suppressed(0)
+    {
+    }
+
+    // Returns true if the caller may log.  suppressed_out is set
+    // to the number of messages dropped since the last allowed one.
+    bool allow(std::uint64_t& suppressed_out)
+    {
+      const std::uint64_t now = now_sec();
+      std::uint64_t w = window.load(std::memory_order_relaxed);
+      if (now != w && window.compare_exchange_strong(w, now, std::memory_order_relaxed))
+	count.store(0, std::memory_order_relaxed);
+      if (count.fetch_add(1, std::memory_order_relaxed) < per_sec)
+	{
+	  suppressed_out = suppressed.exchange(0, std::memory_order_relaxed);
+	  return true;
+	}
+      suppressed.fetch_add(1, std::memory_order_relaxed);
+      return false;
+    }
+
+  private:
+    static std::uint64_t now_sec()
+    {
+      return std::chrono::duration_cast<std::chrono::seconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+    const unsigned int per_sec;
+    std::atomic<std::uint64_t> window;
+    std::atomic<unsigned int> count;
+    std::atomic<std::uint64_t> suppressed;
+  };
+
+}
+
+// Default rate for per-packet error logging (udplink, tcplink, tun)
+#ifndef OPENVPN_LOG_ERROR_RATE
+#define OPENVPN_LOG_ERROR_RATE 10
+#endif
+
+// Like OPENVPN_LOG, but skips formatting entirely beyond per_sec
+// messages per second from this call site.
+#define OPENVPN_LOG_RATELIMIT(per_sec, args) \
+  do { \
+    static openvpn::LogRateLimit _ovpn_log_rl(per_sec); \
+    std::uint64_t _ovpn_log_sup; \
+    if (_ovpn_log_rl.allow(_ovpn_log_sup)) { \
+      if (_ovpn_log_sup) \
+	OPENVPN_LOG(args << " [" << _ovpn_log_sup << " similar messages suppressed]"); \
+      else \
+	OPENVPN_LOG(args); \
+    } \
+  } while (0)
+
+#endif
@@ -0,0 +1,337 @@
+//    OpenVPN -- An application to securely tunnel IP networks
+//               over a single port, with support for SSL/TLS-based
+//               session authentication and key exchange,
+//               packet encryption, packet authentication, and
+//               packet compression.
+//
+//    Copyright (C) 2012-2016 OpenVPN Technologies, Inc.
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU Affero General Public License Version 3
+//    as published by the Free Software Foundation.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU Affero General Public License for more details.
+//
+//    You should have received a copy of the GNU Affero General Public License
+//    along with this program in the COPYING file.
+//    If not, see <http://www.gnu.org/licenses/>.
+// Optional data path instrumentation: per-stage latency histograms,
+// batch size histograms and queue depth gauges.  Hooks compile to
+// nothing unless OPENVPN_PERF_INSTRUMENTATION is defined.
+
+#ifndef OPENVPN_LOG_PERFSTATS_H
+#define OPENVPN_LOG_PERFSTATS_H
+
+#include <string>
+#include <sstream>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+
+#include <openvpn/common/size.hpp>
+#include <openvpn/common/rc.hpp>
+#include <openvpn/common/ffs.hpp>
+
+namespace openvpn {
+
+  // Log-linear histogram in the style of HdrHistogram: 8 sub-buckets
+  // per power of 2, so any recorded value is reported within 12.5%.
+  // Values up to 2^32-1 are tracked, larger ones are clamped.
+  // Recording is a relaxed atomic add and safe from any thread.
+  class PerfHistogram
+  {
+  public:
+    enum {
+      SUB_BITS = 3,
+      SUB = 1 << SUB_BITS,
+      N_BUCKETS = (32 - SUB_BITS) * SUB + SUB,
+    };
+
+    PerfHistogram()
+    {
+      reset();
+    }
+
+    void record(std::uint64_t value)
+    {
+      if (value > 0xFFFFFFFFu)
+	value = 0xFFFFFFFFu;
+      buckets[index((unsigned int)value)].fetch_add(1, std::memory_order_relaxed);
+      sum_.fetch_add(value, std::memory_order_relaxed);
+      std::uint64_t m = max_.load(std::memory_order_relaxed);
+      while (value > m && !max_.compare_exchange_weak(m, value, std::memory_order_relaxed))
+	;
+    }
+
+    void reset()
+    {
+      for (auto &b : buckets)
+	b.store(0, std::memory_order_relaxed);
+      sum_.store(0, std::memory_order_relaxed);
+      max_.store(0, std::memory_order_relaxed);
+    }
+
+    std::uint64_t count() const
+    {
+      std::uint64_t ret = 0;
+      for (auto &b : buckets)
+	ret += b.load(std::memory_order_relaxed);
+      return ret;
+    }
+
+    std::uint64_t sum() const { return sum_.load(std::memory_order_relaxed); }
+    std::uint64_t max() const { return max_.load(std::memory_order_relaxed); }
+
+    // Upper bound of the bucket holding quantile q (0.0 to 1.0),
+    // capped at the largest value recorded.
+    std::uint64_t quantile(const double q) const
+    {
+      std::uint64_t counts[N_BUCKETS];
+      std::uint64_t total = 0;
+      for (size_t i = 0; i < N_BUCKETS; ++i)
+	total += (counts[i] = buckets[i].load(std::memory_order_relaxed));
+      if (!total)
+	return 0;
+      std::uint64_t target = std::uint64_t(q * total + 0.5);
+      if (target < 1)
+	target = 1;
+      std::uint64_t seen = 0;
+      for (size_t i = 0; i < N_BUCKETS; ++i)
+	{
+	  seen += counts[i];
+	  if (seen >= target)
+	    {
+	      const std::uint64_t u = upper(i);
+	      const std::uint64_t m = max();
+	      return u < m ? u : m;
+	    }
+	}
+      return max();
+    }
+
+    std::string to_string() const
+    {
+      std::ostringstream os;
+      const std::uint64_t n = count();
+      os << "n=" << n;
+      if (n)
+	os << " avg=" << sum() / n
+	   << " p50=" << quantile(0.50)
+	   << " p90=" << quantile(0.90)
+	   << " p99=" << quantile(0.99)
+	   << " p999=" << quantile(0.999)
+	   << " max=" << max();
+      return os.str();
+    }
+
+    static size_t index(const unsigned int v)
+    {
+      if (v < SUB)
+	return v;
+      const int e = find_last_set(v); // e > SUB_BITS
+      return (e - SUB_BITS) * SUB + ((v >> (e - SUB_BITS - 1)) & (SUB - 1));
+    }
+
+    static std::uint64_t lower(const size_t i)
+    {
+      if (i < SUB)
+	return i;
+      const int e = int(i / SUB) + SUB_BITS;
+      return std::uint64_t(SUB + (i % SUB)) << (e - SUB_BITS - 1);
+    }
+
+    static std::uint64_t upper(const size_t i)
+    {
+      return i + 1 < N_BUCKETS ? lower(i + 1) - 1 : 0xFFFFFFFFu;
+    }
+
+  private:
+    std::atomic<std::uint64_t> buckets[N_BUCKETS];
+    std::atomic<std::uint64_t> sum_;
+    std::atomic<std::uint64_t> max_;
+  };
+
+  class PerfStats : public RC<thread_safe_refcount>
+  {
+  public:
+    typedef RCPtr<PerfStats> Ptr;
+
+    // latency per data path stage, in nanoseconds
+    enum Stage {
+      TUN_READ = 0,      // tun packet read -> handed to transport
+      COMPRESS,
+      ENCRYPT,
+      TRANSPORT_SEND,    // socket send call(s)
+      TRANSPORT_RECV,    // transport packet read -> handed to tun
+      DECRYPT,
+      DECOMPRESS,
+      N_STAGES,
+    };
+
+    // packets per batch
+    enum Batch {
+      TUN_READ_BATCH = 0,
+      TRANSPORT_RECV_BATCH,
+      TRANSPORT_SEND_BATCH,
+      ENCRYPT_BATCH,
+      DATA_BUNDLE,       // packets merged into another packet's bundle
+      N_BATCHES,
+    };
+
+    // instantaneous depth, with high-water mark
+    enum Gauge {
+      TRANSPORT_SEND_QUEUE = 0, // packets (UDP) or bytes (TCP) queued
+      N_GAUGES,
+    };
+
+    // Measure the lifetime of the object into a stage histogram.
+    class Timer
+    {
+    public:
+      Timer(PerfStats* ps_arg, const Stage stage_arg)
+	: ps(ps_arg),
+	  stage(stage_arg)
+      {
+	if (ps)
+	  start = std::chrono::steady_clock::now();
+      }
+
+      ~Timer()
+      {
+	if (ps)
+	  ps->stage_latency(stage, std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count());
+      }
+
+    private:
+      Timer(const Timer&) = delete;
+      Timer& operator=(const Timer&) = delete;
+
+      PerfStats* ps;
+      Stage stage;
+      std::chrono::steady_clock::time_point start;
+    };
+
+    PerfStats()
+    {
+      for (size_t i = 0; i < N_GAUGES; ++i)
+	{
+	  gauges[i].cur.store(0, std::memory_order_relaxed);
+	  gauges[i].max.store(0, std::memory_order_relaxed);
+	}
+    }
+
+    void stage_latency(const Stage s, const std::int64_t ns)
+    {
+      stages[s].record(ns > 0 ? std::uint64_t(ns) : 0);
+    }
+
+    void batch_size(const Batch b, const size_t n)
+    {
+      batches[b].record(n);
+    }
+
+    void gauge(const Gauge g, const std::int64_t value)
+    {
+      Level& l = gauges[g];
+      l.cur.store(value, std::memory_order_relaxed);
+      std::int64_t m = l.max.load(std::memory_order_relaxed);
+      while (value > m && !l.max.compare_exchange_weak(m, value, std::memory_order_relaxed))
+	;
+    }
+
+    const PerfHistogram& stage(const Stage s) const { return stages[s]; }
+    const PerfHistogram& batch(const Batch b) const { return batches[b]; }
+    std::int64_t gauge_value(const Gauge g) const { return gauges[g].cur.load(std::memory_order_relaxed); }
+    std::int64_t gauge_max(const Gauge g) const { return gauges[g].max.load(std::memory_order_relaxed); }
+
+    void reset()
+    {
+      for (auto &h : stages)
+	h.reset();
+      for (auto &h : batches)
+	h.reset();
+      for (auto &l : gauges)
+	l.max.store(l.cur.load(std::memory_order_relaxed), std::memory_order_relaxed);
+    }
+
+    static const char *stage_name(const size_t s)
+    {
+      static const char *names[] = {
+	"TUN_READ",
+	"COMPRESS",
+	"ENCRYPT",
+	"TRANSPORT_SEND",
+	"TRANSPORT_RECV",
+	"DECRYPT",
+	"DECOMPRESS",
+      };
+      static_assert(sizeof(names) / sizeof(names[0]) == N_STAGES, "PerfStats stage names");
+      return s < N_STAGES ? names[s] : "UNKNOWN_STAGE";
+    }
+
+    static const char *batch_name(const size_t b)
+    {
+      static const char *names[] = {
+	"TUN_READ_BATCH",
+	"TRANSPORT_RECV_BATCH",
+	"TRANSPORT_SEND_BATCH",
+	"ENCRYPT_BATCH",
+	"DATA_BUNDLE",
+      };
+      static_assert(sizeof(names) / sizeof(names[0]) == N_BATCHES, "PerfStats batch names");
+      return b < N_BATCHES ? names[b] : "UNKNOWN_BATCH";
+    }
+
+    static const char *gauge_name(const size_t g)
+    {
+      static const char *names[] = {
+	"TRANSPORT_SEND_QUEUE",
+      };
+      static_assert(sizeof(names) / sizeof(names[0]) == N_GAUGES, "PerfStats gauge names");
+      return g < N_GAUGES ? names[g] : "UNKNOWN_GAUGE";
+    }
+
+    // one line per non-empty histogram and per gauge, latencies in ns
+    std::string to_string() const
+    {
+      std::ostringstream os;
+      for (size_t i = 0; i < N_STAGES; ++i)
+	if (stages[i].count())
+	  os << stage_name(i) << "_NS " << stages[i].to_string() << std::endl;
+      for (size_t i = 0; i < N_BATCHES; ++i)
+	if (batches[i].count())
+	  os << batch_name(i) << ' ' << batches[i].to_string() << std::endl;
+      for (size_t i = 0; i < N_GAUGES; ++i)
+	os << gauge_name(i) << " cur=" << gauge_value(Gauge(i)) << " max=" << gauge_max(Gauge(i)) << std::endl;
+      return os.str();
+    }
+
+  private:
+    struct Level
+    {
+      std::atomic<std::int64_t> cur;
+      std::atomic<std::int64_t> max;
+    };
+
+    PerfHistogram stages[N_STAGES];
+    PerfHistogram batches[N_BATCHES];
+    Level gauges[N_GAUGES];
+  };
+
+}
+
+// Data path hooks, given a SessionStats pointer.
+#ifdef OPENVPN_PERF_INSTRUMENTATION
+#define OPENVPN_PERF_TIMER(stats, st) PerfStats::Timer perf_timer_##st((stats) ? (stats)->perf() : nullptr, PerfStats::st)
+#define OPENVPN_PERF_BATCH(stats, b, n) do { if (stats) (stats)->perf()->batch_size(PerfStats::b, n); } while (0)
+#define OPENVPN_PERF_GAUGE(stats, g, v) do { if (stats) (stats)->perf()->gauge(PerfStats::g, v); } while (0)
+#else
+#define OPENVPN_PERF_TIMER(stats, st)
+#define OPENVPN_PERF_BATCH(stats, b, n) do { (void)(n); } while (0) // keep n used
+#define OPENVPN_PERF_GAUGE(stats, g, v)
+#endif
+
+#endif
@@ -0,0 +1,321 @@
+//    OpenVPN -- An application to securely tunnel IP networks
+//               over a single port, with support for SSL/TLS-based
+//               session authentication and key exchange,
+//               packet encryption, packet authentication, and
+//               packet compression.
+//
+//    Copyright (C) 2012-2016 OpenVPN Technologies, Inc.
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU Affero General Public License Version 3
+//    as published by the Free Software Foundation.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU Affero General Public License for more details.
+//
+//    You should have received a copy of the GNU Affero General Public License
+//    along with this program in the COPYING file.
+//    If not, see <http://www.gnu.org/licenses/>.
+// Runtime-toggleable packet capture into a fixed-size in-memory ring,
+// exportable as pcapng while the tunnel keeps running.
+
+#ifndef OPENVPN_LOG_PKTCAP_H
+#define OPENVPN_LOG_PKTCAP_H
+
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <ostream>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <new>
+
+#include <openvpn/common/platform.hpp>
+#include <openvpn/common/size.hpp>
+#include <openvpn/common/rc.hpp>
+#include <openvpn/common/exception.hpp>
+#include <openvpn/common/format.hpp>
+#include <openvpn/buffer/buffer.hpp>
+
+#ifndef OPENVPN_PLATFORM_WIN
+#include <sys/mman.h>
+#endif
+
+namespace openvpn {
+
+  // Packets are recorded at four points: plaintext on the tun side and
+  // OpenVPN-encapsulated on the wire side, in each direction.  The ring
+  // is a fixed array of snaplen-sized slots, so memory use is set at
+  // construction and the oldest records are overwritten.
+  //
+  // capture() is a single relaxed load while disabled.  When enabled,
+  // writers claim slots with one fetch_add and publish them with a
+  // per-slot sequence number (seqlock), so export can run concurrently
+  // and simply skips slots that are mid-write or were overwritten.
+  class PacketCapture : public RC<thread_safe_refcount>
+  {
+  public:
+    typedef RCPtr<PacketCapture> Ptr;
+
+    OPENVPN_EXCEPTION(packet_capture_error);
+
+    enum Point {
+      TUN_IN=0,  // read from tun, on its way to the peer
+      TUN_OUT,   // decrypted, about to be written to tun
+      WIRE_IN,   // received from the transport, before decryption
+      WIRE_OUT,  // encrypted, about to be sent on the transport
+    };
+
+    PacketCapture(const size_t ring_bytes = 4*1024*1024,
+		  const size_t snaplen_arg = 1600)
+      : snaplen(snaplen_arg),
+	stride(round8(sizeof(Slot) + snaplen_arg)),
+	n_slots(ring_bytes / stride),
+	mem_size(n_slots * stride),
+	mem(nullptr),
+	enabled_(false),
+	write_idx(0),
+	next_session_id(0)
+    {
+      if (!n_slots || snaplen > 0xFFFF)
+	throw packet_capture_error("bad ring size or snaplen");
+#ifdef OPENVPN_PLATFORM_WIN
+      mem = new unsigned char[mem_size];
+#else
+      void* m = ::mmap(nullptr, mem_size, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+      if (m == MAP_FAILED)
+	throw packet_capture_error("mmap failed");
+      mem = (unsigned char *)m;
+#endif
+      for (size_t i = 0; i < n_slots; ++i)
+	new (slot(i)) Slot();
+    }
+
+    virtual ~PacketCapture()
+    {
+#ifdef OPENVPN_PLATFORM_WIN
+      delete [] mem;
+#else
+      ::munmap(mem, mem_size);
+#endif
+    }
+
+    void enable(const bool state)
+    {
+      enabled_.store(state, std::memory_order_relaxed);
+    }
+
+    bool enabled() const
+    {
+      return enabled_.load(std::memory_order_relaxed);
+    }
+
+    // Identifies a session in exported records.
+    std::uint64_t new_session_id()
+    {
+      return ++next_session_id;
+    }
+
+    void capture(const Point point, const std::uint64_t session_id, const Buffer& buf)
+    {
+      if (enabled() && buf.size())
+	record(point, session_id, buf.c_data(), buf.size());
+    }
+
+    // Number of packets recorded since construction, including any
+    // that have since been overwritten.
+    std::uint64_t captured() const
+    {
+      return write_idx.load(std::memory_order_relaxed);
+    }
+
+    size_t capacity() const
+    {
+      return n_slots;
+    }
+
+    // Write the current ring contents, oldest first.  Interface 0 is
+    // the tun side (raw IP), interface 1 the wire side (OpenVPN
+    // packets, LINKTYPE_USER0).  Each record carries its direction in
+    // epb_flags and the session id in a comment.
+    void write_pcapng(std::ostream& os) const
+    {
+      // Section Header Block
+      put32(os, 0x0A0D0D0A);
+      put32(os, 28);
+      put32(os, 0x1A2B3C4D);
+      put16(os, 1);
+      put16(os, 0);
+      put32(os, 0xFFFFFFFF); // section length unspecified
+      put32(os, 0xFFFFFFFF);
+      put32(os, 28);
+
+      write_idb(os, LINKTYPE_RAW, "tun");
+      write_idb(os, LINKTYPE_USER0, "wire");
+
+      std::unique_ptr<unsigned char[]> data(new unsigned char[snaplen]);
+      const std::uint64_t end = write_idx.load(std::memory_order_acquire);
+      const std::uint64_t begin = end > n_slots ? end - n_slots : 0;
+      for (std::uint64_t i = begin; i < end; ++i)
+	{
+	  const Slot* s = slot(i % n_slots);
+	  const std::uint64_t seq = s->seq.load(std::memory_order_acquire);
+	  if (seq != 2*i+2)
+	    continue;
+	  const Slot copy_hdr(*s);
+	  std::memcpy(data.get(), payload(s), copy_hdr.cap_len);
+	  std::atomic_thread_fence(std::memory_order_acquire);
+	  if (s->seq.load(std::memory_order_relaxed) != seq)
+	    continue;
+	  write_epb(os, copy_hdr, data.get());
+	}
+    }
+
+  private:
+    enum {
+      LINKTYPE_RAW = 101,
+      LINKTYPE_USER0 = 147,
+    };
+
+    struct Slot
+    {
+      Slot() : seq(0) {}
+
+      Slot(const Slot& other)
+	: seq(other.seq.load(std::memory_order_relaxed)),
+	  ts_us(other.ts_us),
+	  session_id(other.session_id),
+	  orig_len(other.orig_len),
+	  cap_len(other.cap_len),
+	  point(other.point)
+      {
+      }
+
+      std::atomic<std::uint64_t> seq; // 2*idx+1 while writing, 2*idx+2 when complete
+      std::uint64_t ts_us = 0;
+      std::uint64_t session_id = 0;
+      std::uint32_t orig_len = 0;
+      std::uint16_t cap_len = 0;
+      std::uint8_t point = 0;
+    };
+
+    static size_t round8(const size_t n)
+    {
+      return (n + 7) & ~size_t(7);
+    }
+
+    Slot* slot(const size_t i) const
+    {
+      return (Slot*)(mem + i * stride);
+    }
+
+    static unsigned char* payload(const Slot* s)
+    {
+      return (unsigned char *)s + sizeof(Slot);
+    }
+
+    void record(const Point point, const std::uint64_t session_id, const unsigned char* data, const size_t size)
+    {
+      const std::uint64_t idx = write_idx.fetch_add(1, std::memory_order_relaxed);
+      Slot* s = slot(idx % n_slots);
+      s->seq.store(2*idx+1, std::memory_order_relaxed);
+      std::atomic_thread_fence(std::memory_order_release);
+      s->ts_us = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+      s->session_id = session_id;
+      s->orig_len = (std::uint32_t)size;
+      s->cap_len = (std::uint16_t)(size < snaplen ? size : snaplen);
+      s->point = (std::uint8_t)point;
+      std::memcpy(payload(s), data, s->cap_len);
+      s->seq.store(2*idx+2, std::memory_order_release);
+    }
+
+    static void put16(std::ostream& os, const std::uint16_t v)
+    {
+      os.write((const char *)&v, sizeof(v));
+    }
+
+    static void put32(std::ostream& os, const std::uint32_t v)
+    {
+      os.write((const char *)&v, sizeof(v));
+    }
+
+    static size_t pad4(const size_t n)
+    {
+      return (n + 3) & ~size_t(3);
+    }
+
+    static void put_padded(std::ostream& os, const void* data, const size_t size)
+    {
+      static const char zero[4] = { 0, 0, 0, 0 };
+      os.write((const char *)data, size);
+      os.write(zero, pad4(size) - size);
+    }
+
+    static void put_option(std::ostream& os, const std::uint16_t code, const void* data, const size_t size)
+    {
+      put16(os, code);
+      put16(os, (std::uint16_t)size);
+      put_padded(os, data, size);
+    }
+
+    static size_t option_size(const size_t size)
+    {
+      return 4 + pad4(size);
+    }
+
+    void write_idb(std::ostream& os, const std::uint16_t linktype, const std::string& name) const
+    {
+      const std::uint32_t len = (std::uint32_t)(20 + option_size(name.length()) + 4);
+      put32(os, 1);
+      put32(os, len);
+      put16(os, linktype);
+      put16(os, 0);
+      put32(os, (std::uint32_t)snaplen);
+      put_option(os, 2, name.c_str(), name.length()); // if_name
+      put32(os, 0);                                   // opt_endofopt
+      put32(os, len);
+    }
+
+    static void write_epb(std::ostream& os, const Slot& s, const unsigned char* data)
+    {
+      const bool tun = (s.point == TUN_IN || s.point == TUN_OUT);
+      const bool inbound = (s.point == TUN_IN || s.point == WIRE_IN);
+      const std::uint32_t flags = inbound ? 1 : 2;
+      const std::string comment = "session " + openvpn::to_string(s.session_id);
+      const std::uint32_t len = (std::uint32_t)(28 + pad4(s.cap_len)
+						+ option_size(sizeof(flags))
+						+ option_size(comment.length())
+						+ 4 + 4);
+      put32(os, 6);
+      put32(os, len);
+      put32(os, tun ? 0 : 1);
+      put32(os, (std::uint32_t)(s.ts_us >> 32));
+      put32(os, (std::uint32_t)s.ts_us);
+      put32(os, s.cap_len);
+      put32(os, s.orig_len);
+      put_padded(os, data, s.cap_len);
+      put_option(os, 1, comment.c_str(), comment.length()); // opt_comment
+      put_option(os, 2, &flags, sizeof(flags));             // epb_flags
+      put32(os, 0);                                         // opt_endofopt
+      put32(os, len);
+    }
+
+    PacketCapture(const PacketCapture&) = delete;
+    PacketCapture& operator=(const PacketCapture&) = delete;
+
+    const size_t snaplen;
+    const size_t stride;
+    const size_t n_slots;
+    const size_t mem_size;
+    unsigned char* mem;
+    std::atomic<bool> enabled_;
+    std::atomic<std::uint64_t> write_idx;
+    std::atomic<std::uint64_t> next_session_id;
+  };
+
+}
+
+#endif
@@ -25,12 +25,17 @@
 #define OPENVPN_LOG_SESSIONSTATS_H
 
 #include <cstring>
+#include <cstdint>
+#include <atomic>
+#include <new>
 
 #include <openvpn/common/size.hpp>
+#include <openvpn/common/likely.hpp>
 #include <openvpn/common/count.hpp>
 #include <openvpn/common/rc.hpp>
 #include <openvpn/error/error.hpp>
 #include <openvpn/time/time.hpp>
+#include <openvpn/log/perfstats.hpp>
 
 namespace openvpn {
 
@@ -49,13 +54,59 @@ namespace openvpn {
       TUN_BYTES_OUT,       // tun/tap bytes out
       TUN_PACKETS_IN,      // tun/tap packets in
       TUN_PACKETS_OUT,     // tun/tap packets out
+      KERNEL_DROPS,        // datagrams dropped by the kernel socket receive queue
+      LATENCY_PROBES_SENT, // data channel latency probes sent
+      LATENCY_PROBES_LOST, // latency probes not echoed in time
+      KEEPALIVES_IN,       // data channel keepalives received
       N_STATS,
     };
 
+    // Counters are sharded by writer thread, each shard on its own
+    // cache line, so that threads sharing one SessionStats object
+    // don't bounce a line on every packet.  Up to N_SHARDS threads
+    // at a time each own a shard and update it without a locked
+    // instruction.  Further threads are spread over N_SHARED_SHARDS
+    // more shards that are updated atomically.  Readers sum the
+    // shards.
+    enum {
+      N_SHARDS = 8,         // at most 32
+      N_SHARED_SHARDS = 8,
+      CACHE_LINE = 64,
+    };
+
+    // Sum of all shards at one point in time.  Each counter is exact
+    // and never goes backwards between snapshots; counters are read
+    // one after another, so they are not a single atomic cut.
+    struct Snapshot
+    {
+      Snapshot()
+      {
+	std::memset(stats, 0, sizeof(stats));
+      }
+
+      count_t get(const size_t type) const
+      {
+	return type < N_STATS ? stats[type] : 0;
+      }
+
+      count_t stats[N_STATS];
+    };
+
     SessionStats()
       : verbose_(false)
+#ifdef OPENVPN_PERF_INSTRUMENTATION
+      , perf_(new PerfStats())
+#endif
     {
-      std::memset((void *)stats_, 0, sizeof(stats_));
+      // align shards to cache lines within shard_mem_
+      const std::uintptr_t base = ((std::uintptr_t)shard_mem_ + CACHE_LINE - 1) & ~std::uintptr_t(CACHE_LINE - 1);
+      shards_ = (Shard *)base;
+      for (size_t i = 0; i < N_SHARD_SLOTS; ++i)
+	{
+	  Shard* sh = new (shard_ptr(i)) Shard();
+	  for (auto &v : sh->v)
+	    v.store(0, std::memory_order_relaxed);
+	}
     }
 
     virtual void error(const size_t type, const std::string* text=nullptr) {}
@@ -70,20 +121,33 @@ namespace openvpn {
     void inc_stat(const size_t type, const count_t value)
     {
       if (type < N_STATS)
-	stats_[type] += value;
+	add(type, value);
     }
 
     count_t get_stat(const size_t type) const
     {
       if (type < N_STATS)
-	return stats_[type];
+	return sum(type);
       else
 	return 0;
     }
 
     count_t get_stat_fast(const size_t type) const
     {
-      return stats_[type];
+      return sum(type);
+    }
+
+    // Safe to call from any thread, doesn't disturb writers.
+    Snapshot snapshot() const
+    {
+      Snapshot ret;
+      for (size_t i = 0; i < N_SHARD_SLOTS; ++i)
+	{
+	  const Shard* sh = shard_ptr(i);
+	  for (size_t t = 0; t < N_STATS; ++t)
+	    ret.stats[t] += sh->v[t].load(std::memory_order_relaxed);
+	}
+      return ret;
     }
 
     static const char *stat_name(const size_t type)
@@ -97,6 +161,10 @@ namespace openvpn {
 	"TUN_BYTES_OUT",
 	"TUN_PACKETS_IN",
 	"TUN_PACKETS_OUT",
+	"KERNEL_DROPS",
+	"LATENCY_PROBES_SENT",
+	"LATENCY_PROBES_LOST",
+	"KEEPALIVES_IN",
       };
 
       if (type < N_STATS)
@@ -105,6 +173,11 @@ namespace openvpn {
 	return "UNKNOWN_STAT_TYPE";
     }
 
+#ifdef OPENVPN_PERF_INSTRUMENTATION
+    // data path timing, see OPENVPN_PERF_* hooks
+    PerfStats* perf() const { return perf_.get(); }
+#endif
+
     void update_last_packet_received(const Time& now)
     {
       last_packet_received_ = now;
@@ -112,6 +185,32 @@ namespace openvpn {
 
     const Time& last_packet_received() const { return last_packet_received_; }
 
+    // Latest data channel latency, in microseconds, from LatencyProbe.
+    // These are gauges rather than counters, all zero until measured.
+    struct Latency
+    {
+      count_t rtt_us = 0;
+      count_t rtt_min_us = 0;
+      count_t jitter_us = 0;
+    };
+
+    void update_latency(const count_t rtt_us, const count_t rtt_min_us, const count_t jitter_us)
+    {
+      rtt_us_.store(rtt_us, std::memory_order_relaxed);
+      rtt_min_us_.store(rtt_min_us, std::memory_order_relaxed);
+      jitter_us_.store(jitter_us, std::memory_order_relaxed);
+    }
+
+    // Safe to call from any thread.
+    Latency latency() const
+    {
+      Latency ret;
+      ret.rtt_us = rtt_us_.load(std::memory_order_relaxed);
+      ret.rtt_min_us = rtt_min_us_.load(std::memory_order_relaxed);
+      ret.jitter_us = jitter_us_.load(std::memory_order_relaxed);
+      return ret;
+    }
+
     struct DCOTransportSource : public virtual RC<thread_unsafe_refcount>
     {
       typedef RCPtr<DCOTransportSource> Ptr;
@@ -156,8 +255,8 @@ namespace openvpn {
       if (dco_)
 	{
 	  const DCOTransportSource::Data data = dco_->dco_transport_stats_delta();
-	  stats_[BYTES_IN] += data.bytes_in;
-	  stats_[BYTES_OUT] += data.bytes_out;
+	  add(BYTES_IN, data.bytes_in);
+	  add(BYTES_OUT, data.bytes_out);
 	}
     }
 
@@ -165,10 +264,109 @@ namespace openvpn {
     void session_stats_set_verbose(const bool v) { verbose_ = v; }
 
   private:
+    struct Shard
+    {
+      std::atomic<count_t> v[N_STATS];
+    };
+
+    enum {
+      SHARD_STRIDE = (sizeof(Shard) + CACHE_LINE - 1) / CACHE_LINE * CACHE_LINE,
+      N_SHARD_SLOTS = N_SHARDS + N_SHARED_SHARDS,
+    };
+
+    // A thread's claim on a shard, process-wide, so that an owned
+    // shard (index below N_SHARDS) has a single writer in every
+    // object.  An owned shard is released when its thread exits and
+    // is then reused by the next new thread; the release/acquire
+    // pair orders the old owner's last stores before the new one's.
+    class ShardClaim
+    {
+    public:
+      ShardClaim()
+      {
+	unsigned int m = owned().load(std::memory_order_relaxed);
+	for (;;)
+	  {
+	    size_t i = 0;
+	    while (i < N_SHARDS && (m & (1u << i)))
+	      ++i;
+	    if (i == N_SHARDS)
+	      {
+		index = N_SHARDS + overflow().fetch_add(1, std::memory_order_relaxed) % N_SHARED_SHARDS;
+		return;
+	      }
+	    if (owned().compare_exchange_weak(m, m | (1u << i),
+					      std::memory_order_acquire,
+					      std::memory_order_relaxed))
+	      {
+		index = i;
+		return;
+	      }
+	  }
+      }
+
+      ~ShardClaim()
+      {
+	if (index < N_SHARDS)
+	  owned().fetch_and(~(1u << index), std::memory_order_release);
+      }
+
+      size_t index;
+
+    private:
+      static std::atomic<unsigned int>& owned()
+      {
+	static std::atomic<unsigned int> m(0);
+	return m;
+      }
+
+      static std::atomic<unsigned int>& overflow()
+      {
+	static std::atomic<unsigned int> n(0);
+	return n;
+      }
+    };
+
+    static size_t shard_index()
+    {
+      static thread_local const ShardClaim claim;
+      return claim.index;
+    }
+
+    Shard* shard_ptr(const size_t i) const
+    {
+      return (Shard *)((unsigned char *)shards_ + i * SHARD_STRIDE);
+    }
+
+    void add(const size_t type, const count_t value)
+    {
+      const size_t i = shard_index();
+      std::atomic<count_t>& c = shard_ptr(i)->v[type];
+      if (likely(i < N_SHARDS))
+	c.store(c.load(std::memory_order_relaxed) + value, std::memory_order_relaxed); // single writer
+      else
+	c.fetch_add(value, std::memory_order_relaxed);
+    }
+
+    count_t sum(const size_t type) const
+    {
+      count_t ret = 0;
+      for (size_t i = 0; i < N_SHARD_SLOTS; ++i)
+	ret += shard_ptr(i)->v[type].load(std::memory_order_relaxed);
+      return ret;
+    }
+
     bool verbose_;
     Time last_packet_received_;
+    std::atomic<count_t> rtt_us_{0};
+    std::atomic<count_t> rtt_min_us_{0};
+    std::atomic<count_t> jitter_us_{0};
     DCOTransportSource::Ptr dco_;
-    volatile count_t stats_[N_STATS];
+#ifdef OPENVPN_PERF_INSTRUMENTATION
+    PerfStats::Ptr perf_;
+#endif
+    Shard* shards_;
+    unsigned char shard_mem_[N_SHARD_SLOTS * SHARD_STRIDE + CACHE_LINE];
   };
 
 } // namespace openvpn
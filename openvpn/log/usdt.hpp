@@ -0,0 +1,62 @@
+//    OpenVPN -- An application to securely tunnel IP networks
+//               over a single port, with support for SSL/TLS-based
+//               session authentication and key exchange,
+//               packet encryption, packet authentication, and
+//               packet compression.
+//
+//    Copyright (C) 2012-2016 OpenVPN Technologies, Inc.
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU Affero General Public License Version 3
+//    as published by the Free Software Foundation.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU Affero General Public License for more details.
+//
+//    You should have received a copy of the GNU Affero General Public License
+//    along with this program in the COPYING file.
+//    If not, see <http://www.gnu.org/licenses/>.
+
+// Statically defined tracepoints (USDT) for bpftrace, perf and
+// SystemTap, under the provider name "openvpn".  Defined when building
+// with OPENVPN_USDT and <sys/sdt.h> (systemtap-sdt-dev); otherwise the
+// macros compile to nothing.  An unattached probe is a single nop
+// plus an ELF note, so probes can stay in production builds, but
+// their arguments are still evaluated, so keep them to values already
+// at hand.  List the probes with:
+//
+//   bpftrace -l 'usdt:/path/to/binary:openvpn:*'
+//
+// Probes and arguments:
+//
+//   key_state        proto, key_id, old state, new state
+//   handshake_start  proto, key_id, initiator
+//   handshake_done   proto, key_id, handshake time in ms
+//   renegotiate      proto
+//   pktid_reject     Error::Type, packet ID, highest packet ID seen
+//   udp_send_error   errno (0 for a partial send), bytes
+//   tcp_queue_full   bytes queued, bytes of the dropped packet
+//   tun_read         bytes
+//   tun_write        bytes, packets
+//   session_create   session, thread index
+//   session_stop     session
+
+#ifndef OPENVPN_LOG_USDT_H
+#define OPENVPN_LOG_USDT_H
+
+#ifdef OPENVPN_USDT
+#include <sys/sdt.h>
+#define OPENVPN_USDT1(name, a) DTRACE_PROBE1(openvpn, name, a)
+#define OPENVPN_USDT2(name, a, b) DTRACE_PROBE2(openvpn, name, a, b)
+#define OPENVPN_USDT3(name, a, b, c) DTRACE_PROBE3(openvpn, name, a, b, c)
+#define OPENVPN_USDT4(name, a, b, c, d) DTRACE_PROBE4(openvpn, name, a, b, c, d)
+#else
+#define OPENVPN_USDT1(name, a)
+#define OPENVPN_USDT2(name, a, b)
+#define OPENVPN_USDT3(name, a, b, c)
+#define OPENVPN_USDT4(name, a, b, c, d)
+#endif
+
+#endif
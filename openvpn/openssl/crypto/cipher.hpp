@@ -58,7 +58,8 @@ namespace openvpn {
       // OpenSSL cipher constants
       enum {
 	MAX_IV_LENGTH = EVP_MAX_IV_LENGTH,
-	CIPH_CBC_MODE = EVP_CIPH_CBC_MODE
+	CIPH_CBC_MODE = EVP_CIPH_CBC_MODE,
+	CIPH_CTR_MODE = EVP_CIPH_CTR_MODE
       };
 
       CipherContext()
@@ -165,6 +166,8 @@ namespace openvpn {
 	    return EVP_des_ede3_cbc();
 	  case CryptoAlgs::BF_CBC:
 	    return EVP_bf_cbc();
+	  case CryptoAlgs::AES_256_CTR:
+	    return EVP_aes_256_ctr();
 	  default:
 	    OPENVPN_THROW(openssl_cipher_error, CryptoAlgs::name(alg) << ": not usable");
 	  }
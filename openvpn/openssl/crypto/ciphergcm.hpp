@@ -19,7 +19,8 @@
 //    along with this program in the COPYING file.
 //    If not, see <http://www.gnu.org/licenses/>.
 
-// Wrap the OpenSSL GCM API.
+// Wrap the OpenSSL GCM API.  Also handles ChaCha20-Poly1305, which
+// OpenSSL drives through the same EVP AEAD interface.
 
 #ifndef OPENVPN_OPENSSL_CRYPTO_CIPHERGCM_H
 #define OPENVPN_OPENSSL_CRYPTO_CIPHERGCM_H
@@ -57,7 +58,8 @@ namespace openvpn {
       enum {
 	IV_LEN = 12,
 	AUTH_TAG_LEN = 16,
-	SUPPORTS_IN_PLACE_ENCRYPT = 0,
+	SUPPORTS_IN_PLACE_ENCRYPT = 1, // EVP GCM allows input == output
+	SUPPORTS_IN_PLACE_DECRYPT = 1,
       };
 
       CipherContextGCM()
@@ -198,9 +200,24 @@ namespace openvpn {
 
       bool is_initialized() const { return initialized; }
 
+      static bool is_supported(const CryptoAlgs::Type alg)
+      {
+	unsigned int keysize;
+	return cipher_type_noexcept(alg, keysize) != nullptr;
+      }
+
     private:
       static const EVP_CIPHER *cipher_type(const CryptoAlgs::Type alg,
 					   unsigned int& keysize)
+      {
+	const EVP_CIPHER *ciph = cipher_type_noexcept(alg, keysize);
+	if (!ciph)
+	  OPENVPN_THROW(openssl_gcm_error, CryptoAlgs::name(alg) << ": not usable");
+	return ciph;
+      }
+
+      static const EVP_CIPHER *cipher_type_noexcept(const CryptoAlgs::Type alg,
+						    unsigned int& keysize)
       {
 	switch (alg)
 	  {
@@ -213,8 +230,13 @@ namespace openvpn {
 	  case CryptoAlgs::AES_256_GCM:
 	    keysize = 32;
 	    return EVP_aes_256_gcm();
+#if OPENSSL_VERSION_NUMBER >= 0x10100000L && !defined(OPENSSL_NO_CHACHA) && !defined(OPENSSL_NO_POLY1305)
+	  case CryptoAlgs::CHACHA20_POLY1305:
+	    keysize = 32;
+	    return EVP_chacha20_poly1305();
+#endif
 	  default:
-	    OPENVPN_THROW(openssl_gcm_error, CryptoAlgs::name(alg) << ": not usable");
+	    return nullptr;
 	  }
       }
 
@@ -75,6 +75,8 @@ namespace openvpn {
 	initialized = true;
       }
 
+      // A null key makes HMAC_Init_ex copy the keyed inner state saved
+      // by init() rather than hash the ipad again.
       void reset()
       {
 	check_initialized();
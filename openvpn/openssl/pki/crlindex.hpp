@@ -0,0 +1,402 @@
+//    OpenVPN -- An application to securely tunnel IP networks
+//               over a single port, with support for SSL/TLS-based
+//               session authentication and key exchange,
+//               packet encryption, packet authentication, and
+//               packet compression.
+//
+//    Copyright (C) 2012-2016 OpenVPN Technologies, Inc.
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU Affero General Public License Version 3
+//    as published by the Free Software Foundation.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU Affero General Public License for more details.
+//
+//    You should have received a copy of the GNU Affero General Public License
+//    along with this program in the COPYING file.
+//    If not, see <http://www.gnu.org/licenses/>.
+
+// Compact revocation index built from CRLs, for servers with very
+// large CRLs that would be slow to search through the X509_STORE
+
+#ifndef OPENVPN_OPENSSL_PKI_CRLINDEX_H
+#define OPENVPN_OPENSSL_PKI_CRLINDEX_H
+
+#include <string>
+#include <vector>
+#include <cstring>
+#include <cstdint>
+#include <ctime>
+#include <memory>
+#include <algorithm>
+
+#include <openssl/x509.h>
+#include <openssl/evp.h>
+
+#include <openvpn/common/size.hpp>
+#include <openvpn/common/exception.hpp>
+#include <openvpn/common/rc.hpp>
+#include <openvpn/common/mmapfile.hpp>
+#include <openvpn/buffer/buffer.hpp>
+#include <openvpn/openssl/util/error.hpp>
+#include <openvpn/openssl/pki/x509.hpp>
+#include <openvpn/openssl/pki/crl.hpp>
+
+namespace openvpn {
+  namespace OpenSSLPKI {
+
+    // The index is a flat image that is used in place, either built
+    // in memory from parsed CRLs or memory-mapped from a file written
+    // by render():
+    //
+    //   header:  "OVPNCRL1", issuer count (4 bytes), entry count (4 bytes)
+    //   issuers: sorted SHA-256 of DER issuer name (32 bytes),
+    //            CRL nextUpdate as UNIX time or 0 (8 bytes)
+    //   entries: sorted issuer index (4 bytes), serial length with
+    //            0x80 set if negative (1 byte), serial magnitude
+    //            right-aligned (27 bytes)
+    //
+    // All integers are big-endian.  A lookup is two binary searches.
+    class CRLIndex : public RC<thread_unsafe_refcount>
+    {
+    public:
+      typedef RCPtr<CRLIndex> Ptr;
+
+      OPENVPN_EXCEPTION(crl_index_error);
+
+      enum Status {
+	OK=0,
+	REVOKED,
+	NO_CRL,      // no CRL from the cert issuer
+	CRL_EXPIRED, // CRL of the cert issuer is past nextUpdate
+      };
+
+      // Build from parsed CRLs.  If cas is defined, each CRL must be
+      // signed by one of them.
+      static Ptr build(const CRLList& crls, const X509List* cas)
+      {
+	std::vector<Issuer> issuers;
+	std::vector<Entry> entries;
+	for (auto &crl : crls)
+	  {
+	    X509_CRL *c = crl->obj();
+	    if (cas && cas->defined())
+	      verify_crl(c, *cas);
+
+	    Issuer iss;
+	    name_digest(X509_CRL_get_issuer(c), iss.digest);
+	    iss.next_update = next_update(c);
+	    issuers.push_back(iss);
+	  }
+	std::sort(issuers.begin(), issuers.end());
+	merge_issuers(issuers);
+
+	for (auto &crl : crls)
+	  {
+	    X509_CRL *c = crl->obj();
+	    Issuer iss;
+	    name_digest(X509_CRL_get_issuer(c), iss.digest);
+	    const std::uint32_t idx = std::uint32_t(std::lower_bound(issuers.begin(), issuers.end(), iss) - issuers.begin());
+	    STACK_OF(X509_REVOKED) *revoked = X509_CRL_get_REVOKED(c);
+	    const int n = revoked ? sk_X509_REVOKED_num(revoked) : 0;
+	    for (int i = 0; i < n; ++i)
+	      {
+		const X509_REVOKED *r = sk_X509_REVOKED_value(revoked, i);
+		Entry e;
+#if OPENSSL_VERSION_NUMBER >= 0x10100000L
+		const ASN1_INTEGER *serial = X509_REVOKED_get0_serialNumber(r);
+#else
+		const ASN1_INTEGER *serial = r->serialNumber;
+#endif
+		if (!make_entry(e, idx, serial))
+		  throw crl_index_error("CRL serial number too long");
+		entries.push_back(e);
+	      }
+	  }
+	std::sort(entries.begin(), entries.end());
+	entries.erase(std::unique(entries.begin(), entries.end()), entries.end());
+
+	// lay out the image
+	const size_t size = HEADER_SIZE + issuers.size() * ISSUER_SIZE + entries.size() * ENTRY_SIZE;
+	BufferPtr buf(new BufferAllocated(size, 0));
+	unsigned char *h = buf->write_alloc(HEADER_SIZE);
+	std::memcpy(h, magic(), 8);
+	write_u32(h + 8, std::uint32_t(issuers.size()));
+	write_u32(h + 12, std::uint32_t(entries.size()));
+	for (auto &iss : issuers)
+	  {
+	    unsigned char *d = buf->write_alloc(ISSUER_SIZE);
+	    std::memcpy(d, iss.digest, DIGEST_SIZE);
+	    write_u64(d + DIGEST_SIZE, iss.next_update);
+	  }
+	for (auto &e : entries)
+	  buf->write(e.data, ENTRY_SIZE);
+
+	Ptr ret(new CRLIndex());
+	ret->image = std::move(buf);
+	ret->attach(ret->image->c_data(), ret->image->size());
+	return ret;
+      }
+
+      // map an image previously written from render()
+      static Ptr from_file(const std::string& filename)
+      {
+	Ptr ret(new CRLIndex());
+	ret->file.reset(new MappedFile(filename));
+	ret->attach((const unsigned char *)ret->file->c_str(), ret->file->size());
+	return ret;
+      }
+
+      // the index image, to be written to a file for from_file()
+      ConstBuffer render() const
+      {
+	return ConstBuffer(data, size, true);
+      }
+
+      Status check(X509_NAME *issuer, const ASN1_INTEGER *serial) const
+      {
+	Issuer iss;
+	name_digest(issuer, iss.digest);
+	const unsigned char *ip = find_issuer(iss.digest);
+	if (!ip)
+	  return NO_CRL;
+	const std::uint64_t nu = read_u64(ip + DIGEST_SIZE);
+	if (nu && std::uint64_t(std::time(nullptr)) > nu)
+	  return CRL_EXPIRED;
+
+	Entry key;
+	if (!make_entry(key, std::uint32_t((ip - issuers) / ISSUER_SIZE), serial))
+	  return OK; // longer than any serial in the index
+	size_t lo = 0, hi = n_entries;
+	while (lo < hi)
+	  {
+	    const size_t mid = lo + (hi - lo) / 2;
+	    const int c = std::memcmp(entries + mid * ENTRY_SIZE, key.data, ENTRY_SIZE);
+	    if (c == 0)
+	      return REVOKED;
+	    else if (c < 0)
+	      lo = mid + 1;
+	    else
+	      hi = mid;
+	  }
+	return OK;
+      }
+
+      static const char *status_string(const Status status)
+      {
+	switch (status)
+	  {
+	  case OK:
+	    return "OK";
+	  case REVOKED:
+	    return "certificate revoked";
+	  case NO_CRL:
+	    return "unable to get certificate CRL";
+	  case CRL_EXPIRED:
+	    return "CRL has expired";
+	  default:
+	    return "CRL_INDEX_UNKNOWN";
+	  }
+      }
+
+      size_t n_revoked() const
+      {
+	return n_entries;
+      }
+
+    private:
+      enum {
+	DIGEST_SIZE = 32,
+	HEADER_SIZE = 16,
+	ISSUER_SIZE = DIGEST_SIZE + 8,
+	ENTRY_SIZE = 32,
+	SERIAL_SIZE = ENTRY_SIZE - 5,
+      };
+
+      struct Issuer
+      {
+	unsigned char digest[DIGEST_SIZE];
+	std::uint64_t next_update;
+
+	bool operator<(const Issuer& other) const
+	{
+	  return std::memcmp(digest, other.digest, DIGEST_SIZE) < 0;
+	}
+      };
+
+      struct Entry
+      {
+	unsigned char data[ENTRY_SIZE];
+
+	bool operator<(const Entry& other) const
+	{
+	  return std::memcmp(data, other.data, ENTRY_SIZE) < 0;
+	}
+
+	bool operator==(const Entry& other) const
+	{
+	  return std::memcmp(data, other.data, ENTRY_SIZE) == 0;
+	}
+      };
+
+      CRLIndex() {}
+
+      static const char *magic()
+      {
+	return "OVPNCRL1";
+      }
+
+      // validate the image and set up views into it
+      void attach(const unsigned char *d, const size_t s)
+      {
+	if (s < HEADER_SIZE || std::memcmp(d, magic(), 8))
+	  throw crl_index_error("bad CRL index header");
+	n_issuers = read_u32(d + 8);
+	n_entries = read_u32(d + 12);
+	if (s != HEADER_SIZE + n_issuers * ISSUER_SIZE + n_entries * ENTRY_SIZE)
+	  throw crl_index_error("bad CRL index size");
+	data = d;
+	size = s;
+	issuers = d + HEADER_SIZE;
+	entries = issuers + n_issuers * ISSUER_SIZE;
+
+	// lookups rely on strict ordering and valid issuer indices
+	for (size_t i = 1; i < n_issuers; ++i)
+	  if (std::memcmp(issuers + (i - 1) * ISSUER_SIZE, issuers + i * ISSUER_SIZE, DIGEST_SIZE) >= 0)
+	    throw crl_index_error("CRL index issuers not sorted");
+	for (size_t i = 0; i < n_entries; ++i)
+	  {
+	    const unsigned char *e = entries + i * ENTRY_SIZE;
+	    if (read_u32(e) >= n_issuers
+		|| (i && std::memcmp(e - ENTRY_SIZE, e, ENTRY_SIZE) >= 0))
+	      throw crl_index_error("CRL index entries not sorted");
+	  }
+      }
+
+      const unsigned char *find_issuer(const unsigned char *digest) const
+      {
+	size_t lo = 0, hi = n_issuers;
+	while (lo < hi)
+	  {
+	    const size_t mid = lo + (hi - lo) / 2;
+	    const unsigned char *ip = issuers + mid * ISSUER_SIZE;
+	    const int c = std::memcmp(ip, digest, DIGEST_SIZE);
+	    if (c == 0)
+	      return ip;
+	    else if (c < 0)
+	      lo = mid + 1;
+	    else
+	      hi = mid;
+	  }
+	return nullptr;
+      }
+
+      // several CRLs from one issuer: keep the earliest nextUpdate
+      static void merge_issuers(std::vector<Issuer>& issuers)
+      {
+	std::vector<Issuer> out;
+	for (auto &iss : issuers)
+	  {
+	    if (!out.empty() && !std::memcmp(out.back().digest, iss.digest, DIGEST_SIZE))
+	      {
+		std::uint64_t& nu = out.back().next_update;
+		if (iss.next_update && (!nu || iss.next_update < nu))
+		  nu = iss.next_update;
+	      }
+	    else
+	      out.push_back(iss);
+	  }
+	issuers = std::move(out);
+      }
+
+      static bool make_entry(Entry& e, const std::uint32_t issuer_idx, const ASN1_INTEGER *serial)
+      {
+	std::memset(e.data, 0, ENTRY_SIZE);
+	if (!serial || serial->length < 0 || serial->length > SERIAL_SIZE)
+	  return false;
+	write_u32(e.data, issuer_idx);
+	e.data[4] = (unsigned char)serial->length;
+	if (serial->type == V_ASN1_NEG_INTEGER)
+	  e.data[4] |= 0x80;
+	std::memcpy(e.data + ENTRY_SIZE - serial->length, serial->data, serial->length);
+	return true;
+      }
+
+      static void name_digest(X509_NAME *name, unsigned char *digest)
+      {
+	unsigned int len = 0;
+	if (!name || X509_NAME_digest(name, EVP_sha256(), digest, &len) != 1 || len != DIGEST_SIZE)
+	  throw OpenSSLException("CRLIndex: X509_NAME_digest failed");
+      }
+
+      static std::uint64_t next_update(X509_CRL *crl)
+      {
+#if OPENSSL_VERSION_NUMBER >= 0x10100000L
+	const ASN1_TIME *t = X509_CRL_get0_nextUpdate(crl);
+#else
+	const ASN1_TIME *t = X509_CRL_get_nextUpdate(crl);
+#endif
+	int days = 0, secs = 0;
+	if (!t || !ASN1_TIME_diff(&days, &secs, nullptr, t))
+	  return 0;
+	const std::int64_t ret = std::int64_t(std::time(nullptr)) + std::int64_t(days) * 86400 + secs;
+	return ret > 0 ? std::uint64_t(ret) : 1;
+      }
+
+      static void verify_crl(X509_CRL *crl, const X509List& cas)
+      {
+	X509_NAME *issuer = X509_CRL_get_issuer(crl);
+	for (auto &ca : cas)
+	  {
+	    if (X509_NAME_cmp(X509_get_subject_name(ca->obj()), issuer))
+	      continue;
+	    EVP_PKEY *pkey = X509_get_pubkey(ca->obj());
+	    const int ok = pkey ? X509_CRL_verify(crl, pkey) : 0;
+	    EVP_PKEY_free(pkey);
+	    if (ok == 1)
+	      return;
+	  }
+	throw crl_index_error("CRL signature does not verify against any CA");
+      }
+
+      static std::uint32_t read_u32(const unsigned char *p)
+      {
+	return (std::uint32_t(p[0]) << 24) | (std::uint32_t(p[1]) << 16) | (std::uint32_t(p[2]) << 8) | p[3];
+      }
+
+      static std::uint64_t read_u64(const unsigned char *p)
+      {
+	return (std::uint64_t(read_u32(p)) << 32) | read_u32(p + 4);
+      }
+
+      static void write_u32(unsigned char *p, const std::uint32_t v)
+      {
+	p[0] = (unsigned char)(v >> 24);
+	p[1] = (unsigned char)(v >> 16);
+	p[2] = (unsigned char)(v >> 8);
+	p[3] = (unsigned char)v;
+      }
+
+      static void write_u64(unsigned char *p, const std::uint64_t v)
+      {
+	write_u32(p, std::uint32_t(v >> 32));
+	write_u32(p + 4, std::uint32_t(v));
+      }
+
+      BufferPtr image;                  // built in memory, or
+      std::unique_ptr<MappedFile> file; // mapped from a file
+      const unsigned char *data = nullptr;
+      size_t size = 0;
+      const unsigned char *issuers = nullptr;
+      const unsigned char *entries = nullptr;
+      size_t n_issuers = 0;
+      size_t n_entries = 0;
+    };
+
+  }
+}
+
+#endif
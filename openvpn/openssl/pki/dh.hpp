@@ -33,22 +33,23 @@
 #include <openvpn/common/exception.hpp>
 #include <openvpn/openssl/util/error.hpp>
 
-// workaround for bug in DHparams_dup macro on OpenSSL 0.9.8 and lower
-#if SSLEAY_VERSION_NUMBER <= 0x00908000L
-#undef CHECKED_PTR_OF
-#define CHECKED_PTR_OF(type, p) ((char*) (1 ? p : (type*)0))
-#endif
-
 namespace openvpn {
   namespace OpenSSLPKI {
 
     namespace DH_private {
-      // defined outside of DH class to avoid symbol collision in way
-      // that DHparams_dup macro is defined
-      inline ::DH *dup(const ::DH *dh)
+      // DH params are immutable once parsed, so copies share them
+      inline ::DH *ref(const ::DH *dh)
       {
 	if (dh)
-	  return DHparams_dup(const_cast< ::DH * >(dh));
+	  {
+	    ::DH *d = const_cast< ::DH * >(dh);
+#if OPENSSL_VERSION_NUMBER >= 0x10100000L
+	    DH_up_ref(d);
+#else
+	    CRYPTO_add(&d->references, 1, CRYPTO_LOCK_DH);
+#endif
+	    return d;
+	  }
 	else
 	  return nullptr;
       }
@@ -135,8 +136,9 @@ namespace openvpn {
     private:
       void assign(const ::DH *dh)
       {
+	::DH *d = DH_private::ref(dh);
 	erase();
-	dh_ = DH_private::dup(dh);
+	dh_ = d;
       }
 
       ::DH *dh_;
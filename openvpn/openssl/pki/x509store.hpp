@@ -46,7 +46,8 @@ namespace openvpn {
 
       X509Store() : x509_store_(nullptr) {}
 
-      explicit X509Store(const CertCRLList& cc)
+      // load_crls false: certs only, revocation is checked elsewhere
+      explicit X509Store(const CertCRLList& cc, const bool load_crls = true)
       {
 	init();
 
@@ -61,7 +62,7 @@ namespace openvpn {
 
 	// Load CRL list
 	{
-	  if (cc.crls.defined())
+	  if (load_crls && cc.crls.defined())
 	    {
 	      X509_STORE_set_flags(x509_store_, X509_V_FLAG_CRL_CHECK | X509_V_FLAG_CRL_CHECK_ALL);
 	      for (CRLList::const_iterator i = cc.crls.begin(); i != cc.crls.end(); ++i)
@@ -0,0 +1,202 @@
+//    OpenVPN -- An application to securely tunnel IP networks
+//               over a single port, with support for SSL/TLS-based
+//               session authentication and key exchange,
+//               packet encryption, packet authentication, and
+//               packet compression.
+//
+//    Copyright (C) 2012-2016 OpenVPN Technologies, Inc.
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU Affero General Public License Version 3
+//    as published by the Free Software Foundation.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU Affero General Public License for more details.
+//
+//    You should have received a copy of the GNU Affero General Public License
+//    along with this program in the COPYING file.
+//    If not, see <http://www.gnu.org/licenses/>.
+// One server-side OpenSSL context shared by all worker threads,
+// with CRL reload that doesn't stall handshakes.
+
+#ifndef OPENVPN_OPENSSL_SSL_SHAREDCTX_H
+#define OPENVPN_OPENSSL_SSL_SHAREDCTX_H
+
+#include <string>
+#include <mutex>
+#include <memory>
+#include <atomic>
+
+#include <openvpn/common/size.hpp>
+#include <openvpn/common/exception.hpp>
+#include <openvpn/common/rc.hpp>
+#include <openvpn/frame/frame.hpp>
+#include <openvpn/openssl/ssl/sslctx.hpp>
+
+namespace openvpn {
+
+  // Builds one OpenSSLContext -- and so one SSL_CTX, X509_STORE and
+  // one copy of the parsed CA/CRL lists -- and hands out per-thread
+  // SSLFactoryAPI objects that create sessions from it.
+  //
+  // reload_crl() parses the new CRLs and builds a complete new
+  // context on the calling thread, then publishes it by bumping a
+  // generation counter.  Worker threads pick up the new context on
+  // their next handshake; handshakes already running finish against
+  // the context they started with, which stays alive until its last
+  // SSL session is gone.
+  //
+  // The Config and the objects it references are only refcounted by
+  // the contexts built from it, and those are created and destroyed
+  // under one lock, so no thread_unsafe_refcount is ever touched by
+  // two threads at once.  The lock is not taken on the handshake path.
+  class OpenSSLSharedContext : public RC<thread_safe_refcount>
+  {
+  public:
+    typedef RCPtr<OpenSSLSharedContext> Ptr;
+
+    OPENVPN_EXCEPTION(openssl_shared_context_error);
+
+    explicit OpenSSLSharedContext(OpenSSLContext::Config* config_arg)
+      : config_lock(new ConfigLock(config_arg)),
+	generation_(0)
+    {
+      if (!config_arg->get_mode().is_server())
+	throw openssl_shared_context_error("server mode only");
+      std::lock_guard<std::mutex> lock(config_lock->mutex);
+      current = new Context(config_lock, nullptr);
+    }
+
+    // Per-thread factory, suitable for ProtoContext::Config::ssl_factory.
+    // frame must not be shared with other threads.
+    SSLFactoryAPI::Ptr new_factory(const Frame::Ptr& frame)
+    {
+      return SSLFactoryAPI::Ptr(new Factory(Ptr(this), frame));
+    }
+
+    // Replace the CRLs with those in crl_txt (PEM).  Throws on parse
+    // errors, leaving the current context in place.
+    void reload_crl(const std::string& crl_txt)
+    {
+      std::lock_guard<std::mutex> reload(reload_mutex);
+
+      // parse outside of config_lock, this is the slow part
+      OpenSSLContext::CertCRLList trust;
+      OpenSSLContext::CertCRLList::from_string(crl_txt, "crl-verify", nullptr, &trust.crls);
+
+      Context::Ptr ctx;
+      {
+	std::lock_guard<std::mutex> lock(config_lock->mutex);
+	trust.certs = config_lock->config->get_ca().certs;
+	ctx.reset(new Context(config_lock, &trust));
+	trust.certs.clear();
+      }
+      {
+	std::lock_guard<std::mutex> lock(current_mutex);
+	current.swap(ctx);
+	generation_.fetch_add(1, std::memory_order_release);
+      }
+      // old context (ctx) is released here, or by its last SSL session
+    }
+
+    // incremented by each successful reload_crl()
+    size_t generation() const
+    {
+      return generation_.load(std::memory_order_acquire);
+    }
+
+  private:
+    struct ConfigLock
+    {
+      ConfigLock(OpenSSLContext::Config* config_arg)
+	: config(config_arg)
+      {
+      }
+
+      std::mutex mutex;
+      OpenSSLContext::Config::Ptr config;
+    };
+
+    // one immutable build of the SSL_CTX
+    class Context : public RC<thread_safe_refcount>
+    {
+    public:
+      typedef RCPtr<Context> Ptr;
+
+      // caller holds lock_arg->mutex
+      Context(const std::shared_ptr<ConfigLock>& lock_arg,
+	      const OpenSSLContext::CertCRLList* trust)
+	: lock(lock_arg),
+	  ctx(new OpenSSLContext(lock_arg->config.get(), trust))
+      {
+      }
+
+      ~Context()
+      {
+	std::lock_guard<std::mutex> l(lock->mutex);
+	ctx.reset();
+      }
+
+      const OpenSSLContext& context() const { return *ctx; }
+
+    private:
+      std::shared_ptr<ConfigLock> lock;
+      OpenSSLContext::Ptr ctx;
+    };
+
+    class Factory : public SSLFactoryAPI
+    {
+    public:
+      Factory(const OpenSSLSharedContext::Ptr& parent_arg, const Frame::Ptr& frame_arg)
+	: parent(parent_arg),
+	  frame(frame_arg),
+	  mode_(parent_arg->config_lock->config->get_mode()),
+	  generation(0)
+      {
+	refresh();
+      }
+
+      virtual SSLAPI::Ptr ssl()
+      {
+	if (generation != parent->generation())
+	  refresh();
+	return ctx->context().ssl_shared(frame, ctx);
+      }
+
+      virtual SSLAPI::Ptr ssl(const std::string& hostname)
+      {
+	throw openssl_shared_context_error("hostname verification is client only");
+      }
+
+      virtual const Mode& mode() const
+      {
+	return mode_;
+      }
+
+    private:
+      void refresh()
+      {
+	std::lock_guard<std::mutex> lock(parent->current_mutex);
+	ctx = parent->current;
+	generation = parent->generation_.load(std::memory_order_relaxed);
+      }
+
+      OpenSSLSharedContext::Ptr parent;
+      Frame::Ptr frame;
+      const Mode mode_;
+      Context::Ptr ctx;
+      size_t generation;
+    };
+
+    std::shared_ptr<ConfigLock> config_lock;
+    std::mutex reload_mutex;
+    std::mutex current_mutex; // protects current, held only to copy/swap the pointer
+    Context::Ptr current;
+    std::atomic<size_t> generation_;
+  };
+
+}
+
+#endif
@@ -28,10 +28,15 @@
 #include <string>
 #include <cstring>
 #include <sstream>
+#include <vector>
+#include <map>
 #include <utility>
+#include <mutex>
 
 #include <openssl/ssl.h>
 #include <openssl/x509v3.h>
+#include <openssl/evp.h>
+#include <openssl/hmac.h>
 
 #include <openvpn/common/size.hpp>
 #include <openvpn/common/exception.hpp>
@@ -52,14 +57,23 @@
 #include <openvpn/ssl/tls_remote.hpp>
 #include <openvpn/ssl/sslconsts.hpp>
 #include <openvpn/ssl/sslapi.hpp>
+#include <openvpn/ssl/ticketkeys.hpp>
+#include <openvpn/ssl/verifycache.hpp>
 #include <openvpn/openssl/util/error.hpp>
+#include <openvpn/openssl/util/engine.hpp>
 #include <openvpn/openssl/pki/x509.hpp>
 #include <openvpn/openssl/pki/crl.hpp>
+#include <openvpn/openssl/pki/crlindex.hpp>
 #include <openvpn/openssl/pki/pkey.hpp>
 #include <openvpn/openssl/pki/dh.hpp>
 #include <openvpn/openssl/pki/x509store.hpp>
 #include <openvpn/openssl/bio/bio_memq_stream.hpp>
 
+// ASYNC jobs (SSL_MODE_ASYNC) were added in OpenSSL 1.1.0
+#if OPENSSL_VERSION_NUMBER >= 0x10100000L && !defined(OPENSSL_NO_ASYNC)
+#define OPENVPN_OPENSSL_HAVE_ASYNC
+#endif
+
 // An SSL Context is essentially a configuration that can be used
 // to generate an arbitrary number of actual SSL connections objects.
 
@@ -70,8 +84,12 @@ namespace openvpn {
 
   // Represents an SSL configuration that can be used
   // to instantiate actual SSL sessions.
+  class OpenSSLSharedContext;
+
   class OpenSSLContext : public SSLFactoryAPI
   {
+    friend class OpenSSLSharedContext;
+
   public:
     typedef RCPtr<OpenSSLContext> Ptr;
     typedef CertCRLListTemplate<OpenSSLPKI::X509List, OpenSSLPKI::CRLList> CertCRLList;
@@ -112,6 +130,11 @@ namespace openvpn {
 	return mode;
       }
 
+      const CertCRLList& get_ca() const
+      {
+	return ca;
+      }
+
       // if this callback is defined, no private key needs to be loaded
       virtual void set_external_pki_callback(ExternalPKIBase* external_pki_arg)
       {
@@ -126,11 +149,13 @@ namespace openvpn {
       virtual void load_ca(const std::string& ca_txt, bool strict)
       {
 	ca.parse_pem(ca_txt, "ca");
+	trust_changed();
       }
 
       virtual void load_crl(const std::string& crl_txt)
       {
-	throw ssl_options_error("CRL not implemented yet in OpenSSL driver"); // fixme
+	CertCRLList::from_string(crl_txt, "crl-verify", nullptr, &ca.crls);
+	trust_changed();
       }
 
       virtual void load_cert(const std::string& cert_txt)
@@ -192,7 +217,22 @@ namespace openvpn {
 
       virtual void set_tls_version_min_override(const std::string& override)
       {
-	TLSVersion::apply_override(tls_version_min, override);
+	TLSVersion::apply_override(tls_version_min, override, max_tls_version());
+      }
+
+      // TLS 1.3 ciphersuites in OpenSSL format, e.g.
+      // "TLS_AES_256_GCM_SHA384:TLS_CHACHA20_POLY1305_SHA256",
+      // empty for the library default
+      void set_tls_ciphersuites(const std::string& suites)
+      {
+	tls_ciphersuites = suites;
+      }
+
+      // ECDHE groups in preference order, e.g. "X25519:P-256",
+      // empty for our default
+      void set_tls_groups(const std::string& groups)
+      {
+	tls_groups = groups;
       }
 
       virtual void set_local_cert_enabled(const bool v)
@@ -221,6 +261,38 @@ namespace openvpn {
 	// use its own RNG.
       }
 
+      // [server only] issue and accept session tickets under
+      // these keys, requires SSLConst::ENABLE_SESSION_CACHE
+      void set_session_ticket_keys(const TLSTicketKeys::Ptr& keys)
+      {
+	ticket_keys = keys;
+      }
+
+      // [server only] reuse recent successful peer cert verifications
+      // from this cache.  Setting it, or later loading CAs/CRLs,
+      // invalidates entries verified under any previous trust.
+      void set_verify_cache(const TLSVerifyCache::Ptr& cache)
+      {
+	verify_cache = cache;
+	trust_changed();
+      }
+
+      // [server only] check peer certs for revocation against this
+      // index instead of loading CRLs into the X509_STORE
+      void set_crl_index(const OpenSSLPKI::CRLIndex::Ptr& index)
+      {
+	crl_index = index;
+	trust_changed();
+      }
+
+      // build a CRL index from the loaded CRLs, verified against the
+      // loaded CAs, and drop the CRL objects
+      void index_crls()
+      {
+	set_crl_index(OpenSSLPKI::CRLIndex::build(ca.crls, &ca.certs));
+	ca.crls.clear();
+      }
+
       virtual std::string validate_cert(const std::string& cert_txt) const
       {
 	OpenSSLPKI::X509 cert(cert_txt, "cert");
@@ -247,7 +319,9 @@ namespace openvpn {
 
       virtual std::string validate_crl(const std::string& crl_txt) const
       {
-	throw ssl_options_error("CRL not implemented yet in OpenSSL driver"); // fixme
+	OpenSSLPKI::CRLList crls;
+	CertCRLList::from_string(crl_txt, "crl-verify", nullptr, &crls);
+	return crls.render_pem();
       }
 
       virtual void load(const OptionList& opt, const unsigned int lflags)
@@ -285,11 +359,12 @@ namespace openvpn {
 	      }
 	  }
 
-	// DH
+	// DH, "dh none" for ECDHE only
 	if (mode.is_server())
 	  {
 	    const std::string& dh_txt = opt.get("dh", 1, Option::MULTILINE);
-	    load_dh(dh_txt);
+	    if (dh_txt != "none")
+	      load_dh(dh_txt);
 	  }
 
 	// ns-cert-type
@@ -304,18 +379,15 @@ namespace openvpn {
 	tls_remote = opt.get_optional("tls-remote", 1, 256);
 
 	// Parse tls-version-min option.
-	// Assume that presence of SSL_OP_NO_TLSvX macro indicates
-	// that local OpenSSL library implements TLSvX.
-	{
-#         if defined(SSL_OP_NO_TLSv1_2)
-	    const TLSVersion::Type maxver = TLSVersion::V1_2;
-#         elif defined(SSL_OP_NO_TLSv1_1)
-	    const TLSVersion::Type maxver = TLSVersion::V1_1;
-#         else
-            const TLSVersion::Type maxver = TLSVersion::V1_0;
-#         endif
-	  tls_version_min = TLSVersion::parse_tls_version_min(opt, maxver);
-	}
+	tls_version_min = TLSVersion::parse_tls_version_min(opt, max_tls_version());
+
+	// parse tls-ciphersuites (TLS 1.3)
+	tls_ciphersuites = opt.get_optional("tls-ciphersuites", 1, 256);
+
+	// parse tls-groups, or single-curve ecdh-curve
+	tls_groups = opt.get_optional("tls-groups", 1, 256);
+	if (tls_groups.empty())
+	  tls_groups = opt.get_optional("ecdh-curve", 1, 256);
 
 	// unsupported cert checkers
 	{
@@ -323,6 +395,27 @@ namespace openvpn {
       }
 
     private:
+      void trust_changed()
+      {
+	if (verify_cache)
+	  verify_gen = verify_cache->invalidate();
+      }
+
+      // Assume that presence of SSL_OP_NO_TLSvX macro indicates
+      // that local OpenSSL library implements TLSvX.
+      static TLSVersion::Type max_tls_version()
+      {
+#       if defined(SSL_OP_NO_TLSv1_3)
+	  return TLSVersion::V1_3;
+#       elif defined(SSL_OP_NO_TLSv1_2)
+	  return TLSVersion::V1_2;
+#       elif defined(SSL_OP_NO_TLSv1_1)
+	  return TLSVersion::V1_1;
+#       else
+	  return TLSVersion::V1_0;
+#       endif
+      }
+
       Mode mode;
       CertCRLList ca;                   // from OpenVPN "ca" option
       OpenSSLPKI::X509 cert;            // from OpenVPN "cert" option
@@ -338,7 +431,13 @@ namespace openvpn {
       std::string eku;              // if defined, peer cert X509 extended key usage must match this OID/string
       std::string tls_remote;
       TLSVersion::Type tls_version_min; // minimum TLS version that we will negotiate
+      std::string tls_ciphersuites;     // TLS 1.3 ciphersuites, empty for default
+      std::string tls_groups;           // ECDHE groups, empty for default
       X509Track::ConfigSet x509_track_config;
+      TLSTicketKeys::Ptr ticket_keys;
+      TLSVerifyCache::Ptr verify_cache;
+      OpenSSLPKI::CRLIndex::Ptr crl_index;
+      unsigned int verify_gen = 0;      // verify_cache generation of ca
       bool local_cert_enabled;
       bool force_aes_cbc_ciphersuites;
       bool enable_renegotiation;
@@ -377,6 +476,8 @@ namespace openvpn {
 	if (!overflow)
 	  {
 	    const int status = BIO_read(ssl_bio, data, capacity);
+	    if (!resume_checked)
+	      check_resumed();
 	    if (status < 0)
 	      {
 		if (status == -1 && BIO_should_retry(ssl_bio))
@@ -393,7 +494,8 @@ namespace openvpn {
 
       virtual bool read_cleartext_ready() const
       {
-	return !bmq_stream::memq_from_bio(ct_in)->empty() || SSL_pending(ssl) > 0;
+	// a parked ASYNC job is resumed by retrying the read
+	return !bmq_stream::memq_from_bio(ct_in)->empty() || SSL_pending(ssl) > 0 || async_pending();
       }
 
       virtual void write_ciphertext(const BufferPtr& buf)
@@ -425,6 +527,46 @@ namespace openvpn {
 	return authcert;
       }
 
+      virtual bool async_pending() const
+      {
+#ifdef OPENVPN_OPENSSL_HAVE_ASYNC
+	return SSL_waiting_for_async(ssl) == 1;
+#else
+	return false;
+#endif
+      }
+
+      virtual void release_buffers()
+      {
+#if OPENSSL_VERSION_NUMBER >= 0x10100000L
+	SSL_free_buffers(ssl);
+#endif
+      }
+
+      virtual bool export_key_material(unsigned char *dest, const size_t size,
+				       const std::string& label)
+      {
+#if OPENSSL_VERSION_NUMBER >= 0x10001000L
+	return SSL_export_keying_material(ssl, dest, size, label.c_str(), label.length(),
+					  nullptr, 0, 0) == 1;
+#else
+	return false;
+#endif
+      }
+
+      virtual void async_fds(std::vector<int>& fds) const
+      {
+#ifdef OPENVPN_OPENSSL_HAVE_ASYNC
+	size_t n = 0;
+	if (SSL_get_all_async_fds(ssl, nullptr, &n) == 1 && n)
+	  {
+	    std::vector<OSSL_ASYNC_FD> afds(n);
+	    if (SSL_get_all_async_fds(ssl, afds.data(), &n) == 1)
+	      fds.insert(fds.end(), afds.begin(), afds.begin() + n);
+	  }
+#endif
+      }
+
       ~SSL()
       {
 	ssl_erase();
@@ -448,8 +590,19 @@ namespace openvpn {
 	ssl23_method_server_.ssl_pending = ssl_pending_override;
       }
 
+      // With OPENVPN_LAZY_INIT, InitProcess skips init_openssl() and
+      // the first OpenSSLContext does the equivalent instead.
+      static void init_static_once()
+      {
+	static std::once_flag once;
+	std::call_once(once, []() {
+	    openssl_setup_engine("auto");
+	    init_static();
+	  });
+      }
+
     private:
-      SSL(const OpenSSLContext& ctx, const char *hostname)
+      SSL(const OpenSSLContext& ctx, const Frame::Ptr& frame, const char *hostname)
       {
 	ssl_clear();
 	try {
@@ -470,13 +623,15 @@ namespace openvpn {
 	  ssl_bio = BIO_new(BIO_f_ssl());
 	  if (!ssl_bio)
 	    throw OpenSSLException("OpenSSLContext::SSL: BIO_new BIO_f_ssl failed");
-	  ct_in = mem_bio(ctx.config->frame);
-	  ct_out = mem_bio(ctx.config->frame);
+	  ct_in = mem_bio(frame);
+	  ct_out = mem_bio(frame);
 
 	  // set client/server mode
 	  if (ctx.config->mode.is_server())
 	    {
 	      SSL_set_accept_state(ssl);
+	      if (!(ctx.config->flags & SSLConst::ENABLE_SESSION_CACHE))
+		resume_checked = true;
 	      authcert.reset(new AuthCert());
 	      if (!ctx.config->x509_track_config.empty())
 		authcert->x509_track.reset(new X509Track::Set);
@@ -487,6 +642,16 @@ namespace openvpn {
 	      if (ctx.config->flags & SSLConst::ENABLE_SNI)
 		if (SSL_set_tlsext_host_name(ssl, hostname) != 1)
 		  throw OpenSSLException("OpenSSLContext::SSL: SSL_set_tlsext_host_name failed");
+
+	      // offer to resume the last session with this remote
+	      resume_checked = true;
+	      if (ctx.config->flags & SSLConst::ENABLE_SESSION_CACHE)
+		{
+		  session_key = ctx.session_cache_key;
+		  auto i = ctx.session_cache.find(session_key);
+		  if (ctx.session_offer && i != ctx.session_cache.end())
+		    SSL_set_session(ssl, i->second);
+		}
 	    }
 	  else
 	    OPENVPN_THROW(ssl_context_error, "OpenSSLContext::SSL: unknown client/server mode");
@@ -540,9 +705,22 @@ namespace openvpn {
 	return os.str();
       }
 
+      // A resumed session skips certificate verification,
+      // so restore the leaf cert info in authcert from the session.
+      void check_resumed()
+      {
+	if (SSL_is_init_finished(ssl))
+	  {
+	    resume_checked = true;
+	    if (authcert && SSL_session_reused(ssl))
+	      OpenSSLContext::authcert_from_resumed_session(ssl, *authcert);
+	  }
+      }
+
       void ssl_clear()
       {
 	ssl_bio_linkage = false;
+	resume_checked = false;
 	ssl = nullptr;
 	ssl_bio = nullptr;
 	ct_in = nullptr;
@@ -595,8 +773,11 @@ namespace openvpn {
       BIO *ct_in;          // write ciphertext to here
       BIO *ct_out;         // read ciphertext from here
       AuthCert::Ptr authcert;
+      std::string session_key; // client session cache key
       bool ssl_bio_linkage;
       bool overflow;
+      bool resume_checked;
+      RCPtr<RC<thread_safe_refcount>> owner; // keeps a shared context alive, see ssl_shared()
 
       // Helps us to store pointer to self in ::SSL object
       static int mydata_index;
@@ -767,11 +948,16 @@ namespace openvpn {
 
     /////// start of main class implementation
 
-    OpenSSLContext(Config* config_arg)
+    // If trust is defined, it replaces the CAs/CRLs from config.
+    OpenSSLContext(Config* config_arg, const CertCRLList* trust = nullptr)
       : config(config_arg),
 	ctx(nullptr),
-	epki(nullptr)
+	epki(nullptr),
+	verify_gen(config_arg->verify_gen)
     {
+#ifdef OPENVPN_LAZY_INIT
+      SSL::init_static_once();
+#endif
       try
 	{
 	  // Create new SSL_CTX for server or client mode
@@ -782,11 +968,14 @@ namespace openvpn {
 	      if (ctx == nullptr)
 		throw OpenSSLException("OpenSSLContext: SSL_CTX_new failed for server method");
 
-	      // Set DH object
-	      if (!config->dh.defined())
+	      // Set DH object, without one only ECDHE key exchange is offered
+	      if (config->dh.defined())
+		{
+		  if (!SSL_CTX_set_tmp_dh(ctx, config->dh.obj()))
+		    throw OpenSSLException("OpenSSLContext: SSL_CTX_set_tmp_dh failed");
+		}
+	      else if (config->force_aes_cbc_ciphersuites)
 		OPENVPN_THROW(ssl_context_error, "OpenSSLContext: DH not defined");
-	      if (!SSL_CTX_set_tmp_dh(ctx, config->dh.obj()))
-		throw OpenSSLException("OpenSSLContext: SSL_CTX_set_tmp_dh failed");
 	      if (config->enable_renegotiation)
 		SSL_CTX_set_session_cache_mode(ctx, SSL_SESS_CACHE_SERVER);
 	    }
@@ -804,14 +993,39 @@ namespace openvpn {
 	  // Set SSL options
 	  if (!config->enable_renegotiation)
 	    SSL_CTX_set_session_cache_mode(ctx, SSL_SESS_CACHE_OFF);
+	  const bool session_cache = (config->flags & SSLConst::ENABLE_SESSION_CACHE)
+	    && (config->mode.is_client() || config->ticket_keys);
+	  if (session_cache)
+	    {
+	      if (config->mode.is_client())
+		{
+		  // we keep the cache ourselves, keyed by remote
+		  SSL_CTX_set_session_cache_mode(ctx, SSL_SESS_CACHE_CLIENT|SSL_SESS_CACHE_NO_INTERNAL_STORE);
+		  SSL_CTX_sess_set_new_cb(ctx, new_session_callback);
+		}
+	      else
+		{
+		  // stateless tickets only, no server-side session store
+		  static const unsigned char sid_ctx[] = "OpenVPN";
+		  SSL_CTX_set_session_cache_mode(ctx, SSL_SESS_CACHE_OFF);
+		  SSL_CTX_set_session_id_context(ctx, sid_ctx, sizeof(sid_ctx) - 1);
+		  SSL_CTX_set_tlsext_ticket_key_cb(ctx, ticket_key_callback);
+		}
+	    }
+#ifdef OPENVPN_OPENSSL_HAVE_ASYNC
+	  if (config->flags & SSLConst::ENABLE_ASYNC)
+	    SSL_CTX_set_mode(ctx, SSL_MODE_ASYNC);
+#endif
 	  if (!(config->flags & SSLConst::NO_VERIFY_PEER))
 	    {
 	      SSL_CTX_set_verify(ctx, SSL_VERIFY_PEER | SSL_VERIFY_FAIL_IF_NO_PEER_CERT,
 				 config->mode.is_client() ? verify_callback_client : verify_callback_server);
 	      SSL_CTX_set_verify_depth(ctx, 16);
+	      if (config->mode.is_server() && config->verify_cache)
+		SSL_CTX_set_cert_verify_callback(ctx, cert_verify_callback_server, this);
 	    }
 	  long sslopt = SSL_OP_SINGLE_DH_USE | SSL_OP_SINGLE_ECDH_USE | SSL_OP_NO_COMPRESSION;
-	  if (!config->enable_renegotiation)
+	  if (!config->enable_renegotiation && !session_cache)
 	    sslopt |= SSL_OP_NO_TICKET;
 	  if (ssl23)
 	    {
@@ -830,9 +1044,28 @@ namespace openvpn {
 		      sslopt |= SSL_OP_NO_TLSv1_2;
 #                 endif
 	        }
+#             ifdef SSL_OP_NO_TLSv1_3
+	      // TLS 1.3 has no CBC ciphersuites
+	      if (config->force_aes_cbc_ciphersuites)
+		sslopt |= SSL_OP_NO_TLSv1_3;
+#             endif
 	    }
 	  SSL_CTX_set_options(ctx, sslopt);
 
+#if OPENSSL_VERSION_NUMBER >= 0x10101000L
+	  // TLS 1.3 ciphersuites are configured separately from the
+	  // cipher list, and the server sends session tickets after
+	  // the handshake: one if we resume sessions, else none
+	  if (!config->tls_ciphersuites.empty()
+	      && !SSL_CTX_set_ciphersuites(ctx, config->tls_ciphersuites.c_str()))
+	    OPENVPN_THROW(ssl_context_error, "OpenSSLContext: SSL_CTX_set_ciphersuites failed: " << config->tls_ciphersuites);
+	  if (config->mode.is_server())
+	    SSL_CTX_set_num_tickets(ctx, session_cache ? 1 : 0);
+#else
+	  if (!config->tls_ciphersuites.empty())
+	    OPENVPN_THROW(ssl_context_error, "OpenSSLContext: tls-ciphersuites requires OpenSSL 1.1.1 or higher");
+#endif
+
 	  if (config->force_aes_cbc_ciphersuites)
 	    {
 	      if (!SSL_CTX_set_cipher_list(ctx, "DHE-RSA-AES256-SHA:DHE-RSA-AES128-SHA"))
@@ -844,7 +1077,12 @@ namespace openvpn {
 		OPENVPN_THROW(ssl_context_error, "OpenSSLContext: SSL_CTX_set_cipher_list failed");
 #if OPENSSL_VERSION_NUMBER >= 0x10002000L
 	      SSL_CTX_set_ecdh_auto(ctx, 1);
+	      set_groups();
 #endif
+	      // our cipher list orders ECDHE before DHE, so have the
+	      // server enforce it
+	      if (config->mode.is_server())
+		SSL_CTX_set_options(ctx, SSL_OP_CIPHER_SERVER_PREFERENCE);
 	    }
 
 	  if (config->local_cert_enabled)
@@ -885,13 +1123,17 @@ namespace openvpn {
 	    }
 
 	  // Set CAs/CRLs
-	  if (config->ca.certs.defined())
-	    update_trust(config->ca);
+	  if (trust)
+	    new_verify_generation();
+	  else
+	    trust = &config->ca;
+	  if (trust->certs.defined())
+	    set_cert_store(*trust);
 	  else if (!(config->flags & SSLConst::NO_VERIFY_PEER))
 	    OPENVPN_THROW(ssl_context_error, "OpenSSLContext: CA not defined");
 
 	  // keep a reference to this in ctx, for use by verify callback
-	  ctx->app_verify_arg = this;
+	  SSL_CTX_set_app_data(ctx, this);
 
 	  // Show handshake debugging info
 	  if (config->ssl_debug_level)
@@ -908,19 +1150,45 @@ namespace openvpn {
     // create a new SSL instance
     virtual SSLAPI::Ptr ssl()
     {
-      return SSL::Ptr(new SSL(*this, nullptr));
+      SSL::Ptr ret(new SSL(*this, config->frame, nullptr));
+      session_offer = false;
+      return ret;
     }
 
     // like ssl() above but verify hostname against cert CommonName and/or SubjectAltName
     virtual SSLAPI::Ptr ssl(const std::string& hostname)
     {
-      return SSL::Ptr(new SSL(*this, hostname.c_str()));
+      SSL::Ptr ret(new SSL(*this, config->frame, hostname.c_str()));
+      session_offer = false;
+      return ret;
+    }
+
+    // Client session resumption, keyed by remote (see
+    // RemoteList::current_session_cache_key).  Only the next SSL
+    // object offers the cached session, key renegotiations within
+    // the connection do a full handshake to keep forward secrecy.
+    virtual void set_session_cache_key(const std::string& key)
+    {
+      session_cache_key = key;
+      session_offer = true;
+    }
+
+    // Create a server SSL instance without touching any mutable or
+    // refcounted state of this object, so that several threads may
+    // call it concurrently (see OpenSSLSharedContext).  BIO buffers
+    // are allocated from frame, which must belong to the calling
+    // thread, and owner is held until the instance is destroyed.
+    SSLAPI::Ptr ssl_shared(const Frame::Ptr& frame, const RCPtr<RC<thread_safe_refcount>>& owner) const
+    {
+      SSL::Ptr ret(new SSL(*this, frame, nullptr));
+      ret->owner = owner;
+      return ret;
     }
 
     void update_trust(const CertCRLList& cc)
     {
-      OpenSSLPKI::X509Store store(cc);
-      SSL_CTX_set_cert_store(ctx, store.move());
+      set_cert_store(cc);
+      new_verify_generation();
     }
 
     ~OpenSSLContext()
@@ -932,8 +1200,68 @@ namespace openvpn {
     {
       return config->mode;
     }
+
+    virtual bool key_material_export_supported() const
+    {
+      return OPENSSL_VERSION_NUMBER >= 0x10001000L;
+    }
  
   private:
+#if OPENSSL_VERSION_NUMBER >= 0x10002000L
+    void set_groups()
+    {
+      std::string groups = config->tls_groups;
+#if OPENSSL_VERSION_NUMBER >= 0x10100000L
+      if (groups.empty())
+	groups = "X25519:P-256:P-384";
+#endif
+      if (groups.empty())
+	return;
+#if OPENSSL_VERSION_NUMBER >= 0x10101000L
+      if (SSL_CTX_set1_groups_list(ctx, groups.c_str()) != 1)
+#else
+      if (SSL_CTX_set1_curves_list(ctx, groups.c_str()) != 1)
+#endif
+	OPENVPN_THROW(ssl_context_error, "OpenSSLContext: bad tls-groups: " << groups);
+    }
+#endif
+
+    void set_cert_store(const CertCRLList& cc)
+    {
+      OpenSSLPKI::X509Store store(cc, !config->crl_index);
+      SSL_CTX_set_cert_store(ctx, store.move());
+      if (!config->crl_index)
+	resume_crls = cc.crls;
+    }
+
+    // Server: a resumed session skips verification, so check its leaf
+    // cert against the CRLs in force now.  Returns the reason to reject
+    // it, or nullptr.
+    const char *resumed_cert_revoked(::X509 *cert) const
+    {
+      X509_NAME *issuer = X509_get_issuer_name(cert);
+      const ASN1_INTEGER *serial = X509_get_serialNumber(cert);
+      if (config->crl_index)
+	{
+	  const OpenSSLPKI::CRLIndex::Status status = config->crl_index->check(issuer, serial);
+	  return status != OpenSSLPKI::CRLIndex::OK ? OpenSSLPKI::CRLIndex::status_string(status) : nullptr;
+	}
+      for (const auto& crl : resume_crls)
+	{
+	  X509_REVOKED *revoked = nullptr;
+	  if (X509_NAME_cmp(X509_CRL_get_issuer(crl->obj()), issuer) == 0
+	      && X509_CRL_get0_by_serial(crl->obj(), &revoked, const_cast<ASN1_INTEGER *>(serial)) == 1)
+	    return "certificate revoked";
+	}
+      return nullptr;
+    }
+
+    void new_verify_generation()
+    {
+      if (config->verify_cache)
+	verify_gen = config->verify_cache->invalidate();
+    }
+
     // ns-cert-type verification
 
     bool ns_cert_type_defined() const
@@ -1156,9 +1484,14 @@ namespace openvpn {
 				   x509_get_serial_hex(cert));
 		  break;
 		case X509Track::SHA1:
-		  xts.emplace_back(X509Track::SHA1,
-				   depth,
-				   render_hex_sep(cert->sha1_hash, SHA_DIGEST_LENGTH, ':', true));
+		  {
+		    unsigned char md[SHA_DIGEST_LENGTH];
+		    unsigned int md_len = 0;
+		    if (X509_digest(cert, EVP_sha1(), md, &md_len) == 1 && md_len == sizeof(md))
+		      xts.emplace_back(X509Track::SHA1,
+				       depth,
+				       render_hex_sep(md, sizeof(md), ':', true));
+		  }
 		  break;
 		case X509Track::CN:
 		  x509_track_extract_nid(X509Track::CN, NID_commonName, cert, depth, xts);
@@ -1234,13 +1567,16 @@ namespace openvpn {
       ::SSL* ssl = (::SSL*) X509_STORE_CTX_get_ex_data (ctx, SSL_get_ex_data_X509_STORE_CTX_idx());
 
       // get OpenSSLContext
-      const OpenSSLContext* self = (OpenSSLContext*) ssl->ctx->app_verify_arg;
+      const OpenSSLContext* self = (OpenSSLContext*) SSL_CTX_get_app_data(SSL_get_SSL_CTX(ssl));
 
       // get depth
       const int depth = X509_STORE_CTX_get_error_depth(ctx);
 
+      // get the cert being verified
+      ::X509 *current_cert = X509_STORE_CTX_get_current_cert(ctx);
+
       // log subject
-      const std::string subject = x509_get_subject(ctx->current_cert);
+      const std::string subject = x509_get_subject(current_cert);
       if (self->config->flags & SSLConst::LOG_VERIFY_STATUS)
 	OPENVPN_LOG_SSL(cert_status_line(preverify_ok, depth, X509_STORE_CTX_get_error(ctx), subject));
 
@@ -1248,21 +1584,21 @@ namespace openvpn {
       if (depth == 0)
 	{
 	  // verify ns-cert-type
-	  if (self->ns_cert_type_defined() && !self->verify_ns_cert_type(ctx->current_cert))
+	  if (self->ns_cert_type_defined() && !self->verify_ns_cert_type(current_cert))
 	    {
 	      OPENVPN_LOG_SSL("VERIFY FAIL -- bad ns-cert-type in leaf certificate");
 	      preverify_ok = false;
 	    }
 
 	  // verify X509 key usage
-	  if (self->x509_cert_ku_defined() && !self->verify_x509_cert_ku(ctx->current_cert))
+	  if (self->x509_cert_ku_defined() && !self->verify_x509_cert_ku(current_cert))
 	    {
 	      OPENVPN_LOG_SSL("VERIFY FAIL -- bad X509 key usage in leaf certificate");
 	      preverify_ok = false;
 	    }
 
 	  // verify X509 extended key usage
-	  if (self->x509_cert_eku_defined() && !self->verify_x509_cert_eku(ctx->current_cert))
+	  if (self->x509_cert_eku_defined() && !self->verify_x509_cert_eku(current_cert))
 	    {
 	      OPENVPN_LOG_SSL("VERIFY FAIL -- bad X509 extended key usage in leaf certificate");
 	      preverify_ok = false;
@@ -1272,7 +1608,7 @@ namespace openvpn {
 	  if (!self->config->tls_remote.empty())
 	    {
 	      const std::string subj = TLSRemote::sanitize_x509_name(subject);
-	      const std::string common_name = TLSRemote::sanitize_common_name(x509_get_field(ctx->current_cert, NID_commonName));
+	      const std::string common_name = TLSRemote::sanitize_common_name(x509_get_field(current_cert, NID_commonName));
 	      TLSRemote::log(self->config->tls_remote, subj, common_name);
 	      if (!TLSRemote::test(self->config->tls_remote, subj, common_name))
 		{
@@ -1285,13 +1621,145 @@ namespace openvpn {
       return preverify_ok;
     }
 
+    // client: take ownership of a newly negotiated session
+    static int new_session_callback(::SSL *ssl, SSL_SESSION *sess)
+    {
+      OpenSSLContext* self = (OpenSSLContext*) SSL_CTX_get_app_data(SSL_get_SSL_CTX(ssl));
+      SSL* self_ssl = (SSL *) SSL_get_ex_data (ssl, SSL::mydata_index);
+      if (!self_ssl || self_ssl->session_key.empty())
+	return 0;
+      SSL_SESSION*& entry = self->session_cache[self_ssl->session_key];
+      if (entry)
+	SSL_SESSION_free(entry);
+      entry = sess;
+      return 1;
+    }
+
+    // server: encrypt/decrypt session tickets under rotating keys
+    static int ticket_key_callback(::SSL *ssl, unsigned char *key_name, unsigned char *iv,
+				   EVP_CIPHER_CTX *ectx, HMAC_CTX *hctx, int enc)
+    {
+      static_assert(TLSTicketKeys::IV_SIZE == EVP_MAX_IV_LENGTH, "ticket IV size inconsistency");
+      const OpenSSLContext* self = (OpenSSLContext*) SSL_CTX_get_app_data(SSL_get_SSL_CTX(ssl));
+      TLSTicketKeys& keys = *self->config->ticket_keys;
+      try {
+	if (enc)
+	  {
+	    const TLSTicketKeys::Key& key = keys.current();
+	    keys.iv(iv);
+	    std::memcpy(key_name, key.name, TLSTicketKeys::NAME_SIZE);
+	    if (EVP_EncryptInit_ex(ectx, EVP_aes_256_cbc(), nullptr, key.cipher_key, iv) != 1
+		|| HMAC_Init_ex(hctx, key.hmac_key, TLSTicketKeys::HMAC_KEY_SIZE, EVP_sha256(), nullptr) != 1)
+	      return -1;
+	    return 1;
+	  }
+	else
+	  {
+	    bool renew;
+	    const TLSTicketKeys::Key* key = keys.lookup(key_name, renew);
+	    if (!key)
+	      return 0; // unknown or expired key, do a full handshake
+	    if (HMAC_Init_ex(hctx, key->hmac_key, TLSTicketKeys::HMAC_KEY_SIZE, EVP_sha256(), nullptr) != 1
+		|| EVP_DecryptInit_ex(ectx, EVP_aes_256_cbc(), nullptr, key->cipher_key, iv) != 1)
+	      return -1;
+	    return renew ? 2 : 1;
+	  }
+      }
+      catch (const std::exception& e)
+	{
+	  OPENVPN_LOG_SSL("OpenSSLContext::ticket_key_callback: " << e.what());
+	  return -1;
+	}
+    }
+
+    // Server: fill authcert from the leaf cert of a resumed session,
+    // failing it if the cert has been revoked since the session was
+    // issued.  Only the leaf is available, so issuer_fp stays unset.
+    static void authcert_from_resumed_session(::SSL *ssl, AuthCert& authcert)
+    {
+      const OpenSSLContext* self = (OpenSSLContext*) SSL_CTX_get_app_data(SSL_get_SSL_CTX(ssl));
+      ::X509 *cert = SSL_get_peer_certificate(ssl);
+      if (!cert)
+	{
+	  authcert.add_fail(0, AuthCert::Fail::OTHER, "no peer certificate in resumed session");
+	  return;
+	}
+      const char *revoked = self->resumed_cert_revoked(cert);
+      if (revoked)
+	{
+	  OPENVPN_LOG_SSL("VERIFY FAIL (resumed session) -- " << revoked);
+	  authcert.add_fail(0, AuthCert::Fail::OTHER, revoked);
+	}
+      authcert.cn = x509_get_field(cert, NID_commonName);
+      const ASN1_INTEGER *ai = X509_get_serialNumber(cert);
+      authcert.sn = ai ? ASN1_INTEGER_get(ai) : -1;
+      if (authcert.x509_track)
+	x509_track_extract_from_cert(cert, 0, self->config->x509_track_config, *authcert.x509_track);
+      X509_free(cert);
+    }
+
+    // Server: replaces X509_verify_cert() when a verify cache is
+    // configured.  On a hit, fill authcert from the cache and skip
+    // chain validation, cert type checks and x509-track extraction.
+    static int cert_verify_callback_server(X509_STORE_CTX *ctx, void *arg)
+    {
+      const OpenSSLContext* self = (OpenSSLContext*) arg;
+      ::SSL* ssl = (::SSL*) X509_STORE_CTX_get_ex_data (ctx, SSL_get_ex_data_X509_STORE_CTX_idx());
+      SSL* self_ssl = ssl ? (SSL *) SSL_get_ex_data (ssl, SSL::mydata_index) : nullptr;
+      TLSVerifyCache& cache = *self->config->verify_cache;
+
+#if OPENSSL_VERSION_NUMBER >= 0x10100000L
+      ::X509 *cert = X509_STORE_CTX_get0_cert(ctx);
+#else
+      ::X509 *cert = ctx->cert;
+#endif
+
+      unsigned char md[EVP_MAX_MD_SIZE];
+      unsigned int md_len = 0;
+      if (!self_ssl || !self_ssl->authcert || !cert
+#if OPENSSL_VERSION_NUMBER >= 0x10100000L
+	  || X509_cmp_current_time(X509_get0_notAfter(cert)) <= 0
+#else
+	  || X509_cmp_current_time(X509_get_notAfter(cert)) <= 0
+#endif
+	  || X509_digest(cert, EVP_sha256(), md, &md_len) != 1)
+	return X509_verify_cert(ctx);
+      const std::string digest((const char *)md, md_len);
+
+      AuthCert& authcert = *self_ssl->authcert;
+      const TLSVerifyCache::Entry* e = cache.lookup(digest, self->verify_gen);
+      if (e)
+	{
+	  if (self->config->flags & SSLConst::LOG_VERIFY_STATUS)
+	    OPENVPN_LOG_SSL("VERIFY OK (cached): " << x509_get_subject(cert));
+	  authcert.cn = e->cn;
+	  authcert.sn = e->sn;
+	  std::memcpy(authcert.issuer_fp, e->issuer_fp, sizeof(authcert.issuer_fp));
+	  if (authcert.x509_track && e->x509_track)
+	    *authcert.x509_track = *e->x509_track;
+	  return 1;
+	}
+
+      const int ret = X509_verify_cert(ctx);
+      if (ret == 1 && !authcert.is_fail())
+	{
+	  TLSVerifyCache::Entry& ne = cache.insert(digest, self->verify_gen);
+	  ne.cn = authcert.cn;
+	  ne.sn = authcert.sn;
+	  std::memcpy(ne.issuer_fp, authcert.issuer_fp, sizeof(ne.issuer_fp));
+	  if (authcert.x509_track)
+	    ne.x509_track.reset(new X509Track::Set(*authcert.x509_track));
+	}
+      return ret;
+    }
+
     static int verify_callback_server(int preverify_ok, X509_STORE_CTX *ctx)
     {
       // get the OpenSSL SSL object
       ::SSL* ssl = (::SSL*) X509_STORE_CTX_get_ex_data (ctx, SSL_get_ex_data_X509_STORE_CTX_idx());
 
       // get OpenSSLContext
-      const OpenSSLContext* self = (OpenSSLContext*) ssl->ctx->app_verify_arg;
+      const OpenSSLContext* self = (OpenSSLContext*) SSL_CTX_get_app_data(SSL_get_SSL_CTX(ssl));
 
       // get OpenSSLContext::SSL
       SSL* self_ssl = (SSL *) SSL_get_ex_data (ssl, SSL::mydata_index);
@@ -1302,27 +1770,49 @@ namespace openvpn {
       // get depth
       const int depth = X509_STORE_CTX_get_error_depth(ctx);
 
+      // get the cert being verified
+      ::X509 *current_cert = X509_STORE_CTX_get_current_cert(ctx);
+
       // log subject
       if (self->config->flags & SSLConst::LOG_VERIFY_STATUS)
-	OPENVPN_LOG_SSL(cert_status_line(preverify_ok, depth, err, x509_get_subject(ctx->current_cert)));
+	OPENVPN_LOG_SSL(cert_status_line(preverify_ok, depth, err, x509_get_subject(current_cert)));
 
       // record cert error in authcert
       if (!preverify_ok && self_ssl->authcert)
 	self_ssl->authcert->add_fail(depth, cert_fail_code(err), X509_verify_cert_error_string(err));
 
+      // check revocation against CRL index
+      if (self->config->crl_index)
+	{
+	  const OpenSSLPKI::CRLIndex::Status status =
+	    self->config->crl_index->check(X509_get_issuer_name(current_cert),
+					   X509_get_serialNumber(current_cert));
+	  if (status != OpenSSLPKI::CRLIndex::OK)
+	    {
+	      const char *reason = OpenSSLPKI::CRLIndex::status_string(status);
+	      OPENVPN_LOG_SSL("VERIFY FAIL -- " << reason << " [" << depth << ']');
+	      if (self_ssl->authcert)
+		self_ssl->authcert->add_fail(depth, AuthCert::Fail::OTHER, reason);
+	      preverify_ok = false;
+	    }
+	}
+
       if (depth == 1) // issuer cert
 	{
 	  // save the issuer cert fingerprint
 	  if (self_ssl->authcert)
 	    {
 	      static_assert(sizeof(AuthCert::issuer_fp) == SHA_DIGEST_LENGTH, "size inconsistency");
-	      std::memcpy(self_ssl->authcert->issuer_fp, ctx->current_cert->sha1_hash, sizeof(AuthCert::issuer_fp));
+	      unsigned int md_len = 0;
+	      if (X509_digest(current_cert, EVP_sha1(), self_ssl->authcert->issuer_fp, &md_len) != 1
+		  || md_len != sizeof(AuthCert::issuer_fp))
+		std::memset(self_ssl->authcert->issuer_fp, 0, sizeof(AuthCert::issuer_fp));
 	    }
 	}
       else if (depth == 0) // leaf cert
 	{
 	  // verify ns-cert-type
-	  if (self->ns_cert_type_defined() && !self->verify_ns_cert_type(ctx->current_cert))
+	  if (self->ns_cert_type_defined() && !self->verify_ns_cert_type(current_cert))
 	    {
 	      OPENVPN_LOG_SSL("VERIFY FAIL -- bad ns-cert-type in leaf certificate");
 	      if (self_ssl->authcert)
@@ -1331,7 +1821,7 @@ namespace openvpn {
 	    }
 
 	  // verify X509 key usage
-	  if (self->x509_cert_ku_defined() && !self->verify_x509_cert_ku(ctx->current_cert))
+	  if (self->x509_cert_ku_defined() && !self->verify_x509_cert_ku(current_cert))
 	    {
 	      OPENVPN_LOG_SSL("VERIFY FAIL -- bad X509 key usage in leaf certificate");
 	      if (self_ssl->authcert)
@@ -1340,7 +1830,7 @@ namespace openvpn {
 	    }
 
 	  // verify X509 extended key usage
-	  if (self->x509_cert_eku_defined() && !self->verify_x509_cert_eku(ctx->current_cert))
+	  if (self->x509_cert_eku_defined() && !self->verify_x509_cert_eku(current_cert))
 	    {
 	      OPENVPN_LOG_SSL("VERIFY FAIL -- bad X509 extended key usage in leaf certificate");
 	      if (self_ssl->authcert)
@@ -1351,17 +1841,17 @@ namespace openvpn {
 	  if (self_ssl->authcert)
 	    {
 	      // save the Common Name
-	      self_ssl->authcert->cn = x509_get_field(ctx->current_cert, NID_commonName);
+	      self_ssl->authcert->cn = x509_get_field(current_cert, NID_commonName);
 
 	      // save the leaf cert serial number
-	      const ASN1_INTEGER *ai = X509_get_serialNumber(ctx->current_cert);
+	      const ASN1_INTEGER *ai = X509_get_serialNumber(current_cert);
 	      self_ssl->authcert->sn = ai ? ASN1_INTEGER_get(ai) : -1;
 	    }
 	}
 
       // x509-track enabled?
       if (self_ssl->authcert && self_ssl->authcert->x509_track)
-	x509_track_extract_from_cert(ctx->current_cert,
+	x509_track_extract_from_cert(current_cert,
 				     depth,
 				     self->config->x509_track_config,
 				     *self_ssl->authcert->x509_track);
@@ -1386,6 +1876,9 @@ namespace openvpn {
 
     void erase()
     {
+      for (auto &e : session_cache)
+	SSL_SESSION_free(e.second);
+      session_cache.clear();
       if (epki)
 	{
 	  delete epki;
@@ -1401,6 +1894,11 @@ namespace openvpn {
     Config::Ptr config;
     SSL_CTX* ctx;
     ExternalPKIImpl* epki;
+    std::map<std::string, SSL_SESSION*> session_cache; // client only
+    std::string session_cache_key;
+    bool session_offer = false;
+    OpenSSLPKI::CRLList resume_crls; // server: CRLs of the cert store, for resumed sessions
+    unsigned int verify_gen;  // config->verify_cache generation of our trust
   };
 
   int OpenSSLContext::SSL::mydata_index = -1;
@@ -0,0 +1,201 @@
+//    OpenVPN -- An application to securely tunnel IP networks
+//               over a single port, with support for SSL/TLS-based
+//               session authentication and key exchange,
+//               packet encryption, packet authentication, and
+//               packet compression.
+//
+//    Copyright (C) 2012-2016 OpenVPN Technologies, Inc.
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU Affero General Public License Version 3
+//    as published by the Free Software Foundation.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU Affero General Public License for more details.
+//
+//    You should have received a copy of the GNU Affero General Public License
+//    along with this program in the COPYING file.
+//    If not, see <http://www.gnu.org/licenses/>.
+// OpenSSL implementation of the server session token service
+// (see openvpn/server/sesstoken.hpp).
+
+#ifndef OPENVPN_OPENSSL_UTIL_SESSTOKEN_H
+#define OPENVPN_OPENSSL_UTIL_SESSTOKEN_H
+
+#include <string>
+#include <atomic>
+#include <cstring> // for std::memcpy
+#include <cstdint> // for std::uint8_t, std::uint64_t
+
+#include <openvpn/common/size.hpp>
+#include <openvpn/common/exception.hpp>
+#include <openvpn/common/base64.hpp>
+#include <openvpn/common/memneq.hpp>
+#include <openvpn/buffer/buffer.hpp>
+#include <openvpn/random/randapi.hpp>
+#include <openvpn/time/time.hpp>
+#include <openvpn/crypto/cryptoalgs.hpp>
+#include <openvpn/openssl/crypto/hmac.hpp>
+#include <openvpn/openssl/util/tokenencrypt.hpp>
+#include <openvpn/server/sesstoken.hpp>
+
+namespace openvpn {
+
+  // A token is one TokenEncrypt block, laid out before encryption as
+  //
+  //   [0,8)   expiration, seconds since epoch, big-endian
+  //   [8,16)  serial number, unique per factory
+  //   [16,32) HMAC-SHA256(username || [0,16)), truncated
+  //
+  // The HMAC covers the first half, so ECB block swapping or
+  // splicing between tokens is caught on verify.
+  class OpenSSLSessionTokenFactory : public SessionTokenFactory
+  {
+  public:
+    typedef RCPtr<OpenSSLSessionTokenFactory> Ptr;
+
+    OpenSSLSessionTokenFactory(RandomAPI& rng, const unsigned int lifetime_arg)
+      : crypt_key(rng),
+	lifetime(lifetime_arg)
+    {
+      std::uint64_t s;
+      rng.rand_bytes(hmac_key, sizeof(hmac_key));
+      rng.rand_bytes((unsigned char *)&s, sizeof(s));
+      serial = s;
+    }
+
+    virtual SessionToken::Ptr new_obj()
+    {
+      return new Instance(this);
+    }
+
+  private:
+    enum {
+      EXPIRE_OFFSET = 0,
+      SERIAL_OFFSET = 8,
+      TAG_OFFSET = 16,
+      TAG_SIZE = TokenEncrypt::TOK_SIZE - TAG_OFFSET,
+      HMAC_KEY_SIZE = 32,
+    };
+
+    class Instance : public SessionToken
+    {
+    public:
+      Instance(const OpenSSLSessionTokenFactory::Ptr& parent_arg)
+	: parent(parent_arg),
+	  ctx(parent->crypt_key),
+	  hmac(CryptoAlgs::SHA256, parent->hmac_key, HMAC_KEY_SIZE)
+      {
+      }
+
+      virtual std::string generate(const std::string& username)
+      {
+	unsigned char tok[TokenEncrypt::TOK_SIZE];
+	write_u64(tok + EXPIRE_OFFSET, std::uint64_t(Time::now().seconds_since_epoch()) + parent->lifetime);
+	write_u64(tok + SERIAL_OFFSET, parent->serial++);
+	gen_tag(tok + TAG_OFFSET, username, tok);
+	ctx.encrypt.crypt(tok, tok, sizeof(tok));
+	return std::string(prefix()) + base64->encode(tok, sizeof(tok));
+      }
+
+      virtual bool verify(const std::string& username, const std::string& token)
+      {
+	const Request req = { &username, &token };
+	bool ok;
+	return verify_batch(&req, 1, &ok) == 1;
+      }
+
+      // Decode all tokens into one scratch buffer so that they
+      // are decrypted by a single cipher call.
+      virtual size_t verify_batch(const Request* reqs, const size_t n, bool* ok)
+      {
+	constexpr size_t TS = TokenEncrypt::TOK_SIZE;
+	scratch.reset(0, n * TS, 0);
+	unsigned char *data = scratch.data();
+	for (size_t i = 0; i < n; ++i)
+	  ok[i] = decode(data + i * TS, *reqs[i].token);
+	ctx.decrypt.crypt(data, data, n * TS);
+
+	const std::uint64_t now = Time::now().seconds_since_epoch();
+	size_t n_ok = 0;
+	for (size_t i = 0; i < n; ++i)
+	  {
+	    if (ok[i])
+	      {
+		const unsigned char *tok = data + i * TS;
+		unsigned char tag[TAG_SIZE];
+		gen_tag(tag, *reqs[i].username, tok);
+		ok[i] = !crypto::memneq(tag, tok + TAG_OFFSET, TAG_SIZE)
+		        && read_u64(tok + EXPIRE_OFFSET) > now;
+		if (ok[i])
+		  ++n_ok;
+	      }
+	  }
+	std::memset(data, 0, n * TS);
+	return n_ok;
+      }
+
+    private:
+      static bool decode(unsigned char *dest, const std::string& token)
+      {
+	bool ret = false;
+	if (is_token(token))
+	  {
+	    Buffer buf(dest, TokenEncrypt::TOK_SIZE, false);
+	    try {
+	      base64->decode(buf, token.substr(std::strlen(prefix())));
+	      ret = (buf.size() == TokenEncrypt::TOK_SIZE);
+	    }
+	    catch (const std::exception&)
+	      {
+	      }
+	  }
+	if (!ret)
+	  std::memset(dest, 0, TokenEncrypt::TOK_SIZE);
+	return ret;
+      }
+
+      void gen_tag(unsigned char *dest, const std::string& username, const unsigned char *tok)
+      {
+	unsigned char digest[OpenSSLCrypto::HMACContext::MAX_HMAC_SIZE];
+	hmac.reset();
+	hmac.update((const unsigned char *)username.c_str(), username.length());
+	hmac.update(tok, TAG_OFFSET);
+	hmac.final(digest);
+	std::memcpy(dest, digest, TAG_SIZE);
+      }
+
+      static void write_u64(unsigned char *dest, std::uint64_t value)
+      {
+	for (int i = 7; i >= 0; --i)
+	  {
+	    dest[i] = (unsigned char)value;
+	    value >>= 8;
+	  }
+      }
+
+      static std::uint64_t read_u64(const unsigned char *src)
+      {
+	std::uint64_t ret = 0;
+	for (int i = 0; i < 8; ++i)
+	  ret = (ret << 8) | src[i];
+	return ret;
+      }
+
+      OpenSSLSessionTokenFactory::Ptr parent;
+      TokenEncryptDecrypt ctx;
+      OpenSSLCrypto::HMACContext hmac;
+      BufferAllocated scratch;
+    };
+
+    TokenEncrypt::Key crypt_key;
+    unsigned char hmac_key[HMAC_KEY_SIZE];
+    std::atomic<std::uint64_t> serial;
+    const unsigned int lifetime;
+  };
+
+}
+
+#endif
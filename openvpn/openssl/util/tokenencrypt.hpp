@@ -72,17 +72,27 @@ namespace openvpn {
 
       // crypt it
       unsigned char dest[TOK_SIZE];
+      crypt(dest, src, TOK_SIZE);
+
+      // convert result to base64
+      return base64->encode(dest, TOK_SIZE);
+    }
+
+    // Crypt binary data in place or to dest.  Since we run in ECB
+    // mode, size may cover any number of tokens, letting callers
+    // batch several tokens into one cipher call.
+    void crypt(unsigned char *dest, const unsigned char *src, const size_t size)
+    {
+      if (size % TOK_SIZE)
+	OPENVPN_THROW_EXCEPTION("TokenEncrypt: input size=" << size << " is not a multiple of " << TOK_SIZE);
       int outlen=0;
       if (!EVP_CipherInit_ex (&ctx, nullptr, nullptr, nullptr, nullptr, -1))
 	throw OpenSSLException("TokenEncrypt: EVP_CipherInit_ex[2] failed");
-      if (!EVP_CipherUpdate(&ctx, dest, &outlen, src, TOK_SIZE))
+      if (!EVP_CipherUpdate(&ctx, dest, &outlen, src, int(size)))
 	throw OpenSSLException("TokenEncrypt: EVP_CipherUpdate failed");
       // NOTE: we skip EVP_CipherFinal_ex because we are running in ECB mode without padding
-      if (outlen != TOK_SIZE)
+      if (size_t(outlen) != size)
 	OPENVPN_THROW_EXCEPTION("TokenEncrypt: unexpected output length=" << outlen);
-
-      // convert result to base64
-      return base64->encode(dest, TOK_SIZE);
     }
 
   private:
@@ -27,8 +27,13 @@
 #ifndef OPENVPN_OPTIONS_CONTINUATION_H
 #define OPENVPN_OPTIONS_CONTINUATION_H
 
+#include <string>
+#include <vector>
+#include <utility>
+
 #include <openvpn/common/exception.hpp>
 #include <openvpn/common/options.hpp>
+#include <openvpn/buffer/buffer.hpp>
 
 namespace openvpn {
 
@@ -41,12 +46,22 @@ namespace openvpn {
   };
 
   // Aggregate pushed option continuations into a singular option list.
-  // Note that map is not updated until list is complete.
+  // The map is maintained as each fragment arrives, so that a large
+  // push costs no more than the sum of its fragments.
   class OptionListContinuation : public OptionList
   {
   public:
     OPENVPN_SIMPLE_EXCEPTION(olc_complete); // add called when object is already complete
 
+    // Called with each fragment, after filtering, as it arrives,
+    // i.e. before the option list is complete.  May throw to
+    // reject the push.
+    struct ChunkHandler
+    {
+      virtual void push_chunk(const OptionList& chunk, const bool complete) = 0;
+      virtual ~ChunkHandler() {}
+    };
+
     OptionListContinuation(const PushOptionsBase::Ptr& push_base_arg)
       : partial_(false),
 	complete_(false),
@@ -55,26 +70,52 @@ namespace openvpn {
       // Prepend from base where multiple options of the same type can aggregate,
       // so that server-pushed options will be at the end of list.
       if (push_base)
-	extend(push_base->multi, nullptr);
+	{
+	  extend(push_base->multi, nullptr);
+	  update_map();
+	}
+    }
+
+    void set_chunk_handler(ChunkHandler* handler)
+    {
+      chunk_handler = handler;
     }
 
     // call with option list fragments
     void add(const OptionList& other, OptionList::FilterBase* filt)
+    {
+      add(OptionList(other), filt);
+    }
+
+    void add(OptionList&& other, OptionList::FilterBase* filt)
     {
       if (!complete_)
 	{
 	  partial_ = true;
-	  extend(other, filt);
-	  if (!continuation(other))
+	  const bool cont = continuation(other);
+	  if (chunk_handler)
+	    {
+	      OptionList chunk;
+	      chunk.extend(other, filt);
+	      chunk.update_map();
+	      chunk_handler->push_chunk(chunk, !cont);
+	      add_fragment(std::move(chunk), nullptr);
+	    }
+	  else
+	    add_fragment(std::move(other), filt);
+	  if (!cont)
 	    {
 	      if (push_base)
 		{
 		  // Append from base where only a single instance of each option makes sense,
 		  // provided that option wasn't already pushed by server.
-		  update_map();
-		  extend_nonexistent(push_base->singleton);
+		  for (const auto &opt : push_base->singleton)
+		    if (!opt.empty() && map().find(opt.ref(0)) == map().end())
+		      {
+			opt.touch();
+			add_item(opt);
+		      }
 		}
-	      update_map();
 	      complete_ = true;
 	    }
 	}
@@ -89,6 +130,19 @@ namespace openvpn {
     bool complete() const { return complete_; }
 
   private:
+    void add_fragment(OptionList&& other, OptionList::FilterBase* filt)
+    {
+      reserve(size() + other.size());
+      for (auto &opt : other)
+	{
+	  if (!filt || filt->filter(opt))
+	    {
+	      opt.touch();
+	      add_item(std::move(opt));
+	    }
+	}
+    }
+
     static bool continuation(const OptionList& opt)
     {
       const Option *o = opt.get_ptr("push-continuation");
@@ -99,6 +153,67 @@ namespace openvpn {
     bool complete_;
 
     PushOptionsBase::Ptr push_base;
+    ChunkHandler* chunk_handler = nullptr;
+  };
+
+  // Server side: split a list of pushed directives (each already
+  // in wire form, e.g. "route 10.0.0.0 255.255.255.0") into
+  // PUSH_REPLY messages of less than max_size bytes (leaving room
+  // for the null terminator), tagged with
+  // push-continuation so that all of them can be sent back to back
+  // in reply to a single PUSH_REQUEST.
+  class PushReplyFragmenter
+  {
+  public:
+    OPENVPN_EXCEPTION(push_directive_too_large);
+
+    static std::vector<BufferPtr> fragment(const std::vector<std::string>& directives,
+					   const size_t max_size = 1024)
+    {
+      std::vector<BufferPtr> ret;
+      fragment(ret, directives, max_size, true);
+      return ret;
+    }
+
+    // Append fragments to ret.  If final is false, more fragments
+    // will follow, so every fragment is tagged as a continuation.
+    static void fragment(std::vector<BufferPtr>& ret,
+			 const std::vector<std::string>& directives,
+			 const size_t max_size,
+			 const bool final)
+    {
+      static const std::string prefix("PUSH_REPLY");
+      static const std::string cont(",push-continuation 2");
+      static const std::string last(",push-continuation 1");
+
+      std::string msg = prefix;
+      for (const auto &d : directives)
+	{
+	  if (prefix.length() + 1 + d.length() + cont.length() >= max_size)
+	    OPENVPN_THROW(push_directive_too_large, "pushed directive exceeds " << max_size << " bytes: " << d.substr(0, 64));
+	  if (msg.length() + 1 + d.length() + cont.length() >= max_size)
+	    {
+	      msg += cont;
+	      ret.push_back(to_buf(msg));
+	      msg = prefix;
+	    }
+	  msg += ',';
+	  msg += d;
+	}
+      if (!final)
+	msg += cont;
+      else if (!ret.empty())
+	msg += last;
+      ret.push_back(to_buf(msg));
+    }
+
+  private:
+    static BufferPtr to_buf(const std::string& msg)
+    {
+      BufferPtr bp = new BufferAllocated(msg.length() + 1, 0);
+      bp->write((const unsigned char *)msg.c_str(), msg.length());
+      return bp;
+    }
   };
 
 } // namespace openvpn
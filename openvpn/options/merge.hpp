@@ -30,6 +30,7 @@
 #include <string>
 #include <sstream>
 #include <vector>
+#include <memory>
 
 #include <openvpn/common/size.hpp>
 #include <openvpn/common/exception.hpp>
@@ -38,6 +39,7 @@
 #include <openvpn/common/split.hpp>
 #include <openvpn/common/path.hpp>
 #include <openvpn/common/file.hpp>
+#include <openvpn/common/mmapfile.hpp>
 #include <openvpn/common/splitlines.hpp>
 
 namespace openvpn {
@@ -125,8 +127,8 @@ namespace openvpn {
       try {
 	size_t total_size = 0;
 
-	// read the profile
-	std::string orig_profile_content;
+	// map the profile
+	std::unique_ptr<MappedFile> orig_profile;
 	std::string profile_dir;
 	try {
 	  profile_dir = !profile_dir_override.empty() ? profile_dir_override : path::dirname(profile_path);
@@ -134,8 +136,9 @@ namespace openvpn {
 	  const std::string ext = path::ext(basename_);
 	  if (profile_ext.empty() || string::strcasecmp(ext, profile_ext) == 0)
 	    {
-	      orig_profile_content = read_text_utf8(profile_path, max_size);
-	      total_size = orig_profile_content.size();
+	      orig_profile.reset(new MappedFile(profile_path, max_size));
+	      orig_profile->validate_text_utf8(profile_path);
+	      total_size = orig_profile->size();
 	    }
 	  else
 	    {
@@ -152,7 +155,8 @@ namespace openvpn {
 	  }
 
 	// expand the profile
-	expand_profile(orig_profile_content, profile_dir, follow_references, max_line_len, max_size, total_size);
+	expand_profile(orig_profile->c_str(), orig_profile->length(), profile_dir,
+		       follow_references, max_line_len, max_size, total_size);
       }
       catch (const std::exception& e)
 	{
@@ -185,6 +189,22 @@ namespace openvpn {
 			const size_t max_line_len,
 			const size_t max_size,
 			size_t total_size)
+    {
+      expand_profile(orig_profile_content.c_str(), orig_profile_content.length(), profile_dir,
+		     follow_references, max_line_len, max_size, total_size);
+    }
+
+    // Scan the profile in place, each line is copied once, and only
+    // lines that may open a tag or reference a file are tokenized.
+    // Referenced files are mapped and appended to the unified profile
+    // directly.
+    void expand_profile(const char *orig_profile_data,
+			const size_t orig_profile_size,
+			const std::string& profile_dir,
+			const Follow follow_references,
+			const size_t max_line_len,
+			const size_t max_size,
+			size_t total_size)
     {
       if (total_size > max_size)
 	{
@@ -195,13 +215,13 @@ namespace openvpn {
 
       status_ = MERGE_SUCCESS;
 
-      SplitLines in(orig_profile_content, max_line_len);
+      SplitLines in(orig_profile_data, orig_profile_size, max_line_len);
       int line_num = 0;
       bool in_multiline = false;
       bool opaque_multiline = false;
       Option multiline;
 
-      profile_content_.reserve(orig_profile_content.length());
+      profile_content_.reserve(orig_profile_size);
       while (in(true))
 	{
 	  if (in.line_overflow())
@@ -222,7 +242,7 @@ namespace openvpn {
 		  opaque_multiline = false;
 		}
 	    }
-	  else if (!OptionList::ignore_line(line))
+	  else if (!OptionList::ignore_line(line) && may_be_tag_or_fileref(line))
 	    {
 	      Option opt = Split::by_space<Option, OptionList::LexComment, SpaceMatch, Split::NullLimit>(line);
 	      if (opt.size())
@@ -263,6 +283,9 @@ namespace openvpn {
 				}
 			    }
 			}
+		      // "dh none" selects ECDHE only, no file
+		      if (is_fileref && opt.ref(0) == "dh" && opt.ref(1) == "none")
+			is_fileref = false;
 		      if (is_fileref)
 			{
 			  // found a directive referencing a file
@@ -288,7 +311,7 @@ namespace openvpn {
 			  else
 			    {
 			      std::string path;
-			      std::string file_content;
+			      std::unique_ptr<MappedFile> file_content;
 			      bool error = false;
 			      try {
 				if (follow_references == FOLLOW_NONE)
@@ -298,15 +321,16 @@ namespace openvpn {
 				    return;
 				  }
 				path = path::join(profile_dir, fn);
-				file_content = read_text_utf8(path, max_size);
-				total_size += file_content.size();
+				file_content.reset(new MappedFile(path, max_size));
+				file_content->validate_text_utf8(path);
+				total_size += file_content->size();
 				if (total_size > max_size)
 				  {
 				    status_ = MERGE_EXCEPTION;
 				    error_ = fn + ": file too large";
 				    return;
 				  }
-				OptionList::detect_multiline_breakout(file_content, opt.ref(0));
+				OptionList::detect_multiline_breakout(file_content->c_str(), file_content->length(), opt.ref(0));
 			      }
 			      catch (const std::exception& e)
 				{
@@ -335,11 +359,18 @@ namespace openvpn {
 
 				  // format file_content for appending to profile
 				  {
-				    std::ostringstream os;
 				    const std::string& tag = opt.ref(0);
-				    string::add_trailing(file_content, '\n');
-				    os << '<' << tag << ">\n" << file_content << "</" << tag << ">\n";
-				    profile_content_ += os.str();
+				    const size_t len = file_content->length();
+				    profile_content_.reserve(profile_content_.length() + len + 2 * tag.length() + 8);
+				    profile_content_ += '<';
+				    profile_content_ += tag;
+				    profile_content_ += ">\n";
+				    profile_content_.append(file_content->c_str(), len);
+				    if (!len || file_content->c_str()[len-1] != '\n')
+				      profile_content_ += '\n';
+				    profile_content_ += "</";
+				    profile_content_ += tag;
+				    profile_content_ += ">\n";
 				  }
 
 				  // save file we referenced
@@ -373,6 +404,25 @@ namespace openvpn {
 	}
     }
 
+    // Cheap check on the first word of a line, before tokenizing it.
+    // Quoted first words are passed on to the full lexer.
+    static bool may_be_tag_or_fileref(const std::string& line)
+    {
+      size_t i = 0;
+      while (i < line.length() && SpaceMatch::is_space(line[i]))
+	++i;
+      if (i >= line.length())
+	return false;
+      const char c = line[i];
+      if (c == '<' || c == '"' || c == '\'' || c == '\\')
+	return true;
+      size_t j = i;
+      while (j < line.length() && !SpaceMatch::is_space(line[j]))
+	++j;
+      unsigned int flags = 0;
+      return is_fileref_directive(line.substr(i, j - i), flags);
+    }
+
     static bool is_fileref_directive(const std::string& d, unsigned int& flags)
     {
       if (d.length() > 0)
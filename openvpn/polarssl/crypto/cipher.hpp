@@ -56,7 +56,8 @@ namespace openvpn {
       // PolarSSL cipher constants
       enum {
 	MAX_IV_LENGTH = POLARSSL_MAX_IV_LENGTH,
-	CIPH_CBC_MODE = POLARSSL_MODE_CBC
+	CIPH_CBC_MODE = POLARSSL_MODE_CBC,
+	CIPH_CTR_MODE = POLARSSL_MODE_CTR
       };
 
       CipherContext()
@@ -163,6 +164,8 @@ namespace openvpn {
 	    return cipher_info_from_type(POLARSSL_CIPHER_DES_EDE3_CBC);
 	  case CryptoAlgs::BF_CBC:
 	    return cipher_info_from_type(POLARSSL_CIPHER_BLOWFISH_CBC);
+	  case CryptoAlgs::AES_256_CTR:
+	    return cipher_info_from_type(POLARSSL_CIPHER_AES_256_CTR);
 	  default:
 	    OPENVPN_THROW(polarssl_cipher_error, CryptoAlgs::name(alg) << ": not usable");
 	  }
@@ -56,6 +56,7 @@ namespace openvpn {
 	IV_LEN = 12,
 	AUTH_TAG_LEN = 16,
 	SUPPORTS_IN_PLACE_ENCRYPT = 1,
+	SUPPORTS_IN_PLACE_DECRYPT = 1,
       };
 
 #if 0
@@ -108,7 +109,7 @@ namespace openvpn {
 	  OPENVPN_THROW(polarssl_gcm_error, "gcm_crypt_and_tag failed with status=" << status);
       }
 
-      // input and output may NOT be equal
+      // input and output may be equal, but must not partially overlap
       bool decrypt(const unsigned char *input,
 		  unsigned char *output,
 		  size_t length,
@@ -125,6 +126,20 @@ namespace openvpn {
 
       bool is_initialized() const { return initialized; }
 
+      // PolarSSL has no ChaCha20-Poly1305, so only AES-GCM is usable
+      static bool is_supported(const CryptoAlgs::Type alg)
+      {
+	switch (alg)
+	  {
+	  case CryptoAlgs::AES_128_GCM:
+	  case CryptoAlgs::AES_192_GCM:
+	  case CryptoAlgs::AES_256_GCM:
+	    return true;
+	  default:
+	    return false;
+	  }
+      }
+
     private:
       static cipher_id_t cipher_type(const CryptoAlgs::Type alg, unsigned int& keysize)
       {
@@ -26,6 +26,14 @@
 #define OPENVPN_POLARSSL_CRYPTO_HMAC_H
 
 #include <string>
+#include <cstring>
+#include <memory>
+
+#include <polarssl/md4.h>
+#include <polarssl/md5.h>
+#include <polarssl/sha1.h>
+#include <polarssl/sha256.h>
+#include <polarssl/sha512.h>
 
 #include <openvpn/common/size.hpp>
 #include <openvpn/common/exception.hpp>
@@ -68,12 +76,25 @@ namespace openvpn {
 	if (md_hmac_starts(&ctx, key, key_size) < 0)
 	  throw polarssl_hmac_error("md_hmac_starts");
 	initialized = true;
+
+	// Save the digest state after the keyed ipad block so that
+	// reset() can restore it with a copy instead of hashing the
+	// ipad again.  The per-algorithm context also holds the ipad
+	// and opad, so the copy is the complete HMAC state.
+	keyed_size = state_size(ctx.md_info->type);
+	if (keyed_size)
+	  {
+	    keyed.reset(new unsigned char[keyed_size]);
+	    std::memcpy(keyed.get(), ctx.md_ctx, keyed_size);
+	  }
       }
 
       void reset()
       {
 	check_initialized();
-	if (md_hmac_reset(&ctx) < 0)
+	if (keyed_size)
+	  std::memcpy(ctx.md_ctx, keyed.get(), keyed_size);
+	else if (md_hmac_reset(&ctx) < 0)
 	  throw polarssl_hmac_error("md_hmac_reset");
       }
 
@@ -108,6 +129,36 @@ namespace openvpn {
 	    md_free_ctx(&ctx);
 	    initialized = false;
 	  }
+	if (keyed_size)
+	  {
+	    volatile unsigned char *p = keyed.get();
+	    for (size_t i = 0; i < keyed_size; ++i)
+	      p[i] = 0;
+	    keyed.reset();
+	    keyed_size = 0;
+	  }
+      }
+
+      // size of the context md_init_ctx allocates for type, or 0 if unknown
+      static size_t state_size(const md_type_t type)
+      {
+	switch (type)
+	  {
+	  case POLARSSL_MD_MD4:
+	    return sizeof(md4_context);
+	  case POLARSSL_MD_MD5:
+	    return sizeof(md5_context);
+	  case POLARSSL_MD_SHA1:
+	    return sizeof(sha1_context);
+	  case POLARSSL_MD_SHA224:
+	  case POLARSSL_MD_SHA256:
+	    return sizeof(sha256_context);
+	  case POLARSSL_MD_SHA384:
+	  case POLARSSL_MD_SHA512:
+	    return sizeof(sha512_context);
+	  default:
+	    return 0;
+	  }
       }
 
       size_t size_() const
@@ -125,6 +176,8 @@ namespace openvpn {
 
       bool initialized;
       md_context_t ctx;
+      std::unique_ptr<unsigned char[]> keyed;
+      size_t keyed_size = 0;
     };
   }
 }
@@ -253,7 +253,7 @@ namespace openvpn {
 
       virtual void set_tls_version_min_override(const std::string& override)
       {
-	TLSVersion::apply_override(tls_version_min, override);
+	TLSVersion::apply_override(tls_version_min, override, TLSVersion::V1_2); // no TLS 1.3 in PolarSSL
       }
 
       virtual void set_local_cert_enabled(const bool v)
@@ -357,7 +357,8 @@ namespace openvpn {
 	if (mode.is_server())
 	  {
 	    const std::string& dh_txt = opt.get("dh", 1, Option::MULTILINE);
-	    load_dh(dh_txt);
+	    if (dh_txt != "none")
+	      load_dh(dh_txt);
 	  }
 
 	// parse ns-cert-type
@@ -0,0 +1,127 @@
+//    OpenVPN -- An application to securely tunnel IP networks
+//               over a single port, with support for SSL/TLS-based
+//               session authentication and key exchange,
+//               packet encryption, packet authentication, and
+//               packet compression.
+//
+//    Copyright (C) 2012-2016 OpenVPN Technologies, Inc.
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU Affero General Public License Version 3
+//    as published by the Free Software Foundation.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU Affero General Public License for more details.
+//
+//    You should have received a copy of the GNU Affero General Public License
+//    along with this program in the COPYING file.
+//    If not, see <http://www.gnu.org/licenses/>.
+
+// Remember how a proxy authenticated us, so that a reconnect can send
+// the Proxy-Authorization header with the first CONNECT instead of
+// waiting for a 407 challenge.
+
+#ifndef OPENVPN_PROXY_AUTHCACHE_H
+#define OPENVPN_PROXY_AUTHCACHE_H
+
+#include <string>
+#include <cstdio> // for std::snprintf
+
+namespace openvpn {
+  namespace HTTPProxy {
+
+    class AuthCache
+    {
+    public:
+      enum Method {
+	NONE,
+	BASIC,
+	DIGEST,
+	NTLM,
+      };
+
+      // Digest session state from the last challenge.  The nonce stays
+      // usable until the proxy declares it stale, each reuse must carry
+      // a higher nonce-count.
+      struct DigestState
+      {
+	DigestState() : nonce_count(0) {}
+
+	std::string realm;
+	std::string nonce;
+	std::string algorithm;
+	std::string opaque;
+	std::string cnonce;
+	std::string session_key; // H(A1)
+	unsigned int nonce_count;
+      };
+
+      AuthCache() : method_(NONE) {}
+
+      void set(const Method method,
+	       const std::string& proxy_host,
+	       const std::string& proxy_port,
+	       const std::string& username)
+      {
+	method_ = method;
+	key_ = make_key(proxy_host, proxy_port, username);
+	if (method != DIGEST)
+	  digest_ = DigestState();
+      }
+
+      void set_digest(const std::string& proxy_host,
+		      const std::string& proxy_port,
+		      const std::string& username,
+		      const DigestState& ds)
+      {
+	set(DIGEST, proxy_host, proxy_port, username);
+	digest_ = ds;
+      }
+
+      // return the cached method if it was learned from the same
+      // proxy with the same username
+      Method method(const std::string& proxy_host,
+		    const std::string& proxy_port,
+		    const std::string& username) const
+      {
+	if (method_ != NONE && key_ == make_key(proxy_host, proxy_port, username))
+	  return method_;
+	return NONE;
+      }
+
+      DigestState& digest() { return digest_; }
+
+      // advance and render the nonce-count as 8 hex digits
+      std::string next_nonce_count()
+      {
+	char buf[16];
+	std::snprintf(buf, sizeof(buf), "%08x", ++digest_.nonce_count);
+	return buf;
+      }
+
+      void clear()
+      {
+	method_ = NONE;
+	key_.clear();
+	digest_ = DigestState();
+      }
+
+    private:
+      static std::string make_key(const std::string& proxy_host,
+				  const std::string& proxy_port,
+				  const std::string& username)
+      {
+	return proxy_host + ':' + proxy_port + '/' + username;
+      }
+
+      Method method_;
+      std::string key_;
+      DigestState digest_;
+    };
+
+  }
+}
+
+#endif
@@ -0,0 +1,220 @@
+//    OpenVPN -- An application to securely tunnel IP networks
+//               over a single port, with support for SSL/TLS-based
+//               session authentication and key exchange,
+//               packet encryption, packet authentication, and
+//               packet compression.
+//
+//    Copyright (C) 2012-2016 OpenVPN Technologies, Inc.
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU Affero General Public License Version 3
+//    as published by the Free Software Foundation.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU Affero General Public License for more details.
+//
+//    You should have received a copy of the GNU Affero General Public License
+//    along with this program in the COPYING file.
+//    If not, see <http://www.gnu.org/licenses/>.
+
+// Buffered ChaCha20 DRBG.  Produces random bytes in bulk from a
+// ChaCha20 keystream seeded by another RandomAPI, so that callers
+// needing a few bytes per packet (such as CBC IVs) don't pay for a
+// syscall or a locked library call each time.  Not thread safe,
+// create one per thread or per data channel instance.
+
+#ifndef OPENVPN_RANDOM_CHACHARAND_H
+#define OPENVPN_RANDOM_CHACHARAND_H
+
+#include <cstdint>
+#include <cstring>
+#include <string>
+
+#include <openvpn/common/size.hpp>
+#include <openvpn/common/exception.hpp>
+#include <openvpn/random/randapi.hpp>
+
+namespace openvpn {
+
+  class ChaChaRand : public RandomAPI
+  {
+  public:
+    OPENVPN_EXCEPTION(chacha_rand_error);
+
+    typedef RCPtr<ChaChaRand> Ptr;
+
+    // pull a fresh key from seed after this many output bytes
+    enum {
+      RESEED_INTERVAL = 1024*1024,
+    };
+
+    ChaChaRand(const RandomAPI::Ptr& seed_arg)
+      : seed(seed_arg)
+    {
+      if (!seed)
+	throw chacha_rand_error("no seed source");
+      if (!reseed())
+	throw chacha_rand_error("seed failed");
+    }
+
+    ~ChaChaRand()
+    {
+      wipe(key, sizeof(key));
+      wipe(buf, sizeof(buf));
+    }
+
+    // Random algorithm name
+    virtual std::string name() const
+    {
+      return "ChaCha20-" + seed->name();
+    }
+
+    // Fill buffer with random bytes
+    virtual void rand_bytes(unsigned char *out, size_t size)
+    {
+      if (!rndbytes(out, size))
+	throw chacha_rand_error("rand_bytes failed");
+    }
+
+    // Like rand_bytes, but don't throw exception.
+    // Return true on successs, false on fail.
+    virtual bool rand_bytes_noexcept(unsigned char *out, size_t size)
+    {
+      return rndbytes(out, size);
+    }
+
+  private:
+    enum {
+      KEY_SIZE = 32,
+      BLOCK_SIZE = 64,
+      N_BLOCKS = 8,
+      BUF_SIZE = BLOCK_SIZE * N_BLOCKS,
+    };
+
+    bool rndbytes(unsigned char *out, size_t size)
+    {
+      while (size)
+	{
+	  if (avail == 0 && !refill())
+	    return false;
+	  const size_t n = size < avail ? size : avail;
+	  unsigned char *src = buf + BUF_SIZE - avail;
+	  std::memcpy(out, src, n);
+	  wipe(src, n); // don't retain bytes already handed out
+	  avail -= n;
+	  out += n;
+	  size -= n;
+	}
+      return true;
+    }
+
+    // Generate the next batch of keystream under a fresh key.  The
+    // first KEY_SIZE bytes replace the key (fast key erasure), so a
+    // later compromise of this object can't reveal earlier output.
+    bool refill()
+    {
+      if (since_reseed >= RESEED_INTERVAL && !reseed())
+	return false;
+      for (unsigned int i = 0; i < N_BLOCKS; ++i)
+	block(buf + i * BLOCK_SIZE, i);
+      std::memcpy(key, buf, KEY_SIZE);
+      wipe(buf, KEY_SIZE);
+      avail = BUF_SIZE - KEY_SIZE;
+      since_reseed += avail;
+      return true;
+    }
+
+    bool reseed()
+    {
+      unsigned char k[KEY_SIZE];
+      if (!seed->rand_bytes_noexcept(k, sizeof(k)))
+	return false;
+      for (unsigned int i = 0; i < KEY_SIZE; ++i)
+	key[i] ^= k[i];
+      wipe(k, sizeof(k));
+      wipe(buf, sizeof(buf));
+      avail = 0;
+      since_reseed = 0;
+      return true;
+    }
+
+    // ChaCha20 block function (RFC 7539) with a zero nonce; the key
+    // changes on every refill, so the block counter never repeats
+    // under one key.
+    void block(unsigned char *out, const std::uint32_t counter) const
+    {
+      std::uint32_t in[16];
+      in[0] = 0x61707865;
+      in[1] = 0x3320646e;
+      in[2] = 0x79622d32;
+      in[3] = 0x6b206574;
+      for (unsigned int i = 0; i < 8; ++i)
+	in[4 + i] = load32(key + 4 * i);
+      in[12] = counter;
+      in[13] = in[14] = in[15] = 0;
+
+      std::uint32_t x[16];
+      std::memcpy(x, in, sizeof(x));
+      for (unsigned int i = 0; i < 10; ++i)
+	{
+	  quarter(x[0], x[4], x[8], x[12]);
+	  quarter(x[1], x[5], x[9], x[13]);
+	  quarter(x[2], x[6], x[10], x[14]);
+	  quarter(x[3], x[7], x[11], x[15]);
+	  quarter(x[0], x[5], x[10], x[15]);
+	  quarter(x[1], x[6], x[11], x[12]);
+	  quarter(x[2], x[7], x[8], x[13]);
+	  quarter(x[3], x[4], x[9], x[14]);
+	}
+      for (unsigned int i = 0; i < 16; ++i)
+	store32(out + 4 * i, x[i] + in[i]);
+      wipe(x, sizeof(x));
+      wipe(in, sizeof(in));
+    }
+
+    static std::uint32_t rotl(const std::uint32_t v, const unsigned int n)
+    {
+      return (v << n) | (v >> (32 - n));
+    }
+
+    static void quarter(std::uint32_t& a, std::uint32_t& b, std::uint32_t& c, std::uint32_t& d)
+    {
+      a += b; d = rotl(d ^ a, 16);
+      c += d; b = rotl(b ^ c, 12);
+      a += b; d = rotl(d ^ a, 8);
+      c += d; b = rotl(b ^ c, 7);
+    }
+
+    static std::uint32_t load32(const unsigned char *p)
+    {
+      return std::uint32_t(p[0]) | (std::uint32_t(p[1]) << 8)
+	| (std::uint32_t(p[2]) << 16) | (std::uint32_t(p[3]) << 24);
+    }
+
+    static void store32(unsigned char *p, const std::uint32_t v)
+    {
+      p[0] = (unsigned char)v;
+      p[1] = (unsigned char)(v >> 8);
+      p[2] = (unsigned char)(v >> 16);
+      p[3] = (unsigned char)(v >> 24);
+    }
+
+    static void wipe(void *p, const size_t size)
+    {
+      volatile unsigned char *v = static_cast<volatile unsigned char *>(p);
+      for (size_t i = 0; i < size; ++i)
+	v[i] = 0;
+    }
+
+    RandomAPI::Ptr seed;
+    unsigned char key[KEY_SIZE] = {};
+    unsigned char buf[BUF_SIZE];
+    size_t avail = 0;
+    size_t since_reseed = 0;
+  };
+
+}
+
+#endif
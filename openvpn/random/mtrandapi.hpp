@@ -50,6 +50,12 @@ namespace openvpn {
     {
     }
 
+    // deterministic sequence for a given seed
+    explicit MTRand(const rand_type::result_type seed)
+      : rng(seed)
+    {
+    }
+
     // Random algorithm name
     virtual std::string name() const
     {
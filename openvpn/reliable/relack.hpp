@@ -31,6 +31,7 @@
 #include <openvpn/common/socktypes.hpp>
 #include <openvpn/buffer/buffer.hpp>
 #include <openvpn/crypto/packet_id.hpp>
+#include <openvpn/time/time.hpp>
 #include <openvpn/reliable/relcommon.hpp>
 
 namespace openvpn {
@@ -45,6 +46,7 @@ namespace openvpn {
 
     size_t size() const        { return data.size(); }
     bool empty() const         { return data.empty(); }
+    bool full() const          { return data.size() >= max_ack_list_; }
     void push_back(id_t value) { data.push_back(value); }
     id_t front() const         { return data.front(); }
     void pop_front()           { data.pop_front(); }
@@ -53,14 +55,14 @@ namespace openvpn {
     // If live is false, read the ACK IDs, but don't modify rel_send.
     // Return the number of ACK IDs read.
     template <typename REL_SEND>
-    static size_t ack(REL_SEND& rel_send, Buffer& buf, const bool live)
+    static size_t ack(REL_SEND& rel_send, Buffer& buf, const bool live, const Time& now)
     {
       const size_t len = buf.pop_front();
       for (size_t i = 0; i < len; ++i)
 	{
 	  const id_t id = read_id(buf);
 	  if (live)
-	    rel_send.ack(id);
+	    rel_send.ack(id, now);
 	}
       return len;
     }
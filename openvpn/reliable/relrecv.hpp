@@ -88,6 +88,17 @@ namespace openvpn {
       window_.rm_head_nocheck();
     }
 
+    // Return bytes held by buffered packets, zero if none are held
+    size_t buffered_bytes() const
+    {
+      size_t ret = 0;
+      window_.for_each([&ret](const Message& m) {
+	  if (m.defined())
+	    ret += m.packet.buffer().capacity();
+	});
+      return ret;
+    }
+
   private:
     MessageWindow<Message, id_t> window_;
   };
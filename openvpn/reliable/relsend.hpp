@@ -24,6 +24,9 @@
 #ifndef OPENVPN_RELIABLE_RELSEND_H
 #define OPENVPN_RELIABLE_RELSEND_H
 
+#include <cstdint>
+#include <algorithm>
+
 #include <openvpn/common/size.hpp>
 #include <openvpn/common/exception.hpp>
 #include <openvpn/common/msgwin.hpp>
@@ -32,6 +35,75 @@
 
 namespace openvpn {
 
+  // Retransmit timeout estimator (RFC 6298).  Smoothed RTT and
+  // RTT variance are kept in binary ms scaled by 8.  Until the
+  // first sample, and when disabled, the configured tls_timeout
+  // is used as-is.  The estimate is floored at the RFC's 1 s
+  // minimum, or at tls_timeout if that is shorter.
+  class ReliableRTO
+  {
+  public:
+    ReliableRTO() : srtt8(0), rttvar8(0), adaptive(true) {}
+
+    void set_adaptive(const bool enable)
+    {
+      adaptive = enable;
+    }
+
+    bool defined() const
+    {
+      return srtt8 != 0;
+    }
+
+    void sample(const Time::Duration& rtt)
+    {
+      const std::int64_t r8 = std::int64_t(std::max(rtt.raw(), Time::type(1))) * 8;
+      if (!srtt8)
+	{
+	  srtt8 = r8;
+	  rttvar8 = r8 / 2;
+	}
+      else
+	{
+	  const std::int64_t err = r8 > srtt8 ? r8 - srtt8 : srtt8 - r8;
+	  rttvar8 += (err - rttvar8) / 4;
+	  srtt8 += (r8 - srtt8) / 8;
+	}
+    }
+
+    // retransmit timeout after n_retransmit prior retransmissions
+    Time::Duration rto(const Time::Duration& tls_timeout, const unsigned int n_retransmit) const
+    {
+      Time::type t;
+      if (adaptive && srtt8)
+	{
+	  t = Time::type((srtt8 + 4 * rttvar8 + 7) / 8);
+	  t = std::max(t, std::min(tls_timeout.raw(), Time::type(MIN_RTO_MS)));
+	}
+      else
+	t = tls_timeout.raw();
+      const Time::type limit = std::max(tls_timeout.raw(), Time::type(MAX_RTO_MS));
+      for (unsigned int i = 0; i < n_retransmit && t < limit; ++i)
+	t *= 2;
+      return Time::Duration::binary_ms(std::min(t, limit));
+    }
+
+    Time::Duration srtt() const
+    {
+      return Time::Duration::binary_ms(Time::type(srtt8 / 8));
+    }
+
+  private:
+    enum {
+      MIN_RTO_MS = 1024,   // 1 second in binary ms
+      MAX_RTO_MS = 16384,  // 16 seconds in binary ms
+    };
+
+    std::int64_t srtt8;
+    std::int64_t rttvar8;
+    bool adaptive;
+  };
+
   template <typename PACKET>
   class ReliableSendTemplate
   {
@@ -64,6 +136,15 @@ namespace openvpn {
 
     private:
       Time retransmit_at_;
+      Time sent_at_;
+      unsigned int n_retransmit_ = 0;
+      unsigned int n_sacked_after_ = 0; // later messages acked while this one is outstanding
+    };
+
+    // A message is retransmitted immediately once this many
+    // messages sent after it have been acknowledged.
+    enum {
+      FAST_RETRANSMIT_THRESHOLD = 2,
     };
 
     ReliableSendTemplate() : next(0) {}
@@ -121,6 +202,17 @@ namespace openvpn {
       return ret;
     }
 
+    // Return bytes held by buffered packets, zero if none are held
+    size_t buffered_bytes() const
+    {
+      size_t ret = 0;
+      window_.for_each([&ret](const Message& m) {
+	  if (m.defined())
+	    ret += m.packet.buffer().capacity();
+	});
+      return ret;
+    }
+
     // Return a fresh Message object that can be used to
     // construct the next packet in the sequence.  Don't call
     // unless ready() returns true.
@@ -128,19 +220,55 @@ namespace openvpn {
     {
       Message& msg = window_.ref_by_id(next);
       msg.id_ = next++;
-      msg.reset_retransmit(now, tls_timeout);
+      msg.sent_at_ = now;
+      msg.n_retransmit_ = 0;
+      msg.n_sacked_after_ = 0;
+      msg.reset_retransmit(now, rto_.rto(tls_timeout, 0));
       return msg;
     }
 
+    // Call after msg has been retransmitted, backs off its timeout
+    void retransmitted(Message& msg, const Time& now, const Time::Duration& tls_timeout)
+    {
+      ++msg.n_retransmit_;
+      msg.n_sacked_after_ = 0;
+      msg.reset_retransmit(now, rto_.rto(tls_timeout, msg.n_retransmit_));
+    }
+
     // Return true if send queue is ready to receive another packet
     bool ready() const { return window_.in_window(next); }
 
-    // Remove a message from send queue that has been acknowledged
-    void ack(const id_t id) { window_.rm_by_id(id); }
+    // Remove a message from send queue that has been acknowledged.
+    // ACKs are selective, so an ACK for id also tells us that
+    // earlier messages still outstanding were probably lost.
+    void ack(const id_t id, const Time& now)
+    {
+      if (window_.in_window(id))
+	{
+	  const Message& msg = window_.ref_by_id(id);
+	  if (msg.defined())
+	    {
+	      if (!msg.n_retransmit_ && now >= msg.sent_at_) // Karn's algorithm
+		rto_.sample(now - msg.sent_at_);
+	      for (id_t i = head_id(); i < id; ++i)
+		{
+		  Message& m = window_.ref_by_id(i);
+		  if (m.defined() && ++m.n_sacked_after_ == FAST_RETRANSMIT_THRESHOLD)
+		    m.retransmit_at_ = now;
+		}
+	    }
+	}
+      window_.rm_by_id(id);
+    }
+
+    void set_adaptive_rto(const bool enable) { rto_.set_adaptive(enable); }
+
+    const ReliableRTO& rto() const { return rto_; }
 
   private:
     id_t next;
     MessageWindow<Message, id_t> window_;
+    ReliableRTO rto_;
   };
 
 } // namespace openvpn
@@ -0,0 +1,398 @@
+//    OpenVPN -- An application to securely tunnel IP networks
+//               over a single port, with support for SSL/TLS-based
+//               session authentication and key exchange,
+//               packet encryption, packet authentication, and
+//               packet compression.
+//
+//    Copyright (C) 2012-2016 OpenVPN Technologies, Inc.
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU Affero General Public License Version 3
+//    as published by the Free Software Foundation.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU Affero General Public License for more details.
+//
+//    You should have received a copy of the GNU Affero General Public License
+//    along with this program in the COPYING file.
+//    If not, see <http://www.gnu.org/licenses/>.
+// Per-thread dispatcher that batches, coalesces and rate-limits
+// client auth requests on their way to an external auth backend.
+
+#ifndef OPENVPN_SERVER_AUTHDISPATCH_H
+#define OPENVPN_SERVER_AUTHDISPATCH_H
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <unordered_map>
+#include <utility> // for std::move
+#include <algorithm> // for std::min
+
+#include <asio.hpp>
+
+#include <openvpn/common/size.hpp>
+#include <openvpn/common/rc.hpp>
+#include <openvpn/time/time.hpp>
+#include <openvpn/time/asiotimer.hpp>
+#include <openvpn/auth/authcreds.hpp>
+#include <openvpn/auth/authcert.hpp>
+#include <openvpn/server/peeraddr.hpp>
+
+#ifndef OPENVPN_LOG_AUTHDISPATCH
+#define OPENVPN_LOG_AUTHDISPATCH(x)
+#endif
+
+namespace openvpn {
+
+  // A management layer calls submit() from its
+  // ManClientInstanceSend::auth_request.  Requests with identical
+  // credentials that are queued or in flight at the same time share
+  // one backend lookup.  Unique requests are queued and handed to the
+  // Backend in batches of up to Config::max_batch, with at most
+  // Config::max_in_flight requests outstanding; when the queue is
+  // full, new requests fail at once so that clients back off and
+  // retry instead of piling up on a stalled backend.
+  //
+  // All methods, including Backend::auth_batch completion via
+  // batch_done(), must run on the dispatcher's io_context.
+  class AuthDispatcher : public RC<thread_unsafe_refcount>
+  {
+  public:
+    typedef RCPtr<AuthDispatcher> Ptr;
+
+    struct Config
+    {
+      Config()
+	: max_batch(64),
+	  max_in_flight(256),
+	  max_queue(8192),
+	  batch_delay(Time::Duration::milliseconds(10)),
+	  trust_session_token(true)
+      {
+      }
+
+      size_t max_batch;            // requests per backend call
+      size_t max_in_flight;        // requests outstanding at the backend
+      size_t max_queue;            // queued requests before rejecting
+      Time::Duration batch_delay;  // wait for a partial batch to fill
+      bool trust_session_token;    // accept AuthCreds::session_token without a backend call
+    };
+
+    struct Stats
+    {
+      size_t submitted = 0;
+      size_t coalesced = 0;
+      size_t rejected = 0;
+      size_t batches = 0;
+    };
+
+    // Backend verdict, may be subclassed by the backend
+    // to carry attributes such as an ACL ID.
+    struct Result : public RC<thread_unsafe_refcount>
+    {
+      typedef RCPtr<Result> Ptr;
+
+      Result() {}
+
+      Result(const bool ok_arg, const std::string& reason_arg)
+	: ok(ok_arg),
+	  reason(reason_arg)
+      {
+      }
+
+      bool ok = false;
+      std::string reason; // passed to auth_failed if !ok
+    };
+
+    class Request;
+
+    // A client instance waiting for a verdict.
+    class Client : public virtual RC<thread_unsafe_refcount>
+    {
+      friend class AuthDispatcher;
+
+    public:
+      typedef RCPtr<Client> Ptr;
+
+      virtual void auth_done(const Result& result) = 0;
+
+    private:
+      Request* auth_req = nullptr;
+    };
+
+    // One unique set of credentials.  creds, cert and peer_addr
+    // are those of the first client to submit them.
+    class Request : public RC<thread_unsafe_refcount>
+    {
+      friend class AuthDispatcher;
+
+    public:
+      typedef RCPtr<Request> Ptr;
+
+      size_t n_clients() const
+      {
+	return clients.size();
+      }
+
+      AuthCreds::Ptr creds;
+      AuthCert::Ptr cert;
+      PeerAddr::Ptr peer_addr;
+
+      // set by the backend, undefined is treated as a failure
+      Result::Ptr result;
+
+    private:
+      std::string key;
+      std::vector<Client::Ptr> clients;
+      bool in_flight = false;
+    };
+
+    struct Batch : public RC<thread_unsafe_refcount>
+    {
+      typedef RCPtr<Batch> Ptr;
+
+      std::vector<Request::Ptr> requests;
+    };
+
+    struct Backend : public RC<thread_unsafe_refcount>
+    {
+      typedef RCPtr<Backend> Ptr;
+
+      // Authenticate every request in batch, setting request->result,
+      // then call AuthDispatcher::batch_done(batch), synchronously or
+      // later.  Several batches may be outstanding at once, so a
+      // backend with a pool of keep-alive connections to an HTTP/JSON
+      // or RADIUS service can pipeline them.
+      virtual void auth_batch(const Batch::Ptr& batch) = 0;
+
+      virtual void stop() = 0;
+    };
+
+    AuthDispatcher(asio::io_context& io_context,
+		   const Backend::Ptr& backend_arg,
+		   const Config& config_arg = Config())
+      : backend(backend_arg),
+	config(config_arg),
+	timer(io_context)
+    {
+      if (!config.max_batch)
+	config.max_batch = 1;
+      if (config.max_in_flight < config.max_batch)
+	config.max_in_flight = config.max_batch;
+    }
+
+    void submit(const Client::Ptr& client,
+		const AuthCreds::Ptr& creds,
+		const AuthCert::Ptr& cert,
+		const PeerAddr::Ptr& peer_addr)
+    {
+      cancel(client.get());
+      ++stats_.submitted;
+      if (halt)
+	{
+	  client->auth_done(Result(false, "auth dispatcher stopped"));
+	  return;
+	}
+      if (config.trust_session_token && creds->session_token)
+	{
+	  client->auth_done(Result(true, ""));
+	  return;
+	}
+
+      const std::string k = key(*creds, cert.get());
+      auto e = requests.find(k);
+      if (e != requests.end())
+	{
+	  ++stats_.coalesced;
+	  attach(client, *e->second);
+	  return;
+	}
+      if (queue.size() >= config.max_queue)
+	{
+	  ++stats_.rejected;
+	  client->auth_done(Result(false, "auth backend busy"));
+	  return;
+	}
+
+      Request::Ptr req(new Request());
+      req->creds = creds;
+      req->cert = cert;
+      req->peer_addr = peer_addr;
+      req->key = k;
+      attach(client, *req);
+      requests[k] = req;
+      queue.push_back(std::move(req));
+      schedule();
+    }
+
+    // Forget client, for example because it disconnected.  The
+    // backend lookup proceeds if other clients share it or it is
+    // already in flight.
+    void cancel(Client* client)
+    {
+      Request* req = client->auth_req;
+      if (!req)
+	return;
+      client->auth_req = nullptr;
+      Client::Ptr hold(client);
+      for (auto i = req->clients.begin(); i != req->clients.end(); ++i)
+	if (i->get() == client)
+	  {
+	    req->clients.erase(i);
+	    break;
+	  }
+      // queued requests left without clients are skipped by dispatch()
+      if (req->clients.empty() && !req->in_flight)
+	requests.erase(req->key);
+    }
+
+    // Called by the backend when every request of batch has a result.
+    void batch_done(const Batch::Ptr& batch)
+    {
+      if (halt)
+	return;
+      in_flight -= std::min(in_flight, batch->requests.size());
+      for (auto& req : batch->requests)
+	{
+	  auto e = requests.find(req->key);
+	  if (e != requests.end() && e->second.get() == req.get())
+	    requests.erase(e);
+	  req->in_flight = false;
+
+	  std::vector<Client::Ptr> clients;
+	  clients.swap(req->clients);
+	  for (auto& c : clients)
+	    c->auth_req = nullptr;
+	  Result::Ptr result = req->result;
+	  if (!result)
+	    result.reset(new Result(false, "auth backend error"));
+	  for (auto& c : clients)
+	    c->auth_done(*result);
+	}
+      dispatch(true);
+    }
+
+    void stop()
+    {
+      if (!halt)
+	{
+	  halt = true;
+	  timer.cancel();
+	  for (auto& e : requests)
+	    {
+	      for (auto& c : e.second->clients)
+		c->auth_req = nullptr;
+	      e.second->clients.clear();
+	    }
+	  requests.clear();
+	  queue.clear();
+	  if (backend)
+	    backend->stop();
+	}
+    }
+
+    const Stats& stats() const
+    {
+      return stats_;
+    }
+
+    size_t n_queued() const
+    {
+      return queue.size();
+    }
+
+    size_t n_in_flight() const
+    {
+      return in_flight;
+    }
+
+  private:
+    static std::string key(const AuthCreds& creds, const AuthCert* cert)
+    {
+      std::string ret = creds.username;
+      ret += '\0';
+      ret += creds.password.to_string();
+      if (cert && cert->defined())
+	{
+	  ret += '\0';
+	  ret += cert->to_string();
+	}
+      return ret;
+    }
+
+    static void attach(const Client::Ptr& client, Request& req)
+    {
+      client->auth_req = &req;
+      req.clients.push_back(client);
+    }
+
+    // Send full batches now, or wait up to batch_delay
+    // for a partial one to fill.
+    void schedule()
+    {
+      if (queue.size() >= config.max_batch)
+	dispatch(false);
+      else if (!timer_armed)
+	{
+	  timer_armed = true;
+	  timer.expires_at(Time::now() + config.batch_delay);
+	  timer.async_wait([self=Ptr(this)](const asio::error_code& error)
+			   {
+			     self->timer_armed = false;
+			     if (!error && !self->halt)
+			       self->dispatch(true);
+			   });
+	}
+    }
+
+    void dispatch(const bool partial)
+    {
+      while (!halt && in_flight < config.max_in_flight)
+	{
+	  // drop queued requests whose clients have all cancelled
+	  while (!queue.empty() && queue.front()->clients.empty())
+	    queue.pop_front();
+	  const size_t n = std::min(config.max_batch, config.max_in_flight - in_flight);
+	  if (queue.empty() || (!partial && queue.size() < n))
+	    break;
+
+	  Batch::Ptr batch(new Batch());
+	  batch->requests.reserve(std::min(n, queue.size()));
+	  while (!queue.empty() && batch->requests.size() < n)
+	    {
+	      Request::Ptr req = std::move(queue.front());
+	      queue.pop_front();
+	      if (req->clients.empty())
+		continue;
+	      req->in_flight = true;
+	      batch->requests.push_back(std::move(req));
+	    }
+	  if (batch->requests.empty())
+	    break;
+	  in_flight += batch->requests.size();
+	  ++stats_.batches;
+	  OPENVPN_LOG_AUTHDISPATCH("AuthDispatcher: batch of " << batch->requests.size() << ", in flight " << in_flight << ", queued " << queue.size());
+	  backend->auth_batch(batch);
+	}
+      if (!queue.empty() && !halt && in_flight < config.max_in_flight)
+	schedule();
+    }
+
+    Backend::Ptr backend;
+    Config config;
+    AsioTimer timer;
+    bool timer_armed = false;
+    bool halt = false;
+
+    std::unordered_map<std::string, Request::Ptr> requests; // queued or in flight, by key
+    std::deque<Request::Ptr> queue;
+    size_t in_flight = 0;
+    Stats stats_;
+  };
+
+}
+
+#endif
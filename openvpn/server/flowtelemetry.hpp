@@ -0,0 +1,539 @@
+//    OpenVPN -- An application to securely tunnel IP networks
+//               over a single port, with support for SSL/TLS-based
+//               session authentication and key exchange,
+//               packet encryption, packet authentication, and
+//               packet compression.
+//
+//    Copyright (C) 2012-2016 OpenVPN Technologies, Inc.
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU Affero General Public License Version 3
+//    as published by the Free Software Foundation.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU Affero General Public License for more details.
+//
+//    You should have received a copy of the GNU Affero General Public License
+//    along with this program in the COPYING file.
+//    If not, see <http://www.gnu.org/licenses/>.
+
+// Sampled flow telemetry for the server data path, exported as IPFIX
+// (RFC 7011) over UDP.  Each server thread takes 1 in N packets into
+// its own flow cache keyed by the inner 5-tuple, session and
+// direction.  Expired flows are handed to a background thread once
+// per flush interval, which encodes and sends them, so an unsampled
+// packet costs one counter increment and one branch.
+
+#ifndef OPENVPN_SERVER_FLOWTELEMETRY_H
+#define OPENVPN_SERVER_FLOWTELEMETRY_H
+
+#include <string>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <cstddef> // for offsetof
+#include <ctime>
+#include <algorithm>
+
+#include <asio.hpp>
+
+#include <openvpn/common/size.hpp>
+#include <openvpn/common/exception.hpp>
+#include <openvpn/common/rc.hpp>
+#include <openvpn/common/hash.hpp>
+#include <openvpn/common/options.hpp>
+#include <openvpn/common/hostport.hpp>
+#include <openvpn/buffer/buffer.hpp>
+#include <openvpn/addr/ip.hpp>
+#include <openvpn/ip/pktclass.hpp>
+
+namespace openvpn {
+
+  class FlowTelemetry : public RC<thread_safe_refcount>
+  {
+  public:
+    typedef RCPtr<FlowTelemetry> Ptr;
+
+    OPENVPN_EXCEPTION(flow_telemetry_error);
+
+    // IPFIX flowDirection values
+    enum Direction {
+      FROM_CLIENT = 0, // ingress: decrypted from the client
+      TO_CLIENT = 1,   // egress: routed to the client
+    };
+
+    struct Config
+    {
+      Config() {}
+
+      // flow-export <collector-addr> [port] [sampling] [cache-size]
+      explicit Config(const OptionList& opt)
+      {
+	const Option* o = opt.get_ptr("flow-export");
+	if (!o)
+	  return;
+	collector = IP::Addr::from_string(o->get(1, 256), "flow-export collector");
+	if (o->size() >= 3)
+	  port = HostPort::parse_port(o->get(2, 16), "flow-export port");
+	sampling = o->get_num<unsigned int>(3, sampling, 1, 1000000);
+	cache_size = o->get_num<size_t>(4, cache_size, 16, 1 << 20);
+      }
+
+      bool defined() const
+      {
+	return collector.defined();
+      }
+
+      IP::Addr collector;
+      unsigned short port = 4739;     // IANA IPFIX port
+      unsigned int sampling = 1000;   // take 1 in N packets
+      size_t cache_size = 4096;       // flows per thread, rounded up to a power of 2
+      std::uint32_t domain_id = 0;    // IPFIX observation domain
+      unsigned int active_timeout = 60; // seconds before a long flow is exported
+      unsigned int idle_timeout = 15;   // seconds without sample before export
+      unsigned int flush_ms = 1000;     // per-thread handoff interval
+      size_t max_queue = 65536;         // records waiting for export, excess dropped
+    };
+
+    // one exported flow
+    struct Record
+    {
+      std::uint8_t addr[32];  // source then destination, IPv4 in first 4 bytes of each
+      std::uint64_t session;  // exported as commonPropertiesId
+      std::uint16_t sport;
+      std::uint16_t dport;
+      std::uint8_t version;
+      std::uint8_t proto;
+      std::uint8_t dir;
+      std::uint8_t pad;
+
+      std::uint64_t packets;  // sampled counts, scaled by the collector
+      std::uint64_t bytes;
+      std::uint64_t first_ms; // wall clock
+      std::uint64_t last_ms;
+    };
+
+    // Flow cache owned by one server thread, which must be the only
+    // one to call its methods.
+    class PerThread
+    {
+      friend class FlowTelemetry;
+
+    public:
+      // Data path hook for a cleartext packet.
+      void sample(const Buffer& buf, const std::uint64_t session, const Direction dir)
+      {
+	if (++count < interval)
+	  return;
+	record(buf, session, dir);
+      }
+
+      // Call from the thread periodically (e.g. from housekeeping) so
+      // that flows on a quiet thread still get exported.
+      void poll()
+      {
+	const std::uint64_t now = now_ms();
+	if (now >= next_flush)
+	  flush(now);
+      }
+
+    private:
+      enum {
+	MAX_PROBE = 8, // linear probe length before evicting
+	KEY_SIZE = offsetof(Record, packets),
+      };
+
+      void init(FlowTelemetry* owner_arg, const Config& config)
+      {
+	owner = owner_arg;
+	interval = config.sampling;
+	size_t n = 16;
+	while (n < config.cache_size)
+	  n <<= 1;
+	table.resize(n);
+	used.resize(n, false);
+	mask = n - 1;
+	active_ms = std::uint64_t(config.active_timeout) * 1000;
+	idle_ms = std::uint64_t(config.idle_timeout) * 1000;
+	flush_ms = config.flush_ms;
+      }
+
+      void record(const Buffer& buf, const std::uint64_t session, const Direction dir)
+      {
+	count = 0;
+	IPClass::Meta m;
+	if (!IPClass::parse(buf, m))
+	  return;
+
+	Record key;
+	std::memset(&key, 0, sizeof(key));
+	std::memcpy(key.addr, m.addr, sizeof(key.addr));
+	if (m.version == 4)
+	  {
+	    std::memset(key.addr + 4, 0, 12);
+	    std::memset(key.addr + 20, 0, 12);
+	  }
+	key.session = session;
+	key.sport = m.sport;
+	key.dport = m.dport;
+	key.version = m.version;
+	key.proto = m.proto;
+	key.dir = (std::uint8_t)dir;
+
+	std::size_t h = 0;
+	Hash::combine_data(h, &key, KEY_SIZE);
+	const std::uint64_t now = now_ms();
+
+	// probe a short chain, inserting at the first free slot, and
+	// evict the flow at the home slot if the chain is full
+	const size_t home = h & mask;
+	size_t slot = home;
+	bool found = false;
+	for (size_t i = 0; i < MAX_PROBE; ++i, slot = (slot + 1) & mask)
+	  {
+	    if (!used[slot])
+	      {
+		key.first_ms = now;
+		table[slot] = key;
+		used[slot] = true;
+		found = true;
+		break;
+	      }
+	    if (!std::memcmp(&table[slot], &key, KEY_SIZE))
+	      {
+		found = true;
+		break;
+	      }
+	  }
+	if (!found)
+	  {
+	    slot = home;
+	    out.push_back(table[slot]);
+	    key.first_ms = now;
+	    table[slot] = key;
+	  }
+
+	Record& r = table[slot];
+	++r.packets;
+	r.bytes += buf.size();
+	r.last_ms = now;
+
+	if (now >= next_flush)
+	  flush(now);
+      }
+
+      // export flows that are idle or have been active too long,
+      // then hand them to the exporter thread
+      void flush(const std::uint64_t now)
+      {
+	next_flush = now + flush_ms;
+	for (size_t i = 0; i < table.size(); ++i)
+	  if (used[i])
+	    {
+	      const Record& r = table[i];
+	      if (now - r.last_ms >= idle_ms || now - r.first_ms >= active_ms)
+		{
+		  out.push_back(r);
+		  used[i] = false;
+		}
+	    }
+	// later entries of a probe chain stay reachable once an earlier
+	// one is freed, since lookups stop at the first match, and any
+	// duplicate this creates is just a flow split in two records
+	if (!out.empty())
+	  {
+	    owner->enqueue(out);
+	    out.clear();
+	  }
+      }
+
+      static std::uint64_t now_ms()
+      {
+	return (std::uint64_t)std::chrono::duration_cast<std::chrono::milliseconds>(
+	  std::chrono::system_clock::now().time_since_epoch()).count();
+      }
+
+      FlowTelemetry* owner = nullptr;
+      unsigned int count = 0;
+      unsigned int interval = 1;
+      std::vector<Record> table;
+      std::vector<bool> used;
+      size_t mask = 0;
+      std::vector<Record> out;
+      std::uint64_t next_flush = 0;
+      std::uint64_t active_ms = 0;
+      std::uint64_t idle_ms = 0;
+      std::uint64_t flush_ms = 0;
+    };
+
+    FlowTelemetry(const Config& config_arg, const unsigned int n_threads)
+      : config(config_arg),
+	thr(n_threads),
+	socket(io_context)
+    {
+      if (!n_threads)
+	throw flow_telemetry_error("no threads");
+      if (!config.defined())
+	throw flow_telemetry_error("no collector");
+      for (auto &pt : thr)
+	pt.init(this, config);
+      endpoint = asio::ip::udp::endpoint(config.collector.to_asio(), config.port);
+      socket.open(endpoint.protocol());
+      exporter = std::thread([this]() { run(); });
+    }
+
+    ~FlowTelemetry()
+    {
+      stop();
+    }
+
+    // Stop the exporter thread after a final export of what has been
+    // handed off.  Flows still in the per-thread caches are discarded.
+    void stop()
+    {
+      {
+	std::lock_guard<std::mutex> lock(mutex);
+	if (halt)
+	  return;
+	halt = true;
+      }
+      cv.notify_all();
+      if (exporter.joinable())
+	exporter.join();
+      asio::error_code ec;
+      socket.close(ec);
+    }
+
+    // The cache must only be used from its own thread.
+    PerThread& per_thread(const unsigned int index)
+    {
+      if (index >= thr.size())
+	throw flow_telemetry_error("thread index out of range");
+      return thr[index];
+    }
+
+    // identifies a session in exported records (commonPropertiesId)
+    std::uint64_t new_session_id()
+    {
+      return next_session_id.fetch_add(1, std::memory_order_relaxed) + 1;
+    }
+
+    std::uint64_t exported() const { return exported_.load(std::memory_order_relaxed); }
+    std::uint64_t dropped() const { return dropped_.load(std::memory_order_relaxed); }
+
+  private:
+    enum {
+      IPFIX_VERSION = 10,
+      MSG_HEADER = 16,
+      SET_HEADER = 4,
+      TEMPLATE_SET_ID = 2,
+      TEMPLATE_V4 = 256,
+      TEMPLATE_V6 = 257,
+      MAX_MESSAGE = 1400,
+      TEMPLATE_REFRESH = 30, // seconds
+    };
+
+    struct Field
+    {
+      std::uint16_t id;
+      std::uint16_t len;
+    };
+
+    void enqueue(const std::vector<Record>& recs)
+    {
+      {
+	std::lock_guard<std::mutex> lock(mutex);
+	const size_t room = config.max_queue > queue.size() ? config.max_queue - queue.size() : 0;
+	const size_t n = std::min(room, recs.size());
+	queue.insert(queue.end(), recs.begin(), recs.begin() + n);
+	if (n < recs.size())
+	  dropped_.fetch_add(recs.size() - n, std::memory_order_relaxed);
+      }
+      cv.notify_one();
+    }
+
+    void run()
+    {
+      std::vector<Record> work;
+      for (;;)
+	{
+	  {
+	    std::unique_lock<std::mutex> lock(mutex);
+	    cv.wait(lock, [this]() { return halt || !queue.empty(); });
+	    work.swap(queue);
+	    if (halt && work.empty())
+	      return;
+	  }
+	  export_records(work);
+	  work.clear();
+	}
+    }
+
+    static const std::vector<Field>& fields(const std::uint8_t version)
+    {
+      static const std::vector<Field> v4 = { // CONST GLOBAL
+	{8, 4}, {12, 4},          // sourceIPv4Address, destinationIPv4Address
+	{4, 1}, {7, 2}, {11, 2},  // protocolIdentifier, source/destinationTransportPort
+	{61, 1}, {137, 8},        // flowDirection, commonPropertiesId
+	{2, 8}, {1, 8},           // packetDeltaCount, octetDeltaCount
+	{152, 8}, {153, 8},       // flowStart/EndMilliseconds
+	{305, 4},                 // samplingPacketInterval
+      };
+      static const std::vector<Field> v6 = { // CONST GLOBAL
+	{27, 16}, {28, 16},       // sourceIPv6Address, destinationIPv6Address
+	{4, 1}, {7, 2}, {11, 2},
+	{61, 1}, {137, 8},
+	{2, 8}, {1, 8},
+	{152, 8}, {153, 8},
+	{305, 4},
+      };
+      return version == 6 ? v6 : v4;
+    }
+
+    static size_t record_size(const std::uint8_t version)
+    {
+      size_t ret = 0;
+      for (auto &f : fields(version))
+	ret += f.len;
+      return ret;
+    }
+
+    template <typename T>
+    static void put(Buffer& b, const T v)
+    {
+      for (int shift = int(sizeof(T) * 8) - 8; shift >= 0; shift -= 8)
+	b.push_back((unsigned char)(v >> shift));
+    }
+
+    void write_templates(Buffer& b)
+    {
+      const std::vector<Field>& f4 = fields(4);
+      const std::vector<Field>& f6 = fields(6);
+      put<std::uint16_t>(b, TEMPLATE_SET_ID);
+      put<std::uint16_t>(b, std::uint16_t(SET_HEADER + 8 + 4 * (f4.size() + f6.size())));
+      put<std::uint16_t>(b, TEMPLATE_V4);
+      put<std::uint16_t>(b, std::uint16_t(f4.size()));
+      for (auto &f : f4)
+	{
+	  put(b, f.id);
+	  put(b, f.len);
+	}
+      put<std::uint16_t>(b, TEMPLATE_V6);
+      put<std::uint16_t>(b, std::uint16_t(f6.size()));
+      for (auto &f : f6)
+	{
+	  put(b, f.id);
+	  put(b, f.len);
+	}
+    }
+
+    void write_record(Buffer& b, const Record& r)
+    {
+      const size_t alen = r.version == 6 ? 16 : 4;
+      b.write(r.addr, alen);
+      b.write(r.addr + 16, alen);
+      b.push_back(r.proto);
+      put(b, r.sport);
+      put(b, r.dport);
+      b.push_back(r.dir);
+      put(b, r.session);
+      put(b, r.packets);
+      put(b, r.bytes);
+      put(b, r.first_ms);
+      put(b, r.last_ms);
+      put<std::uint32_t>(b, config.sampling);
+    }
+
+    // One message per run of same-version records that fits in
+    // MAX_MESSAGE, with the templates prepended when due.
+    void export_records(const std::vector<Record>& recs)
+    {
+      BufferAllocated b(MAX_MESSAGE + 512, 0);
+      size_t i = 0;
+      while (i < recs.size())
+	{
+	  const std::uint32_t now = (std::uint32_t)std::time(nullptr);
+	  b.reset_content();
+	  b.write_alloc(MSG_HEADER);
+	  if (now >= template_due)
+	    {
+	      write_templates(b);
+	      template_due = now + TEMPLATE_REFRESH;
+	    }
+
+	  const std::uint8_t version = recs[i].version;
+	  const size_t rsize = record_size(version);
+	  const size_t set_off = b.size();
+	  b.write_alloc(SET_HEADER);
+	  std::uint32_t n = 0;
+	  while (i < recs.size() && recs[i].version == version
+		 && b.size() + rsize <= MAX_MESSAGE)
+	    {
+	      write_record(b, recs[i++]);
+	      ++n;
+	    }
+	  if (!n)
+	    {
+	      // record of an unparsed version, or no room after templates
+	      if (version != 4 && version != 6)
+		++i;
+	      b.set_size(set_off);
+	    }
+	  else
+	    {
+	      unsigned char *s = b.data() + set_off;
+	      const std::uint16_t set_id = version == 6 ? TEMPLATE_V6 : TEMPLATE_V4;
+	      const std::uint16_t set_len = std::uint16_t(b.size() - set_off);
+	      s[0] = set_id >> 8; s[1] = set_id & 0xff;
+	      s[2] = set_len >> 8; s[3] = set_len & 0xff;
+	    }
+
+	  unsigned char *h = b.data();
+	  const std::uint32_t hdr[] = { now, sequence, config.domain_id };
+	  h[0] = 0; h[1] = IPFIX_VERSION;
+	  h[2] = std::uint8_t(b.size() >> 8); h[3] = std::uint8_t(b.size());
+	  for (size_t k = 0; k < 3; ++k)
+	    for (size_t j = 0; j < 4; ++j)
+	      h[4 + k * 4 + j] = std::uint8_t(hdr[k] >> (24 - 8 * j));
+	  sequence += n;
+
+	  asio::error_code ec;
+	  socket.send_to(asio::buffer(b.c_data(), b.size()), endpoint, 0, ec);
+	  if (ec)
+	    dropped_.fetch_add(n, std::memory_order_relaxed);
+	  else
+	    exported_.fetch_add(n, std::memory_order_relaxed);
+	}
+    }
+
+    const Config config;
+    std::vector<PerThread> thr;
+
+    // used by exporter thread only
+    asio::io_context io_context{1};
+    asio::ip::udp::socket socket;
+    asio::ip::udp::endpoint endpoint;
+    std::uint32_t sequence = 0;    // data records sent, per RFC 7011
+    std::uint32_t template_due = 0;
+
+    std::mutex mutex;
+    std::condition_variable cv;
+    std::vector<Record> queue;     // protected by mutex
+    bool halt = false;
+    std::thread exporter;
+
+    std::atomic<std::uint64_t> next_session_id{0};
+    std::atomic<std::uint64_t> exported_{0};
+    std::atomic<std::uint64_t> dropped_{0};
+  };
+
+}
+
+#endif
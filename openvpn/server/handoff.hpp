@@ -0,0 +1,202 @@
+//    OpenVPN -- An application to securely tunnel IP networks
+//               over a single port, with support for SSL/TLS-based
+//               session authentication and key exchange,
+//               packet encryption, packet authentication, and
+//               packet compression.
+//
+//    Copyright (C) 2012-2016 OpenVPN Technologies, Inc.
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU Affero General Public License Version 3
+//    as published by the Free Software Foundation.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU Affero General Public License for more details.
+//
+//    You should have received a copy of the GNU Affero General Public License
+//    along with this program in the COPYING file.
+//    If not, see <http://www.gnu.org/licenses/>.
+
+// Hot restart: hand the listening sockets and tun fd of a running
+// server process to the process that replaces it
+
+#ifndef OPENVPN_SERVER_HANDOFF_H
+#define OPENVPN_SERVER_HANDOFF_H
+
+#include <string>
+#include <vector>
+#include <utility>
+#include <cstring>
+#include <cerrno>
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/time.h>
+#include <poll.h>
+#include <unistd.h>
+
+#include <openvpn/common/size.hpp>
+#include <openvpn/common/exception.hpp>
+#include <openvpn/common/scoped_fd.hpp>
+#include <openvpn/common/peercred.hpp>
+#include <openvpn/common/lex.hpp>
+#include <openvpn/common/split.hpp>
+#include <openvpn/common/fdpass.hpp>
+
+namespace openvpn {
+
+  // The old process calls give() with its fds, each tagged with a
+  // name such as "udp 0.0.0.0 1194" or "tun", and keeps serving
+  // until give() returns.  The new process calls take() on the same
+  // path and builds its listeners from the fds instead of binding
+  // new ones, so the sockets never close and no packets are refused
+  // during the restart.  Only a peer running as root or as our own
+  // uid is given the fds.
+  class ListenHandoff
+  {
+  public:
+    OPENVPN_EXCEPTION(listen_handoff_error);
+
+    typedef std::vector<std::pair<std::string, int>> FDList;
+
+    // Wait up to timeout_ms for the new process to connect on the
+    // unix socket path and pass it fds.  Our copies stay open.
+    static void give(const std::string& path, const FDList& fds, const int timeout_ms)
+    {
+      std::string payload = magic();
+      std::vector<int> fdv;
+      for (auto &e : fds)
+	{
+	  if (e.first.empty() || e.first.find('\n') != std::string::npos)
+	    throw listen_handoff_error("bad fd name");
+	  payload += e.first;
+	  payload += '\n';
+	  fdv.push_back(e.second);
+	}
+
+      struct sockaddr_un sa;
+      init_addr(sa, path);
+      ScopedFD listen_fd(::socket(AF_UNIX, SOCK_STREAM, 0));
+      if (!listen_fd.defined())
+	throw_errno("socket");
+      ::unlink(path.c_str());
+      if (::bind(listen_fd(), (struct sockaddr *)&sa, sizeof(sa)) < 0)
+	throw_errno("bind");
+      if (::listen(listen_fd(), 1) < 0)
+	{
+	  ::unlink(path.c_str());
+	  throw_errno("listen");
+	}
+
+      try {
+	struct pollfd pfd;
+	pfd.fd = listen_fd();
+	pfd.events = POLLIN;
+	pfd.revents = 0;
+	if (::poll(&pfd, 1, timeout_ms) <= 0)
+	  throw listen_handoff_error("timed out waiting for new process");
+	ScopedFD conn(::accept(listen_fd(), nullptr, nullptr));
+	if (!conn.defined())
+	  throw_errno("accept");
+	SockOpt::Creds cr;
+	if (!SockOpt::peercreds(conn(), cr) || !cr.root_or_self_uid())
+	  throw listen_handoff_error("peer not authorized");
+	FDPass::send(conn(), payload, fdv);
+
+	// wait for the new process to confirm that it has the fds
+	char ack;
+	set_timeout(conn(), timeout_ms);
+	if (::read(conn(), &ack, 1) != 1 || ack != 'K')
+	  throw listen_handoff_error("new process did not confirm");
+      }
+      catch (...)
+	{
+	  ::unlink(path.c_str());
+	  throw;
+	}
+      ::unlink(path.c_str());
+    }
+
+    // Connect to the old process on path and receive its fds, which
+    // are then owned by the caller.
+    static FDList take(const std::string& path, const int timeout_ms)
+    {
+      struct sockaddr_un sa;
+      init_addr(sa, path);
+      ScopedFD conn(::socket(AF_UNIX, SOCK_STREAM, 0));
+      if (!conn.defined())
+	throw_errno("socket");
+      if (::connect(conn(), (struct sockaddr *)&sa, sizeof(sa)) < 0)
+	throw_errno("connect");
+      SockOpt::Creds cr;
+      if (!SockOpt::peercreds(conn(), cr) || !cr.root_or_self_uid())
+	throw listen_handoff_error("peer not authorized");
+      set_timeout(conn(), timeout_ms);
+
+      std::vector<int> fdv;
+      const std::string payload = FDPass::recv(conn(), fdv, 16384);
+      FDList ret;
+      try {
+	const std::string m = magic();
+	if (payload.compare(0, m.length(), m))
+	  throw listen_handoff_error("bad handoff message");
+	const std::vector<std::string> names = Split::by_char<std::vector<std::string>, NullLex, Split::NullLimit>(payload.substr(m.length()), '\n');
+	size_t i = 0;
+	for (auto &name : names)
+	  {
+	    if (name.empty())
+	      continue;
+	    if (i >= fdv.size())
+	      throw listen_handoff_error("fd count mismatch");
+	    ret.emplace_back(name, fdv[i++]);
+	  }
+	if (i != fdv.size())
+	  throw listen_handoff_error("fd count mismatch");
+	if (::write(conn(), "K", 1) != 1)
+	  throw_errno("write");
+      }
+      catch (...)
+	{
+	  for (auto fd : fdv)
+	    ::close(fd);
+	  throw;
+	}
+      return ret;
+    }
+
+  private:
+    static const char *magic()
+    {
+      return "OPENVPN_HANDOFF 1\n";
+    }
+
+    static void init_addr(struct sockaddr_un& sa, const std::string& path)
+    {
+      std::memset(&sa, 0, sizeof(sa));
+      sa.sun_family = AF_UNIX;
+      if (path.empty() || path.length() >= sizeof(sa.sun_path))
+	throw listen_handoff_error("bad unix socket path");
+      std::memcpy(sa.sun_path, path.c_str(), path.length());
+    }
+
+    static void set_timeout(const int fd, const int timeout_ms)
+    {
+      struct timeval tv;
+      tv.tv_sec = timeout_ms / 1000;
+      tv.tv_usec = (timeout_ms % 1000) * 1000;
+      ::setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    }
+
+    static void throw_errno(const char *what)
+    {
+      const int eno = errno;
+      OPENVPN_THROW(listen_handoff_error, what << ": " << std::strerror(eno));
+    }
+  };
+
+}
+
+#endif
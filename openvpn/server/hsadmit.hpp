@@ -0,0 +1,149 @@
+//    OpenVPN -- An application to securely tunnel IP networks
+//               over a single port, with support for SSL/TLS-based
+//               session authentication and key exchange,
+//               packet encryption, packet authentication, and
+//               packet compression.
+//
+//    Copyright (C) 2012-2016 OpenVPN Technologies, Inc.
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU Affero General Public License Version 3
+//    as published by the Free Software Foundation.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU Affero General Public License for more details.
+//
+//    You should have received a copy of the GNU Affero General Public License
+//    along with this program in the COPYING file.
+//    If not, see <http://www.gnu.org/licenses/>.
+
+// Per-thread admission control for new client handshakes, so that
+// during a reconnect storm returning clients are not crowded out by
+// new ones and the thread isn't overcommitted on TLS work.
+
+#ifndef OPENVPN_SERVER_HSADMIT_H
+#define OPENVPN_SERVER_HSADMIT_H
+
+#include <unordered_map>
+
+#include <openvpn/common/size.hpp>
+#include <openvpn/common/count.hpp>
+#include <openvpn/common/rc.hpp>
+#include <openvpn/addr/ip.hpp>
+#include <openvpn/time/time.hpp>
+
+namespace openvpn {
+
+  // At most max_active handshakes run at once.  The last
+  // known_reserve slots are only given to clients from addresses
+  // that authenticated recently, so they are admitted first while
+  // new clients are turned away.  A rejected client is not queued:
+  // its HARD_RESET is dropped and the client's own retransmit is the
+  // retry, by which time a slot has likely been freed.
+  //
+  // Not thread-safe: use one object per server thread.
+  class HandshakeAdmission : public RC<thread_unsafe_refcount>
+  {
+  public:
+    typedef RCPtr<HandshakeAdmission> Ptr;
+
+    enum Priority {
+      KNOWN=0, // authenticated from this address within known_ttl
+      NEW,
+      N_PRIORITY
+    };
+
+    struct Config
+    {
+      unsigned int max_active = 64;    // concurrent handshakes
+      unsigned int known_reserve = 16; // slots of max_active held for KNOWN
+      size_t known_max = 65536;        // remembered addresses
+      Time::Duration known_ttl = Time::Duration::seconds(3600);
+    };
+
+    explicit HandshakeAdmission(const Config& config_arg)
+      : config(config_arg)
+    {
+      if (config.known_reserve > config.max_active)
+	config.known_reserve = config.max_active;
+      for (auto &r : rejected_)
+	r = 0;
+    }
+
+    Priority priority(const IP::Addr& addr, const Time& now) const
+    {
+      auto i = known.find(addr);
+      return (i != known.end() && now < i->second) ? KNOWN : NEW;
+    }
+
+    // Start a handshake from addr if the budget allows, a true
+    // return must be paired with release().
+    bool admit(const IP::Addr& addr, const Time& now)
+    {
+      const Priority pri = priority(addr, now);
+      const unsigned int limit = (pri == KNOWN) ? config.max_active : config.max_active - config.known_reserve;
+      if (active_ < limit)
+	{
+	  ++active_;
+	  return true;
+	}
+      ++rejected_[pri];
+      return false;
+    }
+
+    void release()
+    {
+      if (active_)
+	--active_;
+    }
+
+    // addr authenticated, give it priority on its next reconnect
+    void remember(const IP::Addr& addr, const Time& now)
+    {
+      if (known.size() >= config.known_max && !known.count(addr))
+	expire(now);
+      known[addr] = now + config.known_ttl;
+    }
+
+    unsigned int active() const
+    {
+      return active_;
+    }
+
+    // true while a NEW client would be turned away
+    bool busy() const
+    {
+      return active_ >= config.max_active - config.known_reserve;
+    }
+
+    count_t rejected(const Priority pri) const
+    {
+      return rejected_[pri];
+    }
+
+  private:
+    // drop expired addresses, or all if none had expired
+    void expire(const Time& now)
+    {
+      for (auto i = known.begin(); i != known.end(); )
+	{
+	  if (now >= i->second)
+	    i = known.erase(i);
+	  else
+	    ++i;
+	}
+      if (known.size() >= config.known_max)
+	known.clear();
+    }
+
+    Config config;
+    unsigned int active_ = 0;
+    count_t rejected_[N_PRIORITY];
+    std::unordered_map<IP::Addr, Time> known;
+  };
+
+}
+
+#endif
@@ -26,6 +26,7 @@
 
 #include <string>
 #include <vector>
+#include <cstdint> // for std::uint64_t
 
 #include <openvpn/common/size.hpp>
 #include <openvpn/common/exception.hpp>
@@ -108,6 +109,10 @@ namespace openvpn {
     // set fwmark value in client instance
     virtual void set_fwmark(const unsigned int fwmark) = 0;
 
+    // Shape traffic to the client to rate bytes/sec with a burst of
+    // burst bytes, or remove the limit if rate is 0.
+    virtual void set_rate_limit(const std::uint64_t rate, const std::uint64_t burst) = 0;
+
     // get client bandwidth stats
     virtual PeerStats stats_poll() = 0;
   };
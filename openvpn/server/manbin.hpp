@@ -0,0 +1,1046 @@
+//    OpenVPN -- An application to securely tunnel IP networks
+//               over a single port, with support for SSL/TLS-based
+//               session authentication and key exchange,
+//               packet encryption, packet authentication, and
+//               packet compression.
+//
+//    Copyright (C) 2012-2016 OpenVPN Technologies, Inc.
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU Affero General Public License Version 3
+//    as published by the Free Software Foundation.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU Affero General Public License for more details.
+//
+//    You should have received a copy of the GNU Affero General Public License
+//    along with this program in the COPYING file.
+//    If not, see <http://www.gnu.org/licenses/>.
+
+// Binary, pipelined management protocol between the server threads
+// and an external controller, carried over a Unix domain socket.
+// Implements the ManClientInstanceSend/ManClientInstanceFactory
+// interfaces so that it can be plugged into ServerProto directly.
+
+#ifndef OPENVPN_SERVER_MANBIN_H
+#define OPENVPN_SERVER_MANBIN_H
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <unordered_map>
+#include <cstdint>
+#include <cstring>
+#include <utility> // for std::move
+
+#include <asio.hpp>
+
+#include <openvpn/common/size.hpp>
+#include <openvpn/common/exception.hpp>
+#include <openvpn/common/rc.hpp>
+#include <openvpn/common/string.hpp>
+#include <openvpn/time/time.hpp>
+#include <openvpn/time/asiotimer.hpp>
+#include <openvpn/buffer/buffer.hpp>
+#include <openvpn/addr/ip.hpp>
+#include <openvpn/addr/route.hpp>
+#include <openvpn/server/manage.hpp>
+
+#ifndef OPENVPN_LOG_MANBIN
+#define OPENVPN_LOG_MANBIN(x)
+#endif
+
+namespace openvpn {
+  namespace ManBin {
+
+    // Wire format.  All integers are in network byte order.
+    //
+    //   frame  := u32 length | u16 type | u16 count | record * count
+    //   record := u32 length | payload
+    //
+    // length counts the bytes that follow it.  A frame carries count
+    // records of the same type, so a storm of auth requests or stats
+    // updates costs one frame and one write rather than one message
+    // per client.  Strings are u32 length | bytes, addresses are
+    // 16 bytes in IPv4-mapped IPv6 form, and every per-session record
+    // starts with the u64 session ID assigned by the server.
+    //
+    // Either side may send any number of frames without waiting for
+    // a reply.  Auth requests are flow controlled: the server sends
+    // at most as many as the controller has granted with CREDIT,
+    // starting from the window it announced in HELLO.
+
+    enum { VERSION = 1 };
+
+    enum Type : std::uint16_t {
+      // server -> controller
+      HELLO = 1,          // u32 version | u32 thread_index | u32 auth_window
+      AUTH_REQUEST = 2,   // sid | str user | str pass | peer info | u8 token | cert | peer addr
+      PUSH_REQUEST = 3,   // sid
+      STATS = 4,          // sid | u8 final | u64 rx | u64 tx | i32 status | u64 rtt_us | u64 jitter_us | cost
+      FLOAT = 5,          // sid | peer addr
+      ACL_ID = 6,         // sid | u32 acl_id | u8 has_username | str username | u8 challenge
+      CLOSED = 7,         // sid
+
+      // controller -> server
+      AUTH_FAILED = 64,   // sid | str reason | u8 tell_client
+      PUSH_REPLY = 65,    // sid | u32 fwmark | u32 n | str * n | u32 n | route * n
+      HALT_RESTART = 66,  // sid | u8 HaltRestart::Type | str reason | u8 tell_client
+      POST_INFO = 67,     // sid | str info
+      SET_FWMARK = 68,    // sid | u32 fwmark
+      RATE_LIMIT = 69,    // sid | u64 rate | u64 burst
+      STATS_POLL = 70,    // sid, answered with STATS
+      CREDIT = 71,        // u32 auth requests the server may send
+    };
+
+    OPENVPN_EXCEPTION(manbin_error);
+
+    class Encoder
+    {
+    public:
+      Encoder(std::string& out_arg)
+	: out(out_arg)
+      {
+      }
+
+      void u8(const unsigned int v)
+      {
+	out += (char)v;
+      }
+
+      void u16(const unsigned int v)
+      {
+	out += (char)(v >> 8);
+	out += (char)v;
+      }
+
+      void u32(const std::uint32_t v)
+      {
+	out += (char)(v >> 24);
+	out += (char)(v >> 16);
+	out += (char)(v >> 8);
+	out += (char)v;
+      }
+
+      void u64(const std::uint64_t v)
+      {
+	u32((std::uint32_t)(v >> 32));
+	u32((std::uint32_t)v);
+      }
+
+      void str(const char *data, const size_t size)
+      {
+	u32((std::uint32_t)size);
+	out.append(data, size);
+      }
+
+      void str(const std::string& s)
+      {
+	str(s.data(), s.length());
+      }
+
+      void addr(const IP::Addr& a)
+      {
+	unsigned char b[16];
+	a.to_byte_string(b);
+	out.append((const char *)b, sizeof(b));
+      }
+
+      // overwrite a u32 reserved earlier at pos
+      void patch_u32(const size_t pos, const std::uint32_t v)
+      {
+	out[pos] = (char)(v >> 24);
+	out[pos+1] = (char)(v >> 16);
+	out[pos+2] = (char)(v >> 8);
+	out[pos+3] = (char)v;
+      }
+
+    private:
+      std::string& out;
+    };
+
+    // cost := u64 rx_cpu_ns | u64 tx_cpu_ns | u64 handshake_cpu_ns |
+    //         u64 rx_sizes * N_SIZES | u64 tx_sizes * N_SIZES
+    // (see PeerStats), all zero unless the server accounts cost
+    inline void encode_cost(Encoder& e, const PeerStats& ps)
+    {
+      e.u64(ps.rx_cpu_ns);
+      e.u64(ps.tx_cpu_ns);
+      e.u64(ps.handshake_cpu_ns);
+      for (unsigned int i = 0; i < PeerStats::N_SIZES; ++i)
+	e.u64(ps.rx_sizes[i]);
+      for (unsigned int i = 0; i < PeerStats::N_SIZES; ++i)
+	e.u64(ps.tx_sizes[i]);
+    }
+
+    class Decoder
+    {
+    public:
+      Decoder(const unsigned char *data_arg, const size_t size_arg)
+	: data(data_arg),
+	  size(size_arg)
+      {
+      }
+
+      unsigned int u8()
+      {
+	return *get(1);
+      }
+
+      unsigned int u16()
+      {
+	const unsigned char *p = get(2);
+	return (p[0] << 8) | p[1];
+      }
+
+      std::uint32_t u32()
+      {
+	const unsigned char *p = get(4);
+	return (std::uint32_t(p[0]) << 24) | (std::uint32_t(p[1]) << 16)
+	  | (std::uint32_t(p[2]) << 8) | std::uint32_t(p[3]);
+      }
+
+      std::uint64_t u64()
+      {
+	const std::uint64_t hi = u32();
+	return (hi << 32) | u32();
+      }
+
+      std::string str()
+      {
+	const size_t len = u32();
+	return std::string((const char *)get(len), len);
+      }
+
+      IP::Addr addr()
+      {
+	const unsigned char *b = get(16);
+	if (IPv6::Addr::byte_string_is_v4(b))
+	  return IP::Addr::from_ipv4(IPv4::Addr::from_uint32_net(IPv6::Addr::v4_from_byte_string(b)));
+	else
+	  return IP::Addr::from_ipv6(IPv6::Addr::from_byte_string(b));
+      }
+
+      // split off the next n bytes as a decoder of their own
+      Decoder sub(const size_t n)
+      {
+	return Decoder(get(n), n);
+      }
+
+      size_t remaining() const
+      {
+	return size;
+      }
+
+    private:
+      const unsigned char *get(const size_t n)
+      {
+	if (n > size)
+	  throw manbin_error("truncated record");
+	const unsigned char *ret = data;
+	data += n;
+	size -= n;
+	return ret;
+      }
+
+      const unsigned char *data;
+      size_t size;
+    };
+
+    // Builds frames into an output string, starting a new frame
+    // whenever the record type changes.
+    class FrameWriter
+    {
+    public:
+      FrameWriter(std::string& out_arg)
+	: out(out_arg)
+      {
+      }
+
+      // Begin a record of the given type, returns an Encoder
+      // for its payload.  Call end_record() when done.
+      Encoder begin_record(const Type type)
+      {
+	Encoder e(out);
+	if (frame_pos == std::string::npos || type != frame_type || frame_count == 0xFFFF)
+	  {
+	    end_frame();
+	    frame_pos = out.length();
+	    frame_type = type;
+	    frame_count = 0;
+	    e.u32(0);
+	    e.u16(type);
+	    e.u16(0);
+	  }
+	record_pos = out.length();
+	e.u32(0);
+	return e;
+      }
+
+      void end_record()
+      {
+	Encoder e(out);
+	e.patch_u32(record_pos, (std::uint32_t)(out.length() - record_pos - 4));
+	++frame_count;
+      }
+
+      // finish the current frame, if any
+      void end_frame()
+      {
+	if (frame_pos != std::string::npos)
+	  {
+	    Encoder e(out);
+	    e.patch_u32(frame_pos, (std::uint32_t)(out.length() - frame_pos - 4));
+	    out[frame_pos+6] = (char)(frame_count >> 8);
+	    out[frame_pos+7] = (char)frame_count;
+	    frame_pos = std::string::npos;
+	  }
+      }
+
+      // forget any frame in progress after the output was discarded
+      void reset()
+      {
+	frame_pos = std::string::npos;
+      }
+
+    private:
+      std::string& out;
+      size_t frame_pos = std::string::npos;
+      size_t record_pos = 0;
+      unsigned int frame_count = 0;
+      Type frame_type = HELLO;
+    };
+
+    // The per-thread connection to the controller, shared by all
+    // sessions of a server thread.  Records submitted during one
+    // turn of the io_context are coalesced into frames and written
+    // together.  If the controller falls behind and the output queue
+    // exceeds Config::max_out_bytes, stats updates are dropped and
+    // new auth requests fail at once, so that a stalled controller
+    // cannot grow server memory without bound.
+    class Link : public RC<thread_unsafe_refcount>
+    {
+    public:
+      typedef RCPtr<Link> Ptr;
+
+      struct Config
+      {
+	Config()
+	  : auth_window(1024),
+	    max_auth_queue(8192),
+	    max_out_bytes(4*1024*1024),
+	    max_frame_size(1024*1024),
+	    reconnect_delay(Time::Duration::seconds(2))
+	{
+	}
+
+	std::string path;              // controller Unix socket
+	unsigned int auth_window;      // initial auth request credit
+	size_t max_auth_queue;         // auth requests held back for credit
+	size_t max_out_bytes;          // output backlog before shedding
+	size_t max_frame_size;         // largest frame accepted from controller
+	Time::Duration reconnect_delay;
+      };
+
+      struct Stats
+      {
+	size_t frames_out = 0;
+	size_t frames_in = 0;
+	size_t records_out = 0;
+	size_t records_in = 0;
+	size_t auth_rejected = 0;     // failed locally because of backlog
+	size_t stats_dropped = 0;
+	size_t unknown_session = 0;   // controller records for gone sessions
+	size_t reconnects = 0;
+      };
+
+      class Session;
+
+      Link(asio::io_context& io_context_arg,
+	   const unsigned int thread_index_arg,
+	   const Config& config_arg)
+	: io_context(io_context_arg),
+	  socket(io_context_arg),
+	  reconnect_timer(io_context_arg),
+	  config(config_arg),
+	  thread_index(thread_index_arg),
+	  writer(out_next),
+	  next_sid(std::uint64_t(thread_index_arg) << 40)
+      {
+      }
+
+      void start()
+      {
+	if (!halt && !connecting && !connected)
+	  connect();
+      }
+
+      void stop()
+      {
+	if (!halt)
+	  {
+	    halt = true;
+	    reconnect_timer.cancel();
+	    close_socket();
+	    fail_pending_auth("management link stopped");
+	  }
+      }
+
+      const Stats& stats() const
+      {
+	return stats_;
+      }
+
+      bool is_connected() const
+      {
+	return connected;
+      }
+
+      ManClientInstanceSend::Ptr new_session(ManClientInstanceRecv* instance);
+
+    private:
+      friend class Session;
+
+      void connect()
+      {
+	connecting = true;
+	socket.async_connect(asio::local::stream_protocol::endpoint(config.path),
+			     [self=Ptr(this)](const asio::error_code& error)
+			     {
+			       self->handle_connect(error);
+			     });
+      }
+
+      void handle_connect(const asio::error_code& error)
+      {
+	connecting = false;
+	if (halt)
+	  return;
+	if (error)
+	  {
+	    OPENVPN_LOG_MANBIN("MANBIN connect " << config.path << " failed: " << error.message());
+	    close_socket();
+	    schedule_reconnect();
+	    return;
+	  }
+	connected = true;
+	in.clear();
+	credit = config.auth_window;
+
+	// HELLO goes first, ahead of anything queued while disconnected
+	std::string hello;
+	{
+	  FrameWriter fw(hello);
+	  Encoder e = fw.begin_record(HELLO);
+	  e.u32(VERSION);
+	  e.u32(thread_index);
+	  e.u32(config.auth_window);
+	  fw.end_record();
+	  fw.end_frame();
+	}
+	writer.end_frame();
+	out_next.insert(0, hello);
+	drain_auth_queue();
+	schedule_flush();
+	queue_read();
+      }
+
+      void schedule_reconnect()
+      {
+	++stats_.reconnects;
+	reconnect_timer.expires_at(Time::now() + config.reconnect_delay);
+	reconnect_timer.async_wait([self=Ptr(this)](const asio::error_code& error)
+				   {
+				     if (!error && !self->halt)
+				       self->connect();
+				   });
+      }
+
+      void close_socket()
+      {
+	asio::error_code ec;
+	socket.close(ec);
+	connected = false;
+	writing = false;
+	out_cur.clear();
+	out_next.clear();
+	writer.reset();
+      }
+
+      // The controller is gone; sessions waiting on it would
+      // otherwise hang, so fail them and let the clients retry.
+      void link_error(const std::string& reason)
+      {
+	OPENVPN_LOG_MANBIN("MANBIN link error: " << reason);
+	close_socket();
+	fail_pending_auth(reason);
+	if (!halt)
+	  schedule_reconnect();
+      }
+
+      void fail_pending_auth(const std::string& reason)
+      {
+	std::vector<ManClientInstanceRecv::Ptr> fail;
+	for (auto &s : sessions)
+	  if (s.second.auth_pending && s.second.instance)
+	    {
+	      s.second.auth_pending = false;
+	      fail.push_back(s.second.instance);
+	    }
+	auth_queue.clear();
+	for (auto &inst : fail)
+	  inst->auth_failed(reason, false);
+      }
+
+      size_t backlog() const
+      {
+	return out_cur.length() + out_next.length();
+      }
+
+      Encoder begin(const Type type)
+      {
+	schedule_flush();
+	return writer.begin_record(type);
+      }
+
+      void end()
+      {
+	writer.end_record();
+	++stats_.records_out;
+      }
+
+      void schedule_flush()
+      {
+	if (!flush_pending)
+	  {
+	    flush_pending = true;
+	    asio::post(io_context, [self=Ptr(this)]()
+		       {
+			 self->flush_pending = false;
+			 self->flush();
+		       });
+	  }
+      }
+
+      void flush()
+      {
+	writer.end_frame();
+	if (!connected || writing || out_next.empty())
+	  return;
+	out_cur.swap(out_next);
+	out_next.clear();
+	writing = true;
+	asio::async_write(socket, asio::buffer(out_cur),
+			  [self=Ptr(this)](const asio::error_code& error, const size_t)
+			  {
+			    self->handle_write(error);
+			  });
+      }
+
+      void handle_write(const asio::error_code& error)
+      {
+	writing = false;
+	if (halt)
+	  return;
+	if (error)
+	  {
+	    link_error("write: " + error.message());
+	    return;
+	  }
+	++stats_.frames_out;
+	out_cur.clear();
+	flush();
+      }
+
+      void queue_read()
+      {
+	socket.async_read_some(asio::buffer(read_buf, sizeof(read_buf)),
+			       [self=Ptr(this)](const asio::error_code& error, const size_t bytes_recvd)
+			       {
+				 self->handle_read(error, bytes_recvd);
+			       });
+      }
+
+      void handle_read(const asio::error_code& error, const size_t bytes_recvd)
+      {
+	if (halt || !connected)
+	  return;
+	if (error)
+	  {
+	    link_error("read: " + error.message());
+	    return;
+	  }
+	in.append((const char *)read_buf, bytes_recvd);
+	try {
+	  size_t pos = 0;
+	  while (in.length() - pos >= 8)
+	    {
+	      Decoder hdr((const unsigned char *)in.data() + pos, 8);
+	      const size_t len = hdr.u32();
+	      if (len < 4 || len > config.max_frame_size)
+		throw manbin_error("bad frame length");
+	      if (in.length() - pos - 4 < len)
+		break;
+	      const unsigned int type = hdr.u16();
+	      const unsigned int count = hdr.u16();
+	      Decoder frame((const unsigned char *)in.data() + pos + 8, len - 4);
+	      pos += 4 + len;
+	      ++stats_.frames_in;
+	      for (unsigned int i = 0; i < count; ++i)
+		{
+		  Decoder rec = frame.sub(frame.u32());
+		  ++stats_.records_in;
+		  dispatch(type, rec);
+		  if (halt || !connected)
+		    return;
+		}
+	    }
+	  in.erase(0, pos);
+	}
+	catch (const std::exception& e)
+	  {
+	    link_error(std::string("protocol: ") + e.what());
+	    return;
+	  }
+	queue_read();
+      }
+
+      void dispatch(const unsigned int type, Decoder& d);
+
+      void drain_auth_queue();
+
+      struct SessionState
+      {
+	ManClientInstanceRecv::Ptr instance;
+	bool auth_pending = false;
+      };
+
+      asio::io_context& io_context;
+      asio::local::stream_protocol::socket socket;
+      AsioTimer reconnect_timer;
+      Config config;
+      Stats stats_;
+      unsigned int thread_index;
+
+      std::string out_cur;   // being written
+      std::string out_next;  // being filled
+      FrameWriter writer;
+      std::string in;
+      unsigned char read_buf[16384];
+
+      std::unordered_map<std::uint64_t, SessionState> sessions;
+      std::deque<RCPtr<Session>> auth_queue; // waiting for credit
+      std::uint64_t next_sid;
+      size_t credit = 0;
+
+      bool halt = false;
+      bool connecting = false;
+      bool connected = false;
+      bool writing = false;
+      bool flush_pending = false;
+    };
+
+    // Management object of one client session.
+    class Link::Session : public ManClientInstanceSend
+    {
+      friend class Link;
+
+    public:
+      typedef RCPtr<Session> Ptr;
+
+      Session(Link* link_arg, const std::uint64_t sid_arg)
+	: link(link_arg),
+	  sid(sid_arg)
+      {
+      }
+
+      std::uint64_t session_id() const
+      {
+	return sid;
+      }
+
+      virtual void stop() override
+      {
+	if (link)
+	  {
+	    link->sessions.erase(sid);
+	    if (link->connected)
+	      {
+		Encoder e = link->begin(CLOSED);
+		e.u64(sid);
+		link->end();
+	      }
+	    link.reset();
+	  }
+	creds.reset();
+	cert.reset();
+	peer_addr.reset();
+      }
+
+      virtual void auth_request(const AuthCreds::Ptr& auth_creds,
+				const AuthCert::Ptr& auth_cert,
+				const PeerAddr::Ptr& peer_addr_arg) override
+      {
+	if (!link)
+	  return;
+	creds = auth_creds;
+	cert = auth_cert;
+	peer_addr = peer_addr_arg;
+	SessionState* ss = state();
+	if (!ss)
+	  return;
+	if (!link->connected
+	    || link->backlog() > link->config.max_out_bytes
+	    || link->auth_queue.size() >= link->config.max_auth_queue)
+	  {
+	    ++link->stats_.auth_rejected;
+	    ss->instance->auth_failed("management backlog", false);
+	    return;
+	  }
+	ss->auth_pending = true;
+	if (link->credit)
+	  {
+	    --link->credit;
+	    send_auth_request();
+	  }
+	else
+	  link->auth_queue.emplace_back(this);
+      }
+
+      virtual void push_request(const ProtoContext::Config::Ptr& pconf) override
+      {
+	if (link && link->connected)
+	  {
+	    Encoder e = link->begin(PUSH_REQUEST);
+	    e.u64(sid);
+	    link->end();
+	  }
+      }
+
+      virtual void stats_notify(const PeerStats& ps, const bool final) override
+      {
+	if (!link)
+	  return;
+	if (!link->connected || (!final && link->backlog() > link->config.max_out_bytes))
+	  {
+	    ++link->stats_.stats_dropped;
+	    return;
+	  }
+	Encoder e = link->begin(STATS);
+	e.u64(sid);
+	e.u8(final);
+	e.u64(ps.rx_bytes);
+	e.u64(ps.tx_bytes);
+	e.u32((std::uint32_t)ps.status);
+	e.u64(ps.rtt_us);
+	e.u64(ps.jitter_us);
+	encode_cost(e, ps);
+	link->end();
+      }
+
+      virtual void float_notify(const PeerAddr::Ptr& addr) override
+      {
+	peer_addr = addr;
+	if (link && link->connected && addr)
+	  {
+	    Encoder e = link->begin(FLOAT);
+	    e.u64(sid);
+	    encode_peer_addr(e, *addr);
+	    link->end();
+	  }
+      }
+
+      virtual std::string describe_user() override
+      {
+	std::string ret = "{\"sid\":" + openvpn::to_string(sid);
+	if (creds)
+	  ret += ",\"user\":" + json_str(creds->username);
+	if (peer_addr)
+	  ret += ",\"peer\":" + json_str(peer_addr->to_string());
+	ret += '}';
+	return ret;
+      }
+
+      virtual void disconnect_user(const HaltRestart::Type type,
+				   const std::string& reason,
+				   const bool tell_client) override
+      {
+	SessionState* ss = state();
+	if (ss && ss->instance)
+	  ss->instance->push_halt_restart_msg(type, reason, tell_client);
+      }
+
+      virtual void post_info_user(BufferPtr&& info) override
+      {
+	SessionState* ss = state();
+	if (ss && ss->instance)
+	  ss->instance->post_info(std::move(info));
+      }
+
+      virtual void set_acl_id(const unsigned int acl_id,
+			      const std::string* username,
+			      const bool challenge,
+			      const bool throw_on_error) override
+      {
+	if (!link || !link->connected)
+	  {
+	    if (throw_on_error)
+	      throw manbin_error("set_acl_id: management link down");
+	    return;
+	  }
+	Encoder e = link->begin(ACL_ID);
+	e.u64(sid);
+	e.u32(acl_id);
+	e.u8(username != nullptr);
+	e.str(username ? *username : std::string());
+	e.u8(challenge);
+	link->end();
+      }
+
+    private:
+      SessionState* state()
+      {
+	if (!link)
+	  return nullptr;
+	auto i = link->sessions.find(sid);
+	if (i == link->sessions.end())
+	  return nullptr;
+	return &i->second;
+      }
+
+      void send_auth_request()
+      {
+	Encoder e = link->begin(AUTH_REQUEST);
+	e.u64(sid);
+	e.str(creds->username);
+	const std::string pw = creds->password.to_string();
+	e.str(pw);
+	e.u32((std::uint32_t)creds->peer_info.size());
+	for (const auto &opt : creds->peer_info)
+	  {
+	    e.u32((std::uint32_t)opt.size());
+	    for (size_t j = 0; j < opt.size(); ++j)
+	      e.str(opt.ref(j));
+	  }
+	e.u8(creds->session_token);
+	if (cert && cert->defined())
+	  {
+	    e.u8(1);
+	    e.str(cert->get_cn());
+	    e.u64((std::uint64_t)cert->get_sn());
+	    e.str(cert->issuer_fp_str(false));
+	  }
+	else
+	  e.u8(0);
+	if (peer_addr)
+	  {
+	    e.u8(1);
+	    encode_peer_addr(e, *peer_addr);
+	  }
+	else
+	  e.u8(0);
+	link->end();
+      }
+
+      static std::string json_str(const std::string& s)
+      {
+	static const char hex[] = "0123456789abcdef";
+	std::string ret = "\"";
+	for (const char c : s)
+	  {
+	    if (c == '"' || c == '\\')
+	      {
+		ret += '\\';
+		ret += c;
+	      }
+	    else if ((unsigned char)c < 0x20)
+	      {
+		ret += "\\u00";
+		ret += hex[(unsigned char)c >> 4];
+		ret += hex[c & 0xF];
+	      }
+	    else
+	      ret += c;
+	  }
+	ret += '"';
+	return ret;
+      }
+
+      static void encode_peer_addr(Encoder& e, const PeerAddr& pa)
+      {
+	e.u8(pa.tcp);
+	e.addr(pa.remote.addr);
+	e.u16(pa.remote.port);
+	e.addr(pa.local.addr);
+	e.u16(pa.local.port);
+      }
+
+      Link::Ptr link;
+      const std::uint64_t sid;
+      AuthCreds::Ptr creds;
+      AuthCert::Ptr cert;
+      PeerAddr::Ptr peer_addr;
+    };
+
+    inline ManClientInstanceSend::Ptr Link::new_session(ManClientInstanceRecv* instance)
+    {
+      const std::uint64_t sid = ++next_sid;
+      SessionState& ss = sessions[sid];
+      ss.instance.reset(instance);
+      return ManClientInstanceSend::Ptr(new Session(this, sid));
+    }
+
+    inline void Link::drain_auth_queue()
+    {
+      while (credit && !auth_queue.empty())
+	{
+	  Session::Ptr s = std::move(auth_queue.front());
+	  auth_queue.pop_front();
+	  if (!s->link)
+	    continue;
+	  SessionState* ss = s->state();
+	  if (!ss || !ss->auth_pending)
+	    continue;
+	  --credit;
+	  s->send_auth_request();
+	}
+    }
+
+    inline void Link::dispatch(const unsigned int type, Decoder& d)
+    {
+      if (type == CREDIT)
+	{
+	  credit += d.u32();
+	  drain_auth_queue();
+	  return;
+	}
+
+      const std::uint64_t sid = d.u64();
+      auto i = sessions.find(sid);
+      if (i == sessions.end() || !i->second.instance)
+	{
+	  ++stats_.unknown_session;
+	  return;
+	}
+      SessionState& ss = i->second;
+      ManClientInstanceRecv::Ptr inst = ss.instance; // may be stopped by the call below
+
+      switch (type)
+	{
+	case AUTH_FAILED:
+	  {
+	    const std::string reason = d.str();
+	    const bool tell_client = d.u8();
+	    ss.auth_pending = false;
+	    inst->auth_failed(reason, tell_client);
+	    break;
+	  }
+	case PUSH_REPLY:
+	  {
+	    const unsigned int fwmark = d.u32();
+	    std::vector<BufferPtr> msgs;
+	    const size_t n_msgs = d.u32();
+	    if (n_msgs > d.remaining() / 4)
+	      throw manbin_error("bad push message count");
+	    msgs.reserve(n_msgs);
+	    for (size_t j = 0; j < n_msgs; ++j)
+	      msgs.push_back(buf_from_string(d.str()));
+	    std::vector<IP::Route> routes;
+	    const size_t n_routes = d.u32();
+	    if (n_routes > d.remaining() / 17)
+	      throw manbin_error("bad route count");
+	    routes.reserve(n_routes);
+	    for (size_t j = 0; j < n_routes; ++j)
+	      {
+		IP::Route r;
+		r.addr = d.addr();
+		r.prefix_len = d.u8();
+		routes.push_back(std::move(r));
+	      }
+	    ss.auth_pending = false;
+	    inst->push_reply(std::move(msgs), routes, fwmark);
+	    break;
+	  }
+	case HALT_RESTART:
+	  {
+	    const HaltRestart::Type ht = (HaltRestart::Type)d.u8();
+	    const std::string reason = d.str();
+	    const bool tell_client = d.u8();
+	    inst->push_halt_restart_msg(ht, reason, tell_client);
+	    break;
+	  }
+	case POST_INFO:
+	  inst->post_info(buf_from_string(d.str()));
+	  break;
+	case SET_FWMARK:
+	  inst->set_fwmark(d.u32());
+	  break;
+	case RATE_LIMIT:
+	  {
+	    const std::uint64_t rate = d.u64();
+	    const std::uint64_t burst = d.u64();
+	    inst->set_rate_limit(rate, burst);
+	    break;
+	  }
+	case STATS_POLL:
+	  {
+	    const PeerStats ps = inst->stats_poll();
+	    Encoder e = begin(STATS);
+	    e.u64(sid);
+	    e.u8(0);
+	    e.u64(ps.rx_bytes);
+	    e.u64(ps.tx_bytes);
+	    e.u32((std::uint32_t)ps.status);
+	    e.u64(ps.rtt_us);
+	    e.u64(ps.jitter_us);
+	    encode_cost(e, ps);
+	    end();
+	    break;
+	  }
+	default:
+	  throw manbin_error("unknown record type " + openvpn::to_string(type));
+	}
+    }
+
+    // One Factory, and thus one Link, per server thread.
+    class Factory : public ManClientInstanceFactory
+    {
+    public:
+      typedef RCPtr<Factory> Ptr;
+
+      Factory(asio::io_context& io_context,
+	      const unsigned int thread_index,
+	      const Link::Config& config)
+	: link(new Link(io_context, thread_index, config))
+      {
+      }
+
+      virtual void start() override
+      {
+	link->start();
+      }
+
+      virtual ManClientInstanceSend::Ptr new_obj(ManClientInstanceRecv* instance) override
+      {
+	return link->new_session(instance);
+      }
+
+      void stop()
+      {
+	link->stop();
+      }
+
+      const Link::Ptr& get_link() const
+      {
+	return link;
+      }
+
+    private:
+      Link::Ptr link;
+    };
+  }
+}
+
+#endif
@@ -0,0 +1,270 @@
+//    OpenVPN -- An application to securely tunnel IP networks
+//               over a single port, with support for SSL/TLS-based
+//               session authentication and key exchange,
+//               packet encryption, packet authentication, and
+//               packet compression.
+//
+//    Copyright (C) 2012-2016 OpenVPN Technologies, Inc.
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU Affero General Public License Version 3
+//    as published by the Free Software Foundation.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU Affero General Public License for more details.
+//
+//    You should have received a copy of the GNU Affero General Public License
+//    along with this program in the COPYING file.
+//    If not, see <http://www.gnu.org/licenses/>.
+// Minimal HTTP endpoint serving PeerMetrics in OpenMetrics format.
+
+#ifndef OPENVPN_SERVER_METRICSSERV_H
+#define OPENVPN_SERVER_METRICSSERV_H
+
+#include <string>
+#include <sstream>
+#include <utility> // for std::move
+
+#include <asio.hpp>
+
+#include <openvpn/common/size.hpp>
+#include <openvpn/common/exception.hpp>
+#include <openvpn/common/rc.hpp>
+#include <openvpn/time/asiotimer.hpp>
+#include <openvpn/http/request.hpp>
+#include <openvpn/http/status.hpp>
+#include <openvpn/server/peermetrics.hpp>
+
+#ifndef OPENVPN_LOG_METRICS
+#define OPENVPN_LOG_METRICS(x)
+#endif
+
+namespace openvpn {
+
+  // Accepts connections on one TCP endpoint, answers a single
+  // "GET /metrics" per connection and closes.  Rendering reads
+  // only published PeerMetrics snapshots, so it can run on an
+  // io_context of its own, away from the server threads.
+  class MetricsServer : public RC<thread_unsafe_refcount>
+  {
+  public:
+    typedef RCPtr<MetricsServer> Ptr;
+
+    OPENVPN_EXCEPTION(metrics_server_error);
+
+    struct Config
+    {
+      Config()
+	: path("/metrics"),
+	  max_request_size(8192),
+	  timeout(Time::Duration::seconds(10))
+      {
+      }
+
+      std::string path;
+      size_t max_request_size;
+      Time::Duration timeout;
+    };
+
+    MetricsServer(asio::io_context& io_context_arg,
+		  const asio::ip::tcp::endpoint& endpoint,
+		  const PeerMetrics::Ptr& metrics_arg,
+		  const Config& config_arg = Config())
+      : io_context(io_context_arg),
+	acceptor(io_context_arg),
+	metrics(metrics_arg),
+	config(config_arg),
+	halt(false)
+    {
+      acceptor.open(endpoint.protocol());
+      acceptor.set_option(asio::ip::tcp::acceptor::reuse_address(true));
+      acceptor.bind(endpoint);
+      acceptor.listen();
+    }
+
+    void start()
+    {
+      queue_accept();
+    }
+
+    void stop()
+    {
+      if (!halt)
+	{
+	  halt = true;
+	  asio::error_code ec;
+	  acceptor.close(ec);
+	}
+    }
+
+    asio::ip::tcp::endpoint local_endpoint() const
+    {
+      return acceptor.local_endpoint();
+    }
+
+    // Build the complete HTTP response for a parsed request.
+    static std::string response(const HTTP::Request& req,
+				const std::string& path,
+				const PeerMetrics& metrics)
+    {
+      std::string uri = req.uri;
+      const size_t q = uri.find_first_of('?');
+      if (q != std::string::npos)
+	uri.resize(q);
+      if (req.method != "GET" && req.method != "HEAD")
+	return reply(HTTP::Status::BadRequest, "text/plain", "bad method\n", true);
+      if (uri != path)
+	return reply(HTTP::Status::NotFound, "text/plain", "not found\n", true);
+      return reply(HTTP::Status::OK,
+		   "application/openmetrics-text; version=1.0.0; charset=utf-8",
+		   metrics.render_openmetrics(),
+		   req.method == "GET");
+    }
+
+  private:
+    class Conn : public RC<thread_unsafe_refcount>
+    {
+    public:
+      typedef RCPtr<Conn> Ptr;
+
+      Conn(MetricsServer* parent_arg)
+	: parent(parent_arg),
+	  socket(parent_arg->io_context),
+	  timer(parent_arg->io_context),
+	  n_read(0)
+      {
+      }
+
+      void start()
+      {
+	timer.expires_at(Time::now() + parent->config.timeout);
+	timer.async_wait([self=Ptr(this)](const asio::error_code& error)
+			 {
+			   if (!error)
+			     self->close();
+			 });
+	queue_read();
+      }
+
+    private:
+      MetricsServer::Ptr parent;
+
+    public:
+      asio::ip::tcp::socket socket;
+
+    private:
+      void queue_read()
+      {
+	socket.async_read_some(asio::buffer(buf, sizeof(buf)),
+			       [self=Ptr(this)](const asio::error_code& error, const size_t bytes_recvd)
+			       {
+				 self->handle_read(error, bytes_recvd);
+			       });
+      }
+
+      void handle_read(const asio::error_code& error, const size_t bytes_recvd)
+      {
+	if (error)
+	  {
+	    close();
+	    return;
+	  }
+	n_read += bytes_recvd;
+	for (size_t i = 0; i < bytes_recvd; ++i)
+	  {
+	    switch (parser.consume(req, buf[i]))
+	      {
+	      case HTTP::RequestParser::pending:
+		break;
+	      case HTTP::RequestParser::success:
+		OPENVPN_LOG_METRICS("METRICS " << req.to_string_compact());
+		send(response(req, parent->config.path, *parent->metrics));
+		return;
+	      case HTTP::RequestParser::fail:
+		send(reply(HTTP::Status::BadRequest, "text/plain", "bad request\n", true));
+		return;
+	      }
+	  }
+	if (n_read > parent->config.max_request_size)
+	  send(reply(HTTP::Status::BadRequest, "text/plain", "request too large\n", true));
+	else
+	  queue_read();
+      }
+
+      void send(std::string&& data)
+      {
+	out = std::move(data);
+	asio::async_write(socket, asio::buffer(out),
+			  [self=Ptr(this)](const asio::error_code& error, const size_t)
+			  {
+			    self->close();
+			  });
+      }
+
+      void close()
+      {
+	asio::error_code ec;
+	timer.cancel();
+	socket.shutdown(asio::ip::tcp::socket::shutdown_both, ec);
+	socket.close(ec);
+      }
+
+      AsioTimer timer;
+      HTTP::Request req;
+      HTTP::RequestParser parser;
+      size_t n_read;
+      unsigned char buf[1024];
+      std::string out;
+    };
+
+    static std::string reply(const int status,
+			     const char *content_type,
+			     const std::string& body,
+			     const bool include_body)
+    {
+      std::ostringstream os;
+      os << "HTTP/1.1 " << status << ' ' << HTTP::Status::to_string(status) << "\r\n"
+	 << "Content-Type: " << content_type << "\r\n"
+	 << "Content-Length: " << body.length() << "\r\n"
+	 << "Connection: close\r\n"
+	 << "\r\n";
+      if (include_body)
+	os << body;
+      return os.str();
+    }
+
+    void queue_accept()
+    {
+      if (halt)
+	return;
+      Conn::Ptr conn(new Conn(this));
+      acceptor.async_accept(conn->socket,
+			    [self=Ptr(this), conn](const asio::error_code& error)
+			    {
+			      self->handle_accept(conn, error);
+			    });
+    }
+
+    void handle_accept(const Conn::Ptr& conn, const asio::error_code& error)
+    {
+      if (halt)
+	return;
+      if (!error)
+	conn->start();
+      else
+	OPENVPN_LOG_METRICS("METRICS accept error: " << error.message());
+      queue_accept();
+    }
+
+    asio::io_context& io_context;
+    asio::ip::tcp::acceptor acceptor;
+    PeerMetrics::Ptr metrics;
+    Config config;
+    bool halt;
+  };
+
+}
+
+#endif
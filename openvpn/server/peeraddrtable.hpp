@@ -0,0 +1,317 @@
+//    OpenVPN -- An application to securely tunnel IP networks
+//               over a single port, with support for SSL/TLS-based
+//               session authentication and key exchange,
+//               packet encryption, packet authentication, and
+//               packet compression.
+//
+//    Copyright (C) 2012-2016 OpenVPN Technologies, Inc.
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU Affero General Public License Version 3
+//    as published by the Free Software Foundation.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU Affero General Public License for more details.
+//
+//    You should have received a copy of the GNU Affero General Public License
+//    along with this program in the COPYING file.
+//    If not, see <http://www.gnu.org/licenses/>.
+
+// Server-side directory of client instances indexed by source endpoint
+
+#ifndef OPENVPN_SERVER_PEERADDRTABLE_H
+#define OPENVPN_SERVER_PEERADDRTABLE_H
+
+#include <vector>
+#include <cstring> // for std::memcpy, std::memset
+#include <cstdint> // for std::uint8_t, uint64_t
+
+#include <openvpn/common/likely.hpp>
+#include <openvpn/common/hash.hpp>
+#include <openvpn/common/ffs.hpp>
+#include <openvpn/common/socktypes.hpp>
+#include <openvpn/random/randapi.hpp>
+#include <openvpn/server/peeraddr.hpp>
+
+#if (defined(__x86_64__) || (defined(__i386__) && defined(__SSE2__))) && !defined(OPENVPN_NO_SIMD)
+#define OPENVPN_PEERADDRTABLE_SSE2
+#include <emmintrin.h>
+#endif
+
+namespace openvpn {
+
+  // Open-addressing map of client endpoint -> client instance, for
+  // packets that PeerIDTable cannot dispatch (P_DATA_V1 and control
+  // packets from clients that predate peer-ids).
+  //
+  // The layout follows the Swiss table: a control byte per slot,
+  // holding 7 bits of the slot's hash or EMPTY/DELETED, is scanned 16
+  // slots at a time with one SSE2 compare, so a lookup normally
+  // touches one control group and one key.  Keys are packed into
+  // three 64-bit words and compared without branching on the address
+  // family.  Hashes are SipHash keyed with a secret from the rng
+  // passed in, so clients cannot choose source endpoints that
+  // collide.  A slot costs 33 bytes, and the table is kept at most
+  // 7/8 full.
+  //
+  // Not thread-safe, one table per worker thread, like PeerIDTable.
+  template <typename INSTANCE>
+  class PeerAddrTable
+  {
+  public:
+    typedef typename INSTANCE::Ptr InstancePtr;
+
+    // Packed endpoint: IPv6 address (IPv4 mapped as in
+    // IP::Addr::to_byte_string), then port and address family.
+    struct Key
+    {
+      Key()
+      {
+	std::memset(w, 0, sizeof(w));
+      }
+
+      Key(const AddrPort& ap)
+      {
+	unsigned char a[16];
+	ap.addr.to_byte_string(a);
+	std::memcpy(w, a, sizeof(a));
+	w[2] = std::uint64_t(ap.port) | (std::uint64_t(ap.addr.version()) << 16);
+      }
+
+      // from a raw source address and port in network byte order
+      Key(const std::uint8_t *addr, const bool v6, const std::uint16_t port_net)
+      {
+	unsigned char a[16];
+	if (v6)
+	  std::memcpy(a, addr, 16);
+	else
+	  IPv6::Addr::v4_to_byte_string(a, *(const std::uint32_t *)addr);
+	std::memcpy(w, a, sizeof(a));
+	w[2] = std::uint64_t(ntohs(port_net)) | (std::uint64_t(v6 ? IP::Addr::V6 : IP::Addr::V4) << 16);
+      }
+
+      bool operator==(const Key& other) const
+      {
+	return !((w[0] ^ other.w[0]) | (w[1] ^ other.w[1]) | (w[2] ^ other.w[2]));
+      }
+
+      std::uint64_t w[3];
+    };
+
+    PeerAddrTable(RandomAPI& rng, const size_t expected=0)
+      : hasher(rng.rand_get<std::uint64_t>(), rng.rand_get<std::uint64_t>())
+    {
+      rehash(capacity_for(expected));
+    }
+
+    // Returns false if key is already present.
+    bool add(const Key& key, const InstancePtr& inst)
+    {
+      const std::uint64_t h = hash(key);
+      if (find(key, h) != NPOS)
+	return false;
+      if ((n_used + n_deleted + 1) * 8 > ctrl.size() * 7)
+	{
+	  // Drop tombstones, growing only if live entries need it.
+	  rehash((n_used + 1) * 8 > ctrl.size() * 7 / 2 ? ctrl.size() * 2 : ctrl.size());
+	}
+      const size_t i = free_slot(h);
+      if (ctrl[i] == DELETED)
+	--n_deleted;
+      ctrl[i] = h2(h);
+      slots[i].key = key;
+      slots[i].inst = inst;
+      ++n_used;
+      return true;
+    }
+
+    bool remove(const Key& key)
+    {
+      const size_t i = find(key, hash(key));
+      if (i == NPOS)
+	return false;
+      slots[i].inst.reset();
+
+      // With group-aligned probing, a lookup stops at a group that
+      // has an empty slot, so no entry can have been pushed past
+      // this one and the slot can become empty again.
+      const size_t g = i & ~size_t(GROUP - 1);
+      if (match_byte(&ctrl[g], EMPTY))
+	ctrl[i] = EMPTY;
+      else
+	{
+	  ctrl[i] = DELETED;
+	  ++n_deleted;
+	}
+      --n_used;
+      return true;
+    }
+
+    INSTANCE* lookup(const Key& key) const
+    {
+      const size_t i = find(key, hash(key));
+      if (likely(i != NPOS))
+	return slots[i].inst.get();
+      return nullptr;
+    }
+
+    INSTANCE* lookup(const AddrPort& ap) const
+    {
+      return lookup(Key(ap));
+    }
+
+    template <typename FUNC>
+    void for_each(FUNC func) const
+    {
+      for (size_t i = 0; i < ctrl.size(); ++i)
+	if (!(ctrl[i] & 0x80))
+	  func(slots[i].inst.get());
+    }
+
+    void clear()
+    {
+      std::vector<std::uint8_t>(GROUP, EMPTY).swap(ctrl);
+      std::vector<Slot>(GROUP).swap(slots);
+      n_used = n_deleted = 0;
+    }
+
+    size_t size() const { return n_used; }
+    size_t capacity() const { return ctrl.size(); }
+
+    size_t memory() const
+    {
+      return ctrl.capacity() + slots.capacity() * sizeof(Slot);
+    }
+
+  private:
+    enum : std::uint8_t {
+      EMPTY = 0x80,
+      DELETED = 0xFE,
+    };
+
+    enum {
+      GROUP = 16,
+    };
+
+    static constexpr size_t NPOS = ~size_t(0);
+
+    struct Slot
+    {
+      Key key;
+      InstancePtr inst;
+    };
+
+    static size_t capacity_for(const size_t expected)
+    {
+      size_t cap = GROUP;
+      while (expected * 8 > cap * 7)
+	cap <<= 1;
+      return cap;
+    }
+
+    std::uint64_t hash(const Key& key) const
+    {
+      return hasher(key.w, 3);
+    }
+
+    static std::uint8_t h2(const std::uint64_t h)
+    {
+      return std::uint8_t(h & 0x7F);
+    }
+
+    // bit i set for each of the 16 control bytes at c equal to b
+    static unsigned int match_byte(const std::uint8_t *c, const std::uint8_t b)
+    {
+#ifdef OPENVPN_PEERADDRTABLE_SSE2
+      const __m128i v = _mm_loadu_si128((const __m128i *)c);
+      return (unsigned int)_mm_movemask_epi8(_mm_cmpeq_epi8(v, _mm_set1_epi8((char)b)));
+#else
+      unsigned int m = 0;
+      for (unsigned int i = 0; i < GROUP; ++i)
+	m |= (unsigned int)(c[i] == b) << i;
+      return m;
+#endif
+    }
+
+    // bit i set for each EMPTY or DELETED control byte (high bit set)
+    static unsigned int match_free(const std::uint8_t *c)
+    {
+#ifdef OPENVPN_PEERADDRTABLE_SSE2
+      return (unsigned int)_mm_movemask_epi8(_mm_loadu_si128((const __m128i *)c));
+#else
+      unsigned int m = 0;
+      for (unsigned int i = 0; i < GROUP; ++i)
+	m |= (unsigned int)(c[i] >> 7) << i;
+      return m;
+#endif
+    }
+
+    // Probe groups quadratically (triangular numbers), which visits
+    // every group of a power-of-2 table.
+    size_t find(const Key& key, const std::uint64_t h) const
+    {
+      const size_t mask = ctrl.size() / GROUP - 1;
+      size_t g = size_t(h >> 7) & mask;
+      for (size_t step = 1; ; ++step)
+	{
+	  const size_t base = g * GROUP;
+	  unsigned int m = match_byte(&ctrl[base], h2(h));
+	  while (m)
+	    {
+	      const size_t i = base + find_first_set(m) - 1;
+	      if (likely(slots[i].key == key))
+		return i;
+	      m &= m - 1;
+	    }
+	  if (likely(match_byte(&ctrl[base], EMPTY)))
+	    return NPOS;
+	  if (step > mask)
+	    return NPOS;
+	  g = (g + step) & mask;
+	}
+    }
+
+    size_t free_slot(const std::uint64_t h) const
+    {
+      const size_t mask = ctrl.size() / GROUP - 1;
+      size_t g = size_t(h >> 7) & mask;
+      for (size_t step = 1; ; ++step)
+	{
+	  const unsigned int m = match_free(&ctrl[g * GROUP]);
+	  if (m)
+	    return g * GROUP + find_first_set(m) - 1;
+	  g = (g + step) & mask;
+	}
+    }
+
+    void rehash(const size_t cap)
+    {
+      std::vector<std::uint8_t> old_ctrl(cap, EMPTY);
+      std::vector<Slot> old_slots(cap);
+      old_ctrl.swap(ctrl);
+      old_slots.swap(slots);
+      n_deleted = 0;
+      for (size_t i = 0; i < old_ctrl.size(); ++i)
+	{
+	  if (!(old_ctrl[i] & 0x80))
+	    {
+	      const std::uint64_t h = hash(old_slots[i].key);
+	      const size_t j = free_slot(h);
+	      ctrl[j] = h2(h);
+	      slots[j].key = old_slots[i].key;
+	      slots[j].inst = std::move(old_slots[i].inst);
+	    }
+	}
+    }
+
+    const Hash::SipHash13 hasher;
+    std::vector<std::uint8_t> ctrl;
+    std::vector<Slot> slots;
+    size_t n_used = 0;
+    size_t n_deleted = 0;
+  };
+}
+
+#endif
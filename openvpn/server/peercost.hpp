@@ -0,0 +1,181 @@
+//    OpenVPN -- An application to securely tunnel IP networks
+//               over a single port, with support for SSL/TLS-based
+//               session authentication and key exchange,
+//               packet encryption, packet authentication, and
+//               packet compression.
+//
+//    Copyright (C) 2012-2016 OpenVPN Technologies, Inc.
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU Affero General Public License Version 3
+//    as published by the Free Software Foundation.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU Affero General Public License for more details.
+//
+//    You should have received a copy of the GNU Affero General Public License
+//    along with this program in the COPYING file.
+//    If not, see <http://www.gnu.org/licenses/>.
+
+// Per-session CPU cost and packet size accounting for the server
+
+#ifndef OPENVPN_SERVER_PEERCOST_H
+#define OPENVPN_SERVER_PEERCOST_H
+
+#include <cstdint> // for std::uint32_t, uint64_t, etc.
+#include <chrono>
+
+#include <openvpn/common/size.hpp>
+#include <openvpn/server/peerstats.hpp>
+
+namespace openvpn {
+
+  // Tells which clients are expensive to serve.  Every data packet is
+  // counted in a size histogram, and one in 2^sample_shift has its
+  // decrypt (with decompression) or encrypt (with compression) timed,
+  // and the time scaled up, so the clock is read twice per 64 packets
+  // at the default.  Control channel work (TLS, retransmits) is rare
+  // enough to time every call.  All times are wall clock time on the
+  // session's thread, which is CPU time as long as the thread is not
+  // preempted.  Reported through PeerStats.
+  class PeerCost
+  {
+  public:
+    enum Dir {
+      RX = 0, // from the client
+      TX,     // to the client
+    };
+
+    // Times one data packet in 2^sample_shift.
+    void enable(const unsigned int sample_shift)
+    {
+      shift = sample_shift;
+      mask = (std::uint32_t(1) << sample_shift) - 1;
+      enabled_ = true;
+      reset();
+    }
+
+    void disable()
+    {
+      enabled_ = false;
+    }
+
+    bool enabled() const { return enabled_; }
+
+    void reset()
+    {
+      for (unsigned int d = 0; d < 2; ++d)
+	{
+	  tick[d] = 0;
+	  data_ns[d] = 0;
+	  for (auto &s : sizes[d])
+	    s = 0;
+	}
+      control_ns = 0;
+    }
+
+    // Count a data packet of size bytes, and time the scope if this
+    // is a sampled packet.
+    class DataTimer
+    {
+    public:
+      DataTimer(PeerCost& pc_arg, const Dir dir_arg, const size_t size)
+      {
+	if (pc_arg.enabled_)
+	  {
+	    ++pc_arg.sizes[dir_arg][size_class(size)];
+	    if (!(pc_arg.tick[dir_arg]++ & pc_arg.mask))
+	      {
+		pc = &pc_arg;
+		dir = dir_arg;
+		start = now_ns();
+	      }
+	  }
+      }
+
+      ~DataTimer()
+      {
+	if (pc)
+	  pc->data_ns[dir] += (now_ns() - start) << pc->shift;
+      }
+
+    private:
+      PeerCost* pc = nullptr;
+      Dir dir = RX;
+      std::uint64_t start = 0;
+    };
+
+    // time the scope as control channel work
+    class ControlTimer
+    {
+    public:
+      ControlTimer(PeerCost& pc_arg)
+      {
+	if (pc_arg.enabled_)
+	  {
+	    pc = &pc_arg;
+	    start = now_ns();
+	  }
+      }
+
+      ~ControlTimer()
+      {
+	if (pc)
+	  pc->control_ns += now_ns() - start;
+      }
+
+    private:
+      PeerCost* pc = nullptr;
+      std::uint64_t start = 0;
+    };
+
+    void add_to(PeerStats& ps) const
+    {
+      if (!enabled_)
+	return;
+      ps.rx_cpu_ns = data_ns[RX];
+      ps.tx_cpu_ns = data_ns[TX];
+      ps.handshake_cpu_ns = control_ns;
+      for (unsigned int i = 0; i < PeerStats::N_SIZES; ++i)
+	{
+	  ps.rx_sizes[i] = sizes[RX][i];
+	  ps.tx_sizes[i] = sizes[TX][i];
+	}
+    }
+
+    // index into PeerStats::rx_sizes/tx_sizes
+    static unsigned int size_class(const size_t size)
+    {
+      if (size <= 64)
+	return 0;
+      if (size <= 128)
+	return 1;
+      if (size <= 256)
+	return 2;
+      if (size <= 512)
+	return 3;
+      if (size <= 1024)
+	return 4;
+      return 5;
+    }
+
+  private:
+    static std::uint64_t now_ns()
+    {
+      return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+    bool enabled_ = false;
+    unsigned int shift = 0;
+    std::uint32_t mask = 0;
+    std::uint32_t tick[2];
+    std::uint64_t data_ns[2];
+    std::uint64_t control_ns;
+    std::uint64_t sizes[2][PeerStats::N_SIZES];
+  };
+
+}
+
+#endif
@@ -0,0 +1,223 @@
+//    OpenVPN -- An application to securely tunnel IP networks
+//               over a single port, with support for SSL/TLS-based
+//               session authentication and key exchange,
+//               packet encryption, packet authentication, and
+//               packet compression.
+//
+//    Copyright (C) 2012-2016 OpenVPN Technologies, Inc.
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU Affero General Public License Version 3
+//    as published by the Free Software Foundation.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU Affero General Public License for more details.
+//
+//    You should have received a copy of the GNU Affero General Public License
+//    along with this program in the COPYING file.
+//    If not, see <http://www.gnu.org/licenses/>.
+
+// Server-side directory of client instances indexed by peer-id
+
+#ifndef OPENVPN_SERVER_PEERIDTABLE_H
+#define OPENVPN_SERVER_PEERIDTABLE_H
+
+#include <vector>
+#include <deque>
+#include <cstdint> // for std::uint32_t
+
+#include <openvpn/common/likely.hpp>
+#include <openvpn/common/exception.hpp>
+#include <openvpn/common/socktypes.hpp>
+#include <openvpn/buffer/buffer.hpp>
+
+namespace openvpn {
+
+  // Cluster mode peer-id layout.  The top node_bits of the 24-bit
+  // peer-id hold the index of the owning server node, the rest is
+  // the node-local peer-id.  A stateless load balancer in front of
+  // the cluster routes P_DATA_V2 packets by node_of() alone, so a
+  // client that floats to a new address, or whose 5-tuple hashes
+  // differently after an ECMP change, still reaches its owner.
+  // Other packets must be routed by a stable hash of the source as
+  // before, the session lives on the node that got its HARD_RESET.
+  struct PeerIDCluster
+  {
+    OPENVPN_EXCEPTION(peer_id_cluster_error);
+
+    enum {
+      PEER_ID_BITS = 24,
+      MAX_NODE_BITS = 8,
+    };
+
+    PeerIDCluster() {}
+
+    PeerIDCluster(const unsigned int node_bits_arg, const unsigned int node_arg)
+      : node_bits(node_bits_arg),
+	node(node_arg)
+    {
+      if (node_bits > MAX_NODE_BITS)
+	throw peer_id_cluster_error("too many node bits");
+      if (node >> node_bits)
+	throw peer_id_cluster_error("node index out of range");
+    }
+
+    unsigned int local_bits() const
+    {
+      return PEER_ID_BITS - node_bits;
+    }
+
+    std::uint32_t local_mask() const
+    {
+      return (std::uint32_t(1) << local_bits()) - 1;
+    }
+
+    int encode(const std::uint32_t local_peer_id) const
+    {
+      return int((std::uint32_t(node) << local_bits()) | local_peer_id);
+    }
+
+    // returns -1 for peer-ids owned by another node
+    int decode(const int peer_id) const
+    {
+      if ((std::uint32_t(peer_id) >> local_bits()) != node)
+	return -1;
+      return int(std::uint32_t(peer_id) & local_mask());
+    }
+
+    // the node owning a peer-id, for the load balancer
+    static unsigned int node_of(const int peer_id, const unsigned int node_bits)
+    {
+      return node_bits ? (std::uint32_t(peer_id) & 0x00FFFFFF) >> (PEER_ID_BITS - node_bits) : 0;
+    }
+
+    unsigned int node_bits = 0;
+    unsigned int node = 0;
+  };
+
+  // Flat array of client instances indexed by the 24-bit peer-id that
+  // clients put on every P_DATA_V2 packet.  The UDP server transport
+  // uses it to dispatch data packets without hashing the source endpoint,
+  // so a client that floated to a new address is found by the same
+  // lookup and only needs float_notify once its packet authenticates.
+  //
+  // When the listener is sharded (see UDPTransport::ShardedListener),
+  // each shard owns one table and only hands out peer-ids where
+  // (peer_id % n_shards) == shard, so the kernel steering program and
+  // the table agree on which thread owns a client.  In cluster mode
+  // (see PeerIDCluster) this applies to the node-local part.
+  //
+  // Not thread-safe, one table per worker thread.
+  template <typename INSTANCE>
+  class PeerIDTable
+  {
+  public:
+    typedef typename INSTANCE::Ptr InstancePtr;
+
+    OPENVPN_EXCEPTION(peer_id_table_error);
+
+    enum {
+      PEER_ID_UNDEF = 0x00FFFFFF, // reserved by the protocol
+    };
+
+    PeerIDTable(const size_t max_instances,
+		const unsigned int shard_arg=0,
+		const unsigned int n_shards_arg=1,
+		const PeerIDCluster& cluster_arg=PeerIDCluster())
+      : shard(shard_arg),
+	n_shards(n_shards_arg),
+	cluster(cluster_arg),
+	n_used(0)
+    {
+      if (!n_shards || shard >= n_shards)
+	throw peer_id_table_error("bad shard index");
+      if (!max_instances || (max_instances - 1) * n_shards + shard >= cluster.local_mask())
+	throw peer_id_table_error("too many instances for peer-id");
+      slots.resize(max_instances);
+      for (size_t i = 0; i < max_instances; ++i)
+	free_slots.push_back(i);
+    }
+
+    // Add an instance and return its peer-id, or -1 if the table is full.
+    // Freed slots are reused in FIFO order so that a stale peer-id is not
+    // handed out again right away.
+    int add(const InstancePtr& inst)
+    {
+      if (free_slots.empty())
+	return -1;
+      const size_t slot = free_slots.front();
+      free_slots.pop_front();
+      slots[slot] = inst;
+      ++n_used;
+      return cluster.encode(std::uint32_t(slot * n_shards + shard));
+    }
+
+    void remove(const int peer_id)
+    {
+      const size_t slot = slot_of(peer_id);
+      if (slot < slots.size() && slots[slot])
+	{
+	  slots[slot].reset();
+	  free_slots.push_back(slot);
+	  --n_used;
+	}
+    }
+
+    // O(1) dispatch, returns nullptr for unknown or foreign peer-ids
+    INSTANCE* lookup(const int peer_id) const
+    {
+      const size_t slot = slot_of(peer_id);
+      if (likely(slot < slots.size()))
+	return slots[slot].get();
+      return nullptr;
+    }
+
+    // Lookup by the peer-id of a P_DATA_V2 packet, returns nullptr
+    // for all other packets.
+    INSTANCE* lookup(const Buffer& buf) const
+    {
+      const int peer_id = data_v2_peer_id(buf);
+      if (peer_id >= 0)
+	return lookup(peer_id);
+      return nullptr;
+    }
+
+    size_t size() const { return n_used; }
+    size_t capacity() const { return slots.size(); }
+
+    // Return the peer-id of a P_DATA_V2 packet, or -1 if buf is not
+    // a P_DATA_V2 packet or the peer-id is undefined.  Opcode layout
+    // must match ProtoContext (DATA_V2 == 9 in the high 5 bits).
+    static int data_v2_peer_id(const Buffer& buf)
+    {
+      if (buf.size() < 4 || (buf[0] >> 3) != 9)
+	return -1;
+      const int peer_id = ntohl(*(const std::uint32_t *)buf.c_data()) & PEER_ID_UNDEF;
+      return peer_id != PEER_ID_UNDEF ? peer_id : -1;
+    }
+
+  private:
+    // returns an out-of-range slot for peer-ids owned by other
+    // shards or nodes
+    size_t slot_of(const int peer_id) const
+    {
+      if (unlikely(peer_id < 0))
+	return slots.size();
+      const int local = cluster.decode(peer_id);
+      if (unlikely(local < 0 || (unsigned int)local % n_shards != shard))
+	return slots.size();
+      return (unsigned int)local / n_shards;
+    }
+
+    const unsigned int shard;
+    const unsigned int n_shards;
+    const PeerIDCluster cluster;
+    size_t n_used;
+    std::vector<InstancePtr> slots;
+    std::deque<size_t> free_slots;
+  };
+}
+
+#endif
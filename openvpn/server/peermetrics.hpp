@@ -0,0 +1,291 @@
+//    OpenVPN -- An application to securely tunnel IP networks
+//               over a single port, with support for SSL/TLS-based
+//               session authentication and key exchange,
+//               packet encryption, packet authentication, and
+//               packet compression.
+//
+//    Copyright (C) 2012-2016 OpenVPN Technologies, Inc.
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU Affero General Public License Version 3
+//    as published by the Free Software Foundation.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU Affero General Public License for more details.
+//
+//    You should have received a copy of the GNU Affero General Public License
+//    along with this program in the COPYING file.
+//    If not, see <http://www.gnu.org/licenses/>.
+// Aggregate per-peer server stats into per-thread snapshots that can
+// be rendered in OpenMetrics text format without touching sessions.
+
+#ifndef OPENVPN_SERVER_PEERMETRICS_H
+#define OPENVPN_SERVER_PEERMETRICS_H
+
+#include <string>
+#include <sstream>
+#include <vector>
+#include <unordered_map>
+#include <mutex>
+#include <cstdint>
+#include <algorithm> // for std::max
+
+#include <openvpn/common/size.hpp>
+#include <openvpn/common/exception.hpp>
+#include <openvpn/common/rc.hpp>
+#include <openvpn/time/time.hpp>
+#include <openvpn/server/peerstats.hpp>
+#include <openvpn/server/peeraddr.hpp>
+
+namespace openvpn {
+
+  // Each server thread owns a PerThread view and records stats
+  // updates into it without locking.  Every publish interval the
+  // owner builds an immutable Snapshot of its peers and swaps it in
+  // under a per-thread mutex held only for the pointer swap.  A
+  // scrape grabs the current snapshot of each thread and renders
+  // them, so its cost never lands on the data path and it never
+  // walks live sessions.
+  class PeerMetrics : public RC<thread_safe_refcount>
+  {
+  public:
+    typedef RCPtr<PeerMetrics> Ptr;
+
+    OPENVPN_EXCEPTION(peer_metrics_error);
+
+    struct Row
+    {
+      std::string proto;
+      std::string remote;
+      std::uint64_t rx_bytes = 0;
+      std::uint64_t tx_bytes = 0;
+      std::uint64_t cpu_ns = 0; // see PeerCost
+    };
+
+    struct Snapshot : public RC<thread_safe_refcount>
+    {
+      typedef RCPtr<Snapshot> Ptr;
+
+      std::vector<Row> peers;
+      std::uint64_t closed_rx_bytes = 0; // from peers no longer listed
+      std::uint64_t closed_tx_bytes = 0;
+      std::uint64_t closed = 0;
+      Time published;
+    };
+
+    class PerThread
+    {
+      friend class PeerMetrics;
+
+    public:
+      typedef const void* Key;
+
+      // Record current stats for a peer, identified by an opaque key
+      // that stays unique while the peer is live (the session pointer).
+      void update(Key key, const PeerAddr* addr, const PeerStats& ps)
+      {
+	Row& r = live[key];
+	if (r.remote.empty() && addr)
+	  {
+	    r.proto = addr->tcp ? "tcp" : "udp";
+	    r.remote = addr->remote.to_string();
+	  }
+	r.rx_bytes = ps.rx_bytes;
+	r.tx_bytes = ps.tx_bytes;
+	r.cpu_ns = ps.rx_cpu_ns + ps.tx_cpu_ns + ps.handshake_cpu_ns;
+	dirty = true;
+      }
+
+      // Peer went away; ps holds its final stats.
+      void remove(Key key, const PeerStats& ps)
+      {
+	auto i = live.find(key);
+	if (i != live.end())
+	  {
+	    closed_rx_bytes += std::max(ps.rx_bytes, i->second.rx_bytes);
+	    closed_tx_bytes += std::max(ps.tx_bytes, i->second.tx_bytes);
+	    ++closed;
+	    live.erase(i);
+	    dirty = true;
+	  }
+      }
+
+      // Publish a new snapshot if something changed and the previous
+      // one is older than the publish interval.
+      void publish_if_due(const Time& now)
+      {
+	if (dirty && (!last_publish.defined() || now >= last_publish + owner->interval))
+	  publish(now);
+      }
+
+      void publish(const Time& now)
+      {
+	Snapshot::Ptr s(new Snapshot());
+	s->peers.reserve(live.size());
+	for (auto &e : live)
+	  s->peers.push_back(e.second);
+	s->closed_rx_bytes = closed_rx_bytes;
+	s->closed_tx_bytes = closed_tx_bytes;
+	s->closed = closed;
+	s->published = now;
+	{
+	  std::lock_guard<std::mutex> lock(mutex);
+	  current.swap(s);
+	}
+	last_publish = now;
+	dirty = false;
+      }
+
+      size_t size() const { return live.size(); }
+
+    private:
+      Snapshot::Ptr get() const
+      {
+	std::lock_guard<std::mutex> lock(mutex);
+	return current;
+      }
+
+      PeerMetrics* owner = nullptr;
+      std::unordered_map<Key, Row> live;
+      std::uint64_t closed_rx_bytes = 0;
+      std::uint64_t closed_tx_bytes = 0;
+      std::uint64_t closed = 0;
+      bool dirty = false;
+      Time last_publish;
+
+      // shared with scrapers
+      mutable std::mutex mutex;
+      Snapshot::Ptr current;
+    };
+
+    PeerMetrics(const unsigned int n_threads,
+		const Time::Duration& interval_arg = Time::Duration::seconds(5),
+		const bool per_peer_arg = true)
+      : interval(interval_arg),
+	per_peer(per_peer_arg),
+	thr(n_threads)
+    {
+      if (!n_threads)
+	throw peer_metrics_error("no threads");
+      for (auto &pt : thr)
+	pt.owner = this;
+    }
+
+    // The view must only be used from its own thread.
+    PerThread& per_thread(const unsigned int index)
+    {
+      if (index >= thr.size())
+	throw peer_metrics_error("thread index out of range");
+      return thr[index];
+    }
+
+    // Render the latest published snapshots; callable from any thread.
+    std::string render_openmetrics() const
+    {
+      std::vector<Snapshot::Ptr> snaps;
+      snaps.reserve(thr.size());
+      for (auto &pt : thr)
+	snaps.push_back(pt.get());
+
+      std::uint64_t peers = 0, rx = 0, tx = 0, closed = 0;
+      for (auto &s : snaps)
+	{
+	  if (!s)
+	    continue;
+	  peers += s->peers.size();
+	  rx += s->closed_rx_bytes;
+	  tx += s->closed_tx_bytes;
+	  closed += s->closed;
+	  for (auto &r : s->peers)
+	    {
+	      rx += r.rx_bytes;
+	      tx += r.tx_bytes;
+	    }
+	}
+
+      std::ostringstream os;
+      os << "# TYPE openvpn_server_peers gauge\n"
+	 << "# HELP openvpn_server_peers Connected peers.\n"
+	 << "openvpn_server_peers " << peers << '\n'
+	 << "# TYPE openvpn_server_rx_bytes counter\n"
+	 << "# HELP openvpn_server_rx_bytes Bytes received from peers.\n"
+	 << "openvpn_server_rx_bytes_total " << rx << '\n'
+	 << "# TYPE openvpn_server_tx_bytes counter\n"
+	 << "# HELP openvpn_server_tx_bytes Bytes sent to peers.\n"
+	 << "openvpn_server_tx_bytes_total " << tx << '\n'
+	 << "# TYPE openvpn_server_sessions_closed counter\n"
+	 << "# HELP openvpn_server_sessions_closed Peer sessions ended.\n"
+	 << "openvpn_server_sessions_closed_total " << closed << '\n';
+
+      if (per_peer)
+	{
+	  os << "# TYPE openvpn_peer_rx_bytes gauge\n"
+	     << "# HELP openvpn_peer_rx_bytes Bytes received from peer in this session.\n";
+	  render_peers(os, snaps, "openvpn_peer_rx_bytes", &Row::rx_bytes);
+	  os << "# TYPE openvpn_peer_tx_bytes gauge\n"
+	     << "# HELP openvpn_peer_tx_bytes Bytes sent to peer in this session.\n";
+	  render_peers(os, snaps, "openvpn_peer_tx_bytes", &Row::tx_bytes);
+	  os << "# TYPE openvpn_peer_cpu_ns gauge\n"
+	     << "# HELP openvpn_peer_cpu_ns Estimated CPU time spent on peer in this session, if accounted.\n";
+	  render_peers(os, snaps, "openvpn_peer_cpu_ns", &Row::cpu_ns);
+	}
+      os << "# EOF\n";
+      return os.str();
+    }
+
+    // Escape a label value per the OpenMetrics text format.
+    static std::string escape_label(const std::string& in)
+    {
+      std::string ret;
+      ret.reserve(in.length());
+      for (auto c : in)
+	{
+	  switch (c)
+	    {
+	    case '\\':
+	      ret += "\\\\";
+	      break;
+	    case '"':
+	      ret += "\\\"";
+	      break;
+	    case '\n':
+	      ret += "\\n";
+	      break;
+	    default:
+	      ret += c;
+	      break;
+	    }
+	}
+      return ret;
+    }
+
+  private:
+    static void render_peers(std::ostream& os,
+			     const std::vector<Snapshot::Ptr>& snaps,
+			     const char *name,
+			     std::uint64_t Row::*field)
+    {
+      for (size_t t = 0; t < snaps.size(); ++t)
+	{
+	  const Snapshot* s = snaps[t].get();
+	  if (!s)
+	    continue;
+	  for (auto &r : s->peers)
+	    os << name
+	       << "{thread=\"" << t
+	       << "\",proto=\"" << r.proto
+	       << "\",remote=\"" << escape_label(r.remote)
+	       << "\"} " << r.*field << '\n';
+	}
+    }
+
+    const Time::Duration interval;
+    const bool per_peer;
+    std::vector<PerThread> thr;
+  };
+
+}
+
+#endif
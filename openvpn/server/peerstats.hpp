@@ -38,6 +38,24 @@ namespace openvpn {
     std::uint64_t rx_bytes;
     std::uint64_t tx_bytes;
     int status;
+
+    // data channel latency from "latency-probe", 0 if not measured
+    std::uint64_t rtt_us = 0;
+    std::uint64_t rtt_min_us = 0;
+    std::uint64_t jitter_us = 0;
+    std::uint64_t probes_sent = 0;
+    std::uint64_t probes_lost = 0;
+
+    // CPU time in ns spent on this peer, 0 unless accounted by
+    // PeerCost.  Data channel times are extrapolated from samples.
+    std::uint64_t rx_cpu_ns = 0;        // decrypt and decompress
+    std::uint64_t tx_cpu_ns = 0;        // compress and encrypt
+    std::uint64_t handshake_cpu_ns = 0; // control channel and TLS
+
+    // data packets by size: up to 64, 128, 256, 512, 1024 bytes, larger
+    enum { N_SIZES = 6 };
+    std::uint64_t rx_sizes[N_SIZES] = {};
+    std::uint64_t tx_sizes[N_SIZES] = {};
   };
 
 }
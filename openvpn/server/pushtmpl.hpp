@@ -0,0 +1,124 @@
+//    OpenVPN -- An application to securely tunnel IP networks
+//               over a single port, with support for SSL/TLS-based
+//               session authentication and key exchange,
+//               packet encryption, packet authentication, and
+//               packet compression.
+//
+//    Copyright (C) 2012-2016 OpenVPN Technologies, Inc.
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU Affero General Public License Version 3
+//    as published by the Free Software Foundation.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU Affero General Public License for more details.
+//
+//    You should have received a copy of the GNU Affero General Public License
+//    along with this program in the COPYING file.
+//    If not, see <http://www.gnu.org/licenses/>.
+
+// Pre-serialized PUSH_REPLY templates shared by all clients of a
+// server profile.  Only per-client directives are serialized at push
+// time.
+
+#ifndef OPENVPN_SERVER_PUSHTMPL_H
+#define OPENVPN_SERVER_PUSHTMPL_H
+
+#include <string>
+#include <vector>
+#include <mutex>
+#include <unordered_map>
+
+#include <openvpn/common/rc.hpp>
+#include <openvpn/buffer/buffer.hpp>
+#include <openvpn/options/continuation.hpp>
+
+namespace openvpn {
+
+  // Immutable after construction, so it may be shared across
+  // server threads.  The push path takes ownership of its message
+  // buffers (control_send consumes them), so instantiate() returns
+  // private copies of the pre-serialized chunks, which costs one
+  // memcpy per chunk instead of re-serializing the option set.
+  class PushTemplate : public RC<thread_safe_refcount>
+  {
+  public:
+    typedef RCPtr<PushTemplate> Ptr;
+
+    PushTemplate(const std::vector<std::string>& invariant_directives,
+		 const size_t max_size_arg = 1024)
+      : max_size(max_size_arg)
+    {
+      if (!invariant_directives.empty())
+	PushReplyFragmenter::fragment(invariant, invariant_directives, max_size, true);
+    }
+
+    // Build the PUSH_REPLY messages for one client.  Per-client
+    // directives such as ifconfig, peer-id, or auth-token go first,
+    // followed by the shared chunks.
+    std::vector<BufferPtr> instantiate(const std::vector<std::string>& per_client) const
+    {
+      std::vector<BufferPtr> ret;
+      ret.reserve(invariant.size() + 1);
+      if (!per_client.empty() || invariant.empty())
+	PushReplyFragmenter::fragment(ret, per_client, max_size, invariant.empty());
+      for (auto &chunk : invariant)
+	ret.emplace_back(new BufferAllocated(*chunk));
+      return ret;
+    }
+
+    size_t n_chunks() const
+    {
+      return invariant.size();
+    }
+
+  private:
+    const size_t max_size;
+    std::vector<BufferPtr> invariant;
+  };
+
+  // Templates keyed by an application-defined name, such as a
+  // profile or user group.  build() is only called on a miss.
+  class PushTemplateCache : public RC<thread_safe_refcount>
+  {
+  public:
+    typedef RCPtr<PushTemplateCache> Ptr;
+
+    template <typename BUILD>
+    PushTemplate::Ptr get(const std::string& key, BUILD build)
+    {
+      {
+	std::lock_guard<std::mutex> lock(mutex);
+	auto i = map.find(key);
+	if (i != map.end())
+	  return i->second;
+      }
+      PushTemplate::Ptr tmpl = build();
+      std::lock_guard<std::mutex> lock(mutex);
+      auto ins = map.emplace(key, tmpl);
+      return ins.first->second;
+    }
+
+    // drop a template after its invariant directives change
+    void invalidate(const std::string& key)
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      map.erase(key);
+    }
+
+    void clear()
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      map.clear();
+    }
+
+  private:
+    std::mutex mutex;
+    std::unordered_map<std::string, PushTemplate::Ptr> map;
+  };
+
+}
+
+#endif
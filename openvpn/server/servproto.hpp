@@ -24,6 +24,11 @@
 #ifndef OPENVPN_SERVER_SERVPROTO_H
 #define OPENVPN_SERVER_SERVPROTO_H
 
+#include <vector>
+#include <deque>
+#include <memory>
+#include <cstring>
+#include <algorithm>
 #include <utility> // for std::move
 
 #include <openvpn/common/size.hpp>
@@ -32,14 +37,28 @@
 #include <openvpn/common/unicode.hpp>
 #include <openvpn/common/abort.hpp>
 #include <openvpn/common/link.hpp>
+#include <openvpn/buffer/bufstr.hpp>
 #include <openvpn/buffer/bufstream.hpp>
 #include <openvpn/time/asiotimer.hpp>
 #include <openvpn/time/coarsetime.hpp>
+#include <openvpn/time/timerwheel.hpp>
 #include <openvpn/crypto/cryptodc.hpp>
 #include <openvpn/ssl/proto.hpp>
 #include <openvpn/transport/server/transbase.hpp>
 #include <openvpn/tun/server/tunbase.hpp>
 #include <openvpn/server/manage.hpp>
+#include <openvpn/server/vpnservfib.hpp>
+#include <openvpn/server/vpnservmac.hpp>
+#include <openvpn/server/vpnservneigh.hpp>
+#include <openvpn/server/peermetrics.hpp>
+#include <openvpn/server/peercost.hpp>
+#include <openvpn/server/flowtelemetry.hpp>
+#include <openvpn/server/statsbatch.hpp>
+#include <openvpn/server/sesstoken.hpp>
+#include <openvpn/server/shaper.hpp>
+#include <openvpn/server/hsadmit.hpp>
+#include <openvpn/log/pktcap.hpp>
+#include <openvpn/log/usdt.hpp>
 
 #ifdef OPENVPN_DEBUG_SERVPROTO
 #define OPENVPN_LOG_SERVPROTO(x) OPENVPN_LOG(x)
@@ -57,8 +76,59 @@ namespace openvpn {
     typedef Link<ManClientInstanceSend, ManClientInstanceRecv> ManLink;
 
   public:
+    typedef VPNServerFIB<TunClientInstanceRecv*> FIB;
+    typedef VPNServerMACTable<TunClientInstanceRecv*> MACTable;
+    typedef VPNServerNeighborProxy<TunClientInstanceRecv*> NeighborProxy;
+
     class Session;
 
+    // Per-thread pool of stopped sessions, reused by the factory
+    // for new clients so that a connect storm does not construct
+    // and destroy every session object from scratch.  A session
+    // stopped while the pool is enabled erases its keys and
+    // cleartext buffers and is retired here, but only becomes
+    // reusable once the pool holds its last reference, i.e. once
+    // the transport, tun and management layers and any pending
+    // handlers have let go of it.  Key contexts, and with them SSL
+    // objects and reliability windows, are still built per handshake.
+    class SessionPool : public RC<thread_unsafe_refcount>
+    {
+    public:
+      typedef RCPtr<SessionPool> Ptr;
+
+      // max_size bounds the sessions retired at any one time,
+      // scan the number of oldest ones examined per get()
+      SessionPool(const size_t max_size_arg, const size_t scan_arg=8)
+	: max_size(max_size_arg),
+	  scan(scan_arg)
+      {
+      }
+
+      inline ~SessionPool();
+
+      inline void retire(Session* session);
+
+      // a quiescent session, or undefined
+      inline RCPtr<Session> get();
+
+      // drop all retired sessions, when the factory goes away
+      void clear()
+      {
+	retired.clear();
+      }
+
+      size_t size() const { return retired.size(); }
+
+      // sessions handed out for reuse
+      size_t n_reused() const { return reused; }
+
+    private:
+      std::deque<RCPtr<Session>> retired;
+      const size_t max_size;
+      const size_t scan;
+      size_t reused = 0;
+    };
+
     class Factory : public TransportClientInstanceFactory
     {
     public:
@@ -66,15 +136,95 @@ namespace openvpn {
       typedef Base::Config ProtoConfig;
 
       Factory(asio::io_context& io_context_arg,
-	      const Base::Config& c)
-	: io_context(io_context_arg)
+	      const Base::Config& c,
+	      const bool stateless_reset=false)
+	: io_context(io_context_arg),
+	  stateless_reset_(stateless_reset)
       {
-	if (c.tls_auth_enabled())
-	  preval.reset(new Base::TLSAuthPreValidate(c, true));
+	init_prevalidate(c);
+      }
+
+      virtual ~Factory()
+      {
+	if (session_pool)
+	  session_pool->clear();
+      }
+
+      // Sessions and the factory share this to notice reloads.
+      struct ReloadState : public RC<thread_unsafe_refcount>
+      {
+	typedef RCPtr<ReloadState> Ptr;
+
+	ProtoConfig::Ptr config; // latest reloaded config
+	unsigned int generation = 0;
+      };
+
+      // Hot reload without dropping sessions.  The server re-parses its
+      // config into a new ProtoConfig for each thread and posts this
+      // call to the thread's io_context, so the swap needs no locking.
+      // New sessions are created from c at once.  Existing sessions
+      // keep their config, and switch to the SSL factory of c (CA,
+      // CRL, certificate) at their next renegotiation; push options
+      // and auth settings are taken from the management layer's own
+      // reloaded state when a new session issues its push_request.
+      void reload(const ProtoConfig::Ptr& c)
+      {
+	preval.reset();
+	psid_cookie.reset();
+	init_prevalidate(*c);
+	proto_context_config = c;
+	reload_state->config = c;
+	++reload_state->generation;
       }
 
       virtual TransportClientInstanceRecv::Ptr new_client_instance();
 
+      // Stateless HARD_RESET mode (see ProtoContext::PsidCookie).
+      // For a packet from an unknown source, the transport first
+      // tries stateless_reset_reply() and sends the reply if it
+      // returns true.  Otherwise it tries new_client_instance_from_cookie()
+      // and, after start(), passes the instance client_reset and
+      // then the packet itself.  Unmatched packets are dropped.
+      bool stateless_reset_enabled() const
+      {
+	return bool(psid_cookie);
+      }
+
+      bool stateless_reset_reply(const Buffer& net_buf, const AddrPort& remote, BufferAllocated& reply)
+      {
+	if (!psid_cookie)
+	  return false;
+	switch (psid_cookie->reset_reply(net_buf, remote.addr, remote.port, reply))
+	  {
+	  case ProtoContext::PsidCookie::OK:
+	    return true;
+	  case ProtoContext::PsidCookie::AUTH_FAIL:
+	    stats->error(Error::TLS_AUTH_FAIL);
+	    return false;
+	  default:
+	    return false;
+	  }
+      }
+
+      TransportClientInstanceRecv::Ptr new_client_instance_from_cookie(const Buffer& net_buf,
+								      const AddrPort& remote,
+								      BufferAllocated& client_reset);
+
+      // Batched form of validate_initial_packet, returns number valid.
+      size_t validate_initial_packets(const Buffer* const* bufs, const size_t n, bool* ok)
+      {
+	if (preval)
+	  {
+	    const size_t n_ok = preval->validate_batch(bufs, n, ok);
+	    for (size_t i = n_ok; i < n; ++i)
+	      stats->error(Error::TLS_AUTH_FAIL);
+	    return n_ok;
+	  }
+	for (size_t i = 0; i < n; ++i)
+	  ok[i] = true;
+	return n;
+      }
+
       virtual bool validate_initial_packet(const Buffer& net_buf)
       {
 	if (preval)
@@ -93,6 +243,11 @@ namespace openvpn {
 	return new ProtoConfig(*proto_context_config);
       }
 
+      unsigned int config_generation() const
+      {
+	return reload_state->generation;
+      }
+
       asio::io_context& io_context;
       ProtoConfig::Ptr proto_context_config;
 
@@ -101,17 +256,93 @@ namespace openvpn {
 
       SessionStats::Ptr stats;
 
+      // if defined, sessions schedule housekeeping on this
+      // shared wheel instead of arming their own timer
+      TimerWheel::Ptr housekeeping_wheel;
+
+      // index of our io_context among the server threads,
+      // used for the per-thread views below
+      unsigned int thread_index = 0;
+
+      // if defined, sessions register their client addresses
+      // here once pushed
+      FIB::Ptr fib;
+
+      // if defined (layer 2), sessions join here once pushed and
+      // learn the source MACs of the frames they receive
+      MACTable::Ptr mac_table;
+
+      // if defined (layer 2), sessions bind their pushed addresses
+      // here to their client's MAC, and answer ARP requests and
+      // neighbor solicitations from their client for bound addresses
+      NeighborProxy::Ptr neigh_proxy;
+
+      // if defined, sessions report their peer stats here
+      PeerMetrics::Ptr metrics;
+
+      // if defined, sessions record packets here while it is enabled
+      PacketCapture::Ptr packet_capture;
+
+      // if defined, periodic (non-final) peer stats go to the
+      // management layer in one batch per interval for this thread,
+      // instead of one stats_notify call per session
+      PeerStatsBatch::Ptr stats_batch;
+
+      // if defined, sessions sample cleartext packets into the flow
+      // cache of their thread for IPFIX export
+      FlowTelemetry::Ptr flow_telemetry;
+
+      // if enabled, sessions that have received nothing for this long
+      // release their scratch and SSL record buffers until the next
+      // packet arrives (see ProtoContext::compact)
+      Time::Duration idle_compact;
+
+      // if defined, passwords carrying a session token are verified
+      // here, on this thread, and the management layer is told via
+      // AuthCreds::session_token so it can skip the auth backend
+      SessionToken::Ptr session_token;
+
+      // if defined, limits concurrent handshakes on this thread
+      // and gives priority to returning clients
+      HandshakeAdmission::Ptr handshake_admission;
+
+      ReloadState::Ptr reload_state{new ReloadState()};
+
+      // if defined, stopped sessions are kept here for reuse
+      SessionPool::Ptr session_pool;
+
+      // if enabled, sessions account their CPU time and packet sizes
+      // in PeerStats, timing one data packet in 2^cost_sample_shift
+      // (see PeerCost)
+      bool cost_accounting = false;
+      unsigned int cost_sample_shift = 6;
+
     private:
-      Base::TLSAuthPreValidate::Ptr preval;
+      void init_prevalidate(const Base::Config& c)
+      {
+	if (c.tls_auth_enabled())
+	  {
+	    preval.reset(new Base::TLSAuthPreValidate(c, true));
+	    if (stateless_reset_)
+	      psid_cookie.reset(new Base::PsidCookie(c));
+	  }
+	else if (c.tls_crypt_enabled())
+	  preval.reset(new Base::TLSCryptPreValidate(c, true));
+      }
+
+      const bool stateless_reset_;
+      Base::PreValidate::Ptr preval;
+      Base::PsidCookie::Ptr psid_cookie;
     };
 
     // This is the main server-side client instance object
     class Session : Base,                  // OpenVPN protocol implementation
 		    public TransportLink,  // Transport layer
 		    public TunLink,        // Tun/routing layer
-		    public ManLink         // Management layer
+		    public ManLink,        // Management layer
+		    TimerWheel::Entry      // Shared housekeeping wakeup
     {
-      friend class Factory; // calls constructor
+      friend class Factory; // calls constructor, recycle
 
       typedef Base::PacketType PacketType;
 
@@ -136,13 +367,29 @@ namespace openvpn {
 			 const PeerAddr::Ptr& addr,
 			 const int local_peer_id)
       {
+	Base::update_now();
+	if (handshake_admission)
+	  {
+	    if (!handshake_admission->admit(addr->remote.addr, now()))
+	      {
+		stats->error(Error::HANDSHAKE_ADMISSION_DROP);
+		halt = true;
+		parent->stop();
+		return;
+	      }
+	    handshake_admitted = true;
+	  }
+
 	TransportLink::send = parent;
 	peer_addr = addr;
 
 	// init OpenVPN protocol handshake
-	Base::update_now();
-	Base::reset();
+	if (psid_self.defined())
+	  Base::reset(psid_self);
+	else
+	  Base::reset();
 	Base::set_local_peer_id(local_peer_id);
+	last_recv = now();
 	Base::start();
 	Base::flush(true);
 
@@ -152,10 +399,12 @@ namespace openvpn {
 
       virtual PeerStats stats_poll()
       {
+	PeerStats ps;
 	if (TransportLink::send)
-	  return TransportLink::send->stats_poll();
-	else
-	  return PeerStats();
+	  ps = TransportLink::send->stats_poll();
+	add_latency(ps);
+	cost.add_to(ps);
+	return ps;
       }
 
       virtual void stop()
@@ -163,13 +412,36 @@ namespace openvpn {
 	if (!halt)
 	  {
 	    halt = true;
+	    OPENVPN_USDT1(session_stop, this);
+	    handshake_release();
 	    housekeeping_timer.cancel();
+	    shaper_timer.cancel();
+	    if (housekeeping_wheel)
+	      housekeeping_wheel->cancel(*this);
+	    if (fib)
+	      fib->remove(fib_routes, this);
+	    if (mac_table)
+	      mac_table->remove(this);
+	    if (neigh_proxy)
+	      neigh_proxy->remove(this);
+	    ssl_async_release();
 
 	    // deliver final peer stats to management layer
+	    if (stats_slot != PeerStatsBatch::NO_SLOT)
+	      {
+		stats_batch->remove(stats_slot);
+		stats_slot = PeerStatsBatch::NO_SLOT;
+	      }
 	    if (TransportLink::send && ManLink::send)
 	      {
 		if (TransportLink::send->stats_pending())
-		  ManLink::send->stats_notify(TransportLink::send->stats_poll(), true);
+		  ManLink::send->stats_notify(stats_poll(), true);
+	      }
+	    if (metrics)
+	      {
+		PeerMetrics::PerThread& pm = metrics->per_thread(thread_index);
+		pm.remove(this, stats_poll());
+		pm.publish_if_due(now());
 	      }
 
 	    Base::pre_destroy();
@@ -189,6 +461,16 @@ namespace openvpn {
 		ManLink::send->stop();
 		ManLink::send.reset();
 	      }
+
+	    if (session_pool)
+	      {
+		Base::scrub();
+		if (shaper_buf.capacity())
+		  std::memset(shaper_buf.data_raw(), 0, shaper_buf.capacity());
+		shaper_buf.reset_content();
+		session_pool->retire(this);
+		session_pool.reset(); // the pool holds us now, don't hold it back
+	      }
 	  }
       }
 
@@ -198,9 +480,12 @@ namespace openvpn {
 	bool ret = false;
 	try {
 	  OPENVPN_LOG_SERVPROTO("Transport RECV[" << buf.size() << "] " << client_endpoint_render() << ' ' << Base::dump_packet(buf));
+	  capture(PacketCapture::WIRE_IN, buf);
 
 	  // update current time
 	  Base::update_now();
+	  last_recv = now();
+	  compacted_ = false;
 
 	  // get packet type
 	  Base::PacketType pt = Base::packet_type(buf);
@@ -209,17 +494,28 @@ namespace openvpn {
 	  if (pt.is_data())
 	    {
 	      // data packet
-	      ret = Base::data_decrypt(pt, buf);
+	      bool idle_keepalive;
+	      {
+		PeerCost::DataTimer ct(cost, PeerCost::RX, buf.size());
+		ret = Base::data_decrypt(pt, buf, idle_keepalive);
+	      }
+
+	      // keepalive from an idle client, nothing to forward,
+	      // flush or reschedule
+	      if (idle_keepalive)
+		return ret;
+
 	      if (buf.size())
+		tun_deliver(buf);
+	      else
 		{
-#ifdef OPENVPN_PACKET_LOG
-		  log_packet(buf, false);
-#endif
-		  // make packet appear as incoming on tun interface
-		  if (true) // fixme: was tun
+		  // bundled packets
+		  BufferAllocated** bufs;
+		  const size_t n = Base::data_unbundled(bufs);
+		  for (size_t i = 0; i < n; ++i)
 		    {
-		      OPENVPN_LOG_SERVPROTO("TUN SEND[" << buf.size() << ']');
-		      // fixme -- code me
+		      if (bufs[i]->size())
+			tun_deliver(*bufs[i]);
 		    }
 		}
 
@@ -229,10 +525,14 @@ namespace openvpn {
 	  else if (pt.is_control())
 	    {
 	      // control packet
+	      PeerCost::ControlTimer ct(cost);
 	      ret = Base::control_net_recv(pt, std::move(buf));
 
 	      // do a full flush
 	      Base::flush(true);
+
+	      // handshake may be parked on an async SSL operation
+	      ssl_async_wait();
 	    }
 
 	  // schedule housekeeping wakeup
@@ -250,7 +550,38 @@ namespace openvpn {
       // called with cleartext IP packets from routing layer
       virtual void tun_recv(BufferAllocated& buf)
       {
-	// fixme -- code me
+	capture(PacketCapture::TUN_IN, buf);
+	if (halt)
+	  return;
+	if (flows)
+	  flows->sample(buf, flow_session_id, FlowTelemetry::TO_CLIENT);
+	try {
+	  Base::update_now();
+	  if (shaper && !shaper->admit(buf.size(), now()))
+	    {
+	      if (shaper->enqueue(buf))
+		schedule_shaper();
+	      else
+		stats->error(Error::SHAPER_DROP);
+	      return;
+	    }
+	  data_send(buf);
+	}
+	catch (const std::exception& e)
+	  {
+	    error(e);
+	  }
+      }
+
+      // called with a packet flooded to several sessions, encrypted
+      // from a copy in the caller's scratch buffer
+      virtual void tun_recv_shared(const Buffer& buf, BufferAllocated& work)
+      {
+	if (halt)
+	  return;
+	Base::frame().prepare(Frame::READ_TUN, work);
+	work.write(buf.c_data(), buf.size());
+	tun_recv(work);
       }
 
       // Return true if keepalive parameter(s) are enabled.
@@ -273,6 +604,14 @@ namespace openvpn {
 	Base::dc_settings().set_factory(dc_factory);
       }
 
+      // buffer memory currently held by this session
+      void memory_usage(MemUsage& mu) const
+      {
+	Base::memory_usage(mu);
+      }
+
+      bool compacted() const { return compacted_; }
+
       virtual ~Session()
       {
 	// fatal error if destructor called while Session is active
@@ -285,27 +624,135 @@ namespace openvpn {
 	      const Factory& factory,
 	      ManClientInstanceFactory::Ptr man_factory_arg,
 	      TunClientInstanceFactory::Ptr tun_factory_arg)
-	: Base(factory.clone_proto_config(), factory.stats),
+	: Base(factory.proto_context_config, factory.stats),
 	  io_context(io_context_arg),
-	  halt(false),
-	  did_push(false),
-	  did_client_halt_restart(false),
 	  housekeeping_timer(io_context_arg),
-	  disconnect_at(Time::infinite()),
-	  stats(factory.stats),
-	  man_factory(man_factory_arg),
-	  tun_factory(tun_factory_arg)
-      {}
+	  shaper_timer(io_context_arg)
+      {
+	init(factory, man_factory_arg, tun_factory_arg);
+      }
+
+      // Reuse a session taken from a SessionPool, as if newly
+      // constructed by factory.
+      void recycle(const Factory& factory,
+		   ManClientInstanceFactory::Ptr man_factory_arg,
+		   TunClientInstanceFactory::Ptr tun_factory_arg)
+      {
+	Base::recycle(factory.proto_context_config, factory.stats);
+	init(factory, man_factory_arg, tun_factory_arg);
+      }
+
+      // Per-session state that the constructor and recycle() set up.
+      // Buffers and vectors keep their capacity.
+      void init(const Factory& factory,
+		ManClientInstanceFactory::Ptr man_factory_arg,
+		TunClientInstanceFactory::Ptr tun_factory_arg)
+      {
+	halt = false;
+	did_push = false;
+	did_client_halt_restart = false;
+	peer_addr.reset();
+	housekeeping_schedule = CoarseTime();
+	shaper.reset();
+	shaper_pending = false;
+	disconnect_at = Time::infinite();
+	stats = factory.stats;
+	man_factory = std::move(man_factory_arg);
+	tun_factory = std::move(tun_factory_arg);
+	housekeeping_wheel = factory.housekeeping_wheel;
+	thread_index = factory.thread_index;
+	fib = factory.fib;
+	mac_table = factory.mac_table;
+	macs = mac_table ? &mac_table->per_thread(thread_index) : nullptr;
+	neigh_proxy = factory.neigh_proxy;
+	neigh = neigh_proxy ? &neigh_proxy->per_thread(thread_index) : nullptr;
+	neigh_addrs.clear();
+	metrics = factory.metrics;
+	packet_capture = factory.packet_capture;
+	capture_session_id = packet_capture ? packet_capture->new_session_id() : 0;
+	reload_state = factory.reload_state;
+	config_generation = reload_state->generation;
+	stats_batch = factory.stats_batch;
+	stats_slot = PeerStatsBatch::NO_SLOT;
+	flow_telemetry = factory.flow_telemetry;
+	flows = flow_telemetry ? &flow_telemetry->per_thread(thread_index) : nullptr;
+	flow_session_id = flow_telemetry ? flow_telemetry->new_session_id() : 0;
+	idle_compact = factory.idle_compact;
+	session_token = factory.session_token;
+	handshake_admission = factory.handshake_admission;
+	handshake_admitted = false;
+	last_recv = Time();
+	compacted_ = false;
+	fib_routes.clear();
+	psid_self.reset();
+	session_pool = factory.session_pool;
+	if (factory.cost_accounting)
+	  cost.enable(factory.cost_sample_shift);
+	else
+	  cost.disable();
+
+	// share the factory's config until this session changes it
+	Base::config_copy_on_write();
+
+	OPENVPN_USDT2(session_create, this, thread_index);
+      }
+
+      Session(asio::io_context& io_context_arg,
+	      const Factory& factory,
+	      ManClientInstanceFactory::Ptr man_factory_arg,
+	      TunClientInstanceFactory::Ptr tun_factory_arg,
+	      const ProtoSessionID& psid_self_arg)
+	: Session(io_context_arg, factory, man_factory_arg, tun_factory_arg)
+      {
+	psid_self = psid_self_arg;
+      }
 
       bool defined_() const
       {
 	return !halt && TransportLink::send;
       }
 
+      // initial key context is active, handshake is done
+      virtual void active()
+      {
+	handshake_release();
+      }
+
+      // don't add our own renegotiations to a connect storm
+      virtual bool defer_renegotiation()
+      {
+	return handshake_admission && handshake_admission->busy();
+      }
+
+      void handshake_release()
+      {
+	if (handshake_admitted)
+	  {
+	    handshake_admitted = false;
+	    handshake_admission->release();
+	  }
+      }
+
+      void compact_if_idle()
+      {
+	if (idle_compact.enabled() && !compacted_ && now() >= last_recv + idle_compact)
+	  {
+	    Base::compact();
+	    compacted_ = true;
+	  }
+      }
+
+      void capture(const PacketCapture::Point point, const Buffer& buf)
+      {
+	if (packet_capture)
+	  packet_capture->capture(point, capture_session_id, buf);
+      }
+
       // proto base class calls here for control channel network sends
       virtual void control_net_send(const Buffer& net_buf)
       {
 	OPENVPN_LOG_SERVPROTO("Transport SEND[" << net_buf.size() << "] " << client_endpoint_render() << ' ' << Base::dump_packet(net_buf));
+	capture(PacketCapture::WIRE_OUT, net_buf);
 	if (TransportLink::send)
 	  {
 	    if (TransportLink::send->transport_send_const(net_buf))
@@ -328,7 +775,35 @@ namespace openvpn {
 	    AuthCreds::Ptr auth_creds(new AuthCreds(Unicode::utf8_printable(username, MAX_USERNAME_SIZE|Unicode::UTF8_FILTER),
 						    Unicode::utf8_printable(password, MAX_PASSWORD_SIZE|Unicode::UTF8_FILTER),
 						    Unicode::utf8_printable(peer_info, Unicode::UTF8_FILTER|Unicode::UTF8_PASS_FMT)));
+	    if (session_token)
+	      {
+		const std::string pw = auth_creds->password.to_string();
+		if (SessionToken::is_token(pw))
+		  {
+		    if (!session_token->verify(auth_creds->username, pw))
+		      {
+			auth_failed("session token expired or invalid", true);
+			return;
+		      }
+		    auth_creds->session_token = true;
+		  }
+	      }
+	    if (PeerInfo::flag_set(peer_info, PeerInfo::CTRL_ZLIB))
+	      Base::enable_control_compress();
+	    if (PeerInfo::flag_set(peer_info, PeerInfo::BUNDLE))
+	      Base::enable_bundle_send();
 	    ManLink::send->auth_request(auth_creds, auth_cert, peer_addr);
+
+	    // Client accepts an unrequested PUSH_REPLY, so queue the push
+	    // request now and let the management layer reply as soon as
+	    // authentication completes, rather than at the client's next
+	    // PUSH_REQUEST poll.
+	    if (!halt && !did_push && ManLink::send
+		&& PeerInfo::flag_set(peer_info, PeerInfo::PUSH_EARLY))
+	      {
+		did_push = true;
+		ManLink::send->push_request(push_conf());
+	      }
 	  }
       }
 
@@ -343,7 +818,7 @@ namespace openvpn {
 	      {
 		did_push = true;
 		if (get_management())
-		  ManLink::send->push_request(Base::conf_ptr());
+		  ManLink::send->push_request(push_conf());
 		else
 		  {
 		    auth_failed("no management provider", false);
@@ -368,6 +843,34 @@ namespace openvpn {
 	  TunLink::send->set_fwmark(fwmark);
       }
 
+      virtual void set_rate_limit(const std::uint64_t rate, const std::uint64_t burst)
+      {
+	if (halt)
+	  return;
+	Base::update_now();
+	if (rate)
+	  {
+	    if (shaper)
+	      shaper->set(rate, burst);
+	    else
+	      shaper.reset(new TokenBucketShaper(rate, burst, now()));
+	    schedule_shaper();
+	  }
+	else if (shaper)
+	  {
+	    // unshaped, send what was held back
+	    std::unique_ptr<TokenBucketShaper> s(std::move(shaper));
+	    shaper_timer.cancel();
+	    try {
+	      s->drain([this](BufferAllocated& buf) { data_send(buf); });
+	    }
+	    catch (const std::exception& e)
+	      {
+		error(e);
+	      }
+	  }
+      }
+
       virtual void push_reply(std::vector<BufferPtr>&& push_msgs,
 			      const std::vector<IP::Route>& rtvec,
 			      const unsigned int initial_fwmark)
@@ -377,15 +880,36 @@ namespace openvpn {
 
 	if (get_tun())
 	  {
+	    if (handshake_admission && peer_addr)
+	      handshake_admission->remember(peer_addr->remote.addr, now());
+
+	    // data channel keys are derived by the method pushed to the client
+	    if (pushes_tls_ekm(push_msgs))
+	      Base::conf().tls_ekm = true;
 	    Base::init_data_channel();
 	    if (initial_fwmark)
 	      TunLink::send->set_fwmark(initial_fwmark);
 	    TunLink::send->add_routes(rtvec);
-	    for (auto &msg : push_msgs)
+	    if (fib)
+	      {
+		if (!fib_routes.empty())
+		  fib->remove(fib_routes, this);
+		fib_routes = rtvec;
+		fib->add(fib_routes, this, thread_index);
+	      }
+	    if (mac_table)
+	      mac_table->join(this, thread_index);
+	    if (neigh_proxy)
 	      {
-		msg->null_terminate();
-		Base::control_send(std::move(msg));
+		neigh_proxy->remove(this);
+		neigh_addrs.clear();
+		for (auto &r : rtvec)
+		  if (r.addr.defined() && r.prefix_len == r.addr.size())
+		    neigh_addrs.push_back(r.addr);
 	      }
+	    for (auto &msg : push_msgs)
+	      msg->null_terminate();
+	    Base::control_send(std::move(push_msgs));
 	    Base::flush(true);
 	    set_housekeeping_timer();
 	  }
@@ -487,9 +1011,24 @@ namespace openvpn {
 	set_housekeeping_timer();
       }
 
-      virtual void stats_notify(const PeerStats& ps, const bool final)
+      virtual void stats_notify(const PeerStats& ps_arg, const bool final)
       {
-	if (ManLink::send)
+	PeerStats ps(ps_arg);
+	add_latency(ps);
+	cost.add_to(ps);
+	if (metrics)
+	  {
+	    PeerMetrics::PerThread& pm = metrics->per_thread(thread_index);
+	    pm.update(this, peer_addr.get(), ps);
+	    pm.publish_if_due(now());
+	  }
+	if (stats_batch && !final && ManLink::send)
+	  {
+	    if (stats_slot == PeerStatsBatch::NO_SLOT)
+	      stats_slot = stats_batch->add(ManLink::send.get());
+	    stats_batch->update(stats_slot, ps);
+	  }
+	else if (ManLink::send)
 	  ManLink::send->stats_notify(ps, final);
       }
 
@@ -499,6 +1038,26 @@ namespace openvpn {
 	  ManLink::send->float_notify(addr);
       }
 
+      // The management layer may set per-session data channel
+      // parameters (e.g. the negotiated cipher) on the config it is
+      // given, so hand it one this session owns.
+      const Base::Config::Ptr& push_conf()
+      {
+	Base::mutable_conf();
+	return Base::conf_ptr();
+      }
+
+      // fill in the data channel latency measured by this session
+      void add_latency(PeerStats& ps) const
+      {
+	const LatencyProbe::Stats& ls = Base::latency_stats();
+	ps.rtt_us = ls.rtt_us;
+	ps.rtt_min_us = ls.rtt_min_us;
+	ps.jitter_us = ls.jitter_us;
+	ps.probes_sent = ls.sent;
+	ps.probes_lost = ls.lost;
+      }
+
       virtual void data_limit_notify(const int key_id,
 				     const DataLimit::Mode cdl_mode,
 				     const DataLimit::State cdl_status)
@@ -534,6 +1093,102 @@ namespace openvpn {
 	disconnect_at = now() + dur;
       }
 
+      // encrypt and send a tun packet to the client
+      void data_send(BufferAllocated& buf)
+      {
+	{
+	  PeerCost::DataTimer ct(cost, PeerCost::TX, buf.size());
+	  Base::data_encrypt(buf);
+	}
+	if (buf.size() && TransportLink::send)
+	  {
+	    OPENVPN_LOG_SERVPROTO("Transport SEND[" << buf.size() << "] " << client_endpoint_render() << ' ' << Base::dump_packet(buf));
+	    capture(PacketCapture::WIRE_OUT, buf);
+	    if (TransportLink::send->transport_send(buf))
+	      Base::update_last_sent();
+	  }
+	Base::flush(false);
+	set_housekeeping_timer();
+      }
+
+      // True if the pushed options select "key-derivation tls-ekm"
+      static bool pushes_tls_ekm(const std::vector<BufferPtr>& push_msgs)
+      {
+	for (auto &msg : push_msgs)
+	  {
+	    const std::string str = buf_to_string(*msg);
+	    if (!string::starts_with(str, "PUSH_REPLY,"))
+	      continue;
+	    const OptionList opt = OptionList::parse_from_csv_static(str.substr(11), nullptr);
+	    if (opt.get_optional_relaxed("key-derivation", 1, 16) == "tls-ekm")
+	      return true;
+	  }
+	return false;
+      }
+
+      // pass a decrypted packet from the client on to the routing layer
+      void tun_deliver(BufferAllocated& buf)
+      {
+	capture(PacketCapture::TUN_OUT, buf);
+	if (macs)
+	  macs->learn(buf, this, now());
+	if (neigh && neigh_answer(buf))
+	  buf.reset_size();
+	if (flows && buf.size())
+	  flows->sample(buf, flow_session_id, FlowTelemetry::FROM_CLIENT);
+	// make packet appear as incoming on tun interface
+	if (TunLink::send && buf.size())
+	  {
+	    OPENVPN_LOG_SERVPROTO("TUN SEND[" << buf.size() << ']');
+	    TunLink::send->tun_send(buf);
+	  }
+      }
+
+      // Bind our client's addresses as it uses them, and answer an
+      // ARP request or neighbor solicitation from it for another
+      // client's address ourselves.  Returns true if answered.
+      bool neigh_answer(const Buffer& buf)
+      {
+	neigh->observe(buf, neigh_addrs, this);
+	const NeighborProxy::Entry* e = neigh->resolve(buf, this);
+	if (!e)
+	  return false;
+	Base::frame().prepare(Frame::READ_TUN, neigh_reply);
+	NeighborProxy::reply(buf, *e, neigh_reply);
+	data_send(neigh_reply);
+	return true;
+      }
+
+      // wake up when the shaper can release its next packet
+      void schedule_shaper()
+      {
+	if (!shaper || shaper->empty() || shaper_pending)
+	  return;
+	shaper_pending = true;
+	shaper_timer.expires_at(shaper->next_release(now()));
+	shaper_timer.async_wait([self=Ptr(this)](const asio::error_code& error)
+				{
+				  self->shaper_callback(error);
+				});
+      }
+
+      void shaper_callback(const asio::error_code& e)
+      {
+	shaper_pending = false;
+	if (e || halt || !shaper)
+	  return;
+	try {
+	  Base::update_now();
+	  while (shaper->release(shaper_buf, now()))
+	    data_send(shaper_buf);
+	  schedule_shaper();
+	}
+	catch (const std::exception& e)
+	  {
+	    error(e);
+	  }
+      }
+
       void housekeeping_callback(const asio::error_code& e)
       {
 	try {
@@ -543,7 +1198,20 @@ namespace openvpn {
 	      Base::update_now();
 
 	      housekeeping_schedule.reset();
-	      Base::housekeeping();
+	      {
+		PeerCost::ControlTimer ct(cost);
+		if (Base::ssl_async_pending() && !ssl_async_waiting())
+		  Base::ssl_async_resume(); // SSL engine without async fds
+		Base::housekeeping();
+	      }
+	      compact_if_idle();
+	      if (flows)
+		flows->poll();
+	      if (config_generation != reload_state->generation)
+		{
+		  config_generation = reload_state->generation;
+		  Base::set_renegotiation_config(reload_state->config);
+		}
 	      if (Base::invalidated())
 		invalidation_error(Base::invalidation_reason());
 	      else if (now() >= disconnect_at)
@@ -558,13 +1226,92 @@ namespace openvpn {
 	  }
       }
 
+      // Wait for a parked async SSL operation (SSLConst::ENABLE_ASYNC)
+      // to signal its fd, then resume the handshake on our io_context,
+      // leaving the reactor free to serve other sessions meanwhile.
+      void ssl_async_wait()
+      {
+#ifdef ASIO_HAS_POSIX_STREAM_DESCRIPTOR
+	if (ssl_async_sd || !Base::ssl_async_pending())
+	  return;
+	std::vector<int> fds;
+	Base::ssl_async_fds(fds);
+	if (fds.empty())
+	  return;
+	ssl_async_sd.reset(new asio::posix::stream_descriptor(io_context, fds[0]));
+	ssl_async_sd->async_wait(asio::posix::stream_descriptor::wait_read,
+				 [self=Ptr(this)](const asio::error_code& error)
+				 {
+				   self->ssl_async_callback(error);
+				 });
+#endif
+      }
+
+      void ssl_async_callback(const asio::error_code& e)
+      {
+	ssl_async_release();
+	try {
+	  if (!e && !halt)
+	    {
+	      Base::update_now();
+	      {
+		PeerCost::ControlTimer ct(cost);
+		Base::ssl_async_resume();
+	      }
+	      ssl_async_wait();
+	      set_housekeeping_timer();
+	    }
+	}
+	catch (const std::exception& e)
+	  {
+	    error(e);
+	  }
+      }
+
+      bool ssl_async_waiting() const
+      {
+#ifdef ASIO_HAS_POSIX_STREAM_DESCRIPTOR
+	return bool(ssl_async_sd);
+#else
+	return false;
+#endif
+      }
+
+      // the fd is owned by the SSL engine, so release rather than close
+      void ssl_async_release()
+      {
+#ifdef ASIO_HAS_POSIX_STREAM_DESCRIPTOR
+	if (ssl_async_sd)
+	  {
+	    ssl_async_sd->release();
+	    ssl_async_sd.reset();
+	  }
+#endif
+      }
+
+      // TimerWheel::Entry
+      virtual void timer_wheel_expired()
+      {
+	Ptr self(this); // callback may drop the last reference
+	housekeeping_callback(asio::error_code());
+      }
+
       void set_housekeeping_timer()
       {
 	Time next = Base::next_housekeeping();
 	next.min(disconnect_at);
 	if (!housekeeping_schedule.similar(next))
 	  {
-	    if (!next.is_infinite())
+	    if (housekeeping_wheel)
+	      {
+		if (!next.is_infinite())
+		  {
+		    next.max(now());
+		    housekeeping_schedule.reset(next);
+		  }
+		housekeeping_wheel->schedule(*this, next);
+	      }
+	    else if (!next.is_infinite())
 	      {
 		next.max(now());
 		housekeeping_schedule.reset(next);
@@ -620,28 +1367,128 @@ namespace openvpn {
       }
 
       asio::io_context& io_context;
-      bool halt;
-      bool did_push;
-      bool did_client_halt_restart;
+      bool halt = false;
+      bool did_push = false;
+      bool did_client_halt_restart = false;
 
       PeerAddr::Ptr peer_addr;
 
       CoarseTime housekeeping_schedule;
       AsioTimer housekeeping_timer;
 
+      std::unique_ptr<TokenBucketShaper> shaper; // if rate limited by management layer
+      AsioTimer shaper_timer;
+      BufferAllocated shaper_buf;
+      bool shaper_pending = false;
+
       Time disconnect_at;
 
       SessionStats::Ptr stats;
 
       ManClientInstanceFactory::Ptr man_factory;
       TunClientInstanceFactory::Ptr tun_factory;
+      TimerWheel::Ptr housekeeping_wheel;
+      unsigned int thread_index = 0;
+      FIB::Ptr fib;
+      MACTable::Ptr mac_table;
+      MACTable::PerThread* macs; // our thread's view, if mac_table
+      NeighborProxy::Ptr neigh_proxy;
+      NeighborProxy::PerThread* neigh; // our thread's view, if neigh_proxy
+      std::vector<IP::Addr> neigh_addrs; // pushed host addresses
+      BufferAllocated neigh_reply;
+      PeerMetrics::Ptr metrics;
+      PacketCapture::Ptr packet_capture;
+      std::uint64_t capture_session_id;
+      Factory::ReloadState::Ptr reload_state;
+      unsigned int config_generation; // of the config we were created from
+      PeerStatsBatch::Ptr stats_batch;
+      PeerStatsBatch::Slot stats_slot = PeerStatsBatch::NO_SLOT;
+      FlowTelemetry::Ptr flow_telemetry;
+      FlowTelemetry::PerThread* flows; // our thread's cache, if flow_telemetry
+      std::uint64_t flow_session_id;
+      Time::Duration idle_compact;
+      SessionToken::Ptr session_token;
+      HandshakeAdmission::Ptr handshake_admission;
+      bool handshake_admitted = false; // holds a handshake_admission slot
+      Time last_recv;
+      bool compacted_ = false;
+      std::vector<IP::Route> fib_routes; // registered in fib
+      ProtoSessionID psid_self; // issued by PsidCookie, if defined
+      SessionPool::Ptr session_pool; // retire here on stop, if defined
+      PeerCost cost;
+
+#ifdef ASIO_HAS_POSIX_STREAM_DESCRIPTOR
+      std::unique_ptr<asio::posix::stream_descriptor> ssl_async_sd;
+#endif
     };
   };
 
+  inline ServerProto::SessionPool::~SessionPool()
+  {
+  }
+
+  inline void ServerProto::SessionPool::retire(Session* session)
+  {
+    if (!max_size)
+      return;
+    if (retired.size() >= max_size)
+      retired.pop_front();
+    retired.emplace_back(session);
+  }
+
+  inline RCPtr<ServerProto::Session> ServerProto::SessionPool::get()
+  {
+    const size_t n = std::min(retired.size(), scan);
+    for (size_t i = 0; i < n; ++i)
+      {
+	if (retired[i]->use_count() == 1)
+	  {
+	    Session::Ptr s(std::move(retired[i]));
+	    retired.erase(retired.begin() + i);
+	    ++reused;
+	    return s;
+	  }
+      }
+    return Session::Ptr();
+  }
+
   inline TransportClientInstanceRecv::Ptr ServerProto::Factory::new_client_instance()
   {
+    if (session_pool)
+      {
+	Session::Ptr s = session_pool->get();
+	if (s)
+	  {
+	    s->recycle(*this, man_factory, tun_factory);
+	    return s;
+	  }
+      }
     return new Session(io_context, *this, man_factory, tun_factory);
   }
+
+  inline TransportClientInstanceRecv::Ptr ServerProto::Factory::new_client_instance_from_cookie(const Buffer& net_buf,
+												  const AddrPort& remote,
+												  BufferAllocated& client_reset)
+  {
+    if (!psid_cookie)
+      return TransportClientInstanceRecv::Ptr();
+    ProtoSessionID psid;
+    const ProtoContext::PsidCookie::Result r = psid_cookie->verify(net_buf, remote.addr, remote.port, psid, client_reset);
+    if (r == ProtoContext::PsidCookie::OK)
+      {
+	Session::Ptr s = session_pool ? session_pool->get() : Session::Ptr();
+	if (s)
+	  {
+	    s->recycle(*this, man_factory, tun_factory);
+	    s->psid_self = psid;
+	    return s;
+	  }
+	return new Session(io_context, *this, man_factory, tun_factory, psid);
+      }
+    if (r == ProtoContext::PsidCookie::AUTH_FAIL)
+      stats->error(Error::TLS_AUTH_FAIL);
+    return TransportClientInstanceRecv::Ptr();
+  }
 }
 
 #endif
@@ -0,0 +1,82 @@
+//    OpenVPN -- An application to securely tunnel IP networks
+//               over a single port, with support for SSL/TLS-based
+//               session authentication and key exchange,
+//               packet encryption, packet authentication, and
+//               packet compression.
+//
+//    Copyright (C) 2012-2016 OpenVPN Technologies, Inc.
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU Affero General Public License Version 3
+//    as published by the Free Software Foundation.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU Affero General Public License for more details.
+//
+//    You should have received a copy of the GNU Affero General Public License
+//    along with this program in the COPYING file.
+//    If not, see <http://www.gnu.org/licenses/>.
+// Server-side session tokens, issued after a successful backend
+// authentication and verified locally on reconnect.
+
+#ifndef OPENVPN_SERVER_SESSTOKEN_H
+#define OPENVPN_SERVER_SESSTOKEN_H
+
+#include <string>
+
+#include <openvpn/common/size.hpp>
+#include <openvpn/common/rc.hpp>
+#include <openvpn/common/string.hpp>
+
+namespace openvpn {
+
+  // Per-thread session token issuer/verifier.  Implementations keep
+  // their cipher and HMAC state keyed for the life of the object,
+  // so an instance must not be shared between threads; get one per
+  // server thread from SessionTokenFactory::new_obj().
+  struct SessionToken : public RC<thread_unsafe_refcount>
+  {
+    typedef RCPtr<SessionToken> Ptr;
+
+    // Clients return the token in the password field, marked
+    // by this prefix.
+    static bool is_token(const std::string& password)
+    {
+      return string::starts_with(password, prefix());
+    }
+
+    static const char *prefix()
+    {
+      return "SESS_ID_";
+    }
+
+    struct Request
+    {
+      const std::string* username;
+      const std::string* token; // as returned by generate()
+    };
+
+    // Return a new token bound to username.
+    virtual std::string generate(const std::string& username) = 0;
+
+    // Return true if token was issued to username and has not expired.
+    virtual bool verify(const std::string& username, const std::string& token) = 0;
+
+    // Verify n tokens at once, setting ok[i] for each,
+    // and return the number of valid tokens.
+    virtual size_t verify_batch(const Request* reqs, const size_t n, bool* ok) = 0;
+  };
+
+  // Holds the token keys and is shared by all server threads.
+  struct SessionTokenFactory : public RC<thread_safe_refcount>
+  {
+    typedef RCPtr<SessionTokenFactory> Ptr;
+
+    virtual SessionToken::Ptr new_obj() = 0;
+  };
+
+}
+
+#endif
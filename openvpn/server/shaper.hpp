@@ -0,0 +1,157 @@
+//    OpenVPN -- An application to securely tunnel IP networks
+//               over a single port, with support for SSL/TLS-based
+//               session authentication and key exchange,
+//               packet encryption, packet authentication, and
+//               packet compression.
+//
+//    Copyright (C) 2012-2016 OpenVPN Technologies, Inc.
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU Affero General Public License Version 3
+//    as published by the Free Software Foundation.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU Affero General Public License for more details.
+//
+//    You should have received a copy of the GNU Affero General Public License
+//    along with this program in the COPYING file.
+//    If not, see <http://www.gnu.org/licenses/>.
+
+// Per-session token bucket shaper for server to client traffic.
+// Packets that exceed the rate are held in a bounded queue and
+// released as tokens accumulate, rather than dropped.  Tokens are
+// only refilled when a packet doesn't fit in the tokens left, so
+// a session under its rate costs one compare per packet.
+
+#ifndef OPENVPN_SERVER_SHAPER_H
+#define OPENVPN_SERVER_SHAPER_H
+
+#include <cstdint>   // for std::uint64_t, std::int64_t
+#include <deque>
+#include <algorithm> // for std::min
+
+#include <openvpn/common/size.hpp>
+#include <openvpn/buffer/buffer.hpp>
+#include <openvpn/time/time.hpp>
+
+namespace openvpn {
+
+  class TokenBucketShaper
+  {
+  public:
+    enum {
+      DEFAULT_QUEUE_MAX = 256, // packets
+    };
+
+    // rate in bytes per second, burst in bytes
+    TokenBucketShaper(const std::uint64_t rate, const std::uint64_t burst,
+		      const Time& now, const size_t queue_max_arg = DEFAULT_QUEUE_MAX)
+      : queue_max(queue_max_arg),
+	last_refill(now)
+    {
+      set(rate, burst);
+      tokens = std::int64_t(burst_);
+    }
+
+    void set(const std::uint64_t rate, const std::uint64_t burst)
+    {
+      rate_ = std::max(rate, std::uint64_t(1));
+      burst_ = std::max(burst, std::uint64_t(2048)); // at least one full packet
+      tokens = std::min(tokens, std::int64_t(burst_));
+    }
+
+    // Return true if a packet of size bytes may be sent now, and
+    // take its tokens.  Packets must stay in order, so nothing passes
+    // while others are queued.
+    bool admit(const size_t size, const Time& now)
+    {
+      if (!queue.empty())
+	return false;
+      return take(size, now);
+    }
+
+    // Hold a packet that was not admitted, taking over the contents
+    // of buf.  Returns false if the queue is full (packet dropped).
+    bool enqueue(BufferAllocated& buf)
+    {
+      if (queue.size() >= queue_max)
+	return false;
+      queue.emplace_back(std::move(buf));
+      return true;
+    }
+
+    // Move the next queued packet that has enough tokens into buf.
+    bool release(BufferAllocated& buf, const Time& now)
+    {
+      if (queue.empty() || !take(queue.front().size(), now))
+	return false;
+      buf = std::move(queue.front());
+      queue.pop_front();
+      return true;
+    }
+
+    // When the head of the queue will have enough tokens.
+    Time next_release(const Time& now) const
+    {
+      if (queue.empty())
+	return Time::infinite();
+      const std::int64_t need = std::int64_t(queue.front().size()) - tokens;
+      if (need <= 0)
+	return now;
+      return last_refill + Time::Duration::binary_ms(Time::type((std::uint64_t(need) * Time::prec + rate_ - 1) / rate_));
+    }
+
+    bool empty() const
+    {
+      return queue.empty();
+    }
+
+    // Hand back all queued packets, such as when the limit is removed.
+    template <typename F>
+    void drain(F f)
+    {
+      while (!queue.empty())
+	{
+	  BufferAllocated buf(std::move(queue.front()));
+	  queue.pop_front();
+	  f(buf);
+	}
+    }
+
+  private:
+    bool take(const size_t size, const Time& now)
+    {
+      if (tokens < std::int64_t(size))
+	{
+	  refill(now);
+	  if (tokens < std::int64_t(size))
+	    return false;
+	}
+      tokens -= size;
+      return true;
+    }
+
+    void refill(const Time& now)
+    {
+      if (now <= last_refill)
+	return;
+      const std::uint64_t added = (now - last_refill).raw() * rate_ / Time::prec;
+      if (!added)
+	return; // keep accumulating at low rates
+      tokens = std::min(tokens + std::int64_t(added), std::int64_t(burst_));
+      last_refill = now;
+    }
+
+    std::uint64_t rate_ = 0;
+    std::uint64_t burst_ = 0;
+    std::int64_t tokens = 0;
+    size_t queue_max;
+    Time last_refill;
+    std::deque<BufferAllocated> queue;
+  };
+
+}
+
+#endif
@@ -0,0 +1,190 @@
+//    OpenVPN -- An application to securely tunnel IP networks
+//               over a single port, with support for SSL/TLS-based
+//               session authentication and key exchange,
+//               packet encryption, packet authentication, and
+//               packet compression.
+//
+//    Copyright (C) 2012-2016 OpenVPN Technologies, Inc.
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU Affero General Public License Version 3
+//    as published by the Free Software Foundation.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU Affero General Public License for more details.
+//
+//    You should have received a copy of the GNU Affero General Public License
+//    along with this program in the COPYING file.
+//    If not, see <http://www.gnu.org/licenses/>.
+
+// Coalesce periodic peer stats updates of one server thread into a
+// single batch per interval.  Sessions store their latest stats into
+// a slot without any virtual call or allocation, and the batch holds
+// only sessions whose counters changed since the last one.
+
+#ifndef OPENVPN_SERVER_STATSBATCH_H
+#define OPENVPN_SERVER_STATSBATCH_H
+
+#include <vector>
+#include <cstdint>
+
+#include <openvpn/common/size.hpp>
+#include <openvpn/common/exception.hpp>
+#include <openvpn/common/rc.hpp>
+#include <openvpn/time/time.hpp>
+#include <openvpn/time/asiotimer.hpp>
+#include <openvpn/server/peerstats.hpp>
+#include <openvpn/server/manage.hpp>
+
+namespace openvpn {
+
+  class PeerStatsBatch : public RC<thread_unsafe_refcount>
+  {
+  public:
+    typedef RCPtr<PeerStatsBatch> Ptr;
+
+    typedef unsigned int Slot;
+    enum : Slot { NO_SLOT = ~0u };
+
+    struct Entry
+    {
+      ManClientInstanceSend* instance; // the management object of the session
+      PeerStats stats;
+    };
+
+    // Management layer side.  Called on the server thread; entries
+    // are only valid for the duration of the call.
+    struct Sink : public RC<thread_safe_refcount>
+    {
+      typedef RCPtr<Sink> Ptr;
+
+      virtual void stats_batch(const unsigned int thread_index,
+			       const Entry* entries,
+			       const size_t n) = 0;
+    };
+
+    PeerStatsBatch(asio::io_context& io_context,
+		   const Sink::Ptr& sink_arg,
+		   const unsigned int thread_index_arg,
+		   const Time::Duration& interval_arg = Time::Duration::seconds(10))
+      : timer(io_context),
+	sink(sink_arg),
+	thread_index(thread_index_arg),
+	interval(interval_arg)
+    {
+    }
+
+    // Start a slot for a session once its management object exists.
+    Slot add(ManClientInstanceSend* instance)
+    {
+      Slot s;
+      if (!free_slots.empty())
+	{
+	  s = free_slots.back();
+	  free_slots.pop_back();
+	}
+      else
+	{
+	  s = (Slot)slots.size();
+	  slots.emplace_back();
+	}
+      SlotState& st = slots[s];
+      st.entry.instance = instance;
+      st.entry.stats = PeerStats();
+      st.dirty = false;
+      schedule();
+      return s;
+    }
+
+    // Record the latest stats of a session.
+    void update(const Slot s, const PeerStats& ps)
+    {
+      SlotState& st = slots[s];
+      if (ps.rx_bytes == st.entry.stats.rx_bytes
+	  && ps.tx_bytes == st.entry.stats.tx_bytes
+	  && ps.status == st.entry.stats.status)
+	return;
+      st.entry.stats = ps;
+      if (!st.dirty)
+	{
+	  st.dirty = true;
+	  dirty.push_back(s);
+	}
+    }
+
+    // Release a slot when the session goes away.  A pending update is
+    // dropped; the session reports its final stats directly.
+    void remove(const Slot s)
+    {
+      SlotState& st = slots[s];
+      st.entry.instance = nullptr;
+      st.dirty = false;
+      free_slots.push_back(s);
+    }
+
+    // Send pending updates now.
+    void flush()
+    {
+      out.clear();
+      for (auto s : dirty)
+	{
+	  SlotState& st = slots[s];
+	  if (st.dirty && st.entry.instance)
+	    {
+	      out.push_back(st.entry);
+	      st.dirty = false;
+	    }
+	}
+      dirty.clear();
+      if (!out.empty() && sink)
+	sink->stats_batch(thread_index, out.data(), out.size());
+    }
+
+    void stop()
+    {
+      halt = true;
+      timer.cancel();
+    }
+
+  private:
+    struct SlotState
+    {
+      Entry entry{nullptr, PeerStats()};
+      bool dirty = false;
+    };
+
+    void schedule()
+    {
+      if (scheduled || halt)
+	return;
+      scheduled = true;
+      timer.expires_at(Time::now() + interval);
+      timer.async_wait([self=Ptr(this)](const asio::error_code& error)
+                       {
+			 self->scheduled = false;
+			 if (!error && !self->halt)
+			   {
+			     self->flush();
+			     if (self->slots.size() > self->free_slots.size())
+			       self->schedule();
+			   }
+                       });
+    }
+
+    AsioTimer timer;
+    Sink::Ptr sink;
+    const unsigned int thread_index;
+    const Time::Duration interval;
+    std::vector<SlotState> slots;
+    std::vector<Slot> free_slots;
+    std::vector<Slot> dirty; // slots updated since the last batch
+    std::vector<Entry> out;  // scratch for the batch, reused
+    bool scheduled = false;
+    bool halt = false;
+  };
+
+}
+
+#endif
@@ -0,0 +1,248 @@
+//    OpenVPN -- An application to securely tunnel IP networks
+//               over a single port, with support for SSL/TLS-based
+//               session authentication and key exchange,
+//               packet encryption, packet authentication, and
+//               packet compression.
+//
+//    Copyright (C) 2012-2016 OpenVPN Technologies, Inc.
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU Affero General Public License Version 3
+//    as published by the Free Software Foundation.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU Affero General Public License for more details.
+//
+//    You should have received a copy of the GNU Affero General Public License
+//    along with this program in the COPYING file.
+//    If not, see <http://www.gnu.org/licenses/>.
+// Server-side forwarding table mapping client VPN addresses to the
+// session that owns them, for tun -> client dispatch.
+
+#ifndef OPENVPN_SERVER_VPNSERVFIB_H
+#define OPENVPN_SERVER_VPNSERVFIB_H
+
+#include <vector>
+#include <unordered_map>
+#include <mutex>
+#include <atomic>
+#include <utility> // for std::move
+
+#include <openvpn/common/size.hpp>
+#include <openvpn/common/exception.hpp>
+#include <openvpn/common/rc.hpp>
+#include <openvpn/addr/ip.hpp>
+#include <openvpn/addr/route.hpp>
+
+namespace openvpn {
+
+  // Read-mostly map of client VPN address -> (owner, thread).
+  //
+  // Updates are copy-on-write: the writer builds a new immutable
+  // snapshot under a mutex and bumps a generation counter.  Each
+  // server thread keeps a PerThread view holding its own reference
+  // to the current snapshot, and only touches the mutex when the
+  // generation has moved, so steady-state forwarding is lock-free.
+  //
+  // T is normally a raw pointer to a thread_unsafe session object.
+  // Callers may only dereference an owner whose thread matches their
+  // own; entries for other threads should be handed off to that
+  // thread, which looks the address up again in its own view.  Since
+  // an owner removes its addresses on its own thread before it goes
+  // away, and views revalidate on every lookup, a thread never sees
+  // a stale owner of its own.
+  template <typename T>
+  class VPNServerFIB : public RC<thread_safe_refcount>
+  {
+  public:
+    typedef RCPtr<VPNServerFIB> Ptr;
+
+    OPENVPN_EXCEPTION(vpn_serv_fib_error);
+
+    struct Entry
+    {
+      Entry() : owner(), thread(0) {}
+
+      Entry(const T& owner_arg, const unsigned int thread_arg)
+	: owner(owner_arg),
+	  thread(thread_arg)
+      {
+      }
+
+      T owner;
+      unsigned int thread;
+    };
+
+  private:
+    struct Table : public RC<thread_safe_refcount>
+    {
+      typedef RCPtr<Table> Ptr;
+
+      std::unordered_map<IP::Addr, Entry> map;
+    };
+
+  public:
+    class PerThread
+    {
+      friend class VPNServerFIB;
+
+    public:
+      PerThread() : gen(0) {}
+
+      // Return the entry for addr or nullptr.  The pointer is valid
+      // until the next call on this view.
+      const Entry* lookup(const IP::Addr& addr)
+      {
+	refresh();
+	if (table)
+	  {
+	    auto e = table->map.find(addr);
+	    if (e != table->map.end())
+	      return &e->second;
+	  }
+	return nullptr;
+      }
+
+      unsigned int thread_index() const { return thread; }
+
+    private:
+      void refresh()
+      {
+	if (fib->generation.load(std::memory_order_acquire) != gen)
+	  {
+	    std::lock_guard<std::mutex> lock(fib->mutex);
+	    table = fib->current;
+	    gen = fib->generation.load(std::memory_order_relaxed);
+	  }
+      }
+
+      VPNServerFIB* fib = nullptr;
+      typename Table::Ptr table;
+      size_t gen;
+      unsigned int thread = 0;
+    };
+
+    VPNServerFIB(const unsigned int n_threads)
+      : generation(1),
+	current(new Table())
+    {
+      if (!n_threads)
+	throw vpn_serv_fib_error("no threads");
+      thr.resize(n_threads);
+      for (unsigned int i = 0; i < n_threads; ++i)
+	{
+	  thr[i].fib = this;
+	  thr[i].thread = i;
+	}
+    }
+
+    // The view must only be used from its own thread.
+    PerThread& per_thread(const unsigned int index)
+    {
+      if (index >= thr.size())
+	throw vpn_serv_fib_error("thread index out of range");
+      return thr[index];
+    }
+
+    size_t n_threads() const { return thr.size(); }
+
+    // Register owner for every host route in rtvec (the form in
+    // which VPNServerPool::IP46 hands out client addresses).  An
+    // existing mapping for the same address is replaced.
+    void add(const std::vector<IP::Route>& rtvec, const T& owner, const unsigned int thread)
+    {
+      update([&](Table& t) {
+	  bool mod = false;
+	  for (auto &r : rtvec)
+	    {
+	      if (is_host(r))
+		{
+		  t.map[r.addr] = Entry(owner, thread);
+		  mod = true;
+		}
+	    }
+	  return mod;
+	});
+    }
+
+    void add(const IP::Addr& addr, const T& owner, const unsigned int thread)
+    {
+      update([&](Table& t) {
+	  t.map[addr] = Entry(owner, thread);
+	  return true;
+	});
+    }
+
+    // Drop every mapping still pointing at owner, leaving addresses
+    // that have since been handed to someone else alone.
+    void remove(const std::vector<IP::Route>& rtvec, const T& owner)
+    {
+      update([&](Table& t) {
+	  bool mod = false;
+	  for (auto &r : rtvec)
+	    {
+	      if (is_host(r))
+		mod |= erase(t, r.addr, owner);
+	    }
+	  return mod;
+	});
+    }
+
+    void remove(const IP::Addr& addr, const T& owner)
+    {
+      update([&](Table& t) {
+	  return erase(t, addr, owner);
+	});
+    }
+
+    size_t size() const
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      return current->map.size();
+    }
+
+  private:
+    static bool is_host(const IP::Route& r)
+    {
+      return r.addr.defined() && r.prefix_len == r.addr.size();
+    }
+
+    static bool erase(Table& t, const IP::Addr& addr, const T& owner)
+    {
+      auto e = t.map.find(addr);
+      if (e != t.map.end() && e->second.owner == owner)
+	{
+	  t.map.erase(e);
+	  return true;
+	}
+      return false;
+    }
+
+    // Copy, modify, publish.  The old snapshot is released by
+    // whichever view drops its last reference.
+    template <typename F>
+    void update(F func)
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      typename Table::Ptr t(new Table());
+      t->map = current->map;
+      if (func(*t))
+	{
+	  current = std::move(t);
+	  generation.fetch_add(1, std::memory_order_release);
+	}
+    }
+
+    // views reach in here
+    mutable std::mutex mutex;
+    std::atomic<size_t> generation;
+    typename Table::Ptr current;
+
+    std::vector<PerThread> thr;
+  };
+
+}
+
+#endif
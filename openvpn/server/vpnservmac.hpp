@@ -0,0 +1,388 @@
+//    OpenVPN -- An application to securely tunnel IP networks
+//               over a single port, with support for SSL/TLS-based
+//               session authentication and key exchange,
+//               packet encryption, packet authentication, and
+//               packet compression.
+//
+//    Copyright (C) 2012-2016 OpenVPN Technologies, Inc.
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU Affero General Public License Version 3
+//    as published by the Free Software Foundation.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU Affero General Public License for more details.
+//
+//    You should have received a copy of the GNU Affero General Public License
+//    along with this program in the COPYING file.
+//    If not, see <http://www.gnu.org/licenses/>.
+
+// Server-side MAC learning table for layer 2 (tap) deployments,
+// mapping the source MACs seen behind each client to its session,
+// for tap -> client dispatch of ethernet frames.
+
+#ifndef OPENVPN_SERVER_VPNSERVMAC_H
+#define OPENVPN_SERVER_VPNSERVMAC_H
+
+#include <vector>
+#include <mutex>
+#include <atomic>
+#include <algorithm> // for std::find, std::remove
+#include <cstdint>
+#include <utility>   // for std::move
+
+#include <openvpn/common/exception.hpp>
+#include <openvpn/common/rc.hpp>
+#include <openvpn/buffer/buffer.hpp>
+#include <openvpn/ip/eth.hpp>
+#include <openvpn/time/time.hpp>
+
+namespace openvpn {
+
+  // MAC address -> (owner, thread), learned from the source MAC of
+  // frames received from each client, and aged out when a MAC has
+  // not been seen for max_age.
+  //
+  // Like VPNServerFIB, membership changes are copy-on-write
+  // snapshots published under a mutex, and each server thread reads
+  // through its own PerThread view without locking.  The snapshot is
+  // an open-addressing hash (linear probing, load <= 1/2) over a
+  // dense entry array.  Re-sighting a MAC with an unchanged owner,
+  // the common case for every received frame, only stores the time
+  // into the entry's shared stamp, at most once a second.
+  //
+  // The table also keeps, per thread, the owners that joined it, so
+  // that broadcast, multicast and unknown-unicast frames can be
+  // flooded to every session of a thread in one pass (see
+  // TunClientInstanceRecv::tun_recv_shared).
+  template <typename T>
+  class VPNServerMACTable : public RC<thread_safe_refcount>
+  {
+  public:
+    typedef RCPtr<VPNServerMACTable> Ptr;
+
+    OPENVPN_EXCEPTION(vpn_serv_mac_error);
+
+    // last sighting in seconds, shared by every snapshot holding the entry
+    struct Stamp : public RC<thread_safe_refcount>
+    {
+      typedef RCPtr<Stamp> Ptr;
+
+      explicit Stamp(const Time::base_type s) : seen(s) {}
+
+      std::atomic<Time::base_type> seen;
+    };
+
+    struct Entry
+    {
+      std::uint64_t mac;
+      T owner;
+      unsigned int thread;
+      typename Stamp::Ptr stamp;
+    };
+
+    // where a frame from the tap should go
+    enum Dest {
+      DROP,    // runt frame
+      UNICAST, // to the owner of the destination MAC
+      FLOOD,   // to every member
+    };
+
+  private:
+    enum {
+      EMPTY = 0xFFFFFFFF,
+    };
+
+    struct Table : public RC<thread_safe_refcount>
+    {
+      typedef RCPtr<Table> Ptr;
+
+      const Entry* find(const std::uint64_t mac) const
+      {
+	if (slots.empty())
+	  return nullptr;
+	for (size_t i = hash(mac) & mask; ; i = (i + 1) & mask)
+	  {
+	    const std::uint32_t idx = slots[i];
+	    if (idx == EMPTY)
+	      return nullptr;
+	    if (entries[idx].mac == mac)
+	      return &entries[idx];
+	  }
+      }
+
+      // Rehash the entries into a fresh index, which also clears
+      // out any trace of removed entries.
+      void rebuild()
+      {
+	size_t cap = 16;
+	while (cap < entries.size() * 2)
+	  cap <<= 1;
+	slots.assign(cap, EMPTY);
+	mask = cap - 1;
+	for (size_t e = 0; e < entries.size(); ++e)
+	  {
+	    size_t i = hash(entries[e].mac) & mask;
+	    while (slots[i] != EMPTY)
+	      i = (i + 1) & mask;
+	    slots[i] = std::uint32_t(e);
+	  }
+      }
+
+      std::vector<Entry> entries;
+      std::vector<std::uint32_t> slots; // index into entries
+      size_t mask = 0;
+      std::vector<std::vector<T>> members; // flood targets, per thread
+    };
+
+  public:
+    class PerThread
+    {
+      friend class VPNServerMACTable;
+
+    public:
+      PerThread() : gen(0) {}
+
+      // Return the live entry for mac or nullptr.  The pointer is
+      // valid until the next call on this view.
+      const Entry* lookup(const std::uint64_t mac, const Time& now)
+      {
+	refresh();
+	if (table)
+	  {
+	    const Entry* e = table->find(mac);
+	    if (e && !aged(*e, now))
+	      return e;
+	  }
+	return nullptr;
+      }
+
+      // Classify a frame read from the tap.  For UNICAST, entry is
+      // set to the owner of the destination MAC.
+      Dest dest(const Buffer& frame, const Time& now, const Entry*& entry)
+      {
+	if (frame.size() < sizeof(EthHeader))
+	  return DROP;
+	const EthHeader* eth = (const EthHeader*)frame.c_data();
+	if (is_group(eth->dest_mac))
+	  return FLOOD;
+	entry = lookup(to_uint64(eth->dest_mac), now);
+	return entry ? UNICAST : FLOOD;
+      }
+
+      // Note the source MAC of a frame received from owner, learning
+      // it or moving it to owner if needed.  Returns false for a
+      // runt or a group source address, which is never learned.
+      bool learn(const Buffer& frame, const T& owner, const Time& now)
+      {
+	if (frame.size() < sizeof(EthHeader))
+	  return false;
+	const EthHeader* eth = (const EthHeader*)frame.c_data();
+	if (is_group(eth->src_mac))
+	  return false;
+	const std::uint64_t mac = to_uint64(eth->src_mac);
+	refresh();
+	const Entry* e = table ? table->find(mac) : nullptr;
+	if (e && e->owner == owner && e->thread == thread)
+	  {
+	    const Time::base_type s = now.seconds_since_epoch();
+	    if (e->stamp->seen.load(std::memory_order_relaxed) != s)
+	      e->stamp->seen.store(s, std::memory_order_relaxed);
+	  }
+	else
+	  mt->learn(mac, owner, thread, now);
+	return true;
+      }
+
+      // Owners on this thread to flood a frame to.  The reference is
+      // valid until the next call on this view.
+      const std::vector<T>& members()
+      {
+	static const std::vector<T> none;
+	refresh();
+	return table ? table->members[thread] : none;
+      }
+
+      unsigned int thread_index() const { return thread; }
+
+    private:
+      bool aged(const Entry& e, const Time& now) const
+      {
+	return Time::base_type(e.stamp->seen.load(std::memory_order_relaxed) + mt->max_age) < now.seconds_since_epoch();
+      }
+
+      void refresh()
+      {
+	if (mt->generation.load(std::memory_order_acquire) != gen)
+	  {
+	    std::lock_guard<std::mutex> lock(mt->mutex);
+	    table = mt->current;
+	    gen = mt->generation.load(std::memory_order_relaxed);
+	  }
+      }
+
+      VPNServerMACTable* mt = nullptr;
+      typename Table::Ptr table;
+      size_t gen;
+      unsigned int thread = 0;
+    };
+
+    // max_age in seconds
+    VPNServerMACTable(const unsigned int n_threads, const unsigned int max_age_arg)
+      : max_age(max_age_arg),
+	generation(1),
+	current(new Table())
+    {
+      if (!n_threads)
+	throw vpn_serv_mac_error("no threads");
+      current->members.resize(n_threads);
+      thr.resize(n_threads);
+      for (unsigned int i = 0; i < n_threads; ++i)
+	{
+	  thr[i].mt = this;
+	  thr[i].thread = i;
+	}
+    }
+
+    // The view must only be used from its own thread.
+    PerThread& per_thread(const unsigned int index)
+    {
+      if (index >= thr.size())
+	throw vpn_serv_mac_error("thread index out of range");
+      return thr[index];
+    }
+
+    size_t n_threads() const { return thr.size(); }
+
+    // Make owner a flood target on its thread.
+    void join(const T& owner, const unsigned int thread)
+    {
+      if (thread >= thr.size())
+	throw vpn_serv_mac_error("thread index out of range");
+      update([&](Table& t) {
+	  std::vector<T>& m = t.members[thread];
+	  if (std::find(m.begin(), m.end(), owner) != m.end())
+	    return false;
+	  m.push_back(owner);
+	  return true;
+	});
+    }
+
+    // Drop owner and every MAC still pointing at it.
+    void remove(const T& owner)
+    {
+      update([&](Table& t) {
+	  bool mod = false;
+	  for (auto &m : t.members)
+	    {
+	      const size_t n = m.size();
+	      m.erase(std::remove(m.begin(), m.end(), owner), m.end());
+	      mod |= m.size() != n;
+	    }
+	  mod |= erase_if(t, [&](const Entry& e) { return e.owner == owner; });
+	  return mod;
+	});
+    }
+
+    // Drop MACs not seen for max_age, call from a periodic timer.
+    void expire(const Time& now)
+    {
+      const Time::base_type s = now.seconds_since_epoch();
+      update([&](Table& t) {
+	  return erase_if(t, [&](const Entry& e) {
+	      return Time::base_type(e.stamp->seen.load(std::memory_order_relaxed) + max_age) < s;
+	    });
+	});
+    }
+
+    size_t size() const
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      return current->entries.size();
+    }
+
+    static std::uint64_t to_uint64(const std::uint8_t *mac)
+    {
+      return (std::uint64_t(mac[0]) << 40) | (std::uint64_t(mac[1]) << 32)
+	| (std::uint64_t(mac[2]) << 24) | (std::uint64_t(mac[3]) << 16)
+	| (std::uint64_t(mac[4]) << 8) | std::uint64_t(mac[5]);
+    }
+
+    // broadcast or multicast (I/G bit)
+    static bool is_group(const std::uint8_t *mac)
+    {
+      return mac[0] & 1;
+    }
+
+  private:
+    static size_t hash(const std::uint64_t mac)
+    {
+      // Fibonacci hashing, the low bits of a MAC are its most varied
+      return size_t((mac * 0x9E3779B97F4A7C15ULL) >> 24);
+    }
+
+    // slow path of PerThread::learn
+    void learn(const std::uint64_t mac, const T& owner, const unsigned int thread, const Time& now)
+    {
+      update([&](Table& t) {
+	  const Entry* ce = current->find(mac);
+	  if (ce)
+	    {
+	      Entry& e = t.entries[ce - current->entries.data()];
+	      if (e.owner == owner && e.thread == thread)
+		return false; // lost a race with another learner
+	      e.owner = owner;
+	      e.thread = thread;
+	      e.stamp.reset(new Stamp(now.seconds_since_epoch()));
+	      return true;
+	    }
+	  Entry e;
+	  e.mac = mac;
+	  e.owner = owner;
+	  e.thread = thread;
+	  e.stamp.reset(new Stamp(now.seconds_since_epoch()));
+	  t.entries.push_back(std::move(e));
+	  return true;
+	});
+    }
+
+    template <typename PRED>
+    static bool erase_if(Table& t, PRED pred)
+    {
+      const size_t n = t.entries.size();
+      t.entries.erase(std::remove_if(t.entries.begin(), t.entries.end(), pred), t.entries.end());
+      return t.entries.size() != n;
+    }
+
+    // Copy, modify, reindex, publish.  The old snapshot is released
+    // by whichever view drops its last reference.
+    template <typename F>
+    void update(F func)
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      typename Table::Ptr t(new Table());
+      t->entries = current->entries;
+      t->members = current->members;
+      if (func(*t))
+	{
+	  t->rebuild();
+	  current = std::move(t);
+	  generation.fetch_add(1, std::memory_order_release);
+	}
+    }
+
+    const unsigned int max_age;
+
+    // views reach in here
+    mutable std::mutex mutex;
+    std::atomic<size_t> generation;
+    typename Table::Ptr current;
+
+    std::vector<PerThread> thr;
+  };
+
+}
+
+#endif
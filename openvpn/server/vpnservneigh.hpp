@@ -0,0 +1,432 @@
+//    OpenVPN -- An application to securely tunnel IP networks
+//               over a single port, with support for SSL/TLS-based
+//               session authentication and key exchange,
+//               packet encryption, packet authentication, and
+//               packet compression.
+//
+//    Copyright (C) 2012-2016 OpenVPN Technologies, Inc.
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU Affero General Public License Version 3
+//    as published by the Free Software Foundation.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU Affero General Public License for more details.
+//
+//    You should have received a copy of the GNU Affero General Public License
+//    along with this program in the COPYING file.
+//    If not, see <http://www.gnu.org/licenses/>.
+
+// Server-side ARP and IPv6 neighbor discovery proxy for layer 2 (tap)
+// deployments.  ARP requests and neighbor solicitations for a client
+// address are answered by the server with the MAC the client uses,
+// instead of being flooded to every client.
+
+#ifndef OPENVPN_SERVER_VPNSERVNEIGH_H
+#define OPENVPN_SERVER_VPNSERVNEIGH_H
+
+#include <vector>
+#include <unordered_map>
+#include <mutex>
+#include <atomic>
+#include <algorithm> // for std::find
+#include <cstddef>   // for offsetof
+#include <cstdint>
+#include <cstring>
+#include <utility>   // for std::move
+
+#include <openvpn/common/exception.hpp>
+#include <openvpn/common/rc.hpp>
+#include <openvpn/common/socktypes.hpp>
+#include <openvpn/buffer/buffer.hpp>
+#include <openvpn/addr/ip.hpp>
+#include <openvpn/ip/eth.hpp>
+#include <openvpn/ip/arp.hpp>
+#include <openvpn/ip/ip.hpp>
+#include <openvpn/ip/csum.hpp>
+
+namespace openvpn {
+
+  // Client VPN address -> (MAC, owner).  An address is bound when
+  // the owner's client sends a frame from it, and only if it is one
+  // of the addresses the owner was pushed (its VPNServerPool
+  // assignment), so a client cannot claim another's address.
+  //
+  // Bindings change rarely, so like VPNServerFIB they are kept in
+  // copy-on-write snapshots, read without locking through a
+  // PerThread view.  The tap reader checks frames with resolve()
+  // before flooding them, and sessions do the same for frames from
+  // their client.  Either way a request for a bound address costs
+  // one reply instead of one encryption per client.
+  template <typename T>
+  class VPNServerNeighborProxy : public RC<thread_safe_refcount>
+  {
+  public:
+    typedef RCPtr<VPNServerNeighborProxy> Ptr;
+
+    OPENVPN_EXCEPTION(vpn_serv_neigh_error);
+
+    struct Entry
+    {
+      std::uint8_t mac[6];
+      T owner;
+    };
+
+  private:
+    enum {
+      ETHERTYPE_IPV6 = 0x86DD,
+      IPV6_HLEN = 40,
+      ICMPV6 = 58,
+      ND_HOP_LIMIT = 255,
+
+      // ICMPv6 neighbor discovery
+      NS = 135,
+      NA = 136,
+      NA_SOLICITED = 0x40,
+      NA_OVERRIDE = 0x20,
+      NDOPT_TARGET_LL = 2,
+      ND_LEN = 24,        // type .. target
+      ND_TARGET_OFF = 8,
+    };
+
+    struct Table : public RC<thread_safe_refcount>
+    {
+      typedef RCPtr<Table> Ptr;
+
+      std::unordered_map<IP::Addr, Entry> map;
+    };
+
+  public:
+    class PerThread
+    {
+      friend class VPNServerNeighborProxy;
+
+    public:
+      PerThread() : gen(0) {}
+
+      // If frame is an ARP request or neighbor solicitation for a
+      // bound address, return its entry, else nullptr.  asker is the
+      // owner the frame came from, or T() for the tap side; a
+      // request for one's own address (duplicate address detection)
+      // is not answered.  The pointer is valid until the next call
+      // on this view.
+      const Entry* resolve(const Buffer& frame, const T& asker)
+      {
+	IP::Addr target;
+	if (!parse_request(frame, target))
+	  return nullptr;
+	refresh();
+	if (table)
+	  {
+	    auto e = table->map.find(target);
+	    if (e != table->map.end() && !(asker && e->second.owner == asker))
+	      return &e->second;
+	  }
+	return nullptr;
+      }
+
+      // Bind the source address of a frame from owner's client to
+      // its source MAC, if the address is in owned.
+      void observe(const Buffer& frame, const std::vector<IP::Addr>& owned, const T& owner)
+      {
+	IP::Addr addr;
+	const std::uint8_t *mac;
+	if (owned.empty() || !parse_sender(frame, addr, mac))
+	  return;
+	if (std::find(owned.begin(), owned.end(), addr) == owned.end())
+	  return;
+	refresh();
+	if (table)
+	  {
+	    auto e = table->map.find(addr);
+	    if (e != table->map.end()
+		&& e->second.owner == owner
+		&& !std::memcmp(e->second.mac, mac, 6))
+	      return;
+	  }
+	np->bind(addr, mac, owner);
+      }
+
+      unsigned int thread_index() const { return thread; }
+
+    private:
+      void refresh()
+      {
+	if (np->generation.load(std::memory_order_acquire) != gen)
+	  {
+	    std::lock_guard<std::mutex> lock(np->mutex);
+	    table = np->current;
+	    gen = np->generation.load(std::memory_order_relaxed);
+	  }
+      }
+
+      VPNServerNeighborProxy* np = nullptr;
+      typename Table::Ptr table;
+      size_t gen;
+      unsigned int thread = 0;
+    };
+
+    VPNServerNeighborProxy(const unsigned int n_threads)
+      : generation(1),
+	current(new Table())
+    {
+      if (!n_threads)
+	throw vpn_serv_neigh_error("no threads");
+      thr.resize(n_threads);
+      for (unsigned int i = 0; i < n_threads; ++i)
+	{
+	  thr[i].np = this;
+	  thr[i].thread = i;
+	}
+    }
+
+    // The view must only be used from its own thread.
+    PerThread& per_thread(const unsigned int index)
+    {
+      if (index >= thr.size())
+	throw vpn_serv_neigh_error("thread index out of range");
+      return thr[index];
+    }
+
+    size_t n_threads() const { return thr.size(); }
+
+    void bind(const IP::Addr& addr, const std::uint8_t *mac, const T& owner)
+    {
+      update([&](Table& t) {
+	  Entry& e = t.map[addr];
+	  std::memcpy(e.mac, mac, 6);
+	  e.owner = owner;
+	  return true;
+	});
+    }
+
+    // Drop every binding of owner.
+    void remove(const T& owner)
+    {
+      update([&](Table& t) {
+	  bool mod = false;
+	  for (auto i = t.map.begin(); i != t.map.end(); )
+	    {
+	      if (i->second.owner == owner)
+		{
+		  i = t.map.erase(i);
+		  mod = true;
+		}
+	      else
+		++i;
+	    }
+	  return mod;
+	});
+    }
+
+    size_t size() const
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      return current->map.size();
+    }
+
+    // Build into out (prepared by the caller) the ARP reply or
+    // neighbor advertisement answering request, which resolve()
+    // matched to e.
+    static void reply(const Buffer& request, const Entry& e, BufferAllocated& out)
+    {
+      const std::uint8_t *in = request.c_data();
+      const EthHeader* ieth = (const EthHeader*)in;
+
+      if (ntohs(ieth->ethertype) == ARPHeader::ETHERTYPE)
+	{
+	  const ARPHeader* req = (const ARPHeader*)(in + sizeof(EthHeader));
+	  std::uint8_t *o = out.write_alloc(sizeof(EthHeader) + sizeof(ARPHeader));
+	  EthHeader* eth = (EthHeader*)o;
+	  std::memcpy(eth->dest_mac, ieth->src_mac, 6);
+	  std::memcpy(eth->src_mac, e.mac, 6);
+	  eth->ethertype = htons(ARPHeader::ETHERTYPE);
+	  ARPHeader* arp = (ARPHeader*)(o + sizeof(EthHeader));
+	  arp->htype = htons(ARPHeader::HTYPE_ETHER);
+	  arp->ptype = htons(ARPHeader::PTYPE_IPV4);
+	  arp->hlen = 6;
+	  arp->plen = 4;
+	  arp->oper = htons(ARPHeader::REPLY);
+	  std::memcpy(arp->sha, e.mac, 6);
+	  std::memcpy(arp->spa, req->tpa, 4);
+	  std::memcpy(arp->tha, req->sha, 6);
+	  std::memcpy(arp->tpa, req->spa, 4);
+	  return;
+	}
+
+      // neighbor advertisement with a target link-layer address option
+      const std::uint8_t *ip6 = in + sizeof(EthHeader);
+      const std::uint8_t *ns = ip6 + IPV6_HLEN;
+      const size_t plen = ND_LEN + 8;
+      std::uint8_t *o = out.write_alloc(sizeof(EthHeader) + IPV6_HLEN + plen);
+      std::uint8_t *oip6 = o + sizeof(EthHeader);
+      std::uint8_t *na = oip6 + IPV6_HLEN;
+
+      // unsolicited (to all-nodes) if the asker has no address yet
+      static const std::uint8_t unspec[16] = { 0 };
+      const bool dad = !std::memcmp(ip6 + 8, unspec, 16);
+
+      EthHeader* eth = (EthHeader*)o;
+      if (dad)
+	{
+	  static const std::uint8_t all_nodes_mac[6] = { 0x33, 0x33, 0, 0, 0, 1 };
+	  std::memcpy(eth->dest_mac, all_nodes_mac, 6);
+	}
+      else
+	std::memcpy(eth->dest_mac, ieth->src_mac, 6);
+      std::memcpy(eth->src_mac, e.mac, 6);
+      eth->ethertype = htons(ETHERTYPE_IPV6);
+
+      oip6[0] = 0x60;
+      oip6[1] = oip6[2] = oip6[3] = 0;
+      oip6[4] = std::uint8_t(plen >> 8);
+      oip6[5] = std::uint8_t(plen);
+      oip6[6] = ICMPV6;
+      oip6[7] = ND_HOP_LIMIT;
+      std::memcpy(oip6 + 8, ns + ND_TARGET_OFF, 16);
+      if (dad)
+	{
+	  static const std::uint8_t all_nodes[16] = { 0xff, 0x02, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 1 };
+	  std::memcpy(oip6 + 24, all_nodes, 16);
+	}
+      else
+	std::memcpy(oip6 + 24, ip6 + 8, 16);
+
+      na[0] = NA;
+      na[1] = 0;
+      na[2] = na[3] = 0;
+      na[4] = std::uint8_t((dad ? 0 : NA_SOLICITED) | NA_OVERRIDE);
+      na[5] = na[6] = na[7] = 0;
+      std::memcpy(na + ND_TARGET_OFF, ns + ND_TARGET_OFF, 16);
+      na[ND_LEN] = NDOPT_TARGET_LL;
+      na[ND_LEN + 1] = 1; // in units of 8 octets
+      std::memcpy(na + ND_LEN + 2, e.mac, 6);
+
+      const std::uint64_t sum = IPChecksum::pseudo_v6(oip6 + 8, oip6 + 24, ICMPV6, std::uint32_t(plen));
+      const std::uint16_t check = IPChecksum::compute(na, plen, sum);
+      std::memcpy(na + 2, &check, 2);
+    }
+
+  private:
+    // target address of an ARP request or neighbor solicitation
+    static bool parse_request(const Buffer& frame, IP::Addr& target)
+    {
+      const std::uint8_t *data = frame.c_data();
+      const size_t size = frame.size();
+      if (size < sizeof(EthHeader))
+	return false;
+      const EthHeader* eth = (const EthHeader*)data;
+      switch (ntohs(eth->ethertype))
+	{
+	case ARPHeader::ETHERTYPE:
+	  {
+	    if (size < sizeof(EthHeader) + sizeof(ARPHeader))
+	      return false;
+	    const ARPHeader* arp = (const ARPHeader*)(data + sizeof(EthHeader));
+	    if (!is_ipv4_arp(arp)
+		|| ntohs(arp->oper) != ARPHeader::REQUEST
+		|| !std::memcmp(arp->spa, arp->tpa, 4)) // gratuitous
+	      return false;
+	    target = IP::Addr::from_ipv4(IPv4::Addr::from_bytes_net(arp->tpa));
+	    return true;
+	  }
+	case ETHERTYPE_IPV6:
+	  {
+	    // NS right after the fixed header, as RFC 4861 requires
+	    // no extension headers to be skipped for a valid one
+	    const std::uint8_t *ip6 = data + sizeof(EthHeader);
+	    if (size < sizeof(EthHeader) + IPV6_HLEN + ND_LEN
+		|| ip6[6] != ICMPV6
+		|| ip6[7] != ND_HOP_LIMIT)
+	      return false;
+	    const std::uint8_t *ns = ip6 + IPV6_HLEN;
+	    if (ns[0] != NS || ns[1] != 0)
+	      return false;
+	    target = IP::Addr::from_ipv6(IPv6::Addr::from_byte_string(ns + ND_TARGET_OFF));
+	    return true;
+	  }
+	default:
+	  return false;
+	}
+    }
+
+    // source address and MAC of an ARP packet or IP datagram
+    static bool parse_sender(const Buffer& frame, IP::Addr& addr, const std::uint8_t*& mac)
+    {
+      const std::uint8_t *data = frame.c_data();
+      const size_t size = frame.size();
+      if (size < sizeof(EthHeader))
+	return false;
+      const EthHeader* eth = (const EthHeader*)data;
+      const std::uint8_t *l3 = data + sizeof(EthHeader);
+      mac = eth->src_mac;
+      switch (ntohs(eth->ethertype))
+	{
+	case ARPHeader::ETHERTYPE:
+	  {
+	    if (size < sizeof(EthHeader) + sizeof(ARPHeader))
+	      return false;
+	    const ARPHeader* arp = (const ARPHeader*)l3;
+	    if (!is_ipv4_arp(arp))
+	      return false;
+	    mac = arp->sha;
+	    addr = IP::Addr::from_ipv4(IPv4::Addr::from_bytes_net(arp->spa));
+	    return true;
+	  }
+	case 0x0800:
+	  {
+	    if (size < sizeof(EthHeader) + sizeof(IPHeader)
+		|| IPHeader::version(l3[0]) != 4)
+	      return false;
+	    addr = IP::Addr::from_ipv4(IPv4::Addr::from_bytes_net(l3 + offsetof(IPHeader, saddr)));
+	    return true;
+	  }
+	case ETHERTYPE_IPV6:
+	  {
+	    if (size < sizeof(EthHeader) + IPV6_HLEN
+		|| IPHeader::version(l3[0]) != 6)
+	      return false;
+	    addr = IP::Addr::from_ipv6(IPv6::Addr::from_byte_string(l3 + 8));
+	    return true;
+	  }
+	default:
+	  return false;
+	}
+    }
+
+    static bool is_ipv4_arp(const ARPHeader* arp)
+    {
+      return ntohs(arp->htype) == ARPHeader::HTYPE_ETHER
+	&& ntohs(arp->ptype) == ARPHeader::PTYPE_IPV4
+	&& arp->hlen == 6
+	&& arp->plen == 4;
+    }
+
+    // Copy, modify, publish.  The old snapshot is released by
+    // whichever view drops its last reference.
+    template <typename F>
+    void update(F func)
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      typename Table::Ptr t(new Table());
+      t->map = current->map;
+      if (func(*t))
+	{
+	  current = std::move(t);
+	  generation.fetch_add(1, std::memory_order_release);
+	}
+    }
+
+    // views reach in here
+    mutable std::mutex mutex;
+    std::atomic<size_t> generation;
+    typename Table::Ptr current;
+
+    std::vector<PerThread> thr;
+  };
+
+}
+
+#endif
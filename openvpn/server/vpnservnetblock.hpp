@@ -23,6 +23,7 @@
 #define OPENVPN_SERVER_VPNSERVNETBLOCK_H
 
 #include <sstream>
+#include <limits>
 
 #include <openvpn/common/size.hpp>
 #include <openvpn/common/exception.hpp>
@@ -45,18 +46,29 @@ namespace openvpn {
       {
 	if (!route.is_canonical())
 	  throw vpn_serv_netblock("not canonical");
-	const size_t extent = route.extent();
-	if (extent < 4)
+	// extent is kept as an address, since an IPv6 netblock
+	// such as a /64 has more addresses than a size_t can count
+	const IP::Addr extent = route.netmask().extent_from_netmask();
+	if (extent < IP::Addr::from_ulong(extent.version(), 4))
 	  throw vpn_serv_netblock("need at least 4 addresses in netblock");
 	net = route.addr;
 	server_gw = net + 1;
-	bcast = net + (extent - 1);
-	clients = IP::Range(net + 2, extent - 3);
+	bcast = net + extent - 1;
+	clients = IP::Range(net + 2, range_extent(extent - 3));
 	prefix_len = route.prefix_len;
       }
 
       bool defined() const { return net.defined(); }
 
+      // clamp client range of huge netblocks to what a size_t can count
+      static size_t range_extent(const IP::Addr& extent)
+      {
+	const size_t max = std::numeric_limits<size_t>::max();
+	if (extent.version() == IP::Addr::V6 && extent > IP::Addr::from_ulong(IP::Addr::V6, max))
+	  return max;
+	return extent.to_ulong();
+      }
+
       IP::Addr netmask() const
       {
 	return IP::Addr::netmask_from_prefix_len(net.version(), prefix_len);
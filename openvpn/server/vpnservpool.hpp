@@ -36,6 +36,7 @@
 #include <openvpn/addr/ip.hpp>
 #include <openvpn/addr/route.hpp>
 #include <openvpn/addr/pool.hpp>
+#include <openvpn/addr/bitmappool.hpp>
 
 namespace openvpn {
   namespace VPNServerPool {
@@ -76,45 +77,82 @@ namespace openvpn {
 	IPv6_DEPLETION=(1<<1),
       };
 
-      Pool(const OptionList& opt)
-	: VPNServerNetblock(init_snb_from_opt(opt))
+      // If n_threads is nonzero, the client range is partitioned into
+      // one address pool per server thread (see VPNServerNetblock::PerThread),
+      // each with its own lock, so threads don't contend for addresses.
+      Pool(const OptionList& opt, const unsigned int n_threads = 0)
+	: VPNServerNetblock(init_snb_from_opt(opt, n_threads))
       {
 	if (configured(opt, "server"))
 	  {
-	    pool4.add_range(netblock4().clients);
-	    pool6.add_range(netblock6().clients);
+	    if (n_threads)
+	      {
+		for (size_t i = 0; i < size(); ++i)
+		  {
+		    const PerThread& pt = per_thread(i);
+		    pools.emplace_back(new ThreadPool(pt.range4(),
+						      pt.range6_defined() ? pt.range6() : IP::Range()));
+		  }
+	      }
+	    else
+	      pools.emplace_back(new ThreadPool(netblock4().clients, netblock6().clients));
 	  }
       }
 
       // returns flags
-      unsigned int acquire(IP46& addr_pair, const bool request_ipv6)
+      unsigned int acquire(IP46& addr_pair, const bool request_ipv6, const size_t thread_index = 0)
       {
-	std::lock_guard<std::mutex> lock(mutex);
 	unsigned int flags = 0;
-	if (!pool4.acquire_addr(addr_pair.ip4))
+	if (pools.empty())
+	  return IPv4_DEPLETION | (request_ipv6 && netblock6().defined() ? IPv6_DEPLETION : 0);
+	ThreadPool& tp = *pools[thread_index < pools.size() ? thread_index : 0];
+	std::lock_guard<std::mutex> lock(tp.mutex);
+	if (!tp.pool4.acquire_addr(addr_pair.ip4))
 	  flags |= IPv4_DEPLETION;
 	if (request_ipv6 && netblock6().defined())
 	  {
-	    if (!pool6.acquire_addr(addr_pair.ip6))
+	    if (!tp.pool6.acquire_addr(addr_pair.ip6))
 	      flags |= IPv6_DEPLETION;
 	  }
 	return flags;
       }
 
+      // may be called from any thread
       void release(IP46& addr_pair)
       {
-	std::lock_guard<std::mutex> lock(mutex);
-	if (addr_pair.ip4.defined())
-	  pool4.release_addr(addr_pair.ip4);
-	if (addr_pair.ip6.defined())
-	  pool6.release_addr(addr_pair.ip6);
+	for (auto &tp : pools)
+	  {
+	    const bool own4 = addr_pair.ip4.defined() && tp->pool4.owns(addr_pair.ip4);
+	    const bool own6 = addr_pair.ip6.defined() && tp->pool6.owns(addr_pair.ip6);
+	    if (own4 || own6)
+	      {
+		std::lock_guard<std::mutex> lock(tp->mutex);
+		if (own4)
+		  tp->pool4.release_addr(addr_pair.ip4);
+		if (own6)
+		  tp->pool6.release_addr(addr_pair.ip6);
+	      }
+	  }
       }
 
     private:
-      static VPNServerNetblock init_snb_from_opt(const OptionList& opt)
+      struct ThreadPool
+      {
+	ThreadPool(const IP::Range& range4, const IP::Range& range6)
+	  : pool4(range4)
+	{
+	  pool6.add_range(range6);
+	}
+
+	std::mutex mutex;
+	IP::BitmapPool pool4;
+	IP::Pool pool6; // lazy, since IPv6 client ranges may be huge
+      };
+
+      static VPNServerNetblock init_snb_from_opt(const OptionList& opt, const unsigned int n_threads)
       {
 	if (configured(opt, "server"))
-	  return VPNServerNetblock(opt, "server", false, 0);
+	  return VPNServerNetblock(opt, "server", false, n_threads);
 	else if (configured(opt, "ifconfig"))
 	  return VPNServerNetblock(opt, "ifconfig", false, 0);
 	else
@@ -127,10 +165,7 @@ namespace openvpn {
 	return opt.exists(opt_name) || opt.exists(opt_name + "-ipv6");
       }
 
-      std::mutex mutex;
-
-      IP::Pool pool4;
-      IP::Pool pool6;
+      std::vector<std::unique_ptr<ThreadPool>> pools; // ranges are immutable once built
     };
 
     class IP46AutoRelease : public IP46, public RC<thread_safe_refcount>
@@ -0,0 +1,163 @@
+//    OpenVPN -- An application to securely tunnel IP networks
+//               over a single port, with support for SSL/TLS-based
+//               session authentication and key exchange,
+//               packet encryption, packet authentication, and
+//               packet compression.
+//
+//    Copyright (C) 2012-2016 OpenVPN Technologies, Inc.
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU Affero General Public License Version 3
+//    as published by the Free Software Foundation.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU Affero General Public License for more details.
+//
+//    You should have received a copy of the GNU Affero General Public License
+//    along with this program in the COPYING file.
+//    If not, see <http://www.gnu.org/licenses/>.
+
+// Data channel packet bundling.  Several small tun packets that are
+// read together are carried in one data channel packet, which saves
+// the per-packet header, packet ID, tag and crypto call.
+
+#ifndef OPENVPN_SSL_BUNDLE_H
+#define OPENVPN_SSL_BUNDLE_H
+
+#include <cstring> // for std::memcmp
+#include <cstdint> // for std::uint16_t
+
+#include <openvpn/common/size.hpp>
+#include <openvpn/buffer/buffer.hpp>
+
+namespace openvpn {
+
+  class DataBundle
+  {
+  public:
+    // A bundle is laid out as
+    // magic[8] | (length[2] | packet)...
+    enum {
+      MAGIC_SIZE = 8,
+      LEN_SIZE = 2,
+    };
+
+    static bool is_message(const Buffer& buf)
+    {
+      return buf.size() >= MAGIC_SIZE + LEN_SIZE
+	&& buf[0] == magic()[0]
+	&& !std::memcmp(magic(), buf.c_data(), MAGIC_SIZE);
+    }
+
+    // Merge runs of packets of at most max_packet bytes into bundles
+    // of at most max_size bytes, in place.  Each bundle is built in
+    // the first buffer of its run, while keeping tailroom bytes at
+    // the end of the buffer free.  The other buffers of the run are
+    // emptied.  Returns the number of buffers emptied.
+    static size_t pack(BufferAllocated** bufs, const size_t n,
+		       const size_t max_packet, const size_t max_size,
+		       const size_t tailroom)
+    {
+      size_t emptied = 0;
+      size_t i = 0;
+      while (i < n)
+	{
+	  BufferAllocated& base = *bufs[i++];
+	  if (!small(base, max_packet) || base.offset() < MAGIC_SIZE + LEN_SIZE)
+	    continue;
+	  bool started = false;
+	  while (i < n && small(*bufs[i], max_packet))
+	    {
+	      BufferAllocated& next = *bufs[i];
+	      const size_t header = started ? 0 : MAGIC_SIZE + LEN_SIZE;
+	      const size_t need = next.size() + LEN_SIZE;
+	      if (base.size() + header + need > max_size || base.remaining(tailroom) < need)
+		break;
+	      if (!started)
+		{
+		  prepend_len(base, base.size());
+		  base.prepend(magic(), MAGIC_SIZE);
+		  started = true;
+		}
+	      write_len(base, next.size());
+	      base.write(next.c_data(), next.size());
+	      next.reset_size();
+	      ++emptied;
+	      ++i;
+	    }
+	}
+      return emptied;
+    }
+
+    // Call f(const unsigned char *data, size_t size) for each packet
+    // in a bundle that satisfies is_message().  Returns false, without
+    // calling f, if the bundle is malformed.
+    template <typename F>
+    static bool unpack(const Buffer& buf, F f)
+    {
+      if (!valid(buf))
+	return false;
+      const unsigned char *p = buf.c_data() + MAGIC_SIZE;
+      const unsigned char *end = buf.c_data() + buf.size();
+      while (p < end)
+	{
+	  const size_t len = (size_t(p[0]) << 8) | p[1];
+	  p += LEN_SIZE;
+	  f(p, len);
+	  p += len;
+	}
+      return true;
+    }
+
+  private:
+    static bool small(const Buffer& buf, const size_t max_packet)
+    {
+      return buf.size() && buf.size() <= max_packet;
+    }
+
+    static bool valid(const Buffer& buf)
+    {
+      const unsigned char *p = buf.c_data() + MAGIC_SIZE;
+      const unsigned char *end = buf.c_data() + buf.size();
+      while (p < end)
+	{
+	  if (end - p < LEN_SIZE)
+	    return false;
+	  const size_t len = (size_t(p[0]) << 8) | p[1];
+	  p += LEN_SIZE;
+	  if (!len || size_t(end - p) < len)
+	    return false;
+	  p += len;
+	}
+      return true;
+    }
+
+    static void prepend_len(Buffer& buf, const size_t len)
+    {
+      unsigned char *p = buf.prepend_alloc(LEN_SIZE);
+      p[0] = (unsigned char)(len >> 8);
+      p[1] = (unsigned char)len;
+    }
+
+    static void write_len(Buffer& buf, const size_t len)
+    {
+      buf.push_back((unsigned char)(len >> 8));
+      buf.push_back((unsigned char)len);
+    }
+
+    // distinct from the keepalive and PMTU messages, and not a
+    // valid IP header
+    static const unsigned char *magic()
+    {
+      static const unsigned char m[MAGIC_SIZE] = { // CONST GLOBAL
+	0x2c, 0x0e, 0x95, 0xd1, 0x73, 0x4f, 0xb8, 0x26
+      };
+      return m;
+    }
+  };
+
+}
+
+#endif
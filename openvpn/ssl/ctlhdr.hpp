@@ -0,0 +1,203 @@
+//    OpenVPN -- An application to securely tunnel IP networks
+//               over a single port, with support for SSL/TLS-based
+//               session authentication and key exchange,
+//               packet encryption, packet authentication, and
+//               packet compression.
+//
+//    Copyright (C) 2012-2016 OpenVPN Technologies, Inc.
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU Affero General Public License Version 3
+//    as published by the Free Software Foundation.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU Affero General Public License for more details.
+//
+//    You should have received a copy of the GNU Affero General Public License
+//    along with this program in the COPYING file.
+//    If not, see <http://www.gnu.org/licenses/>.
+
+// One-pass parser for the OpenVPN control channel packet header.
+
+#ifndef OPENVPN_SSL_CTLHDR_H
+#define OPENVPN_SSL_CTLHDR_H
+
+#include <cstdint>
+#include <cstring>
+
+#include <openvpn/common/size.hpp>
+#include <openvpn/common/socktypes.hpp>
+#include <openvpn/buffer/buffer.hpp>
+#include <openvpn/time/time.hpp>
+#include <openvpn/crypto/packet_id.hpp>
+#include <openvpn/reliable/relcommon.hpp>
+#include <openvpn/ssl/psid.hpp>
+
+namespace openvpn {
+
+  // Decodes the control packet header
+  //
+  //   [OP] [SRC_PSID] [HMAC PID] [N_ACKS] [ACK_ID...] [DEST_PSID] [MSG_ID]
+  //
+  // where HMAC and PID are only present with tls-auth, DEST_PSID only
+  // when N_ACKS > 0, and MSG_ID only for packets other than ACK_V1.
+  // Each part is bounds checked once before any field is read; ACK IDs
+  // are left in the packet and decoded on demand, so parsing never
+  // allocates.
+  class ControlHeader
+  {
+  public:
+    typedef reliable::id_t id_t;
+
+    // Parse the header at the front of buf.  On success, return true
+    // and advance buf to the payload, otherwise leave buf unchanged.
+    bool parse(Buffer& buf, const size_t hmac_size, const bool tls_auth, const bool is_ack)
+    {
+      const unsigned char *p = buf.c_data();
+      const size_t size = buf.size();
+
+      const size_t pid_size = tls_auth ? PacketID::size(PacketID::LONG_FORM) : 0;
+      const size_t head = 1 + ProtoSessionID::SIZE + (tls_auth ? hmac_size : 0) + pid_size;
+      if (size < head)
+	return false;
+      const size_t tail = parse_tail(p + head, size - head, is_ack);
+      if (!tail)
+	return false;
+
+      op_ = p[0];
+      src_psid_ = SessionID(p + 1);
+      if (tls_auth)
+	read_pid(p + head - pid_size);
+      else
+	pid_.reset();
+
+      buf.advance(head + tail);
+      return true;
+    }
+
+    // Parse the cleartext head of a tls-crypt packet
+    //
+    //   [OP] [SRC_PSID] [PID] [TAG] [encrypted tail...]
+    //
+    // without advancing buf.  The tail is parsed separately with
+    // parse_tail() once it has been decrypted.
+    bool parse_tls_crypt_head(const Buffer& buf)
+    {
+      if (buf.size() < TLS_CRYPT_HEAD_SIZE)
+	return false;
+      const unsigned char *p = buf.c_data();
+      op_ = p[0];
+      src_psid_ = SessionID(p + 1);
+      read_pid(p + 1 + ProtoSessionID::SIZE);
+      return true;
+    }
+
+    // Parse [N_ACKS] [ACK_ID...] [DEST_PSID] [MSG_ID] at the front of buf.
+    // On success, return true and advance buf to the payload.
+    bool parse_tail(Buffer& buf, const bool is_ack)
+    {
+      const size_t tail = parse_tail(buf.c_data(), buf.size(), is_ack);
+      if (!tail)
+	return false;
+      buf.advance(tail);
+      return true;
+    }
+
+    // size of [OP] [SRC_PSID] [PID], the part of a tls-crypt
+    // packet that precedes the tag
+    enum {
+      TLS_CRYPT_HEAD_SIZE = 1 + ProtoSessionID::SIZE + 8,
+    };
+
+    unsigned int op() const { return op_; }
+    const ProtoSessionID& src_psid() const { return src_psid_; }
+    const ProtoSessionID& dest_psid() const { return dest_psid_; } // defined if n_acks() > 0
+    const PacketID& pid() const { return pid_; }                   // tls-auth only
+    id_t msg_id() const { return msg_id_; }                        // not for ACK_V1
+
+    size_t n_acks() const { return n_acks_; }
+
+    id_t ack(const size_t i) const
+    {
+      return load32(acks_ + i * sizeof(id_t));
+    }
+
+    // mark the ACK IDs carried by this packet as ACKed in rel_send
+    template <typename REL_SEND>
+    void ack(REL_SEND& rel_send, const Time& now) const
+    {
+      for (size_t i = 0; i < n_acks_; ++i)
+	rel_send.ack(ack(i), now);
+    }
+
+  private:
+    // return size of tail at p, or 0 if truncated
+    size_t parse_tail(const unsigned char *p, const size_t size, const bool is_ack)
+    {
+      if (size < 1)
+	return 0;
+      const size_t n_acks = p[0];
+      const size_t acks_size = n_acks * sizeof(id_t);
+      const size_t total = 1 + acks_size
+	+ (n_acks ? ProtoSessionID::SIZE : 0)
+	+ (is_ack ? 0 : sizeof(id_t));
+      if (size < total)
+	return 0;
+
+      n_acks_ = n_acks;
+      acks_ = p + 1;
+      size_t off = 1 + acks_size;
+      if (n_acks)
+	{
+	  dest_psid_ = SessionID(p + off);
+	  off += ProtoSessionID::SIZE;
+	}
+      else
+	dest_psid_.reset();
+      if (!is_ack)
+	{
+	  msg_id_ = load32(p + off);
+	  off += sizeof(id_t);
+	}
+      else
+	msg_id_ = 0;
+      return off;
+    }
+
+    void read_pid(const unsigned char *p)
+    {
+      pid_.id = load32(p);
+      pid_.time = load32(p + 4);
+    }
+
+    struct SessionID : public ProtoSessionID
+    {
+      SessionID() {}
+
+      explicit SessionID(const unsigned char *data)
+	: ProtoSessionID(data)
+      {
+      }
+    };
+
+    static std::uint32_t load32(const unsigned char *p)
+    {
+      std::uint32_t net;
+      std::memcpy(&net, p, sizeof(net));
+      return ntohl(net);
+    }
+
+    unsigned int op_ = 0;
+    size_t n_acks_ = 0;
+    const unsigned char *acks_ = nullptr;
+    id_t msg_id_ = 0;
+    PacketID pid_;
+    ProtoSessionID src_psid_;
+    ProtoSessionID dest_psid_;
+  };
+
+}
+
+#endif
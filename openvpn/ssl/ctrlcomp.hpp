@@ -0,0 +1,129 @@
+//    OpenVPN -- An application to securely tunnel IP networks
+//               over a single port, with support for SSL/TLS-based
+//               session authentication and key exchange,
+//               packet encryption, packet authentication, and
+//               packet compression.
+//
+//    Copyright (C) 2012-2016 OpenVPN Technologies, Inc.
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU Affero General Public License Version 3
+//    as published by the Free Software Foundation.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU Affero General Public License for more details.
+//
+//    You should have received a copy of the GNU Affero General Public License
+//    along with this program in the COPYING file.
+//    If not, see <http://www.gnu.org/licenses/>.
+
+// zlib-compressed envelopes for long control channel messages.
+// An envelope is itself a control message,
+//   "ZCTL," base64(gzip(msg1 \0 msg2 \0 ...)) \0
+// so it passes through the null-terminated message framing of the
+// control channel unchanged.  Peers that can unpack envelopes
+// advertise PeerInfo::CTRL_ZLIB.
+
+#ifndef OPENVPN_SSL_CTRLCOMP_H
+#define OPENVPN_SSL_CTRLCOMP_H
+
+#include <cstring> // for std::memcmp
+#include <string>
+#include <vector>
+
+#include <openvpn/common/exception.hpp>
+#include <openvpn/buffer/buffer.hpp>
+
+#ifdef HAVE_ZLIB
+#include <openvpn/common/base64.hpp>
+#include <openvpn/buffer/zlib.hpp>
+#endif
+
+namespace openvpn {
+  namespace ControlCompress {
+
+    OPENVPN_EXCEPTION(control_compress_error);
+
+    enum {
+      // uncompressed bytes per envelope, keeps the encoded envelope
+      // under ProtoContext::APP_MSG_MAX even if incompressible
+      INPUT_MAX = 32768,
+
+      // largest unpacked envelope we accept
+      OUTPUT_MAX = 65536,
+    };
+
+    static const char PREFIX[] = "ZCTL,";
+
+    inline bool is_envelope(const Buffer& buf)
+    {
+      return buf.size() >= sizeof(PREFIX) - 1
+	&& !std::memcmp(buf.c_data(), PREFIX, sizeof(PREFIX) - 1);
+    }
+
+#ifdef HAVE_ZLIB
+
+    // Pack n messages into one envelope.
+    inline BufferPtr pack(const BufferPtr* msgs, const size_t n, const int level = 6)
+    {
+      size_t size = 0;
+      for (size_t i = 0; i < n; ++i)
+	size += msgs[i]->size() + 1;
+      BufferPtr raw(new BufferAllocated(size, 0));
+      for (size_t i = 0; i < n; ++i)
+	{
+	  raw->write(msgs[i]->c_data(), msgs[i]->size());
+	  raw->null_terminate();
+	}
+
+      const BufferPtr z = ZLib::compress_gzip(raw, 0, 0, level);
+      const std::string enc = base64->encode(z->c_data(), z->size());
+      BufferPtr ret(new BufferAllocated(sizeof(PREFIX) + enc.length(), 0));
+      ret->write((const unsigned char *)PREFIX, sizeof(PREFIX) - 1);
+      ret->write((const unsigned char *)enc.c_str(), enc.length());
+      ret->null_terminate();
+      return ret;
+    }
+
+    // Unpack an envelope into its null-terminated messages.
+    inline std::vector<BufferPtr> unpack(const Buffer& env)
+    {
+      size_t size = env.size();
+      if (size && env[size-1] == 0)
+	--size;
+      const std::string enc((const char *)env.c_data() + sizeof(PREFIX) - 1,
+			    size - (sizeof(PREFIX) - 1));
+      BufferPtr z(new BufferAllocated(enc.length(), BufferAllocated::GROW));
+      try {
+	base64->decode(*z, enc);
+      }
+      catch (const std::exception& e)
+	{
+	  OPENVPN_THROW(control_compress_error, "bad envelope encoding: " << e.what());
+	}
+      const BufferPtr raw = ZLib::decompress_gzip(z, 0, 0, OUTPUT_MAX);
+
+      std::vector<BufferPtr> ret;
+      const unsigned char *p = raw->c_data();
+      const unsigned char *end = p + raw->size();
+      while (p < end)
+	{
+	  const unsigned char *nul = (const unsigned char *)std::memchr(p, 0, end - p);
+	  const unsigned char *next = nul ? nul + 1 : end;
+	  BufferPtr msg(new BufferAllocated(next - p + 1, 0));
+	  msg->write(p, next - p);
+	  if (!nul)
+	    msg->null_terminate();
+	  ret.push_back(std::move(msg));
+	  p = next;
+	}
+      return ret;
+    }
+
+#endif
+  }
+}
+
+#endif
@@ -0,0 +1,316 @@
+//    OpenVPN -- An application to securely tunnel IP networks
+//               over a single port, with support for SSL/TLS-based
+//               session authentication and key exchange,
+//               packet encryption, packet authentication, and
+//               packet compression.
+//
+//    Copyright (C) 2012-2016 OpenVPN Technologies, Inc.
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU Affero General Public License Version 3
+//    as published by the Free Software Foundation.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU Affero General Public License for more details.
+//
+//    You should have received a copy of the GNU Affero General Public License
+//    along with this program in the COPYING file.
+//    If not, see <http://www.gnu.org/licenses/>.
+
+// Forward error correction for the UDP data channel.  After every
+// group of encrypted data channel packets, an XOR parity packet is
+// sent that lets the receiver rebuild one lost packet of the group
+// before it reaches decryption and replay checking.  The group size
+// follows the loss rate that the peer reports in its own parity
+// packets.
+
+#ifndef OPENVPN_SSL_FEC_H
+#define OPENVPN_SSL_FEC_H
+
+#include <cstring>   // for std::memset
+#include <cstdint>   // for std::uint32_t
+#include <vector>
+#include <algorithm> // for std::min, std::max
+
+#include <openvpn/common/size.hpp>
+#include <openvpn/buffer/buffer.hpp>
+#include <openvpn/time/time.hpp>
+
+namespace openvpn {
+
+  class DataFEC
+  {
+  public:
+    // Parity messages (following the opcode) are laid out as
+    // loss | count | (length[2] | hash[4]) * count | xor of packets
+    // where loss is the receive loss rate of the sender in 1/256
+    // units, and shorter packets are zero-padded for the xor.
+    enum {
+      HEADER_SIZE = 2,
+      ENTRY_SIZE = 6,
+      MAX_GROUP = 32,
+      HASH_BYTES = 32, // packet prefix covered by the hash
+    };
+
+    struct Config
+    {
+      Config()
+	: min_group(2),
+	  max_group(16),
+	  window(64),
+	  max_delay(Time::Duration::milliseconds(20))
+      {
+      }
+
+      size_t min_group;         // smallest group, used at high loss
+      size_t max_group;         // largest group, used without loss
+      size_t window;            // received packets kept for rebuilding
+      Time::Duration max_delay; // send parity of an incomplete group after this
+    };
+
+    // Group size that expects about half a lost packet per group
+    // at the given loss rate, so that most groups are recoverable.
+    static size_t group_size_for(const unsigned int loss, const Config& config)
+    {
+      size_t n = config.max_group;
+      if (loss)
+	n = 128 / loss;
+      n = std::max(std::min(n, config.max_group), config.min_group);
+      return std::min(n, size_t(MAX_GROUP));
+    }
+
+    // The packet ID, tag or HMAC at the beginning of an encrypted
+    // packet differs for every packet, so hashing the prefix and the
+    // length is enough to tell packets of a group apart.
+    static std::uint32_t hash(const unsigned char *data, const size_t size)
+    {
+      std::uint32_t h = 2166136261u ^ std::uint32_t(size);
+      const size_t n = std::min(size, size_t(HASH_BYTES));
+      for (size_t i = 0; i < n; ++i)
+	h = (h ^ data[i]) * 16777619u;
+      return h;
+    }
+
+    class Encoder
+    {
+    public:
+      Encoder() {}
+
+      explicit Encoder(const Config& config_arg)
+	: config(config_arg),
+	  group_size_(group_size_for(0, config_arg))
+      {
+      }
+
+      // Add an encrypted packet, as it will be sent on the wire.
+      void add(const Buffer& pkt, const Time& now)
+      {
+	const size_t size = pkt.size();
+	if (!size || size > 0xFFFF)
+	  return;
+	if (!count)
+	  {
+	    max_len = 0;
+	    deadline_ = now + config.max_delay;
+	  }
+	if (size > max_len)
+	  {
+	    if (parity.size() < size)
+	      parity.resize(size);
+	    std::memset(parity.data() + max_len, 0, size - max_len);
+	    max_len = size;
+	  }
+	const unsigned char *src = pkt.c_data();
+	unsigned char *dest = parity.data();
+	for (size_t i = 0; i < size; ++i)
+	  dest[i] ^= src[i];
+	lens[count] = static_cast<std::uint16_t>(size);
+	hashes[count] = hash(src, size);
+	++count;
+      }
+
+      // No room for another packet in the current group.
+      bool full() const
+      {
+	return count >= group_size_;
+      }
+
+      // Parity is due, either because the group is full or because
+      // its first packet has waited max_delay.
+      bool due(const Time& now) const
+      {
+	return count && (count >= group_size_ || now >= deadline_);
+      }
+
+      Time next_event() const
+      {
+	return count ? deadline_ : Time::infinite();
+      }
+
+      size_t message_size() const
+      {
+	return HEADER_SIZE + count * ENTRY_SIZE + max_len;
+      }
+
+      // Append the parity message of the current group to out,
+      // reporting our own receive loss, and start a new group.
+      void finish(Buffer& out, const unsigned int loss)
+      {
+	out.push_back(static_cast<unsigned char>(loss));
+	out.push_back(static_cast<unsigned char>(count));
+	for (size_t i = 0; i < count; ++i)
+	  {
+	    out.push_back(static_cast<unsigned char>(lens[i] >> 8));
+	    out.push_back(static_cast<unsigned char>(lens[i]));
+	    for (int s = 24; s >= 0; s -= 8)
+	      out.push_back(static_cast<unsigned char>(hashes[i] >> s));
+	  }
+	out.write(parity.data(), max_len);
+	count = 0;
+      }
+
+      // Adapt the group size to the loss rate reported by the peer.
+      void set_peer_loss(const unsigned int loss)
+      {
+	group_size_ = group_size_for(loss, config);
+      }
+
+      size_t group_size() const
+      {
+	return group_size_;
+      }
+
+    private:
+      Config config;
+      size_t group_size_ = 0;
+      size_t count = 0;
+      size_t max_len = 0;
+      Time deadline_;
+      std::vector<unsigned char> parity;
+      std::uint16_t lens[MAX_GROUP];
+      std::uint32_t hashes[MAX_GROUP];
+    };
+
+    class Decoder
+    {
+    public:
+      enum Status {
+	NONE,      // nothing to rebuild, or more than one packet lost
+	RECOVERED, // lost packet written to out
+	MALFORMED, // bad parity message
+      };
+
+      Decoder() {}
+
+      explicit Decoder(const Config& config_arg)
+	: config(config_arg),
+	  ring(config_arg.window)
+      {
+      }
+
+      // Remember a received packet, before decryption.
+      void store(const Buffer& pkt)
+      {
+	if (ring.empty() || !pkt.size())
+	  return;
+	Entry& e = ring[next];
+	next = (next + 1) % ring.size();
+	e.data.assign(pkt.c_data(), pkt.c_data() + pkt.size());
+	e.hash = hash(pkt.c_data(), pkt.size());
+      }
+
+      // Process a parity message.  If exactly one packet of its group
+      // has not been received, append the rebuilt packet to out.
+      // peer_loss is set to the loss rate reported by the peer.
+      Status recv(const Buffer& msg, Buffer& out, unsigned int& peer_loss)
+      {
+	if (msg.size() < HEADER_SIZE)
+	  return MALFORMED;
+	const unsigned char *p = msg.c_data();
+	const size_t count = p[1];
+	if (!count || count > MAX_GROUP || msg.size() < HEADER_SIZE + count * ENTRY_SIZE)
+	  return MALFORMED;
+	peer_loss = p[0];
+
+	const unsigned char *xor_data = p + HEADER_SIZE + count * ENTRY_SIZE;
+	const size_t xor_len = msg.size() - HEADER_SIZE - count * ENTRY_SIZE;
+	const Entry *found[MAX_GROUP];
+	size_t missing = 0;
+	size_t missing_index = 0;
+	size_t missing_len = 0;
+	for (size_t i = 0; i < count; ++i)
+	  {
+	    const unsigned char *ent = p + HEADER_SIZE + i * ENTRY_SIZE;
+	    const size_t len = (size_t(ent[0]) << 8) | ent[1];
+	    const std::uint32_t h = (std::uint32_t(ent[2]) << 24) | (std::uint32_t(ent[3]) << 16)
+	                          | (std::uint32_t(ent[4]) << 8) | std::uint32_t(ent[5]);
+	    if (!len || len > xor_len)
+	      return MALFORMED;
+	    found[i] = lookup(h, len);
+	    if (!found[i])
+	      {
+		++missing;
+		missing_index = i;
+		missing_len = len;
+	      }
+	  }
+	update_loss(missing, count);
+	if (missing != 1)
+	  return NONE;
+	if (missing_len > out.remaining())
+	  return MALFORMED;
+
+	unsigned char *dest = out.write_alloc(missing_len);
+	std::memcpy(dest, xor_data, missing_len);
+	for (size_t i = 0; i < count; ++i)
+	  {
+	    if (i == missing_index)
+	      continue;
+	    const std::vector<unsigned char>& src = found[i]->data;
+	    const size_t n = std::min(src.size(), missing_len);
+	    for (size_t j = 0; j < n; ++j)
+	      dest[j] ^= src[j];
+	  }
+	return RECOVERED;
+      }
+
+      // Our receive loss rate in 1/256 units.
+      unsigned int loss() const
+      {
+	return std::min(static_cast<unsigned int>(loss_ * 256.0 + 0.5), 255u);
+      }
+
+    private:
+      struct Entry
+      {
+	std::vector<unsigned char> data;
+	std::uint32_t hash = 0;
+      };
+
+      const Entry *lookup(const std::uint32_t h, const size_t len) const
+      {
+	for (const auto& e : ring)
+	  {
+	    if (e.hash == h && e.data.size() == len)
+	      return &e;
+	  }
+	return nullptr;
+      }
+
+      void update_loss(const size_t missing, const size_t count)
+      {
+	loss_ += (double(missing) / double(count) - loss_) / 16.0;
+      }
+
+      Config config;
+      std::vector<Entry> ring;
+      size_t next = 0;
+      double loss_ = 0.0;
+    };
+  };
+
+}
+
+#endif
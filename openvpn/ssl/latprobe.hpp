@@ -0,0 +1,274 @@
+//    OpenVPN -- An application to securely tunnel IP networks
+//               over a single port, with support for SSL/TLS-based
+//               session authentication and key exchange,
+//               packet encryption, packet authentication, and
+//               packet compression.
+//
+//    Copyright (C) 2012-2016 OpenVPN Technologies, Inc.
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU Affero General Public License Version 3
+//    as published by the Free Software Foundation.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU Affero General Public License for more details.
+//
+//    You should have received a copy of the GNU Affero General Public License
+//    along with this program in the COPYING file.
+//    If not, see <http://www.gnu.org/licenses/>.
+
+// Timestamped latency probes for the data channel.  Each end sends
+// probes at a fixed interval and the peer echoes them at once, so
+// the sender measures RTT and loss, while the receiver measures the
+// one-way delay variation (RFC 3550 interarrival jitter) from the
+// sender's timestamps without needing synchronized clocks.
+
+#ifndef OPENVPN_SSL_LATPROBE_H
+#define OPENVPN_SSL_LATPROBE_H
+
+#include <cstring>   // for std::memcmp
+#include <cstdint>   // for std::uint32_t, std::uint64_t
+#include <chrono>
+
+#include <openvpn/common/size.hpp>
+#include <openvpn/buffer/buffer.hpp>
+#include <openvpn/time/time.hpp>
+
+namespace openvpn {
+
+  class LatencyProbe
+  {
+  public:
+    // Probe and echo messages are laid out as
+    // magic[16] | type | seq[4] | timestamp[8]
+    // where timestamp is the sender's clock in microseconds,
+    // copied unchanged into the echo.
+    enum {
+      MAGIC_SIZE = 16,
+      MESSAGE_SIZE = MAGIC_SIZE + 1 + 4 + 8,
+      WINDOW = 32, // outstanding probes tracked for loss
+    };
+
+    enum Type {
+      REQUEST = 1,
+      REPLY = 2,
+    };
+
+    struct Config
+    {
+      Config()
+	: interval(Time::Duration::seconds(1)),
+	  timeout(Time::Duration::seconds(3))
+      {
+      }
+
+      Time::Duration interval; // time between probes
+      Time::Duration timeout;  // a probe is lost if not echoed by then
+    };
+
+    struct Stats
+    {
+      std::uint64_t rtt_us = 0;     // smoothed RTT
+      std::uint64_t rtt_min_us = 0; // lowest RTT seen
+      std::uint64_t rtt_var_us = 0; // RTT variation
+      std::uint64_t jitter_us = 0;  // one-way delay variation of peer's probes
+      std::uint64_t sent = 0;
+      std::uint64_t received = 0;   // echoes of our probes
+      std::uint64_t lost = 0;
+    };
+
+    LatencyProbe() {}
+
+    explicit LatencyProbe(const Config& config_arg)
+      : config(config_arg)
+    {
+    }
+
+    void start(const Time& now)
+    {
+      enabled_ = true;
+      next_event_ = now;
+    }
+
+    void stop()
+    {
+      enabled_ = false;
+    }
+
+    bool enabled() const
+    {
+      return enabled_;
+    }
+
+    Time next_event() const
+    {
+      return enabled_ ? next_event_ : Time::infinite();
+    }
+
+    // If a probe is due at now, return true with its sequence number
+    // and timestamp, for the caller to send with write_message(REQUEST, ...).
+    // Returns the number of probes found lost in n_lost.
+    bool probe_due(const Time& now, std::uint32_t& seq, std::uint64_t& ts, unsigned int& n_lost)
+    {
+      n_lost = 0;
+      if (!enabled_ || now < next_event_)
+	return false;
+      const std::uint64_t t = clock_us();
+      const std::uint64_t timeout_us = config.timeout.to_milliseconds() * 1000;
+      for (auto &s : slots)
+	if (s.pending && t - s.sent_us >= timeout_us)
+	  {
+	    s.pending = false;
+	    ++n_lost;
+	  }
+      stats_.lost += n_lost;
+
+      seq = ++seq_;
+      Slot& s = slots[seq % WINDOW];
+      if (s.pending)
+	{
+	  ++n_lost;
+	  ++stats_.lost;
+	}
+      s.seq = seq;
+      s.sent_us = t;
+      s.pending = true;
+      ts = t;
+      ++stats_.sent;
+      next_event_ = now + config.interval;
+      return true;
+    }
+
+    // Process an echo of one of our probes, return true if it
+    // produced a new RTT sample.
+    bool echo(const std::uint32_t seq, const std::uint64_t sent_us)
+    {
+      Slot& s = slots[seq % WINDOW];
+      if (!s.pending || s.seq != seq || s.sent_us != sent_us)
+	return false;
+      s.pending = false;
+      ++stats_.received;
+
+      const std::uint64_t now = clock_us();
+      const std::uint64_t r = now > sent_us ? now - sent_us : 0;
+      if (!stats_.rtt_us)
+	{
+	  stats_.rtt_us = r;
+	  stats_.rtt_var_us = r / 2;
+	  stats_.rtt_min_us = r;
+	}
+      else
+	{
+	  // RFC 6298 smoothing
+	  const std::uint64_t d = r > stats_.rtt_us ? r - stats_.rtt_us : stats_.rtt_us - r;
+	  stats_.rtt_var_us = (3 * stats_.rtt_var_us + d) / 4;
+	  stats_.rtt_us = (7 * stats_.rtt_us + r) / 8;
+	  if (r < stats_.rtt_min_us)
+	    stats_.rtt_min_us = r;
+	}
+      return true;
+    }
+
+    // Process a probe from the peer, updating the interarrival jitter.
+    // Works whether or not our own probes are enabled.
+    void peer_probe(const std::uint64_t peer_sent_us)
+    {
+      // clocks are unsynchronized, so only differences of transit
+      // times are meaningful, taken modulo 2^64
+      const std::uint64_t transit = clock_us() - peer_sent_us;
+      if (have_transit)
+	{
+	  std::int64_t d = (std::int64_t)(transit - last_transit);
+	  if (d < 0)
+	    d = -d;
+	  jitter16 += d - jitter16 / 16;
+	}
+      last_transit = transit;
+      have_transit = true;
+      stats_.jitter_us = (std::uint64_t)(jitter16 >> 4);
+    }
+
+    const Stats& stats() const
+    {
+      return stats_;
+    }
+
+    // monotonic clock, finer than Time
+    static std::uint64_t clock_us()
+    {
+      return (std::uint64_t)std::chrono::duration_cast<std::chrono::microseconds>(
+	std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+    static bool is_message(const Buffer& buf)
+    {
+      return buf.size() >= MESSAGE_SIZE
+	&& buf[0] == magic()[0]
+	&& !std::memcmp(magic(), buf.c_data(), MAGIC_SIZE);
+    }
+
+    static void write_message(Buffer& buf, const Type type, const std::uint32_t seq, const std::uint64_t ts)
+    {
+      buf.write(magic(), MAGIC_SIZE);
+      buf.push_back((unsigned char)type);
+      for (int shift = 24; shift >= 0; shift -= 8)
+	buf.push_back((unsigned char)(seq >> shift));
+      for (int shift = 56; shift >= 0; shift -= 8)
+	buf.push_back((unsigned char)(ts >> shift));
+    }
+
+    // Buffer must satisfy is_message().
+    static Type message_type(const Buffer& buf)
+    {
+      return Type(buf[MAGIC_SIZE]);
+    }
+
+    static std::uint32_t message_seq(const Buffer& buf)
+    {
+      const unsigned char *p = buf.c_data() + MAGIC_SIZE + 1;
+      return (std::uint32_t(p[0]) << 24) | (std::uint32_t(p[1]) << 16) | (std::uint32_t(p[2]) << 8) | p[3];
+    }
+
+    static std::uint64_t message_timestamp(const Buffer& buf)
+    {
+      const unsigned char *p = buf.c_data() + MAGIC_SIZE + 1 + 4;
+      std::uint64_t ret = 0;
+      for (int i = 0; i < 8; ++i)
+	ret = (ret << 8) | p[i];
+      return ret;
+    }
+
+  private:
+    // distinct from the keepalive and PMTU messages, and not a valid IP header
+    static const unsigned char *magic()
+    {
+      static const unsigned char m[MAGIC_SIZE] = { // CONST GLOBAL
+	0x2c, 0x51, 0x9a, 0xe3, 0x07, 0xb8, 0x6d, 0x24,
+	0xf1, 0x3e, 0x85, 0xca, 0x19, 0x72, 0xd6, 0x4b
+      };
+      return m;
+    }
+
+    struct Slot
+    {
+      std::uint32_t seq = 0;
+      std::uint64_t sent_us = 0;
+      bool pending = false;
+    };
+
+    Config config;
+    bool enabled_ = false;
+    Time next_event_;
+    std::uint32_t seq_ = 0;
+    Slot slots[WINDOW];
+    Stats stats_;
+    std::uint64_t last_transit = 0;
+    std::int64_t jitter16 = 0; // jitter scaled by 16
+    bool have_transit = false;
+  };
+
+}
+
+#endif
@@ -38,6 +38,12 @@ namespace openvpn {
       const Option *o = opt.get_ptr("mssfix");
       if (o)
 	{
+	  // "mssfix 0" disables clamping
+	  if (o->get(1, 16) == "0")
+	    {
+	      mssfix = 0;
+	      return;
+	    }
 	  const bool status = parse_number_validate<decltype(mssfix)>(o->get(1, 16),
 								      16,
 								      576,
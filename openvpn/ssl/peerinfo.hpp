@@ -39,6 +39,35 @@ namespace openvpn {
 
     OPENVPN_EXCEPTION(peer_info_error);
 
+    // Advertised by clients that accept a PUSH_REPLY sent as soon as
+    // authentication completes, before any PUSH_REQUEST.
+    static const char PUSH_EARLY[] = "IV_PUSH_EARLY";
+
+    // Advertised by peers that unpack zlib-compressed control
+    // message envelopes (see ControlCompress).
+    static const char CTRL_ZLIB[] = "IV_CTRL_ZLIB";
+
+    // Advertised by peers that unpack bundled data channel
+    // packets (see DataBundle).
+    static const char BUNDLE[] = "IV_BUNDLE";
+
+    // Return true if peer info in the form K1=V1\nK2=V2\n...
+    // sets key to 1.
+    inline bool flag_set(const std::string& peer_info, const std::string& key)
+    {
+      const std::string kv = key + "=1";
+      size_t pos = 0;
+      while ((pos = peer_info.find(kv, pos)) != std::string::npos)
+	{
+	  const size_t end = pos + kv.length();
+	  if ((pos == 0 || peer_info[pos-1] == '\n')
+	      && (end == peer_info.length() || peer_info[end] == '\n' || peer_info[end] == '\r'))
+	    return true;
+	  pos = end;
+	}
+      return false;
+    }
+
     struct KeyValue
     {
       KeyValue(const std::string& key_arg, const std::string& value_arg)
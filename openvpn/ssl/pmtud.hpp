@@ -0,0 +1,243 @@
+//    OpenVPN -- An application to securely tunnel IP networks
+//               over a single port, with support for SSL/TLS-based
+//               session authentication and key exchange,
+//               packet encryption, packet authentication, and
+//               packet compression.
+//
+//    Copyright (C) 2012-2016 OpenVPN Technologies, Inc.
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU Affero General Public License Version 3
+//    as published by the Free Software Foundation.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU Affero General Public License for more details.
+//
+//    You should have received a copy of the GNU Affero General Public License
+//    along with this program in the COPYING file.
+//    If not, see <http://www.gnu.org/licenses/>.
+// Packetization Layer Path MTU Discovery (RFC 8899) for the UDP
+// data channel.  Probes are padded data channel messages that the
+// peer answers with a short ack, so the search runs over the
+// tunnel itself and does not depend on ICMP reaching us.
+
+#ifndef OPENVPN_SSL_PMTUD_H
+#define OPENVPN_SSL_PMTUD_H
+
+#include <cstring>   // for std::memcmp, std::memset
+#include <cstdint>   // for std::uint32_t
+#include <algorithm> // for std::min, std::max
+
+#include <openvpn/common/size.hpp>
+#include <openvpn/buffer/buffer.hpp>
+#include <openvpn/time/time.hpp>
+
+namespace openvpn {
+
+  class PMTUDiscovery
+  {
+  public:
+    // Probe and ack messages are laid out as
+    // magic[16] | type | seq[4] | zero padding
+    enum {
+      MAGIC_SIZE = 16,
+      HEADER_SIZE = MAGIC_SIZE + 1 + 4,
+    };
+
+    enum Type {
+      PROBE = 1,
+      ACK = 2,
+    };
+
+    struct Config
+    {
+      Config()
+	: base(1200),
+	  granularity(16),
+	  max_probes(3),
+	  probe_timeout(Time::Duration::seconds(2)),
+	  raise_interval(Time::Duration::seconds(600))
+      {
+      }
+
+      size_t base;                   // link size assumed to work from the start
+      size_t granularity;            // stop searching when the range is this small
+      unsigned int max_probes;       // a size has failed after this many lost probes
+      Time::Duration probe_timeout;  // time to wait for an ack
+      Time::Duration raise_interval; // time between searches once complete
+    };
+
+    PMTUDiscovery() {}
+
+    explicit PMTUDiscovery(const Config& config_arg)
+      : config(config_arg)
+    {
+    }
+
+    // Begin searching between config.base and max_size, both being
+    // link (UDP payload) sizes.
+    void start(const size_t max_size, const Time& now)
+    {
+      max_ = max_size;
+      lo = std::min(config.base, max_size);
+      hi = max_size + 1;
+      target = 0;
+      probe_count = 0;
+      pending = false;
+      complete = false;
+      next_event_ = now;
+    }
+
+    void stop()
+    {
+      max_ = 0;
+    }
+
+    bool enabled() const
+    {
+      return max_ != 0;
+    }
+
+    // When the next probe or timeout is due.
+    Time next_event() const
+    {
+      return enabled() ? next_event_ : Time::infinite();
+    }
+
+    // If a probe is due at now, return its link size, otherwise 0.
+    // Caller sends it and then calls sent().
+    size_t probe_due(const Time& now)
+    {
+      if (!enabled() || now < next_event_)
+	return 0;
+      if (pending)
+	{
+	  // probe lost
+	  pending = false;
+	  if (++probe_count >= config.max_probes)
+	    {
+	      hi = target;
+	      probe_count = 0;
+	    }
+	}
+      else if (complete)
+	{
+	  // raise timer expired, see if the path has grown
+	  complete = false;
+	  hi = max_ + 1;
+	}
+
+      if (hi - lo <= config.granularity)
+	{
+	  complete = true;
+	  next_event_ = now + config.raise_interval;
+	  return 0;
+	}
+      if (!probe_count)
+	target = (hi == max_ + 1) ? max_ : (lo + hi) / 2;
+      return target;
+    }
+
+    void sent(const std::uint32_t seq, const Time& now)
+    {
+      seq_ = seq;
+      pending = true;
+      next_event_ = now + config.probe_timeout;
+    }
+
+    // Process an ack, return true if it confirmed a larger size,
+    // in which case the next probe is due at once.
+    bool ack(const std::uint32_t seq, const Time& now)
+    {
+      if (!pending || seq != seq_)
+	return false;
+      pending = false;
+      probe_count = 0;
+      next_event_ = now;
+      if (target > lo)
+	{
+	  lo = target;
+	  return true;
+	}
+      return false;
+    }
+
+    // true once a search has converged, until the next one starts
+    bool search_complete() const
+    {
+      return complete;
+    }
+
+    // largest link size confirmed so far
+    size_t plpmtu() const
+    {
+      return lo;
+    }
+
+    // largest tun packet that fits in plpmtu() given the per-packet
+    // link overhead, or 0 if disabled
+    size_t tun_mtu(const size_t link_overhead) const
+    {
+      if (enabled() && lo > link_overhead)
+	return lo - link_overhead;
+      return 0;
+    }
+
+    static bool is_message(const Buffer& buf)
+    {
+      return buf.size() >= HEADER_SIZE
+	&& buf[0] == magic()[0]
+	&& !std::memcmp(magic(), buf.c_data(), MAGIC_SIZE);
+    }
+
+    // Write a message of the given total size (at least HEADER_SIZE).
+    static void write_message(Buffer& buf, const Type type, const std::uint32_t seq, const size_t size)
+    {
+      buf.write(magic(), MAGIC_SIZE);
+      buf.push_back((unsigned char)type);
+      for (int shift = 24; shift >= 0; shift -= 8)
+	buf.push_back((unsigned char)(seq >> shift));
+      if (size > HEADER_SIZE)
+	std::memset(buf.write_alloc(size - HEADER_SIZE), 0, size - HEADER_SIZE);
+    }
+
+    // Buffer must satisfy is_message().
+    static Type message_type(const Buffer& buf)
+    {
+      return Type(buf[MAGIC_SIZE]);
+    }
+
+    static std::uint32_t message_seq(const Buffer& buf)
+    {
+      const unsigned char *p = buf.c_data() + MAGIC_SIZE + 1;
+      return (std::uint32_t(p[0]) << 24) | (std::uint32_t(p[1]) << 16) | (std::uint32_t(p[2]) << 8) | p[3];
+    }
+
+  private:
+    // distinct from the keepalive message, and not a valid IP header
+    static const unsigned char *magic()
+    {
+      static const unsigned char m[MAGIC_SIZE] = { // CONST GLOBAL
+	0x2b, 0x7c, 0xe1, 0x09, 0x5d, 0x93, 0x4a, 0xf6,
+	0x18, 0xc0, 0x37, 0x8e, 0x62, 0xd5, 0xab, 0x41
+      };
+      return m;
+    }
+
+    Config config;
+    size_t max_ = 0;
+    size_t lo = 0;           // largest size confirmed
+    size_t hi = 0;           // smallest size failed, or max_ + 1
+    size_t target = 0;       // size of current probe
+    unsigned int probe_count = 0;
+    std::uint32_t seq_ = 0;
+    bool pending = false;
+    bool complete = false;
+    Time next_event_;
+  };
+
+}
+
+#endif
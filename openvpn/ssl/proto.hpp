@@ -48,22 +48,35 @@
 #include <openvpn/buffer/buffer.hpp>
 #include <openvpn/buffer/safestr.hpp>
 #include <openvpn/buffer/bufcomposed.hpp>
+#include <openvpn/buffer/bufrope.hpp>
 #include <openvpn/time/time.hpp>
 #include <openvpn/time/durhelper.hpp>
 #include <openvpn/frame/frame.hpp>
+#include <openvpn/ip/mssfix.hpp>
 #include <openvpn/random/randapi.hpp>
 #include <openvpn/crypto/cryptoalgs.hpp>
 #include <openvpn/crypto/cryptodc.hpp>
 #include <openvpn/crypto/cipher.hpp>
 #include <openvpn/crypto/ovpnhmac.hpp>
+#include <openvpn/crypto/tls_crypt.hpp>
 #include <openvpn/crypto/packet_id.hpp>
 #include <openvpn/crypto/static_key.hpp>
 #include <openvpn/crypto/bs64_data_limit.hpp>
+#include <openvpn/crypto/crypto_fixed.hpp>
 #include <openvpn/log/sessionstats.hpp>
+#include <openvpn/log/usdt.hpp>
 #include <openvpn/ssl/protostack.hpp>
 #include <openvpn/ssl/psid.hpp>
+#include <openvpn/ssl/ctlhdr.hpp>
 #include <openvpn/ssl/tlsprf.hpp>
 #include <openvpn/ssl/datalimit.hpp>
+#include <openvpn/ssl/pmtud.hpp>
+#include <openvpn/ssl/latprobe.hpp>
+#include <openvpn/ssl/ctrlcomp.hpp>
+#include <openvpn/ssl/bundle.hpp>
+#include <openvpn/ssl/fec.hpp>
+#include <openvpn/ssl/reorder.hpp>
+#include <openvpn/ssl/mssparms.hpp>
 #include <openvpn/transport/protocol.hpp>
 #include <openvpn/tun/layer.hpp>
 #include <openvpn/tun/tunmtu.hpp>
@@ -166,6 +179,7 @@ namespace openvpn {
       ACK_V1 =                       5,   // acknowledgement for packets received
       DATA_V1 =                      6,   // data channel packet with 1-byte header
       DATA_V2 =                      9,   // data channel packet with 4-byte header
+      DATA_FEC_V1 =                 30,   // FEC parity for data channel packets, 4-byte header as DATA_V2
 
       // indicates key_method >= 2
       CONTROL_HARD_RESET_CLIENT_V2 = 7,   // initial key from client, forget previous state
@@ -291,9 +305,16 @@ namespace openvpn {
       OvpnHMACContext::Ptr tls_auth_context;
       int key_direction = -1;        // 0, 1, or -1 for bidirectional
 
+      // tls_crypt parms
+      OpenVPNStaticKey tls_crypt_key; // leave this undefined to disable tls_crypt
+      TLSCryptFactory::Ptr tls_crypt_factory;
+      TLSCryptContext::Ptr tls_crypt_context;
+
       // reliability layer parms
-      reliable::id_t reliable_window = 0;
+      reliable::id_t reliable_window = 0;      // send window
+      reliable::id_t reliable_recv_window = 0; // receive window, never less than reliable_window
       size_t max_ack_list = 0;
+      bool reliable_adaptive_rto = true;       // derive retransmit timeout from measured RTT
 
       // packet_id parms for both data and control channels
       int pid_mode = 0;                // PacketIDReceive::UDP_MODE or PacketIDReceive::TCP_MODE
@@ -301,14 +322,20 @@ namespace openvpn {
       // timeout parameters, relative to construction of KeyContext object
       Time::Duration handshake_window; // SSL/TLS negotiation must complete by this time
       Time::Duration become_primary;   // KeyContext (that is ACTIVE) becomes primary at this time
+      bool become_primary_on_decrypt = true; // ...or as soon as the peer transmits on it
       Time::Duration renegotiate;      // start SSL/TLS renegotiation at this time
+      Time::Duration reneg_jitter;     // ...or up to this much earlier, at random per key
       Time::Duration expire;           // KeyContext expires at this time
       Time::Duration tls_timeout;      // Packet retransmit timeout on TLS control channel
+      Time::Duration ack_delay;        // Hold standalone control channel ACKs up to this long (undefined to disable)
 
       // keepalive parameters
       Time::Duration keepalive_ping;
       Time::Duration keepalive_timeout;
 
+      // once idle, space keepalives out to half of keepalive_timeout
+      bool keepalive_idle = false;
+
       // extra peer info key/value pairs generated by client app
       PeerInfo::Set::Ptr extra_peer_info;
 
@@ -323,6 +350,68 @@ namespace openvpn {
       // MTU
       unsigned int tun_mtu = 1500;
 
+      // Probe the UDP path MTU over the data channel (see PMTUDiscovery).
+      // Enabled by the "pmtud" option, which the server may push.
+      bool pmtud = false;
+      PMTUDiscovery::Config pmtud_config;
+
+      // Send timestamped latency probes over the data channel (see
+      // LatencyProbe).  Enabled by "latency-probe [interval-ms]", which
+      // the server may push to clients that advertise IV_LATPROBE.
+      bool latency_probe = false;
+      LatencyProbe::Config latprobe_config;
+
+      // Bundle small tun packets passed together to data_encrypt_batch
+      // into one data channel packet (see DataBundle).  Enabled by the
+      // "bundle" option, but only used once the peer has said that it
+      // can receive bundles (see ProtoContext::enable_bundle_send).
+      bool bundle = false;
+      size_t bundle_max_packet = 256;
+
+      // Send XOR parity packets over groups of UDP data channel
+      // packets so that the peer can rebuild lost ones (see DataFEC).
+      // Enabled by the "fec" option, which the server may push to
+      // clients that advertise IV_FEC.
+      bool fec = false;
+      DataFEC::Config fec_config;
+
+      // Hold UDP data channel packets that arrive ahead of a gap in
+      // the packet IDs for a few ms and release them to tun in order
+      // (see DataReorder).  Enabled by "reorder [max-hold-ms]", which
+      // only affects the receiving side and is not negotiated.
+      bool reorder = false;
+      DataReorder::Config reorder_config;
+
+      // Use 64-bit packet IDs (PacketIDWide) on AEAD data channels, so
+      // that a key is never renegotiated because its IDs would wrap.
+      // Enabled by the "pktid64" option, which the server may push to
+      // clients that advertise IV_PKTID64.
+      bool pktid64 = false;
+
+      // Ratchet AEAD data channel keys forward with HKDF every
+      // 2^key_epoch_bits packets or key_epoch_period seconds, between
+      // TLS renegotiations (see CryptoDCInstance::init_epoch).  Enabled
+      // by "key-epoch [period-sec] [bits]", which the server may push
+      // to clients that advertise IV_KEY_EPOCH.
+      bool key_epoch = false;
+      unsigned int key_epoch_period = 600; // 0 to only count packets
+      unsigned int key_epoch_bits = 24;
+
+      // Derive data channel keys with the RFC 5705 TLS keying material
+      // exporter rather than the TLS PRF over the random material in
+      // the auth messages.  Enabled by "key-derivation tls-ekm", which
+      // the server may push to clients advertising IV_PROTO bit 3.
+      bool tls_ekm = false;
+
+      // Send control messages totalling at least this many bytes in
+      // zlib-compressed envelopes (see ControlCompress) to peers that
+      // advertise IV_CTRL_ZLIB.  Set by "control-compress [min-bytes]",
+      // 0 to disable.
+      size_t ctrl_compress_threshold = 0;
+
+      // TCP MSS clamping of tunnel packets, from "mssfix"
+      MSSParms mss_parms;
+
       // Debugging
       int debug_level = 1;
 
@@ -334,6 +423,7 @@ namespace openvpn {
       {
 	// first set defaults
 	reliable_window = 4;
+	reliable_recv_window = 16;
 	max_ack_list = 4;
 	handshake_window = Time::Duration::seconds(60);
 	renegotiate = Time::Duration::seconds(3600);
@@ -408,6 +498,18 @@ namespace openvpn {
 		  set_tls_auth_digest(digest);
 	      }
 	  }
+
+	  // tls-crypt
+	  {
+	    const Option *o = opt.get_ptr("tls-crypt");
+	    if (o)
+	      {
+		if (tls_auth_key.defined())
+		  throw proto_option_error("tls-auth and tls-crypt are mutually exclusive");
+		tls_crypt_key.parse(o->get(1, 0));
+		set_tls_crypt_algs(CryptoAlgs::SHA256, CryptoAlgs::AES_256_CTR);
+	      }
+	  }
 	}
 
 	// key-direction
@@ -621,6 +723,18 @@ namespace openvpn {
 	return tls_auth_key.defined() && tls_auth_context;
       }
 
+      void set_tls_crypt_algs(const CryptoAlgs::Type digest, const CryptoAlgs::Type cipher)
+      {
+	if (!tls_crypt_factory)
+	  throw proto_option_error("tls-crypt not supported");
+	tls_crypt_context = tls_crypt_factory->new_obj(digest, cipher);
+      }
+
+      bool tls_crypt_enabled() const
+      {
+	return tls_crypt_key.defined() && tls_crypt_context;
+      }
+
       void validate_complete() const
       {
 	if (!protocol.defined())
@@ -683,7 +797,12 @@ namespace openvpn {
 	  {
 	    out << "IV_NCP=2\n"; // negotiable crypto parameters V2
 	    out << "IV_TCPNL=1\n"; // supports TCP non-linear packet ID
-	    out << "IV_PROTO=2\n"; // supports op32 and P_DATA_V2
+	    // bit 1: supports op32 and P_DATA_V2
+	    // bit 3: supports key derivation with the TLS keying material exporter
+	    out << "IV_PROTO=" << (2 | (ssl_factory && ssl_factory->key_material_export_supported() ? 8 : 0)) << '\n';
+	    const std::string ciphers = aead_ciphers_string();
+	    if (!ciphers.empty())
+	      out << "IV_CIPHERS=" << ciphers << '\n'; // negotiable AEAD data channel ciphers
 	    compstr = comp_ctx.peer_info_string();
 	  }
 	else
@@ -694,11 +813,47 @@ namespace openvpn {
 	  out << extra_peer_info->to_string();
 	if (is_bs64_cipher(dc.cipher()))
 	  out << "IV_BS64DL=1\n"; // indicate support for data limits when using 64-bit block-size ciphers, version 1 (CVE-2016-6329)
+	out << "IV_PMTUD=1\n"; // we answer data channel PMTU probes
+	out << "IV_LATPROBE=1\n"; // we echo data channel latency probes
+	out << PeerInfo::BUNDLE << "=1\n"; // we receive bundled data channel packets
+	out << "IV_FEC=1\n"; // we rebuild lost data channel packets from parity
+	out << "IV_PKTID64=1\n"; // we accept 64-bit packet IDs on AEAD data channels
+	out << "IV_KEY_EPOCH=1\n"; // we ratchet AEAD data channel keys with key-epoch
+	out << PeerInfo::PUSH_EARLY << "=1\n"; // we accept PUSH_REPLY before PUSH_REQUEST
+#ifdef HAVE_ZLIB
+	out << PeerInfo::CTRL_ZLIB << "=1\n"; // we unpack compressed control messages
+#endif
 	const std::string ret = out.str();
 	OPENVPN_LOG_PROTO("Peer Info:" << std::endl << ret);
 	return ret;
       }
 
+      // colon-separated list of AEAD ciphers supported by the
+      // data channel factory, in order of preference
+      std::string aead_ciphers_string() const
+      {
+	static const CryptoAlgs::Type pref[] = {
+	  CryptoAlgs::AES_256_GCM,
+	  CryptoAlgs::AES_128_GCM,
+	  CryptoAlgs::CHACHA20_POLY1305,
+	};
+	std::string ret;
+	const CryptoDCFactory::Ptr factory = dc.factory();
+	if (factory)
+	  {
+	    for (const auto alg : pref)
+	      {
+		if (factory->supports_cipher(alg))
+		  {
+		    if (!ret.empty())
+		      ret += ':';
+		    ret += CryptoAlgs::name(alg);
+		  }
+	      }
+	  }
+	return ret;
+      }
+
       // Used to generate link_mtu option sent to peer.
       // Not const because dc.context() caches the DC context.
       unsigned int link_mtu_adjust()
@@ -706,11 +861,29 @@ namespace openvpn {
 	const size_t adj = protocol.extra_transport_bytes() + // extra 2 bytes for TCP-streamed packet length
           (enable_op32 ? 4 : 1) +                        // leading op
 	  comp_ctx.extra_payload_bytes() +               // compression header
-	  PacketID::size(PacketID::SHORT_FORM) +         // sequence number
+	  PacketID::size(data_pid_form()) +              // sequence number
 	  dc.context().encap_overhead();                 // data channel crypto layer overhead
 	return (unsigned int)adj;
       }
 
+      // packet ID form of the data channel
+      int data_pid_form() const
+      {
+	if (pktid64
+	    && CryptoAlgs::defined(dc.cipher())
+	    && CryptoAlgs::get(dc.cipher()).mode() == CryptoAlgs::AEAD)
+	  return PacketID::WIDE_FORM;
+	return PacketID::SHORT_FORM;
+      }
+
+      // key epochs only apply to AEAD data channels
+      bool key_epoch_enabled() const
+      {
+	return key_epoch
+	  && CryptoAlgs::defined(dc.cipher())
+	  && CryptoAlgs::get(dc.cipher()).mode() == CryptoAlgs::AEAD;
+      }
+
     private:
       enum LoadCommonType {
 	LOAD_COMMON_SERVER,
@@ -739,9 +912,102 @@ namespace openvpn {
 	load_duration_parm(become_primary, "become-primary", opt, 0, false, false);
 	load_duration_parm(tls_timeout, "tls-timeout", opt, 100, false, true);
 
+	// delayed ACKs on the control channel, e.g. "ack-delay-ms 20"
+	load_duration_parm(ack_delay, "ack-delay", opt, 1, false, true);
+
+	// Larger control channel send window for high-RTT links.  Our
+	// receive window (reliable_recv_window) defaults to 16, so peers
+	// running this implementation can raise their send window
+	// without a handshake-time negotiation.
+	{
+	  const Option *o = opt.get_ptr("reliable-window");
+	  if (o)
+	    reliable_window = o->get_num<reliable::id_t>(1, reliable_window, 1, 64);
+	  reliable_recv_window = std::max(reliable_recv_window, reliable_window);
+	}
+
 	if (type == LOAD_COMMON_SERVER)
 	  renegotiate += handshake_window; // avoid renegotiation collision with client
 
+	// spread out the renegotiations of sessions that connected
+	// together, e.g. "reneg-jitter 600"
+	load_duration_parm(reneg_jitter, "reneg-jitter", opt, 0, false, false);
+	reneg_jitter = std::min(reneg_jitter, Time::Duration::seconds(renegotiate.to_seconds() / 2));
+
+	// path MTU discovery
+	if (opt.exists("pmtud"))
+	  pmtud = true;
+
+	// data channel latency probes
+	{
+	  const Option *o = opt.get_ptr("latency-probe");
+	  if (o)
+	    {
+	      latency_probe = true;
+	      if (o->size() >= 2)
+		latprobe_config.interval = Time::Duration::milliseconds(o->get_num<unsigned int>(1, 1000, 10, 3600*1000));
+	      latprobe_config.timeout = std::max(latprobe_config.interval * 3, Time::Duration::seconds(3));
+	    }
+	}
+
+	// small packet bundling
+	if (opt.exists("bundle"))
+	  bundle = true;
+
+	// forward error correction
+	if (opt.exists("fec"))
+	  fec = true;
+
+	// receive reordering, e.g. "reorder 10"
+	{
+	  const Option *o = opt.get_ptr("reorder");
+	  if (o)
+	    {
+	      reorder = true;
+	      if (o->size() >= 2)
+		reorder_config.max_hold = Time::Duration::milliseconds(o->get_num<unsigned int>(1, 10, 1, 1000));
+	      reorder_config.min_hold = std::min(reorder_config.min_hold, reorder_config.max_hold);
+	    }
+	}
+
+	// 64-bit data channel packet IDs
+	if (opt.exists("pktid64"))
+	  pktid64 = true;
+
+	// compressed control messages, e.g. "control-compress 512"
+	{
+	  const Option *o = opt.get_ptr("control-compress");
+	  if (o)
+	    ctrl_compress_threshold = o->get_num<size_t>(1, 512, 1, ControlCompress::INPUT_MAX);
+	}
+
+	// data channel key epochs, e.g. "key-epoch 600 24"
+	{
+	  const Option *o = opt.get_ptr("key-epoch");
+	  if (o)
+	    {
+	      key_epoch = true;
+	      key_epoch_period = o->get_num<unsigned int>(1, key_epoch_period, 0, 86400);
+	      key_epoch_bits = o->get_num<unsigned int>(2, key_epoch_bits, 16, 30);
+	    }
+	}
+
+	// data channel key derivation
+	{
+	  const Option *o = opt.get_ptr("key-derivation");
+	  if (o)
+	    {
+	      const std::string& method = o->get(1, 16);
+	      if (method == "tls-ekm")
+		tls_ekm = true;
+	      else
+		OPENVPN_THROW(proto_option_error, "unknown key-derivation method: " << method);
+	    }
+	}
+
+	// mssfix
+	mss_parms.parse(opt);
+
 	// keepalive, ping, ping-restart
 	{
 	  const Option *o = opt.get_ptr("keepalive");
@@ -802,6 +1068,7 @@ namespace openvpn {
 		    break;
 		  }
 		case DATA_V2:
+		case DATA_FEC_V1:
 		  {
 		    if (unlikely(buf.size() < 4))
 		      return;
@@ -870,6 +1137,8 @@ namespace openvpn {
 	  return "DATA_V1";
 	case DATA_V2:
 	  return "DATA_V2";
+	case DATA_FEC_V1:
+	  return "DATA_FEC_V1";
 	case CONTROL_HARD_RESET_CLIENT_V2:
 	  return "CONTROL_HARD_RESET_CLIENT_V2";
 	case CONTROL_HARD_RESET_SERVER_V2:
@@ -913,6 +1182,17 @@ namespace openvpn {
 		pid.read(b, PacketID::LONG_FORM);
 		out << " PID=" << pid.str();
 	      }
+	    else if (use_tls_crypt)
+	      {
+		PacketID pid;
+		pid.read(b, PacketID::LONG_FORM);
+		out << " PID=" << pid.str();
+
+		const unsigned char *tag = b.read_alloc(hmac_size);
+		out << " TAG=" << render_hex(tag, hmac_size);
+		out << " ENCRYPTED SIZE=" << b.size() << '/' << orig_size;
+		return out.str();
+	      }
 
 	    ReliableAck ack(0);
 	    ack.read(b);
@@ -954,6 +1234,41 @@ namespace openvpn {
     }
 #endif
 
+    // Authenticate and decrypt a tls-crypt control packet.  On success,
+    // hdr holds the decoded header and work the cleartext following it.
+    static Error::Type tls_crypt_unwrap(TLSCryptInstance& tls_crypt,
+					const size_t tag_size,
+					const Frame& frame,
+					const Buffer& recv,
+					ControlHeader& hdr,
+					BufferAllocated& work,
+					const bool is_ack)
+    {
+      const size_t data_offset = ControlHeader::TLS_CRYPT_HEAD_SIZE + tag_size;
+      if (!hdr.parse_tls_crypt_head(recv) || recv.size() < data_offset)
+	return Error::BUFFER_ERROR;
+      const unsigned char *data = recv.c_data();
+      const size_t size = recv.size() - data_offset;
+
+      // decrypt tail, the IV is the head of the tag
+      frame.prepare(Frame::DECRYPT_WORK, work);
+      if (work.max_size() < size)
+	return Error::BUFFER_ERROR;
+      if (tls_crypt.decrypt(data + ControlHeader::TLS_CRYPT_HEAD_SIZE,
+			    work.data(), work.max_size(),
+			    data + data_offset, size) != size)
+	return Error::DECRYPT_ERROR;
+      work.set_size(size);
+
+      // verify tag over cleartext head and decrypted tail
+      if (!tls_crypt.hmac_cmp(data, ControlHeader::TLS_CRYPT_HEAD_SIZE, work.c_data(), size))
+	return Error::HMAC_ERROR;
+
+      if (!hdr.parse_tail(work, is_ack))
+	return Error::BUFFER_ERROR;
+      return Error::SUCCESS;
+    }
+
   protected:
 
     // used for reading/writing authentication strings (username, password, etc.)
@@ -1027,10 +1342,30 @@ namespace openvpn {
       return S();
     }
 
+    template <typename S>
+    static S read_control_string(const BufferRope& rope)
+    {
+      size_t size = rope.size();
+      if (size && rope.chunks().back()->back() == 0)
+	--size;
+      return rope.to_string<S>(0, size);
+    }
+
+    // Messages larger than an SSL cleartext frame are sent as a rope
+    // of frame-sized chunks rather than as one contiguous buffer.
     template <typename S>
     void write_control_string(const S& str)
     {
       const size_t len = str.length();
+      const size_t chunk = (*config->frame)[Frame::WRITE_SSL_CLEARTEXT].payload();
+      if (chunk && len + 1 > chunk)
+	{
+	  BufferRope rope(chunk);
+	  rope.write((const unsigned char *)str.c_str(), len);
+	  rope.push_back(0);
+	  control_send(std::move(rope));
+	  return;
+	}
       BufferPtr bp = new BufferAllocated(len+1, 0);
       write_control_string(str, *bp);
       control_send(std::move(bp));
@@ -1116,10 +1451,11 @@ namespace openvpn {
       // for example if cipher/digest are pushed.
       struct DataChannelKey
       {
-	DataChannelKey() : rekey_defined(false) {}
+	DataChannelKey() : rekey_defined(false), derived(false) {}
 
 	OpenVPNStaticKey key;
 	bool rekey_defined;
+	bool derived;     // key is set, see derive_session_key()
 	CryptoDCInstance::RekeyType rekey_type;
       };
 
@@ -1221,14 +1557,22 @@ namespace openvpn {
 	  crypto_flags(0),
 	  dirty(0),
 	  key_limit_renegotiation_fired(false),
+	  renegotiate_deferred(false),
+	  decrypt_seen(false),
 	  is_reliable(p.config->protocol.is_reliable()),
 	  tlsprf(p.config->tlsprf_factory->new_obj(p.is_server()))
       {
+	// receive window may be larger than our send window
+	rel_recv.init(std::max(p.config->reliable_window, p.config->reliable_recv_window));
+	rel_send.set_adaptive_rto(p.config->reliable_adaptive_rto);
+	Base::set_ack_delay(p.config->ack_delay);
+
 	// get key_id from parent
 	key_id_ = proto.next_key_id();
 
 	// set initial state
 	set_state((proto.is_server() ? S_INITIAL : C_INITIAL) + (initiator ? 0 : 1));
+	OPENVPN_USDT3(handshake_start, &proto, key_id_, initiator);
 
 	// cache stuff that we need to access in hot path
 	cache_op32();
@@ -1263,6 +1607,23 @@ namespace openvpn {
 	  }
       }
 
+      bool ssl_async_pending() const
+      {
+	return Base::ssl_async_pending();
+      }
+
+      void ssl_async_fds(std::vector<int>& fds) const
+      {
+	Base::ssl_async_fds(fds);
+      }
+
+      // resume handshake parked on an async SSL operation
+      void ssl_async_resume()
+      {
+	Base::ssl_async_resume();
+	dirty = true;
+      }
+
       void invalidate(const Error::Type reason)
       {
 	Base::invalidate(reason);
@@ -1304,6 +1665,16 @@ namespace openvpn {
 	  app_pre_write_queue.push_back(bp);
       }
 
+      // Send a message chunk by chunk.  The peer reassembles it up to
+      // the terminating null, as it would a message split by SSL.
+      void app_send(BufferRope&& rope)
+      {
+	if (rope.size() > APP_MSG_MAX)
+	  throw proto_error("app_send: sent control message is too large");
+	for (auto &bp : rope.release())
+	  app_send(std::move(bp));
+      }
+
       // pass received ciphertext packets on network to SSL/reliability layers
       bool net_recv(Packet&& pkt)
       {
@@ -1312,6 +1683,25 @@ namespace openvpn {
 	return ret;
       }
 
+      // release buffers held between packets (see ProtoContext::compact)
+      void compact()
+      {
+	Base::compact();
+	if (crypto)
+	  crypto->compact();
+	if (compress)
+	  compress->compact();
+      }
+
+      void memory_usage(MemUsage& mu) const
+      {
+	Base::memory_usage(mu);
+	if (crypto)
+	  crypto->memory_usage(mu);
+	if (compress)
+	  compress->memory_usage(mu);
+      }
+
       // data channel encrypt
       void encrypt(BufferAllocated& buf)
       {
@@ -1333,6 +1723,23 @@ namespace openvpn {
 	  buf.reset_size(); // no crypto context available
       }
 
+      // data channel encrypt of a burst of packets
+      void encrypt_batch(BufferAllocated** bufs, const size_t n)
+      {
+	if (state >= ACTIVE
+	    && (crypto_flags & CryptoDCInstance::CRYPTO_DEFINED)
+	    && !invalidated())
+	  {
+	    if (do_encrypt_batch(bufs, n))
+	      schedule_key_limit_renegotiation();
+	  }
+	else
+	  {
+	    for (size_t i = 0; i < n; ++i)
+	      bufs[i]->reset_size(); // no crypto context available
+	  }
+      }
+
       // data channel decrypt
       void decrypt(BufferAllocated& buf)
       {
@@ -1348,13 +1755,24 @@ namespace openvpn {
 	      buf.advance(head_size);
 
 	      // decrypt packet
-	      const Error::Type err = crypto->decrypt(buf, now->seconds_since_epoch(), op32);
+	      Error::Type err;
+	      {
+		OPENVPN_PERF_TIMER(proto.stats, DECRYPT);
+		err = dc_decrypt(buf, now->seconds_since_epoch(), op32);
+	      }
 	      if (err)
 		{
 		  proto.stats->error(err);
 		  if (proto.is_tcp() && (err == Error::DECRYPT_ERROR || err == Error::HMAC_ERROR))
 		    invalidate(err);
 		}
+	      else
+		{
+		  proto.rx_seq_key = key_id_;
+		  proto.rx_seq_pid = crypto->rx_packet_id();
+		  if (unlikely(!decrypt_seen) && buf.size())
+		    first_decrypt();
+		}
 
 	      // trigger renegotiation if we hit decrypt data limit
 	      if (data_limit)
@@ -1362,7 +1780,10 @@ namespace openvpn {
 
 	      // decompress packet
 	      if (compress)
-		compress->decompress(buf);
+		{
+		  OPENVPN_PERF_TIMER(proto.stats, DECOMPRESS);
+		  compress->decompress(buf);
+		}
 	    }
 	  else
 	    buf.reset_size(); // no crypto context available
@@ -1376,6 +1797,20 @@ namespace openvpn {
 	  }
       }
 
+      // True if decrypt() leaves the cleartext in the storage of buf.
+      bool decrypt_in_place() const
+      {
+	return crypto && crypto->decrypt_in_place() && !compress;
+      }
+
+      // True if decrypting a packet cannot change the key schedule:
+      // the key has already decrypted a packet (see first_decrypt) and
+      // has no data limit.
+      bool decrypt_quiet() const
+      {
+	return decrypt_seen && !data_limit;
+      }
+
       // usually called by parent ProtoContext object when this KeyContext
       // has been retired.
       void prepare_expire(const EventType current_ev = KeyContext::KEV_NONE)
@@ -1452,6 +1887,36 @@ namespace openvpn {
       // time that our state transitioned to ACTIVE
       Time reached_active() const { return reached_active_time_; }
 
+      // transmit a PMTU probe or ack, padded to size bytes before encryption
+      void send_pmtud_message(const PMTUDiscovery::Type type, const std::uint32_t seq, const size_t size)
+      {
+	if (state >= ACTIVE
+	    && (crypto_flags & CryptoDCInstance::CRYPTO_DEFINED)
+	    && !invalidated())
+	  {
+	    Packet pkt;
+	    pkt.frame_prepare(*proto.config->frame, Frame::WRITE_DC_MSG);
+	    PMTUDiscovery::write_message(*pkt.buf, type, seq, size);
+	    do_encrypt(*pkt.buf, false); // set compress hint to "no"
+	    proto.net_send(key_id_, pkt);
+	  }
+      }
+
+      // transmit a latency probe or echo
+      void send_latprobe_message(const LatencyProbe::Type type, const std::uint32_t seq, const std::uint64_t ts)
+      {
+	if (state >= ACTIVE
+	    && (crypto_flags & CryptoDCInstance::CRYPTO_DEFINED)
+	    && !invalidated())
+	  {
+	    Packet pkt;
+	    pkt.frame_prepare(*proto.config->frame, Frame::WRITE_DC_MSG);
+	    LatencyProbe::write_message(*pkt.buf, type, seq, ts);
+	    do_encrypt(*pkt.buf, false); // set compress hint to "no"
+	    proto.net_send(key_id_, pkt);
+	  }
+      }
+
       // transmit a keepalive message to peer
       void send_keepalive()
       {
@@ -1499,70 +1964,43 @@ namespace openvpn {
       {
 	try {
 	  Buffer recv(net_buf);
-	  if (proto.use_tls_auth)
-	    {
-	      const unsigned char *orig_data = recv.data();
-	      const size_t orig_size = recv.size();
-
-	      // advance buffer past initial op byte
-	      recv.advance(1);
-
-	      // get source PSID
-	      ProtoSessionID src_psid(recv);
-
-	      // verify HMAC
-	      {
-		recv.advance(proto.hmac_size);
-		if (!proto.ta_hmac_recv->ovpn_hmac_cmp(orig_data, orig_size,
-						       1 + ProtoSessionID::SIZE,
-						       proto.hmac_size,
-						       PacketID::size(PacketID::LONG_FORM)))
-		  return false;
-	      }
+	  ControlHeader hdr;
 
-	      // verify source PSID
-	      if (!proto.psid_peer.match(src_psid))
+	  if (proto.use_tls_crypt)
+	    {
+	      // authenticate and decrypt, don't require MSG_ID
+	      if (tls_crypt_unwrap(*proto.tls_crypt_recv, proto.hmac_size, *proto.config->frame,
+				   recv, hdr, proto.tls_crypt_work, true) != Error::SUCCESS)
 		return false;
-
-	      // read tls_auth packet ID
-	      const PacketID pid = proto.ta_pid_recv.read_next(recv);
-
-	      // get current time_t
-	      const PacketID::time_t t = now->seconds_since_epoch();
-
-	      // verify tls_auth packet ID
-	      const bool pid_ok = proto.ta_pid_recv.test_add(pid, t, false);
-
-	      // make sure that our own PSID is contained in packet received from peer
-	      if (ReliableAck::ack_skip(recv))
-		{
-		  ProtoSessionID dest_psid(recv);
-		  if (!proto.psid_self.match(dest_psid))
-		    return false;
-		}
-
-	      return pid_ok;
 	    }
 	  else
 	    {
-	      // advance buffer past initial op byte
-	      recv.advance(1);
+	      // verify HMAC
+	      if (proto.use_tls_auth
+		  && !proto.ta_hmac_recv->ovpn_hmac_cmp(recv.c_data(), recv.size(),
+							1 + ProtoSessionID::SIZE,
+							proto.hmac_size,
+							PacketID::size(PacketID::LONG_FORM)))
+		return false;
 
-	      // verify source PSID
-	      ProtoSessionID src_psid(recv);
-	      if (!proto.psid_peer.match(src_psid))
+	      // decode header up to the ACK list, don't require MSG_ID
+	      if (!hdr.parse(recv, proto.hmac_size, proto.use_tls_auth, true))
 		return false;
+	    }
 
-	      // make sure that our own PSID is contained in packet received from peer
-	      if (ReliableAck::ack_skip(recv))
-		{
-		  ProtoSessionID dest_psid(recv);
-		  if (!proto.psid_self.match(dest_psid))
-		    return false;
-		}
+	  // verify source PSID
+	  if (!proto.psid_peer.match(hdr.src_psid()))
+	    return false;
 
-	      return true;
-	    }
+	  // verify tls_auth/tls_crypt packet ID
+	  const bool pid_ok = !(proto.use_tls_auth || proto.use_tls_crypt)
+	    || proto.ta_pid_recv.test_add(hdr.pid(), now->seconds_since_epoch(), false);
+
+	  // make sure that our own PSID is contained in packet received from peer
+	  if (hdr.n_acks() && !proto.psid_self.match(hdr.dest_psid()))
+	    return false;
+
+	  return pid_ok;
 	}
 	catch (BufferException&)
 	  {
@@ -1576,8 +2014,11 @@ namespace openvpn {
 	// set up crypto for data channel
 	if (data_channel_key)
 	  {
+	    if (!data_channel_key->derived)
+	      derive_session_key(*data_channel_key);
+
 	    bool enable_compress = true;
-	    Config& c = *proto.config;
+	    Config& c = proto.mutable_conf(); // dc caches its context
 	    const unsigned int key_dir = proto.is_server() ? OpenVPNStaticKey::INVERSE : OpenVPNStaticKey::NORMAL;
 	    const OpenVPNStaticKey& key = data_channel_key->key;
 
@@ -1594,6 +2035,9 @@ namespace openvpn {
 	    // build crypto context for data channel encryption/decryption
 	    crypto = c.dc.context().new_obj(key_id_);
 	    crypto_flags = crypto->defined();
+#ifdef OPENVPN_FIXED_DC_AEAD
+	    crypto_fixed = fixed_crypto_dc(crypto.get());
+#endif
 
 	    if (crypto_flags & CryptoDCInstance::CIPHER_DEFINED)
 	      crypto->init_cipher(key.slice(OpenVPNStaticKey::CIPHER | OpenVPNStaticKey::ENCRYPT | key_dir),
@@ -1603,12 +2047,18 @@ namespace openvpn {
 	      crypto->init_hmac(key.slice(OpenVPNStaticKey::HMAC | OpenVPNStaticKey::ENCRYPT | key_dir),
 				key.slice(OpenVPNStaticKey::HMAC | OpenVPNStaticKey::DECRYPT | key_dir));
 
-	    crypto->init_pid(PacketID::SHORT_FORM,
+	    crypto->init_pid(c.data_pid_form(),
 			     c.pid_mode,
-			     PacketID::SHORT_FORM,
+			     c.data_pid_form(),
 			     "DATA", int(key_id_),
 			     proto.stats);
 
+	    if (c.key_epoch_enabled()
+		&& !crypto->init_epoch(c.key_epoch_bits, c.key_epoch_period,
+				       key.slice(OpenVPNStaticKey::CIPHER | OpenVPNStaticKey::ENCRYPT | key_dir),
+				       key.slice(OpenVPNStaticKey::CIPHER | OpenVPNStaticKey::DECRYPT | key_dir)))
+	      throw proto_error("data channel does not support key-epoch");
+
 	    enable_compress = crypto->consider_compression(proto.config->comp_ctx);
 
 	    if (data_channel_key->rekey_defined)
@@ -1634,13 +2084,47 @@ namespace openvpn {
       }
 
     private:
+      // Data channel crypto calls.  With OPENVPN_FIXED_DC_AEAD, keys
+      // using the fixed implementation bypass virtual dispatch.
+      bool dc_encrypt(BufferAllocated& buf, const PacketID::time_t now, const unsigned char *op32)
+      {
+#ifdef OPENVPN_FIXED_DC_AEAD
+	if (likely(crypto_fixed != nullptr))
+	  return crypto_fixed->FixedCryptoDC::encrypt(buf, now, op32);
+#endif
+	return crypto->encrypt(buf, now, op32);
+      }
+
+      bool dc_encrypt_batch(BufferAllocated** bufs, const size_t n, const PacketID::time_t now, const unsigned char *op32)
+      {
+#ifdef OPENVPN_FIXED_DC_AEAD
+	if (likely(crypto_fixed != nullptr))
+	  return crypto_fixed->FixedCryptoDC::encrypt_batch(bufs, n, now, op32);
+#endif
+	return crypto->encrypt_batch(bufs, n, now, op32);
+      }
+
+      Error::Type dc_decrypt(BufferAllocated& buf, const PacketID::time_t now, const unsigned char *op32)
+      {
+#ifdef OPENVPN_FIXED_DC_AEAD
+	if (likely(crypto_fixed != nullptr))
+	  return crypto_fixed->FixedCryptoDC::decrypt(buf, now, op32);
+#endif
+	return crypto->decrypt(buf, now, op32);
+      }
+
       bool do_encrypt(BufferAllocated& buf, const bool compress_hint)
       {
 	bool pid_wrap;
 
 	// compress packet
 	if (compress)
-	  compress->compress(buf, compress_hint);
+	  {
+	    OPENVPN_PERF_TIMER(proto.stats, COMPRESS);
+	    compress->compress(buf, compress_hint);
+	  }
+
+	OPENVPN_PERF_TIMER(proto.stats, ENCRYPT);
 
 	// trigger renegotiation if we hit encrypt data limit
 	if (data_limit)
@@ -1653,7 +2137,7 @@ namespace openvpn {
 	    static_assert(sizeof(op32) == OP_SIZE_V2, "OP_SIZE_V2 inconsistency");
 
 	    // encrypt packet
-	    pid_wrap = crypto->encrypt(buf, now->seconds_since_epoch(), (const unsigned char *)&op32);
+	    pid_wrap = dc_encrypt(buf, now->seconds_since_epoch(), (const unsigned char *)&op32);
 
 	    // prepend op
 	    buf.prepend((const unsigned char *)&op32, sizeof(op32));
@@ -1661,7 +2145,7 @@ namespace openvpn {
 	else
 	  {
 	    // encrypt packet
-	    pid_wrap = crypto->encrypt(buf, now->seconds_since_epoch(), nullptr);
+	    pid_wrap = dc_encrypt(buf, now->seconds_since_epoch(), nullptr);
 
 	    // prepend op
 	    buf.push_front(op_compose(DATA_V1, key_id_));
@@ -1669,6 +2153,40 @@ namespace openvpn {
 	return pid_wrap;
       }
 
+      bool do_encrypt_batch(BufferAllocated** bufs, const size_t n)
+      {
+	OPENVPN_PERF_BATCH(proto.stats, ENCRYPT_BATCH, n);
+	for (size_t i = 0; i < n; ++i)
+	  {
+	    BufferAllocated& buf = *bufs[i];
+	    if (compress)
+	      {
+		OPENVPN_PERF_TIMER(proto.stats, COMPRESS);
+		compress->compress(buf, true);
+	      }
+	    if (data_limit)
+	      data_limit_add(DataLimit::Encrypt, buf.size());
+	  }
+
+	OPENVPN_PERF_TIMER(proto.stats, ENCRYPT);
+	bool pid_wrap;
+	if (enable_op32)
+	  {
+	    const std::uint32_t op32 = htonl(op32_compose(DATA_V2, key_id_, remote_peer_id));
+	    pid_wrap = dc_encrypt_batch(bufs, n, now->seconds_since_epoch(), (const unsigned char *)&op32);
+	    for (size_t i = 0; i < n; ++i)
+	      bufs[i]->prepend((const unsigned char *)&op32, sizeof(op32));
+	  }
+	else
+	  {
+	    pid_wrap = dc_encrypt_batch(bufs, n, now->seconds_since_epoch(), nullptr);
+	    const unsigned char op = op_compose(DATA_V1, key_id_);
+	    for (size_t i = 0; i < n; ++i)
+	      bufs[i]->push_front(op);
+	  }
+	return pid_wrap;
+      }
+
       // cache op32 and remote_peer_id
       void cache_op32()
       {
@@ -1679,6 +2197,7 @@ namespace openvpn {
       void set_state(const int newstate)
       {
 	OPENVPN_LOG_PROTO_VERBOSE(proto.debug_prefix() << " KeyContext[" << key_id_ << "] " << state_string(state) << " -> " << state_string(newstate));
+	OPENVPN_USDT4(key_state, &proto, key_id_, state, newstate);
 	state = newstate;
       }
 
@@ -1750,6 +2269,23 @@ namespace openvpn {
 	  set_event(KEV_NONE, KEV_BECOME_PRIMARY, *now + Time::Duration::seconds(1));
       }
 
+      // Once the peer transmits on a new secondary key, it has the key
+      // installed, so we can switch to it too instead of waiting out
+      // become_primary.  Both keys stay usable for receive until the
+      // old primary expires, so in-flight packets on either key land.
+      void first_decrypt()
+      {
+	decrypt_seen = true;
+	if (proto.config->become_primary_on_decrypt
+	    && key_id_
+	    && next_event == KEV_BECOME_PRIMARY
+	    && next_event_time > *now)
+	  {
+	    OPENVPN_LOG_PROTO_VERBOSE(proto.debug_prefix() << " KeyContext[" << key_id_ << "] first decrypt, become primary now");
+	    next_event_time = *now;
+	  }
+      }
+
       // Should we enter KEV_PRIMARY_PENDING state?  Do it if:
       // 1. we are a client,
       // 2. data limit is enabled,
@@ -1766,6 +2302,42 @@ namespace openvpn {
 	return *now + (proto.config->handshake_window * 2);
       }
 
+      // Time after construction to start renegotiating this key,
+      // pulled in by a random part of reneg_jitter.
+      Time::Duration renegotiate_after() const
+      {
+	const Config& c = *proto.config;
+	if (!c.reneg_jitter.defined())
+	  return c.renegotiate;
+	return c.renegotiate - Time::Duration::binary_ms(c.prng->randrange<Time::type>(c.reneg_jitter.raw() + 1));
+      }
+
+      // Hold back a scheduled renegotiation while the parent is busy
+      // (see ProtoContext::defer_renegotiation), but never one fired
+      // by a data limit, and never beyond the point where the new key
+      // could no longer become primary before this one expires.
+      bool renegotiate_defer()
+      {
+	const Config& c = *proto.config;
+	if (key_limit_renegotiation_fired
+	    || *now + c.handshake_window + c.become_primary >= construct_time + c.expire
+	    || !proto.defer_renegotiation())
+	  return false;
+	if (!renegotiate_deferred)
+	  {
+	    renegotiate_deferred = true;
+	    proto.stats->error(Error::N_RENEG_DEFER);
+	  }
+	return true;
+      }
+
+      // retry a deferred renegotiation in 1 to 2 seconds, so that
+      // deferred sessions don't all come back together
+      Time::Duration renegotiate_retry() const
+      {
+	return Time::Duration::milliseconds(1000 + proto.config->prng->randrange<unsigned int>(1000));
+      }
+
       void active_event()
       {
 	set_event(KEV_ACTIVE, KEV_BECOME_PRIMARY, reached_active() + proto.config->become_primary);
@@ -1781,9 +2353,14 @@ namespace openvpn {
 		if (data_limit_defer())
 		  set_event(KEV_NONE, KEV_PRIMARY_PENDING, data_limit_expire());
 		else
-		  set_event(KEV_BECOME_PRIMARY, KEV_RENEGOTIATE, construct_time + proto.config->renegotiate);
+		  set_event(KEV_BECOME_PRIMARY, KEV_RENEGOTIATE, construct_time + renegotiate_after());
 		break;
 	      case KEV_RENEGOTIATE:
+		if (renegotiate_defer())
+		  set_event(KEV_NONE, KEV_RENEGOTIATE, *now + renegotiate_retry());
+		else
+		  prepare_expire(next_event);
+		break;
 	      case KEV_RENEGOTIATE_FORCE:
 		prepare_expire(next_event);
 		break;
@@ -1869,7 +2446,7 @@ namespace openvpn {
 	  case S_WAIT_AUTH_ACK: // rare case where client receives auth, goes ACTIVE, but the ACK response is dropped
 	  case ACTIVE:
 	    if (bcc.advance_to_null()) // does composed buffer contain terminating null char?
-	      proto.app_recv(key_id_, bcc.get());
+	      proto.app_recv(key_id_, bcc.get_rope());
 	    break;
 	  }
       }
@@ -1984,28 +2561,44 @@ namespace openvpn {
 	  }
 	reached_active_time_ = *now;
 	proto.slowest_handshake_.max(reached_active_time_ - construct_time);
+	OPENVPN_USDT3(handshake_done, &proto, key_id_, (reached_active_time_ - construct_time).to_milliseconds());
 	active_event();
       }
 
-      // use the TLS PRF construction to exchange session keys for building
-      // the data channel crypto context
+      // Set up the session keys for building the data channel crypto
+      // context.  With dc_deferred they are only derived once the pushed
+      // options, which select the key derivation method, are known.
       void generate_session_keys()
       {
 	std::unique_ptr<DataChannelKey> dck(new DataChannelKey());
-	tlsprf->generate_key_expansion(dck->key, proto.psid_self, proto.psid_peer);
-	OPENVPN_LOG_PROTO_VERBOSE(proto.debug_prefix() << " KEY " << proto.mode().str() << ' ' << dck->key.render());
-	tlsprf->erase();
 	dck.swap(data_channel_key);
 	if (!proto.dc_deferred)
 	  init_data_channel();
       }
 
-      // generate message head
-      void gen_head(const unsigned int opcode, Buffer& buf)
+      // derive session keys with the TLS keying material exporter if
+      // negotiated, else with the TLS PRF construction
+      void derive_session_key(DataChannelKey& dck)
       {
-	if (proto.use_tls_auth)
+	if (proto.config->tls_ekm)
 	  {
-	    // write tls-auth packet ID
+	    if (!Base::export_key_material(dck.key.raw_alloc(), OpenVPNStaticKey::KEY_SIZE,
+					   "EXPORTER-OpenVPN-datakeys"))
+	      throw proto_error("TLS keying material export failed");
+	  }
+	else
+	  tlsprf->generate_key_expansion(dck.key, proto.psid_self, proto.psid_peer);
+	OPENVPN_LOG_PROTO_VERBOSE(proto.debug_prefix() << " KEY " << proto.mode().str() << ' ' << dck.key.render());
+	tlsprf->erase();
+	dck.derived = true;
+      }
+
+      // generate message head
+      void gen_head(const unsigned int opcode, Buffer& buf)
+      {
+	if (proto.use_tls_auth)
+	  {
+	    // write tls-auth packet ID
 	    proto.ta_pid_send.write_next(buf, true, now->seconds_since_epoch());
 
 	    // make space for tls-auth HMAC
@@ -2023,6 +2616,32 @@ namespace openvpn {
 					      proto.hmac_size,
 					      PacketID::size(PacketID::LONG_FORM));
 	  }
+	else if (proto.use_tls_crypt)
+	  {
+	    // buf holds the tail (ACKs, message ID, payload) to be encrypted
+	    const size_t tail_size = buf.size();
+
+	    // make space for tls-crypt tag
+	    buf.prepend_alloc(proto.hmac_size);
+
+	    // write tls-crypt packet ID
+	    proto.ta_pid_send.write_next(buf, true, now->seconds_since_epoch());
+
+	    // write source PSID
+	    proto.psid_self.prepend(buf);
+
+	    // write opcode
+	    buf.push_front(op_compose(opcode, key_id_));
+
+	    // tag the cleartext, then encrypt the tail in place using
+	    // the head of the tag as IV
+	    unsigned char *head = buf.data();
+	    unsigned char *tail = head + ControlHeader::TLS_CRYPT_HEAD_SIZE + proto.hmac_size;
+	    proto.tls_crypt_send->hmac_gen(head, ControlHeader::TLS_CRYPT_HEAD_SIZE, tail, tail_size);
+	    if (proto.tls_crypt_send->encrypt(head + ControlHeader::TLS_CRYPT_HEAD_SIZE,
+					      tail, tail_size, tail, tail_size) != tail_size)
+	      throw proto_error("tls_crypt_encrypt");
+	  }
 	else
 	  {
 	    // write source PSID
@@ -2070,9 +2689,8 @@ namespace openvpn {
 	return true;
       }
 
-      bool verify_dest_psid(Buffer& buf)
+      bool verify_dest_psid(const ProtoSessionID& dest_psid)
       {
-	ProtoSessionID dest_psid(buf);
 	if (!proto.psid_self.match(dest_psid))
 	  {
 	    proto.stats->error(Error::CC_ERROR);
@@ -2101,63 +2719,66 @@ namespace openvpn {
       {
 	try {
 	  Buffer& recv = *pkt.buf;
+	  ControlHeader hdr;
+	  const bool is_ack = (pkt.opcode == ACK_V1);
 
-	  if (proto.use_tls_auth)
+	  if (proto.use_tls_auth || proto.use_tls_crypt)
 	    {
-	      const unsigned char *orig_data = recv.data();
-	      const size_t orig_size = recv.size();
-
-	      // advance buffer past initial op byte
-	      recv.advance(1);
-
-	      // get source PSID
-	      ProtoSessionID src_psid(recv);
-
-	      // verify HMAC
-	      {
-		recv.advance(proto.hmac_size);
-		if (!proto.ta_hmac_recv->ovpn_hmac_cmp(orig_data, orig_size,
-						       1 + ProtoSessionID::SIZE,
-						       proto.hmac_size,
-						       PacketID::size(PacketID::LONG_FORM)))
-		  {
-		    proto.stats->error(Error::HMAC_ERROR);
-		    if (proto.is_tcp())
-		      invalidate(Error::HMAC_ERROR);
-		    return false;
-		  }      
-	      }
+	      if (proto.use_tls_crypt)
+		{
+		  // authenticate and decrypt, then continue with the
+		  // cleartext payload in place of the packet
+		  const Error::Type err = tls_crypt_unwrap(*proto.tls_crypt_recv, proto.hmac_size, *proto.config->frame,
+							   recv, hdr, proto.tls_crypt_work, is_ack);
+		  if (err != Error::SUCCESS)
+		    return decapsulate_error(err);
+		  pkt.buf->swap(proto.tls_crypt_work);
+		}
+	      else
+		{
+		  // verify HMAC
+		  if (!proto.ta_hmac_recv->ovpn_hmac_cmp(recv.c_data(), recv.size(),
+							 1 + ProtoSessionID::SIZE,
+							 proto.hmac_size,
+							 PacketID::size(PacketID::LONG_FORM)))
+		    return decapsulate_error(Error::HMAC_ERROR);
+
+		  // decode the rest of the header in one pass
+		  if (!hdr.parse(recv, proto.hmac_size, true, is_ack))
+		    return decapsulate_error(Error::BUFFER_ERROR);
+		}
 
 	      // update our last-packet-received time
 	      proto.update_last_received();
 
 	      // verify source PSID
-	      if (!verify_src_psid(src_psid))
+	      if (!verify_src_psid(hdr.src_psid()))
 		return false;
 
-	      // read tls_auth packet ID
-	      const PacketID pid = proto.ta_pid_recv.read_next(recv);
-
 	      // get current time_t
 	      const PacketID::time_t t = now->seconds_since_epoch();
 
 	      // verify tls_auth packet ID
+	      const PacketID& pid = hdr.pid();
 	      const bool pid_ok = proto.ta_pid_recv.test_add(pid, t, false);
 
 	      // process ACKs sent by peer (if packet ID check failed,
-	      // read the ACK IDs, but don't modify the rel_send object).
-	      if (ReliableAck::ack(rel_send, recv, pid_ok))
+	      // don't modify the rel_send object).
+	      if (hdr.n_acks())
 		{
+		  if (pid_ok)
+		    hdr.ack(rel_send, *now);
+
 		  // make sure that our own PSID is contained in packet received from peer
-		  if (!verify_dest_psid(recv))
+		  if (!verify_dest_psid(hdr.dest_psid()))
 		    return false;
 		}
 
 	      // for CONTROL packets only, not ACK
-	      if (pkt.opcode != ACK_V1)
+	      if (!is_ack)
 		{
 		  // get message sequence number
-		  const id_t id = ReliableAck::read_id(recv);
+		  const id_t id = hdr.msg_id();
 
 		  if (pid_ok)
 		    {
@@ -2195,27 +2816,29 @@ namespace openvpn {
 	      // update our last-packet-received time
 	      proto.update_last_received();
 
-	      // advance buffer past initial op byte
-	      recv.advance(1);
+	      // decode header in one pass
+	      if (!hdr.parse(recv, 0, false, is_ack))
+		return decapsulate_error(Error::BUFFER_ERROR);
 
 	      // verify source PSID
-	      ProtoSessionID src_psid(recv);
-	      if (!verify_src_psid(src_psid))
+	      if (!verify_src_psid(hdr.src_psid()))
 		return false;
 
 	      // process ACKs sent by peer
-	      if (ReliableAck::ack(rel_send, recv, true))
+	      if (hdr.n_acks())
 		{
+		  hdr.ack(rel_send, *now);
+
 		  // make sure that our own PSID is in packet received from peer
-		  if (!verify_dest_psid(recv))
+		  if (!verify_dest_psid(hdr.dest_psid()))
 		    return false;
 		}
 
 	      // for CONTROL packets only, not ACK
-	      if (pkt.opcode != ACK_V1)
+	      if (!is_ack)
 		{
 		  // get message sequence number
-		  const id_t id = ReliableAck::read_id(recv);
+		  const id_t id = hdr.msg_id();
 
 		  // try to push message into reliable receive object
 		  const unsigned int rflags = rel_recv.receive(pkt, id);
@@ -2232,13 +2855,19 @@ namespace openvpn {
 	}
 	catch (BufferException&)
 	  {
-	    proto.stats->error(Error::BUFFER_ERROR);
-	    if (proto.is_tcp())
-	      invalidate(Error::BUFFER_ERROR);
+	    decapsulate_error(Error::BUFFER_ERROR);
 	  }
 	return false;
       }
 
+      bool decapsulate_error(const Error::Type err)
+      {
+	proto.stats->error(err);
+	if (proto.is_tcp())
+	  invalidate(err);
+	return false;
+      }
+
       void generate_ack(Packet& pkt) // called by ProtoStackBase
       {
 	Buffer& buf = *pkt.buf;
@@ -2302,9 +2931,14 @@ namespace openvpn {
       bool enable_op32;
       bool dirty;
       bool key_limit_renegotiation_fired;
+      bool renegotiate_deferred;
+      bool decrypt_seen;
       bool is_reliable;
       Compress::Ptr compress;
       CryptoDCInstance::Ptr crypto;
+#ifdef OPENVPN_FIXED_DC_AEAD
+      FixedCryptoDC* crypto_fixed = nullptr; // crypto, if it is the fixed implementation
+#endif
       TLSPRFInstance::Ptr tlsprf;
       Time construct_time;
       Time reached_active_time_;
@@ -2319,8 +2953,54 @@ namespace openvpn {
 
   public:
 
+    // Stateless screen for initial packets from unknown peers, run
+    // before any session state is allocated.
+    class PreValidate : public RC<thread_unsafe_refcount>
+    {
+    public:
+      typedef RCPtr<PreValidate> Ptr;
+
+      virtual bool validate(const Buffer& net_buf) = 0;
+
+      // Validate a batch of initial packets, setting ok[i] for each
+      // and returning the number of valid packets.  The opcode screen
+      // runs over the whole batch first, so MACs are only computed
+      // for packets that could possibly be a hard reset.
+      size_t validate_batch(const Buffer* const* bufs, const size_t n, bool* ok)
+      {
+	for (size_t i = 0; i < n; ++i)
+	  ok[i] = is_reset(*bufs[i]);
+	size_t n_ok = 0;
+	for (size_t i = 0; i < n; ++i)
+	  if (ok[i])
+	    {
+	      ok[i] = validate(*bufs[i]);
+	      n_ok += ok[i];
+	    }
+	return n_ok;
+      }
+
+    protected:
+      PreValidate(const bool server)
+	: reset_op(server ? CONTROL_HARD_RESET_CLIENT_V2 : CONTROL_HARD_RESET_SERVER_V2)
+      {
+      }
+
+      // is packet the hard reset op we expect to receive from peer?
+      bool is_reset(const Buffer& net_buf) const
+      {
+	if (!net_buf.size())
+	  return false;
+	const unsigned int op = net_buf[0];
+	return opcode_extract(op) == reset_op && key_id_extract(op) == 0;
+      }
+
+    private:
+      unsigned int reset_op;
+    };
+
     // Validate the integrity of a packet, only considering tls-auth HMAC.
-    class TLSAuthPreValidate : public RC<thread_unsafe_refcount>
+    class TLSAuthPreValidate : public PreValidate
     {
     public:
       typedef RCPtr<TLSAuthPreValidate> Ptr;
@@ -2328,6 +3008,7 @@ namespace openvpn {
       OPENVPN_SIMPLE_EXCEPTION(tls_auth_pre_validate);
 
       TLSAuthPreValidate(const Config& c, const bool server)
+	: PreValidate(server)
       {
 	if (!c.tls_auth_enabled())
 	  throw tls_auth_pre_validate();
@@ -2335,9 +3016,6 @@ namespace openvpn {
 	// init OvpnHMACInstance
 	ta_hmac_recv = c.tls_auth_context->new_obj();
 
-	// save hard reset op we expect to receive from peer
-	reset_op = server ? CONTROL_HARD_RESET_CLIENT_V2 : CONTROL_HARD_RESET_SERVER_V2;
-
 	// init tls_auth hmac
 	if (c.key_direction >= 0)
 	  {
@@ -2352,29 +3030,269 @@ namespace openvpn {
 	  }
       }
 
-      bool validate(const Buffer& net_buf)
+      virtual bool validate(const Buffer& net_buf)
+      {
+	try {
+	  if (is_reset(net_buf))
+	    return ta_hmac_recv->ovpn_hmac_cmp(net_buf.c_data(), net_buf.size(),
+					       1 + ProtoSessionID::SIZE,
+					       ta_hmac_recv->output_size(),
+					       PacketID::size(PacketID::LONG_FORM));
+	}
+	catch (BufferException&)
+	  {
+	  }
+	return false;
+      }
+
+    private:
+      OvpnHMACInstance::Ptr ta_hmac_recv;
+    };
+
+    // Validate the integrity of a packet by decrypting and
+    // authenticating it with the tls-crypt key.
+    class TLSCryptPreValidate : public PreValidate
+    {
+    public:
+      typedef RCPtr<TLSCryptPreValidate> Ptr;
+
+      OPENVPN_SIMPLE_EXCEPTION(tls_crypt_pre_validate);
+
+      TLSCryptPreValidate(const Config& c, const bool server)
+	: PreValidate(server),
+	  frame(c.frame)
+      {
+	if (!c.tls_crypt_enabled() || !frame)
+	  throw tls_crypt_pre_validate();
+
+	tag_size = c.tls_crypt_context->digest_size();
+	tls_crypt_recv = c.tls_crypt_context->new_obj();
+	const unsigned int key_dir = server ? OpenVPNStaticKey::NORMAL : OpenVPNStaticKey::INVERSE;
+	tls_crypt_recv->init(c.tls_crypt_key.slice(OpenVPNStaticKey::HMAC | OpenVPNStaticKey::DECRYPT | key_dir),
+			     c.tls_crypt_key.slice(OpenVPNStaticKey::CIPHER | OpenVPNStaticKey::DECRYPT | key_dir));
+      }
+
+      virtual bool validate(const Buffer& net_buf)
+      {
+	try {
+	  ControlHeader hdr;
+	  return is_reset(net_buf)
+	    && tls_crypt_unwrap(*tls_crypt_recv, tag_size, *frame, net_buf, hdr, work, false) == Error::SUCCESS;
+	}
+	catch (BufferException&)
+	  {
+	  }
+	return false;
+      }
+
+    private:
+      Frame::Ptr frame;
+      TLSCryptInstance::Ptr tls_crypt_recv;
+      size_t tag_size;
+      BufferAllocated work;
+    };
+
+    // Stateless, SYN-cookie-like handling of the initial
+    // HARD_RESET_CLIENT_V2 exchange on the server (tls-auth only).
+    //
+    // Our reset reply carries a session ID derived from a keyed HMAC
+    // over (time slot, client address, client session ID), so nothing
+    // is allocated until the client echoes it back as the destination
+    // session ID of its next packet, proving return-routability.  The
+    // caller then creates the client instance with that session ID
+    // (ServerProto::Factory::new_client_instance(psid)) and feeds it
+    // the reconstructed client reset followed by the client's packet.
+    class PsidCookie : public RC<thread_unsafe_refcount>
+    {
+    public:
+      typedef RCPtr<PsidCookie> Ptr;
+
+      OPENVPN_SIMPLE_EXCEPTION(psid_cookie_error);
+
+      enum {
+	SLOT_SECONDS = 32, // cookie is valid for one to two slots
+	ADDR_SIZE = 16,
+	MAX_HMAC_SIZE = 64,
+      };
+
+      PsidCookie(const Config& c)
+	: hmac_size(c.tls_auth_enabled() ? c.tls_auth_context->size() : 0)
+      {
+	if (!c.tls_auth_enabled() || c.tls_auth_context->size() < ProtoSessionID::SIZE)
+	  throw psid_cookie_error();
+
+	ta_hmac_send = c.tls_auth_context->new_obj();
+	ta_hmac_recv = c.tls_auth_context->new_obj();
+	if (c.key_direction >= 0)
+	  {
+	    const unsigned int key_dir = c.key_direction ? OpenVPNStaticKey::INVERSE : OpenVPNStaticKey::NORMAL;
+	    ta_hmac_send->init(c.tls_auth_key.slice(OpenVPNStaticKey::HMAC | OpenVPNStaticKey::ENCRYPT | key_dir));
+	    ta_hmac_recv->init(c.tls_auth_key.slice(OpenVPNStaticKey::HMAC | OpenVPNStaticKey::DECRYPT | key_dir));
+	  }
+	else
+	  {
+	    ta_hmac_send->init(c.tls_auth_key.slice(OpenVPNStaticKey::HMAC));
+	    ta_hmac_recv->init(c.tls_auth_key.slice(OpenVPNStaticKey::HMAC));
+	  }
+
+	// cookie secret never leaves this object
+	unsigned char secret[64];
+	c.rng->rand_bytes(secret, sizeof(secret));
+	cookie_hmac = c.tls_auth_context->new_obj();
+	cookie_hmac->init(StaticKey(secret, sizeof(secret)));
+	std::memset(secret, 0, sizeof(secret));
+	if (cookie_hmac->output_size() > MAX_HMAC_SIZE)
+	  throw psid_cookie_error();
+      }
+
+      // Outcome of reset_reply() and verify().  Only AUTH_FAIL, a
+      // failed tls-auth HMAC or cookie check, should be counted as
+      // an authentication failure, NO_MATCH means the packet is not
+      // of the kind being checked for.
+      enum Result {
+	OK,
+	NO_MATCH,
+	AUTH_FAIL,
+      };
+
+      // If net_buf is a valid HARD_RESET_CLIENT_V2, write our stateless
+      // HARD_RESET_SERVER_V2 reply into reply and return OK.
+      Result reset_reply(const Buffer& net_buf, const IP::Addr& addr, const std::uint16_t port,
+			 BufferAllocated& reply)
+      {
+	try {
+	  Buffer recv(net_buf);
+	  const unsigned int op = recv.pop_front();
+	  if (opcode_extract(op) != CONTROL_HARD_RESET_CLIENT_V2 || key_id_extract(op) != 0)
+	    return NO_MATCH;
+	  if (!ta_hmac_recv->ovpn_hmac_cmp(net_buf.c_data(), net_buf.size(),
+					   1 + ProtoSessionID::SIZE, hmac_size,
+					   PacketID::size(PacketID::LONG_FORM)))
+	    return AUTH_FAIL;
+	  const ProtoSessionID psid_peer(recv);
+	  recv.advance(hmac_size + PacketID::size(PacketID::LONG_FORM));
+	  if (recv.pop_front() != 0) // reset carries no ACKs
+	    return NO_MATCH;
+	  const reliable::id_t msg_id = ReliableAck::read_id(recv);
+
+	  unsigned char cookie[ProtoSessionID::SIZE];
+	  make_cookie(cookie, slot(), addr, port, psid_peer);
+
+	  // [OP] [PSID] [HMAC] [PID] [ACK_LEN=1] [ACK_ID] [PEER_PSID] [MSG_ID=0]
+	  reply.reset(64 + hmac_size, 0);
+	  reply.push_back(op_compose(CONTROL_HARD_RESET_SERVER_V2, 0));
+	  reply.write(cookie, sizeof(cookie));
+	  std::memset(reply.write_alloc(hmac_size), 0, hmac_size);
+	  PacketIDConstruct(Time::now().seconds_since_epoch(), 1).write(reply, PacketID::LONG_FORM, false);
+	  reply.push_back(1);
+	  const std::uint32_t net_ack = htonl(msg_id);
+	  reply.write((const unsigned char *)&net_ack, sizeof(net_ack));
+	  psid_peer.write(reply);
+	  const std::uint32_t net_msg_id = 0;
+	  reply.write((const unsigned char *)&net_msg_id, sizeof(net_msg_id));
+	  ta_hmac_send->ovpn_hmac_gen(reply.data(), reply.size(),
+				      1 + ProtoSessionID::SIZE, hmac_size,
+				      PacketID::size(PacketID::LONG_FORM));
+	  return OK;
+	}
+	catch (BufferException&)
+	  {
+	  }
+	return NO_MATCH;
+      }
+
+      // If net_buf is a valid P_ACK_V1 or P_CONTROL_V1 whose destination
+      // session ID is one of our cookies, return our session ID in
+      // psid_self and the reconstructed client reset in client_reset,
+      // and return OK.
+      Result verify(const Buffer& net_buf, const IP::Addr& addr, const std::uint16_t port,
+		    ProtoSessionID& psid_self, BufferAllocated& client_reset)
       {
 	try {
-	  if (net_buf.size())
+	  Buffer recv(net_buf);
+	  const unsigned int op = recv.pop_front();
+	  const unsigned int opc = opcode_extract(op);
+	  if ((opc != ACK_V1 && opc != CONTROL_V1) || key_id_extract(op) != 0)
+	    return NO_MATCH;
+	  if (!ta_hmac_recv->ovpn_hmac_cmp(net_buf.c_data(), net_buf.size(),
+					   1 + ProtoSessionID::SIZE, hmac_size,
+					   PacketID::size(PacketID::LONG_FORM)))
+	    return AUTH_FAIL;
+	  const ProtoSessionID psid_peer(recv);
+	  recv.advance(hmac_size);
+	  PacketID pid;
+	  pid.read(recv, PacketID::LONG_FORM);
+	  const unsigned int n_acks = recv.pop_front();
+	  if (!n_acks || pid.id < 2)
+	    return NO_MATCH;
+	  recv.advance(n_acks * sizeof(reliable::id_t));
+	  const unsigned char *dest_psid = recv.read_alloc(ProtoSessionID::SIZE);
+
+	  // accept cookies from the current and previous slot
+	  const std::uint32_t s = slot();
+	  unsigned char cookie[ProtoSessionID::SIZE];
+	  make_cookie(cookie, s, addr, port, psid_peer);
+	  if (crypto::memneq(cookie, dest_psid, sizeof(cookie)))
 	    {
-	      const unsigned int op = net_buf[0];
-	      if (opcode_extract(op) != reset_op || key_id_extract(op) != 0)
-		return false;
-	      return ta_hmac_recv->ovpn_hmac_cmp(net_buf.c_data(), net_buf.size(),
-						 1 + ProtoSessionID::SIZE,
-						 ta_hmac_recv->output_size(),
-						 PacketID::size(PacketID::LONG_FORM));
+	      make_cookie(cookie, s - 1, addr, port, psid_peer);
+	      if (crypto::memneq(cookie, dest_psid, sizeof(cookie)))
+		return AUTH_FAIL;
 	    }
+	  {
+	    Buffer cb(cookie, sizeof(cookie), true);
+	    psid_self.read(cb);
+	  }
+
+	  // the client's reset, as the client instance would have seen it
+	  // [OP] [PSID] [HMAC] [PID] [ACK_LEN=0] [MSG_ID=0]
+	  client_reset.reset(32 + hmac_size, 0);
+	  client_reset.push_back(op_compose(CONTROL_HARD_RESET_CLIENT_V2, 0));
+	  psid_peer.write(client_reset);
+	  std::memset(client_reset.write_alloc(hmac_size), 0, hmac_size);
+	  PacketIDConstruct(pid.time, pid.id - 1).write(client_reset, PacketID::LONG_FORM, false);
+	  client_reset.push_back(0);
+	  const std::uint32_t net_msg_id = 0;
+	  client_reset.write((const unsigned char *)&net_msg_id, sizeof(net_msg_id));
+	  ta_hmac_recv->ovpn_hmac_gen(client_reset.data(), client_reset.size(),
+				      1 + ProtoSessionID::SIZE, hmac_size,
+				      PacketID::size(PacketID::LONG_FORM));
+	  return OK;
 	}
 	catch (BufferException&)
 	  {
 	  }
-	return false;
+	return NO_MATCH;
       }
 
     private:
+      static std::uint32_t slot()
+      {
+	return std::uint32_t(Time::now().seconds_since_epoch() / SLOT_SECONDS);
+      }
+
+      // cookie = HMAC(secret, slot | addr | port | peer psid), truncated
+      void make_cookie(unsigned char *cookie, const std::uint32_t s,
+		       const IP::Addr& addr, const std::uint16_t port,
+		       const ProtoSessionID& psid_peer)
+      {
+	unsigned char data[MAX_HMAC_SIZE + 4 + ADDR_SIZE + 2 + ProtoSessionID::SIZE];
+	const size_t hs = cookie_hmac->output_size();
+	Buffer b(data, sizeof(data), false);
+	b.write_alloc(hs);
+	const std::uint32_t net_slot = htonl(s);
+	b.write((const unsigned char *)&net_slot, sizeof(net_slot));
+	addr.to_byte_string(b.write_alloc(ADDR_SIZE));
+	const std::uint16_t net_port = htons(port);
+	b.write((const unsigned char *)&net_port, sizeof(net_port));
+	psid_peer.write(b);
+	cookie_hmac->ovpn_hmac_gen(b.data(), b.size(), 0, hs, 0);
+	std::memcpy(cookie, b.c_data(), ProtoSessionID::SIZE);
+      }
+
+      const size_t hmac_size;
+      OvpnHMACInstance::Ptr ta_hmac_send;
       OvpnHMACInstance::Ptr ta_hmac_recv;
-      unsigned int reset_op;
+      OvpnHMACInstance::Ptr cookie_hmac;
     };
 
     OPENVPN_SIMPLE_EXCEPTION(select_key_context_error);
@@ -2387,21 +3305,15 @@ namespace openvpn {
 	n_key_ids(0),
 	now_(config_arg->now)
     {
-      const Config& c = *config;
-
-      // tls-auth setup
-      if (c.tls_auth_context)
-	{
-	  use_tls_auth = true;
+      init_config();
+    }
 
-	  // get HMAC size from Digest object
-	  hmac_size = c.tls_auth_context->size();
-	}
-      else
-	{
-	  use_tls_auth = false;
-	  hmac_size = 0;
-	}
+    // like reset(), but with our session ID given, e.g. one
+    // issued statelessly by PsidCookie
+    void reset(const ProtoSessionID& psid)
+    {
+      reset();
+      psid_self = psid;
     }
 
     void reset()
@@ -2420,6 +3332,16 @@ namespace openvpn {
       // start with key ID 0
       upcoming_key_id = 0;
 
+      // restart path MTU discovery once the new data channel is up
+      pmtud.stop();
+      pmtud_reported = 0;
+      latprobe.stop();
+      mss_dirty = true;
+
+      // FEC groups don't survive a restart
+      fec_started = false;
+      fec_tx_n = 0;
+
       // tls-auth initialization
       if (use_tls_auth)
 	{
@@ -2450,6 +3372,27 @@ namespace openvpn {
 			   stats);
 	}
 
+      // tls-crypt initialization
+      if (use_tls_crypt)
+	{
+	  tls_crypt_send = c.tls_crypt_context->new_obj();
+	  tls_crypt_recv = c.tls_crypt_context->new_obj();
+
+	  // the server uses the key in normal direction, the client inverse
+	  const unsigned int key_dir = is_server() ? OpenVPNStaticKey::NORMAL : OpenVPNStaticKey::INVERSE;
+	  tls_crypt_send->init(c.tls_crypt_key.slice(OpenVPNStaticKey::HMAC | OpenVPNStaticKey::ENCRYPT | key_dir),
+			       c.tls_crypt_key.slice(OpenVPNStaticKey::CIPHER | OpenVPNStaticKey::ENCRYPT | key_dir));
+	  tls_crypt_recv->init(c.tls_crypt_key.slice(OpenVPNStaticKey::HMAC | OpenVPNStaticKey::DECRYPT | key_dir),
+			       c.tls_crypt_key.slice(OpenVPNStaticKey::CIPHER | OpenVPNStaticKey::DECRYPT | key_dir));
+
+	  // init tls_crypt packet ID
+	  ta_pid_send.init(PacketID::LONG_FORM);
+	  ta_pid_recv.init(c.pid_mode,
+			   PacketID::LONG_FORM,
+			   "SSL-CC", 0,
+			   stats);
+	}
+
       // initialize proto session ID
       psid_self.randomize(*c.prng);
       psid_peer.reset();
@@ -2470,6 +3413,58 @@ namespace openvpn {
       reset_all();
     }
 
+    // Like pre_destroy(), but also drop the tls-auth/tls-crypt key
+    // instances and zero buffers that may hold cleartext, so that
+    // a halted object can be kept for reuse (see recycle()).
+    void scrub()
+    {
+      reset_all();
+      ta_hmac_send.reset();
+      ta_hmac_recv.reset();
+      tls_crypt_send.reset();
+      tls_crypt_recv.reset();
+      zero_buffer(tls_crypt_work);
+      for (auto &b : bundle_rx)
+	zero_buffer(b);
+      bundle_rx_n = 0;
+      psid_self.reset();
+      psid_peer.reset();
+    }
+
+    // Return a halted object to the state of a newly constructed
+    // one with the given config and stats.  Allocated buffers keep
+    // their capacity.  Call reset() before starting it again.
+    void recycle(const Config::Ptr& config_arg,
+		 const SessionStats::Ptr& stats_arg)
+    {
+      scrub();
+      config = config_arg;
+      config_next.reset();
+      config_cow = false;
+      local_peer_id_ = -1;
+      ctrl_compress = false;
+      bundle_send = false;
+      ssl_factory_retired[0].reset();
+      ssl_factory_retired[1].reset();
+      stats = stats_arg;
+      mode_ = config->ssl_factory->mode();
+      upcoming_key_id = 0;
+      n_key_ids = 0;
+      now_ = config->now;
+      keepalive_xmit = Time();
+      keepalive_expire = Time();
+      pmtud.stop();
+      pmtud_seq = 0;
+      pmtud_reported = 0;
+      latprobe.stop();
+      mss_mtu = 0;
+      mss_dirty = true;
+      fec_started = false;
+      fec_tx_n = 0;
+      slowest_handshake_ = Time::Duration();
+      init_config();
+    }
+
     virtual ~ProtoContext() {}
 
     // return the PacketType of an incoming network packet
@@ -2488,11 +3483,45 @@ namespace openvpn {
     // trigger a protocol renegotiation
     void renegotiate()
     {
+      OPENVPN_USDT1(renegotiate, this);
+
       // initialize secondary key context
       new_secondary_key(true);
       secondary->start();
     }
 
+    // send a keepalive now, such as to announce a new source
+    // address to a peer that floats clients by peer-id
+    void send_keepalive_now()
+    {
+      primary->send_keepalive();
+      update_last_sent();
+    }
+
+    // True if a key context is parked on an asynchronous SSL
+    // operation, caller should wait on ssl_async_fds() and
+    // then call ssl_async_resume().
+    bool ssl_async_pending() const
+    {
+      return primary->ssl_async_pending() || (secondary && secondary->ssl_async_pending());
+    }
+
+    void ssl_async_fds(std::vector<int>& fds) const
+    {
+      primary->ssl_async_fds(fds);
+      if (secondary)
+	secondary->ssl_async_fds(fds);
+    }
+
+    // resume parked key contexts and flush
+    void ssl_async_resume()
+    {
+      primary->ssl_async_resume();
+      if (secondary)
+	secondary->ssl_async_resume();
+      flush(true);
+    }
+
     // Should be called at the end of sequence of send/recv
     // operations on underlying protocol object.
     // If control_channel is true, do a full flush.
@@ -2500,6 +3529,7 @@ namespace openvpn {
     // channel only.
     void flush(const bool control_channel)
     {
+      fec_flush();
       if (control_channel || process_events())
 	{
 	  do {
@@ -2528,6 +3558,31 @@ namespace openvpn {
 
       // handle keepalive/expiration
       keepalive_housekeeping();
+
+      // send PMTU probes
+      pmtud_housekeeping();
+
+      // send latency probes
+      latprobe_housekeeping();
+    }
+
+    // Release control and data channel buffers that are only needed
+    // while traffic is flowing, for sessions that have been idle for
+    // a while.  Keys and SSL sessions are kept, so no handshake is
+    // needed to resume; buffers are reallocated on next use.
+    void compact()
+    {
+      primary->compact();
+      if (secondary)
+	secondary->compact();
+    }
+
+    // Add the buffer memory currently held by this session to mu.
+    void memory_usage(MemUsage& mu) const
+    {
+      primary->memory_usage(mu);
+      if (secondary)
+	secondary->memory_usage(mu);
     }
 
     // When should we next call housekeeping?
@@ -2542,6 +3597,10 @@ namespace openvpn {
 	    ret.min(secondary->next_retransmit());
 	  ret.min(keepalive_xmit);
 	  ret.min(keepalive_expire);
+	  ret.min(pmtud.next_event());
+	  ret.min(latprobe.next_event());
+	  if (fec_started)
+	    ret.min(fec_tx.next_event());
 	  return ret;
 	}
       else
@@ -2560,6 +3619,58 @@ namespace openvpn {
       control_send(app_buf.move_to_ptr());
     }
 
+    void control_send(BufferRope&& app_rope)
+    {
+      select_control_send_context().app_send(std::move(app_rope));
+    }
+
+    // Send a run of control messages.  Once enabled by
+    // enable_control_compress, runs of at least
+    // ctrl_compress_threshold bytes go out packed into compressed
+    // envelopes of up to ControlCompress::INPUT_MAX bytes each.
+    void control_send(std::vector<BufferPtr>&& msgs)
+    {
+#ifdef HAVE_ZLIB
+      if (ctrl_compress)
+	{
+	  size_t i = 0;
+	  while (i < msgs.size())
+	    {
+	      size_t j = i, size = 0;
+	      while (j < msgs.size() && size + msgs[j]->size() < ControlCompress::INPUT_MAX)
+		size += msgs[j++]->size() + 1;
+	      if (size >= config->ctrl_compress_threshold)
+		{
+		  control_send(ControlCompress::pack(&msgs[i], j - i));
+		  i = j;
+		}
+	      else
+		control_send(std::move(msgs[i++]));
+	    }
+	  return;
+	}
+#endif
+      for (auto &msg : msgs)
+	control_send(std::move(msg));
+    }
+
+    // Called on server once the client has advertised that it
+    // unpacks compressed control messages (PeerInfo::CTRL_ZLIB).
+    void enable_control_compress()
+    {
+#ifdef HAVE_ZLIB
+      ctrl_compress = config->ctrl_compress_threshold > 0;
+#endif
+    }
+
+    // Called once the peer has said that it unpacks bundled data
+    // channel packets: on a server when the client advertises
+    // PeerInfo::BUNDLE, on a client when the server pushes "bundle".
+    void enable_bundle_send()
+    {
+      bundle_send = config->bundle;
+    }
+
     // validate a control channel network packet
     bool control_net_validate(const PacketType& type, const Buffer& net_buf)
     {
@@ -2588,18 +3699,82 @@ namespace openvpn {
     void data_encrypt(BufferAllocated& in_out)
     {
       //OPENVPN_LOG_PROTO_VERBOSE(debug_prefix() << " DATA ENCRYPT size=" << in_out.size());
+      mss_clamp(in_out);
       primary->encrypt(in_out);
+      if (in_out.size() && fec_ready())
+	fec_add(in_out);
+    }
+
+    // encrypt a burst of data channel packets using primary KeyContext,
+    // buffers that end up empty (because their packet was bundled into
+    // another buffer) must not be sent
+    void data_encrypt_batch(BufferAllocated** bufs, const size_t n)
+    {
+      for (size_t i = 0; i < n; ++i)
+	mss_clamp(*bufs[i]);
+      if (bundle_send && n > 1)
+	{
+	  size_t max_size = config->tun_mtu;
+	  const size_t pm = pmtu_tun_mtu();
+	  if (pm && pm < max_size)
+	    max_size = pm;
+	  const size_t tailroom = (*config->frame)[Frame::READ_TUN].tailroom();
+	  const size_t bundled = DataBundle::pack(bufs, n, config->bundle_max_packet, max_size, tailroom);
+	  OPENVPN_PERF_BATCH(stats, DATA_BUNDLE, bundled);
+	}
+
+      // encrypt only non-empty buffers
+      bundle_tx.clear();
+      for (size_t i = 0; i < n; ++i)
+	{
+	  if (bufs[i]->size())
+	    bundle_tx.push_back(bufs[i]);
+	}
+      if (!bundle_tx.empty())
+	{
+	  primary->encrypt_batch(bundle_tx.data(), bundle_tx.size());
+	  if (fec_ready())
+	    {
+	      for (auto *b : bundle_tx)
+		{
+		  if (b->size())
+		    fec_add(*b);
+		}
+	    }
+	}
     }
 
     // decrypt a data channel packet (automatically select primary
     // or secondary KeyContext based on packet content)
     bool data_decrypt(const PacketType& type, BufferAllocated& in_out)
+    {
+      bool idle_keepalive;
+      return data_decrypt(type, in_out, idle_keepalive);
+    }
+
+    // Like data_decrypt(), but also sets idle_keepalive if the packet
+    // was a keepalive on a key that has already seen traffic and has
+    // no data limit.  Such a packet only moves keepalive_expire later
+    // and leaves the key schedule alone, so the caller may skip the
+    // flush and keep its pending housekeeping wakeup, which at worst
+    // fires early.  This is the whole per-packet cost of clients that
+    // only ever send keepalives.
+    bool data_decrypt(const PacketType& type, BufferAllocated& in_out, bool& idle_keepalive)
     {
       bool ret = false;
+      idle_keepalive = false;
 
       //OPENVPN_LOG_PROTO_VERBOSE(debug_prefix() << " DATA DECRYPT key_id=" << select_key_context(type, false).key_id() << " size=" << in_out.size());
 
-      select_key_context(type, false).decrypt(in_out);
+      rx_seq_pid = 0;
+      if (type.opcode == DATA_FEC_V1)
+	return fec_recv(in_out);
+      if (fec_started)
+	fec_rx.store(in_out);
+
+      KeyContext& kc = select_key_context(type, false);
+      const bool quiet = kc.decrypt_quiet();
+      kc.decrypt(in_out);
 
       // update time of most recent packet received
       if (in_out.size())
@@ -2612,11 +3787,64 @@ namespace openvpn {
       if (proto_context_private::is_keepalive(in_out))
 	{
 	  in_out.reset_size();
+	  stats->inc_stat(SessionStats::KEEPALIVES_IN, 1);
+	  idle_keepalive = quiet;
 	}
+      else if (PMTUDiscovery::is_message(in_out))
+	{
+	  pmtud_recv(in_out);
+	  in_out.reset_size();
+	}
+      else if (LatencyProbe::is_message(in_out))
+	{
+	  latprobe_recv(in_out);
+	  in_out.reset_size();
+	}
+      else if (DataBundle::is_message(in_out))
+	{
+	  unbundle(in_out);
+	  in_out.reset_size();
+	}
+      else if (in_out.size())
+	mss_clamp(in_out);
 
       return ret;
     }
 
+    // True if data_decrypt() of a packet of this type leaves the
+    // result in the storage of its buffer, without swapping it out
+    // or keeping it, so the buffer may be a window onto memory that
+    // the caller still needs.
+    bool data_decrypt_in_place(const PacketType& type)
+    {
+      if (!type.is_data() || type.opcode == DATA_FEC_V1 || fec_started)
+	return false;
+      const KeyContext* kc = (type.flags & PacketType::SECONDARY) ? secondary.get() : primary.get();
+      return kc && kc->decrypt_in_place();
+    }
+
+    // After data_decrypt has returned an empty buffer, return the
+    // packets of a received bundle, if any.  The buffers stay valid
+    // until the next data_decrypt call.
+    size_t data_unbundled(BufferAllocated**& bufs)
+    {
+      const size_t n = bundle_rx_n;
+      bundle_rx_n = 0;
+      bufs = bundle_rx_ptrs.data();
+      return n;
+    }
+
+    // After data_decrypt, get the key ID and packet ID of the packet
+    // if it passed the replay check, for restoring the send order
+    // (see DataReorder).  Returns false if it didn't, or if the data
+    // channel backend doesn't report packet IDs.
+    bool data_rx_seq(unsigned int& key_id, std::uint64_t& pid) const
+    {
+      key_id = rx_seq_key;
+      pid = rx_seq_pid;
+      return pid != 0;
+    }
+
     // enter disconnected state
     void disconnect(const Error::Type reason)
     {
@@ -2660,6 +3888,7 @@ namespace openvpn {
     void init_data_channel()
     {
       dc_deferred = false;
+      mss_dirty = true; // cipher may have changed
 
       // initialize data channel (crypto & compression)
       primary->init_data_channel();
@@ -2671,7 +3900,12 @@ namespace openvpn {
     void process_push(const OptionList& opt, const ProtoContextOptions& pco)
     {
       // modify config with pushed options
-      config->process_push(opt, pco);
+      mutable_conf().process_push(opt, pco);
+      mss_dirty = true;
+
+      // a pushed "bundle" says the server unpacks bundles
+      if (opt.exists("bundle"))
+	enable_bundle_send();
 
       // in case keepalive parms were modified by push
       keepalive_parms_modified();
@@ -2683,6 +3917,19 @@ namespace openvpn {
       return config->enable_op32 ? 0 : 1;
     }
 
+    // data channel RTT, jitter and loss, see LatencyProbe
+    const LatencyProbe::Stats& latency_stats() const
+    {
+      return latprobe.stats();
+    }
+
+    // Largest tun packet confirmed by path MTU discovery to reach
+    // the peer without fragmentation, or 0 if not known.
+    size_t pmtu_tun_mtu() const
+    {
+      return pmtud.tun_mtu(config->link_mtu_adjust());
+    }
+
     // Return true if keepalive parameter(s) are enabled
     bool is_keepalive_enabled() const
     {
@@ -2697,8 +3944,9 @@ namespace openvpn {
     {
       keepalive_ping = config->keepalive_ping.enabled() ? config->keepalive_ping.to_seconds() : 0;
       keepalive_timeout = config->keepalive_timeout.enabled() ? config->keepalive_timeout.to_seconds() : 0;
-      config->keepalive_ping = Time::Duration::infinite();
-      config->keepalive_timeout = Time::Duration::infinite();
+      Config& c = mutable_conf();
+      c.keepalive_ping = Time::Duration::infinite();
+      c.keepalive_timeout = Time::Duration::infinite();
       keepalive_parms_modified();
     }
 
@@ -2716,21 +3964,26 @@ namespace openvpn {
     // access the data channel settings
     CryptoDCSettings& dc_settings()
     {
-      return config->dc;
+      return mutable_conf().dc;
     }
 
     // reset the data channel factory
     void reset_dc_factory()
     {
+      // nothing to release while still sharing another owner's config
+      if (config_cow && config->use_count() > 1)
+	return;
       config->dc.reset();
     }
 
     // set the local peer ID (or -1 to disable)
     void set_local_peer_id(const int local_peer_id)
     {
-      config->local_peer_id = local_peer_id;
+      local_peer_id_ = local_peer_id;
     }
 
+    int local_peer_id() const { return local_peer_id_; }
+
     // current time
     const Time& now() const { return *now_; }
     void update_now() { now_->update(); }
@@ -2750,13 +4003,75 @@ namespace openvpn {
 
     // configuration
     const Config& conf() const { return *config; }
-    Config& conf() { return *config; }
+    Config& conf() { return mutable_conf(); }
     const Config::Ptr& conf_ptr() const { return config; }
 
+    // Server sessions may share one Config with the other sessions
+    // of their thread, rather than holding a copy each.  The config
+    // is then copied the first time this session changes it.
+    void config_copy_on_write()
+    {
+      config_cow = true;
+    }
+
+    // config for modification, unshared first if copy-on-write
+    Config& mutable_conf()
+    {
+      if (config_cow)
+	{
+	  if (config->use_count() > 1)
+	    config.reset(new Config(*config));
+	  config_cow = false;
+	}
+      return *config;
+    }
+
+    // After a config reload, make the next renegotiation (from either
+    // side) build its key context with the SSL factory of next, so the
+    // session picks up a new CA, CRL or certificate.  Everything the
+    // peer has already agreed to, such as the data channel cipher and
+    // the tls-auth/tls-crypt keys, is kept.
+    void set_renegotiation_config(const Config::Ptr& next)
+    {
+      config_next = next;
+    }
+
     // stats
     SessionStats& stat() const { return *stats; }
 
   private:
+    // settings derived from config at construction
+    void init_config()
+    {
+      const Config& c = *config;
+
+      // tls-auth setup
+      if (c.tls_auth_context)
+	{
+	  use_tls_auth = true;
+
+	  // get HMAC size from Digest object
+	  hmac_size = c.tls_auth_context->size();
+	}
+      else
+	{
+	  use_tls_auth = false;
+	  hmac_size = 0;
+	}
+
+      // tls-crypt setup
+      use_tls_crypt = !use_tls_auth && c.tls_crypt_enabled();
+      if (use_tls_crypt)
+	hmac_size = c.tls_crypt_context->digest_size();
+    }
+
+    static void zero_buffer(BufferAllocated& buf)
+    {
+      if (buf.capacity())
+	std::memset(buf.data_raw(), 0, buf.capacity());
+      buf.reset_content();
+    }
+
     void reset_all()
     {
       if (primary)
@@ -2770,6 +4085,14 @@ namespace openvpn {
     // app may take ownership of app_bp via std::move
     virtual void control_recv(BufferPtr&& app_bp) = 0;
 
+    // Called instead of control_recv for a message that arrived in
+    // more than one SSL read.  Override to consume it without
+    // linearizing, e.g. with read_control_string(const BufferRope&).
+    virtual void control_recv_rope(BufferRope&& app_rope)
+    {
+      control_recv(app_rope.join());
+    }
+
     // Called on client to request username/password credentials.
     // Should be overriden by derived class if credentials are required.
     // username and password should be written into buf with write_auth_string().
@@ -2793,6 +4116,14 @@ namespace openvpn {
     {
     }
 
+    // Called when a scheduled renegotiation of the primary key is due,
+    // return true to retry it a little later.  Data limit renegotiations
+    // are never deferred.
+    virtual bool defer_renegotiation()
+    {
+      return false;
+    }
+
     void update_last_received()
     {
       keepalive_expire = *now_ + config->keepalive_timeout;
@@ -2803,8 +4134,29 @@ namespace openvpn {
       control_net_send(net_pkt.buffer());
     }
 
+    void app_recv(const unsigned int key_id, BufferRope&& to_app_rope)
+    {
+      // compressed envelopes are inflated from one buffer
+      if (to_app_rope.n_chunks() <= 1
+#ifdef HAVE_ZLIB
+	  || to_app_rope.starts_with(ControlCompress::PREFIX, sizeof(ControlCompress::PREFIX) - 1)
+#endif
+	  )
+	app_recv(key_id, to_app_rope.join());
+      else
+	control_recv_rope(std::move(to_app_rope));
+    }
+
     void app_recv(const unsigned int key_id, BufferPtr&& to_app_buf)
     {
+#ifdef HAVE_ZLIB
+      if (ControlCompress::is_envelope(*to_app_buf))
+	{
+	  for (auto &msg : ControlCompress::unpack(*to_app_buf))
+	    control_recv(std::move(msg));
+	  return;
+	}
+#endif
       control_recv(std::move(to_app_buf));
     }
 
@@ -2863,7 +4215,10 @@ namespace openvpn {
       if (now >= keepalive_xmit)
 	{
 	  primary->send_keepalive();
-	  update_last_sent();
+	  if (config->keepalive_idle)
+	    keepalive_xmit = now + keepalive_idle_ping(); // nothing sent for a full cycle
+	  else
+	    update_last_sent();
 	}
       if (now >= keepalive_expire)
 	{
@@ -2873,6 +4228,243 @@ namespace openvpn {
 	}
     }
 
+    // Keepalive interval for an idle link, stretched as far as the
+    // peer's ping-restart allows, assuming it matches our own.
+    Time::Duration keepalive_idle_ping() const
+    {
+      Time::Duration ret = config->keepalive_ping;
+      if (config->keepalive_timeout.enabled())
+	ret.max(Time::Duration::binary_ms(config->keepalive_timeout.raw() / 2));
+      return ret;
+    }
+
+    // Start path MTU discovery once the data channel is up,
+    // then send probes as PMTUDiscovery schedules them.
+    void pmtud_housekeeping()
+    {
+      const Time now = *now_;
+      if (!pmtud.enabled())
+	{
+	  if (config->pmtud && is_udp() && data_channel_ready())
+	    {
+	      pmtud = PMTUDiscovery(config->pmtud_config);
+	      pmtud.start(config->tun_mtu + config->link_mtu_adjust(), now);
+	    }
+	  else
+	    return;
+	}
+      const size_t size = pmtud.probe_due(now);
+      if (size)
+	{
+	  const size_t adj = config->link_mtu_adjust();
+	  primary->send_pmtud_message(PMTUDiscovery::PROBE, ++pmtud_seq,
+				      std::max(size - std::min(size, adj), size_t(PMTUDiscovery::HEADER_SIZE)));
+	  pmtud.sent(pmtud_seq, now);
+	}
+      else if (pmtud.search_complete() && pmtud.plpmtu() != pmtud_reported)
+	{
+	  pmtud_reported = pmtud.plpmtu();
+	  OPENVPN_LOG_PROTO(debug_prefix() << " PMTU link=" << pmtud_reported << " tun-mtu=" << pmtu_tun_mtu());
+	}
+    }
+
+    void pmtud_recv(const Buffer& buf)
+    {
+      const std::uint32_t seq = PMTUDiscovery::message_seq(buf);
+      switch (PMTUDiscovery::message_type(buf))
+	{
+	case PMTUDiscovery::PROBE:
+	  primary->send_pmtud_message(PMTUDiscovery::ACK, seq, PMTUDiscovery::HEADER_SIZE);
+	  break;
+	case PMTUDiscovery::ACK:
+	  if (pmtud.ack(seq, *now_))
+	    {
+	      mss_dirty = true;
+	      pmtud_housekeeping();
+	    }
+	  break;
+	}
+    }
+
+    // Start latency probes once the data channel is up.
+    void latprobe_housekeeping()
+    {
+      const Time now = *now_;
+      if (!latprobe.enabled())
+	{
+	  if (config->latency_probe && data_channel_ready())
+	    {
+	      latprobe = LatencyProbe(config->latprobe_config);
+	      latprobe.start(now);
+	    }
+	  else
+	    return;
+	}
+      std::uint32_t seq;
+      std::uint64_t ts;
+      unsigned int lost;
+      if (latprobe.probe_due(now, seq, ts, lost))
+	{
+	  primary->send_latprobe_message(LatencyProbe::REQUEST, seq, ts);
+	  stats->inc_stat(SessionStats::LATENCY_PROBES_SENT, 1);
+	  if (lost)
+	    stats->inc_stat(SessionStats::LATENCY_PROBES_LOST, lost);
+	}
+    }
+
+    void latprobe_recv(const Buffer& buf)
+    {
+      const std::uint32_t seq = LatencyProbe::message_seq(buf);
+      const std::uint64_t ts = LatencyProbe::message_timestamp(buf);
+      switch (LatencyProbe::message_type(buf))
+	{
+	case LatencyProbe::REQUEST:
+	  primary->send_latprobe_message(LatencyProbe::REPLY, seq, ts);
+	  latprobe.peer_probe(ts);
+	  break;
+	case LatencyProbe::REPLY:
+	  if (!latprobe.echo(seq, ts))
+	    return;
+	  break;
+	default:
+	  return;
+	}
+      const LatencyProbe::Stats& ls = latprobe.stats();
+      stats->update_latency(ls.rtt_us, ls.rtt_min_us, ls.jitter_us);
+    }
+
+    // Start FEC once enabled on a UDP transport.
+    bool fec_ready()
+    {
+      if (!fec_started && config->fec && is_udp())
+	{
+	  fec_tx = DataFEC::Encoder(config->fec_config);
+	  fec_rx = DataFEC::Decoder(config->fec_config);
+	  fec_started = true;
+	}
+      return fec_started;
+    }
+
+    // Add an encrypted packet to the current group.  Parity of a
+    // full group is queued, since the caller has not sent the packets
+    // yet, and goes out on the next flush.
+    void fec_add(const Buffer& buf)
+    {
+      if (fec_tx.full())
+	fec_close();
+      fec_tx.add(buf, *now_);
+    }
+
+    void fec_close()
+    {
+      if (fec_tx_n == fec_tx_bufs.size())
+	fec_tx_bufs.emplace_back();
+      BufferAllocated& b = fec_tx_bufs[fec_tx_n++];
+      b.reset(0, OP_SIZE_V2 + fec_tx.message_size(), 0);
+      const std::uint32_t op32 = htonl(op32_compose(DATA_FEC_V1, primary->key_id(), config->remote_peer_id));
+      b.write((const unsigned char *)&op32, sizeof(op32));
+      fec_tx.finish(b, fec_rx.loss());
+    }
+
+    // send queued parity, and that of the current group once due
+    void fec_flush()
+    {
+      if (!fec_started)
+	return;
+      if (fec_tx.due(*now_))
+	fec_close();
+      for (size_t i = 0; i < fec_tx_n; ++i)
+	control_net_send(fec_tx_bufs[i]);
+      fec_tx_n = 0;
+    }
+
+    // Process a parity packet, then decrypt the packet it rebuilt, if any.
+    bool fec_recv(BufferAllocated& in_out)
+    {
+      if (fec_ready() && in_out.size() >= OP_SIZE_V2)
+	{
+	  in_out.advance(OP_SIZE_V2);
+	  config->frame->prepare(Frame::READ_LINK_UDP, fec_rx_buf);
+	  unsigned int peer_loss = 0;
+	  switch (fec_rx.recv(in_out, fec_rx_buf, peer_loss))
+	    {
+	    case DataFEC::Decoder::RECOVERED:
+	      {
+		fec_tx.set_peer_loss(peer_loss);
+		in_out.swap(fec_rx_buf);
+		const PacketType type(in_out, *this);
+		if (type.is_data() && type.opcode != DATA_FEC_V1)
+		  {
+		    stats->error(Error::N_FEC_RECOVERED);
+		    return data_decrypt(type, in_out);
+		  }
+		break;
+	      }
+	    case DataFEC::Decoder::NONE:
+	      fec_tx.set_peer_loss(peer_loss);
+	      break;
+	    case DataFEC::Decoder::MALFORMED:
+	      stats->error(Error::BUFFER_ERROR);
+	      break;
+	    }
+	}
+      in_out.reset_size();
+      return false;
+    }
+
+    // split a received bundle into bundle_rx
+    void unbundle(const Buffer& buf)
+    {
+      size_t n = 0;
+      const bool ok = DataBundle::unpack(buf, [this, &n](const unsigned char *data, const size_t size)
+        {
+	  if (n == bundle_rx.size())
+	    bundle_rx.emplace_back();
+	  BufferAllocated& b = bundle_rx[n++];
+	  config->frame->prepare(Frame::READ_LINK_UDP, b);
+	  b.write(data, size);
+	  mss_clamp(b);
+	});
+      if (!ok)
+	{
+	  stats->error(Error::BUFFER_ERROR);
+	  return;
+	}
+      bundle_rx_ptrs.resize(bundle_rx.size());
+      for (size_t i = 0; i < n; ++i)
+	bundle_rx_ptrs[i] = &bundle_rx[i];
+      bundle_rx_n = n;
+    }
+
+    // Clamp the MSS of TCP SYNs entering or leaving the tunnel
+    // to the smaller of the mssfix limit and the discovered path MTU.
+    void mss_clamp(Buffer& buf)
+    {
+      if (mss_dirty)
+	update_mss_mtu();
+      if (mss_mtu)
+	MSSFix::clamp(buf, mss_mtu);
+    }
+
+    void update_mss_mtu()
+    {
+      mss_dirty = false;
+      size_t mtu = 0;
+      const MSSParms& mp = config->mss_parms;
+      if (mp.mssfix)
+	{
+	  size_t overhead = config->link_mtu_adjust();
+	  if (mp.mtu) // mssfix includes outer IP and UDP/TCP headers
+	    overhead += (config->protocol.is_ipv6() ? 40 : 20) + (is_udp() ? 8 : 20);
+	  if (mp.mssfix > overhead)
+	    mtu = mp.mssfix - overhead;
+	}
+      const size_t pm = pmtu_tun_mtu();
+      if (pm && (!mtu || pm < mtu))
+	mtu = pm;
+      mss_mtu = mtu;
+    }
+
     // Process KEV_x events
     // Return true if any events were processed.
     bool process_events()
@@ -2902,6 +4494,19 @@ namespace openvpn {
     //   true  : local renegotiation request
     void new_secondary_key(const bool initiator)
     {
+      // switch to a reloaded SSL factory, keeping the previous ones
+      // alive for the key contexts still using them
+      if (config_next)
+	{
+	  if (config_next->ssl_factory && config_next->ssl_factory.get() != config->ssl_factory.get())
+	    {
+	      ssl_factory_retired[1] = std::move(ssl_factory_retired[0]);
+	      ssl_factory_retired[0] = config->ssl_factory;
+	      mutable_conf().ssl_factory = config_next->ssl_factory;
+	    }
+	  config_next.reset();
+	}
+
       // Create the secondary
       secondary.reset(new KeyContext(*this, initiator));
       OPENVPN_LOG_PROTO_VERBOSE(debug_prefix() << " New KeyContext SECONDARY id=" << secondary->key_id() << (initiator ? " local-triggered" : " remote-triggered"));
@@ -3037,6 +4642,12 @@ namespace openvpn {
     // BEGIN ProtoContext data members
 
     Config::Ptr config;
+    Config::Ptr config_next;                    // see set_renegotiation_config
+    bool config_cow = false;                    // see config_copy_on_write
+    int local_peer_id_ = -1;
+    bool ctrl_compress = false;                 // see enable_control_compress
+    bool bundle_send = false;                   // see enable_bundle_send
+    SSLFactoryAPI::Ptr ssl_factory_retired[2];  // replaced by config_next, may still be in use
     SessionStats::Ptr stats;
 
     size_t hmac_size;
@@ -3049,10 +4660,36 @@ namespace openvpn {
     Time keepalive_xmit;               // time in future when we will transmit a keepalive (subject to continuous change)
     Time keepalive_expire;             // time in future when we must have received a packet from peer or we will timeout session
 
+    PMTUDiscovery pmtud;               // path MTU search state, if config->pmtud
+    std::uint32_t pmtud_seq = 0;       // sequence number of last PMTU probe sent
+    size_t pmtud_reported = 0;         // last plpmtu() logged
+    LatencyProbe latprobe;             // RTT, jitter and loss, if config->latency_probe
+    size_t mss_mtu = 0;                // inner MTU for MSS clamping, 0 to disable
+    bool mss_dirty = true;             // recompute mss_mtu before next use
+
+    std::vector<BufferAllocated*> bundle_tx;     // scratch for data_encrypt_batch
+    std::vector<BufferAllocated> bundle_rx;      // packets of the last bundle received
+    std::vector<BufferAllocated*> bundle_rx_ptrs;
+    size_t bundle_rx_n = 0;
+
+    unsigned int rx_seq_key = 0;       // key ID and packet ID of the last packet
+    std::uint64_t rx_seq_pid = 0;      //   that passed the replay check, see data_rx_seq
+
+    bool fec_started = false;          // fec_tx/fec_rx set up, if config->fec
+    DataFEC::Encoder fec_tx;           // parity of packets we send
+    DataFEC::Decoder fec_rx;           // packets we received, for rebuilding
+    std::vector<BufferAllocated> fec_tx_bufs; // parity waiting for the next flush
+    size_t fec_tx_n = 0;
+    BufferAllocated fec_rx_buf;
+
     Time::Duration slowest_handshake_; // longest time to reach a successful handshake
 
     OvpnHMACInstance::Ptr ta_hmac_send;
     OvpnHMACInstance::Ptr ta_hmac_recv;
+    bool use_tls_crypt;
+    TLSCryptInstance::Ptr tls_crypt_send;
+    TLSCryptInstance::Ptr tls_crypt_recv;
+    BufferAllocated tls_crypt_work;    // decrypted tls-crypt control packet
     PacketIDSend ta_pid_send;
     PacketIDReceive ta_pid_recv;
 
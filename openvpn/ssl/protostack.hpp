@@ -23,11 +23,13 @@
 #define OPENVPN_SSL_PROTOSTACK_H
 
 #include <deque>
+#include <vector>
 #include <utility>
 
 #include <openvpn/common/exception.hpp>
 #include <openvpn/common/size.hpp>
 #include <openvpn/common/usecount.hpp>
+#include <openvpn/common/memusage.hpp>
 #include <openvpn/buffer/buffer.hpp>
 #include <openvpn/time/time.hpp>
 #include <openvpn/log/sessionstats.hpp>
@@ -104,6 +106,7 @@ namespace openvpn {
 	invalidation_reason_(Error::SUCCESS),
 	ssl_started_(false),
 	next_retransmit_(Time::infinite()),
+	ack_deadline_(Time::infinite()),
 	stats(stats_arg),
 	now(now_arg),
 	rel_recv(span),
@@ -123,6 +126,30 @@ namespace openvpn {
 	}
     }
 
+    // True if the SSL handshake is parked on an asynchronous
+    // private-key or verify operation.
+    bool ssl_async_pending() const
+    {
+      return ssl_started_ && ssl_->async_pending();
+    }
+
+    void ssl_async_fds(std::vector<int>& fds) const
+    {
+      if (ssl_started_)
+	ssl_->async_fds(fds);
+    }
+
+    // Retry a parked handshake after its asynchronous operation
+    // completed.  Should be followed by flush().
+    void ssl_async_resume()
+    {
+      if (!invalidated() && ssl_started_)
+	{
+	  UseCount use_count(up_stack_reentry_level);
+	  up_sequenced();
+	}
+    }
+
     // Incoming ciphertext packet arriving from network,
     // we will take ownership of pkt.
     bool net_recv(PACKET&& pkt)
@@ -163,11 +190,31 @@ namespace openvpn {
 	}
     }
 
-    // Send pending ACKs back to sender for packets already received
-    void send_pending_acks()
+    // Hold standalone ACKs for up to delay, or until a packet's worth
+    // is pending, so that they can ride on outgoing control data
+    // instead.  Undefined delay sends them on every flush.
+    void set_ack_delay(const Time::Duration& delay)
+    {
+      ack_delay_ = delay;
+    }
+
+    // Send pending ACKs back to sender for packets already received.
+    // ACKs are piggybacked on control packets sent by flush(), so only
+    // those left over go out here as standalone ACK packets, subject
+    // to the delayed-ACK policy unless force is true.
+    void send_pending_acks(const bool force = false)
     {
       if (!invalidated())
 	{
+	  if (!force && ack_delay_.defined() && !xmit_acks.empty() && !xmit_acks.full())
+	    {
+	      if (ack_deadline_.is_infinite())
+		ack_deadline_ = *now + ack_delay_;
+	      if (*now < ack_deadline_)
+		return;
+	    }
+	  ack_deadline_ = Time::infinite();
+
 	  while (!xmit_acks.empty())
 	    {
 	      ack_send_buf.frame_prepare(*frame_, Frame::WRITE_ACK_STANDALONE);
@@ -181,9 +228,11 @@ namespace openvpn {
 	}
     }
 
-    // Send any pending retransmissions
+    // Send any pending retransmissions, and delayed ACKs that are due
     void retransmit()
     {
+      if (!invalidated() && *now >= ack_deadline_)
+	send_pending_acks(true);
       if (!invalidated() && *now >= next_retransmit_)
 	{
 	  for (id_t i = rel_send.head_id(); i < rel_send.tail_id(); ++i)
@@ -192,7 +241,7 @@ namespace openvpn {
 	      if (m.ready_retransmit(*now))
 		{
 		  parent().net_send(m.packet, NET_SEND_RETRANSMIT);
-		  m.reset_retransmit(*now, tls_timeout);
+		  rel_send.retransmitted(m, *now, tls_timeout);
 		}
 	    }
 	  update_retransmit();
@@ -203,7 +252,11 @@ namespace openvpn {
     Time next_retransmit() const
     {
       if (!invalidated())
-	return next_retransmit_;
+	{
+	  Time ret = next_retransmit_;
+	  ret.min(ack_deadline_);
+	  return ret;
+	}
       else
 	return Time::infinite();
     }
@@ -233,11 +286,58 @@ namespace openvpn {
       return ssl_->ssl_handshake_details();
     }
 
+    // True if nothing is queued, unacknowledged, or awaiting
+    // sequencing on the control channel.
+    bool control_idle() const
+    {
+      return app_write_queue.empty()
+	&& raw_write_queue.empty()
+	&& xmit_acks.empty()
+	&& !rel_send.buffered_bytes()
+	&& !rel_recv.buffered_bytes();
+    }
+
+    // Release buffers that are only needed while control channel
+    // traffic is in flight, including the SSL record buffers.
+    // No-op unless control_idle().  Everything is reallocated on
+    // next use.
+    void compact()
+    {
+      if (!invalidated() && !up_stack_reentry_level && control_idle())
+	{
+	  to_app_buf.reset();
+	  ack_send_buf.reset();
+	  if (ssl_started_)
+	    ssl_->release_buffers();
+	}
+    }
+
+    void memory_usage(MemUsage& mu) const
+    {
+      size_t n = rel_send.buffered_bytes() + rel_recv.buffered_bytes();
+      if (to_app_buf)
+	n += to_app_buf->capacity();
+      if (ack_send_buf)
+	n += ack_send_buf.buffer().capacity();
+      for (const auto& b : app_write_queue)
+	n += b->capacity();
+      for (const auto& p : raw_write_queue)
+	if (p)
+	  n += p.buffer().capacity();
+      mu.add(MemUsage::CONTROL, n);
+    }
+
     const AuthCert::Ptr& auth_cert() const
     {
       return ssl_->auth_cert();
     }
 
+    // RFC 5705 keying material from the completed SSL handshake
+    bool export_key_material(unsigned char *dest, const size_t size, const std::string& label)
+    {
+      return ssl_started_ && ssl_->export_key_material(dest, size, label);
+    }
+
   private:
     // Parent methods -- derived class must define these methods
 
@@ -463,6 +563,8 @@ namespace openvpn {
     Error::Type invalidation_reason_;
     bool ssl_started_;
     Time next_retransmit_;
+    Time::Duration ack_delay_;  // delayed-ACK policy, see set_ack_delay()
+    Time ack_deadline_;         // when held ACKs must be sent
     BufferPtr to_app_buf; // cleartext data decrypted by SSL that is to be passed to app via app_recv method
     PACKET ack_send_buf;  // only used for standalone ACKs to be sent to peer
     std::deque<BufferPtr> app_write_queue;
@@ -0,0 +1,284 @@
+//    OpenVPN -- An application to securely tunnel IP networks
+//               over a single port, with support for SSL/TLS-based
+//               session authentication and key exchange,
+//               packet encryption, packet authentication, and
+//               packet compression.
+//
+//    Copyright (C) 2012-2016 OpenVPN Technologies, Inc.
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU Affero General Public License Version 3
+//    as published by the Free Software Foundation.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU Affero General Public License for more details.
+//
+//    You should have received a copy of the GNU Affero General Public License
+//    along with this program in the COPYING file.
+//    If not, see <http://www.gnu.org/licenses/>.
+
+// Receive reorder stage for the UDP data channel.  The replay window
+// accepts packets out of order, which is correct but passes the
+// reordering of multipath or bonded links on to the tunnelled TCP
+// flows, where it looks like loss.  Packets that arrive ahead of a
+// gap in the packet IDs are held in a small ring until the gap fills,
+// or until a hold time derived from how long gaps have taken to fill
+// so far, and are then released in packet ID order.
+
+#ifndef OPENVPN_SSL_REORDER_H
+#define OPENVPN_SSL_REORDER_H
+
+#include <cstdint>   // for std::uint64_t
+#include <vector>
+#include <algorithm> // for std::min, std::max
+
+#include <openvpn/common/likely.hpp>
+#include <openvpn/buffer/buffer.hpp>
+#include <openvpn/time/time.hpp>
+
+namespace openvpn {
+
+  class DataReorder
+  {
+  public:
+    struct Config
+    {
+      Config()
+	: window(64),
+	  min_hold(Time::Duration::milliseconds(1)),
+	  max_hold(Time::Duration::milliseconds(10))
+      {
+      }
+
+      size_t window;           // packets held at most, rounded up to a power of 2
+      Time::Duration min_hold; // bounds of the adaptive hold time
+      Time::Duration max_hold;
+    };
+
+    struct Stats
+    {
+      std::uint64_t held = 0;    // packets that waited for a gap to fill
+      std::uint64_t late = 0;    // packets that arrived after their gap was given up
+      std::uint64_t skipped = 0; // packet IDs given up as lost
+    };
+
+    explicit DataReorder(const Config& config_arg)
+      : config(config_arg),
+	fill_avg(config_arg.max_hold.raw() * 4) // start at max_hold
+    {
+      size_t n = 2;
+      while (n < config.window)
+	n <<= 1;
+      ring.resize(n);
+      mask = n - 1;
+    }
+
+    // Pass a packet that has just passed the replay check, with its
+    // key ID and packet ID.  Packets that can go to tun now, including
+    // empty ones such as keepalives and bundles, are left in buf.
+    // Packets ahead of a gap are moved into the ring, leaving buf
+    // empty.  In both cases, call pop() afterwards.
+    void push(const unsigned int key_id, const std::uint64_t pid, BufferAllocated& buf, const Time& now)
+    {
+      if (unlikely(!started))
+	{
+	  start(key_id, pid);
+	  return;
+	}
+
+      if (unlikely(key_id != key))
+	{
+	  // a new key starts its own packet ID sequence, so give up
+	  // the gaps of the old one and queue the packet behind it
+	  if (n_held)
+	    drain_then(key_id, pid, buf);
+	  else
+	    start(key_id, pid);
+	  return;
+	}
+
+      if (likely(pid == next_pid))
+	{
+	  ++next_pid;
+	  if (unlikely(n_held))
+	    {
+	      // gap filled, learn how long it took
+	      fill_sample(now - gap_since);
+	      gap_since = now;
+	    }
+	  return;
+	}
+
+      if (pid < next_pid)
+	{
+	  // too late to be ordered, but better late than dropped
+	  ++stats_.late;
+	  fill_sample(hold() * 2);
+	  return;
+	}
+
+      if (pid - next_pid > mask)
+	{
+	  // beyond the ring, give up everything held
+	  drain_then(key_id, pid, buf);
+	  return;
+	}
+
+      Slot& s = ring[pid & mask];
+      s.buf.swap(buf);
+      buf.reset_size();
+      s.used = true;
+      s.arrival = now;
+      if (!n_held++)
+	gap_since = now;
+      if (s.buf.size())
+	++stats_.held;
+    }
+
+    // Return the next packet that can go to tun, or nullptr.  The
+    // buffer stays valid until the next push() or pop() call.  Call
+    // until it returns nullptr before the next push().
+    BufferAllocated* pop()
+    {
+      while (n_held)
+	{
+	  Slot& s = ring[next_pid & mask];
+	  if (s.used)
+	    {
+	      s.used = false;
+	      ++next_pid;
+	      if (!--n_held)
+		deadline = Time::infinite();
+	      if (!s.buf.size())
+		continue; // keepalive or bundle, already handled
+	      out.swap(s.buf);
+	      s.buf.reset_size();
+	      return &out;
+	    }
+	  if (!draining)
+	    {
+	      // a gap is given up once the oldest packet behind it
+	      // has waited for the hold time
+	      const Time due = oldest_arrival() + hold();
+	      if (!skipping || due > skip_now)
+		{
+		  skipping = false;
+		  deadline = due;
+		  return nullptr;
+		}
+	    }
+	  ++next_pid;
+	  ++stats_.skipped;
+	}
+      skipping = false;
+      if (draining)
+	{
+	  draining = false;
+	  start(pending_key, pending_pid);
+	  if (pending.size())
+	    {
+	      out.swap(pending);
+	      pending.reset_size();
+	      return &out;
+	    }
+	}
+      return nullptr;
+    }
+
+    // Give up gaps whose hold time has expired, then call pop().
+    void expire(const Time& now)
+    {
+      if (n_held && now >= deadline)
+	{
+	  skipping = true;
+	  skip_now = now;
+	  deadline = Time::infinite();
+	}
+    }
+
+    // When expire() should next be called, or infinite.
+    Time next_event() const
+    {
+      return deadline;
+    }
+
+    Time::Duration hold() const
+    {
+      Time::Duration h = Time::Duration::binary_ms(fill_avg / 4);
+      h = std::max(h, config.min_hold);
+      return std::min(h, config.max_hold);
+    }
+
+    const Stats& stats() const { return stats_; }
+
+  private:
+    struct Slot
+    {
+      BufferAllocated buf;
+      Time arrival;
+      bool used = false;
+    };
+
+    void start(const unsigned int key_id, const std::uint64_t pid)
+    {
+      started = true;
+      key = key_id;
+      next_pid = pid + 1;
+    }
+
+    // release everything held, then the packet in buf
+    void drain_then(const unsigned int key_id, const std::uint64_t pid, BufferAllocated& buf)
+    {
+      draining = true;
+      pending_key = key_id;
+      pending_pid = pid;
+      pending.swap(buf);
+      buf.reset_size();
+      deadline = Time::infinite();
+    }
+
+    Time oldest_arrival() const
+    {
+      Time t = Time::infinite();
+      for (const auto& s : ring)
+	if (s.used)
+	  t.min(s.arrival);
+      return t;
+    }
+
+    // fill_avg is an EWMA (gain 1/8) of gap fill time in binary ms,
+    // scaled by 8, and hold() is twice the average
+    void fill_sample(const Time::Duration& d)
+    {
+      fill_avg = fill_avg - fill_avg / 8 + std::min(d, config.max_hold).raw();
+    }
+
+    const Config config;
+    std::vector<Slot> ring;
+    size_t mask;
+
+    bool started = false;
+    unsigned int key = 0;
+    std::uint64_t next_pid = 0;
+    size_t n_held = 0;
+
+    Time gap_since;
+    Time deadline = Time::infinite();
+    Time skip_now;
+    bool skipping = false;
+    std::uint64_t fill_avg;
+
+    bool draining = false;
+    unsigned int pending_key = 0;
+    std::uint64_t pending_pid = 0;
+    BufferAllocated pending;
+
+    BufferAllocated out;
+    Stats stats_;
+  };
+
+}
+
+#endif
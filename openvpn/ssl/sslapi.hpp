@@ -25,6 +25,7 @@
 #define OPENVPN_SSL_SSLAPI_H
 
 #include <string>
+#include <vector>
 
 #include <openvpn/common/size.hpp>
 #include <openvpn/common/exception.hpp>
@@ -57,6 +58,24 @@ namespace openvpn {
     virtual BufferPtr read_ciphertext() = 0;
     virtual std::string ssl_handshake_details() const = 0;
     virtual const AuthCert::Ptr& auth_cert() const = 0;
+
+    // Asynchronous handshake support (SSLConst::ENABLE_ASYNC).  While a
+    // private-key or verify operation is running elsewhere (another
+    // thread, an OpenSSL ASYNC job, or a hardware engine), the handshake
+    // makes no progress and async_pending() returns true.  The caller
+    // waits for one of async_fds() to become readable and then resumes
+    // by retrying the handshake (see ProtoStackBase::ssl_async_resume).
+    virtual bool async_pending() const { return false; }
+    virtual void async_fds(std::vector<int>& fds) const {}
+
+    // Free internal record buffers while the session is idle, if the
+    // implementation supports it.  They are reallocated on next use.
+    virtual void release_buffers() {}
+
+    // RFC 5705 keying material exporter, returns false if the
+    // implementation doesn't support it or the handshake is incomplete.
+    virtual bool export_key_material(unsigned char *dest, const size_t size,
+				     const std::string& label) { return false; }
   };
 
   class SSLFactoryAPI : public RC<thread_unsafe_refcount>
@@ -77,6 +96,13 @@ namespace openvpn {
 
     // client or server?
     virtual const Mode& mode() const = 0;
+
+    // Client session resumption (SSLConst::ENABLE_SESSION_CACHE): SSL objects
+    // created after this call offer the session last negotiated under key.
+    virtual void set_session_cache_key(const std::string& key) {}
+
+    // True if SSLAPI::export_key_material is implemented.
+    virtual bool key_material_export_supported() const { return false; }
   };
 
   class SSLConfigAPI : public RC<thread_unsafe_refcount>
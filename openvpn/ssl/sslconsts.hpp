@@ -52,6 +52,16 @@ namespace openvpn {
       // fail status data via AuthCert so the higher layers
       // can handle it.
       DEFERRED_CERT_VERIFY=(1<<3),
+
+      // Allow private-key and verify operations to complete
+      // asynchronously (see SSLAPI::async_pending), if supported
+      // by the SSL implementation and its crypto engine.
+      ENABLE_ASYNC=(1<<4),
+
+      // Allow abbreviated handshakes on reconnect.  Client caches
+      // one session per remote (see SSLFactoryAPI::set_session_cache_key),
+      // server accepts session tickets if ticket keys are configured.
+      ENABLE_SESSION_CACHE=(1<<5),
     };
 
   }
@@ -0,0 +1,144 @@
+//    OpenVPN -- An application to securely tunnel IP networks
+//               over a single port, with support for SSL/TLS-based
+//               session authentication and key exchange,
+//               packet encryption, packet authentication, and
+//               packet compression.
+//
+//    Copyright (C) 2012-2016 OpenVPN Technologies, Inc.
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU Affero General Public License Version 3
+//    as published by the Free Software Foundation.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU Affero General Public License for more details.
+//
+//    You should have received a copy of the GNU Affero General Public License
+//    along with this program in the COPYING file.
+//    If not, see <http://www.gnu.org/licenses/>.
+
+// Rotating server-side key set for stateless TLS session tickets (RFC 5077)
+
+#ifndef OPENVPN_SSL_TICKETKEYS_H
+#define OPENVPN_SSL_TICKETKEYS_H
+
+#include <cstring>
+
+#include <openvpn/common/size.hpp>
+#include <openvpn/common/exception.hpp>
+#include <openvpn/common/rc.hpp>
+#include <openvpn/common/memneq.hpp>
+#include <openvpn/time/time.hpp>
+#include <openvpn/random/randapi.hpp>
+
+namespace openvpn {
+
+  // New tickets are always issued under the current key.  After
+  // each rotation the previous key is still accepted for one more
+  // lifetime, so a ticket is honoured for at most two lifetimes and
+  // clients presenting an old-key ticket get a fresh one.  Keys are
+  // random and never leave memory, so restarting the server simply
+  // invalidates all outstanding tickets.
+  //
+  // Not thread-safe: share one object only between SSL contexts that
+  // run on the same thread.
+  class TLSTicketKeys : public RC<thread_unsafe_refcount>
+  {
+  public:
+    typedef RCPtr<TLSTicketKeys> Ptr;
+
+    OPENVPN_SIMPLE_EXCEPTION(tls_ticket_keys_no_rng);
+
+    enum {
+      NAME_SIZE = 16,   // matches OpenSSL tlsext ticket key name
+      CIPHER_KEY_SIZE = 32, // AES-256
+      HMAC_KEY_SIZE = 32,   // HMAC-SHA256
+      IV_SIZE = 16,
+    };
+
+    struct Key
+    {
+      unsigned char name[NAME_SIZE];
+      unsigned char cipher_key[CIPHER_KEY_SIZE];
+      unsigned char hmac_key[HMAC_KEY_SIZE];
+    };
+
+    TLSTicketKeys(const RandomAPI::Ptr& rng_arg,
+		  const Time::Duration& lifetime_arg)
+      : rng(rng_arg),
+	lifetime(lifetime_arg),
+	has_previous(false)
+    {
+      if (!rng)
+	throw tls_ticket_keys_no_rng();
+      generate(current_);
+      rotate_at = Time::now() + lifetime;
+    }
+
+    ~TLSTicketKeys()
+    {
+      std::memset(&current_, 0, sizeof(current_));
+      std::memset(&previous_, 0, sizeof(previous_));
+    }
+
+    // key for issuing new tickets, rotating first if due
+    const Key& current()
+    {
+      rotate_if_due();
+      return current_;
+    }
+
+    // Return the key named by a presented ticket, or nullptr if
+    // unknown.  Sets renew if the client should get a new ticket.
+    const Key* lookup(const unsigned char *name, bool& renew)
+    {
+      rotate_if_due();
+      renew = false;
+      if (!crypto::memneq(name, current_.name, NAME_SIZE))
+	return &current_;
+      if (has_previous && !crypto::memneq(name, previous_.name, NAME_SIZE))
+	{
+	  renew = true;
+	  return &previous_;
+	}
+      return nullptr;
+    }
+
+    void iv(unsigned char *dest)
+    {
+      rng->rand_bytes(dest, IV_SIZE);
+    }
+
+    // force an immediate rotation, e.g. on suspected key compromise
+    void rotate()
+    {
+      previous_ = current_;
+      has_previous = true;
+      generate(current_);
+      rotate_at = Time::now() + lifetime;
+    }
+
+  private:
+    void rotate_if_due()
+    {
+      if (Time::now() >= rotate_at)
+	rotate();
+    }
+
+    void generate(Key& key)
+    {
+      rng->rand_fill(key);
+    }
+
+    RandomAPI::Ptr rng;
+    Time::Duration lifetime;
+    Time rotate_at;
+    Key current_;
+    Key previous_;
+    bool has_previous;
+  };
+}
+
+#endif
@@ -0,0 +1,149 @@
+//    OpenVPN -- An application to securely tunnel IP networks
+//               over a single port, with support for SSL/TLS-based
+//               session authentication and key exchange,
+//               packet encryption, packet authentication, and
+//               packet compression.
+//
+//    Copyright (C) 2012-2016 OpenVPN Technologies, Inc.
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU Affero General Public License Version 3
+//    as published by the Free Software Foundation.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU Affero General Public License for more details.
+//
+//    You should have received a copy of the GNU Affero General Public License
+//    along with this program in the COPYING file.
+//    If not, see <http://www.gnu.org/licenses/>.
+
+// Server-side cache of successful peer certificate verifications
+
+#ifndef OPENVPN_SSL_VERIFYCACHE_H
+#define OPENVPN_SSL_VERIFYCACHE_H
+
+#include <string>
+#include <list>
+#include <unordered_map>
+#include <memory>
+#include <utility>
+
+#include <openvpn/common/size.hpp>
+#include <openvpn/common/rc.hpp>
+#include <openvpn/time/time.hpp>
+#include <openvpn/pki/x509track.hpp>
+
+namespace openvpn {
+
+  // Entries are keyed by a digest of the DER-encoded leaf cert and
+  // tagged with the trust generation (CA/CRL set) they were verified
+  // under.  invalidate() starts a new generation, so entries verified
+  // against replaced CAs or CRLs are never returned again.  Only
+  // verifications that passed without any recorded failure are cached.
+  //
+  // Not thread-safe: share one object only between SSL contexts that
+  // run on the same thread.
+  class TLSVerifyCache : public RC<thread_unsafe_refcount>
+  {
+  public:
+    typedef RCPtr<TLSVerifyCache> Ptr;
+
+    // results of a successful verification, as extracted into AuthCert
+    struct Entry
+    {
+      std::string cn;
+      long sn = -1;
+      unsigned char issuer_fp[20];
+      std::unique_ptr<X509Track::Set> x509_track;
+
+    private:
+      friend class TLSVerifyCache;
+      Time expire;
+      unsigned int generation = 0;
+      std::list<std::string>::iterator order;
+    };
+
+    TLSVerifyCache(const size_t max_entries_arg,
+		   const Time::Duration& ttl_arg)
+      : max_entries(max_entries_arg ? max_entries_arg : 1),
+	ttl(ttl_arg)
+    {
+    }
+
+    // current trust generation
+    unsigned int generation() const
+    {
+      return generation_;
+    }
+
+    // start a new trust generation, call when CAs or CRLs change
+    unsigned int invalidate()
+    {
+      map.clear();
+      order.clear();
+      return ++generation_;
+    }
+
+    // return the unexpired entry for leaf digest, or nullptr
+    const Entry* lookup(const std::string& digest, const unsigned int gen)
+    {
+      auto i = map.find(digest);
+      if (i == map.end())
+	return nullptr;
+      Entry& e = i->second;
+      if (e.generation != gen || Time::now() >= e.expire)
+	{
+	  erase(i);
+	  return nullptr;
+	}
+      return &e;
+    }
+
+    // add or replace the entry for leaf digest, caller fills it in
+    Entry& insert(const std::string& digest, const unsigned int gen)
+    {
+      if (gen != generation_)
+	{
+	  // verified under stale trust, keep it out of the shared map
+	  stale = Entry();
+	  return stale;
+	}
+      auto i = map.find(digest);
+      if (i != map.end())
+	erase(i);
+      while (map.size() >= max_entries)
+	erase(map.find(order.front()));
+      order.push_back(digest);
+      Entry& e = map[digest];
+      e.expire = Time::now() + ttl;
+      e.generation = gen;
+      e.order = std::prev(order.end());
+      return e;
+    }
+
+    size_t size() const
+    {
+      return map.size();
+    }
+
+  private:
+    typedef std::unordered_map<std::string, Entry> Map;
+
+    void erase(Map::iterator i)
+    {
+      order.erase(i->second.order);
+      map.erase(i);
+    }
+
+    const size_t max_entries;
+    const Time::Duration ttl;
+    unsigned int generation_ = 0;
+    Map map;
+    std::list<std::string> order; // insertion order, oldest first
+    Entry stale;
+  };
+}
+
+#endif
@@ -69,6 +69,22 @@ namespace openvpn {
     {
       return asio::basic_waitable_timer<AsioClock>::expires_at(AsioClock::to_time_point(t));
     }    
+
+    // Like expires_at, but delay t by up to leeway so that it lands on
+    // a multiple of leeway since the time base.  Timers armed with the
+    // same leeway then expire together instead of waking separately.
+    std::size_t expires_at_coalesced(const Time& t, const Time::Duration& leeway)
+    {
+      return expires_at(coalesce(t, leeway));
+    }
+
+    static Time coalesce(const Time& t, const Time::Duration& leeway)
+    {
+      if (!leeway.enabled() || !leeway.raw() || t.is_infinite())
+	return t;
+      const auto l = leeway.raw();
+      return t + Time::Duration::binary_ms((l - t.raw() % l) % l);
+    }
   };
 }
 
@@ -34,11 +34,19 @@
 // but imposes a wraparound limit of ~ 48 days.  Servers
 // should always use a 64-bit data type to avoid this
 // limitation.
+//
+// Where the platform has CLOCK_MONOTONIC, time is read from it
+// rather than from the wall clock, so that NTP steps don't disturb
+// timers.  It is calibrated against the wall clock in reset_base(),
+// so seconds_since_epoch() remains approximately wall time.  Define
+// OPENVPN_TIME_COARSE to read CLOCK_MONOTONIC_COARSE instead, which
+// is cheaper still, at the kernel tick resolution (1-10 ms).
 
 #ifndef OPENVPN_TIME_TIME_H
 #define OPENVPN_TIME_TIME_H
 
 #include <limits>
+#include <atomic>
 #include <cstdint> // for std::uint32_t, uint64_t
 
 #include <openvpn/common/platform.hpp>
@@ -50,6 +58,16 @@
 #include <windows.h>  // for GetTickCount
 #else
 #include <sys/time.h> // for ::time() and ::gettimeofday()
+#include <time.h>     // for ::clock_gettime()
+#endif
+
+#if !defined(OPENVPN_PLATFORM_WIN) && defined(CLOCK_MONOTONIC)
+#define OPENVPN_TIME_MONOTONIC
+#if defined(OPENVPN_TIME_COARSE) && defined(CLOCK_MONOTONIC_COARSE)
+#define OPENVPN_TIME_CLOCK CLOCK_MONOTONIC_COARSE
+#else
+#define OPENVPN_TIME_CLOCK CLOCK_MONOTONIC
+#endif
 #endif
 
 namespace openvpn {
@@ -200,6 +218,28 @@ namespace openvpn {
     base_type seconds_since_epoch() const { return base_ + time_ / prec; }
     T fractional_binary_ms() const { return time_ % prec; }
 
+    // While a Batch is in scope on a thread, now() and update() on
+    // that thread return the time the outermost Batch began, so that
+    // all the packets of one I/O burst share a single clock read.
+    class Batch
+    {
+    public:
+      Batch()
+      {
+	BatchState& bs = batch_state();
+	if (!bs.depth++)
+	  bs.time = clock_();
+      }
+
+      ~Batch()
+      {
+	--batch_state().depth;
+      }
+
+      Batch(const Batch&) = delete;
+      Batch& operator=(const Batch&) = delete;
+    };
+
     static TimeType now() { return TimeType(now_()); }
 
     void update() { time_ = now_(); }
@@ -280,6 +320,9 @@ namespace openvpn {
       base_ = ::time(0);
 #     ifdef OPENVPN_PLATFORM_WIN
         win_recalibrate(::GetTickCount());
+#     endif
+#     ifdef OPENVPN_TIME_MONOTONIC
+        mono_calibrate();
 #     endif
     }
 
@@ -293,6 +336,26 @@ namespace openvpn {
   private:
     explicit TimeType(const T time) : time_(time) {}
 
+    struct BatchState
+    {
+      unsigned int depth;
+      T time;
+    };
+
+    static BatchState& batch_state()
+    {
+      static thread_local BatchState bs;
+      return bs;
+    }
+
+    static T now_()
+    {
+      const BatchState& bs = batch_state();
+      if (bs.depth)
+	return bs.time;
+      return clock_();
+    }
+
 #ifdef OPENVPN_PLATFORM_WIN
 
     static void win_recalibrate(const DWORD gtc)
@@ -301,7 +364,7 @@ namespace openvpn {
       gtc_base = ::time(0) - gtc_last/1000;
     }
 
-    static T now_()
+    static T clock_()
     {
       const DWORD gtc = ::GetTickCount();
       if (gtc < gtc_last)
@@ -314,9 +377,43 @@ namespace openvpn {
     static DWORD gtc_last;
     static time_t gtc_base;
 
+#elif defined(OPENVPN_TIME_MONOTONIC)
+
+    static std::int64_t mono_ns()
+    {
+      ::timespec ts;
+      if (::clock_gettime(OPENVPN_TIME_CLOCK, &ts) != 0)
+	throw get_time_error();
+      return std::int64_t(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+    }
+
+    // Pick the monotonic origin so that clock_() continues from the
+    // wall clock's position relative to base_.
+    static std::int64_t mono_calibrate()
+    {
+      ::timeval tv;
+      if (::gettimeofday(&tv, nullptr) != 0)
+	throw get_time_error();
+      const std::int64_t origin = mono_ns()
+	- (std::int64_t(tv.tv_sec - base_) * 1000000000 + std::int64_t(tv.tv_usec) * 1000);
+      mono_origin_.store(origin, std::memory_order_relaxed);
+      return origin;
+    }
+
+    static T clock_()
+    {
+      std::int64_t origin = mono_origin_.load(std::memory_order_relaxed);
+      if (!origin) // reset_base() not called yet
+	origin = mono_calibrate();
+      const std::int64_t ns = mono_ns() - origin;
+      return T((ns / 1000000000) * prec + (ns % 1000000000) * prec / 1000000000);
+    }
+
+    static std::atomic<std::int64_t> mono_origin_;
+
 #else
 
-    static T now_()
+    static T clock_()
     {
       ::timeval tv;
       if (::gettimeofday(&tv, nullptr) != 0)
@@ -335,6 +432,10 @@ namespace openvpn {
   template <typename T> time_t TimeType<T>::gtc_base;
 #endif
 
+#ifdef OPENVPN_TIME_MONOTONIC
+  template <typename T> std::atomic<std::int64_t> TimeType<T>::mono_origin_(0);
+#endif
+
   template <typename T> typename TimeType<T>::base_type TimeType<T>::base_;
 
   typedef TimeType<oulong> Time;
@@ -0,0 +1,336 @@
+//    OpenVPN -- An application to securely tunnel IP networks
+//               over a single port, with support for SSL/TLS-based
+//               session authentication and key exchange,
+//               packet encryption, packet authentication, and
+//               packet compression.
+//
+//    Copyright (C) 2012-2016 OpenVPN Technologies, Inc.
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU Affero General Public License Version 3
+//    as published by the Free Software Foundation.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU Affero General Public License for more details.
+//
+//    You should have received a copy of the GNU Affero General Public License
+//    along with this program in the COPYING file.
+//    If not, see <http://www.gnu.org/licenses/>.
+
+// Hierarchical timer wheel, so that many sessions can share one
+// AsioTimer for coarse housekeeping wakeups.
+
+#ifndef OPENVPN_TIME_TIMERWHEEL_H
+#define OPENVPN_TIME_TIMERWHEEL_H
+
+#include <cstdint>
+
+#include <asio.hpp>
+
+#include <openvpn/common/rc.hpp>
+#include <openvpn/time/time.hpp>
+#include <openvpn/time/coarsetime.hpp>
+#include <openvpn/time/asiotimer.hpp>
+
+namespace openvpn {
+
+  // Time is quantized into ticks of 256 binary ms (1/4 second).
+  // Level 0 has 256 tick slots (64 sec), levels 1-3 have 64 slots
+  // each, covering 256^1*64, 256*64^2, and 256*64^3 ticks, beyond
+  // which expirations are clamped and re-evaluated on cascade.
+  // Entries are intrusive list nodes, so schedule and cancel are
+  // O(1).  While any entry is scheduled the wheel wakes once per
+  // tick and runs every entry that is due in that tick as a batch.
+  // Entry cancels itself on destruction.
+  class TimerWheel : public RC<thread_unsafe_refcount>
+  {
+    struct Link
+    {
+      Link* prev = nullptr;
+      Link* next = nullptr;
+
+      void init_head()
+      {
+	prev = next = this;
+      }
+
+      bool empty_head() const
+      {
+	return next == this;
+      }
+    };
+
+  public:
+    typedef RCPtr<TimerWheel> Ptr;
+    typedef std::uint64_t tick_t;
+
+    enum {
+      TICK_SHIFT = 8,     // 256 binary ms per tick
+      L0_BITS = 8,
+      LN_BITS = 6,
+      N_UPPER = 3,        // levels above level 0
+      L0_SIZE = 1 << L0_BITS,
+      LN_SIZE = 1 << LN_BITS,
+    };
+
+    class Entry : private Link
+    {
+      friend class TimerWheel;
+
+    public:
+      Entry() {}
+
+      // wheel is not copied
+      Entry(const Entry&) : Link() {}
+      Entry& operator=(const Entry&) { return *this; }
+
+      virtual ~Entry()
+      {
+	if (wheel)
+	  wheel->cancel(*this);
+      }
+
+      bool timer_wheel_scheduled() const
+      {
+	return wheel != nullptr;
+      }
+
+    protected:
+      // called by the wheel when expiration is reached,
+      // entry is no longer scheduled and may reschedule
+      virtual void timer_wheel_expired() = 0;
+
+    private:
+      TimerWheel* wheel = nullptr;
+      tick_t expires = 0;
+    };
+
+    TimerWheel(asio::io_context& io_context)
+      : timer(io_context),
+	current(0),
+	count(0),
+	armed(false),
+	halt(false)
+    {
+      for (auto &s : level0)
+	s.init_head();
+      for (auto &l : upper)
+	for (auto &s : l)
+	  s.init_head();
+    }
+
+    virtual ~TimerWheel()
+    {
+      stop();
+    }
+
+    // Schedule or reschedule e to expire at t.  An infinite
+    // t cancels.  Expiration is rounded up to the next tick.
+    void schedule(Entry& e, const Time& t)
+    {
+      if (halt)
+	return;
+      if (t.is_infinite())
+	{
+	  cancel(e);
+	  return;
+	}
+      if (!count)
+	current = to_tick(Time::now());
+      if (e.wheel)
+	unlink(e);
+      e.wheel = this;
+      e.expires = to_tick(t) + 1;
+      insert(e);
+      ++count;
+      arm();
+    }
+
+    void cancel(Entry& e)
+    {
+      if (e.wheel == this)
+	{
+	  unlink(e);
+	  e.wheel = nullptr;
+	  --count;
+	}
+    }
+
+    // number of scheduled entries
+    size_t size() const
+    {
+      return count;
+    }
+
+    // Unschedule all entries and stop the timer.
+    void stop()
+    {
+      if (!halt)
+	{
+	  halt = true;
+	  for (auto &s : level0)
+	    clear(s);
+	  for (auto &l : upper)
+	    for (auto &s : l)
+	      clear(s);
+	  count = 0;
+	  timer.cancel();
+	}
+    }
+
+  private:
+    static tick_t to_tick(const Time& t)
+    {
+      return tick_t(t.raw()) >> TICK_SHIFT;
+    }
+
+    static Time from_tick(const tick_t tick)
+    {
+      return Time::zero() + Time::Duration::binary_ms(tick << TICK_SHIFT);
+    }
+
+    static unsigned int upper_shift(const unsigned int level) // level in [0, N_UPPER)
+    {
+      return L0_BITS + LN_BITS * level;
+    }
+
+    static void link_tail(Link& head, Link& l)
+    {
+      l.prev = head.prev;
+      l.next = &head;
+      head.prev->next = &l;
+      head.prev = &l;
+    }
+
+    static void unlink(Link& l)
+    {
+      l.prev->next = l.next;
+      l.next->prev = l.prev;
+      l.prev = l.next = nullptr;
+    }
+
+    // move all nodes of from onto to, which must be empty
+    static void splice(Link& from, Link& to)
+    {
+      if (from.empty_head())
+	to.init_head();
+      else
+	{
+	  to.next = from.next;
+	  to.prev = from.prev;
+	  to.next->prev = &to;
+	  to.prev->next = &to;
+	  from.init_head();
+	}
+    }
+
+    static void clear(Link& head)
+    {
+      while (!head.empty_head())
+	{
+	  Entry& e = static_cast<Entry&>(*head.next);
+	  unlink(e);
+	  e.wheel = nullptr;
+	}
+    }
+
+    // place e in a slot according to e.expires relative to current
+    void insert(Entry& e)
+    {
+      if (e.expires <= current)
+	e.expires = current + 1;
+      const tick_t delta = e.expires - current;
+      if (delta < L0_SIZE)
+	{
+	  link_tail(level0[e.expires & (L0_SIZE - 1)], e);
+	  return;
+	}
+      for (unsigned int level = 0; level < N_UPPER; ++level)
+	{
+	  if (delta < (tick_t(1) << (upper_shift(level) + LN_BITS)) || level == N_UPPER - 1)
+	    {
+	      tick_t exp = e.expires;
+	      if (level == N_UPPER - 1 && delta >= (tick_t(1) << (upper_shift(level) + LN_BITS)))
+		exp = current + (tick_t(1) << (upper_shift(level) + LN_BITS)) - 1; // clamp, re-evaluated on cascade
+	      link_tail(upper[level][(exp >> upper_shift(level)) & (LN_SIZE - 1)], e);
+	      return;
+	    }
+	}
+    }
+
+    // redistribute the slot of level that current has just entered
+    void cascade(const unsigned int level)
+    {
+      const unsigned int idx = (current >> upper_shift(level)) & (LN_SIZE - 1);
+      Link pending;
+      splice(upper[level][idx], pending);
+      while (!pending.empty_head())
+	{
+	  Entry& e = static_cast<Entry&>(*pending.next);
+	  unlink(e);
+	  insert(e);
+	}
+      if (!idx && level + 1 < N_UPPER)
+	cascade(level + 1);
+    }
+
+    void arm()
+    {
+      if (!armed && count && !halt)
+	{
+	  armed = true;
+	  timer.expires_at(from_tick(current + 1));
+	  timer.async_wait([self=Ptr(this)](const asio::error_code& error)
+			   {
+			     self->tick(error);
+			   });
+	}
+    }
+
+    void tick(const asio::error_code& error)
+    {
+      armed = false;
+      if (error || halt)
+	return;
+      const tick_t target = to_tick(Time::now());
+      while (current < target && count)
+	{
+	  ++current;
+	  if (!(current & (L0_SIZE - 1)))
+	    cascade(0);
+
+	  // entries scheduled from a callback land in a later
+	  // slot, so the batch can't grow while we run it
+	  Link due;
+	  splice(level0[current & (L0_SIZE - 1)], due);
+	  while (!due.empty_head() && !halt)
+	    {
+	      Entry& e = static_cast<Entry&>(*due.next);
+	      unlink(e);
+	      e.wheel = nullptr;
+	      --count;
+	      e.timer_wheel_expired();
+	    }
+	  if (halt)
+	    {
+	      clear(due);
+	      return;
+	    }
+	}
+      arm();
+    }
+
+    AsioTimer timer;
+    Link level0[L0_SIZE];
+    Link upper[N_UPPER][LN_SIZE];
+    tick_t current;
+    size_t count;
+    bool armed;
+    bool halt;
+  };
+
+}
+
+#endif
@@ -42,6 +42,7 @@
 #include <openvpn/common/userpass.hpp>
 #include <openvpn/buffer/bufstr.hpp>
 #include <openvpn/buffer/buflimit.hpp>
+#include <openvpn/time/asiotimer.hpp>
 #include <openvpn/transport/tcplink.hpp>
 #include <openvpn/transport/client/transbase.hpp>
 #include <openvpn/transport/socket_protect.hpp>
@@ -52,12 +53,15 @@
 #include <openvpn/proxy/proxyauth.hpp>
 #include <openvpn/proxy/httpdigest.hpp>
 #include <openvpn/proxy/ntlm.hpp>
+#include <openvpn/proxy/authcache.hpp>
 #include <openvpn/client/remotelist.hpp>
 #include <openvpn/crypto/digestapi.hpp>
 
 namespace openvpn {
   namespace HTTPProxyTransport {
 
+    class Client;
+
     class Options : public RC<thread_safe_refcount>
     {
     public:
@@ -75,13 +79,31 @@ namespace openvpn {
 
       typedef RCPtr<Options> Ptr;
 
-      Options() : allow_cleartext_auth(false) {}
+      Options()
+	: allow_cleartext_auth(false),
+	  preconnect_max_age(0),
+	  standby(nullptr)
+      {
+      }
 
       RemoteList::Ptr proxy_server;
       std::string username;
       std::string password;
       bool allow_cleartext_auth;
 
+      // If nonzero, a CONNECT tunnel to the next remote is set up
+      // ahead of failover and kept for up to this many seconds
+      // (http-proxy-option PRECONNECT [seconds]).
+      unsigned int preconnect_max_age;
+
+      // how the proxy last authenticated us, for preemptive auth
+      // on reconnect
+      HTTPProxy::AuthCache auth_cache;
+
+      // pre-established tunnel waiting to be adopted, owned by its
+      // own pending I/O and cleared by it on destruction
+      Client* standby;
+
       std::string http_version;
       std::string user_agent;
 
@@ -156,6 +178,12 @@ namespace openvpn {
 			user_agent = o.get(2, 256);
 			o.touch();
 		      }
+		    else if (type == "PRECONNECT")
+		      {
+			const std::string age = o.get_optional(2, 16);
+			preconnect_max_age = age.empty() ? 20 : parse_number_throw<unsigned int>(age, "http-proxy-option PRECONNECT");
+			o.touch();
+		      }
 		    else if (type == "EXT1" || type == "EXT2" || type == "CUSTOM-HEADER")
 		      {
 			CustomHeader::Ptr h(new CustomHeader());
@@ -233,7 +261,17 @@ namespace openvpn {
 
 	    // Get target server host:port.  We don't care about resolving it
 	    // since proxy server will do that for us.
-	    remote_list().endpoint_available(&server_host, &server_port, nullptr);
+	    if (standby_parent)
+	      {
+		server_host = standby_host;
+		server_port = standby_port;
+	      }
+	    else
+	      {
+		remote_list().endpoint_available(&server_host, &server_port, nullptr);
+		if (adopt_standby())
+		  return;
+	      }
 
 	    // Get proxy server host:port, and resolve it if not already cached
 	    if (proxy_remote_list().endpoint_available(&proxy_host, &proxy_port, nullptr))
@@ -308,7 +346,13 @@ namespace openvpn {
       }
 
       virtual void stop() { stop_(); }
-      virtual ~Client() { stop_(); }
+
+      virtual ~Client()
+      {
+	stop_();
+	if (config->http_proxy_options && config->http_proxy_options->standby == this)
+	  config->http_proxy_options->standby = nullptr;
+      }
 
     private:
       struct ProxyResponseLimit : public BufferLimit<size_t>
@@ -324,6 +368,29 @@ namespace openvpn {
 	}
       };
 
+      // Parent of a standby tunnel.  The tunnel only needs to learn
+      // that it failed, progress and data are of no interest.
+      struct StandbyParent : public TransportClientParent
+      {
+	StandbyParent(Client* client_arg) : client(client_arg) {}
+
+	virtual void transport_recv(BufferAllocated& buf) {}
+	virtual void transport_needs_send() {}
+	virtual void transport_error(const Error::Type fatal_err, const std::string& err_text) { client->standby_discard(); }
+	virtual void proxy_error(const Error::Type fatal_err, const std::string& err_text) { client->standby_discard(); }
+	virtual void ip_hole_punch(const IP::Addr& addr) {}
+	virtual bool transport_is_openvpn_protocol() { return true; }
+	virtual void transport_pre_resolve() {}
+	virtual void transport_wait_proxy() {}
+	virtual void transport_wait() {}
+	virtual void transport_connecting() {}
+	virtual bool is_keepalive_enabled() const { return false; }
+	virtual void disable_keepalive(unsigned int& keepalive_ping,
+				       unsigned int& keepalive_timeout) {}
+
+	Client* client;
+      };
+
       Client(asio::io_context& io_context_arg,
 	     ClientConfig* config_arg,
 	     TransportClientParent& parent_arg)
@@ -337,10 +404,27 @@ namespace openvpn {
 	   proxy_established(false),
 	   http_reply_status(HTTP::ReplyParser::pending),
 	   ntlm_phase_2_response_pending(false),
-	   drain_content_length(0)
+	   drain_content_length(0),
+	   preemptive_auth_sent(false),
+	   tunnel_established(false),
+	   preconnect_timer(io_context_arg),
+	   preconnect_bytes_in(0),
+	   standby_ready(false)
       {
       }
 
+      // construct a standby tunnel to host:port
+      Client(asio::io_context& io_context_arg,
+	     ClientConfig* config_arg,
+	     const std::string& host,
+	     const std::string& port)
+	: Client(io_context_arg, config_arg, *new StandbyParent(this))
+      {
+	standby_parent.reset(static_cast<StandbyParent*>(&parent));
+	standby_host = host;
+	standby_port = port;
+      }
+
       bool send_const(const Buffer& cbuf)
       {
 	if (impl)
@@ -378,6 +462,13 @@ namespace openvpn {
 
       bool tcp_read_handler(BufferAllocated& buf) // called by LinkImpl
       {
+	// fast path once the CONNECT reply and any HTML are consumed
+	if (tunnel_established)
+	  {
+	    parent.transport_recv(buf);
+	    return true;
+	  }
+
 	if (proxy_established)
 	  {
 	    if (!html_skip)
@@ -398,6 +489,14 @@ namespace openvpn {
 	return true;
       }
 
+      bool tcp_read_in_place(BufferAllocated& buf, bool& requeue) // called by LinkImpl
+      {
+	if (!tunnel_established)
+	  return false;
+	requeue = true;
+	return parent.transport_recv_in_place(buf);
+      }
+
       void tcp_write_queue_needs_send() // called by LinkImpl
       {
 	if (proxy_established)
@@ -431,37 +530,38 @@ namespace openvpn {
 	if (http_reply_status == HTTP::ReplyParser::pending)
 	  {
 	    OPENVPN_LOG_NTNL("FROM PROXY: " << buf_to_string(buf));
-	    for (size_t i = 0; i < buf.size(); ++i)
+	    size_t used;
+	    http_reply_status = http_parser.consume(buf.data(), buf.size(), used);
+	    if (http_reply_status != HTTP::ReplyParser::pending)
 	      {
-		http_reply_status = http_parser.consume(http_reply, (char)buf[i]);
-		if (http_reply_status != HTTP::ReplyParser::pending)
+		buf.advance(used);
+		if (http_reply_status == HTTP::ReplyParser::success)
 		  {
-		    buf.advance(i+1);
-		    if (http_reply_status == HTTP::ReplyParser::success)
-		      {
-			//OPENVPN_LOG("*** HTTP header parse complete, resid_size=" << buf.size());
-			//OPENVPN_LOG(http_reply.to_string());
+		    http_reply = http_parser.reply().to_reply();
 
-			// we are connected, switch socket to tunnel mode
-			if (http_reply.status_code == HTTP::Status::Connected)
+		    //OPENVPN_LOG("*** HTTP header parse complete, resid_size=" << buf.size());
+		    //OPENVPN_LOG(http_reply.to_string());
+
+		    // we are connected, switch socket to tunnel mode
+		    if (http_reply.status_code == HTTP::Status::Connected)
+		      {
+			if (standby_parent)
+			  standby_park(buf);
+			else if (config->skip_html)
 			  {
-			    if (config->skip_html)
-			      {
-				proxy_half_connected();
-				html_skip.reset(new HTTP::HTMLSkip());
-				drain_html(buf);
-			      }
-			    else
-			      proxy_connected(buf, true);
+			    proxy_half_connected();
+			    html_skip.reset(new HTTP::HTMLSkip());
+			    drain_html(buf);
 			  }
-			else if (ntlm_phase_2_response_pending)
-			  ntlm_auth_phase_2_pre();
-		      }
-		    else
-		      {
-			throw Exception("HTTP proxy header parse error");
+			else
+			  proxy_connected(buf, true);
 		      }
-		    break;
+		    else if (ntlm_phase_2_response_pending)
+		      ntlm_auth_phase_2_pre();
+		  }
+		else
+		  {
+		    throw Exception("HTTP proxy header parse error");
 		  }
 	      }
 	  }
@@ -483,6 +583,8 @@ namespace openvpn {
       void proxy_connected(BufferAllocated& buf, const bool notify_parent)
       {
 	proxy_established = true;
+	tunnel_established = true;
+	release_proxy_state();
 	if (parent.transport_is_openvpn_protocol())
 	  {
 	    // switch socket from HTTP proxy handshake mode to OpenVPN protocol mode
@@ -504,6 +606,128 @@ namespace openvpn {
 	      parent.transport_connecting();
 	    parent.transport_recv(buf);
 	  }
+	preconnect_arm();
+      }
+
+      // Drop the handshake state, none of it is needed in tunnel mode.
+      void release_proxy_state()
+      {
+	http_reply = HTTP::Reply();
+	http_parser.reset();
+	proxy_response_limit.reset();
+	std::string().swap(http_request);
+      }
+
+      // Standby tunnels to the next remote.  If the server hasn't
+      // answered within PRECONNECT_DELAY of the CONNECT succeeding,
+      // or the proxy can't reach it, a CONNECT tunnel to the next
+      // remote is set up (including proxy auth) while this attempt
+      // runs out, and parked.  The next transport_start() for that
+      // remote adopts the parked socket instead of dialing the proxy.
+
+      enum {
+	PRECONNECT_DELAY_MS = 2000,
+      };
+
+      void preconnect_arm()
+      {
+	if (standby_parent || !config->http_proxy_options->preconnect_max_age)
+	  return;
+	preconnect_bytes_in = config->stats->get_stat(SessionStats::BYTES_IN);
+	preconnect_timer.expires_at(Time::now() + Time::Duration::milliseconds(PRECONNECT_DELAY_MS));
+	preconnect_timer.async_wait([self=Ptr(this)](const asio::error_code& error)
+				    {
+				      if (!error && !self->halt
+					  && self->config->stats->get_stat(SessionStats::BYTES_IN) == self->preconnect_bytes_in)
+					self->standby_start();
+				    });
+      }
+
+      void standby_start()
+      {
+	Options& opt = *config->http_proxy_options;
+	if (standby_parent || !opt.preconnect_max_age || opt.standby || config->skip_html || remote_list().size() < 2)
+	  return;
+	std::string host, port;
+	if (!remote_list().fork(1)->endpoint_available(&host, &port, nullptr))
+	  return;
+	if (host == server_host && port == server_port)
+	  return;
+
+	OPENVPN_LOG("Pre-establishing tunnel to " << host << ':' << port << " via HTTP proxy");
+	Ptr sb(new Client(io_context, config.get(), host, port));
+	opt.standby = sb.get();
+
+	// the expiry timer holds the standby until it is adopted or discarded
+	sb->preconnect_timer.expires_at(Time::now() + Time::Duration::seconds(opt.preconnect_max_age));
+	sb->preconnect_timer.async_wait([sb](const asio::error_code& error)
+					{
+					  sb->stop_();
+					});
+	sb->transport_start();
+      }
+
+      // CONNECT succeeded on a standby tunnel, stop reading and wait
+      void standby_park(BufferAllocated& buf)
+      {
+	if (buf.size())
+	  {
+	    standby_discard(); // server spoke first, can't hand over
+	    return;
+	  }
+	standby_ready = true;
+	proxy_established = true;
+	release_proxy_state();
+	impl->stop();
+	OPENVPN_LOG("Tunnel to " << server_host << ':' << server_port << " via HTTP proxy is on standby");
+      }
+
+      void standby_discard()
+      {
+	stop_();
+	preconnect_timer.cancel();
+      }
+
+      bool adopt_standby()
+      {
+	Options& opt = *config->http_proxy_options;
+	if (!opt.standby)
+	  return false;
+	Ptr sb(opt.standby);
+	opt.standby = nullptr;
+	const bool usable = sb->standby_ready
+	  && !sb->halt
+	  && sb->server_host == server_host
+	  && sb->server_port == server_port;
+	if (usable)
+	  {
+	    // abort the parked read so it can't swallow the first reply
+	    asio::error_code ec;
+	    sb->socket.cancel(ec);
+	    socket = std::move(sb->socket);
+	    server_endpoint = sb->server_endpoint;
+	    proxy_host = sb->proxy_host;
+	    proxy_port = sb->proxy_port;
+	    n_transactions = sb->n_transactions;
+	  }
+	sb->standby_discard();
+	if (!usable)
+	  return false;
+
+	OPENVPN_LOG("Contacting " << server_endpoint << " via pre-established HTTP proxy tunnel");
+	parent.transport_wait_proxy();
+	parent.transport_wait();
+	impl.reset(new LinkImpl(this,
+				socket,
+				0, // send_queue_max_bytes is unlimited because we regulate size in cliproto.hpp
+				config->free_list_max_size,
+				(*config->frame)[Frame::READ_LINK_TCP],
+				config->stats));
+	impl->set_raw_mode(true);
+	impl->start();
+	BufferAllocated empty;
+	proxy_connected(empty, true);
+	return true;
       }
 
       // Called after header received but before possible extraneous HTML
@@ -562,6 +786,16 @@ namespace openvpn {
 	  {
 	    if (http_reply.status_code == HTTP::Status::ProxyAuthenticationRequired)
 	      {
+		// cached credentials were refused, e.g. stale digest nonce,
+		// fall back to answering the challenge
+		if (preemptive_auth_sent)
+		  {
+		    preemptive_auth_sent = false;
+		    auth_cache().clear();
+		  }
+		else if (n_transactions > 1)
+		  auth_cache().clear();
+
 		if (n_transactions <= 1)
 		  {
 		    //OPENVPN_LOG("*** PROXY AUTHENTICATION REQUIRED");
@@ -615,7 +849,8 @@ namespace openvpn {
 		     || http_reply.status_code == HTTP::Status::ServiceUnavailable)
 	      {
 		// this is a nonfatal error, so we pass Error::UNDEF to tell the upper layer to
-		// retry the connection
+		// retry the connection, meanwhile prepare the next remote
+		standby_start();
 		proxy_error(Error::UNDEF, "HTTP proxy server could not connect to OpenVPN server");
 		return;
 	      }
@@ -634,14 +869,20 @@ namespace openvpn {
       {
 	OPENVPN_LOG("Proxy method: Basic" << std::endl << pa.to_string());
 
+	auth_cache().set(HTTPProxy::AuthCache::BASIC, proxy_host, proxy_port, config->http_proxy_options->username);
+	http_request = basic_auth_request();
+	reset();
+	start_connect_();
+      }
+
+      std::string basic_auth_request()
+      {
 	std::ostringstream os;
 	gen_headers(os);
 	os << "Proxy-Authorization: Basic "
 	   << base64->encode(config->http_proxy_options->username + ':' + config->http_proxy_options->password)
 	   << "\r\n";
-	http_request = os.str();
-	reset();
-	start_connect_();
+	return os.str();
       }
 
       void digest_auth(HTTPProxy::ProxyAuthenticate& pa)
@@ -649,56 +890,33 @@ namespace openvpn {
 	try {
 	  OPENVPN_LOG("Proxy method: Digest" << std::endl << pa.to_string());
 
-	  // constants
-	  const std::string http_method = "CONNECT";
-	  const std::string nonce_count = "00000001";
-	  const std::string qop = "auth";
-
 	  // get values from Proxy-Authenticate header
-	  const std::string realm = pa.parms.get_value("realm");
-	  const std::string nonce = pa.parms.get_value("nonce");
-	  const std::string algorithm = pa.parms.get_value("algorithm");
-	  const std::string opaque = pa.parms.get_value("opaque");
+	  HTTPProxy::AuthCache::DigestState ds;
+	  ds.realm = pa.parms.get_value("realm");
+	  ds.nonce = pa.parms.get_value("nonce");
+	  ds.algorithm = pa.parms.get_value("algorithm");
+	  ds.opaque = pa.parms.get_value("opaque");
 
 	  // generate a client nonce
 	  unsigned char cnonce_raw[8];
 	  config->rng->rand_bytes(cnonce_raw, sizeof(cnonce_raw));
-	  const std::string cnonce = render_hex(cnonce_raw, sizeof(cnonce_raw));
-
-	  // build URI
-	  const std::string uri = server_host + ":" + server_port;
+	  ds.cnonce = render_hex(cnonce_raw, sizeof(cnonce_raw));
 
 	  // calculate session key
-	  const std::string session_key = HTTPProxy::Digest::calcHA1(
+	  ds.session_key = HTTPProxy::Digest::calcHA1(
 	      *config->digest_factory,
-	      algorithm,
+	      ds.algorithm,
 	      config->http_proxy_options->username,
-	      realm,
+	      ds.realm,
 	      config->http_proxy_options->password,
-	      nonce,
-	      cnonce);
+	      ds.nonce,
+	      ds.cnonce);
 
-	  // calculate response
-	  const std::string response = HTTPProxy::Digest::calcResponse(
-	      *config->digest_factory,
-	      session_key,
-	      nonce,
-	      nonce_count,
-	      cnonce,
-	      qop,
-	      http_method,
-	      uri,
-	      "");
+	  // keep the session so reconnects can reuse the nonce
+	  auth_cache().set_digest(proxy_host, proxy_port, config->http_proxy_options->username, ds);
 
 	  // generate proxy request
-	  std::ostringstream os;
-	  gen_headers(os);
-	  os << "Proxy-Authorization: Digest username=\"" << config->http_proxy_options->username << "\", realm=\"" << realm << "\", nonce=\"" << nonce << "\", uri=\"" << uri << "\", qop=" << qop << ", nc=" << nonce_count << ", cnonce=\"" << cnonce << "\", response=\"" << response << "\"";
-	  if (!opaque.empty())
-	    os << ", opaque=\"" + opaque + "\"";
-	  os << "\r\n";
-
-	  http_request = os.str();
+	  http_request = digest_auth_request();
 	  reset();
 	  start_connect_();
 	}
@@ -708,6 +926,41 @@ namespace openvpn {
 	  }
       }
 
+      // build Proxy-Authorization from the cached digest session,
+      // using the next nonce-count
+      std::string digest_auth_request()
+      {
+	// constants
+	const std::string http_method = "CONNECT";
+	const std::string qop = "auth";
+
+	const std::string nonce_count = auth_cache().next_nonce_count();
+	const HTTPProxy::AuthCache::DigestState& ds = auth_cache().digest();
+
+	// build URI
+	const std::string uri = server_host + ":" + server_port;
+
+	// calculate response
+	const std::string response = HTTPProxy::Digest::calcResponse(
+	    *config->digest_factory,
+	    ds.session_key,
+	    ds.nonce,
+	    nonce_count,
+	    ds.cnonce,
+	    qop,
+	    http_method,
+	    uri,
+	    "");
+
+	std::ostringstream os;
+	gen_headers(os);
+	os << "Proxy-Authorization: Digest username=\"" << config->http_proxy_options->username << "\", realm=\"" << ds.realm << "\", nonce=\"" << ds.nonce << "\", uri=\"" << uri << "\", qop=" << qop << ", nc=" << nonce_count << ", cnonce=\"" << ds.cnonce << "\", response=\"" << response << "\"";
+	if (!ds.opaque.empty())
+	  os << ", opaque=\"" + ds.opaque + "\"";
+	os << "\r\n";
+	return os.str();
+      }
+
       std::string get_ntlm_phase_2_response()
       {
 	for (HTTP::HeaderList::const_iterator i = http_reply.headers.begin(); i != http_reply.headers.end(); ++i)
@@ -727,17 +980,51 @@ namespace openvpn {
       {
 	OPENVPN_LOG("Proxy method: NTLM" << std::endl << pa.to_string());
 
+	auth_cache().set(HTTPProxy::AuthCache::NTLM, proxy_host, proxy_port, config->http_proxy_options->username);
+	http_request = ntlm_auth_phase_1_request();
+	reset();
+	ntlm_phase_2_response_pending = true;
+	start_connect_();
+      }
+
+      std::string ntlm_auth_phase_1_request()
+      {
 	const std::string phase_1_reply = HTTPProxy::NTLM::phase_1();
 
 	std::ostringstream os;
 	gen_headers(os);
 	os << "Proxy-Connection: Keep-Alive\r\n";
 	os << "Proxy-Authorization: NTLM " << phase_1_reply << "\r\n";
+	return os.str();
+      }
 
-	http_request = os.str();
-	reset();
-	ntlm_phase_2_response_pending = true;
-	start_connect_();
+      // On the first transaction, offer the method the proxy used last
+      // time right away.  NTLM still needs its per-connection challenge,
+      // but starts directly with phase 1.
+      void preemptive_auth()
+      {
+	const Options& opt = *config->http_proxy_options;
+	if (opt.username.empty())
+	  return;
+	switch (auth_cache().method(proxy_host, proxy_port, opt.username))
+	  {
+	  case HTTPProxy::AuthCache::BASIC:
+	    if (!opt.allow_cleartext_auth)
+	      return;
+	    http_request = basic_auth_request();
+	    break;
+	  case HTTPProxy::AuthCache::DIGEST:
+	    http_request = digest_auth_request();
+	    break;
+	  case HTTPProxy::AuthCache::NTLM:
+	    http_request = ntlm_auth_phase_1_request();
+	    ntlm_phase_2_response_pending = true;
+	    break;
+	  default:
+	    return;
+	  }
+	OPENVPN_LOG("Proxy: using cached authentication");
+	preemptive_auth_sent = true;
       }
 
       void ntlm_auth_phase_2_pre()
@@ -761,6 +1048,8 @@ namespace openvpn {
 	const std::string phase_2_response = get_ntlm_phase_2_response();
 	if (!phase_2_response.empty())
 	  ntlm_auth_phase_3(phase_2_response);
+	else if (preemptive_auth_sent)
+	  proxy_eof_handler(); // proxy no longer does NTLM, answer its challenge
 	else
 	  throw Exception("NTLM phase-2 response missing");
       }
@@ -841,6 +1130,8 @@ namespace openvpn {
 
 	    socket.close();
 	    resolver.cancel();
+	    if (!standby_parent)
+	      preconnect_timer.cancel();
 	  }
       }
 
@@ -873,6 +1164,7 @@ namespace openvpn {
 	halt = false;
 	proxy_response_limit.reset();
 	proxy_established = false;
+	tunnel_established = false;
 	reset_partial();
       }
 
@@ -923,7 +1215,7 @@ namespace openvpn {
 		parent.transport_wait();
 		impl.reset(new LinkImpl(this,
 					socket,
-					0, // send_queue_max_size is unlimited because we regulate size in cliproto.hpp
+					0, // send_queue_max_bytes is unlimited because we regulate size in cliproto.hpp
 					config->free_list_max_size,
 					(*config->frame)[Frame::READ_LINK_TCP],
 					config->stats));
@@ -931,6 +1223,9 @@ namespace openvpn {
 		impl->start();
 		++n_transactions;
 
+		if (n_transactions == 1 && http_request.empty())
+		  preemptive_auth();
+
 		// tell proxy to connect through to OpenVPN server
 		http_proxy_send();
 	      }
@@ -981,6 +1276,7 @@ namespace openvpn {
 
       RemoteList& remote_list() const { return *config->remote_list; }
       RemoteList& proxy_remote_list() const { return *config->http_proxy_options->proxy_server; }
+      HTTPProxy::AuthCache& auth_cache() const { return config->http_proxy_options->auth_cache; }
 
       std::string proxy_host;
       std::string proxy_port;
@@ -1002,13 +1298,24 @@ namespace openvpn {
       bool proxy_established;
       HTTP::ReplyParser::status http_reply_status;
       HTTP::Reply http_reply;
-      HTTP::ReplyParser http_parser;
+      HTTP::ReplyViewParser http_parser;
       std::string http_request;
 
       bool ntlm_phase_2_response_pending;
       size_t drain_content_length;
 
       std::unique_ptr<HTTP::HTMLSkip> html_skip;
+
+      bool preemptive_auth_sent;
+      bool tunnel_established;
+
+      // standby tunnels
+      AsioTimer preconnect_timer;  // preconnect delay, or standby expiry
+      count_t preconnect_bytes_in;
+      std::unique_ptr<StandbyParent> standby_parent; // defined if this is a standby
+      std::string standby_host;
+      std::string standby_port;
+      bool standby_ready;
     };
 
     inline TransportClient::Ptr ClientConfig::new_transport_client_obj(asio::io_context& io_context, TransportClientParent& parent)
@@ -0,0 +1,450 @@
+//    OpenVPN -- An application to securely tunnel IP networks
+//               over a single port, with support for SSL/TLS-based
+//               session authentication and key exchange,
+//               packet encryption, packet authentication, and
+//               packet compression.
+//
+//    Copyright (C) 2012-2016 OpenVPN Technologies, Inc.
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU Affero General Public License Version 3
+//    as published by the Free Software Foundation.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU Affero General Public License for more details.
+//
+//    You should have received a copy of the GNU Affero General Public License
+//    along with this program in the COPYING file.
+//    If not, see <http://www.gnu.org/licenses/>.
+
+// Multipath UDP client transport.  Sub-flows to the same server run
+// over several local interfaces (such as Wi-Fi and LTE, or two WAN
+// uplinks) and carry one OpenVPN session, so they share the data
+// channel key and peer-id.  Outgoing packets are spread over the paths
+// that answer probes (see PathProbe) in proportion to the inverse of
+// their cost, which grows with RTT and loss.  A path that stops
+// answering or fails gets no more traffic until it recovers.
+//
+// The server sees one peer-id arriving from several addresses, so
+// packets of the session arrive reordered.  Servers should be built
+// with OPENVPN_PKTID_WIDE_REPLAY_WINDOW, and their UDP transport has
+// to echo PathProbe requests.
+
+#ifndef OPENVPN_TRANSPORT_CLIENT_MULTIPATH_H
+#define OPENVPN_TRANSPORT_CLIENT_MULTIPATH_H
+
+#include <vector>
+#include <memory>
+#include <string>
+#include <sstream>
+
+#include <asio.hpp>
+
+#include <openvpn/common/exception.hpp>
+#include <openvpn/common/rc.hpp>
+#include <openvpn/buffer/buffer.hpp>
+#include <openvpn/time/asiotimer.hpp>
+#include <openvpn/log/sessionstats.hpp>
+#include <openvpn/transport/pathprobe.hpp>
+#include <openvpn/transport/client/transbase.hpp>
+
+namespace openvpn {
+  namespace MultipathTransport {
+
+    class ClientConfig : public TransportClientFactory
+    {
+    public:
+      typedef RCPtr<ClientConfig> Ptr;
+
+      // one factory per path, usually UDPTransport::ClientConfig
+      // objects that differ in bind_dev
+      std::vector<TransportClientFactory::Ptr> paths;
+      PathProbe::Config probe;
+      Time::Duration retry_interval = Time::Duration::seconds(5); // restart a failed path after this
+      SessionStats::Ptr stats;
+
+      static Ptr new_obj()
+      {
+	return new ClientConfig;
+      }
+
+      virtual TransportClient::Ptr new_transport_client_obj(asio::io_context& io_context,
+							    TransportClientParent& parent);
+
+    private:
+      ClientConfig() {}
+    };
+
+    class Client : public TransportClient
+    {
+      typedef RCPtr<Client> Ptr;
+
+      friend class ClientConfig; // calls constructor
+
+      // Parent of one sub-flow, forwarding to the parent of the
+      // multipath transport.
+      struct Path : public TransportClientParent
+      {
+	virtual void transport_recv(BufferAllocated& buf)
+	{
+	  if (PathProbe::is_message(buf))
+	    {
+	      if (PathProbe::message_type(buf) == PathProbe::REPLY)
+		probe.reply(PathProbe::message_seq(buf), Time::now());
+	      return;
+	    }
+	  mp->parent.transport_recv(buf);
+	}
+
+	virtual void transport_needs_send()
+	{
+	  mp->parent.transport_needs_send();
+	}
+
+	virtual void transport_error(const Error::Type fatal_err, const std::string& err_text)
+	{
+	  mp->path_error(*this, err_text);
+	}
+
+	virtual void proxy_error(const Error::Type fatal_err, const std::string& err_text)
+	{
+	  mp->path_error(*this, err_text);
+	}
+
+	virtual void ip_hole_punch(const IP::Addr& addr)
+	{
+	  mp->parent.ip_hole_punch(addr);
+	}
+
+	virtual bool transport_is_openvpn_protocol()
+	{
+	  return mp->parent.transport_is_openvpn_protocol();
+	}
+
+	virtual void transport_pre_resolve()
+	{
+	  if (!mp->connected)
+	    mp->parent.transport_pre_resolve();
+	}
+
+	virtual void transport_wait_proxy()
+	{
+	  if (!mp->connected)
+	    mp->parent.transport_wait_proxy();
+	}
+
+	virtual void transport_wait()
+	{
+	  if (!mp->connected)
+	    mp->parent.transport_wait();
+	}
+
+	virtual void transport_connecting()
+	{
+	  mp->path_connecting(*this);
+	}
+
+	virtual bool is_keepalive_enabled() const
+	{
+	  return mp->parent.is_keepalive_enabled();
+	}
+
+	virtual void disable_keepalive(unsigned int& keepalive_ping,
+				       unsigned int& keepalive_timeout)
+	{
+	  mp->parent.disable_keepalive(keepalive_ping, keepalive_timeout);
+	}
+
+	Client* mp = nullptr;
+	size_t index = 0;
+	TransportClient::Ptr transport;
+	PathProbe::Estimator probe;
+	bool up = false;     // sub-flow connected and not failed
+	Time failed_at;      // when the sub-flow failed, if !up
+	double vtime = 0.0;  // virtual send time, for weighted scheduling
+      };
+
+    public:
+      virtual void transport_start()
+      {
+	if (!started)
+	  {
+	    started = true;
+	    halt = false;
+	    for (auto& p : paths)
+	      start_path(*p);
+	  }
+      }
+
+      virtual bool transport_send_const(const Buffer& buf)
+      {
+	return send(buf);
+      }
+
+      virtual bool transport_send(BufferAllocated& buf)
+      {
+	return send(buf);
+      }
+
+      virtual bool transport_send_queue_empty()
+      {
+	return false;
+      }
+
+      virtual bool transport_has_send_queue()
+      {
+	return false;
+      }
+
+      virtual unsigned int transport_send_queue_size()
+      {
+	return 0;
+      }
+
+      virtual void reset_align_adjust(const size_t align_adjust)
+      {
+	for (auto& p : paths)
+	  {
+	    if (p->transport)
+	      p->transport->reset_align_adjust(align_adjust);
+	  }
+      }
+
+      virtual IP::Addr server_endpoint_addr() const
+      {
+	const Path* p = best_path();
+	return p ? p->transport->server_endpoint_addr() : IP::Addr();
+      }
+
+      virtual void server_endpoint_info(std::string& host, std::string& port, std::string& proto, std::string& ip_addr) const
+      {
+	const Path* p = best_path();
+	if (p)
+	  p->transport->server_endpoint_info(host, port, proto, ip_addr);
+      }
+
+      virtual bool transport_rebind()
+      {
+	bool ret = false;
+	for (auto& p : paths)
+	  {
+	    if (p->up && p->transport->transport_rebind())
+	      ret = true;
+	  }
+	return ret;
+      }
+
+      virtual void stop() { stop_(); }
+      virtual ~Client() { stop_(); }
+
+    private:
+      Client(asio::io_context& io_context_arg,
+	     ClientConfig* config_arg,
+	     TransportClientParent& parent_arg)
+	: io_context(io_context_arg),
+	  config(config_arg),
+	  parent(parent_arg),
+	  timer(io_context_arg)
+      {
+	if (config->paths.empty())
+	  throw Exception("multipath transport: no paths defined");
+	for (size_t i = 0; i < config->paths.size(); ++i)
+	  {
+	    std::unique_ptr<Path> p(new Path());
+	    p->mp = this;
+	    p->index = i;
+	    p->probe = PathProbe::Estimator(config->probe);
+	    paths.push_back(std::move(p));
+	  }
+      }
+
+      void start_path(Path& p)
+      {
+	p.up = false;
+	p.transport = config->paths[p.index]->new_transport_client_obj(io_context, p);
+	p.transport->transport_start();
+      }
+
+      void path_connecting(Path& p)
+      {
+	if (halt)
+	  return;
+	const Time now = Time::now();
+	p.up = true;
+	p.probe.start(now);
+	p.vtime = vclock;
+	OPENVPN_LOG("Multipath: path " << p.index << " up");
+	schedule(now);
+	if (!connected)
+	  {
+	    connected = true;
+	    parent.transport_connecting();
+	  }
+      }
+
+      void path_error(Path& p, const std::string& err_text)
+      {
+	if (halt)
+	  return;
+	OPENVPN_LOG("Multipath: path " << p.index << " failed: " << err_text);
+	p.up = false;
+	p.failed_at = Time::now();
+	if (p.transport)
+	  p.transport->stop();
+	for (auto& q : paths)
+	  {
+	    if (q->up || !q->failed_at.defined())
+	      {
+		schedule(Time::now());
+		return;
+	      }
+	  }
+	// no path left
+	stop_();
+	parent.transport_error(Error::UNDEF, "multipath: all paths failed, last error: " + err_text);
+      }
+
+      // Pick the usable path with the smallest virtual time, then
+      // advance its virtual time by its cost, so that paths get
+      // traffic in proportion to 1/cost.  Fall back to any connected
+      // path if none answers probes.
+      Path* select_path()
+      {
+	const Time now = Time::now();
+	Path* best = nullptr;
+	for (auto& p : paths)
+	  {
+	    if (p->up && p->probe.alive(now) && (!best || p->vtime < best->vtime))
+	      best = p.get();
+	  }
+	if (!best)
+	  return const_cast<Path*>(best_path());
+	vclock = best->vtime;
+	best->vtime += best->probe.cost();
+	return best;
+      }
+
+      // connected path with the lowest cost
+      const Path* best_path() const
+      {
+	const Path* best = nullptr;
+	for (auto& p : paths)
+	  {
+	    if (p->up && (!best || p->probe.cost() < best->probe.cost()))
+	      best = p.get();
+	  }
+	return best;
+      }
+
+      bool send(const Buffer& buf)
+      {
+	if (halt)
+	  return false;
+	Path* p = select_path();
+	if (!p)
+	  return false;
+	if (p->transport->transport_send_const(buf))
+	  return true;
+
+	// failover to the next best path
+	const Path* alt = best_path();
+	if (alt && alt != p)
+	  return alt->transport->transport_send_const(buf);
+	return false;
+      }
+
+      void schedule(const Time& now)
+      {
+	Time next = Time::infinite();
+	for (auto& p : paths)
+	  {
+	    if (p->up)
+	      next.min(p->probe.next_event());
+	    else if (p->failed_at.defined())
+	      next.min(p->failed_at + config->retry_interval);
+	  }
+	if (next.is_infinite())
+	  return;
+	if (next < now)
+	  next = now;
+	if (timer_pending && next >= timer_at)
+	  return;
+	timer_pending = true;
+	timer_at = next;
+	timer.expires_at(next);
+	timer.async_wait([self=Ptr(this)](const asio::error_code& error)
+			 {
+			   if (!error && !self->halt)
+			     {
+			       self->timer_pending = false;
+			       self->housekeeping();
+			     }
+			 });
+      }
+
+      // send due probes and restart failed paths
+      void housekeeping()
+      {
+	const Time now = Time::now();
+	for (auto& p : paths)
+	  {
+	    if (p->up)
+	      {
+		const std::uint32_t seq = p->probe.probe_due(now);
+		if (seq)
+		  {
+		    BufferAllocated buf(PathProbe::SIZE, 0);
+		    PathProbe::write_message(buf, PathProbe::REQUEST, seq);
+		    p->transport->transport_send_const(buf);
+		  }
+	      }
+	    else if (p->failed_at.defined() && now >= p->failed_at + config->retry_interval)
+	      {
+		p->failed_at.reset();
+		OPENVPN_LOG("Multipath: restarting path " << p->index);
+		start_path(*p);
+	      }
+	  }
+	schedule(now);
+      }
+
+      void stop_()
+      {
+	if (!halt)
+	  {
+	    halt = true;
+	    timer.cancel();
+	    timer_pending = false;
+	    for (auto& p : paths)
+	      {
+		p->up = false;
+		if (p->transport)
+		  p->transport->stop();
+	      }
+	  }
+      }
+
+      asio::io_context& io_context;
+      ClientConfig::Ptr config;
+      TransportClientParent& parent;
+      std::vector<std::unique_ptr<Path>> paths;
+      AsioTimer timer;
+      Time timer_at;
+      double vclock = 0.0; // virtual time of the last path selected
+      bool timer_pending = false;
+      bool started = false;
+      bool connected = false;
+      bool halt = false;
+    };
+
+    inline TransportClient::Ptr ClientConfig::new_transport_client_obj(asio::io_context& io_context,
+								       TransportClientParent& parent)
+    {
+      return TransportClient::Ptr(new Client(io_context, this, parent));
+    }
+  }
+} // namespace openvpn
+
+#endif
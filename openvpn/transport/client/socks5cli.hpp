@@ -0,0 +1,833 @@
+//    OpenVPN -- An application to securely tunnel IP networks
+//               over a single port, with support for SSL/TLS-based
+//               session authentication and key exchange,
+//               packet encryption, packet authentication, and
+//               packet compression.
+//
+//    Copyright (C) 2012-2016 OpenVPN Technologies, Inc.
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU Affero General Public License Version 3
+//    as published by the Free Software Foundation.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU Affero General Public License for more details.
+//
+//    You should have received a copy of the GNU Affero General Public License
+//    along with this program in the COPYING file.
+//    If not, see <http://www.gnu.org/licenses/>.
+
+// SOCKS5 proxy transport (RFC 1928/1929) for the client.  TCP remotes
+// are reached with CONNECT, UDP remotes with UDP ASSOCIATE so that UDP
+// tunnels keep working through the proxy.
+
+#ifndef OPENVPN_TRANSPORT_CLIENT_SOCKS5CLI_H
+#define OPENVPN_TRANSPORT_CLIENT_SOCKS5CLI_H
+
+#include <string>
+#include <sstream>
+#include <vector>
+
+#include <asio.hpp>
+
+#include <openvpn/common/size.hpp>
+#include <openvpn/common/exception.hpp>
+#include <openvpn/common/arraysize.hpp>
+#include <openvpn/common/number.hpp>
+#include <openvpn/common/options.hpp>
+#include <openvpn/common/userpass.hpp>
+#include <openvpn/addr/ip.hpp>
+#include <openvpn/transport/tcplink.hpp>
+#include <openvpn/transport/udplink.hpp>
+#include <openvpn/transport/client/transbase.hpp>
+#include <openvpn/transport/socket_protect.hpp>
+#include <openvpn/client/remotelist.hpp>
+
+namespace openvpn {
+  namespace Socks5Transport {
+
+    class Options : public RC<thread_safe_refcount>
+    {
+    public:
+      typedef RCPtr<Options> Ptr;
+
+      RemoteList::Ptr proxy_server;
+      std::string username;
+      std::string password;
+
+      void set_proxy_server(const std::string& host, const std::string& port)
+      {
+	proxy_server.reset(new RemoteList(host, port, Protocol(Protocol::TCP), "socks proxy port"));
+      }
+
+      void proxy_server_set_enable_cache(const bool enable_cache)
+      {
+	proxy_server->set_enable_cache(enable_cache);
+      }
+
+      void proxy_server_precache(RemoteList::Ptr& r)
+      {
+	if (proxy_server->get_enable_cache())
+	  r = proxy_server;
+      }
+
+      // socks-proxy server [port]
+      // <socks-proxy-user-pass> inline username/password
+      static Ptr parse(const OptionList& opt)
+      {
+	const Option* sp = opt.get_ptr("socks-proxy");
+	if (!sp)
+	  return Ptr();
+
+	Ptr obj(new Options);
+	const std::string port = sp->get_optional(2, 16);
+	obj->set_proxy_server(sp->get(1, 256), port.empty() ? "1080" : port);
+
+	std::vector<std::string> user_pass;
+	if (UserPass::parse(opt, "socks-proxy-user-pass", 0, &user_pass))
+	  {
+	    if (user_pass.size() >= 1)
+	      obj->username = user_pass[0];
+	    if (user_pass.size() >= 2)
+	      obj->password = user_pass[1];
+	  }
+	return obj;
+      }
+    };
+
+    class ClientConfig : public TransportClientFactory
+    {
+    public:
+      typedef RCPtr<ClientConfig> Ptr;
+
+      RemoteList::Ptr remote_list;
+      size_t free_list_max_size;
+      int n_parallel;
+      Frame::Ptr frame;
+      SessionStats::Ptr stats;
+
+      Options::Ptr socks_proxy_options;
+
+      SocketProtect* socket_protect;
+
+      static Ptr new_obj()
+      {
+	return new ClientConfig;
+      }
+
+      virtual TransportClient::Ptr new_transport_client_obj(asio::io_context& io_context,
+							    TransportClientParent& parent);
+
+    private:
+      ClientConfig()
+	: free_list_max_size(8),
+	  n_parallel(8),
+	  socket_protect(nullptr)
+      {}
+    };
+
+    class Client : public TransportClient
+    {
+      typedef RCPtr<Client> Ptr;
+
+      typedef TCPTransport::Link<asio::ip::tcp, Client*, false> TCPLinkImpl;
+      typedef UDPTransport::Link<Client*> UDPLinkImpl;
+
+      friend class ClientConfig;  // calls constructor
+      friend TCPLinkImpl;         // calls tcp_read_handler
+      friend UDPLinkImpl;         // calls udp_read_handler
+
+      enum {
+	VERSION = 5,
+	AUTH_VERSION = 1,
+
+	METHOD_NONE = 0,
+	METHOD_USERPASS = 2,
+	METHOD_UNACCEPTABLE = 0xff,
+
+	CMD_CONNECT = 1,
+	CMD_UDP_ASSOCIATE = 3,
+
+	ATYP_IPV4 = 1,
+	ATYP_DOMAIN = 3,
+	ATYP_IPV6 = 4,
+
+	// fixed part of a reply: VER REP RSV ATYP and the first address byte
+	REPLY_HEAD = 5,
+      };
+
+    public:
+      virtual void transport_start()
+      {
+	if (!tcp_impl && !udp_impl)
+	  {
+	    if (!config->socks_proxy_options)
+	      {
+		parent.proxy_error(Error::PROXY_ERROR, "socks_proxy_options not defined");
+		return;
+	      }
+
+	    halt = false;
+	    udp = remote_list().current_transport_protocol().is_udp();
+
+	    // The proxy resolves the OpenVPN server for us.
+	    remote_list().endpoint_available(&server_host, &server_port, nullptr);
+
+	    if (proxy_remote_list().endpoint_available(&proxy_host, &proxy_port, nullptr))
+	      start_connect_();
+	    else
+	      {
+		parent.transport_pre_resolve();
+		resolver.async_resolve(proxy_host, proxy_port,
+				       [self=Ptr(this)](const asio::error_code& error, asio::ip::tcp::resolver::results_type results)
+				       {
+					 self->do_resolve_(error, results);
+				       });
+	      }
+	  }
+      }
+
+      virtual bool transport_send_const(const Buffer& buf)
+      {
+	if (udp_impl)
+	  {
+	    BufferAllocated b(buf.size() + udp_header.size(), 0);
+	    b.write(udp_header.data(), udp_header.size());
+	    b.write(buf.c_data(), buf.size());
+	    return udp_send(b);
+	  }
+	else if (tcp_impl)
+	  {
+	    BufferAllocated b(buf, 0);
+	    return tcp_impl->send(b, true); // control channel and keepalives are urgent
+	  }
+	return false;
+      }
+
+      virtual bool transport_send(BufferAllocated& buf)
+      {
+	if (udp_impl)
+	  {
+	    // prepend the UDP request header, in the headroom if there is room
+	    if (buf.offset() >= udp_header.size())
+	      {
+		buf.prepend(udp_header.data(), udp_header.size());
+		return udp_send(buf);
+	      }
+	    return transport_send_const(buf);
+	  }
+	else if (tcp_impl)
+	  return tcp_impl->send(buf, false); // data channel is bulk
+	return false;
+      }
+
+      virtual bool transport_send_queue_empty()
+      {
+	if (tcp_impl)
+	  return tcp_impl->send_queue_empty();
+	return false;
+      }
+
+      virtual bool transport_has_send_queue()
+      {
+	return !udp;
+      }
+
+      virtual unsigned int transport_send_queue_size()
+      {
+	if (tcp_impl)
+	  return tcp_impl->send_queue_size();
+	return 0;
+      }
+
+      virtual void reset_align_adjust(const size_t align_adjust)
+      {
+	if (tcp_impl)
+	  tcp_impl->reset_align_adjust(align_adjust);
+	else if (udp_impl)
+	  udp_impl->reset_align_adjust(align_adjust);
+      }
+
+      virtual void server_endpoint_info(std::string& host, std::string& port, std::string& proto, std::string& ip_addr) const
+      {
+	host = server_host;
+	port = server_port;
+	const IP::Addr addr = server_endpoint_addr();
+	proto = udp ? "UDP" : "TCP";
+	proto += addr.version_string();
+	proto += "-via-SOCKS";
+	ip_addr = addr.to_string();
+      }
+
+      virtual IP::Addr server_endpoint_addr() const
+      {
+	return IP::Addr::from_asio(proxy_endpoint.address());
+      }
+
+      virtual void stop() { stop_(); }
+      virtual ~Client() { stop_(); }
+
+    private:
+      Client(asio::io_context& io_context_arg,
+	     ClientConfig* config_arg,
+	     TransportClientParent& parent_arg)
+	:  io_context(io_context_arg),
+	   socket(io_context_arg),
+	   udp_socket(io_context_arg),
+	   config(config_arg),
+	   parent(parent_arg),
+	   resolver(io_context_arg),
+	   hs_buf(1024, 0),
+	   halt(false),
+	   udp(false)
+      {
+      }
+
+      bool udp_send(const Buffer& buf)
+      {
+	return udp_impl->send(buf, nullptr) == 0;
+      }
+
+      void proxy_error(const Error::Type fatal_err, const std::string& what)
+      {
+	std::ostringstream os;
+	os << "on " << proxy_host << ':' << proxy_port << ": " << what;
+	config->stats->error(Error::PROXY_ERROR);
+	stop();
+	parent.proxy_error(fatal_err, os.str());
+      }
+
+      void tcp_eof_handler() // called by TCPLinkImpl
+      {
+	config->stats->error(Error::NETWORK_EOF_ERROR);
+	tcp_error_handler("NETWORK_EOF_ERROR");
+      }
+
+      bool tcp_read_handler(BufferAllocated& buf) // called by TCPLinkImpl
+      {
+	parent.transport_recv(buf);
+	return true;
+      }
+
+      bool tcp_read_in_place(BufferAllocated& buf, bool& requeue) // called by TCPLinkImpl
+      {
+	requeue = true;
+	return parent.transport_recv_in_place(buf);
+      }
+
+      void tcp_write_queue_needs_send() // called by TCPLinkImpl
+      {
+	parent.transport_needs_send();
+      }
+
+      void tcp_error_handler(const char *error) // called by TCPLinkImpl
+      {
+	std::ostringstream os;
+	os << "Transport error on '" << server_host << "' via SOCKS proxy " << proxy_host << ':' << proxy_port << ": " << error;
+	stop();
+	parent.transport_error(Error::TRANSPORT_ERROR, os.str());
+      }
+
+      // strip the UDP request header from datagrams coming back
+      // through the relay
+      void udp_read_handler(UDPTransport::PacketFrom::SPtr& pfp) // called by UDPLinkImpl
+      {
+	if (pfp->sender_endpoint != relay_endpoint)
+	  {
+	    config->stats->error(Error::BAD_SRC_ADDR);
+	    return;
+	  }
+	BufferAllocated& buf = pfp->buf;
+	if (buf.size() < 4 || buf[2] != 0) // fragments are not supported
+	  {
+	    config->stats->error(Error::BUFFER_ERROR);
+	    return;
+	  }
+	size_t hlen;
+	switch (buf[3])
+	  {
+	  case ATYP_IPV4:
+	    hlen = 4 + 4 + 2;
+	    break;
+	  case ATYP_IPV6:
+	    hlen = 4 + 16 + 2;
+	    break;
+	  case ATYP_DOMAIN:
+	    hlen = buf.size() >= 5 ? 4 + 1 + buf[4] + 2 : buf.size() + 1;
+	    break;
+	  default:
+	    hlen = buf.size() + 1;
+	    break;
+	  }
+	if (hlen > buf.size())
+	  {
+	    config->stats->error(Error::BUFFER_ERROR);
+	    return;
+	  }
+	buf.advance(hlen);
+	parent.transport_recv(buf);
+      }
+
+      void udp_read_handler_batch(UDPTransport::PacketFromBatch& batch, const size_t n) // called by UDPLinkImpl
+      {
+	for (size_t i = 0; i < n && !halt; ++i)
+	  udp_read_handler(batch[i]);
+      }
+
+      void stop_()
+      {
+	if (!halt)
+	  {
+	    halt = true;
+	    if (tcp_impl)
+	      tcp_impl->stop();
+	    if (udp_impl)
+	      udp_impl->stop();
+	    socket.close();
+	    udp_socket.close();
+	    resolver.cancel();
+	  }
+      }
+
+      // do DNS resolve of the proxy
+      void do_resolve_(const asio::error_code& error,
+		       asio::ip::tcp::resolver::results_type results)
+      {
+	if (!halt)
+	  {
+	    if (!error)
+	      {
+		proxy_remote_list().set_endpoint_range(results);
+		start_connect_();
+	      }
+	    else
+	      {
+		std::ostringstream os;
+		os << "DNS resolve error on '" << proxy_host << "' for SOCKS proxy: " << error.message();
+		config->stats->error(Error::RESOLVE_ERROR);
+		stop();
+		parent.transport_error(Error::UNDEF, os.str());
+	      }
+	  }
+      }
+
+      // do TCP connect to the proxy
+      void start_connect_()
+      {
+	proxy_remote_list().get_endpoint(proxy_endpoint);
+	OPENVPN_LOG("Contacting " << proxy_endpoint << " via SOCKS Proxy");
+	parent.transport_wait_proxy();
+	parent.ip_hole_punch(server_endpoint_addr());
+	socket.open(proxy_endpoint.protocol());
+#ifdef OPENVPN_PLATFORM_TYPE_UNIX
+	if (config->socket_protect)
+	  {
+	    if (!config->socket_protect->socket_protect(socket.native_handle()))
+	      {
+		config->stats->error(Error::SOCKET_PROTECT_ERROR);
+		stop();
+		parent.transport_error(Error::UNDEF, "socket_protect error (SOCKS Proxy)");
+		return;
+	      }
+	  }
+#endif
+	socket.set_option(asio::ip::tcp::no_delay(true));
+	socket.async_connect(proxy_endpoint, [self=Ptr(this)](const asio::error_code& error)
+			     {
+			       self->handle_connect_(error);
+			     });
+      }
+
+      void handle_connect_(const asio::error_code& error)
+      {
+	if (halt)
+	  return;
+	if (error)
+	  {
+	    proxy_remote_list().next();
+
+	    std::ostringstream os;
+	    os << "TCP connect error on '" << proxy_host << ':' << proxy_port << "' (" << proxy_endpoint << ") for SOCKS proxy session: " << error.message();
+	    config->stats->error(Error::TCP_CONNECT_ERROR);
+	    stop();
+	    parent.transport_error(Error::UNDEF, os.str());
+	    return;
+	  }
+
+	parent.transport_wait();
+
+	// Greeting.  Without credentials the only method we offer is
+	// "no auth", so the request can be pipelined behind it and the
+	// handshake costs a single round trip.
+	hs_buf.reset_content();
+	hs_buf.push_back(VERSION);
+	if (have_creds())
+	  {
+	    hs_buf.push_back(2);
+	    hs_buf.push_back(METHOD_NONE);
+	    hs_buf.push_back(METHOD_USERPASS);
+	  }
+	else
+	  {
+	    hs_buf.push_back(1);
+	    hs_buf.push_back(METHOD_NONE);
+	    gen_request(hs_buf);
+	  }
+	hs_write([](Client* self) {
+	    self->hs_read(2, [](Client* self) {
+		self->handle_method_();
+	      });
+	  });
+      }
+
+      void handle_method_()
+      {
+	if (hs_buf[0] != VERSION)
+	  return proxy_error(Error::PROXY_ERROR, "SOCKS proxy replied with bad version");
+
+	switch (hs_buf[1])
+	  {
+	  case METHOD_NONE:
+	    if (have_creds())
+	      {
+		hs_buf.reset_content();
+		gen_request(hs_buf);
+		hs_write([](Client* self) { self->read_reply_(); });
+	      }
+	    else
+	      read_reply_();
+	    break;
+	  case METHOD_USERPASS:
+	    {
+	      if (!have_creds())
+		return proxy_error(Error::PROXY_NEED_CREDS, "SOCKS proxy requires credentials");
+	      const std::string& user = config->socks_proxy_options->username;
+	      const std::string& pass = config->socks_proxy_options->password;
+	      if (user.length() > 255 || pass.length() > 255)
+		return proxy_error(Error::PROXY_NEED_CREDS, "SOCKS proxy username or password too long");
+
+	      // RFC 1929 subnegotiation, with the request pipelined behind it
+	      hs_buf.reset_content();
+	      hs_buf.push_back(AUTH_VERSION);
+	      hs_buf.push_back((unsigned char)user.length());
+	      hs_buf.write((const unsigned char *)user.c_str(), user.length());
+	      hs_buf.push_back((unsigned char)pass.length());
+	      hs_buf.write((const unsigned char *)pass.c_str(), pass.length());
+	      gen_request(hs_buf);
+	      hs_write([](Client* self) {
+		  self->hs_read(2, [](Client* self) {
+		      if (self->hs_buf[1] != 0)
+			return self->proxy_error(Error::PROXY_NEED_CREDS, "SOCKS proxy credentials were not accepted");
+		      self->read_reply_();
+		    });
+		});
+	    }
+	    break;
+	  default:
+	    proxy_error(Error::PROXY_NEED_CREDS, "SOCKS proxy offered no acceptable authentication method");
+	    break;
+	  }
+      }
+
+      // read the CONNECT or UDP ASSOCIATE reply
+      void read_reply_()
+      {
+	hs_read(REPLY_HEAD, [](Client* self) {
+	    const Buffer& r = self->hs_buf;
+	    if (r[0] != VERSION)
+	      return self->proxy_error(Error::PROXY_ERROR, "SOCKS proxy replied with bad version");
+	    if (r[1] != 0)
+	      return self->reply_error_(r[1]);
+
+	    size_t rest;
+	    switch (r[3])
+	      {
+	      case ATYP_IPV4:
+		rest = 4 - 1 + 2;
+		break;
+	      case ATYP_IPV6:
+		rest = 16 - 1 + 2;
+		break;
+	      case ATYP_DOMAIN:
+		rest = r[4] + 2;
+		break;
+	      default:
+		return self->proxy_error(Error::PROXY_ERROR, "SOCKS proxy reply has bad address type");
+	      }
+	    self->hs_read(rest, [](Client* self) {
+		self->handle_reply_();
+	      }, true);
+	  });
+      }
+
+      void reply_error_(const unsigned int rep)
+      {
+	static const char *const text[] = {
+	  "succeeded",
+	  "general SOCKS server failure",
+	  "connection not allowed by ruleset",
+	  "network unreachable",
+	  "host unreachable",
+	  "connection refused",
+	  "TTL expired",
+	  "command not supported",
+	  "address type not supported",
+	};
+	std::ostringstream os;
+	os << "SOCKS proxy could not reach OpenVPN server: ";
+	if (rep < array_size(text))
+	  os << text[rep];
+	else
+	  os << "error " << rep;
+
+	// unreachable or refused servers are worth retrying on the
+	// next remote, anything else is a proxy policy problem
+	if (rep >= 3 && rep <= 6)
+	  proxy_error(Error::UNDEF, os.str());
+	else
+	  proxy_error(Error::PROXY_ERROR, os.str());
+      }
+
+      void handle_reply_()
+      {
+	if (!udp)
+	  {
+	    OPENVPN_LOG("SOCKS proxy connected to " << server_host << ':' << server_port);
+	    tcp_impl.reset(new TCPLinkImpl(this,
+					   socket,
+					   0, // send_queue_max_bytes is unlimited because we regulate size in cliproto.hpp
+					   config->free_list_max_size,
+					   (*config->frame)[Frame::READ_LINK_TCP],
+					   config->stats));
+	    tcp_impl->start();
+	    if (!parent.transport_is_openvpn_protocol())
+	      tcp_impl->set_raw_mode(true);
+	    parent.transport_connecting();
+	    return;
+	  }
+
+	// UDP ASSOCIATE: BND.ADDR:BND.PORT is the relay to send to,
+	// an unspecified address means "same host as the proxy"
+	const Buffer& r = hs_buf;
+	asio::ip::address relay_addr;
+	if (r[3] == ATYP_IPV4)
+	  {
+	    asio::ip::address_v4::bytes_type b;
+	    std::memcpy(b.data(), r.c_data() + 4, b.size());
+	    relay_addr = asio::ip::address_v4(b);
+	  }
+	else if (r[3] == ATYP_IPV6)
+	  {
+	    asio::ip::address_v6::bytes_type b;
+	    std::memcpy(b.data(), r.c_data() + 4, b.size());
+	    relay_addr = asio::ip::address_v6(b);
+	  }
+	else
+	  return proxy_error(Error::PROXY_ERROR, "SOCKS proxy UDP relay given as a hostname is not supported");
+	if (relay_addr.is_unspecified())
+	  relay_addr = proxy_endpoint.address();
+	const unsigned char *pp = r.c_data() + r.size() - 2;
+	relay_endpoint = UDPTransport::AsioEndpoint(relay_addr, (pp[0] << 8) | pp[1]);
+
+	gen_udp_header();
+
+	udp_socket.open(relay_endpoint.protocol());
+#ifdef OPENVPN_PLATFORM_TYPE_UNIX
+	if (config->socket_protect)
+	  {
+	    if (!config->socket_protect->socket_protect(udp_socket.native_handle()))
+	      {
+		config->stats->error(Error::SOCKET_PROTECT_ERROR);
+		stop();
+		parent.transport_error(Error::UNDEF, "socket_protect error (SOCKS Proxy UDP)");
+		return;
+	      }
+	  }
+#endif
+	udp_socket.async_connect(relay_endpoint, [self=Ptr(this)](const asio::error_code& error)
+				 {
+				   self->start_udp_(error);
+				 });
+      }
+
+      void start_udp_(const asio::error_code& error)
+      {
+	if (halt)
+	  return;
+	if (error)
+	  {
+	    std::ostringstream os;
+	    os << "UDP connect error on SOCKS relay " << relay_endpoint << ": " << error.message();
+	    config->stats->error(Error::UDP_CONNECT_ERROR);
+	    stop();
+	    parent.transport_error(Error::UNDEF, os.str());
+	    return;
+	  }
+
+	OPENVPN_LOG("SOCKS proxy UDP relay " << relay_endpoint << " for " << server_host << ':' << server_port);
+	udp_impl.reset(new UDPLinkImpl(this,
+				       udp_socket,
+				       (*config->frame)[Frame::READ_LINK_UDP],
+				       config->stats));
+	udp_impl->start(config->n_parallel);
+
+	// the association lives as long as the control connection
+	hs_buf.reset_content();
+	socket.async_read_some(asio::buffer(hs_buf.data(), 1),
+			       [self=Ptr(this)](const asio::error_code& error, const size_t bytes_transferred)
+			       {
+				 if (!self->halt)
+				   {
+				     self->config->stats->error(Error::NETWORK_EOF_ERROR);
+				     self->stop();
+				     self->parent.transport_error(Error::TRANSPORT_ERROR, "SOCKS proxy closed the UDP association");
+				   }
+			       });
+	parent.transport_connecting();
+      }
+
+      // append a CONNECT or UDP ASSOCIATE request to buf
+      void gen_request(Buffer& buf)
+      {
+	buf.push_back(VERSION);
+	if (udp)
+	  {
+	    // we don't know our address as seen by the proxy, so let it
+	    // accept datagrams from any source port of this host
+	    buf.push_back(CMD_UDP_ASSOCIATE);
+	    buf.push_back(0);
+	    if (proxy_endpoint.address().is_v6())
+	      {
+		buf.push_back(ATYP_IPV6);
+		for (size_t i = 0; i < 16; ++i)
+		  buf.push_back(0);
+	      }
+	    else
+	      {
+		buf.push_back(ATYP_IPV4);
+		for (size_t i = 0; i < 4; ++i)
+		  buf.push_back(0);
+	      }
+	    buf.push_back(0);
+	    buf.push_back(0);
+	  }
+	else
+	  {
+	    buf.push_back(CMD_CONNECT);
+	    buf.push_back(0);
+	    gen_dest(buf);
+	  }
+      }
+
+      // append ATYP DST.ADDR DST.PORT for the OpenVPN server
+      void gen_dest(Buffer& buf)
+      {
+	if (IP::Addr::is_valid(server_host))
+	  {
+	    const IP::Addr addr = IP::Addr::from_string(server_host);
+	    buf.push_back(addr.version() == IP::Addr::V6 ? ATYP_IPV6 : ATYP_IPV4);
+	    addr.to_byte_string(buf.write_alloc(addr.size() / 8));
+	  }
+	else
+	  {
+	    if (server_host.length() > 255)
+	      throw Exception("SOCKS proxy: server hostname too long");
+	    buf.push_back(ATYP_DOMAIN);
+	    buf.push_back((unsigned char)server_host.length());
+	    buf.write((const unsigned char *)server_host.c_str(), server_host.length());
+	  }
+	const unsigned int port = parse_number_throw<unsigned short>(server_port, "SOCKS proxy server port");
+	buf.push_back((unsigned char)(port >> 8));
+	buf.push_back((unsigned char)port);
+      }
+
+      // RSV RSV FRAG, then the destination, prepended to every datagram
+      void gen_udp_header()
+      {
+	BufferAllocated h(4 + 1 + 255 + 2, 0);
+	h.push_back(0);
+	h.push_back(0);
+	h.push_back(0);
+	gen_dest(h);
+	udp_header.assign(h.c_data(), h.c_data() + h.size());
+      }
+
+      bool have_creds() const
+      {
+	return !config->socks_proxy_options->username.empty();
+      }
+
+      // write hs_buf to the proxy, then call next
+      template <typename NEXT>
+      void hs_write(NEXT next)
+      {
+	asio::async_write(socket, asio::buffer(hs_buf.c_data(), hs_buf.size()),
+			  [self=Ptr(this), next](const asio::error_code& error, const size_t bytes_transferred)
+			  {
+			    if (!self->halt)
+			      {
+				if (error)
+				  self->proxy_error(Error::UNDEF, "SOCKS proxy write error: " + error.message());
+				else
+				  next(self.get());
+			      }
+			  });
+      }
+
+      // read exactly n bytes from the proxy into hs_buf (appending if
+      // append is set), then call next
+      template <typename NEXT>
+      void hs_read(const size_t n, NEXT next, const bool append = false)
+      {
+	if (!append)
+	  hs_buf.reset_content();
+	unsigned char *dest = hs_buf.write_alloc(n);
+	asio::async_read(socket, asio::buffer(dest, n),
+			 [self=Ptr(this), next](const asio::error_code& error, const size_t bytes_transferred)
+			 {
+			   if (!self->halt)
+			     {
+			       if (error)
+				 self->proxy_error(Error::UNDEF, "SOCKS proxy read error: " + error.message());
+			       else
+				 next(self.get());
+			     }
+			 });
+      }
+
+      RemoteList& remote_list() const { return *config->remote_list; }
+      RemoteList& proxy_remote_list() const { return *config->socks_proxy_options->proxy_server; }
+
+      std::string proxy_host;
+      std::string proxy_port;
+
+      std::string server_host;
+      std::string server_port;
+
+      asio::io_context& io_context;
+      asio::ip::tcp::socket socket;
+      asio::ip::udp::socket udp_socket;
+      ClientConfig::Ptr config;
+      TransportClientParent& parent;
+      TCPLinkImpl::Ptr tcp_impl;
+      UDPLinkImpl::Ptr udp_impl;
+      asio::ip::tcp::resolver resolver;
+      TCPLinkImpl::protocol::endpoint proxy_endpoint;
+      UDPTransport::AsioEndpoint relay_endpoint;
+      BufferAllocated hs_buf;
+      std::vector<unsigned char> udp_header;
+      bool halt;
+      bool udp;
+    };
+
+    inline TransportClient::Ptr ClientConfig::new_transport_client_obj(asio::io_context& io_context,
+								       TransportClientParent& parent)
+    {
+      return TransportClient::Ptr(new Client(io_context, this, parent));
+    }
+  }
+} // namespace openvpn
+
+#endif
@@ -28,6 +28,7 @@
 
 #include <asio.hpp>
 
+#include <openvpn/common/sockopt.hpp>
 #include <openvpn/transport/tcplink.hpp>
 #include <openvpn/transport/client/transbase.hpp>
 #include <openvpn/transport/socket_protect.hpp>
@@ -43,6 +44,10 @@ namespace openvpn {
 
       RemoteList::Ptr remote_list;
       size_t free_list_max_size;
+      size_t send_gather_max; // max packets per socket write, 1 to disable gathering
+      size_t recv_ring_size;  // stream reassembly ring bytes, 0 to disable
+      size_t cork_threshold;  // hold bulk data until this many bytes are queued, 0 to disable
+      bool fast_open;         // send the first packet in the SYN (TCP Fast Open)
       Frame::Ptr frame;
       SessionStats::Ptr stats;
 
@@ -63,6 +68,10 @@ namespace openvpn {
     private:
       ClientConfig()
 	: free_list_max_size(8),
+	  send_gather_max(16),
+	  recv_ring_size(0),
+	  cork_threshold(16384),
+	  fast_open(false),
 	  socket_protect(nullptr)
       {}
     };
@@ -171,7 +180,7 @@ namespace openvpn {
 	if (impl)
 	  {
 	    BufferAllocated buf(cbuf, 0);
-	    return impl->send(buf);
+	    return impl->send(buf, true); // control channel and keepalives are urgent
 	  }
 	else
 	  return false;
@@ -180,7 +189,7 @@ namespace openvpn {
       bool send(BufferAllocated& buf)
       {
 	if (impl)
-	  return impl->send(buf);
+	  return impl->send(buf, false); // data channel is bulk
 	else
 	  return false;
       }
@@ -197,6 +206,12 @@ namespace openvpn {
 	return true;
       }
 
+      bool tcp_read_in_place(BufferAllocated& buf, bool& requeue) // called by LinkImpl
+      {
+	requeue = true;
+	return parent.transport_recv_in_place(buf);
+      }
+
       void tcp_write_queue_needs_send() // called by LinkImpl
       {
 	parent.transport_needs_send();
@@ -267,6 +282,13 @@ namespace openvpn {
 	  }
 #endif
 	socket.set_option(asio::ip::tcp::no_delay(true));
+#ifdef TCP_FASTOPEN_CONNECT
+	// connect completes at once, and the HARD_RESET_CLIENT written
+	// by transport_connecting() rides in the SYN when a cookie is
+	// cached, otherwise the kernel falls back to a normal handshake
+	if (config->fast_open && !SockOpt::tcp_fastopen_connect(socket.native_handle()))
+	  OPENVPN_LOG("TCP Fast Open not supported by kernel");
+#endif
 	socket.async_connect(server_endpoint, [self=Ptr(this)](const asio::error_code& error)
                                               {
                                                 self->start_impl_(error);
@@ -282,10 +304,13 @@ namespace openvpn {
 	      {
 		impl.reset(new LinkImpl(this,
 					socket,
-					0, // // send_queue_max_size is unlimited because we regulate size in cliproto.hpp
+					0, // send_queue_max_bytes is unlimited because we regulate size in cliproto.hpp
 					config->free_list_max_size,
 					(*config->frame)[Frame::READ_LINK_TCP],
 					config->stats));
+		impl->set_gather_write(config->send_gather_max);
+		impl->set_stream_ring(config->recv_ring_size);
+		impl->set_cork(config->cork_threshold);
 #ifdef OPENVPN_GREMLIN
 		impl->gremlin_config(config->gremlin_config);
 #endif
@@ -53,6 +53,19 @@ namespace openvpn {
     virtual void reset_align_adjust(const size_t align_adjust) = 0;
     virtual IP::Addr server_endpoint_addr() const = 0;
     virtual void server_endpoint_info(std::string& host, std::string& port, std::string& proto, std::string& ip_addr) const = 0;
+
+    // Reopen the socket to the same server endpoint, such as after
+    // a local network change, while keeping the session above it.
+    // Parent is notified through transport_rebound().  Returns false
+    // if the transport can't do this (caller should reconnect).
+    virtual bool transport_rebind() { return false; }
+
+    // Send buf with tos as the outer TOS/traffic class, on
+    // transports that can set it per packet.
+    virtual bool transport_send_tos(BufferAllocated& buf, const unsigned int tos)
+    {
+      return transport_send(buf);
+    }
   };
 
   // Base class for parent of client transport object, used by client transport
@@ -61,6 +74,24 @@ namespace openvpn {
   struct TransportClientParent
   {
     virtual void transport_recv(BufferAllocated& buf) = 0;
+
+    // Like transport_recv, but buf is a window onto a receive buffer
+    // that also holds the packets after it.  Process it in place, or
+    // return false without touching buf to have it copied and passed
+    // to transport_recv instead.  In place, buf may be modified and
+    // prepended to, but not written past its end, nor its storage
+    // swapped out or kept.
+    virtual bool transport_recv_in_place(BufferAllocated& buf)
+    {
+      return false;
+    }
+
+    // incoming packet, with the outer TOS/traffic class it arrived with
+    virtual void transport_recv_tos(BufferAllocated& buf, const unsigned int tos)
+    {
+      transport_recv(buf);
+    }
+
     virtual void transport_needs_send() = 0; // notification that send queue is empty
     virtual void transport_error(const Error::Type fatal_err, const std::string& err_text) = 0;
     virtual void proxy_error(const Error::Type fatal_err, const std::string& err_text) = 0;
@@ -78,6 +109,7 @@ namespace openvpn {
     virtual void transport_wait_proxy() = 0;
     virtual void transport_wait() = 0;
     virtual void transport_connecting() = 0;
+    virtual void transport_rebound() {} // see TransportClient::transport_rebind
 
     // Return true if keepalive parameter(s) are enabled.
     virtual bool is_keepalive_enabled() const = 0;
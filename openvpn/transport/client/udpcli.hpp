@@ -33,6 +33,7 @@
 #include <openvpn/transport/udplink.hpp>
 #include <openvpn/transport/client/transbase.hpp>
 #include <openvpn/transport/socket_protect.hpp>
+#include <openvpn/common/sockopt.hpp>
 #include <openvpn/client/remotelist.hpp>
 
 namespace openvpn {
@@ -46,6 +47,17 @@ namespace openvpn {
       RemoteList::Ptr remote_list;
       bool server_addr_float;
       int n_parallel;
+      unsigned int recv_batch_size; // if nonzero, use batched receive where supported
+      unsigned int send_queue_size; // if nonzero, coalesce sends where supported
+      bool send_gso;                // allow UDP GSO when coalescing sends
+      bool pmtu_probe;              // send with DF set, for data channel PMTU discovery
+      bool io_uring;                // receive and send through io_uring where supported
+      bool pass_tos;                // per-packet outer TOS, and outer TOS on batched receive
+      int rcvbuf;                   // socket buffer sizes, 0 for the kernel default
+      int sndbuf;
+      int sockbuf_autotune_max;     // if nonzero, grow socket buffers up to this size
+      int busy_poll_us;             // if nonzero, SO_BUSY_POLL time in microseconds
+      std::string bind_dev;         // if not empty, send through this local interface
       Frame::Ptr frame;
       SessionStats::Ptr stats;
 
@@ -67,6 +79,16 @@ namespace openvpn {
       ClientConfig()
 	: server_addr_float(false),
 	  n_parallel(8),
+	  recv_batch_size(0),
+	  send_queue_size(0),
+	  send_gso(false),
+	  pmtu_probe(false),
+	  io_uring(false),
+	  pass_tos(false),
+	  rcvbuf(0),
+	  sndbuf(0),
+	  sockbuf_autotune_max(0),
+	  busy_poll_us(0),
 	  socket_protect(nullptr)
       {}
     };
@@ -76,7 +98,7 @@ namespace openvpn {
       typedef RCPtr<Client> Ptr;
 
       friend class ClientConfig;  // calls constructor
-      friend class Link<Client*>; // calls udp_read_handler
+      friend class Link<Client*>; // calls udp_read_handler, udp_read_handler_batch
 
       typedef Link<Client*> LinkImpl;
 
@@ -109,7 +131,12 @@ namespace openvpn {
 
       virtual bool transport_send(BufferAllocated& buf)
       {
-	return send(buf);
+	return send_consume(buf);
+      }
+
+      virtual bool transport_send_tos(BufferAllocated& buf, const unsigned int tos)
+      {
+	return send_consume(buf, tos);
       }
 
       virtual bool transport_send_queue_empty() // really only has meaning for TCP
@@ -148,6 +175,19 @@ namespace openvpn {
 	return IP::Addr::from_asio(server_endpoint.address());
       }
 
+      virtual bool transport_rebind()
+      {
+	if (halt || !impl)
+	  return false;
+	OPENVPN_LOG("Rebinding UDP socket to " << server_endpoint);
+	impl->stop();
+	impl.reset();
+	socket.close();
+	rebinding = true;
+	open_connect_();
+	return true;
+      }
+
       virtual void stop() { stop_(); }
       virtual ~Client() { stop_(); }
 
@@ -164,39 +204,55 @@ namespace openvpn {
       {
       }
 
-      bool send(const Buffer& buf)
+      bool send(const Buffer& buf, const unsigned int tos = 0)
       {
-	if (impl)
+	return impl && send_status(impl->send(buf, nullptr, tos));
+      }
+
+      // the send queue may take over the storage of buf
+      bool send_consume(BufferAllocated& buf, const unsigned int tos = 0)
+      {
+	return impl && send_status(impl->send_consume(buf, nullptr, tos));
+      }
+
+      bool send_status(const int err)
+      {
+	if (unlikely(err))
 	  {
-	    const int err = impl->send(buf, nullptr);
-	    if (unlikely(err))
-	      {
-		// While UDP errors are generally ignored, certain
-		// errors should be forwarded up to the higher levels.
+	    // While UDP errors are generally ignored, certain
+	    // errors should be forwarded up to the higher levels.
 #ifdef OPENVPN_PLATFORM_IPHONE
-		if (err == EADDRNOTAVAIL)
-		  {
-		    stop();
-		    parent.transport_error(Error::TRANSPORT_ERROR, "EADDRNOTAVAIL: Can't assign requested address");
-		  }
-#endif
-		return false;
+	    if (err == EADDRNOTAVAIL)
+	      {
+		stop();
+		parent.transport_error(Error::TRANSPORT_ERROR, "EADDRNOTAVAIL: Can't assign requested address");
 	      }
-	    else
-	      return true;
+#endif
+	    return false;
 	  }
 	else
-	  return false;
+	  return true;
       }
 
       void udp_read_handler(PacketFrom::SPtr& pfp) // called by LinkImpl
       {
 	if (config->server_addr_float || pfp->sender_endpoint == server_endpoint)
-	  parent.transport_recv(pfp->buf);
+	  {
+	    if (config->pass_tos)
+	      parent.transport_recv_tos(pfp->buf, pfp->tos);
+	    else
+	      parent.transport_recv(pfp->buf);
+	  }
 	else
 	  config->stats->error(Error::BAD_SRC_ADDR);
       }
 
+      void udp_read_handler_batch(PacketFromBatch& batch, const size_t n) // called by LinkImpl
+      {
+	for (size_t i = 0; i < n && !halt; ++i)
+	  udp_read_handler(batch[i]);
+      }
+
       void stop_()
       {
 	if (!halt)
@@ -238,6 +294,12 @@ namespace openvpn {
 	config->remote_list->get_endpoint(server_endpoint);
 	OPENVPN_LOG("Contacting " << server_endpoint << " via UDP");
 	parent.transport_wait();
+	open_connect_();
+      }
+
+      // open socket and connect it to server_endpoint
+      void open_connect_()
+      {
 	parent.ip_hole_punch(server_endpoint_addr());
 	socket.open(server_endpoint.protocol());
 #ifdef OPENVPN_PLATFORM_TYPE_UNIX
@@ -251,6 +313,18 @@ namespace openvpn {
 		return;
 	      }
 	  }
+	if (config->pmtu_probe)
+	  SockOpt::pmtu_probe(socket.native_handle(), server_endpoint.protocol() == asio::ip::udp::v6());
+	if (!config->bind_dev.empty())
+	  SockOpt::bind_device(socket.native_handle(), config->bind_dev, server_endpoint.protocol() == asio::ip::udp::v6());
+	if (config->rcvbuf)
+	  SockOpt::set_rcvbuf(socket.native_handle(), config->rcvbuf);
+	if (config->sndbuf)
+	  SockOpt::set_sndbuf(socket.native_handle(), config->sndbuf);
+#ifdef SO_BUSY_POLL
+	if (config->busy_poll_us && !SockOpt::busy_poll(socket.native_handle(), config->busy_poll_us))
+	  OPENVPN_LOG("UDP SO_BUSY_POLL not permitted, polling in user space only");
+#endif
 #endif
 	socket.async_connect(server_endpoint, [self=Ptr(this)](const asio::error_code& error)
                                               {
@@ -258,6 +332,25 @@ namespace openvpn {
                                               });
       }
 
+      // Returns true if reads were started through io_uring.
+      bool start_uring()
+      {
+#ifdef OPENVPN_UDPLINK_HAVE_URING
+	if (config->io_uring)
+	  {
+	    try {
+	      impl->start_uring(io_context, config->recv_batch_size ? config->recv_batch_size : 64);
+	      return true;
+	    }
+	    catch (const std::exception& e)
+	      {
+		OPENVPN_LOG("UDP io_uring unavailable, using reactor: " << e.what());
+	      }
+	  }
+#endif
+	return false;
+      }
+
       // start I/O on UDP socket
       void start_impl_(const asio::error_code& error)
       {
@@ -272,8 +365,35 @@ namespace openvpn {
 #ifdef OPENVPN_GREMLIN
 		impl->gremlin_config(config->gremlin_config);
 #endif
-		impl->start(config->n_parallel);
-		parent.transport_connecting();
+#ifdef OPENVPN_UDPLINK_HAVE_MMSG
+		if (config->send_queue_size)
+		  impl->enable_send_queue(config->send_queue_size, config->send_gso);
+		if (config->pass_tos)
+		  impl->enable_tos(server_endpoint.address().is_v6());
+		if (config->sockbuf_autotune_max)
+		  {
+		    SockBufTune::Config tc;
+		    tc.max = config->sockbuf_autotune_max;
+		    impl->enable_sockbuf_tune(tc);
+		  }
+#endif
+		if (!start_uring())
+		  {
+#ifdef OPENVPN_UDPLINK_HAVE_MMSG
+		    // outer TOS and kernel drops are only seen by batched receive
+		    if (config->recv_batch_size || config->pass_tos || config->sockbuf_autotune_max)
+		      impl->start_batch(config->recv_batch_size ? config->recv_batch_size : config->n_parallel);
+		    else
+#endif
+		    impl->start(config->n_parallel);
+		  }
+		if (rebinding)
+		  {
+		    rebinding = false;
+		    parent.transport_rebound();
+		  }
+		else
+		  parent.transport_connecting();
 	      }
 	    else
 	      {
@@ -297,6 +417,7 @@ namespace openvpn {
       asio::ip::udp::resolver resolver;
       UDPTransport::AsioEndpoint server_endpoint;
       bool halt;
+      bool rebinding = false;
     };
 
     inline TransportClient::Ptr ClientConfig::new_transport_client_obj(asio::io_context& io_context,
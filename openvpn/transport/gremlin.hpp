@@ -40,23 +40,48 @@ namespace openvpn {
 
     OPENVPN_EXCEPTION(gremlin_error);
 
+    // Delays events by a fixed time plus optional jitter.  With a
+    // nonzero rate_kbps, events of the given size are also serialized
+    // through a bottleneck of that rate with an unbounded queue, which
+    // models bufferbloat.  Events always fire in queue order.
     struct DelayedQueue : public RC<thread_unsafe_refcount>
     {
     public:
       typedef RCPtr<DelayedQueue> Ptr;
 
       DelayedQueue(asio::io_context& io_context,
-		   const unsigned int delay_ms)
+		   const unsigned int delay_ms,
+		   const unsigned int jitter_ms_arg = 0,
+		   const unsigned int rate_kbps_arg = 0,
+		   const MTRand::rand_type::result_type seed = 0)
 	: dur(Time::Duration::milliseconds(delay_ms)),
-	  next_event(io_context)
+	  jitter_ms(jitter_ms_arg),
+	  rate_kbps(rate_kbps_arg),
+	  next_event(io_context),
+	  rng(seed)
       {
       }
 
       template <class F>
-      void queue(F&& func_arg)
+      void queue(F&& func_arg, const size_t size = 0)
       {
 	const bool empty = events.empty();
-	events.emplace_back(new Event<F>(Time::now() + dur, std::move(func_arg)));
+	Time fire = Time::now();
+	if (rate_kbps && size)
+	  {
+	    // wait behind packets already queued at the bottleneck
+	    if (link_free > fire)
+	      fire = link_free;
+	    fire += tx_time(size);
+	    link_free = fire;
+	  }
+	fire += dur;
+	if (jitter_ms)
+	  fire += Time::Duration::milliseconds(rng.randrange(jitter_ms + 1));
+	if (!empty && fire < last_fire)
+	  fire = last_fire;
+	last_fire = fire;
+	events.emplace_back(new Event<F>(fire, std::move(func_arg)));
 	if (empty)
 	  set_timer();
       }
@@ -122,8 +147,24 @@ namespace openvpn {
 			      });
       }
 
+      // serialization time in Time units (1/1024 sec), carrying
+      // the remainder so that small packets at high rates add up
+      Time::Duration tx_time(const size_t size)
+      {
+	const std::uint64_t div = std::uint64_t(rate_kbps) * 1000;
+	const std::uint64_t n = std::uint64_t(size) * 8 * Time::prec + tx_carry;
+	tx_carry = n % div;
+	return Time::Duration::binary_ms(n / div);
+      }
+
       Time::Duration dur;
+      const unsigned int jitter_ms;
+      const unsigned int rate_kbps;
       AsioTimer next_event;
+      MTRand rng;
+      Time link_free;
+      Time last_fire;
+      std::uint64_t tx_carry = 0;
       std::deque<std::unique_ptr<EventBase>> events;
     };
 
@@ -132,8 +173,12 @@ namespace openvpn {
     public:
       typedef RCPtr<Config> Ptr;
 
+      // config_str is either a profile name (see set_profile) or
+      // send_delay_ms,recv_delay_ms,send_drop_prob,recv_drop_prob[,jitter_ms[,rate_kbps[,seed]]]
       Config(const std::string& config_str)
       {
+	if (set_profile(string::trim_copy(config_str)))
+	  return;
 	const std::vector<std::string> parms = string::split(config_str, ',');
 	if (parms.size() < 4)
 	  throw gremlin_error("need 4 comma-separated values for send_delay_ms, recv_delay_ms, send_drop_prob, recv_drop_prob");
@@ -145,12 +190,35 @@ namespace openvpn {
 	  throw gremlin_error("send_drop_probability");
 	if (!parse_number(string::trim_copy(parms[3]), recv_drop_probability))
 	  throw gremlin_error("recv_drop_probability");
+	if (parms.size() >= 5 && !parse_number(string::trim_copy(parms[4]), jitter_ms))
+	  throw gremlin_error("jitter_ms");
+	if (parms.size() >= 6 && !parse_number(string::trim_copy(parms[5]), rate_kbps))
+	  throw gremlin_error("rate_kbps");
+	if (parms.size() >= 7 && !parse_number(string::trim_copy(parms[6]), seed))
+	  throw gremlin_error("seed");
+      }
+
+      // Named network profiles.  Delays, jitter and rate apply to each
+      // direction, drop probabilities are 1 in N.
+      static Ptr profile(const std::string& name, const unsigned int seed = 0)
+      {
+	Ptr ret(new Config());
+	if (!ret->set_profile(name))
+	  throw gremlin_error("unknown profile: " + name);
+	ret->seed = seed;
+	return ret;
+      }
+
+      static const char *profile_names()
+      {
+	return "clean, lte, satellite, wifi-lossy, bufferbloat";
       }
 
       std::string to_string() const
       {
 	std::ostringstream os;
-	os << '[' << send_delay_ms << ',' << recv_delay_ms << ',' << send_drop_probability << ',' << recv_drop_probability << ']';
+	os << '[' << send_delay_ms << ',' << recv_delay_ms << ',' << send_drop_probability << ',' << recv_drop_probability
+	   << ',' << jitter_ms << ',' << rate_kbps << ',' << seed << ']';
 	return os.str();
       }
 
@@ -158,6 +226,37 @@ namespace openvpn {
       unsigned int recv_delay_ms = 0;
       unsigned int send_drop_probability = 0;
       unsigned int recv_drop_probability = 0;
+      unsigned int jitter_ms = 0;   // uniform extra delay of 0..jitter_ms, order-preserving
+      unsigned int rate_kbps = 0;   // bottleneck rate, 0 for none
+      unsigned int seed = 0;        // nonzero for a reproducible drop/jitter sequence
+
+    private:
+      Config() {}
+
+      bool set_profile(const std::string& name)
+      {
+	if (name == "clean")
+	  set(0, 0, 0, 0);
+	else if (name == "lte")
+	  set(35, 100, 15, 20000);
+	else if (name == "satellite")
+	  set(300, 200, 10, 10000);
+	else if (name == "wifi-lossy")
+	  set(5, 20, 5, 30000);
+	else if (name == "bufferbloat")
+	  set(20, 0, 0, 2000);
+	else
+	  return false;
+	return true;
+      }
+
+      void set(const unsigned int delay, const unsigned int drop, const unsigned int jitter, const unsigned int rate)
+      {
+	send_delay_ms = recv_delay_ms = delay;
+	send_drop_probability = recv_drop_probability = drop;
+	jitter_ms = jitter;
+	rate_kbps = rate;
+      }
     };
 
     class SendRecvQueue
@@ -167,24 +266,26 @@ namespace openvpn {
 		    const Config::Ptr& conf_arg,
 		    const bool tcp_arg)
 	: conf(conf_arg),
-	  send(new DelayedQueue(io_context, conf->send_delay_ms)),
-	  recv(new DelayedQueue(io_context, conf->recv_delay_ms)),
+	  ri(conf->seed ? conf->seed : MTRand().rand()),
+	  send(new DelayedQueue(io_context, conf->send_delay_ms, conf->jitter_ms, conf->rate_kbps, ri.rand())),
+	  recv(new DelayedQueue(io_context, conf->recv_delay_ms, conf->jitter_ms, conf->rate_kbps, ri.rand())),
 	  tcp(tcp_arg)
       {
       }
 
+      // size is the packet size in bytes, used by the rate limit
       template <class F>
-      void send_queue(F&& func_arg)
+      void send_queue(F&& func_arg, const size_t size = 0)
       {
 	if (tcp || flip(conf->send_drop_probability))
-	  send->queue(std::move(func_arg));
+	  send->queue(std::move(func_arg), size);
       }
 
       template <class F>
-      void recv_queue(F&& func_arg)
+      void recv_queue(F&& func_arg, const size_t size = 0)
       {
 	if (tcp || flip(conf->recv_drop_probability))
-	  recv->queue(std::move(func_arg));
+	  recv->queue(std::move(func_arg), size);
       }
 
       size_t send_size() const
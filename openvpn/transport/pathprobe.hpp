@@ -0,0 +1,202 @@
+//    OpenVPN -- An application to securely tunnel IP networks
+//               over a single port, with support for SSL/TLS-based
+//               session authentication and key exchange,
+//               packet encryption, packet authentication, and
+//               packet compression.
+//
+//    Copyright (C) 2012-2016 OpenVPN Technologies, Inc.
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU Affero General Public License Version 3
+//    as published by the Free Software Foundation.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU Affero General Public License for more details.
+//
+//    You should have received a copy of the GNU Affero General Public License
+//    along with this program in the COPYING file.
+//    If not, see <http://www.gnu.org/licenses/>.
+
+// Per-path probes for multipath UDP transports.  The client sends a
+// short request on each path, and the server transport echoes it back
+// on the same path without involving a session, so the client can
+// measure RTT and loss of each path independently.
+
+#ifndef OPENVPN_TRANSPORT_PATHPROBE_H
+#define OPENVPN_TRANSPORT_PATHPROBE_H
+
+#include <cstring> // for std::memcmp
+#include <cstdint> // for std::uint32_t
+
+#include <openvpn/buffer/buffer.hpp>
+#include <openvpn/time/time.hpp>
+
+namespace openvpn {
+
+  class PathProbe
+  {
+  public:
+    // Messages are laid out as magic[8] | type | seq[4].  The first
+    // byte is zero, which is an invalid OpenVPN opcode, so servers
+    // that don't know about probes drop them.
+    enum {
+      MAGIC_SIZE = 8,
+      SIZE = MAGIC_SIZE + 1 + 4,
+    };
+
+    enum Type {
+      REQUEST = 1,
+      REPLY = 2,
+    };
+
+    struct Config
+    {
+      Config()
+	: interval(Time::Duration::seconds(1)),
+	  timeout(Time::Duration::seconds(3)),
+	  initial_rtt_ms(100)
+      {
+      }
+
+      Time::Duration interval; // time between probes on a path
+      Time::Duration timeout;  // path is down after this long without reply
+      unsigned int initial_rtt_ms; // assumed until the first reply
+    };
+
+    static bool is_message(const Buffer& buf)
+    {
+      return buf.size() == SIZE
+	&& buf[0] == magic()[0]
+	&& !std::memcmp(magic(), buf.c_data(), MAGIC_SIZE);
+    }
+
+    static void write_message(Buffer& buf, const Type type, const std::uint32_t seq)
+    {
+      buf.write(magic(), MAGIC_SIZE);
+      buf.push_back(static_cast<unsigned char>(type));
+      for (int s = 24; s >= 0; s -= 8)
+	buf.push_back(static_cast<unsigned char>(seq >> s));
+    }
+
+    static Type message_type(const Buffer& buf)
+    {
+      return Type(buf[MAGIC_SIZE]);
+    }
+
+    static std::uint32_t message_seq(const Buffer& buf)
+    {
+      const unsigned char *p = buf.c_data() + MAGIC_SIZE + 1;
+      return (std::uint32_t(p[0]) << 24) | (std::uint32_t(p[1]) << 16)
+	| (std::uint32_t(p[2]) << 8) | std::uint32_t(p[3]);
+    }
+
+    // Server side: if buf is a probe request, turn it into its
+    // reply in place and return true.
+    static bool make_reply(Buffer& buf)
+    {
+      if (!is_message(buf) || message_type(buf) != REQUEST)
+	return false;
+      buf[MAGIC_SIZE] = REPLY;
+      return true;
+    }
+
+    // Client side RTT and loss estimate of one path, with at most
+    // one probe outstanding.
+    class Estimator
+    {
+    public:
+      Estimator() {}
+
+      explicit Estimator(const Config& config_arg)
+	: config(config_arg),
+	  srtt(config_arg.initial_rtt_ms)
+      {
+      }
+
+      // Begin probing, such as when the path has connected.
+      void start(const Time& now)
+      {
+	started = now;
+	next_probe = now;
+	outstanding = false;
+      }
+
+      // If a probe is due, return its sequence number (nonzero) and
+      // mark it sent, otherwise return 0.
+      std::uint32_t probe_due(const Time& now)
+      {
+	if (now < next_probe)
+	  return 0;
+	if (outstanding)
+	  loss += (1.0 - loss) / 8.0; // probe lost
+	outstanding = true;
+	sent = now;
+	next_probe = now + config.interval;
+	if (!++seq)
+	  ++seq;
+	return seq;
+      }
+
+      void reply(const std::uint32_t reply_seq, const Time& now)
+      {
+	if (!outstanding || reply_seq != seq)
+	  return;
+	outstanding = false;
+	const double rtt = double((now - sent).to_milliseconds());
+	srtt = replied ? srtt + (rtt - srtt) / 8.0 : rtt;
+	loss -= loss / 8.0;
+	replied = true;
+	last_reply = now;
+      }
+
+      // Path has answered recently.  A path that has never answered
+      // counts as alive until the timeout has passed once.
+      bool alive(const Time& now) const
+      {
+	if (replied)
+	  return now < last_reply + config.timeout;
+	return now < started + config.timeout;
+      }
+
+      // Relative cost of sending on this path, lower is better.
+      double cost() const
+      {
+	return (srtt + 1.0) * (1.0 + 10.0 * loss);
+      }
+
+      double rtt_ms() const { return srtt; }
+      double loss_rate() const { return loss; }
+
+      Time next_event() const
+      {
+	return next_probe;
+      }
+
+    private:
+      Config config;
+      double srtt = 0.0;
+      double loss = 0.0;
+      bool replied = false;
+      bool outstanding = false;
+      std::uint32_t seq = 0;
+      Time started;
+      Time sent;
+      Time next_probe;
+      Time last_reply;
+    };
+
+  private:
+    static const unsigned char *magic()
+    {
+      static const unsigned char m[MAGIC_SIZE] = { // CONST GLOBAL
+	0x00, 0x6d, 0x70, 0xa3, 0x5e, 0x91, 0xc4, 0x27
+      };
+      return m;
+    }
+  };
+
+}
+
+#endif
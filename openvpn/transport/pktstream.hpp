@@ -24,6 +24,7 @@
 
 #include <algorithm>         // for std::min
 #include <cstdint>           // for std::uint16_t, etc.
+#include <cstring>           // for std::memmove
 
 #include <openvpn/common/exception.hpp>
 #include <openvpn/buffer/buffer.hpp>
@@ -39,7 +40,7 @@ namespace openvpn {
     OPENVPN_SIMPLE_EXCEPTION(embedded_packet_size_error);
     OPENVPN_SIMPLE_EXCEPTION(packet_not_fully_formed);
 
-    PacketStream() : declared_size_defined(false) {}
+    PacketStream() : declared_size_defined(false), moved(0) {}
 
     // Add stream fragment to packet that we are building up.
     // Data will be read from buf.  On return buf may still contain
@@ -64,7 +65,8 @@ namespace openvpn {
 		      else
 			{
 			  buffer.swap(buf);
-			  frame_context.realign(buffer);
+			  if (frame_context.realign(buffer))
+			    ++moved;
 			}
 		    }
 		  else                                 // packet is oversized
@@ -72,12 +74,14 @@ namespace openvpn {
 		      frame_context.prepare(buffer);
 		      const unsigned char *data = buf.read_alloc(declared_size);
 		      buffer.write(data, declared_size);
+		      ++moved;
 		    }
 		}
 	      else // rare case where packet fragment is too small to contain embedded size
 		{
 		  buffer.swap(buf);
-		  frame_context.realign(buffer);
+		  if (frame_context.realign(buffer))
+		    ++moved;
 		}
 	    }
 	  else
@@ -95,11 +99,18 @@ namespace openvpn {
 		  const size_t needed = std::min(declared_size - buffer.size(), buf.size());
 		  const unsigned char *data = buf.read_alloc(needed);
 		  buffer.write(data, needed);
+		  ++moved;
 		}
 	    }
 	}
     }
 
+    // returns true if a partial packet is buffered
+    bool empty() const
+    {
+      return !declared_size_defined && buffer.empty();
+    }
+
     // returns true if get() may be called to return fully formed packet
     bool ready() const
     {
@@ -120,6 +131,16 @@ namespace openvpn {
 	throw packet_not_fully_formed();
     }
 
+    // Number of packet copies or realigns (full-packet memmoves) since
+    // the last call.  Every partial TCP read that has to be reassembled
+    // or realigned costs one.
+    size_t take_moved()
+    {
+      const size_t ret = moved;
+      moved = 0;
+      return ret;
+    }
+
     // prepend uint16_t size to buffer
     static void prepend_size(Buffer& buf)
     {
@@ -157,6 +178,106 @@ namespace openvpn {
     size_t declared_size;       // declared size of packet in leading uint16_t prefix
     bool declared_size_defined; // true if declared_size is defined
     BufferAllocated buffer;     // accumulated packet data
+    size_t moved;               // copies/realigns not yet reported by take_moved()
+  };
+
+  // Alternative to PacketStream for large stream reads.  The caller
+  // reads directly into the ring at write_ptr()/write_avail(), then
+  // calls commit() with the number of bytes read.  Complete packets
+  // are then lent out by lend() as a window onto the ring's own
+  // storage, without copying.  The borrower may modify the packet and
+  // prepend into the headroom before it, which only holds consumed
+  // data, but must not write past its end or keep the storage, and
+  // must return it with reclaim() before the next lend().  When free
+  // space runs short, the one packet left incomplete at the end is
+  // moved back to the start of the ring, so that is the only data
+  // ever copied.
+  class PacketStreamRing
+  {
+  public:
+    PacketStreamRing(const size_t capacity, const Frame::Context& frame_context)
+      : headroom(frame_context.headroom()),
+	max_packet(frame_context.payload()),
+	ring(headroom + std::max(capacity, max_packet + sizeof(std::uint16_t)), 0),
+	head(headroom),
+	tail(headroom),
+	lent(nullptr)
+    {
+    }
+
+    unsigned char *write_ptr()
+    {
+      if (head == tail)
+	head = tail = headroom;
+      else if (ring.capacity() - tail < max_packet + sizeof(std::uint16_t))
+	{
+	  // move the straddling partial packet to the front
+	  const size_t residual = tail - head;
+	  std::memmove(ring.data_raw() + headroom, ring.data_raw() + head, residual);
+	  head = headroom;
+	  tail = headroom + residual;
+	}
+      return ring.data_raw() + tail;
+    }
+
+    size_t write_avail() const
+    {
+      return ring.capacity() - tail;
+    }
+
+    void commit(const size_t size)
+    {
+      if (size > write_avail())
+	throw embedded_packet_size_error();
+      tail += size;
+    }
+
+    // Lend the next fully formed packet as pkt, whose previous
+    // content is kept until reclaim().  Returns false if there is
+    // no complete packet.
+    bool lend(BufferAllocated& pkt)
+    {
+      const size_t avail = tail - head;
+      if (avail < sizeof(std::uint16_t))
+	return false;
+      const unsigned char *p = ring.c_data_raw() + head;
+      const size_t size = (size_t(p[0]) << 8) | size_t(p[1]);
+      if (!size || size > max_packet)
+	throw embedded_packet_size_error();
+      if (avail < sizeof(std::uint16_t) + size)
+	return false;
+      ring.init_headroom(head + sizeof(std::uint16_t));
+      ring.set_size(size);
+      head += sizeof(std::uint16_t) + size;
+      lent = ring.c_data_raw();
+      pkt.swap(ring);
+      return true;
+    }
+
+    // take back the storage lent as pkt
+    void reclaim(BufferAllocated& pkt)
+    {
+      if (pkt.c_data_raw() != lent)
+	throw ring_storage_lost();
+      pkt.swap(ring);
+    }
+
+    // bytes received but not yet lent
+    size_t pending() const
+    {
+      return tail - head;
+    }
+
+    OPENVPN_SIMPLE_EXCEPTION(embedded_packet_size_error);
+    OPENVPN_SIMPLE_EXCEPTION(ring_storage_lost);
+
+  private:
+    const size_t headroom;
+    const size_t max_packet;
+    BufferAllocated ring;
+    size_t head;  // start of first unconsumed byte
+    size_t tail;  // end of received data
+    const unsigned char *lent;
   };
 } // namespace openvpn
 
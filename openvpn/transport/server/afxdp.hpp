@@ -0,0 +1,857 @@
+//    OpenVPN -- An application to securely tunnel IP networks
+//               over a single port, with support for SSL/TLS-based
+//               session authentication and key exchange,
+//               packet encryption, packet authentication, and
+//               packet compression.
+//
+//    Copyright (C) 2012-2016 OpenVPN Technologies, Inc.
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU Affero General Public License Version 3
+//    as published by the Free Software Foundation.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU Affero General Public License for more details.
+//
+//    You should have received a copy of the GNU Affero General Public License
+//    along with this program in the COPYING file.
+//    If not, see <http://www.gnu.org/licenses/>.
+
+// AF_XDP server transport for Linux.  An XDP program attached to one
+// NIC queue redirects UDP packets for the VPN port to an AF_XDP socket,
+// everything else continues up the kernel stack.  Packets are received
+// from and sent through a shared UMEM area with no per-packet syscall.
+
+#ifndef OPENVPN_TRANSPORT_SERVER_AFXDP_H
+#define OPENVPN_TRANSPORT_SERVER_AFXDP_H
+
+#include <string>
+#include <vector>
+#include <cstring>
+#include <cstdint>
+
+#include <errno.h>
+#include <unistd.h>
+#include <net/if.h>
+#include <arpa/inet.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <linux/bpf.h>
+#include <linux/if_link.h>
+#include <linux/if_xdp.h>
+
+#include <asio.hpp>
+
+#include <openvpn/common/exception.hpp>
+#include <openvpn/common/rc.hpp>
+#include <openvpn/common/scoped_fd.hpp>
+#include <openvpn/common/format.hpp>
+#include <openvpn/frame/frame.hpp>
+#include <openvpn/log/sessionstats.hpp>
+#include <openvpn/random/randapi.hpp>
+#include <openvpn/ip/ip.hpp>
+#include <openvpn/ip/eth.hpp>
+#include <openvpn/ip/udp.hpp>
+#include <openvpn/server/peeraddrtable.hpp>
+#include <openvpn/transport/server/transbase.hpp>
+#include <openvpn/transport/pathprobe.hpp>
+
+#ifndef AF_XDP
+#define AF_XDP 44
+#endif
+#ifndef SOL_XDP
+#define SOL_XDP 283
+#endif
+
+namespace openvpn {
+  namespace AFXDPTransport {
+
+    OPENVPN_EXCEPTION(afxdp_error);
+
+    class Server;
+
+    class ServerConfig : public TransportServerFactory
+    {
+    public:
+      typedef RCPtr<ServerConfig> Ptr;
+
+      std::string dev;                 // NIC to attach to
+      unsigned int queue_id = 0;       // NIC queue, one server per queue
+      std::uint16_t port = 1194;       // UDP port steered to user space
+
+      unsigned int n_frames = 4096;    // UMEM frames, half for RX, half for TX
+      unsigned int frame_size = 2048;  // UMEM frame size, a power of 2
+      unsigned int batch_size = 64;    // max packets handled per wakeup
+      bool zerocopy = true;            // try driver zero-copy mode first
+
+      Frame::Ptr frame;
+      SessionStats::Ptr stats;
+      RandomAPI::Ptr rng;              // keys the client endpoint hash
+      TransportClientInstanceFactory::Ptr client_instance_factory;
+
+      static Ptr new_obj()
+      {
+	return new ServerConfig;
+      }
+
+      virtual TransportServer::Ptr new_server_obj(asio::io_context& io_context);
+
+    private:
+      ServerConfig() {}
+    };
+
+    class Server : public TransportServer
+    {
+    public:
+      typedef RCPtr<Server> Ptr;
+
+      Server(asio::io_context& io_context_arg,
+	     const ServerConfig::Ptr& config_arg)
+	: io_context(io_context_arg),
+	  config(config_arg),
+	  xsk(io_context_arg),
+	  frame_context((*config_arg->frame)[Frame::READ_LINK_UDP]),
+	  instances(rng_of(*config_arg))
+      {
+      }
+
+      virtual void start()
+      {
+	if (halt)
+	  return;
+	ifindex = ::if_nametoindex(config->dev.c_str());
+	if (!ifindex)
+	  OPENVPN_THROW(afxdp_error, "unknown interface " << config->dev);
+	setup_socket();
+	setup_program();
+	queue_recv();
+      }
+
+      virtual void stop()
+      {
+	if (halt)
+	  return;
+	halt = true;
+
+	// detach the program first, so the kernel stack sees the port again
+	link_fd.close();
+	prog_fd.close();
+	map_fd.close();
+
+	instances.for_each([](Instance* inst)
+			   {
+			     inst->server = nullptr;
+			     if (inst->recv)
+			       inst->recv->stop();
+			   });
+	instances.clear();
+
+	asio::error_code ec;
+	xsk.close(ec);
+	unmap();
+      }
+
+      virtual std::string local_endpoint_info() const
+      {
+	return "AF_XDP " + config->dev + ':' + openvpn::to_string(config->queue_id)
+	  + (zerocopy_ ? " zero-copy" : " copy") + " UDP port " + openvpn::to_string(config->port);
+      }
+
+      ~Server()
+      {
+	stop();
+      }
+
+    private:
+      // Client endpoint, addresses in network byte order.
+      struct Key
+      {
+	std::uint8_t addr[16];
+	std::uint16_t port;
+	bool v6;
+
+	bool operator==(const Key& other) const
+	{
+	  return port == other.port && v6 == other.v6
+	    && !std::memcmp(addr, other.addr, v6 ? 16 : 4);
+	}
+      };
+
+
+      // Per-client state, and the client instance's path back to us.
+      // Replies go out through the same next hop and local address
+      // that the last packet from the client came in on.
+      struct Instance : public TransportClientInstanceSend
+      {
+	typedef RCPtr<Instance> Ptr;
+
+	virtual bool defined() const
+	{
+	  return server != nullptr;
+	}
+
+	virtual void stop()
+	{
+	  if (server)
+	    {
+	      Server* s = server;
+	      server = nullptr;
+	      s->instances.remove(table_key(key));
+	    }
+	}
+
+	virtual bool transport_send_const(const Buffer& buf)
+	{
+	  if (server && server->send(*this, buf))
+	    {
+	      ps.tx_bytes += buf.size();
+	      pending = true;
+	      return true;
+	    }
+	  return false;
+	}
+
+	virtual bool transport_send(BufferAllocated& buf)
+	{
+	  return transport_send_const(buf);
+	}
+
+	virtual const std::string& transport_info() const
+	{
+	  return info;
+	}
+
+	virtual bool stats_pending() const
+	{
+	  return pending;
+	}
+
+	virtual PeerStats stats_poll()
+	{
+	  pending = false;
+	  return ps;
+	}
+
+	Server* server = nullptr;
+	TransportClientInstanceRecv::Ptr recv;
+	Key key;
+	std::uint8_t local_addr[16];
+	std::uint8_t peer_mac[6];   // next hop towards the client
+	std::uint8_t local_mac[6];
+	std::string info;
+	PeerStats ps;
+	bool pending = false;
+      };
+
+      // One of the four single-producer/single-consumer rings
+      // shared with the kernel.
+      struct Ring
+      {
+	std::uint32_t *producer = nullptr;
+	std::uint32_t *consumer = nullptr;
+	std::uint32_t *flags = nullptr;
+	void* ring = nullptr;
+	std::uint32_t mask = 0;
+	std::uint32_t size = 0;
+	std::uint32_t local = 0; // our producer or consumer index
+	void* map = nullptr;
+	size_t map_len = 0;
+
+	std::uint32_t kernel_producer() const
+	{
+	  return __atomic_load_n(producer, __ATOMIC_ACQUIRE);
+	}
+
+	std::uint32_t kernel_consumer() const
+	{
+	  return __atomic_load_n(consumer, __ATOMIC_ACQUIRE);
+	}
+
+	void publish_producer()
+	{
+	  __atomic_store_n(producer, local, __ATOMIC_RELEASE);
+	}
+
+	void publish_consumer()
+	{
+	  __atomic_store_n(consumer, local, __ATOMIC_RELEASE);
+	}
+
+	bool need_wakeup() const
+	{
+	  return *flags & XDP_RING_NEED_WAKEUP;
+	}
+
+	std::uint64_t& addr(const std::uint32_t i)
+	{
+	  return ((std::uint64_t *)ring)[i & mask];
+	}
+
+	struct xdp_desc& desc(const std::uint32_t i)
+	{
+	  return ((struct xdp_desc *)ring)[i & mask];
+	}
+      };
+
+      void setup_socket()
+      {
+	const unsigned int fsize = config->frame_size;
+	const unsigned int nframes = config->n_frames;
+	if (fsize < 2048 || (fsize & (fsize - 1)) || nframes < 64 || (nframes & (nframes - 1)))
+	  throw afxdp_error("frame_size and n_frames must be powers of 2, at least 2048 and 64");
+
+	const int fd = ::socket(AF_XDP, SOCK_RAW | SOCK_CLOEXEC, 0);
+	if (fd < 0)
+	  OPENVPN_THROW(afxdp_error, "AF_XDP socket: " << std::strerror(errno));
+	xsk.assign(fd);
+
+	umem_len = size_t(nframes) * fsize;
+	void *m = ::mmap(nullptr, umem_len, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS|MAP_POPULATE, -1, 0);
+	if (m == MAP_FAILED)
+	  OPENVPN_THROW(afxdp_error, "UMEM mmap: " << std::strerror(errno));
+	umem = (std::uint8_t *)m;
+
+	struct xdp_umem_reg reg;
+	std::memset(&reg, 0, sizeof(reg));
+	reg.addr = (std::uint64_t)umem;
+	reg.len = umem_len;
+	reg.chunk_size = fsize;
+	sockopt(XDP_UMEM_REG, &reg, sizeof(reg), "XDP_UMEM_REG");
+
+	// RX frames cycle between the fill and RX rings,
+	// TX frames between the TX and completion rings.
+	const std::uint32_t half = nframes / 2;
+	sockopt(XDP_UMEM_FILL_RING, &half, sizeof(half), "XDP_UMEM_FILL_RING");
+	sockopt(XDP_UMEM_COMPLETION_RING, &half, sizeof(half), "XDP_UMEM_COMPLETION_RING");
+	sockopt(XDP_RX_RING, &half, sizeof(half), "XDP_RX_RING");
+	sockopt(XDP_TX_RING, &half, sizeof(half), "XDP_TX_RING");
+
+	struct xdp_mmap_offsets off;
+	socklen_t optlen = sizeof(off);
+	if (::getsockopt(fd, SOL_XDP, XDP_MMAP_OFFSETS, &off, &optlen) < 0)
+	  OPENVPN_THROW(afxdp_error, "XDP_MMAP_OFFSETS: " << std::strerror(errno));
+	map_ring(fill, off.fr, half, sizeof(std::uint64_t), XDP_UMEM_PGOFF_FILL_RING);
+	map_ring(comp, off.cr, half, sizeof(std::uint64_t), XDP_UMEM_PGOFF_COMPLETION_RING);
+	map_ring(rx, off.rx, half, sizeof(struct xdp_desc), XDP_PGOFF_RX_RING);
+	map_ring(tx, off.tx, half, sizeof(struct xdp_desc), XDP_PGOFF_TX_RING);
+
+	for (std::uint32_t i = 0; i < half; ++i)
+	  fill.addr(fill.local++) = std::uint64_t(i) * fsize;
+	fill.publish_producer();
+	tx_free.reserve(half);
+	for (std::uint32_t i = half; i < nframes; ++i)
+	  tx_free.push_back(std::uint64_t(i) * fsize);
+
+	// prefer zero-copy, fall back to copy mode on drivers without it
+	struct sockaddr_xdp sxdp;
+	std::memset(&sxdp, 0, sizeof(sxdp));
+	sxdp.sxdp_family = AF_XDP;
+	sxdp.sxdp_ifindex = ifindex;
+	sxdp.sxdp_queue_id = config->queue_id;
+	int status = -1;
+	if (config->zerocopy)
+	  {
+	    sxdp.sxdp_flags = XDP_ZEROCOPY | XDP_USE_NEED_WAKEUP;
+	    status = ::bind(fd, (struct sockaddr *)&sxdp, sizeof(sxdp));
+	    zerocopy_ = (status == 0);
+	  }
+	if (status < 0)
+	  {
+	    sxdp.sxdp_flags = XDP_COPY | XDP_USE_NEED_WAKEUP;
+	    status = ::bind(fd, (struct sockaddr *)&sxdp, sizeof(sxdp));
+	  }
+	if (status < 0)
+	  OPENVPN_THROW(afxdp_error, "AF_XDP bind to " << config->dev << " queue " << config->queue_id << ": " << std::strerror(errno));
+      }
+
+      void sockopt(const int opt, const void *value, const socklen_t len, const char *title)
+      {
+	if (::setsockopt(xsk.native_handle(), SOL_XDP, opt, value, len) < 0)
+	  OPENVPN_THROW(afxdp_error, title << ": " << std::strerror(errno));
+      }
+
+      void map_ring(Ring& r, const struct xdp_ring_offset& off, const std::uint32_t size,
+		    const size_t entry_size, const off_t pgoff)
+      {
+	r.map_len = off.desc + size * entry_size;
+	r.map = ::mmap(nullptr, r.map_len, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_POPULATE, xsk.native_handle(), pgoff);
+	if (r.map == MAP_FAILED)
+	  {
+	    r.map = nullptr;
+	    OPENVPN_THROW(afxdp_error, "AF_XDP ring mmap: " << std::strerror(errno));
+	  }
+	std::uint8_t *base = (std::uint8_t *)r.map;
+	r.producer = (std::uint32_t *)(base + off.producer);
+	r.consumer = (std::uint32_t *)(base + off.consumer);
+	r.flags = (std::uint32_t *)(base + off.flags);
+	r.ring = base + off.desc;
+	r.size = size;
+	r.mask = size - 1;
+	r.local = 0;
+      }
+
+      void unmap()
+      {
+	for (Ring* r : { &fill, &comp, &rx, &tx })
+	  {
+	    if (r->map)
+	      ::munmap(r->map, r->map_len);
+	    r->map = nullptr;
+	  }
+	if (umem)
+	  ::munmap(umem, umem_len);
+	umem = nullptr;
+      }
+
+      static int bpf(const int cmd, union bpf_attr& attr)
+      {
+	return (int)::syscall(__NR_bpf, cmd, &attr, sizeof(attr));
+      }
+
+      static struct bpf_insn insn(const std::uint8_t code, const std::uint8_t dst, const std::uint8_t src,
+				  const std::int16_t off, const std::int32_t imm)
+      {
+	struct bpf_insn i;
+	i.code = code;
+	i.dst_reg = dst;
+	i.src_reg = src;
+	i.off = off;
+	i.imm = imm;
+	return i;
+      }
+
+      // Create the XSKMAP holding our socket and load and attach the
+      // steering program:
+      //
+      //   if (IPv4 without options or IPv6, unfragmented UDP, dest port == port)
+      //     return bpf_redirect_map(&xsks, ctx->rx_queue_index, XDP_PASS);
+      //   return XDP_PASS;
+      void setup_program()
+      {
+	union bpf_attr attr;
+
+	std::memset(&attr, 0, sizeof(attr));
+	attr.map_type = BPF_MAP_TYPE_XSKMAP;
+	attr.key_size = sizeof(std::uint32_t);
+	attr.value_size = sizeof(std::uint32_t);
+	attr.max_entries = config->queue_id + 1;
+	const int mfd = bpf(BPF_MAP_CREATE, attr);
+	if (mfd < 0)
+	  OPENVPN_THROW(afxdp_error, "XSKMAP create: " << std::strerror(errno));
+	map_fd.reset(mfd);
+
+	const std::uint32_t key = config->queue_id;
+	const std::uint32_t value = xsk.native_handle();
+	std::memset(&attr, 0, sizeof(attr));
+	attr.map_fd = mfd;
+	attr.key = (std::uint64_t)&key;
+	attr.value = (std::uint64_t)&value;
+	if (bpf(BPF_MAP_UPDATE_ELEM, attr) < 0)
+	  OPENVPN_THROW(afxdp_error, "XSKMAP update: " << std::strerror(errno));
+
+	enum { R0=0, R1, R2, R3, R4, R5, R6 };
+	const std::int32_t port = htons(config->port);
+	const std::int32_t eth_ip4 = htons(0x0800);
+	const std::int32_t eth_ip6 = htons(0x86DD);
+	const std::int32_t frag4 = htons(0x3FFF); // MF flag and fragment offset
+	const struct bpf_insn prog[] = {
+	  insn(BPF_ALU64|BPF_MOV|BPF_X, R6, R1, 0, 0),			//  0: r6 = ctx
+	  insn(BPF_LDX|BPF_MEM|BPF_W, R2, R1, 0, 0),			//  1: r2 = data
+	  insn(BPF_LDX|BPF_MEM|BPF_W, R3, R1, 4, 0),			//  2: r3 = data_end
+	  insn(BPF_ALU64|BPF_MOV|BPF_X, R4, R2, 0, 0),			//  3: r4 = data
+	  insn(BPF_ALU64|BPF_ADD|BPF_K, R4, 0, 0, 14),			//  4: r4 += eth
+	  insn(BPF_JMP|BPF_JGT|BPF_X, R4, R3, 28, 0),			//  5: short -> pass
+	  insn(BPF_LDX|BPF_MEM|BPF_H, R5, R2, 12, 0),			//  6: r5 = ethertype
+	  insn(BPF_JMP|BPF_JEQ|BPF_K, R5, 0, 2, eth_ip4),		//  7: -> ipv4
+	  insn(BPF_JMP|BPF_JEQ|BPF_K, R5, 0, 13, eth_ip6),		//  8: -> ipv6
+	  insn(BPF_JMP|BPF_JA, 0, 0, 24, 0),				//  9: -> pass
+	  insn(BPF_ALU64|BPF_ADD|BPF_K, R4, 0, 0, 20 + 8),		// 10: ipv4: r4 += ip + udp
+	  insn(BPF_JMP|BPF_JGT|BPF_X, R4, R3, 22, 0),			// 11: short -> pass
+	  insn(BPF_LDX|BPF_MEM|BPF_B, R5, R2, 14, 0),			// 12: r5 = version_len
+	  insn(BPF_JMP|BPF_JNE|BPF_K, R5, 0, 20, 0x45),			// 13: options -> pass
+	  insn(BPF_LDX|BPF_MEM|BPF_B, R5, R2, 14 + 9, 0),		// 14: r5 = protocol
+	  insn(BPF_JMP|BPF_JNE|BPF_K, R5, 0, 18, IPHeader::UDP),	// 15: not udp -> pass
+	  insn(BPF_LDX|BPF_MEM|BPF_H, R5, R2, 14 + 6, 0),		// 16: r5 = frag_off
+	  insn(BPF_ALU64|BPF_AND|BPF_K, R5, 0, 0, frag4),		// 17:
+	  insn(BPF_JMP|BPF_JNE|BPF_K, R5, 0, 15, 0),			// 18: fragment -> pass
+	  insn(BPF_LDX|BPF_MEM|BPF_H, R5, R2, 14 + 20 + 2, 0),		// 19: r5 = udp dest
+	  insn(BPF_JMP|BPF_JNE|BPF_K, R5, 0, 13, port),			// 20: other port -> pass
+	  insn(BPF_JMP|BPF_JA, 0, 0, 6, 0),				// 21: -> redirect
+	  insn(BPF_ALU64|BPF_ADD|BPF_K, R4, 0, 0, 40 + 8),		// 22: ipv6: r4 += ip + udp
+	  insn(BPF_JMP|BPF_JGT|BPF_X, R4, R3, 10, 0),			// 23: short -> pass
+	  insn(BPF_LDX|BPF_MEM|BPF_B, R5, R2, 14 + 6, 0),		// 24: r5 = next header
+	  insn(BPF_JMP|BPF_JNE|BPF_K, R5, 0, 8, IPHeader::UDP),		// 25: not udp -> pass
+	  insn(BPF_LDX|BPF_MEM|BPF_H, R5, R2, 14 + 40 + 2, 0),		// 26: r5 = udp dest
+	  insn(BPF_JMP|BPF_JNE|BPF_K, R5, 0, 6, port),			// 27: other port -> pass
+	  insn(BPF_LDX|BPF_MEM|BPF_W, R2, R6, 16, 0),			// 28: redirect: r2 = rx_queue_index
+	  insn(BPF_LD|BPF_DW|BPF_IMM, R1, BPF_PSEUDO_MAP_FD, 0, mfd),	// 29: r1 = &xsks
+	  insn(0, 0, 0, 0, 0),						// 30:
+	  insn(BPF_ALU64|BPF_MOV|BPF_K, R3, 0, 0, XDP_PASS),		// 31: r3 = XDP_PASS if no socket
+	  insn(BPF_JMP|BPF_CALL, 0, 0, 0, BPF_FUNC_redirect_map),	// 32: bpf_redirect_map()
+	  insn(BPF_JMP|BPF_EXIT, 0, 0, 0, 0),				// 33:
+	  insn(BPF_ALU64|BPF_MOV|BPF_K, R0, 0, 0, XDP_PASS),		// 34: pass: r0 = XDP_PASS
+	  insn(BPF_JMP|BPF_EXIT, 0, 0, 0, 0),				// 35:
+	};
+	static const char license[] = "Dual BSD/GPL";
+
+	std::memset(&attr, 0, sizeof(attr));
+	attr.prog_type = BPF_PROG_TYPE_XDP;
+	attr.insns = (std::uint64_t)prog;
+	attr.insn_cnt = sizeof(prog) / sizeof(prog[0]);
+	attr.license = (std::uint64_t)license;
+	const int pfd = bpf(BPF_PROG_LOAD, attr);
+	if (pfd < 0)
+	  OPENVPN_THROW(afxdp_error, "XDP program load: " << std::strerror(errno));
+	prog_fd.reset(pfd);
+
+	// native mode where the driver supports it, generic otherwise
+	int lfd = -1;
+	for (const std::uint32_t flags : { std::uint32_t(XDP_FLAGS_DRV_MODE), std::uint32_t(XDP_FLAGS_SKB_MODE) })
+	  {
+	    std::memset(&attr, 0, sizeof(attr));
+	    attr.link_create.prog_fd = pfd;
+	    attr.link_create.target_ifindex = ifindex;
+	    attr.link_create.attach_type = BPF_XDP;
+	    attr.link_create.flags = flags;
+	    lfd = bpf(BPF_LINK_CREATE, attr);
+	    if (lfd >= 0)
+	      break;
+	  }
+	if (lfd < 0)
+	  OPENVPN_THROW(afxdp_error, "XDP attach to " << config->dev << ": " << std::strerror(errno));
+	link_fd.reset(lfd);
+      }
+
+      void queue_recv()
+      {
+	xsk.async_wait(asio::posix::stream_descriptor::wait_read,
+		       [self=Ptr(this)](const asio::error_code& error)
+		       {
+			 if (!self->halt && !error)
+			   {
+			     self->handle_recv();
+			     self->queue_recv();
+			   }
+		       });
+      }
+
+      // drain up to batch_size packets from the RX ring
+      void handle_recv()
+      {
+	const std::uint32_t avail = rx.kernel_producer() - rx.local;
+	const std::uint32_t n = std::min(avail, std::uint32_t(config->batch_size));
+	for (std::uint32_t i = 0; i < n && !halt; ++i)
+	  {
+	    const struct xdp_desc d = rx.desc(rx.local++);
+	    recv_packet(umem + d.addr, d.len);
+
+	    // the frame is free again as soon as its payload is consumed
+	    fill.addr(fill.local++) = d.addr & ~std::uint64_t(config->frame_size - 1);
+	  }
+	if (halt)
+	  return;
+	rx.publish_consumer();
+	fill.publish_producer();
+	if (fill.need_wakeup())
+	  ::recvfrom(xsk.native_handle(), nullptr, 0, MSG_DONTWAIT, nullptr, nullptr);
+	if (avail > n)
+	  {
+	    // more pending, yield to other handlers before continuing
+	    asio::post(io_context, [self=Ptr(this)]()
+		       {
+			 if (!self->halt)
+			   self->handle_recv();
+		       });
+	  }
+      }
+
+      void recv_packet(const std::uint8_t *pkt, const size_t len)
+      {
+	Key key;
+	std::memset(&key, 0, sizeof(key));
+	std::uint8_t local_addr[16];
+	const std::uint8_t *payload;
+	size_t payload_len;
+
+	if (len < sizeof(EthHeader))
+	  return;
+	const EthHeader* eth = (const EthHeader *)pkt;
+	const std::uint8_t *ip = pkt + sizeof(EthHeader);
+	const size_t ip_len = len - sizeof(EthHeader);
+	if (eth->ethertype == htons(0x0800))
+	  {
+	    if (ip_len < sizeof(IPHeader) + sizeof(UDPHeader))
+	      return;
+	    const IPHeader* iph = (const IPHeader *)ip;
+	    const size_t hlen = IPHeader::length(iph->version_len);
+	    if (hlen < sizeof(IPHeader) || ip_len < hlen + sizeof(UDPHeader))
+	      return;
+	    std::memcpy(key.addr, &iph->saddr, 4);
+	    std::memcpy(local_addr, &iph->daddr, 4);
+	    payload = ip + hlen;
+	    payload_len = std::min(size_t(ntohs(iph->tot_len)), ip_len) - hlen;
+	  }
+	else if (eth->ethertype == htons(0x86DD))
+	  {
+	    if (ip_len < IP6_HEADER_SIZE + sizeof(UDPHeader))
+	      return;
+	    key.v6 = true;
+	    std::memcpy(key.addr, ip + 8, 16);
+	    std::memcpy(local_addr, ip + 24, 16);
+	    payload = ip + IP6_HEADER_SIZE;
+	    payload_len = std::min(size_t(ntohs(*(const std::uint16_t *)(ip + 4))), ip_len - IP6_HEADER_SIZE);
+	  }
+	else
+	  return;
+
+	const UDPHeader* udp = (const UDPHeader *)payload;
+	key.port = udp->source;
+	const size_t udp_len = ntohs(udp->len);
+	if (udp_len < sizeof(UDPHeader) || udp_len > payload_len)
+	  return;
+	payload += sizeof(UDPHeader);
+	payload_len = udp_len - sizeof(UDPHeader);
+	if (!payload_len)
+	  return;
+
+	frame_context.prepare(rx_buf);
+	if (payload_len > frame_context.remaining_payload(rx_buf))
+	  {
+	    config->stats->error(Error::NETWORK_RECV_ERROR);
+	    return;
+	  }
+	rx_buf.write(payload, payload_len);
+	config->stats->inc_stat(SessionStats::BYTES_IN, payload_len);
+	config->stats->inc_stat(SessionStats::PACKETS_IN, 1);
+
+	// echo multipath probes on the path they came from, sessions
+	// never see them
+	if (PathProbe::make_reply(rx_buf))
+	  {
+	    Instance reply;
+	    reply.key = key;
+	    std::memcpy(reply.local_addr, local_addr, 16);
+	    std::memcpy(reply.peer_mac, eth->src_mac, 6);
+	    std::memcpy(reply.local_mac, eth->dest_mac, 6);
+	    send(reply, rx_buf);
+	    return;
+	  }
+
+	Instance* inst = instances.lookup(table_key(key));
+	if (!inst)
+	  {
+	    inst = new_instance(key, local_addr, udp->dest);
+	    if (!inst)
+	      return;
+	  }
+
+	// track the route back, which may change under us
+	std::memcpy(inst->peer_mac, eth->src_mac, 6);
+	std::memcpy(inst->local_mac, eth->dest_mac, 6);
+	inst->ps.rx_bytes += payload_len;
+	inst->pending = true;
+	inst->recv->transport_recv(rx_buf);
+      }
+
+      Instance* new_instance(const Key& key, const std::uint8_t *local_addr, const std::uint16_t local_port)
+      {
+	if (!config->client_instance_factory->validate_initial_packet(rx_buf))
+	  return nullptr;
+
+	Instance::Ptr inst(new Instance());
+	inst->server = this;
+	inst->key = key;
+	std::memcpy(inst->local_addr, local_addr, 16);
+
+	PeerAddr::Ptr addr(new PeerAddr());
+	addr->remote.addr = to_ip_addr(key.addr, key.v6);
+	addr->remote.port = ntohs(key.port);
+	addr->local.addr = to_ip_addr(local_addr, key.v6);
+	addr->local.port = ntohs(local_port);
+	inst->info = addr->to_string();
+
+	inst->recv = config->client_instance_factory->new_client_instance();
+	instances.add(table_key(key), inst);
+	inst->recv->start(inst, addr, next_peer_id());
+	return inst->defined() ? inst.get() : nullptr;
+      }
+
+      static PeerAddrTable<Instance>::Key table_key(const Key& key)
+      {
+	return PeerAddrTable<Instance>::Key(key.addr, key.v6, key.port);
+      }
+
+      static RandomAPI& rng_of(const ServerConfig& config)
+      {
+	if (!config.rng)
+	  throw afxdp_error("no rng");
+	return *config.rng;
+      }
+
+      static IP::Addr to_ip_addr(const std::uint8_t *addr, const bool v6)
+      {
+	if (v6)
+	  return IP::Addr::from_ipv6(IPv6::Addr::from_in6_addr((const struct in6_addr *)addr));
+	std::uint32_t a;
+	std::memcpy(&a, addr, 4);
+	return IP::Addr::from_ipv4(IPv4::Addr::from_uint32_net(a));
+      }
+
+      int next_peer_id()
+      {
+	const int ret = peer_id;
+	peer_id = (peer_id + 1) % 0xFFFFFF; // 0xFFFFFF is undefined
+	return ret;
+      }
+
+      // Build the frame in place in a TX frame, the flush is posted
+      // so that all packets sent during one handler run go out with
+      // at most one kick.
+      bool send(Instance& inst, const Buffer& buf)
+      {
+	if (halt)
+	  return false;
+	const size_t l3 = inst.key.v6 ? IP6_HEADER_SIZE : sizeof(IPHeader);
+	const size_t total = sizeof(EthHeader) + l3 + sizeof(UDPHeader) + buf.size();
+	if (total > config->frame_size)
+	  {
+	    config->stats->error(Error::NETWORK_SEND_ERROR);
+	    return false;
+	  }
+	if (tx_free.empty())
+	  reclaim_tx();
+	if (tx_free.empty() || tx.local - tx.kernel_consumer() >= tx.size)
+	  {
+	    config->stats->error(Error::NETWORK_SEND_ERROR);
+	    return false;
+	  }
+	const std::uint64_t addr = tx_free.back();
+	tx_free.pop_back();
+
+	std::uint8_t *pkt = umem + addr;
+	EthHeader* eth = (EthHeader *)pkt;
+	std::memcpy(eth->dest_mac, inst.peer_mac, 6);
+	std::memcpy(eth->src_mac, inst.local_mac, 6);
+	std::uint8_t *ip = pkt + sizeof(EthHeader);
+	UDPHeader* udp = (UDPHeader *)(ip + l3);
+	const size_t udp_len = sizeof(UDPHeader) + buf.size();
+	udp->source = htons(config->port);
+	udp->dest = inst.key.port;
+	udp->len = htons(udp_len);
+	udp->check = 0;
+	std::memcpy(udp + 1, buf.c_data(), buf.size());
+
+	if (inst.key.v6)
+	  {
+	    eth->ethertype = htons(0x86DD);
+	    const std::uint32_t vtc = htonl(6u << 28);
+	    std::memcpy(ip, &vtc, 4);
+	    *(std::uint16_t *)(ip + 4) = htons(udp_len);
+	    ip[6] = IPHeader::UDP;
+	    ip[7] = 64;
+	    std::memcpy(ip + 8, inst.local_addr, 16);
+	    std::memcpy(ip + 24, inst.key.addr, 16);
+
+	    // the UDP checksum is mandatory over IPv6
+	    const std::uint64_t sum = IPChecksum::pseudo_v6(ip + 8, ip + 24, IPHeader::UDP, udp_len);
+	    udp->check = IPChecksum::compute(udp, udp_len, sum);
+	    if (!udp->check)
+	      udp->check = 0xFFFF;
+	  }
+	else
+	  {
+	    eth->ethertype = htons(0x0800);
+	    IPHeader* iph = (IPHeader *)ip;
+	    iph->version_len = IPHeader::ver_len(4, sizeof(IPHeader));
+	    iph->tos = 0;
+	    iph->tot_len = htons(sizeof(IPHeader) + udp_len);
+	    iph->id = 0;
+	    iph->frag_off = htons(0x4000); // DF
+	    iph->ttl = 64;
+	    iph->protocol = IPHeader::UDP;
+	    iph->check = 0;
+	    std::memcpy(&iph->saddr, inst.local_addr, 4);
+	    std::memcpy(&iph->daddr, inst.key.addr, 4);
+	    iph->check = ip_checksum(iph, sizeof(IPHeader));
+	  }
+
+	struct xdp_desc& d = tx.desc(tx.local++);
+	d.addr = addr;
+	d.len = std::uint32_t(total);
+	d.options = 0;
+	config->stats->inc_stat(SessionStats::BYTES_OUT, buf.size());
+	config->stats->inc_stat(SessionStats::PACKETS_OUT, 1);
+
+	if (!tx_flush_pending)
+	  {
+	    tx_flush_pending = true;
+	    asio::post(io_context, [self=Ptr(this)]()
+		       {
+			 self->tx_flush_pending = false;
+			 self->flush_tx();
+		       });
+	  }
+	return true;
+      }
+
+      void flush_tx()
+      {
+	if (halt)
+	  return;
+	tx.publish_producer();
+	if (!zerocopy_ || tx.need_wakeup())
+	  ::sendto(xsk.native_handle(), nullptr, 0, MSG_DONTWAIT, nullptr, 0);
+	reclaim_tx();
+      }
+
+      // return completed TX frames to the free list
+      void reclaim_tx()
+      {
+	const std::uint32_t n = comp.kernel_producer() - comp.local;
+	for (std::uint32_t i = 0; i < n; ++i)
+	  tx_free.push_back(comp.addr(comp.local++));
+	if (n)
+	  comp.publish_consumer();
+      }
+
+      enum {
+	IP6_HEADER_SIZE = 40,
+      };
+
+      asio::io_context& io_context;
+      ServerConfig::Ptr config;
+      asio::posix::stream_descriptor xsk;
+      const Frame::Context& frame_context;
+      BufferAllocated rx_buf;
+
+      unsigned int ifindex = 0;
+      std::uint8_t *umem = nullptr;
+      size_t umem_len = 0;
+      Ring fill;
+      Ring comp;
+      Ring rx;
+      Ring tx;
+      std::vector<std::uint64_t> tx_free;
+      bool tx_flush_pending = false;
+      bool zerocopy_ = false;
+
+      ScopedFD map_fd;
+      ScopedFD prog_fd;
+      ScopedFD link_fd;
+
+      PeerAddrTable<Instance> instances;
+      int peer_id = 0;
+      bool halt = false;
+    };
+
+    inline TransportServer::Ptr ServerConfig::new_server_obj(asio::io_context& io_context)
+    {
+      return TransportServer::Ptr(new Server(io_context, this));
+    }
+  }
+}
+
+#endif
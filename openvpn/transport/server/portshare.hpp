@@ -0,0 +1,484 @@
+//    OpenVPN -- An application to securely tunnel IP networks
+//               over a single port, with support for SSL/TLS-based
+//               session authentication and key exchange,
+//               packet encryption, packet authentication, and
+//               packet compression.
+//
+//    Copyright (C) 2012-2016 OpenVPN Technologies, Inc.
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU Affero General Public License Version 3
+//    as published by the Free Software Foundation.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU Affero General Public License for more details.
+//
+//    You should have received a copy of the GNU Affero General Public License
+//    along with this program in the COPYING file.
+//    If not, see <http://www.gnu.org/licenses/>.
+// TCP port-share front end: classify new connections by their first
+// bytes and either hand them to the OpenVPN TCP transport or proxy
+// them to a backend server (typically HTTPS on the same port).
+
+#ifndef OPENVPN_TRANSPORT_SERVER_PORTSHARE_H
+#define OPENVPN_TRANSPORT_SERVER_PORTSHARE_H
+
+#include <string>
+#include <utility> // for std::move
+
+#include <asio.hpp>
+
+#include <openvpn/common/size.hpp>
+#include <openvpn/common/exception.hpp>
+#include <openvpn/common/rc.hpp>
+#include <openvpn/common/platform.hpp>
+#include <openvpn/buffer/buffer.hpp>
+#include <openvpn/time/asiotimer.hpp>
+#include <openvpn/ssl/is_openvpn_protocol.hpp>
+
+#if defined(OPENVPN_PLATFORM_LINUX)
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#define OPENVPN_PORTSHARE_SPLICE
+#endif
+
+#ifndef OPENVPN_LOG_PORTSHARE
+#define OPENVPN_LOG_PORTSHARE(x)
+#endif
+
+namespace openvpn {
+  namespace PortShare {
+
+    struct Config
+    {
+      Config()
+	: classify_timeout(Time::Duration::seconds(10)),
+	  connect_timeout(Time::Duration::seconds(10)),
+	  chunk_size(65536)
+      {
+      }
+
+      asio::ip::tcp::endpoint backend;  // where non-OpenVPN connections go
+      Time::Duration classify_timeout;  // time allowed for the first bytes
+      Time::Duration connect_timeout;   // time allowed to reach backend
+      size_t chunk_size;                // max bytes moved per splice or read
+    };
+
+    // Receives connections that start with an OpenVPN client reset.
+    // initial holds the bytes already read from socket, which should
+    // be passed to TCPTransport::Link::inject() after start().
+    struct Handler
+    {
+      virtual void port_share_openvpn(asio::ip::tcp::socket&& socket, const Buffer& initial) = 0;
+      virtual ~Handler() {}
+    };
+
+    // Proxies one client connection to the backend.  On Linux the
+    // payload moves socket -> pipe -> socket with splice(2) and never
+    // enters user space; elsewhere it is copied through a buffer.
+    class Proxy : public RC<thread_unsafe_refcount>
+    {
+    public:
+      typedef RCPtr<Proxy> Ptr;
+
+      Proxy(asio::io_context& io_context,
+	    asio::ip::tcp::socket&& client_arg,
+	    const Config& config_arg)
+	: client(std::move(client_arg)),
+	  backend(io_context),
+	  timer(io_context),
+	  config(config_arg),
+	  up(client, backend),
+	  down(backend, client)
+      {
+      }
+
+      // initial = bytes already consumed from client during classification
+      void start(const unsigned char *initial, const size_t size)
+      {
+	initial_.assign((const char *)initial, size);
+	timer.expires_at(Time::now() + config.connect_timeout);
+	timer.async_wait([self=Ptr(this)](const asio::error_code& error)
+			 {
+			   if (!error)
+			     self->close("backend connect timeout");
+			 });
+	backend.async_connect(config.backend, [self=Ptr(this)](const asio::error_code& error)
+			      {
+				self->handle_connect(error);
+			      });
+      }
+
+      void close(const char *reason)
+      {
+	if (!halt)
+	  {
+	    halt = true;
+	    OPENVPN_LOG_PORTSHARE("PORT-SHARE close: " << reason);
+	    asio::error_code ec;
+	    timer.cancel();
+	    client.close(ec);
+	    backend.close(ec);
+	    up.close();
+	    down.close();
+	  }
+      }
+
+    private:
+      struct Direction
+      {
+	Direction(asio::ip::tcp::socket& from_arg, asio::ip::tcp::socket& to_arg)
+	  : from(from_arg),
+	    to(to_arg)
+	{
+	}
+
+	~Direction()
+	{
+	  close();
+	}
+
+	void close()
+	{
+#ifdef OPENVPN_PORTSHARE_SPLICE
+	  for (int& fd : pipe_fd)
+	    if (fd >= 0)
+	      {
+		::close(fd);
+		fd = -1;
+	      }
+#endif
+	}
+
+	asio::ip::tcp::socket& from;
+	asio::ip::tcp::socket& to;
+	size_t pending = 0; // bytes read but not yet written
+	bool eof = false;
+#ifdef OPENVPN_PORTSHARE_SPLICE
+	int pipe_fd[2] = { -1, -1 };
+#else
+	unsigned char buf[16384];
+#endif
+      };
+
+      void handle_connect(const asio::error_code& error)
+      {
+	if (halt)
+	  return;
+	if (error)
+	  {
+	    close("backend connect failed");
+	    return;
+	  }
+	timer.cancel();
+	asio::error_code ec;
+	backend.set_option(asio::ip::tcp::no_delay(true), ec);
+	asio::async_write(backend, asio::buffer(initial_),
+			  [self=Ptr(this)](const asio::error_code& error, const size_t)
+			  {
+			    if (error)
+			      self->close("backend write failed");
+			    else
+			      self->start_relay();
+			  });
+      }
+
+      void start_relay()
+      {
+	if (halt)
+	  return;
+	initial_.clear();
+#ifdef OPENVPN_PORTSHARE_SPLICE
+	if (::pipe2(up.pipe_fd, O_NONBLOCK|O_CLOEXEC) < 0
+	    || ::pipe2(down.pipe_fd, O_NONBLOCK|O_CLOEXEC) < 0)
+	  {
+	    close("pipe2 failed");
+	    return;
+	  }
+	client.native_non_blocking(true);
+	backend.native_non_blocking(true);
+#endif
+	pump(up);
+	pump(down);
+      }
+
+#ifdef OPENVPN_PORTSHARE_SPLICE
+      // Move data until a socket would block, then wait for it.  Runs
+      // at most a few rounds per call so one busy connection cannot
+      // monopolize the io_context.
+      void pump(Direction& d)
+      {
+	const unsigned int flags = SPLICE_F_MOVE|SPLICE_F_NONBLOCK;
+	for (int round = 0; round < 16 && !halt; ++round)
+	  {
+	    if (!d.pending)
+	      {
+		if (d.eof)
+		  return;
+		const ssize_t n = ::splice(d.from.native_handle(), nullptr, d.pipe_fd[1], nullptr, config.chunk_size, flags);
+		if (n == 0)
+		  {
+		    half_close(d);
+		    return;
+		  }
+		if (n < 0)
+		  {
+		    if (errno == EAGAIN)
+		      wait(d, d.from, asio::socket_base::wait_read);
+		    else
+		      close("splice read error");
+		    return;
+		  }
+		d.pending = size_t(n);
+	      }
+	    const ssize_t n = ::splice(d.pipe_fd[0], nullptr, d.to.native_handle(), nullptr, d.pending, flags);
+	    if (n < 0)
+	      {
+		if (errno == EAGAIN)
+		  wait(d, d.to, asio::socket_base::wait_write);
+		else
+		  close("splice write error");
+		return;
+	      }
+	    d.pending -= size_t(n);
+	  }
+	if (!halt)
+	  asio::post(client.get_executor(), [self=Ptr(this), &d]()
+		     {
+		       self->pump(d);
+		     });
+      }
+
+      void wait(Direction& d, asio::ip::tcp::socket& sock, const asio::socket_base::wait_type type)
+      {
+	sock.async_wait(type, [self=Ptr(this), &d](const asio::error_code& error)
+			{
+			  if (self->halt)
+			    return;
+			  if (error)
+			    self->close("wait error");
+			  else
+			    self->pump(d);
+			});
+      }
+#else
+      void pump(Direction& d)
+      {
+	d.from.async_read_some(asio::buffer(d.buf, std::min(sizeof(d.buf), config.chunk_size)),
+			       [self=Ptr(this), &d](const asio::error_code& error, const size_t bytes)
+			       {
+				 if (self->halt)
+				   return;
+				 if (error == asio::error::eof)
+				   self->half_close(d);
+				 else if (error)
+				   self->close("read error");
+				 else
+				   {
+				     d.pending = bytes;
+				     asio::async_write(d.to, asio::buffer(d.buf, bytes),
+						       [self, &d](const asio::error_code& error, const size_t)
+						       {
+							 if (self->halt)
+							   return;
+							 d.pending = 0;
+							 if (error)
+							   self->close("write error");
+							 else
+							   self->pump(d);
+						       });
+				   }
+			       });
+      }
+#endif
+
+      // peer finished sending, pass the FIN on and close
+      // once both directions are done
+      void half_close(Direction& d)
+      {
+	d.eof = true;
+	asio::error_code ec;
+	d.to.shutdown(asio::ip::tcp::socket::shutdown_send, ec);
+	if (up.eof && down.eof)
+	  close("done");
+      }
+
+      asio::ip::tcp::socket client;
+      asio::ip::tcp::socket backend;
+      AsioTimer timer;
+      Config config;
+      std::string initial_;
+      Direction up;   // client -> backend
+      Direction down; // backend -> client
+      bool halt = false;
+    };
+
+    // Accepts on one TCP endpoint and routes each connection.
+    class Listener : public RC<thread_unsafe_refcount>
+    {
+    public:
+      typedef RCPtr<Listener> Ptr;
+
+      Listener(asio::io_context& io_context_arg,
+	       const asio::ip::tcp::endpoint& endpoint,
+	       Handler* handler_arg,
+	       const Config& config_arg)
+	: io_context(io_context_arg),
+	  acceptor(io_context_arg),
+	  handler(handler_arg),
+	  config(config_arg)
+      {
+	acceptor.open(endpoint.protocol());
+	acceptor.set_option(asio::ip::tcp::acceptor::reuse_address(true));
+	acceptor.bind(endpoint);
+	acceptor.listen();
+      }
+
+      void start()
+      {
+	queue_accept();
+      }
+
+      void stop()
+      {
+	if (!halt)
+	  {
+	    halt = true;
+	    asio::error_code ec;
+	    acceptor.close(ec);
+	  }
+      }
+
+      asio::ip::tcp::endpoint local_endpoint() const
+      {
+	return acceptor.local_endpoint();
+      }
+
+    private:
+      // Reads just enough of a new connection to tell
+      // OpenVPN from anything else.
+      class Classifier : public RC<thread_unsafe_refcount>
+      {
+      public:
+	typedef RCPtr<Classifier> Ptr;
+
+	enum {
+	  CLASSIFY_SIZE = 3, // is_openvpn_protocol() is decisive after 3 bytes
+	};
+
+	Classifier(Listener* parent_arg)
+	  : parent(parent_arg),
+	    socket(parent_arg->io_context),
+	    timer(parent_arg->io_context)
+	{
+	}
+
+	void start()
+	{
+	  timer.expires_at(Time::now() + parent->config.classify_timeout);
+	  timer.async_wait([self=Ptr(this)](const asio::error_code& error)
+			   {
+			     if (!error)
+			       self->close();
+			   });
+	  queue_read();
+	}
+
+	Listener::Ptr parent;
+	asio::ip::tcp::socket socket;
+
+      private:
+	void queue_read()
+	{
+	  socket.async_read_some(asio::buffer(buf + len, CLASSIFY_SIZE - len),
+				 [self=Ptr(this)](const asio::error_code& error, const size_t bytes)
+				 {
+				   self->handle_read(error, bytes);
+				 });
+	}
+
+	void handle_read(const asio::error_code& error, const size_t bytes)
+	{
+	  if (error || parent->halt)
+	    {
+	      close();
+	      return;
+	    }
+	  len += bytes;
+	  const bool ovpn = is_openvpn_protocol(buf, len);
+	  if (ovpn && len < CLASSIFY_SIZE)
+	    {
+	      queue_read();
+	      return;
+	    }
+	  timer.cancel();
+	  if (ovpn)
+	    {
+	      OPENVPN_LOG_PORTSHARE("PORT-SHARE openvpn " << endpoint_str());
+	      const Buffer initial(buf, len, true);
+	      parent->handler->port_share_openvpn(std::move(socket), initial);
+	    }
+	  else
+	    {
+	      OPENVPN_LOG_PORTSHARE("PORT-SHARE proxy " << endpoint_str());
+	      Proxy::Ptr proxy(new Proxy(parent->io_context, std::move(socket), parent->config));
+	      proxy->start(buf, len);
+	    }
+	}
+
+	std::string endpoint_str() const
+	{
+	  asio::error_code ec;
+	  const asio::ip::tcp::endpoint ep = socket.remote_endpoint(ec);
+	  return ec ? std::string("[unknown]") : ep.address().to_string();
+	}
+
+	void close()
+	{
+	  asio::error_code ec;
+	  timer.cancel();
+	  socket.close(ec);
+	}
+
+	AsioTimer timer;
+	unsigned char buf[CLASSIFY_SIZE];
+	size_t len = 0;
+      };
+
+      void queue_accept()
+      {
+	if (halt)
+	  return;
+	Classifier::Ptr c(new Classifier(this));
+	acceptor.async_accept(c->socket,
+			      [self=Ptr(this), c](const asio::error_code& error)
+			      {
+				self->handle_accept(c, error);
+			      });
+      }
+
+      void handle_accept(const Classifier::Ptr& c, const asio::error_code& error)
+      {
+	if (halt)
+	  return;
+	if (!error)
+	  c->start();
+	else
+	  OPENVPN_LOG_PORTSHARE("PORT-SHARE accept error: " << error.message());
+	queue_accept();
+      }
+
+      asio::io_context& io_context;
+      asio::ip::tcp::acceptor acceptor;
+      Handler* handler;
+      Config config;
+      bool halt = false;
+    };
+
+  }
+}
+
+#endif
@@ -0,0 +1,329 @@
+//    OpenVPN -- An application to securely tunnel IP networks
+//               over a single port, with support for SSL/TLS-based
+//               session authentication and key exchange,
+//               packet encryption, packet authentication, and
+//               packet compression.
+//
+//    Copyright (C) 2012-2016 OpenVPN Technologies, Inc.
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU Affero General Public License Version 3
+//    as published by the Free Software Foundation.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU Affero General Public License for more details.
+//
+//    You should have received a copy of the GNU Affero General Public License
+//    along with this program in the COPYING file.
+//    If not, see <http://www.gnu.org/licenses/>.
+
+// Sharded TCP server listener: one SO_REUSEPORT accept socket per
+// worker thread, batched accepts per readiness event, TCP_DEFER_ACCEPT,
+// and validation of the client's first bytes before a session is created.
+
+#ifndef OPENVPN_TRANSPORT_SERVER_TCPSHARD_H
+#define OPENVPN_TRANSPORT_SERVER_TCPSHARD_H
+
+#include <vector>
+#include <utility> // for std::move
+
+#include <asio.hpp>
+
+#include <openvpn/common/platform.hpp>
+#include <openvpn/common/exception.hpp>
+#include <openvpn/common/rc.hpp>
+#include <openvpn/common/hostport.hpp>
+#include <openvpn/common/sockopt.hpp>
+#include <openvpn/addr/ip.hpp>
+#include <openvpn/buffer/buffer.hpp>
+#include <openvpn/time/asiotimer.hpp>
+#include <openvpn/server/listenlist.hpp>
+#include <openvpn/ssl/is_openvpn_protocol.hpp>
+
+#ifndef OPENVPN_LOG_TCPSHARD
+#define OPENVPN_LOG_TCPSHARD(x)
+#endif
+
+namespace openvpn {
+  namespace TCPTransport {
+
+    // Each shard owns one listening socket on its own io_context, and the
+    // kernel spreads incoming connections over the reuseport group by
+    // 4-tuple hash, so a reconnect storm is accepted by all worker
+    // threads in parallel instead of serializing on one accept loop.
+    //
+    // With TCP_DEFER_ACCEPT the kernel only reports a connection once the
+    // client's first segment has arrived, so the initial bytes can usually
+    // be read right after accept without another trip through the reactor.
+    // Connections that don't start with an OpenVPN client reset are closed
+    // before the handler sees them.
+    class ShardedListener : public RC<thread_unsafe_refcount>
+    {
+    public:
+      typedef RCPtr<ShardedListener> Ptr;
+
+      OPENVPN_EXCEPTION(tcp_shard_error);
+
+      struct Config
+      {
+	Config()
+	  : validate_timeout(Time::Duration::seconds(10))
+	{
+	}
+
+	int backlog = 1024;             // listen(2) backlog per shard
+	unsigned int accept_batch = 64; // max accepts per readiness event
+	int defer_accept = 10;          // TCP_DEFER_ACCEPT seconds, 0 to disable
+	int fast_open_qlen = 0;         // TCP_FASTOPEN queue length, 0 to disable
+	Time::Duration validate_timeout; // time allowed for the first bytes
+      };
+
+      // Receives validated connections on the io_context thread of the
+      // shard that accepted them.  initial holds the bytes already read
+      // from socket, which should be passed to TCPTransport::Link::inject()
+      // after start().
+      struct Handler
+      {
+	virtual void tcp_shard_accept(const unsigned int shard,
+				      asio::ip::tcp::socket&& socket,
+				      const Buffer& initial) = 0;
+	virtual ~Handler() {}
+      };
+
+      class Shard : public RC<thread_unsafe_refcount>
+      {
+      public:
+	typedef RCPtr<Shard> Ptr;
+
+	Shard(asio::io_context& io_context_arg,
+	      const unsigned int index_arg,
+	      Handler* handler_arg,
+	      const Config& config_arg)
+	  : io_context(io_context_arg),
+	    acceptor(io_context_arg),
+	    index(index_arg),
+	    handler(handler_arg),
+	    config(config_arg)
+	{
+	}
+
+	// call on the shard's io_context thread
+	void start()
+	{
+	  queue_wait();
+	}
+
+	void stop()
+	{
+	  if (!halt)
+	    {
+	      halt = true;
+	      asio::error_code ec;
+	      acceptor.close(ec);
+	    }
+	}
+
+	asio::io_context& io_context;
+	asio::ip::tcp::acceptor acceptor;
+	const unsigned int index;
+
+      private:
+	friend class ShardedListener;
+
+	// Reads just enough of a new connection to tell
+	// whether it is an OpenVPN client.
+	class Validator : public RC<thread_unsafe_refcount>
+	{
+	public:
+	  typedef RCPtr<Validator> Ptr;
+
+	  enum {
+	    VALIDATE_SIZE = 3, // is_openvpn_protocol() is decisive after 3 bytes
+	  };
+
+	  Validator(Shard* parent_arg, asio::ip::tcp::socket&& socket_arg)
+	    : parent(parent_arg),
+	      socket(std::move(socket_arg)),
+	      timer(parent_arg->io_context)
+	  {
+	  }
+
+	  void start()
+	  {
+	    // with TCP_DEFER_ACCEPT the first bytes are normally already here
+	    asio::error_code ec;
+	    socket.non_blocking(true, ec);
+	    const size_t bytes = ec ? 0 : socket.read_some(asio::buffer(buf, VALIDATE_SIZE), ec);
+	    if (ec != asio::error::would_block)
+	      {
+		if (handle_read(ec, bytes))
+		  return;
+	      }
+	    timer.expires_at(Time::now() + parent->config.validate_timeout);
+	    timer.async_wait([self=Ptr(this)](const asio::error_code& error)
+			     {
+			       if (!error)
+				 self->close();
+			     });
+	    queue_read();
+	  }
+
+	private:
+	  void queue_read()
+	  {
+	    socket.async_read_some(asio::buffer(buf + len, VALIDATE_SIZE - len),
+				   [self=Ptr(this)](const asio::error_code& error, const size_t bytes)
+				   {
+				     if (!self->handle_read(error, bytes))
+				       self->queue_read();
+				   });
+	  }
+
+	  // returns true when done with the connection
+	  bool handle_read(const asio::error_code& error, const size_t bytes)
+	  {
+	    if (error || parent->halt)
+	      {
+		close();
+		return true;
+	      }
+	    len += bytes;
+	    if (!is_openvpn_protocol(buf, len))
+	      {
+		OPENVPN_LOG_TCPSHARD("TCP shard " << parent->index << ": rejected non-OpenVPN connection");
+		close();
+		return true;
+	      }
+	    if (len < VALIDATE_SIZE)
+	      return false;
+	    timer.cancel();
+	    const Buffer initial(buf, len, true);
+	    parent->handler->tcp_shard_accept(parent->index, std::move(socket), initial);
+	    return true;
+	  }
+
+	  void close()
+	  {
+	    asio::error_code ec;
+	    timer.cancel();
+	    socket.close(ec);
+	  }
+
+	  Shard::Ptr parent;
+	  asio::ip::tcp::socket socket;
+	  AsioTimer timer;
+	  unsigned char buf[VALIDATE_SIZE];
+	  size_t len = 0;
+	};
+
+	void queue_wait()
+	{
+	  if (halt)
+	    return;
+	  acceptor.async_wait(asio::ip::tcp::acceptor::wait_read,
+			      [self=Ptr(this)](const asio::error_code& error)
+			      {
+				self->handle_wait(error);
+			      });
+	}
+
+	// drain up to accept_batch pending connections per wakeup
+	void handle_wait(const asio::error_code& error)
+	{
+	  if (halt)
+	    return;
+	  if (!error)
+	    {
+	      for (unsigned int i = 0; i < config.accept_batch; ++i)
+		{
+		  asio::ip::tcp::socket socket(io_context);
+		  asio::error_code ec;
+		  acceptor.accept(socket, ec);
+		  if (ec)
+		    {
+		      if (ec != asio::error::would_block && ec != asio::error::try_again)
+			OPENVPN_LOG_TCPSHARD("TCP shard " << index << " accept error: " << ec.message());
+		      break;
+		    }
+		  Validator::Ptr v(new Validator(this, std::move(socket)));
+		  v->start();
+		}
+	    }
+	  else
+	    OPENVPN_LOG_TCPSHARD("TCP shard " << index << " wait error: " << error.message());
+	  queue_wait();
+	}
+
+	Handler* handler;
+	const Config config;
+	bool halt = false;
+      };
+
+      // io_contexts[i] is the io_context of worker thread i.
+      ShardedListener(const Listen::Item& listen_item,
+		      const std::vector<asio::io_context*>& io_contexts,
+		      Handler* handler,
+		      const Config& config)
+      {
+	if (!listen_item.proto.is_tcp())
+	  throw tcp_shard_error("listener must be TCP: " + listen_item.to_string());
+	if (io_contexts.empty())
+	  throw tcp_shard_error("no worker threads");
+	if (!config.accept_batch)
+	  throw tcp_shard_error("accept batch must be at least 1");
+
+	const IP::Addr addr = IP::Addr::from_string(listen_item.addr, "listen address");
+	const asio::ip::tcp::endpoint endpoint(addr.to_asio(),
+					       HostPort::parse_port(listen_item.port, "listen port"));
+
+	for (size_t i = 0; i < io_contexts.size(); ++i)
+	  {
+	    Shard::Ptr s(new Shard(*io_contexts[i], (unsigned int)i, handler, config));
+	    s->acceptor.open(endpoint.protocol());
+	    const int fd = s->acceptor.native_handle();
+	    SockOpt::set_cloexec(fd);
+	    SockOpt::reuseaddr(fd);
+#ifdef SO_REUSEPORT
+	    SockOpt::reuseport(fd);
+#else
+	    if (io_contexts.size() > 1)
+	      throw tcp_shard_error("SO_REUSEPORT not supported on this platform");
+#endif
+#ifdef TCP_DEFER_ACCEPT
+	    if (config.defer_accept > 0 && !SockOpt::tcp_defer_accept(fd, config.defer_accept))
+	      OPENVPN_LOG_TCPSHARD("TCP shard " << i << ": TCP_DEFER_ACCEPT not supported");
+#endif
+#ifdef TCP_FASTOPEN
+	    if (config.fast_open_qlen > 0 && !SockOpt::tcp_fastopen(fd, config.fast_open_qlen))
+	      OPENVPN_LOG_TCPSHARD("TCP shard " << i << ": TCP_FASTOPEN not supported");
+#endif
+	    s->acceptor.bind(endpoint);
+	    s->acceptor.listen(config.backlog);
+	    s->acceptor.non_blocking(true);
+	    shards.push_back(std::move(s));
+	  }
+      }
+
+      size_t size() const { return shards.size(); }
+
+      // call shard(i).start() from the io_context thread of shard i
+      Shard& shard(const size_t index)
+      {
+	return *shards[index];
+      }
+
+      // stop shard i from its own io_context thread
+      void stop(const size_t index)
+      {
+	shards[index]->stop();
+      }
+
+    private:
+      std::vector<Shard::Ptr> shards;
+    };
+  }
+}
+
+#endif
@@ -70,6 +70,10 @@ namespace openvpn {
     virtual bool defined() const = 0;
     virtual void stop() = 0;
 
+    // Implementations that share one socket across many client
+    // instances may queue the packet and flush the queue once per
+    // io_context handler run (see UDPTransport::Link::enable_send_queue),
+    // so a true return means the packet was accepted, not yet sent.
     virtual bool transport_send_const(const Buffer& buf) = 0;
     virtual bool transport_send(BufferAllocated& buf) = 0;
 
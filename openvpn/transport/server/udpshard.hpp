@@ -0,0 +1,223 @@
+//    OpenVPN -- An application to securely tunnel IP networks
+//               over a single port, with support for SSL/TLS-based
+//               session authentication and key exchange,
+//               packet encryption, packet authentication, and
+//               packet compression.
+//
+//    Copyright (C) 2012-2016 OpenVPN Technologies, Inc.
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU Affero General Public License Version 3
+//    as published by the Free Software Foundation.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU Affero General Public License for more details.
+//
+//    You should have received a copy of the GNU Affero General Public License
+//    along with this program in the COPYING file.
+//    If not, see <http://www.gnu.org/licenses/>.
+
+// Sharded UDP server listener: N SO_REUSEPORT sockets bound to the same
+// address/port, one per worker thread, with kernel-side steering of
+// returning clients to the thread that owns their session.
+
+#ifndef OPENVPN_TRANSPORT_SERVER_UDPSHARD_H
+#define OPENVPN_TRANSPORT_SERVER_UDPSHARD_H
+
+#include <vector>
+#include <memory>
+
+#include <asio.hpp>
+
+#include <openvpn/common/platform.hpp>
+#include <openvpn/common/exception.hpp>
+#include <openvpn/common/rc.hpp>
+#include <openvpn/common/hostport.hpp>
+#include <openvpn/common/sockopt.hpp>
+#include <openvpn/addr/ip.hpp>
+#include <openvpn/server/listenlist.hpp>
+#include <openvpn/server/vpnservnetblock.hpp>
+#include <openvpn/server/peeridtable.hpp>
+
+#if defined(OPENVPN_PLATFORM_LINUX)
+#include <sys/socket.h>
+#include <linux/filter.h>
+#endif
+
+namespace openvpn {
+  namespace UDPTransport {
+
+    // Each shard owns one socket on its own io_context and the per-thread
+    // VPN address range, so a worker thread never touches another thread's
+    // sessions.  Steering works as follows:
+    //
+    // * P_DATA_V2 packets carry a peer-id, and the server allocates peer-ids
+    //   so that (peer_id % n_shards) is the index of the owning shard.  A
+    //   classic BPF program attached with SO_ATTACH_REUSEPORT_CBPF maps the
+    //   peer-id back to that shard, which also handles clients that float to
+    //   a new source address.
+    //
+    // * All other packets (control channel, P_DATA_V1, undefined peer-id)
+    //   get an out-of-range index from the BPF program, which makes the
+    //   kernel fall back to its stable 4-tuple hash.  The session is created
+    //   on the shard that receives the client's initial packet, so the
+    //   hash keeps the handshake on the owning shard too.
+    //
+    // * If shard_cpus gives the CPU each shard's thread is pinned to (see
+    //   ThreadTopology::Layout), those packets go instead to the shard on
+    //   the CPU that received them, so new sessions land on the core that
+    //   services the client's RSS queue.  Packets received on any other
+    //   CPU still use the hash.
+    class ShardedListener : public RC<thread_unsafe_refcount>
+    {
+    public:
+      typedef RCPtr<ShardedListener> Ptr;
+
+      OPENVPN_EXCEPTION(udp_shard_error);
+
+      struct Shard
+      {
+	Shard(asio::io_context& io_context_arg,
+	      const unsigned int index_arg,
+	      const VPNServerNetblock::PerThread* netblock_arg)
+	  : io_context(io_context_arg),
+	    socket(io_context_arg),
+	    index(index_arg),
+	    netblock(netblock_arg)
+	{
+	}
+
+	asio::io_context& io_context;
+	asio::ip::udp::socket socket;
+	const unsigned int index;
+	const VPNServerNetblock::PerThread* netblock; // may be null
+      };
+
+      // io_contexts[i] is the io_context of worker thread i.  If netblock
+      // is defined, it must have been partitioned into io_contexts.size()
+      // per-thread ranges.
+      // In cluster mode, node_bits must match the PeerIDCluster of
+      // the shards' PeerIDTables.
+      ShardedListener(const Listen::Item& listen_item,
+		      const std::vector<asio::io_context*>& io_contexts,
+		      const VPNServerNetblock* netblock,
+		      const unsigned int node_bits=0,
+		      const std::vector<int>* shard_cpus=nullptr)
+	: node_bits_(node_bits)
+      {
+	if (!listen_item.proto.is_udp())
+	  throw udp_shard_error("listener must be UDP: " + listen_item.to_string());
+	if (io_contexts.empty())
+	  throw udp_shard_error("no worker threads");
+	if (netblock && netblock->size() != io_contexts.size())
+	  throw udp_shard_error("server netblock thread count mismatch");
+	if (shard_cpus && shard_cpus->size() != io_contexts.size())
+	  throw udp_shard_error("shard cpu list thread count mismatch");
+
+	const IP::Addr addr = IP::Addr::from_string(listen_item.addr, "listen address");
+	const asio::ip::udp::endpoint endpoint(addr.to_asio(),
+					       HostPort::parse_port(listen_item.port, "listen port"));
+
+	// Bind order defines the index of each socket in the kernel's
+	// reuseport group, which is what the steering program returns.
+	for (size_t i = 0; i < io_contexts.size(); ++i)
+	  {
+	    std::unique_ptr<Shard> s(new Shard(*io_contexts[i], i,
+					       netblock ? &netblock->per_thread(i) : nullptr));
+	    s->socket.open(endpoint.protocol());
+	    const int fd = s->socket.native_handle();
+	    SockOpt::set_cloexec(fd);
+#ifdef SO_REUSEPORT
+	    SockOpt::reuseport(fd);
+#else
+	    if (io_contexts.size() > 1)
+	      throw udp_shard_error("SO_REUSEPORT not supported on this platform");
+#endif
+	    s->socket.bind(endpoint);
+	    shards.push_back(std::move(s));
+	  }
+
+	if (shards.size() > 1)
+	  attach_steering(shard_cpus);
+      }
+
+      size_t size() const { return shards.size(); }
+
+      Shard& shard(const size_t index)
+      {
+	return *shards[index];
+      }
+
+      bool steering() const { return steering_; }
+
+      // Index of the shard that owns a given peer-id.
+      static unsigned int shard_of_peer_id(const int peer_id, const size_t n_shards,
+					   const unsigned int node_bits=0)
+      {
+	return ((unsigned int)peer_id & PeerIDCluster(node_bits, 0).local_mask()) % (unsigned int)n_shards;
+      }
+
+      void stop()
+      {
+	for (auto &s : shards)
+	  {
+	    asio::error_code ec;
+	    s->socket.close(ec);
+	  }
+      }
+
+    private:
+      void attach_steering(const std::vector<int>* shard_cpus)
+      {
+#if defined(OPENVPN_PLATFORM_LINUX) && defined(SO_ATTACH_REUSEPORT_CBPF)
+	// BPF runs with the packet data starting at the UDP payload.
+	// Opcode is the high 5 bits of byte 0 (P_DATA_V2 == 9), peer-id is
+	// the low 24 bits of the first 32-bit word (0xFFFFFF == undefined).
+	// In cluster mode the node bits are masked off before the modulus.
+	const unsigned int local_mask = PeerIDCluster(node_bits_, 0).local_mask();
+	std::vector<struct sock_filter> code = {
+	  BPF_STMT(BPF_LD | BPF_B | BPF_ABS, 0),				// 0: A = op
+	  BPF_STMT(BPF_ALU | BPF_RSH | BPF_K, 3),				// 1: A = opcode
+	  BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, 9, 0, 6),			// 2: DATA_V2 ?
+	  BPF_STMT(BPF_LD | BPF_W | BPF_ABS, 0),				// 3: A = op32
+	  BPF_STMT(BPF_ALU | BPF_AND | BPF_K, 0x00FFFFFF),		// 4: A = peer-id
+	  BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, 0x00FFFFFF, 3, 0),	// 5: undefined ?
+	  BPF_STMT(BPF_ALU | BPF_AND | BPF_K, local_mask),		// 6: A = local peer-id
+	  BPF_STMT(BPF_ALU | BPF_MOD | BPF_K, (unsigned int)shards.size()),	// 7: A %= n
+	  BPF_STMT(BPF_RET | BPF_A, 0),					// 8: return shard
+	};
+
+	// 9: fallback, optionally by receiving CPU
+	if (shard_cpus)
+	  {
+	    code.push_back(BPF_STMT(BPF_LD | BPF_W | BPF_ABS, (unsigned int)(SKF_AD_OFF + SKF_AD_CPU)));
+	    for (size_t i = 0; i < shard_cpus->size(); ++i)
+	      {
+		code.push_back(BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, (unsigned int)(*shard_cpus)[i], 0, 1));
+		code.push_back(BPF_STMT(BPF_RET | BPF_K, (unsigned int)i));
+	      }
+	  }
+	code.push_back(BPF_STMT(BPF_RET | BPF_K, 0xFFFFFFFF));		// hash fallback
+
+	struct sock_fprog prog;
+	prog.len = (unsigned short)code.size();
+	prog.filter = code.data();
+
+	// the program is shared by the whole reuseport group
+	if (::setsockopt(shards[0]->socket.native_handle(), SOL_SOCKET,
+			 SO_ATTACH_REUSEPORT_CBPF, &prog, sizeof(prog)) < 0)
+	  throw udp_shard_error("error setting SO_ATTACH_REUSEPORT_CBPF on socket");
+	steering_ = true;
+#endif
+      }
+
+      std::vector<std::unique_ptr<Shard>> shards;
+      const unsigned int node_bits_;
+      bool steering_ = false;
+    };
+  }
+}
+
+#endif
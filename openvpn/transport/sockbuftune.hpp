@@ -0,0 +1,136 @@
+//    OpenVPN -- An application to securely tunnel IP networks
+//               over a single port, with support for SSL/TLS-based
+//               session authentication and key exchange,
+//               packet encryption, packet authentication, and
+//               packet compression.
+//
+//    Copyright (C) 2012-2016 OpenVPN Technologies, Inc.
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU Affero General Public License Version 3
+//    as published by the Free Software Foundation.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU Affero General Public License for more details.
+//
+//    You should have received a copy of the GNU Affero General Public License
+//    along with this program in the COPYING file.
+//    If not, see <http://www.gnu.org/licenses/>.
+
+// Adaptive sizing of a UDP socket's kernel buffers.  The receive
+// buffer grows when the kernel reports receive queue drops
+// (SO_RXQ_OVFL) or when a burst read in one batch would fill more
+// than a quarter of it, and the send buffer grows when sends
+// fail with a full queue.  Buffers only grow, by doubling, up to
+// a configured maximum.
+
+#ifndef OPENVPN_TRANSPORT_SOCKBUFTUNE_H
+#define OPENVPN_TRANSPORT_SOCKBUFTUNE_H
+
+#include <cstdint>
+#include <algorithm>
+
+#include <openvpn/common/sockopt.hpp>
+
+namespace openvpn {
+
+  class SockBufTune
+  {
+  public:
+    struct Config
+    {
+      int rcvbuf = 0;         // initial size, 0 keeps the kernel default
+      int sndbuf = 0;
+      int max = 4*1024*1024;  // upper bound for autotuned sizes
+      bool autotune = true;   // grow buffers on drops and bursts
+    };
+
+    SockBufTune()
+      : fd(-1)
+    {
+    }
+
+    // apply the initial sizes to fd and turn on drop reporting
+    void start(const int fd_arg, const Config& config_arg)
+    {
+      fd = fd_arg;
+      config = config_arg;
+      if (config.rcvbuf)
+	SockOpt::set_rcvbuf(fd, config.rcvbuf);
+      if (config.sndbuf)
+	SockOpt::set_sndbuf(fd, config.sndbuf);
+      rcvbuf = SockOpt::get_rcvbuf(fd);
+      sndbuf = SockOpt::get_sndbuf(fd);
+#ifdef SO_RXQ_OVFL
+      SockOpt::rxq_ovfl(fd);
+#endif
+    }
+
+    bool defined() const
+    {
+      return fd >= 0;
+    }
+
+    // Called with the SO_RXQ_OVFL counter of a received datagram,
+    // returns the number of drops since the last call.
+    std::uint32_t drops(const std::uint32_t counter)
+    {
+      const std::uint32_t delta = counter - last_drops; // counter may wrap
+      last_drops = counter;
+      if (delta && config.autotune)
+	grow_rcvbuf(rcvbuf * 2);
+      return delta;
+    }
+
+    // called after reading a batch of bytes datagram bytes at once
+    void burst(const size_t bytes)
+    {
+      // the kernel charges about twice the payload per datagram
+      // against the buffer, so keep that under a quarter of it
+      if (config.autotune && bytes * 8 > size_t(rcvbuf))
+	grow_rcvbuf(int(std::min(std::max(size_t(rcvbuf) * 2, bytes * 8), size_t(config.max))));
+    }
+
+    // called when a send failed because the send queue was full
+    void send_full()
+    {
+      const int want = std::min(sndbuf * 2, config.max);
+      if (config.autotune && !sndbuf_max && want > sndbuf)
+	{
+	  SockOpt::set_sndbuf(fd, want / 2);
+	  const int got = SockOpt::get_sndbuf(fd);
+	  sndbuf_max = (got <= sndbuf); // system limit reached
+	  sndbuf = got;
+	}
+    }
+
+    int rcvbuf_size() const { return rcvbuf; }
+    int sndbuf_size() const { return sndbuf; }
+
+  private:
+    // sizes are as reported by the kernel, which doubles the request
+    void grow_rcvbuf(int want)
+    {
+      want = std::min(want, config.max);
+      if (rcvbuf_max || want <= rcvbuf)
+	return;
+      SockOpt::set_rcvbuf(fd, want / 2);
+      const int got = SockOpt::get_rcvbuf(fd);
+      rcvbuf_max = (got <= rcvbuf); // system limit reached
+      rcvbuf = got;
+    }
+
+    int fd;
+    Config config;
+    int rcvbuf = 0;
+    int sndbuf = 0;
+    std::uint32_t last_drops = 0;
+    bool rcvbuf_max = false;
+    bool sndbuf_max = false;
+  };
+
+}
+
+#endif
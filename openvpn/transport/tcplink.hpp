@@ -25,6 +25,8 @@
 #define OPENVPN_TRANSPORT_TCPLINK_H
 
 #include <deque>
+#include <algorithm> // for std::min
+#include <vector>
 #include <utility> // for std::move
 #include <memory>
 
@@ -35,6 +37,7 @@
 #include <openvpn/common/socktypes.hpp>
 #include <openvpn/frame/frame.hpp>
 #include <openvpn/log/sessionstats.hpp>
+#include <openvpn/log/usdt.hpp>
 #include <openvpn/transport/pktstream.hpp>
 #include <openvpn/transport/mutate.hpp>
 
@@ -43,7 +46,8 @@
 #endif
 
 #if defined(OPENVPN_DEBUG_TCPLINK) && OPENVPN_DEBUG_TCPLINK >= 1
-#define OPENVPN_LOG_TCPLINK_ERROR(x) OPENVPN_LOG(x)
+#include <openvpn/log/logratelimit.hpp>
+#define OPENVPN_LOG_TCPLINK_ERROR(x) OPENVPN_LOG_RATELIMIT(OPENVPN_LOG_ERROR_RATE, x)
 #else
 #define OPENVPN_LOG_TCPLINK_ERROR(x)
 #endif
@@ -66,7 +70,9 @@ namespace openvpn {
     template <typename Protocol, typename ReadHandler, bool RAW_MODE_ONLY>
     class Link : public RC<thread_unsafe_refcount>
     {
-      typedef std::deque<BufferPtr> Queue;
+      // send queue buffers are owned by exactly one stage at a time
+      typedef std::unique_ptr<BufferAllocated> BufferUPtr;
+      typedef std::deque<BufferUPtr> Queue;
 
     public:
       typedef RCPtr<Link> Ptr;
@@ -75,7 +81,7 @@ namespace openvpn {
 
       Link(ReadHandler read_handler_arg,
 	   typename Protocol::socket& socket_arg,
-	   const size_t send_queue_max_size_arg, // 0 to disable
+	   const size_t send_queue_max_bytes_arg, // 0 to disable
 	   const size_t free_list_max_size_arg,
 	   const Frame::Context& frame_context_arg,
 	   const SessionStats::Ptr& stats_arg)
@@ -84,8 +90,13 @@ namespace openvpn {
 	  read_handler(read_handler_arg),
 	  frame_context(frame_context_arg),
 	  stats(stats_arg),
-	  send_queue_max_size(send_queue_max_size_arg),
-	  free_list_max_size(free_list_max_size_arg)
+	  send_queue_max_bytes(send_queue_max_bytes_arg),
+	  free_list_max_size(free_list_max_size_arg),
+	  send_gather_max(1),
+	  queue_bytes(0),
+	  cork_threshold(0),
+	  send_active(false),
+	  cork_flush_pending(false)
       {
 	set_raw_mode(false);
       }
@@ -143,6 +154,27 @@ namespace openvpn {
 	  return raw_mode_write;
       }
 
+      // Write up to max_packets queued packets with each send,
+      // as a single buffer sequence.  1 disables gathering.
+      void set_gather_write(const size_t max_packets)
+      {
+	send_gather_max = max_packets ? max_packets : 1;
+      }
+
+      // In non-raw mode without a mutator, read the stream in chunks
+      // of up to bytes into a reassembly ring rather than through
+      // PacketStream.  Each packet is first offered in place, as a
+      // window onto the ring, to the read handler's tcp_read_in_place(),
+      // and only copied out for tcp_read_handler() if that declines.
+      // 0 disables.
+      void set_stream_ring(const size_t bytes)
+      {
+	if (bytes)
+	  ring.reset(new PacketStreamRing(bytes, frame_context));
+	else
+	  ring.reset();
+      }
+
       void set_mutate(const TransportMutateStream::Ptr& mutate_arg)
       {
 	mutate = mutate_arg;
@@ -162,23 +194,41 @@ namespace openvpn {
 	  ;
       }
 
-      bool send(BufferAllocated& b)
+      // bytes queued but not yet written to the socket
+      size_t send_queue_bytes() const
+      {
+	return queue_bytes;
+      }
+
+      // Hold bulk packets (send with urgent == false) while the
+      // socket is idle, until threshold bytes are queued, an urgent
+      // packet is sent, or the handlers currently ready on the
+      // io_context have run.  0 writes every packet immediately.
+      void set_cork(const size_t threshold)
+      {
+	cork_threshold = threshold;
+      }
+
+      // Control channel packets and keepalives are urgent,
+      // data channel packets are bulk.
+      bool send(BufferAllocated& b, const bool urgent = true)
       {
 	if (halt)
 	  return false;
 
-	if (send_queue_max_size && queue.size() >= send_queue_max_size)
+	if (send_queue_max_bytes && queue_bytes + b.size() > send_queue_max_bytes)
 	  {
+	    OPENVPN_USDT2(tcp_queue_full, queue_bytes, b.size());
 	    stats->error(Error::TCP_OVERFLOW);
 	    read_handler->tcp_error_handler("TCP_OVERFLOW");
 	    stop();
 	    return false;
 	  }
 
-	BufferPtr buf;
+	BufferUPtr buf;
 	if (!free_list.empty())
 	  {
-	    buf = free_list.front();
+	    buf = std::move(free_list.front());
 	    free_list.pop_front();
 	  }
 	else
@@ -193,7 +243,7 @@ namespace openvpn {
 	  gremlin_queue_send_buffer(buf);
 	else
 #endif
-	queue_send_buffer(buf);
+	queue_send_buffer(buf, urgent);
 	return true;
       }
 
@@ -234,52 +284,114 @@ namespace openvpn {
       ~Link() { stop(); }
 
     private:
-      void queue_send_buffer(BufferPtr& buf)
+      void queue_send_buffer(BufferUPtr& buf, const bool urgent = true)
       {
+	queue_bytes += buf->size();
 	queue.push_back(std::move(buf));
-	if (queue.size() == 1) // send operation not currently active?
+	OPENVPN_PERF_GAUGE(stats, TRANSPORT_SEND_QUEUE, queue_bytes);
+	if (!send_active) // send operation not currently active?
+	  {
+	    if (urgent || !cork_threshold || queue_bytes >= cork_threshold)
+	      queue_send();
+	    else if (!cork_flush_pending)
+	      {
+		cork_flush_pending = true;
+		asio::post(socket.get_executor(), [self=Ptr(this)]()
+			   {
+			     self->cork_flush();
+			   });
+	      }
+	  }
+      }
+
+      void cork_flush()
+      {
+	cork_flush_pending = false;
+	if (!halt && !send_active && !queue.empty())
 	  queue_send();
       }
 
-      void queue_send()
+      // As with receives, the completion handler's reference to this
+      // link is handed on to the next send while the queue is busy.
+      void queue_send(Ptr self = Ptr())
       {
-	BufferAllocated& buf = *queue.front();
-	socket.async_send(buf.const_buffers_1_clamp(),
-			  [self=Ptr(this)](const asio::error_code& error, const size_t bytes_sent)
-			  {
-			    self->handle_send(error, bytes_sent);
-			  });
+	if (!self)
+	  self.reset(this);
+	send_active = true;
+	if (send_gather_max > 1 && queue.size() > 1)
+	  {
+	    const size_t n = std::min(queue.size(), send_gather_max);
+	    gather.clear();
+	    for (size_t i = 0; i < n; ++i)
+	      gather.push_back(queue[i]->const_buffers_1_clamp());
+
+	    // tell the kernel that more data follows this batch
+	    asio::socket_base::message_flags flags = 0;
+#ifdef MSG_MORE
+	    if (cork_threshold && queue.size() > n)
+	      flags = MSG_MORE;
+#endif
+	    socket.async_send(gather, flags,
+			      [self=std::move(self)](const asio::error_code& error, const size_t bytes_sent) mutable
+			      {
+				self->handle_send(self, error, bytes_sent);
+			      });
+	  }
+	else
+	  {
+	    BufferAllocated& buf = *queue.front();
+	    socket.async_send(buf.const_buffers_1_clamp(),
+			      [self=std::move(self)](const asio::error_code& error, const size_t bytes_sent) mutable
+			      {
+				self->handle_send(self, error, bytes_sent);
+			      });
+	  }
       }
 
-      void handle_send(const asio::error_code& error, const size_t bytes_sent)
+      void handle_send(Ptr& self, const asio::error_code& error, const size_t bytes_sent)
       {
+	send_active = false;
 	if (!halt)
 	  {
 	    if (!error)
 	      {
 		OPENVPN_LOG_TCPLINK_VERBOSE("TCP send raw=" << raw_mode_write << " size=" << bytes_sent);
 		stats->inc_stat(SessionStats::BYTES_OUT, bytes_sent);
-		stats->inc_stat(SessionStats::PACKETS_OUT, 1);
 
-		BufferPtr buf = queue.front();
-		if (bytes_sent == buf->size())
+		// retire fully written buffers, a partial write
+		// leaves the remainder at the front of the queue
+		size_t remaining = bytes_sent;
+		size_t packets = 0;
+		while (remaining)
 		  {
-		    queue.pop_front();
-		    if (free_list.size() < free_list_max_size)
+		    if (queue.empty())
 		      {
-			buf->reset_content();
-			free_list.push_back(std::move(buf)); // recycle the buffer for later use
+			stats->error(Error::TCP_OVERFLOW);
+			read_handler->tcp_error_handler("TCP_INTERNAL_ERROR"); // error sent more bytes than we asked for
+			stop();
+			return;
+		      }
+		    BufferUPtr& buf = queue.front();
+		    if (remaining >= buf->size())
+		      {
+			remaining -= buf->size();
+			queue_bytes -= buf->size();
+			++packets;
+			if (free_list.size() < free_list_max_size)
+			  {
+			    buf->reset_content();
+			    free_list.push_back(std::move(buf)); // recycle the buffer for later use
+			  }
+			queue.pop_front();
+		      }
+		    else
+		      {
+			buf->advance(remaining);
+			queue_bytes -= remaining;
+			remaining = 0;
 		      }
 		  }
-		else if (bytes_sent < buf->size())
-		  buf->advance(bytes_sent);
-		else
-		  {
-		    stats->error(Error::TCP_OVERFLOW);
-		    read_handler->tcp_error_handler("TCP_INTERNAL_ERROR"); // error sent more bytes than we asked for
-		    stop();
-		    return;
-		  }
+		stats->inc_stat(SessionStats::PACKETS_OUT, packets);
 	      }
 	    else
 	      {
@@ -290,27 +402,35 @@ namespace openvpn {
 		return;
 	      }
 	    if (!queue.empty())
-	      queue_send();
+	      queue_send(std::move(self));
 	    else
 	      read_handler->tcp_write_queue_needs_send();
 	  }
       }
 
-      void queue_recv(PacketFrom *tcpfrom)
+      void queue_recv(PacketFrom *tcpfrom, Ptr self = Ptr())
       {
 	OPENVPN_LOG_TCPLINK_VERBOSE("TCPLink::queue_recv");
+	if (ring && !is_raw_mode_read() && !mutate && !pktstream_pending())
+	  {
+	    delete tcpfrom;
+	    queue_recv_ring(std::move(self));
+	    return;
+	  }
 	if (!tcpfrom)
 	  tcpfrom = new PacketFrom();
+	if (!self)
+	  self.reset(this);
 	frame_context.prepare(tcpfrom->buf);
 
 	socket.async_receive(frame_context.mutable_buffers_1_clamp(tcpfrom->buf),
-			     [self=Ptr(this), tcpfrom](const asio::error_code& error, const size_t bytes_recvd)
+			     [self=std::move(self), tcpfrom](const asio::error_code& error, const size_t bytes_recvd) mutable
 			     {
-			       self->handle_recv(tcpfrom, error, bytes_recvd);
+			       self->handle_recv(self, tcpfrom, error, bytes_recvd);
 			     });
       }
 
-      void handle_recv(PacketFrom *tcpfrom, const asio::error_code& error, const size_t bytes_recvd)
+      void handle_recv(Ptr& self, PacketFrom *tcpfrom, const asio::error_code& error, const size_t bytes_recvd)
       {
 	OPENVPN_LOG_TCPLINK_VERBOSE("TCPLink::handle_recv: " << error.message());
 	PacketFrom::SPtr pfp(tcpfrom);
@@ -350,7 +470,88 @@ namespace openvpn {
 		    requeue = read_handler->tcp_read_handler(pfp->buf);
 		  }
 		if (!halt && requeue)
-		  queue_recv(pfp.release()); // reuse PacketFrom object
+		  queue_recv(pfp.release(), std::move(self)); // reuse PacketFrom object
+	      }
+	    else if (error == asio::error::eof)
+	      {
+		OPENVPN_LOG_TCPLINK_ERROR("TCP recv EOF");
+		read_handler->tcp_eof_handler();
+	      }
+	    else
+	      {
+		OPENVPN_LOG_TCPLINK_ERROR("TCP recv error: " << error.message());
+		stats->error(Error::NETWORK_RECV_ERROR);
+		read_handler->tcp_error_handler("NETWORK_RECV_ERROR");
+		stop();
+	      }
+	  }
+      }
+
+      void queue_recv_ring(Ptr self = Ptr())
+      {
+	if (!self)
+	  self.reset(this);
+	unsigned char *data = ring->write_ptr();
+	socket.async_receive(asio::mutable_buffers_1(data, ring->write_avail()),
+			     [self=std::move(self)](const asio::error_code& error, const size_t bytes_recvd) mutable
+			     {
+			       self->handle_recv_ring(self, error, bytes_recvd);
+			     });
+      }
+
+      void handle_recv_ring(Ptr& self, const asio::error_code& error, const size_t bytes_recvd)
+      {
+	OPENVPN_LOG_TCPLINK_VERBOSE("TCPLink::handle_recv_ring: " << error.message());
+	if (!halt)
+	  {
+	    if (!error)
+	      {
+		bool requeue = true;
+		OPENVPN_LOG_TCPLINK_VERBOSE("TCP recv ring size=" << bytes_recvd);
+		stats->inc_stat(SessionStats::BYTES_IN, bytes_recvd);
+		stats->inc_stat(SessionStats::PACKETS_IN, 1);
+		try {
+		  ring->commit(bytes_recvd);
+		  BufferAllocated view;
+		  while (!halt && ring->lend(view))
+		    {
+		      bool in_place = false;
+#ifdef OPENVPN_GREMLIN
+		      if (!gremlin) // gremlin holds packets back
+#endif
+		      in_place = read_handler->tcp_read_in_place(view, requeue);
+		      if (in_place)
+			{
+			  ring->reclaim(view);
+			  continue;
+			}
+
+		      // the handler wants to own the packet, so copy it
+		      BufferAllocated pkt;
+		      pkt.swap(ring_pkt);
+		      frame_context.prepare(pkt);
+		      pkt.write(view.c_data(), view.size());
+		      ring->reclaim(view);
+#ifdef OPENVPN_GREMLIN
+		      if (gremlin)
+			requeue = gremlin_recv(pkt);
+		      else
+#endif
+		      requeue = read_handler->tcp_read_handler(pkt);
+		      if (pkt.allocated())
+			ring_pkt.swap(pkt); // recycle buffer not grabbed by handler
+		    }
+		}
+		catch (const std::exception& e)
+		  {
+		    OPENVPN_LOG_TCPLINK_ERROR("TCP packet extract error: " << e.what());
+		    stats->error(Error::TCP_SIZE_ERROR);
+		    read_handler->tcp_error_handler("TCP_SIZE_ERROR");
+		    stop();
+		    return;
+		  }
+		if (!halt && requeue)
+		  queue_recv(nullptr, std::move(self));
 	      }
 	    else if (error == asio::error::eof)
 	      {
@@ -367,6 +568,12 @@ namespace openvpn {
 	  }
       }
 
+      // data buffered by PacketStream must be drained through it first
+      bool pktstream_pending() const
+      {
+	return !pktstream.empty();
+      }
+
       bool put_pktstream(BufferAllocated& buf, BufferAllocated& pkt)
       {
 	bool requeue = true;
@@ -377,6 +584,8 @@ namespace openvpn {
 	while (buf.size())
 	  {
 	    pktstream.put(buf, frame_context);
+	    for (size_t n = pktstream.take_moved(); n > 0; --n)
+	      stats->error(Error::N_FRAME_REALIGN);
 	    if (pktstream.ready())
 	      {
 		pktstream.get(pkt);
@@ -392,18 +601,20 @@ namespace openvpn {
       }
 
 #ifdef OPENVPN_GREMLIN
-      void gremlin_queue_send_buffer(BufferPtr& buf)
+      void gremlin_queue_send_buffer(BufferUPtr& buf)
       {
+	const size_t size = buf->size();
 	gremlin->send_queue([self=Ptr(this), buf=std::move(buf)]() mutable {
 	    if (!self->halt)
 	      {
 		self->queue_send_buffer(buf);
 	      }
-	  });
+	  }, size);
       }
 
       bool gremlin_recv(BufferAllocated& buf)
       {
+	const size_t size = buf.size();
 	gremlin->recv_queue([self=Ptr(this), buf=std::move(buf)]() mutable {
 	    if (!self->halt)
 	      {
@@ -411,7 +622,7 @@ namespace openvpn {
 		if (requeue)
 		  self->queue_recv(nullptr);
 	      }
-	  });
+	  }, size);
 	return false;
       }
 #endif
@@ -423,11 +634,19 @@ namespace openvpn {
       ReadHandler read_handler;
       Frame::Context frame_context;
       SessionStats::Ptr stats;
-      const size_t send_queue_max_size;
+      const size_t send_queue_max_bytes;
       const size_t free_list_max_size;
+      size_t send_gather_max;
+      size_t queue_bytes;
+      size_t cork_threshold;
+      bool send_active;
+      bool cork_flush_pending;
       Queue queue;      // send queue
+      std::vector<asio::const_buffer> gather; // buffer sequence for gather write
       Queue free_list;  // recycled free buffers for send queue
       PacketStream pktstream;
+      std::unique_ptr<PacketStreamRing> ring;
+      BufferAllocated ring_pkt; // recycled packet buffer for ring mode
       TransportMutateStream::Ptr mutate;
 
 #ifdef OPENVPN_GREMLIN
@@ -25,20 +25,43 @@
 #define OPENVPN_TRANSPORT_UDPLINK_H
 
 #include <memory>
+#include <vector>
+#include <algorithm>
+#include <cstdint>
 
 #include <asio.hpp>
 
+#include <openvpn/common/platform.hpp>
 #include <openvpn/common/size.hpp>
 #include <openvpn/common/rc.hpp>
 #include <openvpn/frame/frame.hpp>
+#include <openvpn/time/time.hpp>
 #include <openvpn/log/sessionstats.hpp>
+#include <openvpn/log/usdt.hpp>
 
 #ifdef OPENVPN_GREMLIN
 #include <openvpn/transport/gremlin.hpp>
 #endif
 
+#if defined(OPENVPN_PLATFORM_LINUX)
+#include <errno.h>
+#include <cstring>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <netinet/in.h>
+#include <netinet/udp.h>
+#include <openvpn/transport/sockbuftune.hpp>
+#define OPENVPN_UDPLINK_HAVE_MMSG
+#ifdef OPENVPN_IO_URING
+#include <openvpn/linux/iouring.hpp>
+#define OPENVPN_UDPLINK_HAVE_URING
+#endif
+#endif
+
 #if defined(OPENVPN_DEBUG_UDPLINK) && OPENVPN_DEBUG_UDPLINK >= 1
-#define OPENVPN_LOG_UDPLINK_ERROR(x) OPENVPN_LOG(x)
+#include <openvpn/log/logratelimit.hpp>
+#define OPENVPN_LOG_UDPLINK_ERROR(x) OPENVPN_LOG_RATELIMIT(OPENVPN_LOG_ERROR_RATE, x)
 #else
 #define OPENVPN_LOG_UDPLINK_ERROR(x)
 #endif
@@ -64,8 +87,15 @@ namespace openvpn {
       typedef std::unique_ptr<PacketFrom> SPtr;
       BufferAllocated buf;
       AsioEndpoint sender_endpoint;
+      unsigned int tos = 0; // outer TOS/traffic class, see Link::enable_tos
     };
 
+    // A batch of received packets, passed to udp_read_handler_batch.
+    // Only the first n elements are valid.  The read handler may
+    // take ownership of any element by moving it out of the vector,
+    // the link will replace it before the next receive.
+    typedef std::vector<PacketFrom::SPtr> PacketFromBatch;
+
     template <typename ReadHandler>
     class Link : public RC<thread_unsafe_refcount>
     {
@@ -94,7 +124,12 @@ namespace openvpn {
 
       // Returns 0 on success, or a system error code on error.
       // May also return SEND_PARTIAL or SEND_SOCKET_HALTED.
-      int send(const Buffer& buf, const AsioEndpoint* endpoint)
+      // If the send queue is enabled, the packet is queued and
+      // 0 is returned; errors are then only reflected in stats.
+      // A nonzero tos is sent as the packet's TOS/traffic class
+      // if enable_tos() was called, otherwise the socket default
+      // is used.
+      int send(const Buffer& buf, const AsioEndpoint* endpoint, const unsigned int tos = 0)
       {
 #ifdef OPENVPN_GREMLIN
 	if (gremlin)
@@ -104,7 +139,34 @@ namespace openvpn {
 	  }
 	else
 #endif
-	return do_send(buf, endpoint);
+#ifdef OPENVPN_UDPLINK_HAVE_MMSG
+	if (send_queue_max)
+	  return queue_send(buf, endpoint, tos);
+	else
+#endif
+	return do_send(buf, endpoint, tos);
+      }
+
+      // Like send(), but with the send queue enabled, buf is queued
+      // by swapping its storage rather than by copying it, leaving
+      // buf with a recycled buffer of undefined content.
+      int send_consume(BufferAllocated& buf, const AsioEndpoint* endpoint, const unsigned int tos = 0)
+      {
+#ifdef OPENVPN_UDPLINK_HAVE_MMSG
+	if (send_queue_max
+#ifdef OPENVPN_GREMLIN
+	    && !gremlin
+#endif
+	    )
+	  {
+	    SendQueueEntry* e = queue_entry(endpoint, tos);
+	    if (!e)
+	      return halt ? SEND_SOCKET_HALTED : EAGAIN;
+	    e->buf.swap(buf);
+	    return 0;
+	  }
+#endif
+	return send(buf, endpoint, tos);
       }
 
       void start(const int n_parallel)
@@ -116,12 +178,104 @@ namespace openvpn {
 	  }
       }
 
+#ifdef OPENVPN_UDPLINK_HAVE_MMSG
+      // Per-packet TOS/traffic class: packets passed to send() with
+      // a nonzero tos carry it in an IP_TOS/IPV6_TCLASS cmsg, and the
+      // TOS of each packet received in batched mode (start_batch) is
+      // returned in PacketFrom::tos.  Call before starting reads.
+      void enable_tos(const bool ipv6)
+      {
+	const int on = 1;
+	if (ipv6)
+	  ::setsockopt(socket.native_handle(), IPPROTO_IPV6, IPV6_RECVTCLASS, &on, sizeof(on));
+	::setsockopt(socket.native_handle(), IPPROTO_IP, IP_RECVTOS, &on, sizeof(on));
+	tos_enabled = true;
+	tos_v6 = ipv6;
+      }
+
+      // Size the socket buffers, and with config.autotune grow them
+      // on kernel receive queue drops, bursts, or full send queues.
+      // Kernel drops are counted in SessionStats::KERNEL_DROPS, as
+      // seen by batched receive (start_batch).  Call before starting
+      // reads.
+      void enable_sockbuf_tune(const SockBufTune::Config& config)
+      {
+	buftune.start(socket.native_handle(), config);
+      }
+#endif
+
+#ifdef OPENVPN_UDPLINK_HAVE_MMSG
+      // Batched receive mode: each time the socket becomes readable,
+      // receive up to batch_size datagrams with a single recvmmsg()
+      // call and pass them to read_handler->udp_read_handler_batch().
+      // Use instead of start().
+      void start_batch(const size_t batch_size)
+      {
+	if (!halt && batch_size)
+	  {
+	    batch.resize(batch_size);
+	    batch_msgs.resize(batch_size);
+	    batch_iov.resize(batch_size);
+	    if (recv_cmsgs())
+	      batch_control.resize(batch_size);
+	    queue_read_batch();
+	  }
+      }
+#endif
+
+#ifdef OPENVPN_UDPLINK_HAVE_MMSG
+      // Enable the send coalescing queue.  Packets passed to send()
+      // during one io_context handler run are gathered and flushed
+      // together from a posted handler with sendmmsg(), or with a
+      // single UDP_SEGMENT (GSO) sendmsg() when all packets go to the
+      // same endpoint and have equal size (the last may be shorter).
+      // Since all sessions sharing this link share the queue, a
+      // server can flush many sessions with one syscall.
+      void enable_send_queue(const size_t max_packets, const bool gso)
+      {
+	send_queue_max = std::min(max_packets, size_t(UIO_MAXIOV));
+	send_queue.resize(send_queue_max);
+	send_msgs.resize(send_queue_max);
+	send_iov.resize(send_queue_max);
+#ifdef UDP_SEGMENT
+	send_gso = gso;
+#endif
+      }
+#endif
+
+#ifdef OPENVPN_UDPLINK_HAVE_URING
+      // io_uring receive mode: keep a multishot recvmsg posted on the
+      // socket, with the kernel picking receive buffers from a ring
+      // of n_bufs provided buffers.  Packets completed in one pass
+      // are passed to read_handler->udp_read_handler_batch(), up to
+      // batch_size at a time.  If the send queue is enabled, it is
+      // also flushed through io_uring.  Use instead of start() or
+      // start_batch().  Throws IOUring::io_uring_error if io_uring
+      // is not usable, in which case the link is left untouched.
+      void start_uring(asio::io_context& io_context, const size_t batch_size, const unsigned int n_bufs = 256)
+      {
+	if (halt || !batch_size)
+	  return;
+	IOUring::Ptr u = IOUring::instance(io_context);
+	const size_t buf_size = sizeof(struct io_uring_recvmsg_out) + sizeof(struct sockaddr_in6) + frame_context.payload();
+	uring_recv.reset(new UringRecv(this, new IOUring::BufRing(*u, n_bufs, buf_size)));
+	uring = std::move(u);
+	uring->attach();
+	batch.resize(batch_size);
+	uring_arm();
+      }
+#endif
+
       void stop()
       {
 	halt = true;
 #ifdef OPENVPN_GREMLIN
 	if (gremlin)
 	  gremlin->stop();
+#endif
+#ifdef OPENVPN_UDPLINK_HAVE_URING
+	if (uring_recv && uring_recv->armed)
+	  uring->cancel(IOUring::user_data(uring_recv.get(), 0));
 #endif
       }
 
@@ -133,26 +287,41 @@ namespace openvpn {
       ~Link() { stop(); }
 
     private:
-      void queue_read(PacketFrom *udpfrom)
+#ifdef OPENVPN_UDPLINK_HAVE_MMSG
+      union CmsgControl
+      {
+	char buf[CMSG_SPACE(sizeof(int)) * 3]; // room for IP_TOS, IPV6_TCLASS and SO_RXQ_OVFL on receive
+	struct cmsghdr align;
+      };
+
+#endif
+
+      // The completion handler's reference to this link is handed on
+      // to the next read, like the PacketFrom object, so a busy link
+      // does no reference counting per packet.
+      void queue_read(PacketFrom *udpfrom, Ptr self = Ptr())
       {
 	OPENVPN_LOG_UDPLINK_VERBOSE("UDPLink::queue_read");
 	if (!udpfrom)
 	  udpfrom = new PacketFrom();
+	if (!self)
+	  self.reset(this);
 	frame_context.prepare(udpfrom->buf);
 	socket.async_receive_from(frame_context.mutable_buffers_1(udpfrom->buf),
 				  udpfrom->sender_endpoint,
-				  [self=Ptr(this), udpfrom](const asio::error_code& error, const size_t bytes_recvd)
+				  [self=std::move(self), udpfrom](const asio::error_code& error, const size_t bytes_recvd) mutable
                                   {
-                                    self->handle_read(udpfrom, error, bytes_recvd);
+                                    self->handle_read(self, udpfrom, error, bytes_recvd);
                                   });
       }
 
-      void handle_read(PacketFrom *udpfrom, const asio::error_code& error, const size_t bytes_recvd)
+      void handle_read(Ptr& self, PacketFrom *udpfrom, const asio::error_code& error, const size_t bytes_recvd)
       {
 	OPENVPN_LOG_UDPLINK_VERBOSE("UDPLink::handle_read: " << error.message());
 	PacketFrom::SPtr pfp(udpfrom);
 	if (!halt)
 	  {
+	    OPENVPN_PERF_TIMER(stats, TRANSPORT_RECV);
 	    if (bytes_recvd)
 	      {
 		if (!error)
@@ -175,14 +344,623 @@ namespace openvpn {
 		  }
 	      }
 	    if (!halt)
-	      queue_read(pfp.release()); // reuse PacketFrom object if still available
+	      queue_read(pfp.release(), std::move(self)); // reuse PacketFrom object if still available
 	  }
       }
 
-      int do_send(const Buffer& buf, const AsioEndpoint* endpoint)
+#ifdef OPENVPN_UDPLINK_HAVE_MMSG
+      void queue_read_batch(Ptr self = Ptr())
+      {
+	OPENVPN_LOG_UDPLINK_VERBOSE("UDPLink::queue_read_batch");
+	if (!self)
+	  self.reset(this);
+	socket.async_wait(asio::ip::udp::socket::wait_read,
+			  [self=std::move(self)](const asio::error_code& error) mutable
+                          {
+                            self->handle_read_batch(self, error);
+                          });
+      }
+
+      void handle_read_batch(Ptr& self, const asio::error_code& error)
       {
+	OPENVPN_LOG_UDPLINK_VERBOSE("UDPLink::handle_read_batch: " << error.message());
+	if (halt)
+	  return;
+	if (!error)
+	  {
+	    OPENVPN_PERF_TIMER(stats, TRANSPORT_RECV);
+	    const size_t n = recv_batch();
+	    if (n)
+	      {
+		OPENVPN_PERF_BATCH(stats, TRANSPORT_RECV_BATCH, n);
+		const Time::Batch time_batch; // one timestamp for the burst
+#ifdef OPENVPN_GREMLIN
+		if (gremlin)
+		  {
+		    for (size_t i = 0; i < n; ++i)
+		      gremlin_recv(batch[i]);
+		  }
+		else
+#endif
+		read_handler->udp_read_handler_batch(batch, n);
+	      }
+	  }
+	else
+	  {
+	    OPENVPN_LOG_UDPLINK_ERROR("UDP recv wait error: " << error.message());
+	    stats->error(Error::NETWORK_RECV_ERROR);
+	  }
 	if (!halt)
+	  queue_read_batch(std::move(self));
+      }
+
+      // Returns the number of packets received into batch.
+      size_t recv_batch()
+      {
+	const size_t batch_size = batch.size();
+	for (size_t i = 0; i < batch_size; ++i)
 	  {
+	    PacketFrom::SPtr& pf = batch[i];
+	    if (!pf)
+	      pf.reset(new PacketFrom());
+	    frame_context.prepare(pf->buf);
+	    batch_iov[i].iov_base = pf->buf.data();
+	    batch_iov[i].iov_len = frame_context.remaining_payload(pf->buf);
+	    struct msghdr& h = batch_msgs[i].msg_hdr;
+	    h.msg_name = pf->sender_endpoint.data();
+	    h.msg_namelen = pf->sender_endpoint.capacity();
+	    h.msg_iov = &batch_iov[i];
+	    h.msg_iovlen = 1;
+	    if (recv_cmsgs())
+	      {
+		h.msg_control = batch_control[i].buf;
+		h.msg_controllen = sizeof(batch_control[i].buf);
+	      }
+	    else
+	      {
+		h.msg_control = nullptr;
+		h.msg_controllen = 0;
+	      }
+	    h.msg_flags = 0;
+	    batch_msgs[i].msg_len = 0;
+	  }
+
+	const int status = ::recvmmsg(socket.native_handle(), batch_msgs.data(), batch_size, MSG_DONTWAIT, nullptr);
+	if (status < 0)
+	  {
+	    const int eno = errno;
+	    if (eno != EAGAIN && eno != EWOULDBLOCK && eno != EINTR)
+	      {
+		OPENVPN_LOG_UDPLINK_ERROR("UDP recvmmsg error: " << std::strerror(eno));
+		stats->error(Error::NETWORK_RECV_ERROR);
+	      }
+	    return 0;
+	  }
+
+	// compact out zero-length datagrams so the handler sees only real packets
+	size_t n = 0;
+	size_t bytes = 0;
+	bool have_drops = false;
+	std::uint32_t drops = 0;
+	for (size_t i = 0; i < size_t(status); ++i)
+	  {
+	    const size_t bytes_recvd = batch_msgs[i].msg_len;
+	    if (bytes_recvd)
+	      {
+		PacketFrom& pf = *batch[i];
+		pf.buf.set_size(bytes_recvd);
+		pf.sender_endpoint.resize(batch_msgs[i].msg_hdr.msg_namelen);
+		pf.tos = 0;
+		if (recv_cmsgs())
+		  have_drops |= read_cmsgs(batch_msgs[i].msg_hdr, pf, drops);
+		bytes += bytes_recvd;
+		OPENVPN_LOG_UDPLINK_VERBOSE("UDP[" << bytes_recvd << "] from " << pf.sender_endpoint);
+		stats->inc_stat(SessionStats::BYTES_IN, bytes_recvd);
+		if (i != n)
+		  batch[i].swap(batch[n]);
+		++n;
+	      }
+	  }
+	stats->inc_stat(SessionStats::PACKETS_IN, n);
+	if (buftune.defined())
+	  {
+	    if (have_drops)
+	      {
+		const std::uint32_t delta = buftune.drops(drops);
+		if (delta)
+		  stats->inc_stat(SessionStats::KERNEL_DROPS, delta);
+	      }
+	    buftune.burst(bytes);
+	  }
+	return n;
+      }
+#endif
+
+#ifdef OPENVPN_UDPLINK_HAVE_MMSG
+      struct SendQueueEntry;
+
+      int queue_send(const Buffer& buf, const AsioEndpoint* endpoint, const unsigned int tos)
+      {
+	SendQueueEntry* e = queue_entry(endpoint, tos);
+	if (!e)
+	  return halt ? SEND_SOCKET_HALTED : EAGAIN;
+	e->buf.reset(buf.size(), 0);
+	e->buf.init_headroom(0);
+	e->buf.write(buf.c_data(), buf.size());
+	return 0;
+      }
+
+      // Return the next free send queue entry, set up for endpoint
+      // and tos, or nullptr if halted or the queue is still full
+      // after a flush, in which case the packet is dropped.
+      SendQueueEntry* queue_entry(const AsioEndpoint* endpoint, const unsigned int tos)
+      {
+	if (halt)
+	  return nullptr;
+	if (send_queue_size >= send_queue_max)
+	  {
+	    flush_send_queue();
+	    if (send_queue_size >= send_queue_max)
+	      {
+		stats->error(Error::NETWORK_SEND_ERROR);
+		return nullptr;
+	      }
+	  }
+	SendQueueEntry& e = send_queue[send_queue_size++];
+	e.has_endpoint = (endpoint != nullptr);
+	if (endpoint)
+	  e.endpoint = *endpoint;
+	e.tos = tos_enabled ? tos : 0;
+	OPENVPN_PERF_GAUGE(stats, TRANSPORT_SEND_QUEUE, send_queue_size);
+	if (!send_flush_pending)
+	  {
+	    send_flush_pending = true;
+	    asio::post(socket.get_executor(), [self=Ptr(this)]()
+                       {
+                         self->send_flush_pending = false;
+                         self->flush_send_queue();
+                       });
+	  }
+	return &e;
+      }
+
+      // Packets the socket has no room for stay queued until it
+      // is writable again.  Other send errors drop only the packet
+      // that failed.
+      void flush_send_queue()
+      {
+	const size_t n = send_queue_size;
+	if (halt || !n || send_wait_pending)
+	  return;
+	send_queue_size = 0;
+	OPENVPN_PERF_TIMER(stats, TRANSPORT_SEND);
+	OPENVPN_PERF_BATCH(stats, TRANSPORT_SEND_BATCH, n);
+#ifdef OPENVPN_UDPLINK_HAVE_URING
+	if (uring)
+	  {
+	    uring_flush_send_queue(n);
+	    return;
+	  }
+#endif
+#ifdef UDP_SEGMENT
+	if (send_gso && n > 1 && flush_gso(n))
+	  return;
+#endif
+	size_t i;
+	for (i = 0; i < n; ++i)
+	  {
+	    SendQueueEntry& e = send_queue[i];
+	    send_iov[i].iov_base = e.buf.data();
+	    send_iov[i].iov_len = e.buf.size();
+	    struct msghdr& h = send_msgs[i].msg_hdr;
+	    h.msg_name = e.has_endpoint ? e.endpoint.data() : nullptr;
+	    h.msg_namelen = e.has_endpoint ? e.endpoint.size() : 0;
+	    h.msg_iov = &send_iov[i];
+	    h.msg_iovlen = 1;
+	    h.msg_control = nullptr;
+	    h.msg_controllen = 0;
+	    if (e.tos)
+	      set_tos_cmsg(h, e.control, e.tos);
+	    h.msg_flags = 0;
+	    send_msgs[i].msg_len = 0;
+	  }
+	i = 0;
+	while (i < n)
+	  {
+	    const int status = ::sendmmsg(socket.native_handle(), &send_msgs[i], n - i, 0);
+	    if (status <= 0)
+	      {
+		const int eno = errno;
+		if (eno == EINTR)
+		  continue;
+		if (eno == EAGAIN || eno == EWOULDBLOCK || eno == ENOBUFS)
+		  {
+		    if (buftune.defined())
+		      buftune.send_full();
+		    retain_send_queue(i, n);
+		    wait_send_writable();
+		    return;
+		  }
+		OPENVPN_LOG_UDPLINK_ERROR("UDP sendmmsg error: " << std::strerror(eno));
+		OPENVPN_USDT2(udp_send_error, eno, send_queue[i].buf.size());
+		stats->error(Error::NETWORK_SEND_ERROR);
+		++i;
+		continue;
+	      }
+	    for (int j = 0; j < status; ++j, ++i)
+	      {
+		const size_t wrote = send_msgs[i].msg_len;
+		stats->inc_stat(SessionStats::BYTES_OUT, wrote);
+		stats->inc_stat(SessionStats::PACKETS_OUT, 1);
+		if (wrote != send_queue[i].buf.size())
+		  {
+		    OPENVPN_LOG_UDPLINK_ERROR("UDP partial send error");
+		    OPENVPN_USDT2(udp_send_error, 0, send_queue[i].buf.size());
+		    stats->error(Error::NETWORK_SEND_ERROR);
+		  }
+	      }
+	  }
+      }
+
+      // keep the unsent entries [begin, n) at the front of the queue
+      void retain_send_queue(const size_t begin, const size_t n)
+      {
+	for (size_t i = begin; i < n; ++i)
+	  std::swap(send_queue[i - begin], send_queue[i]);
+	send_queue_size = n - begin;
+      }
+
+      void wait_send_writable()
+      {
+	send_wait_pending = true;
+	socket.async_wait(asio::ip::udp::socket::wait_write,
+			  [self=Ptr(this)](const asio::error_code& error)
+			  {
+			    self->send_wait_pending = false;
+			    if (!error)
+			      self->flush_send_queue();
+			  });
+      }
+
+#ifdef UDP_SEGMENT
+      // Returns false if the queue is not GSO-eligible, or the socket
+      // has no room for it, in which case the caller should fall back
+      // to sendmmsg.
+      bool flush_gso(const size_t n)
+      {
+	enum { MAX_GSO_SEGMENTS = 64, MAX_GSO_BYTES = 65000 };
+	if (n > MAX_GSO_SEGMENTS)
+	  return false;
+	const SendQueueEntry& first = send_queue[0];
+	const size_t seg_size = first.buf.size();
+	size_t total = 0;
+	for (size_t i = 0; i < n; ++i)
+	  {
+	    const SendQueueEntry& e = send_queue[i];
+	    if (e.has_endpoint != first.has_endpoint
+		|| (e.has_endpoint && e.endpoint != first.endpoint)
+		|| e.tos != first.tos
+		|| e.buf.size() > seg_size
+		|| (e.buf.size() < seg_size && i != n - 1)
+		|| !e.buf.size())
+	      return false;
+	    send_iov[i].iov_base = const_cast<unsigned char*>(e.buf.c_data());
+	    send_iov[i].iov_len = e.buf.size();
+	    total += e.buf.size();
+	  }
+	if (total > MAX_GSO_BYTES)
+	  return false;
+
+	union {
+	  char buf[CMSG_SPACE(sizeof(std::uint16_t)) + CMSG_SPACE(sizeof(int))];
+	  struct cmsghdr align;
+	} control;
+	struct msghdr h = {};
+	h.msg_name = first.has_endpoint ? const_cast<AsioEndpoint&>(first.endpoint).data() : nullptr;
+	h.msg_namelen = first.has_endpoint ? first.endpoint.size() : 0;
+	h.msg_iov = send_iov.data();
+	h.msg_iovlen = n;
+	h.msg_control = control.buf;
+	h.msg_controllen = sizeof(control.buf);
+	struct cmsghdr* cm = CMSG_FIRSTHDR(&h);
+	cm->cmsg_level = IPPROTO_UDP;
+	cm->cmsg_type = UDP_SEGMENT;
+	cm->cmsg_len = CMSG_LEN(sizeof(std::uint16_t));
+	const std::uint16_t gso_size = std::uint16_t(seg_size);
+	std::memcpy(CMSG_DATA(cm), &gso_size, sizeof(gso_size));
+	if (first.tos)
+	  {
+	    cm = CMSG_NXTHDR(&h, cm);
+	    put_tos_cmsg(cm, first.tos);
+	    h.msg_controllen = CMSG_SPACE(sizeof(std::uint16_t)) + CMSG_SPACE(sizeof(int));
+	  }
+	else
+	  h.msg_controllen = CMSG_SPACE(sizeof(std::uint16_t));
+
+	ssize_t status;
+	do {
+	  status = ::sendmsg(socket.native_handle(), &h, 0);
+	} while (status < 0 && errno == EINTR);
+	if (status < 0)
+	  {
+	    const int eno = errno;
+	    if (eno == EINVAL || eno == EOPNOTSUPP || eno == EIO)
+	      {
+		// kernel or device without UDP GSO support
+		OPENVPN_LOG_UDPLINK_ERROR("UDP GSO disabled: " << std::strerror(eno));
+		send_gso = false;
+		return false;
+	      }
+	    if (eno == EAGAIN || eno == EWOULDBLOCK || eno == ENOBUFS)
+	      return false;
+	    OPENVPN_LOG_UDPLINK_ERROR("UDP GSO send error: " << std::strerror(eno));
+	    OPENVPN_USDT2(udp_send_error, eno, total);
+	    stats->error(Error::NETWORK_SEND_ERROR);
+	    return true;
+	  }
+	stats->inc_stat(SessionStats::BYTES_OUT, status);
+	stats->inc_stat(SessionStats::PACKETS_OUT, n);
+	if (size_t(status) != total)
+	  {
+	    OPENVPN_LOG_UDPLINK_ERROR("UDP partial GSO send error");
+	    OPENVPN_USDT2(udp_send_error, 0, total);
+	    stats->error(Error::NETWORK_SEND_ERROR);
+	  }
+	return true;
+      }
+#endif
+
+      // Point h at control, holding a TOS/traffic class cmsg.
+      void set_tos_cmsg(struct msghdr& h, CmsgControl& control, const unsigned int tos) const
+      {
+	h.msg_control = control.buf;
+	h.msg_controllen = CMSG_SPACE(sizeof(int));
+	put_tos_cmsg(CMSG_FIRSTHDR(&h), tos);
+      }
+
+      void put_tos_cmsg(struct cmsghdr* cm, const unsigned int tos) const
+      {
+	cm->cmsg_level = tos_v6 ? IPPROTO_IPV6 : IPPROTO_IP;
+	cm->cmsg_type = tos_v6 ? IPV6_TCLASS : IP_TOS;
+	cm->cmsg_len = CMSG_LEN(sizeof(int));
+	const int v = int(tos & 0xff);
+	std::memcpy(CMSG_DATA(cm), &v, sizeof(v));
+      }
+
+      bool recv_cmsgs() const
+      {
+	return tos_enabled || buftune.defined();
+      }
+
+      // Set pf.tos from the cmsgs of a received packet, returns true
+      // if they include the kernel drop counter, which goes in drops.
+      static bool read_cmsgs(struct msghdr& h, PacketFrom& pf, std::uint32_t& drops)
+      {
+	bool ret = false;
+	for (struct cmsghdr* cm = CMSG_FIRSTHDR(&h); cm; cm = CMSG_NXTHDR(&h, cm))
+	  {
+	    if ((cm->cmsg_level == IPPROTO_IP && cm->cmsg_type == IP_TOS)
+		|| (cm->cmsg_level == IPPROTO_IPV6 && cm->cmsg_type == IPV6_TCLASS))
+	      {
+		// IP_TOS is delivered as a byte, IPV6_TCLASS as an int
+		if (cm->cmsg_len == CMSG_LEN(1))
+		  pf.tos = *(const unsigned char *)CMSG_DATA(cm);
+		else
+		  {
+		    int v;
+		    std::memcpy(&v, CMSG_DATA(cm), sizeof(v));
+		    pf.tos = unsigned(v) & 0xff;
+		  }
+	      }
+#ifdef SO_RXQ_OVFL
+	    else if (cm->cmsg_level == SOL_SOCKET && cm->cmsg_type == SO_RXQ_OVFL)
+	      {
+		std::memcpy(&drops, CMSG_DATA(cm), sizeof(drops));
+		ret = true;
+	      }
+#endif
+	  }
+	return ret;
+      }
+#endif
+
+#ifdef OPENVPN_UDPLINK_HAVE_URING
+      void uring_arm()
+      {
+	UringRecv& ur = *uring_recv;
+	struct io_uring_sqe *sqe = uring->get_sqe();
+	if (!sqe)
+	  {
+	    // submission queue full, retry after this pass
+	    ur.rearm = true;
+	    uring->flush_at_end(&ur);
+	    return;
+	  }
+	sqe->opcode = IORING_OP_RECVMSG;
+	sqe->fd = socket.native_handle();
+	sqe->addr = (std::uint64_t)&ur.msg;
+	sqe->len = 1;
+	sqe->ioprio = IORING_RECV_MULTISHOT;
+	sqe->flags = IOSQE_BUFFER_SELECT;
+	sqe->buf_group = ur.bufs->bgid();
+	sqe->user_data = IOUring::user_data(&ur, 0);
+	ur.armed = true;
+	ur.rearm = false;
+	if (!ur.hold)
+	  ur.hold.reset(this);
+      }
+
+      void uring_recv_complete(const struct io_uring_cqe& cqe)
+      {
+	UringRecv& ur = *uring_recv;
+	if (!(cqe.flags & IORING_CQE_F_MORE))
+	  {
+	    ur.armed = false;
+	    ur.rearm = true;
+	    uring->flush_at_end(&ur);
+	  }
+	if (cqe.res < 0)
+	  {
+	    const int eno = -cqe.res;
+	    if (eno == EINVAL && !ur.received)
+	      {
+		// kernel without multishot recvmsg, use the reactor
+		OPENVPN_LOG_UDPLINK_ERROR("UDP io_uring multishot recvmsg unavailable, falling back");
+		ur.rearm = false;
+		uring_fallback = true;
+	      }
+	    else if (eno != ENOBUFS && eno != ECANCELED)
+	      {
+		OPENVPN_LOG_UDPLINK_ERROR("UDP io_uring recv error: " << std::strerror(eno));
+		stats->error(Error::NETWORK_RECV_ERROR);
+	      }
+	    return;
+	  }
+	if (!(cqe.flags & IORING_CQE_F_BUFFER))
+	  return;
+	ur.received = true;
+
+	const unsigned int bid = cqe.flags >> IORING_CQE_BUFFER_SHIFT;
+	const unsigned char *b = ur.bufs->buf(bid);
+	const struct io_uring_recvmsg_out* out = (const struct io_uring_recvmsg_out*)b;
+	const unsigned char *name = b + sizeof(struct io_uring_recvmsg_out);
+	const unsigned char *payload = name + ur.msg.msg_namelen + ur.msg.msg_controllen;
+	const size_t bytes_recvd = out->payloadlen;
+	if (!halt && bytes_recvd && !(out->flags & MSG_TRUNC))
+	  {
+	    if (ur.n >= batch.size())
+	      uring_deliver();
+	    PacketFrom::SPtr& pf = batch[ur.n];
+	    if (!pf)
+	      pf.reset(new PacketFrom());
+	    frame_context.prepare(pf->buf);
+	    if (bytes_recvd <= frame_context.remaining_payload(pf->buf))
+	      {
+		std::memcpy(pf->buf.data(), payload, bytes_recvd);
+		pf->buf.set_size(bytes_recvd);
+		const size_t namelen = std::min(size_t(out->namelen), size_t(ur.msg.msg_namelen));
+		std::memcpy(pf->sender_endpoint.data(), name, namelen);
+		pf->sender_endpoint.resize(namelen);
+		OPENVPN_LOG_UDPLINK_VERBOSE("UDP[" << bytes_recvd << "] from " << pf->sender_endpoint);
+		stats->inc_stat(SessionStats::BYTES_IN, bytes_recvd);
+		stats->inc_stat(SessionStats::PACKETS_IN, 1);
+		++ur.n;
+		uring->flush_at_end(&ur);
+	      }
+	  }
+	ur.bufs->recycle(bid);
+      }
+
+      void uring_deliver()
+      {
+	UringRecv& ur = *uring_recv;
+	const size_t n = ur.n;
+	ur.n = 0;
+	if (n && !halt)
+	  {
+	    OPENVPN_PERF_BATCH(stats, TRANSPORT_RECV_BATCH, n);
+	    const Time::Batch time_batch; // one timestamp for the burst
+#ifdef OPENVPN_GREMLIN
+	    if (gremlin)
+	      {
+		for (size_t i = 0; i < n; ++i)
+		  gremlin_recv(batch[i]);
+	      }
+	    else
+#endif
+	    read_handler->udp_read_handler_batch(batch, n);
+	  }
+      }
+
+      void uring_recv_flush()
+      {
+	UringRecv& ur = *uring_recv;
+	uring_deliver();
+	if (ur.armed)
+	  return;
+	if (!halt && ur.rearm)
+	  uring_arm();
+	else if (!halt && uring_fallback)
+	  {
+	    uring_release();
+	    queue_read_batch();
+	  }
+	else
+	  uring_release();
+      }
+
+      // Drop io_uring state once nothing is in flight.  Deferred, since
+      // this can release the last reference to the link.
+      void uring_release()
+      {
+	UringRecv& ur = *uring_recv;
+	if (ur.hold)
+	  {
+	    Ptr self = std::move(ur.hold);
+	    asio::post(uring->context(), [self=std::move(self)]()
+                       {
+                         if (self->uring_recv && !self->uring_recv->armed)
+                           {
+                             self->uring_recv.reset();
+                             self->uring->detach();
+                             self->uring.reset();
+                           }
+                       });
+	  }
+      }
+
+      // Submit the send queue as one SENDMSG per packet.
+      void uring_flush_send_queue(const size_t n)
+      {
+	std::unique_ptr<UringSend> us(new UringSend(uring, stats));
+	us->entries.resize(n);
+	for (size_t i = 0; i < n; ++i)
+	  std::swap(us->entries[i], send_queue[i]);
+	us->msgs.resize(n);
+	us->iov.resize(n);
+	size_t i;
+	for (i = 0; i < n; ++i)
+	  {
+	    struct io_uring_sqe *sqe = uring->get_sqe();
+	    if (!sqe)
+	      {
+		OPENVPN_LOG_UDPLINK_ERROR("UDP io_uring submission queue full");
+		OPENVPN_USDT2(udp_send_error, EAGAIN, us->entries[i].buf.size());
+		stats->error(Error::NETWORK_SEND_ERROR);
+		break;
+	      }
+	    SendQueueEntry& e = us->entries[i];
+	    us->iov[i].iov_base = e.buf.data();
+	    us->iov[i].iov_len = e.buf.size();
+	    struct msghdr& h = us->msgs[i];
+	    std::memset(&h, 0, sizeof(h));
+	    h.msg_name = e.has_endpoint ? e.endpoint.data() : nullptr;
+	    h.msg_namelen = e.has_endpoint ? e.endpoint.size() : 0;
+	    h.msg_iov = &us->iov[i];
+	    h.msg_iovlen = 1;
+	    if (e.tos)
+	      set_tos_cmsg(h, e.control, e.tos);
+	    sqe->opcode = IORING_OP_SENDMSG;
+	    sqe->fd = socket.native_handle();
+	    sqe->addr = (std::uint64_t)&h;
+	    sqe->len = 1;
+	    sqe->user_data = IOUring::user_data(us.get(), 0);
+	  }
+	us->pending = i;
+	if (i)
+	  us.release();
+      }
+#endif
+
+      int do_send(const Buffer& buf, const AsioEndpoint* endpoint, const unsigned int tos = 0)
+      {
+	if (!halt)
+	  {
+	    OPENVPN_PERF_TIMER(stats, TRANSPORT_SEND);
+#ifdef OPENVPN_UDPLINK_HAVE_MMSG
+	    if (tos && tos_enabled)
+	      return do_send_tos(buf, endpoint, tos);
+#endif
 	    try {
 	      const size_t wrote = endpoint
 		? socket.send_to(buf.const_buffers_1(), *endpoint)
@@ -194,13 +972,20 @@ namespace openvpn {
 	      else
 		{
 		  OPENVPN_LOG_UDPLINK_ERROR("UDP partial send error");
+		  OPENVPN_USDT2(udp_send_error, 0, buf.size());
 		  stats->error(Error::NETWORK_SEND_ERROR);
 		  return SEND_PARTIAL;
 		}
 	    }
 	    catch (asio::system_error& e)
 	      {
+#ifdef OPENVPN_UDPLINK_HAVE_MMSG
+		if ((e.code() == asio::error::no_buffer_space || e.code() == asio::error::would_block)
+		    && buftune.defined())
+		  buftune.send_full();
+#endif
 		OPENVPN_LOG_UDPLINK_ERROR("UDP send error: " << e.what());
+		OPENVPN_USDT2(udp_send_error, e.code().value(), buf.size());
 		stats->error(Error::NETWORK_SEND_ERROR);
 		return e.code().value();
 	      }
@@ -209,6 +994,44 @@ namespace openvpn {
 	  return SEND_SOCKET_HALTED;
       }
 
+#ifdef OPENVPN_UDPLINK_HAVE_MMSG
+      int do_send_tos(const Buffer& buf, const AsioEndpoint* endpoint, const unsigned int tos)
+      {
+	CmsgControl control;
+	struct iovec iov;
+	iov.iov_base = const_cast<unsigned char*>(buf.c_data());
+	iov.iov_len = buf.size();
+	struct msghdr h = {};
+	h.msg_name = endpoint ? const_cast<AsioEndpoint*>(endpoint)->data() : nullptr;
+	h.msg_namelen = endpoint ? endpoint->size() : 0;
+	h.msg_iov = &iov;
+	h.msg_iovlen = 1;
+	set_tos_cmsg(h, control, tos);
+	ssize_t status;
+	do {
+	  status = ::sendmsg(socket.native_handle(), &h, 0);
+	} while (status < 0 && errno == EINTR);
+	if (status < 0)
+	  {
+	    const int eno = errno;
+	    if ((eno == EAGAIN || eno == EWOULDBLOCK || eno == ENOBUFS) && buftune.defined())
+	      buftune.send_full();
+	    OPENVPN_LOG_UDPLINK_ERROR("UDP send error: " << std::strerror(eno));
+	    OPENVPN_USDT2(udp_send_error, eno, buf.size());
+	    stats->error(Error::NETWORK_SEND_ERROR);
+	    return eno;
+	  }
+	stats->inc_stat(SessionStats::BYTES_OUT, status);
+	stats->inc_stat(SessionStats::PACKETS_OUT, 1);
+	if (size_t(status) == buf.size())
+	  return 0;
+	OPENVPN_LOG_UDPLINK_ERROR("UDP partial send error");
+	OPENVPN_USDT2(udp_send_error, 0, buf.size());
+	stats->error(Error::NETWORK_SEND_ERROR);
+	return SEND_PARTIAL;
+      }
+#endif
+
 #ifdef OPENVPN_GREMLIN
       void gremlin_send(const Buffer& buf, const AsioEndpoint* endpoint)
       {
@@ -218,15 +1041,16 @@ namespace openvpn {
 	gremlin->send_queue([self=Ptr(this), buf=BufferAllocated(buf, 0), ep=std::move(ep)]() mutable {
 	    if (!self->halt)
 	      self->do_send(buf, ep.get());
-	  });
+	  }, buf.size());
       }
 
       void gremlin_recv(PacketFrom::SPtr& pfp)
       {
+	const size_t size = pfp->buf.size();
 	gremlin->recv_queue([self=Ptr(this), pfp=std::move(pfp)]() mutable {
 	    if (!self->halt)
 	      self->read_handler->udp_read_handler(pfp);
-	  });
+	  }, size);
       }
 #endif
 
@@ -236,6 +1060,116 @@ namespace openvpn {
       Frame::Context frame_context;
       SessionStats::Ptr stats;
 
+#ifdef OPENVPN_UDPLINK_HAVE_MMSG
+      PacketFromBatch batch;
+      std::vector<struct mmsghdr> batch_msgs;
+      std::vector<struct iovec> batch_iov;
+      std::vector<CmsgControl> batch_control; // when tos_enabled
+
+      struct SendQueueEntry
+      {
+	BufferAllocated buf;
+	AsioEndpoint endpoint;
+	bool has_endpoint = false;
+	unsigned int tos = 0;
+	CmsgControl control;
+      };
+
+      std::vector<SendQueueEntry> send_queue;
+      std::vector<struct mmsghdr> send_msgs;
+      std::vector<struct iovec> send_iov;
+      size_t send_queue_size = 0;
+      size_t send_queue_max = 0;
+      bool send_flush_pending = false;
+      bool send_wait_pending = false; // waiting for the socket to be writable
+      bool send_gso = false;
+      bool tos_enabled = false;
+      bool tos_v6 = false;
+      SockBufTune buftune;
+#endif
+
+#ifdef OPENVPN_UDPLINK_HAVE_URING
+      struct UringRecv : public IOUring::Sink
+      {
+	UringRecv(Link* link_arg, IOUring::BufRing* bufs_arg)
+	  : IOUring::Sink(complete_cb, flush_cb),
+	    link(link_arg),
+	    bufs(bufs_arg)
+	{
+	  std::memset(&msg, 0, sizeof(msg));
+	  msg.msg_namelen = sizeof(struct sockaddr_in6);
+	}
+
+	static void complete_cb(IOUring::Sink* sink, const struct io_uring_cqe& cqe, const unsigned int)
+	{
+	  UringRecv* self = static_cast<UringRecv*>(sink);
+	  self->link->uring_recv_complete(cqe);
+	}
+
+	static void flush_cb(IOUring::Sink* sink)
+	{
+	  UringRecv* self = static_cast<UringRecv*>(sink);
+	  self->link->uring_recv_flush();
+	}
+
+	Link* link;
+	std::unique_ptr<IOUring::BufRing> bufs;
+	struct msghdr msg;
+	Ptr hold;           // keeps the link alive while armed
+	size_t n = 0;       // packets gathered in batch
+	bool armed = false;
+	bool received = false;
+	bool rearm = false;
+      };
+
+      // A flushed send queue, owned by io_uring until the last
+      // SENDMSG completes.
+      struct UringSend : public IOUring::Sink
+      {
+	UringSend(const IOUring::Ptr& uring_arg, const SessionStats::Ptr& stats_arg)
+	  : IOUring::Sink(complete_cb),
+	    uring(uring_arg),
+	    stats(stats_arg)
+	{
+	  uring->attach();
+	}
+
+	~UringSend()
+	{
+	  uring->detach();
+	}
+
+	static void complete_cb(IOUring::Sink* sink, const struct io_uring_cqe& cqe, const unsigned int)
+	{
+	  UringSend* self = static_cast<UringSend*>(sink);
+	  if (cqe.res < 0)
+	    {
+	      OPENVPN_LOG_UDPLINK_ERROR("UDP io_uring send error: " << std::strerror(-cqe.res));
+	      OPENVPN_USDT2(udp_send_error, -cqe.res, 0);
+	      self->stats->error(Error::NETWORK_SEND_ERROR);
+	    }
+	  else
+	    {
+	      self->stats->inc_stat(SessionStats::BYTES_OUT, cqe.res);
+	      self->stats->inc_stat(SessionStats::PACKETS_OUT, 1);
+	    }
+	  if (!--self->pending)
+	    delete self;
+	}
+
+	std::vector<SendQueueEntry> entries;
+	std::vector<struct msghdr> msgs;
+	std::vector<struct iovec> iov;
+	IOUring::Ptr uring;
+	SessionStats::Ptr stats;
+	size_t pending = 0;
+      };
+
+      IOUring::Ptr uring;
+      std::unique_ptr<UringRecv> uring_recv;
+      bool uring_fallback = false;
+#endif
+
 #ifdef OPENVPN_GREMLIN
       std::unique_ptr<Gremlin::SendRecvQueue> gremlin;
 #endif
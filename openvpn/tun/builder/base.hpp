@@ -23,8 +23,19 @@
 #define OPENVPN_TUN_BUILDER_BASE_H
 
 #include <string>
+#include <cstddef> // for size_t
 
 namespace openvpn {
+
+  // One IP packet passed across the packet-batch interface,
+  // family is AF_INET or AF_INET6.
+  struct TunBuilderPacket
+  {
+    const unsigned char* data;
+    size_t size;
+    int family;
+  };
+
   class TunBuilderBase
   {
   public:
@@ -216,6 +227,27 @@ namespace openvpn {
       return -1;
     }
 
+    // Optional alternative to tun_builder_establish() for platforms
+    // where the tunnel has no file descriptor (such as iOS
+    // NEPacketTunnelFlow).  Return true to exchange packets in bursts:
+    // the core sends them with tun_builder_write_packets() and the
+    // app passes packets it read from the tunnel to
+    // OpenVPNClient::tun_read_packets().  Return false (the default)
+    // to fall back to tun_builder_establish().
+    // Sessions established this way are never persisted.
+    virtual bool tun_builder_establish_packets()
+    {
+      return false;
+    }
+
+    // Called in packet-batch mode with a burst of n packets to be
+    // written to the tunnel.  The packet buffers are owned by the
+    // core and are only valid for the duration of the call.
+    virtual bool tun_builder_write_packets(const TunBuilderPacket* packets, size_t n)
+    {
+      return false;
+    }
+
     // Return true if tun interface may be persisted, i.e. rolled
     // into a new session with properties untouched.  This method
     // is only called after all other tests of persistence
@@ -691,34 +691,14 @@ namespace openvpn {
 
     std::string to_string() const
     {
-      std::ostringstream os;
-      os << "Session Name: " << session_name << std::endl;
-      os << "Layer: " << layer.str() << std::endl;
-      if (mtu)
-	os << "MTU: " << mtu << std::endl;
-      os << "Remote Address: " << remote_address.to_string() << std::endl;
-      render_list(os, "Tunnel Addresses", tunnel_addresses);
-      os << "Reroute Gateway: " << reroute_gw.to_string() << std::endl;
-      os << "Block IPv6: " << (block_ipv6 ? "yes" : "no") << std::endl;
-      if (route_metric_default >= 0)
-	os << "Route Metric Default: " << route_metric_default << std::endl;
-      render_list(os, "Add Routes", add_routes);
-      render_list(os, "Exclude Routes", exclude_routes);
-      render_list(os, "DNS Servers", dns_servers);
-      render_list(os, "Search Domains", search_domains);
-      if (!adapter_domain_suffix.empty())
-	os << "Adapter Domain Suffix: " << adapter_domain_suffix << std::endl;
-      if (!proxy_bypass.empty())
-	render_list(os, "Proxy Bypass", proxy_bypass);
-      if (proxy_auto_config_url.defined())
-	os << "Proxy Auto Config URL: " << proxy_auto_config_url.to_string() << std::endl;
-      if (http_proxy.defined())
-	os << "HTTP Proxy: " << http_proxy.to_string() << std::endl;
-      if (https_proxy.defined())
-	os << "HTTPS Proxy: " << https_proxy.to_string() << std::endl;
-      if (!wins_servers.empty())
-	render_list(os, "WINS Servers", wins_servers);
-      return os.str();
+      return to_string_(true);
+    }
+
+    // Like to_string(), but leave out add_routes and exclude_routes,
+    // so that configs differing only in their routes compare equal.
+    std::string to_string_excluding_routes() const
+    {
+      return to_string_(false);
     }
 
 #ifdef HAVE_JSONCPP
@@ -808,6 +788,41 @@ namespace openvpn {
     std::vector<WINSServer> wins_servers;  // Windows WINS servers
 
   private:
+    std::string to_string_(const bool routes) const
+    {
+      std::ostringstream os;
+      os << "Session Name: " << session_name << std::endl;
+      os << "Layer: " << layer.str() << std::endl;
+      if (mtu)
+	os << "MTU: " << mtu << std::endl;
+      os << "Remote Address: " << remote_address.to_string() << std::endl;
+      render_list(os, "Tunnel Addresses", tunnel_addresses);
+      os << "Reroute Gateway: " << reroute_gw.to_string() << std::endl;
+      os << "Block IPv6: " << (block_ipv6 ? "yes" : "no") << std::endl;
+      if (route_metric_default >= 0)
+	os << "Route Metric Default: " << route_metric_default << std::endl;
+      if (routes)
+	{
+	  render_list(os, "Add Routes", add_routes);
+	  render_list(os, "Exclude Routes", exclude_routes);
+	}
+      render_list(os, "DNS Servers", dns_servers);
+      render_list(os, "Search Domains", search_domains);
+      if (!adapter_domain_suffix.empty())
+	os << "Adapter Domain Suffix: " << adapter_domain_suffix << std::endl;
+      if (!proxy_bypass.empty())
+	render_list(os, "Proxy Bypass", proxy_bypass);
+      if (proxy_auto_config_url.defined())
+	os << "Proxy Auto Config URL: " << proxy_auto_config_url.to_string() << std::endl;
+      if (http_proxy.defined())
+	os << "HTTP Proxy: " << http_proxy.to_string() << std::endl;
+      if (https_proxy.defined())
+	os << "HTTPS Proxy: " << https_proxy.to_string() << std::endl;
+      if (!wins_servers.empty())
+	render_list(os, "WINS Servers", wins_servers);
+      return os.str();
+    }
+
     template <typename LIST>
     static void render_list(std::ostream& os, const std::string& title, const LIST& list)
     {
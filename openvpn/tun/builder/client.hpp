@@ -32,6 +32,7 @@
 #include <openvpn/tun/persist/tunpersist.hpp>
 #include <openvpn/common/scoped_fd.hpp>
 #include <openvpn/tun/tunio.hpp>
+#include <openvpn/tun/builder/pktbridge.hpp>
 
 namespace openvpn {
   namespace TunBuilderClient {
@@ -91,6 +92,7 @@ namespace openvpn {
       EmulateExcludeRouteFactory::Ptr eer_factory;
       TunPersist::Ptr tun_persist;
       TunBuilderBase* builder;
+      PacketBridge::Ptr packet_bridge; // for packet-batch mode
 
       static Ptr new_obj()
       {
@@ -116,7 +118,7 @@ namespace openvpn {
     class Client : public TunClient
     {
       friend class ClientConfig;  // calls constructor
-      friend class TunIO<Client*, PacketFrom, asio::posix::stream_descriptor>;  // calls tun_read_handler
+      friend class TunIO<Client*, PacketFrom, asio::posix::stream_descriptor>;  // calls tun_read_handler, tun_read_handler_batch
 
       typedef Tun<Client*> TunImpl;
 
@@ -126,6 +128,7 @@ namespace openvpn {
 	if (!impl)
 	  {
 	    halt = false;
+	    packet_mode = false;
 	    if (config->tun_persist)
 	      tun_persist = config->tun_persist; // long-term persistent
 	    else
@@ -160,7 +163,15 @@ namespace openvpn {
 		  TunProp::configure_builder(tb, state.get(), config->stats.get(), server_addr,
 					     config->tun_prop, opt, config->eer_factory.get(), false);
 
-		  // start tun
+		  // start tun, preferring packet-batch mode if the builder supports it
+		  if (config->packet_bridge && tb->tun_builder_establish_packets())
+		    {
+		      packet_mode = true;
+		      config->packet_bridge->attach(io_context, parent, config->frame, config->stats);
+		      OPENVPN_LOG("TunBuilder: packet-batch mode");
+		      parent.tun_connected();
+		      return;
+		    }
 		  sd = tb->tun_builder_establish();
 		}
 
@@ -199,13 +210,27 @@ namespace openvpn {
 
       virtual bool tun_send(BufferAllocated& buf) override
       {
+	if (packet_mode)
+	  {
+	    BufferAllocated* bufs[1] = { &buf };
+	    return write_packets(bufs, 1);
+	  }
 	return send(buf);
       }
 
+      virtual bool tun_send_batch(BufferAllocated** bufs, const size_t n) override
+      {
+	if (packet_mode)
+	  return write_packets(bufs, n);
+	return TunClient::tun_send_batch(bufs, n);
+      }
+
       virtual std::string tun_name() const override
       {
 	if (impl)
 	  return impl->name();
+	else if (packet_mode)
+	  return "tun";
 	else
 	  return "UNDEF_TUN";
       }
@@ -259,6 +284,7 @@ namespace openvpn {
 	   config(config_arg),
 	   parent(parent_arg),
 	   halt(false),
+	   packet_mode(false),
 	   state(new TunProp::State())
       {
       }
@@ -271,11 +297,38 @@ namespace openvpn {
 	  return false;
       }
 
+      // pass a burst of outgoing packets to the builder in packet-batch mode
+      bool write_packets(BufferAllocated* const* bufs, const size_t n)
+      {
+	if (halt)
+	  return false;
+	write_pkts.resize(n);
+	for (size_t i = 0; i < n; ++i)
+	  {
+	    const Buffer& buf = *bufs[i];
+	    TunBuilderPacket& p = write_pkts[i];
+	    p.data = buf.c_data();
+	    p.size = buf.size();
+	    p.family = (buf.size() && IPHeader::version(buf[0]) == 6) ? AF_INET6 : AF_INET;
+	  }
+	return config->builder->tun_builder_write_packets(write_pkts.data(), n);
+      }
+
       void tun_read_handler(PacketFrom::SPtr& pfp) // called by TunImpl
       {
 	parent.tun_recv(pfp->buf);
       }
 
+      void tun_read_handler_batch(TunImpl::PacketFromBatch& batch, const size_t n) // called by TunImpl
+      {
+	if (halt)
+	  return;
+	batch_ptrs.resize(n);
+	for (size_t i = 0; i < n; ++i)
+	  batch_ptrs[i] = &batch[i]->buf;
+	parent.tun_recv_batch(batch_ptrs.data(), n);
+      }
+
       void tun_error_handler(const Error::Type errtype, // called by TunImpl
 			     const asio::error_code* error)
       {
@@ -290,6 +343,8 @@ namespace openvpn {
 	    // stop tun
 	    if (impl)
 	      impl->stop();
+	    if (packet_mode)
+	      config->packet_bridge->detach();
 	    tun_persist.reset();
 	  }
       }
@@ -301,6 +356,9 @@ namespace openvpn {
       TunClientParent& parent;
       TunImpl::Ptr impl;
       bool halt;
+      bool packet_mode;
+      std::vector<BufferAllocated*> batch_ptrs;
+      std::vector<TunBuilderPacket> write_pkts;
       TunProp::State::Ptr state;
     };
 
@@ -0,0 +1,180 @@
+//    OpenVPN -- An application to securely tunnel IP networks
+//               over a single port, with support for SSL/TLS-based
+//               session authentication and key exchange,
+//               packet encryption, packet authentication, and
+//               packet compression.
+//
+//    Copyright (C) 2012-2016 OpenVPN Technologies, Inc.
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU Affero General Public License Version 3
+//    as published by the Free Software Foundation.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU Affero General Public License for more details.
+//
+//    You should have received a copy of the GNU Affero General Public License
+//    along with this program in the COPYING file.
+//    If not, see <http://www.gnu.org/licenses/>.
+
+// Thread-safe bridge that carries packets read by the app in
+// packet-batch mode (see TunBuilderBase::tun_builder_establish_packets)
+// into the VPN core, one io_context crossing per burst.
+
+#ifndef OPENVPN_TUN_BUILDER_PKTBRIDGE_H
+#define OPENVPN_TUN_BUILDER_PKTBRIDGE_H
+
+#include <vector>
+#include <memory>
+#include <mutex>
+
+#include <asio.hpp>
+
+#include <openvpn/common/rc.hpp>
+#include <openvpn/buffer/buffer.hpp>
+#include <openvpn/frame/frame.hpp>
+#include <openvpn/error/error.hpp>
+#include <openvpn/log/sessionstats.hpp>
+#include <openvpn/tun/builder/base.hpp>
+#include <openvpn/tun/client/tunbase.hpp>
+
+namespace openvpn {
+  namespace TunBuilderClient {
+
+    class PacketBridge : public RC<thread_safe_refcount>
+    {
+    public:
+      typedef RCPtr<PacketBridge> Ptr;
+
+      // Bind to an established tun session, called on the io_context thread.
+      void attach(asio::io_context& io_context_arg,
+		  TunClientParent& parent_arg,
+		  const Frame::Ptr& frame_arg,
+		  const SessionStats::Ptr& stats_arg)
+      {
+	std::lock_guard<std::mutex> lock(mutex);
+	io_context = &io_context_arg;
+	parent = &parent_arg;
+	frame = frame_arg;
+	stats = stats_arg;
+      }
+
+      // Unbind, called on the io_context thread.  Packets still
+      // queued are dropped when the posted delivery runs.
+      void detach()
+      {
+	std::lock_guard<std::mutex> lock(mutex);
+	parent = nullptr;
+      }
+
+      // Copy a burst of n packets into pooled buffers and queue them
+      // for the VPN core.  May be called from any thread, returns
+      // false if no tun session is attached.
+      bool packets_in(const TunBuilderPacket* packets, const size_t n)
+      {
+	std::lock_guard<std::mutex> lock(mutex);
+	if (!parent)
+	  return false;
+	const Frame::Context& fc = (*frame)[Frame::READ_TUN];
+	for (size_t i = 0; i < n; ++i)
+	  {
+	    const TunBuilderPacket& p = packets[i];
+	    BufferPtr buf = take_buffer();
+	    fc.prepare(*buf);
+	    if (!p.size || p.size > fc.remaining_payload(*buf))
+	      {
+		++dropped;
+		pool.push_back(std::move(buf));
+		continue;
+	      }
+	    buf->write(p.data, p.size);
+	    pending.push_back(std::move(buf));
+	  }
+	if (!posted && (!pending.empty() || dropped))
+	  {
+	    posted = true;
+	    asio::post(*io_context, [self=Ptr(this)]()
+		       {
+			 self->deliver();
+		       });
+	  }
+	return true;
+      }
+
+    private:
+      typedef std::unique_ptr<BufferAllocated> BufferPtr;
+
+      enum {
+	POOL_MAX = 256, // max idle buffers retained
+      };
+
+      BufferPtr take_buffer()
+      {
+	if (pool.empty())
+	  return BufferPtr(new BufferAllocated());
+	BufferPtr buf = std::move(pool.back());
+	pool.pop_back();
+	return buf;
+      }
+
+      // runs on the io_context thread
+      void deliver()
+      {
+	TunClientParent* p;
+	size_t drop;
+	{
+	  std::lock_guard<std::mutex> lock(mutex);
+	  batch.swap(pending);
+	  posted = false;
+	  p = parent;
+	  drop = dropped;
+	  dropped = 0;
+	}
+
+	if (p)
+	  {
+	    while (drop--)
+	      stats->error(Error::TUN_READ_ERROR);
+	    if (batch.size() == 1)
+	      p->tun_recv(*batch[0]);
+	    else if (!batch.empty())
+	      {
+		ptrs.resize(batch.size());
+		for (size_t i = 0; i < batch.size(); ++i)
+		  ptrs[i] = batch[i].get();
+		p->tun_recv_batch(ptrs.data(), ptrs.size());
+	      }
+	  }
+
+	// recycle buffers
+	std::lock_guard<std::mutex> lock(mutex);
+	for (auto& b : batch)
+	  {
+	    if (pool.size() >= POOL_MAX)
+	      break;
+	    pool.push_back(std::move(b));
+	  }
+	batch.clear();
+      }
+
+      std::mutex mutex;
+      asio::io_context* io_context = nullptr;
+      TunClientParent* parent = nullptr;
+      Frame::Ptr frame;
+      SessionStats::Ptr stats;
+      std::vector<BufferPtr> pool;
+      std::vector<BufferPtr> pending;
+      size_t dropped = 0;
+      bool posted = false;
+
+      // only touched by deliver()
+      std::vector<BufferPtr> batch;
+      std::vector<BufferAllocated*> ptrs;
+    };
+
+  }
+}
+
+#endif
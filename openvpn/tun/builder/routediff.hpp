@@ -0,0 +1,186 @@
+//    OpenVPN -- An application to securely tunnel IP networks
+//               over a single port, with support for SSL/TLS-based
+//               session authentication and key exchange,
+//               packet encryption, packet authentication, and
+//               packet compression.
+//
+//    Copyright (C) 2012-2016 OpenVPN Technologies, Inc.
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU Affero General Public License Version 3
+//    as published by the Free Software Foundation.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU Affero General Public License for more details.
+//
+//    You should have received a copy of the GNU Affero General Public License
+//    along with this program in the COPYING file.
+//    If not, see <http://www.gnu.org/licenses/>.
+
+// Route diffing for incremental application of TunBuilderCapture configs
+
+#ifndef OPENVPN_TUN_BUILDER_ROUTEDIFF_H
+#define OPENVPN_TUN_BUILDER_ROUTEDIFF_H
+
+#include <string>
+#include <vector>
+#include <utility>
+#include <unordered_map>
+#include <unordered_set>
+
+#include <openvpn/common/action.hpp>
+#include <openvpn/tun/builder/capture.hpp>
+
+namespace openvpn {
+
+  // Tracks the routes installed from a TunBuilderCapture, together
+  // with the action that removes each one.  When a new capture
+  // differs from the installed one only in its routes, diff()
+  // yields just the routes to add and delete, so that tun setup
+  // code can apply the change without tearing down the interface.
+  class TunBuilderRouteDiff
+  {
+  public:
+    enum Type {
+      ADD_ROUTE=0,    // TunBuilderCapture::add_routes
+      EXCLUDE_ROUTE,  // TunBuilderCapture::exclude_routes
+      N_TYPES,
+    };
+
+    struct Delta
+    {
+      // routes to install, pointing into the capture passed to diff()
+      std::vector<std::pair<Type, const TunBuilderCapture::Route*>> add;
+
+      // keys of installed routes to remove
+      std::vector<std::pair<Type, std::string>> del;
+
+      size_t unchanged = 0;
+
+      bool empty() const
+      {
+	return add.empty() && del.empty();
+      }
+
+      std::string to_string() const
+      {
+	return "ROUTE DIFF: add=" + std::to_string(add.size())
+	  + " delete=" + std::to_string(del.size())
+	  + " unchanged=" + std::to_string(unchanged);
+      }
+    };
+
+    // Start tracking a newly established config.  context describes
+    // platform state that the route commands depend on, such as the
+    // default gateway, and must match for a later diff() to succeed.
+    void reset(const TunBuilderCapture& pull, const std::string& context)
+    {
+      clear();
+      base = pull.to_string_excluding_routes() + context;
+      defined_ = true;
+    }
+
+    // Record a route of pull as installed.  destroy may be
+    // undefined if no action was needed for the route.
+    void add(const Type type, const TunBuilderCapture::Route& route, const Action::Ptr& destroy)
+    {
+      routes[type].emplace(route.to_string(), destroy);
+    }
+
+    // Compute the changes needed to go from the installed routes
+    // to those of pull.  Returns false if nothing is installed, or
+    // if pull or context differ in more than the routes.
+    bool diff(const TunBuilderCapture& pull,
+	      const std::string& context,
+	      Delta& delta) const
+    {
+      delta = Delta();
+      if (!defined_ || pull.to_string_excluding_routes() + context != base)
+	return false;
+      diff_type(ADD_ROUTE, pull.add_routes, delta);
+      diff_type(EXCLUDE_ROUTE, pull.exclude_routes, delta);
+      return true;
+    }
+
+    // Forget an installed route, returning its destroy action
+    Action::Ptr release(const Type type, const std::string& key)
+    {
+      Action::Ptr ret;
+      RouteMap& rm = routes[type];
+      auto i = rm.find(key);
+      if (i != rm.end())
+	{
+	  ret = std::move(i->second);
+	  rm.erase(i);
+	}
+      return ret;
+    }
+
+    // Forget all installed routes, moving their destroy actions to al
+    template <typename ACTIONS>
+    void release_all(ACTIONS& al)
+    {
+      for (auto &rm : routes)
+	for (auto &e : rm)
+	  al.add(e.second);
+      clear();
+    }
+
+    // Remove all installed routes
+    void destroy(std::ostream& os)
+    {
+      ActionList al;
+      release_all(al);
+      al.execute(os);
+    }
+
+    void clear()
+    {
+      for (auto &rm : routes)
+	rm.clear();
+      base.clear();
+      defined_ = false;
+    }
+
+    bool defined() const
+    {
+      return defined_;
+    }
+
+  private:
+    typedef std::unordered_map<std::string, Action::Ptr> RouteMap;
+
+    void diff_type(const Type type,
+		   const std::vector<TunBuilderCapture::Route>& next,
+		   Delta& delta) const
+    {
+      const RouteMap& rm = routes[type];
+      std::unordered_set<std::string> keys;
+      keys.reserve(next.size());
+      for (auto &r : next)
+	{
+	  auto k = keys.insert(r.to_string());
+	  if (!k.second)
+	    continue; // duplicate route in pull
+	  if (rm.find(*k.first) != rm.end())
+	    ++delta.unchanged;
+	  else
+	    delta.add.emplace_back(type, &r);
+	}
+      for (auto &e : rm)
+	{
+	  if (keys.find(e.first) == keys.end())
+	    delta.del.emplace_back(type, e.first);
+	}
+    }
+
+    std::string base;
+    RouteMap routes[N_TYPES];
+    bool defined_ = false;
+  };
+
+}
+
+#endif
@@ -51,6 +51,17 @@ namespace openvpn {
 			    Config* config,
 			    Stop* stop,
 			    std::ostream& os) = 0;
+
+      // Reconfigure an established tun for pull by adding and
+      // deleting only the routes that changed.  Returns false if
+      // pull differs in more than its routes, in which case the
+      // caller must tear down and establish() again.
+      virtual bool update_routes(const TunBuilderCapture& pull,
+				 Config* config,
+				 std::ostream& os)
+      {
+	return false;
+      }
     };
 
     struct Factory : public RC<thread_unsafe_refcount>
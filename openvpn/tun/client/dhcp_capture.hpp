@@ -23,6 +23,7 @@
 #define OPENVPN_TUN_CLIENT_DHCP_CAPTURE_H
 
 #include <cstring>
+#include <cstddef> // for offsetof
 
 #include <openvpn/common/socktypes.hpp>
 #include <openvpn/buffer/buffer.hpp>
@@ -47,17 +48,29 @@ namespace openvpn {
       reset();
     }
 
+    // Cheap pre-check of the fixed offsets of an Ethernet/IPv4/UDP
+    // frame from the DHCP server port to the client port, so that
+    // ordinary data frames can be passed by without calling mod_reply.
+    static bool candidate(const Buffer& buf)
+    {
+      if (buf.size() < sizeof(DHCPPacket))
+	return false;
+      const std::uint8_t* p = buf.c_data();
+      return p[ETHERTYPE_OFF] == 0x08 && p[ETHERTYPE_OFF+1] == 0x00
+	&& p[VERSION_LEN_OFF] == 0x45 // IPv4 without options, as assumed by DHCPPacket
+	&& p[PROTOCOL_OFF] == IPHeader::UDP
+	&& p[UDP_SOURCE_OFF] == 0 && p[UDP_SOURCE_OFF+1] == DHCP::BOOTPS_PORT
+	&& p[UDP_DEST_OFF] == 0 && p[UDP_DEST_OFF+1] == DHCP::BOOTPC_PORT;
+    }
+
     // returns true when router addr and DNS servers are captured
     bool mod_reply(Buffer& buf)
     {
-      if (buf.size() < sizeof(DHCPPacket))
+      if (!candidate(buf))
 	return false;
 
       DHCPPacket* dhcp = (DHCPPacket*)buf.data();
-      if (dhcp->ip.protocol == IPHeader::UDP
-	  && dhcp->udp.source == htons(DHCP::BOOTPS_PORT)
-	  && dhcp->udp.dest == htons(DHCP::BOOTPC_PORT)
-	  && dhcp->dhcp.op == DHCP::BOOTREPLY)
+      if (dhcp->dhcp.op == DHCP::BOOTREPLY)
 	{
 	  const unsigned int optlen = buf.size() - sizeof(DHCPPacket);
 	  const int message_type = dhcp_message_type(dhcp, optlen);
@@ -130,6 +143,14 @@ namespace openvpn {
     }
 
   private:
+    enum : size_t {
+      ETHERTYPE_OFF = offsetof(EthHeader, ethertype),
+      VERSION_LEN_OFF = sizeof(EthHeader) + offsetof(IPHeader, version_len),
+      PROTOCOL_OFF = sizeof(EthHeader) + offsetof(IPHeader, protocol),
+      UDP_SOURCE_OFF = sizeof(EthHeader) + sizeof(IPHeader) + offsetof(UDPHeader, source),
+      UDP_DEST_OFF = sizeof(EthHeader) + sizeof(IPHeader) + offsetof(UDPHeader, dest),
+    };
+
     void reset()
     {
       props->reset_tunnel_addresses();
@@ -45,6 +45,15 @@ namespace openvpn {
     virtual void set_disconnect() = 0;
     virtual bool tun_send(BufferAllocated& buf) = 0; // return true if send succeeded
 
+    // send a batch of packets, return true if all sends succeeded
+    virtual bool tun_send_batch(BufferAllocated** bufs, const size_t n)
+    {
+      bool ret = true;
+      for (size_t i = 0; i < n; ++i)
+	ret &= tun_send(*bufs[i]);
+      return ret;
+    }
+
     virtual std::string tun_name() const = 0;
 
     virtual std::string vpn_ip4() const = 0; // VPN IP addresses
@@ -60,6 +69,18 @@ namespace openvpn {
   struct TunClientParent
   {
     virtual void tun_recv(BufferAllocated& buf) = 0;
+
+    // packets read together from the tun device, empty
+    // buffers must be skipped
+    virtual void tun_recv_batch(BufferAllocated** bufs, const size_t n)
+    {
+      for (size_t i = 0; i < n; ++i)
+	{
+	  if (bufs[i]->size())
+	    tun_recv(*bufs[i]);
+	}
+    }
+
     virtual void tun_error(const Error::Type fatal_err, const std::string& err_text) = 0;
 
     // progress notifications
@@ -25,6 +25,9 @@
 #define OPENVPN_TUN_CLIENT_TUNPROP_H
 
 #include <string>
+#include <vector>
+#include <map>
+#include <tuple>
 
 #include <openvpn/common/size.hpp>
 #include <openvpn/common/rc.hpp>
@@ -33,6 +36,7 @@
 #include <openvpn/common/hostport.hpp>
 #include <openvpn/tun/builder/base.hpp>
 #include <openvpn/addr/addrpair.hpp>
+#include <openvpn/addr/routetrie.hpp>
 #include <openvpn/client/remotelist.hpp>
 #include <openvpn/client/ipverflags.hpp>
 #include <openvpn/tun/client/emuexr.hpp>
@@ -76,6 +80,11 @@ namespace openvpn {
       // for the initial connection has taken effect.
       RemoteList::Ptr remote_list;
       bool remote_bypass = false;
+
+      // If route_aggregate is true, merge pushed routes that share a
+      // target and metric into the smallest equivalent set before
+      // passing them to the tun builder.
+      bool route_aggregate = true;
     };
 
     struct State : public RC<thread_unsafe_refcount>
@@ -126,7 +135,7 @@ namespace openvpn {
 	add_remote_bypass_routes(tb, *config.remote_list, server_addr, eer.get(), quiet);
 
       // add routes
-      add_routes(tb, opt, server_addr, ipv, eer.get(), quiet);
+      add_routes(tb, opt, server_addr, ipv, eer.get(), config.route_aggregate, quiet);
 
       // emulate exclude routes
       if (eer && eer->enabled(ipv))
@@ -372,8 +381,11 @@ namespace openvpn {
 			   const IP::Addr& server_addr,
 			   const IPVerFlags& ipv,
 			   EmulateExcludeRoute* eer,
+			   const bool aggregate,
 			   const bool quiet)
     {
+      RouteAggregator agg(aggregate);
+
       // add IPv4 routes
       if (ipv.v4())
 	{
@@ -391,7 +403,7 @@ namespace openvpn {
 		    if (pair.version() != IP::Addr::V4)
 		      throw tun_prop_error("route is not IPv4");
 		    const bool add = route_target(o, 3);
-		    add_exclude_route(tb, add, pair.addr, pair.netmask.prefix_len(), metric, false, eer);
+		    agg.add(add, IP::Route(pair.addr, pair.netmask.prefix_len()), metric);
 		  }
 		  catch (const std::exception& e)
 		    {
@@ -419,7 +431,7 @@ namespace openvpn {
 		    if (pair.version() != IP::Addr::V6)
 		      throw tun_prop_error("route is not IPv6");
 		    const bool add = route_target(o, 2);
-		    add_exclude_route(tb, add, pair.addr, pair.netmask.prefix_len(), metric, true, eer);
+		    agg.add(add, IP::Route(pair.addr, pair.netmask.prefix_len()), metric);
 		  }
 		  catch (const std::exception& e)
 		    {
@@ -429,8 +441,89 @@ namespace openvpn {
 		}
 	    }
 	}
+
+      agg.apply(tb, eer, quiet);
     }
 
+    // Collects pushed routes, and, per address family, merges routes
+    // of the same target and metric.  Merging drops routes contained
+    // in other routes, which is only safe when no route of the opposite
+    // target could sit between them, so a family that has both added
+    // and excluded routes is passed through unchanged.
+    class RouteAggregator
+    {
+    public:
+      RouteAggregator(const bool enabled)
+	: enabled_(enabled)
+      {
+      }
+
+      void add(const bool add, const IP::Route& route, const int metric)
+      {
+	pending.push_back(Pending{add, metric, route});
+	mixed[route.addr.version() == IP::Addr::V6] |= add ? 1 : 2;
+      }
+
+      void apply(TunBuilderBase* tb, EmulateExcludeRoute* eer, const bool quiet)
+      {
+	std::map<std::tuple<bool, bool, int>, IP::RouteTrie<bool>> groups;
+	size_t n_in = 0;
+	for (const auto& p : pending)
+	  {
+	    const bool ipv6 = p.route.addr.version() == IP::Addr::V6;
+	    if (enabled_ && mixed[ipv6] != 3)
+	      {
+		groups[std::make_tuple(ipv6, p.add, p.metric)].insert(p.route, true);
+		++n_in;
+	      }
+	    else
+	      install(tb, p.add, p.route, p.metric, eer, quiet);
+	  }
+
+	size_t n_out = 0;
+	for (const auto& g : groups)
+	  {
+	    IP::RouteList rl;
+	    g.second.aggregate(rl);
+	    for (const auto& r : rl)
+	      install(tb, std::get<1>(g.first), r, std::get<2>(g.first), eer, quiet);
+	    n_out += rl.size();
+	  }
+
+	if (n_out < n_in && !quiet)
+	  OPENVPN_LOG("Aggregated " << n_in << " routes into " << n_out);
+      }
+
+    private:
+      static void install(TunBuilderBase* tb,
+			  const bool add,
+			  const IP::Route& route,
+			  const int metric,
+			  EmulateExcludeRoute* eer,
+			  const bool quiet)
+      {
+	try {
+	  add_exclude_route(tb, add, route.addr, route.prefix_len, metric, route.addr.version() == IP::Addr::V6, eer);
+	}
+	catch (const std::exception& e)
+	  {
+	    if (!quiet)
+	      OPENVPN_LOG("Error adding route: " << route.to_string() << " : " << e.what());
+	  }
+      }
+
+      struct Pending
+      {
+	bool add;
+	int metric;
+	IP::Route route;
+      };
+
+      const bool enabled_;
+      std::vector<Pending> pending;
+      unsigned int mixed[2] = { 0, 0 }; // [ipv6], 1=add 2=exclude
+    };
+
     static void add_remote_bypass_routes(TunBuilderBase* tb,
 					 const RemoteList& remote_list,
 					 const IP::Addr& server_addr,
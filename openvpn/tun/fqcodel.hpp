@@ -0,0 +1,281 @@
+//    OpenVPN -- An application to securely tunnel IP networks
+//               over a single port, with support for SSL/TLS-based
+//               session authentication and key exchange,
+//               packet encryption, packet authentication, and
+//               packet compression.
+//
+//    Copyright (C) 2012-2016 OpenVPN Technologies, Inc.
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU Affero General Public License Version 3
+//    as published by the Free Software Foundation.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU Affero General Public License for more details.
+//
+//    You should have received a copy of the GNU Affero General Public License
+//    along with this program in the COPYING file.
+//    If not, see <http://www.gnu.org/licenses/>.
+
+// Flow queueing with CoDel active queue management (RFC 8290) for tun
+// packets waiting on a transport that queues in user space.  Packets
+// are hashed by their inner 5-tuple into flows that are served by
+// deficit round robin, with new flows served first, and each flow
+// drops from its head once packets have waited longer than the target
+// for a whole interval (RFC 8289).  A bulk flow then builds its queue
+// in its own bucket, while interactive flows stay close to empty.
+
+#ifndef OPENVPN_TUN_FQCODEL_H
+#define OPENVPN_TUN_FQCODEL_H
+
+#include <cmath>     // for std::sqrt
+#include <algorithm> // for std::max
+#include <deque>
+#include <vector>
+
+#include <openvpn/common/size.hpp>
+#include <openvpn/buffer/buffer.hpp>
+#include <openvpn/time/time.hpp>
+#include <openvpn/ip/flowhash.hpp>
+
+namespace openvpn {
+
+  class FQCoDel
+  {
+  public:
+    struct Config
+    {
+      Config()
+	: flows(1024),
+	  quantum(1514),
+	  limit(1024),
+	  target(Time::Duration::milliseconds(5)),
+	  interval(Time::Duration::milliseconds(100))
+      {
+      }
+
+      size_t flows;            // number of flow buckets
+      size_t quantum;          // bytes a flow may send per round
+      size_t limit;            // total packets queued before dropping
+      Time::Duration target;   // acceptable standing queue delay
+      Time::Duration interval; // how long the delay may stay above target
+    };
+
+    explicit FQCoDel(const Config& config_arg)
+      : config(config_arg),
+	flows(std::max(config_arg.flows, size_t(1)))
+    {
+    }
+
+    // Queue a packet, taking over the contents of buf.  If the queue
+    // is full, a packet is dropped from the head of the longest flow.
+    void enqueue(BufferAllocated& buf, const Time& now)
+    {
+      enqueue(buf, now, IPFlow::hash(buf));
+    }
+
+    // same, with a flow hash computed by the caller
+    void enqueue(BufferAllocated& buf, const Time& now, const std::size_t flow_hash)
+    {
+      if (total >= config.limit)
+	drop_longest();
+      Flow& f = flows[flow_hash % flows.size()];
+      f.bytes += buf.size();
+      f.q.emplace_back(std::move(buf), now);
+      ++total;
+      if (!f.active)
+	{
+	  f.active = true;
+	  f.deficit = long(config.quantum);
+	  new_flows.push_back(&f);
+	}
+    }
+
+    // Move the next packet to send into buf, return false if empty.
+    bool dequeue(BufferAllocated& buf, const Time& now)
+    {
+      while (true)
+	{
+	  std::deque<Flow *>* list;
+	  if (!new_flows.empty())
+	    list = &new_flows;
+	  else if (!old_flows.empty())
+	    list = &old_flows;
+	  else
+	    return false;
+
+	  Flow* f = list->front();
+	  if (f->deficit <= 0)
+	    {
+	      f->deficit += long(config.quantum);
+	      list->pop_front();
+	      old_flows.push_back(f);
+	      continue;
+	    }
+	  if (!codel_dequeue(*f, buf, now))
+	    {
+	      // flow is empty, a new flow gets one more round as an old
+	      // one so that it can't stay ahead by emptying repeatedly
+	      list->pop_front();
+	      if (list == &new_flows && !old_flows.empty())
+		old_flows.push_back(f);
+	      else
+		f->active = false;
+	      continue;
+	    }
+	  f->deficit -= long(buf.size());
+	  return true;
+	}
+    }
+
+    size_t size() const
+    {
+      return total;
+    }
+
+    bool empty() const
+    {
+      return !total;
+    }
+
+    // Number of packets dropped since the last call.
+    size_t take_drops()
+    {
+      const size_t ret = drops;
+      drops = 0;
+      return ret;
+    }
+
+  private:
+    struct Item
+    {
+      Item(BufferAllocated&& buf_arg, const Time& enq_arg)
+	: buf(std::move(buf_arg)),
+	  enq(enq_arg)
+      {
+      }
+
+      BufferAllocated buf;
+      Time enq;
+    };
+
+    struct Flow
+    {
+      std::deque<Item> q;
+      size_t bytes = 0;
+      long deficit = 0;
+      bool active = false;   // on new_flows or old_flows
+
+      // CoDel state
+      bool dropping = false;
+      unsigned int count = 0;
+      unsigned int lastcount = 0;
+      Time first_above_time;
+      Time drop_next;
+    };
+
+    // Pop the head of f into buf and tell whether it has waited long
+    // enough to be dropped.
+    bool pop(Flow& f, BufferAllocated& buf, const Time& now, bool& ok_to_drop)
+    {
+      ok_to_drop = false;
+      if (f.q.empty())
+	{
+	  f.first_above_time.reset();
+	  return false;
+	}
+      Item& item = f.q.front();
+      const Time::Duration sojourn = now - item.enq;
+      buf = std::move(item.buf);
+      f.q.pop_front();
+      f.bytes -= buf.size();
+      --total;
+
+      if (sojourn < config.target || f.bytes <= config.quantum)
+	f.first_above_time.reset();
+      else if (!f.first_above_time.defined())
+	f.first_above_time = now + config.interval;
+      else if (now >= f.first_above_time)
+	ok_to_drop = true;
+      return true;
+    }
+
+    bool codel_dequeue(Flow& f, BufferAllocated& buf, const Time& now)
+    {
+      bool ok_to_drop;
+      if (!pop(f, buf, now, ok_to_drop))
+	{
+	  f.dropping = false;
+	  return false;
+	}
+      if (f.dropping)
+	{
+	  if (!ok_to_drop)
+	    f.dropping = false;
+	  while (f.dropping && now >= f.drop_next)
+	    {
+	      ++drops;
+	      ++f.count;
+	      if (!pop(f, buf, now, ok_to_drop))
+		{
+		  f.dropping = false;
+		  return false;
+		}
+	      if (!ok_to_drop)
+		f.dropping = false;
+	      else
+		f.drop_next = control_law(f.drop_next, f.count);
+	    }
+	}
+      else if (ok_to_drop)
+	{
+	  ++drops;
+	  if (!pop(f, buf, now, ok_to_drop))
+	    return false;
+	  f.dropping = true;
+	  const unsigned int delta = f.count - f.lastcount;
+	  if (delta > 1 && now < f.drop_next + config.interval * 16)
+	    f.count = delta;
+	  else
+	    f.count = 1;
+	  f.drop_next = control_law(now, f.count);
+	  f.lastcount = f.count;
+	}
+      return true;
+    }
+
+    Time control_law(const Time& t, const unsigned int count) const
+    {
+      return t + Time::Duration::binary_ms(Time::type(double(config.interval.raw()) / std::sqrt(double(count))));
+    }
+
+    void drop_longest()
+    {
+      Flow* longest = nullptr;
+      for (auto& f : flows)
+	{
+	  if (!f.q.empty() && (!longest || f.bytes > longest->bytes))
+	    longest = &f;
+	}
+      if (longest)
+	{
+	  longest->bytes -= longest->q.front().buf.size();
+	  longest->q.pop_front();
+	  --total;
+	  ++drops;
+	}
+    }
+
+    Config config;
+    std::vector<Flow> flows;
+    std::deque<Flow *> new_flows;
+    std::deque<Flow *> old_flows;
+    size_t total = 0;
+    size_t drops = 0;
+  };
+
+}
+
+#endif
@@ -33,8 +33,10 @@
 #include <openvpn/common/process.hpp>
 #include <openvpn/common/action.hpp>
 #include <openvpn/addr/route.hpp>
+#include <openvpn/ip/flowhash.hpp>
 #include <openvpn/tun/builder/capture.hpp>
 #include <openvpn/tun/linux/tun.hpp>
+#include <openvpn/tun/linux/client/tunnetlink.hpp>
 #include <openvpn/tun/client/tunbase.hpp>
 #include <openvpn/tun/client/tunprop.hpp>
 
@@ -48,6 +50,7 @@ namespace openvpn {
       R_ADD_SYS=(1<<1),
       R_ADD_DCO=(1<<2),
       R_ADD_ALL=R_ADD_SYS|R_ADD_DCO,
+      R_NETLINK=(1<<3), // add system route via rtnetlink rather than /sbin/ip
     };
 
     inline IP::Addr cvt_pnr_ip_v4(const std::string& hexaddr)
@@ -95,7 +98,15 @@ namespace openvpn {
 	  const IPv6::Addr netmask = IPv6::Addr::netmask_from_prefix_len(prefix_len);
 	  const IPv6::Addr net = addr & netmask;
 
-	  if (flags & R_ADD_SYS)
+	  if ((flags & (R_ADD_SYS|R_NETLINK)) == (R_ADD_SYS|R_NETLINK))
+	    {
+	      NetlinkRoute::Ptr add(new NetlinkRoute(true,
+						     IP::Route(IP::Addr::from_ipv6(net), prefix_len),
+						     IP::Addr::from_string(gateway_str)));
+	      destroy = add->reverse();
+	      create = add;
+	    }
+	  else if (flags & R_ADD_SYS)
 	    {
 	      // ip route add 2001:db8:1::/48 via 2001:db8:1::1
 	      Command::Ptr add(new Command);
@@ -123,7 +134,15 @@ namespace openvpn {
 	  const IPv4::Addr netmask = IPv4::Addr::netmask_from_prefix_len(prefix_len);
 	  const IPv4::Addr net = addr & netmask;
 
-	  if (flags & R_ADD_SYS)
+	  if ((flags & (R_ADD_SYS|R_NETLINK)) == (R_ADD_SYS|R_NETLINK))
+	    {
+	      NetlinkRoute::Ptr add(new NetlinkRoute(true,
+						     IP::Route(IP::Addr::from_ipv4(net), prefix_len),
+						     IP::Addr::from_string(gateway_str)));
+	      destroy = add->reverse();
+	      create = add;
+	    }
+	  else if (flags & R_ADD_SYS)
 	    {
 	      // ip route add 192.0.2.128/25 via 192.0.2.1
 	      Command::Ptr add(new Command);
@@ -164,27 +183,35 @@ namespace openvpn {
     inline void iface_up(const std::string& iface_name,
 			     const int mtu,
 			     ActionList& create,
-			     ActionList& destroy)
+			     ActionList& destroy,
+			     const bool netlink = false)
     {
-      {
-	Command::Ptr add(new Command);
-	add->argv.push_back("/sbin/ip");
-	add->argv.push_back("link");
-	add->argv.push_back("set");
-	add->argv.push_back(iface_name);
-	add->argv.push_back("up");
-	if (mtu > 0)
-	  {
-	    add->argv.push_back("mtu");
-	    add->argv.push_back(openvpn::to_string(mtu));
-	  }
-	create.add(add);
+      if (netlink)
+	{
+	  NetlinkLink::Ptr add(new NetlinkLink(iface_name, true, mtu));
+	  create.add(add);
+	  destroy.add(add->reverse());
+	}
+      else
+	{
+	  Command::Ptr add(new Command);
+	  add->argv.push_back("/sbin/ip");
+	  add->argv.push_back("link");
+	  add->argv.push_back("set");
+	  add->argv.push_back(iface_name);
+	  add->argv.push_back("up");
+	  if (mtu > 0)
+	    {
+	      add->argv.push_back("mtu");
+	      add->argv.push_back(openvpn::to_string(mtu));
+	    }
+	  create.add(add);
 
-	// for the destroy command, copy the add command but replace "up" with "down"
-	Command::Ptr del(add->copy());
-	del->argv[4] = "down";
-	destroy.add(del);
-      }
+	  // for the destroy command, copy the add command but replace "up" with "down"
+	  Command::Ptr del(add->copy());
+	  del->argv[4] = "down";
+	  destroy.add(del);
+	}
     }
 
     inline void iface_config(const std::string& iface_name,
@@ -192,14 +219,31 @@ namespace openvpn {
 			     const TunBuilderCapture& pull,
 			     std::vector<IP::Route>* rtvec,
 			     ActionList& create,
-			     ActionList& destroy)
+			     ActionList& destroy,
+			     const bool netlink = false)
     {
       // set local4 and local6 to point to IPv4/6 route configurations
       const TunBuilderCapture::RouteAddress* local4 = pull.vpn_ipv4();
       const TunBuilderCapture::RouteAddress* local6 = pull.vpn_ipv6();
 
       // Set IPv4 Interface
-      if (local4)
+      if (local4 && netlink)
+	{
+	  const IPv4::Addr addr = IPv4::Addr::from_string(local4->address);
+	  const IPv4::Addr bcast = addr | ~IPv4::Addr::netmask_from_prefix_len(local4->prefix_length);
+	  NetlinkAddr::Ptr add(new NetlinkAddr(true,
+					       iface_name,
+					       IP::Addr::from_ipv4(addr),
+					       local4->prefix_length,
+					       IP::Addr::from_ipv4(bcast),
+					       unit >= 0 ? iface_name + ':' + openvpn::to_string(unit) : ""));
+	  create.add(add);
+	  destroy.add(add->reverse());
+
+	  // add interface route to rtvec if defined
+	  add_del_route(local4->address, local4->prefix_length, local4->address, R_ADD_DCO, rtvec, create, destroy);
+	}
+      else if (local4)
 	{
 	  Command::Ptr add(new Command);
 	  add->argv.push_back("/sbin/ip");
@@ -228,7 +272,21 @@ namespace openvpn {
 	}
 
       // Set IPv6 Interface
-      if (local6 && !pull.block_ipv6)
+      if (local6 && !pull.block_ipv6 && netlink)
+	{
+	  NetlinkAddr::Ptr add(new NetlinkAddr(true,
+					       iface_name,
+					       IP::Addr::from_string(local6->address),
+					       local6->prefix_length,
+					       IP::Addr(),
+					       ""));
+	  create.add(add);
+	  destroy.add(add->reverse());
+
+	  // add interface route to rtvec if defined
+	  add_del_route(local6->address, local6->prefix_length, local6->address, R_ADD_DCO|R_IPv6, rtvec, create, destroy);
+	}
+      else if (local6 && !pull.block_ipv6)
 	{
 	  Command::Ptr add(new Command);
 	  add->argv.push_back("/sbin/ip");
@@ -250,21 +308,26 @@ namespace openvpn {
 	}
     }
 
+    // If netlink is true, addresses and routes are configured through
+    // NetlinkActions rather than /sbin/ip commands, so create and destroy
+    // should be ActionListNetlink objects to batch them.
     inline void tun_config(const std::string& iface_name,
 			   const TunBuilderCapture& pull,
 			   std::vector<IP::Route>* rtvec,
 			   ActionList& create,
-			   ActionList& destroy)
+			   ActionList& destroy,
+			   const bool netlink = false)
     {
       const IP::Addr gw4 = get_default_gateway_v4();
+      const unsigned int nl = netlink ? R_NETLINK : 0;
 
       // set local4 and local6 to point to IPv4/6 route configurations
       const TunBuilderCapture::RouteAddress* local4 = pull.vpn_ipv4();
       const TunBuilderCapture::RouteAddress* local6 = pull.vpn_ipv6();
 
       // configure interface
-      iface_up(iface_name, pull.mtu, create, destroy);
-      iface_config(iface_name, -1, pull, rtvec, create, destroy);
+      iface_up(iface_name, pull.mtu, create, destroy, netlink);
+      iface_config(iface_name, -1, pull, rtvec, create, destroy, netlink);
 
       // Process Routes
       {
@@ -273,12 +336,12 @@ namespace openvpn {
 	    if (route.ipv6)
 	      {
 		if (!pull.block_ipv6)
-		  add_del_route(route.address, route.prefix_length, local6->gateway, R_ADD_ALL|R_IPv6, rtvec, create, destroy);
+		  add_del_route(route.address, route.prefix_length, local6->gateway, R_ADD_ALL|R_IPv6|nl, rtvec, create, destroy);
 	      }
 	    else
 	      {
 		if (local4 && !local4->gateway.empty())
-		  add_del_route(route.address, route.prefix_length, local4->gateway, R_ADD_ALL, rtvec, create, destroy);
+		  add_del_route(route.address, route.prefix_length, local4->gateway, R_ADD_ALL|nl, rtvec, create, destroy);
 		else
 		  OPENVPN_LOG("ERROR: IPv4 route pushed without IPv4 ifconfig and/or route-gateway");
 	      }
@@ -296,7 +359,7 @@ namespace openvpn {
 	    else
 	      {
 		if (gw4.defined())
-		  add_del_route(route.address, route.prefix_length, gw4.to_string(), R_ADD_SYS, rtvec, create, destroy);
+		  add_del_route(route.address, route.prefix_length, gw4.to_string(), R_ADD_SYS|nl, rtvec, create, destroy);
 		else
 		  OPENVPN_LOG("NOTE: cannot determine gateway for exclude IPv4 routes");
 	      }
@@ -308,17 +371,17 @@ namespace openvpn {
 	{
 	  // add bypass route
 	  if (!pull.remote_address.ipv6 && !(pull.reroute_gw.flags & RedirectGatewayFlags::RG_LOCAL))
-	    add_del_route(pull.remote_address.address, 32, gw4.to_string(), R_ADD_SYS, rtvec, create, destroy);
+	    add_del_route(pull.remote_address.address, 32, gw4.to_string(), R_ADD_SYS|nl, rtvec, create, destroy);
 
-	  add_del_route("0.0.0.0", 1, local4->gateway, R_ADD_ALL, rtvec, create, destroy);
-	  add_del_route("128.0.0.0", 1, local4->gateway, R_ADD_ALL, rtvec, create, destroy);
+	  add_del_route("0.0.0.0", 1, local4->gateway, R_ADD_ALL|nl, rtvec, create, destroy);
+	  add_del_route("128.0.0.0", 1, local4->gateway, R_ADD_ALL|nl, rtvec, create, destroy);
 	}
 
       // Process IPv6 redirect-gateway
       if (pull.reroute_gw.ipv6 && !pull.block_ipv6)
 	{
-	  add_del_route("0000::", 1, local6->gateway, R_ADD_ALL|R_IPv6, rtvec, create, destroy);
-	  add_del_route("8000::", 1, local6->gateway, R_ADD_ALL|R_IPv6, rtvec, create, destroy);
+	  add_del_route("0000::", 1, local6->gateway, R_ADD_ALL|R_IPv6|nl, rtvec, create, destroy);
+	  add_del_route("8000::", 1, local6->gateway, R_ADD_ALL|R_IPv6|nl, rtvec, create, destroy);
 	}
 
       // fixme -- Process block-ipv6
@@ -337,6 +400,36 @@ namespace openvpn {
       TunProp::Config tun_prop;
 
       int n_parallel = 8;
+
+      // If > 1, open the tun device with IFF_MULTI_QUEUE and
+      // attach n_queues queues.  The kernel steers reads across
+      // queues by flow, and writes are steered by IPFlow::hash.
+      unsigned int n_queues = 1;
+
+      // If nonzero, drain up to batch_limit ready packets per
+      // reactor wakeup (see TunIO::start_batch).
+      unsigned int batch_limit = 0;
+
+      // Read the tun device through io_uring where supported
+      // (see TunIO::start_uring).
+      bool io_uring = false;
+
+      // Open the tun device with IFF_VNET_HDR and TCP segmentation
+      // offload, so that the stack hands over TCP super-packets of up
+      // to 64 KB in one read, which are segmented here and passed on
+      // as one batch (see TunIO::enable_vnet_hdr).  Replaces io_uring
+      // and batch_limit reads.
+      bool vnet_hdr = false;
+
+      // With vnet_hdr, also merge in-order TCP segments received from
+      // the server into super-packets before writing them to the tun
+      // device (see TunIO::enable_gro).
+      bool gro = false;
+
+      // Configure addresses and routes with batched rtnetlink
+      // requests, rather than running /sbin/ip once per item.
+      bool netlink = true;
+
       Frame::Ptr frame;
       SessionStats::Ptr stats;
 
@@ -353,6 +446,12 @@ namespace openvpn {
 	    if (dev)
 	      dev_name = dev->get(1, 64);
 	  }
+
+	// "tun-queues n" and "tun-batch n", see n_queues and batch_limit
+	if (opt.exists("tun-queues"))
+	  n_queues = opt.get_num<unsigned int>("tun-queues", 1, 4, 1, 64);
+	if (opt.exists("tun-batch"))
+	  batch_limit = opt.get_num<unsigned int>("tun-batch", 1, 64, 1, 1024);
       }
 
       static Ptr new_obj()
@@ -370,7 +469,7 @@ namespace openvpn {
     class Client : public TunClient
     {
       friend class ClientConfig;  // calls constructor
-      friend class TunIO<Client*, PacketFrom, asio::posix::stream_descriptor>;  // calls tun_read_handler
+      friend class TunIO<Client*, PacketFrom, asio::posix::stream_descriptor>;  // calls tun_read_handler, tun_read_handler_batch
 
       typedef Tun<Client*> TunImpl;
 
@@ -400,8 +499,8 @@ namespace openvpn {
 	      OPENVPN_LOG("CAPTURED OPTIONS:" << std::endl << po->to_string());
 
 	      // configure tun/tap interface properties
-	      ActionList::Ptr add_cmds = new ActionList();
-	      remove_cmds.reset(new ActionList());
+	      ActionList::Ptr add_cmds = new ActionListNetlink();
+	      remove_cmds.reset(new ActionListNetlink());
 
 	      // start tun
 	      impl.reset(new TunImpl(io_context,
@@ -410,15 +509,32 @@ namespace openvpn {
 				     config->stats,
 				     config->dev_name,
 				     config->tun_prop.layer,
-				     config->txqueuelen
+				     config->txqueuelen,
+				     (config->n_queues > 1 ? MULTI_QUEUE : 0)
+				     | (config->vnet_hdr ? VNET_HDR : 0)
 				     ));
-	      impl->start(config->n_parallel);
+	      start_reads(*impl);
+
+	      // attach additional queues
+	      for (unsigned int i = 1; i < config->n_queues; ++i)
+		{
+		  TunImpl::Ptr q(new TunImpl(io_context,
+					     this,
+					     config->frame,
+					     config->stats,
+					     impl->name(),
+					     config->tun_prop.layer,
+					     0,
+					     ATTACH_QUEUE | (config->vnet_hdr ? VNET_HDR : 0)));
+		  start_reads(*q);
+		  queues.push_back(std::move(q));
+		}
 
 	      // get the iface name
 	      state->iface_name = impl->name();
 
 	      // configure tun properties
-	      TunLinux::tun_config(state->iface_name, *po, nullptr, *add_cmds, *remove_cmds);
+	      TunLinux::tun_config(state->iface_name, *po, nullptr, *add_cmds, *remove_cmds, config->netlink);
 
 	      // execute commands to bring up interface
 	      add_cmds->execute(std::cout);
@@ -439,6 +555,13 @@ namespace openvpn {
 	return send(buf);
       }
 
+      virtual bool tun_send_batch(BufferAllocated** bufs, const size_t n)
+      {
+	if (impl && queues.empty())
+	  return impl->write_batch(bufs, n) == n;
+	return TunClient::tun_send_batch(bufs, n);
+      }
+
       virtual std::string tun_name() const
       {
 	if (impl)
@@ -498,10 +621,44 @@ namespace openvpn {
       {
       }
 
+      void start_reads(TunImpl& tun)
+      {
+	if (config->vnet_hdr)
+	  {
+	    tun.enable_vnet_hdr();
+	    if (config->gro)
+	      tun.enable_gro();
+	    tun.start(config->n_parallel);
+	    return;
+	  }
+#ifdef OPENVPN_TUNIO_HAVE_URING
+	if (config->io_uring)
+	  {
+	    try {
+	      tun.start_uring(io_context, config->n_parallel, config->batch_limit);
+	      return;
+	    }
+	    catch (const std::exception& e)
+	      {
+		OPENVPN_LOG("TUN io_uring unavailable, using reactor: " << e.what());
+	      }
+	  }
+#endif
+	tun.start_batch(config->n_parallel, config->batch_limit);
+      }
+
       bool send(Buffer& buf)
       {
 	if (impl)
-	  return impl->write(buf);
+	  {
+	    if (!queues.empty())
+	      {
+		const size_t q = IPFlow::hash(buf) % (queues.size() + 1);
+		if (q)
+		  return queues[q-1]->write(buf);
+	      }
+	    return impl->write(buf);
+	  }
 	else
 	  return false;
       }
@@ -511,6 +668,16 @@ namespace openvpn {
 	parent.tun_recv(pfp->buf);
       }
 
+      void tun_read_handler_batch(TunImpl::PacketFromBatch& batch, const size_t n) // called by TunImpl
+      {
+	if (halt)
+	  return;
+	batch_ptrs.resize(n);
+	for (size_t i = 0; i < n; ++i)
+	  batch_ptrs[i] = &batch[i]->buf;
+	parent.tun_recv_batch(batch_ptrs.data(), n);
+      }
+
       void tun_error_handler(const Error::Type errtype, // called by TunImpl
 			     const asio::error_code* error)
       {
@@ -527,6 +694,9 @@ namespace openvpn {
 	      remove_cmds->execute(std::cout);
 
 	    // stop tun
+	    for (auto &q : queues)
+	      q->stop();
+	    queues.clear();
 	    if (impl)
 	      impl->stop();
 	  }
@@ -536,9 +706,11 @@ namespace openvpn {
       ClientConfig::Ptr config;
       TunClientParent& parent;
       TunImpl::Ptr impl;
+      std::vector<TunImpl::Ptr> queues; // additional multi-queue queues
       TunProp::State::Ptr state;
       ActionList::Ptr remove_cmds;
       bool halt;
+      std::vector<BufferAllocated*> batch_ptrs;
     };
 
     inline TunClient::Ptr ClientConfig::new_tun_client_obj(asio::io_context& io_context,
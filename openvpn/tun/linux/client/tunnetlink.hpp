@@ -0,0 +1,357 @@
+//    OpenVPN -- An application to securely tunnel IP networks
+//               over a single port, with support for SSL/TLS-based
+//               session authentication and key exchange,
+//               packet encryption, packet authentication, and
+//               packet compression.
+//
+//    Copyright (C) 2012-2016 OpenVPN Technologies, Inc.
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU Affero General Public License Version 3
+//    as published by the Free Software Foundation.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU Affero General Public License for more details.
+//
+//    You should have received a copy of the GNU Affero General Public License
+//    along with this program in the COPYING file.
+//    If not, see <http://www.gnu.org/licenses/>.
+
+// rtnetlink backend for Linux client tun setup.  The actions here
+// are drop-in replacements for the /sbin/ip commands built by
+// tun/linux/client/tuncli.hpp, and ActionListNetlink sends runs
+// of them to the kernel as batched netlink transactions instead
+// of forking one process per address or route.
+
+#ifndef OPENVPN_TUN_LINUX_CLIENT_TUNNETLINK_H
+#define OPENVPN_TUN_LINUX_CLIENT_TUNNETLINK_H
+
+#include <net/if.h>
+#include <errno.h>
+
+#include <string>
+#include <vector>
+#include <ostream>
+#include <cstring>
+#include <cstdint>
+
+#include <openvpn/common/exception.hpp>
+#include <openvpn/common/action.hpp>
+#include <openvpn/common/asioerr.hpp>
+#include <openvpn/common/format.hpp>
+#include <openvpn/addr/ip.hpp>
+#include <openvpn/addr/route.hpp>
+#include <openvpn/dco/linux/ovpnnl.hpp>
+
+namespace openvpn {
+  namespace TunLinux {
+
+    OPENVPN_EXCEPTION(tun_netlink_error);
+
+    // An Action carried out by a single rtnetlink request
+    class NetlinkAction : public Action
+    {
+    public:
+      typedef RCPtr<NetlinkAction> Ptr;
+
+      virtual OvpnNL::Message request() const = 0;
+
+      // True if the kernel error err means the action
+      // had nothing to do, such as deleting a route that the
+      // kernel already flushed when the interface went down
+      virtual bool nothing_to_do(const int err) const
+      {
+	return false;
+      }
+
+      // Run on its own, outside of an ActionListNetlink
+      virtual void execute(std::ostream& os) override
+      {
+	os << to_string() << std::endl;
+	OvpnNL::Socket sock(NETLINK_ROUTE);
+	OvpnNL::Message msg = request();
+	sock.transact(msg, "rtnetlink");
+      }
+
+    protected:
+      static void put_addr(OvpnNL::Message& msg, const std::uint16_t type, const IP::Addr& addr)
+      {
+	if (addr.version() == IP::Addr::V6)
+	  {
+	    const struct in6_addr a = addr.to_ipv6().to_in6_addr();
+	    msg.put(type, &a, sizeof(a));
+	  }
+	else
+	  msg.put_u32(type, addr.to_ipv4().to_uint32_net());
+      }
+
+      static unsigned char family(const IP::Addr& addr)
+      {
+	return addr.version() == IP::Addr::V6 ? AF_INET6 : AF_INET;
+      }
+
+      static unsigned int ifindex(const std::string& iface)
+      {
+	const unsigned int ret = ::if_nametoindex(iface.c_str());
+	if (!ret)
+	  OPENVPN_THROW(tun_netlink_error, "interface " << iface << " not found");
+	return ret;
+      }
+    };
+
+    // ip route add|del <route> via <gateway>
+    class NetlinkRoute : public NetlinkAction
+    {
+    public:
+      typedef RCPtr<NetlinkRoute> Ptr;
+
+      NetlinkRoute(const bool add_arg,
+		   const IP::Route& route_arg,
+		   const IP::Addr& gateway_arg)
+	: add(add_arg),
+	  route(route_arg),
+	  gateway(gateway_arg)
+      {
+      }
+
+      NetlinkAction::Ptr reverse() const
+      {
+	return new NetlinkRoute(!add, route, gateway);
+      }
+
+      virtual OvpnNL::Message request() const override
+      {
+	OvpnNL::Message msg(add ? RTM_NEWROUTE : RTM_DELROUTE,
+			    add ? NLM_F_CREATE | NLM_F_EXCL : 0);
+	struct rtmsg rtm;
+	std::memset(&rtm, 0, sizeof(rtm));
+	rtm.rtm_family = family(route.addr);
+	rtm.rtm_dst_len = (unsigned char)route.prefix_len;
+	rtm.rtm_table = RT_TABLE_MAIN;
+	rtm.rtm_protocol = RTPROT_BOOT;
+	rtm.rtm_scope = add ? RT_SCOPE_UNIVERSE : RT_SCOPE_NOWHERE;
+	rtm.rtm_type = RTN_UNICAST;
+	msg.put_header(&rtm, sizeof(rtm));
+	put_addr(msg, RTA_DST, route.addr);
+	put_addr(msg, RTA_GATEWAY, gateway);
+	return msg;
+      }
+
+      virtual bool nothing_to_do(const int err) const override
+      {
+	return !add && err == ESRCH;
+      }
+
+      virtual std::string to_string() const override
+      {
+	return std::string("netlink route ") + (add ? "add " : "del ") + route.to_string() + " via " + gateway.to_string();
+      }
+
+    private:
+      const bool add;
+      const IP::Route route;
+      const IP::Addr gateway;
+    };
+
+    // ip addr add|del <addr>/<prefix_len> [broadcast <bcast>] dev <iface> [label <label>]
+    class NetlinkAddr : public NetlinkAction
+    {
+    public:
+      typedef RCPtr<NetlinkAddr> Ptr;
+
+      NetlinkAddr(const bool add_arg,
+		  const std::string& iface_arg,
+		  const IP::Addr& addr_arg,
+		  const unsigned int prefix_len_arg,
+		  const IP::Addr& broadcast_arg,
+		  const std::string& label_arg)
+	: add(add_arg),
+	  iface(iface_arg),
+	  addr(addr_arg),
+	  prefix_len(prefix_len_arg),
+	  broadcast(broadcast_arg),
+	  label(label_arg)
+      {
+      }
+
+      NetlinkAction::Ptr reverse() const
+      {
+	return new NetlinkAddr(!add, iface, addr, prefix_len, broadcast, label);
+      }
+
+      virtual OvpnNL::Message request() const override
+      {
+	OvpnNL::Message msg(add ? RTM_NEWADDR : RTM_DELADDR,
+			    add ? NLM_F_CREATE | NLM_F_EXCL : 0);
+	struct ifaddrmsg ifa;
+	std::memset(&ifa, 0, sizeof(ifa));
+	ifa.ifa_family = family(addr);
+	ifa.ifa_prefixlen = (unsigned char)prefix_len;
+	ifa.ifa_index = ifindex(iface);
+	msg.put_header(&ifa, sizeof(ifa));
+	put_addr(msg, IFA_LOCAL, addr);
+	put_addr(msg, IFA_ADDRESS, addr);
+	if (broadcast.defined())
+	  put_addr(msg, IFA_BROADCAST, broadcast);
+	if (!label.empty())
+	  msg.put_string(IFA_LABEL, label);
+	return msg;
+      }
+
+      virtual bool nothing_to_do(const int err) const override
+      {
+	return !add && (err == EADDRNOTAVAIL || err == ENODEV);
+      }
+
+      virtual std::string to_string() const override
+      {
+	std::string ret = std::string("netlink addr ") + (add ? "add " : "del ") + addr.to_string() + '/' + openvpn::to_string(prefix_len);
+	if (broadcast.defined())
+	  ret += " broadcast " + broadcast.to_string();
+	ret += " dev " + iface;
+	if (!label.empty())
+	  ret += " label " + label;
+	return ret;
+      }
+
+    private:
+      const bool add;
+      const std::string iface;
+      const IP::Addr addr;
+      const unsigned int prefix_len;
+      const IP::Addr broadcast; // IPv4 only, optional
+      const std::string label;  // optional
+    };
+
+    // ip link set <iface> up|down [mtu <mtu>]
+    class NetlinkLink : public NetlinkAction
+    {
+    public:
+      typedef RCPtr<NetlinkLink> Ptr;
+
+      NetlinkLink(const std::string& iface_arg,
+		  const bool up_arg,
+		  const int mtu_arg)
+	: iface(iface_arg),
+	  up(up_arg),
+	  mtu(mtu_arg)
+      {
+      }
+
+      NetlinkAction::Ptr reverse() const
+      {
+	return new NetlinkLink(iface, !up, mtu);
+      }
+
+      virtual OvpnNL::Message request() const override
+      {
+	OvpnNL::Message msg(RTM_NEWLINK, 0);
+	struct ifinfomsg ifi;
+	std::memset(&ifi, 0, sizeof(ifi));
+	ifi.ifi_family = AF_UNSPEC;
+	ifi.ifi_index = int(ifindex(iface));
+	ifi.ifi_flags = up ? IFF_UP : 0;
+	ifi.ifi_change = IFF_UP;
+	msg.put_header(&ifi, sizeof(ifi));
+	if (up && mtu > 0)
+	  msg.put_u32(IFLA_MTU, std::uint32_t(mtu));
+	return msg;
+      }
+
+      virtual std::string to_string() const override
+      {
+	std::string ret = "netlink link set " + iface + (up ? " up" : " down");
+	if (up && mtu > 0)
+	  ret += " mtu " + openvpn::to_string(mtu);
+	return ret;
+      }
+
+    private:
+      const std::string iface;
+      const bool up;
+      const int mtu;
+    };
+
+    // ActionList that sends each run of consecutive NetlinkActions
+    // as one batched netlink transaction.  Other actions are executed
+    // individually, in order, as by ActionList.
+    class ActionListNetlink : public ActionList
+    {
+    public:
+      typedef RCPtr<ActionListNetlink> Ptr;
+
+      virtual void execute(std::ostream& os) override
+      {
+	std::vector<const NetlinkAction*> batch;
+	Iter i(size(), reverse_);
+	while (i())
+	  {
+	    if (is_halt())
+	      break;
+	    Action* a = (*this)[i.index()].get();
+	    const NetlinkAction* na = dynamic_cast<const NetlinkAction*>(a);
+	    if (na)
+	      {
+		batch.push_back(na);
+		continue;
+	      }
+	    flush(batch, os);
+	    try {
+	      a->execute(os);
+	    }
+	    catch (const std::exception& e)
+	      {
+		os << "action exception: " << e.what() << std::endl;
+	      }
+	  }
+	flush(batch, os);
+      }
+
+    private:
+      static void flush(std::vector<const NetlinkAction*>& batch, std::ostream& os)
+      {
+	if (batch.empty())
+	  return;
+	try {
+	  std::vector<OvpnNL::Message> msgs;
+	  std::vector<const NetlinkAction*> sent;
+	  msgs.reserve(batch.size());
+	  sent.reserve(batch.size());
+	  for (auto a : batch)
+	    {
+	      try {
+		msgs.push_back(a->request());
+		sent.push_back(a);
+	      }
+	      catch (const std::exception& e)
+		{
+		  os << "action exception: " << a->to_string() << ": " << e.what() << std::endl;
+		}
+	    }
+
+	  size_t errors = 0;
+	  OvpnNL::Socket sock(NETLINK_ROUTE);
+	  sock.transact_batch(msgs, "rtnetlink", [&](const size_t idx, const int err)
+			      {
+				if (!sent[idx]->nothing_to_do(err))
+				  {
+				    os << "netlink error: " << sent[idx]->to_string() << ": " << errinfo(err) << std::endl;
+				    ++errors;
+				  }
+			      });
+	  os << "netlink: " << msgs.size() << " requests, " << errors << " errors" << std::endl;
+	}
+	catch (const std::exception& e)
+	  {
+	    os << "action exception: " << e.what() << std::endl;
+	  }
+	batch.clear();
+      }
+    };
+
+  }
+}
+
+#endif
@@ -0,0 +1,577 @@
+//    OpenVPN -- An application to securely tunnel IP networks
+//               over a single port, with support for SSL/TLS-based
+//               session authentication and key exchange,
+//               packet encryption, packet authentication, and
+//               packet compression.
+//
+//    Copyright (C) 2012-2016 OpenVPN Technologies, Inc.
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU Affero General Public License Version 3
+//    as published by the Free Software Foundation.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU Affero General Public License for more details.
+//
+//    You should have received a copy of the GNU Affero General Public License
+//    along with this program in the COPYING file.
+//    If not, see <http://www.gnu.org/licenses/>.
+
+// Multi-queue tun device for multi-threaded Linux servers.  The device
+// is opened with IFF_MULTI_QUEUE and one queue is attached per server
+// thread, so each thread reads and writes its own descriptor.
+
+#ifndef OPENVPN_TUN_LINUX_SERVER_TUNMQ_H
+#define OPENVPN_TUN_LINUX_SERVER_TUNMQ_H
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <cstring>
+#include <cstdint>
+
+#include <errno.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/bpf.h>
+#include <linux/if_tun.h>
+
+#include <asio.hpp>
+
+#include <openvpn/common/exception.hpp>
+#include <openvpn/common/rc.hpp>
+#include <openvpn/common/scoped_fd.hpp>
+#include <openvpn/addr/ip.hpp>
+#include <openvpn/ip/ip.hpp>
+#include <openvpn/frame/frame.hpp>
+#include <openvpn/log/sessionstats.hpp>
+#include <openvpn/tun/linux/tun.hpp>
+#include <openvpn/tun/server/tunbase.hpp>
+#include <openvpn/server/vpnservnetblock.hpp>
+#include <openvpn/server/vpnservfib.hpp>
+
+namespace openvpn {
+  namespace TunLinuxServer {
+
+    OPENVPN_EXCEPTION(tun_mq_error);
+
+    // client VPN address -> session, shared by all threads
+    typedef VPNServerFIB<TunClientInstanceRecv*> FIB;
+
+    class Server;
+
+    // The shared tun device.  Construct it once before starting the
+    // server threads, then have thread i create a Server for index i
+    // on io_contexts[i], which takes over queue i.
+    //
+    // The kernel picks the queue a packet is read from when it routes
+    // the packet to the device.  By default that is a flow hash, so a
+    // steering program is attached with TUNSETSTEERINGEBPF that maps
+    // the destination address to the thread owning it in the
+    // VPNServerNetblock::PerThread partition, and packets for a
+    // client's pool address are read by the thread serving the client.
+    // Anything else (steering unavailable, addresses outside the pool)
+    // is read by some thread, looked up in the FIB, and if owned by
+    // another thread, posted to it.
+    class Device : public RC<thread_safe_refcount>
+    {
+      friend class Server;
+
+    public:
+      typedef RCPtr<Device> Ptr;
+
+      // io_contexts[i] is the io_context of server thread i, and
+      // netblock must have been partitioned into io_contexts.size()
+      // per-thread ranges.  If fib is undefined, a private one is
+      // created.  If vnet_hdr, all queues are opened with
+      // IFF_VNET_HDR and TCP segmentation offload (see
+      // TunIO::enable_vnet_hdr).
+      Device(const std::string& name,
+	     const std::vector<asio::io_context*>& io_contexts,
+	     const VPNServerNetblock& netblock,
+	     const int txqueuelen,
+	     const FIB::Ptr& fib_arg=FIB::Ptr(),
+	     const bool vnet_hdr_arg=false)
+	: fib_(fib_arg),
+	  vnet_hdr_(vnet_hdr_arg)
+      {
+	const unsigned int vflag = vnet_hdr_ ? TunLinux::VNET_HDR : 0;
+	const size_t n = io_contexts.size();
+	if (!n)
+	  throw tun_mq_error("no server threads");
+	if (netblock.size() != n)
+	  throw tun_mq_error("server netblock thread count mismatch");
+	if (!fib_)
+	  fib_.reset(new FIB((unsigned int)n));
+	else if (fib_->n_threads() != n)
+	  throw tun_mq_error("FIB thread count mismatch");
+
+	slots.resize(n);
+	for (size_t i = 0; i < n; ++i)
+	  slots[i].io_context = io_contexts[i];
+	name_ = name;
+	slots[0].fd.reset(TunLinux::tun_open(name_, Layer(Layer::OSI_LAYER_3), txqueuelen, TunLinux::MULTI_QUEUE | vflag));
+	for (size_t i = 1; i < n; ++i)
+	  {
+	    std::string qn = name_;
+	    slots[i].fd.reset(TunLinux::tun_open(qn, Layer(Layer::OSI_LAYER_3), 0, TunLinux::ATTACH_QUEUE | vflag));
+	  }
+
+	try {
+	  attach_steering(netblock);
+	  steered = true;
+	}
+	catch (const std::exception& e)
+	  {
+	    OPENVPN_LOG("TunLinuxServer: " << e.what() << ", handing off packets between threads");
+	  }
+	OPENVPN_LOG_TUN(name_ << " opened with " << n << " queues");
+      }
+
+      const std::string& name() const { return name_; }
+      size_t n_queues() const { return slots.size(); }
+      bool vnet_hdr() const { return vnet_hdr_; }
+      bool steering() const { return steered; }
+      const FIB::Ptr& fib() const { return fib_; }
+
+    private:
+      struct Slot
+      {
+	ScopedFD fd;                          // until taken by Server
+	asio::io_context* io_context = nullptr;
+	Server* server = nullptr;             // only touched on its own thread
+      };
+
+      static int bpf(const int cmd, union bpf_attr& attr)
+      {
+	return (int)::syscall(__NR_bpf, cmd, &attr, sizeof(attr));
+      }
+
+      static struct bpf_insn insn(const std::uint8_t code, const std::uint8_t dst, const std::uint8_t src,
+				  const std::int16_t off, const std::int32_t imm)
+      {
+	struct bpf_insn i;
+	i.code = code;
+	i.dst_reg = dst;
+	i.src_reg = src;
+	i.off = off;
+	i.imm = imm;
+	return i;
+      }
+
+      // 128-bit address as (hi, lo), host order
+      static void split(const IP::Addr& a, std::uint64_t& hi, std::uint64_t& lo)
+      {
+	if (a.version() == IP::Addr::V4)
+	  {
+	    hi = 0;
+	    lo = a.to_ipv4().to_uint32();
+	  }
+	else
+	  {
+	    unsigned char b[16];
+	    a.to_byte_string(b);
+	    hi = lo = 0;
+	    for (int i = 0; i < 8; ++i)
+	      {
+		hi = (hi << 8) | b[i];
+		lo = (lo << 8) | b[i + 8];
+	      }
+	  }
+      }
+
+      // Build and attach a socket filter returning the queue index:
+      //
+      //   r8:r7 = destination address (IPv4 in r7 with r8 = 0)
+      //   for each thread i, for each of its ranges
+      //     if (start <= r8:r7 <= last) return i;
+      //   return 0;
+      //
+      // The skb handed to the steering program starts at the IP
+      // header, as a tun device has no link-layer header.  A range
+      // extent fits a size_t, so a range's hi half spans at most two
+      // values.
+      void attach_steering(const VPNServerNetblock& netblock)
+      {
+#ifdef TUNSETSTEERINGEBPF
+	enum { R0=0, R1, R6=6, R7, R8, R9 };
+	std::vector<struct bpf_insn> prog;
+	auto emit = [&prog](const struct bpf_insn& i) {
+	  prog.push_back(i);
+	  return prog.size() - 1;
+	};
+	auto imm64 = [&](const int reg, const std::uint64_t v) {
+	  emit(insn(BPF_LD|BPF_DW|BPF_IMM, reg, 0, 0, std::int32_t(std::uint32_t(v))));
+	  emit(insn(0, 0, 0, 0, std::int32_t(std::uint32_t(v >> 32))));
+	};
+	auto land = [&prog](const size_t at) { // point the jump at 'at' to the next insn
+	  prog[at].off = std::int16_t(prog.size() - at - 1);
+	};
+	auto load_abs = [&](const int reg, const int off) {
+	  emit(insn(BPF_LD|BPF_ABS|BPF_W, 0, 0, 0, off));
+	  emit(insn(BPF_ALU64|BPF_MOV|BPF_X, reg, R0, 0, 0));
+	};
+
+	// emit checks for ranges[i] of one address family, return i on match
+	auto ranges = [&](const bool v6) {
+	  for (size_t t = 0; t < netblock.size(); ++t)
+	    {
+	      const VPNServerNetblock::PerThread& pt = netblock.per_thread(t);
+	      if (v6 && !pt.range6_defined())
+		continue;
+	      const IP::Range& r = v6 ? pt.range6() : pt.range4();
+	      if (!r.extent())
+		continue;
+	      std::uint64_t shi, slo;
+	      split(r.start(), shi, slo);
+	      const std::uint64_t llo = slo + (r.extent() - 1);
+	      const std::uint64_t lhi = shi + (llo < slo);
+
+	      std::vector<size_t> miss;
+	      size_t hit_jump = 0;
+	      imm64(R9, shi);
+	      const size_t other_hi = emit(insn(BPF_JMP|BPF_JNE|BPF_X, R8, R9, 0, 0));
+	      imm64(R9, slo);
+	      miss.push_back(emit(insn(BPF_JMP|BPF_JGT|BPF_X, R9, R7, 0, 0)));
+	      if (lhi == shi)
+		{
+		  imm64(R9, llo);
+		  miss.push_back(emit(insn(BPF_JMP|BPF_JGT|BPF_X, R7, R9, 0, 0)));
+		  miss.push_back(other_hi);
+		}
+	      else
+		{
+		  hit_jump = emit(insn(BPF_JMP|BPF_JA, 0, 0, 0, 0));
+		  land(other_hi);
+		  imm64(R9, lhi);
+		  miss.push_back(emit(insn(BPF_JMP|BPF_JNE|BPF_X, R8, R9, 0, 0)));
+		  imm64(R9, llo);
+		  miss.push_back(emit(insn(BPF_JMP|BPF_JGT|BPF_X, R7, R9, 0, 0)));
+		  land(hit_jump);
+		}
+	      emit(insn(BPF_ALU64|BPF_MOV|BPF_K, R0, 0, 0, std::int32_t(t)));
+	      emit(insn(BPF_JMP|BPF_EXIT, 0, 0, 0, 0));
+	      for (const size_t m : miss)
+		land(m);
+	    }
+	};
+
+	emit(insn(BPF_ALU64|BPF_MOV|BPF_X, R6, R1, 0, 0));		// r6 = skb, for ld_abs
+	emit(insn(BPF_LD|BPF_ABS|BPF_B, 0, 0, 0, 0));			// r0 = version_len
+	emit(insn(BPF_ALU64|BPF_RSH|BPF_K, R0, 0, 0, 4));
+	const size_t to_v6 = emit(insn(BPF_JMP|BPF_JEQ|BPF_K, R0, 0, 0, 6));
+	const size_t not_v4 = emit(insn(BPF_JMP|BPF_JNE|BPF_K, R0, 0, 0, 4));
+	load_abs(R7, 16);						// ipv4 daddr
+	emit(insn(BPF_ALU64|BPF_MOV|BPF_K, R8, 0, 0, 0));
+	ranges(false);
+	const size_t v4_miss = emit(insn(BPF_JMP|BPF_JA, 0, 0, 0, 0));
+	land(to_v6);
+	load_abs(R8, 24);						// ipv6 daddr
+	emit(insn(BPF_ALU64|BPF_LSH|BPF_K, R8, 0, 0, 32));
+	load_abs(R9, 28);
+	emit(insn(BPF_ALU64|BPF_OR|BPF_X, R8, R9, 0, 0));
+	load_abs(R7, 32);
+	emit(insn(BPF_ALU64|BPF_LSH|BPF_K, R7, 0, 0, 32));
+	load_abs(R9, 36);
+	emit(insn(BPF_ALU64|BPF_OR|BPF_X, R7, R9, 0, 0));
+	ranges(true);
+	land(not_v4);
+	land(v4_miss);
+	emit(insn(BPF_ALU64|BPF_MOV|BPF_K, R0, 0, 0, 0));
+	emit(insn(BPF_JMP|BPF_EXIT, 0, 0, 0, 0));
+
+	if (prog.size() > 32767)
+	  throw tun_mq_error("steering program too large");
+	static const char license[] = "Dual BSD/GPL";
+
+	union bpf_attr attr;
+	std::memset(&attr, 0, sizeof(attr));
+	attr.prog_type = BPF_PROG_TYPE_SOCKET_FILTER;
+	attr.insns = (std::uint64_t)prog.data();
+	attr.insn_cnt = (std::uint32_t)prog.size();
+	attr.license = (std::uint64_t)license;
+	ScopedFD pfd(bpf(BPF_PROG_LOAD, attr));
+	if (!pfd.defined())
+	  OPENVPN_THROW(tun_mq_error, "steering program load: " << std::strerror(errno));
+
+	// the device keeps its own reference to the program
+	int fd = pfd();
+	if (::ioctl(slots[0].fd(), TUNSETSTEERINGEBPF, (void *)&fd) < 0)
+	  OPENVPN_THROW(tun_mq_error, "TUNSETSTEERINGEBPF: " << std::strerror(errno));
+#else
+	throw tun_mq_error("TUNSETSTEERINGEBPF not supported by kernel headers");
+#endif
+      }
+
+      // post a packet read on the wrong queue to its owning thread
+      inline void handoff(const unsigned int thread, TunLinux::PacketFrom::SPtr& pfp);
+
+      std::string name_;
+      FIB::Ptr fib_;
+      std::vector<Slot> slots;
+      bool steered = false;
+      const bool vnet_hdr_;
+    };
+
+    // Per-thread view of the device, and the TunClientInstanceFactory
+    // for the sessions of that thread.  Reads come from the thread's
+    // own queue, and session writes go to it too, so the data path of
+    // a thread shares no descriptor or lock with the other threads.
+    class Server : public TunClientInstanceFactory
+    {
+      friend class Device;
+      friend class TunIO<Server*, TunLinux::PacketFrom, asio::posix::stream_descriptor>; // calls tun_read_handler
+
+      typedef TunLinux::Tun<Server*> TunImpl;
+
+    public:
+      typedef RCPtr<Server> Ptr;
+
+      struct Config
+      {
+	int n_parallel = 8;
+
+	// If nonzero, drain up to batch_limit ready packets per
+	// reactor wakeup (see TunIO::start_batch).
+	unsigned int batch_limit = 0;
+
+	// On a Device opened with vnet_hdr, merge in-order TCP segments
+	// sent to the tun device into super-packets (see
+	// TunIO::enable_gro).
+	bool gro = false;
+      };
+
+      // Must be called on the thread of io_context, which must be the
+      // one passed to Device for this index.
+      Server(asio::io_context& io_context_arg,
+	     const Device::Ptr& device_arg,
+	     const unsigned int index_arg,
+	     const Frame::Ptr& frame,
+	     const SessionStats::Ptr& stats_arg,
+	     const Config& config_arg)
+	: io_context(io_context_arg),
+	  device(device_arg),
+	  index(index_arg),
+	  stats(stats_arg),
+	  config(config_arg),
+	  view(device_arg->fib_->per_thread(index_arg))
+      {
+	if (index >= device->slots.size())
+	  throw tun_mq_error("thread index out of range");
+	Device::Slot& slot = device->slots[index];
+	if (slot.io_context != &io_context)
+	  OPENVPN_THROW(tun_mq_error, "queue " << index << " belongs to another io_context");
+	if (!slot.fd.defined())
+	  OPENVPN_THROW(tun_mq_error, "queue " << index << " already taken");
+	impl.reset(new TunImpl(io_context, this, frame, stats, device->name(), slot.fd.release()));
+	if (device->vnet_hdr())
+	  {
+	    impl->enable_vnet_hdr();
+	    if (config.gro)
+	      impl->enable_gro();
+	  }
+	slot.server = this;
+      }
+
+      void start()
+      {
+	if (!halt)
+	  {
+	    if (config.batch_limit)
+	      impl->start_batch(config.n_parallel, config.batch_limit);
+	    else
+	      impl->start(config.n_parallel);
+	  }
+      }
+
+      void stop()
+      {
+	if (!halt)
+	  {
+	    halt = true;
+	    device->slots[index].server = nullptr;
+	    if (impl)
+	      impl->stop();
+	  }
+      }
+
+      virtual TunClientInstanceSend::Ptr new_obj(TunClientInstanceRecv* parent);
+
+      unsigned int thread_index() const { return index; }
+
+      // packets read here but owned by another thread
+      size_t n_handoff() const { return handoff_count; }
+
+    private:
+      class Session;
+
+      void tun_read_handler(TunLinux::PacketFrom::SPtr& pfp) // called by TunImpl
+      {
+	if (!halt)
+	  dispatch(pfp, false);
+      }
+
+      void tun_read_handler_batch(TunImpl::PacketFromBatch& batch, const size_t n) // called by TunImpl
+      {
+	for (size_t i = 0; i < n && !halt; ++i)
+	  dispatch(batch[i], false);
+      }
+
+      void tun_error_handler(const Error::Type errtype, // called by TunImpl
+			     const asio::error_code* error)
+      {
+      }
+
+      // Deliver to the owning session, or post to the owning thread.
+      // Packets already handed off are not passed on again.
+      void dispatch(TunLinux::PacketFrom::SPtr& pfp, const bool handed_off)
+      {
+	IP::Addr dest;
+	if (!dest_addr(pfp->buf, dest))
+	  {
+	    stats->error(Error::TUN_FRAMING_ERROR);
+	    return;
+	  }
+	const FIB::Entry* e = view.lookup(dest);
+	if (!e)
+	  stats->error(Error::TUN_NO_ROUTE);
+	else if (e->thread == index)
+	  e->owner->tun_recv(pfp->buf);
+	else if (!handed_off)
+	  {
+	    ++handoff_count;
+	    device->handoff(e->thread, pfp);
+	  }
+	else
+	  stats->error(Error::TUN_NO_ROUTE);
+      }
+
+      static bool dest_addr(const Buffer& buf, IP::Addr& dest)
+      {
+	if (buf.size() >= 1)
+	  {
+	    switch (IPHeader::version(buf[0]))
+	      {
+	      case 4:
+		if (buf.size() >= 20)
+		  {
+		    std::uint32_t a;
+		    std::memcpy(&a, buf.c_data() + 16, sizeof(a));
+		    dest = IP::Addr::from_ipv4(IPv4::Addr::from_uint32_net(a));
+		    return true;
+		  }
+		break;
+	      case 6:
+		if (buf.size() >= 40)
+		  {
+		    dest = IP::Addr::from_ipv6(IPv6::Addr::from_byte_string(buf.c_data() + 24));
+		    return true;
+		  }
+		break;
+	      }
+	  }
+	return false;
+      }
+
+      bool send(Buffer& buf)
+      {
+	return !halt && impl->write(buf);
+      }
+
+      asio::io_context& io_context;
+      Device::Ptr device;
+      const unsigned int index;
+      SessionStats::Ptr stats;
+      const Config config;
+      FIB::PerThread& view;
+      TunImpl::Ptr impl;
+      size_t handoff_count = 0;
+      bool halt = false;
+    };
+
+    class Server::Session : public TunClientInstanceSend
+    {
+    public:
+      Session(Server* server_arg, TunClientInstanceRecv* parent_arg)
+	: server(server_arg),
+	  parent(parent_arg)
+      {
+      }
+
+      virtual void stop()
+      {
+	if (parent)
+	  {
+	    server->device->fib_->remove(routes, parent);
+	    routes.clear();
+	    parent = nullptr;
+	  }
+      }
+
+      virtual bool tun_send_const(const Buffer& buf)
+      {
+	Buffer b(buf);
+	return server->send(b);
+      }
+
+      virtual bool tun_send(BufferAllocated& buf)
+      {
+	return server->send(buf);
+      }
+
+      // Only host routes (the client's pool addresses) are looked up
+      // by the FIB.  Routes to networks behind the client still have
+      // to be routed to the tun device by the system.
+      virtual void add_routes(const std::vector<IP::Route>& rtvec)
+      {
+	if (parent)
+	  {
+	    server->device->fib_->add(rtvec, parent, server->index);
+	    routes.insert(routes.end(), rtvec.begin(), rtvec.end());
+	  }
+      }
+
+      // marks apply to sockets, not to packets written to tun
+      virtual void set_fwmark(const unsigned int fwmark)
+      {
+      }
+
+      virtual const std::string& tun_info() const
+      {
+	return server->device->name();
+      }
+
+    private:
+      Server::Ptr server;
+      TunClientInstanceRecv* parent;
+      std::vector<IP::Route> routes;
+    };
+
+    inline TunClientInstanceSend::Ptr Server::new_obj(TunClientInstanceRecv* parent)
+    {
+      return new Session(this, parent);
+    }
+
+    inline void Device::handoff(const unsigned int thread, TunLinux::PacketFrom::SPtr& pfp)
+    {
+      Slot& slot = slots[thread];
+      std::shared_ptr<TunLinux::PacketFrom> pf(std::move(pfp));
+      asio::post(*slot.io_context, [self=Ptr(this), thread, pf]()
+		 {
+		   Server* s = self->slots[thread].server;
+		   if (s && !s->halt)
+		     {
+		       TunLinux::PacketFrom::SPtr p(new TunLinux::PacketFrom());
+		       p->buf.move(pf->buf);
+		       s->dispatch(p, true);
+		     }
+		 });
+    }
+
+  }
+}
+
+#endif
@@ -38,6 +38,7 @@
 #include <openvpn/common/process.hpp>
 #include <openvpn/common/format.hpp>
 #include <openvpn/common/scoped_fd.hpp>
+#include <openvpn/ip/gso.hpp>
 #include <openvpn/tun/tunio.hpp>
 #include <openvpn/tun/layer.hpp>
 #include <openvpn/log/sessionstats.hpp>
@@ -61,6 +62,126 @@ namespace openvpn {
     OPENVPN_EXCEPTION(tun_tx_queue_len_error);
     OPENVPN_EXCEPTION(tun_ifconfig_error);
 
+    enum { // Tun constructor flags
+      MULTI_QUEUE=(1<<0),  // open with IFF_MULTI_QUEUE
+      ATTACH_QUEUE=(1<<1), // attach an additional queue to an existing multi-queue device
+      VNET_HDR=(1<<2),     // open with IFF_VNET_HDR and TCP segmentation/checksum offload,
+                           // see TunIO::enable_vnet_hdr
+    };
+
+    inline void tun_attach_queue(const std::string& name, struct ifreq& ifr, ScopedFD& fd)
+    {
+      if (name.length() >= IFNAMSIZ)
+	throw tun_name_error();
+      ::strcpy (ifr.ifr_name, name.c_str());
+      if (ioctl (fd(), TUNSETIFF, (void *) &ifr) < 0)
+	{
+	  const int eno = errno;
+	  OPENVPN_THROW(tun_ioctl_error, "failed to attach queue to tun device '" << name << "' : " << errinfo(eno));
+	}
+    }
+
+    inline void tun_open_unit(const std::string& name, struct ifreq& ifr, ScopedFD& fd)
+    {
+      if (!name.empty())
+	{
+	  const int max_units = 256;
+	  for (int unit = 0; unit < max_units; ++unit)
+	    {
+	      std::string n = name;
+	      if (unit)
+		n += openvpn::to_string(unit);
+	      if (n.length() < IFNAMSIZ)
+		::strcpy (ifr.ifr_name, n.c_str());
+	      else
+		throw tun_name_error();
+	      if (ioctl (fd(), TUNSETIFF, (void *) &ifr) == 0)
+		return;
+	    }
+	  const int eno = errno;
+	  OPENVPN_THROW(tun_ioctl_error, "failed to open tun device '" << name << "' after trying " << max_units << "units : " << errinfo(eno));
+	}
+      else
+	{
+	  if (ioctl (fd(), TUNSETIFF, (void *) &ifr) < 0)
+	    {
+	      const int eno = errno;
+	      OPENVPN_THROW(tun_ioctl_error, "failed to open tun device '" << name << "' : " << errinfo(eno));
+	    }
+	}
+    }
+
+    // Open /dev/net/tun as a non-blocking descriptor for users that
+    // drive it without asio.  name is set to the interface opened.
+    inline int tun_open(std::string& name,
+			const Layer& layer,
+			const int txqueuelen,
+			const unsigned int flags=0)
+    {
+      static const char node[] = "/dev/net/tun";
+      ScopedFD fd(open(node, O_RDWR));
+      if (!fd.defined())
+	OPENVPN_THROW(tun_open_error, "error opening tun device " << node << ": " << errinfo(errno));
+
+      struct ifreq ifr;
+      std::memset(&ifr, 0, sizeof(ifr));
+      if (flags & (MULTI_QUEUE|ATTACH_QUEUE))
+	ifr.ifr_flags = IFF_MULTI_QUEUE;
+      else
+	ifr.ifr_flags = IFF_ONE_QUEUE;
+      ifr.ifr_flags |= IFF_NO_PI;
+      if (flags & VNET_HDR)
+	ifr.ifr_flags |= IFF_VNET_HDR;
+      if (layer() == Layer::OSI_LAYER_3)
+	ifr.ifr_flags |= IFF_TUN;
+      else if (layer() == Layer::OSI_LAYER_2)
+	ifr.ifr_flags |= IFF_TAP;
+      else
+	throw tun_layer_error("unknown OSI layer");
+
+      if (flags & ATTACH_QUEUE)
+	tun_attach_queue(name, ifr, fd);
+      else
+	tun_open_unit(name, ifr, fd);
+
+      if (fcntl (fd(), F_SETFL, O_NONBLOCK) < 0)
+	throw tun_fcntl_error(errinfo(errno));
+
+      // Let the stack hand us TCP super-packets of up to 64 KB with
+      // checksums left partial, rather than segmenting them first
+      if (flags & VNET_HDR)
+	{
+	  const int hdr_size = sizeof(GSO::VnetHdr);
+	  if (ioctl (fd(), TUNSETVNETHDRSZ, (void *) &hdr_size) < 0
+	      || ioctl (fd(), TUNSETOFFLOAD, (unsigned long)(TUN_F_CSUM|TUN_F_TSO4|TUN_F_TSO6|TUN_F_TSO_ECN)) < 0)
+	    {
+	      const int eno = errno;
+	      OPENVPN_THROW(tun_ioctl_error, "failed to enable offloads on tun device '" << ifr.ifr_name << "' : " << errinfo(eno));
+	    }
+	}
+
+      // Set the TX send queue size
+      if (txqueuelen)
+	{
+	  struct ifreq netifr;
+	  ScopedFD ctl_fd(socket (AF_INET, SOCK_DGRAM, 0));
+
+	  if (ctl_fd.defined())
+	    {
+	      std::memset(&netifr, 0, sizeof(netifr));
+	      strcpy (netifr.ifr_name, ifr.ifr_name);
+	      netifr.ifr_qlen = txqueuelen;
+	      if (ioctl (ctl_fd(), SIOCSIFTXQLEN, (void *) &netifr) < 0)
+		throw tun_tx_queue_len_error(errinfo(errno));
+	    }
+	  else
+	    throw tun_tx_queue_len_error(errinfo(errno));
+	}
+
+      name = ifr.ifr_name;
+      return fd.release();
+    }
+
     template <typename ReadHandler>
     class Tun : public TunIO<ReadHandler, PacketFrom, asio::posix::stream_descriptor>
     {
@@ -75,85 +196,32 @@ namespace openvpn {
 	  const SessionStats::Ptr& stats_arg,
 	  const std::string& name,
 	  const Layer& layer,
-	  const int txqueuelen)
+	  const int txqueuelen,
+	  const unsigned int flags=0)
 	: Base(read_handler_arg, frame_arg, stats_arg)
       {
-	static const char node[] = "/dev/net/tun";
-	ScopedFD fd(open(node, O_RDWR));
-	if (!fd.defined())
-	  OPENVPN_THROW(tun_open_error, "error opening tun device " << node << ": " << errinfo(errno));
-
-	struct ifreq ifr;
-	std::memset(&ifr, 0, sizeof(ifr));
-	ifr.ifr_flags = IFF_ONE_QUEUE;
-	ifr.ifr_flags |= IFF_NO_PI;
-	if (layer() == Layer::OSI_LAYER_3)
-	  ifr.ifr_flags |= IFF_TUN;
-	else if (layer() == Layer::OSI_LAYER_2)
-	  ifr.ifr_flags |= IFF_TAP;
-	else
-	  throw tun_layer_error("unknown OSI layer");
-
-	open_unit(name, ifr, fd);
-
-	if (fcntl (fd(), F_SETFL, O_NONBLOCK) < 0)
-	  throw tun_fcntl_error(errinfo(errno));
-
-	// Set the TX send queue size
-	if (txqueuelen)
-	  {
-	    struct ifreq netifr;
-	    ScopedFD ctl_fd(socket (AF_INET, SOCK_DGRAM, 0));
-
-	    if (ctl_fd.defined())
-	      {
-		std::memset(&netifr, 0, sizeof(netifr));
-		strcpy (netifr.ifr_name, ifr.ifr_name);
-		netifr.ifr_qlen = txqueuelen;
-		if (ioctl (ctl_fd(), SIOCSIFTXQLEN, (void *) &netifr) < 0)
-		  throw tun_tx_queue_len_error(errinfo(errno));
-	      }
-	    else
-	      throw tun_tx_queue_len_error(errinfo(errno));
-	  }
-
-	Base::name_ = ifr.ifr_name;
-	Base::stream = new asio::posix::stream_descriptor(io_context, fd.release());
+	std::string n = name;
+	const int fd = tun_open(n, layer, txqueuelen, flags);
+	Base::name_ = n;
+	Base::stream = new asio::posix::stream_descriptor(io_context, fd);
 	OPENVPN_LOG_TUN(Base::name_ << " opened");
       }
 
-      ~Tun() { Base::stop(); }
-
-    private:
-      static void open_unit(const std::string& name, struct ifreq& ifr, ScopedFD& fd)
+      // Adopt an already open, non-blocking tun descriptor, such as
+      // one queue of a multi-queue device opened with tun_open().
+      Tun(asio::io_context& io_context,
+	  ReadHandler read_handler_arg,
+	  const Frame::Ptr& frame_arg,
+	  const SessionStats::Ptr& stats_arg,
+	  const std::string& name,
+	  const int fd)
+	: Base(read_handler_arg, frame_arg, stats_arg)
       {
-	if (!name.empty())
-	  {
-	    const int max_units = 256;
-	    for (int unit = 0; unit < max_units; ++unit)
-	      {
-		std::string n = name;
-		if (unit)
-		  n += openvpn::to_string(unit);
-		if (n.length() < IFNAMSIZ)
-		  ::strcpy (ifr.ifr_name, n.c_str());
-		else
-		  throw tun_name_error();
-		if (ioctl (fd(), TUNSETIFF, (void *) &ifr) == 0)
-		  return;
-	      }
-	    const int eno = errno;
-	    OPENVPN_THROW(tun_ioctl_error, "failed to open tun device '" << name << "' after trying " << max_units << "units : " << errinfo(eno));
-	  }
-	else
-	  {
-	    if (ioctl (fd(), TUNSETIFF, (void *) &ifr) < 0)
-	      {
-		const int eno = errno;
-		OPENVPN_THROW(tun_ioctl_error, "failed to open tun device '" << name << "' : " << errinfo(eno));
-	      }
-	  }
+	Base::name_ = name;
+	Base::stream = new asio::posix::stream_descriptor(io_context, fd);
       }
+
+      ~Tun() { Base::stop(); }
     };
 
   }
@@ -94,10 +94,15 @@ namespace openvpn {
       TunProp::Config tun_prop;
       int n_parallel = 8;        // number of parallel async reads on tun socket
 
+      // If nonzero, drain up to batch_limit ready packets per
+      // reactor wakeup (see TunIO::start_batch).
+      unsigned int batch_limit = 0;
+
       Frame::Ptr frame;
       SessionStats::Ptr stats;
 
       TunPersist::Ptr tun_persist;
+      TunBuilderSetup::Base::Ptr persisted_setup; // setup object of persisted tun
 
       Stop* stop = nullptr;
 
@@ -134,14 +139,17 @@ namespace openvpn {
       virtual void finalize(const bool disconnected)
       {
 	if (disconnected)
-	  tun_persist.reset();
+	  {
+	    tun_persist.reset();
+	    persisted_setup.reset();
+	  }
       }
     };
 
     class Client : public TunClient
     {
       friend class ClientConfig;  // calls constructor
-      friend class TunIO<Client*, PacketFrom, TunWrapAsioStream<TunPersist> >;  // calls tun_read_handler
+      friend class TunIO<Client*, PacketFrom, TunWrapAsioStream<TunPersist> >;  // calls tun_read_handler, tun_read_handler_batch
 
       typedef Tun<Client*, TunPersist> TunImpl;
 
@@ -171,6 +179,10 @@ namespace openvpn {
 		  state = tun_persist->state();
 		  OPENVPN_LOG("TunPersist: reused tun context");
 		}
+	      else if (update_persisted_routes(server_addr, opt))
+		{
+		  OPENVPN_LOG("TunPersist: updated routes of persisted tun context");
+		}
 	      else
 		{
 		  OPENVPN_LOG("TunPersist: new tun context");
@@ -230,6 +242,8 @@ namespace openvpn {
 
 		  // enable tun_setup destructor
 		  tun_persist->add_destructor(tun_setup);
+		  if (config->tun_persist)
+		    config->persisted_setup = tun_setup;
 		}
 
 	      // configure tun interface packet forwarding
@@ -241,7 +255,7 @@ namespace openvpn {
 				     config->frame,
 				     config->stats
 				     ));
-	      impl->start(config->n_parallel);
+	      impl->start_batch(config->n_parallel, config->batch_limit);
 
 	      // signal that we are connected
 	      parent.tun_connected();
@@ -265,6 +279,13 @@ namespace openvpn {
 	return send(buf);
       }
 
+      virtual bool tun_send_batch(BufferAllocated** bufs, const size_t n) override
+      {
+	if (impl)
+	  return impl->write_batch(bufs, n) == n;
+	return false;
+      }
+
       virtual std::string tun_name() const override
       {
 	if (impl)
@@ -337,6 +358,59 @@ namespace openvpn {
 	parent.tun_recv(pfp->buf);
       }
 
+      void tun_read_handler_batch(TunImpl::PacketFromBatch& batch, const size_t n) // called by TunImpl
+      {
+	for (size_t i = 0; i < n && !halt; ++i)
+	  parent.tun_recv(batch[i]->buf);
+      }
+
+      // If the persisted tun differs from the to-be-created session
+      // only in its routes, add and delete the changed routes in
+      // place rather than reconfiguring the interface.
+      bool update_persisted_routes(const IP::Addr& server_addr, const OptionList& opt)
+      {
+	if (!config->tun_persist || !config->persisted_setup || !tun_persist->obj_defined() || !tun_persist->state())
+	  return false;
+
+	// emulated exclude routes
+	EmulateExcludeRouteFactory::Ptr eer_factory;
+#ifdef TEST_EER
+	eer_factory.reset(new EmulateExcludeRouteFactoryImpl(true));
+#endif
+	TunBuilderCapture::Ptr po(new TunBuilderCapture());
+	TunProp::configure_builder(po.get(),
+				   state.get(),
+				   nullptr,
+				   server_addr,
+				   config->tun_prop,
+				   opt,
+				   eer_factory.get(),
+				   false);
+	if (!po->mtu)
+	  po->mtu = 1500;
+
+	Setup::Config tsconf;
+	tsconf.iface_name = tun_persist->state()->iface_name;
+	tsconf.layer = config->tun_prop.layer;
+
+	bool updated;
+	{
+	  std::ostringstream os;
+	  auto os_print = Cleanup([&os](){ OPENVPN_LOG_STRING(os.str()); });
+	  updated = config->persisted_setup->update_routes(*po, &tsconf, os);
+	}
+	if (!updated)
+	  return false;
+
+	OPENVPN_LOG("CAPTURED OPTIONS:" << std::endl << po->to_string());
+	tun_setup = config->persisted_setup;
+	state->iface_name = tun_persist->state()->iface_name;
+	state->tun_prefix = tun_persist->state()->tun_prefix;
+	if (tun_persist->update_tun_state(state))
+	  OPENVPN_LOG("TunPersist: saving tun context:" << std::endl << tun_persist->options());
+	return true;
+      }
+
       void tun_error_handler(const Error::Type errtype, // called by TunImpl
 			     const asio::error_code* error)
       {
@@ -41,6 +41,7 @@
 #include <openvpn/tun/mac/macgw.hpp>
 #include <openvpn/tun/mac/macdns_watchdog.hpp>
 #include <openvpn/tun/builder/rgwflags.hpp>
+#include <openvpn/tun/builder/routediff.hpp>
 #include <openvpn/tun/builder/setup.hpp>
 
 #ifdef HAVE_JSONCPP
@@ -134,7 +135,8 @@ namespace openvpn {
 	remove_cmds.reset(new ActionList());
 
 	// populate add/remove lists with actions
-	tun_config(conf->iface_name, pull, *add_cmds, *remove_cmds, os);
+	iface_name_ = conf->iface_name;
+	tun_config(iface_name_, pull, *add_cmds, *remove_cmds, os);
 
 	// execute the add actions
 	add_cmds->execute(os);
@@ -147,13 +149,42 @@ namespace openvpn {
 	return fd;
       }
 
+      // Apply only the route changes, if pull differs from the
+      // established config in nothing else.
+      virtual bool update_routes(const TunBuilderCapture& pull, // defined by TunBuilderSetup::Base
+				 TunBuilderSetup::Config* config,
+				 std::ostream& os) override
+      {
+	if (!remove_cmds)
+	  return false;
+
+	MacGWInfo gw;
+	TunBuilderRouteDiff::Delta delta;
+	if (!route_set.diff(pull, gw.to_string(), delta))
+	  return false;
+	os << delta.to_string() << std::endl;
+
+	// delete stale routes before adding new ones
+	ActionList::Ptr cmds(new ActionList());
+	for (auto &d : delta.del)
+	  cmds->add(route_set.release(d.first, d.second));
+	for (auto &a : delta.add)
+	  add_route(a.first, *a.second, pull, iface_name_, gw, *cmds, os);
+	cmds->execute(os);
+	return true;
+      }
+
       virtual void destroy(std::ostream& os) override // defined by DestructorBase
       {
+	// pushed routes
+	route_set.destroy(os);
+
 	if (remove_cmds)
 	  {
 	    remove_cmds->destroy(os);
 	    remove_cmds.reset();
 	  }
+	iface_name_.clear();
       }
 
       virtual ~Setup()
@@ -282,11 +313,73 @@ namespace openvpn {
 	destroy.add(d);
       }
 
-      static void tun_config(const std::string& iface_name,
-			     const TunBuilderCapture& pull,
-			     ActionList& create,
-			     ActionList& destroy,
-			     std::ostream& os)
+      // Build the commands that add and delete a pushed route
+      static void route_actions(const TunBuilderRouteDiff::Type type,
+				const TunBuilderCapture::Route& route,
+				const TunBuilderCapture& pull,
+				const std::string& iface_name,
+				const MacGWInfo& gw,
+				Action::Ptr& create,
+				Action::Ptr& destroy,
+				std::ostream& os)
+      {
+	if (type == TunBuilderRouteDiff::EXCLUDE_ROUTE)
+	  {
+	    if (route.ipv6)
+	      {
+		if (!pull.block_ipv6)
+		  {
+		    if (gw.v6.defined())
+		      add_del_route(route.address, route.prefix_length, gw.v6.router.to_string(), gw.v6.iface, R_IPv6|R_IFACE_HINT, create, destroy);
+		    else
+		      os << "NOTE: cannot determine gateway for exclude IPv6 routes" << std::endl;
+		  }
+	      }
+	    else
+	      {
+		if (gw.v4.defined())
+		  add_del_route(route.address, route.prefix_length, gw.v4.router.to_string(), gw.v4.iface, 0, create, destroy);
+		else
+		  os << "NOTE: cannot determine gateway for exclude IPv4 routes" << std::endl;
+	      }
+	  }
+	else if (route.ipv6)
+	  {
+	    const TunBuilderCapture::RouteAddress* local6 = pull.vpn_ipv6();
+	    if (!pull.block_ipv6 && local6)
+	      add_del_route(route.address, route.prefix_length, local6->gateway, iface_name, R_IPv6|R_IFACE, create, destroy);
+	  }
+	else
+	  {
+	    const TunBuilderCapture::RouteAddress* local4 = pull.vpn_ipv4();
+	    if (local4 && !local4->gateway.empty())
+	      add_del_route(route.address, route.prefix_length, local4->gateway, iface_name, 0, create, destroy);
+	    else
+	      os << "ERROR: IPv4 route pushed without IPv4 ifconfig and/or route-gateway" << std::endl;
+	  }
+      }
+
+      // Queue the add command of a pushed route on create, and
+      // track its delete command in route_set
+      void add_route(const TunBuilderRouteDiff::Type type,
+		     const TunBuilderCapture::Route& route,
+		     const TunBuilderCapture& pull,
+		     const std::string& iface_name,
+		     const MacGWInfo& gw,
+		     ActionList& create,
+		     std::ostream& os)
+      {
+	Action::Ptr c, d;
+	route_actions(type, route, pull, iface_name, gw, c, d, os);
+	create.add(c);
+	route_set.add(type, route, d);
+      }
+
+      void tun_config(const std::string& iface_name,
+		      const TunBuilderCapture& pull,
+		      ActionList& create,
+		      ActionList& destroy,
+		      std::ostream& os)
       {
 	// get default gateway
 	MacGWInfo gw;
@@ -342,51 +435,14 @@ namespace openvpn {
 	    add_del_route(local6->address, local6->prefix_length, "", iface_name, R_IPv6|R_IFACE, create, destroy);
 	  }
 
-	// Process Routes
-	{
-	  for (std::vector<TunBuilderCapture::Route>::const_iterator i = pull.add_routes.begin(); i != pull.add_routes.end(); ++i)
-	    {
-	      const TunBuilderCapture::Route& route = *i;
-	      if (route.ipv6)
-		{
-		  if (!pull.block_ipv6)
-		    add_del_route(route.address, route.prefix_length, local6->gateway, iface_name, R_IPv6|R_IFACE, create, destroy);
-		}
-	      else
-		{
-		  if (local4 && !local4->gateway.empty())
-		    add_del_route(route.address, route.prefix_length, local4->gateway, iface_name, 0, create, destroy);
-		  else
-		    os << "ERROR: IPv4 route pushed without IPv4 ifconfig and/or route-gateway" << std::endl;
-		}
-	    }
-	}
-
-	// Process exclude routes
-	if (!pull.exclude_routes.empty())
-	  {
-	    for (std::vector<TunBuilderCapture::Route>::const_iterator i = pull.exclude_routes.begin(); i != pull.exclude_routes.end(); ++i)
-	      {
-		const TunBuilderCapture::Route& route = *i;
-		if (route.ipv6)
-		  {
-		    if (!pull.block_ipv6)
-		      {
-			if (gw.v6.defined())
-			  add_del_route(route.address, route.prefix_length, gw.v6.router.to_string(), gw.v6.iface, R_IPv6|R_IFACE_HINT, create, destroy);
-			else
-			  os << "NOTE: cannot determine gateway for exclude IPv6 routes" << std::endl;
-		      }
-		  }
-		else
-		  {
-		    if (gw.v4.defined())
-		      add_del_route(route.address, route.prefix_length, gw.v4.router.to_string(), gw.v4.iface, 0, create, destroy);
-		    else
-		      os << "NOTE: cannot determine gateway for exclude IPv4 routes" << std::endl;
-		  }
-	      }
-	  }
+	// Process routes and exclude routes.  Their delete commands
+	// are kept in route_set rather than destroy, so that a later
+	// config differing only in its routes can be applied incrementally.
+	route_set.reset(pull, gw.to_string());
+	for (auto &route : pull.add_routes)
+	  add_route(TunBuilderRouteDiff::ADD_ROUTE, route, pull, iface_name, gw, create, os);
+	for (auto &route : pull.exclude_routes)
+	  add_route(TunBuilderRouteDiff::EXCLUDE_ROUTE, route, pull, iface_name, gw, create, os);
 
 	// Process IPv4 redirect-gateway
 	if (pull.reroute_gw.ipv4)
@@ -465,6 +521,10 @@ namespace openvpn {
       }
 
       ActionList::Ptr remove_cmds;
+
+      // pushed routes and their delete commands
+      TunBuilderRouteDiff route_set;
+      std::string iface_name_;
     };
   }
 }
@@ -156,46 +156,12 @@ namespace openvpn {
 	// cleanup settings applied to previous interface
 	interface_change_cleanup(info.get());
 
+	// push it
+	apply_config(*info, config);
 	if (config.redirect_dns)
-	  {
-	    // redirect all DNS
-	    info->dns.will_modify();
-
-	    // set DNS servers
-	    if (CF::array_len(config.dns_servers))
-	      {
-		info->dns.backup_orig("ServerAddresses");
-		CF::dict_set_obj(info->dns.mod, "ServerAddresses", config.dns_servers());
-	      }
-
-	    // set search domains
-	    info->dns.backup_orig("SearchDomains");
-	    if (CF::array_len(config.search_domains))
-	      CF::dict_set_obj(info->dns.mod, "SearchDomains", config.search_domains());
-
-	    // set search order
-	    info->dns.backup_orig("SearchOrder");
-	    CF::dict_set_int(info->dns.mod, "SearchOrder", config.search_order);
-
-	    // push it
-	    mod |= info->dns.push_to_store();
-	  }
+	  mod |= info->dns.push_to_store();
 	else
-	  {
-	    // redirect specific domains
-	    info->ovpn.mod_reset();
-	    if (CF::array_len(config.dns_servers) && CF::array_len(config.search_domains))
-	      {
-		// set DNS servers
-		CF::dict_set_obj(info->ovpn.mod, "ServerAddresses", config.dns_servers());
-
-		// set search domains, reverse domains can be added here as well
-		CF::dict_set_obj(info->ovpn.mod, "SupplementalMatchDomains", config.search_domains());
-	      }
-
-	    // push it
-	    mod |= info->ovpn.push_to_store();
-	  }
+	  mod |= info->ovpn.push_to_store();
 
 	if (mod)
 	  {
@@ -222,6 +188,25 @@ namespace openvpn {
       return mod;
     }
 
+    // Return true if setdns(config) would modify the store,
+    // without modifying it.
+    bool setdns_pending(const Config& config) const
+    {
+      try {
+	CF::DynamicStore sc = ds_create();
+	Info::Ptr info(new Info(sc, sname));
+	if (info->interface_change(prev.get()))
+	  return true;
+	apply_config(*info, config);
+	return config.redirect_dns ? info->dns.dirty() : info->ovpn.dirty();
+      }
+      catch (const std::exception& e)
+	{
+	  OPENVPN_LOG("MacDNS: setdns_pending: " << e.what());
+	  return true;
+	}
+    }
+
     bool resetdns()
     {
       bool mod = false;
@@ -273,6 +258,45 @@ namespace openvpn {
     }
 
   private:
+    // Stage the modifications of config in the mod dicts of info
+    static void apply_config(Info& info, const Config& config)
+    {
+      if (config.redirect_dns)
+	{
+	  // redirect all DNS
+	  info.dns.will_modify();
+
+	  // set DNS servers
+	  if (CF::array_len(config.dns_servers))
+	    {
+	      info.dns.backup_orig("ServerAddresses");
+	      CF::dict_set_obj(info.dns.mod, "ServerAddresses", config.dns_servers());
+	    }
+
+	  // set search domains
+	  info.dns.backup_orig("SearchDomains");
+	  if (CF::array_len(config.search_domains))
+	    CF::dict_set_obj(info.dns.mod, "SearchDomains", config.search_domains());
+
+	  // set search order
+	  info.dns.backup_orig("SearchOrder");
+	  CF::dict_set_int(info.dns.mod, "SearchOrder", config.search_order);
+	}
+      else
+	{
+	  // redirect specific domains
+	  info.ovpn.mod_reset();
+	  if (CF::array_len(config.dns_servers) && CF::array_len(config.search_domains))
+	    {
+	      // set DNS servers
+	      CF::dict_set_obj(info.ovpn.mod, "ServerAddresses", config.dns_servers());
+
+	      // set search domains, reverse domains can be added here as well
+	      CF::dict_set_obj(info.ovpn.mod, "SupplementalMatchDomains", config.search_domains());
+	    }
+	}
+    }
+
     void interface_change_cleanup(Info* info)
     {
       if (info->interface_change(prev.get()))
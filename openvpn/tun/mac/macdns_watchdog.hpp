@@ -24,18 +24,24 @@
 #ifndef OPENVPN_TUN_MAC_MACDNS_WATCHDOG_H
 #define OPENVPN_TUN_MAC_MACDNS_WATCHDOG_H
 
-#include <thread>
-#include <mutex>
+#include <string>
+#include <sstream>
+
+#include <dispatch/dispatch.h>
 
 #include <openvpn/log/logthread.hpp>
 #include <openvpn/common/action.hpp>
-#include <openvpn/applecrypto/cf/cftimer.hpp>
-#include <openvpn/apple/runloop.hpp>
+#include <openvpn/apple/scdynstore.hpp>
 #include <openvpn/tun/mac/macdns.hpp>
 
 namespace openvpn {
   OPENVPN_EXCEPTION(macdns_watchdog_error);
 
+  // The watchdog has no thread of its own.  SCDynamicStore
+  // notifications and the debounced push timer are delivered on a
+  // private serial dispatch queue, which only wakes up when a
+  // watched key changes.  All MacDNS calls made while the watchdog
+  // is active are serialized on that queue.
   class MacDNSWatchdog : public RC<thread_unsafe_refcount>
   {
   public:
@@ -91,14 +97,13 @@ namespace openvpn {
     };
 
     MacDNSWatchdog()
-      : macdns(new MacDNS("OpenVPNConnect")),
-	thread(nullptr)
+      : macdns(new MacDNS("OpenVPNConnect"))
     {
     }
 
     virtual ~MacDNSWatchdog()
     {
-      stop_thread();
+      stop_watch();
     }
 
     static void add_actions(const MacDNS::Config::Ptr& dns,
@@ -115,37 +120,43 @@ namespace openvpn {
     }
 
   private:
+    struct SetDNS
+    {
+      MacDNSWatchdog* self;
+      const MacDNS::Config::Ptr* config;
+      bool mod;
+    };
+
     bool setdns(const MacDNS::Config::Ptr& config, const unsigned int flags)
     {
       bool mod = false;
       if (config)
 	{
 	  if ((flags & SYNCHRONOUS) || !(flags & ENABLE_WATCHDOG))
-	    stop_thread();
-	  config_ = config;
-	  if (flags & ENABLE_WATCHDOG)
+	    stop_watch();
+	  if ((flags & ENABLE_WATCHDOG) && !queue)
+	    {
+	      config_ = config;
+	      mod = macdns->setdns(*config_);
+	      start_watch();
+	    }
+	  else if (queue)
 	    {
-	      if (!thread)
-		{
-		  mod = macdns->setdns(*config_);
-		  thread = new std::thread(&MacDNSWatchdog::thread_func, this);
-		}
-	      else
-		{
-		  if (runloop.defined())
-		    schedule_push_timer(0);
-		  else
-		    OPENVPN_LOG("MacDNSWatchdog::setdns: runloop undefined");
-		}
+	      // a new config of a running watchdog is applied on the
+	      // queue, so it can't race with a push timer callback
+	      SetDNS sd = { this, &config, false };
+	      dispatch_sync_f(queue, &sd, setdns_on_queue);
+	      mod = sd.mod;
 	    }
 	  else
 	    {
+	      config_ = config;
 	      mod = macdns->setdns(*config_);
 	    }
 	}
       else
 	{
-	  stop_thread();
+	  stop_watch();
 	  config_.reset();
 	  mod = macdns->resetdns();
 	}
@@ -157,6 +168,15 @@ namespace openvpn {
       return mod;
     }
 
+    // dispatch_sync_f runs this on the calling thread, which already
+    // has a log context
+    static void setdns_on_queue(void* arg)
+    {
+      SetDNS* sd = (SetDNS*)arg;
+      sd->self->config_ = *sd->config;
+      sd->mod = sd->self->macdns->setdns(*sd->self->config_);
+    }
+
     std::string to_string() const
     {
       const MacDNS::Config::Ptr config(config_);
@@ -166,32 +186,28 @@ namespace openvpn {
 	return std::string("UNDEF");
     }
 
-    void stop_thread()
-    {
-      if (thread)
-	{
-	  if (runloop.defined())
-	    CFRunLoopStop(runloop());
-	  thread->join();
-	  delete thread;
-	  thread = nullptr;
-	}
-    }
-
-    // All methods below this point called in the context of watchdog thread
-    // except for schedule_push_timer which may be called from parent thread
-    // as well.
-    void thread_func()
+    void start_watch()
     {
-      runloop.reset(CFRunLoopGetCurrent(), CF::BORROW);
-      Log::Context logctx(logwrap);
-
       try {
+	queue = dispatch_queue_create("net.openvpn.MacDNSWatchdog", DISPATCH_QUEUE_SERIAL);
+	if (!queue)
+	  throw macdns_watchdog_error("dispatch_queue_create");
+
+	// one-shot timer that is re-armed by every notification,
+	// so a burst of changes causes a single reassertion
+	push_timer = dispatch_source_create(DISPATCH_SOURCE_TYPE_TIMER, 0, 0, queue);
+	if (!push_timer)
+	  throw macdns_watchdog_error("dispatch_source_create");
+	dispatch_set_context(push_timer, this);
+	dispatch_source_set_event_handler_f(push_timer, push_timer_callback_static);
+	dispatch_source_set_timer(push_timer, DISPATCH_TIME_FOREVER, DISPATCH_TIME_FOREVER, 0);
+	dispatch_resume(push_timer);
+
 	SCDynamicStoreContext context = {0, this, nullptr, nullptr, nullptr};
-	CF::DynamicStore ds(SCDynamicStoreCreate(kCFAllocatorDefault,
-						 CFSTR("OpenVPN_MacDNSWatchdog"),
-						 callback_static,
-						 &context));
+	ds.reset(SCDynamicStoreCreate(kCFAllocatorDefault,
+				      CFSTR("OpenVPN_MacDNSWatchdog"),
+				      callback_static,
+				      &context));
 	if (!ds.defined())
 	  throw macdns_watchdog_error("SCDynamicStoreCreate");
 	const CF::Array watched_keys(macdns->dskey_array());
@@ -201,21 +217,40 @@ namespace openvpn {
 					       watched_keys(),
 					       nullptr))
 	  throw macdns_watchdog_error("SCDynamicStoreSetNotificationKeys failed");
-	CF::RunLoopSource rls(SCDynamicStoreCreateRunLoopSource(kCFAllocatorDefault, ds(), 0));
-	if (!rls.defined())
-	  throw macdns_watchdog_error("SCDynamicStoreCreateRunLoopSource failed");
-	CFRunLoopAddSource(CFRunLoopGetCurrent(), rls(), kCFRunLoopDefaultMode);
-
-	// process event loop until CFRunLoopStop is called from parent thread
-	CFRunLoopRun();
+	if (!SCDynamicStoreSetDispatchQueue(ds(), queue))
+	  throw macdns_watchdog_error("SCDynamicStoreSetDispatchQueue failed");
       }
       catch (const std::exception& e)
 	{
-	  OPENVPN_LOG("MacDNSWatchdog::thread_func: " << e.what());
+	  OPENVPN_LOG("MacDNSWatchdog::start_watch: " << e.what());
+	  stop_watch();
 	}
-      cancel_push_timer();
     }
 
+    void stop_watch()
+    {
+      if (ds.defined())
+	{
+	  SCDynamicStoreSetDispatchQueue(ds(), nullptr);
+	  ds.reset();
+	}
+      if (push_timer)
+	{
+	  dispatch_source_cancel(push_timer);
+	  dispatch_release(push_timer);
+	  push_timer = nullptr;
+	}
+      if (queue)
+	{
+	  // wait for any callback already running on the queue
+	  dispatch_sync_f(queue, nullptr, [](void*) {});
+	  dispatch_release(queue);
+	  queue = nullptr;
+	}
+    }
+
+    // All methods below this point are called on queue.
+
     static void callback_static(SCDynamicStoreRef store, CFArrayRef changedKeys, void *arg)
     {
       MacDNSWatchdog *self = (MacDNSWatchdog *)arg;
@@ -224,50 +259,51 @@ namespace openvpn {
 
     void callback(SCDynamicStoreRef store, CFArrayRef changedKeys)
     {
-      // DNS Watchdog delay from the time that change is detected
-      // to when we forcibly revert it (seconds).
-      schedule_push_timer(1);
-    }
+      Log::Context logctx(logwrap);
 
-    void schedule_push_timer(const int seconds)
-    {
-      std::lock_guard<std::mutex> lock(push_timer_lock);
-      CFRunLoopTimerContext context = { 0, this, nullptr, nullptr, nullptr };
-      cancel_push_timer_nolock();
-      push_timer.reset(CFRunLoopTimerCreate(kCFAllocatorDefault, CFAbsoluteTimeGetCurrent() + seconds, 0, 0, 0, push_timer_callback_static, &context));
-      if (push_timer.defined())
-	CFRunLoopAddTimer(runloop(), push_timer(), kCFRunLoopCommonModes);
-      else
-	OPENVPN_LOG("MacDNSWatchdog::schedule_push_timer: failed to create timer");
-    }
+      // only reassert if the store now differs from our config,
+      // since our own writes and changes to keys that don't affect
+      // our settings notify us as well
+      if (!config_ || !macdns->setdns_pending(*config_))
+	return;
 
-    void cancel_push_timer_nolock()
-    {
-      if (push_timer.defined())
+      const CFIndex n = changedKeys ? CFArrayGetCount(changedKeys) : 0;
+      for (CFIndex i = 0; i < n; ++i)
 	{
-	  CFRunLoopTimerInvalidate(push_timer());
-	  push_timer.reset(nullptr);
+	  const CF::String key = CF::string_cast(CFArrayGetValueAtIndex(changedKeys, i));
+	  if (key.defined())
+	    OPENVPN_LOG("MacDNSWatchdog: changed by third party: " << CF::cppstring(key));
 	}
+
+      // DNS Watchdog delay from the time that change is detected
+      // to when we forcibly revert it (seconds).
+      schedule_push_timer(1);
     }
 
-    void cancel_push_timer()
+    void schedule_push_timer(const int seconds)
     {
-      std::lock_guard<std::mutex> lock(push_timer_lock);
-      cancel_push_timer_nolock();
+      dispatch_source_set_timer(push_timer,
+				dispatch_time(DISPATCH_TIME_NOW, seconds * NSEC_PER_SEC),
+				DISPATCH_TIME_FOREVER,
+				100 * NSEC_PER_MSEC);
     }
 
-    static void push_timer_callback_static(CFRunLoopTimerRef timer, void *info)
+    static void push_timer_callback_static(void *info)
     {
       MacDNSWatchdog* self = (MacDNSWatchdog*)info;
-      self->push_timer_callback(timer);
+      self->push_timer_callback();
     }
 
-    void push_timer_callback(CFRunLoopTimerRef timer)
+    void push_timer_callback()
     {
+      Log::Context logctx(logwrap);
+
+      // one-shot
+      dispatch_source_set_timer(push_timer, DISPATCH_TIME_FOREVER, DISPATCH_TIME_FOREVER, 0);
       try {
 	// reset DNS settings after watcher detected modifications by third party
 	const MacDNS::Config::Ptr config(config_);
-	if (macdns->setdns(*config))
+	if (config && macdns->setdns(*config))
 	  OPENVPN_LOG("MacDNSWatchdog: updated DNS settings");
       }
       catch (const std::exception& e)
@@ -276,14 +312,12 @@ namespace openvpn {
 	}
     }
 
-
     MacDNS::Config::Ptr config_;
     MacDNS::Ptr macdns;
 
-    std::thread* thread;            // watcher thread
-    CF::RunLoop runloop;           // run loop in watcher thread
-    CF::Timer push_timer;          // watcher thread timer
-    std::mutex push_timer_lock;
+    dispatch_queue_t queue = nullptr;            // serializes watchdog callbacks
+    dispatch_source_t push_timer = nullptr;      // debounced reassertion
+    CF::DynamicStore ds;                         // notification source
     Log::Context::Wrapper logwrap; // used to carry forward the log context from parent thread
   };
 }
@@ -22,6 +22,9 @@
 #ifndef OPENVPN_TUN_PERSIST_TUNPERSIST_H
 #define OPENVPN_TUN_PERSIST_TUNPERSIST_H
 
+#include <string>
+#include <functional>
+
 #include <openvpn/common/size.hpp>
 #include <openvpn/tun/persist/tunwrap.hpp>
 #include <openvpn/tun/client/tunprop.hpp>
@@ -60,6 +63,7 @@ namespace openvpn {
     void invalidate()
     {
       options_.clear();
+      fast_key_.clear();
     }
 
     void close()
@@ -99,6 +103,24 @@ namespace openvpn {
       }
 #endif
 
+      // Fast reconnect: if the server endpoint and the pushed options
+      // that may affect the tun config are unchanged since the tun was
+      // persisted, reuse it without re-evaluating the options.
+      if (enable_persistence_)
+	{
+	  pending_key_ = fast_key(server_addr, opt);
+	  pending_hash_ = std::hash<std::string>()(pending_key_);
+	  if (TunWrapTemplate<SCOPED_OBJ>::obj_defined()
+	      && !options_.empty()
+	      && pending_hash_ == fast_hash_
+	      && pending_key_ == fast_key_
+	      && (tb_ ? tb_->tun_builder_persist() : true))
+	    {
+	      use_persisted_tun_ = true;
+	      return true;
+	    }
+	}
+
       // In tun_persist mode, capture tun builder settings so we can
       // compare them to previous persisted settings.
       if (enable_persistence_)
@@ -119,6 +141,12 @@ namespace openvpn {
 			    && !options_.empty()
 			    && options_ == copt_->to_string()
 			    && (tb_ ? tb_->tun_builder_persist() : true));
+      if (use_persisted_tun_)
+	{
+	  // tun config matched, so this push can take the fast path next time
+	  fast_key_ = pending_key_;
+	  fast_hash_ = pending_hash_;
+	}
       return use_persisted_tun_;
     }
 
@@ -134,6 +162,25 @@ namespace openvpn {
 	{
 	  state_ = state;
 	  options_ = copt_->to_string();
+	  fast_key_ = std::move(pending_key_);
+	  fast_hash_ = pending_hash_;
+	  return true;
+	}
+      else
+	return false;
+    }
+
+    // The persisted tun was reconfigured in place for the
+    // to-be-created session, so save its state and options
+    // while keeping the existing tun obj.
+    bool update_tun_state(const TunProp::State::Ptr& state)
+    {
+      if (enable_persistence_ && copt_ && TunWrapTemplate<SCOPED_OBJ>::obj_defined())
+	{
+	  state_ = state;
+	  options_ = copt_->to_string();
+	  fast_key_ = std::move(pending_key_);
+	  fast_hash_ = pending_hash_;
 	  return true;
 	}
       else
@@ -141,12 +188,44 @@ namespace openvpn {
     }
 
   private:
+    // Pushed options that differ between otherwise identical
+    // sessions and never affect the tun config.
+    static bool per_session_option(const std::string& name)
+    {
+      static const char *const names[] = {
+	"peer-id", "auth-token", "auth-token-user", "cipher", "auth",
+	"key-derivation", "protocol-flags", "ping", "ping-restart",
+	"ping-exit", "inactive", "explicit-exit-notify", "echo",
+      };
+      for (auto n : names)
+	{
+	  if (name == n)
+	    return true;
+	}
+      return false;
+    }
+
+    static std::string fast_key(const IP::Addr& server_addr, const OptionList& opt)
+    {
+      std::string key = server_addr.to_string();
+      key += '\n';
+      for (const auto& o : opt)
+	{
+	  if (o.empty() || per_session_option(o.ref(0)))
+	    continue;
+	  key += o.render(Option::RENDER_BRACKET);
+	  key += '\n';
+	}
+      return key;
+    }
+
     void close_local()
     {
       if (tb_)
 	tb_->tun_builder_teardown(disconnect);
       state_.reset();
       options_ = "";
+      fast_key_.clear();
     }
 
     const bool enable_persistence_;
@@ -154,6 +233,13 @@ namespace openvpn {
     TunProp::State::Ptr state_;
     std::string options_;
 
+    // fast reconnect key of persisted session, and of the
+    // session being started
+    std::string fast_key_;
+    std::size_t fast_hash_ = 0;
+    std::string pending_key_;
+    std::size_t pending_hash_ = 0;
+
     TunBuilderCapture::Ptr copt_;
     bool use_persisted_tun_;
 
@@ -63,6 +63,18 @@ namespace openvpn {
       return tun_wrap->obj()->write_some(buffers);
     }
 
+    // used by TunIO batch mode, only on streams that support it
+    template <typename MutableBufferSequence>
+    std::size_t read_some(const MutableBufferSequence& buffers, asio::error_code& ec)
+    {
+      return tun_wrap->obj()->read_some(buffers, ec);
+    }
+
+    void non_blocking(const bool mode)
+    {
+      tun_wrap->obj()->non_blocking(mode);
+    }
+
     void cancel()
     {
       tun_wrap->obj()->cancel();
@@ -48,6 +48,15 @@ namespace openvpn {
     // Called with IP packets from tun layer.
     virtual void tun_recv(BufferAllocated& buf) = 0;
 
+    // Called with a packet that is being sent to several client
+    // instances, such as a flooded tap frame.  buf is left intact,
+    // and work is scratch space the caller reuses across instances.
+    virtual void tun_recv_shared(const Buffer& buf, BufferAllocated& work)
+    {
+      work.init(buf.c_data(), buf.size(), 0);
+      tun_recv(work);
+    }
+
     // push a halt or restart message to client
     virtual void push_halt_restart_msg(const HaltRestart::Type type,
 				       const std::string& reason,
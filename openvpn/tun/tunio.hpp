@@ -24,16 +24,29 @@
 #ifndef OPENVPN_TUN_TUNIO_H
 #define OPENVPN_TUN_TUNIO_H
 
+#include <vector>
+#include <array>
+
 #include <asio.hpp>
 
+#include <openvpn/common/platform.hpp>
 #include <openvpn/common/size.hpp>
 #include <openvpn/common/rc.hpp>
 #include <openvpn/frame/frame.hpp>
 #include <openvpn/ip/ip.hpp>
+#include <openvpn/ip/gso.hpp>
 #include <openvpn/common/socktypes.hpp>
 #include <openvpn/log/sessionstats.hpp>
+#include <openvpn/log/usdt.hpp>
+#include <openvpn/time/time.hpp>
 #include <openvpn/tun/tunlog.hpp>
 
+#if defined(OPENVPN_IO_URING) && defined(OPENVPN_PLATFORM_LINUX)
+#include <memory>
+#include <openvpn/linux/iouring.hpp>
+#define OPENVPN_TUNIO_HAVE_URING
+#endif
+
 namespace openvpn {
 
   template <typename ReadHandler, typename PacketFrom, typename STREAM>
@@ -42,6 +55,11 @@ namespace openvpn {
   public:
     typedef RCPtr<TunIO> Ptr;
 
+    // A batch of packets passed to tun_read_handler_batch.  Only
+    // the first n elements are valid, and the read handler may
+    // move elements out of the vector.
+    typedef std::vector<typename PacketFrom::SPtr> PacketFromBatch;
+
     TunIO(ReadHandler read_handler_arg,
 	  const Frame::Ptr& frame_arg,
 	  const SessionStats::Ptr& stats_arg)
@@ -67,19 +85,22 @@ namespace openvpn {
     {
       if (!halt)
 	{
+	  if (gro_enabled && gro_write(buf))
+	    return true;
 	  try {
 	    // handle tun packet prefix, if enabled
 	    if (tun_prefix)
 	      {
-		if (buf.offset() >= 4 && buf.size() >= 1)
+		std::uint32_t pf;
+		if (buf.size() >= 1)
 		  {
 		    switch (IPHeader::version(buf[0]))
 		      {
 		      case 4:
-			prepend_pf_inet(buf, PF_INET);
+			pf = PF_INET;
 			break;
 		      case 6:
-			prepend_pf_inet(buf, PF_INET6);
+			pf = PF_INET6;
 			break;
 		      default:
 			OPENVPN_LOG_TUN_ERROR("TUN write error: cannot identify IP version for prefix");
@@ -93,10 +114,28 @@ namespace openvpn {
 		    tun_error(Error::TUN_FRAMING_ERROR, nullptr);
 		    return false;
 		  }
+
+		// Put the prefix in the buffer headroom, which the frame
+		// normally reserves.  Otherwise gather it in front of the
+		// packet, rather than shifting the packet.
+		if (buf.offset() >= 4)
+		  prepend_pf_inet(buf, pf);
+		else
+		  return write_prefixed(buf, pf);
+	      }
+	    else if (vnet_hdr)
+	      {
+		// no offloads requested for packets we write
+		static const GSO::VnetHdr none = {};
+		if (buf.offset() >= sizeof(none))
+		  buf.prepend((const unsigned char *)&none, sizeof(none));
+		else
+		  return write_prefixed(buf, &none, sizeof(none));
 	      }
 
 	    // write data to tun device
 	    const size_t wrote = stream->write_some(buf.const_buffers_1());
+	    OPENVPN_USDT2(tun_write, wrote, 1);
 	    if (stats)
 	      {
 		stats->inc_stat(SessionStats::TUN_BYTES_OUT, wrote);
@@ -122,6 +161,20 @@ namespace openvpn {
 	return false;
     }
 
+    // Write a batch of packets in one pass, returns the
+    // number of packets successfully written.
+    template <typename BUFPTR>
+    size_t write_batch(BUFPTR* bufs, const size_t n)
+    {
+      size_t written = 0;
+      for (size_t i = 0; i < n && !halt; ++i)
+	{
+	  if (write(*bufs[i]))
+	    ++written;
+	}
+      return written;
+    }
+
     template <class BUFSEQ>
     bool write_seq(const BUFSEQ& bs)
     {
@@ -130,6 +183,7 @@ namespace openvpn {
 	  try {
 	    // write data to tun device
 	    const size_t wrote = stream->write_some(bs);
+	    OPENVPN_USDT2(tun_write, wrote, 1);
 	    if (stats)
 	      {
 		stats->inc_stat(SessionStats::TUN_BYTES_OUT, wrote);
@@ -155,6 +209,43 @@ namespace openvpn {
 	return false;
     }
 
+    // The device was opened with IFF_VNET_HDR and offloads (see
+    // TunLinux::VNET_HDR).  Reads then return packets of up to
+    // max_read bytes behind a GSO::VnetHdr.  Super-packets are
+    // segmented here and passed to read_handler->tun_read_handler_batch()
+    // as one batch, so the data path can encrypt and send them
+    // together, and partial checksums are completed.  Writes get an
+    // empty header.  Call before start() or start_batch(), which then
+    // does one read per wakeup.  Not for use with start_uring().
+    void enable_vnet_hdr(const size_t max_read = 65535)
+    {
+      vnet_hdr = true;
+      vnet_context = Frame::Context(frame_context.headroom(),
+				    max_read + sizeof(GSO::VnetHdr),
+				    frame_context.tailroom(),
+				    0,
+				    sizeof(size_t),
+				    frame_context.buffer_flags());
+    }
+
+    // With the device opened for offloads and enable_vnet_hdr()
+    // called, hold TCP segments passed to write() and merge
+    // consecutive in-order ones of a flow into super-packets of up to
+    // max_size bytes (see GSO::Coalescer).  A super-packet is written
+    // when the next write cannot be merged into it, or when the
+    // current handler returns, so all packets decrypted from one
+    // transport read go to the device in as few writes as possible.
+    // Errors writing held packets are reported through
+    // tun_error_handler.  Has no effect without enable_vnet_hdr().
+    void enable_gro(const size_t max_size = 65535)
+    {
+      if (vnet_hdr)
+	{
+	  gro.init(max_size);
+	  gro_enabled = true;
+	}
+    }
+
     void start(const int n_parallel)
     {
       if (!halt)
@@ -164,12 +255,58 @@ namespace openvpn {
 	}
     }
 
+    // Batch mode: after each completed read, drain up to
+    // batch_limit packets that the device has ready with
+    // non-blocking reads and pass them to
+    // read_handler->tun_read_handler_batch() in one call.
+    // Requires a stream that supports non_blocking().
+    void start_batch(const int n_parallel, const size_t batch_limit)
+    {
+      if (!halt && batch_limit)
+	{
+	  stream->non_blocking(true);
+	  batch.resize(batch_limit);
+	}
+      start(n_parallel);
+    }
+
+#ifdef OPENVPN_TUNIO_HAVE_URING
+    // io_uring mode: keep n_parallel reads posted on the tun fd
+    // through io_uring, each reading straight into its own packet
+    // buffer.  Reads completed in one pass are passed together to
+    // read_handler->tun_read_handler_batch(), at most batch_limit
+    // (or n_parallel if zero) at a time.  Use instead of start()
+    // or start_batch().  Throws IOUring::io_uring_error if io_uring
+    // is not usable.
+    void start_uring(asio::io_context& io_context, const int n_parallel, const size_t batch_limit)
+    {
+      if (halt || n_parallel <= 0)
+	return;
+      uring = IOUring::instance(io_context);
+      uring->attach();
+      batch.resize(batch_limit ? batch_limit : size_t(n_parallel));
+      uring_reads.resize(n_parallel);
+      for (auto &r : uring_reads)
+	{
+	  r.reset(new UringRead(this));
+	  uring_queue_read(*r);
+	}
+    }
+#endif
+
     // must be called by derived class destructor
     void stop()
     {
       if (!halt)
 	{
 	  halt = true;
+#ifdef OPENVPN_TUNIO_HAVE_URING
+	  for (auto &r : uring_reads)
+	    {
+	      if (r->armed)
+		uring->cancel(IOUring::user_data(r.get(), 0));
+	    }
+#endif
 	  if (stream)
 	    {
 	      stream->cancel();
@@ -190,57 +327,138 @@ namespace openvpn {
     }
 
   private:
+    // Returns true if buf was merged into the pending super-packet.
+    // Otherwise the pending one has been written, so buf can be
+    // written next.
+    bool gro_write(const Buffer& buf)
+    {
+      if (gro.add(buf))
+	{
+	  gro_schedule();
+	  return true;
+	}
+      if (gro.empty())
+	return false;
+      gro_flush();
+      if (!halt && gro.add(buf))
+	{
+	  gro_schedule();
+	  return true;
+	}
+      return false;
+    }
+
+    void gro_schedule()
+    {
+      if (!gro_flush_pending)
+	{
+	  gro_flush_pending = true;
+	  asio::post(stream->get_executor(), [self=RCPtr<TunIO>(this)]()
+		     {
+		       self->gro_flush_pending = false;
+		       if (!self->halt)
+			 self->gro_flush();
+		     });
+	}
+    }
+
+    void gro_flush()
+    {
+      if (gro.empty())
+	return;
+      const size_t n = gro.segments();
+      const Buffer& buf = gro.finish();
+      try {
+	const size_t wrote = stream->write_some(buf.const_buffers_1());
+	OPENVPN_USDT2(tun_write, wrote, n);
+	if (stats)
+	  {
+	    stats->inc_stat(SessionStats::TUN_BYTES_OUT, wrote);
+	    stats->inc_stat(SessionStats::TUN_PACKETS_OUT, n);
+	  }
+	if (wrote != buf.size())
+	  {
+	    OPENVPN_LOG_TUN_ERROR("TUN partial write error");
+	    tun_error(Error::TUN_WRITE_ERROR, nullptr);
+	  }
+      }
+      catch (asio::system_error& e)
+	{
+	  OPENVPN_LOG_TUN_ERROR("TUN write error: " << e.what());
+	  tun_error(Error::TUN_WRITE_ERROR, &e.code());
+	}
+      gro.reset();
+    }
+
     void prepend_pf_inet(Buffer& buf, const std::uint32_t value)
     {
       const std::uint32_t net_value = htonl(value);
       buf.prepend((unsigned char *)&net_value, sizeof(net_value));
     }
 
+    bool write_prefixed(const Buffer& buf, const std::uint32_t value)
+    {
+      const std::uint32_t net_value = htonl(value);
+      return write_prefixed(buf, &net_value, sizeof(net_value));
+    }
+
+    bool write_prefixed(const Buffer& buf, const void *prefix, const size_t prefix_size)
+    {
+      const std::array<asio::const_buffer, 2> seq = {{
+	  asio::const_buffer(prefix, prefix_size),
+	  asio::const_buffer(buf.c_data(), buf.size()),
+	}};
+      const size_t wrote = stream->write_some(seq);
+      OPENVPN_USDT2(tun_write, wrote, 1);
+      if (stats)
+	{
+	  stats->inc_stat(SessionStats::TUN_BYTES_OUT, wrote);
+	  stats->inc_stat(SessionStats::TUN_PACKETS_OUT, 1);
+	}
+      if (wrote == buf.size() + prefix_size)
+	return true;
+      OPENVPN_LOG_TUN_ERROR("TUN partial write error");
+      tun_error(Error::TUN_WRITE_ERROR, nullptr);
+      return false;
+    }
+
   protected:
-    void queue_read(PacketFrom *tunfrom)
+    // The completion handler's reference to this object is handed
+    // on to the next read, so steady-state reads do no reference
+    // counting.
+    void queue_read(PacketFrom *tunfrom, Ptr self = Ptr())
     {
       OPENVPN_LOG_TUN_VERBOSE("TunIO::queue_read");
       if (!tunfrom)
 	tunfrom = new PacketFrom();
-      frame_context.prepare(tunfrom->buf);
+      if (!self)
+	self.reset(this);
+      const Frame::Context& read_context = vnet_hdr ? vnet_context : frame_context;
+      read_context.prepare(tunfrom->buf);
 
       // queue read on tun device
-      stream->async_read_some(frame_context.mutable_buffers_1(tunfrom->buf),
-			      [self=Ptr(this), tunfrom](const asio::error_code& error, const size_t bytes_recvd)
+      stream->async_read_some(read_context.mutable_buffers_1(tunfrom->buf),
+			      [self=std::move(self), tunfrom](const asio::error_code& error, const size_t bytes_recvd) mutable
                               {
-                                self->handle_read(tunfrom, error, bytes_recvd);
+                                self->handle_read(self, tunfrom, error, bytes_recvd);
                               });
     }
 
-    void handle_read(PacketFrom *tunfrom, const asio::error_code& error, const size_t bytes_recvd)
+    void handle_read(Ptr& self, PacketFrom *tunfrom, const asio::error_code& error, const size_t bytes_recvd)
     {
       OPENVPN_LOG_TUN_VERBOSE("TunIO::handle_read: " << error.message());
       typename PacketFrom::SPtr pfp(tunfrom);
       if (!halt)
 	{
+	  OPENVPN_PERF_TIMER(stats, TUN_READ);
 	  if (!error)
 	    {
-	      pfp->buf.set_size(bytes_recvd);
-	      if (stats)
-		{
-		  stats->inc_stat(SessionStats::TUN_BYTES_IN, bytes_recvd);
-		  stats->inc_stat(SessionStats::TUN_PACKETS_IN, 1);
-		}
-	      if (!tun_prefix)
-		{
-		  read_handler->tun_read_handler(pfp);
-		}
-	      else if (pfp->buf.size() >= 4)
-		{
-		  // handle tun packet prefix, if enabled
-		  pfp->buf.advance(4);
-		  read_handler->tun_read_handler(pfp);
-		}
-	      else
-		{
-		  OPENVPN_LOG_TUN_ERROR("TUN Read Error: cannot read prefix");
-		  tun_error(Error::TUN_READ_ERROR, nullptr);
-		}
+	      if (vnet_hdr)
+		read_vnet(pfp, bytes_recvd);
+	      else if (!batch.empty())
+		read_batch(pfp, bytes_recvd);
+	      else if (post_read(*pfp, bytes_recvd))
+		read_handler->tun_read_handler(pfp);
 	    }
 	  else
 	    {
@@ -248,10 +466,235 @@ namespace openvpn {
 	      tun_error(Error::TUN_READ_ERROR, &error);
 	    }
 	  if (!halt)
-	    queue_read(pfp.release()); // reuse buffer if still available
+	    queue_read(pfp.release(), std::move(self)); // reuse buffer if still available
+	}
+    }
+
+    // Drain additional ready packets into batch, after pfp which
+    // was just completed by async_read_some.
+    void read_batch(typename PacketFrom::SPtr& pfp, const size_t bytes_recvd)
+    {
+      const size_t limit = batch.size();
+      size_t n = 0;
+      if (post_read(*pfp, bytes_recvd))
+	batch[n++].swap(pfp);
+      for (size_t attempts = 1; attempts < limit && n < limit && !halt; ++attempts)
+	{
+	  typename PacketFrom::SPtr& pf = batch[n];
+	  if (!pf)
+	    pf.reset(new PacketFrom());
+	  frame_context.prepare(pf->buf);
+	  asio::error_code ec;
+	  const size_t len = stream->read_some(frame_context.mutable_buffers_1(pf->buf), ec);
+	  if (ec)
+	    {
+	      if (ec != asio::error::would_block && ec != asio::error::try_again)
+		{
+		  OPENVPN_LOG_TUN_ERROR("TUN Read Error: " << ec.message());
+		  tun_error(Error::TUN_READ_ERROR, &ec);
+		}
+	      break;
+	    }
+	  if (post_read(*pf, len))
+	    ++n;
+	}
+      OPENVPN_PERF_BATCH(stats, TUN_READ_BATCH, n);
+      if (n && !halt)
+	{
+	  const Time::Batch time_batch; // one timestamp for the burst
+	  read_handler->tun_read_handler_batch(batch, n);
+	}
+    }
+
+    // Strip the virtio-net header, then pass on a single packet,
+    // or the segments of a super-packet as one batch.
+    void read_vnet(typename PacketFrom::SPtr& pfp, const size_t bytes_recvd)
+    {
+      if (!post_read(*pfp, bytes_recvd))
+	return;
+      BufferAllocated& buf = pfp->buf;
+      try {
+	GSO::VnetHdr h;
+	buf.read((unsigned char *)&h, sizeof(h));
+	const unsigned int gso_type = h.gso_type & ~GSO::VnetHdr::GSO_ECN;
+	if (gso_type == GSO::VnetHdr::GSO_NONE)
+	  {
+	    if ((h.flags & GSO::VnetHdr::F_NEEDS_CSUM) && !GSO::complete_csum(buf, h))
+	      {
+		OPENVPN_LOG_TUN_ERROR("TUN Read Error: bad checksum offset");
+		tun_error(Error::TUN_FRAMING_ERROR, nullptr);
+		return;
+	      }
+	    read_handler->tun_read_handler(pfp);
+	    return;
+	  }
+	size_t n = 0;
+	if (gso_type == GSO::VnetHdr::GSO_TCPV4 || gso_type == GSO::VnetHdr::GSO_TCPV6)
+	  n = GSO::segment_tcp(buf, h, [this](const size_t size) -> BufferAllocated& {
+	      const size_t i = vnet_n++;
+	      if (i == vnet_segs.size())
+		vnet_segs.emplace_back();
+	      typename PacketFrom::SPtr& pf = vnet_segs[i];
+	      if (!pf)
+		pf.reset(new PacketFrom());
+	      frame_context.prepare(pf->buf);
+	      return pf->buf;
+	    });
+	vnet_n = 0;
+	if (!n)
+	  {
+	    OPENVPN_LOG_TUN_ERROR("TUN Read Error: cannot segment GSO type " << gso_type);
+	    tun_error(Error::TUN_FRAMING_ERROR, nullptr);
+	    return;
+	  }
+	OPENVPN_PERF_BATCH(stats, TUN_READ_BATCH, n);
+	const Time::Batch time_batch; // one timestamp for the burst
+	read_handler->tun_read_handler_batch(vnet_segs, n);
+      }
+      catch (const BufferException&)
+	{
+	  vnet_n = 0;
+	  OPENVPN_LOG_TUN_ERROR("TUN Read Error: bad virtio-net header");
+	  tun_error(Error::TUN_FRAMING_ERROR, nullptr);
+	}
+    }
+
+    // Account for a received packet and strip the tun prefix,
+    // returns false if the packet should be dropped.
+    bool post_read(PacketFrom& pf, const size_t bytes_recvd)
+    {
+      pf.buf.set_size(bytes_recvd);
+      OPENVPN_USDT1(tun_read, bytes_recvd);
+      if (stats)
+	{
+	  stats->inc_stat(SessionStats::TUN_BYTES_IN, bytes_recvd);
+	  stats->inc_stat(SessionStats::TUN_PACKETS_IN, 1);
+	}
+      if (!tun_prefix)
+	return true;
+      else if (pf.buf.size() >= 4)
+	{
+	  // handle tun packet prefix, if enabled
+	  pf.buf.advance(4);
+	  return true;
+	}
+      else
+	{
+	  OPENVPN_LOG_TUN_ERROR("TUN Read Error: cannot read prefix");
+	  tun_error(Error::TUN_READ_ERROR, nullptr);
+	  return false;
+	}
+    }
+
+#ifdef OPENVPN_TUNIO_HAVE_URING
+    struct UringRead : public IOUring::Sink
+    {
+      UringRead(TunIO* parent_arg)
+	: IOUring::Sink(complete_cb, flush_cb),
+	  parent(parent_arg)
+      {
+      }
+
+      static void complete_cb(IOUring::Sink* sink, const struct io_uring_cqe& cqe, const unsigned int)
+      {
+	UringRead* self = static_cast<UringRead*>(sink);
+	self->parent->uring_read_complete(*self, cqe);
+      }
+
+      static void flush_cb(IOUring::Sink* sink)
+      {
+	UringRead* self = static_cast<UringRead*>(sink);
+	self->parent->uring_flush();
+      }
+
+      TunIO* parent;
+      typename PacketFrom::SPtr pf;
+      bool armed = false;
+    };
+
+    void uring_queue_read(UringRead& r)
+    {
+      struct io_uring_sqe *sqe = uring->get_sqe();
+      if (!sqe)
+	{
+	  // submission queue full, retry after this pass
+	  uring->flush_at_end(&r);
+	  return;
 	}
+      if (!r.pf)
+	r.pf.reset(new PacketFrom());
+      frame_context.prepare(r.pf->buf);
+      sqe->opcode = IORING_OP_READ;
+      sqe->fd = stream->native_handle();
+      sqe->addr = (std::uint64_t)r.pf->buf.data();
+      sqe->len = (std::uint32_t)frame_context.remaining_payload(r.pf->buf);
+      sqe->off = (std::uint64_t)-1;
+      sqe->user_data = IOUring::user_data(&r, 0);
+      r.armed = true;
+      if (!uring_hold)
+	uring_hold.reset(this);
     }
 
+    void uring_read_complete(UringRead& r, const struct io_uring_cqe& cqe)
+    {
+      r.armed = false;
+      uring->flush_at_end(&r);
+      if (halt)
+	return;
+      if (cqe.res < 0)
+	{
+	  if (cqe.res != -ECANCELED && cqe.res != -EAGAIN && cqe.res != -EINTR)
+	    {
+	      const asio::error_code ec(-cqe.res, asio::system_category());
+	      OPENVPN_LOG_TUN_ERROR("TUN Read Error: " << ec.message());
+	      tun_error(Error::TUN_READ_ERROR, &ec);
+	    }
+	  return;
+	}
+      if (uring_n >= batch.size())
+	uring_deliver();
+      if (post_read(*r.pf, cqe.res))
+	batch[uring_n++].swap(r.pf);
+    }
+
+    void uring_deliver()
+    {
+      const size_t n = uring_n;
+      uring_n = 0;
+      OPENVPN_PERF_BATCH(stats, TUN_READ_BATCH, n);
+      if (n && !halt)
+	{
+	  const Time::Batch time_batch; // one timestamp for the burst
+	  read_handler->tun_read_handler_batch(batch, n);
+	}
+    }
+
+    // Called after a completion pass: deliver the batch and repost
+    // the reads that completed.
+    void uring_flush()
+    {
+      uring_deliver();
+      bool armed = false;
+      for (auto &r : uring_reads)
+	{
+	  if (!halt && !r->armed)
+	    uring_queue_read(*r);
+	  armed |= r->armed;
+	}
+      if (!armed && uring_hold)
+	{
+	  // deferred, since this can release the last reference
+	  Ptr self = std::move(uring_hold);
+	  asio::post(uring->context(), [self=std::move(self)]()
+                     {
+                       self->uring_reads.clear();
+                       self->uring->detach();
+                       self->uring.reset();
+                     });
+	}
+    }
+#endif
+
     void tun_error(const Error::Type errtype, const asio::error_code* error)
     {
       if (stats)
@@ -270,6 +713,23 @@ namespace openvpn {
     const Frame::Ptr frame;
     const Frame::Context& frame_context;
     SessionStats::Ptr stats;
+
+    PacketFromBatch batch; // nonempty in batch mode
+
+    bool vnet_hdr = false;         // see enable_vnet_hdr
+    Frame::Context vnet_context;   // reads of whole super-packets
+    PacketFromBatch vnet_segs;     // segments of the last super-packet
+    size_t vnet_n = 0;
+    GSO::Coalescer gro;            // see enable_gro
+    bool gro_enabled = false;
+    bool gro_flush_pending = false;
+
+#ifdef OPENVPN_TUNIO_HAVE_URING
+    IOUring::Ptr uring;
+    std::vector<std::unique_ptr<UringRead>> uring_reads;
+    Ptr uring_hold;        // keeps this object alive while reads are posted
+    size_t uring_n = 0;    // packets gathered in batch
+#endif
   };
 }
 
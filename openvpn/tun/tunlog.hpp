@@ -25,7 +25,8 @@
 #define OPENVPN_TUN_TUNLOG_H
 
 #if defined(OPENVPN_DEBUG_TUN) && OPENVPN_DEBUG_TUN >= 1
-#define OPENVPN_LOG_TUN_ERROR(x) OPENVPN_LOG(x)
+#include <openvpn/log/logratelimit.hpp>
+#define OPENVPN_LOG_TUN_ERROR(x) OPENVPN_LOG_RATELIMIT(OPENVPN_LOG_ERROR_RATE, x)
 #else
 #define OPENVPN_LOG_TUN_ERROR(x)
 #endif
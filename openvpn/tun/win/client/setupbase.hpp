@@ -53,6 +53,16 @@ namespace openvpn {
 			     Stop* stop,
 			     std::ostream& os) = 0;
 
+      // Reconfigure an established adapter for pull by adding and
+      // deleting only the routes that changed.  Returns false if
+      // pull differs in more than its routes, in which case the
+      // caller must tear down and establish() again.
+      virtual bool update_routes(const TunBuilderCapture& pull,
+				 std::ostream& os)
+      {
+	return false;
+      }
+
       virtual void confirm()
       {
       }
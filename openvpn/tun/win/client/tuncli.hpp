@@ -39,6 +39,7 @@
 #include <openvpn/tun/persist/tunwrapasio.hpp>
 #include <openvpn/tun/tunio.hpp>
 #include <openvpn/tun/win/client/tunsetup.hpp>
+#include <openvpn/tun/win/ringbuffer.hpp>
 #include <openvpn/win/modname.hpp>
 
 namespace openvpn {
@@ -90,6 +91,7 @@ namespace openvpn {
 
       TunProp::Config tun_prop;
       int n_parallel = 8;         // number of parallel async reads on tun socket
+      bool ring_buffer = false;   // use shared ring buffers if the driver supports them
 
       Frame::Ptr frame;
       SessionStats::Ptr stats;
@@ -97,6 +99,8 @@ namespace openvpn {
       Stop* stop = nullptr;
 
       TunPersist::Ptr tun_persist;
+      RingBuffer::Ptr persisted_ring; // rings registered on persisted TAP handle
+      TunWin::SetupBase::Ptr persisted_setup; // setup object of persisted TAP handle
 
       TunWin::SetupFactory::Ptr tun_setup_factory;
 
@@ -120,7 +124,11 @@ namespace openvpn {
       virtual void finalize(const bool disconnected) override
       {
 	if (disconnected)
-	  tun_persist.reset();
+	  {
+	    tun_persist.reset();
+	    persisted_ring.reset();
+	    persisted_setup.reset();
+	  }
       }
 
       virtual bool layer_2_supported() const override
@@ -132,16 +140,18 @@ namespace openvpn {
     class Client : public TunClient
     {
       friend class ClientConfig;  // calls constructor
-      friend class TunIO<Client*, PacketFrom, TunWrapAsioStream<TunPersist> >;  // calls tun_read_handler
+      friend class TunIO<Client*, PacketFrom, TunWrapAsioStream<TunPersist> >;  // calls tun_read_handler, tun_read_handler_batch
+      friend class TunRingIO<Client*, PacketFrom>; // calls tun_read_handler
 
       typedef Tun<Client*, TunPersist> TunImpl;
+      typedef TunRingIO<Client*, PacketFrom> RingImpl;
 
     public:
       typedef RCPtr<Client> Ptr;
 
       virtual void tun_start(const OptionList& opt, TransportClient& transcli, CryptoDCSettings&) override
       {
-	if (!impl)
+	if (!impl && !ring_impl)
 	  {
 	    halt = false;
 	    if (config->tun_persist)
@@ -156,8 +166,14 @@ namespace openvpn {
 	      if (tun_persist->use_persisted_tun(server_addr, config->tun_prop, opt))
 		{
 		  state = tun_persist->state();
+		  ring = config->persisted_ring;
 		  OPENVPN_LOG("TunPersist: reused tun context");
 		}
+	      else if (update_persisted_routes(server_addr, opt))
+		{
+		  ring = config->persisted_ring;
+		  OPENVPN_LOG("TunPersist: updated routes of persisted tun context");
+		}
 	      else
 		{
 		  // notify parent
@@ -189,6 +205,24 @@ namespace openvpn {
 		    th = tun_setup->establish(*po, Win::module_name(), config->stop, os);
 		  }
 
+		  // try to switch the adapter to ring buffer I/O
+		  if (config->ring_buffer)
+		    {
+		      RingBuffer::Ptr rb(new RingBuffer());
+		      if (rb->register_rings(th))
+			{
+			  OPENVPN_LOG("TAP: using ring buffer I/O");
+			  ring = std::move(rb);
+			}
+		      else
+			OPENVPN_LOG("TAP: ring buffers not supported by driver, using overlapped I/O");
+		    }
+		  if (config->tun_persist)
+		    {
+		      config->persisted_ring = ring;
+		      config->persisted_setup = tun_setup;
+		    }
+
 		  // create ASIO wrapper for HANDLE
 		  TAPStream* ts = new TAPStream(io_context, th);
 
@@ -214,14 +248,27 @@ namespace openvpn {
 		}
 
 	      // configure tun interface packet forwarding
-	      impl.reset(new TunImpl(tun_persist,
-				     "TUN_WIN",
-				     true,
-				     this,
-				     config->frame,
-				     config->stats
-				     ));
-	      impl->start(config->n_parallel);
+	      if (ring)
+		{
+		  ring_impl.reset(new RingImpl(io_context,
+					       ring,
+					       "TUN_WIN_RING",
+					       this,
+					       config->frame,
+					       config->stats));
+		  ring_impl->start();
+		}
+	      else
+		{
+		  impl.reset(new TunImpl(tun_persist,
+					 "TUN_WIN",
+					 true,
+					 this,
+					 config->frame,
+					 config->stats
+					 ));
+		  impl->start(config->n_parallel);
+		}
 
 	      if (!dhcp_capture)
 		parent.tun_connected(); // signal that we are connected
@@ -249,6 +296,8 @@ namespace openvpn {
       {
 	if (impl)
 	  return impl->name();
+	else if (ring_impl)
+	  return ring_impl->name();
 	else
 	  return "UNDEF_TUN";
       }
@@ -307,11 +356,13 @@ namespace openvpn {
 
       bool send(Buffer& buf)
       {
-	if (impl)
+	if (impl || ring_impl)
 	  {
-	    if (dhcp_capture)
+	    // only the first few seconds of a layer 2 session, and only
+	    // frames that look like a DHCP reply, need inspection
+	    if (dhcp_capture && DHCPCapture::candidate(buf))
 	      dhcp_inspect(buf);
-	    return impl->write(buf);
+	    return impl ? impl->write(buf) : ring_impl->write(buf);
 	  }
 	else
 	  return false;
@@ -328,6 +379,46 @@ namespace openvpn {
 #endif
       }
 
+      void tun_read_handler_batch(TunImpl::PacketFromBatch& batch, const size_t n) // called by TunImpl
+      {
+	for (size_t i = 0; i < n && !halt; ++i)
+	  parent.tun_recv(batch[i]->buf);
+      }
+
+      // If the persisted TAP adapter differs from the to-be-created
+      // session only in its routes, add and delete the changed
+      // routes in place rather than reconfiguring the adapter.
+      bool update_persisted_routes(const IP::Addr& server_addr, const OptionList& opt)
+      {
+	if (!config->tun_persist || !config->persisted_setup || !tun_persist->obj_defined())
+	  return false;
+
+	TunBuilderCapture::Ptr po(new TunBuilderCapture());
+	TunProp::configure_builder(po.get(),
+				   state.get(),
+				   nullptr,
+				   server_addr,
+				   config->tun_prop,
+				   opt,
+				   nullptr,
+				   false);
+
+	bool updated;
+	{
+	  std::ostringstream os;
+	  auto os_print = Cleanup([&os](){ OPENVPN_LOG_STRING(os.str()); });
+	  updated = config->persisted_setup->update_routes(*po, os);
+	}
+	if (!updated)
+	  return false;
+
+	OPENVPN_LOG("CAPTURED OPTIONS:" << std::endl << po->to_string());
+	tun_setup = config->persisted_setup;
+	if (tun_persist->update_tun_state(state))
+	  OPENVPN_LOG("TunPersist: saving tun context:" << std::endl << tun_persist->options());
+	return true;
+      }
+
       void tun_error_handler(const Error::Type errtype, // called by TunImpl
 			     const asio::error_code* error)
       {
@@ -348,6 +439,8 @@ namespace openvpn {
 	    // stop tun
 	    if (impl)
 	      impl->stop();
+	    if (ring_impl)
+	      ring_impl->stop();
 	    tun_persist.reset();
 	  }
       }
@@ -430,6 +523,8 @@ namespace openvpn {
       ClientConfig::Ptr config;
       TunClientParent& parent;
       TunImpl::Ptr impl;
+      RingBuffer::Ptr ring;
+      RingImpl::Ptr ring_impl;
       TunProp::State::Ptr state;
       TunWin::SetupBase::Ptr tun_setup;
 
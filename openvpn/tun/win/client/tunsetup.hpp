@@ -40,6 +40,8 @@
 #include <openvpn/error/excode.hpp>
 #include <openvpn/win/scoped_handle.hpp>
 #include <openvpn/win/cmd.hpp>
+#include <openvpn/common/actionconc.hpp>
+#include <openvpn/tun/builder/routediff.hpp>
 #include <openvpn/tun/win/tunutil.hpp>
 #include <openvpn/tun/win/client/setupbase.hpp>
 
@@ -89,6 +91,7 @@ namespace openvpn {
 	// create ActionLists for setting up and removing adapter properties
 	ActionList::Ptr add_cmds(new ActionList());
 	remove_cmds.reset(new ActionList());
+	tap_index_name_ = tap.index_or_name();
 
 	// populate add/remove lists with actions
 	switch (pull.layer())
@@ -157,6 +160,34 @@ namespace openvpn {
 	  }
       }
 
+#if _WIN32_WINNT >= 0x0600
+      // Apply only the route changes, if pull differs from the
+      // established config in nothing else.
+      virtual bool update_routes(const TunBuilderCapture& pull,
+				 std::ostream& os) override
+      {
+	if (!remove_cmds || l2_state || pull.layer() != Layer::OSI_LAYER_3)
+	  return false;
+
+	const Util::DefaultGateway gw;
+	TunBuilderRouteDiff::Delta delta;
+	if (!route_set.diff(pull, route_context(gw), delta))
+	  return false;
+	os << delta.to_string() << std::endl;
+
+	// delete stale routes before adding new ones
+	ActionConcurrent::Ptr del_cmds(new ActionConcurrent());
+	ActionConcurrent::Ptr add_cmds(new ActionConcurrent());
+	for (auto &d : delta.del)
+	  del_cmds->add(route_set.release(d.first, d.second));
+	for (auto &a : delta.add)
+	  add_route(a.first, *a.second, pull, tap_index_name_, gw, *add_cmds);
+	del_cmds->execute(os);
+	add_cmds->execute(os);
+	return true;
+      }
+#endif
+
       virtual void destroy(std::ostream& os) override // defined by DestructorBase
       {
 	// l2_state
@@ -174,12 +205,20 @@ namespace openvpn {
 	    l2_thread.reset();
 	  }
 
+	// pushed routes
+	{
+	  ActionConcurrent route_cmds;
+	  route_set.release_all(route_cmds);
+	  route_cmds.execute(os);
+	}
+
 	// remove_cmds
 	if (remove_cmds)
 	  {
 	    remove_cmds->destroy(os);
 	    remove_cmds.reset();
 	  }
+	tap_index_name_.clear();
       }
 
       virtual ~Setup()
@@ -354,30 +393,17 @@ namespace openvpn {
 	// Usage: delete route [prefix=]<IPv6 address>/<integer> [interface=]<string>
 	//  [[nexthop=]<IPv6 address>]
 	//  [[store=]active|persistent]
-	{
-	  for (auto &route : pull.add_routes)
-	    {
-	      const std::string metric = route_metric_opt(pull, route, MT_NETSH);
-	      if (route.ipv6)
-		{
-		  if (!pull.block_ipv6)
-		    {
-		      create.add(new WinCmd("netsh interface ipv6 add route " + route.address + '/' + to_string(route.prefix_length) + ' ' + tap_index_name + ' ' + ipv6_next_hop + metric + " store=active"));
-		      destroy.add(new WinCmd("netsh interface ipv6 delete route " + route.address + '/' + to_string(route.prefix_length) + ' ' + tap_index_name + ' ' + ipv6_next_hop + " store=active"));
-		    }
-		}
-	      else
-		{
-		  if (local4)
-		    {
-		      create.add(new WinCmd("netsh interface ip add route " + route.address + '/' + to_string(route.prefix_length) + ' ' + tap_index_name + ' ' + local4->gateway + metric + " store=active"));
-		      destroy.add(new WinCmd("netsh interface ip delete route " + route.address + '/' + to_string(route.prefix_length) + ' ' + tap_index_name + ' ' + local4->gateway + " store=active"));
-		    }
-		  else
-		    throw tun_win_setup("IPv4 routes pushed without IPv4 ifconfig");
-		}
-	    }
-	}
+	//
+	// The delete commands for pushed routes are kept in route_set
+	// rather than destroy, so that a later config differing only
+	// in its routes can be applied incrementally.
+	//
+	// Each route is a separate netsh process and the routes don't
+	// depend on each other, so they are added concurrently.
+	route_set.reset(pull, route_context(gw));
+	ActionConcurrent::Ptr route_cmds(new ActionConcurrent());
+	for (auto &route : pull.add_routes)
+	  add_route(TunBuilderRouteDiff::ADD_ROUTE, route, pull, tap_index_name, gw, *route_cmds);
 
 	// Process exclude routes
 	if (!pull.exclude_routes.empty())
@@ -387,16 +413,9 @@ namespace openvpn {
 		bool ipv6_error = false;
 		for (auto &route : pull.exclude_routes)
 		  {
-		    const std::string metric = route_metric_opt(pull, route, MT_NETSH);
 		    if (route.ipv6)
-		      {
-			ipv6_error = true;
-		      }
-		    else
-		      {
-			create.add(new WinCmd("netsh interface ip add route " + route.address + '/' + to_string(route.prefix_length) + ' ' + to_string(gw.interface_index()) + ' ' + gw.gateway_address() + metric + " store=active"));
-			destroy.add(new WinCmd("netsh interface ip delete route " + route.address + '/' + to_string(route.prefix_length) + ' ' + to_string(gw.interface_index()) + ' ' + gw.gateway_address() + " store=active"));
-		      }
+		      ipv6_error = true;
+		    add_route(TunBuilderRouteDiff::EXCLUDE_ROUTE, route, pull, tap_index_name, gw, *route_cmds);
 		  }
 		if (ipv6_error)
 		  os << "NOTE: exclude IPv6 routes not currently supported" << std::endl;
@@ -404,6 +423,8 @@ namespace openvpn {
 	    else
 	      os << "NOTE: exclude routes error: cannot detect default gateway" << std::endl;
 	  }
+	if (!route_cmds->empty())
+	  create.add(route_cmds);
 
 	// Process IPv4 redirect-gateway
 	if (pull.reroute_gw.ipv4)
@@ -584,6 +605,72 @@ namespace openvpn {
 	create.add(new WinCmd("ipconfig /flushdns"));
 	destroy.add(new WinCmd("ipconfig /flushdns"));
       }
+
+      // Platform state that the pushed route commands depend on
+      static std::string route_context(const Util::DefaultGateway& gw)
+      {
+	if (gw.defined())
+	  return "GW: " + to_string(gw.interface_index()) + ' ' + gw.gateway_address();
+	else
+	  return "GW: none";
+      }
+
+      // Build the commands that add and delete a pushed route
+      static void route_actions(const TunBuilderRouteDiff::Type type,
+				const TunBuilderCapture::Route& route,
+				const TunBuilderCapture& pull,
+				const std::string& tap_index_name,
+				const Util::DefaultGateway& gw,
+				Action::Ptr& create,
+				Action::Ptr& destroy)
+      {
+	// special IPv6 next-hop recognized by TAP driver (magic)
+	const std::string ipv6_next_hop = "fe80::8";
+
+	const std::string metric = route_metric_opt(pull, route, MT_NETSH);
+	const std::string prefix = route.address + '/' + to_string(route.prefix_length);
+	if (type == TunBuilderRouteDiff::EXCLUDE_ROUTE)
+	  {
+	    // exclude IPv6 routes not currently supported
+	    if (!route.ipv6 && gw.defined())
+	      {
+		const std::string nh = to_string(gw.interface_index()) + ' ' + gw.gateway_address();
+		create.reset(new WinCmd("netsh interface ip add route " + prefix + ' ' + nh + metric + " store=active"));
+		destroy.reset(new WinCmd("netsh interface ip delete route " + prefix + ' ' + nh + " store=active"));
+	      }
+	  }
+	else if (route.ipv6)
+	  {
+	    if (!pull.block_ipv6)
+	      {
+		create.reset(new WinCmd("netsh interface ipv6 add route " + prefix + ' ' + tap_index_name + ' ' + ipv6_next_hop + metric + " store=active"));
+		destroy.reset(new WinCmd("netsh interface ipv6 delete route " + prefix + ' ' + tap_index_name + ' ' + ipv6_next_hop + " store=active"));
+	      }
+	  }
+	else
+	  {
+	    const TunBuilderCapture::RouteAddress* local4 = pull.vpn_ipv4();
+	    if (!local4)
+	      throw tun_win_setup("IPv4 routes pushed without IPv4 ifconfig");
+	    create.reset(new WinCmd("netsh interface ip add route " + prefix + ' ' + tap_index_name + ' ' + local4->gateway + metric + " store=active"));
+	    destroy.reset(new WinCmd("netsh interface ip delete route " + prefix + ' ' + tap_index_name + ' ' + local4->gateway + " store=active"));
+	  }
+      }
+
+      // Queue the add command of a pushed route on create, and
+      // track its delete command in route_set
+      void add_route(const TunBuilderRouteDiff::Type type,
+		     const TunBuilderCapture::Route& route,
+		     const TunBuilderCapture& pull,
+		     const std::string& tap_index_name,
+		     const Util::DefaultGateway& gw,
+		     ActionConcurrent& create)
+      {
+	Action::Ptr c, d;
+	route_actions(type, route, pull, tap_index_name, gw, c, d);
+	create.add(c);
+	route_set.add(type, route, d);
+      }
 #else
       // Configure TAP adapter for pre-Vista
       // Currently we don't support IPv6 on pre-Vista
@@ -828,6 +915,10 @@ namespace openvpn {
       std::unique_ptr<L2State> l2_state;
 
       ActionList::Ptr remove_cmds;
+
+      // pushed routes and their delete commands
+      TunBuilderRouteDiff route_set;
+      std::string tap_index_name_;
     };
   }
 }
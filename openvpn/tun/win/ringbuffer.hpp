@@ -0,0 +1,403 @@
+//    OpenVPN -- An application to securely tunnel IP networks
+//               over a single port, with support for SSL/TLS-based
+//               session authentication and key exchange,
+//               packet encryption, packet authentication, and
+//               packet compression.
+//
+//    Copyright (C) 2012-2016 OpenVPN Technologies, Inc.
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU Affero General Public License Version 3
+//    as published by the Free Software Foundation.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU Affero General Public License for more details.
+//
+//    You should have received a copy of the GNU Affero General Public License
+//    along with this program in the COPYING file.
+//    If not, see <http://www.gnu.org/licenses/>.
+
+// Ring buffer packet I/O for Windows tun adapters whose driver
+// supports shared send/receive rings (Wintun-style
+// TUN_IOCTL_REGISTER_RINGS), as an alternative to one overlapped
+// ReadFile/WriteFile per packet.
+
+#ifndef OPENVPN_TUN_WIN_RINGBUFFER_H
+#define OPENVPN_TUN_WIN_RINGBUFFER_H
+
+#include <asio/detail/socket_types.hpp> // prevent winsock multiple def errors
+
+#include <windows.h>
+#include <winioctl.h>
+
+#include <string>
+#include <cstring>
+#include <atomic>
+
+#include <asio.hpp>
+
+#include <openvpn/common/exception.hpp>
+#include <openvpn/common/rc.hpp>
+#include <openvpn/buffer/buffer.hpp>
+#include <openvpn/frame/frame.hpp>
+#include <openvpn/log/sessionstats.hpp>
+#include <openvpn/tun/tunlog.hpp>
+#include <openvpn/win/scoped_handle.hpp>
+
+#ifndef TUN_IOCTL_REGISTER_RINGS
+#define TUN_IOCTL_REGISTER_RINGS CTL_CODE(51820U, 0x970U, METHOD_BUFFERED, FILE_READ_DATA | FILE_WRITE_DATA)
+#endif
+
+namespace openvpn {
+  namespace TunWin {
+
+    OPENVPN_EXCEPTION(ring_buffer_error);
+
+    // Send and receive rings shared with the driver.  The driver
+    // writes packets from the OS into the send ring and reads
+    // packets that we write into the receive ring.  Each side
+    // signals the other's tail_moved event, but only while the
+    // other side has declared itself alertable (i.e. is about
+    // to sleep), so a busy ring needs no syscalls at all.
+    class RingBuffer : public RC<thread_unsafe_refcount>
+    {
+    public:
+      typedef RCPtr<RingBuffer> Ptr;
+
+      enum {
+	RING_CAPACITY = 0x800000, // must be a power of 2
+	RING_TRAILING_BYTES = 0x10000,
+	MAX_PACKET_SIZE = 0xFFFF,
+	PACKET_ALIGN = 4,
+      };
+
+      enum Status {
+	EMPTY,
+	PACKET,
+	DROPPED, // packet didn't fit in caller's buffer
+	CORRUPT,
+      };
+
+      RingBuffer()
+      {
+	send_ring = alloc_ring();
+	receive_ring = alloc_ring();
+	send_tail_moved_.reset(::CreateEventW(nullptr, FALSE, FALSE, nullptr));
+	receive_tail_moved.reset(::CreateEventW(nullptr, FALSE, FALSE, nullptr));
+	if (!send_ring || !receive_ring || !send_tail_moved_.defined() || !receive_tail_moved.defined())
+	  {
+	    free_rings();
+	    throw ring_buffer_error("cannot allocate rings");
+	  }
+      }
+
+      ~RingBuffer()
+      {
+	free_rings();
+      }
+
+      // Register rings with the driver behind device.  Returns false
+      // if the driver doesn't support ring buffers.
+      bool register_rings(HANDLE device)
+      {
+	RegisterRings rr;
+	rr.send.ring_size = sizeof(Ring);
+	rr.send.ring = send_ring;
+	rr.send.tail_moved = send_tail_moved_();
+	rr.receive.ring_size = sizeof(Ring);
+	rr.receive.ring = receive_ring;
+	rr.receive.tail_moved = receive_tail_moved();
+	DWORD len;
+	return ::DeviceIoControl(device, TUN_IOCTL_REGISTER_RINGS, &rr, sizeof(rr),
+				 nullptr, 0, &len, nullptr) != 0;
+      }
+
+      // Pop the next packet that the driver put on the send ring,
+      // appending it to buf.
+      Status read(Buffer& buf)
+      {
+	const ULONG head = send_ring->head;
+	const ULONG tail = send_ring->tail;
+	if (head >= RING_CAPACITY || tail >= RING_CAPACITY)
+	  return CORRUPT;
+	if (head == tail)
+	  return EMPTY;
+	std::atomic_thread_fence(std::memory_order_acquire);
+
+	const ULONG content = (tail - head) & (RING_CAPACITY - 1);
+	ULONG size;
+	if (content < sizeof(size))
+	  return CORRUPT;
+	std::memcpy(&size, send_ring->data + head, sizeof(size));
+	if (size > MAX_PACKET_SIZE)
+	  return CORRUPT;
+	const ULONG aligned = align(sizeof(size) + size);
+	if (aligned > content)
+	  return CORRUPT;
+
+	// packets never wrap, they may run into the trailing bytes
+	Status ret = DROPPED;
+	if (size <= buf.remaining())
+	  {
+	    buf.write(send_ring->data + head + sizeof(size), size);
+	    ret = PACKET;
+	  }
+	std::atomic_thread_fence(std::memory_order_release);
+	send_ring->head = (head + aligned) & (RING_CAPACITY - 1);
+	return ret;
+      }
+
+      // Push buf onto the receive ring.  Returns false if the ring
+      // is full or corrupt, in which case the packet is dropped.
+      bool write(const Buffer& buf)
+      {
+	const ULONG size = ULONG(buf.size());
+	if (size > MAX_PACKET_SIZE)
+	  return false;
+	const ULONG head = receive_ring->head;
+	const ULONG tail = receive_ring->tail;
+	if (head >= RING_CAPACITY || tail >= RING_CAPACITY)
+	  return false;
+	const ULONG aligned = align(sizeof(size) + size);
+	const ULONG space = (head - tail - PACKET_ALIGN) & (RING_CAPACITY - 1);
+	if (aligned > space)
+	  return false;
+
+	std::memcpy(receive_ring->data + tail, &size, sizeof(size));
+	std::memcpy(receive_ring->data + tail + sizeof(size), buf.c_data(), size);
+	std::atomic_thread_fence(std::memory_order_release);
+	receive_ring->tail = (tail + aligned) & (RING_CAPACITY - 1);
+	std::atomic_thread_fence(std::memory_order_seq_cst);
+	if (receive_ring->alertable)
+	  ::SetEvent(receive_tail_moved());
+	return true;
+      }
+
+      // Called after read() returned EMPTY.  Asks the driver to
+      // signal send_tail_moved() on the next packet.  Returns false
+      // if a packet arrived meanwhile, in which case read again.
+      bool arm()
+      {
+	send_ring->alertable = TRUE;
+	std::atomic_thread_fence(std::memory_order_seq_cst);
+	if (send_ring->head != send_ring->tail)
+	  {
+	    send_ring->alertable = FALSE;
+	    return false;
+	  }
+	return true;
+      }
+
+      void disarm()
+      {
+	send_ring->alertable = FALSE;
+      }
+
+      HANDLE send_tail_moved() const
+      {
+	return send_tail_moved_();
+      }
+
+    private:
+      struct Ring
+      {
+	volatile ULONG head;
+	volatile ULONG tail;
+	volatile LONG alertable;
+	UCHAR data[RING_CAPACITY + RING_TRAILING_BYTES];
+      };
+
+      struct RegisterRings
+      {
+	struct
+	{
+	  ULONG ring_size;
+	  Ring* ring;
+	  HANDLE tail_moved;
+	} send, receive;
+      };
+
+      static ULONG align(const ULONG size)
+      {
+	return (size + (PACKET_ALIGN - 1)) & ~ULONG(PACKET_ALIGN - 1);
+      }
+
+      // VirtualAlloc returns zeroed, page-aligned memory
+      static Ring* alloc_ring()
+      {
+	return (Ring*)::VirtualAlloc(nullptr, sizeof(Ring), MEM_COMMIT|MEM_RESERVE, PAGE_READWRITE);
+      }
+
+      void free_rings()
+      {
+	if (send_ring)
+	  ::VirtualFree(send_ring, 0, MEM_RELEASE);
+	if (receive_ring)
+	  ::VirtualFree(receive_ring, 0, MEM_RELEASE);
+	send_ring = receive_ring = nullptr;
+      }
+
+      Ring* send_ring = nullptr;
+      Ring* receive_ring = nullptr;
+      Win::ScopedHANDLE send_tail_moved_;
+      Win::ScopedHANDLE receive_tail_moved;
+    };
+
+    // Packet forwarding over a RingBuffer, with the same read handler
+    // interface as TunIO.  On each wakeup every packet that is ready
+    // on the send ring is drained, up to batch_limit before yielding
+    // to other handlers.
+    template <typename ReadHandler, typename PacketFrom>
+    class TunRingIO : public RC<thread_unsafe_refcount>
+    {
+    public:
+      typedef RCPtr<TunRingIO> Ptr;
+
+      TunRingIO(asio::io_context& io_context,
+		const RingBuffer::Ptr& ring_arg,
+		const std::string& name,
+		ReadHandler read_handler_arg,
+		const Frame::Ptr& frame_arg,
+		const SessionStats::Ptr& stats_arg,
+		const size_t batch_limit_arg = 64)
+	: ring(ring_arg),
+	  name_(name),
+	  read_handler(read_handler_arg),
+	  frame(frame_arg),
+	  frame_context((*frame_arg)[Frame::READ_TUN]),
+	  stats(stats_arg),
+	  event(io_context),
+	  batch_limit(batch_limit_arg)
+      {
+	// object_handle closes its handle, so give it a duplicate
+	HANDLE h;
+	if (!::DuplicateHandle(::GetCurrentProcess(), ring->send_tail_moved(),
+			       ::GetCurrentProcess(), &h, 0, FALSE, DUPLICATE_SAME_ACCESS))
+	  throw ring_buffer_error("cannot duplicate ring event");
+	event.assign(h);
+      }
+
+      void start()
+      {
+	if (!halt)
+	  drain();
+      }
+
+      bool write(const Buffer& buf)
+      {
+	if (halt)
+	  return false;
+	if (!ring->write(buf))
+	  {
+	    OPENVPN_LOG_TUN_ERROR("TUN write error: receive ring full");
+	    return false;
+	  }
+	if (stats)
+	  {
+	    stats->inc_stat(SessionStats::TUN_BYTES_OUT, buf.size());
+	    stats->inc_stat(SessionStats::TUN_PACKETS_OUT, 1);
+	  }
+	return true;
+      }
+
+      void stop()
+      {
+	if (!halt)
+	  {
+	    halt = true;
+	    ring->disarm();
+	    asio::error_code ec;
+	    event.cancel(ec);
+	    event.close(ec);
+	  }
+      }
+
+      std::string name() const
+      {
+	return name_;
+      }
+
+    private:
+      void drain()
+      {
+	for (;;)
+	  {
+	    size_t n = 0;
+	    while (n < batch_limit && !halt)
+	      {
+		if (!pfp)
+		  pfp.reset(new PacketFrom());
+		frame_context.prepare(pfp->buf);
+		const RingBuffer::Status status = ring->read(pfp->buf);
+		if (status == RingBuffer::EMPTY)
+		  break;
+		if (status == RingBuffer::CORRUPT)
+		  {
+		    OPENVPN_LOG_TUN_ERROR("TUN Read Error: send ring corrupt");
+		    read_handler->tun_error_handler(Error::TUN_READ_ERROR, nullptr);
+		    return;
+		  }
+		++n;
+		if (status == RingBuffer::DROPPED)
+		  continue;
+		if (stats)
+		  {
+		    stats->inc_stat(SessionStats::TUN_BYTES_IN, pfp->buf.size());
+		    stats->inc_stat(SessionStats::TUN_PACKETS_IN, 1);
+		  }
+		read_handler->tun_read_handler(pfp); // may take pfp
+	      }
+	    OPENVPN_PERF_BATCH(stats, TUN_READ_BATCH, n);
+	    if (halt)
+	      return;
+	    if (n == batch_limit)
+	      {
+		// ring is busy, let other handlers run before continuing
+		asio::post(event.get_executor(), [self=Ptr(this)]()
+			   {
+			     if (!self->halt)
+			       self->drain();
+			   });
+		return;
+	      }
+	    if (ring->arm())
+	      break;
+	  }
+	queue_wait();
+      }
+
+      void queue_wait()
+      {
+	event.async_wait([self=Ptr(this)](const asio::error_code& error)
+			 {
+			   if (self->halt)
+			     return;
+			   if (error)
+			     {
+			       OPENVPN_LOG_TUN_ERROR("TUN Read Error: " << error.message());
+			       self->read_handler->tun_error_handler(Error::TUN_READ_ERROR, &error);
+			       return;
+			     }
+			   self->ring->disarm();
+			   self->drain();
+			 });
+      }
+
+      RingBuffer::Ptr ring;
+      std::string name_;
+      ReadHandler read_handler;
+      Frame::Ptr frame;
+      const Frame::Context& frame_context;
+      SessionStats::Ptr stats;
+      asio::windows::object_handle event;
+      const size_t batch_limit;
+      typename PacketFrom::SPtr pfp;
+      bool halt = false;
+    };
+
+  }
+}
+
+#endif
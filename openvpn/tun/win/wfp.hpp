@@ -63,6 +63,11 @@ namespace openvpn {
 	// Get app ID
 	unique_ptr_del<FWP_BYTE_BLOB> openvpn_app_id_blob = get_app_id_blob(openvpn_app_path);
 
+	// Install the sublayer and all filters in one transaction,
+	// so that the BFE commits them together and a failure
+	// part way through leaves no partial filter set behind
+	Transaction transaction(engineHandle());
+
 	// Populate packet filter layer information
 	{
 	  FWPM_SUBLAYER0 subLayer = {0};
@@ -142,6 +147,8 @@ namespace openvpn {
 
 	add_filter(&filter, NULL, &filterid);
 	log << "allow IPv6 traffic from TAP" << std::endl;
+
+	transaction.commit();
       }
 
       void reset(std::ostream& log)
@@ -203,6 +210,39 @@ namespace openvpn {
 	HANDLE handle = NULL;
       };
 
+      // Aborted on destruction unless committed
+      class Transaction
+      {
+      public:
+	Transaction(HANDLE engine_arg)
+	  : engine(engine_arg)
+	{
+	  const DWORD status = ::FwpmTransactionBegin0(engine, 0);
+	  if (status != ERROR_SUCCESS)
+	    OPENVPN_THROW(wfp_error, "FwpmTransactionBegin0 failed with status=0x" << std::hex << status);
+	}
+
+	void commit()
+	{
+	  const DWORD status = ::FwpmTransactionCommit0(engine);
+	  engine = NULL;
+	  if (status != ERROR_SUCCESS)
+	    OPENVPN_THROW(wfp_error, "FwpmTransactionCommit0 failed with status=0x" << std::hex << status);
+	}
+
+	~Transaction()
+	{
+	  if (engine)
+	    ::FwpmTransactionAbort0(engine);
+	}
+
+      private:
+	Transaction(const Transaction&) = delete;
+	Transaction& operator=(const Transaction&) = delete;
+
+	HANDLE engine;
+      };
+
       static GUID new_guid()
       {
 	UUID ret;
@@ -0,0 +1,608 @@
+//    OpenVPN -- An application to securely tunnel IP networks
+//               over a single port, with support for SSL/TLS-based
+//               session authentication and key exchange,
+//               packet encryption, packet authentication, and
+//               packet compression.
+//
+//    Copyright (C) 2012-2016 OpenVPN Technologies, Inc.
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU Affero General Public License Version 3
+//    as published by the Free Software Foundation.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU Affero General Public License for more details.
+//
+//    You should have received a copy of the GNU Affero General Public License
+//    along with this program in the COPYING file.
+//    If not, see <http://www.gnu.org/licenses/>.
+
+// Client cold-start benchmark: connects the ClientAPI client to a
+// (normally local) server a number of times and breaks the time to
+// the first tunneled packet down by startup phase, with the link
+// RTT emulated by Gremlin.
+
+#include <string>
+#include <vector>
+#include <iostream>
+#include <iomanip>
+#include <thread>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <algorithm>
+
+#include <openvpn/common/platform.hpp>
+
+// Emulated RTT is applied by Gremlin, and the tunnel is a
+// packet-batch TunBuilderBase implementation below, so no tun
+// device (and no privilege) is needed on any platform.
+#define OPENVPN_GREMLIN
+#ifndef USE_TUN_BUILDER
+#define USE_TUN_BUILDER
+#endif
+
+// don't export core symbols
+#define OPENVPN_CORE_API_VISIBILITY_HIDDEN
+
+// should be included before other openvpn includes,
+// with the exception of openvpn/log includes
+#include <client/ovpncli.cpp>
+
+#include <openvpn/common/exception.hpp>
+#include <openvpn/common/file.hpp>
+#include <openvpn/common/string.hpp>
+#include <openvpn/addr/ipv4.hpp>
+#include <openvpn/ip/ip.hpp>
+#include <openvpn/ip/icmp.hpp>
+
+using namespace openvpn;
+
+enum Format {
+  TEXT,
+  JSON,
+  CSV,
+};
+
+// Phase boundaries, in the order a connection passes them.  Events
+// that a given connection does not raise (RESOLVE for a numeric
+// remote, WAIT on some transports) take the time of the next
+// boundary that was reached, so their phase reads as zero.
+enum Mark {
+  START,         // connect() called
+  RESOLVE,       // pre-resolve of remote hostnames began
+  WAIT,          // transport started, waiting for the server
+  CONNECTING,    // first packet from the server
+  GET_CONFIG,    // TLS handshake done, first PUSH_REQUEST sent
+  ASSIGN_IP,     // push reply received, tun setup began
+  CONNECTED,     // tun established
+  FIRST_PACKET,  // echo reply to the first tunneled packet
+  N_MARKS,
+};
+
+static const char *event_marks[] = {
+  nullptr,
+  "RESOLVE",
+  "WAIT",
+  "CONNECTING",
+  "GET_CONFIG",
+  "ASSIGN_IP",
+  "CONNECTED",
+  nullptr,
+};
+
+// phase i runs from mark i to mark i+1
+static const char *phase_names[] = {
+  "startup",
+  "pre-resolve",
+  "transport-connect",
+  "tls-handshake",
+  "push",
+  "tun-establish",
+  "first-packet",
+};
+
+typedef std::chrono::steady_clock Clock;
+
+static double ms_between(const Clock::time_point a, const Clock::time_point b)
+{
+  return std::chrono::duration<double, std::milli>(b - a).count();
+}
+
+class Client : public ClientAPI::OpenVPNClient
+{
+public:
+  Client(const bool verbose_arg)
+    : verbose(verbose_arg)
+  {
+  }
+
+  // Mark START and run connect() on its own thread.
+  void start()
+  {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      marks[START] = Clock::now();
+      reached[START] = true;
+    }
+    thread.reset(new std::thread([this]() {
+	  asio::detail::signal_blocker signal_blocker;
+	  const ClientAPI::Status status = connect();
+	  std::lock_guard<std::mutex> lock(mutex);
+	  if (status.error)
+	    error = status.status + ": " + status.message;
+	  done = true;
+	  cv.notify_all();
+	}));
+  }
+
+  // Wait until CONNECTED, then inject an echo request to the VPN
+  // gateway and wait for its reply.  Returns an empty string on
+  // success.
+  std::string wait(const int timeout_ms, const int ping_timeout_ms)
+  {
+    std::unique_lock<std::mutex> lock(mutex);
+    if (!cv.wait_for(lock, std::chrono::milliseconds(timeout_ms),
+		     [this]() { return reached[CONNECTED] || done || !error.empty(); }))
+      return "timeout waiting for CONNECTED";
+    if (!reached[CONNECTED])
+      return error.empty() ? "disconnected" : error;
+    if (gateway.empty())
+      return std::string();
+
+    const std::vector<unsigned char> pkt = echo_request();
+    lock.unlock();
+    TunBuilderPacket tbp;
+    tbp.data = pkt.data();
+    tbp.size = pkt.size();
+    tbp.family = AF_INET;
+    if (!tun_read_packets(&tbp, 1))
+      return "tun_read_packets failed";
+    lock.lock();
+    cv.wait_for(lock, std::chrono::milliseconds(ping_timeout_ms),
+		[this]() { return reached[FIRST_PACKET] || done; });
+    return std::string();
+  }
+
+  void finish()
+  {
+    stop();
+    if (thread)
+      {
+	thread->join();
+	thread.reset();
+      }
+  }
+
+  // Milliseconds spent in each phase, filling boundaries that were
+  // never reached from the next one that was.
+  std::vector<double> phases() const
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    Clock::time_point t[N_MARKS];
+    int last = CONNECTED;
+    if (reached[FIRST_PACKET])
+      last = FIRST_PACKET;
+    t[last] = marks[last];
+    for (int i = last - 1; i >= 0; --i)
+      t[i] = reached[i] ? marks[i] : t[i + 1];
+    std::vector<double> ret;
+    for (int i = 0; i < N_MARKS - 1; ++i)
+      ret.push_back(i < last ? ms_between(t[i], t[i + 1]) : -1.0);
+    return ret;
+  }
+
+  double tun_builder_ms() const
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    return ms_between(tun_new, tun_established);
+  }
+
+private:
+  void mark(const int m)
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (!reached[m])
+      {
+	marks[m] = Clock::now();
+	reached[m] = true;
+	cv.notify_all();
+      }
+  }
+
+  std::vector<unsigned char> echo_request()
+  {
+    std::vector<unsigned char> pkt(sizeof(ICMP) + 32, 0);
+    ICMP* icmp = (ICMP*)pkt.data();
+    icmp->head.version_len = IPHeader::ver_len(4, sizeof(IPHeader));
+    icmp->head.tot_len = htons(std::uint16_t(pkt.size()));
+    icmp->head.ttl = 64;
+    icmp->head.protocol = IPHeader::ICMP;
+    icmp->head.saddr = IPv4::Addr::from_string(address).to_uint32_net();
+    icmp->head.daddr = IPv4::Addr::from_string(gateway).to_uint32_net();
+    icmp->head.check = ip_checksum(&icmp->head, sizeof(IPHeader));
+    icmp->type = ICMP::ECHO_REQUEST;
+    icmp->hd.echo.id = htons(ECHO_ID);
+    icmp->hd.echo.seq_num = htons(1);
+    icmp->checksum = ip_checksum(&icmp->type, pkt.size() - sizeof(IPHeader));
+    return pkt;
+  }
+
+  virtual bool socket_protect(int socket) override
+  {
+    return true;
+  }
+
+  virtual void event(const ClientAPI::Event& ev) override
+  {
+    if (verbose)
+      std::cerr << "EVENT: " << ev.name << ' ' << ev.info << std::endl;
+    for (int i = 0; i < N_MARKS; ++i)
+      {
+	if (event_marks[i] && ev.name == event_marks[i])
+	  {
+	    mark(i);
+	    return;
+	  }
+      }
+    if (ev.error || ev.name == "DISCONNECTED")
+      {
+	std::lock_guard<std::mutex> lock(mutex);
+	if (error.empty())
+	  error = ev.name + ' ' + ev.info;
+	cv.notify_all();
+      }
+  }
+
+  virtual void log(const ClientAPI::LogInfo& log) override
+  {
+    if (verbose)
+      std::cerr << log.text << std::flush;
+  }
+
+  virtual void external_pki_cert_request(ClientAPI::ExternalPKICertRequest& certreq) override
+  {
+    certreq.error = true;
+    certreq.errorText = "external_pki_cert_request not implemented";
+  }
+
+  virtual void external_pki_sign_request(ClientAPI::ExternalPKISignRequest& signreq) override
+  {
+    signreq.error = true;
+    signreq.errorText = "external_pki_sign_request not implemented";
+  }
+
+  virtual bool pause_on_connection_timeout() override
+  {
+    return false;
+  }
+
+  // TunBuilderBase: accept everything, remember the VPN address
+  // and gateway for the echo request, and exchange packets in
+  // batch mode so no file descriptor is needed.
+  virtual bool tun_builder_new() override
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    tun_new = Clock::now();
+    return true;
+  }
+
+  virtual bool tun_builder_set_layer(int layer) override { return true; }
+  virtual bool tun_builder_set_remote_address(const std::string& address, bool ipv6) override { return true; }
+
+  virtual bool tun_builder_add_address(const std::string& address_arg,
+				       int prefix_length,
+				       const std::string& gateway_arg,
+				       bool ipv6,
+				       bool net30) override
+  {
+    if (!ipv6)
+      {
+	std::lock_guard<std::mutex> lock(mutex);
+	address = address_arg;
+	gateway = gateway_arg;
+      }
+    return true;
+  }
+
+  virtual bool tun_builder_set_route_metric_default(int metric) override { return true; }
+  virtual bool tun_builder_reroute_gw(bool ipv4, bool ipv6, unsigned int flags) override { return true; }
+
+  virtual bool tun_builder_add_route(const std::string& address,
+				     int prefix_length,
+				     int metric,
+				     bool ipv6) override
+  {
+    return true;
+  }
+
+  virtual bool tun_builder_exclude_route(const std::string& address,
+					 int prefix_length,
+					 int metric,
+					 bool ipv6) override
+  {
+    return true;
+  }
+
+  virtual bool tun_builder_add_dns_server(const std::string& address, bool ipv6) override { return true; }
+  virtual bool tun_builder_add_search_domain(const std::string& domain) override { return true; }
+  virtual bool tun_builder_set_mtu(int mtu) override { return true; }
+  virtual bool tun_builder_set_session_name(const std::string& name) override { return true; }
+  virtual bool tun_builder_add_proxy_bypass(const std::string& bypass_host) override { return true; }
+  virtual bool tun_builder_set_proxy_auto_config_url(const std::string& url) override { return true; }
+  virtual bool tun_builder_set_proxy_http(const std::string& host, int port) override { return true; }
+  virtual bool tun_builder_set_proxy_https(const std::string& host, int port) override { return true; }
+  virtual bool tun_builder_add_wins_server(const std::string& address) override { return true; }
+  virtual bool tun_builder_set_block_ipv6(bool block_ipv6) override { return true; }
+  virtual bool tun_builder_set_adapter_domain_suffix(const std::string& name) override { return true; }
+
+  virtual bool tun_builder_establish_packets() override
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    tun_established = Clock::now();
+    return true;
+  }
+
+  virtual bool tun_builder_write_packets(const TunBuilderPacket* packets, size_t n) override
+  {
+    for (size_t i = 0; i < n; ++i)
+      {
+	const TunBuilderPacket& p = packets[i];
+	if (p.size < sizeof(ICMP))
+	  continue;
+	const ICMP* icmp = (const ICMP*)p.data;
+	if (IPHeader::version(icmp->head.version_len) == 4
+	    && IPHeader::length(icmp->head.version_len) == sizeof(IPHeader)
+	    && icmp->head.protocol == IPHeader::ICMP
+	    && icmp->type == ICMP::ECHO_REPLY
+	    && icmp->hd.echo.id == htons(ECHO_ID))
+	  mark(FIRST_PACKET);
+      }
+    return true;
+  }
+
+  virtual bool tun_builder_persist() override
+  {
+    return false;
+  }
+
+  enum {
+    ECHO_ID = 0x4f33,
+  };
+
+  const bool verbose;
+
+  mutable std::mutex mutex;
+  std::condition_variable cv;
+  Clock::time_point marks[N_MARKS];
+  bool reached[N_MARKS] = {};
+  Clock::time_point tun_new;
+  Clock::time_point tun_established;
+  std::string address;
+  std::string gateway;
+  std::string error;
+  bool done = false;
+  std::unique_ptr<std::thread> thread;
+};
+
+class Report
+{
+public:
+  Report(const Format format_arg)
+    : format(format_arg)
+  {
+    if (format == CSV)
+      std::cout << "phase,runs,min_ms,median_ms,max_ms" << std::endl;
+    else if (format == JSON)
+      std::cout << '[' << std::endl;
+  }
+
+  ~Report()
+  {
+    if (format == JSON)
+      std::cout << std::endl << ']' << std::endl;
+  }
+
+  // samples < 0 were not measured
+  void add(const std::string& phase, std::vector<double> samples)
+  {
+    samples.erase(std::remove_if(samples.begin(), samples.end(), [](double v) { return v < 0.0; }),
+		  samples.end());
+    if (samples.empty())
+      return;
+    std::sort(samples.begin(), samples.end());
+    const double min = samples.front();
+    const double med = samples[samples.size() / 2];
+    const double max = samples.back();
+    switch (format)
+      {
+      case TEXT:
+	std::cout << std::left << std::setw(20) << phase << std::right
+		  << std::fixed << std::setprecision(2)
+		  << std::setw(10) << min
+		  << std::setw(10) << med
+		  << std::setw(10) << max << " ms"
+		  << std::defaultfloat << std::endl;
+	break;
+      case CSV:
+	std::cout << phase << ',' << samples.size() << ',' << min << ',' << med << ',' << max << std::endl;
+	break;
+      case JSON:
+	if (n_results)
+	  std::cout << ',' << std::endl;
+	std::cout << "  {\"phase\": \"" << phase << '"'
+		  << ", \"runs\": " << samples.size()
+		  << ", \"min_ms\": " << min
+		  << ", \"median_ms\": " << med
+		  << ", \"max_ms\": " << max
+		  << '}';
+	break;
+      }
+    ++n_results;
+  }
+
+  void header()
+  {
+    if (format == TEXT)
+      std::cout << std::left << std::setw(20) << "phase" << std::right
+		<< std::setw(10) << "min"
+		<< std::setw(10) << "median"
+		<< std::setw(10) << "max" << std::endl;
+  }
+
+private:
+  const Format format;
+  size_t n_results = 0;
+};
+
+static void usage()
+{
+  std::cerr << "usage: coldstart [options] <profile.ovpn>" << std::endl
+	    << "  --runs N           connections to measure (5)" << std::endl
+	    << "  --rtt MS           emulated round-trip time, added by Gremlin (0)" << std::endl
+	    << "  --user U           username, if the profile needs creds" << std::endl
+	    << "  --pass P           password" << std::endl
+	    << "  --timeout MS       limit for reaching CONNECTED (30000)" << std::endl
+	    << "  --ping-timeout MS  limit for the first packet reply (5000)" << std::endl
+	    << "  --format F         text, json or csv (text)" << std::endl
+	    << "  --verbose 0|1      show client log and events on stderr (0)" << std::endl;
+}
+
+int main(int argc, char *argv[])
+{
+  int runs = 5;
+  int rtt = 0;
+  int timeout = 30000;
+  int ping_timeout = 5000;
+  std::string username;
+  std::string password;
+  std::string profile;
+  Format format = TEXT;
+  bool verbose = false;
+
+  try {
+    for (int i = 1; i < argc; ++i)
+      {
+	const std::string opt = argv[i];
+	if (!string::starts_with(opt, "--") && profile.empty())
+	  {
+	    profile = opt;
+	    continue;
+	  }
+	if (i + 1 >= argc)
+	  {
+	    usage();
+	    return 2;
+	  }
+	const std::string arg = argv[++i];
+	if (opt == "--runs")
+	  runs = std::stoi(arg);
+	else if (opt == "--rtt")
+	  rtt = std::stoi(arg);
+	else if (opt == "--user")
+	  username = arg;
+	else if (opt == "--pass")
+	  password = arg;
+	else if (opt == "--timeout")
+	  timeout = std::stoi(arg);
+	else if (opt == "--ping-timeout")
+	  ping_timeout = std::stoi(arg);
+	else if (opt == "--verbose")
+	  verbose = arg == "1";
+	else if (opt == "--format")
+	  {
+	    if (arg == "text")
+	      format = TEXT;
+	    else if (arg == "json")
+	      format = JSON;
+	    else if (arg == "csv")
+	      format = CSV;
+	    else
+	      OPENVPN_THROW_EXCEPTION("unknown format: " << arg);
+	  }
+	else
+	  {
+	    usage();
+	    return 2;
+	  }
+      }
+    if (profile.empty() || runs < 1 || rtt < 0)
+      {
+	usage();
+	return 2;
+      }
+
+    // process-wide initialization, once per cold start
+    const Clock::time_point t0 = Clock::now();
+    Client::init_process();
+    const double init_ms = ms_between(t0, Clock::now());
+
+    ClientAPI::Config config;
+    config.content = read_text_utf8(profile);
+    if (rtt)
+      config.gremlinConfig = std::to_string(rtt / 2) + ',' + std::to_string(rtt - rtt / 2) + ",0,0";
+
+    std::vector<double> eval_ms;
+    std::vector<std::vector<double>> phase_ms(N_MARKS - 1);
+    std::vector<double> tun_builder_ms;
+    std::vector<double> total_ms;
+    for (int r = 0; r < runs; ++r)
+      {
+	Client client(verbose);
+
+	const Clock::time_point e0 = Clock::now();
+	const ClientAPI::EvalConfig eval = client.eval_config(config);
+	eval_ms.push_back(ms_between(e0, Clock::now()));
+	if (eval.error)
+	  OPENVPN_THROW_EXCEPTION("eval config error: " << eval.message);
+	if (!eval.autologin)
+	  {
+	    if (username.empty())
+	      OPENVPN_THROW_EXCEPTION("profile needs --user and --pass");
+	    ClientAPI::ProvideCreds creds;
+	    creds.username = username;
+	    creds.password = password;
+	    const ClientAPI::Status status = client.provide_creds(creds);
+	    if (status.error)
+	      OPENVPN_THROW_EXCEPTION("creds error: " << status.message);
+	  }
+
+	client.start();
+	const std::string err = client.wait(timeout, ping_timeout);
+	client.finish();
+	if (!err.empty())
+	  OPENVPN_THROW_EXCEPTION("run " << r << ": " << err);
+
+	const std::vector<double> ph = client.phases();
+	double total = 0.0;
+	for (size_t i = 0; i < ph.size(); ++i)
+	  {
+	    phase_ms[i].push_back(ph[i]);
+	    if (ph[i] > 0.0)
+	      total += ph[i];
+	  }
+	tun_builder_ms.push_back(client.tun_builder_ms());
+	total_ms.push_back(total + eval_ms.back());
+      }
+
+    Report report(format);
+    report.header();
+    report.add("init-process", std::vector<double>{ init_ms });
+    report.add("eval-config", eval_ms);
+    for (size_t i = 0; i < phase_ms.size(); ++i)
+      report.add(phase_names[i], phase_ms[i]);
+    report.add("  tun-builder", tun_builder_ms);
+    report.add("total", total_ms);
+  }
+  catch (const std::exception& e)
+    {
+      std::cerr << "Exception: " << e.what() << std::endl;
+      Client::uninit_process();
+      return 1;
+    }
+  Client::uninit_process();
+  return 0;
+}
@@ -0,0 +1,93 @@
+//    OpenVPN -- An application to securely tunnel IP networks
+//               over a single port, with support for SSL/TLS-based
+//               session authentication and key exchange,
+//               packet encryption, packet authentication, and
+//               packet compression.
+//
+//    Copyright (C) 2012-2016 OpenVPN Technologies, Inc.
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU Affero General Public License Version 3
+//    as published by the Free Software Foundation.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU Affero General Public License for more details.
+//
+//    You should have received a copy of the GNU Affero General Public License
+//    along with this program in the COPYING file.
+//    If not, see <http://www.gnu.org/licenses/>.
+
+// SSL fixture shared by the test tools: client and server SSL
+// factories built from the keys in test/ssl (ca.crt, client.crt,
+// client.key, server.crt, server.key and dh.pem).
+
+#ifndef OPENVPN_TEST_COMMON_TESTKEYS_H
+#define OPENVPN_TEST_COMMON_TESTKEYS_H
+
+#include <string>
+
+#include <openvpn/common/file.hpp>
+#include <openvpn/frame/frame.hpp>
+#include <openvpn/random/randapi.hpp>
+#include <openvpn/ssl/sslapi.hpp>
+#include <openvpn/ssl/sslchoose.hpp>
+
+namespace openvpn {
+  namespace TestKeys {
+
+    inline SSLFactoryAPI::Ptr client_ssl(const std::string& keydir,
+					 const Frame::Ptr& frame,
+					 const RandomAPI::Ptr& rng)
+    {
+      const std::string dir = keydir + '/';
+      SSLLib::SSLAPI::Config::Ptr cc(new SSLLib::SSLAPI::Config());
+      cc->set_mode(Mode(Mode::CLIENT));
+      cc->set_frame(frame);
+      cc->load_ca(read_text(dir + "ca.crt"), true);
+      cc->load_cert(read_text(dir + "client.crt"));
+      cc->load_private_key(read_text(dir + "client.key"));
+      cc->set_rng(rng);
+      return cc->new_factory();
+    }
+
+    inline SSLFactoryAPI::Ptr server_ssl(const std::string& keydir,
+					 const Frame::Ptr& frame,
+					 const RandomAPI::Ptr& rng)
+    {
+      const std::string dir = keydir + '/';
+      SSLLib::SSLAPI::Config::Ptr sc(new SSLLib::SSLAPI::Config());
+      sc->set_mode(Mode(Mode::SERVER));
+      sc->set_frame(frame);
+      sc->load_ca(read_text(dir + "ca.crt"), true);
+      sc->load_cert(read_text(dir + "server.crt"));
+      sc->load_private_key(read_text(dir + "server.key"));
+      sc->load_dh(read_text(dir + "dh.pem"));
+      sc->set_rng(rng);
+      return sc->new_factory();
+    }
+
+    // one client and one server factory sharing a frame and RNGs
+    struct Keys
+    {
+      Keys(const std::string& keydir, const Frame::Ptr& frame_arg)
+	: rng(new SSLLib::RandomAPI(false)),
+	  prng(new SSLLib::RandomAPI(true)),
+	  frame(frame_arg),
+	  client_ssl(TestKeys::client_ssl(keydir, frame, rng)),
+	  server_ssl(TestKeys::server_ssl(keydir, frame, rng))
+      {
+      }
+
+      RandomAPI::Ptr rng;
+      RandomAPI::Ptr prng;
+      Frame::Ptr frame;
+      SSLFactoryAPI::Ptr client_ssl;
+      SSLFactoryAPI::Ptr server_ssl;
+    };
+
+  }
+}
+
+#endif
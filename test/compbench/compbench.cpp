@@ -0,0 +1,612 @@
+//    OpenVPN -- An application to securely tunnel IP networks
+//               over a single port, with support for SSL/TLS-based
+//               session authentication and key exchange,
+//               packet encryption, packet authentication, and
+//               packet compression.
+//
+//    Copyright (C) 2012-2016 OpenVPN Technologies, Inc.
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU Affero General Public License Version 3
+//    as published by the Free Software Foundation.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU Affero General Public License for more details.
+//
+//    You should have received a copy of the GNU Affero General Public License
+//    along with this program in the COPYING file.
+//    If not, see <http://www.gnu.org/licenses/>.
+
+// Compression effectiveness benchmark: replays the IP packets of
+// one or more pcap captures of tunnel (inner) traffic through every
+// available compressor, with and without adaptive skipping, and
+// reports compression ratio, compress/decompress MB/s and the share
+// of packets that came out larger than they went in.
+
+#include <iostream>
+#include <fstream>
+#include <iomanip>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <cstring>
+#include <cstdint>
+#include <cstdlib>
+
+#include <openvpn/common/platform.hpp>
+
+#include <openvpn/log/logsimple.hpp>
+
+#include <openvpn/common/exception.hpp>
+#include <openvpn/common/file.hpp>
+#include <openvpn/frame/frame_init.hpp>
+#include <openvpn/log/sessionstats.hpp>
+#include <openvpn/compress/compress.hpp>
+#include <openvpn/init/initprocess.hpp>
+
+// With the LZO library, lzo.hpp compresses, and the built-in
+// decompress-only implementation can be measured against its output.
+#ifdef HAVE_LZO
+#include <openvpn/compress/lzoasym.hpp>
+#endif
+
+// packets compressed, then decompressed, per timed batch
+#ifndef BATCH
+#define BATCH 256
+#endif
+
+using namespace openvpn;
+
+OPENVPN_EXCEPTION(compbench_error);
+
+// Minimal reader for classic libpcap files, returning the IP packet
+// of each record.  Captures of a tun device are usually raw IP or
+// Linux cooked, captures of a tap or veth are Ethernet.
+class PcapReader
+{
+public:
+  enum {
+    LINKTYPE_NULL = 0,
+    LINKTYPE_ETHERNET = 1,
+    LINKTYPE_RAW_OLD = 12,
+    LINKTYPE_RAW = 101,
+    LINKTYPE_LINUX_SLL = 113,
+    LINKTYPE_IPV4 = 228,
+    LINKTYPE_IPV6 = 229,
+    LINKTYPE_LINUX_SLL2 = 276,
+  };
+
+  PcapReader(const std::string& fn)
+    : data(read_binary_file(fn))
+  {
+    if (data.size() < 24)
+      throw compbench_error(fn + ": not a pcap file");
+    const std::uint32_t magic = get32(0);
+    if (magic == 0xa1b2c3d4 || magic == 0xa1b23c4d)
+      swap = false;
+    else if (magic == 0xd4c3b2a1 || magic == 0x4d3cb2a1)
+      swap = true;
+    else
+      throw compbench_error(fn + ": not a classic pcap file (pcapng is not supported)");
+    linktype = get32(20) & 0xFFFF;
+    pos = 24;
+  }
+
+  // Return the next IP packet, skipping non-IP records.
+  // Returns false at end of file.
+  bool next(const unsigned char*& pkt, size_t& size)
+  {
+    while (pos + 16 <= data.size())
+      {
+	const size_t incl_len = get32(pos + 8);
+	const size_t orig_len = get32(pos + 12);
+	const size_t rec = pos + 16;
+	pos = rec + incl_len;
+	if (pos > data.size())
+	  break;
+	if (incl_len < orig_len)
+	  {
+	    ++n_truncated; // snaplen cut, not the real packet
+	    continue;
+	  }
+	const size_t hdr = link_header(data.data() + rec, incl_len);
+	if (hdr == size_t(-1) || hdr >= incl_len)
+	  {
+	    ++n_non_ip;
+	    continue;
+	  }
+	pkt = data.data() + rec + hdr;
+	size = incl_len - hdr;
+	return true;
+      }
+    return false;
+  }
+
+  size_t n_truncated = 0;
+  size_t n_non_ip = 0;
+
+private:
+  static std::vector<unsigned char> read_binary_file(const std::string& fn)
+  {
+    std::ifstream ifs(fn, std::ios::binary);
+    if (!ifs)
+      throw compbench_error("cannot open " + fn);
+    return std::vector<unsigned char>((std::istreambuf_iterator<char>(ifs)),
+				      std::istreambuf_iterator<char>());
+  }
+
+  std::uint32_t get32(const size_t off) const
+  {
+    std::uint32_t v;
+    std::memcpy(&v, data.data() + off, sizeof(v));
+    if (swap)
+      v = (v >> 24) | ((v >> 8) & 0xFF00) | ((v << 8) & 0xFF0000) | (v << 24);
+    return v;
+  }
+
+  static bool ip_version_ok(const unsigned char *p, const size_t len)
+  {
+    return len && ((p[0] >> 4) == 4 || (p[0] >> 4) == 6);
+  }
+
+  // bytes of link-layer header before the IP packet, or -1 if not IP
+  size_t link_header(const unsigned char *p, const size_t len) const
+  {
+    size_t hdr;
+    switch (linktype)
+      {
+      case LINKTYPE_RAW_OLD:
+      case LINKTYPE_RAW:
+      case LINKTYPE_IPV4:
+      case LINKTYPE_IPV6:
+	hdr = 0;
+	break;
+      case LINKTYPE_NULL:
+	hdr = 4;
+	break;
+      case LINKTYPE_ETHERNET:
+	{
+	  hdr = 14;
+	  // skip 802.1Q/802.1ad tags
+	  while (len >= hdr && (p[hdr-2] == 0x81 || p[hdr-2] == 0x88) && (p[hdr-1] == 0x00 || p[hdr-1] == 0xa8))
+	    hdr += 4;
+	  if (len < hdr || !((p[hdr-2] == 0x08 && p[hdr-1] == 0x00) || (p[hdr-2] == 0x86 && p[hdr-1] == 0xdd)))
+	    return size_t(-1);
+	  break;
+	}
+      case LINKTYPE_LINUX_SLL:
+	hdr = 16;
+	break;
+      case LINKTYPE_LINUX_SLL2:
+	hdr = 20;
+	break;
+      default:
+	return size_t(-1);
+      }
+    if (len < hdr || !ip_version_ok(p + hdr, len - hdr))
+      return size_t(-1);
+    return hdr;
+  }
+
+  const std::vector<unsigned char> data;
+  bool swap = false;
+  unsigned int linktype = 0;
+  size_t pos = 0;
+};
+
+struct Corpus
+{
+  std::string name;
+  std::vector<std::vector<unsigned char>> packets;
+  size_t bytes = 0;
+  size_t n_oversize = 0;
+};
+
+static Corpus load_corpus(const std::string& fn, const size_t max_packet, const size_t max_packets)
+{
+  Corpus c;
+  c.name = fn;
+  PcapReader r(fn);
+  const unsigned char *pkt;
+  size_t size;
+  while (c.packets.size() < max_packets && r.next(pkt, size))
+    {
+      if (size > max_packet)
+	{
+	  ++c.n_oversize; // e.g. captured with GSO/TSO
+	  continue;
+	}
+      c.packets.emplace_back(pkt, pkt + size);
+      c.bytes += size;
+    }
+  if (r.n_truncated || r.n_non_ip || c.n_oversize)
+    std::cerr << fn << ": skipped " << r.n_truncated << " truncated, "
+	      << r.n_non_ip << " non-IP and " << c.n_oversize << " oversize records" << std::endl;
+  if (c.packets.empty())
+    throw compbench_error(fn + ": no usable IP packets");
+  return c;
+}
+
+struct Method
+{
+  CompressContext::Type type;
+  bool adaptive;
+  bool lzo_asym; // decompress with the built-in LZO implementation
+};
+
+struct Result
+{
+  std::string corpus;
+  std::string method;
+  bool adaptive = false;
+  size_t packets = 0;
+  size_t bytes_in = 0;
+  size_t bytes_out = 0;
+  size_t expanded = 0;
+  size_t errors = 0;
+  double comp_sec = 0.0;
+  double decomp_sec = 0.0;
+
+  double ratio() const
+  {
+    return bytes_in ? double(bytes_out) / double(bytes_in) : 0.0;
+  }
+
+  double comp_mbps() const
+  {
+    return comp_sec > 0.0 ? double(bytes_in) / comp_sec / 1e6 : 0.0;
+  }
+
+  double decomp_mbps() const
+  {
+    return decomp_sec > 0.0 ? double(bytes_in) / decomp_sec / 1e6 : 0.0;
+  }
+
+  double expanded_pct() const
+  {
+    return packets ? double(expanded) * 100.0 / double(packets) : 0.0;
+  }
+
+  static void csv_header(std::ostream& os)
+  {
+    os << "corpus,method,adaptive,packets,bytes_in,bytes_out,ratio,comp_mbps,decomp_mbps,expanded_pct,errors" << std::endl;
+  }
+
+  void csv(std::ostream& os) const
+  {
+    os << corpus << ','
+       << method << ','
+       << adaptive << ','
+       << packets << ','
+       << bytes_in << ','
+       << bytes_out << ','
+       << ratio() << ','
+       << comp_mbps() << ','
+       << decomp_mbps() << ','
+       << expanded_pct() << ','
+       << errors << std::endl;
+  }
+
+  void json(std::ostream& os) const
+  {
+    os << "  {\"corpus\": \"" << corpus << '"'
+       << ", \"method\": \"" << method << '"'
+       << ", \"adaptive\": " << (adaptive ? "true" : "false")
+       << ", \"packets\": " << packets
+       << ", \"bytes_in\": " << bytes_in
+       << ", \"bytes_out\": " << bytes_out
+       << ", \"ratio\": " << ratio()
+       << ", \"comp_mbps\": " << comp_mbps()
+       << ", \"decomp_mbps\": " << decomp_mbps()
+       << ", \"expanded_pct\": " << expanded_pct()
+       << ", \"errors\": " << errors
+       << '}';
+  }
+
+  void text(std::ostream& os) const
+  {
+    os << std::left << std::setw(12) << method
+       << std::setw(9) << (adaptive ? "adaptive" : "") << std::right
+       << std::fixed << std::setprecision(3)
+       << " ratio=" << ratio()
+       << std::setprecision(1)
+       << " comp=" << std::setw(8) << comp_mbps() << "MB/s"
+       << " decomp=" << std::setw(8) << decomp_mbps() << "MB/s"
+       << " expanded=" << std::setw(5) << expanded_pct() << '%'
+       << std::defaultfloat;
+    if (errors)
+      os << " ERRORS=" << errors;
+    os << std::endl;
+  }
+};
+
+class CompBench
+{
+public:
+  CompBench()
+    : frame(frame_init(true, 1500, 1024, false)),
+      stats(new SessionStats())
+  {
+  }
+
+  size_t max_packet() const
+  {
+    return (*frame)[Frame::READ_TUN].payload();
+  }
+
+  // Compress each packet in order with one instance, then
+  // decompress in order with another, as the two ends of a tunnel
+  // would, so that stateful methods see a real flow.
+  Result run(const Corpus& corpus, const Method& meth, const unsigned int passes)
+  {
+    typedef std::chrono::steady_clock clock;
+
+    Result r;
+    r.corpus = corpus.name;
+    r.method = method_name(meth);
+    r.adaptive = meth.adaptive;
+
+    for (unsigned int pass = 0; pass < passes; ++pass)
+      {
+	CompressContext ctx(meth.type, false);
+	Compress::Ptr comp = ctx.new_compressor(frame, stats);
+	Compress::Ptr decomp = new_decompressor(ctx, meth);
+	comp->set_adaptive(meth.adaptive);
+	decomp->set_adaptive(meth.adaptive);
+
+	std::vector<BufferAllocated> bufs(BATCH);
+	for (size_t done = 0; done < corpus.packets.size(); )
+	  {
+	    const size_t n = std::min(size_t(BATCH), corpus.packets.size() - done);
+	    for (size_t i = 0; i < n; ++i)
+	      {
+		const std::vector<unsigned char>& p = corpus.packets[done + i];
+		frame->prepare(Frame::READ_TUN, bufs[i]);
+		bufs[i].write(p.data(), p.size());
+	      }
+
+	    const clock::time_point t0 = clock::now();
+	    for (size_t i = 0; i < n; ++i)
+	      comp->compress(bufs[i], true);
+	    const clock::time_point t1 = clock::now();
+
+	    for (size_t i = 0; i < n; ++i)
+	      {
+		const size_t in = corpus.packets[done + i].size();
+		const size_t out = bufs[i].size();
+		r.bytes_in += in;
+		r.bytes_out += out;
+		r.expanded += out > in;
+	      }
+
+	    const clock::time_point t2 = clock::now();
+	    for (size_t i = 0; i < n; ++i)
+	      decomp->decompress(bufs[i]);
+	    const clock::time_point t3 = clock::now();
+
+	    for (size_t i = 0; i < n; ++i)
+	      {
+		const std::vector<unsigned char>& p = corpus.packets[done + i];
+		if (bufs[i].size() != p.size() || std::memcmp(bufs[i].c_data(), p.data(), p.size()))
+		  ++r.errors;
+	      }
+
+	    r.comp_sec += std::chrono::duration<double>(t1 - t0).count();
+	    r.decomp_sec += std::chrono::duration<double>(t3 - t2).count();
+	    r.packets += n;
+	    done += n;
+	  }
+      }
+    return r;
+  }
+
+  static std::vector<Method> methods()
+  {
+    static const CompressContext::Type types[] = {
+      CompressContext::NONE,
+      CompressContext::COMP_STUB,
+      CompressContext::COMP_STUBv2,
+      CompressContext::LZO,
+      CompressContext::LZO_SWAP,
+      CompressContext::LZ4,
+      CompressContext::LZ4v2,
+      CompressContext::LZ4_DICTv2,
+      CompressContext::ZSTDv2,
+      CompressContext::SNAPPY,
+      CompressContext::HDRv2,
+    };
+    std::vector<Method> ret;
+    for (const auto t : types)
+      {
+	if (!CompressContext::compressor_available(t))
+	  continue;
+	ret.push_back({ t, false, false });
+	if (adaptive_capable(t))
+	  ret.push_back({ t, true, false });
+      }
+#ifdef HAVE_LZO
+    ret.push_back({ CompressContext::LZO, false, true });
+#endif
+    return ret;
+  }
+
+private:
+  static bool adaptive_capable(const CompressContext::Type t)
+  {
+    switch (t)
+      {
+      case CompressContext::LZ4:
+      case CompressContext::LZ4v2:
+      case CompressContext::LZ4_DICTv2:
+      case CompressContext::ZSTDv2:
+	return true;
+      default:
+	return false;
+      }
+  }
+
+  static std::string method_name(const Method& meth)
+  {
+    if (meth.type == CompressContext::NONE)
+      return "NONE";
+    std::string ret = CompressContext(meth.type, false).str();
+    if (meth.lzo_asym)
+      ret += "-asym";
+    return ret;
+  }
+
+  Compress::Ptr new_decompressor(CompressContext& ctx, const Method& meth)
+  {
+#ifdef HAVE_LZO
+    if (meth.lzo_asym)
+      return new CompressLZOAsym(frame, stats, false, true);
+#endif
+    return ctx.new_compressor(frame, stats);
+  }
+
+  Frame::Ptr frame;
+  SessionStats::Ptr stats;
+};
+
+static void usage()
+{
+  std::cerr << "usage: compbench [options] capture.pcap..." << std::endl
+	    << "  --passes N         replays of each capture (1)" << std::endl
+	    << "  --max-packets N    packets used from each capture (1000000)" << std::endl
+	    << "  --format F         text, json or csv (text)" << std::endl
+	    << "  --out FILE         write results to FILE rather than stdout" << std::endl;
+}
+
+int main(int argc, char* argv[])
+{
+  enum Format {
+    TEXT,
+    JSON,
+    CSV,
+  };
+
+  // process-wide initialization
+  InitProcess::init();
+
+  unsigned int passes = 1;
+  size_t max_packets = 1000000;
+  Format format = TEXT;
+  std::string out_fn;
+  std::vector<std::string> captures;
+  std::vector<Result> results;
+
+  try {
+    for (int i = 1; i < argc; ++i)
+      {
+	const std::string opt = argv[i];
+	if (opt.length() < 2 || opt.substr(0, 2) != "--")
+	  {
+	    captures.push_back(opt);
+	    continue;
+	  }
+	if (i + 1 >= argc)
+	  {
+	    usage();
+	    return 2;
+	  }
+	const std::string arg = argv[++i];
+	if (opt == "--passes")
+	  passes = std::max(std::atoi(arg.c_str()), 1);
+	else if (opt == "--max-packets")
+	  max_packets = std::max(std::atoi(arg.c_str()), 1);
+	else if (opt == "--format")
+	  {
+	    if (arg == "text")
+	      format = TEXT;
+	    else if (arg == "json")
+	      format = JSON;
+	    else if (arg == "csv")
+	      format = CSV;
+	    else
+	      OPENVPN_THROW_EXCEPTION("unknown format: " << arg);
+	  }
+	else if (opt == "--out")
+	  out_fn = arg;
+	else
+	  {
+	    usage();
+	    return 2;
+	  }
+      }
+    if (captures.empty())
+      {
+	usage();
+	return 2;
+      }
+
+    CompBench bench;
+    const std::vector<Method> methods = CompBench::methods();
+    for (const auto &fn : captures)
+      {
+	const Corpus corpus = load_corpus(fn, bench.max_packet(), max_packets);
+	if (format == TEXT && out_fn.empty())
+	  std::cout << corpus.name << ": " << corpus.packets.size() << " packets, "
+		    << corpus.bytes << " bytes" << std::endl;
+	for (const auto &m : methods)
+	  results.push_back(bench.run(corpus, m, passes));
+	if (format == TEXT && out_fn.empty())
+	  {
+	    for (size_t i = results.size() - methods.size(); i < results.size(); ++i)
+	      results[i].text(std::cout);
+	  }
+      }
+  }
+  catch (const std::exception& e)
+    {
+      std::cerr << "Exception: " << e.what() << std::endl;
+      return 1;
+    }
+
+  int ret = 0;
+  for (const auto &r : results)
+    if (r.errors)
+      ret = 1;
+
+  std::ofstream out_file;
+  if (!out_fn.empty())
+    {
+      out_file.open(out_fn);
+      if (!out_file)
+	{
+	  std::cerr << "cannot write " << out_fn << std::endl;
+	  return 1;
+	}
+    }
+  else if (format == TEXT)
+    return ret; // already shown per capture
+  std::ostream& out = out_fn.empty() ? std::cout : out_file;
+
+  switch (format)
+    {
+    case TEXT:
+      for (const auto &r : results)
+	{
+	  out << r.corpus << ": ";
+	  r.text(out);
+	}
+      break;
+    case CSV:
+      Result::csv_header(out);
+      for (const auto &r : results)
+	r.csv(out);
+      break;
+    case JSON:
+      out << '[' << std::endl;
+      for (size_t i = 0; i < results.size(); ++i)
+	{
+	  if (i)
+	    out << ',' << std::endl;
+	  results[i].json(out);
+	}
+      out << std::endl << ']' << std::endl;
+      break;
+    }
+  return ret;
+}
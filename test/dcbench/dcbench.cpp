@@ -0,0 +1,331 @@
+//    OpenVPN -- An application to securely tunnel IP networks
+//               over a single port, with support for SSL/TLS-based
+//               session authentication and key exchange,
+//               packet encryption, packet authentication, and
+//               packet compression.
+//
+//    Copyright (C) 2012-2016 OpenVPN Technologies, Inc.
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU Affero General Public License Version 3
+//    as published by the Free Software Foundation.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU Affero General Public License for more details.
+//
+//    You should have received a copy of the GNU Affero General Public License
+//    along with this program in the COPYING file.
+//    If not, see <http://www.gnu.org/licenses/>.
+
+// Microbenchmark for the data channel: pushes fixed-size and IMIX
+// packet mixes through every CryptoDCInstance cipher/digest
+// combination and every available compressor, and reports
+// Gbit/s, pps and cycles/byte for encrypt and decrypt.
+
+#include <iostream>
+#include <iomanip>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <cstring>
+#include <cstdlib>
+
+#include <openvpn/common/platform.hpp>
+
+#define OPENVPN_LOG_SSL(x) // disable
+
+#include <openvpn/log/logsimple.hpp>
+
+#include <openvpn/common/exception.hpp>
+#include <openvpn/common/count.hpp>
+#include <openvpn/common/arraysize.hpp>
+#include <openvpn/random/mtrandapi.hpp>
+#include <openvpn/frame/frame_init.hpp>
+#include <openvpn/log/sessionstats.hpp>
+#include <openvpn/compress/compress.hpp>
+#include <openvpn/crypto/cryptodcsel.hpp>
+#include <openvpn/crypto/static_key.hpp>
+#include <openvpn/crypto/packet_id.hpp>
+#include <openvpn/init/initprocess.hpp>
+
+#if defined(USE_OPENSSL)
+#include <openvpn/openssl/crypto/api.hpp>
+#elif defined(USE_POLARSSL)
+#include <openvpn/polarssl/crypto/api.hpp>
+#else
+#error Must define USE_OPENSSL or USE_POLARSSL
+#endif
+
+#if defined(__i386__) || defined(__x86_64__)
+#include <x86intrin.h>
+#define HAVE_RDTSC
+#endif
+
+// number of packets per measurement
+#ifndef N_PACKETS
+#define N_PACKETS 200000
+#endif
+
+// packets encrypted/decrypted per timed batch
+#ifndef BATCH
+#define BATCH 256
+#endif
+
+using namespace openvpn;
+
+#if defined(USE_OPENSSL)
+typedef OpenSSLCryptoAPI CryptoAPI;
+#elif defined(USE_POLARSSL)
+typedef PolarSSLCryptoAPI CryptoAPI;
+#endif
+
+// Simple IMIX: 7 x 64, 4 x 576, 1 x 1500 bytes
+static const size_t imix[] = { 64, 64, 64, 64, 64, 64, 64, 576, 576, 576, 576, 1500 };
+
+static const size_t fixed_sizes[] = { 64, 512, 1400 };
+
+struct CipherSpec
+{
+  const char *cipher;
+  const char *digest;
+};
+
+static const CipherSpec cipher_specs[] = {
+  { "AES-128-CBC",       "SHA1"   },
+  { "AES-256-CBC",       "SHA256" },
+  { "AES-128-GCM",       "NONE"   },
+  { "AES-256-GCM",       "NONE"   },
+  { "CHACHA20-POLY1305", "NONE"   },
+};
+
+static const CompressContext::Type comp_types[] = {
+  CompressContext::NONE,
+  CompressContext::COMP_STUB,
+  CompressContext::COMP_STUBv2,
+  CompressContext::LZO,
+  CompressContext::LZO_SWAP,
+  CompressContext::LZ4,
+  CompressContext::LZ4v2,
+  CompressContext::SNAPPY,
+};
+
+static const char *comp_name(const CompressContext::Type t)
+{
+  switch (t)
+    {
+    case CompressContext::NONE:        return "none";
+    case CompressContext::COMP_STUB:   return "stub";
+    case CompressContext::COMP_STUBv2: return "stub-v2";
+    case CompressContext::LZO:         return "lzo";
+    case CompressContext::LZO_SWAP:    return "lzo-swap";
+    case CompressContext::LZ4:         return "lz4";
+    case CompressContext::LZ4v2:       return "lz4-v2";
+    case CompressContext::SNAPPY:      return "snappy";
+    default:                           return "?";
+    }
+}
+
+static inline std::uint64_t cycles()
+{
+#ifdef HAVE_RDTSC
+  return __rdtsc();
+#else
+  return 0;
+#endif
+}
+
+class Meter
+{
+public:
+  void start()
+  {
+    t0 = std::chrono::steady_clock::now();
+    c0 = cycles();
+  }
+
+  void stop(const size_t bytes, const size_t packets)
+  {
+    const std::uint64_t c1 = cycles();
+    const auto t1 = std::chrono::steady_clock::now();
+    ns += std::chrono::duration_cast<std::chrono::nanoseconds>(t1 - t0).count();
+    cyc += c1 - c0;
+    total_bytes += bytes;
+    total_packets += packets;
+  }
+
+  void report(std::ostream& os) const
+  {
+    const double sec = double(ns) / 1e9;
+    os << std::fixed << std::setprecision(3)
+       << std::setw(8) << (sec > 0 ? double(total_bytes) * 8 / sec / 1e9 : 0.0) << " Gbps "
+       << std::setprecision(0)
+       << std::setw(10) << (sec > 0 ? double(total_packets) / sec : 0.0) << " pps ";
+#ifdef HAVE_RDTSC
+    os << std::setprecision(2)
+       << std::setw(7) << (total_bytes ? double(cyc) / double(total_bytes) : 0.0) << " c/B";
+#else
+    os << "    n/a c/B";
+#endif
+  }
+
+private:
+  std::chrono::steady_clock::time_point t0;
+  std::uint64_t c0 = 0;
+  std::uint64_t ns = 0;
+  std::uint64_t cyc = 0;
+  count_t total_bytes = 0;
+  count_t total_packets = 0;
+};
+
+class DCBench
+{
+public:
+  DCBench()
+    : frame(frame_init(true, 1500, 1024, false)),
+      stats(new SessionStats()),
+      prng(new MTRand())
+  {
+    // Compressible payload so that the compressors do real work
+    static const char text[] =
+      "It was a bright cold day in April, and the clocks were striking thirteen. "
+      "Winston Smith, his chin nuzzled into his breast in an effort to escape the vile wind, ";
+    payload.resize(2048);
+    for (size_t i = 0; i < payload.size(); ++i)
+      payload[i] = text[i % (sizeof(text) - 1)];
+    factory.reset(new CryptoDCSelect<CryptoAPI>(frame, stats, prng));
+  }
+
+  void run_all()
+  {
+    for (const auto& cs : cipher_specs)
+      {
+	const CryptoAlgs::Type cipher = CryptoAlgs::lookup(cs.cipher);
+	if (!factory->supports_cipher(cipher))
+	  {
+	    std::cout << cs.cipher << ": not supported by this crypto library" << std::endl;
+	    continue;
+	  }
+	const CryptoAlgs::Type digest = std::strcmp(cs.digest, "NONE") ? CryptoAlgs::lookup(cs.digest) : CryptoAlgs::NONE;
+	for (const auto ct : comp_types)
+	  {
+	    if (!CompressContext::compressor_available(ct))
+	      continue;
+	    for (const auto size : fixed_sizes)
+	      run(cs, cipher, digest, ct, &size, 1, std::to_string(size));
+	    run(cs, cipher, digest, ct, imix, array_size(imix), "imix");
+	  }
+      }
+  }
+
+private:
+  void run(const CipherSpec& cs,
+	   const CryptoAlgs::Type cipher,
+	   const CryptoAlgs::Type digest,
+	   const CompressContext::Type comp_type,
+	   const size_t* sizes,
+	   const size_t n_sizes,
+	   const std::string& mix_name)
+  {
+    CryptoDCInstance::Ptr dc = new_instance(cipher, digest);
+    CompressContext comp_ctx(comp_type, false);
+    Compress::Ptr comp = comp_ctx.new_compressor(frame, stats);
+
+    std::vector<BufferAllocated> bufs(BATCH);
+    Meter enc, dec;
+    size_t sent = 0;
+    while (sent < N_PACKETS)
+      {
+	const size_t n = std::min(size_t(BATCH), size_t(N_PACKETS) - sent);
+	size_t bytes = 0;
+	for (size_t i = 0; i < n; ++i)
+	  {
+	    const size_t size = sizes[(sent + i) % n_sizes];
+	    BufferAllocated& b = bufs[i];
+	    frame->prepare(Frame::READ_TUN, b);
+	    b.write(payload.data(), size);
+	    bytes += size;
+	  }
+
+	enc.start();
+	for (size_t i = 0; i < n; ++i)
+	  {
+	    comp->compress(bufs[i], true);
+	    dc->encrypt(bufs[i], 0, nullptr);
+	  }
+	enc.stop(bytes, n);
+
+	dec.start();
+	for (size_t i = 0; i < n; ++i)
+	  {
+	    const Error::Type err = dc->decrypt(bufs[i], 0, nullptr);
+	    if (err)
+	      OPENVPN_THROW_EXCEPTION("decrypt failed: " << Error::name(err));
+	    comp->decompress(bufs[i]);
+	  }
+	dec.stop(bytes, n);
+
+	sent += n;
+      }
+
+    std::cout << std::left << std::setw(18) << cs.cipher
+	      << std::setw(7) << cs.digest
+	      << std::setw(9) << comp_name(comp_type)
+	      << std::setw(5) << mix_name << std::right
+	      << " ENC ";
+    enc.report(std::cout);
+    std::cout << " DEC ";
+    dec.report(std::cout);
+    std::cout << std::endl;
+  }
+
+  CryptoDCInstance::Ptr new_instance(const CryptoAlgs::Type cipher, const CryptoAlgs::Type digest)
+  {
+    CryptoDCContext::Ptr ctx = factory->new_obj(cipher, digest);
+    CryptoDCInstance::Ptr dc = ctx->new_obj(0);
+    const unsigned int flags = dc->defined();
+
+    // use the same key in both directions so the instance can decrypt its own output
+    unsigned char key[64];
+    if (flags & CryptoDCInstance::CIPHER_DEFINED)
+      {
+	prng->rand_bytes(key, sizeof(key));
+	dc->init_cipher(StaticKey(key, sizeof(key)), StaticKey(key, sizeof(key)));
+      }
+    if (flags & CryptoDCInstance::HMAC_DEFINED)
+      {
+	prng->rand_bytes(key, sizeof(key));
+	dc->init_hmac(StaticKey(key, sizeof(key)), StaticKey(key, sizeof(key)));
+      }
+    dc->init_pid(PacketID::SHORT_FORM,
+		 PacketIDReceive::UDP_MODE,
+		 PacketID::SHORT_FORM,
+		 "DATA", 0,
+		 stats);
+    return dc;
+  }
+
+  Frame::Ptr frame;
+  SessionStats::Ptr stats;
+  RandomAPI::Ptr prng;
+  CryptoDCFactory::Ptr factory;
+  std::vector<unsigned char> payload;
+};
+
+int main(int argc, char* argv[])
+{
+  // process-wide initialization
+  InitProcess::init();
+
+  try {
+    DCBench bench;
+    bench.run_all();
+  }
+  catch (const std::exception& e)
+    {
+      std::cerr << "Exception: " << e.what() << std::endl;
+      return 1;
+    }
+  return 0;
+}
@@ -0,0 +1,817 @@
+//    OpenVPN -- An application to securely tunnel IP networks
+//               over a single port, with support for SSL/TLS-based
+//               session authentication and key exchange,
+//               packet encryption, packet authentication, and
+//               packet compression.
+//
+//    Copyright (C) 2012-2016 OpenVPN Technologies, Inc.
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU Affero General Public License Version 3
+//    as published by the Free Software Foundation.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU Affero General Public License for more details.
+//
+//    You should have received a copy of the GNU Affero General Public License
+//    along with this program in the COPYING file.
+//    If not, see <http://www.gnu.org/licenses/>.
+
+// Data path allocation profile: runs packets through the per-packet
+// path of two connected ProtoContexts (tun read, compress, encrypt,
+// UDP send, UDP receive, decrypt, decompress, tun write) in both
+// directions, and reports heap allocations, BufferAllocated
+// allocations, reference count operations and hardware cache misses
+// per steady-state packet.  Exits with status 1 if steady-state
+// packets allocate, so it can be used as a regression gate.
+
+#include <iostream>
+#include <iomanip>
+#include <string>
+#include <vector>
+#include <new>
+#include <cstring>
+#include <cstdlib>
+#include <cstdint>
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/socket.h>
+
+#if defined(__linux__)
+#include <sys/syscall.h>
+#include <sys/ioctl.h>
+#include <linux/perf_event.h>
+#define HAVE_PERF_EVENT
+#endif
+
+#include <asio.hpp>
+
+#include <openvpn/common/platform.hpp>
+
+#define OPENVPN_ALLOC_INSTRUMENTATION
+
+#define OPENVPN_LOG_SSL(x) // disable
+
+#include <openvpn/log/logsimple.hpp>
+
+#include <openvpn/common/alloccount.hpp>
+#include <openvpn/common/exception.hpp>
+#include <openvpn/common/file.hpp>
+#include <openvpn/common/string.hpp>
+#include <openvpn/init/initprocess.hpp>
+#include <openvpn/time/asiotimer.hpp>
+#include <openvpn/time/coarsetime.hpp>
+#include <openvpn/frame/frame_init.hpp>
+#include <openvpn/log/sessionstats.hpp>
+#include <openvpn/compress/compress.hpp>
+#include <openvpn/crypto/cryptodcsel.hpp>
+#include <openvpn/ssl/proto.hpp>
+#include <openvpn/ssl/sslchoose.hpp>
+#include <openvpn/tun/tunio.hpp>
+#include <openvpn/transport/udplink.hpp>
+
+#include "../common/testkeys.hpp"
+
+// Count every heap allocation made by this program.  The counters
+// are per-thread and everything below runs on the main thread.
+
+void* operator new(std::size_t size)
+{
+  openvpn::AllocCount::heap_alloc();
+  if (void* p = std::malloc(size ? size : 1))
+    return p;
+  throw std::bad_alloc();
+}
+
+void* operator new[](std::size_t size)
+{
+  return ::operator new(size);
+}
+
+void* operator new(std::size_t size, const std::nothrow_t&) noexcept
+{
+  openvpn::AllocCount::heap_alloc();
+  return std::malloc(size ? size : 1);
+}
+
+void* operator new[](std::size_t size, const std::nothrow_t& nt) noexcept
+{
+  return ::operator new(size, nt);
+}
+
+void operator delete(void* p) noexcept
+{
+  if (p)
+    {
+      openvpn::AllocCount::heap_free();
+      std::free(p);
+    }
+}
+
+void operator delete[](void* p) noexcept
+{
+  ::operator delete(p);
+}
+
+void operator delete(void* p, std::size_t) noexcept
+{
+  ::operator delete(p);
+}
+
+void operator delete[](void* p, std::size_t) noexcept
+{
+  ::operator delete(p);
+}
+
+void operator delete(void* p, const std::nothrow_t&) noexcept
+{
+  ::operator delete(p);
+}
+
+void operator delete[](void* p, const std::nothrow_t&) noexcept
+{
+  ::operator delete(p);
+}
+
+using namespace openvpn;
+
+namespace openvpn {
+  namespace DPAlloc {
+
+    OPENVPN_EXCEPTION(dpalloc_error);
+
+    struct Options
+    {
+      Options()
+	: warmup(2000),
+	  packets(100000),
+	  timeout(60),
+	  max_allocs(0.0),
+	  comp(CompressContext::compressor_available(CompressContext::LZ4v2) ? CompressContext::LZ4v2 : CompressContext::COMP_STUBv2),
+	  keydir("../ssl"),
+	  cipher("AES-128-CBC"),
+	  digest("SHA1")
+      {
+      }
+
+      unsigned int warmup;     // packets before counting starts
+      unsigned int packets;    // packets counted
+      unsigned int timeout;    // seconds allowed for the whole run
+      double max_allocs;       // gate: heap allocations per packet
+      CompressContext::Type comp;
+      std::vector<size_t> sizes; // packet size cycle, default IMIX
+      std::string keydir;
+      std::string cipher;
+      std::string digest;
+    };
+
+    // Hardware counters for the calling thread, user space only.
+    // Unavailable counters (no PMU, perf_event_paranoid) read as -1.
+    class PerfCounters
+    {
+    public:
+      enum Index {
+	CACHE_MISSES,
+	L1D_READ_MISSES,
+	INSTRUCTIONS,
+	N_COUNTERS,
+      };
+
+      PerfCounters()
+      {
+	for (int i = 0; i < N_COUNTERS; ++i)
+	  {
+	    fds[i] = -1;
+	    values[i] = -1;
+	  }
+#ifdef HAVE_PERF_EVENT
+	fds[CACHE_MISSES] = open(PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES);
+	fds[L1D_READ_MISSES] = open(PERF_TYPE_HW_CACHE,
+				    PERF_COUNT_HW_CACHE_L1D
+				    | (PERF_COUNT_HW_CACHE_OP_READ << 8)
+				    | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16));
+	fds[INSTRUCTIONS] = open(PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS);
+#endif
+      }
+
+      ~PerfCounters()
+      {
+	for (int i = 0; i < N_COUNTERS; ++i)
+	  if (fds[i] >= 0)
+	    ::close(fds[i]);
+      }
+
+      void start()
+      {
+#ifdef HAVE_PERF_EVENT
+	for (int i = 0; i < N_COUNTERS; ++i)
+	  if (fds[i] >= 0)
+	    {
+	      ::ioctl(fds[i], PERF_EVENT_IOC_RESET, 0);
+	      ::ioctl(fds[i], PERF_EVENT_IOC_ENABLE, 0);
+	    }
+#endif
+      }
+
+      void stop()
+      {
+#ifdef HAVE_PERF_EVENT
+	for (int i = 0; i < N_COUNTERS; ++i)
+	  if (fds[i] >= 0)
+	    {
+	      ::ioctl(fds[i], PERF_EVENT_IOC_DISABLE, 0);
+	      std::uint64_t v;
+	      if (::read(fds[i], &v, sizeof(v)) == sizeof(v))
+		values[i] = (long long)v;
+	    }
+#endif
+      }
+
+      long long value(const Index i) const
+      {
+	return values[i];
+      }
+
+    private:
+#ifdef HAVE_PERF_EVENT
+      static int open(const std::uint32_t type, const std::uint64_t config)
+      {
+	struct perf_event_attr attr;
+	std::memset(&attr, 0, sizeof(attr));
+	attr.size = sizeof(attr);
+	attr.type = type;
+	attr.config = config;
+	attr.disabled = 1;
+	attr.exclude_kernel = 1;
+	attr.exclude_hv = 1;
+	return (int)::syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+      }
+#endif
+
+      int fds[N_COUNTERS];
+      long long values[N_COUNTERS];
+    };
+
+    typedef TestKeys::Keys Keys;
+
+    struct TunPacketFrom
+    {
+      typedef std::unique_ptr<TunPacketFrom> SPtr;
+      BufferAllocated buf;
+    };
+
+    // tun device on a pre-existing socket, as in TunBuilderClient
+    template <typename ReadHandler>
+    class Tun : public TunIO<ReadHandler, TunPacketFrom, asio::posix::stream_descriptor>
+    {
+      typedef TunIO<ReadHandler, TunPacketFrom, asio::posix::stream_descriptor> Base;
+
+    public:
+      typedef RCPtr<Tun> Ptr;
+
+      Tun(asio::io_context& io_context,
+	  const int socket,
+	  ReadHandler read_handler_arg,
+	  const Frame::Ptr& frame_arg,
+	  const SessionStats::Ptr& stats_arg)
+	: Base(read_handler_arg, frame_arg, stats_arg)
+      {
+	Base::stream = new asio::posix::stream_descriptor(io_context, socket);
+	Base::name_ = "tun";
+      }
+
+      ~Tun() { Base::stop(); }
+    };
+
+    class Run;
+
+    // One side of the tunnel.  The tun and transport handlers follow
+    // ClientProto::Session::tun_recv and transport_recv, so the
+    // counted work is the work a client does per packet.  The tun
+    // device is one end of a datagram socketpair, the harness
+    // injects and collects plaintext packets on the other end.
+    class Endpoint : public ProtoContext
+    {
+      typedef ProtoContext Base;
+      typedef Tun<Endpoint*> TunImpl;
+      typedef UDPTransport::Link<Endpoint*> LinkImpl;
+
+      friend class TunIO<Endpoint*, TunPacketFrom, asio::posix::stream_descriptor>; // calls tun_read_handler
+      friend LinkImpl; // calls udp_read_handler
+
+    public:
+      Endpoint(asio::io_context& io_context,
+	       const Base::Config::Ptr& config,
+	       const SessionStats::Ptr& stats,
+	       Run& run_arg)
+	: Base(config, stats),
+	  run(run_arg),
+	  socket(io_context),
+	  housekeeping_timer(io_context)
+      {
+	int sv[2];
+	if (::socketpair(AF_UNIX, SOCK_DGRAM, 0, sv) < 0)
+	  throw dpalloc_error("socketpair failed");
+	kernel_fd = sv[1];
+	::fcntl(kernel_fd, F_SETFL, O_NONBLOCK);
+	tun.reset(new TunImpl(io_context, sv[0], this, config->frame, stats));
+
+	socket.open(asio::ip::udp::v4());
+	socket.bind(asio::ip::udp::endpoint(asio::ip::address_v4::loopback(), 0));
+	link.reset(new LinkImpl(this, socket, (*config->frame)[Frame::READ_LINK_UDP], stats));
+	housekeeping_schedule.init(Time::Duration::binary_ms(512), Time::Duration::binary_ms(1024));
+      }
+
+      ~Endpoint()
+      {
+	if (kernel_fd >= 0)
+	  ::close(kernel_fd);
+      }
+
+      asio::ip::udp::endpoint local_endpoint() const
+      {
+	return socket.local_endpoint();
+      }
+
+      void start(const asio::ip::udp::endpoint& peer)
+      {
+	socket.connect(peer);
+	link->start(1);
+	tun->start(1);
+	update_now();
+	Base::reset();
+	Base::start();
+	Base::flush(true);
+	set_housekeeping_timer();
+      }
+
+      void stop()
+      {
+	halt = true;
+	housekeeping_timer.cancel();
+	link->stop();
+	tun->stop();
+	socket.close();
+      }
+
+      int kernel() const
+      {
+	return kernel_fd;
+      }
+
+      using Base::data_channel_ready;
+
+    private:
+      void tun_read_handler(TunPacketFrom::SPtr& pfp)
+      {
+	if (halt)
+	  return;
+	BufferAllocated& buf = pfp->buf;
+	update_now();
+	if (buf.size())
+	  {
+	    data_encrypt(buf);
+	    if (buf.size())
+	      link->send(buf, nullptr);
+	  }
+	flush(false);
+	set_housekeeping_timer();
+      }
+
+      void tun_read_handler_batch(TunImpl::PacketFromBatch& batch, const size_t n)
+      {
+	for (size_t i = 0; i < n; ++i)
+	  tun_read_handler(batch[i]);
+      }
+
+      void tun_error_handler(const Error::Type errtype, const asio::error_code* error)
+      {
+	fail(std::string("tun error: ") + Error::name(errtype));
+      }
+
+      void udp_read_handler(UDPTransport::PacketFrom::SPtr& pfp)
+      {
+	if (halt)
+	  return;
+	BufferAllocated& buf = pfp->buf;
+	bool delivered = false;
+	try {
+	  update_now();
+	  const PacketType pt = packet_type(buf);
+	  if (pt.is_data())
+	    {
+	      data_decrypt(pt, buf);
+	      if (buf.size())
+		delivered = tun->write(buf);
+	      flush(false);
+	    }
+	  else if (pt.is_control())
+	    {
+	      control_net_recv(pt, std::move(buf));
+	      flush(true);
+	    }
+	  set_housekeeping_timer();
+	}
+	catch (const std::exception& e)
+	  {
+	    fail(e.what());
+	    return;
+	  }
+	if (invalidated())
+	  fail(std::string("invalidated: ") + Error::name(invalidation_reason()));
+	else
+	  progress(delivered);
+      }
+
+      void udp_read_handler_batch(UDPTransport::PacketFromBatch& batch, const size_t n)
+      {
+	for (size_t i = 0; i < n; ++i)
+	  udp_read_handler(batch[i]);
+      }
+
+      virtual void control_net_send(const Buffer& net_buf)
+      {
+	if (!halt)
+	  link->send(net_buf, nullptr);
+      }
+
+      virtual void control_recv(BufferPtr&& app_bp)
+      {
+      }
+
+      void set_housekeeping_timer()
+      {
+	if (halt)
+	  return;
+	Time next = next_housekeeping();
+	if (!housekeeping_schedule.similar(next))
+	  {
+	    if (!next.is_infinite())
+	      {
+		next.max(now());
+		housekeeping_schedule.reset(next);
+		housekeeping_timer.expires_at(next);
+		housekeeping_timer.async_wait([this](const asio::error_code& error)
+					      {
+						if (!error && !halt)
+						  {
+						    update_now();
+						    housekeeping_schedule.reset();
+						    housekeeping();
+						    set_housekeeping_timer();
+						  }
+					      });
+	      }
+	    else
+	      housekeeping_timer.cancel();
+	  }
+      }
+
+      inline void fail(const std::string& reason);
+      inline void progress(const bool delivered);
+
+      Run& run;
+      asio::ip::udp::socket socket;
+      LinkImpl::Ptr link;
+      TunImpl::Ptr tun;
+      int kernel_fd = -1;
+      AsioTimer housekeeping_timer;
+      CoarseTime housekeeping_schedule;
+      bool halt = false;
+    };
+
+    struct Result
+    {
+      AllocCount::Counters counters;
+      long long perf[PerfCounters::N_COUNTERS] = {};
+      size_t packets = 0;
+      size_t bytes = 0;
+      std::string error;
+    };
+
+    // Lockstep traffic: one packet in flight, alternating client to
+    // server and server to client.  The harness side of the tun
+    // socketpairs uses plain non-blocking syscalls so that it adds
+    // nothing to the counters.
+    class Run
+    {
+    public:
+      Run(const Options& opt_arg, const Keys& keys)
+	: opt(opt_arg),
+	  cli_stats(new SessionStats()),
+	  serv_stats(new SessionStats()),
+	  client(io_context, proto_config(keys, false, cli_stats), cli_stats, *this),
+	  server(io_context, proto_config(keys, true, serv_stats), serv_stats, *this),
+	  watchdog(io_context)
+      {
+	build_packets();
+	scratch.resize(65536);
+      }
+
+      Result go()
+      {
+	watchdog.expires_at(Time::now() + Time::Duration::seconds(opt.timeout));
+	watchdog.async_wait([this](const asio::error_code& error)
+			    {
+			      if (!error)
+				fail(started ? "stalled" : "handshake timeout");
+			    });
+	const asio::ip::udp::endpoint cep = client.local_endpoint();
+	const asio::ip::udp::endpoint sep = server.local_endpoint();
+	server.start(cep);
+	client.start(sep);
+	io_context.run();
+	return result;
+      }
+
+      void progress(Endpoint& ep, const bool delivered)
+      {
+	if (done)
+	  return;
+	if (!started)
+	  {
+	    if (client.data_channel_ready() && server.data_channel_ready())
+	      {
+		started = true;
+		inject();
+	      }
+	    return;
+	  }
+	if (!delivered)
+	  return;
+
+	// collect the decrypted packet from the far end's tun
+	const ssize_t len = ::read(ep.kernel(), scratch.data(), scratch.size());
+	if (len != ssize_t(packets[n_delivered % packets.size()].size()))
+	  {
+	    fail("tun output does not match input");
+	    return;
+	  }
+
+	++n_delivered;
+	if (n_delivered == opt.warmup)
+	  {
+	    begin = AllocCount::local();
+	    perf.start();
+	  }
+	else if (n_delivered == opt.warmup + opt.packets)
+	  {
+	    perf.stop();
+	    result.counters = AllocCount::local() - begin;
+	    for (int i = 0; i < PerfCounters::N_COUNTERS; ++i)
+	      result.perf[i] = perf.value(PerfCounters::Index(i));
+	    result.packets = opt.packets;
+	    finish();
+	    return;
+	  }
+	if (n_delivered > opt.warmup)
+	  result.bytes += len;
+	inject();
+      }
+
+      void fail(const std::string& reason)
+      {
+	if (!done)
+	  {
+	    result.error = reason;
+	    finish();
+	  }
+      }
+
+    private:
+      ProtoContext::Config::Ptr proto_config(const Keys& keys, const bool is_server, const SessionStats::Ptr& stats)
+      {
+	ProtoContext::Config::Ptr c(new ProtoContext::Config());
+	c->ssl_factory = is_server ? keys.server_ssl : keys.client_ssl;
+	c->dc.set_factory(new CryptoDCSelect<SSLLib::CryptoAPI>(keys.frame, stats, keys.prng));
+	c->tlsprf_factory.reset(new CryptoTLSPRFFactory<SSLLib::CryptoAPI>());
+	c->frame = keys.frame;
+	c->now = &now;
+	c->rng = keys.rng;
+	c->prng = keys.prng;
+	c->protocol = Protocol(Protocol::UDPv4);
+	c->layer = Layer(Layer::OSI_LAYER_3);
+	c->comp_ctx = CompressContext(opt.comp, false);
+	c->dc.set_cipher(CryptoAlgs::lookup(opt.cipher));
+	c->dc.set_digest(CryptoAlgs::lookup(opt.digest));
+	c->pid_mode = PacketIDReceive::UDP_MODE;
+	c->handshake_window = Time::Duration::seconds(opt.timeout);
+	c->become_primary = c->handshake_window;
+	c->tls_timeout = Time::Duration::seconds(1);
+	c->renegotiate = Time::Duration::infinite();
+	c->expire = Time::Duration::infinite();
+	c->keepalive_ping = Time::Duration::seconds(10);
+	c->keepalive_timeout = Time::Duration::seconds(opt.timeout);
+	return c;
+      }
+
+      // IPv4/UDP packets of the configured sizes with a compressible
+      // payload, so that the compressor does real work
+      void build_packets()
+      {
+	static const size_t imix[] = { 64, 64, 64, 64, 64, 64, 64, 576, 576, 576, 576, 1500 };
+	static const char text[] =
+	  "It was a bright cold day in April, and the clocks were striking thirteen. "
+	  "Winston Smith, his chin nuzzled into his breast in an effort to escape the vile wind, ";
+
+	std::vector<size_t> sizes = opt.sizes;
+	if (sizes.empty())
+	  sizes.assign(imix, imix + sizeof(imix) / sizeof(imix[0]));
+
+	// alternate directions, so give each direction the full cycle
+	for (const auto size : sizes)
+	  for (int dir = 0; dir < 2; ++dir)
+	    {
+	      std::vector<unsigned char> p(std::max(size, size_t(28)));
+	      for (size_t i = 28; i < p.size(); ++i)
+		p[i] = text[i % (sizeof(text) - 1)];
+	      p[0] = 0x45;                // IPv4, 20 byte header
+	      p[2] = (unsigned char)(p.size() >> 8);
+	      p[3] = (unsigned char)p.size();
+	      p[8] = 64;                  // TTL
+	      p[9] = 17;                  // UDP
+	      const unsigned char src[] = { 10, 8, 0, (unsigned char)(dir ? 1 : 2) };
+	      const unsigned char dst[] = { 10, 8, 0, (unsigned char)(dir ? 2 : 1) };
+	      std::memcpy(&p[12], src, 4);
+	      std::memcpy(&p[16], dst, 4);
+	      p[21] = 9;                  // UDP source port
+	      p[23] = 9;                  // UDP discard port
+	      p[24] = (unsigned char)((p.size() - 20) >> 8);
+	      p[25] = (unsigned char)(p.size() - 20);
+	      packets.push_back(std::move(p));
+	    }
+      }
+
+      void inject()
+      {
+	const std::vector<unsigned char>& p = packets[n_delivered % packets.size()];
+	Endpoint& src = (n_delivered & 1) ? server : client;
+	if (::write(src.kernel(), p.data(), p.size()) != ssize_t(p.size()))
+	  fail("tun input write failed");
+      }
+
+      void finish()
+      {
+	done = true;
+	watchdog.cancel();
+	client.stop();
+	server.stop();
+      }
+
+      const Options& opt;
+      asio::io_context io_context;
+      Time now;
+      SessionStats::Ptr cli_stats;
+      SessionStats::Ptr serv_stats;
+      Endpoint client;
+      Endpoint server;
+      AsioTimer watchdog;
+      std::vector<std::vector<unsigned char>> packets;
+      std::vector<unsigned char> scratch;
+      PerfCounters perf;
+      AllocCount::Counters begin;
+      size_t n_delivered = 0;
+      bool started = false;
+      bool done = false;
+      Result result;
+    };
+
+    inline void Endpoint::fail(const std::string& reason)
+    {
+      run.fail(std::string(is_server() ? "server: " : "client: ") + reason);
+    }
+
+    inline void Endpoint::progress(const bool delivered)
+    {
+      run.progress(*this, delivered);
+    }
+
+    inline void report(const Options& opt, const Result& r)
+    {
+      const double n = double(r.packets);
+      const AllocCount::Counters& c = r.counters;
+      std::cout << std::fixed << std::setprecision(3)
+		<< "packets               " << r.packets << " (" << CompressContext(opt.comp, false).str()
+		<< ' ' << opt.cipher << '/' << opt.digest << ')' << std::endl
+		<< "heap allocs/pkt       " << c.heap_alloc / n << std::endl
+		<< "heap frees/pkt        " << c.heap_free / n << std::endl
+		<< "buffer allocs/pkt     " << c.buffer_alloc / n << std::endl
+		<< "buffer reallocs/pkt   " << c.buffer_realloc / n << std::endl
+		<< "buffer frees/pkt      " << c.buffer_free / n << std::endl
+		<< "refcount ops/pkt      " << c.rc_ops / n << std::endl
+		<< "atomic refcount ops/pkt " << c.rc_atomic_ops / n << std::endl;
+
+      static const char *perf_names[] = {
+	"cache misses/pkt      ",
+	"L1D read misses/pkt   ",
+	"instructions/pkt      ",
+      };
+      for (int i = 0; i < PerfCounters::N_COUNTERS; ++i)
+	{
+	  std::cout << perf_names[i];
+	  if (r.perf[i] >= 0)
+	    std::cout << std::setprecision(1) << r.perf[i] / n << std::endl;
+	  else
+	    std::cout << "n/a" << std::endl;
+	}
+    }
+  }
+}
+
+static void usage()
+{
+  std::cerr << "usage: dpalloc [options]" << std::endl
+	    << "  --packets N    : packets counted (100000)" << std::endl
+	    << "  --warmup N     : packets before counting starts (2000)" << std::endl
+	    << "  --size A,B,... : packet size cycle (IMIX 7:4:1 of 64/576/1500)" << std::endl
+	    << "  --comp METHOD  : compression method (lz4-v2 if available, else stub-v2)" << std::endl
+	    << "  --cipher C     : data channel cipher (AES-128-CBC)" << std::endl
+	    << "  --digest D     : data channel digest (SHA1)" << std::endl
+	    << "  --max-allocs X : fail if heap allocs/pkt exceeds X (0)" << std::endl
+	    << "  --timeout N    : seconds allowed for the run (60)" << std::endl
+	    << "  --keys DIR     : directory with test/ssl keys (../ssl)" << std::endl;
+}
+
+int main(int argc, char* argv[])
+{
+  // process-wide initialization
+  InitProcess::init();
+
+  int ret = 0;
+  try {
+    DPAlloc::Options opt;
+    for (int i = 1; i < argc; ++i)
+      {
+	const std::string o = argv[i];
+	if (i + 1 >= argc)
+	  {
+	    usage();
+	    return 2;
+	  }
+	const std::string arg = argv[++i];
+	if (o == "--packets")
+	  opt.packets = std::max(std::atoi(arg.c_str()), 1);
+	else if (o == "--warmup")
+	  opt.warmup = std::max(std::atoi(arg.c_str()), 1);
+	else if (o == "--size")
+	  {
+	    for (const auto &s : string::split(arg, ','))
+	      opt.sizes.push_back(std::min(std::max(std::atoi(s.c_str()), 28), 1500));
+	  }
+	else if (o == "--comp")
+	  {
+	    opt.comp = CompressContext::parse_method(arg);
+	    if (opt.comp == CompressContext::NONE && arg != "none")
+	      OPENVPN_THROW_EXCEPTION("unknown compression method: " << arg);
+	    if (!CompressContext::compressor_available(opt.comp))
+	      OPENVPN_THROW_EXCEPTION("compression method not available in this build: " << arg);
+	  }
+	else if (o == "--cipher")
+	  opt.cipher = arg;
+	else if (o == "--digest")
+	  opt.digest = arg;
+	else if (o == "--max-allocs")
+	  opt.max_allocs = std::atof(arg.c_str());
+	else if (o == "--timeout")
+	  opt.timeout = std::max(std::atoi(arg.c_str()), 1);
+	else if (o == "--keys")
+	  opt.keydir = arg;
+	else
+	  {
+	    usage();
+	    return 2;
+	  }
+      }
+
+    const DPAlloc::Keys keys(opt.keydir, frame_init(true, 1500, 1024, false));
+    DPAlloc::Run run(opt, keys);
+    const DPAlloc::Result r = run.go();
+    if (!r.error.empty())
+      {
+	std::cerr << "FAILED: " << r.error << std::endl;
+	ret = 1;
+      }
+    else
+      {
+	DPAlloc::report(opt, r);
+	if (r.counters.heap_alloc > opt.max_allocs * r.packets)
+	  {
+	    std::cout << "FAIL: steady-state packets allocate" << std::endl;
+	    ret = 1;
+	  }
+	else
+	  std::cout << "PASS" << std::endl;
+      }
+  }
+  catch (const std::exception& e)
+    {
+      std::cerr << "Exception: " << e.what() << std::endl;
+      ret = 1;
+    }
+
+  InitProcess::uninit();
+  return ret;
+}
@@ -0,0 +1,818 @@
+//    OpenVPN -- An application to securely tunnel IP networks
+//               over a single port, with support for SSL/TLS-based
+//               session authentication and key exchange,
+//               packet encryption, packet authentication, and
+//               packet compression.
+//
+//    Copyright (C) 2012-2016 OpenVPN Technologies, Inc.
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU Affero General Public License Version 3
+//    as published by the Free Software Foundation.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU Affero General Public License for more details.
+//
+//    You should have received a copy of the GNU Affero General Public License
+//    along with this program in the COPYING file.
+//    If not, see <http://www.gnu.org/licenses/>.
+
+// Network impairment benchmark: runs a client and a server
+// ProtoContext over loopback through UDPTransport::Link and
+// TCPTransport::Link, with the client link impaired by a seeded
+// Gremlin profile, and measures control channel handshake time,
+// data channel goodput, queue drain time and reconnect time.
+
+#include <iostream>
+#include <iomanip>
+#include <string>
+#include <vector>
+#include <memory>
+#include <chrono>
+#include <algorithm>
+#include <cstring>
+#include <cstdlib>
+
+#include <asio.hpp>
+
+#include <openvpn/common/platform.hpp>
+
+// the links only support impairment when built with OPENVPN_GREMLIN
+#define OPENVPN_GREMLIN
+
+#define OPENVPN_LOG_SSL(x) // disable
+
+#include <openvpn/log/logsimple.hpp>
+
+#include <openvpn/common/exception.hpp>
+#include <openvpn/common/file.hpp>
+#include <openvpn/common/string.hpp>
+#include <openvpn/init/initprocess.hpp>
+#include <openvpn/time/asiotimer.hpp>
+#include <openvpn/frame/frame_init.hpp>
+#include <openvpn/log/sessionstats.hpp>
+#include <openvpn/crypto/cryptodcsel.hpp>
+#include <openvpn/ssl/proto.hpp>
+#include <openvpn/ssl/sslchoose.hpp>
+#include <openvpn/transport/gremlin.hpp>
+#include <openvpn/transport/udplink.hpp>
+#include <openvpn/transport/tcplink.hpp>
+
+#include "../common/testkeys.hpp"
+
+using namespace openvpn;
+
+namespace openvpn {
+  namespace Impair {
+
+    OPENVPN_EXCEPTION(impair_error);
+
+    typedef std::chrono::steady_clock Clock;
+
+    inline double ms_since(const Clock::time_point& t)
+    {
+      const std::chrono::duration<double, std::milli> dt = Clock::now() - t;
+      return dt.count();
+    }
+
+    struct Options
+    {
+      Options()
+	: seed(1),
+	  duration(5),
+	  offered_kbps(5000),
+	  packet_size(1200),
+	  reconnects(3),
+	  timeout(60),
+	  keydir("../ssl"),
+	  cipher("AES-128-CBC"),
+	  digest("SHA1"),
+	  csv(false)
+      {
+      }
+
+      std::vector<std::string> profiles;
+      std::vector<std::string> transports;
+      unsigned int seed;         // Gremlin seed, same for every run
+      unsigned int duration;     // seconds of data channel traffic
+      unsigned int offered_kbps; // data channel offered load
+      size_t packet_size;        // data channel payload bytes
+      unsigned int reconnects;   // reconnects measured per run
+      unsigned int timeout;      // seconds allowed for each phase
+      std::string keydir;        // directory with test/ssl style keys
+      std::string cipher;
+      std::string digest;
+      bool csv;
+    };
+
+    struct Result
+    {
+      std::string profile;
+      std::string transport;
+      std::string error;
+      double handshake_ms = 0.0;
+      double goodput_kbps = 0.0;
+      double drain_ms = 0.0;
+      double reconnect_ms_avg = 0.0;
+      double reconnect_ms_max = 0.0;
+      size_t sent = 0;
+      size_t received = 0;
+    };
+
+    // SSL contexts shared by every run
+    typedef TestKeys::Keys Keys;
+
+    class Run;
+
+    struct Wire
+    {
+      virtual void send(const Buffer& buf, const bool urgent) = 0;
+      virtual void stop() = 0;
+      virtual ~Wire() {}
+    };
+
+    // One side of the tunnel: a ProtoContext driven by real time and
+    // fed from a transport link.
+    class Endpoint : public ProtoContext
+    {
+      typedef ProtoContext Base;
+
+    public:
+      Endpoint(asio::io_context& io_context,
+	       const Base::Config::Ptr& config,
+	       const SessionStats::Ptr& stats,
+	       Run& run_arg)
+	: Base(config, stats),
+	  run(run_arg),
+	  frame(config->frame),
+	  housekeeping_timer(io_context)
+      {
+      }
+
+      void set_wire(Wire* wire_arg)
+      {
+	wire = wire_arg;
+      }
+
+      void restart()
+      {
+	update_now();
+	Base::reset();
+	Base::start();
+	Base::flush(true);
+	schedule_housekeeping();
+      }
+
+      void stop()
+      {
+	halt = true;
+	housekeeping_timer.cancel();
+      }
+
+      inline void net_recv(BufferAllocated& buf);
+
+      void send_data(const size_t size)
+      {
+	if (halt || !data_channel_ready())
+	  return;
+	update_now();
+	BufferAllocated buf;
+	frame->prepare(Frame::READ_TUN, buf);
+	std::memset(buf.write_alloc(size), 0x5a, size);
+	data_encrypt(buf);
+	if (buf.size())
+	  wire->send(buf, false);
+      }
+
+      using Base::data_channel_ready;
+
+    private:
+      virtual void control_net_send(const Buffer& net_buf)
+      {
+	if (!halt)
+	  wire->send(net_buf, true);
+      }
+
+      virtual void control_recv(BufferPtr&& app_bp)
+      {
+      }
+
+      inline void check();
+
+      void schedule_housekeeping()
+      {
+	if (halt)
+	  return;
+	housekeeping_timer.expires_at(next_housekeeping());
+	housekeeping_timer.async_wait([this](const asio::error_code& error)
+				      {
+					if (!error && !halt)
+					  {
+					    update_now();
+					    housekeeping();
+					    check();
+					    schedule_housekeeping();
+					  }
+				      });
+      }
+
+      Run& run;
+      Frame::Ptr frame;
+      Wire* wire = nullptr;
+      AsioTimer housekeeping_timer;
+      bool halt = false;
+    };
+
+    class UDPWire : public Wire
+    {
+    public:
+      typedef UDPTransport::Link<UDPWire*> LinkImpl;
+      friend LinkImpl; // calls udp_read_handler
+
+      UDPWire(asio::io_context& io_context,
+	      Endpoint& endpoint_arg,
+	      const Frame::Ptr& frame,
+	      const SessionStats::Ptr& stats,
+	      const Gremlin::Config::Ptr& gremlin,
+	      const asio::ip::udp::endpoint* connect_to)
+	: endpoint(endpoint_arg),
+	  socket(io_context)
+      {
+	socket.open(asio::ip::udp::v4());
+	if (connect_to)
+	  socket.connect(*connect_to);
+	else
+	  socket.bind(asio::ip::udp::endpoint(asio::ip::address_v4::loopback(), 0));
+	connected = connect_to != nullptr;
+	link.reset(new LinkImpl(this, socket, (*frame)[Frame::READ_LINK_UDP], stats));
+	link->gremlin_config(gremlin);
+	link->start(1);
+      }
+
+      asio::ip::udp::endpoint local_endpoint() const
+      {
+	return socket.local_endpoint();
+      }
+
+      virtual void send(const Buffer& buf, const bool urgent)
+      {
+	if (connected)
+	  link->send(buf, nullptr);
+	else if (have_peer)
+	  link->send(buf, &peer);
+      }
+
+      virtual void stop()
+      {
+	link->stop();
+	socket.close();
+      }
+
+    private:
+      void udp_read_handler(UDPTransport::PacketFrom::SPtr& pfp)
+      {
+	peer = pfp->sender_endpoint;
+	have_peer = true;
+	endpoint.net_recv(pfp->buf);
+      }
+
+      Endpoint& endpoint;
+      asio::ip::udp::socket socket;
+      LinkImpl::Ptr link;
+      asio::ip::udp::endpoint peer;
+      bool connected = false;
+      bool have_peer = false;
+    };
+
+    class TCPWire : public Wire
+    {
+    public:
+      typedef TCPTransport::Link<asio::ip::tcp, TCPWire*, false> LinkImpl;
+      friend LinkImpl; // calls tcp_* handlers
+
+      TCPWire(Endpoint& endpoint_arg,
+	      Run& run_arg,
+	      asio::ip::tcp::socket&& socket_arg,
+	      const Frame::Ptr& frame,
+	      const SessionStats::Ptr& stats,
+	      const Gremlin::Config::Ptr& gremlin)
+	: endpoint(endpoint_arg),
+	  run(run_arg),
+	  socket(std::move(socket_arg))
+      {
+	socket.set_option(asio::ip::tcp::no_delay(true));
+	link.reset(new LinkImpl(this, socket, 0, 8, (*frame)[Frame::READ_LINK_TCP], stats));
+	link->gremlin_config(gremlin);
+	link->start();
+      }
+
+      virtual void send(const Buffer& buf, const bool urgent)
+      {
+	BufferAllocated b(buf, 0);
+	link->send(b, urgent);
+      }
+
+      virtual void stop()
+      {
+	link->stop();
+	socket.close();
+      }
+
+    private:
+      bool tcp_read_handler(BufferAllocated& buf)
+      {
+	endpoint.net_recv(buf);
+	return true;
+      }
+
+      bool tcp_read_in_place(BufferAllocated& buf, bool& requeue)
+      {
+	return false;
+      }
+
+      void tcp_write_queue_needs_send()
+      {
+      }
+
+      inline void tcp_eof_handler();
+      inline void tcp_error_handler(const char *error);
+
+      Endpoint& endpoint;
+      Run& run;
+      asio::ip::tcp::socket socket;
+      LinkImpl::Ptr link;
+    };
+
+    // One profile over one transport.  Phases: handshake, a fixed
+    // window of paced data channel traffic measured at the server,
+    // drain until the server has been idle, then repeated soft
+    // reconnects (both ProtoContexts reset) timed until the server
+    // decrypts the first data packet of the new session.
+    class Run
+    {
+    public:
+      Run(const Options& opt_arg,
+	  const Keys& keys,
+	  const std::string& profile,
+	  const std::string& transport)
+	: opt(opt_arg),
+	  tcp(transport == "tcp"),
+	  gremlin(Gremlin::Config::profile(profile, opt_arg.seed)),
+	  cli_stats(new SessionStats()),
+	  serv_stats(new SessionStats()),
+	  client(io_context, proto_config(keys, false, cli_stats), cli_stats, *this),
+	  server(io_context, proto_config(keys, true, serv_stats), serv_stats, *this),
+	  pace_timer(io_context),
+	  phase_timer(io_context)
+      {
+	result.profile = profile;
+	result.transport = transport;
+	if (!tcp && transport != "udp")
+	  throw impair_error("unknown transport: " + transport);
+
+	if (tcp)
+	  {
+	    asio::ip::tcp::acceptor acceptor(io_context, asio::ip::tcp::endpoint(asio::ip::address_v4::loopback(), 0));
+	    asio::ip::tcp::socket cs(io_context);
+	    cs.connect(acceptor.local_endpoint());
+	    asio::ip::tcp::socket ss(io_context);
+	    acceptor.accept(ss);
+	    server_wire.reset(new TCPWire(server, *this, std::move(ss), keys.frame, serv_stats, Gremlin::Config::Ptr()));
+	    client_wire.reset(new TCPWire(client, *this, std::move(cs), keys.frame, cli_stats, gremlin));
+	  }
+	else
+	  {
+	    UDPWire* sw = new UDPWire(io_context, server, keys.frame, serv_stats, Gremlin::Config::Ptr(), nullptr);
+	    server_wire.reset(sw);
+	    const asio::ip::udp::endpoint sep = sw->local_endpoint();
+	    client_wire.reset(new UDPWire(io_context, client, keys.frame, cli_stats, gremlin, &sep));
+	  }
+	client.set_wire(client_wire.get());
+	server.set_wire(server_wire.get());
+      }
+
+      Result go()
+      {
+	start_phase(HANDSHAKE);
+	server.restart();
+	client.restart();
+	io_context.run();
+	return result;
+      }
+
+      // called by Endpoint after processing each packet
+      void progress(Endpoint& ep, const size_t data_bytes)
+      {
+	if (phase == DONE)
+	  return;
+	if (&ep == &server && data_bytes)
+	  {
+	    last_recv = Clock::now();
+	    if (phase == DATA)
+	      {
+		result.received += data_bytes;
+		++received_packets;
+	      }
+	    else if (phase == RECONNECT)
+	      reconnected();
+	  }
+	else if (phase == HANDSHAKE && client.data_channel_ready())
+	  {
+	    result.handshake_ms = ms_since(phase_start);
+	    start_data();
+	  }
+	else if (phase == RECONNECT && client.data_channel_ready() && !probing)
+	  {
+	    probing = true;
+	    probe();
+	  }
+      }
+
+      void fail(const std::string& reason)
+      {
+	if (phase != DONE)
+	  {
+	    result.error = phase_name() + std::string(": ") + reason;
+	    finish();
+	  }
+      }
+
+    private:
+      enum Phase {
+	HANDSHAKE,
+	DATA,
+	DRAIN,
+	RECONNECT,
+	DONE,
+      };
+
+      const char *phase_name() const
+      {
+	switch (phase)
+	  {
+	  case HANDSHAKE: return "handshake";
+	  case DATA:      return "data";
+	  case DRAIN:     return "drain";
+	  case RECONNECT: return "reconnect";
+	  default:        return "done";
+	  }
+      }
+
+      ProtoContext::Config::Ptr proto_config(const Keys& keys, const bool is_server, const SessionStats::Ptr& stats)
+      {
+	ProtoContext::Config::Ptr c(new ProtoContext::Config());
+	c->ssl_factory = is_server ? keys.server_ssl : keys.client_ssl;
+	c->dc.set_factory(new CryptoDCSelect<SSLLib::CryptoAPI>(keys.frame, stats, keys.prng));
+	c->tlsprf_factory.reset(new CryptoTLSPRFFactory<SSLLib::CryptoAPI>());
+	c->frame = keys.frame;
+	c->now = &now;
+	c->rng = keys.rng;
+	c->prng = keys.prng;
+	c->protocol = Protocol(tcp ? Protocol::TCPv4 : Protocol::UDPv4);
+	c->layer = Layer(Layer::OSI_LAYER_3);
+	c->dc.set_cipher(CryptoAlgs::lookup(opt.cipher));
+	c->dc.set_digest(CryptoAlgs::lookup(opt.digest));
+	c->reliable_window = 4;
+	c->max_ack_list = 4;
+	c->pid_mode = tcp ? PacketIDReceive::TCP_MODE : PacketIDReceive::UDP_MODE;
+	c->handshake_window = Time::Duration::seconds(opt.timeout);
+	c->become_primary = c->handshake_window;
+	c->tls_timeout = Time::Duration::seconds(2);
+	c->renegotiate = Time::Duration::infinite();
+	c->expire = Time::Duration::infinite();
+	c->keepalive_ping = Time::Duration::seconds(5);
+	c->keepalive_timeout = Time::Duration::seconds(opt.timeout);
+	return c;
+      }
+
+      void start_phase(const Phase p)
+      {
+	phase = p;
+	phase_start = Clock::now();
+	phase_timer.expires_at(Time::now() + Time::Duration::seconds(opt.timeout));
+	phase_timer.async_wait([this, p](const asio::error_code& error)
+			       {
+				 if (!error && phase == p)
+				   fail("timeout");
+			       });
+      }
+
+      void start_data()
+      {
+	start_phase(DATA);
+	data_start = Clock::now();
+	pace();
+      }
+
+      // send at opt.offered_kbps in 1ms steps for opt.duration seconds
+      void pace()
+      {
+	const double elapsed = ms_since(data_start);
+	if (elapsed >= opt.duration * 1000.0)
+	  {
+	    result.goodput_kbps = result.received * 8.0 / opt.duration / 1000.0;
+	    start_drain();
+	    return;
+	  }
+	const size_t due = size_t(elapsed * opt.offered_kbps / 8.0 / opt.packet_size);
+	while (packets_sent < due)
+	  {
+	    client.send_data(opt.packet_size);
+	    result.sent += opt.packet_size;
+	    ++packets_sent;
+	  }
+	pace_timer.expires_at(Time::now() + Time::Duration::binary_ms(1));
+	pace_timer.async_wait([this](const asio::error_code& error)
+			      {
+				if (!error && phase == DATA)
+				  pace();
+			      });
+      }
+
+      // wait for queued packets to arrive, the server must be idle
+      // for 500ms
+      void start_drain()
+      {
+	if (phase != DRAIN)
+	  {
+	    start_phase(DRAIN);
+	    drain_start = Clock::now();
+	    last_recv = Clock::now();
+	  }
+	if (ms_since(last_recv) >= 500.0)
+	  {
+	    const std::chrono::duration<double, std::milli> dt = last_recv - drain_start;
+	    result.drain_ms = dt.count();
+	    start_reconnect();
+	    return;
+	  }
+	pace_timer.expires_at(Time::now() + Time::Duration::milliseconds(50));
+	pace_timer.async_wait([this](const asio::error_code& error)
+			      {
+				if (!error && phase == DRAIN)
+				  start_drain();
+			      });
+      }
+
+      void start_reconnect()
+      {
+	if (n_reconnects >= opt.reconnects)
+	  {
+	    finish();
+	    return;
+	  }
+	start_phase(RECONNECT);
+	probing = false;
+	server.restart();
+	client.restart();
+      }
+
+      // send one data packet every 10ms until the server sees one
+      void probe()
+      {
+	client.send_data(64);
+	pace_timer.expires_at(Time::now() + Time::Duration::milliseconds(10));
+	pace_timer.async_wait([this](const asio::error_code& error)
+			      {
+				if (!error && phase == RECONNECT && probing)
+				  probe();
+			      });
+      }
+
+      void reconnected()
+      {
+	const double ms = ms_since(phase_start);
+	probing = false;
+	pace_timer.cancel();
+	reconnect_total += ms;
+	result.reconnect_ms_max = std::max(result.reconnect_ms_max, ms);
+	result.reconnect_ms_avg = reconnect_total / ++n_reconnects;
+	asio::post(io_context, [this]() {
+	    if (phase == RECONNECT)
+	      start_reconnect();
+	  });
+      }
+
+      void finish()
+      {
+	phase = DONE;
+	pace_timer.cancel();
+	phase_timer.cancel();
+	client.stop();
+	server.stop();
+	client_wire->stop();
+	server_wire->stop();
+      }
+
+      const Options& opt;
+      const bool tcp;
+      Gremlin::Config::Ptr gremlin;
+      asio::io_context io_context;
+      Time now;
+      SessionStats::Ptr cli_stats;
+      SessionStats::Ptr serv_stats;
+      Endpoint client;
+      Endpoint server;
+      std::unique_ptr<Wire> client_wire;
+      std::unique_ptr<Wire> server_wire;
+      AsioTimer pace_timer;
+      AsioTimer phase_timer;
+      Phase phase = HANDSHAKE;
+      Clock::time_point phase_start;
+      Clock::time_point data_start;
+      Clock::time_point drain_start;
+      Clock::time_point last_recv;
+      size_t packets_sent = 0;
+      size_t received_packets = 0;
+      unsigned int n_reconnects = 0;
+      double reconnect_total = 0.0;
+      bool probing = false;
+      Result result;
+    };
+
+    inline void Endpoint::net_recv(BufferAllocated& buf)
+    {
+      if (halt)
+	return;
+      update_now();
+      size_t data_bytes = 0;
+      const PacketType pt = packet_type(buf);
+      if (pt.is_control())
+	control_net_recv(pt, std::move(buf));
+      else if (pt.is_data())
+	{
+	  try {
+	    data_decrypt(pt, buf);
+	    data_bytes = buf.size();
+	  }
+	  catch (const std::exception&)
+	    {
+	      // counted in stats
+	    }
+	}
+      flush(true);
+      check();
+      if (!halt)
+	{
+	  schedule_housekeeping();
+	  run.progress(*this, data_bytes);
+	}
+    }
+
+    inline void Endpoint::check()
+    {
+      if (invalidated())
+	run.fail(std::string(is_server() ? "server" : "client") + " invalidated: " + Error::name(invalidation_reason()));
+    }
+
+    inline void TCPWire::tcp_eof_handler()
+    {
+      run.fail("TCP EOF");
+    }
+
+    inline void TCPWire::tcp_error_handler(const char *error)
+    {
+      run.fail(std::string("TCP error: ") + error);
+    }
+
+    inline void report(const Options& opt, const std::vector<Result>& results)
+    {
+      if (opt.csv)
+	{
+	  std::cout << "profile,transport,ok,handshake_ms,goodput_kbps,drain_ms,reconnect_ms_avg,reconnect_ms_max,sent_bytes,received_bytes,error" << std::endl;
+	  for (const auto &r : results)
+	    std::cout << r.profile << ','
+		      << r.transport << ','
+		      << r.error.empty() << ','
+		      << r.handshake_ms << ','
+		      << r.goodput_kbps << ','
+		      << r.drain_ms << ','
+		      << r.reconnect_ms_avg << ','
+		      << r.reconnect_ms_max << ','
+		      << r.sent << ','
+		      << r.received << ','
+		      << r.error << std::endl;
+	  return;
+	}
+
+      std::cout << std::left << std::setw(12) << "PROFILE"
+		<< std::setw(5) << "LINK"
+		<< std::right
+		<< std::setw(14) << "HANDSHAKE_MS"
+		<< std::setw(14) << "GOODPUT_KBPS"
+		<< std::setw(10) << "DRAIN_MS"
+		<< std::setw(13) << "RECONN_AVG"
+		<< std::setw(13) << "RECONN_MAX" << std::endl;
+      for (const auto &r : results)
+	{
+	  std::cout << std::left << std::setw(12) << r.profile
+		    << std::setw(5) << r.transport
+		    << std::right << std::fixed << std::setprecision(1)
+		    << std::setw(14) << r.handshake_ms
+		    << std::setw(14) << r.goodput_kbps
+		    << std::setw(10) << r.drain_ms
+		    << std::setw(13) << r.reconnect_ms_avg
+		    << std::setw(13) << r.reconnect_ms_max;
+	  if (!r.error.empty())
+	    std::cout << "  FAILED " << r.error;
+	  std::cout << std::endl;
+	}
+    }
+  }
+}
+
+static void usage()
+{
+  std::cerr << "usage: impair [options]" << std::endl
+	    << "  --profile A,B,... : " << Gremlin::Config::profile_names() << " (all)" << std::endl
+	    << "  --transport LIST  : udp,tcp (both)" << std::endl
+	    << "  --seed N          : gremlin seed (1)" << std::endl
+	    << "  --duration N      : seconds of data traffic (5)" << std::endl
+	    << "  --rate N          : offered data load in kbps (5000)" << std::endl
+	    << "  --size N          : data packet payload bytes (1200)" << std::endl
+	    << "  --reconnects N    : reconnects timed per run (3)" << std::endl
+	    << "  --timeout N       : seconds allowed for each phase (60)" << std::endl
+	    << "  --keys DIR        : directory with test/ssl keys (../ssl)" << std::endl
+	    << "  --cipher C        : data channel cipher (AES-128-CBC)" << std::endl
+	    << "  --digest D        : data channel and HMAC digest (SHA1)" << std::endl
+	    << "  --csv             : CSV output" << std::endl;
+}
+
+int main(int argc, char* argv[])
+{
+  // process-wide initialization
+  InitProcess::init();
+
+  int ret = 0;
+  try {
+    Impair::Options opt;
+    for (int i = 1; i < argc; ++i)
+      {
+	const std::string o = argv[i];
+	if (o == "--csv")
+	  {
+	    opt.csv = true;
+	    continue;
+	  }
+	if (i + 1 >= argc)
+	  {
+	    usage();
+	    return 2;
+	  }
+	const std::string arg = argv[++i];
+	if (o == "--profile")
+	  opt.profiles = string::split(arg, ',');
+	else if (o == "--transport")
+	  opt.transports = string::split(arg, ',');
+	else if (o == "--seed")
+	  opt.seed = std::atoi(arg.c_str());
+	else if (o == "--duration")
+	  opt.duration = std::max(std::atoi(arg.c_str()), 1);
+	else if (o == "--rate")
+	  opt.offered_kbps = std::max(std::atoi(arg.c_str()), 1);
+	else if (o == "--size")
+	  opt.packet_size = std::min(std::max(std::atoi(arg.c_str()), 1), 1400);
+	else if (o == "--reconnects")
+	  opt.reconnects = std::atoi(arg.c_str());
+	else if (o == "--timeout")
+	  opt.timeout = std::max(std::atoi(arg.c_str()), 1);
+	else if (o == "--keys")
+	  opt.keydir = arg;
+	else if (o == "--cipher")
+	  opt.cipher = arg;
+	else if (o == "--digest")
+	  opt.digest = arg;
+	else
+	  {
+	    usage();
+	    return 2;
+	  }
+      }
+    if (opt.profiles.empty())
+      opt.profiles = string::split(std::string("clean,lte,satellite,wifi-lossy,bufferbloat"), ',');
+    if (opt.transports.empty())
+      opt.transports = string::split(std::string("udp,tcp"), ',');
+
+    const Impair::Keys keys(opt.keydir, frame_init_simple(2048));
+    std::vector<Impair::Result> results;
+    for (const auto &p : opt.profiles)
+      for (const auto &t : opt.transports)
+	{
+	  Impair::Run run(opt, keys, p, t);
+	  results.push_back(run.go());
+	  if (!results.back().error.empty())
+	    ret = 1;
+	}
+    Impair::report(opt, results);
+  }
+  catch (const std::exception& e)
+    {
+      std::cerr << "Exception: " << e.what() << std::endl;
+      ret = 1;
+    }
+
+  InitProcess::uninit();
+  return ret;
+}
@@ -0,0 +1,921 @@
+//    OpenVPN -- An application to securely tunnel IP networks
+//               over a single port, with support for SSL/TLS-based
+//               session authentication and key exchange,
+//               packet encryption, packet authentication, and
+//               packet compression.
+//
+//    Copyright (C) 2012-2016 OpenVPN Technologies, Inc.
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU Affero General Public License Version 3
+//    as published by the Free Software Foundation.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU Affero General Public License for more details.
+//
+//    You should have received a copy of the GNU Affero General Public License
+//    along with this program in the COPYING file.
+//    If not, see <http://www.gnu.org/licenses/>.
+
+// Server capacity load generator: runs many lightweight
+// ClientProto::Session clients on a few io_context threads against
+// a real server, feeds each tunnel with synthesized traffic from a
+// null tun, and reports handshake rate, connect latency percentiles
+// and throughput.
+
+#include <iostream>
+#include <iomanip>
+#include <string>
+#include <vector>
+#include <memory>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <algorithm>
+#include <cstring>
+#include <cstdlib>
+
+#include <asio.hpp>
+
+// Session objects log every state change, so logging is off
+// unless --verbose is given.
+namespace openvpn {
+  namespace LoadGen {
+    std::atomic<bool> verbose(false);
+
+    inline std::ostream& log_stream()
+    {
+      static std::ostream null_stream(nullptr);
+      return verbose.load(std::memory_order_relaxed) ? std::cout : null_stream;
+    }
+  }
+}
+
+#define OPENVPN_LOG_STREAM (openvpn::LoadGen::log_stream())
+#define OPENVPN_LOG_SSL(x) // disable
+
+#include <openvpn/log/logsimple.hpp>
+
+// tun is replaced by TrafficTun below, never open a real device
+#define OPENVPN_FORCE_TUN_NULL
+
+#include <openvpn/common/platform.hpp>
+#include <openvpn/common/exception.hpp>
+#include <openvpn/common/getopt.hpp>
+#include <openvpn/common/string.hpp>
+#include <openvpn/init/initprocess.hpp>
+#include <openvpn/time/asiotimer.hpp>
+#include <openvpn/frame/frame_init.hpp>
+#include <openvpn/addr/ipv4.hpp>
+#include <openvpn/ip/ip.hpp>
+#include <openvpn/ip/udp.hpp>
+#include <openvpn/options/merge.hpp>
+#include <openvpn/client/cliconstants.hpp>
+#include <openvpn/client/cliopthelper.hpp>
+#include <openvpn/client/cliopt.hpp>
+
+using namespace openvpn;
+
+namespace openvpn {
+  namespace LoadGen {
+
+    OPENVPN_EXCEPTION(loadgen_error);
+
+    typedef std::chrono::steady_clock Clock;
+
+    struct Config
+    {
+      Config()
+	: n_clients(100),
+	  n_threads(2),
+	  ramp_rate(50),
+	  duration(30),
+	  churn(0),
+	  retry(2),
+	  pps(10),
+	  dest_port(9)
+      {
+      }
+
+      std::string profile;
+      std::string server;
+      std::string username;   // "%n" is replaced by the client index
+      std::string password;
+      std::string traffic;    // none, fixed:SIZE, imix
+      std::string dest;       // traffic destination, default is pushed route-gateway
+      unsigned int n_clients;
+      unsigned int n_threads;
+      unsigned int ramp_rate; // new clients per second, across all threads
+      unsigned int duration;  // seconds to run after ramp-up completes
+      unsigned int churn;     // if nonzero, reconnect each client after this many seconds
+      unsigned int retry;     // if nonzero, restart a failed client after this many seconds
+      unsigned int pps;       // packets per second per client
+      unsigned int dest_port;
+    };
+
+    // Packet sizes for the synthesized traffic, cycled per client.
+    class TrafficPattern
+    {
+    public:
+      TrafficPattern() {}
+
+      explicit TrafficPattern(const std::string& spec)
+      {
+	if (spec.empty() || spec == "none")
+	  return;
+	else if (spec == "imix")
+	  {
+	    // 7:4:1 IMIX of 64/576/1500 byte packets
+	    for (int i = 0; i < 7; ++i)
+	      sizes.push_back(64);
+	    for (int i = 0; i < 4; ++i)
+	      sizes.push_back(576);
+	    sizes.push_back(1500);
+	  }
+	else if (string::starts_with(spec, "fixed:"))
+	  {
+	    const int size = std::atoi(spec.c_str() + 6);
+	    if (size < int(min_size()) || size > 1500)
+	      OPENVPN_THROW(loadgen_error, "traffic size must be " << min_size() << "..1500: " << spec);
+	    sizes.push_back(size);
+	  }
+	else
+	  OPENVPN_THROW(loadgen_error, "unknown traffic pattern: " << spec);
+      }
+
+      bool defined() const { return !sizes.empty(); }
+
+      size_t next(size_t& cursor) const
+      {
+	const size_t ret = sizes[cursor];
+	if (++cursor >= sizes.size())
+	  cursor = 0;
+	return ret;
+      }
+
+      static size_t min_size()
+      {
+	return sizeof(IPHeader) + sizeof(UDPHeader);
+      }
+
+    private:
+      std::vector<size_t> sizes;
+    };
+
+    // Null tun that reports itself connected as soon as the tunnel
+    // comes up, then injects IPv4/UDP packets into the tunnel at a
+    // fixed rate and counts what the server sends back.
+    class TrafficTun : public TunClient
+    {
+    public:
+      typedef RCPtr<TrafficTun> Ptr;
+
+      struct Factory : public TunClientFactory
+      {
+	typedef RCPtr<Factory> Ptr;
+
+	Frame::Ptr frame;
+	SessionStats::Ptr stats;
+	TrafficPattern pattern;
+	unsigned int pps = 0;
+	std::string dest;
+	unsigned int dest_port = 0;
+
+	virtual TunClient::Ptr new_tun_client_obj(asio::io_context& io_context,
+						  TunClientParent& parent,
+						  TransportClient* transcli)
+	{
+	  return new TrafficTun(io_context, this, parent);
+	}
+      };
+
+      virtual void tun_start(const OptionList& opt, TransportClient& transcli, CryptoDCSettings&)
+      {
+	const Option* o = opt.get_ptr("ifconfig");
+	if (o)
+	  local = IPv4::Addr::from_string(o->get(1, 256), "ifconfig");
+
+	if (!config->dest.empty())
+	  remote = IPv4::Addr::from_string(config->dest, "traffic-dest");
+	else
+	  {
+	    const std::string gw = opt.get_optional("route-gateway", 1, 256);
+	    remote = IPv4::Addr::from_string(gw.empty() ? "10.8.0.1" : gw, "route-gateway");
+	  }
+
+	parent.tun_connected();
+
+	if (!halt && o && config->pattern.defined() && config->pps)
+	  {
+	    interval = Time::Duration::milliseconds(std::max(1000u / config->pps, 1u));
+	    next_send = Time::now();
+	    schedule_send();
+	  }
+      }
+
+      virtual bool tun_send(BufferAllocated& buf)
+      {
+	config->stats->inc_stat(SessionStats::TUN_BYTES_OUT, buf.size());
+	config->stats->inc_stat(SessionStats::TUN_PACKETS_OUT, 1);
+	return true;
+      }
+
+      virtual std::string tun_name() const
+      {
+	return "TUN_TRAFFIC";
+      }
+
+      virtual std::string vpn_ip4() const
+      {
+	return local.unspecified() ? "" : local.to_string();
+      }
+
+      virtual std::string vpn_ip6() const
+      {
+	return "";
+      }
+
+      virtual void set_disconnect()
+      {
+      }
+
+      virtual void stop()
+      {
+	if (!halt)
+	  {
+	    halt = true;
+	    send_timer.cancel();
+	  }
+      }
+
+    private:
+      TrafficTun(asio::io_context& io_context_arg,
+		 Factory* config_arg,
+		 TunClientParent& parent_arg)
+	: config(config_arg),
+	  parent(parent_arg),
+	  send_timer(io_context_arg),
+	  local(IPv4::Addr::from_zero()),
+	  remote(IPv4::Addr::from_zero())
+      {
+      }
+
+      void schedule_send()
+      {
+	next_send += interval;
+	send_timer.expires_at(next_send);
+	send_timer.async_wait([self=Ptr(this)](const asio::error_code& error)
+			      {
+				if (!error && !self->halt)
+				  {
+				    self->send_packet();
+				    if (!self->halt)
+				      self->schedule_send();
+				  }
+			      });
+      }
+
+      void send_packet()
+      {
+	const size_t size = config->pattern.next(cursor);
+
+	BufferAllocated buf;
+	config->frame->prepare(Frame::READ_TUN, buf);
+
+	IPHeader* ip = (IPHeader*)buf.write_alloc(sizeof(IPHeader));
+	ip->version_len = IPHeader::ver_len(4, sizeof(IPHeader));
+	ip->tos = 0;
+	ip->tot_len = htons(size);
+	ip->id = htons(ip_id++);
+	ip->frag_off = 0;
+	ip->ttl = 64;
+	ip->protocol = IPHeader::UDP;
+	ip->check = 0;
+	ip->saddr = htonl(local.to_uint32());
+	ip->daddr = htonl(remote.to_uint32());
+	ip->check = ip_checksum(ip, sizeof(IPHeader));
+
+	UDPHeader* udp = (UDPHeader*)buf.write_alloc(sizeof(UDPHeader));
+	udp->source = htons(9);
+	udp->dest = htons(config->dest_port);
+	udp->len = htons(size - sizeof(IPHeader));
+	udp->check = 0; // optional for IPv4
+
+	const size_t payload = size - TrafficPattern::min_size();
+	std::memset(buf.write_alloc(payload), 0x5a, payload);
+
+	config->stats->inc_stat(SessionStats::TUN_BYTES_IN, buf.size());
+	config->stats->inc_stat(SessionStats::TUN_PACKETS_IN, 1);
+	parent.tun_recv(buf);
+      }
+
+      Factory::Ptr config;
+      TunClientParent& parent;
+      AsioTimer send_timer;
+      Time next_send;
+      Time::Duration interval;
+      IPv4::Addr local;
+      IPv4::Addr remote;
+      size_t cursor = 0;
+      std::uint16_t ip_id = 0;
+      bool halt = false;
+    };
+
+    // Counters a Worker publishes to the reporting thread.
+    struct Counters
+    {
+      Counters()
+      {
+	for (auto &e : events)
+	  e.store(0, std::memory_order_relaxed);
+      }
+
+      std::atomic<unsigned long> started{0};    // sessions started, including retries
+      std::atomic<unsigned long> connected{0};  // sessions that reached CONNECTED
+      std::atomic<unsigned long> failed{0};     // sessions that ended before CONNECTED
+      std::atomic<unsigned long> dropped{0};    // connected sessions ended by the peer
+      std::atomic<unsigned long> active{0};     // sessions connected now
+      std::atomic<unsigned long> events[ClientEvent::N_TYPES];
+    };
+
+    // Counts client events, owned by the Worker thread.
+    class EventCounter : public ClientEvent::Queue
+    {
+    public:
+      typedef RCPtr<EventCounter> Ptr;
+
+      EventCounter(Counters& counters_arg)
+	: counters(counters_arg)
+      {
+      }
+
+      virtual void add_event(ClientEvent::Base::Ptr event)
+      {
+	counters.events[event->id()].fetch_add(1, std::memory_order_relaxed);
+	if (event->is_error())
+	  OPENVPN_LOG("EVENT: " << event->name() << ' ' << event->render());
+      }
+
+    private:
+      Counters& counters;
+    };
+
+    // One io_context thread and the clients it owns.  Handlers
+    // capture a raw this pointer: the Driver joins every Worker
+    // thread before destroying it.
+    class Worker
+    {
+    public:
+      Worker(const Config& conf_arg,
+	     const OptionList& options,
+	     const unsigned int first_index,
+	     const unsigned int n_clients_arg)
+	: conf(conf_arg),
+	  io_context(1),
+	  stats(new SessionStats()),
+	  ramp_timer(io_context),
+	  n_clients(n_clients_arg)
+      {
+	ClientOptions::Config cc;
+	cc.server_override = conf.server;
+	cc.cli_stats = stats;
+	cc.cli_events.reset(new EventCounter(counters_));
+	cc.proto_context_options.reset(new ProtoContextOptions());
+	cli_opt.reset(new ClientOptions(options, cc));
+
+	tun_factory.reset(new TrafficTun::Factory());
+	tun_factory->frame = frame_init_simple(2048);
+	tun_factory->stats = stats;
+	tun_factory->pattern = TrafficPattern(conf.traffic);
+	tun_factory->pps = conf.pps;
+	tun_factory->dest = conf.dest;
+	tun_factory->dest_port = conf.dest_port;
+
+	for (unsigned int i = 0; i < n_clients; ++i)
+	  clones.emplace_back(new Clone(*this, first_index + i));
+      }
+
+      void start()
+      {
+	thread.reset(new std::thread([this]() {
+	      run();
+	    }));
+      }
+
+      // called from the reporting thread
+      void stop()
+      {
+	asio::post(io_context, [this]() {
+	    stop_all();
+	  });
+      }
+
+      void join()
+      {
+	if (thread)
+	  {
+	    thread->join();
+	    thread.reset();
+	  }
+      }
+
+      bool ramp_done() const
+      {
+	return ramp_done_.load(std::memory_order_acquire);
+      }
+
+      const Counters& counters() const { return counters_; }
+
+      SessionStats::Snapshot stats_snapshot() const
+      {
+	return stats->snapshot();
+      }
+
+      // only valid after join()
+      const std::vector<double>& latencies() const { return latencies_ms; }
+
+    private:
+      class Clone : public ClientProto::NotifyCallback
+      {
+      public:
+	Clone(Worker& parent_arg, const unsigned int index_arg)
+	  : parent(parent_arg),
+	    index(index_arg),
+	    timer(parent_arg.io_context)
+	{
+	}
+
+	void start()
+	{
+	  Client::Config::Ptr c = parent.cli_opt->client_config();
+	  c->tun_factory = parent.tun_factory;
+	  if (!parent.conf.username.empty())
+	    {
+	      ClientCreds::Ptr creds(new ClientCreds());
+	      creds->set_username(username());
+	      creds->set_password(parent.conf.password);
+	      c->creds = creds;
+	    }
+
+	  connected = false;
+	  start_time = Clock::now();
+	  session.reset(new Client(parent.io_context, *c, this));
+	  parent.counters_.started.fetch_add(1, std::memory_order_relaxed);
+	  session->start();
+	}
+
+	void stop()
+	{
+	  timer.cancel();
+	  if (session)
+	    {
+	      session->send_explicit_exit_notify();
+	      session->stop(false);
+	      release_session();
+	    }
+	  if (connected)
+	    {
+	      connected = false;
+	      parent.counters_.active.fetch_sub(1, std::memory_order_relaxed);
+	    }
+	}
+
+      private:
+	typedef ClientProto::Session Client;
+
+	virtual void client_proto_connected()
+	{
+	  const std::chrono::duration<double, std::milli> dt = Clock::now() - start_time;
+	  parent.latencies_ms.push_back(dt.count());
+	  connected = true;
+	  parent.counters_.connected.fetch_add(1, std::memory_order_relaxed);
+	  parent.counters_.active.fetch_add(1, std::memory_order_relaxed);
+	  if (parent.conf.churn)
+	    schedule(parent.conf.churn, true);
+	}
+
+	virtual void client_proto_terminate()
+	{
+	  timer.cancel();
+	  if (connected)
+	    {
+	      connected = false;
+	      parent.counters_.active.fetch_sub(1, std::memory_order_relaxed);
+	      parent.counters_.dropped.fetch_add(1, std::memory_order_relaxed);
+	    }
+	  else
+	    parent.counters_.failed.fetch_add(1, std::memory_order_relaxed);
+
+	  // Session::stop is still on the stack
+	  release_session();
+
+	  if (parent.conf.retry && !parent.halt)
+	    schedule(parent.conf.retry, false);
+	}
+
+	// reconnect after seconds, optionally tearing down the
+	// current session first
+	void schedule(const unsigned int seconds, const bool churn)
+	{
+	  timer.expires_at(Time::now() + Time::Duration::seconds(seconds));
+	  timer.async_wait([this, churn](const asio::error_code& error)
+			   {
+			     if (error || parent.halt)
+			       return;
+			     if (churn && session)
+			       stop();
+			     start();
+			   });
+	}
+
+	std::string username() const
+	{
+	  std::string ret = parent.conf.username;
+	  const size_t pos = ret.find("%n");
+	  if (pos != std::string::npos)
+	    ret.replace(pos, 2, std::to_string(index));
+	  return ret;
+	}
+
+	void release_session()
+	{
+	  Client::Ptr s(std::move(session));
+	  asio::post(parent.io_context, [s]() {});
+	}
+
+	Worker& parent;
+	const unsigned int index;
+	AsioTimer timer;
+	Client::Ptr session;
+	Clock::time_point start_time;
+	bool connected = false;
+      };
+
+      typedef ClientOptions::Client Client;
+
+      void run()
+      {
+	try {
+	  schedule_ramp();
+	  io_context.run();
+	}
+	catch (const std::exception& e)
+	  {
+	    std::cerr << "worker exception: " << e.what() << std::endl;
+	  }
+
+	// sessions and options are single-threaded, release them here
+	clones.clear();
+	cli_opt.reset();
+      }
+
+      // start clients at conf.ramp_rate / n_threads per second,
+      // in 10ms steps
+      void schedule_ramp()
+      {
+	if (n_started >= n_clients)
+	  {
+	    ramp_done_.store(true, std::memory_order_release);
+	    return;
+	  }
+	ramp_timer.expires_at(Time::now() + Time::Duration::milliseconds(10));
+	ramp_timer.async_wait([this](const asio::error_code& error)
+			      {
+				if (error || halt)
+				  return;
+				ramp_credit += double(conf.ramp_rate) / conf.n_threads / 100.0;
+				while (ramp_credit >= 1.0 && n_started < n_clients)
+				  {
+				    ramp_credit -= 1.0;
+				    clones[n_started++]->start();
+				  }
+				schedule_ramp();
+			      });
+      }
+
+      void stop_all()
+      {
+	if (!halt)
+	  {
+	    halt = true;
+	    ramp_timer.cancel();
+	    for (auto &c : clones)
+	      c->stop();
+	  }
+      }
+
+      const Config& conf;
+      Counters counters_;
+      asio::io_context io_context;
+      SessionStats::Ptr stats;
+      ClientOptions::Ptr cli_opt;
+      TrafficTun::Factory::Ptr tun_factory;
+      AsioTimer ramp_timer;
+      std::vector<std::unique_ptr<Clone>> clones;
+      std::unique_ptr<std::thread> thread;
+      std::vector<double> latencies_ms;
+      const unsigned int n_clients;
+      unsigned int n_started = 0;
+      double ramp_credit = 0.0;
+      std::atomic<bool> ramp_done_{false};
+      bool halt = false;
+    };
+
+    class Driver
+    {
+    public:
+      Driver(const Config& conf_arg)
+	: conf(conf_arg)
+      {
+	if (!conf.n_clients || !conf.n_threads || !conf.ramp_rate)
+	  throw loadgen_error("clients, threads and ramp rate must be nonzero");
+	TrafficPattern(conf.traffic); // validate
+
+	ProfileMerge pm(conf.profile, "ovpn", "", ProfileMerge::FOLLOW_PARTIAL,
+			ProfileParseLimits::MAX_LINE_SIZE, ProfileParseLimits::MAX_PROFILE_SIZE);
+	if (pm.status() != ProfileMerge::MERGE_SUCCESS)
+	  OPENVPN_THROW(loadgen_error, "merge config error: " << pm.status_string() << " : " << pm.error());
+
+	OptionList::KeyValueList kvl;
+	const ParseClientConfig cc = ParseClientConfig::parse(pm.profile_content(), &kvl, options);
+	if (cc.error())
+	  OPENVPN_THROW(loadgen_error, "profile error: " << cc.message());
+      }
+
+      void run()
+      {
+	const unsigned int n_threads = std::min(conf.n_threads, conf.n_clients);
+	unsigned int index = 0;
+	for (unsigned int i = 0; i < n_threads; ++i)
+	  {
+	    const unsigned int n = conf.n_clients / n_threads + (i < conf.n_clients % n_threads);
+	    workers.emplace_back(new Worker(conf, options, index, n));
+	    index += n;
+	  }
+
+	const Clock::time_point begin = Clock::now();
+	for (auto &w : workers)
+	  w->start();
+
+	// report once per second until the run time after ramp-up expires
+	Sample prev = sample();
+	Clock::time_point ramp_end;
+	bool ramping = true;
+	unsigned int t = 0;
+	while (true)
+	  {
+	    std::this_thread::sleep_for(std::chrono::seconds(1));
+	    ++t;
+	    const Sample cur = sample();
+	    report_interval(t, prev, cur);
+	    prev = cur;
+
+	    if (ramping && all_ramped())
+	      {
+		ramping = false;
+		ramp_end = Clock::now();
+	      }
+	    if (!ramping && Clock::now() - ramp_end >= std::chrono::seconds(conf.duration))
+	      break;
+	  }
+
+	const Sample end_sample = sample();
+	const std::chrono::duration<double> elapsed = Clock::now() - begin;
+
+	for (auto &w : workers)
+	  w->stop();
+	for (auto &w : workers)
+	  w->join();
+
+	report_final(end_sample, elapsed.count());
+      }
+
+    private:
+      struct Sample
+      {
+	unsigned long started = 0;
+	unsigned long connected = 0;
+	unsigned long failed = 0;
+	unsigned long dropped = 0;
+	unsigned long active = 0;
+	SessionStats::Snapshot stats;
+      };
+
+      Sample sample() const
+      {
+	Sample s;
+	for (auto &w : workers)
+	  {
+	    const Counters& c = w->counters();
+	    s.started += c.started.load(std::memory_order_relaxed);
+	    s.connected += c.connected.load(std::memory_order_relaxed);
+	    s.failed += c.failed.load(std::memory_order_relaxed);
+	    s.dropped += c.dropped.load(std::memory_order_relaxed);
+	    s.active += c.active.load(std::memory_order_relaxed);
+	    const SessionStats::Snapshot ss = w->stats_snapshot();
+	    for (size_t i = 0; i < SessionStats::N_STATS; ++i)
+	      s.stats.stats[i] += ss.stats[i];
+	  }
+	return s;
+      }
+
+      bool all_ramped() const
+      {
+	for (auto &w : workers)
+	  if (!w->ramp_done())
+	    return false;
+	return true;
+      }
+
+      static double mbps(const count_t bytes, const double seconds)
+      {
+	return seconds > 0.0 ? double(bytes) * 8.0 / seconds / 1000000.0 : 0.0;
+      }
+
+      static count_t delta(const Sample& prev, const Sample& cur, const size_t type)
+      {
+	return cur.stats.get(type) - prev.stats.get(type);
+      }
+
+      void report_interval(const unsigned int t, const Sample& prev, const Sample& cur) const
+      {
+	std::cout << "T+" << t << "s"
+		  << " active=" << cur.active
+		  << " started=" << cur.started
+		  << " connected=" << cur.connected
+		  << " failed=" << cur.failed
+		  << " dropped=" << cur.dropped
+		  << " hs/s=" << (cur.connected - prev.connected)
+		  << std::fixed << std::setprecision(2)
+		  << " tun-in=" << mbps(delta(prev, cur, SessionStats::TUN_BYTES_IN), 1.0) << "Mbps"
+		  << " tun-out=" << mbps(delta(prev, cur, SessionStats::TUN_BYTES_OUT), 1.0) << "Mbps"
+		  << std::defaultfloat
+		  << std::endl;
+      }
+
+      static double percentile(const std::vector<double>& sorted, const double p)
+      {
+	if (sorted.empty())
+	  return 0.0;
+	return sorted[size_t(p * (sorted.size() - 1) + 0.5)];
+      }
+
+      void report_final(const Sample& s, const double elapsed) const
+      {
+	std::vector<double> lat;
+	unsigned long events[ClientEvent::N_TYPES] = {};
+	for (auto &w : workers)
+	  {
+	    lat.insert(lat.end(), w->latencies().begin(), w->latencies().end());
+	    for (size_t i = 0; i < ClientEvent::N_TYPES; ++i)
+	      events[i] += w->counters().events[i].load(std::memory_order_relaxed);
+	  }
+	std::sort(lat.begin(), lat.end());
+
+	std::cout << std::fixed << std::setprecision(2)
+		  << "=== " << conf.n_clients << " clients, " << workers.size() << " threads, "
+		  << elapsed << "s ===" << std::endl
+		  << "sessions: started=" << s.started
+		  << " connected=" << s.connected
+		  << " failed=" << s.failed
+		  << " dropped=" << s.dropped << std::endl
+		  << "handshakes/sec: " << (elapsed > 0.0 ? s.connected / elapsed : 0.0) << std::endl
+		  << "connect latency ms: p50=" << percentile(lat, 0.50)
+		  << " p90=" << percentile(lat, 0.90)
+		  << " p99=" << percentile(lat, 0.99)
+		  << " max=" << (lat.empty() ? 0.0 : lat.back()) << std::endl
+		  << "tun Mbps: in=" << mbps(s.stats.get(SessionStats::TUN_BYTES_IN), elapsed)
+		  << " out=" << mbps(s.stats.get(SessionStats::TUN_BYTES_OUT), elapsed) << std::endl
+		  << "link Mbps: in=" << mbps(s.stats.get(SessionStats::BYTES_IN), elapsed)
+		  << " out=" << mbps(s.stats.get(SessionStats::BYTES_OUT), elapsed) << std::endl;
+
+	for (size_t i = ClientEvent::NONFATAL_ERROR_START; i < ClientEvent::N_TYPES; ++i)
+	  if (events[i])
+	    std::cout << "event " << ClientEvent::event_name(ClientEvent::Type(i)) << ": " << events[i] << std::endl;
+      }
+
+      const Config& conf;
+      OptionList options;
+      std::vector<std::unique_ptr<Worker>> workers;
+    };
+  }
+}
+
+static void usage()
+{
+  std::cout << "usage: loadgen [options] <config-file>" << std::endl
+	    << "--clients, -n      : number of clients (100)" << std::endl
+	    << "--threads, -t      : number of io_context threads (2)" << std::endl
+	    << "--ramp, -r         : clients started per second (50)" << std::endl
+	    << "--duration, -d     : seconds to run after ramp-up (30)" << std::endl
+	    << "--churn, -c        : reconnect each client after n seconds (0=off)" << std::endl
+	    << "--retry, -w        : restart a failed client after n seconds (2, 0=off)" << std::endl
+	    << "--server, -s       : override server in config" << std::endl
+	    << "--username, -u     : username, %n is replaced by the client index" << std::endl
+	    << "--password, -p     : password" << std::endl
+	    << "--traffic, -T      : none, fixed:SIZE or imix (none)" << std::endl
+	    << "--pps, -R          : packets per second per client (10)" << std::endl
+	    << "--traffic-dest, -D : traffic destination (pushed route-gateway)" << std::endl
+	    << "--traffic-port, -P : traffic UDP port (9)" << std::endl
+	    << "--verbose, -v      : show session logging" << std::endl;
+}
+
+int main(int argc, char* argv[])
+{
+  static const struct option longopts[] = {
+    { "clients",      required_argument,  nullptr,      'n' },
+    { "threads",      required_argument,  nullptr,      't' },
+    { "ramp",         required_argument,  nullptr,      'r' },
+    { "duration",     required_argument,  nullptr,      'd' },
+    { "churn",        required_argument,  nullptr,      'c' },
+    { "retry",        required_argument,  nullptr,      'w' },
+    { "server",       required_argument,  nullptr,      's' },
+    { "username",     required_argument,  nullptr,      'u' },
+    { "password",     required_argument,  nullptr,      'p' },
+    { "traffic",      required_argument,  nullptr,      'T' },
+    { "pps",          required_argument,  nullptr,      'R' },
+    { "traffic-dest", required_argument,  nullptr,      'D' },
+    { "traffic-port", required_argument,  nullptr,      'P' },
+    { "verbose",      no_argument,        nullptr,      'v' },
+    { nullptr,        0,                  nullptr,       0  }
+  };
+
+  // process-wide initialization
+  InitProcess::init();
+
+  int ret = 0;
+  try {
+    LoadGen::Config conf;
+    int ch;
+    while ((ch = getopt_long(argc, argv, "n:t:r:d:c:w:s:u:p:T:R:D:P:v", longopts, nullptr)) != -1)
+      {
+	switch (ch)
+	  {
+	  case 'n':
+	    conf.n_clients = ::atoi(optarg);
+	    break;
+	  case 't':
+	    conf.n_threads = ::atoi(optarg);
+	    break;
+	  case 'r':
+	    conf.ramp_rate = ::atoi(optarg);
+	    break;
+	  case 'd':
+	    conf.duration = ::atoi(optarg);
+	    break;
+	  case 'c':
+	    conf.churn = ::atoi(optarg);
+	    break;
+	  case 'w':
+	    conf.retry = ::atoi(optarg);
+	    break;
+	  case 's':
+	    conf.server = optarg;
+	    break;
+	  case 'u':
+	    conf.username = optarg;
+	    break;
+	  case 'p':
+	    conf.password = optarg;
+	    break;
+	  case 'T':
+	    conf.traffic = optarg;
+	    break;
+	  case 'R':
+	    conf.pps = ::atoi(optarg);
+	    break;
+	  case 'D':
+	    conf.dest = optarg;
+	    break;
+	  case 'P':
+	    conf.dest_port = ::atoi(optarg);
+	    break;
+	  case 'v':
+	    LoadGen::verbose = true;
+	    break;
+	  default:
+	    usage();
+	    return 2;
+	  }
+      }
+    if (optind + 1 != argc)
+      {
+	usage();
+	return 2;
+      }
+    conf.profile = argv[optind];
+
+    LoadGen::Driver driver(conf);
+    driver.run();
+  }
+  catch (const std::exception& e)
+    {
+      std::cerr << "Exception: " << e.what() << std::endl;
+      ret = 1;
+    }
+
+  InitProcess::uninit();
+  return ret;
+}
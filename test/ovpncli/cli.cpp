@@ -290,6 +290,7 @@ int openvpn_client(int argc, char *argv[], const std::string* profile_content)
     { "proxy-basic",    no_argument,        nullptr,      'B' },
     { "alt-proxy",      no_argument,        nullptr,      'A' },
     { "dco",            no_argument,        nullptr,      'd' },
+    { "data-threads",   required_argument,  nullptr,       2  },
     { "eval",           no_argument,        nullptr,      'e' },
     { "self-test",      no_argument,        nullptr,      'T' },
     { "cache-password", no_argument,        nullptr,      'C' },
@@ -346,6 +347,8 @@ int openvpn_client(int argc, char *argv[], const std::string* profile_content)
 	bool version = false;
 	bool altProxy = false;
 	bool dco = false;
+	bool dataThreads = false;
+	int dataThreadsCore = -1;
 
 	int ch;
 	optind = 1;
@@ -419,6 +422,10 @@ int openvpn_client(int argc, char *argv[], const std::string* profile_content)
 	      case 'd':
 		dco = true;
 		break;
+	      case 2:
+		dataThreads = true;
+		dataThreadsCore = ::atoi(optarg);
+		break;
 	      case 'f':
 		forceAesCbcCiphersuites = true;
 		break;
@@ -514,6 +521,8 @@ int openvpn_client(int argc, char *argv[], const std::string* profile_content)
 	      config.proxyAllowCleartextAuth = proxyAllowCleartextAuth;
 	      config.altProxy = altProxy;
 	      config.dco = dco;
+	      config.dataThreads = dataThreads;
+	      config.dataThreadsCore = dataThreadsCore;
 	      config.defaultKeyDirection = defaultKeyDirection;
 	      config.forceAesCbcCiphersuites = forceAesCbcCiphersuites;
 	      config.sslDebugLevel = sslDebugLevel;
@@ -680,6 +689,7 @@ int openvpn_client(int argc, char *argv[], const std::string* profile_content)
       std::cout << "--proxy-basic, -B    : allow HTTP basic auth" << std::endl;
       std::cout << "--alt-proxy, -A      : enable alternative proxy module" << std::endl;
       std::cout << "--dco, -d            : enable data channel offload" << std::endl;
+      std::cout << "--data-threads       : run data channel on TX/RX threads pinned from this core (-1 = unpinned)" << std::endl;
       std::cout << "--cache-password, -C : cache password" << std::endl;
       std::cout << "--no-cert, -x        : disable client certificate" << std::endl;
       std::cout << "--def-keydir, -k     : default key direction ('bi', '0', or '1')" << std::endl;
@@ -689,7 +699,7 @@ int openvpn_client(int argc, char *argv[], const std::string* profile_content)
       std::cout << "--auto-sess, -a      : request autologin session" << std::endl;
       std::cout << "--persist-tun, -j    : keep TUN interface open across reconnects" << std::endl;
       std::cout << "--peer-info, -I      : peer info key/value list in the form K1=V1,K2=V2,..." << std::endl;
-      std::cout << "--gremlin, -G        : gremlin info (send_delay_ms, recv_delay_ms, send_drop_prob, recv_drop_prob)" << std::endl;
+      std::cout << "--gremlin, -G        : gremlin info (send_delay_ms, recv_delay_ms, send_drop_prob, recv_drop_prob[, jitter_ms[, rate_kbps[, seed]]]) or profile name" << std::endl;
       ret = 2;
     }
   return ret;
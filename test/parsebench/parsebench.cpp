@@ -0,0 +1,419 @@
+//    OpenVPN -- An application to securely tunnel IP networks
+//               over a single port, with support for SSL/TLS-based
+//               session authentication and key exchange,
+//               packet encryption, packet authentication, and
+//               packet compression.
+//
+//    Copyright (C) 2012-2016 OpenVPN Technologies, Inc.
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU Affero General Public License Version 3
+//    as published by the Free Software Foundation.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU Affero General Public License for more details.
+//
+//    You should have received a copy of the GNU Affero General Public License
+//    along with this program in the COPYING file.
+//    If not, see <http://www.gnu.org/licenses/>.
+
+// Microbenchmark for the profile and option parsing paths: builds
+// synthetic client profiles with N route lines and inline certs,
+// and times profile merge, OptionList::parse_from_config, PUSH_REPLY
+// parsing with OptionList::parse_from_csv, ClientOptions construction
+// and PEM certificate/key loading.
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <algorithm>
+#include <cstdlib>
+
+#include <openvpn/common/platform.hpp>
+
+#define OPENVPN_LOG_SSL(x) // disable
+
+// keep library logging out of the results
+#define OPENVPN_LOG_STREAM std::cerr
+
+#include <openvpn/log/logsimple.hpp>
+
+#include <openvpn/common/exception.hpp>
+#include <openvpn/common/file.hpp>
+#include <openvpn/common/options.hpp>
+#include <openvpn/common/split.hpp>
+#include <openvpn/common/lex.hpp>
+#include <openvpn/options/merge.hpp>
+#include <openvpn/client/cliconstants.hpp>
+#include <openvpn/client/cliopt.hpp>
+#include <openvpn/init/initprocess.hpp>
+
+#if defined(USE_OPENSSL)
+#include <openvpn/openssl/pki/x509.hpp>
+#include <openvpn/openssl/pki/pkey.hpp>
+#elif defined(USE_POLARSSL)
+#include <openvpn/polarssl/pki/x509cert.hpp>
+#include <openvpn/polarssl/pki/pkctx.hpp>
+#else
+#error Must define USE_OPENSSL or USE_POLARSSL
+#endif
+
+// minimum wall time spent on each measurement, in milliseconds
+#ifndef MIN_MS
+#define MIN_MS 250
+#endif
+
+using namespace openvpn;
+
+// Generous limits, so that the larger synthetic profiles parse.
+// Production limits (ProfileParseLimits) would reject 10000 routes.
+static OptionList::Limits bench_limits()
+{
+  return OptionList::Limits("benchmark input too large",
+			    64*1024*1024,
+			    ProfileParseLimits::OPT_OVERHEAD,
+			    ProfileParseLimits::TERM_OVERHEAD,
+			    ProfileParseLimits::MAX_LINE_SIZE,
+			    ProfileParseLimits::MAX_DIRECTIVE_SIZE);
+}
+
+static std::string route_net(const unsigned int i)
+{
+  std::ostringstream os;
+  os << "10." << ((i >> 8) & 0xFF) << '.' << (i & 0xFF) << ".0";
+  return os.str();
+}
+
+// ClientOptions wants an event sink
+class NullEvents : public ClientEvent::Queue
+{
+public:
+  virtual void add_event(ClientEvent::Base::Ptr event) {}
+};
+
+struct Keys
+{
+  void load(const std::string& dir)
+  {
+    ca = read_text(dir + "/ca.crt");
+    cert = read_text(dir + "/client.crt");
+    key = read_text(dir + "/client.key");
+  }
+
+  std::string ca;
+  std::string cert;
+  std::string key;
+};
+
+struct Input
+{
+  Input(const Keys& keys, const unsigned int n_routes_arg)
+    : n_routes(n_routes_arg)
+  {
+    std::ostringstream prof;
+    prof << "client" << std::endl
+	 << "dev tun" << std::endl
+	 << "proto udp" << std::endl
+	 << "remote 127.0.0.1 1194" << std::endl
+	 << "nobind" << std::endl
+	 << "cipher AES-128-CBC" << std::endl
+	 << "auth SHA1" << std::endl
+	 << "verb 3" << std::endl;
+    for (unsigned int i = 0; i < n_routes; ++i)
+      prof << "route " << route_net(i) << " 255.255.255.0" << std::endl;
+    prof << "<ca>" << std::endl << keys.ca << "</ca>" << std::endl
+	 << "<cert>" << std::endl << keys.cert << "</cert>" << std::endl
+	 << "<key>" << std::endl << keys.key << "</key>" << std::endl;
+    profile = prof.str();
+
+    // what a server would push for the same routes
+    std::ostringstream push;
+    push << "route-gateway 10.8.0.1,topology subnet,ping 10,ping-restart 60,"
+	 << "dhcp-option DNS 10.8.0.1,ifconfig 10.8.0.2 255.255.255.0";
+    for (unsigned int i = 0; i < n_routes; ++i)
+      push << ",route " << route_net(i) << " 255.255.255.0";
+    push_reply = push.str();
+  }
+
+  const unsigned int n_routes;
+  std::string profile;
+  std::string push_reply; // without the "PUSH_REPLY," prefix
+};
+
+struct Result
+{
+  std::string stage;
+  unsigned int n_routes = 0;
+  size_t input_bytes = 0;
+  size_t iter = 0;
+  double sec = 0.0;
+
+  double ns_per_op() const
+  {
+    return iter ? sec * 1e9 / double(iter) : 0.0;
+  }
+
+  double ops_per_sec() const
+  {
+    return sec > 0.0 ? double(iter) / sec : 0.0;
+  }
+
+  double mb_per_sec() const
+  {
+    return sec > 0.0 ? double(input_bytes) * double(iter) / sec / 1e6 : 0.0;
+  }
+
+  static void csv_header(std::ostream& os)
+  {
+    os << "stage,routes,input_bytes,iter,sec,ns_per_op,ops_per_sec,mb_per_sec" << std::endl;
+  }
+
+  void csv(std::ostream& os) const
+  {
+    os << stage << ','
+       << n_routes << ','
+       << input_bytes << ','
+       << iter << ','
+       << sec << ','
+       << ns_per_op() << ','
+       << ops_per_sec() << ','
+       << mb_per_sec() << std::endl;
+  }
+
+  void json(std::ostream& os) const
+  {
+    os << "  {\"stage\": \"" << stage << '"'
+       << ", \"routes\": " << n_routes
+       << ", \"input_bytes\": " << input_bytes
+       << ", \"iter\": " << iter
+       << ", \"sec\": " << sec
+       << ", \"ns_per_op\": " << ns_per_op()
+       << ", \"ops_per_sec\": " << ops_per_sec()
+       << ", \"mb_per_sec\": " << mb_per_sec()
+       << '}';
+  }
+
+  void text(std::ostream& os) const
+  {
+    os << std::left << std::setw(14) << stage << std::right
+       << " routes=" << std::setw(6) << n_routes
+       << " bytes=" << std::setw(8) << input_bytes
+       << std::fixed << std::setprecision(1)
+       << " us/op=" << std::setw(10) << ns_per_op() / 1000.0
+       << " ops/s=" << std::setw(10) << ops_per_sec()
+       << " MB/s=" << std::setw(8) << mb_per_sec()
+       << std::defaultfloat << std::endl;
+  }
+};
+
+// Call func repeatedly for at least min_ms, and at least 3 times.
+template <typename F>
+static Result measure(const std::string& stage,
+		      const Input& in,
+		      const size_t input_bytes,
+		      const unsigned int min_ms,
+		      F func)
+{
+  typedef std::chrono::steady_clock clock;
+
+  func(); // warm up, and fail early on a bad input
+
+  Result r;
+  r.stage = stage;
+  r.n_routes = in.n_routes;
+  r.input_bytes = input_bytes;
+  const clock::time_point t0 = clock::now();
+  const clock::time_point until = t0 + std::chrono::milliseconds(min_ms);
+  clock::time_point t1;
+  do {
+    func();
+    ++r.iter;
+    t1 = clock::now();
+  } while (t1 < until || r.iter < 3);
+  r.sec = std::chrono::duration<double>(t1 - t0).count();
+  return r;
+}
+
+static void run(const Keys& keys,
+		const unsigned int n_routes,
+		const unsigned int min_ms,
+		std::vector<Result>& results)
+{
+  const Input in(keys, n_routes);
+
+  results.push_back(measure("merge", in, in.profile.size(), min_ms, [&]() {
+	ProfileMergeFromString pm(in.profile, "", ProfileMerge::FOLLOW_NONE,
+				  ProfileParseLimits::MAX_LINE_SIZE, 64*1024*1024);
+	if (pm.status() != ProfileMerge::MERGE_SUCCESS)
+	  OPENVPN_THROW_EXCEPTION("merge: " << pm.status_string() << ": " << pm.error());
+      }));
+
+  results.push_back(measure("parse_config", in, in.profile.size(), min_ms, [&]() {
+	OptionList::Limits lim(bench_limits());
+	OptionList opt;
+	opt.parse_from_config(in.profile, &lim);
+	opt.update_map();
+      }));
+
+  results.push_back(measure("push_reply", in, in.push_reply.size(), min_ms, [&]() {
+	OptionList::Limits lim(bench_limits());
+	OptionList opt;
+	opt.parse_from_csv(in.push_reply, &lim);
+	opt.update_map();
+      }));
+
+  // ClientOptions consumes an already parsed profile, as in
+  // OpenVPNClient::connect
+  OptionList options;
+  {
+    OptionList::Limits lim(bench_limits());
+    options.parse_from_config(in.profile, &lim);
+    options.update_map();
+  }
+  results.push_back(measure("client_options", in, in.profile.size(), min_ms, [&]() {
+	ClientOptions::Config cc;
+	cc.cli_stats.reset(new SessionStats());
+	cc.cli_events.reset(new NullEvents());
+	cc.proto_context_options.reset(new ProtoContextOptions());
+	ClientOptions::Ptr co(new ClientOptions(options, cc));
+      }));
+
+  const size_t pem_bytes = keys.ca.size() + keys.cert.size() + keys.key.size();
+  results.push_back(measure("pem", in, pem_bytes, min_ms, [&]() {
+#if defined(USE_OPENSSL)
+	OpenSSLPKI::X509 ca(keys.ca, "ca");
+	OpenSSLPKI::X509 cert(keys.cert, "cert");
+	OpenSSLPKI::PKey key(keys.key, "key");
+#elif defined(USE_POLARSSL)
+	PolarSSLPKI::X509Cert ca(keys.ca, "ca", false);
+	PolarSSLPKI::X509Cert cert(keys.cert, "cert", false);
+	PolarSSLPKI::PKContext key(keys.key, "key", "");
+#endif
+      }));
+}
+
+static std::vector<unsigned int> parse_list(const std::string& arg)
+{
+  std::vector<unsigned int> ret;
+  for (const auto &s : Split::by_char<std::vector<std::string>, NullLex, Split::NullLimit>(arg, ','))
+    ret.push_back(std::atoi(s.c_str()));
+  return ret;
+}
+
+static void usage()
+{
+  std::cerr << "usage: parsebench [options]" << std::endl
+	    << "  --keys DIR         ca.crt, client.crt and client.key to inline (../ssl)" << std::endl
+	    << "  --routes N,M,...   route lines per profile (10,1000,10000)" << std::endl
+	    << "  --ms N             minimum milliseconds per measurement (" << MIN_MS << ')' << std::endl
+	    << "  --format F         text, json or csv (text)" << std::endl
+	    << "  --out FILE         write results to FILE rather than stdout" << std::endl;
+}
+
+int main(int argc, char* argv[])
+{
+  enum Format {
+    TEXT,
+    JSON,
+    CSV,
+  };
+
+  // process-wide initialization
+  InitProcess::init();
+
+  std::string keys_dir = "../ssl";
+  std::vector<unsigned int> routes = { 10, 1000, 10000 };
+  unsigned int min_ms = MIN_MS;
+  Format format = TEXT;
+  std::string out_fn;
+
+  std::vector<Result> results;
+  try {
+    for (int i = 1; i < argc; ++i)
+      {
+	const std::string opt = argv[i];
+	if (opt == "-h" || opt == "--help" || i + 1 >= argc)
+	  {
+	    usage();
+	    return 2;
+	  }
+	const std::string arg = argv[++i];
+	if (opt == "--keys")
+	  keys_dir = arg;
+	else if (opt == "--routes")
+	  routes = parse_list(arg);
+	else if (opt == "--ms")
+	  min_ms = std::atoi(arg.c_str());
+	else if (opt == "--format")
+	  {
+	    if (arg == "text")
+	      format = TEXT;
+	    else if (arg == "json")
+	      format = JSON;
+	    else if (arg == "csv")
+	      format = CSV;
+	    else
+	      OPENVPN_THROW_EXCEPTION("unknown format: " << arg);
+	  }
+	else if (opt == "--out")
+	  out_fn = arg;
+	else
+	  {
+	    usage();
+	    return 2;
+	  }
+      }
+
+    Keys keys;
+    keys.load(keys_dir);
+    for (const auto n : routes)
+      run(keys, n, min_ms, results);
+  }
+  catch (const std::exception& e)
+    {
+      std::cerr << "Exception: " << e.what() << std::endl;
+      return 1;
+    }
+
+  std::ofstream out_file;
+  if (!out_fn.empty())
+    {
+      out_file.open(out_fn);
+      if (!out_file)
+	{
+	  std::cerr << "cannot write " << out_fn << std::endl;
+	  return 1;
+	}
+    }
+  std::ostream& out = out_fn.empty() ? std::cout : out_file;
+
+  switch (format)
+    {
+    case TEXT:
+      for (const auto &r : results)
+	r.text(out);
+      break;
+    case CSV:
+      Result::csv_header(out);
+      for (const auto &r : results)
+	r.csv(out);
+      break;
+    case JSON:
+      out << '[' << std::endl;
+      for (size_t i = 0; i < results.size(); ++i)
+	{
+	  if (i)
+	    out << ',' << std::endl;
+	  results[i].json(out);
+	}
+      out << std::endl << ']' << std::endl;
+      break;
+    }
+  return 0;
+}
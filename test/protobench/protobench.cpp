@@ -0,0 +1,690 @@
+//    OpenVPN -- An application to securely tunnel IP networks
+//               over a single port, with support for SSL/TLS-based
+//               session authentication and key exchange,
+//               packet encryption, packet authentication, and
+//               packet compression.
+//
+//    Copyright (C) 2012-2016 OpenVPN Technologies, Inc.
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU Affero General Public License Version 3
+//    as published by the Free Software Foundation.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU Affero General Public License for more details.
+//
+//    You should have received a copy of the GNU Affero General Public License
+//    along with this program in the COPYING file.
+//    If not, see <http://www.gnu.org/licenses/>.
+
+// Microbenchmarks for the per-packet protocol building blocks:
+// replay windows, the reliability layer and its ACK lists, TCP
+// stream framing, MemQStream and ProtoContext::PacketType, driven
+// with in-order, reordered, lossy and fragmented patterns.
+// Reports ns/op and heap allocations/op.
+
+#include <iostream>
+#include <iomanip>
+#include <string>
+#include <vector>
+#include <deque>
+#include <chrono>
+#include <random>
+#include <new>
+#include <algorithm>
+#include <cstring>
+#include <cstdlib>
+
+#include <openvpn/common/platform.hpp>
+
+#define OPENVPN_LOG_SSL(x) // disable
+
+#include <openvpn/log/logsimple.hpp>
+
+#include <openvpn/common/exception.hpp>
+#include <openvpn/common/file.hpp>
+#include <openvpn/time/time.hpp>
+#include <openvpn/frame/frame_init.hpp>
+#include <openvpn/frame/memq_stream.hpp>
+#include <openvpn/log/sessionstats.hpp>
+#include <openvpn/crypto/packet_id.hpp>
+#include <openvpn/reliable/relsend.hpp>
+#include <openvpn/reliable/relrecv.hpp>
+#include <openvpn/reliable/relack.hpp>
+#include <openvpn/transport/pktstream.hpp>
+#include <openvpn/ssl/sslchoose.hpp>
+#include <openvpn/ssl/proto.hpp>
+#include <openvpn/crypto/cryptodcsel.hpp>
+#include <openvpn/init/initprocess.hpp>
+
+// operations per measurement
+#ifndef N_OPS
+#define N_OPS 1000000
+#endif
+
+using namespace openvpn;
+
+// Count heap allocations, so that each benchmark can report
+// allocations/op.  The benchmarks are single-threaded.
+static size_t n_allocs = 0;
+
+void* operator new(std::size_t size)
+{
+  ++n_allocs;
+  void* p = std::malloc(size ? size : 1);
+  if (!p)
+    throw std::bad_alloc();
+  return p;
+}
+
+void operator delete(void* p) noexcept
+{
+  std::free(p);
+}
+
+enum Format {
+  TEXT,
+  JSON,
+  CSV,
+};
+
+class Meter
+{
+public:
+  typedef std::chrono::steady_clock clock;
+
+  void start()
+  {
+    a0 = n_allocs;
+    t0 = clock::now();
+  }
+
+  void stop(const size_t ops)
+  {
+    const clock::time_point t1 = clock::now();
+    ns += std::chrono::duration_cast<std::chrono::nanoseconds>(t1 - t0).count();
+    allocs += n_allocs - a0;
+    n_ops += ops;
+  }
+
+  double ns_per_op() const
+  {
+    return n_ops ? double(ns) / double(n_ops) : 0.0;
+  }
+
+  double allocs_per_op() const
+  {
+    return n_ops ? double(allocs) / double(n_ops) : 0.0;
+  }
+
+  size_t ops() const { return n_ops; }
+
+private:
+  clock::time_point t0;
+  size_t a0 = 0;
+  std::uint64_t ns = 0;
+  size_t allocs = 0;
+  size_t n_ops = 0;
+};
+
+class Report
+{
+public:
+  Report(const Format format_arg)
+    : format(format_arg)
+  {
+    if (format == CSV)
+      std::cout << "bench,pattern,ops,ns_per_op,allocs_per_op" << std::endl;
+    else if (format == JSON)
+      std::cout << '[' << std::endl;
+  }
+
+  ~Report()
+  {
+    if (format == JSON)
+      std::cout << std::endl << ']' << std::endl;
+  }
+
+  void add(const std::string& bench, const std::string& pattern, const Meter& m)
+  {
+    switch (format)
+      {
+      case TEXT:
+	std::cout << std::left << std::setw(16) << bench
+		  << std::setw(12) << pattern << std::right
+		  << std::fixed << std::setprecision(1)
+		  << std::setw(10) << m.ns_per_op() << " ns/op"
+		  << std::setprecision(3)
+		  << std::setw(9) << m.allocs_per_op() << " allocs/op"
+		  << std::defaultfloat << std::endl;
+	break;
+      case CSV:
+	std::cout << bench << ',' << pattern << ',' << m.ops() << ','
+		  << m.ns_per_op() << ',' << m.allocs_per_op() << std::endl;
+	break;
+      case JSON:
+	if (n_results)
+	  std::cout << ',' << std::endl;
+	std::cout << "  {\"bench\": \"" << bench << '"'
+		  << ", \"pattern\": \"" << pattern << '"'
+		  << ", \"ops\": " << m.ops()
+		  << ", \"ns_per_op\": " << m.ns_per_op()
+		  << ", \"allocs_per_op\": " << m.allocs_per_op()
+		  << '}';
+	break;
+      }
+    ++n_results;
+  }
+
+private:
+  const Format format;
+  size_t n_results = 0;
+};
+
+// Arrival patterns of packet IDs
+static const char *id_patterns[] = { "inorder", "reorder", "loss+dup" };
+
+static std::vector<PacketID> id_sequence(const std::string& pattern, const size_t n)
+{
+  std::mt19937 rng(1);
+  std::vector<PacketID> ret;
+  ret.reserve(n + n / 50);
+  PacketID pid;
+  pid.time = 0;
+  for (PacketID::id_t id = 1; ret.size() < n; ++id)
+    {
+      pid.id = id;
+      if (pattern == "loss+dup")
+	{
+	  const unsigned int r = rng() % 100;
+	  if (r == 0)
+	    continue;            // 1% lost
+	  if (r == 1)
+	    ret.push_back(pid);  // 1% duplicated
+	}
+      ret.push_back(pid);
+    }
+  ret.resize(n);
+  if (pattern == "reorder")
+    {
+      // shuffle within blocks of 16, as multi-path or parallel
+      // decryption would
+      for (size_t i = 0; i + 16 <= n; i += 16)
+	std::shuffle(ret.begin() + i, ret.begin() + i + 16, rng);
+    }
+  return ret;
+}
+
+template <typename PIDRECV>
+static void bench_replay(Report& report, const std::string& name)
+{
+  SessionStats::Ptr stats(new SessionStats());
+  for (const char *pattern : id_patterns)
+    {
+      const std::vector<PacketID> seq = id_sequence(pattern, N_OPS);
+      PIDRECV recv;
+      recv.init(PIDRECV::UDP_MODE, PacketID::SHORT_FORM, "DATA", 0, stats);
+      Meter m;
+      size_t ok = 0;
+      m.start();
+      for (const auto &pid : seq)
+	ok += recv.test_add(pid, 0, true);
+      m.stop(seq.size());
+      if (!ok)
+	OPENVPN_THROW_EXCEPTION(name << ": no packets accepted");
+      report.add(name, pattern, m);
+    }
+}
+
+static void bench_replay_shared(Report& report)
+{
+  for (const char *pattern : id_patterns)
+    {
+      const std::vector<PacketID> seq = id_sequence(pattern, N_OPS);
+      PacketIDReceiveShared::Ptr recv(new PacketIDReceiveShared());
+      Meter m;
+      size_t ok = 0;
+      m.start();
+      for (const auto &pid : seq)
+	ok += recv->do_test_add(pid) == Error::SUCCESS;
+      m.stop(seq.size());
+      if (!ok)
+	OPENVPN_THROW_EXCEPTION("pid-shared: no packets accepted");
+      report.add("pid-shared", pattern, m);
+    }
+}
+
+// What the reliability layer carries, like ProtoContext::Packet
+struct RelPacket
+{
+  RelPacket() {}
+  explicit RelPacket(const BufferPtr& b) : buf(b) {}
+
+  explicit operator bool() const { return bool(buf); }
+  const Buffer& buffer() const { return *buf; }
+  void reset() { buf.reset(); }
+
+  BufferPtr buf;
+};
+
+typedef ReliableSendTemplate<RelPacket> RelSend;
+typedef ReliableRecvTemplate<RelPacket> RelRecv;
+
+// Move n_msgs control messages from a sender to a receiver through a
+// simulated network that loses loss_pct percent of packets (ACKs
+// included) and delivers each flight in random order.  Reports cost
+// per delivered message, covering send, receive, sequencing, ACK
+// list prepend/parse, and retransmission.
+static void bench_reliable(Report& report, const std::string& pattern,
+			   const unsigned int loss_pct, const bool reorder)
+{
+  enum {
+    WINDOW = 8,
+    MAX_ACK_LIST = 4,
+    MSG_SIZE = 1250,
+  };
+
+  const size_t n_msgs = N_OPS / 10;
+  const Time::Duration tls_timeout = Time::Duration::seconds(2);
+  const Time::Duration step = Time::Duration::binary_ms(50);
+  Frame::Ptr frame(frame_init(true, 1500, 1024, false));
+  const Frame::Context& fc = (*frame)[Frame::WRITE_SSL_CLEARTEXT];
+  std::mt19937 rng(1);
+
+  RelSend send(WINDOW);
+  RelRecv recv(WINDOW);
+  ReliableAck acks(MAX_ACK_LIST);
+  std::vector<std::pair<RelSend::id_t, RelPacket>> wire;
+  std::vector<unsigned char> payload(MSG_SIZE, 'x');
+  BufferAllocated ackbuf;
+  Time now = Time::now();
+  size_t delivered = 0;
+
+  auto transmit = [&](const RelSend::id_t id, const RelPacket& pkt) {
+    if (rng() % 100 >= loss_pct)
+      wire.emplace_back(id, pkt);
+  };
+
+  Meter m;
+  m.start();
+  while (delivered < n_msgs)
+    {
+      // fill the send window
+      while (send.ready())
+	{
+	  RelSend::Message& msg = send.send(now, tls_timeout);
+	  BufferPtr b(new BufferAllocated());
+	  fc.prepare(*b);
+	  b->write(payload.data(), payload.size());
+	  msg.packet = RelPacket(b);
+	  transmit(msg.id(), msg.packet);
+	}
+
+      // deliver this flight
+      if (reorder)
+	std::shuffle(wire.begin(), wire.end(), rng);
+      for (auto &w : wire)
+	{
+	  if (recv.receive(w.second, w.first) & RelRecv::ACK_TO_SENDER)
+	    acks.push_back(w.first);
+	}
+      wire.clear();
+      while (recv.ready())
+	{
+	  recv.next_sequenced().packet.reset();
+	  recv.advance();
+	  ++delivered;
+	}
+
+      // return ACKs, MAX_ACK_LIST per packet
+      while (!acks.empty())
+	{
+	  fc.prepare(ackbuf);
+	  acks.prepend(ackbuf);
+	  if (rng() % 100 >= loss_pct)
+	    ReliableAck::ack(send, ackbuf, true, now);
+	}
+
+      // retransmit
+      now += step;
+      for (RelSend::id_t i = send.head_id(); i < send.tail_id(); ++i)
+	{
+	  RelSend::Message& msg = send.ref_by_id(i);
+	  if (msg.ready_retransmit(now))
+	    {
+	      transmit(msg.id(), msg.packet);
+	      send.retransmitted(msg, now, tls_timeout);
+	    }
+	}
+    }
+  m.stop(delivered);
+  report.add("reliable", pattern, m);
+}
+
+// Prepend and parse ACK lists of 1 and MAX_ACK_LIST IDs
+static void bench_relack(Report& report)
+{
+  Frame::Ptr frame(frame_init(true, 1500, 1024, false));
+  const Frame::Context& fc = (*frame)[Frame::WRITE_SSL_CLEARTEXT];
+  for (const size_t n_ids : { size_t(1), size_t(4) })
+    {
+      ReliableAck out(4);
+      ReliableAck in(4);
+      BufferAllocated buf;
+      RelSend::id_t id = 0;
+      Meter m;
+      m.start();
+      for (size_t i = 0; i < N_OPS; ++i)
+	{
+	  for (size_t j = 0; j < n_ids; ++j)
+	    out.push_back(++id);
+	  fc.prepare(buf);
+	  out.prepend(buf);
+	  in.read(buf);
+	  while (!in.empty())
+	    in.pop_front();
+	}
+      m.stop(N_OPS);
+      report.add("relack", std::to_string(n_ids) + "-ids", m);
+    }
+}
+
+// TCP byte stream of IMIX packets with 16-bit length prefixes
+static std::vector<unsigned char> tcp_stream(const size_t n_packets)
+{
+  static const size_t imix[] = { 64, 64, 64, 64, 64, 64, 64, 576, 576, 576, 576, 1500 };
+  std::vector<unsigned char> ret;
+  for (size_t i = 0; i < n_packets; ++i)
+    {
+      const size_t size = imix[i % (sizeof(imix) / sizeof(imix[0]))];
+      ret.push_back((unsigned char)(size >> 8));
+      ret.push_back((unsigned char)(size & 0xFF));
+      ret.insert(ret.end(), size, (unsigned char)i);
+    }
+  return ret;
+}
+
+// read sizes that chop a stream up like recv() would
+static std::vector<size_t> read_sizes(const std::string& pattern, const size_t total)
+{
+  std::mt19937 rng(1);
+  std::vector<size_t> ret;
+  size_t pos = 0;
+  while (pos < total)
+    {
+      size_t n;
+      if (pattern == "coalesced")
+	n = 16384;
+      else if (pattern == "fragmented")
+	n = 1 + rng() % 1500;
+      else // "split-hdr", worst case with lengths straddling reads
+	n = 1 + rng() % 3;
+      n = std::min(n, total - pos);
+      ret.push_back(n);
+      pos += n;
+    }
+  return ret;
+}
+
+static const char *stream_patterns[] = { "coalesced", "fragmented", "split-hdr" };
+
+static void bench_pktstream(Report& report)
+{
+  const size_t n_packets = N_OPS / 10;
+  const std::vector<unsigned char> stream = tcp_stream(n_packets);
+  Frame::Ptr frame(frame_init_simple(16384)); // room for a coalesced read
+  const Frame::Context& fc = (*frame)[Frame::READ_LINK_TCP];
+
+  for (const char *pattern : stream_patterns)
+    {
+      const std::vector<size_t> reads = read_sizes(pattern, stream.size());
+
+      // PacketStream, as used by TCPLink
+      {
+	PacketStream ps;
+	BufferAllocated buf;
+	BufferAllocated pkt;
+	size_t pos = 0;
+	size_t got = 0;
+	Meter m;
+	m.start();
+	for (const size_t n : reads)
+	  {
+	    fc.prepare(buf);
+	    buf.write(stream.data() + pos, n);
+	    pos += n;
+	    while (buf.size())
+	      {
+		ps.put(buf, fc);
+		if (ps.ready())
+		  {
+		    ps.get(pkt);
+		    ++got;
+		  }
+	      }
+	  }
+	m.stop(got);
+	if (got != n_packets)
+	  OPENVPN_THROW_EXCEPTION("pktstream: got " << got << " of " << n_packets << " packets");
+	report.add("pktstream", pattern, m);
+      }
+
+      // PacketStreamRing, reading straight into the ring
+      {
+	PacketStreamRing ring(65536, fc);
+	BufferAllocated pkt;
+	size_t pos = 0;
+	size_t got = 0;
+	Meter m;
+	m.start();
+	for (const size_t n : reads)
+	  {
+	    std::memcpy(ring.write_ptr(), stream.data() + pos, n);
+	    ring.commit(n);
+	    pos += n;
+	    while (ring.lend(pkt))
+	      {
+		++got;
+		ring.reclaim(pkt);
+	      }
+	  }
+	m.stop(got);
+	if (got != n_packets)
+	  OPENVPN_THROW_EXCEPTION("pktring: got " << got << " of " << n_packets << " packets");
+	report.add("pktring", pattern, m);
+      }
+    }
+}
+
+// TLS records through the MemQStream between the SSL library and
+// the reliability layer, read back in link-sized or large chunks
+static void bench_memq(Report& report)
+{
+  Frame::Ptr frame(frame_init(true, 1500, 1024, false));
+  std::vector<unsigned char> record(1400, 'r');
+  std::vector<unsigned char> out(16384);
+  for (const size_t read_size : { size_t(1024), size_t(16384) })
+    {
+      MemQStream q(frame);
+      const size_t n_records = N_OPS / 10;
+      size_t bytes = 0;
+      Meter m;
+      m.start();
+      for (size_t i = 0; i < n_records; ++i)
+	{
+	  q.write(record.data(), record.size());
+	  while (q.pending() >= read_size)
+	    bytes += q.read(out.data(), read_size);
+	}
+      while (q.pending())
+	bytes += q.read(out.data(), read_size);
+      m.stop(n_records);
+      if (bytes != n_records * record.size())
+	OPENVPN_THROW_EXCEPTION("memq: lost data");
+      report.add("memq", "read-" + std::to_string(read_size), m);
+    }
+}
+
+// Client ProtoContext, reset so that key_id 0 is primary.  Only
+// used to classify incoming packets.
+class BenchProto : public ProtoContext
+{
+public:
+  BenchProto(const Config::Ptr& config, const SessionStats::Ptr& stats)
+    : ProtoContext(config, stats)
+  {
+    reset();
+  }
+
+  // incoming packet mix: mostly data, some control and ACKs,
+  // and packets for an unknown key or with a bad opcode
+  static std::vector<BufferAllocated> packet_mix()
+  {
+    std::vector<BufferAllocated> ret;
+    for (unsigned int i = 0; i < 100; ++i)
+      {
+	unsigned char pkt[64];
+	std::memset(pkt, 0, sizeof(pkt));
+	size_t size = sizeof(pkt);
+	if (i < 80)
+	  {
+	    const std::uint32_t op32 = htonl(op32_compose(DATA_V2, 0, 100));
+	    std::memcpy(pkt, &op32, sizeof(op32));
+	  }
+	else if (i < 85)
+	  pkt[0] = op_compose(DATA_V1, 0);
+	else if (i < 90)
+	  pkt[0] = op_compose(ACK_V1, 0);
+	else if (i < 95)
+	  pkt[0] = op_compose(CONTROL_V1, 0);
+	else if (i < 98)
+	  pkt[0] = op_compose(DATA_V2, 3); // unknown key
+	else
+	  {
+	    pkt[0] = 0xFF; // bad opcode
+	    size = 1;
+	  }
+	ret.emplace_back(pkt, size, 0);
+      }
+    return ret;
+  }
+
+private:
+  virtual void control_net_send(const Buffer& net_buf) {}
+  virtual void control_recv(BufferPtr&& app_bp) {}
+};
+
+static void bench_packet_type(Report& report, const std::string& keys_dir)
+{
+  Frame::Ptr frame(frame_init(true, 1500, 1024, false));
+  RandomAPI::Ptr rng(new SSLLib::RandomAPI(false));
+  RandomAPI::Ptr prng(new SSLLib::RandomAPI(true));
+  SessionStats::Ptr stats(new SessionStats());
+  Time now = Time::now();
+
+  SSLLib::SSLAPI::Config::Ptr cc(new SSLLib::SSLAPI::Config());
+  cc->set_mode(Mode(Mode::CLIENT));
+  cc->set_frame(frame);
+  cc->load_ca(read_text(keys_dir + "/ca.crt"), true);
+  cc->load_cert(read_text(keys_dir + "/client.crt"));
+  cc->load_private_key(read_text(keys_dir + "/client.key"));
+  cc->set_rng(rng);
+
+  ProtoContext::Config::Ptr cp(new ProtoContext::Config);
+  cp->ssl_factory = cc->new_factory();
+  cp->dc.set_factory(new CryptoDCSelect<SSLLib::CryptoAPI>(frame, stats, prng));
+  cp->tlsprf_factory.reset(new CryptoTLSPRFFactory<SSLLib::CryptoAPI>());
+  cp->frame = frame;
+  cp->now = &now;
+  cp->rng = rng;
+  cp->prng = prng;
+  cp->protocol = Protocol(Protocol::UDPv4);
+  cp->layer = Layer(Layer::OSI_LAYER_3);
+  cp->enable_op32 = true;
+  cp->remote_peer_id = 100;
+  cp->reliable_window = 4;
+  cp->max_ack_list = 4;
+  cp->pid_mode = PacketIDReceive::UDP_MODE;
+
+  BenchProto proto(cp, stats);
+  const std::vector<BufferAllocated> mix = BenchProto::packet_mix();
+  size_t n_data = 0;
+  Meter m;
+  m.start();
+  for (size_t i = 0; i < N_OPS; ++i)
+    {
+      const ProtoContext::PacketType t = proto.packet_type(mix[i % mix.size()]);
+      n_data += t.is_data();
+    }
+  m.stop(N_OPS);
+  if (!n_data)
+    OPENVPN_THROW_EXCEPTION("packet_type: no data packets recognized");
+  report.add("packet_type", "mix", m);
+}
+
+static void usage()
+{
+  std::cerr << "usage: protobench [options]" << std::endl
+	    << "  --keys DIR         ca.crt, client.crt and client.key (../ssl)" << std::endl
+	    << "  --format F         text, json or csv (text)" << std::endl;
+}
+
+int main(int argc, char* argv[])
+{
+  // process-wide initialization
+  InitProcess::init();
+
+  std::string keys_dir = "../ssl";
+  Format format = TEXT;
+
+  try {
+    for (int i = 1; i < argc; ++i)
+      {
+	const std::string opt = argv[i];
+	if (i + 1 >= argc)
+	  {
+	    usage();
+	    return 2;
+	  }
+	const std::string arg = argv[++i];
+	if (opt == "--keys")
+	  keys_dir = arg;
+	else if (opt == "--format")
+	  {
+	    if (arg == "text")
+	      format = TEXT;
+	    else if (arg == "json")
+	      format = JSON;
+	    else if (arg == "csv")
+	      format = CSV;
+	    else
+	      OPENVPN_THROW_EXCEPTION("unknown format: " << arg);
+	  }
+	else
+	  {
+	    usage();
+	    return 2;
+	  }
+      }
+
+    Report report(format);
+    bench_replay<PacketIDReceiveType<8, 30>>(report, "pid-bytes");
+    bench_replay<PacketIDReceiveWordType<7, 30>>(report, "pid-words");
+    bench_replay_shared(report);
+    bench_reliable(report, "clean", 0, false);
+    bench_reliable(report, "reorder", 0, true);
+    bench_reliable(report, "loss-5%", 5, true);
+    bench_relack(report);
+    bench_pktstream(report);
+    bench_memq(report);
+    bench_packet_type(report, keys_dir);
+  }
+  catch (const std::exception& e)
+    {
+      std::cerr << "Exception: " << e.what() << std::endl;
+      return 1;
+    }
+  return 0;
+}
@@ -0,0 +1,1042 @@
+//    OpenVPN -- An application to securely tunnel IP networks
+//               over a single port, with support for SSL/TLS-based
+//               session authentication and key exchange,
+//               packet encryption, packet authentication, and
+//               packet compression.
+//
+//    Copyright (C) 2012-2016 OpenVPN Technologies, Inc.
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU Affero General Public License Version 3
+//    as published by the Free Software Foundation.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU Affero General Public License for more details.
+//
+//    You should have received a copy of the GNU Affero General Public License
+//    along with this program in the COPYING file.
+//    If not, see <http://www.gnu.org/licenses/>.
+
+// In-process scale simulator for the server side of the protocol.
+// Like test/ssl/proto.cpp it runs client and server ProtoContext
+// objects against each other over an in-memory wire under virtual
+// time, but with up to 100k synthetic clients behind one simulated
+// server socket.  The server dispatches through PeerIDTable and
+// PeerAddrTable as the real transports do.  Reports heap per
+// session, CPU per handshake and per data packet, the cost of
+// servicing session timers, and how the server lookup tables and
+// timers scale with the number of sessions.
+
+#include <iostream>
+#include <iomanip>
+#include <string>
+#include <vector>
+#include <memory>
+#include <chrono>
+#include <random>
+#include <new>
+#include <algorithm>
+#include <cstring>
+#include <cstdlib>
+#include <cstdint>
+
+#include <openvpn/common/platform.hpp>
+
+#define OPENVPN_LOG_SSL(x) // disable
+
+#include <openvpn/log/logsimple.hpp>
+
+#include <openvpn/common/exception.hpp>
+#include <openvpn/common/file.hpp>
+#include <openvpn/common/rc.hpp>
+#include <openvpn/time/time.hpp>
+#include <openvpn/time/asiotimer.hpp>
+#include <openvpn/time/timerwheel.hpp>
+#include <openvpn/frame/frame_init.hpp>
+#include <openvpn/addr/ip.hpp>
+#include <openvpn/addr/route.hpp>
+#include <openvpn/ssl/sslchoose.hpp>
+#include <openvpn/ssl/proto.hpp>
+#include <openvpn/crypto/cryptodcsel.hpp>
+#include <openvpn/crypto/ovpnhmac.hpp>
+#include <openvpn/server/peeridtable.hpp>
+#include <openvpn/server/peeraddrtable.hpp>
+#include <openvpn/server/vpnservfib.hpp>
+#include <openvpn/init/initprocess.hpp>
+
+#include "../common/testkeys.hpp"
+
+#ifdef USE_OPENSSL
+#include <openssl/crypto.h>
+#endif
+
+// default number of simulated sessions
+#ifndef N_SESSIONS
+#define N_SESSIONS 100000
+#endif
+
+// operations per microbenchmark measurement
+#ifndef N_OPS
+#define N_OPS 1000000
+#endif
+
+using namespace openvpn;
+
+// Heap accounting.  Each allocation carries a header recording its
+// size and the arena that was current when it was made, so memory
+// can be charged to the server sessions, the synthetic clients or
+// the simulator itself even though all three run interleaved on one
+// thread.  Frees are credited back to the arena that allocated.
+enum Arena {
+  SIM,
+  CLIENT,
+  SERVER,
+  N_ARENAS,
+};
+
+static int cur_arena = SIM;
+static size_t live_bytes[N_ARENAS];
+static size_t peak_bytes[N_ARENAS];
+
+static constexpr size_t HDR = 16; // preserves malloc alignment
+
+static void* tracked_malloc(const size_t size)
+{
+  unsigned char* p = (unsigned char*)std::malloc(size + HDR);
+  if (!p)
+    return nullptr;
+  ((size_t*)p)[0] = size;
+  ((size_t*)p)[1] = cur_arena;
+  live_bytes[cur_arena] += size;
+  if (live_bytes[cur_arena] > peak_bytes[cur_arena])
+    peak_bytes[cur_arena] = live_bytes[cur_arena];
+  return p + HDR;
+}
+
+static void tracked_free(void* ptr)
+{
+  if (!ptr)
+    return;
+  unsigned char* p = (unsigned char*)ptr - HDR;
+  live_bytes[((size_t*)p)[1]] -= ((size_t*)p)[0];
+  std::free(p);
+}
+
+// the new block is charged to the current arena
+static void* tracked_realloc(void* ptr, const size_t size)
+{
+  if (!ptr)
+    return tracked_malloc(size);
+  void* q = tracked_malloc(size);
+  if (!q)
+    return nullptr;
+  const size_t old = ((size_t*)((unsigned char*)ptr - HDR))[0];
+  std::memcpy(q, ptr, std::min(old, size));
+  tracked_free(ptr);
+  return q;
+}
+
+void* operator new(std::size_t size)
+{
+  void* p = tracked_malloc(size ? size : 1);
+  if (!p)
+    throw std::bad_alloc();
+  return p;
+}
+
+void operator delete(void* p) noexcept
+{
+  tracked_free(p);
+}
+
+// Route the SSL library heap through the same accounting, so that
+// per-session SSL state shows up in the session cost.  Must run
+// before the library makes its first allocation.
+#if defined(USE_OPENSSL) && OPENSSL_VERSION_NUMBER >= 0x10100000L
+static void* ssl_malloc(size_t n, const char*, int) { return tracked_malloc(n); }
+static void* ssl_realloc(void* p, size_t n, const char*, int) { return tracked_realloc(p, n); }
+static void ssl_free(void* p, const char*, int) { tracked_free(p); }
+#elif defined(USE_OPENSSL)
+static void* ssl_malloc(size_t n) { return tracked_malloc(n); }
+static void* ssl_realloc(void* p, size_t n) { return tracked_realloc(p, n); }
+static void ssl_free(void* p) { tracked_free(p); }
+#endif
+
+static bool hook_ssl_heap()
+{
+#ifdef USE_OPENSSL
+  return CRYPTO_set_mem_functions(ssl_malloc, ssl_realloc, ssl_free) != 0;
+#else
+  return false;
+#endif
+}
+
+// Charge the allocations and elapsed time of a scope to an arena
+// and a nanosecond counter.
+class Charge
+{
+public:
+  typedef std::chrono::steady_clock clock;
+
+  Charge(const Arena arena, std::uint64_t& ns_arg)
+    : saved(cur_arena),
+      ns(ns_arg),
+      t0(clock::now())
+  {
+    cur_arena = arena;
+  }
+
+  ~Charge()
+  {
+    ns += std::chrono::duration_cast<std::chrono::nanoseconds>(clock::now() - t0).count();
+    cur_arena = saved;
+  }
+
+private:
+  const int saved;
+  std::uint64_t& ns;
+  const clock::time_point t0;
+};
+
+enum Format {
+  TEXT,
+  JSON,
+  CSV,
+};
+
+class Report
+{
+public:
+  Report(const Format format_arg)
+    : format(format_arg)
+  {
+    if (format == CSV)
+      std::cout << "section,metric,value,unit" << std::endl;
+    else if (format == JSON)
+      std::cout << '[' << std::endl;
+  }
+
+  ~Report()
+  {
+    if (format == JSON)
+      std::cout << std::endl << ']' << std::endl;
+  }
+
+  void add(const std::string& section, const std::string& metric, const double value, const std::string& unit)
+  {
+    switch (format)
+      {
+      case TEXT:
+	std::cout << std::left << std::setw(12) << section
+		  << std::setw(32) << metric << std::right
+		  << std::fixed << std::setprecision(1)
+		  << std::setw(14) << value << ' ' << unit
+		  << std::defaultfloat << std::endl;
+	break;
+      case CSV:
+	std::cout << section << ',' << metric << ',' << value << ',' << unit << std::endl;
+	break;
+      case JSON:
+	if (n_results)
+	  std::cout << ',' << std::endl;
+	std::cout << "  {\"section\": \"" << section << '"'
+		  << ", \"metric\": \"" << metric << '"'
+		  << ", \"value\": " << value
+		  << ", \"unit\": \"" << unit << "\"}";
+	break;
+      }
+    ++n_results;
+  }
+
+private:
+  const Format format;
+  size_t n_results = 0;
+};
+
+struct SimConfig
+{
+  size_t sessions = N_SESSIONS;
+  size_t concurrency = 1000;            // handshakes in flight
+  unsigned int tick_ms = 50;            // virtual time step
+  unsigned int latency_ms = 20;         // one-way, rounded up to a tick
+  unsigned int loss_pct = 0;            // both directions
+  unsigned int duration = 30;           // virtual seconds of data phase
+  unsigned int interval_ms = 1000;      // per-client data packet interval
+  size_t payload = 1000;
+  std::string keys_dir = "../ssl";
+  Format format = TEXT;
+  bool sim = true;
+  bool micro = true;
+};
+
+// Synthetic source endpoint of client index, 16 clients per address
+template <typename TABLE>
+static typename TABLE::Key endpoint(const size_t index)
+{
+  const std::uint32_t addr = htonl(0x0A000000 + std::uint32_t(index >> 4));
+  const std::uint16_t port = htons(std::uint16_t(20000 + (index & 15)));
+  return typename TABLE::Key((const std::uint8_t *)&addr, false, port);
+}
+
+class Sim;
+
+// One end of a simulated session.  Control packets go straight onto
+// the simulated link rather than into a per-session queue, so the
+// server side holds only what a real session would.
+class SimProto : public ProtoContext, public RC<thread_unsafe_refcount>
+{
+public:
+  typedef RCPtr<SimProto> Ptr;
+
+  SimProto(const ProtoContext::Config::Ptr& config,
+	   const SessionStats::Ptr& stats,
+	   Sim& sim_arg,
+	   const size_t index_arg,
+	   const bool server_arg)
+    : ProtoContext(config, stats),
+      sim(sim_arg),
+      index_(index_arg),
+      server(server_arg)
+  {
+  }
+
+  static bool is_hard_reset(const Buffer& buf)
+  {
+    return buf.size() && opcode_extract(buf[0]) == CONTROL_HARD_RESET_CLIENT_V2;
+  }
+
+  size_t index() const { return index_; }
+
+  int peer_id = -1;
+
+private:
+  virtual void control_net_send(const Buffer& net_buf) override;
+
+  virtual void control_recv(BufferPtr&& app_bp) override
+  {
+  }
+
+  virtual void active() override;
+
+  Sim& sim;
+  const size_t index_;
+  const bool server;
+};
+
+class Sim
+{
+public:
+  typedef PeerIDTable<SimProto> PeerIDs;
+  typedef PeerAddrTable<SimProto> PeerAddrs;
+
+  Sim(const SimConfig& cfg_arg, Report& report_arg)
+    : cfg(cfg_arg),
+      report(report_arg),
+      now(Time::now()),
+      tick(Time::Duration::milliseconds(cfg.tick_ms)),
+      latency(Time::Duration::milliseconds(cfg.latency_ms)),
+      interval(Time::Duration::milliseconds(cfg.interval_ms)),
+      frame(frame_init(true, 1500, 1024, false)),
+      rng(new SSLLib::RandomAPI(false)),
+      prng(new SSLLib::RandomAPI(true)),
+      cli_stats(new SessionStats()),
+      serv_stats(new SessionStats()),
+      noise(1),
+      payload(cfg.payload, 'x'),
+      tls_auth_key(read_text(cfg.keys_dir + "/tls-auth.key"))
+  {
+    client_ssl = TestKeys::client_ssl(cfg.keys_dir, frame, rng);
+    {
+      Charge c(SERVER, server_setup_ns);
+      server_config = new_config(false);
+      by_peer_id.reset(new PeerIDs(cfg.sessions));
+      by_addr.reset(new PeerAddrs(*rng, cfg.sessions));
+    }
+    clients.resize(cfg.sessions);
+  }
+
+  void run()
+  {
+    const size_t server_base = live_bytes[SERVER];
+    const size_t client_base = live_bytes[CLIENT];
+
+    // bring every session up
+    while (next < cfg.sessions || n_pending)
+      {
+	while (next < cfg.sessions && n_pending < cfg.concurrency)
+	  start_client(next++);
+	round(false);
+      }
+    quiesce();
+    const size_t n = n_handshakes ? n_handshakes : 1;
+    const size_t server_bytes = live_bytes[SERVER] - server_base;
+    const size_t client_bytes = live_bytes[CLIENT] - client_base;
+
+    report.add("handshake", "sessions", double(n_handshakes), "");
+    report.add("handshake", "failed", double(n_failed), "");
+    report.add("handshake", "server cpu/handshake", double(server_ctl_ns) / n / 1000.0, "us");
+    report.add("handshake", "server handshakes/core", n_handshakes * 1e9 / std::max(server_ctl_ns, std::uint64_t(1)), "/s");
+    report.add("handshake", "client cpu/handshake", double(client_ns) / n / 1000.0, "us");
+    report.add("handshake", "virtual time/handshake", double(hs_virtual_ms) / n, "ms");
+    report.add("handshake", "virtual time total", double((now - start_time).to_binary_ms()), "ms");
+    report.add("memory", "server heap/session", double(server_bytes) / n, "bytes");
+    report.add("memory", "server peak heap/session", double(peak_bytes[SERVER] - server_base) / n, "bytes");
+    report.add("memory", "client heap/session", double(client_bytes) / n, "bytes");
+    report.add("memory", "peer-id table/session", double(by_peer_id->capacity() * sizeof(SimProto::Ptr)) / n, "bytes");
+    report.add("memory", "addr table/session", double(by_addr->memory()) / n, "bytes");
+    report.add("memory", "ssl heap counted", double(ssl_heap_counted), "bool");
+
+    // data phase
+    server_ctl_ns = server_timer_ns = 0;
+    n_timer_visits = n_timer_fired = n_rounds = 0;
+    const Time end = now + Time::Duration::seconds(cfg.duration);
+    while (now < end)
+      round(true);
+
+    const std::uint64_t n_data = std::max(n_data_rx, size_t(1));
+    report.add("data", "packets", double(n_data_rx), "");
+    report.add("data", "server cpu/packet", double(server_data_ns) / n_data, "ns");
+    report.add("data", "server packets/core", n_data_rx * 1e9 / std::max(server_data_ns, std::uint64_t(1)), "/s");
+    report.add("data", "peer-id lookups", double(n_lookup_peer_id), "");
+    report.add("data", "addr lookups", double(n_lookup_addr), "");
+    report.add("data", "sessions expired", double(n_expired), "");
+    report.add("timers", "server scan cpu/session/tick", double(server_timer_ns) / std::max(n_timer_visits, size_t(1)), "ns");
+    report.add("timers", "server scan cpu/tick", double(server_timer_ns) / std::max(n_rounds, size_t(1)) / 1000.0, "us");
+    report.add("timers", "housekeeping fired/tick", double(n_timer_fired) / std::max(n_rounds, size_t(1)), "");
+    report.add("timers", "server control cpu/tick", double(server_ctl_ns) / std::max(n_rounds, size_t(1)) / 1000.0, "us");
+  }
+
+  // called by SimProto
+  void send(const bool server, const size_t index, const Buffer& buf)
+  {
+    if (drop())
+      return;
+    Packet p;
+    p.due = now + latency;
+    p.index = index;
+    p.buf.reset(new BufferAllocated(buf, 0));
+    (server ? egress : ingress).push_back(std::move(p));
+  }
+
+  void active(const bool server, const size_t index)
+  {
+    Client& c = clients[index];
+    if (server)
+      c.server_up = true;
+    else
+      c.up = true;
+    if (c.up && c.server_up)
+      {
+	++n_handshakes;
+	--n_pending;
+	hs_virtual_ms += (now - c.started).to_binary_ms();
+	c.next_data = now + Time::Duration::milliseconds(noise() % cfg.interval_ms);
+      }
+  }
+
+  static bool ssl_heap_counted;
+
+private:
+  struct Packet
+  {
+    Time due;
+    size_t index;
+    BufferPtr buf;
+  };
+
+  struct Client
+  {
+    ProtoContext::Config::Ptr config;
+    SimProto::Ptr proto;
+    SimProto* server = nullptr; // owned by the server tables
+    Time started;
+    Time next_data;
+    bool up = false;
+    bool server_up = false;
+  };
+
+  bool drop()
+  {
+    return cfg.loss_pct && noise() % 100 < cfg.loss_pct;
+  }
+
+  ProtoContext::Config::Ptr new_config(const bool client)
+  {
+    SessionStats::Ptr stats = client ? cli_stats : serv_stats;
+    ProtoContext::Config::Ptr cp(new ProtoContext::Config);
+    if (client)
+      cp->ssl_factory = client_ssl;
+    else
+      cp->ssl_factory = TestKeys::server_ssl(cfg.keys_dir, frame, rng);
+    cp->dc.set_factory(new CryptoDCSelect<SSLLib::CryptoAPI>(frame, stats, prng));
+    cp->tlsprf_factory.reset(new CryptoTLSPRFFactory<SSLLib::CryptoAPI>());
+    cp->frame = frame;
+    cp->now = &now;
+    cp->rng = rng;
+    cp->prng = prng;
+    cp->protocol = Protocol(Protocol::UDPv4);
+    cp->layer = Layer(Layer::OSI_LAYER_3);
+    cp->enable_op32 = client;
+    cp->dc.set_cipher(CryptoAlgs::lookup("AES-256-GCM"));
+    cp->dc.set_digest(CryptoAlgs::lookup("SHA1"));
+    cp->tls_auth_factory.reset(new CryptoOvpnHMACFactory<SSLLib::CryptoAPI>());
+    cp->tls_auth_key.parse(tls_auth_key);
+    cp->set_tls_auth_digest(CryptoAlgs::lookup("SHA1"));
+    cp->key_direction = client ? 0 : 1;
+    cp->reliable_window = 4;
+    cp->max_ack_list = 4;
+    cp->pid_mode = PacketIDReceive::UDP_MODE;
+    cp->handshake_window = Time::Duration::seconds(60);
+    cp->become_primary = cp->handshake_window;
+    cp->tls_timeout = Time::Duration::seconds(2);
+    cp->renegotiate = Time::Duration::infinite();
+    cp->expire = cp->renegotiate;
+    cp->keepalive_ping = Time::Duration::seconds(10);
+    cp->keepalive_timeout = Time::Duration::seconds(60);
+    return cp;
+  }
+
+  void start_client(const size_t i)
+  {
+    Charge c(CLIENT, client_ns);
+    Client& cl = clients[i];
+    // each client needs its own config for the peer-id the server
+    // hands out, which stands in for the pushed "peer-id" option
+    cl.config = new_config(true);
+    cl.proto.reset(new SimProto(cl.config, cli_stats, *this, i, false));
+    cl.started = now;
+    cl.proto->start();
+    cl.proto->flush(true);
+    ++n_pending;
+  }
+
+  // One tick: client data and timers, deliver everything due in
+  // both directions, then service server timers.
+  void round(const bool data)
+  {
+    {
+      Charge c(CLIENT, client_ns);
+      for (size_t i = 0; i < next; ++i)
+	{
+	  Client& cl = clients[i];
+	  if (!cl.proto)
+	    continue;
+	  if (cl.proto->invalidated())
+	    {
+	      client_failed(cl);
+	      continue;
+	    }
+	  if (data && cl.up && cl.server_up && now >= cl.next_data)
+	    {
+	      send_data(i, *cl.proto);
+	      cl.next_data += interval;
+	    }
+	  if (now >= cl.proto->next_housekeeping())
+	    {
+	      cl.proto->housekeeping();
+	      cl.proto->flush(true);
+	    }
+	}
+    }
+
+    deliver_ingress(false);
+    deliver_egress(false);
+
+    {
+      Charge c(SERVER, server_timer_ns);
+      by_addr->for_each([this](SimProto* s) {
+	  ++n_timer_visits;
+	  if (now >= s->next_housekeeping())
+	    {
+	      s->housekeeping();
+	      s->flush(true);
+	      ++n_timer_fired;
+	      if (s->invalidated())
+		dead.push_back(s);
+	    }
+	});
+      for (auto *s : dead)
+	remove_server(s);
+      dead.clear();
+    }
+
+    ++n_rounds;
+    now += tick;
+  }
+
+  // deliver packets still in flight without running timers
+  void quiesce()
+  {
+    for (int i = 0; i < 16 && (!ingress.empty() || !egress.empty()); ++i)
+      {
+	now += latency;
+	deliver_ingress(true);
+	deliver_egress(true);
+      }
+  }
+
+  void send_data(const size_t i, SimProto& proto)
+  {
+    BufferPtr bp(new BufferAllocated());
+    frame->prepare(Frame::READ_LINK_UDP, *bp);
+    bp->write((const unsigned char *)payload.c_str(), payload.size());
+    proto.data_encrypt(*bp);
+    if (!bp->size() || drop())
+      return;
+    Packet p;
+    p.due = now + latency;
+    p.index = i;
+    p.buf = std::move(bp);
+    ingress.push_back(std::move(p));
+  }
+
+  // The server socket: dispatch by peer-id for P_DATA_V2, else by
+  // source endpoint, creating a session on a client hard reset.
+  void deliver_ingress(const bool all)
+  {
+    while (!ingress.empty() && (all || ingress.front().due <= now))
+      {
+	Packet p = std::move(ingress.front());
+	ingress.pop_front();
+	const int peer_id = PeerIDs::data_v2_peer_id(*p.buf);
+	if (peer_id >= 0)
+	  {
+	    Charge c(SERVER, server_data_ns);
+	    ++n_lookup_peer_id;
+	    SimProto* s = by_peer_id->lookup(peer_id);
+	    if (!s)
+	      continue;
+	    const ProtoContext::PacketType pt = s->packet_type(*p.buf);
+	    try {
+	      s->data_decrypt(pt, *p.buf);
+	    }
+	    catch (const std::exception&)
+	      {
+		continue;
+	      }
+	    if (p.buf->size())
+	      {
+		++n_data_rx;
+		s->data_encrypt(*p.buf);
+		if (p.buf->size() && !drop())
+		  {
+		    p.due = now + latency;
+		    egress.push_back(std::move(p));
+		  }
+	      }
+	  }
+	else
+	  {
+	    Charge c(SERVER, server_ctl_ns);
+	    ++n_lookup_addr;
+	    SimProto* s = by_addr->lookup(endpoint<PeerAddrs>(p.index));
+	    if (!s)
+	      {
+		if (!SimProto::is_hard_reset(*p.buf))
+		  continue;
+		s = new_server(p.index);
+		if (!s)
+		  continue;
+	      }
+	    const ProtoContext::PacketType pt = s->packet_type(*p.buf);
+	    if (pt.is_control())
+	      {
+		try {
+		  s->control_net_recv(pt, std::move(p.buf));
+		  s->flush(true);
+		}
+		catch (const std::exception&)
+		  {
+		  }
+	      }
+	  }
+      }
+  }
+
+  // the client side of the links
+  void deliver_egress(const bool all)
+  {
+    Charge c(CLIENT, client_ns);
+    while (!egress.empty() && (all || egress.front().due <= now))
+      {
+	Packet p = std::move(egress.front());
+	egress.pop_front();
+	Client& cl = clients[p.index];
+	if (!cl.proto)
+	  continue;
+	const ProtoContext::PacketType pt = cl.proto->packet_type(*p.buf);
+	try {
+	  if (pt.is_control())
+	    cl.proto->control_net_recv(pt, std::move(p.buf));
+	  else if (pt.is_data())
+	    cl.proto->data_decrypt(pt, *p.buf);
+	  cl.proto->flush(true);
+	}
+	catch (const std::exception&)
+	  {
+	  }
+      }
+  }
+
+  SimProto* new_server(const size_t index)
+  {
+    SimProto::Ptr s(new SimProto(server_config, serv_stats, *this, index, true));
+    s->peer_id = by_peer_id->add(s);
+    if (s->peer_id < 0)
+      return nullptr;
+    by_addr->add(endpoint<PeerAddrs>(index), s);
+    Client& cl = clients[index];
+    cl.server = s.get();
+    cl.config->remote_peer_id = s->peer_id;
+    s->start();
+    return s.get();
+  }
+
+  void remove_server(SimProto* s)
+  {
+    clients[s->index()].server = nullptr;
+    by_addr->remove(endpoint<PeerAddrs>(s->index()));
+    by_peer_id->remove(s->peer_id); // drops the last reference
+  }
+
+  void client_failed(Client& cl)
+  {
+    if (cl.up && cl.server_up)
+      ++n_expired;
+    else
+      {
+	++n_failed;
+	--n_pending;
+      }
+    if (cl.server)
+      {
+	Charge c(SERVER, server_ctl_ns);
+	remove_server(cl.server);
+      }
+    cl.proto.reset();
+    cl.config.reset();
+  }
+
+  const SimConfig& cfg;
+  Report& report;
+
+  Time now;
+  const Time start_time = now;
+  const Time::Duration tick;
+  const Time::Duration latency;
+  const Time::Duration interval;
+
+  Frame::Ptr frame;
+  RandomAPI::Ptr rng;
+  RandomAPI::Ptr prng;
+  SessionStats::Ptr cli_stats;
+  SessionStats::Ptr serv_stats;
+  std::mt19937 noise;
+  const std::string payload;
+  const std::string tls_auth_key;
+
+  SSLFactoryAPI::Ptr client_ssl;
+  ProtoContext::Config::Ptr server_config;
+  std::unique_ptr<PeerIDs> by_peer_id;
+  std::unique_ptr<PeerAddrs> by_addr;
+  std::vector<SimProto*> dead;
+
+  std::vector<Client> clients;
+  std::deque<Packet> ingress; // client -> server
+  std::deque<Packet> egress;  // server -> client
+
+  size_t next = 0;
+  size_t n_pending = 0;
+  size_t n_handshakes = 0;
+  size_t n_failed = 0;
+  size_t n_expired = 0;
+  size_t n_data_rx = 0;
+  size_t n_lookup_peer_id = 0;
+  size_t n_lookup_addr = 0;
+  size_t n_rounds = 0;
+  size_t n_timer_visits = 0;
+  size_t n_timer_fired = 0;
+  std::uint64_t hs_virtual_ms = 0;
+
+  std::uint64_t client_ns = 0;
+  std::uint64_t server_setup_ns = 0;
+  std::uint64_t server_ctl_ns = 0;
+  std::uint64_t server_data_ns = 0;
+  std::uint64_t server_timer_ns = 0;
+};
+
+bool Sim::ssl_heap_counted = false;
+
+void SimProto::control_net_send(const Buffer& net_buf)
+{
+  sim.send(server, index_, net_buf);
+}
+
+void SimProto::active()
+{
+  sim.active(server, index_);
+}
+
+// Lookup and update cost of the server tables as they grow.
+struct Dummy : public RC<thread_unsafe_refcount>
+{
+  typedef RCPtr<Dummy> Ptr;
+};
+
+static double ns_per(const std::chrono::steady_clock::time_point t0, const size_t n)
+{
+  const auto t1 = std::chrono::steady_clock::now();
+  return double(std::chrono::duration_cast<std::chrono::nanoseconds>(t1 - t0).count()) / double(n);
+}
+
+static void bench_tables(Report& report, const size_t n)
+{
+  typedef std::chrono::steady_clock clock;
+  const std::string sec = "tables/" + std::to_string(n);
+  std::mt19937 r(n);
+  std::vector<size_t> order(N_OPS);
+  for (auto &o : order)
+    o = r() % n;
+  Dummy::Ptr d(new Dummy());
+  size_t hits = 0;
+
+  {
+    size_t base = live_bytes[SIM];
+    PeerIDTable<Dummy> t(n);
+    std::vector<int> ids(n);
+    for (size_t i = 0; i < n; ++i)
+      ids[i] = t.add(d);
+    report.add(sec, "peer-id bytes/entry", double(live_bytes[SIM] - base) / n, "bytes");
+    const clock::time_point t0 = clock::now();
+    for (auto o : order)
+      hits += t.lookup(ids[o]) != nullptr;
+    report.add(sec, "peer-id lookup", ns_per(t0, order.size()), "ns");
+  }
+
+  {
+    typedef PeerAddrTable<Dummy> Table;
+    SSLLib::RandomAPI rng(false);
+    std::vector<Table::Key> keys(n);
+    for (size_t i = 0; i < n; ++i)
+      keys[i] = endpoint<Table>(i);
+    const size_t base = live_bytes[SIM];
+    Table t(rng);
+    clock::time_point t0 = clock::now();
+    for (size_t i = 0; i < n; ++i)
+      t.add(keys[i], d);
+    report.add(sec, "addr insert (growing)", ns_per(t0, n), "ns");
+    report.add(sec, "addr bytes/entry", double(live_bytes[SIM] - base) / n, "bytes");
+    t0 = clock::now();
+    for (auto o : order)
+      hits += t.lookup(keys[o]) != nullptr;
+    report.add(sec, "addr lookup", ns_per(t0, order.size()), "ns");
+  }
+
+  {
+    typedef VPNServerFIB<const void*> FIB;
+    std::vector<IP::Addr> addrs(n);
+    std::vector<IP::Route> routes(n);
+    for (size_t i = 0; i < n; ++i)
+      {
+	addrs[i] = IP::Addr::from_ipv4(IPv4::Addr::from_uint32(0x0A000000 + std::uint32_t(i)));
+	routes[i] = IP::Route(addrs[i], 32);
+      }
+    const size_t base = live_bytes[SIM];
+    FIB::Ptr fib(new FIB(1));
+    fib->add(routes, d.get(), 0);
+    FIB::PerThread& view = fib->per_thread(0);
+    view.lookup(addrs[0]);
+    report.add(sec, "fib bytes/entry", double(live_bytes[SIM] - base) / n, "bytes");
+    clock::time_point t0 = clock::now();
+    for (auto o : order)
+      hits += view.lookup(addrs[o]) != nullptr;
+    report.add(sec, "fib lookup", ns_per(t0, order.size()), "ns");
+
+    // one session joining or leaving, copy-on-write of the table
+    const size_t n_upd = 16;
+    const IP::Addr extra = IP::Addr::from_ipv4(IPv4::Addr::from_uint32(0x0B000000));
+    t0 = clock::now();
+    for (size_t i = 0; i < n_upd; ++i)
+      {
+	fib->add(extra, d.get(), 0);
+	fib->remove(extra, d.get());
+      }
+    report.add(sec, "fib add or remove", ns_per(t0, n_upd * 2) / 1000.0, "us");
+  }
+
+  if (hits != order.size() * 3)
+    OPENVPN_THROW_EXCEPTION("tables: " << n << " lookups missed");
+}
+
+// Cost of keeping one housekeeping timer per session, rearmed at
+// random, on the shared TimerWheel versus an AsioTimer each.
+struct WheelEntry : public TimerWheel::Entry
+{
+  virtual void timer_wheel_expired() override
+  {
+  }
+};
+
+static void bench_timers(Report& report, const size_t n)
+{
+  typedef std::chrono::steady_clock clock;
+  const std::string sec = "timers/" + std::to_string(n);
+  std::mt19937 r(n);
+  const Time base = Time::now();
+  std::vector<std::pair<size_t, Time>> ops(N_OPS);
+  for (auto &o : ops)
+    o = std::make_pair(r() % n, base + Time::Duration::milliseconds(1000 + r() % 59000));
+
+  {
+    asio::io_context io(1);
+    const size_t mem = live_bytes[SIM];
+    TimerWheel::Ptr wheel(new TimerWheel(io));
+    std::unique_ptr<WheelEntry[]> entries(new WheelEntry[n]);
+    for (size_t i = 0; i < n; ++i)
+      wheel->schedule(entries[i], ops[i % ops.size()].second);
+    report.add(sec, "wheel bytes/timer", double(live_bytes[SIM] - mem) / n, "bytes");
+    const clock::time_point t0 = clock::now();
+    for (auto &o : ops)
+      wheel->schedule(entries[o.first], o.second);
+    report.add(sec, "wheel rearm", ns_per(t0, ops.size()), "ns");
+    wheel->stop();
+    io.poll();
+  }
+
+  {
+    asio::io_context io(1);
+    const size_t mem = live_bytes[SIM];
+    std::vector<std::unique_ptr<AsioTimer>> timers(n);
+    for (size_t i = 0; i < n; ++i)
+      {
+	timers[i].reset(new AsioTimer(io));
+	timers[i]->expires_at(ops[i % ops.size()].second);
+	timers[i]->async_wait([](const asio::error_code&) {});
+      }
+    report.add(sec, "asio bytes/timer", double(live_bytes[SIM] - mem) / n, "bytes");
+
+    // rearming cancels the pending wait, whose handler then runs
+    // on the next poll, so draining is part of the cost
+    const clock::time_point t0 = clock::now();
+    size_t i = 0;
+    for (auto &o : ops)
+      {
+	AsioTimer& t = *timers[o.first];
+	t.expires_at(o.second);
+	t.async_wait([](const asio::error_code&) {});
+	if (!(++i & 1023))
+	  io.poll();
+      }
+    io.poll();
+    report.add(sec, "asio rearm", ns_per(t0, ops.size()), "ns");
+    for (auto &t : timers)
+      t->cancel();
+    io.poll();
+  }
+}
+
+static void usage()
+{
+  std::cerr << "usage: scalesim [options]" << std::endl
+	    << "  --sessions N       simulated sessions (" << N_SESSIONS << ')' << std::endl
+	    << "  --concurrency N    handshakes in flight (1000)" << std::endl
+	    << "  --tick MS          virtual time step (50)" << std::endl
+	    << "  --latency MS       one-way link latency (20)" << std::endl
+	    << "  --loss PCT         packet loss in both directions (0)" << std::endl
+	    << "  --duration SEC     virtual length of the data phase (30)" << std::endl
+	    << "  --interval MS      data packet interval per client (1000)" << std::endl
+	    << "  --payload BYTES    data packet size (1000)" << std::endl
+	    << "  --run R            sim, micro or all (all)" << std::endl
+	    << "  --keys DIR         test certs and tls-auth.key (../ssl)" << std::endl
+	    << "  --format F         text, json or csv (text)" << std::endl;
+}
+
+int main(int argc, char* argv[])
+{
+  // before anything can touch the SSL library heap
+  Sim::ssl_heap_counted = hook_ssl_heap();
+
+  // process-wide initialization
+  InitProcess::init();
+
+  SimConfig cfg;
+
+  try {
+    for (int i = 1; i < argc; ++i)
+      {
+	const std::string opt = argv[i];
+	if (i + 1 >= argc)
+	  {
+	    usage();
+	    return 2;
+	  }
+	const std::string arg = argv[++i];
+	if (opt == "--sessions")
+	  cfg.sessions = std::stoul(arg);
+	else if (opt == "--concurrency")
+	  cfg.concurrency = std::stoul(arg);
+	else if (opt == "--tick")
+	  cfg.tick_ms = std::stoul(arg);
+	else if (opt == "--latency")
+	  cfg.latency_ms = std::stoul(arg);
+	else if (opt == "--loss")
+	  cfg.loss_pct = std::stoul(arg);
+	else if (opt == "--duration")
+	  cfg.duration = std::stoul(arg);
+	else if (opt == "--interval")
+	  cfg.interval_ms = std::stoul(arg);
+	else if (opt == "--payload")
+	  cfg.payload = std::stoul(arg);
+	else if (opt == "--keys")
+	  cfg.keys_dir = arg;
+	else if (opt == "--run")
+	  {
+	    cfg.sim = arg == "sim" || arg == "all";
+	    cfg.micro = arg == "micro" || arg == "all";
+	    if (!cfg.sim && !cfg.micro)
+	      OPENVPN_THROW_EXCEPTION("unknown run: " << arg);
+	  }
+	else if (opt == "--format")
+	  {
+	    if (arg == "text")
+	      cfg.format = TEXT;
+	    else if (arg == "json")
+	      cfg.format = JSON;
+	    else if (arg == "csv")
+	      cfg.format = CSV;
+	    else
+	      OPENVPN_THROW_EXCEPTION("unknown format: " << arg);
+	  }
+	else
+	  {
+	    usage();
+	    return 2;
+	  }
+      }
+    if (!cfg.sessions || !cfg.concurrency || !cfg.tick_ms || !cfg.interval_ms || cfg.loss_pct >= 100)
+      OPENVPN_THROW_EXCEPTION("bad option value");
+
+    Report report(cfg.format);
+    if (cfg.sim)
+      {
+	Sim sim(cfg, report);
+	sim.run();
+      }
+    if (cfg.micro)
+      {
+	for (size_t n = 1000; n <= std::max(cfg.sessions, size_t(1000)); n *= 10)
+	  {
+	    bench_tables(report, n);
+	    bench_timers(report, n);
+	  }
+      }
+  }
+  catch (const std::exception& e)
+    {
+      std::cerr << "Exception: " << e.what() << std::endl;
+      return 1;
+    }
+  return 0;
+}
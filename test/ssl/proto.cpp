@@ -22,12 +22,17 @@
 // Unit test for OpenVPN Protocol implementation (class ProtoContext)
 
 #include <iostream>
+#include <iomanip>
 #include <string>
 #include <sstream>
+#include <vector>
 #include <deque>
 #include <algorithm>
 #include <cstring>
+#include <cstdlib>
+#include <ctime>
 #include <limits>
+#include <chrono>
 #include <thread>
 
 #include <openvpn/common/platform.hpp>
@@ -167,6 +172,7 @@
 
 #include <openvpn/common/exception.hpp>
 #include <openvpn/common/file.hpp>
+#include <openvpn/common/split.hpp>
 #include <openvpn/common/count.hpp>
 #include <openvpn/time/time.hpp>
 #include <openvpn/random/mtrandapi.hpp>
@@ -614,13 +620,15 @@ public:
 	    RandomAPI& rand_arg,
 	    const unsigned int reorder_prob_arg,
 	    const unsigned int drop_prob_arg,
-	    const unsigned int corrupt_prob_arg)
+	    const unsigned int corrupt_prob_arg,
+	    const std::string& data_arg)
     : title(title_arg),
       now(now_arg),
       random(rand_arg),
       reorder_prob(reorder_prob_arg),
       drop_prob(drop_prob_arg),
-      corrupt_prob(corrupt_prob_arg)
+      corrupt_prob(corrupt_prob_arg),
+      data(data_arg)
   {
   }
 
@@ -645,7 +653,7 @@ public:
     // queue a data channel packet
     if (a.data_channel_ready())
       {
-	BufferPtr bp = a.data_encrypt_string("Waiting for godot A... Waiting for godot B... Waiting for godot C... Waiting for godot D... Waiting for godot E... Waiting for godot F... Waiting for godot G... Waiting for godot H... Waiting for godot I... Waiting for godot J...");
+	BufferPtr bp = a.data_encrypt_string(data.c_str());
 	wire.push_back(bp);
       }
 
@@ -772,6 +780,7 @@ private:
   unsigned int reorder_prob;
   unsigned int drop_prob;
   unsigned int corrupt_prob;
+  std::string data;
   std::deque<BufferPtr> wire;
 };
 
@@ -813,12 +822,75 @@ private:
   count_t errors[Error::N_ERRORS];
 };
 
+// default data channel payload
+const char godot[] =
+  "Waiting for godot A... Waiting for godot B... Waiting for godot C... Waiting for godot D... Waiting for godot E... Waiting for godot F... Waiting for godot G... Waiting for godot H... Waiting for godot I... Waiting for godot J...";
+
+// Parameters of one benchmark data point.  Defaults come from the
+// compile-time settings above and can be overridden from the
+// command line.
+struct TestConfig
+{
+  enum Format {
+    TEXT,
+    JSON,
+    CSV,
+  };
+
+  TestConfig()
+    : cipher(PROTO_CIPHER),
+      digest(PROTO_DIGEST),
+      comp(COMP_METH),
+      iter(ITER),
+      siter(SITER),
+      reneg(RENEG),
+      n_threads(N_THREADS),
+      packet_size(0),
+      format(TEXT)
+  {
+  }
+
+  // data channel payload, packet_size == 0 means the godot string
+  std::string data_payload() const
+  {
+    if (!packet_size)
+      return godot;
+    std::string ret;
+    while (ret.length() < packet_size)
+      ret += godot;
+    ret.resize(packet_size);
+    return ret;
+  }
+
+  std::string cipher;
+  std::string digest;
+  CompressContext::Type comp;
+  int iter;
+  int siter;
+  int reneg;
+  int n_threads;
+  size_t packet_size;
+  Format format;
+};
+
+// Totals from one test() thread.
+struct TestResult
+{
+  size_t app_bytes = 0;
+  size_t net_bytes = 0;
+  size_t data_bytes = 0;
+  size_t negotiations = 0;
+  count_t handshake_errors = 0;
+  bool ok = false;
+};
+
 // execute the unit test in one thread
-int test(const int thread_num)
+int test(const int thread_num, const TestConfig& tc, TestResult& result)
 {
   try {
     // frame
-    Frame::Ptr frame(new Frame(Frame::Context(128, 256, 128, 0, 16, 0)));
+    const std::string data_payload = tc.data_payload();
+    Frame::Ptr frame(new Frame(Frame::Context(128, std::max(data_payload.length(), size_t(256)), 128, 0, 16, 0)));
 
     // RNG
     ClientRandomAPI::Ptr rng_cli(new ClientRandomAPI(false));
@@ -880,13 +952,13 @@ int test(const int thread_num)
     cp->enable_op32 = true;
     cp->remote_peer_id = 100;
 #endif
-    cp->comp_ctx = CompressContext(COMP_METH, false);
-    cp->dc.set_cipher(CryptoAlgs::lookup(PROTO_CIPHER));
-    cp->dc.set_digest(CryptoAlgs::lookup(PROTO_DIGEST));
+    cp->comp_ctx = CompressContext(tc.comp, false);
+    cp->dc.set_cipher(CryptoAlgs::lookup(tc.cipher));
+    cp->dc.set_digest(CryptoAlgs::lookup(tc.digest));
 #ifdef USE_TLS_AUTH
     cp->tls_auth_factory.reset(new CryptoOvpnHMACFactory<ClientCryptoAPI>());
     cp->tls_auth_key.parse(tls_auth_key);
-    cp->set_tls_auth_digest(CryptoAlgs::lookup(PROTO_DIGEST));
+    cp->set_tls_auth_digest(CryptoAlgs::lookup(tc.digest));
     cp->key_direction = 0;
 #endif
     cp->reliable_window = 4;
@@ -894,10 +966,11 @@ int test(const int thread_num)
     cp->pid_mode = PacketIDReceive::UDP_MODE;
 #if defined(HANDSHAKE_WINDOW)
     cp->handshake_window = Time::Duration::seconds(HANDSHAKE_WINDOW);
-#elif SITER > 1
-    cp->handshake_window = Time::Duration::seconds(30);
 #else
-    cp->handshake_window = Time::Duration::seconds(18); // will cause a small number of handshake failures
+    if (tc.siter > 1)
+      cp->handshake_window = Time::Duration::seconds(30);
+    else
+      cp->handshake_window = Time::Duration::seconds(18); // will cause a small number of handshake failures
 #endif
 #ifdef BECOME_PRIMARY_CLIENT
     cp->become_primary = Time::Duration::seconds(BECOME_PRIMARY_CLIENT);
@@ -908,7 +981,7 @@ int test(const int thread_num)
 #if defined(CLIENT_NO_RENEG)
     cp->renegotiate = Time::Duration::infinite();
 #else
-    cp->renegotiate = Time::Duration::seconds(RENEG);
+    cp->renegotiate = Time::Duration::seconds(tc.reneg);
 #endif
     cp->expire = cp->renegotiate + cp->renegotiate;
     cp->keepalive_ping = Time::Duration::seconds(5);
@@ -950,13 +1023,13 @@ int test(const int thread_num)
     sp->enable_op32 = true;
     sp->remote_peer_id = 101;
 #endif
-    sp->comp_ctx = CompressContext(COMP_METH, false);
-    sp->dc.set_cipher(CryptoAlgs::lookup(PROTO_CIPHER));
-    sp->dc.set_digest(CryptoAlgs::lookup(PROTO_DIGEST));
+    sp->comp_ctx = CompressContext(tc.comp, false);
+    sp->dc.set_cipher(CryptoAlgs::lookup(tc.cipher));
+    sp->dc.set_digest(CryptoAlgs::lookup(tc.digest));
 #ifdef USE_TLS_AUTH
     sp->tls_auth_factory.reset(new CryptoOvpnHMACFactory<ServerCryptoAPI>());
     sp->tls_auth_key.parse(tls_auth_key);
-    sp->set_tls_auth_digest(CryptoAlgs::lookup(PROTO_DIGEST));
+    sp->set_tls_auth_digest(CryptoAlgs::lookup(tc.digest));
     sp->key_direction = 1;
 #endif
     sp->reliable_window = 4;
@@ -964,10 +1037,11 @@ int test(const int thread_num)
     sp->pid_mode = PacketIDReceive::UDP_MODE;
 #if defined(HANDSHAKE_WINDOW)
     sp->handshake_window = Time::Duration::seconds(HANDSHAKE_WINDOW);
-#elif SITER > 1
-    sp->handshake_window = Time::Duration::seconds(30);
 #else
-    sp->handshake_window = Time::Duration::seconds(17) + Time::Duration::binary_ms(512);
+    if (tc.siter > 1)
+      sp->handshake_window = Time::Duration::seconds(30);
+    else
+      sp->handshake_window = Time::Duration::seconds(17) + Time::Duration::binary_ms(512);
 #endif
 #ifdef BECOME_PRIMARY_SERVER
     sp->become_primary = Time::Duration::seconds(BECOME_PRIMARY_SERVER);
@@ -984,7 +1058,7 @@ int test(const int thread_num)
     // OpenSSLContext::SSL::read_cleartext: BIO_read failed, cap=400 status=-1: error:140E0197:SSL routines:SSL_shutdown:shutdown while in init
     // The issue was introduced by this patch in OpenSSL:
     //   https://github.com/openssl/openssl/commit/64193c8218540499984cd63cda41f3cd491f3f59
-    sp->renegotiate = Time::Duration::seconds(RENEG) + sp->handshake_window;
+    sp->renegotiate = Time::Duration::seconds(tc.reneg) + sp->handshake_window;
 #endif
     sp->expire = sp->renegotiate + sp->renegotiate;
     sp->keepalive_ping = Time::Duration::seconds(5);
@@ -999,7 +1073,7 @@ int test(const int thread_num)
     TestProtoClient cli_proto(cp, cli_stats);
     TestProtoServer serv_proto(sp, serv_stats);
 
-    for (int i = 0; i < SITER; ++i)
+    for (int i = 0; i < tc.siter; ++i)
       {
 #ifdef VERBOSE
 	std::cout << "***** SITER " << i << std::endl;
@@ -1007,8 +1081,8 @@ int test(const int thread_num)
 	cli_proto.reset();
 	serv_proto.reset();
 
-	NoisyWire client_to_server("Client -> Server", &time, rng_noncrypto, 8, 16, 32); // last value: 32
-	NoisyWire server_to_client("Server -> Client", &time, rng_noncrypto, 8, 16, 32); // last value: 32
+	NoisyWire client_to_server("Client -> Server", &time, rng_noncrypto, 8, 16, 32, data_payload); // last value: 32
+	NoisyWire server_to_client("Server -> Client", &time, rng_noncrypto, 8, 16, 32, data_payload); // last value: 32
 
 	int j = -1;
 	try {
@@ -1022,7 +1096,7 @@ int test(const int thread_num)
 #endif
 
 	  // message loop
-	  for (j = 0; j < ITER; ++j)
+	  for (j = 0; j < tc.iter; ++j)
 	    {
 	      client_to_server.xfer(cli_proto, serv_proto);
 	      server_to_client.xfer(serv_proto, cli_proto);
@@ -1043,18 +1117,28 @@ int test(const int thread_num)
     const size_t nb = cli_proto.net_bytes() + serv_proto.net_bytes();
     const size_t db = cli_proto.data_bytes() + serv_proto.data_bytes();
 
-    std::cerr << "*** app bytes=" << ab
-	      << " net_bytes=" << nb
-	      << " data_bytes=" << db
-	      << " prog=" << cli_proto.progress() << '/' << serv_proto.progress()
+    result.app_bytes = ab;
+    result.net_bytes = nb;
+    result.data_bytes = db;
+    result.negotiations = cli_proto.negotiations();
+    result.handshake_errors = cli_stats->get_error_count(Error::HANDSHAKE_TIMEOUT) + serv_stats->get_error_count(Error::HANDSHAKE_TIMEOUT);
+    result.ok = true;
+
+    if (tc.format == TestConfig::TEXT)
+      {
+	std::cerr << "*** app bytes=" << ab
+		  << " net_bytes=" << nb
+		  << " data_bytes=" << db
+		  << " prog=" << cli_proto.progress() << '/' << serv_proto.progress()
 #if !FEEDBACK
-              << " CTRL=" << cli_proto.n_control_recv() << '/' << cli_proto.n_control_send() << '/' << serv_proto.n_control_recv() << '/' << serv_proto.n_control_send()
+		  << " CTRL=" << cli_proto.n_control_recv() << '/' << cli_proto.n_control_send() << '/' << serv_proto.n_control_recv() << '/' << serv_proto.n_control_send()
 #endif
-              << " D=" << cli_proto.control_drought().raw() << '/' << cli_proto.data_drought().raw() << '/' << serv_proto.control_drought().raw() << '/' << serv_proto.data_drought().raw()
-              << " N=" << cli_proto.negotiations() << '/' << serv_proto.negotiations()
-              << " SH=" << cli_proto.slowest_handshake().raw() << '/' << serv_proto.slowest_handshake().raw()
-              << " HE=" << cli_stats->get_error_count(Error::HANDSHAKE_TIMEOUT) << '/' << serv_stats->get_error_count(Error::HANDSHAKE_TIMEOUT)
-	      << std::endl;
+		  << " D=" << cli_proto.control_drought().raw() << '/' << cli_proto.data_drought().raw() << '/' << serv_proto.control_drought().raw() << '/' << serv_proto.data_drought().raw()
+		  << " N=" << cli_proto.negotiations() << '/' << serv_proto.negotiations()
+		  << " SH=" << cli_proto.slowest_handshake().raw() << '/' << serv_proto.slowest_handshake().raw()
+		  << " HE=" << cli_stats->get_error_count(Error::HANDSHAKE_TIMEOUT) << '/' << serv_stats->get_error_count(Error::HANDSHAKE_TIMEOUT)
+		  << std::endl;
+      }
 
 #ifdef STATS
     std::cerr << "-------- CLIENT STATS --------" << std::endl;
@@ -1075,6 +1159,136 @@ int test(const int thread_num)
   return 0;
 }
 
+// Run tc.n_threads concurrent copies of test() for one point
+// of the benchmark matrix.
+struct BenchPoint
+{
+  TestConfig tc;
+  TestResult total;
+  double wall_sec = 0.0;
+  double cpu_sec = 0.0;
+  bool ok = true;
+
+  void run()
+  {
+    std::vector<TestResult> results(std::max(tc.n_threads, 1));
+    const std::clock_t cpu_start = std::clock();
+    const std::chrono::steady_clock::time_point wall_start = std::chrono::steady_clock::now();
+
+    if (tc.n_threads >= 2)
+      {
+	std::vector<std::thread> threads;
+	for (int i = 0; i < tc.n_threads; ++i)
+	  threads.emplace_back([this, i, &results]() {
+	      test(i, tc, results[i]);
+	    });
+	for (auto &t : threads)
+	  t.join();
+      }
+    else
+      test(1, tc, results[0]);
+
+    const std::chrono::duration<double> wall = std::chrono::steady_clock::now() - wall_start;
+    wall_sec = wall.count();
+    cpu_sec = double(std::clock() - cpu_start) / CLOCKS_PER_SEC;
+
+    for (const auto &r : results)
+      {
+	total.app_bytes += r.app_bytes;
+	total.net_bytes += r.net_bytes;
+	total.data_bytes += r.data_bytes;
+	total.negotiations += r.negotiations;
+	total.handshake_errors += r.handshake_errors;
+	ok &= r.ok;
+      }
+  }
+
+  double per_sec(const double v) const
+  {
+    return wall_sec > 0.0 ? v / wall_sec : 0.0;
+  }
+
+  std::string comp_name() const
+  {
+    return CompressContext(tc.comp, false).str();
+  }
+
+  static void csv_header(std::ostream& os)
+  {
+    os << "cipher,digest,comp,threads,packet_size,iter,ok,wall_sec,cpu_sec,handshakes,handshakes_per_sec,data_bytes_per_sec,net_bytes_per_sec,handshake_errors" << std::endl;
+  }
+
+  void csv(std::ostream& os) const
+  {
+    os << tc.cipher << ','
+       << tc.digest << ','
+       << comp_name() << ','
+       << tc.n_threads << ','
+       << tc.packet_size << ','
+       << tc.iter << ','
+       << ok << ','
+       << wall_sec << ','
+       << cpu_sec << ','
+       << total.negotiations << ','
+       << per_sec(total.negotiations) << ','
+       << per_sec(total.data_bytes) << ','
+       << per_sec(total.net_bytes) << ','
+       << total.handshake_errors << std::endl;
+  }
+
+  void json(std::ostream& os) const
+  {
+    os << "  {\"cipher\": \"" << tc.cipher << '"'
+       << ", \"digest\": \"" << tc.digest << '"'
+       << ", \"comp\": \"" << comp_name() << '"'
+       << ", \"threads\": " << tc.n_threads
+       << ", \"packet_size\": " << tc.packet_size
+       << ", \"iter\": " << tc.iter
+       << ", \"ok\": " << (ok ? "true" : "false")
+       << ", \"wall_sec\": " << wall_sec
+       << ", \"cpu_sec\": " << cpu_sec
+       << ", \"handshakes\": " << total.negotiations
+       << ", \"handshakes_per_sec\": " << per_sec(total.negotiations)
+       << ", \"data_bytes_per_sec\": " << per_sec(total.data_bytes)
+       << ", \"net_bytes_per_sec\": " << per_sec(total.net_bytes)
+       << ", \"handshake_errors\": " << total.handshake_errors
+       << '}';
+  }
+
+  void text(std::ostream& os) const
+  {
+    os << tc.cipher << '/' << tc.digest << '/' << comp_name()
+       << " threads=" << tc.n_threads
+       << " size=" << tc.packet_size
+       << (ok ? "" : " FAILED")
+       << " hs/s=" << per_sec(total.negotiations)
+       << " data=" << per_sec(total.data_bytes) / 1000000.0 << "MB/s"
+       << " net=" << per_sec(total.net_bytes) / 1000000.0 << "MB/s"
+       << " wall=" << wall_sec << 's'
+       << " cpu=" << cpu_sec << 's' << std::endl;
+  }
+};
+
+static std::vector<std::string> split_list(const std::string& arg)
+{
+  return Split::by_char<std::vector<std::string>, NullLex, Split::NullLimit>(arg, ',');
+}
+
+static void usage()
+{
+  std::cerr << "usage: proto [test]" << std::endl
+	    << "       proto [options]" << std::endl
+	    << "  --cipher A,B,...   data channel ciphers (" << PROTO_CIPHER << ')' << std::endl
+	    << "  --digest A,B,...   data channel/tls-auth digests (" << PROTO_DIGEST << ')' << std::endl
+	    << "  --comp A,B,...     compression methods, e.g. stub,lzo,lz4-v2,none" << std::endl
+	    << "  --threads N,M,...  concurrent sessions (" << N_THREADS << ')' << std::endl
+	    << "  --size N,M,...     data channel payload bytes, 0=default (0)" << std::endl
+	    << "  --iter N           message loop iterations (" << ITER << ')' << std::endl
+	    << "  --siter N          session iterations (" << SITER << ')' << std::endl
+	    << "  --reneg N          virtual seconds between renegotiations (" << RENEG << ')' << std::endl
+	    << "  --format F         text, json or csv (text)" << std::endl;
+}
+
 int main(int argc, char* argv[])
 {
   // process-wide initialization
@@ -1092,22 +1306,131 @@ int main(int argc, char* argv[])
       return 0;
     }
 
-#if N_THREADS >= 2
-  std::thread* threads[N_THREADS];
-  int i;
-  for (i = 0; i < N_THREADS; ++i)
-    {
-      threads[i] = new std::thread([i]() {
-	  test(i);
-	});
-    }
-  for (i = 0; i < N_THREADS; ++i)
+  // parse the benchmark matrix, each list defaults to the compile-time setting
+  TestConfig base;
+  std::vector<std::string> ciphers(1, base.cipher);
+  std::vector<std::string> digests(1, base.digest);
+  std::vector<CompressContext::Type> comps(1, base.comp);
+  std::vector<int> thread_counts(1, base.n_threads);
+  std::vector<size_t> sizes(1, base.packet_size);
+
+  try {
+    for (int i = 1; i < argc; ++i)
+      {
+	const std::string opt = argv[i];
+	if (i + 1 >= argc)
+	  {
+	    usage();
+	    return 2;
+	  }
+	const std::string arg = argv[++i];
+	if (opt == "--cipher")
+	  ciphers = split_list(arg);
+	else if (opt == "--digest")
+	  digests = split_list(arg);
+	else if (opt == "--comp")
+	  {
+	    comps.clear();
+	    for (const auto &c : split_list(arg))
+	      {
+		const CompressContext::Type t = CompressContext::parse_method(c);
+		if (t == CompressContext::NONE && c != "none")
+		  OPENVPN_THROW_EXCEPTION("unknown compression method: " << c);
+		if (!CompressContext::compressor_available(t))
+		  OPENVPN_THROW_EXCEPTION("compression method not available in this build: " << c);
+		comps.push_back(t);
+	      }
+	  }
+	else if (opt == "--threads")
+	  {
+	    thread_counts.clear();
+	    for (const auto &t : split_list(arg))
+	      thread_counts.push_back(std::max(std::atoi(t.c_str()), 1));
+	  }
+	else if (opt == "--size")
+	  {
+	    sizes.clear();
+	    for (const auto &sz : split_list(arg))
+	      sizes.push_back(std::atoi(sz.c_str()));
+	  }
+	else if (opt == "--iter")
+	  base.iter = std::atoi(arg.c_str());
+	else if (opt == "--siter")
+	  base.siter = std::max(std::atoi(arg.c_str()), 1);
+	else if (opt == "--reneg")
+	  base.reneg = std::atoi(arg.c_str());
+	else if (opt == "--format")
+	  {
+	    if (arg == "text")
+	      base.format = TestConfig::TEXT;
+	    else if (arg == "json")
+	      base.format = TestConfig::JSON;
+	    else if (arg == "csv")
+	      base.format = TestConfig::CSV;
+	    else
+	      OPENVPN_THROW_EXCEPTION("unknown format: " << arg);
+	  }
+	else
+	  {
+	    usage();
+	    return 2;
+	  }
+      }
+
+    // validate algorithm names before starting any run
+    for (const auto &c : ciphers)
+      CryptoAlgs::lookup(c);
+    for (const auto &d : digests)
+      CryptoAlgs::lookup(d);
+  }
+  catch (const std::exception& e)
     {
-      threads[i]->join();
-      delete threads[i];
+      std::cerr << "Exception: " << e.what() << std::endl;
+      return 2;
     }
-  return 0;
-#else
-  return test(1);
-#endif
+
+  if (base.format == TestConfig::CSV)
+    BenchPoint::csv_header(std::cout);
+  else if (base.format == TestConfig::JSON)
+    std::cout << '[' << std::endl;
+
+  int ret = 0;
+  bool first = true;
+  for (const auto &cipher : ciphers)
+    for (const auto &digest : digests)
+      for (const auto comp : comps)
+	for (const auto n_threads : thread_counts)
+	  for (const auto size : sizes)
+	    {
+	      BenchPoint bp;
+	      bp.tc = base;
+	      bp.tc.cipher = cipher;
+	      bp.tc.digest = digest;
+	      bp.tc.comp = comp;
+	      bp.tc.n_threads = n_threads;
+	      bp.tc.packet_size = size;
+	      bp.run();
+	      if (!bp.ok)
+		ret = 1;
+
+	      switch (base.format)
+		{
+		case TestConfig::TEXT:
+		  bp.text(std::cout);
+		  break;
+		case TestConfig::CSV:
+		  bp.csv(std::cout);
+		  break;
+		case TestConfig::JSON:
+		  if (!first)
+		    std::cout << ',' << std::endl;
+		  bp.json(std::cout);
+		  break;
+		}
+	      first = false;
+	    }
+
+  if (base.format == TestConfig::JSON)
+    std::cout << std::endl << ']' << std::endl;
+  return ret;
 }